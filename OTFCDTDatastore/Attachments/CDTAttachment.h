@@ -20,6 +20,8 @@
 
 #import "CDTBlobReader.h"
 
+@class CDTAttachmentReader;
+
 NS_ASSUME_NONNULL_BEGIN
 
 /**
@@ -87,6 +89,15 @@ NS_ASSUME_NONNULL_BEGIN
                          key:(NSData *)keyData
                     encoding:(TDAttachmentEncoding)encoding;
 
+/**
+ Returns a reader of the attachment's content, which is read, decrypted and inflated a chunk
+ at a time on a background queue, up to readAheadDepth chunks ahead of the caller.
+
+ Returns nil if the content can't be read.
+ */
+- (nullable CDTAttachmentReader *)readerWithChunkSize:(NSUInteger)chunkSize
+                                       readAheadDepth:(NSUInteger)readAheadDepth;
+
 @end
 
 /**
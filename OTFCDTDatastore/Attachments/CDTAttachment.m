@@ -15,6 +15,7 @@
 //
 
 #import "CDTAttachment.h"
+#import "CDTAttachmentReader.h"
 
 #import <GoogleToolboxForMac/GTMNSData+zlib.h>
 #import "TDBase64.h"
@@ -93,6 +94,25 @@
     return data;
 }
 
+- (CDTAttachmentReader *)readerWithChunkSize:(NSUInteger)chunkSize
+                              readAheadDepth:(NSUInteger)readAheadDepth
+{
+    if (self.encoding != kTDAttachmentEncodingNone && self.encoding != kTDAttachmentEncodingGZIP) {
+        os_log_debug(CDTOSLog, "Unknown attachment encoding %{public}i, returning nil", self.encoding);
+        return nil;
+    }
+
+    NSInputStream *stream = [self.blob inputStreamWithOutputLength:NULL];
+    if (!stream) {
+        os_log_debug(CDTOSLog, "Stream for attachment not opened");
+        return nil;
+    }
+    return [[CDTAttachmentReader alloc] initWithInputStream:stream
+                                                    inflate:(self.encoding == kTDAttachmentEncodingGZIP)
+                                                  chunkSize:chunkSize
+                                             readAheadDepth:readAheadDepth];
+}
+
 @end
 
 @interface CDTUnsavedDataAttachment ()
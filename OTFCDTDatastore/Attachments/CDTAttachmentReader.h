@@ -0,0 +1,78 @@
+//
+//  CDTAttachmentReader.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Handler for a chunk of an attachment's content: the next chunk, or an empty NSData instance at
+ the end of the content, or nil and an error if it couldn't be read.
+ */
+typedef void (^CDTAttachmentChunkHandler)(NSData *_Nullable chunk, NSError *_Nullable error);
+
+/**
+ Reads the content of an attachment a chunk at a time, for consumers which go through it in
+ order, such as media playback or an upload to another service.
+
+ Reading, decrypting and inflating run ahead of the consumer on a background queue, by up to
+ readAheadDepth chunks, so that each chunk is usually ready by the time it's asked for, rather
+ than every read waiting on the disk. Only that many chunks are held at once, however fast the
+ content could be read.
+
+ Get one from -[CDTSavedAttachment readerWithChunkSize:readAheadDepth:].
+ */
+@interface CDTAttachmentReader : NSObject
+
+/**
+ Starts reading ahead from a stream, which mustn't have been opened.
+
+ @param stream where the content is read from
+ @param inflate whether the stream is gzipped, and so is to be inflated
+ @param chunkSize length of the chunks the content is read in; the last may be shorter. When
+ inflating, each chunk is what a chunk of the gzipped content inflates to.
+ @param readAheadDepth how many chunks to read before they're asked for; 0 is taken as 1
+ */
+- (instancetype)initWithInputStream:(NSInputStream *)stream
+                            inflate:(BOOL)inflate
+                          chunkSize:(NSUInteger)chunkSize
+                     readAheadDepth:(NSUInteger)readAheadDepth NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@property (nonatomic, readonly) NSUInteger chunkSize;
+@property (nonatomic, readonly) NSUInteger readAheadDepth;
+
+/**
+ Asks for the next chunk of the content. The handler is called on `queue` once the chunk has
+ been read, straight away if it already has. Handlers for several requests are called in the
+ order they were made.
+
+ @param queue where to call the handler
+ @param handler called with the next chunk, an empty NSData instance at the end of the
+ content, or nil and an error
+ */
+- (void)readNextChunkOnQueue:(dispatch_queue_t)queue
+           completionHandler:(CDTAttachmentChunkHandler)handler;
+
+/**
+ Stops reading ahead and frees the chunks read. Requests not yet answered get an empty
+ NSData instance, as if the content had ended.
+ */
+- (void)close;
+
+@end
+
+NS_ASSUME_NONNULL_END
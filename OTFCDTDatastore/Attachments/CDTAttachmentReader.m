@@ -0,0 +1,236 @@
+//
+//  CDTAttachmentReader.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#import "CDTAttachmentReader.h"
+
+#import <zlib.h>
+
+#import "CDTLogging.h"
+
+static NSError *corruptContentError(void)
+{
+    return [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:nil];
+}
+
+@implementation CDTAttachmentReader {
+    NSInputStream *_stream;
+    BOOL _inflate;
+    z_stream _zstream;
+    BOOL _zstreamOpen;
+    dispatch_queue_t _readQueue;
+
+    // Guarded by @synchronized(self)
+    NSMutableArray<NSData *> *_chunks;
+    NSMutableArray<NSArray *> *_requests;  // queue and handler of each request not yet answered
+    NSError *_error;
+    BOOL _finished;  // the content has all been read, or reading it failed
+    BOOL _reading;   // a chunk's read is queued or under way
+    BOOL _closed;
+}
+
+- (instancetype)initWithInputStream:(NSInputStream *)stream
+                            inflate:(BOOL)inflate
+                          chunkSize:(NSUInteger)chunkSize
+                     readAheadDepth:(NSUInteger)readAheadDepth
+{
+    self = [super init];
+    if (self) {
+        _stream = stream;
+        _inflate = inflate;
+        _chunkSize = MAX(chunkSize, (NSUInteger)1);
+        _readAheadDepth = MAX(readAheadDepth, (NSUInteger)1);
+        _readQueue = dispatch_queue_create("com.cloudant.sync.attachmentreader", DISPATCH_QUEUE_SERIAL);
+        _chunks = [NSMutableArray arrayWithCapacity:_readAheadDepth];
+        _requests = [NSMutableArray array];
+
+        if (inflate) {
+            // 16 more window bits for a gzip header rather than a zlib one
+            _zstreamOpen = (inflateInit2(&_zstream, 16 + MAX_WBITS) == Z_OK);
+            if (!_zstreamOpen) {
+                _error = corruptContentError();
+                _finished = YES;
+            }
+        }
+
+        dispatch_async(_readQueue, ^{
+            [stream open];
+        });
+        @synchronized(self) {
+            [self readAhead];
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    // Every read holds on to the reader, so none is under way by now
+    [_stream close];
+    if (_zstreamOpen) {
+        inflateEnd(&_zstream);
+    }
+}
+
+- (void)readNextChunkOnQueue:(dispatch_queue_t)queue
+           completionHandler:(CDTAttachmentChunkHandler)handler
+{
+    @synchronized(self) {
+        [_requests addObject:@[ queue, [handler copy] ]];
+        [self answerRequests];
+        [self readAhead];
+    }
+}
+
+- (void)close
+{
+    @synchronized(self) {
+        if (_closed) {
+            return;
+        }
+        _closed = YES;
+        [_chunks removeAllObjects];
+        [self answerRequests];
+    }
+    NSInputStream *stream = _stream;
+    dispatch_async(_readQueue, ^{
+        [stream close];
+    });
+}
+
+#pragma mark - Reading ahead
+
+// Call with @synchronized(self)
+- (void)readAhead
+{
+    if (_reading || _finished || _closed || _chunks.count >= _readAheadDepth) {
+        return;
+    }
+    _reading = YES;
+    dispatch_async(_readQueue, ^{
+        [self readChunk];
+    });
+}
+
+// Call with @synchronized(self)
+- (void)answerRequests
+{
+    while (_requests.count > 0 && (_chunks.count > 0 || _finished || _closed)) {
+        dispatch_queue_t queue = _requests[0][0];
+        CDTAttachmentChunkHandler handler = _requests[0][1];
+        [_requests removeObjectAtIndex:0];
+
+        NSData *chunk = nil;
+        NSError *error = nil;
+        if (_chunks.count > 0) {
+            chunk = _chunks[0];
+            [_chunks removeObjectAtIndex:0];
+        } else if (_error && !_closed) {
+            error = _error;
+        } else {
+            chunk = [NSData data];
+        }
+        dispatch_async(queue, ^{
+            handler(chunk, error);
+        });
+    }
+}
+
+// Only call on _readQueue
+- (void)readChunk
+{
+    BOOL ended = NO;
+    NSError *error = nil;
+    NSData *chunk = nil;
+    @synchronized(self) {
+        if (_closed) {
+            _reading = NO;
+            return;
+        }
+    }
+    chunk = [self nextChunkEnded:&ended error:&error];
+
+    @synchronized(self) {
+        _reading = NO;
+        if (_closed) {
+            return;
+        }
+        if (!chunk) {
+            os_log_debug(CDTOSLog, "%{public}@: Attachment not read: %{public}@", self, error);
+            _error = error ?: corruptContentError();
+            _finished = YES;
+        } else {
+            // Inflating may not have produced anything yet, which isn't the end
+            if (chunk.length > 0) {
+                [_chunks addObject:chunk];
+            }
+            _finished = ended;
+        }
+        [self answerRequests];
+        [self readAhead];
+    }
+}
+
+// Only call on _readQueue
+- (NSData *)nextChunkEnded:(BOOL *)outEnded error:(NSError **)outError
+{
+    NSMutableData *data = [NSMutableData dataWithLength:_chunkSize];
+    NSUInteger filled = 0;
+    while (filled < _chunkSize) {
+        NSInteger read =
+            [_stream read:(uint8_t *)data.mutableBytes + filled maxLength:_chunkSize - filled];
+        if (read < 0) {
+            *outError = _stream.streamError;
+            return nil;
+        } else if (read == 0) {
+            *outEnded = YES;
+            break;
+        }
+        filled += read;
+    }
+    data.length = filled;
+    return _inflate ? [self inflate:data ended:*outEnded error:outError] : data;
+}
+
+// Only call on _readQueue
+- (NSData *)inflate:(NSData *)data ended:(BOOL)ended error:(NSError **)outError
+{
+    NSMutableData *inflated = [NSMutableData dataWithLength:MAX(data.length * 2, _chunkSize)];
+    NSUInteger produced = 0;
+    _zstream.next_in = (Bytef *)data.bytes;
+    _zstream.avail_in = (uInt)data.length;
+    int status = Z_OK;
+    do {
+        if (inflated.length - produced < _chunkSize) {
+            inflated.length += _chunkSize;
+        }
+        _zstream.next_out = (Bytef *)inflated.mutableBytes + produced;
+        _zstream.avail_out = (uInt)(inflated.length - produced);
+        status = inflate(&_zstream, Z_NO_FLUSH);
+        produced = inflated.length - _zstream.avail_out;
+        if (status != Z_OK && status != Z_BUF_ERROR && status != Z_STREAM_END) {
+            *outError = corruptContentError();
+            return nil;
+        }
+    } while (status != Z_STREAM_END && (_zstream.avail_in > 0 || _zstream.avail_out == 0));
+
+    if (ended && status != Z_STREAM_END) {
+        *outError = corruptContentError();  // it was cut short
+        return nil;
+    }
+    inflated.length = produced;
+    return inflated;
+}
+
+@end
@@ -37,6 +37,11 @@ typedef NS_ENUM(NSInteger, CDTBlobDataError) {
  
  - 'dataWithError:'.- It will fail if the blob is open.
  - 'inputStreamWithOutputLength:'.- As the previous method, it will fail if the blob is open.
+ - 'dataInRange:error:'.- As the previous methods, it will fail if the blob is open.
+
+ Where it is safe to, the file is memory-mapped rather than read, and the mapping is kept for as
+ long as the blob or any data returned from it is. 'dataInRange:error:' returns a view onto the
+ mapping, without copying the bytes in the range.
  
  @see CDTBlobReader
  @see CDTBlobWriter
@@ -49,4 +54,14 @@ typedef NS_ENUM(NSInteger, CDTBlobDataError) {
 
 + (instancetype)blobWithPath:(NSString *)path;
 
+/**
+ Open the attachment for reading from arbitrary offsets, e.g. to decrypt part of it.
+
+ @param error Output param that will point to an error (in case there is any)
+
+ @return A file handle for reading the attachment or nil if the blob is open or the file can not
+ be opened
+ */
+- (NSFileHandle *)fileHandleForReadingWithError:(NSError **)error;
+
 @end
@@ -26,6 +26,9 @@ NSString *const CDTBlobDataErrorDomain = @"CDTBlobDataErrorDomain";
 
 @property (strong, nonatomic) NSFileHandle *outFileHandle;
 
+/** The content of the file, mapped into memory if possible. Reset whenever the file is written. */
+@property (strong, nonatomic) NSData *mappedData;
+
 @end
 
 @implementation CDTBlobData
@@ -63,9 +66,17 @@ NSString *const CDTBlobDataErrorDomain = @"CDTBlobDataErrorDomain";
 
         thisError = [CDTBlobData errorOperationNotPossibleIfBlobIsOpen];
     } else {
-        data = [NSData dataWithContentsOfFile:self.path
-                                      options:NSDataReadingMappedIfSafe
-                                        error:&thisError];
+        @synchronized(self) {
+            // Mapped pages are read from the page cache on demand and can be dropped again under
+            // memory pressure, so keeping the mapping costs no heap
+            data = self.mappedData;
+            if (!data) {
+                data = [NSData dataWithContentsOfFile:self.path
+                                              options:NSDataReadingMappedIfSafe
+                                                error:&thisError];
+                self.mappedData = data;
+            }
+        }
         if (!data) {
             os_log_debug(CDTOSLog, "Data object could not be created with file %{public}@: %{public}@",
                          self.path, thisError);
@@ -112,6 +123,55 @@ NSString *const CDTBlobDataErrorDomain = @"CDTBlobDataErrorDomain";
     return inputStream;
 }
 
+- (NSData *)dataInRange:(NSRange)range error:(NSError **)error
+{
+    NSData *data = [self dataWithError:error];
+    if (!data) {
+        return nil;
+    }
+
+    if (range.location >= data.length) {
+        return [NSData data];
+    }
+    range.length = MIN(range.length, data.length - range.location);
+    if (range.length == data.length) {
+        return data;
+    }
+
+    // -subdataWithRange: would copy the bytes; instead point into the mapping, keeping it alive
+    // for as long as the returned data is.
+    return [[NSData alloc] initWithBytesNoCopy:(void *)((const uint8_t *)data.bytes + range.location)
+                                        length:range.length
+                                   deallocator:^(void *bytes, NSUInteger length) {
+                                       (void)data;
+                                   }];
+}
+
+- (NSFileHandle *)fileHandleForReadingWithError:(NSError **)error
+{
+    NSFileHandle *handle = nil;
+    NSError *thisError = nil;
+
+    if ([self isBlobOpenForWriting]) {
+        os_log_debug(CDTOSLog, "Blob at %{public}@ is open. Close it before reading its content", self.path);
+
+        thisError = [CDTBlobData errorOperationNotPossibleIfBlobIsOpen];
+    } else {
+        handle = [NSFileHandle fileHandleForReadingFromURL:[NSURL fileURLWithPath:self.path]
+                                                     error:&thisError];
+        if (!handle) {
+            os_log_debug(CDTOSLog, "File %{public}@ could not be opened: %{public}@", self.path,
+                         thisError);
+        }
+    }
+
+    if (!handle && error) {
+        *error = thisError;
+    }
+
+    return handle;
+}
+
 #pragma mark - CDTBlobWriter methods
 - (BOOL)writeEntireBlobWithData:(NSData *)data error:(NSError **)error
 {
@@ -132,6 +192,9 @@ NSString *const CDTBlobDataErrorDomain = @"CDTBlobDataErrorDomain";
         options |= NSDataWritingFileProtectionCompleteUnlessOpen;
 #endif
 
+        @synchronized(self) {
+            self.mappedData = nil;
+        }
         success = [data writeToFile:self.path options:options error:&thisError];
         if (!success) {
             os_log_debug(CDTOSLog, "Could not write data to file %{public}@: %{public}@", self.path, thisError);
@@ -155,6 +218,10 @@ NSString *const CDTBlobDataErrorDomain = @"CDTBlobDataErrorDomain";
         return YES;
     }
 
+    @synchronized(self) {
+        self.mappedData = nil;
+    }
+
     NSDictionary *attributes = nil;
 #if TARGET_OS_IPHONE
     attributes = @{NSFileProtectionKey : NSFileProtectionCompleteUnlessOpen};
@@ -42,4 +42,15 @@
  */
 - (NSInputStream *)inputStreamWithOutputLength:(UInt64 *)outputLength;
 
+/**
+ Read part of the content of an attachment, without reading the rest of it.
+
+ @param range Range of the content to read. It is truncated at the end of the content, so a range
+ starting beyond the end returns an empty NSData instance.
+ @param error Output param that will point to an error (in case there is any)
+
+ @return The content of the attachment in the given range or nil if there is an error
+ */
+- (NSData *)dataInRange:(NSRange)range error:(NSError **)error;
+
 @end
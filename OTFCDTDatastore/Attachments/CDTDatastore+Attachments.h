@@ -57,6 +57,18 @@ typedef NS_ENUM(NSInteger, CDTAttachmentError) {
                  inTransaction:(FMDatabase *)db
                          error:(NSError *__autoreleasing *)error;
 
+/**
+ Returns the attachments of many revisions, read with one query rather than one per revision.
+ They're keyed by sequence, and then by name as CDTDocumentRevision takes them; revisions
+ without attachments have no entry.
+ */
+- (NSDictionary<NSNumber *, NSDictionary<NSString *, CDTAttachment *> *> *)attachmentsForSeqs:
+    (NSArray<NSNumber *> *)seqs;
+
+- (NSDictionary<NSNumber *, NSDictionary<NSString *, CDTAttachment *> *> *)
+    attachmentsForSeqs:(NSArray<NSNumber *> *)seqs
+         inTransaction:(FMDatabase *)db;
+
 /*
  Streams attachment data into a blob in the blob store.
  Returns nil if there was a problem, otherwise a dictionary
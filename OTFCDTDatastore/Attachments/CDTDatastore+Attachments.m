@@ -37,13 +37,24 @@
 
 #pragma mark SQL statements
 
+// Revisions may share their rows in attachments, through revs.attachments_sequence, so the
+// selects join revs to report the sequence of the revision asked about.
+#define SQL_ATTACHMENTS_COLUMNS                                                 \
+    @"SELECT revs.sequence AS sequence, a.filename AS filename, a.key AS key, " \
+    @"a.type AS type, a.encoding AS encoding, a.length AS length, "             \
+    @"a.encoded_length AS encoded_length, a.revpos AS revpos "                  \
+    @"FROM revs JOIN attachments a ON a.sequence = revs.attachments_sequence "
+
 const NSString *SQL_ATTACHMENTS_SELECT =
-    @"SELECT sequence, filename, key, type, encoding, length, encoded_length revpos "
-    @"FROM attachments WHERE filename = :filename AND sequence = :sequence";
+    SQL_ATTACHMENTS_COLUMNS @"WHERE a.filename = :filename AND revs.sequence = :sequence";
 
 const NSString *SQL_ATTACHMENTS_SELECT_ALL =
-    @"SELECT sequence, filename, key, type, encoding, length, encoded_length revpos "
-    @"FROM attachments WHERE sequence = :sequence";
+    SQL_ATTACHMENTS_COLUMNS @"WHERE revs.sequence = :sequence";
+
+// The sequences are integers, formatted into the IN list rather than bound, so there can be any
+// number of them.
+const NSString *SQL_ATTACHMENTS_SELECT_FOR_SEQUENCES =
+    SQL_ATTACHMENTS_COLUMNS @"WHERE revs.sequence IN (%@) ORDER BY revs.sequence";
 
 const NSString *SQL_DELETE_ATTACHMENT_ROW =
     @"DELETE FROM attachments WHERE filename = :filename AND sequence = :sequence";
@@ -112,9 +123,56 @@ static NSString *const CDTAttachmentsErrorDomain = @"CDTAttachmentsErrorDomain";
     return attachments;
 }
 
+- (NSDictionary<NSNumber *, NSDictionary<NSString *, CDTAttachment *> *> *)attachmentsForSeqs:
+    (NSArray<NSNumber *> *)seqs
+{
+    __block NSDictionary *attachments = nil;
+    __weak CDTDatastore *weakSelf = self;
+    [self.database inReadTransaction:^(FMDatabase *db) {
+        attachments = [weakSelf attachmentsForSeqs:seqs inTransaction:db];
+    }];
+    return attachments;
+}
+
+- (NSDictionary<NSNumber *, NSDictionary<NSString *, CDTAttachment *> *> *)
+    attachmentsForSeqs:(NSArray<NSNumber *> *)seqs
+         inTransaction:(FMDatabase *)db
+{
+    NSMutableDictionary *attachments = [NSMutableDictionary dictionary];
+    if (seqs.count == 0) {
+        return attachments;
+    }
+
+    [self.database prefetchBlobFilenamesForSequences:seqs inDatabase:db];
+
+    NSString *sql = [NSString stringWithFormat:[SQL_ATTACHMENTS_SELECT_FOR_SEQUENCES copy],
+                                               [seqs componentsJoinedByString:@","]];
+    FMResultSet *r = [db executeQuery:sql];
+
+    @try {
+        while ([r next]) {
+            CDTSavedAttachment *attachment = [self attachmentFromDbRow:r inDatabase:db];
+
+            if (attachment != nil) {
+                NSMutableDictionary *attachmentsForSeq = attachments[@(attachment.sequence)];
+                if (!attachmentsForSeq) {
+                    attachmentsForSeq = [NSMutableDictionary dictionary];
+                    attachments[@(attachment.sequence)] = attachmentsForSeq;
+                }
+                attachmentsForSeq[attachment.name] = attachment;
+            } else {
+                os_log_info(CDTOSLog, "Error reading an attachment row for attachments on docs with seqs %{public}@", seqs);
+            }
+        }
+    }
+    @finally { [r close]; }
+
+    return attachments;
+}
+
 - (CDTSavedAttachment *)attachmentFromDbRow:(FMResultSet *)r inDatabase:(FMDatabase *)db
 {
-    // SELECT sequence, filename, key, type, encoding, length, encoded_length revpos ...
+    // SELECT sequence, filename, key, type, encoding, length, encoded_length, revpos ...
     SequenceNumber sequence = [r longForColumn:@"sequence"];
     NSString *name = [r stringForColumn:@"filename"];
 
@@ -149,7 +207,7 @@ static NSString *const CDTAttachmentsErrorDomain = @"CDTAttachmentsErrorDomain";
 /*
  Streams attachment data into a blob in the blob store.
  Returns nil if there was a problem, otherwise a dictionary
- with the sha and size of the file.
+ with the sha and size of the file, and how it was encoded.
  */
 - (NSDictionary *)streamAttachmentToBlobStore:(CDTAttachment *)attachment
                                         error:(NSError *__autoreleasing *)error
@@ -174,6 +232,15 @@ static NSString *const CDTAttachmentsErrorDomain = @"CDTAttachmentsErrorDomain";
         return nil;
     }
 
+    NSUInteger length = attachmentContent.length;
+    TDAttachmentEncoding encoding = kTDAttachmentEncodingNone;
+    NSData *compressed =
+        [self.database compressedAttachment:attachmentContent ofType:attachment.type];
+    if (compressed) {
+        attachmentContent = compressed;
+        encoding = kTDAttachmentEncodingGZIP;
+    }
+
     BOOL success = [self.database storeBlob:attachmentContent creatingKey:&outKey error:error];
 
     if (!success) {
@@ -189,7 +256,9 @@ static NSString *const CDTAttachmentsErrorDomain = @"CDTAttachmentsErrorDomain";
     NSDictionary *attachmentData = @{
         @"attachment" : attachment,
         @"keyData" : keyData,
-        @"fileLength" : @(attachmentContent.length)
+        @"fileLength" : @(length),
+        @"encoding" : @(encoding),
+        @"encodedLength" : @(attachmentContent.length)
     };
     return attachmentData;
 }
@@ -210,6 +279,7 @@ static NSString *const CDTAttachmentsErrorDomain = @"CDTAttachmentsErrorDomain";
 
     NSData *keyData = attachmentData[@"keyData"];
     NSNumber *fileLength = attachmentData[@"fileLength"];
+    NSNumber *encodedLength = attachmentData[@"encodedLength"] ?: fileLength;
     CDTAttachment *attachment = attachmentData[@"attachment"];
 
     __block BOOL success;
@@ -222,11 +292,18 @@ static NSString *const CDTAttachmentsErrorDomain = @"CDTAttachmentsErrorDomain";
     SequenceNumber sequence = revision.sequence;
     NSString *filename = attachment.name;
     NSString *type = attachment.type;
-    TDAttachmentEncoding encoding = kTDAttachmentEncodingNone;  // from a raw input stream
+    TDAttachmentEncoding encoding = [attachmentData[@"encoding"] intValue];
     unsigned generation = [TD_Revision generationFromRevID:revision.revId];
 
     NSDictionary *params;
 
+    // The revision's rows may be shared with others, which mustn't see the change
+    TDStatus status = [self.database separateAttachmentsOfSequence:sequence inDatabase:db];
+    if (TDStatusIsError(status)) {
+        if (error) *error = TDStatusToNSError(status, nil);
+        return NO;
+    }
+
     // delete any existing entry for this file and sequence combo
     params = @{ @"filename" : filename, @"sequence" : @(sequence) };
     success = [db executeUpdate:[SQL_DELETE_ATTACHMENT_ROW copy] withParameterDictionary:params];
@@ -243,7 +320,7 @@ static NSString *const CDTAttachmentsErrorDomain = @"CDTAttachmentsErrorDomain";
         @"type" : type,
         @"encoding" : @(encoding),
         @"length" : fileLength,
-        @"encoded_length" : fileLength,  // we don't zip, so same as length, see TDDatabase+Atts
+        @"encoded_length" : encodedLength,
         @"revpos" : @(generation),
     };
 
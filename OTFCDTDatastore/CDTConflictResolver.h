@@ -63,4 +63,13 @@
  */
 - (nullable CDTDocumentRevision *)resolve:(nonnull NSString *)docId conflicts:(nonnull NSArray<CDTDocumentRevision*> *)conflicts;
 
+@optional
+
+/**
+ * Return YES if resolve:conflicts: can safely be called for several documents at the same time,
+ * from different threads. [CDTDatastore resolveConflictsForDocuments:resolver:] then resolves
+ * documents concurrently. Resolvers that don't implement this are called one document at a time.
+ */
+@property (nonatomic, readonly, getter=isThreadSafe) BOOL threadSafe;
+
 @end
@@ -0,0 +1,115 @@
+//
+//  CDTDatastore+Async.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTDatastore.h"
+
+/**
+ Asynchronous versions of the common datastore operations.
+
+ Each operation runs on a queue belonging to the datastore, at the quality of service it is
+ given, and calls its completion handler on that queue when it is done. Writes run one at a
+ time, in order of priority and then of submission; reads run alongside each other and alongside
+ writes. An operation submitted with NSQualityOfServiceUserInitiated is therefore started before
+ any NSQualityOfServiceBackground writes still waiting, which lets UI reads and writes go ahead of
+ bulk imports or other background work.
+
+ Completion handlers are not called on the main queue: dispatch to it to update the UI. In Swift
+ each method can also be called with `await`, in place of passing a completion handler.
+ */
+@interface CDTDatastore (Async)
+
+/**
+ Asynchronously returns the current revision of a document.
+
+ @see -getDocumentWithId:error:
+ */
+- (void)getDocumentWithId:(nonnull NSString *)docId
+         qualityOfService:(NSQualityOfService)qos
+        completionHandler:
+            (void (^__nonnull)(CDTDocumentRevision *__nullable, NSError *__nullable))completionHandler
+    NS_SWIFT_NAME(getDocument(withId:qualityOfService:completionHandler:));
+
+/**
+ Asynchronously returns the winning revisions for a set of document IDs.
+
+ @see -getDocumentsWithIds:
+ */
+- (void)getDocumentsWithIds:(nonnull NSArray<NSString *> *)docIds
+           qualityOfService:(NSQualityOfService)qos
+          completionHandler:
+              (void (^__nonnull)(NSArray<CDTDocumentRevision *> *__nonnull))completionHandler
+    NS_SWIFT_NAME(getDocuments(withIds:qualityOfService:completionHandler:));
+
+/**
+ Asynchronously creates a document.
+
+ @see -createDocumentFromRevision:error:
+ */
+- (void)createDocumentFromRevision:(nonnull CDTDocumentRevision *)revision
+                  qualityOfService:(NSQualityOfService)qos
+                 completionHandler:(void (^__nonnull)(CDTDocumentRevision *__nullable,
+                                                      NSError *__nullable))completionHandler
+    NS_SWIFT_NAME(createDocument(from:qualityOfService:completionHandler:));
+
+/**
+ Asynchronously updates a document.
+
+ @see -updateDocumentFromRevision:error:
+ */
+- (void)updateDocumentFromRevision:(nonnull CDTDocumentRevision *)revision
+                  qualityOfService:(NSQualityOfService)qos
+                 completionHandler:(void (^__nonnull)(CDTDocumentRevision *__nullable,
+                                                      NSError *__nullable))completionHandler
+    NS_SWIFT_NAME(updateDocument(from:qualityOfService:completionHandler:));
+
+/**
+ Asynchronously deletes a document.
+
+ @see -deleteDocumentFromRevision:error:
+ */
+- (void)deleteDocumentFromRevision:(nonnull CDTDocumentRevision *)revision
+                  qualityOfService:(NSQualityOfService)qos
+                 completionHandler:(void (^__nonnull)(CDTDocumentRevision *__nullable,
+                                                      NSError *__nullable))completionHandler
+    NS_SWIFT_NAME(deleteDocument(from:qualityOfService:completionHandler:));
+
+/**
+ Asynchronously finds the documents matching a query.
+
+ The matching documents are all loaded before the completion handler is called. If the query
+ can't be run, the error is in CDTQIndexManagerErrorDomain with the code
+ CDTQQueryErrorQueryFailed, and the reason is logged.
+
+ @see -find:skip:limit:fields:sort:
+ */
+- (void)find:(nonnull NSDictionary *)query
+                 skip:(NSUInteger)skip
+                limit:(NSUInteger)limit
+               fields:(nullable NSArray *)fields
+                 sort:(nullable NSArray *)sortDocument
+     qualityOfService:(NSQualityOfService)qos
+    completionHandler:(void (^__nonnull)(NSArray<CDTDocumentRevision *> *__nullable,
+                                         NSError *__nullable))completionHandler
+    NS_SWIFT_NAME(find(_:skip:limit:fields:sort:qualityOfService:completionHandler:));
+
+/**
+ Asynchronously compacts the datastore. Compaction is queued with the datastore's other writes.
+
+ @see -compactWithError:
+ */
+- (void)compactWithQualityOfService:(NSQualityOfService)qos
+                  completionHandler:(void (^__nonnull)(NSError *__nullable))completionHandler
+    NS_SWIFT_NAME(compact(qualityOfService:completionHandler:));
+
+@end
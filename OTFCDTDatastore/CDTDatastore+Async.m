@@ -0,0 +1,207 @@
+//
+//  CDTDatastore+Async.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTDatastore+Async.h"
+#import "CDTDatastore+Query.h"
+#import "CDTQResultSet.h"
+#import <objc/runtime.h>
+
+// Reads run on the WAL read connections, so there's no point running more at once than there
+// are connections to run them on.
+static const NSInteger kCDTAsyncMaxConcurrentReads = 4;
+
+@implementation CDTDatastore (Async)
+
+#pragma mark Queues
+
+- (NSOperationQueue *)asyncQueueForKey:(SEL)key
+                                 label:(NSString *)label
+                         maxConcurrent:(NSInteger)maxConcurrent
+{
+    @synchronized(self)
+    {
+        NSOperationQueue *queue = objc_getAssociatedObject(self, key);
+        if (queue == nil) {
+            queue = [[NSOperationQueue alloc] init];
+            queue.name = [NSString stringWithFormat:@"CDTDatastore %@ %@", label, self.name];
+            queue.maxConcurrentOperationCount = maxConcurrent;
+            objc_setAssociatedObject(self, key, queue, OBJC_ASSOCIATION_RETAIN);
+        }
+        return queue;
+    }
+}
+
+- (NSOperationQueue *)asyncReadQueue
+{
+    return [self asyncQueueForKey:@selector(asyncReadQueue)
+                            label:@"reads"
+                    maxConcurrent:kCDTAsyncMaxConcurrentReads];
+}
+
+- (NSOperationQueue *)asyncWriteQueue
+{
+    return [self asyncQueueForKey:@selector(asyncWriteQueue) label:@"writes" maxConcurrent:1];
+}
+
+/** Operations waiting on the same queue are started in order of priority, so map each quality
+    of service to one: otherwise a UI write would wait behind every background write before it. */
+static NSOperationQueuePriority CDTQueuePriorityForQualityOfService(NSQualityOfService qos)
+{
+    switch (qos) {
+        case NSQualityOfServiceUserInteractive:
+            return NSOperationQueuePriorityVeryHigh;
+        case NSQualityOfServiceUserInitiated:
+            return NSOperationQueuePriorityHigh;
+        case NSQualityOfServiceUtility:
+            return NSOperationQueuePriorityLow;
+        case NSQualityOfServiceBackground:
+            return NSOperationQueuePriorityVeryLow;
+        default:
+            return NSOperationQueuePriorityNormal;
+    }
+}
+
+- (void)addOperationToQueue:(NSOperationQueue *)queue
+           qualityOfService:(NSQualityOfService)qos
+                      block:(void (^)(void))block
+{
+    NSBlockOperation *operation = [NSBlockOperation blockOperationWithBlock:block];
+    operation.qualityOfService = qos;
+    operation.queuePriority = CDTQueuePriorityForQualityOfService(qos);
+    [queue addOperation:operation];
+}
+
+#pragma mark Reads
+
+- (void)getDocumentWithId:(NSString *)docId
+         qualityOfService:(NSQualityOfService)qos
+        completionHandler:(void (^)(CDTDocumentRevision *, NSError *))completionHandler
+{
+    [self addOperationToQueue:self.asyncReadQueue
+             qualityOfService:qos
+                        block:^{
+                            NSError *error;
+                            CDTDocumentRevision *rev =
+                                [self getDocumentWithId:docId error:&error];
+                            completionHandler(rev, rev ? nil : error);
+                        }];
+}
+
+- (void)getDocumentsWithIds:(NSArray<NSString *> *)docIds
+           qualityOfService:(NSQualityOfService)qos
+          completionHandler:(void (^)(NSArray<CDTDocumentRevision *> *))completionHandler
+{
+    [self addOperationToQueue:self.asyncReadQueue
+             qualityOfService:qos
+                        block:^{
+                            completionHandler([self getDocumentsWithIds:docIds]);
+                        }];
+}
+
+- (void)find:(NSDictionary *)query
+                 skip:(NSUInteger)skip
+                limit:(NSUInteger)limit
+               fields:(NSArray *)fields
+                 sort:(NSArray *)sortDocument
+     qualityOfService:(NSQualityOfService)qos
+    completionHandler:(void (^)(NSArray<CDTDocumentRevision *> *, NSError *))completionHandler
+{
+    // Queries are reads too, even though they may have to update indexes first: the index
+    // manager serialises its own writes to the index database.
+    [self addOperationToQueue:self.asyncReadQueue
+             qualityOfService:qos
+                        block:^{
+                            CDTQResultSet *result = [self find:query
+                                                          skip:skip
+                                                         limit:limit
+                                                        fields:fields
+                                                          sort:sortDocument];
+                            if (!result) {
+                                NSDictionary *userInfo = @{
+                                    NSLocalizedDescriptionKey :
+                                        NSLocalizedString(@"Problem running query.", nil)
+                                };
+                                completionHandler(
+                                    nil, [NSError errorWithDomain:CDTQIndexManagerErrorDomain
+                                                             code:CDTQQueryErrorQueryFailed
+                                                         userInfo:userInfo]);
+                                return;
+                            }
+
+                            NSMutableArray *revs = [NSMutableArray array];
+                            [result enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev,
+                                                                 NSUInteger idx, BOOL *stop) {
+                                [revs addObject:rev];
+                            }];
+                            completionHandler(revs, nil);
+                        }];
+}
+
+#pragma mark Writes
+
+- (void)createDocumentFromRevision:(CDTDocumentRevision *)revision
+                  qualityOfService:(NSQualityOfService)qos
+                 completionHandler:(void (^)(CDTDocumentRevision *, NSError *))completionHandler
+{
+    [self addOperationToQueue:self.asyncWriteQueue
+             qualityOfService:qos
+                        block:^{
+                            NSError *error;
+                            CDTDocumentRevision *rev =
+                                [self createDocumentFromRevision:revision error:&error];
+                            completionHandler(rev, rev ? nil : error);
+                        }];
+}
+
+- (void)updateDocumentFromRevision:(CDTDocumentRevision *)revision
+                  qualityOfService:(NSQualityOfService)qos
+                 completionHandler:(void (^)(CDTDocumentRevision *, NSError *))completionHandler
+{
+    [self addOperationToQueue:self.asyncWriteQueue
+             qualityOfService:qos
+                        block:^{
+                            NSError *error;
+                            CDTDocumentRevision *rev =
+                                [self updateDocumentFromRevision:revision error:&error];
+                            completionHandler(rev, rev ? nil : error);
+                        }];
+}
+
+- (void)deleteDocumentFromRevision:(CDTDocumentRevision *)revision
+                  qualityOfService:(NSQualityOfService)qos
+                 completionHandler:(void (^)(CDTDocumentRevision *, NSError *))completionHandler
+{
+    [self addOperationToQueue:self.asyncWriteQueue
+             qualityOfService:qos
+                        block:^{
+                            NSError *error;
+                            CDTDocumentRevision *rev =
+                                [self deleteDocumentFromRevision:revision error:&error];
+                            completionHandler(rev, rev ? nil : error);
+                        }];
+}
+
+- (void)compactWithQualityOfService:(NSQualityOfService)qos
+                  completionHandler:(void (^)(NSError *))completionHandler
+{
+    [self addOperationToQueue:self.asyncWriteQueue
+             qualityOfService:qos
+                        block:^{
+                            NSError *error;
+                            BOOL success = [self compactWithError:&error];
+                            completionHandler(success ? nil : error);
+                        }];
+}
+
+@end
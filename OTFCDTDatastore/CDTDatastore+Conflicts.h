@@ -61,4 +61,27 @@
                            resolver:(nonnull NSObject<CDTConflictResolver> *)resolver
                               error:(NSError *__autoreleasing __nullable * __nullable)error;
 
+/**
+ Resolve conflicts for many documents at once, for example everything returned by
+ getConflictedDocumentIds after a long period offline.
+
+ Each document is resolved as by resolveConflictsForDocument:resolver:error:, but the conflicting
+ revisions are loaded, and the winners and deletions committed, for hundreds of documents per
+ database transaction. If the resolver's isThreadSafe returns YES, it is also called for several
+ documents concurrently.
+
+ A document that fails to resolve is left unchanged without affecting the others.
+
+ @param docIds ids of the Documents to resolve conflicts
+ @param resolver the CDTConflictResolver-conforming object used to resolve conflicts
+ @return the errors for the documents that could not be resolved, keyed by document id (empty
+    if every document was resolved or left conflicted by the resolver), or nil if the datastore
+    could not be opened.
+
+ @see CDTConflictResolver
+ */
+- (nullable NSDictionary<NSString *, NSError *> *)
+resolveConflictsForDocuments:(nonnull NSArray<NSString *> *)docIds
+                    resolver:(nonnull NSObject<CDTConflictResolver> *)resolver;
+
 @end
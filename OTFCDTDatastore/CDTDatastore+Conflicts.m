@@ -22,6 +22,7 @@
 #import "CDTDatastore+Internal.h"
 #import "CDTDocumentRevision.h"
 #import "CDTLogging.h"
+#import "CollectionUtils.h"
 #import "TDInternal.h"
 #import "TDStatus.h"
 #import "TD_Body.h"
@@ -30,6 +31,9 @@
 #import "TD_Database+Insertion.h"
 #import "TD_Revision.h"
 
+// Documents resolved per transaction by -resolveConflictsForDocuments:resolver:
+#define kCDTConflictResolutionBatchSize 500u
+
 @implementation CDTDatastore (Conflicts)
 
 - (NSArray *)getConflictedDocumentIds
@@ -39,6 +43,135 @@
     return (self.database ? [self.database getConflictedDocumentIds] : nil);
 }
 
+/**
+ Streams any attachments of a resolver's new winning revision that aren't in the blob store yet,
+ collecting their data into downloadedAttachments, and collects the already-saved ones to be
+ copied to the new revision into attachmentsToCopy.
+ */
+- (BOOL)prepareAttachmentsOfResolvedRevision:(CDTDocumentRevision *)resolvedRev
+                       downloadedAttachments:(NSMutableArray *)downloadedAttachments
+                           attachmentsToCopy:(NSMutableArray *)attachmentsToCopy
+                                       error:(NSError *__autoreleasing *)error
+{
+    if (resolvedRev.revId == nil) {
+        [NSException raise:@"Source Revision cannot be nil" format:@""];
+    }
+
+    // need to download attachments to the blob store if there are any which are not saved
+    for (NSString *key in resolvedRev.attachments) {
+        CDTAttachment *attachment = [resolvedRev.attachments objectForKey:key];
+
+        if (![attachment isKindOfClass:[CDTSavedAttachment class]]) {
+            NSDictionary *attachmentData = [self streamAttachmentToBlobStore:attachment error:error];
+            if (attachmentData == nil) {
+                // well we failed to download lets just move on and return false
+                // error is set by streamAttachmentToBlobStore so no need to set
+                return NO;
+            }
+            [downloadedAttachments addObject:attachmentData];
+
+        } else {
+            // umm need to add this to the array to copy;;
+            [attachmentsToCopy addObject:attachment];
+        }
+    }
+    return YES;
+}
+
+/**
+ Only call from within a queued transaction.
+ Makes resolvedRev the winner of docId's conflicts, inserting it first if it's a new revision, and
+ deletes all the other conflicting revisions.
+ */
+- (TDStatus)commitResolvedRevision:(CDTDocumentRevision *)resolvedRev
+                       forDocument:(NSString *)docId
+                         conflicts:(NSArray *)revsArray
+             downloadedAttachments:(NSArray *)downloadedAttachments
+                 attachmentsToCopy:(NSArray *)attachmentsToCopy
+                          database:(FMDatabase *)db
+                             error:(NSError *__autoreleasing *)error
+{
+    // insert at specfied rev
+    // I assume thats already attached so I just insert
+    TDStatus status;
+    NSString *winningRev = nil;
+
+    if (resolvedRev.isChanged) {
+        winningRev = resolvedRev.revId;
+        TD_Revision *converted =
+            [[TD_Revision alloc] initWithDocID:resolvedRev.docId revID:nil deleted:NO];
+        converted.body = [[TD_Body alloc] initWithProperties:resolvedRev.body];
+
+        TD_Revision *winner = [self.database putRevision:converted
+                                          prevRevisionID:winningRev
+                                           allowConflict:NO
+                                                  status:&status
+                                                database:db];
+        if (TDStatusIsError(status)) {
+            // well conflic res failed
+            if (error) *error = TDStatusToNSError(status, nil);
+            return status;
+        }
+
+        // okay we have the new winner, need to insert the attachments
+        // start with the new ones
+        for (NSDictionary *attachment in downloadedAttachments) {
+            NSError *attachmentError = nil;
+            if (![self addAttachment:attachment
+                               toRev:[[CDTDocumentRevision alloc] initWithDocId:winner.docID
+                                                                     revisionId:winner.revID
+                                                                           body:winner.body.properties
+                                                                        deleted:winner.deleted
+                                                                    attachments:@{}
+                                                                       sequence:winner.sequence]
+                          inDatabase:db
+                               error:&attachmentError]) {
+                if (error) {
+                    if (attachmentError.code == SQLITE_FULL) {
+                        *error = TDStatusToNSError(kTDStatusInsufficientStorage, nil);
+                    } else {
+                        *error = TDStatusToNSError(kTDStatusAttachmentError, nil);
+                    }
+                }
+                return kTDStatusAttachmentError;
+            }
+        }
+        status = [self.database copyAttachmentsNamed:[attachmentsToCopy valueForKey:@"name"]
+                                       fromSequences:[attachmentsToCopy valueForKey:@"sequence"]
+                                          toSequence:winner.sequence
+                                          inDatabase:db];
+        if (TDStatusIsError(status)) {
+            if (error) *error = TDStatusToNSError(status, nil);
+            return status;
+        }
+    }
+
+    //
+    // set all remaining conflicted revisions to deleted
+    //
+    for (CDTDocumentRevision *theRev in revsArray) {
+        if (theRev == resolvedRev || [theRev.revId isEqualToString:winningRev]) {
+            continue;
+        }
+
+        TD_Revision *toPutRevision = [[TD_Revision alloc] initWithDocID:docId revID:nil deleted:YES];
+
+        [self.database putRevision:toPutRevision
+                    prevRevisionID:theRev.revId
+                     allowConflict:NO
+                            status:&status
+                          database:db];
+
+        if (TDStatusIsError(status)) {
+            if (error) *error = TDStatusToNSError(status, nil);
+            os_log_debug(CDTOSLog, "CDTDatastore+Conflicts -resolveConflictsForDocument: Failed to delete non-winning revision (%{public}@) for document %{public}@", theRev.revId, docId);
+            return status;
+        }
+    }
+
+    return kTDStatusOK;
+}
+
 - (BOOL)resolveConflictsForDocument:(NSString *)docId
                            resolver:(NSObject<CDTConflictResolver> *)resolver
                               error:(NSError *__autoreleasing *)error
@@ -51,7 +184,6 @@
     }
 
     NSArray *revsArray = [self activeRevisionsForDocumentId:docId];
-    NSString *winningRev;
 
     if (revsArray.count <= 1) {  // no conflicts for this doc
         return kTDStatusOK;
@@ -61,137 +193,194 @@
     NSMutableArray *downloadedAttachments = [NSMutableArray array];
     NSMutableArray *attachmentsToCopy = [NSMutableArray array];
 
-    BOOL isNewRevision = resolvedRev.isChanged;
-
     if (resolvedRev == nil) {  // do nothing
         return kTDStatusOK;
-    } else if (isNewRevision) {
-        CDTDocumentRevision *mutableResolvedRev = (CDTDocumentRevision *)resolvedRev;
-
-        if (mutableResolvedRev.revId == nil) {
-            [NSException raise:@"Source Revision cannot be nil" format:@""];
-        } else {
-            winningRev = mutableResolvedRev.revId;
-
-            // need to download attachments to the blob store if there are any which are not saved
-
-            if (mutableResolvedRev.attachments) {
-                for (NSString *key in mutableResolvedRev.attachments) {
-                    CDTAttachment *attachment = [mutableResolvedRev.attachments objectForKey:key];
-
-                    if (![attachment isKindOfClass:[CDTSavedAttachment class]]) {
-                        NSDictionary *attachmentData =
-                            [self streamAttachmentToBlobStore:attachment error:error];
-                        if (attachmentData == nil) {
-                            // well we failed to download lets just move on and return false
-                            // error is set by streamAttachmentToBlobStore so no need to set
-                            return NO;
-                        }
-                        [downloadedAttachments addObject:attachmentData];
-
-                    } else {
-                        // umm need to add this to the array to copy;;
-                        [attachmentsToCopy addObject:attachment];
-                    }
-                }
-            }
+    } else if (resolvedRev.isChanged) {
+        if (![self prepareAttachmentsOfResolvedRevision:resolvedRev
+                                  downloadedAttachments:downloadedAttachments
+                                      attachmentsToCopy:attachmentsToCopy
+                                                  error:error]) {
+            return NO;
         }
     }
     __block NSError *localError;
     __weak CDTDatastore *weakSelf = self;
 
     TDStatus retStatus = [self.database inTransaction:^TDStatus(FMDatabase *db) {
-
         CDTDatastore *strongSelf = weakSelf;
         localError = nil;
+        NSError *commitError;
+        TDStatus status = [strongSelf commitResolvedRevision:resolvedRev
+                                                 forDocument:docId
+                                                   conflicts:revsArray
+                                       downloadedAttachments:downloadedAttachments
+                                           attachmentsToCopy:attachmentsToCopy
+                                                    database:db
+                                                       error:&commitError];
+        localError = commitError;
+        return status;
+    }];
 
-        // insert at specfied rev
-        // I assume thats already attached so I just insert
-        TDStatus status;
-
-        if (isNewRevision) {
-            TD_Revision *converted =
-                [[TD_Revision alloc] initWithDocID:resolvedRev.docId revID:nil deleted:NO];
-            converted.body = [[TD_Body alloc] initWithProperties:resolvedRev.body];
-
-            TD_Revision *winner = [strongSelf.database putRevision:converted
-                                                    prevRevisionID:winningRev
-                                                     allowConflict:NO
-                                                            status:&status
-                                                          database:db];
-            if (TDStatusIsError(status)) {
-                // well conflic res failed
-                localError = TDStatusToNSError(status, nil);
-                return status;
-            }
+    if (error) {
+        *error = localError;
+    }
+    return retStatus == kTDStatusOK;
+}
 
-            // okay we have the new winner, need to insert the attachments
-            // start with the new ones
-            for (NSDictionary *attachment in downloadedAttachments) {
-                NSError *attachmentError = nil;
-                if (![strongSelf addAttachment:attachment
-                                         toRev:[[CDTDocumentRevision alloc]
-                                                   initWithDocId:winner.docID
-                                                      revisionId:winner.revID
-                                                            body:winner.body.properties
-                                                         deleted:winner.deleted
-                                                     attachments:@{}
-                                                        sequence:winner.sequence]
-                                    inDatabase:db
-                                         error:&attachmentError]) {
-                    if (attachmentError.code == SQLITE_FULL) {
-                        localError = TDStatusToNSError(kTDStatusInsufficientStorage, nil);
-                    } else {
-                        localError = TDStatusToNSError(kTDStatusAttachmentError, nil);
-                    }
-                    return kTDStatusAttachmentError;
+- (BOOL)resolveConflictsForDocument:(NSString *)docId
+                           resolver:(NSObject<CDTConflictResolver> *)resolver
+                           database:(FMDatabase *)db
+                              error:(NSError *__autoreleasing *)error
+{
+    NSArray *revsArray = [self activeRevisionsForDocumentId:docId database:db];
+    if (revsArray.count <= 1) {  // no conflicts for this doc
+        return YES;
+    }
+
+    CDTDocumentRevision *resolvedRev = [resolver resolve:docId conflicts:revsArray];
+    if (resolvedRev == nil) {  // do nothing
+        return YES;
+    }
+    NSMutableArray *downloadedAttachments = [NSMutableArray array];
+    NSMutableArray *attachmentsToCopy = [NSMutableArray array];
+    if (resolvedRev.isChanged &&
+        ![self prepareAttachmentsOfResolvedRevision:resolvedRev
+                              downloadedAttachments:downloadedAttachments
+                                  attachmentsToCopy:attachmentsToCopy
+                                              error:error]) {
+        return NO;
+    }
+
+    if (![db executeUpdate:@"SAVEPOINT resolveConflicts"]) {
+        if (error) *error = TDStatusToNSError(kTDStatusDBError, nil);
+        return NO;
+    }
+    TDStatus status = [self commitResolvedRevision:resolvedRev
+                                       forDocument:docId
+                                         conflicts:revsArray
+                             downloadedAttachments:downloadedAttachments
+                                 attachmentsToCopy:attachmentsToCopy
+                                          database:db
+                                             error:error];
+    if (TDStatusIsError(status)) {
+        [db executeUpdate:@"ROLLBACK TO resolveConflicts"];
+    }
+    [db executeUpdate:@"RELEASE resolveConflicts"];
+    return !TDStatusIsError(status);
+}
+
+- (NSDictionary<NSString *, NSError *> *)resolveConflictsForDocuments:(NSArray<NSString *> *)docIds
+                                                             resolver:(NSObject<CDTConflictResolver> *)resolver
+{
+    if (!self.database) {
+        return nil;
+    }
+
+    BOOL concurrent =
+        [resolver respondsToSelector:@selector(isThreadSafe)] && resolver.isThreadSafe;
+    NSMutableDictionary<NSString *, NSError *> *failures = [NSMutableDictionary dictionary];
+
+    for (NSUInteger offset = 0; offset < docIds.count; offset += kCDTConflictResolutionBatchSize) {
+        @autoreleasepool
+        {
+            NSArray *batch = [docIds
+                subarrayWithRange:NSMakeRange(offset, MIN(kCDTConflictResolutionBatchSize,
+                                                          docIds.count - offset))];
+            NSUInteger count = batch.count;
+
+            // Load the conflicting revisions of the whole batch in one transaction:
+            NSMutableArray *conflicts = [NSMutableArray arrayWithCapacity:count];
+            [self.database inTransaction:^TDStatus(FMDatabase *db) {
+                for (NSString *docId in batch) {
+                    [conflicts addObject:[self activeRevisionsForDocumentId:docId database:db]];
                 }
+                return kTDStatusOK;
+            }];
+
+            // Ask the resolver about each document, concurrently if it allows that:
+            NSMutableArray *resolved = [NSMutableArray arrayWithCapacity:count];
+            for (NSUInteger i = 0; i < count; i++) {
+                [resolved addObject:[NSNull null]];
             }
-            for (CDTSavedAttachment *attachment in attachmentsToCopy) {
-                status = [strongSelf.database copyAttachmentNamed:attachment.name
-                                                     fromSequence:attachment.sequence
-                                                       toSequence:winner.sequence
-                                                       inDatabase:db];
-
-                if (TDStatusIsError(status)) {
-                    localError = TDStatusToNSError(status, nil);
-                    return status;
+            void (^resolve)(size_t) = ^(size_t i) {
+                @autoreleasepool
+                {
+                    NSArray *revsArray = conflicts[i];
+                    if (revsArray.count <= 1) return;  // no conflicts for this doc
+                    CDTDocumentRevision *resolvedRev =
+                        [resolver resolve:batch[i] conflicts:revsArray];
+                    if (resolvedRev) {
+                        @synchronized(resolved)
+                        {
+                            resolved[i] = resolvedRev;
+                        }
+                    }
                 }
+            };
+            if (concurrent) {
+                dispatch_apply(count, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), resolve);
+            } else {
+                for (NSUInteger i = 0; i < count; i++) resolve(i);
             }
-        }
 
-        //
-        // set all remaining conflicted revisions to deleted
-        //
-        for (CDTDocumentRevision *theRev in revsArray) {
-            if (theRev == resolvedRev || [theRev.revId isEqualToString:winningRev]) {
-                continue;
+            // Attachments of new winners have to be in the blob store before the transaction:
+            NSMutableArray *downloaded = [NSMutableArray arrayWithCapacity:count];
+            NSMutableArray *toCopy = [NSMutableArray arrayWithCapacity:count];
+            for (NSUInteger i = 0; i < count; i++) {
+                NSMutableArray *downloadedAttachments = [NSMutableArray array];
+                NSMutableArray *attachmentsToCopy = [NSMutableArray array];
+                CDTDocumentRevision *resolvedRev = $castIf(CDTDocumentRevision, resolved[i]);
+                NSError *error = nil;
+                if (resolvedRev.isChanged &&
+                    ![self prepareAttachmentsOfResolvedRevision:resolvedRev
+                                          downloadedAttachments:downloadedAttachments
+                                              attachmentsToCopy:attachmentsToCopy
+                                                          error:&error]) {
+                    failures[batch[i]] = error ?: TDStatusToNSError(kTDStatusAttachmentError, nil);
+                    resolved[i] = [NSNull null];
+                }
+                [downloaded addObject:downloadedAttachments];
+                [toCopy addObject:attachmentsToCopy];
             }
 
-            TD_Revision *toPutRevision =
-                [[TD_Revision alloc] initWithDocID:docId revID:nil deleted:YES];
-
-            TDStatus status;
-            [strongSelf.database putRevision:toPutRevision
-                              prevRevisionID:theRev.revId
-                               allowConflict:NO
-                                      status:&status
-                                    database:db];
-
-            if (TDStatusIsError(status)) {
-                localError = TDStatusToNSError(status, nil);
-                os_log_debug(CDTOSLog, "CDTDatastore+Conflicts -resolveConflictsForDocument: Failed to delete non-winning revision (%{public}@) for document %{public}@", theRev.revId, docId);
-                return status;
+            // Commit the whole batch together. Each document gets its own savepoint, so one that
+            // fails is rolled back without losing the rest:
+            __weak CDTDatastore *weakSelf = self;
+            TDStatus batchStatus = [self.database inTransaction:^TDStatus(FMDatabase *db) {
+                CDTDatastore *strongSelf = weakSelf;
+                for (NSUInteger i = 0; i < count; i++) {
+                    CDTDocumentRevision *resolvedRev = $castIf(CDTDocumentRevision, resolved[i]);
+                    if (!resolvedRev) continue;
+                    if (![db executeUpdate:@"SAVEPOINT resolveConflicts"]) {
+                        return kTDStatusDBError;
+                    }
+                    NSError *error = nil;
+                    TDStatus status = [strongSelf commitResolvedRevision:resolvedRev
+                                                             forDocument:batch[i]
+                                                               conflicts:conflicts[i]
+                                                   downloadedAttachments:downloaded[i]
+                                                       attachmentsToCopy:toCopy[i]
+                                                                database:db
+                                                                   error:&error];
+                    if (TDStatusIsError(status)) {
+                        [db executeUpdate:@"ROLLBACK TO resolveConflicts"];
+                        failures[batch[i]] = error ?: TDStatusToNSError(status, nil);
+                    }
+                    [db executeUpdate:@"RELEASE resolveConflicts"];
+                }
+                return kTDStatusOK;
+            }];
+            if (TDStatusIsError(batchStatus)) {
+                for (NSUInteger i = 0; i < count; i++) {
+                    if ($castIf(CDTDocumentRevision, resolved[i]) && !failures[batch[i]]) {
+                        failures[batch[i]] = TDStatusToNSError(batchStatus, nil);
+                    }
+                }
             }
         }
-
-        return kTDStatusOK;
-    }];
-
-    if (error) {
-        *error = localError;
     }
-    return retStatus == kTDStatusOK;
+
+    return failures;
 }
 
 @end
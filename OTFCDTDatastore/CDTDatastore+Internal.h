@@ -14,6 +14,7 @@
 
 #import "CDTDatastore.h"
 @class FMDatabase;
+@protocol CDTConflictResolver;
 
 @interface CDTDatastore (Internal)
 
@@ -53,3 +54,41 @@
 - (NSArray *)activeRevisionsForDocumentId:(NSString *)docId;
 
 @end
+
+@interface CDTDatastore (Conflicts_Internal)
+
+/**
+ As -resolveConflictsForDocument:resolver:error:, within a transaction the caller has open, such
+ as the one a pull replication inserts a batch of revisions in. What the resolver chose is
+ committed in a savepoint, which is rolled back if it fails, leaving the document conflicted.
+ */
+- (BOOL)resolveConflictsForDocument:(NSString *)docId
+                           resolver:(NSObject<CDTConflictResolver> *)resolver
+                           database:(FMDatabase *)db
+                              error:(NSError *__autoreleasing *)error;
+
+@end
+
+@interface CDTDatastore (Query_Internal)
+
+/**
+ Opens the query index manager if the datastore has query indexes, so that it's there to take
+ documents purged without a change, e.g., once they expire, out of them. Call before purging.
+ */
+- (void)openIndexesForPurge;
+
+@end
+
+@interface CDTDatastore ()
+
+/**
+ YES while the datastore has replications running or query result sets which might still read
+ from it, so its manager mustn't close it to make room for others.
+ */
+@property (readonly, getter=isInUse) BOOL inUse;
+
+/** Called as a query result set reading from this datastore is created, and as it goes. */
+- (void)resultSetCreated;
+- (void)resultSetReleased;
+
+@end
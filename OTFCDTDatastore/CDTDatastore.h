@@ -21,6 +21,10 @@
 #endif
 
 @class CDTDocumentRevision;
+@class CDTDatastoreStatistics;
+@class CDTPullReplication;
+@class CDTQueueTelemetry;
+@class CDTSlowOperationLog;
 @class FMDatabase;
 
 /** NSNotification posted when a document is updated.
@@ -28,11 +32,29 @@
   - @"rev": the new CDTDocumentRevision,
   - @"source": NSURL of remote db pulled from,
   - @"winner": new winning CDTDocumentRevision, _if_ it changed (often same as rev).
+ Documents saved in one batch (e.g. -createDocumentsFromRevisions:error:) are notified together in
+ a single notification instead, with the keys:
+  - @"revs": NSArray of the new CDTDocumentRevisions,
+  - @"winners": NSArray of the new winning CDTDocumentRevisions, NSNull where unchanged.
  */
 extern NSString * __nonnull const CDTDatastoreChangeNotification;
 
+/** NSNotification listing the revisions added to a datastore over a short time, however many
+ transactions added them, so that an observer of a large pull is woken a few times rather than
+ once for each document. It's posted on a queue of the datastore's own, never on the thread that
+ wrote, at most once every changeNotificationInterval.
+ UserInfo keys:
+  - @"changes": NSArray of CDTDocumentChanges, in the order they were committed.
+ */
+extern NSString * __nonnull const CDTDatastoreChangesNotification;
+
 @class TD_Database;
 
+/**
+ * Returns a new, unique document ID. See CDTDatastore documentIDGenerator.
+ */
+typedef NSString *_Nonnull (^CDTDocumentIDGenerator)(void);
+
 /**
  * The CDTDatastore is the core interaction point for create, delete and update
  * operations (CRUD) for within Cloudant Sync.
@@ -154,6 +176,30 @@ typedef NS_ENUM(NSUInteger, OTFProtectionLevel) {
  */
 - (nullable NSArray<CDTDocumentRevision*> *)getAllDocuments;
 
+/**
+ * Enumerates the current winning revision of every document, in ascending or
+ * descending document ID order.
+ *
+ * Unlike -getAllDocuments, documents are read from the database a page at a time
+ * and handed to the block as they are read, so memory use doesn't grow with the
+ * size of the datastore. The block may safely use the datastore.
+ *
+ * Documents created or deleted while the enumeration is in progress may or may
+ * not be seen.
+ *
+ * @param descending ordered descending if true, otherwise ascendingly
+ * @param block called for each document revision; set `stop` to YES to end
+ *        the enumeration early.
+ * @param error will point to an NSError object in the case of an error
+ *
+ * @return YES if every document was enumerated (or the block stopped the
+ *         enumeration), NO in the case of an error
+ */
+- (BOOL)enumerateAllDocumentsDescending:(BOOL)descending
+                             usingBlock:(void (^__nonnull)(CDTDocumentRevision *__nonnull revision,
+                                                           BOOL *__nonnull stop))block
+                                  error:(NSError *__nullable *__nullable)error;
+
 /**
  * Enumerates the current winning revision for all documents in the
  * datastore and return a list of their document identifiers.
@@ -183,6 +229,59 @@ typedef NS_ENUM(NSUInteger, OTFProtectionLevel) {
                              limit:(NSUInteger)limit
                         descending:(BOOL)descending;
 
+/**
+ * Returns a page of the documents whose IDs are in a range, in ID order. Each page carries on
+ * from the last one at the document ID it stopped at, rather than counting through the documents
+ * before it, so every page takes about as long to read however deep into the range it is, and
+ * documents saved or deleted between pages don't shift the ones after them.
+ *
+ * IDs are compared by their UTF-8 bytes. Deleted documents aren't returned.
+ *
+ * @param startId the first ID of the range, or nil to start at the first document (the last,
+ *        if descending)
+ * @param endId the last ID of the range, or nil to run to the end
+ * @param descending YES to go from the highest ID down, in which case startId is the high end
+ * @param limit the most documents to return; 0 for no limit
+ * @param continuation nil for the first page, or a nextContinuation given by the page before,
+ *        with the same range and order
+ * @param nextContinuation set to a token for the next page if this one is full, which may turn
+ *        out empty; otherwise nil, as there are no more
+ * @param error will point to an NSError object in the case of an error
+ * @return the documents, or nil in case of an error
+ */
+- (nullable NSArray<CDTDocumentRevision *> *)getDocumentsFromId:(nullable NSString *)startId
+                                                           toId:(nullable NSString *)endId
+                                                     descending:(BOOL)descending
+                                                          limit:(NSUInteger)limit
+                                                   continuation:(nullable NSString *)continuation
+                                               nextContinuation:
+                                                   (NSString *__nullable * __nullable)nextContinuation
+                                                          error:(NSError *__nullable * __nullable)error;
+
+/**
+ * Returns a page of the documents whose IDs start with a prefix, in ID order, for IDs made of
+ * parts such as `order:2024:...`. Pages carry on from each other as for
+ * -getDocumentsFromId:toId:descending:limit:continuation:nextContinuation:error:, and reading
+ * one only reads the documents in it.
+ *
+ * @param prefix the start the IDs share; an empty prefix matches every document
+ * @param descending YES to go from the highest ID down
+ * @param limit the most documents to return; 0 for no limit
+ * @param continuation nil for the first page, or a nextContinuation given by the page before,
+ *        with the same prefix and order
+ * @param nextContinuation set to a token for the next page if this one is full, which may turn
+ *        out empty; otherwise nil, as there are no more
+ * @param error will point to an NSError object in the case of an error
+ * @return the documents, or nil in case of an error
+ */
+- (nullable NSArray<CDTDocumentRevision *> *)getDocumentsWithIdPrefix:(nonnull NSString *)prefix
+                                                           descending:(BOOL)descending
+                                                                limit:(NSUInteger)limit
+                                                         continuation:(nullable NSString *)continuation
+                                                     nextContinuation:
+                                                         (NSString *__nullable * __nullable)nextContinuation
+                                                                error:(NSError *__nullable * __nullable)error;
+
 /**
  * Return the winning revisions for a set of document IDs.
  *
@@ -192,6 +291,24 @@ typedef NS_ENUM(NSUInteger, OTFProtectionLevel) {
  */
 - (nonnull NSArray<CDTDocumentRevision*> *)getDocumentsWithIds:(nonnull NSArray *)docIds;
 
+/**
+ * Return the winning revisions for a set of document IDs, with bodies holding just the given
+ * fields, such as those a list shows. Only those fields are read out of each stored body, so
+ * the rest are never parsed or held in memory.
+ *
+ * A field is a top-level property, or a dotted path to one nested in dictionaries: `address.city`
+ * gives a body of `{ "address": { "city": ... } }`. Fields a document doesn't have are left out
+ * of its body. As for a query's projected results, -copy of a revision gives the whole document,
+ * so that updating it doesn't lose the fields left out.
+ *
+ * @param docIds list of document id
+ * @param fields the fields to read
+ *
+ * @return NSArray containing CDTDocumentRevision objects
+ */
+- (nonnull NSArray<CDTDocumentRevision*> *)getDocumentsWithIds:(nonnull NSArray *)docIds
+                                                        fields:(nonnull NSArray<NSString*> *)fields;
+
 /**
  * Returns the history of revisions for the passed revision.
  *
@@ -235,6 +352,39 @@ typedef NS_ENUM(NSUInteger, OTFProtectionLevel) {
  */
 - (nullable CDTDocumentRevision *)updateDocumentFromRevision:(nonnull CDTDocumentRevision *)revision
                                                        error:(NSError *__nullable * __nullable )error;
+
+/**
+ * Creates several documents in a single transaction.
+ *
+ * This is much faster than calling -createDocumentFromRevision:error: for each document when
+ * importing large numbers of documents. Either all the documents are created or, if any of them
+ * fails, none are. A single CDTDatastoreChangeNotification is posted for the whole batch, with
+ * the userInfo keys @"revs" and @"winners" holding arrays of CDTDocumentRevision.
+ *
+ * @param revisions document revisions to create documents from
+ * @param error will point to an NSError object in the case of an error. Its userInfo's
+ *        @"index" key holds the index of the revision which failed, when known.
+ *
+ * @return the created document revisions, in the same order as revisions
+ */
+- (nullable NSArray<CDTDocumentRevision *> *)
+createDocumentsFromRevisions:(nonnull NSArray<CDTDocumentRevision *> *)revisions
+                       error:(NSError *__nullable * __nullable)error;
+
+/**
+ * Updates several documents in a single transaction.
+ *
+ * As -createDocumentsFromRevisions:error:, but each revision must be a full revision of an
+ * existing document, as for -updateDocumentFromRevision:error:.
+ *
+ * @param revisions updated document revisions
+ * @param error will point to an NSError object in the case of an error
+ *
+ * @return the updated document revisions, in the same order as revisions
+ */
+- (nullable NSArray<CDTDocumentRevision *> *)
+updateDocumentsFromRevisions:(nonnull NSArray<CDTDocumentRevision *> *)revisions
+                       error:(NSError *__nullable * __nullable)error;
 /**
  * Deletes a document from the datastore.
  *
@@ -263,10 +413,464 @@ typedef NS_ENUM(NSUInteger, OTFProtectionLevel) {
  * Compact local database, deleting document bodies, keeping only the metadata of
  * previous revisions
  *
+ * The space freed is given back to the file system without rewriting the database file, except
+ * the first time a datastore created by an earlier version is compacted: that converts it to
+ * incremental vacuuming with one full VACUUM, see -vacuumWithError:.
+ *
  * @param error will point to an NSError object in the case of an error
  */
 - (BOOL)compactWithError:(NSError *__nullable * __nullable)error;
 
+/**
+ * Rewrites the whole database file, defragmenting it, and converts datastores created by
+ * earlier versions to incremental vacuuming. This holds up all other use of the datastore until
+ * it finishes, which for a large datastore can be minutes, and needs as much free disk space
+ * again as the database file. Compaction and autoVacuumThreshold give free space back without it.
+ *
+ * @param error will point to an NSError object in the case of an error
+ */
+- (BOOL)vacuumWithError:(NSError *__nullable * __nullable)error;
+
+/**
+ *
+ * Does a bounded share of the work of -compactWithError:, so that compaction can be run a
+ * little at a time without a visible pause, even from the main thread. Progress is kept
+ * between calls: call it again until `finished` is YES.
+ *
+ * The database file shrinks as free pages are given back with incremental vacuuming.
+ * Databases created by earlier versions only do that after one full -compactWithError:.
+ *
+ * @param timeBudget roughly how long, in seconds, the call may take
+ * @param rowBudget the maximum number of revision bodies to remove, or 0 for no limit
+ * @param finished on return, YES if there is nothing left to compact
+ * @param error will point to an NSError object in the case of an error
+ */
+- (BOOL)compactWithTimeBudget:(NSTimeInterval)timeBudget
+                    rowBudget:(NSUInteger)rowBudget
+                     finished:(nullable BOOL *)finished
+                        error:(NSError *__nullable * __nullable)error;
+
+/**
+ * When greater than zero, the datastore compacts itself incrementally in the background once
+ * the bodies of obsolete revisions make up more than this fraction of all the revision bodies
+ * it stores. The fraction is checked every few hundred changes.
+ *
+ * Defaults to 0, which disables automatic compaction.
+ */
+@property (nonatomic) double autoCompactionThreshold;
+
+/**
+ * When greater than zero, once the database file has more than this many bytes of free pages,
+ * as it does after documents are purged or compacted, the datastore gives them back to the file
+ * system in the background, a few hundred pages at a time so that writers are barely held up.
+ * Free space is checked every few hundred changes.
+ *
+ * Datastores created by earlier versions need one -compactWithError: or -vacuumWithError:
+ * before their free pages can be given back this way.
+ *
+ * Defaults to 0, which leaves free pages for the datastore to reuse.
+ */
+@property (nonatomic) UInt64 autoVacuumThreshold;
+
+/**
+ * Purges documents that were deleted more than `age` seconds ago, so their tombstones stop
+ * taking up space. Purged documents are removed completely, along with their revision history,
+ * so the deletions won't replicate anywhere they haven't already: see
+ * -purgeTombstonesOlderThan:pushedWithReplication:timeBudget:purged:finished:error: to only
+ * purge tombstones that have been pushed. Documents with live conflicting revisions are kept.
+ *
+ * Works a batch at a time until the time budget runs out. Progress is kept in the datastore,
+ * so a purge that was interrupted, even by the app being closed, carries on where it stopped:
+ * call it again, for example whenever the app is idle, until `finished` is YES.
+ *
+ * @param age how long ago, in seconds, documents have to have been deleted to be purged.
+ *            Documents deleted before the datastore was upgraded to support this count from
+ *            the upgrade.
+ * @param timeBudget roughly how long, in seconds, the call may take
+ * @param purged on return, how many documents were purged
+ * @param finished on return, YES if every tombstone has been looked at
+ * @param error will point to an NSError object in the case of an error
+ */
+- (BOOL)purgeTombstonesOlderThan:(NSTimeInterval)age
+                      timeBudget:(NSTimeInterval)timeBudget
+                          purged:(nullable NSUInteger *)purged
+                        finished:(nullable BOOL *)finished
+                           error:(NSError *__nullable * __nullable)error;
+
+/**
+ * Sets when a document expires, for documents that are only valid for a while, such as those
+ * of a cache. Once it has expired the document is purged, removed completely along with its
+ * revision history, rather than deleted, so there is no tombstone to replicate; see
+ * -purgeExpiredDocumentsWithTimeBudget:purged:finished:error: and expirySweepInterval.
+ *
+ * The expiry is the document's, not a revision's: it stays as the document is updated, until
+ * it is set again. Expiries aren't replicated.
+ *
+ * @param date when the document expires, or nil for it never to expire
+ * @param docId the ID of the document
+ * @param error will point to an NSError object in the case of an error, including there being
+ *              no such document
+ */
+- (BOOL)setExpiryDate:(nullable NSDate *)date
+    forDocumentWithId:(NSString *)docId
+                error:(NSError *__nullable * __nullable)error;
+
+/**
+ * When the document expires, or nil if it never does.
+ */
+- (nullable NSDate *)expiryDateForDocumentWithId:(NSString *)docId;
+
+/**
+ * Purges documents whose expiry date has passed, those which expired first first. The expiry
+ * dates are indexed, so unexpired documents aren't looked at.
+ *
+ * Works a batch at a time until the time budget runs out: call it again until `finished` is YES.
+ *
+ * @param timeBudget roughly how long, in seconds, the call may take
+ * @param purged on return, how many documents were purged
+ * @param finished on return, YES if no expired documents are left
+ * @param error will point to an NSError object in the case of an error
+ */
+- (BOOL)purgeExpiredDocumentsWithTimeBudget:(NSTimeInterval)timeBudget
+                                     purged:(nullable NSUInteger *)purged
+                                   finished:(nullable BOOL *)finished
+                                      error:(NSError *__nullable * __nullable)error;
+
+/**
+ * When greater than zero, the datastore purges its expired documents in the background this
+ * often, in seconds, in short steps so that writers are barely held up, while it's open.
+ *
+ * Defaults to 0, which leaves expired documents until
+ * -purgeExpiredDocumentsWithTimeBudget:purged:finished:error: is called.
+ */
+@property (nonatomic) NSTimeInterval expirySweepInterval;
+
+/**
+ * Moves the bodies of documents that are seldom read, such as old records, out of the datastore's
+ * database into an archive database beside it, so that the database, its write-ahead log and the
+ * memory caching it are only taken up by the documents in use. Archived documents are read,
+ * queried and replicated as before, if a little more slowly. Updating one stores the new
+ * revision in the database as usual.
+ *
+ * Every revision of each document with a current revision that passes `test` is archived.
+ * The test is given the current revisions not yet archived, without attachments, to decide by
+ * their bodies: by a date field, for example, to archive documents by age. Revisions stored as
+ * deltas against others (see storesHistoryAsDeltas) are small, and aren't archived.
+ *
+ * Snapshots exported from the datastore hold the archived bodies in their database, and backups
+ * copy the archive beside theirs. Encrypted datastores, and those of a manager with
+ * multi-process access enabled, can't be archived.
+ *
+ * @param test decides whether to archive the document a revision belongs to
+ * @param archived on return, how many documents were archived
+ * @param error will point to an NSError object in the case of an error
+ */
+- (BOOL)archiveDocumentsPassingTest:(BOOL (^__nonnull)(CDTDocumentRevision *__nonnull revision))test
+                           archived:(nullable NSUInteger *)archived
+                              error:(NSError *__nullable * __nullable)error;
+
+/**
+ * Most generations of each document's revision history to keep, counting back from each of its
+ * leaf revisions, like CouchDB's revs_limit. Older revisions are deleted when the datastore is
+ * compacted, which keeps often-edited documents from slowing down reads of their history and
+ * replication. Replication still works, since only recent history is needed to find where two
+ * copies of a document diverged; an edit that conflicts with one further back than the limit
+ * is kept as a conflict, as it is by CouchDB.
+ *
+ * Defaults to 0, which keeps every revision.
+ */
+@property (nonatomic) NSUInteger revsLimit;
+
+/**
+ * If YES and revsLimit is set, each document's revisions are trimmed to the limit when a new
+ * revision of it is saved or pulled, rather than at the next compaction. That costs a little on
+ * every write to documents with long histories. Defaults to NO.
+ */
+@property (nonatomic) BOOL stemsRevisionsOnInsert;
+
+/**
+ * Number of documents whose winning revisions -getDocumentWithId:error: keeps in memory, so
+ * that documents read over and over don't go to the database each time. The cache is emptied
+ * when it is resized and on memory warnings; a document leaves it as soon as it changes.
+ *
+ * Defaults to 0, which disables the cache.
+ */
+@property (nonatomic) NSUInteger documentCacheCapacity;
+
+/**
+ * The longest a change waits for others to be listed with it in a CDTDatastoreChangesNotification.
+ * Changes are held this long after the first of them, then posted together.
+ *
+ * Defaults to 0.1 seconds; at 0, a notification lists what was committed while the last one was
+ * being posted.
+ */
+@property NSTimeInterval changeNotificationInterval;
+
+/**
+ * If YES, a CDTDatastoreChangeNotification is also posted for each revision saved, or batch of
+ * them, on the thread which saved it, holding the revisions with their bodies. Observers which
+ * only need to know what changed should use CDTDatastoreChangesNotification instead, and turn
+ * this off, which saves copying every body that's written.
+ *
+ * Defaults to YES.
+ */
+@property BOOL postsRevisionChangeNotifications;
+
+/**
+ * Reads answered from the document cache since it was enabled.
+ */
+@property (nonatomic, readonly) NSUInteger documentCacheHitCount;
+
+/**
+ * Reads the document cache couldn't answer since it was enabled.
+ */
+@property (nonatomic, readonly) NSUInteger documentCacheMissCount;
+
+/**
+ * A snapshot of the datastore's size and activity: document and revision counts, file sizes,
+ * how far views are behind, page cache and transaction statistics. Cheap enough to poll.
+ *
+ * @return the statistics, or nil if the datastore couldn't be opened
+ */
+- (nullable CDTDatastoreStatistics *)statistics;
+
+/**
+ * Log of the datastore's recent slow operations: queries, document listings, change feeds and
+ * write transactions taking longer than its threshold, with their SQL and query plans.
+ * Recording is off until the log's threshold is set.
+ */
+@property (nullable, nonatomic, readonly) CDTSlowOperationLog *slowOperationLog;
+
+/**
+ * How long work has waited for the datastore's database connections and then held them, by
+ * kind of operation, to find which kind is keeping reads waiting. Its timings are also part of
+ * -statistics; turn on its emitsSignposts to see each wait in Instruments.
+ */
+@property (nullable, nonatomic, readonly) CDTQueueTelemetry *queueTelemetry;
+
+/**
+ * MIME types of attachments the datastore stores gzip-compressed, such as
+ * `@[ @"text/*", @"application/json" ]`. A trailing `*` matches any type with that prefix.
+ *
+ * Compressed attachments read back exactly as they were written, and are uploaded to the
+ * remote with `Content-Encoding: gzip` when they are sent as separate MIME parts. Only
+ * attachments saved from then on are affected.
+ *
+ * Defaults to nil, which compresses nothing.
+ */
+@property (nullable, nonatomic, copy) NSArray<NSString *> *compressibleAttachmentTypes;
+
+/**
+ * Attachments saved from then on which are shorter than this many bytes, as stored, are kept in
+ * the datastore's database rather than in files of their own. Many small attachments, such as
+ * thumbnails, then take up less space and are read without opening a file. They are encrypted
+ * with the database if it is. Attachments already saved stay where they are, and are read the
+ * same either way.
+ *
+ * Defaults to 0, which stores every attachment in a file.
+ */
+@property (nonatomic) NSUInteger inlineAttachmentThreshold;
+
+/**
+ * If YES, attachment files saved from then on are spread over two levels of subdirectories of the
+ * datastore's attachment directory, named by the start of each file's name, rather than all kept
+ * in the one directory, which slows down once it holds many thousands of files. Files saved
+ * before stay where they are until -moveAttachmentFilesToShardedLayout: moves them.
+ *
+ * Older versions of this library can read attachments in subdirectories, but would delete them
+ * when compacting the datastore.
+ *
+ * Defaults to NO.
+ */
+@property (nonatomic) BOOL shardsAttachmentFiles;
+
+/**
+ * Moves the attachment files saved before shardsAttachmentFiles was set into subdirectories, a
+ * batch at a time, while the datastore is in use. Files no longer needed are deleted in the
+ * background once each is moved. Runs on the calling thread until every file has been moved;
+ * calling it again after it fails carries on where it stopped.
+ *
+ * @param error will point to an error if a file couldn't be moved
+ * @return YES if every file is in a subdirectory
+ */
+- (BOOL)moveAttachmentFilesToShardedLayout:(NSError *__autoreleasing *)error;
+
+/**
+ * Group commit for many small writes. While this is more than 0, documents created, updated or
+ * deleted one at a time by several threads at once are saved in a shared transaction: the first
+ * write waits up to this long for others, or for groupCommitMaxWrites of them, and they're then
+ * committed together. This saves a commit per write at the cost of up to this much latency.
+ *
+ * Each write still succeeds or fails on its own, with the same conflict checking, and returns
+ * only once it has been committed.
+ *
+ * Defaults to 0, which commits each write by itself.
+ */
+@property (nonatomic) NSTimeInterval groupCommitWindow;
+
+/**
+ * Most writes committed in one group. Defaults to 64.
+ */
+@property (nonatomic) NSUInteger groupCommitMaxWrites;
+
+/**
+ * How hard the datastore works to make each write survive a crash or power loss. Can be changed
+ * at any time, for example to CDTDatastoreDurabilityBulkLoad for an initial pull replication and
+ * back once it has finished. Defaults to CDTDatastoreDurabilityFull.
+ */
+@property (nonatomic) CDTDatastoreDurability durability;
+
+/**
+ * Makes every write so far durable, whatever the durability setting: after this returns YES, they
+ * survive a power loss.
+ *
+ * @param error will point to an NSError object in the case of an error
+ */
+- (BOOL)checkpointWithError:(NSError *__nullable * __nullable)error;
+
+/**
+ * Runs the block with one read transaction open on the datastore, so that every read the block
+ * makes, on the thread it's called on, sees the same state of the datastore: for example
+ * documents fetched by -getDocumentsWithIds:, then the documents a query returns, then
+ * -getConflictedDocumentIds all agree, even if a replication is writing meanwhile. The reads share
+ * one transaction instead of each starting its own, and don't hold up writers, nor writers them.
+ *
+ * Query indexes are kept in a database of their own, so they aren't part of the snapshot; a query
+ * finds documents by what its index holds, and reads those documents from the snapshot. The
+ * document cache isn't used, and documents aren't pulled through, within the block. The block
+ * must not write to the datastore, as it wouldn't see its own writes. Calls made within the block
+ * join the snapshot already open.
+ *
+ * @param block the reads to make
+ */
+- (void)performReadsInSnapshot:(nonnull void (^)(void))block;
+
+/**
+ * If YES, document bodies saved from then on are stored in a compact binary form rather than
+ * as JSON text. Such bodies are read without parsing any JSON, and queries which aren't
+ * answered by an index read just the fields they test. Revision IDs and what is replicated
+ * are the same either way, and bodies already saved in either form can always be read.
+ *
+ * Defaults to NO.
+ */
+@property (nonatomic) BOOL storesBinaryBodies;
+
+/**
+ * Names fields most of the app's documents have, so that reading a binary body shares one string
+ * for each of them across every document read, rather than making one for each document. The
+ * _-prefixed properties and attachment properties are always shared. Applies to every datastore
+ * in the process, and to bodies stored with storesBinaryBodies on only.
+ *
+ * @param fieldNames top-level or nested field names, such as `@[ @"type", @"name" ]`
+ */
++ (void)registerCommonFieldNames:(nonnull NSArray<NSString *> *)fieldNames;
+
+/**
+ * Document bodies saved from then on which take at least this many bytes are stored apart from
+ * the datastore's table of revisions, so that a few very large documents don't slow down the
+ * work on that table which doesn't read bodies, such as listing changes for replication. Bodies
+ * already saved stay where they are, and are read the same either way.
+ *
+ * Defaults to 0, which stores every body with its revision.
+ */
+@property (nonatomic) NSUInteger outOfLineBodyThreshold;
+
+/**
+ * If YES, when a document is updated the body of the revision it replaces is stored from then on
+ * as the difference from the new body, where that's much smaller, and rebuilt from it whenever
+ * it's read. For large documents which are edited often this saves most of the space their
+ * history takes up between compactions, which still remove it.
+ *
+ * Defaults to NO.
+ */
+@property (nonatomic) BOOL storesHistoryAsDeltas;
+
+/**
+ * Makes the IDs of documents created without one. It's called while the document is being
+ * saved, from whichever thread is saving it, and must return an ID that isn't in use.
+ *
+ * Random IDs, the default, spread inserts across the whole of the document ID index, and those
+ * of any query indexes. IDs from timeOrderedDocumentIDGenerator are added in order instead, so
+ * bulk inserts touch far fewer pages, and documents created together are next to each other
+ * when read back in ID order.
+ *
+ * Defaults to nil, which makes random UUIDs.
+ */
+@property (nullable, nonatomic, copy) CDTDocumentIDGenerator documentIDGenerator;
+
+/**
+ * A generator of UUIDs laid out as version 7 UUIDs: each starts with the time it was made, and
+ * sorts after every ID made before it by this process.
+ */
++ (nonnull CDTDocumentIDGenerator)timeOrderedDocumentIDGenerator;
+
+/**
+ * Writes a snapshot of the datastore to the directory at `path`, for shipping with an app so
+ * that new installs needn't replicate everything from scratch. The snapshot holds a compacted
+ * copy of the datastore's database and attachments, and a manifest.json describing them and the
+ * replication checkpoints they carry. The directory is created if need be, but mustn't already
+ * hold a snapshot. Encrypted datastores can't be exported.
+ *
+ * Snapshots are installed with -[CDTDatastoreManager datastoreNamed:fromSnapshotAtPath:error:].
+ *
+ * @param path directory to write the snapshot to
+ * @param error will point to an NSError object in the case of an error
+ */
+- (BOOL)exportSnapshotToDirectory:(nonnull NSString *)path
+                            error:(NSError *__nullable * __nullable)error;
+
+/**
+ * Copies the datastore, while it's in use, to a new database file at `path`, with its attachments
+ * beside it. Given a path of the form `directory/name.touchdb`, the copy opens as the datastore
+ * `name` of a CDTDatastoreManager on `directory`.
+ *
+ * The database is copied `pagesPerStep` pages at a time, and writes, including those of running
+ * replications, carry on between steps and are included in the copy. Attachment files are
+ * cloned or hard-linked where the file system allows. The call returns once the copy is
+ * complete; the datastore mustn't be closed before then.
+ *
+ * @param path the database file to create, which mustn't already exist
+ * @param pagesPerStep how many pages to copy a step; more finish sooner but hold up writers
+ *        for longer at a time
+ * @param progress called after each step with the number of pages left and the total, or nil
+ * @param error will point to an NSError object in the case of an error
+ */
+- (BOOL)backupToPath:(nonnull NSString *)path
+        pagesPerStep:(int)pagesPerStep
+            progress:(nullable void (^)(int remainingPages, int totalPages))progress
+               error:(NSError *__nullable * __nullable)error;
+
+/**
+ * Bytes of memory SQLite may use for this datastore. It's shared out as the page caches of the
+ * datastore's database connections, so with RAM to spare a bigger budget saves reading pages
+ * from disk again.
+ *
+ * If the datastore's manager has a memoryBudget, the manager sets this whenever a datastore is
+ * opened or closed.
+ *
+ * Defaults to 0, which keeps SQLite's default of about 2MB a connection.
+ */
+@property (nonatomic) UInt64 memoryBudget;
+
+/**
+ * Bytes of the datastore's database file to memory-map. Pages within the mapping are read
+ * straight from it instead of being copied into the page caches by read() calls, which suits
+ * large datastores that are mostly read. The mapped pages are the system's to evict, so they
+ * don't count towards memoryBudget.
+ *
+ * Has no effect on encrypted datastores. Defaults to 0, no mapping.
+ *
+ * @see -[CDTDatastoreManager datastoreNamed:mmapSize:error:]
+ */
+@property (nonatomic) UInt64 mmapSize;
+
+/**
+ * Frees what memory the datastore can without closing: its document cache, SQLite's page
+ * caches and cached statements. The datastore's manager calls this when the system is low on
+ * memory. The page caches are freed in the background, once the connections are idle.
+ */
+- (void)releaseMemory;
+
 #if TARGET_OS_IPHONE
 /// This function will help to set FILE Protection manually by users.
 /// @param type Its FileProtection Type Enum provided by Apple, user can pass any Protection case whatever they need to set on there files.
@@ -293,4 +897,32 @@ typedef NS_ENUM(NSUInteger, OTFProtectionLevel) {
  */
 
 @property (nullable, nonatomic, weak) NSObject<CDTNSURLSessionConfigurationDelegate> *sessionConfigDelegate;
+
+/**
+ * The remote database documents missing from this datastore are fetched from on demand, for a
+ * datastore which holds only part of that database.
+ *
+ * When this is set, -getDocumentWithId:error: looks for a document it doesn't find locally on
+ * the replication's source, and if the source has the document inserts it, with its history,
+ * before returning it; the caller is blocked while it's fetched, so this shouldn't be used on
+ * the main thread. The replication's target must be this datastore; its filter, selector and
+ * continuous settings are ignored. As a replication keeps its target, the datastore isn't
+ * deallocated until this is set back to nil. -pullThroughDocumentsWithIds:error: fetches
+ * documents explicitly, for example those a query run on the remote database returned.
+ *
+ * A document fetched this way stays in the datastore until it's evicted, either by
+ * -evictPulledThroughDocumentsOlderThan:evicted:error: or, if pullThroughMaxAge is set, by a
+ * later fetch. Documents changed after they were fetched, locally or by a replication, are kept.
+ *
+ * The source must support _bulk_get. Defaults to nil, so missing documents are just not found.
+ */
+@property (nullable, nonatomic, copy) CDTPullReplication *pullThroughReplication;
+
+/**
+ * When greater than zero, documents fetched by pullThroughReplication more than this many
+ * seconds ago are evicted each time more are fetched, unless they've changed since.
+ *
+ * Defaults to 0, which keeps them until -evictPulledThroughDocumentsOlderThan:evicted:error:.
+ */
+@property (nonatomic) NSTimeInterval pullThroughMaxAge;
 @end
@@ -16,16 +16,37 @@
 
 #import "CDTDatastore.h"
 #import "CDTDocumentRevision.h"
+#import "CDTDocumentRevision+Internal.h"
 #import "CDTDatastoreManager.h"
+#import "CDTDocumentCache.h"
+#import "CDTDocumentChange.h"
+#import "CDTQProjectedDocumentRevision.h"
+#import "CDTDatastoreStatistics.h"
+#import "CDTSlowOperationLog.h"
+#import "CDTQueueTelemetry.h"
 #import "CDTAttachment.h"
 #import "CDTDatastore+Attachments.h"
+#import "CDTDatastore+Replication.h"
+#import "CDTDatastore+Query.h"
+#import "CDTDatastore+EncryptionKey.h"
+#import "CDTDatastore+Internal.h"
 #import "CDTEncryptionKeyNilProvider.h"
 #import "CDTLogging.h"
 
 #import "TD_Database.h"
 #import "TD_View.h"
 #import "TD_Body.h"
+#import "TDBinaryJSON.h"
 #import "TD_Database+Insertion.h"
+#import "TD_Database+Archive.h"
+#import "TD_Database+BlobFilenames.h"
+#import "TD_Database+Backup.h"
+#import "TD_Database+Expiry.h"
+#import "TD_Database+Replication.h"
+#import "TD_Database+Rekey.h"
+#import "TD_Database+Snapshot.h"
+#import "TD_Database+Statistics.h"
+#import "TD_Database+Tombstones.h"
 #import "TDInternal.h"
 #import "TDMisc.h"
 #import "Test.h"
@@ -44,15 +65,35 @@
 #import "CDTError.h"
 
 NSString *const CDTDatastoreChangeNotification = @"CDTDatastoreChangeNotification";
+NSString *const CDTDatastoreChangesNotification = @"CDTDatastoreChangesNotification";
+
+// Changes between checks of how much automatic compaction would reclaim
+static const NSUInteger kAutoCompactionCheckInterval = 500;
+// How long each background compaction step may hold up the database
+static const NSTimeInterval kAutoCompactionStepDuration = 0.05;
+// Free pages given back to the file system per background vacuum step
+static const int kAutoVacuumStepPages = 256;
+// How long each background step purging expired documents may hold up the database
+static const NSTimeInterval kExpirySweepStepDuration = 0.05;
+
+@interface CDTDatastore () {
+    NSUInteger _changesSinceCompactionCheck;
+    BOOL _autoCompacting;
+    NSUInteger _outstandingResultSets;  // guarded by self
+    dispatch_source_t _expirySweepTimer;  // guarded by self
+    BOOL _sweepingExpired;
+    dispatch_queue_t _changesQueue;
+    NSMutableArray<CDTDocumentChange *> *_pendingChanges;  // guarded by _changesQueue
+}
 
-@interface CDTDatastore ()
-
-@property (nonatomic, strong, readonly) id<CDTEncryptionKeyProvider> keyProvider;
+// Replaced when the datastore's key is changed
+@property (strong) id<CDTEncryptionKeyProvider> keyProvider;
 #if TARGET_OS_IPHONE
 @property UIBackgroundTaskIdentifier *backgroundTaskIdentifier;
 #endif
 
 @property (readonly, weak) CDTDatastoreManager *manager;
+@property (strong) CDTDocumentCache *documentCache;
 - (void)TDdbChanged:(NSNotification *)n;
 - (BOOL)validateBodyDictionary:(NSDictionary *)body error:(NSError *__autoreleasing *)error;
 
@@ -92,6 +133,11 @@ int runningProcess;
             _database = database;
             _keyProvider = provider;
             _directory = directory;
+            _changesQueue =
+                dispatch_queue_create("com.cloudant.sync.datastore.changes", DISPATCH_QUEUE_SERIAL);
+            _pendingChanges = [NSMutableArray array];
+            _changeNotificationInterval = 0.1;
+            _postsRevisionChangeNotifications = YES;
 
             NSString *dir = [[database path] stringByDeletingLastPathComponent];
             NSString *name = [database name];
@@ -102,6 +148,17 @@ int runningProcess;
                                                      selector:@selector(TDdbChanged:)
                                                          name:TD_DatabaseChangeNotification
                                                        object:database];
+
+            // Finish re-encrypting the attachments of a rekey cut short; they're readable
+            // with either key meanwhile, so the datastore opens even if this fails
+            NSError *rekeyError = nil;
+            if (database.hasUnfinishedRekey &&
+                ![database rekeyAttachmentsWithEncryptionKeyProvider:provider
+                                                            progress:nil
+                                                               error:&rekeyError]) {
+                os_log_error(CDTOSLog, "Datastore %{public}@ couldn't finish its rekey: %{public}@",
+                             database.name, rekeyError);
+            }
             #if TARGET_OS_IPHONE
             [self encryptFile:NSFileProtectionCompleteUnlessOpen];
             #endif
@@ -232,6 +289,7 @@ int runningProcess;
 #endif
 
 - (void)dealloc {
+    if (_expirySweepTimer) dispatch_source_cancel(_expirySweepTimer);
     _database = nil;
     os_log_debug(CDTOSLog, "-dealloc CDTDatastore %{public}@", self);
     [[NSNotificationCenter defaultCenter] removeObserver:self];
@@ -265,10 +323,56 @@ int runningProcess;
      - @"rev": the new TD_Revision,
      - @"source": NSURL of remote db pulled from,
      - @"winner": new winning TD_Revision, _if_ it changed (often same as rev).
+     or, for revisions committed together:
+     - @"revs": NSArray of the new TD_Revisions,
+     - @"winners": NSArray of the new winning TD_Revisions, NSNull where unchanged.
      */
     NSDictionary *nUserInfo = n.userInfo;
     NSMutableDictionary *userInfo = [NSMutableDictionary dictionary];
 
+    [self noteChangesForAutoCompaction:MAX([nUserInfo[@"revs"] count], (NSUInteger)1)];
+
+    CDTDocumentCache *cache = self.documentCache;
+    if (cache) {
+        for (TD_Revision *tdRev in nUserInfo[@"revs"]) {
+            [cache removeDocumentId:tdRev.docID];
+        }
+        TD_Revision *tdRev = nUserInfo[@"rev"];
+        if (tdRev.docID) [cache removeDocumentId:tdRev.docID];
+    }
+
+    [self queueChangesOfRevisions:nUserInfo[@"revs"]
+                                      ?: (nUserInfo[@"rev"] ? @[ nUserInfo[@"rev"] ] : @[])];
+    if (!self.postsRevisionChangeNotifications) {
+        return;
+    }
+
+    if (nil != nUserInfo[@"revs"]) {
+        NSMutableArray *revs = [NSMutableArray array];
+        NSMutableArray *winners = [NSMutableArray array];
+        for (TD_Revision *tdRev in nUserInfo[@"revs"]) {
+            [revs addObject:[[CDTDocumentRevision alloc] initWithDocId:tdRev.docID
+                                                            revisionId:tdRev.revID
+                                                                  body:tdRev.body.properties
+                                                               deleted:tdRev.deleted
+                                                           attachments:@{}
+                                                              sequence:tdRev.sequence]];
+        }
+        for (id winner in nUserInfo[@"winners"]) {
+            TD_Revision *tdRev = $castIf(TD_Revision, winner);
+            [winners addObject:tdRev ? [[CDTDocumentRevision alloc]
+                                           initWithDocId:tdRev.docID
+                                              revisionId:tdRev.revID
+                                                    body:tdRev.body.properties
+                                                 deleted:tdRev.deleted
+                                             attachments:@{}
+                                                sequence:tdRev.sequence]
+                                     : [NSNull null]];
+        }
+        userInfo[@"revs"] = revs;
+        userInfo[@"winners"] = winners;
+    }
+
     if (nil != nUserInfo[@"rev"]) {
         TD_Revision *tdRev = nUserInfo[@"rev"];
         userInfo[@"rev"] = [[CDTDocumentRevision alloc] initWithDocId:tdRev.docID
@@ -298,6 +402,39 @@ int runningProcess;
                                                       userInfo:userInfo];
 }
 
+/*
+ * Adds revisions to the next CDTDatastoreChangesNotification, scheduling it if there isn't one
+ * waiting already.
+ */
+- (void)queueChangesOfRevisions:(NSArray<TD_Revision *> *)tdRevs
+{
+    if (tdRevs.count == 0) {
+        return;
+    }
+    NSMutableArray *changes = [NSMutableArray arrayWithCapacity:tdRevs.count];
+    for (TD_Revision *tdRev in tdRevs) {
+        [changes addObject:[[CDTDocumentChange alloc] initWithDocId:tdRev.docID
+                                                              revId:tdRev.revID
+                                                           sequence:tdRev.sequence
+                                                            deleted:tdRev.deleted]];
+    }
+    int64_t delay = (int64_t)(self.changeNotificationInterval * NSEC_PER_SEC);
+    dispatch_async(_changesQueue, ^{
+        BOOL scheduled = self->_pendingChanges.count > 0;
+        [self->_pendingChanges addObjectsFromArray:changes];
+        if (scheduled) {
+            return;
+        }
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, delay), self->_changesQueue, ^{
+            NSArray *pending = [self->_pendingChanges copy];
+            [self->_pendingChanges removeAllObjects];
+            [[NSNotificationCenter defaultCenter] postNotificationName:CDTDatastoreChangesNotification
+                                                                object:self
+                                                              userInfo:@{ @"changes" : pending }];
+        });
+    });
+}
+
 #pragma mark Datastore implementation
 
 - (NSUInteger)documentCount
@@ -308,11 +445,100 @@ int runningProcess;
     return self.database.documentCount;
 }
 
+- (CDTDatastoreStatistics *)statistics
+{
+    if (![self ensureDatabaseOpen]) {
+        return nil;
+    }
+    return [[CDTDatastoreStatistics alloc] initWithDatabase:self.database];
+}
+
+- (CDTSlowOperationLog *)slowOperationLog { return self.database.slowOperationLog; }
+
+- (CDTQueueTelemetry *)queueTelemetry { return self.database.queueTelemetry; }
+
 - (NSString *)name { return self.database.name; }
 
 // Public method defined in CDTDatastore+EncryptionKey.h
 - (id<CDTEncryptionKeyProvider>)encryptionKeyProvider { return self.keyProvider; }
 
+- (BOOL)isInUse
+{
+    @synchronized (self) {
+        if (_outstandingResultSets > 0) return YES;
+    }
+    // Replicators leave the list once they stop, or when the database closes
+    return _database.isOpen && _database.activeReplicators.count > 0;
+}
+
+- (void)resultSetCreated
+{
+    @synchronized (self) {
+        _outstandingResultSets++;
+    }
+}
+
+- (void)resultSetReleased
+{
+    @synchronized (self) {
+        _outstandingResultSets--;
+    }
+}
+
+// Public method defined in CDTDatastore+EncryptionKey.h
+- (BOOL)rekeyWithEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
+                              progress:(void (^)(NSUInteger, NSUInteger))progress
+                                 error:(NSError *__autoreleasing *)error
+{
+    if (![self ensureDatabaseOpen]) {
+        if (error) {
+            *error = TDStatusToNSError(kTDStatusException, nil);
+        }
+        return NO;
+    }
+    id<CDTEncryptionKeyProvider> oldProvider = self.keyProvider;
+    if (![oldProvider encryptionKey] || ![provider encryptionKey]) {
+        if (error) {
+            NSString *reason = @"Only an encrypted datastore's key can be changed, to another key";
+            *error = TDStatusToNSErrorWithInfo(kTDStatusBadParam, nil,
+                                               @{NSLocalizedFailureReasonErrorKey : reason});
+        }
+        return NO;
+    }
+
+    TD_Database *database = self.database;
+    if (database.hasUnfinishedRekey &&
+        ![database rekeyAttachmentsWithEncryptionKeyProvider:oldProvider progress:nil error:error]) {
+        return NO;
+    }
+
+    // The databases are rekeyed first, as they're only readable with one key, while attachments
+    // are read with either until they've all been re-encrypted: if that's cut short, the
+    // datastore opens with the new key and finishes it. Each database is rekeyed in one go, so
+    // the index database is put back to the old key if the datastore's can't be given the new one
+    if (![database beginRekeyWithError:error]) {
+        return NO;
+    }
+    if (![self rekeyIndexesWithEncryptionKeyProvider:provider error:error]) {
+        [database abandonRekey];
+        return NO;
+    }
+    if (![database rekeyWithEncryptionKeyProvider:provider error:error]) {
+        [self rekeyIndexesWithEncryptionKeyProvider:oldProvider error:nil];
+        [database abandonRekey];
+        return NO;
+    }
+    self.keyProvider = provider;
+
+    if (![database rekeyAttachmentsWithEncryptionKeyProvider:provider
+                                                    progress:progress
+                                                       error:error]) {
+        return NO;
+    }
+    os_log_info(CDTOSLog, "Datastore %{public}@ re-encrypted with a new key", self.name);
+    return YES;
+}
+
 - (CDTDocumentRevision *)getDocumentWithId:(NSString *)docId error:(NSError *__autoreleasing *)error
 {
     return [self getDocumentWithId:docId rev:nil error:error];
@@ -329,9 +555,31 @@ int runningProcess;
         return nil;
     }
 
+    // The cache holds the latest winners, which a snapshot may be older than
+    BOOL inSnapshot = self.database.isInReadSnapshot;
+    CDTDocumentCache *cache = inSnapshot ? nil : self.documentCache;
+    CDTDocumentRevision *cached = [cache revisionWithDocId:docId revId:revId];
+    if (cached) {
+        return cached;
+    }
+    NSUInteger generation = cache.generation;
+
+    // The body's left as stored until it's used, so -documentAsDataError: can hand the JSON to
+    // an object mapper without it being parsed first.
     TDStatus status;
     TD_Revision *rev =
-    [self.database getDocumentWithID:docId revisionID:revId options:0 status:&status];
+    [self.database getDocumentWithID:docId revisionID:revId options:kTDStoredBody status:&status];
+    if (status == kTDStatusNotFound && !revId && self.pullThroughReplication && !inSnapshot) {
+        NSError *pullError;
+        if ([self pullThroughDocumentsWithIds:@[ docId ] error:&pullError]) {
+            rev = [self.database getDocumentWithID:docId
+                                        revisionID:nil
+                                           options:kTDStoredBody
+                                            status:&status];
+        } else {
+            os_log_info(CDTOSLog, "Couldn't pull through %{public}@: %{public}@", docId, pullError);
+        }
+    }
     if (TDStatusIsError(status)) {
         if (error) {
             *error = TDStatusToNSError(status, nil);
@@ -349,71 +597,91 @@ int runningProcess;
 
     CDTDocumentRevision *revision = [[CDTDocumentRevision alloc] initWithDocId:rev.docID
                                                                     revisionId:rev.revID
-                                                                          body:rev.body.properties
+                                                                      bodyJSON:rev.body.asStoredData
                                                                        deleted:rev.deleted
                                                                    attachments:attachmentsDict
                                                                       sequence:rev.sequence];
 
+    // Only a winner is known to keep its body for as long as it's cached
+    if (!revId) {
+        [cache setWinningRevision:revision generation:generation];
+    }
     return revision;
 }
 
 - (nullable NSArray *)getAllDocuments
 {
-    NSError *error;
-    if (![self ensureDatabaseOpen]) {
-        return nil;
-    }
-
-    NSArray *result = [NSArray array];
-    TDContentOptions contentOptions = kTDIncludeLocalSeq;
-    struct TDQueryOptions query = {.limit = UINT_MAX,
-        .inclusiveEnd = YES,
-        .skip = 0,
-        .descending = NO,
-        .includeDocs = YES,
-        .content = contentOptions};
-
-    // This method must loop to get around the fact that conflicted documents
-    // contribute more than one row in the query -getDocsWithIDs:options: uses,
-    // so in the face of conflicted documents, the initial query above will
-    // only return the winning revisions of a subset of the documents.
-    BOOL done = NO;
-    do {
-        NSMutableArray *batch = [NSMutableArray array];
-
-        NSDictionary *dictResults = [self.database getDocsWithIDs:nil options:&query];
+    NSMutableArray *result = [NSMutableArray array];
+    BOOL success = [self enumerateAllDocumentsDescending:NO
+                                              usingBlock:^(CDTDocumentRevision *revision, BOOL *stop) {
+                                                  [result addObject:revision];
+                                              }
+                                                   error:nil];
+    return success ? result : nil;
+}
 
-        for (NSDictionary *row in dictResults[@"rows"]) {
-            NSString *docId = row[@"id"];
-            NSString *revId = row[@"value"][@"rev"];
+// Number of documents read from the database at a time by -enumerateAllDocumentsDescending:...
+#define kEnumerationPageSize 100
 
-            TD_Revision *revision =
-            [[TD_Revision alloc] initWithDocID:docId revID:revId deleted:NO];
-            revision.body = [[TD_Body alloc] initWithProperties:row[@"doc"]];
-            revision.sequence = [row[@"doc"][@"_local_seq"] longLongValue];
+- (BOOL)enumerateAllDocumentsDescending:(BOOL)descending
+                             usingBlock:(void (^)(CDTDocumentRevision *revision, BOOL *stop))block
+                                  error:(NSError *__autoreleasing *)error
+{
+    if (![self ensureDatabaseOpen]) {
+        if (error) {
+            *error = TDStatusToNSError(kTDStatusException, nil);
+        }
+        return NO;
+    }
 
-            NSArray *attachments = [self attachmentsForSeq:revision.sequence error:&error];
-            NSMutableDictionary *dict = [NSMutableDictionary dictionary];
-            for (CDTAttachment *attachment in attachments) {
-                [dict setObject:attachment forKey:attachment.name];
+    // Revisions are passed on a page at a time, once the attachments of the whole page have been
+    // read with one query:
+    __weak CDTDatastore *weakSelf = self;
+    NSMutableArray<TD_Revision *> *page = [NSMutableArray arrayWithCapacity:kEnumerationPageSize];
+    __block BOOL stopped = NO;
+    void (^flushPage)(void) = ^{
+        CDTDatastore *strongSelf = weakSelf;
+        NSMutableArray *seqs = [NSMutableArray arrayWithCapacity:page.count];
+        for (TD_Revision *rev in page) {
+            [seqs addObject:@(rev.sequence)];
+        }
+        NSDictionary *attachments = [strongSelf attachmentsForSeqs:seqs];
+        for (TD_Revision *rev in page) {
+            @autoreleasepool
+            {
+                block([[CDTDocumentRevision alloc] initWithDocId:rev.docID
+                                                      revisionId:rev.revID
+                                                            body:rev.body.properties
+                                                         deleted:rev.deleted
+                                                     attachments:attachments[@(rev.sequence)] ?: @{}
+                                                        sequence:rev.sequence],
+                      &stopped);
             }
-            [batch addObject:[[CDTDocumentRevision alloc] initWithDocId:revision.docID
-                                                             revisionId:revision.revID
-                                                                   body:revision.body.properties
-                                                                deleted:revision.deleted
-                                                            attachments:dict
-                                                               sequence:revision.sequence]];
+            if (stopped) break;
         }
+        [page removeAllObjects];
+    };
+    TDStatus status = [self.database enumerateDocumentsDescending:descending
+                                                         pageSize:kEnumerationPageSize
+                                                          options:0
+                                                       usingBlock:^(TD_Revision *rev, BOOL *stop) {
+                                                           [page addObject:rev];
+                                                           if (page.count >= kEnumerationPageSize) {
+                                                               flushPage();
+                                                               *stop = stopped;
+                                                           }
+                                                       }];
+    if (!TDStatusIsError(status) && !stopped && page.count > 0) {
+        flushPage();
+    }
 
-        result = [result arrayByAddingObjectsFromArray:batch];
-
-        done = ((NSArray *)dictResults[@"rows"]).count == 0;
-
-        query.skip = query.skip + query.limit;
-
-    } while (!done);
-
-    return result;
+    if (TDStatusIsError(status)) {
+        if (error) {
+            *error = TDStatusToNSError(status, nil);
+        }
+        return NO;
+    }
+    return YES;
 }
 
 - (nullable NSArray *)getAllDocumentIds
@@ -429,15 +697,20 @@ int runningProcess;
         .descending = NO,
         .includeDocs = NO};
 
-    NSDictionary *dictResults;
+    __block NSUInteger count;
     do {
-        dictResults = [self.database getDocsWithIDs:nil options:&query];
-        for (NSDictionary *row in dictResults[@"rows"]) {
-            [result addObject:row[@"id"]];
-        }
+        count = 0;
+        [self.database enumerateDocsWithIDs:nil
+                                    options:&query
+                                 usingBlock:^(NSArray<TD_Revision *> *revs, FMDatabase *db) {
+                                     for (TD_Revision *rev in revs) {
+                                         [result addObject:rev.docID];
+                                     }
+                                     count += revs.count;
+                                 }];
 
         query.skip = query.skip + query.limit;
-    } while (((NSArray *)dictResults[@"rows"]).count > 0);
+    } while (count > 0);
 
     return [NSArray arrayWithArray:result];
 
@@ -452,66 +725,231 @@ int runningProcess;
         .skip = (unsigned)offset,
         .descending = descending,
         .includeDocs = YES};
-    return [self allDocsQuery:nil options:&query];
+    return [self allDocsQuery:nil options:&query status:NULL];
 }
 
-- (NSArray *)getDocumentsWithIds:(NSArray *)docIds
+// The least string greater than every one starting with prefix, in the byte order of UTF-8 which
+// docids are sorted by, or nil if there is none.
+static NSString *upperBoundOfPrefix(NSString *prefix)
 {
-    TDContentOptions contentOptions = kTDIncludeLocalSeq;
-    struct TDQueryOptions query = {
-        .limit = UINT_MAX, .inclusiveEnd = YES, .includeDocs = YES, .content = contentOptions};
-    return [self allDocsQuery:docIds options:&query];
+    NSMutableData *utf32 = [[prefix dataUsingEncoding:NSUTF32LittleEndianStringEncoding] mutableCopy];
+    uint32_t *codePoints = utf32.mutableBytes;
+    NSUInteger count = utf32.length / sizeof(uint32_t);
+    while (count > 0) {
+        uint32_t last = codePoints[count - 1];
+        if (last < 0x10FFFF) {
+            codePoints[count - 1] = (last == 0xD7FF) ? 0xE000 : last + 1;  // skipping surrogates
+            return [[NSString alloc] initWithBytes:codePoints
+                                            length:count * sizeof(uint32_t)
+                                          encoding:NSUTF32LittleEndianStringEncoding];
+        }
+        count--;
+    }
+    return nil;
 }
 
-/* docIds can be null for getting all documents */
-- (NSArray *)allDocsQuery:(NSArray *)docIds options:(TDQueryOptions *)queryOptions
+// Continuation tokens hold the ID of the last document of a page, base64-encoded only so that
+// callers don't come to rely on what they hold.
+static NSString *continuationAfterDocId(NSString *docId)
 {
-    NSError *error;
-    if (![self ensureDatabaseOpen]) {
-        return nil;
-    }
-
-    NSMutableArray *result = [NSMutableArray array];
-
-    NSDictionary *dictResults = [self.database getDocsWithIDs:docIds options:queryOptions];
+    return [[docId dataUsingEncoding:NSUTF8StringEncoding] base64EncodedStringWithOptions:0];
+}
 
-    for (NSDictionary *row in dictResults[@"rows"]) {
-        NSString *docId = row[@"id"];
+static NSString *docIdOfContinuation(NSString *continuation)
+{
+    NSData *data = [[NSData alloc] initWithBase64EncodedString:continuation options:0];
+    return data ? [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] : nil;
+}
 
-        NSString *revId = row[@"value"][@"rev"];
-        
-        // If a document isn't found, docId and revId will be null, and row will
-        // contain an @"error" key.
-        if (docId == nil && revId == nil && [row[@"error"] isEqualToString:@"not_found"]) {
-            continue;
-        }
+- (NSArray *)getDocumentsFromId:(NSString *)startId
+                           toId:(NSString *)endId
+                     descending:(BOOL)descending
+                          limit:(NSUInteger)limit
+                   continuation:(NSString *)continuation
+               nextContinuation:(NSString *__autoreleasing *)nextContinuation
+                          error:(NSError *__autoreleasing *)error
+{
+    return [self getDocumentsFromId:startId
+                     inclusiveStart:YES
+                               toId:endId
+                       inclusiveEnd:YES
+                         descending:descending
+                              limit:limit
+                       continuation:continuation
+                   nextContinuation:nextContinuation
+                              error:error];
+}
 
-        // deleted field only present in deleted documents, but to be safe we use
-        // the fact that (BOOL)[nil -boolValue] is false
-        BOOL deleted = (BOOL)[row[@"value"][@"deleted"] boolValue];
+- (NSArray *)getDocumentsWithIdPrefix:(NSString *)prefix
+                           descending:(BOOL)descending
+                                limit:(NSUInteger)limit
+                         continuation:(NSString *)continuation
+                     nextContinuation:(NSString *__autoreleasing *)nextContinuation
+                                error:(NSError *__autoreleasing *)error
+{
+    // The IDs starting with prefix are those from it up to, but not including, its upper bound.
+    NSString *lowerBound = prefix.length > 0 ? prefix : nil;
+    NSString *upperBound = upperBoundOfPrefix(prefix);
+    return [self getDocumentsFromId:descending ? upperBound : lowerBound
+                     inclusiveStart:!descending
+                               toId:descending ? lowerBound : upperBound
+                       inclusiveEnd:descending
+                         descending:descending
+                              limit:limit
+                       continuation:continuation
+                   nextContinuation:nextContinuation
+                              error:error];
+}
 
-        TD_Revision *revision =
-        [[TD_Revision alloc] initWithDocID:docId revID:revId deleted:deleted];
-        revision.sequence = [row[@"doc"][@"_local_seq"] longLongValue];
+- (NSArray *)getDocumentsFromId:(NSString *)startId
+                 inclusiveStart:(BOOL)inclusiveStart
+                           toId:(NSString *)endId
+                   inclusiveEnd:(BOOL)inclusiveEnd
+                     descending:(BOOL)descending
+                          limit:(NSUInteger)limit
+                   continuation:(NSString *)continuation
+               nextContinuation:(NSString *__autoreleasing *)nextContinuation
+                          error:(NSError *__autoreleasing *)error
+{
+    if (nextContinuation) {
+        *nextContinuation = nil;
+    }
 
-        // Deleted documents won't have a `doc` field
-        if (!deleted) {
-            revision.body = [[TD_Body alloc] initWithProperties:row[@"doc"]];
+    // Starting from a continuation, the next page begins just after the last document of the
+    // one before, wherever that came in the range: no rows are read to be skipped over.
+    BOOL exclusiveStart = !inclusiveStart;
+    if (continuation) {
+        NSString *lastDocId = docIdOfContinuation(continuation);
+        if (!lastDocId) {
+            if (error) {
+                *error = TDStatusToNSErrorWithInfo(kTDStatusBadParam, nil, @{
+                    NSLocalizedFailureReasonErrorKey : @"The continuation token isn't valid."
+                });
+            }
+            return nil;
         }
+        startId = lastDocId;
+        exclusiveStart = YES;
+    }
 
-        NSArray *attachments = [self attachmentsForSeq:revision.sequence error:&error];
-        NSMutableDictionary *dict = [NSMutableDictionary dictionary];
-        for (CDTAttachment *attachment in attachments) {
-            [dict setObject:attachment forKey:attachment.name];
+    struct TDQueryOptions query = {.startKey = startId,
+                                   .endKey = endId,
+                                   .limit = limit > 0 ? (unsigned)MIN(limit, UINT_MAX) : UINT_MAX,
+                                   .inclusiveEnd = inclusiveEnd,
+                                   .exclusiveStart = exclusiveStart,
+                                   .descending = descending,
+                                   .includeDocs = YES};
+    TDStatus status;
+    NSArray *result = [self allDocsQuery:nil options:&query status:&status];
+    if (TDStatusIsError(status)) {
+        if (error) {
+            *error = TDStatusToNSError(status, nil);
         }
-        [result addObject:[[CDTDocumentRevision alloc] initWithDocId:revision.docID
-                                                          revisionId:revision.revID
-                                                                body:revision.body.properties
-                                                             deleted:revision.deleted
+        return nil;
+    }
+    if (nextContinuation && limit > 0 && result.count == limit) {
+        *nextContinuation = continuationAfterDocId([result.lastObject docId]);
+    }
+    return result;
+}
+
+- (NSArray *)getDocumentsWithIds:(NSArray *)docIds
+{
+    if (![self ensureDatabaseOpen]) {
+        return nil;
+    }
+
+    NSArray *revs = [self.database getWinningRevisionsWithDocIDs:docIds];
+    NSMutableArray *seqs = [NSMutableArray arrayWithCapacity:revs.count];
+    for (TD_Revision *rev in revs) {
+        if (!rev.deleted) [seqs addObject:@(rev.sequence)];
+    }
+    NSDictionary *attachments = [self attachmentsForSeqs:seqs];
+
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity:revs.count];
+    for (TD_Revision *rev in revs) {
+        NSDictionary *dict = rev.deleted ? @{} : attachments[@(rev.sequence)] ?: @{};
+        // Bodies are parsed from the stored JSON on first use, so callers which only want
+        // IDs or a few fields don't pay to parse every document.
+        [result addObject:[[CDTDocumentRevision alloc] initWithDocId:rev.docID
+                                                          revisionId:rev.revID
+                                                            bodyJSON:rev.body.asStoredData
+                                                             deleted:rev.deleted
                                                          attachments:dict
-                                                            sequence:revision.sequence]];
+                                                            sequence:rev.sequence]];
+    }
+    return result;
+}
+
+- (NSArray *)getDocumentsWithIds:(NSArray *)docIds fields:(NSArray<NSString *> *)fields
+{
+    if (![self ensureDatabaseOpen]) {
+        return nil;
+    }
+
+    NSArray *revs = [self.database getWinningRevisionsWithDocIDs:docIds fields:fields];
+    NSMutableArray *seqs = [NSMutableArray arrayWithCapacity:revs.count];
+    for (TD_Revision *rev in revs) {
+        if (!rev.deleted) [seqs addObject:@(rev.sequence)];
+    }
+    NSDictionary *attachments = [self attachmentsForSeqs:seqs];
+
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity:revs.count];
+    for (TD_Revision *rev in revs) {
+        NSDictionary *dict = rev.deleted ? @{} : attachments[@(rev.sequence)] ?: @{};
+        [result addObject:[[CDTQProjectedDocumentRevision alloc]
+                              initWithDocId:rev.docID
+                                 revisionId:rev.revID
+                                       body:rev.body.properties ?: @{}
+                                    deleted:rev.deleted
+                                attachments:dict
+                                   sequence:rev.sequence
+                                  datastore:self]];
+    }
+    return result;
+}
+
+/* docIds can be null for getting all documents */
+- (NSArray *)allDocsQuery:(NSArray *)docIds
+                  options:(TDQueryOptions *)queryOptions
+                   status:(TDStatus *)outStatus
+{
+    if (![self ensureDatabaseOpen]) {
+        if (outStatus) *outStatus = kTDStatusException;
+        return nil;
     }
 
+    // The revisions are made straight from the rows read, with the attachments of each batch read
+    // in the same transaction by one query, and their bodies left as JSON until they're used. That
+    // saves building, and holding on to, the documents and rows -getDocsWithIDs:options: would
+    // return.
+    NSMutableArray *result = [NSMutableArray array];
+    __weak CDTDatastore *weakSelf = self;
+    TDStatus status = [self.database
+        enumerateDocsWithIDs:docIds
+                     options:queryOptions
+                  usingBlock:^(NSArray<TD_Revision *> *revs, FMDatabase *db) {
+                      CDTDatastore *strongSelf = weakSelf;
+                      NSMutableArray *seqs = [NSMutableArray arrayWithCapacity:revs.count];
+                      for (TD_Revision *rev in revs) {
+                          if (!rev.deleted && rev.sequence > 0) [seqs addObject:@(rev.sequence)];
+                      }
+                      NSDictionary *attachments = [strongSelf attachmentsForSeqs:seqs
+                                                                   inTransaction:db];
+                      for (TD_Revision *rev in revs) {
+                          NSDictionary *dict =
+                              rev.deleted ? @{} : attachments[@(rev.sequence)] ?: @{};
+                          [result addObject:[[CDTDocumentRevision alloc]
+                                                initWithDocId:rev.docID
+                                                   revisionId:rev.revID
+                                                     bodyJSON:rev.body.asStoredData
+                                                      deleted:rev.deleted
+                                                  attachments:dict
+                                                     sequence:rev.sequence]];
+                      }
+                  }];
+
+    if (outStatus) *outStatus = status;
     return result;
 }
 
@@ -591,6 +1029,22 @@ int runningProcess;
 {
     return [_database openWithEncryptionKeyProvider:self.keyProvider];
 }
+
+/**
+ * Runs a block written for -[FMDatabaseQueue inTransaction:] through -[TD_Database inTransaction:],
+ * so that it can be group committed with other writes.
+ * @return YES if the block's changes were committed.
+ */
+- (BOOL)inWriteTransaction:(void (^)(FMDatabase *db, BOOL *rollback))block
+{
+    CDTQueueOperationScope(CDTQueueOperationPut);
+    TDStatus status = [self.database inTransaction:^TDStatus(FMDatabase *db) {
+        BOOL rollback = NO;
+        block(db, &rollback);
+        return rollback ? kTDStatusDBError : kTDStatusOK;
+    }];
+    return !TDStatusIsError(status);
+}
 /**
  * Validates that attachments are keyed by attachment name.
  * @param attachments The attachments dictionary to validate.
@@ -678,7 +1132,7 @@ int runningProcess;
     __block CDTDocumentRevision *saved;
     __weak CDTDatastore *datastore = self;
 
-    [self.database.fmdbQueue inTransaction:^(FMDatabase *db, BOOL *rollback) {
+    BOOL committed = [self inWriteTransaction:^(FMDatabase *db, BOOL *rollback) {
 
         TDStatus status;
         TD_Revision *new = [datastore.database putRevision : converted prevRevisionID
@@ -714,17 +1168,16 @@ int runningProcess;
                 }
             }
             // copy saved attachments
-            for (CDTSavedAttachment *attachment in attachmentsToCopy) {
-                TDStatus status = [self.database copyAttachmentNamed:attachment.name
-                                                        fromSequence:attachment.sequence
-                                                          toSequence:new.sequence
-                                                          inDatabase:db];
-                if (TDStatusIsError(status)) {
-                    *error = TDStatusToNSError(status, nil);
-                    *rollback = YES;
-                    saved = nil;
-                    return;
-                }
+            TDStatus status =
+                [self.database copyAttachmentsNamed:[attachmentsToCopy valueForKey:@"name"]
+                                      fromSequences:[attachmentsToCopy valueForKey:@"sequence"]
+                                         toSequence:new.sequence
+                                         inDatabase:db];
+            if (TDStatusIsError(status)) {
+                *error = TDStatusToNSError(status, nil);
+                *rollback = YES;
+                saved = nil;
+                return;
             }
 
             saved = [[CDTDocumentRevision alloc] initWithDocId:new.docID
@@ -736,6 +1189,12 @@ int runningProcess;
         }
     }];
 
+    if (saved && !committed) {
+        // the commit failed
+        saved = nil;
+        if (error) *error = TDStatusToNSError(kTDStatusDBError, nil);
+    }
+
     if (saved) {
         NSArray *attachmentsFromBlobStore = [self attachmentsForRev:saved error:error];
         NSMutableDictionary *attachmentDict = [NSMutableDictionary dictionary];
@@ -751,10 +1210,12 @@ int runningProcess;
                                                attachments:attachmentDict
                                                   sequence:saved.sequence];
 
-        NSDictionary *userInfo = @{ @"rev" : saved, @"winner" : saved };
-        [[NSNotificationCenter defaultCenter] postNotificationName:CDTDatastoreChangeNotification
-                                                            object:self
-                                                          userInfo:userInfo];
+        if (self.postsRevisionChangeNotifications) {
+            NSDictionary *userInfo = @{ @"rev" : saved, @"winner" : saved };
+            [[NSNotificationCenter defaultCenter] postNotificationName:CDTDatastoreChangeNotification
+                                                                object:self
+                                                              userInfo:userInfo];
+        }
 #if TARGET_OS_IPHONE
         [self encryptFile:NSFileProtectionComplete];
 #endif
@@ -835,7 +1296,7 @@ int runningProcess;
     __block CDTDocumentRevision *result;
     __weak CDTDatastore *datastore = self;
 
-    [self.database.fmdbQueue inTransaction:^(FMDatabase *db, BOOL *rollback) {
+    BOOL committed = [self inWriteTransaction:^(FMDatabase *db, BOOL *rollback) {
         result = [datastore updateDocumentFromTDRevision:converted
                                                    docId:revision.docId
                                                  prevRev:revision.revId
@@ -855,22 +1316,28 @@ int runningProcess;
                     } else {
                         *error = TDStatusToNSError(kTDStatusDBError, nil);
                     }
+                    return;
                 }
             }
-            for (CDTSavedAttachment *attachment in attachmentToCopy) {
-                TDStatus status = [self.database copyAttachmentNamed:attachment.name
-                                                        fromSequence:attachment.sequence
-                                                          toSequence:result.sequence
-                                                          inDatabase:db];
-                if (TDStatusIsError(status)) {
-                    *error = TDStatusToNSError(status, nil);
-                    *rollback = YES;
-                    result = nil;
-                }
+            TDStatus status =
+                [self.database copyAttachmentsNamed:[attachmentToCopy valueForKey:@"name"]
+                                      fromSequences:[attachmentToCopy valueForKey:@"sequence"]
+                                         toSequence:result.sequence
+                                         inDatabase:db];
+            if (TDStatusIsError(status)) {
+                *error = TDStatusToNSError(status, nil);
+                *rollback = YES;
+                result = nil;
             }
         }
     }];
 
+    if (result && !committed) {
+        // the commit failed
+        result = nil;
+        if (error) *error = TDStatusToNSError(kTDStatusDBError, nil);
+    }
+
     if (result) {
         // populate the attachment array with attachments
         NSArray *attachmentsFromBlobStore = [self attachmentsForRev:result error:error];
@@ -887,54 +1354,52 @@ int runningProcess;
                                                 attachments:attachmentDict
                                                    sequence:result.sequence];
 
-        NSDictionary *userInfo = $dict({ @"rev", result }, { @"winner", result });
-        [[NSNotificationCenter defaultCenter] postNotificationName:CDTDatastoreChangeNotification
-                                                            object:self
-                                                          userInfo:userInfo];
+        if (self.postsRevisionChangeNotifications) {
+            NSDictionary *userInfo = $dict({ @"rev", result }, { @"winner", result });
+            [[NSNotificationCenter defaultCenter] postNotificationName:CDTDatastoreChangeNotification
+                                                                object:self
+                                                              userInfo:userInfo];
+        }
     }
 
     return result;
 }
 
-- (CDTDocumentRevision *)updateDocumentFromTDRevision:(TD_Revision *)td_rev
-                                                docId:(NSString *)docId
-                                              prevRev:(NSString *)prevRev
-                                        inTransaction:(FMDatabase *)db
-                                             rollback:(BOOL *)rollback
-                                                error:(NSError *__autoreleasing *)error
+- (NSArray<CDTDocumentRevision *> *)createDocumentsFromRevisions:
+                                       (NSArray<CDTDocumentRevision *> *)revisions
+                                                           error:(NSError *__autoreleasing *)error
 {
-    if (![self ensureDatabaseOpen]) {
-        if  (error) {
-            *error = TDStatusToNSError(kTDStatusException, nil);
-        }
-
-        return nil;
-    }
+    return [self saveDocumentsFromRevisions:revisions updating:NO error:error];
+}
 
-    TD_Revision *revision = [[TD_Revision alloc] initWithDocID:docId revID:nil deleted:NO];
-    revision.body = td_rev.body;
+- (NSArray<CDTDocumentRevision *> *)updateDocumentsFromRevisions:
+                                       (NSArray<CDTDocumentRevision *> *)revisions
+                                                           error:(NSError *__autoreleasing *)error
+{
+    return [self saveDocumentsFromRevisions:revisions updating:YES error:error];
+}
 
-    TDStatus status;
-    TD_Revision *new = [self.database putRevision : revision prevRevisionID : prevRev allowConflict
-                                                  : NO status : &status database : db];
-    if (TDStatusIsError(status)) {
-        if (error) {
-            *error = TDStatusToNSError(status, nil);
-        }
-        *rollback = YES;
-        return nil;
+static NSError *batchError(TDStatus status, NSUInteger index)
+{
+    NSError *error = TDStatusToNSError(status, nil);
+    if (index == NSNotFound) {
+        return error;
     }
-
-    return [[CDTDocumentRevision alloc] initWithDocId:new.docID
-                                           revisionId:new.revID
-                                                 body:new.body.properties
-                                              deleted:new.deleted
-                                          attachments:@{}
-                                             sequence:new.sequence];
+    NSMutableDictionary *userInfo = [error.userInfo mutableCopy] ?: [NSMutableDictionary dictionary];
+    userInfo[@"index"] = @(index);
+    return [NSError errorWithDomain:error.domain code:error.code userInfo:userInfo];
 }
 
-- (CDTDocumentRevision *)deleteDocumentFromRevision:(CDTDocumentRevision *)revision
-                                              error:(NSError *__autoreleasing *)error
+/**
+ Shared implementation of -createDocumentsFromRevisions:error: and
+ -updateDocumentsFromRevisions:error:. Everything which can be done outside the database
+ transaction (validation, streaming attachments to the blob store) is done first, then the
+ revisions and their attachments are inserted in a single transaction.
+ */
+- (NSArray<CDTDocumentRevision *> *)saveDocumentsFromRevisions:
+                                        (NSArray<CDTDocumentRevision *> *)revisions
+                                                      updating:(BOOL)updating
+                                                         error:(NSError *__autoreleasing *)error
 {
     if (![self ensureDatabaseOpen]) {
         if (error) {
@@ -943,14 +1408,180 @@ int runningProcess;
         return nil;
     }
 
-    // A mutable document revision stores the revId in other property
-    NSString *prevRevisionID = revision.revId;
+    NSMutableArray<TD_Revision *> *converted = [NSMutableArray arrayWithCapacity:revisions.count];
+    NSMutableArray *prevRevIDs = [NSMutableArray arrayWithCapacity:revisions.count];
+    NSMutableArray<NSArray *> *downloadedAttachments =
+        [NSMutableArray arrayWithCapacity:revisions.count];
+    NSMutableArray<NSArray *> *attachmentsToCopy =
+        [NSMutableArray arrayWithCapacity:revisions.count];
 
-    TD_Revision *td_revision =
-    [[TD_Revision alloc] initWithDocID:revision.docId revID:nil deleted:YES];
-    TDStatus status;
-    TD_Revision *new = [self.database putRevision:td_revision
-                                   prevRevisionID:prevRevisionID
+    for (NSUInteger i = 0; i < revisions.count; i++) {
+        CDTDocumentRevision *revision = revisions[i];
+
+        if ((updating && !revision.isFullRevision) || !revision.body) {
+            if (error) {
+                *error = batchError(kTDStatusBadRequest, i);
+            }
+            return nil;
+        }
+
+        if (![self validateBodyDictionary:revision.body error:error]) {
+            return nil;
+        }
+
+        if (![self validateAttachments:revision.attachments]) {
+            os_log_debug(CDTOSLog, "Attachments dictionary is not keyed by attachment name. When accessing attachments on saved revisions they will be keyed by attachment name");
+        }
+
+        TD_Revision *rev = [[TD_Revision alloc] initWithDocID:revision.docId revID:nil deleted:NO];
+        rev.body = [[TD_Body alloc] initWithProperties:revision.body];
+        [converted addObject:rev];
+        [prevRevIDs addObject:(updating && revision.revId) ? revision.revId : [NSNull null]];
+
+        NSMutableArray *downloaded = [NSMutableArray array];
+        NSMutableArray *toCopy = [NSMutableArray array];
+        for (NSString *key in revision.attachments) {
+            CDTAttachment *attachment = revision.attachments[key];
+            if (![attachment isKindOfClass:[CDTSavedAttachment class]]) {
+                NSDictionary *attachmentData =
+                    [self streamAttachmentToBlobStore:attachment error:error];
+                if (attachmentData == nil) {
+                    // error out variable set by -stream...
+                    os_log_debug(CDTOSLog, "Error reading %{public}@ from stream for doc %{public}@, abandoning batch", attachment.name, revision.docId);
+                    return nil;
+                }
+                [downloaded addObject:attachmentData];
+            } else {
+                [toCopy addObject:attachment];
+            }
+        }
+        [downloadedAttachments addObject:downloaded];
+        [attachmentsToCopy addObject:toCopy];
+    }
+
+#if TARGET_OS_IPHONE
+    [self encryptFile:NSFileProtectionCompleteUnlessOpen];
+#endif
+
+    __weak CDTDatastore *datastore = self;
+    TDStatus status;
+    NSUInteger failedIndex = NSNotFound;
+    NSArray<TD_Revision *> *saved = [self.database
+           putRevisions:converted
+        prevRevisionIDs:prevRevIDs
+          allowConflict:NO
+            afterInsert:^TDStatus(NSUInteger index, TD_Revision *newRev, FMDatabase *db) {
+                CDTDocumentRevision *placeholder =
+                    [[CDTDocumentRevision alloc] initWithDocId:newRev.docID
+                                                    revisionId:newRev.revID
+                                                          body:@{}
+                                                       deleted:NO
+                                                   attachments:@{}
+                                                      sequence:newRev.sequence];
+                for (NSDictionary *attachment in downloadedAttachments[index]) {
+                    NSError *attachmentError = nil;
+                    if (![datastore addAttachment:attachment
+                                            toRev:placeholder
+                                       inDatabase:db
+                                            error:&attachmentError]) {
+                        return attachmentError.code == SQLITE_FULL ? kTDStatusInsufficientStorage
+                                                                   : kTDStatusDBError;
+                    }
+                }
+                NSArray *toCopy = attachmentsToCopy[index];
+                return [datastore.database copyAttachmentsNamed:[toCopy valueForKey:@"name"]
+                                                  fromSequences:[toCopy valueForKey:@"sequence"]
+                                                     toSequence:newRev.sequence
+                                                     inDatabase:db];
+            }
+                 status:&status
+            failedIndex:&failedIndex];
+
+#if TARGET_OS_IPHONE
+    [self encryptFile:NSFileProtectionComplete];
+#endif
+
+    if (!saved) {
+        if (error) {
+            *error = batchError(status, failedIndex);
+        }
+        return nil;
+    }
+
+    NSMutableArray<CDTDocumentRevision *> *result = [NSMutableArray arrayWithCapacity:saved.count];
+    for (NSUInteger i = 0; i < saved.count; i++) {
+        TD_Revision *new = saved[i];
+        NSMutableDictionary *attachmentDict = [NSMutableDictionary dictionary];
+        if (downloadedAttachments[i].count + attachmentsToCopy[i].count > 0) {
+            for (CDTAttachment *attachment in [self attachmentsForSeq:new.sequence error:error]) {
+                attachmentDict[attachment.name] = attachment;
+            }
+        }
+        [result addObject:[[CDTDocumentRevision alloc] initWithDocId:new.docID
+                                                          revisionId:new.revID
+                                                                body:revisions[i].body
+                                                             deleted:new.deleted
+                                                         attachments:attachmentDict
+                                                            sequence:new.sequence]];
+    }
+    return result;
+}
+
+- (CDTDocumentRevision *)updateDocumentFromTDRevision:(TD_Revision *)td_rev
+                                                docId:(NSString *)docId
+                                              prevRev:(NSString *)prevRev
+                                        inTransaction:(FMDatabase *)db
+                                             rollback:(BOOL *)rollback
+                                                error:(NSError *__autoreleasing *)error
+{
+    if (![self ensureDatabaseOpen]) {
+        if  (error) {
+            *error = TDStatusToNSError(kTDStatusException, nil);
+        }
+
+        return nil;
+    }
+
+    TD_Revision *revision = [[TD_Revision alloc] initWithDocID:docId revID:nil deleted:NO];
+    revision.body = td_rev.body;
+
+    TDStatus status;
+    TD_Revision *new = [self.database putRevision : revision prevRevisionID : prevRev allowConflict
+                                                  : NO status : &status database : db];
+    if (TDStatusIsError(status)) {
+        if (error) {
+            *error = TDStatusToNSError(status, nil);
+        }
+        *rollback = YES;
+        return nil;
+    }
+
+    return [[CDTDocumentRevision alloc] initWithDocId:new.docID
+                                           revisionId:new.revID
+                                                 body:new.body.properties
+                                              deleted:new.deleted
+                                          attachments:@{}
+                                             sequence:new.sequence];
+}
+
+- (CDTDocumentRevision *)deleteDocumentFromRevision:(CDTDocumentRevision *)revision
+                                              error:(NSError *__autoreleasing *)error
+{
+    if (![self ensureDatabaseOpen]) {
+        if (error) {
+            *error = TDStatusToNSError(kTDStatusException, nil);
+        }
+        return nil;
+    }
+
+    // A mutable document revision stores the revId in other property
+    NSString *prevRevisionID = revision.revId;
+
+    TD_Revision *td_revision =
+    [[TD_Revision alloc] initWithDocID:revision.docId revID:nil deleted:YES];
+    TDStatus status;
+    TD_Revision *new = [self.database putRevision:td_revision
+                                   prevRevisionID:prevRevisionID
                                     allowConflict:NO
                                            status:&status];
     if (TDStatusIsError(status)) {
@@ -970,6 +1601,7 @@ int runningProcess;
 
 - (NSArray *)deleteDocumentWithId:(NSString *)docId error:(NSError *__autoreleasing *)error
 {
+    CDTQueueOperationScope(CDTQueueOperationPut);
     __weak CDTDatastore *weakself = self;
     __block NSMutableArray *deletedDocs = [NSMutableArray array];
 
@@ -1006,7 +1638,7 @@ int runningProcess;
         }
     }];
 
-    if (deletedDocs) {
+    if (deletedDocs && self.postsRevisionChangeNotifications) {
         NSDictionary *userInfo = $dict({ @"deletedRevs", deletedDocs });
         [[NSNotificationCenter defaultCenter] postNotificationName:CDTDatastoreChangeNotification
                                                             object:self
@@ -1016,6 +1648,495 @@ int runningProcess;
     return [deletedDocs copy];
 }
 
+- (BOOL)compactWithTimeBudget:(NSTimeInterval)timeBudget
+                    rowBudget:(NSUInteger)rowBudget
+                     finished:(BOOL *)finished
+                        error:(NSError *__autoreleasing *)error
+{
+    TDStatus status =
+        [self.database compactWithTimeBudget:timeBudget rowBudget:rowBudget finished:finished];
+
+    if (TDStatusIsError(status)) {
+        if (error) {
+            *error = TDStatusToNSError(status, nil);
+        }
+        return NO;
+    }
+
+    return YES;
+}
+
+- (NSArray<NSString *> *)compressibleAttachmentTypes
+{
+    return self.database.compressibleAttachmentTypes;
+}
+
+- (void)setCompressibleAttachmentTypes:(NSArray<NSString *> *)compressibleAttachmentTypes
+{
+    self.database.compressibleAttachmentTypes = compressibleAttachmentTypes;
+}
+
+- (NSTimeInterval)groupCommitWindow
+{
+    return self.database.groupCommitWindow;
+}
+
+- (void)setGroupCommitWindow:(NSTimeInterval)groupCommitWindow
+{
+    self.database.groupCommitWindow = groupCommitWindow;
+}
+
+- (NSUInteger)groupCommitMaxWrites
+{
+    return self.database.groupCommitMaxWrites;
+}
+
+- (void)setGroupCommitMaxWrites:(NSUInteger)groupCommitMaxWrites
+{
+    self.database.groupCommitMaxWrites = groupCommitMaxWrites;
+}
+
+- (CDTDatastoreDurability)durability
+{
+    return (CDTDatastoreDurability)self.database.durability;
+}
+
+- (void)setDurability:(CDTDatastoreDurability)durability
+{
+    self.database.durability = (TDDurability)durability;
+}
+
+- (BOOL)checkpointWithError:(NSError *__autoreleasing *)error
+{
+    if (![self ensureDatabaseOpen]) {
+        if (error) {
+            *error = TDStatusToNSError(kTDStatusException, nil);
+        }
+        return NO;
+    }
+
+    TDStatus status = [self.database checkpoint];
+    if (TDStatusIsError(status)) {
+        if (error) {
+            *error = TDStatusToNSError(status, nil);
+        }
+        return NO;
+    }
+    return YES;
+}
+
+- (void)performReadsInSnapshot:(void (^)(void))block
+{
+    if (![self ensureDatabaseOpen]) {
+        block();
+        return;
+    }
+    [self.database inReadSnapshot:block];
+}
+
+- (NSUInteger)revsLimit { return self.database.revsLimit; }
+
+- (void)setRevsLimit:(NSUInteger)revsLimit { self.database.revsLimit = revsLimit; }
+
+- (BOOL)stemsRevisionsOnInsert { return self.database.stemsRevisionsOnInsert; }
+
+- (void)setStemsRevisionsOnInsert:(BOOL)stemsRevisionsOnInsert
+{
+    self.database.stemsRevisionsOnInsert = stemsRevisionsOnInsert;
+}
+
+- (BOOL)storesBinaryBodies { return self.database.storesBinaryBodies; }
+
+- (void)setStoresBinaryBodies:(BOOL)storesBinaryBodies
+{
+    self.database.storesBinaryBodies = storesBinaryBodies;
+}
+
++ (void)registerCommonFieldNames:(NSArray<NSString *> *)fieldNames
+{
+    [TDBinaryJSON registerSharedKeys:fieldNames];
+}
+
+- (NSUInteger)inlineAttachmentThreshold { return self.database.inlineAttachmentThreshold; }
+
+- (void)setInlineAttachmentThreshold:(NSUInteger)inlineAttachmentThreshold
+{
+    self.database.inlineAttachmentThreshold = inlineAttachmentThreshold;
+}
+
+- (BOOL)shardsAttachmentFiles { return self.database.shardsAttachmentFiles; }
+
+- (void)setShardsAttachmentFiles:(BOOL)shardsAttachmentFiles
+{
+    self.database.shardsAttachmentFiles = shardsAttachmentFiles;
+}
+
+- (BOOL)moveAttachmentFilesToShardedLayout:(NSError *__autoreleasing *)error
+{
+    if (![self ensureDatabaseOpen]) {
+        if (error) {
+            *error = TDStatusToNSError(kTDStatusException, nil);
+        }
+        return NO;
+    }
+    return [self.database moveBlobFilesToShardedLayoutWithError:error];
+}
+
+- (NSUInteger)outOfLineBodyThreshold { return self.database.outOfLineBodyThreshold; }
+
+- (void)setOutOfLineBodyThreshold:(NSUInteger)outOfLineBodyThreshold
+{
+    self.database.outOfLineBodyThreshold = outOfLineBodyThreshold;
+}
+
+- (BOOL)storesHistoryAsDeltas { return self.database.storesHistoryAsDeltas; }
+
+- (void)setStoresHistoryAsDeltas:(BOOL)storesHistoryAsDeltas
+{
+    self.database.storesHistoryAsDeltas = storesHistoryAsDeltas;
+}
+
+- (CDTDocumentIDGenerator)documentIDGenerator { return self.database.documentIDGenerator; }
+
+- (void)setDocumentIDGenerator:(CDTDocumentIDGenerator)documentIDGenerator
+{
+    self.database.documentIDGenerator = documentIDGenerator;
+}
+
++ (CDTDocumentIDGenerator)timeOrderedDocumentIDGenerator
+{
+    return ^NSString * { return TDCreateTimeOrderedUUID(); };
+}
+
+- (BOOL)exportSnapshotToDirectory:(NSString *)path error:(NSError *__autoreleasing *)error
+{
+    if (![self ensureDatabaseOpen]) {
+        if (error) {
+            *error = TDStatusToNSError(kTDStatusException, nil);
+        }
+        return NO;
+    }
+    return [self.database exportSnapshotToDirectory:path error:error];
+}
+
+- (BOOL)backupToPath:(NSString *)path
+        pagesPerStep:(int)pagesPerStep
+            progress:(void (^)(int, int))progress
+               error:(NSError *__autoreleasing *)error
+{
+    if (![self ensureDatabaseOpen]) {
+        if (error) {
+            *error = TDStatusToNSError(kTDStatusException, nil);
+        }
+        return NO;
+    }
+    return [self.database backupToPath:path pagesPerStep:pagesPerStep progress:progress error:error];
+}
+
+- (UInt64)memoryBudget { return self.database.memoryBudget; }
+
+- (void)setMemoryBudget:(UInt64)memoryBudget { self.database.memoryBudget = memoryBudget; }
+
+- (UInt64)mmapSize { return self.database.mmapSize; }
+
+- (void)setMmapSize:(UInt64)mmapSize { self.database.mmapSize = mmapSize; }
+
+- (void)releaseMemory
+{
+    [self.documentCache removeAllDocuments];
+    TD_Database *database = self.database;
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+        [database releaseMemory];
+    });
+}
+
+#pragma mark Document cache
+
+- (NSUInteger)documentCacheCapacity { return self.documentCache.capacity; }
+
+- (void)setDocumentCacheCapacity:(NSUInteger)documentCacheCapacity
+{
+    self.documentCache = documentCacheCapacity > 0
+                             ? [[CDTDocumentCache alloc] initWithCapacity:documentCacheCapacity]
+                             : nil;
+}
+
+- (NSUInteger)documentCacheHitCount { return self.documentCache.hitCount; }
+
+- (NSUInteger)documentCacheMissCount { return self.documentCache.missCount; }
+
+#pragma mark Automatic compaction
+
+- (void)noteChangesForAutoCompaction:(NSUInteger)count
+{
+    double threshold = self.autoCompactionThreshold;
+    UInt64 vacuumThreshold = self.autoVacuumThreshold;
+    if (threshold <= 0 && vacuumThreshold == 0) {
+        return;
+    }
+    @synchronized(self) {
+        _changesSinceCompactionCheck += count;
+        if (_changesSinceCompactionCheck < kAutoCompactionCheckInterval || _autoCompacting) {
+            return;
+        }
+        _changesSinceCompactionCheck = 0;
+        _autoCompacting = YES;
+    }
+
+    __weak CDTDatastore *weakSelf = self;
+    TD_Database *database = _database;
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        // Compaction ends by giving back free pages itself, so it comes first
+        if (threshold > 0) {
+            double ratio = [database obsoleteRevisionBodyRatio];
+            if (ratio > threshold) {
+                os_log_info(CDTOSLog, "%{public}@: %{public}.0f%% of revision bodies are obsolete; compacting",
+                            weakSelf, ratio * 100);
+                [weakSelf autoCompactionStep];
+                return;
+            }
+        }
+        if (vacuumThreshold > 0) {
+            UInt64 freeSpace = database.freeSpace;
+            if (freeSpace > vacuumThreshold) {
+                os_log_info(CDTOSLog, "%{public}@: %llu bytes of free pages; vacuuming", weakSelf,
+                            freeSpace);
+                [weakSelf autoVacuumStep];
+                return;
+            }
+        }
+        [weakSelf endAutoCompaction];
+    });
+}
+
+- (void)autoVacuumStep
+{
+    NSUInteger freePages = 0;
+    TDStatus status = [_database incrementalVacuumPages:kAutoVacuumStepPages freePagesLeft:&freePages];
+    if (TDStatusIsError(status) || freePages == 0) {
+        [self endAutoCompaction];
+        return;
+    }
+
+    __weak CDTDatastore *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW,
+                                 (int64_t)(kAutoCompactionStepDuration * NSEC_PER_SEC)),
+                   dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+                       [weakSelf autoVacuumStep];
+                   });
+}
+
+- (void)autoCompactionStep
+{
+    BOOL finished = NO;
+    TDStatus status = [_database compactWithTimeBudget:kAutoCompactionStepDuration
+                                             rowBudget:0
+                                              finished:&finished];
+    if (TDStatusIsError(status) || finished) {
+        [self endAutoCompaction];
+        return;
+    }
+
+    // Leave writers a gap as long as the step before taking the next one
+    __weak CDTDatastore *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW,
+                                 (int64_t)(kAutoCompactionStepDuration * NSEC_PER_SEC)),
+                   dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+                       [weakSelf autoCompactionStep];
+                   });
+}
+
+- (void)endAutoCompaction
+{
+    @synchronized(self) {
+        _autoCompacting = NO;
+    }
+}
+
+- (BOOL)purgeTombstonesOlderThan:(NSTimeInterval)age
+                      timeBudget:(NSTimeInterval)timeBudget
+                          purged:(NSUInteger *)purged
+                        finished:(BOOL *)finished
+                           error:(NSError *__autoreleasing *)error
+{
+    TDStatus status =
+        [self.database purgeTombstonesDeletedBefore:[NSDate dateWithTimeIntervalSinceNow:-age]
+                                 pushedToCheckpoint:nil
+                                         timeBudget:timeBudget
+                                             purged:purged
+                                           finished:finished];
+    if (TDStatusIsError(status)) {
+        if (error) {
+            *error = TDStatusToNSError(status, nil);
+        }
+        return NO;
+    }
+    return YES;
+}
+
+#pragma mark Expiry
+
+- (BOOL)setExpiryDate:(NSDate *)date
+    forDocumentWithId:(NSString *)docId
+                error:(NSError *__autoreleasing *)error
+{
+    if (![self ensureDatabaseOpen]) {
+        if (error) {
+            *error = TDStatusToNSError(kTDStatusException, nil);
+        }
+        return NO;
+    }
+    TDStatus status = [_database setExpiryDate:date forDocumentID:docId];
+    if (TDStatusIsError(status)) {
+        if (error) {
+            *error = TDStatusToNSError(status, nil);
+        }
+        return NO;
+    }
+    return YES;
+}
+
+- (NSDate *)expiryDateForDocumentWithId:(NSString *)docId
+{
+    return [self.database expiryDateOfDocumentID:docId];
+}
+
+- (BOOL)purgeExpiredDocumentsWithTimeBudget:(NSTimeInterval)timeBudget
+                                     purged:(NSUInteger *)purged
+                                   finished:(BOOL *)finished
+                                      error:(NSError *__autoreleasing *)error
+{
+    if (purged) *purged = 0;
+    NSArray<NSString *> *purgedIds = nil;
+    [self openIndexesForPurge];
+    TDStatus status = [self.database purgeDocumentsExpiredBefore:[NSDate date]
+                                                      timeBudget:timeBudget
+                                               purgedDocumentIDs:&purgedIds
+                                                        finished:finished];
+    // Purges aren't changes, so nothing else tells the cache
+    for (NSString *docId in purgedIds) {
+        [self.documentCache removeDocumentId:docId];
+    }
+    if (TDStatusIsError(status)) {
+        if (error) {
+            *error = TDStatusToNSError(status, nil);
+        }
+        return NO;
+    }
+    if (purged) *purged = purgedIds.count;
+    return YES;
+}
+
+- (BOOL)archiveDocumentsPassingTest:(BOOL (^)(CDTDocumentRevision *))test
+                           archived:(NSUInteger *)archived
+                              error:(NSError *__autoreleasing *)error
+{
+    if (archived) *archived = 0;
+    if (![self ensureDatabaseOpen]) {
+        if (error) {
+            *error = TDStatusToNSError(kTDStatusException, nil);
+        }
+        return NO;
+    }
+    NSArray<NSString *> *archivedIds = nil;
+    BOOL ok = [self.database archiveDocumentsPassingTest:^BOOL(TD_Revision *rev) {
+        return test([[CDTDocumentRevision alloc] initWithDocId:rev.docID
+                                                    revisionId:rev.revID
+                                                      bodyJSON:rev.body.asStoredData
+                                                       deleted:rev.deleted
+                                                   attachments:@{}
+                                                      sequence:rev.sequence]);
+    }
+                                     archivedDocumentIDs:&archivedIds
+                                                   error:error];
+    // Documents are archived for being seldom read, so there's no use keeping them in memory
+    for (NSString *docId in archivedIds) {
+        [self.documentCache removeDocumentId:docId];
+    }
+    if (archived) *archived = archivedIds.count;
+    return ok;
+}
+
+- (void)setExpirySweepInterval:(NSTimeInterval)expirySweepInterval
+{
+    @synchronized(self) {
+        _expirySweepInterval = expirySweepInterval;
+        if (_expirySweepTimer) {
+            dispatch_source_cancel(_expirySweepTimer);
+            _expirySweepTimer = nil;
+        }
+        if (expirySweepInterval <= 0) {
+            return;
+        }
+
+        __weak CDTDatastore *weakSelf = self;
+        uint64_t interval = (uint64_t)(expirySweepInterval * NSEC_PER_SEC);
+        _expirySweepTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0,
+                                                   dispatch_get_global_queue(QOS_CLASS_UTILITY, 0));
+        dispatch_source_set_timer(_expirySweepTimer, dispatch_time(DISPATCH_TIME_NOW, interval),
+                                  interval, interval / 10);
+        dispatch_source_set_event_handler(_expirySweepTimer, ^{
+            [weakSelf beginExpirySweep];
+        });
+        dispatch_resume(_expirySweepTimer);
+    }
+}
+
+- (void)beginExpirySweep
+{
+    @synchronized(self) {
+        if (_sweepingExpired) {
+            return;
+        }
+        _sweepingExpired = YES;
+    }
+    [self expirySweepStep];
+}
+
+- (void)expirySweepStep
+{
+    // A datastore its manager has closed is left closed; it's swept again once it reopens
+    NSArray<NSString *> *purgedIds = nil;
+    BOOL finished = NO;
+    TDStatus status = kTDStatusNotFound;
+    if (_database.isOpen) {
+        [self openIndexesForPurge];
+        status = [_database purgeDocumentsExpiredBefore:[NSDate date]
+                                             timeBudget:kExpirySweepStepDuration
+                                      purgedDocumentIDs:&purgedIds
+                                               finished:&finished];
+    }
+    for (NSString *docId in purgedIds) {
+        [self.documentCache removeDocumentId:docId];
+    }
+    if (TDStatusIsError(status) || finished) {
+        @synchronized(self) {
+            _sweepingExpired = NO;
+        }
+        return;
+    }
+
+    // Leave writers a gap as long as the step before taking the next one
+    __weak CDTDatastore *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW,
+                                 (int64_t)(kExpirySweepStepDuration * NSEC_PER_SEC)),
+                   dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+                       [weakSelf expirySweepStep];
+                   });
+}
+
+- (BOOL)vacuumWithError:(NSError *__autoreleasing *)error
+{
+    TDStatus status = [self.database vacuum];
+    if (TDStatusIsError(status)) {
+        if (error) {
+            *error = TDStatusToNSError(status, nil);
+        }
+        return NO;
+    }
+    return YES;
+}
+
 - (BOOL)compactWithError:(NSError *__autoreleasing *)error
 {
     TDStatus status = [self.database compact];
@@ -21,6 +21,22 @@ extern NSString *__nonnull const CDTDatastoreErrorDomain;
 @class CDTDatastore;
 @class TD_DatabaseManager;
 
+/**
+ How hard a datastore works to make each write survive a crash or power loss. Whatever the
+ setting, -[CDTDatastore checkpointWithError:] makes all the writes so far durable.
+ */
+typedef NS_ENUM(NSInteger, CDTDatastoreDurability) {
+    /** Every write is synced to disk before it returns. The default. */
+    CDTDatastoreDurabilityFull = 0,
+    /** Writes are synced to disk in batches, at checkpoints, instead of one at a time. The
+        datastore can't be corrupted, but the last writes before a power loss may be lost. */
+    CDTDatastoreDurabilityNormal,
+    /** Nothing is synced, and revisions received by pull replication are inserted without some
+        consistency checks. For bulk imports, and for replicas that can be pulled again: after a
+        power loss the datastore may be corrupt and need deleting. */
+    CDTDatastoreDurabilityBulkLoad,
+};
+
 /**
  A CDTDatastoreManager manages a group of CDTDatastores. It also manages
  the behind the scenes threading details to ensure the underlying SQLite
@@ -41,6 +57,48 @@ extern NSString *__nonnull const CDTDatastoreErrorDomain;
  */
 - (nullable instancetype)initWithDirectory:(nonnull NSString *)directoryPath error:(NSError * __autoreleasing __nullable * __nullable)outError;
 
+/**
+ Initialises a datastore manager whose datastores are kept in memory, for caches and tests.
+
+ Its datastores are used as any others are, replication and queries included, but their
+ databases are never written to disk: each lasts until it's deleted or the manager goes, and
+ closing it, as maxOpenDatastores may, keeps its documents. Their attachments and query indexes
+ still need files, so they're kept in a temporary directory of the manager's own, which is
+ removed with it. In-memory datastores can't be encrypted.
+
+ To keep a copy of one on disk, use -[CDTDatastore exportSnapshotToDirectory:error:], which a
+ manager of a directory can install with -datastoreNamed:fromSnapshotAtPath:error:, or
+ -[CDTDatastore backupToPath:error:].
+
+ @param outError will point to an NSError object in case of error.
+ */
+- (nullable instancetype)initInMemoryWithError:(NSError * __autoreleasing __nullable * __nullable)outError;
+
+/**
+ Lets the datastores of this manager share their attachments, so an attachment that several of
+ them hold is only stored once, and a pull replication doesn't download an attachment that
+ another datastore already has.
+
+ Datastores opened after this is called use the shared store; call it before opening any.
+ Encrypted datastores keep their attachments to themselves.
+
+ @param error will point to an NSError object in case of error.
+ */
+- (BOOL)enableSharedAttachmentsWithError:(NSError *__autoreleasing __nullable * __nullable)error;
+
+/**
+ Lets other processes, such as the app's extensions, use the same datastores at the same time,
+ for a directory in an App Group container they share.
+
+ Each process then waits for the others' writes to finish rather than failing, and is told when
+ they change a datastore: its caches are brought up to date, and a
+ CDTDatastoreChangeNotification is posted for the revisions they added, as for its own. Reads never wait for writes, in this process or any other.
+
+ Datastores opened after this is called are shared; call it before opening any. Every process
+ using the directory must call it.
+ */
+- (void)enableMultiProcessAccess;
+
 /**
  Returns a datastore for the given name.
 
@@ -51,6 +109,57 @@ extern NSString *__nonnull const CDTDatastoreErrorDomain;
  */
 - (nullable CDTDatastore *)datastoreNamed:(nonnull NSString *)name error:(NSError *__autoreleasing __nullable * __nullable)error;
 
+/**
+ Returns a datastore for the given name, with the given durability.
+
+ If the datastore is already open, its durability is changed.
+
+ @param name datastore name
+ @param durability how hard the datastore should work to make writes durable
+ @param error will point to an NSError object in case of error.
+
+ @see CDTDatastore.durability
+ */
+- (nullable CDTDatastore *)datastoreNamed:(nonnull NSString *)name
+                               durability:(CDTDatastoreDurability)durability
+                                    error:(NSError *__autoreleasing __nullable * __nullable)error;
+
+/**
+ Returns a datastore for the given name, installing it from the snapshot at `path` first if it
+ doesn't exist yet; if it does, the snapshot is ignored. This makes it safe to call on every
+ launch with a snapshot shipped in the app bundle.
+
+ The installed datastore has new UUIDs, so it replicates as a datastore of its own. Its pull
+ replications of the same remote databases, with the same filters, carry on from the checkpoints
+ the snapshot was made with, fetching only what has changed since.
+
+ @param name datastore name
+ @param path directory written by -[CDTDatastore exportSnapshotToDirectory:error:]
+ @param error will point to an NSError object in case of error.
+ */
+- (nullable CDTDatastore *)datastoreNamed:(nonnull NSString *)name
+                       fromSnapshotAtPath:(nonnull NSString *)path
+                                    error:(NSError *__autoreleasing __nullable * __nullable)error;
+
+/**
+ Returns a datastore for the given name, reading up to `mmapSize` bytes of its database file
+ through a memory mapping rather than with read() calls. This is worth it for large datastores
+ which are queried much more than they're written, such as reference data replicated from a
+ server; SQLite caps the mapping at its compile-time SQLITE_MAX_MMAP_SIZE.
+
+ If the datastore is already open, its mapping is changed. Encrypted datastores are never
+ mapped, so there is no variant taking a key provider.
+
+ @param name datastore name
+ @param mmapSize how many bytes of the file to map, or 0 for none
+ @param error will point to an NSError object in case of error.
+
+ @see CDTDatastore.mmapSize
+ */
+- (nullable CDTDatastore *)datastoreNamed:(nonnull NSString *)name
+                                 mmapSize:(UInt64)mmapSize
+                                    error:(NSError *__autoreleasing __nullable * __nullable)error;
+
 /**
  Deletes a datastore for the given name.
 
@@ -61,6 +170,22 @@ extern NSString *__nonnull const CDTDatastoreErrorDomain;
 
  */
 - (BOOL)deleteDatastoreNamed:(nonnull NSString *)name error:(NSError *__autoreleasing __nullable * __nullable)error;
+
+/**
+ Deletes a datastore for the given name, without waiting for its files to be removed.
+
+ As with -deleteDatastoreNamed:error:, the datastore is closed and all its files, including
+ attachments and extensions, go. They are first moved into the manager's trash directory, which
+ takes the same short time however many attachments the datastore had, so the name can be used
+ for a new datastore as soon as this returns; they are then removed on a background queue.
+ Trash left behind by a process that ended before removing it is removed once a manager for the
+ directory is created again.
+
+ @param name datastore name
+ @param error will point to an NSError object in case of error.
+ */
+- (BOOL)deleteDatastoreNamedInBackground:(nonnull NSString *)name
+                                   error:(NSError *__autoreleasing __nullable * __nullable)error;
 - (void)closeDatastoreNamed:(nonnull NSString *)name;
 
 /**
@@ -70,4 +195,30 @@ extern NSString *__nonnull const CDTDatastoreErrorDomain;
  */
 - (nonnull NSArray<NSString*>*)allDatastores;
 
+/**
+ Bytes of memory SQLite may use across all of this manager's open datastores. It's divided
+ evenly between them, as each one's CDTDatastore.memoryBudget, again each time a datastore is
+ opened or closed.
+
+ Whatever the budget, when the system is low on memory the manager has its open datastores
+ release what memory they can; see -[CDTDatastore releaseMemory].
+
+ Defaults to 0, which leaves each datastore's own budget alone.
+ */
+@property (nonatomic) UInt64 memoryBudget;
+
+/**
+ The most datastores this manager keeps open at once. Each open datastore holds several file
+ descriptors (its database, WAL and shared memory files, and those of its index database) and
+ the memory of its connections' page caches.
+
+ Once more are open, the least recently returned by -datastoreNamed:error: and its variants are
+ closed, as -closeDatastoreNamed: would, except those with replications running or with query
+ result sets still around. A closed datastore is opened again when next asked for; if it is still
+ referenced, the same CDTDatastore is returned, and it also reopens by itself when used.
+
+ Defaults to 0, which keeps every datastore open until it's closed.
+ */
+@property (nonatomic) NSUInteger maxOpenDatastores;
+
 @end
@@ -14,13 +14,19 @@
 //  either express or implied. See the License for the specific language governing permissions
 //  and limitations under the License.
 
+#if TARGET_OS_IPHONE
+#import <UIKit/UIKit.h>
+#endif
+
 #import "CDTDatastoreManager.h"
 #import "CDTDatastore+EncryptionKey.h"
+#import "CDTDatastore+Internal.h"
 #import "CDTEncryptionKeyNilProvider.h"
 #import "CDTLogging.h"
 
 #import "TD_DatabaseManager.h"
 #import "TD_Database.h"
+#import "TD_Database+Snapshot.h"
 
 NSString *const CDTDatastoreErrorDomain = @"CDTDatastoreErrorDomain";
 NSString *const CDTExtensionsDirName = @"_extensions";
@@ -29,6 +35,22 @@ NSString *const CDTExtensionsDirName = @"_extensions";
 
 @property NSMutableDictionary<NSString*, CDTDatastore*> *openDatastores;
 
+// One lock per datastore name, so that opening, closing and deleting a datastore are serialised
+// without datastores of different names having to wait for each other.
+@property NSMutableDictionary<NSString*, NSObject*> *datastoreLocks;
+
+// Names of the open datastores, least recently returned first, for maxOpenDatastores.
+@property NSMutableOrderedSet<NSString*> *datastoreUseOrder;
+
+// Datastores closed to stay within maxOpenDatastores, for as long as something else holds them,
+// so that they're handed out again rather than duplicated.
+@property NSMapTable<NSString*, CDTDatastore*> *closedDatastores;
+
+@property (nonatomic, strong) dispatch_source_t memoryPressureSource;
+
+// The directory made by -initInMemoryWithError:, removed in -dealloc.
+@property (nonatomic, copy) NSString *temporaryDirectory;
+
 @end
 
 @implementation CDTDatastoreManager
@@ -38,16 +60,149 @@ NSString *const CDTExtensionsDirName = @"_extensions";
     self = [super init];
     if (self) {
         _openDatastores = [NSMutableDictionary dictionary];
+        _datastoreLocks = [NSMutableDictionary dictionary];
+        _datastoreUseOrder = [NSMutableOrderedSet orderedSet];
+        _closedDatastores = [NSMapTable strongToWeakObjectsMapTable];
         _manager =
             [[TD_DatabaseManager alloc] initWithDirectory:directoryPath options:nil error:outError];
         if (!_manager) {
-            self = nil;
+            return nil;
         }
+        [self observeMemoryPressure];
     }
 
     return self;
 }
 
+- (id)initInMemoryWithError:(NSError **)outError
+{
+    NSString *directory = [NSTemporaryDirectory()
+        stringByAppendingPathComponent:[@"CDTDatastoreManager-"
+                                           stringByAppendingString:[NSUUID UUID].UUIDString]];
+    if (![[NSFileManager defaultManager] createDirectoryAtPath:directory
+                                   withIntermediateDirectories:YES
+                                                    attributes:nil
+                                                         error:outError]) {
+        return nil;
+    }
+    self = [self initWithDirectory:directory error:outError];
+    if (!self) {
+        [[NSFileManager defaultManager] removeItemAtPath:directory error:nil];
+        return nil;
+    }
+    _temporaryDirectory = directory;
+    _manager.inMemory = YES;
+    return self;
+}
+
+- (void)observeMemoryPressure
+{
+    __weak CDTDatastoreManager *weakSelf = self;
+    _memoryPressureSource = dispatch_source_create(
+        DISPATCH_SOURCE_TYPE_MEMORYPRESSURE, 0,
+        DISPATCH_MEMORYPRESSURE_WARN | DISPATCH_MEMORYPRESSURE_CRITICAL,
+        dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0));
+    dispatch_source_set_event_handler(_memoryPressureSource, ^{
+        [weakSelf releaseMemory];
+    });
+    dispatch_resume(_memoryPressureSource);
+
+#if TARGET_OS_IPHONE
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(releaseMemory)
+                                                 name:UIApplicationDidReceiveMemoryWarningNotification
+                                               object:nil];
+#endif
+}
+
+- (void)releaseMemory
+{
+    NSArray<CDTDatastore *> *datastores;
+    @synchronized (self) {
+        datastores = _openDatastores.allValues;
+    }
+    os_log_info(CDTOSLog, "Low on memory; releasing memory of %lu datastores",
+                (unsigned long)datastores.count);
+    for (CDTDatastore *datastore in datastores) {
+        [datastore releaseMemory];
+    }
+}
+
+- (void)setMemoryBudget:(UInt64)memoryBudget
+{
+    @synchronized (self) {
+        _memoryBudget = memoryBudget;
+    }
+    [self shareMemoryBudget];
+}
+
+// Gives each open datastore an equal share of memoryBudget; called whenever datastores are opened
+// or closed.
+- (void)shareMemoryBudget
+{
+    UInt64 budget;
+    NSArray<CDTDatastore *> *datastores;
+    @synchronized (self) {
+        budget = _memoryBudget;
+        datastores = _openDatastores.allValues;
+    }
+    if (budget == 0 || datastores.count == 0) return;
+    for (CDTDatastore *datastore in datastores) {
+        datastore.memoryBudget = budget / datastores.count;
+    }
+}
+
+- (void)setMaxOpenDatastores:(NSUInteger)maxOpenDatastores
+{
+    @synchronized (self) {
+        _maxOpenDatastores = maxOpenDatastores;
+    }
+    [self closeDatastoresBeyondLimitExcept:nil];
+}
+
+// Closes the least recently used idle datastores until no more than maxOpenDatastores are open.
+// Must not be called holding a datastore's lock, as it takes those of the datastores it closes.
+- (void)closeDatastoresBeyondLimitExcept:(NSString *)keptName
+{
+    NSArray<NSString *> *candidates;
+    NSUInteger excess;
+    @synchronized (self) {
+        if (_maxOpenDatastores == 0 || _openDatastores.count <= _maxOpenDatastores) return;
+        excess = _openDatastores.count - _maxOpenDatastores;
+        candidates = _datastoreUseOrder.array;
+    }
+
+    BOOL closedAny = NO;
+    for (NSString *name in candidates) {
+        if (excess == 0) break;
+        if ([name isEqualToString:keptName]) continue;
+        @synchronized ([self lockForDatastoreNamed:name]) {
+            CDTDatastore *ds;
+            @synchronized (self) {
+                ds = _openDatastores[name];
+            }
+            if (ds == nil || ds.isInUse) continue;
+            os_log_debug(CDTOSLog, "closing idle CDTDatastore %{public}@", name);
+            [[ds database] close];
+            @synchronized (self) {
+                [_openDatastores removeObjectForKey:name];
+                [_datastoreUseOrder removeObject:name];
+                [_closedDatastores setObject:ds forKey:name];
+            }
+            excess--;
+            closedAny = YES;
+        }
+    }
+    if (closedAny) [self shareMemoryBudget];
+}
+
+- (BOOL)enableSharedAttachmentsWithError:(NSError *__autoreleasing *)error
+{
+    return [self.manager enableSharedAttachmentStore:error];
+}
+
+- (void)enableMultiProcessAccess { self.manager.multiProcess = YES; }
+
 - (CDTDatastore *)datastoreNamed:(NSString *)name error:(NSError *__autoreleasing *)error
 {
     CDTEncryptionKeyNilProvider *provider = [CDTEncryptionKeyNilProvider provider];
@@ -55,22 +210,118 @@ NSString *const CDTExtensionsDirName = @"_extensions";
     return [self datastoreNamed:name withEncryptionKeyProvider:provider error:error];
 }
 
+- (CDTDatastore *)datastoreNamed:(NSString *)name
+                      durability:(CDTDatastoreDurability)durability
+                           error:(NSError *__autoreleasing *)error
+{
+    CDTEncryptionKeyNilProvider *provider = [CDTEncryptionKeyNilProvider provider];
+
+    return [self datastoreNamed:name
+        withEncryptionKeyProvider:provider
+                       durability:durability
+                            error:error];
+}
+
 - (CDTDatastore *)datastoreNamed:(NSString *)name
        withEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
+                      durability:(CDTDatastoreDurability)durability
+                           error:(NSError *__autoreleasing *)error
+{
+    CDTDatastore *datastore =
+        [self datastoreNamed:name withEncryptionKeyProvider:provider error:error];
+    datastore.durability = durability;
+    return datastore;
+}
+
+- (CDTDatastore *)datastoreNamed:(NSString *)name
+                        mmapSize:(UInt64)mmapSize
                            error:(NSError *__autoreleasing *)error
+{
+    CDTDatastore *datastore = [self datastoreNamed:name error:error];
+    datastore.mmapSize = mmapSize;
+    return datastore;
+}
+
+- (CDTDatastore *)datastoreNamed:(NSString *)name
+              fromSnapshotAtPath:(NSString *)path
+                           error:(NSError *__autoreleasing *)error
+{
+    CDTDatastore *datastore;
+    @synchronized ([self lockForDatastoreNamed:name]) {
+        // An invalid name is left to -openDatastoreNamed:withEncryptionKeyProvider:error: to report
+        TD_Database *db = [self.manager databaseNamed:name];
+        if (db && !db.exists) {
+            os_log_debug(CDTOSLog, "installing CDTDatastore %{public}@ from snapshot", name);
+            if (![db importSnapshotFromDirectory:path error:error]) {
+                return nil;
+            }
+        }
+        datastore = [self openDatastoreNamed:name
+                   withEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]
+                                       error:error];
+    }
+    if (datastore != nil) {
+        [self closeDatastoresBeyondLimitExcept:name];
+    }
+    return datastore;
+}
+
+- (NSObject *)lockForDatastoreNamed:(NSString *)name
 {
     @synchronized (self) {
-        CDTDatastore *datastore = _openDatastores[name];
+        NSObject *lock = _datastoreLocks[name];
+        if (lock == nil) {
+            lock = [[NSObject alloc] init];
+            _datastoreLocks[name] = lock;
+        }
+        return lock;
+    }
+}
+
+- (CDTDatastore *)datastoreNamed:(NSString *)name
+       withEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
+                           error:(NSError *__autoreleasing *)error
+{
+    CDTDatastore *datastore = [self openDatastoreNamed:name
+                             withEncryptionKeyProvider:provider
+                                                 error:error];
+    if (datastore != nil) {
+        [self closeDatastoresBeyondLimitExcept:name];
+    }
+    return datastore;
+}
+
+- (CDTDatastore *)openDatastoreNamed:(NSString *)name
+           withEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
+                               error:(NSError *__autoreleasing *)error
+{
+    // Opening a datastore can take a while, so only opens of the same datastore wait for each
+    // other; the manager itself is only locked to look up and record open datastores.
+    @synchronized ([self lockForDatastoreNamed:name]) {
+        CDTDatastore *datastore;
+        CDTDatastore *closed;
+        @synchronized (self) {
+            datastore = _openDatastores[name];
+            if (datastore != nil) {
+                [_datastoreUseOrder removeObject:name];
+                [_datastoreUseOrder addObject:name];
+            } else {
+                closed = [_closedDatastores objectForKey:name];
+                [_closedDatastores removeObjectForKey:name];
+            }
+        }
         if (datastore != nil) {
             os_log_debug(CDTOSLog, "returning already open CDTDatastore %{public}@", name);
             return datastore;
         }
-        os_log_debug(CDTOSLog, "opening new CDTDatastore %{public}@", name);
 
-        
         NSString *errorReason = nil;
         TD_Database *db = [self.manager databaseNamed:name];
-        if (db) {
+        if (closed && [db openWithEncryptionKeyProvider:provider]) {
+            os_log_debug(CDTOSLog, "reopening CDTDatastore %{public}@", name);
+            datastore = closed;
+        } else if (db) {
+            os_log_debug(CDTOSLog, "opening new CDTDatastore %{public}@", name);
             datastore = [[CDTDatastore alloc] initWithManager:self database:db encryptionKeyProvider:provider directory: [self.manager directory]];
             if (!datastore) {
                 errorReason = NSLocalizedString(@"Wrong key?", nil);
@@ -89,7 +340,11 @@ NSString *const CDTExtensionsDirName = @"_extensions";
         }
         
         if (datastore != nil) {
-            _openDatastores[name] = datastore;
+            @synchronized (self) {
+                _openDatastores[name] = datastore;
+                [_datastoreUseOrder addObject:name];
+            }
+            [self shareMemoryBudget];
         }
         return datastore;
         
@@ -97,28 +352,41 @@ NSString *const CDTExtensionsDirName = @"_extensions";
 }
 
 - (void)closeDatastoreNamed:(NSString *)name {
-    @synchronized (self) {
+    @synchronized ([self lockForDatastoreNamed:name]) {
         os_log_debug(CDTOSLog, "closing CDTDatastore %{public}@", name);
-        CDTDatastore *ds = _openDatastores[name];
+        CDTDatastore *ds;
+        @synchronized (self) {
+            ds = _openDatastores[name];
+        }
         if (ds == nil) {
             // this may not be an issue if delete was already called and it was removed there
             os_log_debug(CDTOSLog, "can't find CDTDatastore to close %{public}@", name);
             return;
         }
         [[ds database] close];
-        [_openDatastores removeObjectForKey:name];
+        @synchronized (self) {
+            [_openDatastores removeObjectForKey:name];
+            [_datastoreUseOrder removeObject:name];
+            [_closedDatastores removeObjectForKey:name];
+        }
+        [self shareMemoryBudget];
     }
 }
 
 - (void)dealloc {
     os_log_debug(CDTOSLog, "-dealloc CDTDatastoreManager %{public}@", self);
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    if (_memoryPressureSource) dispatch_source_cancel(_memoryPressureSource);
     [_openDatastores removeAllObjects];
     _manager = nil;
+    if (_temporaryDirectory) {
+        [[NSFileManager defaultManager] removeItemAtPath:_temporaryDirectory error:nil];
+    }
 }
 
 - (BOOL)deleteDatastoreNamed:(NSString *)name error:(NSError *__autoreleasing *)error
 {
-    @synchronized (self) {
+    @synchronized ([self lockForDatastoreNamed:name]) {
         // first delete the SQLite database and any attachments
         NSError *localError = nil;
         BOOL success = [self.manager deleteDatabaseNamed:name error:&localError];
@@ -138,7 +406,12 @@ NSString *const CDTExtensionsDirName = @"_extensions";
             // remove the open datastore: this ensures that any associated index manager has -dealloc
             // called on it _before_ we attempt to delete its underlying database
             os_log_debug(CDTOSLog, "calling close from delete %{public}@", name);
-            [_openDatastores removeObjectForKey:name];
+            @synchronized (self) {
+                [_openDatastores removeObjectForKey:name];
+                [_datastoreUseOrder removeObject:name];
+                [_closedDatastores removeObjectForKey:name];
+            }
+            [self shareMemoryBudget];
             NSString *dbPath = [self.manager pathForName:name];
             NSString *extPath = [dbPath stringByDeletingLastPathComponent];
             extPath = [extPath
@@ -160,6 +433,49 @@ NSString *const CDTExtensionsDirName = @"_extensions";
     }
 }
 
+- (BOOL)deleteDatastoreNamedInBackground:(NSString *)name error:(NSError *__autoreleasing *)error
+{
+    @synchronized ([self lockForDatastoreNamed:name]) {
+        NSError *localError = nil;
+        NSString *trashDirectory = [self.manager trashDatabaseNamed:name error:&localError];
+        if (!trashDirectory) {
+            if ([localError.domain isEqualToString:kTD_DatabaseManagerErrorDomain] &&
+                (localError.code == kTD_DatabaseManagerErrorCodeInvalidName)) {
+                localError = [NSError errorWithDomain:CDTDatastoreErrorDomain
+                                                 code:404
+                                             userInfo:localError.userInfo];
+            }
+            if (error) *error = localError;
+            return NO;
+        }
+
+        // As in -deleteDatastoreNamed:error:, the index manager has to go before its database
+        @synchronized (self) {
+            [_openDatastores removeObjectForKey:name];
+            [_datastoreUseOrder removeObject:name];
+            [_closedDatastores removeObjectForKey:name];
+        }
+        [self shareMemoryBudget];
+        NSString *dbPath = [self.manager pathForName:name];
+        NSString *extPath = [[dbPath stringByDeletingLastPathComponent]
+            stringByAppendingPathComponent:[name stringByAppendingString:CDTExtensionsDirName]];
+
+        BOOL success = YES;
+        NSFileManager *fm = [NSFileManager defaultManager];
+        BOOL isDirectory;
+        if ([fm fileExistsAtPath:extPath isDirectory:&isDirectory] && isDirectory) {
+            NSString *extTrashPath =
+                [trashDirectory stringByAppendingPathComponent:CDTExtensionsDirName];
+            success = [fm moveItemAtPath:extPath toPath:extTrashPath error:&localError];
+            if (!success && error) {
+                *error = localError;
+            }
+        }
+        [self.manager emptyTrashDirectory:trashDirectory];
+        return success;
+    }
+}
+
 - (NSArray* /* NSString */) allDatastores
 {
     return [self.manager allDatabaseNames];
@@ -0,0 +1,83 @@
+//
+//  CDTDatastoreStatistics.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+@class CDTQueueTimings, TD_Database;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A snapshot of a datastore's size and activity, returned by CDTDatastore -statistics. None of
+ the figures need the database to be scanned, so they are cheap enough to poll, e.g. to feed a
+ dashboard or decide when to compact.
+
+ How far query indexes are behind the datastore is given by CDTDatastore+Query's
+ -indexSequenceLag, as reading it opens the query index database.
+ */
+@interface CDTDatastoreStatistics : NSObject
+
+/** Number of documents which haven't been deleted, the same as CDTDatastore.documentCount. */
+@property (readonly) NSUInteger documentCount;
+
+/** Number of deleted documents whose tombstones are still stored. */
+@property (readonly) NSUInteger deletedDocumentCount;
+
+/** Number of documents in conflict; see CDTDatastore+Conflicts. */
+@property (readonly) NSUInteger conflictedDocumentCount;
+
+/** Number of revisions stored, including deleted, conflicting and non-leaf revisions. */
+@property (readonly) NSUInteger revisionCount;
+
+/** The datastore's latest sequence number. */
+@property (readonly) SInt64 lastSequence;
+
+/** Size in bytes of the database file and of its write-ahead log. */
+@property (readonly) UInt64 databaseFileSize;
+@property (readonly) UInt64 walFileSize;
+
+/** Bytes within the database file which are unused, and that compaction would give back. */
+@property (readonly) UInt64 freeSpace;
+
+/** Bytes taken by the attachment files. */
+@property (readonly) UInt64 attachmentsSize;
+
+/** For each view, keyed by name, how many sequences it has yet to index. */
+@property (readonly) NSDictionary<NSString *, NSNumber *> *viewSequenceLag;
+
+/** SQLite page cache hits and misses over all the datastore's connections since it was opened,
+    and the proportion of page reads which were hits (0 if there have been none). */
+@property (readonly) UInt64 pageCacheHits;
+@property (readonly) UInt64 pageCacheMisses;
+@property (readonly) double pageCacheHitRate;
+
+/** Write transactions run since the datastore was opened, how many of those were rolled back,
+    and how long they took in total and at most. */
+@property (readonly) NSUInteger transactionCount;
+@property (readonly) NSUInteger rolledBackTransactionCount;
+@property (readonly) NSTimeInterval totalTransactionTime;
+@property (readonly) NSTimeInterval maxTransactionTime;
+
+/** How long each kind of operation has waited for the datastore's database connections and then
+    held them, keyed by operation name; see CDTQueueTelemetry. */
+@property (readonly) NSDictionary<NSString *, CDTQueueTimings *> *queueTimings;
+
+/*
+ Private so no docs. Used by CDTDatastore to gather the statistics.
+ */
+- (instancetype)initWithDatabase:(TD_Database *)database;
+
+@end
+
+NS_ASSUME_NONNULL_END
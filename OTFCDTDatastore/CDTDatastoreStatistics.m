@@ -0,0 +1,64 @@
+//
+//  CDTDatastoreStatistics.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTDatastoreStatistics.h"
+#import "CDTQueueTelemetry.h"
+
+#import "TD_Database.h"
+#import "TD_Database+Statistics.h"
+
+@implementation CDTDatastoreStatistics
+
+- (instancetype)initWithDatabase:(TD_Database *)database
+{
+    self = [super init];
+    if (self) {
+        _documentCount = database.documentCount;
+        _deletedDocumentCount = database.deletedDocumentCount;
+        _conflictedDocumentCount = database.conflictedDocumentCount;
+        _revisionCount = database.revisionCount;
+        _lastSequence = database.lastSequence;
+        _databaseFileSize = database.fileSize;
+        _walFileSize = database.walFileSize;
+        _freeSpace = database.freeSpace;
+        _attachmentsSize = database.attachmentStoreSize;
+        _viewSequenceLag = database.viewSequenceLag;
+        [database getPageCacheHits:&_pageCacheHits misses:&_pageCacheMisses];
+        [database getTransactionCount:&_transactionCount
+                           rolledBack:&_rolledBackTransactionCount
+                            totalTime:&_totalTransactionTime
+                              maxTime:&_maxTransactionTime];
+        _queueTimings = database.queueTelemetry.timings;
+    }
+    return self;
+}
+
+- (double)pageCacheHitRate
+{
+    UInt64 reads = _pageCacheHits + _pageCacheMisses;
+    return reads ? (double)_pageCacheHits / reads : 0;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@ %p: %lu docs, %lu revs, %llu bytes (+%llu WAL, "
+                                      @"%llu free, %llu attachments), cache hit rate %.2f, "
+                                      @"%lu transactions>",
+                                      [self class], self, (unsigned long)_documentCount,
+                                      (unsigned long)_revisionCount, _databaseFileSize,
+                                      _walFileSize, _freeSpace, _attachmentsSize,
+                                      self.pageCacheHitRate, (unsigned long)_transactionCount];
+}
+
+@end
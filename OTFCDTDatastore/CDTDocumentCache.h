@@ -0,0 +1,76 @@
+//
+//  CDTDocumentCache.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+@class CDTDocumentRevision;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ An in-memory cache of the winning revisions of the most recently read documents, used by
+ -[CDTDatastore getDocumentWithId:rev:error:].
+
+ Only winning revisions are cached: a winner's body stays in the database until the document
+ changes, which the datastore hears about and removes it for, whereas the body of any other
+ revision can be dropped by compaction.
+
+ Revisions are copied into and out of the cache, so the revisions callers get can be modified
+ freely. A change bumps the generation; a reader passes the generation it saw before reading
+ the revision, so that a revision read just before it was replaced isn't stored.
+
+ The cache is safe to use from several threads.
+ */
+@interface CDTDocumentCache : NSObject
+
+/**
+ @param capacity Number of documents kept; the least recently used are dropped beyond that.
+ */
+- (instancetype)initWithCapacity:(NSUInteger)capacity NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@property (readonly) NSUInteger capacity;
+
+/** Lookups answered from the cache. */
+@property (readonly) NSUInteger hitCount;
+
+/** Lookups that had to go to the database. */
+@property (readonly) NSUInteger missCount;
+
+/** Incremented every time documents are removed from the cache. */
+@property (readonly) NSUInteger generation;
+
+/**
+ Returns a copy of a document's cached winning revision.
+
+ @param revId The revision wanted, or nil for whichever is the winner.
+ */
+- (nullable CDTDocumentRevision *)revisionWithDocId:(NSString *)docId revId:(nullable NSString *)revId;
+
+/**
+ Stores a copy of a document's winning revision.
+
+ @param generation The generation seen before the revision was read; if documents have been
+        removed since then, the revision is not stored.
+ */
+- (void)setWinningRevision:(CDTDocumentRevision *)revision generation:(NSUInteger)generation;
+
+- (void)removeDocumentId:(NSString *)docId;
+
+- (void)removeAllDocuments;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,148 @@
+//
+//  CDTDocumentCache.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#if TARGET_OS_IPHONE
+#import <UIKit/UIKit.h>
+#endif
+
+#import "CDTDocumentCache.h"
+
+#import "CDTDocumentRevision+Internal.h"
+
+/** The body is deep-copied, so neither copy sees changes made to the other. A body not yet
+    parsed stays so, its JSON being immutable. */
+static CDTDocumentRevision *copyRevision(CDTDocumentRevision *revision)
+{
+    NSData *json = revision.unparsedBodyJSON;
+    if (json) {
+        return [[CDTDocumentRevision alloc] initWithDocId:revision.docId
+                                               revisionId:revision.revId
+                                                 bodyJSON:json
+                                                  deleted:revision.deleted
+                                              attachments:revision.attachments
+                                                 sequence:revision.sequence];
+    }
+    return [[CDTDocumentRevision alloc] initWithDocId:revision.docId
+                                           revisionId:revision.revId
+                                                 body:revision.body
+                                              deleted:revision.deleted
+                                          attachments:revision.attachments
+                                             sequence:revision.sequence];
+}
+
+@interface CDTDocumentCache ()
+
+@property (nonatomic, strong, readonly)
+    NSMutableDictionary<NSString *, CDTDocumentRevision *> *revisions;
+
+// docIds, least recently used first
+@property (nonatomic, strong, readonly) NSMutableOrderedSet<NSString *> *recentDocIds;
+
+@property (readwrite) NSUInteger hitCount;
+@property (readwrite) NSUInteger missCount;
+@property (readwrite) NSUInteger generation;
+
+@end
+
+@implementation CDTDocumentCache
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity
+{
+    self = [super init];
+    if (self) {
+        _capacity = MAX(capacity, 1u);
+        _revisions = [NSMutableDictionary dictionary];
+        _recentDocIds = [NSMutableOrderedSet orderedSet];
+
+#if TARGET_OS_IPHONE
+        [[NSNotificationCenter defaultCenter]
+            addObserver:self
+               selector:@selector(removeAllDocuments)
+                   name:UIApplicationDidReceiveMemoryWarningNotification
+                 object:nil];
+#endif
+    }
+    return self;
+}
+
+- (void)dealloc { [[NSNotificationCenter defaultCenter] removeObserver:self]; }
+
+- (CDTDocumentRevision *)revisionWithDocId:(NSString *)docId revId:(NSString *)revId
+{
+    CDTDocumentRevision *cached;
+    @synchronized(self)
+    {
+        cached = self.revisions[docId];
+        if (cached && revId && ![cached.revId isEqualToString:revId]) {
+            cached = nil;
+        }
+        if (!cached) {
+            self.missCount++;
+            return nil;
+        }
+        self.hitCount++;
+        [self touchDocId:docId];
+    }
+    return copyRevision(cached);
+}
+
+- (void)setWinningRevision:(CDTDocumentRevision *)revision generation:(NSUInteger)generation
+{
+    NSString *docId = revision.docId;
+    if (!docId || !revision.revId) return;
+    CDTDocumentRevision *copy = copyRevision(revision);
+
+    @synchronized(self)
+    {
+        if (generation != self.generation) return;
+
+        self.revisions[docId] = copy;
+        [self touchDocId:docId];
+        while (self.recentDocIds.count > self.capacity) {
+            [self.revisions removeObjectForKey:self.recentDocIds.firstObject];
+            [self.recentDocIds removeObjectAtIndex:0];
+        }
+    }
+}
+
+- (void)removeDocumentId:(NSString *)docId
+{
+    @synchronized(self)
+    {
+        [self.revisions removeObjectForKey:docId];
+        [self.recentDocIds removeObject:docId];
+        self.generation++;
+    }
+}
+
+- (void)removeAllDocuments
+{
+    @synchronized(self)
+    {
+        [self.revisions removeAllObjects];
+        [self.recentDocIds removeAllObjects];
+        self.generation++;
+    }
+}
+
+#pragma mark - Private
+
+/** Must be called while holding the lock. */
+- (void)touchDocId:(NSString *)docId
+{
+    [self.recentDocIds removeObject:docId];
+    [self.recentDocIds addObject:docId];
+}
+
+@end
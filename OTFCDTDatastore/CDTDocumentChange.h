@@ -0,0 +1,46 @@
+//
+//  CDTDocumentChange.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+#import "CDTDefines.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A revision added to a datastore, as listed by a CDTDatastoreChangesNotification. It names the
+ revision without holding its body; fetch the document to read that.
+ */
+@interface CDTDocumentChange : NSObject
+
+@property (nonatomic, copy, readonly) NSString *docId;
+
+@property (nonatomic, copy, readonly) NSString *revId;
+
+/** The revision's sequence number in the datastore. */
+@property (nonatomic, readonly) SequenceNumber sequence;
+
+/** YES if the revision deletes the document. */
+@property (nonatomic, readonly, getter=isDeleted) BOOL deleted;
+
+- (instancetype)initWithDocId:(NSString *)docId
+                        revId:(NSString *)revId
+                     sequence:(SequenceNumber)sequence
+                      deleted:(BOOL)deleted NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+NS_ASSUME_NONNULL_END
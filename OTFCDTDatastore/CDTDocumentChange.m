@@ -0,0 +1,40 @@
+//
+//  CDTDocumentChange.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTDocumentChange.h"
+
+@implementation CDTDocumentChange
+
+- (instancetype)initWithDocId:(NSString *)docId
+                        revId:(NSString *)revId
+                     sequence:(SequenceNumber)sequence
+                      deleted:(BOOL)deleted
+{
+    self = [super init];
+    if (self) {
+        _docId = [docId copy];
+        _revId = [revId copy];
+        _sequence = sequence;
+        _deleted = deleted;
+    }
+    return self;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"%@[%@ %@ #%lld%@]", self.class, _docId, _revId, _sequence,
+                                      _deleted ? @" deleted" : @""];
+}
+
+@end
@@ -0,0 +1,45 @@
+//
+//  CDTDocumentRevision+Internal.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTDocumentRevision.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@interface CDTDocumentRevision (Internal)
+
+/**
+ Creates a revision whose body is the JSON stored for it in the database.
+
+ The JSON isn't parsed until the body is first accessed, so revisions whose body is never
+ looked at (e.g., when only the document IDs are wanted) cost no more than their metadata.
+ */
+- (instancetype)initWithDocId:(nullable NSString *)docId
+                   revisionId:(nullable NSString *)revId
+                     bodyJSON:(nullable NSData *)json
+                      deleted:(BOOL)deleted
+                  attachments:(nullable NSDictionary *)attachments
+                     sequence:(SequenceNumber)sequence;
+
+/**
+ The JSON the body will be parsed from, or nil if the body has already been parsed (or
+ the revision wasn't created from JSON).
+
+ Allows callers that only need a few fields to pull them out of the JSON without
+ parsing the whole body.
+ */
+@property (nullable, nonatomic, readonly) NSData *unparsedBodyJSON;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -87,7 +87,9 @@ NS_ASSUME_NONNULL_BEGIN
 /**
  Return document content as an NSData object.
 
- This is often the format an object mapper will require.
+ This is often the format an object mapper will require, such as Swift's JSONDecoder. For a
+ revision read from the datastore whose body hasn't been used yet, this is the JSON as stored,
+ without the body being parsed into a dictionary first.
 
  @param error will point to an NSError object in case of error.
 
@@ -14,8 +14,10 @@
 //  and limitations under the License.
 
 #import "CDTDocumentRevision.h"
+#import "CDTDocumentRevision+Internal.h"
 #import "Attachments/CDTAttachment.h"
 #import "TDJSON.h"
+#import "TDBinaryJSON.h"
 #import "TD_Revision.h"
 #import "TD_Body.h"
 #import "TD_Database.h"
@@ -30,8 +32,36 @@
 @property (nonatomic, strong, readonly) NSArray *conflicts;
 @property (nonatomic, strong, readonly) TD_Body *td_body;
 
+/** Stored JSON the body hasn't yet been parsed from; nil once _body is set. */
+@property (nonatomic, strong) NSData *bodyJSON;
+
 @end
 
+/**
+ The user-visible body for the given document properties, without any "_"-prefixed keys. With
+ `share`, properties nothing else will change, as parsed from JSON, are wrapped copy-on-write
+ rather than copied.
+ */
+static CDTChangedDictionary *userBody(NSDictionary *properties, BOOL share)
+{
+    NSPredicate *_prefixPredicate = [NSPredicate predicateWithFormat:@" self BEGINSWITH '_'"];
+
+    NSArray *keysToRemove = [[properties allKeys] filteredArrayUsingPredicate:_prefixPredicate];
+
+    if (share) {
+        if (keysToRemove.count > 0) {
+            NSMutableDictionary *filtered = [properties mutableCopy];
+            [filtered removeObjectsForKeys:keysToRemove];
+            properties = filtered;
+        }
+        return [CDTChangedDictionary dictionaryWrappingContents:properties];
+    }
+
+    NSMutableDictionary *mutableCopy = [properties mutableCopy];
+    [mutableCopy removeObjectsForKeys:keysToRemove];
+    return [CDTChangedDictionary dictionaryCopyingContents:mutableCopy];
+}
+
 @implementation CDTDocumentRevision
 
 @synthesize docId = _docId;
@@ -92,15 +122,7 @@
         _attachments = [CDTChangedDictionary dictionaryCopyingContents:attachments];
         _sequence = sequence;
         if (!deleted && body) {
-            NSMutableDictionary *mutableCopy = [body mutableCopy];
-
-            NSPredicate *_prefixPredicate =
-                [NSPredicate predicateWithFormat:@" self BEGINSWITH '_'"];
-
-            NSArray *keysToRemove = [[body allKeys] filteredArrayUsingPredicate:_prefixPredicate];
-
-            [mutableCopy removeObjectsForKeys:keysToRemove];
-            _body = [CDTChangedDictionary dictionaryCopyingContents:mutableCopy];
+            _body = userBody(body, NO);
         } else {
             _body = [CDTChangedDictionary dictionaryCopyingContents:@{}];
         }
@@ -118,6 +140,14 @@
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
 - (NSData *)documentAsDataError:(NSError *__autoreleasing *)error
 {
+    // A body still unparsed is handed over as it was stored, saving parsing it only for it to be
+    // serialized again.
+    if (_bodyJSON) {
+        if (![TDBinaryJSON isBinaryJSON:_bodyJSON]) return _bodyJSON;
+        NSData *json = [TDBinaryJSON canonicalJSONWithData:_bodyJSON];
+        if (json) return json;
+    }
+
     NSError *innerError = nil;
 
     NSData *json = [[TDJSON dataWithJSONObject:self.body options:0 error:&innerError] copy];
@@ -142,9 +172,21 @@
 
 - (void)contentOfObjectDidChange:(NSObject *)object { self.changed = YES; }
 
+- (NSMutableDictionary *)body
+{
+    if (_bodyJSON) {
+        NSDictionary *properties = [TD_Body bodyWithJSON:_bodyJSON].properties;
+        _body = userBody(properties ?: @{}, YES);
+        ((CDTChangedDictionary *)_body).delegate = self;
+        _bodyJSON = nil;
+    }
+    return _body;
+}
+
 - (void)setBody:(NSDictionary *)body
 {
     self.changed = YES;
+    _bodyJSON = nil;
 
     // No need to wrap the dictionary with a CDTChangedDictionary
     // because we've already marked ourselves as changed.
@@ -161,3 +203,28 @@
 }
 
 @end
+
+@implementation CDTDocumentRevision (Internal)
+
+- (instancetype)initWithDocId:(NSString *)docId
+                   revisionId:(NSString *)revId
+                     bodyJSON:(NSData *)json
+                      deleted:(BOOL)deleted
+                  attachments:(NSDictionary *)attachments
+                     sequence:(SequenceNumber)sequence
+{
+    self = [self initWithDocId:docId
+                    revisionId:revId
+                          body:nil
+                       deleted:deleted
+                   attachments:attachments
+                      sequence:sequence];
+    if (self && !deleted && json.length > 0) {
+        _bodyJSON = [json copy];
+    }
+    return self;
+}
+
+- (NSData *)unparsedBodyJSON { return _bodyJSON; }
+
+@end
@@ -16,9 +16,13 @@
 #import "CDTFetchChanges.h"
 
 #import "CDTDocumentRevision.h"
+#import "CDTDocumentRevision+Internal.h"
+#import "CDTAttachment.h"
 
 #import "TD_Database.h"
+#import "TD_Body.h"
 #import "CDTDatastore.h"
+#import "CDTDatastore+Attachments.h"
 
 #define CDTFETCHCHANGES_DEFAULT_OPTION_LIMIT 500
 
@@ -68,52 +72,49 @@
     NSUInteger mResultsLimit = self.resultsLimit;
     BOOL thereIsALimit = (mResultsLimit > 0);
 
-    unsigned optionsLimit = CDTFETCHCHANGES_DEFAULT_OPTION_LIMIT;
+    NSUInteger pageLimit = CDTFETCHCHANGES_DEFAULT_OPTION_LIMIT;
     if (thereIsALimit && (mResultsLimit < CDTFETCHCHANGES_DEFAULT_OPTION_LIMIT)) {
-        optionsLimit = (unsigned)mResultsLimit;
+        pageLimit = mResultsLimit;
     }
 
-    TDChangesOptions options = {
-        .limit = optionsLimit,
-        .contentOptions = 0,
-        .includeDocs = NO,  // we only need the docIDs and sequences, body is retrieved separately
-        .includeConflicts = FALSE,
-        .sortBySequence = TRUE};
-
     BOOL doLoop = YES;
-    TD_RevisionList *changes;
     SequenceNumber lastSequence = [self.mStartSequenceValue longLongValue];
 
     while (doLoop && ![self isCancelled]) {
-        changes = [[self.mDatastore database] changesSinceSequence:lastSequence
-                                                           options:&options
-                                                            filter:nil
-                                                            params:nil];
         if (!thereIsALimit || (mResultsLimit > 0)) {
-            lastSequence = [self notifyChanges:changes startingSequence:lastSequence];
+            NSUInteger count = 0;
+            lastSequence = [self notifyChangesSinceSequence:lastSequence
+                                                      limit:pageLimit
+                                                      count:&count];
 
-            if (changes.count == 0) {
+            if (count == 0) {
                 // There are not more data coming and we can stop looping.
                 doLoop = NO;
             } else if (thereIsALimit) {  // (mResultsLimit > 0)
                 // Subtract the results so far
-                mResultsLimit -= [changes count];
+                mResultsLimit -= count;
 
-                if (mResultsLimit == 0) {
-                    // We reached the limit but we need to know if there are more data coming.
-                    // Loop again
-                    options.limit = 1;
-                } else {
+                if (mResultsLimit > 0) {
                     // Limit not reached yet. Loop again.
-                    options.limit = (mResultsLimit < CDTFETCHCHANGES_DEFAULT_OPTION_LIMIT
-                                         ? (unsigned)mResultsLimit
-                                         : CDTFETCHCHANGES_DEFAULT_OPTION_LIMIT);
+                    pageLimit = (mResultsLimit < CDTFETCHCHANGES_DEFAULT_OPTION_LIMIT
+                                     ? mResultsLimit
+                                     : CDTFETCHCHANGES_DEFAULT_OPTION_LIMIT);
                 }
+                // Otherwise we reached the limit but we need to know if there are more data
+                // coming. Loop again.
             }
         } else {  // (mResultsLimit == 0)
             // Limit was reached in the previous loop. We only need to know if there are more data
             // lastSequence
-            _moreComing = (changes.count > 0);
+            __block BOOL changed = NO;
+            [[self.mDatastore database]
+                enumerateWinningChangesSinceSequence:lastSequence
+                                               limit:1
+                                          usingBlock:^(SequenceNumber sequence, TD_Revision *winner,
+                                                       BOOL *stop) {
+                                              changed = YES;
+                                          }];
+            _moreComing = changed;
 
             doLoop = NO;
         }
@@ -133,56 +134,76 @@
 
 /*
  Process a batch of changes and return the last sequence value in the changes.
- 
- This method works out whether each change is an update/create or a delete, and calls
- the user-provided callback for each.
- 
- @param changes changes come from the from the -changesSinceSequence:options:filter:params: call
- @param startingSequence the sequence value used for the list passed in `changes`.
+
+ This method reads the winning revision of each document changed since `startingSequence`,
+ works out whether it is an update/create or a delete, and calls the user-provided callback
+ for each. The changes and their winners come from a single query; the winner may not be the
+ revision which changed last (e.g., a tombstone on a long branch of a conflicted document).
+
+ @param startingSequence the sequence value to read changes after.
             This is returned if no changes are processed.
- 
- @return Last sequence number in the changes processed, used for the next _changes call.
+ @param limit the maximum number of changes to process.
+ @param count set to the number of changes read.
+
+ @return Last sequence number in the changes processed, used for the next call.
  */
-- (SequenceNumber)notifyChanges:(TD_RevisionList *)changes
-               startingSequence:(SequenceNumber)startingSequence
+- (SequenceNumber)notifyChangesSinceSequence:(SequenceNumber)startingSequence
+                                       limit:(NSUInteger)limit
+                                       count:(NSUInteger *)count
 {
+    *count = 0;
     if ([self isCancelled]) {
         return startingSequence;  // processed no changes
     }
 
-    SequenceNumber lastSequence = startingSequence;
-    
-    // _changes provides the revs with highest rev ID, which might not be the
-    // winning revision (e.g., tombstone on long doc branch). For all docs
-    // that are updated rather than deleted, we need to be sure we index the
-    // winning revision. This loop gets those revisions.
-    NSMutableDictionary *updatedRevisions = [NSMutableDictionary dictionary];
-    for (CDTDocumentRevision *rev in [self.mDatastore getDocumentsWithIds:[changes allDocIDs]]) {
-        if (rev != nil && !rev.deleted) {
-            updatedRevisions[rev.docId] = rev;
+    __block SequenceNumber lastSequence = startingSequence;
+    __block NSUInteger changeCount = 0;
+    __weak CDTFetchChanges *weakSelf = self;
+    [[self.mDatastore database]
+        enumerateWinningChangesSinceSequence:startingSequence
+                                       limit:limit
+                                  usingBlock:^(SequenceNumber sequence, TD_Revision *winner,
+                                               BOOL *stop) {
+                                      CDTFetchChanges *strongSelf = weakSelf;
+                                      if ([strongSelf isCancelled]) {
+                                          // We processed changes up to lastSequence
+                                          *stop = YES;
+                                          return;
+                                      }
+                                      changeCount++;
+                                      [strongSelf notifyWinner:winner];
+                                      lastSequence = sequence;
+                                  }];
+
+    *count = changeCount;
+    return lastSequence;
+}
+
+- (void)notifyWinner:(TD_Revision *)winner
+{
+    if (winner.deleted) {
+        if (self.mDocumentWithIDWasDeletedBlock) {
+            self.mDocumentWithIDWasDeletedBlock(winner.docID);
         }
+        return;
     }
-    
-    for (TD_Revision *change in changes) {
-        if ([self isCancelled]) {
-            return lastSequence;  // We processed changes up to this sequence
-        }
 
-        CDTDocumentRevision *updatedRevision;
-        if ((updatedRevision = updatedRevisions[change.docID]) != nil) {
-            if (self.mDocumentChangedBlock) {
-                self.mDocumentChangedBlock(updatedRevision);
-            }
-        } else {
-            if (self.mDocumentWithIDWasDeletedBlock) {
-                self.mDocumentWithIDWasDeletedBlock(change.docID);
-            }
-        }
-        
-        lastSequence = change.sequence;
+    if (!self.mDocumentChangedBlock) {
+        return;
     }
-    
-    return lastSequence;
+    NSMutableDictionary *attachments = [NSMutableDictionary dictionary];
+    for (CDTAttachment *attachment in [self.mDatastore attachmentsForSeq:winner.sequence
+                                                                   error:nil]) {
+        attachments[attachment.name] = attachment;
+    }
+    // Bodies are parsed from the stored JSON on first use, as by -getDocumentsWithIds:.
+    self.mDocumentChangedBlock(
+        [[CDTDocumentRevision alloc] initWithDocId:winner.docID
+                                        revisionId:winner.revID
+                                          bodyJSON:winner.body.asStoredData
+                                           deleted:NO
+                                       attachments:attachments
+                                          sequence:winner.sequence]);
 }
 
 
@@ -15,7 +15,9 @@
 //  either express or implied. See the License for the specific language governing permissions
 //  and limitations under the License.
 
+#import <Foundation/Foundation.h>
 #import <os/log.h>
+#import <os/signpost.h>
 
 #ifndef _CDTLogging_h
 #define _CDTLogging_h
@@ -33,5 +35,80 @@
 
 #define CDTOSLog os_log_create(NSBundle.mainBundle.bundleIdentifier.UTF8String, @"CDTOSLog".UTF8String)
 
+/*
+
+ os_signpost intervals, which let Instruments attribute time to the library's subsystems (inserts,
+ query indexing and execution, blob writes, replicator batches and HTTP requests), and points of
+ interest for one-off events such as checkpoints and 429 backoffs.
+
+ When nothing is recording signposts, each macro costs an OS version check and a check of whether
+ the log is enabled. As with os_signpost itself, names and formats must be string literals.
+
+ */
+
+static inline os_log_t CDTSignpostLogWithCategory(const char *category)
+{
+    const char *subsystem = NSBundle.mainBundle.bundleIdentifier.UTF8String;
+    return os_log_create(subsystem ?: "CDTDatastore", category);
+}
+
+/** The log signpost intervals go to. */
+static inline os_log_t CDTSignpostLog(void)
+{
+    static os_log_t log;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{ log = CDTSignpostLogWithCategory("CDTSignposts"); });
+    return log;
+}
+
+/** The log signpost events go to, which Instruments shows as points of interest. */
+static inline os_log_t CDTPointsOfInterestLog(void)
+{
+    static os_log_t log;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{ log = CDTSignpostLogWithCategory("PointsOfInterest"); });
+    return log;
+}
+
+/** A new ID, for an interval that may overlap others of the same name. */
+static inline os_signpost_id_t CDTSignpostIDGenerate(void)
+{
+    if (@available(macOS 10.14, iOS 12.0, tvOS 12.0, watchOS 5.0, *)) {
+        return os_signpost_id_generate(CDTSignpostLog());
+    }
+    return OS_SIGNPOST_ID_NULL;
+}
+
+/** The ID of an object's intervals, for intervals that never overlap others on the same object. */
+static inline os_signpost_id_t CDTSignpostIDForObject(const void *object)
+{
+    if (@available(macOS 10.14, iOS 12.0, tvOS 12.0, watchOS 5.0, *)) {
+        return os_signpost_id_make_with_pointer(CDTSignpostLog(), object);
+    }
+    return OS_SIGNPOST_ID_NULL;
+}
+
+#define CDTSignpostIntervalBegin(spid, name, ...)                                          \
+    do {                                                                                   \
+        if (@available(macOS 10.14, iOS 12.0, tvOS 12.0, watchOS 5.0, *)) {                \
+            os_signpost_interval_begin(CDTSignpostLog(), (spid), name, ##__VA_ARGS__);     \
+        }                                                                                  \
+    } while (0)
+
+#define CDTSignpostIntervalEnd(spid, name, ...)                                            \
+    do {                                                                                   \
+        if (@available(macOS 10.14, iOS 12.0, tvOS 12.0, watchOS 5.0, *)) {                \
+            os_signpost_interval_end(CDTSignpostLog(), (spid), name, ##__VA_ARGS__);       \
+        }                                                                                  \
+    } while (0)
+
+#define CDTSignpostEvent(name, ...)                                                        \
+    do {                                                                                   \
+        if (@available(macOS 10.14, iOS 12.0, tvOS 12.0, watchOS 5.0, *)) {                \
+            os_signpost_event_emit(CDTPointsOfInterestLog(), OS_SIGNPOST_ID_EXCLUSIVE, name, \
+                                   ##__VA_ARGS__);                                         \
+        }                                                                                  \
+    } while (0)
+
 
 #endif
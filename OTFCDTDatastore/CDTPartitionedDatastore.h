@@ -0,0 +1,153 @@
+//
+//  CDTPartitionedDatastore.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "CDTDatastore.h"
+
+@class CDTDatastoreManager;
+@class CDTDocumentChange;
+@class CDTDocumentRevision;
+@class CDTPushReplication;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A datastore split across several of a manager's datastores, its partitions, for write-heavy
+ apps: each partition has a database and a writer of its own, so writes to documents in
+ different partitions run side by side rather than one after another.
+
+ Each document lives in one partition, picked by a hash of its ID that doesn't change between
+ runs, so the partition count is fixed once the partitioned datastore has been created. The
+ partitions are named `name_p<index>of<count>`, and are ordinary datastores: they can be used
+ directly, for example to replicate or compact them, as long as every document is written to
+ the partition -partitionForDocumentId: gives for its ID.
+
+ Writes of a batch are atomic within each partition, not across them. The manager should be able
+ to keep every partition open at once (see CDTDatastoreManager.maxOpenDatastores).
+ */
+@interface CDTPartitionedDatastore : NSObject
+
+/**
+ Opens the partitioned datastore `name` of a manager, creating its partitions if need be.
+
+ @param count how many partitions there are. It must be the same every time the datastore is
+        opened, and it fails with an error if partitions of another count are found.
+ */
+- (nullable instancetype)initWithManager:(CDTDatastoreManager *)manager
+                                    name:(NSString *)name
+                          partitionCount:(NSUInteger)count
+                                   error:(NSError *__autoreleasing __nullable * __nullable)error
+    NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@property (readonly) CDTDatastoreManager *manager;
+
+@property (readonly) NSString *name;
+
+/** The partitions, in index order. */
+@property (readonly) NSArray<CDTDatastore *> *partitions;
+
+/** The partition that holds, or would hold, the document with this ID. */
+- (CDTDatastore *)partitionForDocumentId:(NSString *)docId;
+
+/** Makes the IDs of documents created without one, as CDTDatastore.documentIDGenerator does; the
+    ID is made before the document's partition is picked. Defaults to nil, for random UUIDs. */
+@property (nullable, copy) CDTDocumentIDGenerator documentIDGenerator;
+
+/** Number of documents which haven't been deleted, over all the partitions. */
+@property (readonly) NSUInteger documentCount;
+
+#pragma mark CRUD
+
+- (nullable CDTDocumentRevision *)getDocumentWithId:(NSString *)docId
+                                              error:(NSError *__nullable * __nullable)error;
+
+- (nullable CDTDocumentRevision *)getDocumentWithId:(NSString *)docId
+                                                rev:(nullable NSString *)revId
+                                              error:(NSError *__nullable * __nullable)error;
+
+/** The current revisions of the documents with these IDs that exist, in the order of `docIds`.
+    Each partition's documents are read at the same time as the others'. */
+- (NSArray<CDTDocumentRevision *> *)getDocumentsWithIds:(NSArray<NSString *> *)docIds;
+
+- (nullable CDTDocumentRevision *)createDocumentFromRevision:(CDTDocumentRevision *)revision
+                                                       error:(NSError *__nullable * __nullable)error;
+
+/**
+ Creates several documents, each partition's in a single transaction of its own, with the
+ partitions written to at the same time. If one partition's documents fail, documents may still
+ have been created in the others.
+
+ @return the created document revisions, in the same order as revisions, or nil if any failed
+ */
+- (nullable NSArray<CDTDocumentRevision *> *)
+createDocumentsFromRevisions:(NSArray<CDTDocumentRevision *> *)revisions
+                       error:(NSError *__nullable * __nullable)error;
+
+- (nullable CDTDocumentRevision *)updateDocumentFromRevision:(CDTDocumentRevision *)revision
+                                                       error:(NSError *__nullable * __nullable)error;
+
+- (nullable CDTDocumentRevision *)deleteDocumentFromRevision:(CDTDocumentRevision *)revision
+                                                       error:(NSError *__nullable * __nullable)error;
+
+- (nullable NSArray<CDTDocumentRevision *> *)deleteDocumentWithId:(NSString *)docId
+                                                            error:(NSError *__nullable * __nullable)error;
+
+#pragma mark Changes
+
+/**
+ Lists the documents changed since `token`, with their winning revisions, taking changes from
+ each partition in turn so that none is left behind the others.
+
+ @param token where the previous call left off, or nil for every change. Tokens are made of
+        each partition's sequence, and are only good for this partitioned datastore.
+ @param limit most changes to list, or 0 for no limit
+ @param nextToken on return, the token to list later changes from
+ @return the changes, or nil with `error` set if `token` isn't one of this datastore's
+ */
+- (nullable NSArray<CDTDocumentChange *> *)changesSinceToken:(nullable NSString *)token
+                                                       limit:(NSUInteger)limit
+                                                   nextToken:(NSString *__nullable * __nullable)nextToken
+                                                       error:(NSError *__nullable * __nullable)error;
+
+#pragma mark Query
+
+/** Creates the index in every partition, as -[CDTDatastore ensureIndexed:withName:] does.
+    @return The name of the index, or nil if it couldn't be created in every partition. */
+- (nullable NSString *)ensureIndexed:(NSArray<NSString *> *)fieldNames
+                            withName:(NSString *)indexName;
+
+/** Finds documents in every partition, merged as
+    -[CDTDatastoreManager find:inDatastoresNamed:skip:limit:fields:sort:] merges them.
+    @return The matching revisions, or nil if the query failed. */
+- (nullable NSArray<CDTDocumentRevision *> *)find:(NSDictionary *)query
+                                             skip:(NSUInteger)skip
+                                            limit:(NSUInteger)limit
+                                           fields:(nullable NSArray *)fields
+                                             sort:(nullable NSArray *)sortDocument;
+
+/** The number of documents matching a query over all the partitions, or NSNotFound if it failed
+    in any of them. */
+- (NSUInteger)count:(NSDictionary *)query;
+
+#pragma mark Replication
+
+/** A push replication from each partition to `target`. Their documents don't overlap, so they
+    can all be run at once; each keeps its own checkpoint. */
+- (NSArray<CDTPushReplication *> *)pushReplicationsWithTarget:(NSURL *)target;
+
+@end
+
+NS_ASSUME_NONNULL_END
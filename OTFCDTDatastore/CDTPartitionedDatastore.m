@@ -0,0 +1,369 @@
+//
+//  CDTPartitionedDatastore.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTPartitionedDatastore.h"
+#import "CDTDatastoreManager.h"
+#import "CDTDatastoreManager+Query.h"
+#import "CDTDatastore+Query.h"
+#import "CDTDocumentChange.h"
+#import "CDTDocumentRevision.h"
+#import "CDTPushReplication.h"
+#import "CDTLogging.h"
+#import "TD_Database.h"
+#import "TD_Revision.h"
+#import "TDMisc.h"
+#import "TDStatus.h"
+#import "CollectionUtils.h"
+
+static NSError *partitionError(NSString *reason)
+{
+    return TDStatusToNSErrorWithInfo(kTDStatusBadParam, nil,
+                                     @{NSLocalizedFailureReasonErrorKey : reason});
+}
+
+/** FNV-1a over the ID's UTF-8, which unlike -[NSString hash] is the same from run to run. */
+static UInt64 documentIdHash(NSString *docId)
+{
+    UInt64 hash = 14695981039346656037ULL;
+    const char *bytes = docId.UTF8String;
+    for (const char *p = bytes; *p; p++) {
+        hash = (hash ^ (UInt8)*p) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+@interface CDTPartitionedDatastore ()
+
+@property (readwrite) NSArray<NSString *> *partitionNames;
+
+@end
+
+@implementation CDTPartitionedDatastore
+
+- (instancetype)initWithManager:(CDTDatastoreManager *)manager
+                           name:(NSString *)name
+                 partitionCount:(NSUInteger)count
+                          error:(NSError *__autoreleasing *)error
+{
+    if (count == 0) {
+        if (error) *error = partitionError(@"A partitioned datastore needs a partition");
+        return nil;
+    }
+
+    NSMutableArray<NSString *> *names = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [names addObject:$sprintf(@"%@_p%luof%lu", name, (unsigned long)i, (unsigned long)count)];
+    }
+    // Documents would be looked for in the wrong partitions if the count had changed
+    NSString *prefix = [name stringByAppendingString:@"_p"];
+    for (NSString *existing in [manager allDatastores]) {
+        if ([existing hasPrefix:prefix] && ![names containsObject:existing]) {
+            if (error) {
+                *error = partitionError($sprintf(@"%@ has partitions of another count, such as %@",
+                                                 name, existing));
+            }
+            return nil;
+        }
+    }
+
+    NSMutableArray<CDTDatastore *> *partitions = [NSMutableArray arrayWithCapacity:count];
+    for (NSString *partitionName in names) {
+        CDTDatastore *partition = [manager datastoreNamed:partitionName error:error];
+        if (!partition) {
+            return nil;
+        }
+        [partitions addObject:partition];
+    }
+
+    if (self = [super init]) {
+        _manager = manager;
+        _name = [name copy];
+        _partitions = [partitions copy];
+        _partitionNames = [names copy];
+    }
+    return self;
+}
+
+- (CDTDatastore *)partitionForDocumentId:(NSString *)docId
+{
+    return self.partitions[documentIdHash(docId) % self.partitions.count];
+}
+
+- (NSUInteger)documentCount
+{
+    NSUInteger count = 0;
+    for (CDTDatastore *partition in self.partitions) {
+        count += partition.documentCount;
+    }
+    return count;
+}
+
+#pragma mark CRUD
+
+- (CDTDocumentRevision *)getDocumentWithId:(NSString *)docId error:(NSError *__autoreleasing *)error
+{
+    return [[self partitionForDocumentId:docId] getDocumentWithId:docId error:error];
+}
+
+- (CDTDocumentRevision *)getDocumentWithId:(NSString *)docId
+                                       rev:(NSString *)revId
+                                     error:(NSError *__autoreleasing *)error
+{
+    return [[self partitionForDocumentId:docId] getDocumentWithId:docId rev:revId error:error];
+}
+
+/** The indexes into `docIds` of the IDs in each partition, by partition index. */
+- (NSArray<NSMutableIndexSet *> *)indexesByPartitionOfDocumentIds:(NSArray<NSString *> *)docIds
+{
+    NSUInteger count = self.partitions.count;
+    NSMutableArray<NSMutableIndexSet *> *indexes = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [indexes addObject:[NSMutableIndexSet indexSet]];
+    }
+    [docIds enumerateObjectsUsingBlock:^(NSString *docId, NSUInteger idx, BOOL *stop) {
+        [indexes[documentIdHash(docId) % count] addIndex:idx];
+    }];
+    return indexes;
+}
+
+- (NSArray<CDTDocumentRevision *> *)getDocumentsWithIds:(NSArray<NSString *> *)docIds
+{
+    NSArray<NSMutableIndexSet *> *indexes = [self indexesByPartitionOfDocumentIds:docIds];
+    NSMutableDictionary<NSString *, CDTDocumentRevision *> *found = [NSMutableDictionary dictionary];
+    dispatch_apply(self.partitions.count, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0),
+                   ^(size_t i) {
+        if (indexes[i].count == 0) return;
+        NSArray<CDTDocumentRevision *> *revisions =
+            [self.partitions[i] getDocumentsWithIds:[docIds objectsAtIndexes:indexes[i]]];
+        @synchronized(found) {
+            for (CDTDocumentRevision *revision in revisions) {
+                found[revision.docId] = revision;
+            }
+        }
+    });
+
+    NSMutableArray<CDTDocumentRevision *> *result = [NSMutableArray arrayWithCapacity:found.count];
+    for (NSString *docId in docIds) {
+        CDTDocumentRevision *revision = found[docId];
+        if (revision) [result addObject:revision];
+    }
+    return result;
+}
+
+/** The revision, or a copy given a new ID if it has none, so its partition can be picked. */
+- (CDTDocumentRevision *)revisionWithDocumentId:(CDTDocumentRevision *)revision
+{
+    if (revision.docId) {
+        return revision;
+    }
+    CDTDocumentIDGenerator generator = self.documentIDGenerator;
+    CDTDocumentRevision *withId =
+        [CDTDocumentRevision revisionWithDocId:generator ? generator() : TDCreateUUID()];
+    withId.body = revision.body;
+    withId.attachments = revision.attachments;
+    return withId;
+}
+
+- (CDTDocumentRevision *)createDocumentFromRevision:(CDTDocumentRevision *)revision
+                                              error:(NSError *__autoreleasing *)error
+{
+    revision = [self revisionWithDocumentId:revision];
+    return [[self partitionForDocumentId:revision.docId] createDocumentFromRevision:revision
+                                                                              error:error];
+}
+
+- (NSArray<CDTDocumentRevision *> *)createDocumentsFromRevisions:
+                                        (NSArray<CDTDocumentRevision *> *)revisions
+                                                           error:(NSError *__autoreleasing *)error
+{
+    NSMutableArray<CDTDocumentRevision *> *withIds =
+        [NSMutableArray arrayWithCapacity:revisions.count];
+    for (CDTDocumentRevision *revision in revisions) {
+        [withIds addObject:[self revisionWithDocumentId:revision]];
+    }
+    NSArray<NSMutableIndexSet *> *indexes =
+        [self indexesByPartitionOfDocumentIds:[withIds valueForKey:@"docId"]];
+
+    NSMutableArray *created = [NSMutableArray arrayWithCapacity:withIds.count];
+    for (NSUInteger i = 0; i < withIds.count; i++) {
+        [created addObject:[NSNull null]];
+    }
+    __block NSError *firstError = nil;
+    dispatch_apply(self.partitions.count, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0),
+                   ^(size_t i) {
+        if (indexes[i].count == 0) return;
+        NSError *partitionError = nil;
+        NSArray<CDTDocumentRevision *> *batch =
+            [self.partitions[i] createDocumentsFromRevisions:[withIds objectsAtIndexes:indexes[i]]
+                                                       error:&partitionError];
+        @synchronized(created) {
+            if (batch) {
+                [created replaceObjectsAtIndexes:indexes[i] withObjects:batch];
+            } else if (!firstError) {
+                firstError = partitionError;
+            }
+        }
+    });
+
+    if (firstError || [created containsObject:[NSNull null]]) {
+        os_log_error(CDTOSLog, "%{public}@: Documents not created in every partition: %{public}@",
+                     self.name, firstError);
+        if (error) *error = firstError;
+        return nil;
+    }
+    return created;
+}
+
+- (CDTDocumentRevision *)updateDocumentFromRevision:(CDTDocumentRevision *)revision
+                                              error:(NSError *__autoreleasing *)error
+{
+    return [[self partitionForDocumentId:revision.docId] updateDocumentFromRevision:revision
+                                                                              error:error];
+}
+
+- (CDTDocumentRevision *)deleteDocumentFromRevision:(CDTDocumentRevision *)revision
+                                              error:(NSError *__autoreleasing *)error
+{
+    return [[self partitionForDocumentId:revision.docId] deleteDocumentFromRevision:revision
+                                                                              error:error];
+}
+
+- (NSArray<CDTDocumentRevision *> *)deleteDocumentWithId:(NSString *)docId
+                                                   error:(NSError *__autoreleasing *)error
+{
+    return [[self partitionForDocumentId:docId] deleteDocumentWithId:docId error:error];
+}
+
+#pragma mark Changes
+
+- (NSArray<CDTDocumentChange *> *)changesSinceToken:(NSString *)token
+                                              limit:(NSUInteger)limit
+                                          nextToken:(NSString *__autoreleasing *)nextToken
+                                              error:(NSError *__autoreleasing *)error
+{
+    NSUInteger count = self.partitions.count;
+    NSMutableArray<NSNumber *> *sequences = [NSMutableArray arrayWithCapacity:count];
+    NSArray<NSString *> *parts = token ? [token componentsSeparatedByString:@","] : nil;
+    for (NSUInteger i = 0; i < count; i++) {
+        long long sequence = 0;
+        NSScanner *scanner = parts.count == count ? [NSScanner scannerWithString:parts[i]] : nil;
+        if (parts && (![scanner scanLongLong:&sequence] || !scanner.isAtEnd || sequence < 0)) {
+            if (error) {
+                *error = partitionError($sprintf(@"Not a changes token of %@", self.name));
+            }
+            return nil;
+        }
+        [sequences addObject:@(sequence)];
+    }
+
+    // Every partition is asked for the limit, so that changes can be taken from each in turn
+    NSMutableArray<NSArray<CDTDocumentChange *> *> *changesByPartition =
+        [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [changesByPartition addObject:@[]];
+    }
+    __block TDStatus failure = kTDStatusOK;
+    dispatch_apply(count, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t i) {
+        NSMutableArray<CDTDocumentChange *> *changes = [NSMutableArray array];
+        TDStatus status = [self.partitions[i].database
+            enumerateWinningChangesSinceSequence:sequences[i].longLongValue
+                                           limit:limit > 0 ? limit : INT_MAX
+                                      usingBlock:^(SequenceNumber sequence, TD_Revision *winner,
+                                                   BOOL *stop) {
+                                          [changes addObject:[[CDTDocumentChange alloc]
+                                                                 initWithDocId:winner.docID
+                                                                         revId:winner.revID
+                                                                      sequence:sequence
+                                                                       deleted:winner.deleted]];
+                                      }];
+        @synchronized(changesByPartition) {
+            changesByPartition[i] = changes;
+            if (TDStatusIsError(status)) failure = status;
+        }
+    });
+    if (TDStatusIsError(failure)) {
+        if (error) *error = TDStatusToNSError(failure, nil);
+        return nil;
+    }
+
+    NSMutableArray<CDTDocumentChange *> *result = [NSMutableArray array];
+    BOOL more = YES;
+    for (NSUInteger round = 0; more && (limit == 0 || result.count < limit); round++) {
+        more = NO;
+        for (NSUInteger i = 0; i < count && (limit == 0 || result.count < limit); i++) {
+            NSArray<CDTDocumentChange *> *changes = changesByPartition[i];
+            if (round < changes.count) {
+                [result addObject:changes[round]];
+                sequences[i] = @(changes[round].sequence);
+                more = more || round + 1 < changes.count;
+            }
+        }
+    }
+    if (nextToken) *nextToken = [sequences componentsJoinedByString:@","];
+    return result;
+}
+
+#pragma mark Query
+
+- (NSString *)ensureIndexed:(NSArray<NSString *> *)fieldNames withName:(NSString *)indexName
+{
+    for (CDTDatastore *partition in self.partitions) {
+        if (![partition ensureIndexed:fieldNames withName:indexName]) {
+            return nil;
+        }
+    }
+    return indexName;
+}
+
+- (NSArray<CDTDocumentRevision *> *)find:(NSDictionary *)query
+                                    skip:(NSUInteger)skip
+                                   limit:(NSUInteger)limit
+                                  fields:(NSArray *)fields
+                                    sort:(NSArray *)sortDocument
+{
+    NSArray<CDTQFederatedResult *> *results = [self.manager find:query
+                                               inDatastoresNamed:self.partitionNames
+                                                            skip:skip
+                                                           limit:limit
+                                                          fields:fields
+                                                            sort:sortDocument];
+    return [results valueForKey:@"revision"];
+}
+
+- (NSUInteger)count:(NSDictionary *)query
+{
+    NSUInteger total = 0;
+    for (CDTDatastore *partition in self.partitions) {
+        NSUInteger count = [partition count:query];
+        if (count == NSNotFound) {
+            return NSNotFound;
+        }
+        total += count;
+    }
+    return total;
+}
+
+#pragma mark Replication
+
+- (NSArray<CDTPushReplication *> *)pushReplicationsWithTarget:(NSURL *)target
+{
+    NSMutableArray<CDTPushReplication *> *replications =
+        [NSMutableArray arrayWithCapacity:self.partitions.count];
+    for (CDTDatastore *partition in self.partitions) {
+        [replications addObject:[CDTPushReplication replicationWithSource:partition target:target]];
+    }
+    return replications;
+}
+
+@end
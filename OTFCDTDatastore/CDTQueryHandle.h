@@ -0,0 +1,64 @@
+//
+//  CDTQueryHandle.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+@class FMDatabase;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Lets a query be abandoned once it's no longer wanted, such as a search whose text has since
+ been changed, or once it has run for longer than its time budget.
+
+ Pass a handle to CDTQIndexManager -find:skip:limit:fields:sort:after:handle:, then call
+ -cancel from any thread. The SQLite statements the query is running are stopped within a few
+ thousand instructions, and loading and matching its documents stops at the next document,
+ so the database is given up quickly. A cancelled find returns nil, and enumerating the result
+ set of a find cancelled afterwards stops early.
+
+ A handle is cancelled for good; use a new one for each query.
+ */
+@interface CDTQueryHandle : NSObject
+
+/** A handle which is only cancelled by -cancel. */
+- (instancetype)init;
+
+/**
+ A handle which also cancels itself `timeBudget` seconds after it's created, so that's how long
+ a query using it may take, including the time spent waiting for the database.
+ */
+- (instancetype)initWithTimeBudget:(NSTimeInterval)timeBudget NS_DESIGNATED_INITIALIZER;
+
+/** The time budget, or 0 if there is none. */
+@property (readonly) NSTimeInterval timeBudget;
+
+/** YES once -cancel has been called or the time budget has run out. */
+@property (readonly, getter=isCancelled) BOOL cancelled;
+
+/** Stops the queries using the handle. Safe to call from any thread, and more than once. */
+- (void)cancel;
+
+/**
+ Internal: stops the statements run on `db` when the handle is cancelled, until
+ -detachFromDatabase: is called. Only to be called while holding the database's queue.
+ */
+- (void)attachToDatabase:(FMDatabase *)db;
+
+/** Internal: reverses -attachToDatabase:. */
+- (void)detachFromDatabase:(FMDatabase *)db;
+
+@end
+
+NS_ASSUME_NONNULL_END
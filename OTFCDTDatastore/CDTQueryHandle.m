@@ -0,0 +1,83 @@
+//
+//  CDTQueryHandle.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTQueryHandle.h"
+
+#import <fmdb/FMDatabase.h>
+#import <sqlite3.h>
+#import <stdatomic.h>
+
+// SQLite virtual machine instructions run between checks of the handle; a check is a clock
+// read, so this keeps its cost negligible while stopping a statement well within a millisecond.
+static const int kProgressHandlerInstructions = 1000;
+
+static int progressHandler(void *context)
+{
+    // Non-zero makes the running statement fail with SQLITE_INTERRUPT.
+    return ((__bridge CDTQueryHandle *)context).cancelled ? 1 : 0;
+}
+
+@implementation CDTQueryHandle {
+    atomic_bool _cancelled;
+    CFAbsoluteTime _deadline;
+}
+
+- (instancetype)init { return [self initWithTimeBudget:0]; }
+
+- (instancetype)initWithTimeBudget:(NSTimeInterval)timeBudget
+{
+    self = [super init];
+    if (self) {
+        atomic_init(&_cancelled, false);
+        _timeBudget = MAX(timeBudget, 0);
+        _deadline = timeBudget > 0 ? CFAbsoluteTimeGetCurrent() + timeBudget : 0;
+    }
+    return self;
+}
+
+- (BOOL)isCancelled
+{
+    if (atomic_load(&_cancelled)) {
+        return YES;
+    }
+    if (_deadline > 0 && CFAbsoluteTimeGetCurrent() >= _deadline) {
+        atomic_store(&_cancelled, true);
+        return YES;
+    }
+    return NO;
+}
+
+- (void)cancel { atomic_store(&_cancelled, true); }
+
+// sqlite3_interrupt would stop the statement at once, but it stops whatever the connection is
+// running when it's called, which by then may be another caller's work on the same queue. The
+// progress handler only ever stops the statements run between attaching and detaching.
+- (void)attachToDatabase:(FMDatabase *)db
+{
+    sqlite3_progress_handler(db.sqliteHandle, kProgressHandlerInstructions, progressHandler,
+                             (__bridge void *)self);
+}
+
+- (void)detachFromDatabase:(FMDatabase *)db
+{
+    sqlite3_progress_handler(db.sqliteHandle, 0, NULL, NULL);
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<CDTQueryHandle budget: %.3f cancelled: %d>",
+                                      self.timeBudget, self.isCancelled];
+}
+
+@end
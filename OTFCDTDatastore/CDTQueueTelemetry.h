@@ -0,0 +1,130 @@
+//
+//  CDTQueueTelemetry.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/** The kinds of work a datastore's database connections are timed by. */
+typedef NS_ENUM(NSUInteger, CDTQueueOperation) {
+    /** Anything not listed below, such as reading documents or local documents. */
+    CDTQueueOperationOther = 0,
+    CDTQueueOperationPut,
+    CDTQueueOperationForceInsert,
+    CDTQueueOperationQuery,
+    CDTQueueOperationIndexUpdate,
+    CDTQueueOperationCompaction,
+    CDTQueueOperationCheckpoint,
+};
+
+/** Number of buckets in a CDTQueueTimings histogram. */
+#define kCDTQueueHistogramBuckets 20
+
+/**
+ How long one kind of operation waited for a database connection and then held it, since the
+ datastore was opened or its CDTQueueTelemetry was reset.
+
+ The histograms have kCDTQueueHistogramBuckets buckets: bucket 0 counts durations under 10µs,
+ and each bucket after it those under twice the previous bucket's bound, so bucket 10 holds
+ those from about 5ms to 10ms. The last bucket also counts everything longer.
+ */
+@interface CDTQueueTimings : NSObject
+
+/** The operation's name: `put`, `forceInsert`, `query`, `indexUpdate`, `compaction`,
+    `checkpoint` or `other`. */
+@property (readonly) NSString *operation;
+
+/** Number of times the operation used a connection; one operation may use several. */
+@property (readonly) NSUInteger count;
+
+/** Time spent waiting for a connection to be free, in total and at most. */
+@property (readonly) NSTimeInterval totalWaitTime;
+@property (readonly) NSTimeInterval maxWaitTime;
+
+/** Time spent holding a connection, in total and at most. */
+@property (readonly) NSTimeInterval totalHoldTime;
+@property (readonly) NSTimeInterval maxHoldTime;
+
+@property (readonly) NSArray<NSNumber *> *waitHistogram;
+@property (readonly) NSArray<NSNumber *> *holdHistogram;
+
+/** The upper bound of a histogram bucket, or infinity for the last. */
++ (NSTimeInterval)upperBoundOfBucket:(NSUInteger)bucket;
+
+/*
+ Private so no docs. Used by CDTQueueTelemetry to take a snapshot.
+ */
+- (instancetype)initWithOperation:(NSString *)operation
+                            count:(NSUInteger)count
+                    totalWaitTime:(NSTimeInterval)totalWaitTime
+                      maxWaitTime:(NSTimeInterval)maxWaitTime
+                    totalHoldTime:(NSTimeInterval)totalHoldTime
+                      maxHoldTime:(NSTimeInterval)maxHoldTime
+                    waitHistogram:(NSArray<NSNumber *> *)waitHistogram
+                    holdHistogram:(NSArray<NSNumber *> *)holdHistogram NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+/**
+ Times every block run on a datastore's database connections — the writer, the read
+ connections and the query index database — from when it was submitted to when it started
+ running (the wait) and from then until it finished (the hold), by the kind of operation which
+ submitted it. A block's wait includes time spent waiting for a free read connection, or for
+ the database to finish opening or closing. Intended for finding which work is keeping the
+ connections busy when reads are slow.
+
+ Recording costs two clock reads and a lock per block, so it is always on. Safe to use from any
+ thread.
+ */
+@interface CDTQueueTelemetry : NSObject
+
+/** If YES, each wait and hold is also emitted as an os_signpost interval, named `queueWait` and
+    `queueHold`, in the CDTSignposts log, so they can be lined up with other work in Instruments.
+    Defaults to NO. */
+@property BOOL emitsSignposts;
+
+/** Timings of each kind of operation seen so far, keyed by name. */
+@property (readonly) NSDictionary<NSString *, CDTQueueTimings *> *timings;
+
+- (void)reset;
+
+/*
+ Private so no docs. Used by the database queues.
+ */
+- (void)recordOperation:(CDTQueueOperation)operation
+               waitTime:(NSTimeInterval)waitTime
+               holdTime:(NSTimeInterval)holdTime;
+
++ (NSString *)nameOfOperation:(CDTQueueOperation)operation;
+
+@end
+
+/*
+ Private so no docs. Blocks are attributed to the operation current on the thread submitting
+ them, which is CDTQueueOperationOther unless a caller up the stack has declared otherwise with
+ CDTQueueOperationScope.
+ */
+CDTQueueOperation CDTQueueCurrentOperation(void);
+CDTQueueOperation CDTQueueSetCurrentOperation(CDTQueueOperation operation);
+void CDTQueueRestoreOperation(CDTQueueOperation *previous);
+
+/** Makes `operation` the calling thread's current operation until the end of the enclosing
+    scope, when the previous one is restored. */
+#define CDTQueueOperationScope(operation)                                              \
+    __attribute__((cleanup(CDTQueueRestoreOperation), unused))                         \
+        CDTQueueOperation CDTQueuePreviousOperation_ = CDTQueueSetCurrentOperation(operation)
+
+NS_ASSUME_NONNULL_END
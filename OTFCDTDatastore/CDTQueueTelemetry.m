@@ -0,0 +1,172 @@
+//
+//  CDTQueueTelemetry.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTQueueTelemetry.h"
+
+#define kOperationCount (CDTQueueOperationCheckpoint + 1)
+
+static const NSTimeInterval kFirstBucketBound = 10e-6;
+
+static _Thread_local CDTQueueOperation sCurrentOperation = CDTQueueOperationOther;
+
+CDTQueueOperation CDTQueueCurrentOperation(void) { return sCurrentOperation; }
+
+CDTQueueOperation CDTQueueSetCurrentOperation(CDTQueueOperation operation)
+{
+    CDTQueueOperation previous = sCurrentOperation;
+    sCurrentOperation = operation;
+    return previous;
+}
+
+void CDTQueueRestoreOperation(CDTQueueOperation *previous) { sCurrentOperation = *previous; }
+
+static NSUInteger bucketOfDuration(NSTimeInterval duration)
+{
+    NSUInteger bucket = 0;
+    NSTimeInterval bound = kFirstBucketBound;
+    while (duration >= bound && bucket < kCDTQueueHistogramBuckets - 1) {
+        bound *= 2;
+        bucket++;
+    }
+    return bucket;
+}
+
+typedef struct {
+    NSUInteger count;
+    NSTimeInterval totalWait, maxWait, totalHold, maxHold;
+    NSUInteger wait[kCDTQueueHistogramBuckets], hold[kCDTQueueHistogramBuckets];
+} CDTQueueCounts;
+
+static NSArray<NSNumber *> *arrayOfBuckets(const NSUInteger *buckets)
+{
+    NSMutableArray *array = [NSMutableArray arrayWithCapacity:kCDTQueueHistogramBuckets];
+    for (NSUInteger i = 0; i < kCDTQueueHistogramBuckets; i++) {
+        [array addObject:@(buckets[i])];
+    }
+    return array;
+}
+
+@implementation CDTQueueTimings
+
++ (NSTimeInterval)upperBoundOfBucket:(NSUInteger)bucket
+{
+    if (bucket >= kCDTQueueHistogramBuckets - 1) return INFINITY;
+    return kFirstBucketBound * (NSTimeInterval)(1 << bucket);
+}
+
+- (instancetype)initWithOperation:(NSString *)operation
+                            count:(NSUInteger)count
+                    totalWaitTime:(NSTimeInterval)totalWaitTime
+                      maxWaitTime:(NSTimeInterval)maxWaitTime
+                    totalHoldTime:(NSTimeInterval)totalHoldTime
+                      maxHoldTime:(NSTimeInterval)maxHoldTime
+                    waitHistogram:(NSArray<NSNumber *> *)waitHistogram
+                    holdHistogram:(NSArray<NSNumber *> *)holdHistogram
+{
+    self = [super init];
+    if (self) {
+        _operation = [operation copy];
+        _count = count;
+        _totalWaitTime = totalWaitTime;
+        _maxWaitTime = maxWaitTime;
+        _totalHoldTime = totalHoldTime;
+        _maxHoldTime = maxHoldTime;
+        _waitHistogram = [waitHistogram copy];
+        _holdHistogram = [holdHistogram copy];
+    }
+    return self;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@ %p: %@ x%lu, wait %.3fs (max %.3fs), hold %.3fs "
+                                      @"(max %.3fs)>",
+                                      [self class], self, _operation, (unsigned long)_count,
+                                      _totalWaitTime, _maxWaitTime, _totalHoldTime, _maxHoldTime];
+}
+
+@end
+
+@implementation CDTQueueTelemetry {
+    CDTQueueCounts _counts[kOperationCount];
+}
+
++ (NSString *)nameOfOperation:(CDTQueueOperation)operation
+{
+    switch (operation) {
+        case CDTQueueOperationPut:
+            return @"put";
+        case CDTQueueOperationForceInsert:
+            return @"forceInsert";
+        case CDTQueueOperationQuery:
+            return @"query";
+        case CDTQueueOperationIndexUpdate:
+            return @"indexUpdate";
+        case CDTQueueOperationCompaction:
+            return @"compaction";
+        case CDTQueueOperationCheckpoint:
+            return @"checkpoint";
+        case CDTQueueOperationOther:
+        default:
+            return @"other";
+    }
+}
+
+- (void)recordOperation:(CDTQueueOperation)operation
+               waitTime:(NSTimeInterval)waitTime
+               holdTime:(NSTimeInterval)holdTime
+{
+    if (operation >= kOperationCount) operation = CDTQueueOperationOther;
+    NSUInteger waitBucket = bucketOfDuration(waitTime);
+    NSUInteger holdBucket = bucketOfDuration(holdTime);
+    @synchronized(self)
+    {
+        CDTQueueCounts *counts = &_counts[operation];
+        counts->count++;
+        counts->totalWait += waitTime;
+        counts->maxWait = MAX(counts->maxWait, waitTime);
+        counts->totalHold += holdTime;
+        counts->maxHold = MAX(counts->maxHold, holdTime);
+        counts->wait[waitBucket]++;
+        counts->hold[holdBucket]++;
+    }
+}
+
+- (NSDictionary<NSString *, CDTQueueTimings *> *)timings
+{
+    CDTQueueCounts counts[kOperationCount];
+    @synchronized(self) { memcpy(counts, _counts, sizeof(counts)); }
+
+    NSMutableDictionary *timings = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < kOperationCount; i++) {
+        if (counts[i].count == 0) continue;
+        NSString *name = [CDTQueueTelemetry nameOfOperation:i];
+        timings[name] = [[CDTQueueTimings alloc] initWithOperation:name
+                                                             count:counts[i].count
+                                                     totalWaitTime:counts[i].totalWait
+                                                       maxWaitTime:counts[i].maxWait
+                                                     totalHoldTime:counts[i].totalHold
+                                                       maxHoldTime:counts[i].maxHold
+                                                     waitHistogram:arrayOfBuckets(counts[i].wait)
+                                                     holdHistogram:arrayOfBuckets(counts[i].hold)];
+    }
+    return timings;
+}
+
+- (void)reset
+{
+    @synchronized(self) { memset(_counts, 0, sizeof(_counts)); }
+}
+
+@end
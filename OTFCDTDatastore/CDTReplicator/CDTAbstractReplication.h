@@ -49,7 +49,31 @@ typedef NS_ENUM(NSInteger, CDTReplicationErrors) {
     /**
      See below for a list of HTTP keys that one may not modify.
      */
-    CDTReplicationErrorProhibitedOptionalHttpHeader
+    CDTReplicationErrorProhibitedOptionalHttpHeader,
+    /**
+     Replications which must share a source datastore don't.
+     */
+    CDTReplicationErrorMixedSources
+};
+
+/**
+ How a replication's share of the CDTReplicationScheduler compares with others'.
+ */
+typedef NS_ENUM(NSInteger, CDTReplicationPriority) {
+    /**
+     Started after any waiting replications of normal or high priority, and given half the share
+     of HTTP connections of a normal replication.
+     */
+    CDTReplicationPriorityLow = -1,
+    /**
+     The default.
+     */
+    CDTReplicationPriorityNormal = 0,
+    /**
+     Started before any waiting replications of normal or low priority, and given twice the share
+     of HTTP connections of a normal replication.
+     */
+    CDTReplicationPriorityHigh = 1
 };
 
 /**
@@ -135,6 +159,57 @@ typedef NS_ENUM(NSInteger, CDTReplicationErrors) {
  */
 @property (nonatomic, readonly, strong) NSArray<NSObject<CDTHTTPInterceptor>*>* httpInterceptors;
 
+/**
+ The replication's priority when it shares a CDTReplicationScheduler with other replications.
+ Defaults to CDTReplicationPriorityNormal.
+
+ @see CDTReplicatorFactory
+ */
+@property (nonatomic) CDTReplicationPriority priority;
+
+/**
+ @name Checkpoints
+ */
+
+/**
+ How long, in seconds, the replicator waits after making progress before it saves a checkpoint,
+ recording how far it has got so that a later replication can carry on from there. Each save
+ writes a `_local` document on the remote database as well as the local datastore. Defaults to 5.
+ */
+@property (nonatomic) NSTimeInterval checkpointInterval;
+
+/**
+ If more than 0, a checkpoint is saved as soon as this many more documents have been processed
+ since the last one, without waiting for checkpointInterval. Defaults to 0.
+ */
+@property (nonatomic) NSUInteger checkpointAfterDocuments;
+
+/**
+ If more than 0, a checkpoint is saved as soon as this many more bytes have been sent and
+ received since the last one, without waiting for checkpointInterval. Defaults to 0.
+ */
+@property (nonatomic) UInt64 checkpointAfterBytes;
+
+/**
+ If YES, the checkpoints saved while documents are being transferred are only written to the
+ local datastore, sparing a request to the remote database each time. That's enough for a later
+ replication from this device to carry on from there, as long as nothing else has replaced the
+ remote checkpoint in the meantime. The remote checkpoint is brought up to date when the
+ replication goes idle or stops. Defaults to NO.
+
+ Whatever this is set to, on iOS a checkpoint is saved as soon as the app resigns active or
+ enters the background, in case it's killed.
+ */
+@property (nonatomic) BOOL localInterimCheckpoints;
+
+/**
+ If set, a trace of the replication is appended to this file: a JSON object per line for each
+ HTTP request, page of changes, batch of documents inserted and checkpoint saved, with their
+ times, sizes and latencies. Meant for collecting from devices to work out why replications
+ stall, as it's far cheaper than debug logging. The file stops growing at 10MB. Defaults to nil.
+ */
+@property (nullable, nonatomic, copy) NSURL* traceFileURL;
+
 @property (nullable, nonatomic, readonly, strong) NSString* username;
 
 @property (nullable, nonatomic, readonly, strong) NSString* password;
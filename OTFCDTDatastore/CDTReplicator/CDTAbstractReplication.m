@@ -45,6 +45,12 @@ NS_ASSUME_NONNULL_END
         copy.httpInterceptors = [self.httpInterceptors copyWithZone:zone];
         copy.username = self.username;
         copy.password = self.password;
+        copy.priority = self.priority;
+        copy.checkpointInterval = self.checkpointInterval;
+        copy.checkpointAfterDocuments = self.checkpointAfterDocuments;
+        copy.checkpointAfterBytes = self.checkpointAfterBytes;
+        copy.localInterimCheckpoints = self.localInterimCheckpoints;
+        copy.traceFileURL = self.traceFileURL;
     }
 
     return copy;
@@ -65,6 +71,7 @@ NS_ASSUME_NONNULL_BEGIN
         _httpInterceptors = @[];
         _username = username;
         _password = password;
+        _checkpointInterval = 5.0;
     }
     return self;
 }
@@ -75,6 +82,7 @@ NS_ASSUME_NONNULL_BEGIN
     if (self) {
         _httpInterceptors = @[];
         _IAMAPIKey= IAMAPIKey;
+        _checkpointInterval = 5.0;
     }
     return self;
 }
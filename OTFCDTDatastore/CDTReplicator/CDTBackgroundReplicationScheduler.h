@@ -0,0 +1,151 @@
+//
+//  CDTBackgroundReplicationScheduler.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+@class CDTAbstractReplication;
+@class CDTDatastore;
+@class CDTReplicatorFactory;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Runs a set of replications, and optionally some datastore maintenance, in the time the system
+ gives the app to run in the background, so its datastores keep up to date while it isn't open.
+
+ Each run starts the replications added to it most overdue first: the one which has gone longest
+ since it last completed, with that time weighted by the replication's priority, as
+ CDTReplicationScheduler weights its share of the connections. Replications which have never
+ completed go first. They run as many at once as the factory's scheduler allows. Shortly before
+ the run's time budget is spent each running replication saves a checkpoint and is stopped, so
+ the next run carries on where it left off; meanwhile they checkpoint at least every
+ checkpointInterval, in case the app is suspended without warning, saving the checkpoints only
+ locally until they stop (see CDTAbstractReplication's localInterimCheckpoints). The date each
+ replication last completed is kept in the user defaults.
+
+ Maintenance, which is bringing the query indexes of the datastores added for it up to date and
+ then compacting them, takes a lot of I/O and power, so it's only done in runs which ask for it,
+ once the replications have completed, and only while the device is charging and on Wi-Fi.
+
+ On iOS, -registerTasksWithRefreshIdentifier:processingIdentifier: and -scheduleTasks have the
+ runs made from a BGAppRefreshTask, for the replications only, and a BGProcessingTask requiring
+ external power, for the replications and then maintenance. The identifiers must be listed under
+ BGTaskSchedulerPermittedIdentifiers in the app's Info.plist. Elsewhere, call
+ -runWithTimeBudget:maintenance:completionHandler: from whatever gives the app time to run, such
+ as an NSBackgroundActivityScheduler.
+
+ All methods are thread-safe.
+ */
+@interface CDTBackgroundReplicationScheduler : NSObject
+
+/** Keeps completion dates in the standard user defaults. */
+- (instancetype)initWithReplicatorFactory:(CDTReplicatorFactory *)factory;
+
+- (instancetype)initWithReplicatorFactory:(CDTReplicatorFactory *)factory
+                             userDefaults:(NSUserDefaults *)userDefaults NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@property (readonly) CDTReplicatorFactory *factory;
+
+/**
+ Adds a replication to be run, or replaces the one added under the same identifier. The
+ replication is copied; a pull replication is run with `continuous` off.
+
+ @param identifier names the replication in the user defaults, so it must stay the same from one
+        launch of the app to the next.
+ */
+- (void)addReplication:(CDTAbstractReplication *)replication identifier:(NSString *)identifier;
+
+/** Removes a replication; a run already under way still finishes it. */
+- (void)removeReplicationWithIdentifier:(NSString *)identifier;
+
+/** Adds a datastore to be maintained by runs which do maintenance. */
+- (void)addDatastoreForMaintenance:(CDTDatastore *)datastore;
+
+- (void)removeDatastoreForMaintenance:(CDTDatastore *)datastore;
+
+/** When the replication last completed in a run, or nil if it never has. */
+- (nullable NSDate *)lastCompletionOfReplicationWithIdentifier:(NSString *)identifier;
+
+/** The identifiers of the replications added, in the order a run would start them now. */
+@property (readonly) NSArray<NSString *> *identifiersInRunOrder;
+
+/** The longest a replication goes without saving a checkpoint while it's run. A replication whose
+    own checkpointInterval is shorter keeps it. Defaults to 2 seconds. */
+@property NSTimeInterval checkpointInterval;
+
+/** How long before the end of a run's time budget its replications are stopped, leaving them time
+    to save their checkpoints and finish their requests. Defaults to 3 seconds. */
+@property NSTimeInterval stopMargin;
+
+/** YES while a run is under way. */
+@property (readonly, getter=isRunning) BOOL running;
+
+/**
+ Runs the replications, then, if `maintenance` is YES and the device is charging and on Wi-Fi,
+ maintains the datastores until the time budget is spent. Only one run is made at a time; while
+ one is under way, another completes straight away with NO.
+
+ @param timeBudget how long, in seconds, the run may take.
+ @param completionHandler called, on an arbitrary thread, once the run has finished, with YES if
+        every replication completed.
+ */
+- (void)runWithTimeBudget:(NSTimeInterval)timeBudget
+              maintenance:(BOOL)maintenance
+        completionHandler:(void (^)(BOOL completed))completionHandler;
+
+/** Ends the run under way early, checkpointing and stopping its replications and stopping its
+    maintenance, as when the system takes back the time it gave. */
+- (void)cancelRun;
+
+#if TARGET_OS_IOS
+
+/**
+ Registers the background tasks which make runs. Must be called before the app finishes
+ launching, as BGTaskScheduler requires.
+
+ @param refreshIdentifier the identifier of a BGAppRefreshTask which runs the replications.
+ @param processingIdentifier optional; the identifier of a BGProcessingTask which runs the
+        replications and then maintenance.
+ @return NO if the tasks couldn't be registered, such as if an identifier isn't permitted.
+ */
+- (BOOL)registerTasksWithRefreshIdentifier:(NSString *)refreshIdentifier
+                      processingIdentifier:(nullable NSString *)processingIdentifier;
+
+/** Asks for the registered tasks to be run, replacing earlier requests. Each task asks again as it
+    starts, so this only needs calling once, such as when the app enters the background. */
+- (void)scheduleTasks;
+
+/** How long after a refresh task is scheduled it may run. Defaults to 15 minutes. */
+@property NSTimeInterval refreshInterval;
+
+/** The time budget of a run made from the refresh task, which the system gives about 30 seconds.
+    Defaults to 25 seconds. */
+@property NSTimeInterval refreshTimeBudget;
+
+/** The time budget of a run made from the processing task. The system may well take back the time
+    sooner, when the run is cancelled. Defaults to 10 minutes. */
+@property NSTimeInterval processingTimeBudget;
+
+#endif
+
+/*
+ Private so no docs. Used by the tests.
+ */
+- (void)setLastCompletion:(nullable NSDate *)date ofReplicationWithIdentifier:(NSString *)identifier;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,526 @@
+//
+//  CDTBackgroundReplicationScheduler.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTBackgroundReplicationScheduler.h"
+
+#import "CDTDatastore.h"
+#import "CDTDatastore+Query.h"
+#import "CDTLogging.h"
+#import "CDTPullReplication.h"
+#import "CDTPushReplication.h"
+#import "CDTReplicationScheduler.h"
+#import "CDTReplicator.h"
+#import "CDTReplicatorDelegate.h"
+#import "CDTReplicatorFactory.h"
+#import "TDReachability.h"
+
+#if TARGET_OS_IOS
+#import <BackgroundTasks/BackgroundTasks.h>
+#import <UIKit/UIKit.h>
+#endif
+
+static NSString *const kLastCompletionKeyPrefix = @"com.cloudant.sync.background.lastCompletion.";
+
+static const NSTimeInterval kDefaultCheckpointInterval = 2;
+static const NSTimeInterval kDefaultStopMargin = 3;
+
+// Compaction is done in slices of this long, so a cancelled run stops soon after.
+static const NSTimeInterval kCompactionSlice = 1;
+
+@interface CDTBackgroundReplicationScheduler () <CDTReplicatorDelegate>
+@end
+
+@implementation CDTBackgroundReplicationScheduler {
+    NSUserDefaults *_userDefaults;
+    NSMutableDictionary<NSString *, CDTAbstractReplication *> *_replications;
+    NSHashTable<CDTDatastore *> *_maintainedDatastores;  // weak, so they can still be closed
+    dispatch_queue_t _queue;                              // timers and maintenance
+
+    // The run under way, if _completionHandler is set. Each run is numbered, so that timers
+    // left over from earlier runs do nothing.
+    NSUInteger _run;
+    void (^_completionHandler)(BOOL completed);
+    NSMapTable<CDTReplicator *, NSString *> *_running;
+    CFAbsoluteTime _deadline;
+    BOOL _maintenance;
+    BOOL _starting;  // still starting the replications, so the run can't end yet
+    BOOL _replicationsDone;
+    BOOL _allCompleted;
+    BOOL _cancelled;
+
+#if TARGET_OS_IOS
+    NSString *_refreshIdentifier;
+    NSString *_processingIdentifier;
+#endif
+}
+
+- (instancetype)initWithReplicatorFactory:(CDTReplicatorFactory *)factory
+{
+    return [self initWithReplicatorFactory:factory
+                              userDefaults:[NSUserDefaults standardUserDefaults]];
+}
+
+- (instancetype)initWithReplicatorFactory:(CDTReplicatorFactory *)factory
+                             userDefaults:(NSUserDefaults *)userDefaults
+{
+    self = [super init];
+    if (self) {
+        _factory = factory;
+        _userDefaults = userDefaults;
+        _replications = [NSMutableDictionary dictionary];
+        _maintainedDatastores = [NSHashTable weakObjectsHashTable];
+        _queue = dispatch_queue_create("com.cloudant.sync.background",
+                                       dispatch_queue_attr_make_with_qos_class(
+                                           DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0));
+        _checkpointInterval = kDefaultCheckpointInterval;
+        _stopMargin = kDefaultStopMargin;
+#if TARGET_OS_IOS
+        _refreshInterval = 15 * 60;
+        _refreshTimeBudget = 25;
+        _processingTimeBudget = 10 * 60;
+#endif
+    }
+    return self;
+}
+
+#pragma mark Replications and datastores
+
+- (void)addReplication:(CDTAbstractReplication *)replication identifier:(NSString *)identifier
+{
+    @synchronized(self) { _replications[identifier] = [replication copy]; }
+}
+
+- (void)removeReplicationWithIdentifier:(NSString *)identifier
+{
+    @synchronized(self) { [_replications removeObjectForKey:identifier]; }
+}
+
+- (void)addDatastoreForMaintenance:(CDTDatastore *)datastore
+{
+    @synchronized(self) { [_maintainedDatastores addObject:datastore]; }
+}
+
+- (void)removeDatastoreForMaintenance:(CDTDatastore *)datastore
+{
+    @synchronized(self) { [_maintainedDatastores removeObject:datastore]; }
+}
+
+- (NSDate *)lastCompletionOfReplicationWithIdentifier:(NSString *)identifier
+{
+    return $castIf(NSDate, [_userDefaults
+                               objectForKey:[kLastCompletionKeyPrefix
+                                                stringByAppendingString:identifier]]);
+}
+
+- (void)setLastCompletion:(NSDate *)date ofReplicationWithIdentifier:(NSString *)identifier
+{
+    NSString *key = [kLastCompletionKeyPrefix stringByAppendingString:identifier];
+    if (date) {
+        [_userDefaults setObject:date forKey:key];
+    } else {
+        [_userDefaults removeObjectForKey:key];
+    }
+}
+
+- (NSArray<NSString *> *)identifiersInRunOrder
+{
+    NSDictionary<NSString *, CDTAbstractReplication *> *replications;
+    @synchronized(self) { replications = [_replications copy]; }
+
+    // Overdue-ness is the time since a replication last completed, weighted by priority; one
+    // which has never completed is as overdue as can be, so those go by priority alone.
+    NSDate *now = [NSDate date];
+    NSMutableDictionary<NSString *, NSNumber *> *overdue = [NSMutableDictionary dictionary];
+    for (NSString *identifier in replications) {
+        NSDate *last = [self lastCompletionOfReplicationWithIdentifier:identifier];
+        double staleness = last ? MAX([now timeIntervalSinceDate:last], 0) : INFINITY;
+        NSUInteger weight =
+            [CDTReplicationScheduler connectionWeightForPriority:replications[identifier].priority];
+        overdue[identifier] = @(staleness * weight);
+    }
+
+    return [replications.allKeys sortedArrayUsingComparator:^NSComparisonResult(NSString *a,
+                                                                                NSString *b) {
+        NSComparisonResult result = [overdue[b] compare:overdue[a]];
+        if (result == NSOrderedSame) {
+            result = [@(replications[b].priority) compare:@(replications[a].priority)];
+        }
+        return result != NSOrderedSame ? result : [a compare:b];
+    }];
+}
+
+// The copy of a replication which a run starts.
+- (CDTAbstractReplication *)runnableReplicationWithIdentifier:(NSString *)identifier
+{
+    CDTAbstractReplication *replication;
+    @synchronized(self) { replication = [_replications[identifier] copy]; }
+    if (!replication) return nil;
+    replication.checkpointInterval = MIN(replication.checkpointInterval, self.checkpointInterval);
+    replication.localInterimCheckpoints = YES;
+    $castIf(CDTPullReplication, replication).continuous = NO;
+    return replication;
+}
+
+#pragma mark Runs
+
+- (BOOL)isRunning
+{
+    @synchronized(self) { return _completionHandler != nil; }
+}
+
+- (void)runWithTimeBudget:(NSTimeInterval)timeBudget
+              maintenance:(BOOL)maintenance
+        completionHandler:(void (^)(BOOL completed))completionHandler
+{
+    NSUInteger run;
+    @synchronized(self)
+    {
+        if (_completionHandler) {
+            os_log_info(CDTOSLog, "Background run not made, as one is already under way");
+            dispatch_async(_queue, ^{
+                completionHandler(NO);
+            });
+            return;
+        }
+        run = ++_run;
+        _completionHandler = [completionHandler copy];
+        _running = [NSMapTable strongToStrongObjectsMapTable];
+        _deadline = CFAbsoluteTimeGetCurrent() + timeBudget;
+        _maintenance = maintenance;
+        _starting = YES;
+        _replicationsDone = NO;
+        _allCompleted = YES;
+        _cancelled = NO;
+    }
+
+    NSArray<NSString *> *identifiers = self.identifiersInRunOrder;
+    os_log_info(CDTOSLog, "Background run %lu starting %lu replications, with %.0fs",
+                (unsigned long)run, (unsigned long)identifiers.count, timeBudget);
+
+    // Stop whatever's still running in time for it to save its checkpoints, and end the run at
+    // the end of the budget whether or not the replications have all said they've stopped.
+    __weak CDTBackgroundReplicationScheduler *weakSelf = self;
+    NSTimeInterval untilStop = MAX(timeBudget - self.stopMargin, 0);
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(untilStop * NSEC_PER_SEC)), _queue,
+                   ^{
+                       [weakSelf stopReplicationsOfRun:run];
+                   });
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeBudget * NSEC_PER_SEC)), _queue,
+                   ^{
+                       [weakSelf finishRun:run];
+                   });
+
+    for (NSString *identifier in identifiers) {
+        CDTAbstractReplication *replication = [self runnableReplicationWithIdentifier:identifier];
+        if (!replication) continue;
+
+        NSError *error;
+        CDTReplicator *replicator = [self.factory oneWay:replication error:&error];
+        replicator.delegate = self;
+        @synchronized(self)
+        {
+            if (run != _run || _cancelled) break;
+            if (replicator) [_running setObject:identifier forKey:replicator];
+        }
+        if (!replicator || ![replicator startWithError:&error]) {
+            os_log_error(CDTOSLog, "Background replication %{public}@ not started: %{public}@",
+                         identifier, error);
+            @synchronized(self)
+            {
+                if (replicator) [_running removeObjectForKey:replicator];
+                _allCompleted = NO;
+            }
+        }
+    }
+
+    @synchronized(self)
+    {
+        if (run == _run) _starting = NO;
+    }
+    [self replicationsMayBeDoneInRun:run];
+}
+
+- (void)replicatorDidChangeState:(CDTReplicator *)replicator
+{
+    if (replicator.isActive) return;
+
+    NSUInteger run;
+    NSString *identifier;
+    @synchronized(self)
+    {
+        identifier = [_running objectForKey:replicator];
+        if (!identifier) return;
+        [_running removeObjectForKey:replicator];
+        if (replicator.state != CDTReplicatorStateComplete) _allCompleted = NO;
+        run = _run;
+    }
+
+    if (replicator.state == CDTReplicatorStateComplete) {
+        [self setLastCompletion:[NSDate date] ofReplicationWithIdentifier:identifier];
+    }
+    os_log_debug(CDTOSLog, "Background replication %{public}@ %{public}@", identifier,
+                 [CDTReplicator stringForReplicatorState:replicator.state]);
+    [self replicationsMayBeDoneInRun:run];
+}
+
+- (void)replicationsMayBeDoneInRun:(NSUInteger)run
+{
+    BOOL maintain;
+    @synchronized(self)
+    {
+        if (run != _run || !_completionHandler || _starting || _replicationsDone ||
+            _running.count > 0) {
+            return;
+        }
+        _replicationsDone = YES;
+        maintain = _maintenance && _allCompleted && !_cancelled;
+    }
+    if (maintain) {
+        dispatch_async(_queue, ^{
+            [self maintainDatastoresInRun:run];
+        });
+    } else {
+        [self finishRun:run];
+    }
+}
+
+- (void)stopReplicationsOfRun:(NSUInteger)run
+{
+    NSArray<CDTReplicator *> *replicators;
+    @synchronized(self)
+    {
+        if (run != _run || !_completionHandler) return;
+        replicators = _running.keyEnumerator.allObjects;
+    }
+    for (CDTReplicator *replicator in replicators) {
+        // Queued ahead of stopping, in case the app's suspended before that's done.
+        [replicator checkpointNow];
+        [replicator stop];
+    }
+}
+
+- (void)cancelRun
+{
+    NSUInteger run;
+    @synchronized(self)
+    {
+        if (!_completionHandler) return;
+        _cancelled = YES;
+        run = _run;
+    }
+    os_log_info(CDTOSLog, "Background run %lu cancelled", (unsigned long)run);
+    [self stopReplicationsOfRun:run];
+
+    // The system wants its time back sooner than the replications may take to stop.
+    __weak CDTBackgroundReplicationScheduler *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.stopMargin * NSEC_PER_SEC)),
+                   _queue, ^{
+                       [weakSelf finishRun:run];
+                   });
+}
+
+- (void)finishRun:(NSUInteger)run
+{
+    void (^completionHandler)(BOOL);
+    BOOL completed;
+    @synchronized(self)
+    {
+        if (run != _run || !_completionHandler) return;
+        completionHandler = _completionHandler;
+        completed = _allCompleted && _running.count == 0;
+        _completionHandler = nil;
+        _running = nil;
+    }
+    os_log_info(CDTOSLog, "Background run %lu finished, %{public}@", (unsigned long)run,
+                completed ? @"all replications completed" : @"not all replications completed");
+    completionHandler(completed);
+}
+
+// YES once the run's been cancelled, ended or its time's up.
+- (BOOL)isRunOver:(NSUInteger)run
+{
+    @synchronized(self)
+    {
+        return run != _run || !_completionHandler || _cancelled ||
+               CFAbsoluteTimeGetCurrent() >= _deadline;
+    }
+}
+
+#pragma mark Maintenance
+
+- (void)maintainDatastoresInRun:(NSUInteger)run
+{
+    if (![self isChargingOnWiFi]) {
+        os_log_info(CDTOSLog, "Background maintenance skipped, as not charging on Wi-Fi");
+        [self finishRun:run];
+        return;
+    }
+
+    NSArray<CDTDatastore *> *datastores;
+    @synchronized(self) { datastores = _maintainedDatastores.allObjects; }
+
+    // Indexes first, as they make the next queries quicker, whereas compaction can always be done
+    // a slice at a time in the next run.
+    for (CDTDatastore *datastore in datastores) {
+        if ([self isRunOver:run]) break;
+        [datastore updateAllIndexes];
+    }
+    for (CDTDatastore *datastore in datastores) {
+        BOOL finished = NO;
+        while (!finished && ![self isRunOver:run]) {
+            NSTimeInterval remaining;
+            @synchronized(self) { remaining = _deadline - CFAbsoluteTimeGetCurrent(); }
+            NSError *error;
+            if (![datastore compactWithTimeBudget:MIN(remaining, kCompactionSlice)
+                                        rowBudget:0
+                                         finished:&finished
+                                            error:&error]) {
+                os_log_error(CDTOSLog, "Background compaction of %{public}@ failed: %{public}@",
+                             datastore.name, error);
+                break;
+            }
+        }
+    }
+    [self finishRun:run];
+}
+
+// The host of one of the replications' remote databases, to check how the network reaches it.
+- (NSString *)remoteHost
+{
+    NSArray<CDTAbstractReplication *> *replications;
+    @synchronized(self) { replications = _replications.allValues; }
+    for (CDTAbstractReplication *replication in replications) {
+        NSURL *remote = $castIf(CDTPullReplication, replication).source
+                            ?: $castIf(CDTPushReplication, replication).target;
+        if (remote.host) return remote.host;
+    }
+    return nil;
+}
+
+- (BOOL)isChargingOnWiFi
+{
+#if TARGET_OS_IOS
+    __block UIDeviceBatteryState batteryState;
+    dispatch_sync(dispatch_get_main_queue(), ^{
+        UIDevice *device = [UIDevice currentDevice];
+        BOOL monitoring = device.batteryMonitoringEnabled;
+        device.batteryMonitoringEnabled = YES;
+        batteryState = device.batteryState;
+        device.batteryMonitoringEnabled = monitoring;
+    });
+    if (batteryState != UIDeviceBatteryStateCharging && batteryState != UIDeviceBatteryStateFull) {
+        return NO;
+    }
+#endif
+
+    // With nothing to replicate with, maintenance needs no network.
+    NSString *host = [self remoteHost];
+    if (!host) return YES;
+    TDReachability *reachability = [[TDReachability alloc] initWithHostName:host];
+    BOOL onWiFi = [reachability start] && reachability.reachableByWiFi;
+    [reachability stop];
+    return onWiFi;
+}
+
+#pragma mark Background tasks
+
+#if TARGET_OS_IOS
+
+- (BOOL)registerTasksWithRefreshIdentifier:(NSString *)refreshIdentifier
+                      processingIdentifier:(NSString *)processingIdentifier
+{
+    BGTaskScheduler *scheduler = [BGTaskScheduler sharedScheduler];
+    __weak CDTBackgroundReplicationScheduler *weakSelf = self;
+    void (^launch)(BGTask *, BOOL) = ^(BGTask *task, BOOL maintenance) {
+        CDTBackgroundReplicationScheduler *strongSelf = weakSelf;
+        // Registered tasks outlive their scheduler, but must still be ended.
+        if (!strongSelf) [task setTaskCompletedWithSuccess:NO];
+        [strongSelf runTask:task maintenance:maintenance];
+    };
+    BOOL registered = [scheduler registerForTaskWithIdentifier:refreshIdentifier
+                                                    usingQueue:nil
+                                                 launchHandler:^(BGTask *task) {
+                                                     launch(task, NO);
+                                                 }];
+    if (registered && processingIdentifier) {
+        registered = [scheduler registerForTaskWithIdentifier:processingIdentifier
+                                                   usingQueue:nil
+                                                launchHandler:^(BGTask *task) {
+                                                    launch(task, YES);
+                                                }];
+    }
+    if (!registered) {
+        os_log_error(CDTOSLog, "Background tasks %{public}@ and %{public}@ not registered",
+                     refreshIdentifier, processingIdentifier);
+        return NO;
+    }
+    @synchronized(self)
+    {
+        _refreshIdentifier = [refreshIdentifier copy];
+        _processingIdentifier = [processingIdentifier copy];
+    }
+    return YES;
+}
+
+- (void)scheduleTasks
+{
+    NSString *refreshIdentifier, *processingIdentifier;
+    @synchronized(self)
+    {
+        refreshIdentifier = _refreshIdentifier;
+        processingIdentifier = _processingIdentifier;
+    }
+    if (!refreshIdentifier) return;
+
+    BGTaskScheduler *scheduler = [BGTaskScheduler sharedScheduler];
+    NSError *error;
+    BGAppRefreshTaskRequest *refresh =
+        [[BGAppRefreshTaskRequest alloc] initWithIdentifier:refreshIdentifier];
+    refresh.earliestBeginDate = [NSDate dateWithTimeIntervalSinceNow:self.refreshInterval];
+    if (![scheduler submitTaskRequest:refresh error:&error]) {
+        os_log_error(CDTOSLog, "Background task %{public}@ not scheduled: %{public}@",
+                     refreshIdentifier, error);
+    }
+
+    if (processingIdentifier) {
+        BGProcessingTaskRequest *processing =
+            [[BGProcessingTaskRequest alloc] initWithIdentifier:processingIdentifier];
+        processing.requiresExternalPower = YES;
+        processing.requiresNetworkConnectivity = YES;
+        if (![scheduler submitTaskRequest:processing error:&error]) {
+            os_log_error(CDTOSLog, "Background task %{public}@ not scheduled: %{public}@",
+                         processingIdentifier, error);
+        }
+    }
+}
+
+- (void)runTask:(BGTask *)task maintenance:(BOOL)maintenance
+{
+    // Asked for again first, so a run the system cuts short isn't the last.
+    [self scheduleTasks];
+
+    __weak CDTBackgroundReplicationScheduler *weakSelf = self;
+    task.expirationHandler = ^{
+        [weakSelf cancelRun];
+    };
+    [self runWithTimeBudget:maintenance ? self.processingTimeBudget : self.refreshTimeBudget
+                maintenance:maintenance
+          completionHandler:^(BOOL completed) {
+              [task setTaskCompletedWithSuccess:completed];
+          }];
+}
+
+#endif
+
+@end
@@ -0,0 +1,352 @@
+//
+//  CDTDatabaseUpdatesWatcher.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTDatabaseUpdatesWatcher.h"
+
+#import "CDTLogging.h"
+#import "CDTPullReplication.h"
+#import "CDTReplicator.h"
+#import "CDTReplicatorDelegate.h"
+#import "CDTReplicatorFactory.h"
+#import "TDAuthorizer.h"
+
+static const NSTimeInterval kDefaultFeedTimeout = 60;
+static const NSTimeInterval kDefaultMaximumRetryDelay = 5 * 60;
+
+// A feed request answered sooner than this with no updates is followed by a pause, so a server
+// which doesn't hold the request open isn't asked again and again.
+static const NSTimeInterval kMinimumEmptyPoll = 1;
+
+@interface CDTDatabaseUpdatesWatcher () <CDTReplicatorDelegate>
+@end
+
+@implementation CDTDatabaseUpdatesWatcher {
+    NSURL *_serverURL;  // without the credentials, which are in _authorizer
+    TDBasicAuthorizer *_authorizer;
+    NSURLSession *_session;
+    dispatch_queue_t _queue;  // the feed's responses, and starting replicators
+
+    NSMutableDictionary<NSString *, CDTPullReplication *> *_replications;
+    NSMutableDictionary<NSString *, CDTReplicator *> *_replicators;  // those running
+    NSMutableSet<NSString *> *_rerun;  // those woken again while running
+
+    // Each -start begins a new generation, so responses and timers left over from an earlier
+    // one do nothing.
+    BOOL _watching;
+    NSUInteger _generation;
+    NSURLSessionDataTask *_task;
+
+    // Only used on _queue:
+    id _since;  // nil if the server gives no sequences, or "now" until it has given one
+    NSTimeInterval _retryDelay;
+}
+
+- (instancetype)initWithServerURL:(NSURL *)serverURL replicatorFactory:(CDTReplicatorFactory *)factory
+{
+    self = [super init];
+    if (self) {
+        _factory = factory;
+        _authorizer = [[TDBasicAuthorizer alloc] initWithURL:serverURL];
+        NSURLComponents *components =
+            [NSURLComponents componentsWithURL:serverURL resolvingAgainstBaseURL:YES];
+        components.user = nil;
+        components.password = nil;
+        _serverURL = components.URL ?: serverURL;
+        _session = [NSURLSession
+            sessionWithConfiguration:[NSURLSessionConfiguration defaultSessionConfiguration]];
+        _queue = dispatch_queue_create("com.cloudant.sync.dbupdates",
+                                       dispatch_queue_attr_make_with_qos_class(
+                                           DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0));
+        _replications = [NSMutableDictionary dictionary];
+        _replicators = [NSMutableDictionary dictionary];
+        _rerun = [NSMutableSet set];
+        _feedTimeout = kDefaultFeedTimeout;
+        _maximumRetryDelay = kDefaultMaximumRetryDelay;
+    }
+    return self;
+}
+
+- (void)dealloc { [_session invalidateAndCancel]; }
+
+#pragma mark Replications
+
+- (void)addReplication:(CDTPullReplication *)replication identifier:(NSString *)identifier
+{
+    @synchronized(self) { _replications[identifier] = [replication copy]; }
+}
+
+- (void)removeReplicationWithIdentifier:(NSString *)identifier
+{
+    @synchronized(self)
+    {
+        [_replications removeObjectForKey:identifier];
+        [_rerun removeObject:identifier];
+    }
+}
+
+- (NSArray<NSString *> *)identifiersOfReplicationsFromDatabases:(NSArray<NSString *> *)dbNames
+{
+    NSSet<NSString *> *names = [NSSet setWithArray:dbNames];
+    NSMutableArray<NSString *> *identifiers = [NSMutableArray array];
+    @synchronized(self)
+    {
+        [_replications enumerateKeysAndObjectsUsingBlock:^(NSString *identifier,
+                                                           CDTPullReplication *replication,
+                                                           BOOL *stop) {
+            if ([names containsObject:replication.source.lastPathComponent]) {
+                [identifiers addObject:identifier];
+            }
+        }];
+    }
+    return [identifiers sortedArrayUsingSelector:@selector(compare:)];
+}
+
+// Must be called on _queue.
+- (void)wakeReplicationWithIdentifier:(NSString *)identifier
+{
+    CDTPullReplication *replication;
+    @synchronized(self)
+    {
+        if (!_watching) return;
+        if (_replicators[identifier]) {
+            [_rerun addObject:identifier];
+            return;
+        }
+        replication = [_replications[identifier] copy];
+    }
+    if (!replication) return;
+    replication.continuous = NO;
+
+    NSError *error;
+    CDTReplicator *replicator = [self.factory oneWay:replication error:&error];
+    replicator.delegate = self;
+    @synchronized(self)
+    {
+        if (replicator) _replicators[identifier] = replicator;
+    }
+    if (!replicator || ![replicator startWithError:&error]) {
+        os_log_error(CDTOSLog, "Replication %{public}@ not started for a database update: %{public}@",
+                     identifier, error);
+        @synchronized(self) { [_replicators removeObjectForKey:identifier]; }
+    }
+}
+
+// Must be called on _queue.
+- (void)wakeAllReplications
+{
+    NSArray<NSString *> *identifiers;
+    @synchronized(self) { identifiers = _replications.allKeys; }
+    for (NSString *identifier in identifiers) {
+        [self wakeReplicationWithIdentifier:identifier];
+    }
+}
+
+- (void)replicatorDidChangeState:(CDTReplicator *)replicator
+{
+    if (replicator.isActive) return;
+    dispatch_async(_queue, ^{
+        NSString *identifier;
+        BOOL rerun;
+        @synchronized(self)
+        {
+            identifier = [self->_replicators allKeysForObject:replicator].firstObject;
+            if (!identifier) return;
+            [self->_replicators removeObjectForKey:identifier];
+            rerun = [self->_rerun containsObject:identifier];
+            [self->_rerun removeObject:identifier];
+        }
+        os_log_debug(CDTOSLog, "Replication %{public}@ %{public}@%{public}s", identifier,
+                     [CDTReplicator stringForReplicatorState:replicator.state],
+                     rerun ? ", running again" : "");
+        if (rerun) [self wakeReplicationWithIdentifier:identifier];
+    });
+}
+
+#pragma mark Following the feed
+
+- (BOOL)isRunning
+{
+    @synchronized(self) { return _watching; }
+}
+
+- (void)start
+{
+    NSUInteger generation;
+    @synchronized(self)
+    {
+        if (_watching) return;
+        _watching = YES;
+        generation = ++_generation;
+    }
+    os_log_info(CDTOSLog, "Watching %{public}@ for database updates", _serverURL);
+    dispatch_async(_queue, ^{
+        self->_since = @"now";
+        self->_retryDelay = 0;
+        [self wakeAllReplications];
+        [self requestUpdatesInGeneration:generation];
+    });
+}
+
+- (void)stop
+{
+    NSURLSessionDataTask *task;
+    @synchronized(self)
+    {
+        if (!_watching) return;
+        _watching = NO;
+        ++_generation;
+        task = _task;
+        _task = nil;
+    }
+    os_log_info(CDTOSLog, "Stopped watching %{public}@ for database updates", _serverURL);
+    [task cancel];
+}
+
+// Must be called on _queue.
+- (void)requestUpdatesInGeneration:(NSUInteger)generation
+{
+    NSURLComponents *components =
+        [NSURLComponents componentsWithURL:[_serverURL URLByAppendingPathComponent:@"_db_updates"]
+                   resolvingAgainstBaseURL:YES];
+    NSTimeInterval timeout = self.feedTimeout;
+    NSMutableArray<NSURLQueryItem *> *query = [NSMutableArray arrayWithArray:@[
+        [NSURLQueryItem queryItemWithName:@"feed" value:@"longpoll"],
+        [NSURLQueryItem queryItemWithName:@"timeout"
+                                    value:[NSString stringWithFormat:@"%.0f", timeout * 1000]]
+    ]];
+    if (_since) {
+        [query addObject:[NSURLQueryItem queryItemWithName:@"since"
+                                                     value:[NSString stringWithFormat:@"%@", _since]]];
+    }
+    components.queryItems = query;
+
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:components.URL];
+    request.timeoutInterval = timeout + 30;
+    [request setValue:@"application/json" forHTTPHeaderField:@"Accept"];
+    NSString *authorization = [_authorizer authorizeURLRequest:request forRealm:nil];
+    if (authorization) [request setValue:authorization forHTTPHeaderField:@"Authorization"];
+
+    CFAbsoluteTime sent = CFAbsoluteTimeGetCurrent();
+    __weak CDTDatabaseUpdatesWatcher *weakSelf = self;
+    dispatch_queue_t queue = _queue;
+    NSURLSessionDataTask *task = [_session
+        dataTaskWithRequest:request
+          completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+              dispatch_async(queue, ^{
+                  [weakSelf receivedUpdates:data
+                                   response:response
+                                      error:error
+                                   duration:CFAbsoluteTimeGetCurrent() - sent
+                               inGeneration:generation];
+              });
+          }];
+    @synchronized(self)
+    {
+        if (generation != _generation) return;
+        _task = task;
+    }
+    [task resume];
+}
+
+// Must be called on _queue.
+- (void)receivedUpdates:(NSData *)data
+               response:(NSURLResponse *)response
+                  error:(NSError *)error
+               duration:(NSTimeInterval)duration
+           inGeneration:(NSUInteger)generation
+{
+    @synchronized(self)
+    {
+        if (generation != _generation) return;
+        _task = nil;
+    }
+
+    NSInteger status = [$castIf(NSHTTPURLResponse, response) statusCode];
+    id json = data.length ? [NSJSONSerialization JSONObjectWithData:data options:0 error:NULL]
+                          : nil;
+    if (error || status >= 300 || !json) {
+        _retryDelay = MIN(MAX(_retryDelay * 2, 1.0), self.maximumRetryDelay);
+        os_log_info(CDTOSLog, "Database updates from %{public}@ not read (status %ld, %{public}@); "
+                              "trying again in %.0f seconds",
+                    _serverURL, (long)status, error, _retryDelay);
+        [self requestUpdatesAfter:_retryDelay inGeneration:generation wakingAll:YES];
+        return;
+    }
+    _retryDelay = 0;
+
+    id lastSequence;
+    NSArray<NSString *> *dbNames = [[self class] updatedDatabaseNamesInResponse:json
+                                                                  lastSequence:&lastSequence];
+    // A server giving no sequences can't resume the feed, so it's asked for what's new from now.
+    _since = lastSequence;
+    NSArray<NSString *> *identifiers = [self identifiersOfReplicationsFromDatabases:dbNames];
+    if (identifiers.count > 0) {
+        os_log_debug(CDTOSLog, "Databases %{public}@ updated, running %{public}@", dbNames,
+                     identifiers);
+    }
+    for (NSString *identifier in identifiers) {
+        [self wakeReplicationWithIdentifier:identifier];
+    }
+
+    if (dbNames.count == 0 && duration < kMinimumEmptyPoll) {
+        [self requestUpdatesAfter:kMinimumEmptyPoll inGeneration:generation wakingAll:NO];
+    } else {
+        [self requestUpdatesInGeneration:generation];
+    }
+}
+
+// Must be called on _queue. Once the feed has failed, updates may have been missed, unless it can
+// be resumed from a sequence the server gave, so then all the replications are run.
+- (void)requestUpdatesAfter:(NSTimeInterval)delay
+               inGeneration:(NSUInteger)generation
+                  wakingAll:(BOOL)wakeAll
+{
+    __weak CDTDatabaseUpdatesWatcher *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), _queue, ^{
+        CDTDatabaseUpdatesWatcher *strongSelf = weakSelf;
+        if (!strongSelf) return;
+        @synchronized(strongSelf)
+        {
+            if (generation != strongSelf->_generation) return;
+        }
+        id since = strongSelf->_since;
+        if (wakeAll && (!since || [since isEqual:@"now"])) [strongSelf wakeAllReplications];
+        [strongSelf requestUpdatesInGeneration:generation];
+    });
+}
+
+// CouchDB 2 and later, and Cloudant, answer {"results": [{"db_name", "type", "seq"}, ...],
+// "last_seq"}; CouchDB 1 answers with a single {"db_name", "type"} and no sequence.
++ (NSArray<NSString *> *)updatedDatabaseNamesInResponse:(id)response
+                                           lastSequence:(id *)outLastSequence
+{
+    NSDictionary *dict = $castIf(NSDictionary, response);
+    NSArray *results = $castIf(NSArray, dict[@"results"]) ?: (dict ? @[ dict ] : @[]);
+    NSMutableOrderedSet<NSString *> *names = [NSMutableOrderedSet orderedSet];
+    for (NSDictionary *result in results) {
+        if (![result isKindOfClass:[NSDictionary class]]) continue;
+        NSString *name = $castIf(NSString, result[@"db_name"]);
+        NSString *type = $castIf(NSString, result[@"type"]);
+        if (name && ([type isEqualToString:@"updated"] || [type isEqualToString:@"created"])) {
+            [names addObject:name];
+        }
+    }
+    if (outLastSequence) {
+        id lastSequence = dict[@"last_seq"];
+        *outLastSequence = [lastSequence isKindOfClass:[NSNull class]] ? nil : lastSequence;
+    }
+    return names.array;
+}
+
+@end
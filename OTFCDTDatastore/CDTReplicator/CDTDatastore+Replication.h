@@ -14,6 +14,8 @@
 #import "CDTDatastore.h"
 #import "CDTReplicatorDelegate.h"
 
+@class CDTPushReplication;
+
 NS_ASSUME_NONNULL_BEGIN
 
 @interface CDTDatastore (Replication)
@@ -152,6 +154,69 @@ NS_SWIFT_NAME(pull(from:replicator:username:password:completionHandler:));
                  completionHandler:(void (^ __nonnull)(NSError* __nullable)) completionHandler
 NS_SWIFT_NAME(pull(from:IAMAPIKey:completionHandler:));
 
+/**
+ Purges documents deleted more than `age` seconds ago, as
+ -purgeTombstonesOlderThan:timeBudget:purged:finished:error: does, but only once `replication`
+ has pushed their deletions to its target, so the target still learns of them. Deletions pushed
+ since `replication` last checkpointed are left for a later call.
+
+ @param age            How long ago, in seconds, documents have to have been deleted to be purged.
+ @param replication    The push replication from this datastore the deletions must have gone out with.
+ @param timeBudget     Roughly how long, in seconds, the call may take.
+ @param purged         On return, how many documents were purged.
+ @param finished       On return, YES if every tombstone has been looked at.
+ @param error          Will point to an NSError object in the case of an error.
+ */
+- (BOOL)purgeTombstonesOlderThan:(NSTimeInterval)age
+           pushedWithReplication:(CDTPushReplication *)replication
+                      timeBudget:(NSTimeInterval)timeBudget
+                          purged:(nullable NSUInteger *)purged
+                        finished:(nullable BOOL *)finished
+                           error:(NSError *__autoreleasing *)error;
+
+/**
+ Fetches documents from the source of pullThroughReplication, blocking until they've been
+ inserted into this datastore. Documents already here are left alone, unless they were pulled
+ through before and haven't changed since, in which case they're brought up to date. Documents
+ the source doesn't have are skipped. If pullThroughMaxAge is set, documents pulled through too
+ long ago are evicted afterwards.
+
+ @param documentIds    The IDs of the documents to fetch.
+ @param error          Will point to an NSError object in the case of an error, including when
+                       pullThroughReplication isn't set or the fetch times out.
+ */
+- (BOOL)pullThroughDocumentsWithIds:(NSArray<NSString *> *)documentIds
+                              error:(NSError *__autoreleasing *)error;
+
+/**
+ Removes documents pulled through by pullThroughReplication more than `age` seconds ago, with
+ their revision history. Documents changed since they were fetched are kept. Evicted documents
+ are taken out of the datastore's query indexes too.
+
+ @param age            How long ago, in seconds, documents have to have been fetched to be evicted.
+ @param evicted        On return, how many documents were evicted.
+ @param error          Will point to an NSError object in the case of an error.
+ */
+- (BOOL)evictPulledThroughDocumentsOlderThan:(NSTimeInterval)age
+                                     evicted:(nullable NSUInteger *)evicted
+                                       error:(NSError *__autoreleasing *)error;
+
+/**
+ Replicates this datastore to another one in the same process, blocking until it's done. It
+ does what a push replication to the other datastore would, but reads the changes and inserts
+ them directly, with their revision histories, rather than over HTTP: attachments are
+ hard-linked from one datastore's attachments directory to the other's (or copied, where
+ either datastore is encrypted). Like a push replication, it continues from a checkpoint that
+ is saved in this datastore.
+
+ @param target         The datastore to replicate to.
+ @param replicated     On return, how many revisions were added to the target.
+ @param error          Will point to an NSError object in the case of an error.
+ */
+- (BOOL)replicateToDatastore:(CDTDatastore *)target
+                  replicated:(nullable NSUInteger *)replicated
+                       error:(NSError *__autoreleasing *)error;
+
 @end
 
 NS_ASSUME_NONNULL_END
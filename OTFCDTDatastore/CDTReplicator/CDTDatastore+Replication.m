@@ -12,9 +12,20 @@
 
 
 #import "CDTDatastore+Replication.h"
+#import "CDTDatastore+Internal.h"
 #import "CDTPushReplication.h"
 #import "CDTPullReplication.h"
 #import "CDTReplicator.h"
+#import "TDReplicator.h"
+#import "TDStatus.h"
+#import "TD_Database+Tombstones.h"
+#import "TD_Database+PullThrough.h"
+#import "TD_Database+LocalReplication.h"
+#import "CDTDocumentCache.h"
+#import "CDTLogging.h"
+
+// How long -pullThroughDocumentsWithIds:error: waits for the documents to arrive.
+static const NSTimeInterval kPullThroughTimeout = 60.0;
 
 @interface CDTDatastoreReplicationDelegate: NSObject<CDTReplicatorDelegate>
 
@@ -58,6 +69,7 @@
 @interface CDTDatastore ()
 
 @property(readonly) CDTDatastoreManager *manager; // this exists in the CDTDatastoreManager
+@property (strong) CDTDocumentCache *documentCache;
 @end
 
 @implementation CDTDatastore (Replication)
@@ -215,7 +227,151 @@
     }
 }
 
+- (BOOL)purgeTombstonesOlderThan:(NSTimeInterval)age
+           pushedWithReplication:(CDTPushReplication *)replication
+                      timeBudget:(NSTimeInterval)timeBudget
+                          purged:(NSUInteger *)purged
+                        finished:(BOOL *)finished
+                           error:(NSError *__autoreleasing *)error
+{
+    // Only used for its checkpoint ID, which is made from the same settings as the
+    // replicator's own; filter blocks aren't part of it.
+    TDReplicator *repl = [[TDReplicator alloc] initWithDB:self.database
+                                                   remote:replication.target
+                                                     push:YES
+                                               continuous:NO
+                                             interceptors:nil];
+    repl.filterParameters = replication.filterParams;
+    repl.selector = replication.filter ? nil : replication.selector;
+    NSString *checkpointID = repl.remoteCheckpointDocID;
+    if (!checkpointID) {
+        if (error) {
+            *error = TDStatusToNSError(kTDStatusBadParam, nil);
+        }
+        return NO;
+    }
 
+    TDStatus status =
+        [self.database purgeTombstonesDeletedBefore:[NSDate dateWithTimeIntervalSinceNow:-age]
+                                 pushedToCheckpoint:checkpointID
+                                         timeBudget:timeBudget
+                                             purged:purged
+                                           finished:finished];
+    if (TDStatusIsError(status)) {
+        if (error) {
+            *error = TDStatusToNSError(status, nil);
+        }
+        return NO;
+    }
+    return YES;
+}
 
+- (BOOL)pullThroughDocumentsWithIds:(NSArray<NSString *> *)documentIds
+                              error:(NSError *__autoreleasing *)error
+{
+    CDTPullReplication *configuration = self.pullThroughReplication;
+    if (!configuration || configuration.target != self) {
+        if (error) {
+            *error = TDStatusToNSError(kTDStatusBadParam, nil);
+        }
+        return NO;
+    }
+
+    NSSet<NSString *> *held = [self.database heldDocumentIDsAmong:documentIds];
+    NSMutableOrderedSet<NSString *> *toFetch = [NSMutableOrderedSet orderedSet];
+    for (NSString *docId in documentIds) {
+        if (![held containsObject:docId]) [toFetch addObject:docId];
+    }
+    if (toFetch.count == 0) {
+        return YES;
+    }
+
+    CDTPullReplication *pull = [configuration copy];
+    pull.documentIDsToFetch = toFetch.array;
+    __block NSError *pullError = nil;
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+    CDTDatastoreReplicationDelegate *delegate =
+        [[CDTDatastoreReplicationDelegate alloc] initWithCompletionHandler:^(NSError *e) {
+            pullError = e;
+            dispatch_semaphore_signal(done);
+        }];
+    CDTReplicator *replicator = [self replicatorWithReplication:pull delegate:delegate error:error];
+    if (!replicator) {
+        return NO;
+    }
+    if (self.sessionConfigDelegate != nil) {
+        replicator.sessionConfigDelegate = self.sessionConfigDelegate;
+    }
+    if (![replicator startWithError:error]) {
+        return NO;
+    }
+    if (dispatch_semaphore_wait(done, dispatch_time(DISPATCH_TIME_NOW,
+                                                    (int64_t)(kPullThroughTimeout * NSEC_PER_SEC)))) {
+        os_log_info(CDTOSLog, "Timed out pulling through %lu documents",
+                    (unsigned long)toFetch.count);
+        [replicator stop];
+        pullError = TDStatusToNSError(kTDStatusUpstreamError, nil);
+    }
+    if (pullError) {
+        if (error) {
+            *error = pullError;
+        }
+        return NO;
+    }
+
+    TDStatus status = [self.database notePulledThroughDocumentIDs:toFetch.array];
+    if (TDStatusIsError(status)) {
+        if (error) {
+            *error = TDStatusToNSError(status, nil);
+        }
+        return NO;
+    }
+
+    if (self.pullThroughMaxAge > 0) {
+        NSError *evictError;
+        if (![self evictPulledThroughDocumentsOlderThan:self.pullThroughMaxAge
+                                                evicted:NULL
+                                                  error:&evictError]) {
+            // The documents asked for are here, so still a success
+            os_log_error(CDTOSLog, "Couldn't evict pulled through documents: %{public}@",
+                         evictError);
+        }
+    }
+    return YES;
+}
+
+- (BOOL)evictPulledThroughDocumentsOlderThan:(NSTimeInterval)age
+                                     evicted:(NSUInteger *)evicted
+                                       error:(NSError *__autoreleasing *)error
+{
+    if (evicted) *evicted = 0;
+    NSArray<NSString *> *evictedIds = nil;
+    [self openIndexesForPurge];
+    TDStatus status = [self.database
+        evictPulledThroughDocumentsFetchedBefore:[NSDate dateWithTimeIntervalSinceNow:-age]
+                              evictedDocumentIDs:&evictedIds];
+    if (TDStatusIsError(status)) {
+        if (error) {
+            *error = TDStatusToNSError(status, nil);
+        }
+        return NO;
+    }
+
+    // Evictions aren't changes, so nothing else tells the cache
+    for (NSString *docId in evictedIds) {
+        [self.documentCache removeDocumentId:docId];
+    }
+    if (evicted) *evicted = evictedIds.count;
+    return YES;
+}
+
+- (BOOL)replicateToDatastore:(CDTDatastore *)target
+                  replicated:(NSUInteger *)replicated
+                       error:(NSError *__autoreleasing *)error
+{
+    return [self.database replicateToDatabase:target.database
+                          revisionsReplicated:replicated
+                                        error:error];
+}
 
 @end
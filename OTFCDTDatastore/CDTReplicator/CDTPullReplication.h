@@ -14,6 +14,7 @@
 //  and limitations under the License.
 
 #import "CDTAbstractReplication.h"
+#import "CDTConflictResolver.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -192,6 +193,172 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property (nullable, nonatomic, copy) NSDictionary *filterParams;
 
+/** A Cloudant Query (Mango) selector which the remote source filters the replication with.
+
+ Only documents whose latest revision matches the selector are replicated, without having to
+ write a filter function in a design document:
+
+    pull.selector = @{@"owner": @"alice", @"type": @"task"};
+
+ The selector is sent in the body of the _changes request, using the built-in `_selector`
+ filter, so it is not limited by the length of a URL. Replications with different selectors
+ keep separate checkpoints.
+
+ A selector can't be combined with -filter. If both are set, the selector is ignored.
+
+ See the following for more information:
+
+ * https://console.bluemix.net/docs/services/Cloudant/api/cloudant_query.html#selector-syntax
+ * http://docs.couchdb.org/en/latest/api/database/changes.html#selector
+ */
+@property (nullable, nonatomic, copy) NSDictionary *selector;
+
+/**
+ @name Tuning
+ */
+
+/** Whether to adapt batch sizes and concurrency to the network during the replication.
+
+ By default a pull requests 100 changes at a time from the remote's _changes feed, and fetches
+ revisions in batches of 50 over at most 12 simultaneous connections. These are a compromise:
+ on a fast, close connection larger batches make better use of the bandwidth, while on a slow or
+ congested one fewer connections avoid requests queueing behind each other.
+
+ If this property is YES, the replicator measures the throughput and latency of its fetches and
+ adjusts the batch size and number of connections as it goes, scaling the _changes feed page to
+ match. It also backs off when the server responds with 429 Too Many Requests.
+
+ The default is NO.
+ */
+@property (nonatomic) BOOL adaptiveBatching;
+
+/** Number of _changes feed pages to fetch ahead of those still waiting to be processed.
+
+ The replicator reads the remote's _changes feed a page at a time, and stops reading while it
+ has a backlog of revisions to fetch. With a prefetch depth of 1 or 2, it goes on reading that
+ many pages into memory while the backlog drains, so the link isn't left idle in between. Pages
+ are still processed strictly in feed order, so checkpoints are unaffected.
+
+ The default is 1. Values above 2 are treated as 2; 0 reads a page only once the previous one
+ has been processed.
+ */
+@property (nonatomic) NSUInteger changesFeedPrefetchDepth;
+
+/** Most revisions to hold at once between reading them from the _changes feed and storing them.
+
+ On a large initial pull, the replicator would otherwise read the feed faster than it can fetch
+ and store the revisions listed there. Once this many are outstanding it stops reading the feed,
+ and carries on once enough of them have been stored.
+
+ The default is 5000. 0 leaves the feed limited only by the backlog of revisions to fetch.
+ */
+@property (nonatomic) NSUInteger maxPendingRevisions;
+
+/** Most bytes, estimated, of fetched revisions to hold in memory while they wait to be stored.
+
+ Once the revisions waiting take up this much, no more are fetched, and the _changes feed isn't
+ read, until they've been stored. This bounds memory when documents or their attachments are
+ large, or the datastore is slow to write.
+
+ The default is 32MB. 0 for no limit.
+ */
+@property (nonatomic) UInt64 maxPendingBytes;
+
+/** Whether to download attachments separately from the documents they belong to.
+
+ Normally each revision is fetched together with any attachments the local datastore doesn't
+ have, and isn't stored until they have all arrived, so a few large attachments can hold up
+ many small documents.
+
+ If this property is YES, revisions are fetched and stored without those attachments, which are
+ then downloaded on their own, a few at a time. A download cut off part way through carries on
+ from where it stopped, when the replication is retried or next run, unless the datastore is
+ encrypted. Until all its attachments have arrived, a revision lists only those already
+ downloaded, and isn't pushed by a push replication.
+
+ The default is NO.
+ */
+@property (nonatomic) BOOL deferAttachmentDownloads;
+
+/** Whether to pull only the winning revision of each document, leaving out its conflicts.
+
+ Normally the replicator reads the remote's _changes feed with style=all_docs, and fetches every
+ leaf revision listed, including those of conflict branches that may never be resolved. If this
+ property is YES, the feed is read with style=main_only instead, and only winners are fetched.
+
+ A conflict the remote resolves still reaches the datastore: when a pulled winner lands beside
+ other branches of the document that the datastore already had, each of those branches is
+ fetched again in its latest remote revision, such as the deletion that resolved it. Conflicts
+ made only on the remote, though, aren't pulled, so a conflict resolver, or a later pull without
+ this option, won't see them.
+
+ A pull with this option keeps a different checkpoint from one without, so turning it off means
+ the next pull reads the remote's feed from the start again.
+
+ The default is NO.
+ */
+@property (nonatomic) BOOL winningRevisionsOnly;
+
+/** Picks out documents to fetch before the others, such as those the user is looking at.
+
+ During a long replication, revisions are normally fetched in the order the remote's _changes
+ feed lists them. If this block is set, whenever the replicator starts its next fetches it moves
+ revisions of documents for which the block returns YES ahead of the others it has read from the
+ feed but not yet fetched. The block can consult state the app changes while the replication
+ runs, for example the set of documents on screen, so it should be thread safe and quick: it's
+ called on the replicator's thread, for each waiting revision. Documents further down the feed
+ than the replicator has read aren't known to it yet, so aren't moved.
+
+ The default is nil.
+ */
+@property (nullable, nonatomic, copy) BOOL (^prioritizeDocument)(NSString *documentId);
+
+/** Resolves the conflicts pulled revisions make, as soon as they're stored.
+
+ If this property is set, whenever a batch of pulled revisions leaves a document with conflicting
+ revisions, the resolver is asked to choose its winner, as by
+ CDTDatastore -resolveConflictsForDocument:resolver:error:, within the same transaction. The
+ app never sees the document conflicted, and the resolved revision is sent back to the remote
+ by the next push replication. A document the resolver returns nil for, or whose resolution
+ fails, is left conflicted.
+
+ The resolver is called on the datastore's database queue, with the datastore's writes held up
+ until it returns, so it should be quick, and mustn't use the datastore itself.
+
+ The default is nil.
+ */
+@property (nullable, nonatomic, strong) NSObject<CDTConflictResolver> *conflictResolver;
+
+/** Whether to go on pulling changes as they're made, once the replication has caught up.
+
+ If this property is YES, then after the replication has pulled the changes made so far it keeps
+ a connection open to the remote's continuous _changes feed, and pulls each change as it
+ arrives. The replication doesn't complete; it runs until it's stopped or fails. When the server
+ closes a feed on which nothing has changed, the replicator waits a little longer each time
+ before reconnecting, up to a minute, and it doesn't reconnect while the device is offline.
+
+ The default is NO.
+ */
+@property (nonatomic) BOOL continuous;
+
+/**
+ @name Fetching documents by ID
+ */
+
+/** The IDs of documents to fetch, instead of replicating the remote's changes.
+
+ If this property is set, the replication fetches the current revision of each of these
+ documents, with their history and attachments, using the remote's _bulk_get endpoint. The
+ _changes feed isn't read and no checkpoint is saved, so a later replication of the whole
+ database isn't affected. Documents the remote doesn't have are left out. The replication fails
+ if the remote doesn't support _bulk_get, and is never continuous.
+
+ This is how CDTDatastore -pullThroughDocumentsWithIds:error: fetches documents on demand.
+
+ The default is nil.
+ */
+@property (nullable, nonatomic, copy) NSArray<NSString *> *documentIDsToFetch;
+
 @end
 
 NS_ASSUME_NONNULL_END
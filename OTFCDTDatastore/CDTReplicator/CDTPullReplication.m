@@ -69,6 +69,9 @@
         
         _source = sourceComponents.URL;
         _target = target;
+        _changesFeedPrefetchDepth = 1;
+        _maxPendingRevisions = 5000;
+        _maxPendingBytes = 32 * 1024 * 1024;
     }
     return self;
 }
@@ -90,6 +93,9 @@
         
         _source = sourceComponents.URL;
         _target = target;
+        _changesFeedPrefetchDepth = 1;
+        _maxPendingRevisions = 5000;
+        _maxPendingBytes = 32 * 1024 * 1024;
     }
     return self;
 }
@@ -102,6 +108,17 @@
         copy.target = self.target;
         copy.filter = self.filter;
         copy.filterParams = self.filterParams;
+        copy.selector = self.selector;
+        copy.adaptiveBatching = self.adaptiveBatching;
+        copy.changesFeedPrefetchDepth = self.changesFeedPrefetchDepth;
+        copy.maxPendingRevisions = self.maxPendingRevisions;
+        copy.maxPendingBytes = self.maxPendingBytes;
+        copy.deferAttachmentDownloads = self.deferAttachmentDownloads;
+        copy.winningRevisionsOnly = self.winningRevisionsOnly;
+        copy.prioritizeDocument = self.prioritizeDocument;
+        copy.conflictResolver = self.conflictResolver;
+        copy.continuous = self.continuous;
+        copy.documentIDsToFetch = self.documentIDsToFetch;
     }
 
     return copy;
@@ -109,9 +126,13 @@
 
 - (NSString *)description
 {
-    return [NSString stringWithFormat:@"%@, source: %@, target: %@, headers: %@, interceptors: %@, filter: %@, query_params: %@",
+    return [NSString stringWithFormat:@"%@, source: %@, target: %@, headers: %@, interceptors: %@, filter: %@, query_params: %@, selector: %@, adaptive_batching: %d, prefetch_depth: %lu, max_pending_revisions: %lu, max_pending_bytes: %llu, defer_attachments: %d, winning_revisions_only: %d, continuous: %d, documents_to_fetch: %lu",
             [self class], TDCleanURLtoString(self.source), self.target.name, self.optionalHeaders, self.httpInterceptors,
-            self.filter, self.filterParams];
+            self.filter, self.filterParams, self.selector, self.adaptiveBatching,
+            (unsigned long)self.changesFeedPrefetchDepth, (unsigned long)self.maxPendingRevisions,
+            (unsigned long long)self.maxPendingBytes, self.deferAttachmentDownloads,
+            self.winningRevisionsOnly,
+            self.continuous, (unsigned long)self.documentIDsToFetch.count];
 }
 
 // This is method is overridden and this code placed here so we can provide a better error message
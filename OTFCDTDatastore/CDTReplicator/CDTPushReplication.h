@@ -185,6 +185,72 @@ typedef BOOL (^CDTFilterBlock)(CDTDocumentRevision *__nonnull revision,
  */
 @property (nullable, nonatomic, copy) NSDictionary *filterParams;
 
+/** A Cloudant Query selector which picks the local documents to push.
+
+ Only documents whose latest revision matches the selector are pushed:
+
+    push.selector = @{@"owner": @"alice", @"type": @"task"};
+
+ Unlike -filter, which is given every changed revision, the selector is run as a query against
+ the source datastore's query indexes (see CDTDatastore+Query), so the revisions of documents
+ which don't match are never loaded. Create indexes covering the selector's fields for this to
+ be done in SQL; otherwise the changed documents are loaded and matched as -find: would.
+ Deleted documents have no fields, so their deletions are only pushed by selectors which
+ match them. Replications with different selectors keep separate checkpoints.
+
+ A selector can't be combined with -filter. If both are set, the selector is ignored.
+ */
+@property (nullable, nonatomic, copy) NSDictionary *selector;
+
+/**
+ @name Uploading
+ */
+
+/**
+ Whether to gzip the bodies of the larger requests a push sends.
+
+ The `_revs_diff` and `_bulk_docs` requests which make up most of a push upload are JSON, and
+ typically shrink to around a tenth of their size when compressed, which matters on a slow or
+ metered uplink. If this property is YES, those bodies are compressed off the replicator's
+ thread and sent with `Content-Encoding: gzip`. Should the server refuse a compressed body the
+ request is sent again uncompressed, and the rest of the replication isn't compressed.
+
+ The default is NO.
+ */
+@property (nonatomic) BOOL compressRequestBodies;
+
+/**
+ The most uploads of documents with attachments to send at once.
+
+ Documents whose attachments are all smaller than -multipartAttachmentLength are uploaded
+ together, attachments inline, in `_bulk_docs` requests; each document with a larger attachment
+ is streamed on its own as `multipart/related`. Sending several of these at once, over the
+ replicator's pooled connections, saves waiting a round trip for each.
+
+ The default is 4.
+ */
+@property (nonatomic) NSUInteger maxConcurrentUploads;
+
+/**
+ The length, in bytes, from which an attachment is uploaded in a multipart request of its
+ document's own rather than inline in a `_bulk_docs` request.
+
+ The default is 1MB.
+ */
+@property (nonatomic) unsigned long long multipartAttachmentLength;
+
+/**
+ The most batches of changes to push at once.
+
+ Each batch is checked against the remote with `_revs_diff`, then the missing revisions are read
+ from the datastore and uploaded with `_bulk_docs`. With more than one batch in flight, the next
+ batch is checked and read while the one before it is uploaded, rather than after. The checkpoint
+ still only moves past a batch once it and every batch before it are on the remote.
+
+ The default is 2; 1 pushes one batch at a time.
+ */
+@property (nonatomic) NSUInteger maxBatchesInFlight;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -56,6 +56,9 @@
                       password:(NSString *)password
 {
     if (self = [super initWithUsername:username password:password]) {
+        _maxConcurrentUploads = 4;
+        _multipartAttachmentLength = 1024 * 1024;
+        _maxBatchesInFlight = 2;
         NSURLComponents * targetComponents = [NSURLComponents componentsWithURL:target resolvingAgainstBaseURL:NO];
         if(targetComponents.user && targetComponents.password){
             if (username && password) {
@@ -79,6 +82,9 @@
                      IAMAPIKey:(NSString *)IAMAPIKey
 {
     if (self = [super initWithIAMAPIKey:IAMAPIKey]) {
+        _maxConcurrentUploads = 4;
+        _multipartAttachmentLength = 1024 * 1024;
+        _maxBatchesInFlight = 2;
         NSURLComponents * targetComponents = [NSURLComponents componentsWithURL:target resolvingAgainstBaseURL:NO];
         if (targetComponents.user && targetComponents.password) {
             os_log_debug(CDTOSLog, "Credentials provided via the URL but IAM API key was provided, discarding URL credentials.");
@@ -105,6 +111,11 @@
         copy.target = self.target;
         copy.filter = self.filter;
         copy.filterParams = self.filterParams;
+        copy.selector = self.selector;
+        copy.compressRequestBodies = self.compressRequestBodies;
+        copy.maxConcurrentUploads = self.maxConcurrentUploads;
+        copy.multipartAttachmentLength = self.multipartAttachmentLength;
+        copy.maxBatchesInFlight = self.maxBatchesInFlight;
     }
 
     return copy;
@@ -112,9 +123,9 @@
 
 - (NSString *)description
 {    
-    return [NSString stringWithFormat:@"%@, source: %@, target: %@, headers: %@, interceptors: %@, filter: %@, query_params: %@",
+    return [NSString stringWithFormat:@"%@, source: %@, target: %@, headers: %@, interceptors: %@, filter: %@, query_params: %@, selector: %@, compress: %d",
             [self class], self.source.name, TDCleanURLtoString(self.target), self.optionalHeaders, self.httpInterceptors,
-            self.filter, self.filterParams];
+            self.filter, self.filterParams, self.selector, self.compressRequestBodies];
 }
 
 // This is method is overridden and this code placed here so we can provide a better error message
@@ -0,0 +1,78 @@
+//
+//  CDTReplicationEstimate.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ How much a pull replication has still to transfer, as returned by CDTReplicator
+ -estimatePendingWorkWithCompletionHandler:.
+
+ The counts come from the remote database's info and the `pending` count of its _changes feed
+ after the local checkpoint. The sizes and duration are extrapolated from a sample of the first of
+ those changes, fetched with their documents, so they are only a guide: they assume the rest of
+ the changes are like the sample, and the link stays as fast as it was while fetching it.
+ Attachments the local datastore already has are counted too.
+ */
+@interface CDTReplicationEstimate : NSObject
+
+/** The remote database's update sequence, as given in its info. Opaque. */
+@property (nullable, nonatomic, strong, readonly) id remoteUpdateSequence;
+
+/** Number of documents in the remote database, not counting deleted ones. */
+@property (nonatomic, readonly) NSUInteger remoteDocumentCount;
+
+/** The sequence the pull would carry on from, read from the local checkpoint; nil if the pull
+    would start from the beginning. */
+@property (nullable, nonatomic, strong, readonly) id lastSequence;
+
+/** Number of entries in the remote _changes feed after lastSequence. */
+@property (nonatomic, readonly) NSUInteger pendingChanges;
+
+/** Estimated number of revisions those changes lead to; more than one for a conflicted document. */
+@property (nonatomic, readonly) NSUInteger pendingRevisions;
+
+/** Estimated size of the JSON of the pending revisions, without their attachments. */
+@property (nonatomic, readonly) UInt64 documentBytes;
+
+/** Estimated size of the attachments of the pending revisions, as sent by the remote. */
+@property (nonatomic, readonly) UInt64 attachmentBytes;
+
+/** Estimated time to transfer all of it. */
+@property (nonatomic, readonly) NSTimeInterval estimatedDuration;
+
+/** Number of changes sampled. */
+@property (nonatomic, readonly) NSUInteger sampleSize;
+
+/** YES if the sample is known to have been every pending change, so nothing is extrapolated. */
+@property (nonatomic, readonly, getter=isExact) BOOL exact;
+
+/**
+ Internal: makes an estimate from the remote database's info, the sequence the pull would carry
+ on from, and the response to a _changes request after it with `include_docs=true` and the given
+ limit, which took `duration` to receive `bytesReceived`.
+ */
+- (instancetype)initWithDatabaseInfo:(NSDictionary *)info
+                        lastSequence:(nullable id)lastSequence
+                       sampleChanges:(NSDictionary *)changes
+                         sampleLimit:(NSUInteger)limit
+                      sampleDuration:(NSTimeInterval)duration
+                 sampleBytesReceived:(UInt64)bytesReceived NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+NS_ASSUME_NONNULL_END
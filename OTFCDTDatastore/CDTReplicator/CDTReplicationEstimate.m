@@ -0,0 +1,111 @@
+//
+//  CDTReplicationEstimate.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTReplicationEstimate.h"
+
+#import "CollectionUtils.h"
+#import "TDJSON.h"
+
+@implementation CDTReplicationEstimate
+
+- (instancetype)initWithDatabaseInfo:(NSDictionary *)info
+                        lastSequence:(id)lastSequence
+                       sampleChanges:(NSDictionary *)changes
+                         sampleLimit:(NSUInteger)limit
+                      sampleDuration:(NSTimeInterval)duration
+                 sampleBytesReceived:(UInt64)bytesReceived
+{
+    self = [super init];
+    if (self) {
+        _remoteUpdateSequence = info[@"update_seq"];
+        _remoteDocumentCount = [$castIf(NSNumber, info[@"doc_count"]) unsignedIntegerValue];
+        _lastSequence = lastSequence;
+
+        NSArray *results = $castIf(NSArray, changes[@"results"]);
+        NSUInteger revisions = 0;
+        UInt64 documentBytes = 0, attachmentBytes = 0;
+        for (id result in results) {
+            NSDictionary *change = $castIf(NSDictionary, result);
+            if (!change) continue;
+            _sampleSize++;
+            revisions += MAX($castIf(NSArray, change[@"changes"]).count, (NSUInteger)1);
+
+            NSMutableDictionary *doc = [$castIf(NSDictionary, change[@"doc"]) mutableCopy];
+            NSDictionary *attachments = $castIf(NSDictionary, doc[@"_attachments"]);
+            for (id value in attachments.allValues) {
+                NSDictionary *attachment = $castIf(NSDictionary, value);
+                NSNumber *length = $castIf(NSNumber, attachment[@"encoded_length"])
+                                       ?: $castIf(NSNumber, attachment[@"length"]);
+                attachmentBytes += length.unsignedLongLongValue;
+            }
+            [doc removeObjectForKey:@"_attachments"];
+            if (doc) {
+                documentBytes += [TDJSON dataWithJSONObject:doc options:0 error:nil].length;
+            }
+        }
+
+        // CouchDB 2 and Cloudant say how many changes are left after a page; otherwise a short
+        // page is the last, and otherwise the database's info gives an upper bound.
+        NSNumber *pending = $castIf(NSNumber, changes[@"pending"]);
+        if (pending) {
+            _pendingChanges = _sampleSize + pending.unsignedIntegerValue;
+            _exact = (pending.unsignedIntegerValue == 0);
+        } else if (_sampleSize < limit) {
+            _pendingChanges = _sampleSize;
+            _exact = YES;
+        } else {
+            _pendingChanges = MAX(_sampleSize, [CDTReplicationEstimate changesAfter:lastSequence
+                                                                        databaseInfo:info]);
+        }
+
+        double scale = _sampleSize > 0 ? (double)_pendingChanges / _sampleSize : 0;
+        _pendingRevisions = (NSUInteger)llround(revisions * scale);
+        _documentBytes = (UInt64)llround(documentBytes * scale);
+        _attachmentBytes = (UInt64)llround(attachmentBytes * scale);
+
+        // The revisions are fetched at about the pace the sample was; the attachments, which
+        // it didn't include, at the rate its bytes arrived.
+        _estimatedDuration = duration * scale;
+        if (duration > 0 && bytesReceived > 0) {
+            _estimatedDuration += _attachmentBytes / (bytesReceived / duration);
+        }
+    }
+    return self;
+}
+
+// The most changes there can be after a sequence, if the database's info says.
++ (NSUInteger)changesAfter:(id)lastSequence databaseInfo:(NSDictionary *)info
+{
+    if (!lastSequence) {
+        return [$castIf(NSNumber, info[@"doc_count"]) unsignedIntegerValue] +
+               [$castIf(NSNumber, info[@"doc_del_count"]) unsignedIntegerValue];
+    }
+    // Only CouchDB 1's sequences are numbers which can be subtracted.
+    NSNumber *last = $castIf(NSNumber, lastSequence);
+    NSNumber *update = $castIf(NSNumber, info[@"update_seq"]);
+    if (last && update && update.unsignedLongLongValue > last.unsignedLongLongValue) {
+        return (NSUInteger)(update.unsignedLongLongValue - last.unsignedLongLongValue);
+    }
+    return 0;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"%@, pending_changes: %lu, pending_revisions: %lu, document_bytes: %llu, attachment_bytes: %llu, duration: %.1f, sample_size: %lu, exact: %d",
+            [self class], (unsigned long)self.pendingChanges, (unsigned long)self.pendingRevisions,
+            self.documentBytes, self.attachmentBytes, self.estimatedDuration,
+            (unsigned long)self.sampleSize, self.exact];
+}
+
+@end
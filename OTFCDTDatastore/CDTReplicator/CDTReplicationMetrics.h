@@ -0,0 +1,114 @@
+//
+//  CDTReplicationMetrics.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/** Number of buckets in CDTEndpointMetrics.latencyHistogram. */
+extern const NSUInteger CDTLatencyHistogramBucketCount;
+
+/**
+ Request statistics for one kind of HTTP request made by a replication, e.g. for `_changes`.
+ */
+@interface CDTEndpointMetrics : NSObject <NSCopying>
+
+/** Number of requests made, including retries. */
+@property (readonly) NSUInteger requestCount;
+
+/** Number of requests that failed, or had an HTTP status of 400 or more. */
+@property (readonly) NSUInteger errorCount;
+
+@property (readonly) UInt64 bytesSent;
+@property (readonly) UInt64 bytesReceived;
+
+/** Sum of the latencies of all the requests, i.e., time from being sent to completing. */
+@property (readonly) NSTimeInterval totalLatency;
+@property (readonly) NSTimeInterval maxLatency;
+
+/** Number of requests whose latency fell into each bucket. Bucket i counts the requests which took
+    less than +latencyBucketUpperBounds[i] (and at least the previous bound); the last bucket counts
+    the rest. */
+@property (readonly) NSArray<NSNumber *> *latencyHistogram;
+
+/** Upper bounds of the latency histogram buckets, in seconds, one fewer than there are buckets. */
++ (NSArray<NSNumber *> *)latencyBucketUpperBounds;
+
+@end
+
+/**
+ Where a replication is spending its time. CDTReplicator.metrics returns a snapshot of these; it
+ is safe to read from any thread.
+
+ Recording these costs a few counter updates per HTTP request and per batch, so they are always
+ collected.
+ */
+@interface CDTReplicationMetrics : NSObject <NSCopying>
+
+/** Total bytes sent and received in HTTP bodies. */
+@property (readonly) UInt64 bytesSent;
+@property (readonly) UInt64 bytesReceived;
+
+/**
+ Request statistics, keyed by endpoint: the first path component of the request beginning with
+ `_`, such as `_changes`, `_bulk_get`, `_revs_diff`, `_bulk_docs` or `_local`; or
+ `document` for requests to documents and their attachments.
+ */
+@property (readonly) NSDictionary<NSString *, CDTEndpointMetrics *> *endpoints;
+
+/** Number of HTTP requests retried, whether after a transient error or a 429 response. */
+@property (readonly) NSUInteger retryCount;
+
+/** Number of 429 (Too Many Requests) responses. */
+@property (readonly) NSUInteger throttledCount;
+
+/** Number of documents replicated so far. */
+@property (readonly) NSUInteger documentsProcessed;
+
+/** Time since the replication started. */
+@property (readonly) NSTimeInterval elapsedTime;
+
+/** documentsProcessed / elapsedTime. */
+@property (readonly) double documentsPerSecond;
+
+/** For pull replications, time spent inserting revisions into the local database, and the number of
+    revisions inserted. */
+@property (readonly) NSTimeInterval insertTime;
+@property (readonly) NSUInteger insertCount;
+
+/** Current and highest number of revisions waiting in the replicator's inbox to be processed. */
+@property (readonly) NSUInteger queueDepth;
+@property (readonly) NSUInteger maxQueueDepth;
+
+/*
+ Private so no docs. Used by the replicator to record the metrics; all are thread-safe.
+ */
+- (void)recordRequestWithURL:(NSURL *)url
+                  statusCode:(NSInteger)statusCode
+                      failed:(BOOL)failed
+                   bytesSent:(UInt64)bytesSent
+               bytesReceived:(UInt64)bytesReceived
+                     latency:(NSTimeInterval)latency;
+- (void)recordRetry;
+- (void)recordInsertOfRevisions:(NSUInteger)count duration:(NSTimeInterval)duration;
+- (void)recordQueueDepth:(NSUInteger)depth;
+- (void)recordDocumentsProcessed:(NSUInteger)count;
+- (void)restart;
+
+/** Returns the endpoint name under which a request to the URL is recorded. */
++ (NSString *)endpointForURL:(NSURL *)url;
+
+@end
+
+NS_ASSUME_NONNULL_END
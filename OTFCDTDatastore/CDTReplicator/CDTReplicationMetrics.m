@@ -0,0 +1,253 @@
+//
+//  CDTReplicationMetrics.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTReplicationMetrics.h"
+
+#define kBucketCount 11
+
+const NSUInteger CDTLatencyHistogramBucketCount = kBucketCount;
+
+static const NSTimeInterval kBucketUpperBounds[kBucketCount - 1] = {
+    0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0};
+
+@interface CDTEndpointMetrics () {
+   @public
+    NSUInteger _requestCount, _errorCount;
+    UInt64 _bytesSent, _bytesReceived;
+    NSTimeInterval _totalLatency, _maxLatency;
+    NSUInteger _buckets[kBucketCount];
+}
+@end
+
+@implementation CDTEndpointMetrics
+
++ (NSArray<NSNumber *> *)latencyBucketUpperBounds
+{
+    NSMutableArray *bounds = [NSMutableArray arrayWithCapacity:kBucketCount - 1];
+    for (NSUInteger i = 0; i < kBucketCount - 1; i++) {
+        [bounds addObject:@(kBucketUpperBounds[i])];
+    }
+    return bounds;
+}
+
+- (NSUInteger)requestCount { return _requestCount; }
+- (NSUInteger)errorCount { return _errorCount; }
+- (UInt64)bytesSent { return _bytesSent; }
+- (UInt64)bytesReceived { return _bytesReceived; }
+- (NSTimeInterval)totalLatency { return _totalLatency; }
+- (NSTimeInterval)maxLatency { return _maxLatency; }
+
+- (NSArray<NSNumber *> *)latencyHistogram
+{
+    NSMutableArray *histogram = [NSMutableArray arrayWithCapacity:kBucketCount];
+    for (NSUInteger i = 0; i < kBucketCount; i++) {
+        [histogram addObject:@(_buckets[i])];
+    }
+    return histogram;
+}
+
+- (void)recordLatency:(NSTimeInterval)latency
+{
+    NSUInteger bucket = 0;
+    while (bucket < kBucketCount - 1 && latency >= kBucketUpperBounds[bucket]) bucket++;
+    _buckets[bucket]++;
+    _totalLatency += latency;
+    _maxLatency = MAX(_maxLatency, latency);
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    CDTEndpointMetrics *copy = [[CDTEndpointMetrics allocWithZone:zone] init];
+    copy->_requestCount = _requestCount;
+    copy->_errorCount = _errorCount;
+    copy->_bytesSent = _bytesSent;
+    copy->_bytesReceived = _bytesReceived;
+    copy->_totalLatency = _totalLatency;
+    copy->_maxLatency = _maxLatency;
+    memcpy(copy->_buckets, _buckets, sizeof(_buckets));
+    return copy;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@ %lu requests, %lu errors, %.3f sec>",
+                                      [self class], (unsigned long)_requestCount,
+                                      (unsigned long)_errorCount, _totalLatency];
+}
+
+@end
+
+@implementation CDTReplicationMetrics {
+    UInt64 _bytesSent, _bytesReceived;
+    NSMutableDictionary<NSString *, CDTEndpointMetrics *> *_endpoints;
+    NSUInteger _retryCount, _throttledCount;
+    NSUInteger _documentsProcessed;
+    CFAbsoluteTime _startTime, _endTime;  // _endTime is set in snapshots only
+    NSTimeInterval _insertTime;
+    NSUInteger _insertCount;
+    NSUInteger _queueDepth, _maxQueueDepth;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _endpoints = [NSMutableDictionary dictionary];
+        _startTime = CFAbsoluteTimeGetCurrent();
+    }
+    return self;
+}
+
++ (NSString *)endpointForURL:(NSURL *)url
+{
+    for (NSString *component in url.pathComponents) {
+        if ([component hasPrefix:@"_"]) return component;
+    }
+    return @"document";
+}
+
+#pragma mark Recording
+
+- (void)recordRequestWithURL:(NSURL *)url
+                  statusCode:(NSInteger)statusCode
+                      failed:(BOOL)failed
+                   bytesSent:(UInt64)bytesSent
+               bytesReceived:(UInt64)bytesReceived
+                     latency:(NSTimeInterval)latency
+{
+    NSString *endpoint = [[self class] endpointForURL:url];
+    @synchronized(self) {
+        CDTEndpointMetrics *metrics = _endpoints[endpoint];
+        if (!metrics) {
+            metrics = [[CDTEndpointMetrics alloc] init];
+            _endpoints[endpoint] = metrics;
+        }
+        metrics->_requestCount++;
+        if (failed || statusCode >= 400) metrics->_errorCount++;
+        metrics->_bytesSent += bytesSent;
+        metrics->_bytesReceived += bytesReceived;
+        [metrics recordLatency:latency];
+
+        _bytesSent += bytesSent;
+        _bytesReceived += bytesReceived;
+        if (statusCode == 429) _throttledCount++;
+    }
+}
+
+- (void)recordRetry
+{
+    @synchronized(self) {
+        _retryCount++;
+    }
+}
+
+- (void)recordInsertOfRevisions:(NSUInteger)count duration:(NSTimeInterval)duration
+{
+    @synchronized(self) {
+        _insertCount += count;
+        _insertTime += duration;
+    }
+}
+
+- (void)recordQueueDepth:(NSUInteger)depth
+{
+    @synchronized(self) {
+        _queueDepth = depth;
+        _maxQueueDepth = MAX(_maxQueueDepth, depth);
+    }
+}
+
+- (void)recordDocumentsProcessed:(NSUInteger)count
+{
+    @synchronized(self) {
+        _documentsProcessed = count;
+    }
+}
+
+- (void)restart
+{
+    @synchronized(self) {
+        _startTime = CFAbsoluteTimeGetCurrent();
+    }
+}
+
+#pragma mark Reading
+
+- (UInt64)bytesSent { @synchronized(self) { return _bytesSent; } }
+- (UInt64)bytesReceived { @synchronized(self) { return _bytesReceived; } }
+- (NSUInteger)retryCount { @synchronized(self) { return _retryCount; } }
+- (NSUInteger)throttledCount { @synchronized(self) { return _throttledCount; } }
+- (NSUInteger)documentsProcessed { @synchronized(self) { return _documentsProcessed; } }
+- (NSTimeInterval)insertTime { @synchronized(self) { return _insertTime; } }
+- (NSUInteger)insertCount { @synchronized(self) { return _insertCount; } }
+- (NSUInteger)queueDepth { @synchronized(self) { return _queueDepth; } }
+- (NSUInteger)maxQueueDepth { @synchronized(self) { return _maxQueueDepth; } }
+
+- (NSDictionary<NSString *, CDTEndpointMetrics *> *)endpoints
+{
+    @synchronized(self) {
+        NSMutableDictionary *endpoints = [NSMutableDictionary dictionaryWithCapacity:_endpoints.count];
+        [_endpoints enumerateKeysAndObjectsUsingBlock:^(NSString *key, CDTEndpointMetrics *value,
+                                                        BOOL *stop) {
+            endpoints[key] = [value copy];
+        }];
+        return endpoints;
+    }
+}
+
+- (NSTimeInterval)elapsedTime
+{
+    @synchronized(self) {
+        return (_endTime ?: CFAbsoluteTimeGetCurrent()) - _startTime;
+    }
+}
+
+- (double)documentsPerSecond
+{
+    NSTimeInterval elapsed = self.elapsedTime;
+    return elapsed > 0 ? self.documentsProcessed / elapsed : 0;
+}
+
+// Returns a snapshot, whose values (including elapsedTime) don't change.
+- (id)copyWithZone:(NSZone *)zone
+{
+    CDTReplicationMetrics *copy = [[CDTReplicationMetrics allocWithZone:zone] init];
+    @synchronized(self) {
+        copy->_bytesSent = _bytesSent;
+        copy->_bytesReceived = _bytesReceived;
+        copy->_endpoints = [self.endpoints mutableCopy];
+        copy->_retryCount = _retryCount;
+        copy->_throttledCount = _throttledCount;
+        copy->_documentsProcessed = _documentsProcessed;
+        copy->_startTime = _startTime;
+        copy->_endTime = _endTime ?: CFAbsoluteTimeGetCurrent();
+        copy->_insertTime = _insertTime;
+        copy->_insertCount = _insertCount;
+        copy->_queueDepth = _queueDepth;
+        copy->_maxQueueDepth = _maxQueueDepth;
+    }
+    return copy;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@ %lu docs in %.1f sec, %llu bytes in, %llu bytes out, "
+                                      @"%lu retries, %lu throttled, endpoints=%@>",
+                                      [self class], (unsigned long)self.documentsProcessed,
+                                      self.elapsedTime, self.bytesReceived, self.bytesSent,
+                                      (unsigned long)self.retryCount,
+                                      (unsigned long)self.throttledCount, self.endpoints];
+}
+
+@end
@@ -0,0 +1,98 @@
+//
+//  CDTReplicationScheduler.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+#import "CDTAbstractReplication.h"
+
+@class CDTHTTPConnectionBudget;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Shares a fixed amount of replication work between all the replications started from the
+ CDTReplicatorFactory objects that use it.
+
+ At most maxConcurrentReplications run at once, each on its own thread; further replications
+ wait in a queue, highest priority first and then in the order they were started, and are
+ started as running ones stop. Continuous replications never stop of their own accord, so they
+ start straight away and don't take a worker, or they would hold the others up for good. All running replications take their HTTP requests from one
+ connectionBudget, weighted by priority, so a large replication with many requests queued doesn't
+ hold up smaller ones which only need a few.
+
+ All methods are thread-safe.
+ */
+@interface CDTReplicationScheduler : NSObject
+
+/** The scheduler used by CDTReplicatorFactory unless it's given another: four replications at
+    once, sharing four HTTP connections. */
++ (instancetype)sharedScheduler;
+
+/**
+ @param maxConcurrentReplications the size of the worker pool; at least 1.
+ @param maxConnections the number of HTTP requests all replications may have in flight; at least 1.
+ */
+- (instancetype)initWithMaxConcurrentReplications:(NSUInteger)maxConcurrentReplications
+                                   maxConnections:(NSUInteger)maxConnections
+    NS_DESIGNATED_INITIALIZER;
+
+/** Four replications at once, sharing four HTTP connections. */
+- (instancetype)init;
+
+@property (readonly) NSUInteger maxConcurrentReplications;
+
+/** The HTTP connections shared by the scheduled replications. */
+@property (readonly) CDTHTTPConnectionBudget *connectionBudget;
+
+/** Number of replications running on a worker, which continuous ones aren't. */
+@property (readonly) NSUInteger runningCount;
+
+/** Number of replications waiting for a worker. */
+@property (readonly) NSUInteger queuedCount;
+
+/** A replication's share of the connectionBudget. */
++ (NSUInteger)connectionWeightForPriority:(CDTReplicationPriority)priority;
+
+/**
+ Queues a replication, running start once a worker is free; this may be immediately, on the
+ calling thread. The job occupies its worker until -jobFinished: is called.
+
+ @param job identifies the replication to -cancelJob: and -jobFinished:.
+ @param taskGroup optional; entered until start has been called, or the job is cancelled.
+ @param start starts the replication.
+ */
+- (void)enqueueJob:(id)job
+          priority:(CDTReplicationPriority)priority
+         taskGroup:(nullable dispatch_group_t)taskGroup
+             start:(void (^)(void))start;
+
+/**
+ As -enqueueJob:priority:taskGroup:start:, except that a continuous job is started at once, on
+ the calling thread, without taking a worker; it still shares the connectionBudget.
+ */
+- (void)enqueueJob:(id)job
+          priority:(CDTReplicationPriority)priority
+        continuous:(BOOL)continuous
+         taskGroup:(nullable dispatch_group_t)taskGroup
+             start:(void (^)(void))start;
+
+/** Removes a job which is still waiting for a worker. Returns NO if it has already started. */
+- (BOOL)cancelJob:(id)job;
+
+/** Frees the worker of a job which has stopped, starting the next waiting job. */
+- (void)jobFinished:(id)job;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,190 @@
+//
+//  CDTReplicationScheduler.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTReplicationScheduler.h"
+
+#import "CDTHTTPConnectionBudget.h"
+#import "CDTLogging.h"
+
+static const NSUInteger kDefaultMaxConcurrentReplications = 4;
+// The same as CDTURLSession's process-wide limit, which applies to unscheduled replications.
+static const NSUInteger kDefaultMaxConnections = 4;
+
+@interface CDTReplicationSchedulerJob : NSObject
+@property (nonatomic, strong) id job;
+@property (nonatomic) CDTReplicationPriority priority;
+@property (nonatomic, strong) dispatch_group_t taskGroup;
+@property (nonatomic, copy) void (^start)(void);
+@end
+
+@implementation CDTReplicationSchedulerJob
+@end
+
+@implementation CDTReplicationScheduler {
+    NSMutableArray<CDTReplicationSchedulerJob *> *_queue;  // highest priority first, then FIFO
+    NSMutableSet *_running;
+}
+
++ (instancetype)sharedScheduler
+{
+    static CDTReplicationScheduler *sharedScheduler;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedScheduler = [[CDTReplicationScheduler alloc] init];
+    });
+    return sharedScheduler;
+}
+
+- (instancetype)init
+{
+    return [self initWithMaxConcurrentReplications:kDefaultMaxConcurrentReplications
+                                    maxConnections:kDefaultMaxConnections];
+}
+
+- (instancetype)initWithMaxConcurrentReplications:(NSUInteger)maxConcurrentReplications
+                                   maxConnections:(NSUInteger)maxConnections
+{
+    self = [super init];
+    if (self) {
+        _maxConcurrentReplications = MAX(maxConcurrentReplications, (NSUInteger)1);
+        _connectionBudget = [[CDTHTTPConnectionBudget alloc] initWithLimit:maxConnections];
+        _queue = [NSMutableArray array];
+        _running = [NSMutableSet set];
+    }
+    return self;
+}
+
++ (NSUInteger)connectionWeightForPriority:(CDTReplicationPriority)priority
+{
+    switch (priority) {
+        case CDTReplicationPriorityLow:
+            return 1;
+        case CDTReplicationPriorityNormal:
+            return 2;
+        case CDTReplicationPriorityHigh:
+            return 4;
+    }
+    return 2;
+}
+
+- (NSUInteger)runningCount
+{
+    @synchronized(self) { return _running.count; }
+}
+
+- (NSUInteger)queuedCount
+{
+    @synchronized(self) { return _queue.count; }
+}
+
+- (void)enqueueJob:(id)job
+          priority:(CDTReplicationPriority)priority
+         taskGroup:(dispatch_group_t)taskGroup
+             start:(void (^)(void))start
+{
+    [self enqueueJob:job priority:priority continuous:NO taskGroup:taskGroup start:start];
+}
+
+- (void)enqueueJob:(id)job
+          priority:(CDTReplicationPriority)priority
+        continuous:(BOOL)continuous
+         taskGroup:(dispatch_group_t)taskGroup
+             start:(void (^)(void))start
+{
+    if (continuous) {
+        // Not in _running, so -cancelJob: and -jobFinished: leave the workers alone
+        os_log_debug(CDTOSLog, "Scheduler starting continuous %{public}@", job);
+        if (taskGroup) {
+            dispatch_group_enter(taskGroup);
+        }
+        start();
+        if (taskGroup) {
+            dispatch_group_leave(taskGroup);
+        }
+        return;
+    }
+
+    CDTReplicationSchedulerJob *entry = [[CDTReplicationSchedulerJob alloc] init];
+    entry.job = job;
+    entry.priority = priority;
+    entry.taskGroup = taskGroup;
+    entry.start = start;
+    if (taskGroup) {
+        dispatch_group_enter(taskGroup);
+    }
+
+    @synchronized(self)
+    {
+        NSUInteger index = _queue.count;
+        while (index > 0 && _queue[index - 1].priority < priority) {
+            index--;
+        }
+        [_queue insertObject:entry atIndex:index];
+        os_log_debug(CDTOSLog, "Scheduler queued %{public}@ at %{public}lu; %{public}lu running", job, (unsigned long)index, (unsigned long)_running.count);
+    }
+    [self startWaitingJobs];
+}
+
+- (BOOL)cancelJob:(id)job
+{
+    CDTReplicationSchedulerJob *cancelled = nil;
+    @synchronized(self)
+    {
+        for (CDTReplicationSchedulerJob *entry in _queue) {
+            if (entry.job == job) {
+                cancelled = entry;
+                break;
+            }
+        }
+        if (cancelled) {
+            [_queue removeObjectIdenticalTo:cancelled];
+        }
+    }
+    if (cancelled.taskGroup) {
+        dispatch_group_leave(cancelled.taskGroup);
+    }
+    return cancelled != nil;
+}
+
+- (void)jobFinished:(id)job
+{
+    @synchronized(self)
+    {
+        if (![_running containsObject:job]) return;
+        [_running removeObject:job];
+    }
+    [self startWaitingJobs];
+}
+
+- (void)startWaitingJobs
+{
+    while (YES) {
+        CDTReplicationSchedulerJob *next;
+        @synchronized(self)
+        {
+            if (_queue.count == 0 || _running.count >= _maxConcurrentReplications) return;
+            next = _queue[0];
+            [_queue removeObjectAtIndex:0];
+            [_running addObject:next.job];
+        }
+        // Started outside the lock, as starting a job may finish or enqueue others.
+        os_log_debug(CDTOSLog, "Scheduler starting %{public}@", next.job);
+        next.start();
+        if (next.taskGroup) {
+            dispatch_group_leave(next.taskGroup);
+        }
+    }
+}
+
+@end
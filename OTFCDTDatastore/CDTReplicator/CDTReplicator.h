@@ -21,6 +21,10 @@
 @class CDTDatastore;
 @class TD_DatabaseManager;
 @class CDTAbstractReplication;
+@class CDTReplicationScheduler;
+@class CDTReplicationMetrics;
+@class CDTReplicationEstimate;
+@class TDPushChangeSource;
 
 /**
  * Replicator errors.
@@ -46,7 +50,11 @@ typedef NS_ENUM(NSInteger, CDTReplicatorErrors) {
      Programming error: CDTReplicator was deallocated while replication was ongoing. 
      Retain a strong reference to the replicator until replication completes.
      */
-    CDTReplicatorErrorDeallocatedWhileReplicating = 5
+    CDTReplicatorErrorDeallocatedWhileReplicating = 5,
+    /**
+     -estimatePendingWorkWithCompletionHandler: was called for a push replication.
+     */
+    CDTReplicatorErrorEstimateNotSupported = 6
 };
 
 /**
@@ -119,6 +127,14 @@ typedef NS_ENUM(NSInteger, CDTReplicatorState) {
  */
 @property (nonatomic, readonly) NSInteger changesTotal;
 
+/**
+ A snapshot of where the replication has spent its time: bytes transferred, request counts and
+ latencies per endpoint, documents per second, and so on. Nil until the replication has started.
+
+ @see CDTReplicationMetrics
+ */
+@property (nullable, nonatomic, readonly) CDTReplicationMetrics *metrics;
+
 /**
  * Set the replicator's delegate.
  *
@@ -165,6 +181,18 @@ initWithTDDatabaseManager:(nonnull TD_DatabaseManager *)dbManager
       sessionConfigDelegate:(nullable NSObject<CDTNSURLSessionConfigurationDelegate> *)delegate
                       error:(NSError *__autoreleasing __nullable *__nullable)error;
 
+/*
+ Private so no docs. The scheduler which decides when this replicator runs; set by
+ CDTReplicatorFactory. If nil, the replicator runs as soon as it's started.
+ */
+@property (nullable, nonatomic, strong) CDTReplicationScheduler *scheduler;
+
+/*
+ Private so no docs. Shared by the push replicators CDTReplicatorFactory's -fanOut:error: makes,
+ so that the datastore's changes are read and loaded once for them all.
+ */
+@property (nullable, nonatomic, strong) TDPushChangeSource *pushChangeSource;
+
 /*
  Access the underlying NSThread execution state.
  See NSThread Class Reference
@@ -252,6 +280,34 @@ initWithTDDatabaseManager:(nonnull TD_DatabaseManager *)dbManager
  */
 - (BOOL)stop;
 
+/**
+ Saves a checkpoint straight away, rather than when the checkpoint interval is next up, if the
+ replication has made progress since the last one. Useful when the app is about to lose the time
+ it's been given to run in, so that what's been replicated needn't be checked again.
+
+ Does nothing unless the replicator is running.
+ */
+- (void)checkpointNow;
+
+/**
+ Estimates how much a pull replication has to transfer, without replicating.
+
+ The remote database's info is read, and a sample of its _changes feed after the local
+ checkpoint is fetched with the documents, to extrapolate the number of revisions, bytes and
+ time the replication would take; see CDTReplicationEstimate. This costs two requests, and the
+ sample's documents are downloaded, so it's cheap compared with a large replication but not free.
+
+ The replicator itself isn't started, and may be started afterwards as usual. Estimates are
+ only made for pull replications; for a push the handler is given a
+ CDTReplicatorErrorEstimateNotSupported error.
+
+ @param completionHandler called, on a background thread, with the estimate, or the error that
+        prevented one.
+ */
+- (void)estimatePendingWorkWithCompletionHandler:
+    (void (^_Nonnull)(CDTReplicationEstimate *_Nullable estimate,
+                      NSError *_Nullable error))completionHandler;
+
 /**
  If -state is equal to CDTReplicatorStateError, this will contain the error message.
  This error information is also sent to the delegate object.
@@ -22,12 +22,19 @@
 #import "CDTLogging.h"
 #import "CDTDatastoreManager.h"
 #import "CDTDatastore.h"
+#import "CDTDatastore+Query.h"
+#import "CDTDatastore+Internal.h"
 
 #import "TD_Revision.h"
 #import "TD_Database.h"
 #import "TD_Body.h"
 #import "TDPusher.h"
 #import "TDPuller.h"
+#import "TDAdaptiveBatchController.h"
+#import "TDReplicationTrace.h"
+#import "CDTReplicationScheduler.h"
+#import "CDTReplicationMetrics.h"
+#import "CDTReplicationEstimate.h"
 #import "TD_DatabaseManager.h"
 #import "TDStatus.h"
 #import "CDTSessionCookieInterceptor.h"
@@ -35,6 +42,9 @@
 const NSString *CDTReplicatorLog = @"CDTReplicator";
 static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
 
+// Number of changes fetched with their documents by -estimatePendingWorkWithCompletionHandler:.
+static const NSUInteger CDTEstimateSampleSize = 100;
+
 @interface CDTReplicator ()
 
 @property (nonatomic, strong) TD_DatabaseManager *dbManager;
@@ -69,12 +79,17 @@ static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
      | Method                     | State(s)   | Action(s)          |
      |----------------------------+------------+--------------------|
      | -startWithTaskGroup:error: | .Started   | start TDReplicator |
+     |                            |            | (or queue it with  |
+     |                            |            | the scheduler)     |
      |                            |            | retain self        |
      |                            |            | return             |
      |----------------------------+------------+--------------------|
      | -stop                      | .Stopping  | stop TDReplicator  |
      |                            |            | return             |
      |----------------------------+------------+--------------------|
+     | -stop, still queued        | .Stopped   | release self       |
+     |                            |            | return             |
+     |----------------------------+------------+--------------------|
      | -replicatorStopped         | .Stopped   | release self       |
      |                            | .Completed | return             |
      |                            | .Error     |                    |
@@ -237,7 +252,8 @@ static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
         }
     }
 
-    // create TD_FilterBlock that wraps the CDTFilterBlock and set the TDPusher.filter property.
+    // create TD_FilterBlock that wraps the CDTFilterBlock and set the TDPusher.filter property,
+    // or else have the TDPusher pick documents with the selector.
     if ([self.cdtReplication isKindOfClass:[CDTPushReplication class]]) {
         CDTPushReplication *pushRep = (CDTPushReplication *)self.cdtReplication;
         if (pushRep.filter) {
@@ -253,6 +269,14 @@ static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
                                                                    sequence:rev.sequence],
                                  params);
             };
+        } else if (pushRep.selector) {
+            TDPusher *tdpusher = (TDPusher *)self.tdReplicator;
+            CDTDatastore *datastore = pushRep.source;
+            NSDictionary *selector = [pushRep.selector copy];
+
+            tdpusher.docIDsFilter = ^NSSet<NSString *> *(NSArray<NSString *> *docIDs) {
+                return [datastore documentIdsMatching:selector among:docIDs];
+            };
         }
     }
 
@@ -273,13 +297,53 @@ static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
                                                  name:TDReplicatorStartedNotification
                                                object:self.tdReplicator];
 
-    [self.tdReplicator startWithTaskGroup:taskGroup];
+    CDTReplicationScheduler *scheduler = self.scheduler;
+    if (scheduler) {
+        // The scheduler starts the TDReplicator once a worker is free; until then we stay pending.
+        TDReplicator *tdReplicator = self.tdReplicator;
+        [scheduler enqueueJob:self
+                     priority:self.cdtReplication.priority
+                   continuous:tdReplicator.continuous
+                    taskGroup:taskGroup
+                        start:^{
+                            [tdReplicator startWithTaskGroup:taskGroup];
+                        }];
+    } else {
+        [self.tdReplicator startWithTaskGroup:taskGroup];
+    }
     
     os_log_info(CDTOSLog, "start: Replicator starting %{public}@, sessionID %{public}@", [self.tdReplicator class], self.tdReplicator.sessionID);
 
     return YES;
 }
 
+- (void)estimatePendingWorkWithCompletionHandler:
+    (void (^)(CDTReplicationEstimate *, NSError *))completionHandler
+{
+    // A replicator of its own, so this one can still be started, or is unaffected if it has been.
+    NSError *localError;
+    TDReplicator *replicator = [self buildTDReplicatorFromConfiguration:&localError];
+    if (!replicator) {
+        completionHandler(nil, localError);
+        return;
+    }
+    if (replicator.isPush) {
+        NSDictionary *userInfo = @{
+            NSLocalizedDescriptionKey :
+                NSLocalizedString(@"Estimates are only made for pull replications.", nil)
+        };
+        completionHandler(nil, [NSError errorWithDomain:CDTReplicatorErrorDomain
+                                                   code:CDTReplicatorErrorEstimateNotSupported
+                                               userInfo:userInfo]);
+        return;
+    }
+
+    replicator.sessionConfigDelegate = self.sessionConfigDelegate;
+    [replicator startReplicationThread:nil];
+    [(TDPuller *)replicator estimatePendingWorkWithSampleSize:CDTEstimateSampleSize
+                                                 onCompletion:completionHandler];
+}
+
 // MARK: - DB Proxy API's functions for Test cases.
 - (void)testEndPointLocal:(ReplicatorTestCompletionHandler) completionHandler {
     if (self.tdReplicator == nil) {
@@ -385,12 +449,14 @@ static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
     BOOL push = NO;
     CDTDatastore *db;
     NSURL *remote;
-    BOOL continuous = NO;  // we don't support continuous
+    BOOL continuous = NO;  // only pulls can be continuous
     if ([self.cdtReplication isKindOfClass:[CDTPullReplication class]]) {
         push = NO;
         CDTPullReplication *shadowConfig = (CDTPullReplication *)self.cdtReplication;
         db = shadowConfig.target;
         remote = shadowConfig.source;
+        // Fetching documents by ID is done once the last of them has arrived.
+        continuous = shadowConfig.continuous && !shadowConfig.documentIDsToFetch;
     } else if ([self.cdtReplication isKindOfClass:[CDTPushReplication class]]) {
         push = YES;
         CDTPushReplication *shadowConfig = (CDTPushReplication *)self.cdtReplication;
@@ -404,6 +470,13 @@ static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
                                                                                                       password: self.cdtReplication.password];
         [interceptors addObject:cookieInterceptor];
     }
+
+    TDAdaptiveBatchController *batchController = nil;
+    if (!push && ((CDTPullReplication *)self.cdtReplication).adaptiveBatching) {
+        // Added as an interceptor as well, so it sees 429s before they're retried.
+        batchController = [[TDAdaptiveBatchController alloc] init];
+        [interceptors addObject:batchController];
+    }
     
     TDReplicator *repl = [[TDReplicator alloc] initWithDB:db.database remote:remote push:push continuous:continuous
                                              interceptors:interceptors];
@@ -420,6 +493,12 @@ static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
         return nil;
     }
     
+    if (self.scheduler) {
+        repl.connectionBudget = self.scheduler.connectionBudget;
+        repl.connectionWeight =
+            [CDTReplicationScheduler connectionWeightForPriority:self.cdtReplication.priority];
+    }
+
     //Set default value for reset to NO
     //More details: http://docs.couchdb.org/en/latest/query-server/protocol.html
     repl.reset = NO;
@@ -429,16 +508,63 @@ static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
     
     // Headers are validated before being put in properties
     repl.requestHeaders = self.cdtReplication.optionalHeaders;
+
+    repl.checkpointInterval = self.cdtReplication.checkpointInterval;
+    repl.checkpointAfterChanges = self.cdtReplication.checkpointAfterDocuments;
+    repl.checkpointAfterBytes = self.cdtReplication.checkpointAfterBytes;
+    repl.localInterimCheckpoints = self.cdtReplication.localInterimCheckpoints;
+
+    NSURL *traceFileURL = self.cdtReplication.traceFileURL;
+    if (traceFileURL) {
+        NSError *traceError;
+        repl.trace = [[TDReplicationTrace alloc] initWithURL:traceFileURL error:&traceError];
+        if (!repl.trace) {
+            // Tracing is only a diagnostic, so it isn't worth failing the replication for.
+            os_log_error(CDTOSLog, "Replication trace %{public}@ not opened: %{public}@",
+                         traceFileURL.path, traceError);
+        }
+    }
     
     // Push and pull replications can have filters assigned.
     if (!push) {
         CDTPullReplication *shadowConfig = (CDTPullReplication *)self.cdtReplication;
         repl.filterName = shadowConfig.filter;
         repl.filterParameters = shadowConfig.filterParams;
+        repl.selector = shadowConfig.selector;
+        ((TDPuller *)repl).batchController = batchController;
+        ((TDPuller *)repl).changesFeedPrefetchDepth =
+            (unsigned)MIN(shadowConfig.changesFeedPrefetchDepth, (NSUInteger)UINT_MAX);
+        ((TDPuller *)repl).maxPendingRevisions = shadowConfig.maxPendingRevisions;
+        ((TDPuller *)repl).maxPendingBytes = shadowConfig.maxPendingBytes;
+        ((TDPuller *)repl).deferAttachmentDownloads = shadowConfig.deferAttachmentDownloads;
+        ((TDPuller *)repl).winningRevisionsOnly = shadowConfig.winningRevisionsOnly;
+        ((TDPuller *)repl).docIDsToFetch = shadowConfig.documentIDsToFetch;
+        ((TDPuller *)repl).prioritizesDocID = shadowConfig.prioritizeDocument;
+        NSObject<CDTConflictResolver> *resolver = shadowConfig.conflictResolver;
+        if (resolver) {
+            CDTDatastore *datastore = shadowConfig.target;
+            ((TDPuller *)repl).resolvesConflictsOfDocID = ^(NSString *docID, FMDatabase *db) {
+                NSError *resolveError;
+                if (![datastore resolveConflictsForDocument:docID
+                                                   resolver:resolver
+                                                   database:db
+                                                      error:&resolveError]) {
+                    os_log_error(CDTOSLog, "Pulled conflicts of %{public}@ not resolved: %{public}@",
+                                 docID, resolveError);
+                }
+            };
+        }
     } else {
         CDTPushReplication *shadowConfig = (CDTPushReplication *)self.cdtReplication;
         ((TDPusher *)repl).createTarget = NO;
         repl.filterParameters = shadowConfig.filterParams;
+        // Only for the checkpoint ID; the pusher matches it with -docIDsFilter, set in -start.
+        repl.selector = shadowConfig.filter ? nil : shadowConfig.selector;
+        repl.compressRequestBodies = shadowConfig.compressRequestBodies;
+        ((TDPusher *)repl).maxConcurrentUploads = shadowConfig.maxConcurrentUploads;
+        ((TDPusher *)repl).multipartAttachmentLength = shadowConfig.multipartAttachmentLength;
+        ((TDPusher *)repl).maxBatchesInFlight = shadowConfig.maxBatchesInFlight;
+        ((TDPusher *)repl).changeSource = self.pushChangeSource;
     }
 
     return repl;
@@ -449,6 +575,7 @@ static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
     CDTReplicatorState oldstate = self.state;
     BOOL informDelegate = YES;
     BOOL stopSuccessful = YES;
+    BOOL cancelledByScheduler = NO;
 
     @synchronized(self)
     {
@@ -462,7 +589,12 @@ static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
                 if (self.started) {
                     //-startWithTaskGroup:error: was called and self.tdReplicator was successfully
                     //instantiated (otherwise state == 'error')
-                    if ([self.tdReplicator cancelIfNotStarted]) {
+                    if ([self.scheduler cancelJob:self]) {
+                        // still waiting for a worker, so the TDReplicator was never started
+                        cancelledByScheduler = YES;
+                        self.state = CDTReplicatorStateStopped;
+                    } else if ([self.tdReplicator cancelIfNotStarted]) {
+                        [self.scheduler jobFinished:self];
                         self.state = CDTReplicatorStateStopped;
                     } else {
                         stopSuccessful = NO;
@@ -495,9 +627,31 @@ static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
         [self.tdReplicator stop];
     }
 
+    if (cancelledByScheduler) {
+        // No TDReplicatorStoppedNotification will arrive, so clean up as -replicatorStopped:
+        // would.
+        CDTReplicator *strongSelf = self;
+        [[NSNotificationCenter defaultCenter] removeObserver:strongSelf
+                                                        name:nil
+                                                      object:strongSelf.tdReplicator];
+        strongSelf.retainedSelf = nil;
+    }
+
     return stopSuccessful;
 }
 
+- (void)checkpointNow
+{
+    TDReplicator *tdReplicator;
+    @synchronized(self)
+    {
+        // Until it's started the TDReplicator has no thread to checkpoint on, nor anything to save.
+        if (self.state != CDTReplicatorStateStarted) return;
+        tdReplicator = self.tdReplicator;
+    }
+    [tdReplicator checkpointNow];
+}
+
 #pragma mark Methods that may be called by TD_Replicator notifications
 
 // Notified that a TDReplicator has stopped:
@@ -559,6 +713,9 @@ static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
                                                     name:nil
                                                   object:strongSelf.tdReplicator];
 
+    // Let the next scheduled replication have our worker.
+    [strongSelf.scheduler jobFinished:strongSelf];
+
     // Break the retain cycle created in -startWithTaskGroup:error,
     // it is now safe to deallocate this instance in the "fire and forget"
     // use case
@@ -639,6 +796,12 @@ static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
         [delegate replicatorDidChangeProgress:self];
     }
 
+    if ((progressChanged || stateChanged) &&
+        [delegate respondsToSelector:@selector(replicator:didUpdateMetrics:)]) {
+        CDTReplicationMetrics *metrics = self.metrics;
+        if (metrics) [delegate replicator:self didUpdateMetrics:metrics];
+    }
+
     if (stateChanged && [delegate respondsToSelector:@selector(replicatorDidChangeState:)]) {
         [delegate replicatorDidChangeState:self];
     }
@@ -673,6 +836,8 @@ static NSString *const CDTReplicatorErrorDomain = @"CDTReplicatorErrorDomain";
 
 #pragma mark Status information
 
+- (CDTReplicationMetrics *)metrics { return [self.tdReplicator.metrics copy]; }
+
 - (BOOL)isActive { return [self isActiveState:self.state]; }
 
 /*
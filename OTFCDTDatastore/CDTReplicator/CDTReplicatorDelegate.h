@@ -17,6 +17,7 @@
 
 @class CDTReplicator;
 @class CDTReplicationErrorInfo;
+@class CDTReplicationMetrics;
 
 /**
  The delegate of a CDTReplicator must adopt the CDTReplicatorDelegate protocol. The protocol
@@ -45,6 +46,18 @@
  */
 - (void)replicatorDidChangeProgress:(nonnull CDTReplicator *)replicator;
 
+/**
+ * <p>Called whenever the replicator changes progress or state, with a snapshot of its
+ * metrics.</p>
+ *
+ * <p>May be called from any worker thread.</p>
+ *
+ * @param replicator the replicator issuing the event.
+ * @param metrics the replicator's metrics at this point.
+ */
+- (void)replicator:(nonnull CDTReplicator *)replicator
+    didUpdateMetrics:(nonnull CDTReplicationMetrics *)metrics;
+
 /**
  * <p>Called when a state transition to COMPLETE or STOPPED is
  * completed.</p>
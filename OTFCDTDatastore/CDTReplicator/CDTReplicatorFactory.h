@@ -20,6 +20,8 @@
 @class CDTReplicator;
 @class CDTDatastoreManager;
 @class CDTAbstractReplication;
+@class CDTReplicationScheduler;
+@class CDTPushReplication;
 
 /**
  Factory for CDTReplicator objects.
@@ -44,6 +46,13 @@
     //check for error
     [rep start];
 
+ Replicators created by a factory don't each run as soon as they are started. They share the
+ factory's CDTReplicationScheduler, which runs a bounded number of them at once and shares a
+ single budget of HTTP connections between them, so an app syncing many datastores doesn't
+ start a thread and a connection pool for each. Continuous replications, which run until
+ they're stopped, start straight away without counting towards the bound. By default all
+ factories share +[CDTReplicationScheduler sharedScheduler].
+
 */
 @interface CDTReplicatorFactory : NSObject
 
@@ -62,6 +71,21 @@
  */
 - (nonnull instancetype)initWithDatastoreManager:(nonnull CDTDatastoreManager *)dsManager;
 
+/**
+ Initialise with a datastore manager object and the scheduler to run replications with.
+
+ @param dsManager the manager of the datastores that this factory will replicate to and from.
+ @param scheduler the scheduler which runs this factory's replicators, or nil to run each one as
+        soon as it is started.
+ */
+- (nonnull instancetype)initWithDatastoreManager:(nonnull CDTDatastoreManager *)dsManager
+                                       scheduler:(nullable CDTReplicationScheduler *)scheduler;
+
+/**
+ The scheduler which runs this factory's replicators.
+ */
+@property (nullable, nonatomic, strong, readonly) CDTReplicationScheduler *scheduler;
+
 /**---------------------------------------------------------------------------------------
  * @name Creating replication jobs
  *  --------------------------------------------------------------------------------------
@@ -99,6 +123,41 @@
     sessionConfigDelegate:(nullable NSObject<CDTNSURLSessionConfigurationDelegate> *)delegate
                     error:(NSError *__autoreleasing __nullable * __nullable)error;
 
+/**
+ * Create CDTReplicator objects for push replications of one datastore to several remote
+ * databases, e.g. to a primary and a backup account, which share the local work of the push.
+ *
+ * Each replicator runs and checkpoints on its own, asking its target which revisions it's
+ * missing, as if it had been made by oneWay:error:. But the datastore's changes are read once
+ * for them all, and each revision one of them uploads is loaded and encoded once, for any of
+ * the others which need it too. Replications with a filter read the changes themselves, as
+ * they pick from them differently.
+ *
+ * @param replications CDTPushReplications, all from the same source datastore
+ * @param error report error information
+ *
+ * @return CDTReplicator instances, in the same order as the replications, or nil if the
+ *  replications don't have the same source or a replicator couldn't be created.
+ */
+- (nullable NSArray<CDTReplicator *> *)fanOut:(nonnull NSArray<CDTPushReplication *> *)replications
+                                        error:(NSError *__autoreleasing __nullable * __nullable)error;
+
+/**
+ * Gets ready to run the replications soon, e.g. when the app comes to the foreground, so that
+ * they start on warm connections: a connection is opened to each of their remote servers, and
+ * their session cookie interceptors (e.g. of an IAM API key) log in if they've no current cookie.
+ *
+ * Nothing is replicated. It's worth doing when a replication will follow within the time servers
+ * keep idle connections open, typically a minute or so; cookies last much longer. Credentials
+ * given as a username and password are only logged in with once a replicator is started.
+ *
+ * @param replications CDTPushReplications and CDTPullReplications to run soon
+ * @param completionHandler called on an arbitrary queue once every connection has been opened,
+ *  or failed to open, and every login has finished
+ */
+- (void)prewarmReplications:(nonnull NSArray<CDTAbstractReplication *> *)replications
+          completionHandler:(nullable void (^)(void))completionHandler;
+
 
 /**
  @name Deprecated
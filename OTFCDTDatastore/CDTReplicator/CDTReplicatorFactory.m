@@ -23,6 +23,11 @@
 #import "CDTPushReplication.h"
 #import "CDTDocumentRevision.h"
 #import "CDTLogging.h"
+#import "CDTReplicationScheduler.h"
+#import "TDPushChangeSource.h"
+#import "CDTURLSessionPool.h"
+#import "CDTSessionCookieInterceptorBase.h"
+#import "CollectionUtils.h"
 
 static NSString *const CDTReplicatorFactoryErrorDomain = @"CDTReplicatorFactoryErrorDomain";
 
@@ -37,12 +42,20 @@ static NSString *const CDTReplicatorFactoryErrorDomain = @"CDTReplicatorFactoryE
 #pragma mark Manage our TDReplicatorManager instance
 
 - (id)initWithDatastoreManager:(CDTDatastoreManager *)dsManager
+{
+    return [self initWithDatastoreManager:dsManager
+                                scheduler:[CDTReplicationScheduler sharedScheduler]];
+}
+
+- (id)initWithDatastoreManager:(CDTDatastoreManager *)dsManager
+                     scheduler:(CDTReplicationScheduler *)scheduler
 {
     self = [super init];
     if (self) {
         
         if(dsManager){
             _dbManager = dsManager.manager;
+            _scheduler = scheduler;
         } else {
             self = nil;
             os_log_debug(CDTOSLog, "Datastore manager is nil, there isn't a local datastore to replicate with.");
@@ -95,7 +108,95 @@ static NSString *const CDTReplicatorFactoryErrorDomain = @"CDTReplicatorFactoryE
         return nil;
     }
 
+    replicator.scheduler = self.scheduler;
     return replicator;
 }
 
+- (NSArray<CDTReplicator *> *)fanOut:(NSArray<CDTPushReplication *> *)replications
+                               error:(NSError *__autoreleasing *)error
+{
+    CDTDatastore *source = replications.firstObject.source;
+    for (CDTPushReplication *replication in replications) {
+        if (replication.source != source) {
+            if (error) {
+                NSString *msg = @"Replications to fan out must all have the same source.";
+                NSDictionary *userInfo = @{NSLocalizedDescriptionKey : NSLocalizedString(msg, nil)};
+                *error = [NSError errorWithDomain:CDTReplicationErrorDomain
+                                             code:CDTReplicationErrorMixedSources
+                                         userInfo:userInfo];
+            }
+            return nil;
+        }
+    }
+
+    TDPushChangeSource *changeSource =
+        source.database ? [[TDPushChangeSource alloc] initWithDatabase:source.database
+                                                           pusherCount:replications.count]
+                        : nil;
+    NSMutableArray<CDTReplicator *> *replicators =
+        [NSMutableArray arrayWithCapacity:replications.count];
+    for (CDTPushReplication *replication in replications) {
+        CDTReplicator *replicator = [self oneWay:replication error:error];
+        if (!replicator) {
+            return nil;
+        }
+        replicator.pushChangeSource = changeSource;
+        [replicators addObject:replicator];
+    }
+    return replicators;
+}
+
+- (void)prewarmReplications:(NSArray<CDTAbstractReplication *> *)replications
+          completionHandler:(void (^)(void))completionHandler
+{
+    dispatch_group_t group = dispatch_group_create();
+    NSMutableSet<NSString *> *servers = [NSMutableSet set];
+    for (CDTAbstractReplication *replication in replications) {
+        NSURL *remote = nil;
+        if ([replication isKindOfClass:[CDTPullReplication class]]) {
+            remote = ((CDTPullReplication *)replication).source;
+        } else if ([replication isKindOfClass:[CDTPushReplication class]]) {
+            remote = ((CDTPushReplication *)replication).target;
+        }
+        if (!remote.host) {
+            continue;
+        }
+
+        for (NSObject<CDTHTTPInterceptor> *interceptor in replication.httpInterceptors) {
+            CDTSessionCookieInterceptorBase *cookieInterceptor =
+                $castIf(CDTSessionCookieInterceptorBase, interceptor);
+            if (cookieInterceptor.shouldMakeSessionRequest) {
+                dispatch_group_enter(group);
+                dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+                    // Logs in, or renews a cookie due for it, as the first request would.
+                    [cookieInterceptor sessionCookiesForRequestURL:remote];
+                    dispatch_group_leave(group);
+                });
+            }
+        }
+
+        NSString *server = [NSString
+            stringWithFormat:@"%@://%@:%@", remote.scheme.lowercaseString,
+                             remote.host.lowercaseString, remote.port ?: @""];
+        if (![servers containsObject:server]) {
+            [servers addObject:server];
+            dispatch_group_enter(group);
+            [[CDTURLSessionPool sharedPool] prewarmConnectionToURL:remote
+                                                 completionHandler:^(NSError *error) {
+                                                     if (error) {
+                                                         os_log_debug(CDTOSLog,
+                                                                      "Connection to %{public}@ not opened: %{public}@",
+                                                                      server, error);
+                                                     }
+                                                     dispatch_group_leave(group);
+                                                 }];
+        }
+    }
+
+    if (completionHandler) {
+        dispatch_group_notify(group, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0),
+                              completionHandler);
+    }
+}
+
 @end
@@ -0,0 +1,100 @@
+//
+//  CDTSlowOperationLog.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+@class FMDatabase;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ One operation which took longer than its CDTSlowOperationLog's threshold.
+ */
+@interface CDTSlowOperation : NSObject
+
+/** What was slow, e.g. `find:`, `getDocsWithIDs:`, `changesSinceSequence:` or `transaction`. */
+@property (readonly) NSString *operation;
+
+@property (readonly) NSDate *date;
+@property (readonly) NSTimeInterval duration;
+
+/** The SQL statements run, with `?` placeholders, and the query plan SQLite chose for each, as
+    given by `EXPLAIN QUERY PLAN`. Empty for transactions. */
+@property (readonly) NSArray<NSString *> *sql;
+@property (readonly) NSArray<NSString *> *queryPlan;
+
+/** Number of rows returned. */
+@property (readonly) NSUInteger rowCount;
+
+/** For queries, YES if the indexes didn't cover the selector, so each candidate document had to
+    be loaded and matched against it. */
+@property (readonly) BOOL usedUnindexedMatcher;
+
+/** Anything else known about the operation, such as the query selector, or the call stack of
+    a slow transaction. */
+@property (readonly) NSDictionary<NSString *, id> *details;
+
+/*
+ Private so no docs. Used to record slow operations.
+ */
+- (instancetype)initWithOperation:(NSString *)operation
+                         duration:(NSTimeInterval)duration
+                              sql:(NSArray<NSString *> *)sql
+                        queryPlan:(NSArray<NSString *> *)queryPlan
+                         rowCount:(NSUInteger)rowCount
+             usedUnindexedMatcher:(BOOL)usedUnindexedMatcher
+                          details:(NSDictionary<NSString *, id> *)details NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+/**
+ Keeps the most recent operations on a datastore which took longer than a threshold: queries,
+ document listings, change feeds and write transactions. Intended for finding pathological
+ queries in the field, so the app can read -operations and report them.
+
+ Disabled until threshold is set. Operations under the threshold cost a clock read; slow ones
+ also have their query plans explained, so the threshold shouldn't be set so low that most
+ operations are recorded. Safe to use from any thread.
+ */
+@interface CDTSlowOperationLog : NSObject
+
+/** Operations taking at least this long, in seconds, are recorded. 0 (the default) disables the
+    log. */
+@property NSTimeInterval threshold;
+
+/** Number of operations kept; once full, the oldest is discarded for each new one. Defaults to
+    100. */
+@property (nonatomic) NSUInteger capacity;
+
+/** The recorded operations, oldest first. */
+@property (readonly) NSArray<CDTSlowOperation *> *operations;
+
+- (void)removeAllOperations;
+
+/*
+ Private so no docs. Used by the datastore and its query index manager.
+ */
+- (BOOL)isSlow:(NSTimeInterval)duration;
+- (void)recordOperation:(CDTSlowOperation *)operation;
+
+/** Returns the detail column of `EXPLAIN QUERY PLAN` for the statement. */
++ (NSArray<NSString *> *)queryPlanForSQL:(NSString *)sql
+                               arguments:(nullable NSArray *)arguments
+                              inDatabase:(FMDatabase *)db;
+
+@end
+
+NS_ASSUME_NONNULL_END
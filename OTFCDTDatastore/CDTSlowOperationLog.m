@@ -0,0 +1,155 @@
+//
+//  CDTSlowOperationLog.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTSlowOperationLog.h"
+#import "CDTLogging.h"
+
+#import <fmdb/FMDatabase.h>
+#import <fmdb/FMResultSet.h>
+
+static const NSUInteger kDefaultCapacity = 100;
+
+@implementation CDTSlowOperation
+
+- (instancetype)initWithOperation:(NSString *)operation
+                         duration:(NSTimeInterval)duration
+                              sql:(NSArray<NSString *> *)sql
+                        queryPlan:(NSArray<NSString *> *)queryPlan
+                         rowCount:(NSUInteger)rowCount
+             usedUnindexedMatcher:(BOOL)usedUnindexedMatcher
+                          details:(NSDictionary<NSString *, id> *)details
+{
+    self = [super init];
+    if (self) {
+        _operation = [operation copy];
+        _date = [NSDate dateWithTimeIntervalSinceNow:-duration];
+        _duration = duration;
+        _sql = [sql copy];
+        _queryPlan = [queryPlan copy];
+        _rowCount = rowCount;
+        _usedUnindexedMatcher = usedUnindexedMatcher;
+        _details = [details copy];
+    }
+    return self;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@ %p: %@ took %.3fs, %lu rows%@; plan: %@>",
+                                      [self class], self, _operation, _duration,
+                                      (unsigned long)_rowCount,
+                                      _usedUnindexedMatcher ? @", unindexed matcher" : @"",
+                                      [_queryPlan componentsJoinedByString:@"; "]];
+}
+
+@end
+
+@implementation CDTSlowOperationLog {
+    NSMutableArray<CDTSlowOperation *> *_operations;
+    // Index of the oldest operation once the buffer is full, which is where the next one goes.
+    NSUInteger _oldest;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _capacity = kDefaultCapacity;
+        _operations = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void)setCapacity:(NSUInteger)capacity
+{
+    @synchronized(self)
+    {
+        NSArray *operations = self.operations;
+        if (operations.count > capacity) {
+            operations = [operations
+                subarrayWithRange:NSMakeRange(operations.count - capacity, capacity)];
+        }
+        _operations = [operations mutableCopy];
+        _oldest = 0;
+        _capacity = capacity;
+    }
+}
+
+- (NSUInteger)capacity
+{
+    @synchronized(self) { return _capacity; }
+}
+
+- (NSArray<CDTSlowOperation *> *)operations
+{
+    @synchronized(self)
+    {
+        NSRange newer = NSMakeRange(_oldest, _operations.count - _oldest);
+        NSArray *operations = [_operations subarrayWithRange:newer];
+        return [operations
+            arrayByAddingObjectsFromArray:[_operations subarrayWithRange:NSMakeRange(0, _oldest)]];
+    }
+}
+
+- (void)removeAllOperations
+{
+    @synchronized(self)
+    {
+        [_operations removeAllObjects];
+        _oldest = 0;
+    }
+}
+
+- (BOOL)isSlow:(NSTimeInterval)duration
+{
+    NSTimeInterval threshold = self.threshold;
+    return threshold > 0 && duration >= threshold;
+}
+
+- (void)recordOperation:(CDTSlowOperation *)operation
+{
+    os_log_info(CDTOSLog, "Slow operation: %{public}@", operation);
+    @synchronized(self)
+    {
+        if (_capacity == 0) {
+            return;
+        }
+        if (_operations.count < _capacity) {
+            [_operations addObject:operation];
+        } else {
+            _operations[_oldest] = operation;
+            _oldest = (_oldest + 1) % _capacity;
+        }
+    }
+}
+
++ (NSArray<NSString *> *)queryPlanForSQL:(NSString *)sql
+                               arguments:(NSArray *)arguments
+                              inDatabase:(FMDatabase *)db
+{
+    NSMutableArray *plan = [NSMutableArray array];
+    FMResultSet *rs = [db executeQuery:[@"EXPLAIN QUERY PLAN " stringByAppendingString:sql]
+                  withArgumentsInArray:arguments ?: @[]];
+    while ([rs next]) {
+        // Columns are id, parent, notused and detail.
+        NSString *detail = [rs stringForColumn:@"detail"];
+        if (detail) {
+            [plan addObject:detail];
+        }
+    }
+    [rs close];
+    return plan;
+}
+
+@end
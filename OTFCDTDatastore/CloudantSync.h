@@ -18,16 +18,25 @@
 #import "CDTDatastoreManager.h"
 
 #import "CDTDatastore.h"
+#import "CDTDatastoreStatistics.h"
+#import "CDTPartitionedDatastore.h"
+#import "CDTSlowOperationLog.h"
+#import "CDTQueueTelemetry.h"
 #import "CDTDatastore+Attachments.h"
+#import "CDTDatastore+Async.h"
 #import "CDTDatastore+Conflicts.h"
 #import "CDTConflictResolver.h"
 
 #import "CDTDatastore+Query.h"
+#import "CDTDatastoreManager+Query.h"
 #import "CDTQResultSet.h"
+#import "CDTQueryHandle.h"
 
 #import "CDTDocumentRevision.h"
+#import "CDTDocumentChange.h"
 
 #import "CDTAttachment.h"
+#import "CDTAttachmentReader.h"
 
 #import "CDTFetchChanges.h"
 
@@ -35,5 +44,10 @@
 #import "CDTPushReplication.h"
 #import "CDTPullReplication.h"
 #import "CDTReplicatorFactory.h"
+#import "CDTReplicationScheduler.h"
+#import "CDTBackgroundReplicationScheduler.h"
+#import "CDTDatabaseUpdatesWatcher.h"
+#import "CDTReplicationMetrics.h"
+#import "CDTReplicationEstimate.h"
 #import "CDTReplicatorDelegate.h"
 #import "CDTDatastore+Replication.h"
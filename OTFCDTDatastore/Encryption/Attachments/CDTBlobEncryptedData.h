@@ -26,7 +26,24 @@ extern NSString *const CDTBlobEncryptedDataErrorDomain;
 typedef NS_ENUM(NSInteger, CDTBlobEncryptedDataError) {
     CDTBlobEncryptedDataErrorFileTooSmall,
     CDTBlobEncryptedDataErrorWrongVersion,
-    CDTBlobEncryptedDataErrorNoDataProvided
+    CDTBlobEncryptedDataErrorNoDataProvided,
+    CDTBlobEncryptedDataErrorCorrupted,
+    CDTBlobEncryptedDataErrorWrongKey
+};
+
+/**
+ How the body of an encrypted attachment is encrypted, as recorded in its version byte.
+ */
+typedef NS_ENUM(UInt8, CDTBlobEncryptedDataVersion) {
+    /** AES-CBC with PKCS7 padding. */
+    CDTBlobEncryptedDataVersionCBC = 1,
+    /** AES-CTR, with the IV as the initial big-endian counter. The body is the same length as the
+        decrypted content, and any byte range can be decrypted without the rest of it; large
+        content is likewise encrypted a slice per thread. */
+    CDTBlobEncryptedDataVersionCTR = 2,
+    /** AES-CTR, as above, with an ID of the key after the IV, so that while a datastore's key is
+        being changed each attachment is read with the key it was written with. */
+    CDTBlobEncryptedDataVersionKeyedCTR = 3
 };
 
 /**
@@ -39,6 +56,9 @@ typedef NS_ENUM(NSInteger, CDTBlobEncryptedDataError) {
  --------------------------------------------------------------------------
  |                  header             |              body                |
  --------------------------------------------------------------------------
+
+ In CDTBlobEncryptedDataVersionKeyedCTR, the IV is followed by an 8-byte ID of the key, derived
+ from it with HMAC-SHA256, as part of the header.
  
  As its counterpart 'CDTBlobData', this class conforms to protocols 'CDTBlobReader' &
  'CDTBlobWriter'. Notice the beaviour of the methods defined in 'CDTBlobReader' in relation to
@@ -46,6 +66,11 @@ typedef NS_ENUM(NSInteger, CDTBlobEncryptedDataError) {
  
  - 'dataWithError:'.- It will fail if the blob is open.
  - 'inputStreamWithOutputLength:'.- As the previous method, it will fail if the blob is open.
+ - 'dataInRange:error:'.- As the previous methods, it will fail if the blob is open.
+
+ Attachments in either version can be read, and none of these methods read the whole file into
+ memory: the returned stream decrypts it one chunk at a time, and 'dataInRange:error:' only
+ decrypts the blocks in the range.
  
  Also, notice some details about the methods defined in 'CDTBlobWriter':
  
@@ -57,6 +82,9 @@ typedef NS_ENUM(NSInteger, CDTBlobEncryptedDataError) {
  - 'openBlobToAddData'.- As decribed in the documentation for this protocol, this method will create
  a file or it will delete the existing content. This implementation will also add a header to the
  file.
+ - 'appendData:'.- With CDTBlobEncryptedDataVersionCBC, the data is kept in memory and only
+ encrypted and written when the blob is closed. With CDTBlobEncryptedDataVersionCTR it is encrypted
+ and written straight away.
  
  @see CDTBlobData
  @see CDTBlobReader
@@ -71,4 +99,23 @@ typedef NS_ENUM(NSInteger, CDTBlobEncryptedDataError) {
 
 + (instancetype)blobWithPath:(NSString *)path encryptionKey:(CDTEncryptionKey *)encryptionKey;
 
+/**
+ The version new content is written in. Defaults to CDTBlobEncryptedDataVersionCBC, which earlier
+ releases can read. Set it before opening the blob for writing.
+ */
+@property (assign, nonatomic) CDTBlobEncryptedDataVersion version;
+
+/**
+ While a datastore's key is changed, the key it had before. Attachments whose header names it,
+ and those written before keys were named, are read with it; the rest, and all new content, with
+ the key the blob was created with.
+ */
+@property (strong, nonatomic) CDTEncryptionKey *previousEncryptionKey;
+
+/**
+ YES if the file's header names the key the blob was created with, so it needn't be re-encrypted
+ when the key changes. NO for a file written with any other key, or in an earlier version.
+ */
+- (BOOL)isEncryptedWithEncryptionKey;
+
 @end
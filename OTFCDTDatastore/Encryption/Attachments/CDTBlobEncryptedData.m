@@ -17,9 +17,11 @@
 #import "CDTBlobEncryptedData.h"
 //CommonCrypto must be import before Encrypted Data constants
 #import <CommonCrypto/CommonCryptor.h>
+#import <CommonCrypto/CommonHMAC.h>
 #import "CDTBlobEncryptedDataConstants.h"
 
 #import "CDTBlobData.h"
+#import "CDTBlobEncryptedInputStream.h"
 
 #import "CDTEncryptionKeychainUtils.h"
 
@@ -29,13 +31,45 @@
 
 NSString *const CDTBlobEncryptedDataErrorDomain = @"CDTBlobEncryptedDataErrorDomain";
 
+// CTR data at least this long is encrypted in slices on several threads at once: each slice's
+// counter is known from where it falls in the body, so none waits for the one before
+static const NSUInteger kParallelCTRThreshold = 1024 * 1024;
+// Must be a multiple of the AES block size
+static const NSUInteger kParallelCTRSliceSize = 256 * 1024;
+
+static BOOL CDTBlobEncryptedDataVersionIsCTR(CDTBlobEncryptedDataVersion version)
+{
+    return (version == CDTBlobEncryptedDataVersionCTR ||
+            version == CDTBlobEncryptedDataVersionKeyedCTR);
+}
+
+// An AES-CTR encryptor positioned at any byte of the body, not only at the start of a block
+static CCCryptorRef CDTBlobEncryptedDataCreateCTREncryptorAtOffset(NSData *key, NSData *iv,
+                                                                   UInt64 offset)
+{
+    CCCryptorRef cryptor =
+        CDTBlobEncryptedDataCreateCTRCryptor(kCCEncrypt, key, iv, offset / kCCBlockSizeAES128);
+    size_t skip = (size_t)(offset % kCCBlockSizeAES128);
+    if (cryptor && skip > 0) {
+        uint8_t discarded[kCCBlockSizeAES128] = {0};
+        size_t discardedLength = 0;
+        CCCryptorUpdate(cryptor, discarded, skip, discarded, sizeof(discarded), &discardedLength);
+    }
+    return cryptor;
+}
+
 @interface CDTBlobEncryptedData ()
 
 @property (strong, nonatomic, readonly) NSData *key;
+@property (strong, nonatomic, readonly) NSData *keyID;
+@property (strong, nonatomic) NSData *previousKey;
+@property (strong, nonatomic) NSData *previousKeyID;
 @property (strong, nonatomic, readonly) CDTBlobData *blob;
 
 @property (strong, nonatomic) NSData *currentIV;
 @property (strong, nonatomic) NSMutableData *currentData;
+@property (assign, nonatomic) CCCryptorRef currentCryptor;
+@property (assign, nonatomic) UInt64 currentOffset;
 
 @end
 
@@ -60,8 +94,11 @@ NSString *const CDTBlobEncryptedDataErrorDomain = @"CDTBlobEncryptedDataErrorDom
             self = nil;
         } else {
             _key = encryptionKey.data;
+            _keyID = [CDTBlobEncryptedData keyIDForKey:_key];
             _blob = thisBlob;
 
+            _version = CDTBlobEncryptedDataVersionCBC;
+
             _currentIV = nil;
             _currentData = nil;
         }
@@ -73,83 +110,284 @@ NSString *const CDTBlobEncryptedDataErrorDomain = @"CDTBlobEncryptedDataErrorDom
 #pragma mark - Memory management
 - (void)dealloc { [self close]; }
 
+#pragma mark - Keys
+- (void)setPreviousEncryptionKey:(CDTEncryptionKey *)previousEncryptionKey
+{
+    _previousEncryptionKey = previousEncryptionKey;
+    self.previousKey = previousEncryptionKey.data;
+    self.previousKeyID =
+        (self.previousKey ? [CDTBlobEncryptedData keyIDForKey:self.previousKey] : nil);
+}
+
+- (BOOL)isEncryptedWithEncryptionKey
+{
+    CDTBLOBENCRYPTEDDATA_VERSION_TYPE version;
+    NSData *iv = nil, *key = nil;
+    UInt64 length = 0;
+    if (![self readHeaderWithVersion:&version
+                                  iv:&iv
+                                 key:&key
+                              length:&length
+                              handle:nil
+                               error:nil]) {
+        return NO;
+    }
+
+    return (version == CDTBLOBENCRYPTEDDATA_VERSION_KEYED_CTR_VALUE && key == self.key);
+}
+
 #pragma mark - CDTBlobReader methods
 - (NSData *)dataWithError:(NSError **)error
 {
-    // Read file
+    return [self dataInRange:NSMakeRange(0, NSUIntegerMax) error:error];
+}
+
+- (NSInputStream *)inputStreamWithOutputLength:(UInt64 *)outputLength
+{
+    CDTBLOBENCRYPTEDDATA_VERSION_TYPE version;
+    NSData *iv = nil, *key = nil;
+    UInt64 length = 0;
+    NSFileHandle *handle = nil;
+    if (![self readHeaderWithVersion:&version
+                                  iv:&iv
+                                 key:&key
+                              length:&length
+                              handle:&handle
+                               error:nil]) {
+        return nil;
+    }
+
+    if (outputLength) {
+        *outputLength = length;
+    }
+
+    NSRange range = NSMakeRange(0, (NSUInteger)length);
+    return [[CDTBlobEncryptedInputStream alloc] initWithFileHandle:handle
+                                                               key:key
+                                                           version:version
+                                                                iv:iv
+                                                             range:range];
+}
+
+- (NSData *)dataInRange:(NSRange)range error:(NSError **)error
+{
+    CDTBLOBENCRYPTEDDATA_VERSION_TYPE version;
+    NSData *iv = nil, *key = nil;
+    UInt64 length = 0;
+    NSFileHandle *handle = nil;
+    if (![self readHeaderWithVersion:&version
+                                  iv:&iv
+                                 key:&key
+                              length:&length
+                              handle:&handle
+                               error:error]) {
+        return nil;
+    }
+
+    // Truncate the range at the end of the content
+    if (range.location >= length) {
+        [handle closeFile];
+        return [NSData data];
+    }
+    range.length = (NSUInteger)MIN((UInt64)range.length, length - range.location);
+
+    // Decrypt only the blocks in the range
+    CDTBlobEncryptedInputStream *stream =
+        [[CDTBlobEncryptedInputStream alloc] initWithFileHandle:handle
+                                                            key:key
+                                                        version:version
+                                                             iv:iv
+                                                          range:range];
+    NSMutableData *data = [NSMutableData dataWithLength:range.length];
+    NSUInteger total = 0;
+    NSInteger bytesRead = 0;
+    [stream open];
+    while (total < range.length &&
+           (bytesRead = [stream read:data.mutableBytes + total maxLength:range.length - total]) > 0) {
+        total += bytesRead;
+    }
+    NSError *streamError = stream.streamError;
+    [stream close];
+
+    if (total < range.length) {
+        os_log_debug(CDTOSLog, "Encrypted data could not be decrypted: %{public}@", streamError);
+
+        if (error) {
+            *error = streamError ?: [CDTBlobEncryptedData errorCorrupted];
+        }
+
+        return nil;
+    }
+
+    return data;
+}
+
+#pragma mark - Private methods
+/**
+ Reads and checks the header, picks the key to decrypt the body with, and works out the length of
+ the decrypted content without reading the rest of the file. For CBC that means decrypting the
+ last block to find how much padding there is.
+
+ If `outHandle` is given, the file is left open in it, so the body read is the one the header
+ belongs to even if the file is replaced meanwhile.
+ */
+- (BOOL)readHeaderWithVersion:(CDTBLOBENCRYPTEDDATA_VERSION_TYPE *)outVersion
+                           iv:(NSData **)outIV
+                          key:(NSData **)outKey
+                       length:(UInt64 *)outLength
+                       handle:(NSFileHandle **)outHandle
+                        error:(NSError **)error
+{
     NSError *thisError = nil;
-    NSData *fileData = [self.blob dataWithError:&thisError];
-    BOOL success = (fileData != nil);
+    NSFileHandle *handle = [self.blob fileHandleForReadingWithError:&thisError];
+    BOOL success = (handle != nil);
 
     // Check data size
+    NSData *headerData = nil;
     if (success) {
         NSUInteger fileMinimunSize = CDTBLOBENCRYPTEDDATA_ENCRYPTEDDATA_LOCATION;
 
-        success = (fileData.length >= fileMinimunSize);
+        headerData = [handle readDataOfLength:CDTBLOBENCRYPTEDDATA_KEYED_ENCRYPTEDDATA_LOCATION];
+        success = (headerData.length >= fileMinimunSize);
         if (!success) {
             thisError = [CDTBlobEncryptedData errorFileTooSmall];
         }
     }
 
     // Check version
+    CDTBLOBENCRYPTEDDATA_VERSION_TYPE version = 0;
     if (success) {
-        CDTBLOBENCRYPTEDDATA_VERSION_TYPE version;
-        [fileData getBytes:&version
-                     range:NSMakeRange(CDTBLOBENCRYPTEDDATA_VERSION_LOCATION, sizeof(version))];
+        [headerData getBytes:&version
+                       range:NSMakeRange(CDTBLOBENCRYPTEDDATA_VERSION_LOCATION, sizeof(version))];
 
-        success = (version == CDTBLOBENCRYPTEDDATA_VERSION_VALUE);
+        success = (version == CDTBLOBENCRYPTEDDATA_VERSION_VALUE ||
+                   version == CDTBLOBENCRYPTEDDATA_VERSION_CTR_VALUE ||
+                   version == CDTBLOBENCRYPTEDDATA_VERSION_KEYED_CTR_VALUE);
         if (!success) {
             os_log_debug(CDTOSLog, "Wrong version: %{public}ui. File is not encrypted or it is corrupted",
                          version);
 
             thisError = [CDTBlobEncryptedData errorWrongVersion];
+        } else if (version == CDTBLOBENCRYPTEDDATA_VERSION_KEYED_CTR_VALUE &&
+                   headerData.length < CDTBLOBENCRYPTEDDATA_KEYED_ENCRYPTEDDATA_LOCATION) {
+            success = NO;
+            thisError = [CDTBlobEncryptedData errorFileTooSmall];
+        }
+    }
+
+    // Pick the key: the one the header names, or for files from before keys were named, the
+    // one the datastore had before any change of key
+    NSData *key = nil;
+    unsigned long long bodyStart = CDTBLOBENCRYPTEDDATA_ENCRYPTEDDATA_LOCATION;
+    if (success) {
+        if (version == CDTBLOBENCRYPTEDDATA_VERSION_KEYED_CTR_VALUE) {
+            NSData *keyID =
+                [headerData subdataWithRange:NSMakeRange(CDTBLOBENCRYPTEDDATA_KEYID_LOCATION,
+                                                         CDTBLOBENCRYPTEDDATA_KEYID_SIZE)];
+            if ([keyID isEqualToData:self.keyID]) {
+                key = self.key;
+            } else if (self.previousKeyID && [keyID isEqualToData:self.previousKeyID]) {
+                key = self.previousKey;
+            } else {
+                os_log_debug(CDTOSLog, "File is encrypted with another key");
+
+                success = NO;
+                thisError = [CDTBlobEncryptedData errorWrongKey];
+            }
+            bodyStart = CDTBLOBENCRYPTEDDATA_KEYED_ENCRYPTEDDATA_LOCATION;
+        } else {
+            key = self.previousKey ?: self.key;
         }
     }
 
-    // Decrypt data
-    NSData *data = nil;
+    // Get length
+    NSData *iv = nil;
+    UInt64 length = 0;
     if (success) {
-        NSUInteger lengthEncryptedData =
-            (fileData.length - CDTBLOBENCRYPTEDDATA_ENCRYPTEDDATA_LOCATION);
-        if (lengthEncryptedData == 0) {
-            data = [NSData data];
+        iv = [headerData subdataWithRange:NSMakeRange(CDTBLOBENCRYPTEDDATA_IV_LOCATION,
+                                                      CDTBLOBENCRYPTEDDATA_IV_SIZE)];
+
+        UInt64 lengthEncryptedData = [handle seekToEndOfFile] - bodyStart;
+        if (CDTBlobEncryptedDataVersionIsCTR(version) || lengthEncryptedData == 0) {
+            length = lengthEncryptedData;
         } else {
-            // Get IV
-            NSData *iv = [fileData subdataWithRange:NSMakeRange(CDTBLOBENCRYPTEDDATA_IV_LOCATION,
-                                                                CDTBLOBENCRYPTEDDATA_IV_SIZE)];
-
-            // Get encrypted data
-            NSData *encryptedData =
-                [fileData subdataWithRange:NSMakeRange(CDTBLOBENCRYPTEDDATA_ENCRYPTEDDATA_LOCATION,
-                                                       lengthEncryptedData)];
-
-            // Use AES
-            data = [CDTEncryptionKeychainUtils dataForAESEncryptedData:encryptedData
-                                                                   key:self.key
-                                                                    iv:iv];
+            UInt64 padding = [self cbcPaddingOfEncryptedData:handle
+                                                      length:lengthEncryptedData
+                                                          iv:iv
+                                                         key:key];
+            success = (padding > 0);
+            if (success) {
+                length = lengthEncryptedData - padding;
+            } else {
+                thisError = [CDTBlobEncryptedData errorCorrupted];
+            }
         }
     }
 
     // Return
-    if (!success && error) {
+    if (success) {
+        *outVersion = version;
+        *outIV = iv;
+        *outKey = key;
+        *outLength = length;
+    } else if (error) {
         *error = thisError;
     }
 
-    return data;
+    if (success && outHandle) {
+        *outHandle = handle;
+    } else {
+        [handle closeFile];
+    }
+
+    return success;
 }
 
-- (NSInputStream *)inputStreamWithOutputLength:(UInt64 *)outputLength
+/** Returns the number of bytes of PKCS7 padding at the end of the body, or 0 if it is invalid. */
+- (UInt64)cbcPaddingOfEncryptedData:(NSFileHandle *)handle
+                             length:(UInt64)length
+                                 iv:(NSData *)iv
+                                key:(NSData *)key
 {
-    NSData *data = [self dataWithError:nil];
-    if (!data) {
-        return nil;
+    if (length % kCCBlockSizeAES128 != 0) {
+        return 0;
     }
 
-    if (outputLength) {
-        *outputLength = data.length;
+    // The last block is decrypted using the one before it (or the IV) as its IV
+    NSData *blockIV = iv;
+    unsigned long long lastBlock =
+        CDTBLOBENCRYPTEDDATA_ENCRYPTEDDATA_LOCATION + length - kCCBlockSizeAES128;
+    if (length > kCCBlockSizeAES128) {
+        [handle seekToFileOffset:lastBlock - kCCBlockSizeAES128];
+        blockIV = [handle readDataOfLength:kCCBlockSizeAES128];
+    } else {
+        [handle seekToFileOffset:lastBlock];
+    }
+    NSData *block = [handle readDataOfLength:kCCBlockSizeAES128];
+    if (blockIV.length != kCCBlockSizeAES128 || block.length != kCCBlockSizeAES128) {
+        return 0;
     }
 
-    return [NSInputStream inputStreamWithData:data];
+    uint8_t decrypted[kCCBlockSizeAES128];
+    size_t decryptedLength = 0;
+    CCCryptorStatus status =
+        CCCrypt(kCCDecrypt, kCCAlgorithmAES, 0, key.bytes, key.length, blockIV.bytes,
+                block.bytes, block.length, decrypted, sizeof(decrypted), &decryptedLength);
+    if (status != kCCSuccess || decryptedLength != kCCBlockSizeAES128) {
+        return 0;
+    }
+
+    uint8_t padding = decrypted[kCCBlockSizeAES128 - 1];
+    if (padding == 0 || padding > kCCBlockSizeAES128) {
+        return 0;
+    }
+    for (int i = kCCBlockSizeAES128 - padding; i < kCCBlockSizeAES128; i++) {
+        if (decrypted[i] != padding) {
+            return 0;
+        }
+    }
+
+    return padding;
 }
 
 #pragma mark - CDTBlobWriter methods
@@ -169,12 +407,18 @@ NSString *const CDTBlobEncryptedDataErrorDomain = @"CDTBlobEncryptedDataErrorDom
     // Generate file content
     // Header
     NSData *iv = [self generateAESIv];
-    NSMutableData *fileData = [CDTBlobEncryptedData generateHeaderWithIV:iv];
+    NSMutableData *fileData = [self generateHeaderWithIV:iv];
 
     // Encrypted data
     if (data.length > 0) {
-        NSData *encryptedData =
-            [CDTEncryptionKeychainUtils aesEncryptedDataForData:data key:self.key iv:iv];
+        NSData *encryptedData = nil;
+        if (CDTBlobEncryptedDataVersionIsCTR(self.version)) {
+            encryptedData =
+                [CDTBlobEncryptedData encryptCTRData:data withKey:self.key iv:iv offset:0];
+        } else {
+            encryptedData =
+                [CDTEncryptionKeychainUtils aesEncryptedDataForData:data key:self.key iv:iv];
+        }
 
         [fileData appendData:encryptedData];
     }
@@ -198,9 +442,17 @@ NSString *const CDTBlobEncryptedDataErrorDomain = @"CDTBlobEncryptedDataErrorDom
     }
 
     self.currentIV = [self generateAESIv];
-    self.currentData = [NSMutableData data];
+    if (CDTBlobEncryptedDataVersionIsCTR(self.version)) {
+        // CTR needs no padding, so data is encrypted and written as it is added
+        self.currentCryptor =
+            CDTBlobEncryptedDataCreateCTRCryptor(kCCEncrypt, self.key, self.currentIV, 0);
+        self.currentOffset = 0;
+    } else {
+        self.currentData = [NSMutableData data];
+    }
 
-    NSMutableData *headerData = [CDTBlobEncryptedData generateHeaderWithIV:self.currentIV];
+    NSMutableData *headerData =
+        [self generateHeaderWithIV:self.currentIV];
     [self.blob appendData:headerData];
 
     return YES;
@@ -220,6 +472,27 @@ NSString *const CDTBlobEncryptedDataErrorDomain = @"CDTBlobEncryptedDataErrorDom
         return NO;
     }
 
+    if (self.currentCryptor) {
+        NSData *encryptedData = nil;
+        if (data.length >= kParallelCTRThreshold) {
+            encryptedData = [CDTBlobEncryptedData encryptCTRData:data
+                                                         withKey:self.key
+                                                              iv:self.currentIV
+                                                          offset:self.currentOffset];
+
+            // Moved past the data, for smaller appends after it
+            CCCryptorRelease(self.currentCryptor);
+            self.currentCryptor = CDTBlobEncryptedDataCreateCTREncryptorAtOffset(
+                self.key, self.currentIV, self.currentOffset + data.length);
+        } else {
+            encryptedData =
+                [CDTBlobEncryptedData updateCTRCryptor:self.currentCryptor withData:data];
+        }
+        self.currentOffset += data.length;
+
+        return [self.blob appendData:encryptedData];
+    }
+
     [self.currentData appendData:data];
 
     return YES;
@@ -242,6 +515,10 @@ NSString *const CDTBlobEncryptedDataErrorDomain = @"CDTBlobEncryptedDataErrorDom
 
     [self.blob close];
 
+    if (self.currentCryptor) {
+        CCCryptorRelease(self.currentCryptor);
+        self.currentCryptor = NULL;
+    }
     self.currentIV = nil;
     self.currentData = nil;
 }
@@ -261,19 +538,94 @@ NSString *const CDTBlobEncryptedDataErrorDomain = @"CDTBlobEncryptedDataErrorDom
     return [[[self class] alloc] initWithPath:path encryptionKey:encryptionKey];
 }
 
-#pragma mark - Private class methods
-+ (NSMutableData *)generateHeaderWithIV:(NSData *)iv
+#pragma mark - Private methods
+- (NSMutableData *)generateHeaderWithIV:(NSData *)iv
 {
     // Version
-    CDTBLOBENCRYPTEDDATA_VERSION_TYPE version = CDTBLOBENCRYPTEDDATA_VERSION_VALUE;
+    CDTBLOBENCRYPTEDDATA_VERSION_TYPE version;
+    switch (self.version) {
+        case CDTBlobEncryptedDataVersionKeyedCTR:
+            version = CDTBLOBENCRYPTEDDATA_VERSION_KEYED_CTR_VALUE;
+            break;
+        case CDTBlobEncryptedDataVersionCTR:
+            version = CDTBLOBENCRYPTEDDATA_VERSION_CTR_VALUE;
+            break;
+        default:
+            version = CDTBLOBENCRYPTEDDATA_VERSION_VALUE;
+            break;
+    }
     NSMutableData *headerData = [NSMutableData dataWithBytes:&version length:sizeof(version)];
 
     // IV
     [headerData appendData:iv];
 
+    // Key ID
+    if (self.version == CDTBlobEncryptedDataVersionKeyedCTR) {
+        [headerData appendData:self.keyID];
+    }
+
     return headerData;
 }
 
+#pragma mark - Private class methods
+/** Names a key without giving it away: the first bytes of an HMAC of a fixed message. */
++ (NSData *)keyIDForKey:(NSData *)key
+{
+    static const char message[] = "CDTBlobEncryptedData key ID";
+    uint8_t mac[CC_SHA256_DIGEST_LENGTH];
+    CCHmac(kCCHmacAlgSHA256, key.bytes, key.length, message, sizeof(message) - 1, mac);
+
+    return [NSData dataWithBytes:mac length:CDTBLOBENCRYPTEDDATA_KEYID_SIZE];
+}
+
++ (NSData *)encryptCTRData:(NSData *)data
+                  withKey:(NSData *)key
+                       iv:(NSData *)iv
+                   offset:(UInt64)offset
+{
+    if (data.length < kParallelCTRThreshold) {
+        CCCryptorRef cryptor = CDTBlobEncryptedDataCreateCTREncryptorAtOffset(key, iv, offset);
+        NSData *encryptedData = [CDTBlobEncryptedData updateCTRCryptor:cryptor withData:data];
+        CCCryptorRelease(cryptor);
+
+        return encryptedData;
+    }
+
+    NSMutableData *encryptedData = [NSMutableData dataWithLength:data.length];
+    const uint8_t *input = data.bytes;
+    uint8_t *output = encryptedData.mutableBytes;
+    NSUInteger length = data.length;
+    size_t slices = (length + kParallelCTRSliceSize - 1) / kParallelCTRSliceSize;
+    dispatch_apply(slices, dispatch_get_global_queue(qos_class_self(), 0), ^(size_t i) {
+        NSUInteger start = i * kParallelCTRSliceSize;
+        NSUInteger sliceLength = MIN(kParallelCTRSliceSize, length - start);
+        CCCryptorRef cryptor =
+            CDTBlobEncryptedDataCreateCTREncryptorAtOffset(key, iv, offset + start);
+        size_t encryptedLength = 0;
+        CCCryptorStatus status = CCCryptorUpdate(cryptor, input + start, sliceLength,
+                                                 output + start, sliceLength, &encryptedLength);
+        NSCAssert((status == kCCSuccess) && (encryptedLength == sliceLength),
+                  @"Data not encrypted (update)");
+        CCCryptorRelease(cryptor);
+    });
+
+    return encryptedData;
+}
+
++ (NSData *)updateCTRCryptor:(CCCryptorRef)cryptor withData:(NSData *)data
+{
+    // CTR output is the same length as its input
+    NSMutableData *encryptedData = [NSMutableData dataWithLength:data.length];
+    size_t encryptedLength = 0;
+    CCCryptorStatus status = CCCryptorUpdate(cryptor, data.bytes, data.length,
+                                             encryptedData.mutableBytes, encryptedData.length,
+                                             &encryptedLength);
+    NSAssert((status == kCCSuccess) && (encryptedLength == data.length),
+             @"Data not encrypted (update)");
+
+    return encryptedData;
+}
+
 + (NSError *)errorFileTooSmall
 {
     NSDictionary *userInfo = @{
@@ -300,6 +652,30 @@ NSString *const CDTBlobEncryptedDataErrorDomain = @"CDTBlobEncryptedDataErrorDom
                            userInfo:userInfo];
 }
 
++ (NSError *)errorCorrupted
+{
+    NSDictionary *userInfo = @{
+        NSLocalizedDescriptionKey : NSLocalizedString(@"Encrypted data is corrupted",
+                                                      @"Encrypted data is corrupted")
+    };
+
+    return [NSError errorWithDomain:CDTBlobEncryptedDataErrorDomain
+                               code:CDTBlobEncryptedDataErrorCorrupted
+                           userInfo:userInfo];
+}
+
++ (NSError *)errorWrongKey
+{
+    NSDictionary *userInfo = @{
+        NSLocalizedDescriptionKey : NSLocalizedString(@"File is encrypted with another key",
+                                                      @"File is encrypted with another key")
+    };
+
+    return [NSError errorWithDomain:CDTBlobEncryptedDataErrorDomain
+                               code:CDTBlobEncryptedDataErrorWrongKey
+                           userInfo:userInfo];
+}
+
 + (NSError *)errorNoDataProvided
 {
     NSDictionary *userInfo =
@@ -30,6 +30,12 @@
 // Version: current value
 #define CDTBLOBENCRYPTEDDATA_VERSION_VALUE (CDTBLOBENCRYPTEDDATA_VERSION_TYPE)1
 
+// Version: body encrypted with AES-CTR instead of AES-CBC, without padding
+#define CDTBLOBENCRYPTEDDATA_VERSION_CTR_VALUE (CDTBLOBENCRYPTEDDATA_VERSION_TYPE)2
+
+// Version: body encrypted with AES-CTR, and the header followed by the ID of the key
+#define CDTBLOBENCRYPTEDDATA_VERSION_KEYED_CTR_VALUE (CDTBLOBENCRYPTEDDATA_VERSION_TYPE)3
+
 // IV: where this value starts
 #define CDTBLOBENCRYPTEDDATA_IV_LOCATION \
     (CDTBLOBENCRYPTEDDATA_VERSION_LOCATION + sizeof(CDTBLOBENCRYPTEDDATA_VERSION_TYPE))
@@ -38,4 +44,14 @@
 #define CDTBLOBENCRYPTEDDATA_ENCRYPTEDDATA_LOCATION \
     (CDTBLOBENCRYPTEDDATA_IV_LOCATION + kCCBlockSizeAES128)
 
+// Key ID: where this value starts, in the keyed version only
+#define CDTBLOBENCRYPTEDDATA_KEYID_LOCATION CDTBLOBENCRYPTEDDATA_ENCRYPTEDDATA_LOCATION
+
+// Key ID: size on disk
+#define CDTBLOBENCRYPTEDDATA_KEYID_SIZE 8
+
+// Data: where this value starts in the keyed version
+#define CDTBLOBENCRYPTEDDATA_KEYED_ENCRYPTEDDATA_LOCATION \
+    (CDTBLOBENCRYPTEDDATA_KEYID_LOCATION + CDTBLOBENCRYPTEDDATA_KEYID_SIZE)
+
 #endif
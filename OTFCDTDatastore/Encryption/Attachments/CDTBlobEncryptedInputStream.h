@@ -0,0 +1,53 @@
+//
+//  CDTBlobEncryptedInputStream.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import <CommonCrypto/CommonCryptor.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Creates an AES-CTR cryptor whose counter starts `block` blocks after `iv`, i.e., at byte
+ `block * kCCBlockSizeAES128` of the body. Release it with CCCryptorRelease.
+ */
+CCCryptorRef _Nullable CDTBlobEncryptedDataCreateCTRCryptor(CCOperation operation, NSData *key,
+                                                           NSData *iv, UInt64 block);
+
+/**
+ Decrypts part of the body of an encrypted attachment as it is read, holding only one chunk of it
+ in memory at a time. Both body formats can be started at any offset: with CTR the counter is
+ advanced to the offset's block, and with CBC the preceding ciphertext block is used as the IV.
+
+ The stream reads synchronously; it can be reopened after it is closed to read the range again.
+ It keeps the file it was given open until it is deallocated, so it reads the same file however
+ often it's reopened, even if another has been moved to its path meanwhile.
+ */
+@interface CDTBlobEncryptedInputStream : NSInputStream
+
+/**
+ @param handle the open file holding the encrypted attachment, header included.
+ @param key the key the body is encrypted with.
+ @param version the format of the body, as stored in the header.
+ @param iv the IV stored in the header.
+ @param range the range of the decrypted content to read, which must lie within it.
+ */
+- (instancetype)initWithFileHandle:(NSFileHandle *)handle
+                               key:(NSData *)key
+                           version:(UInt8)version
+                                iv:(NSData *)iv
+                             range:(NSRange)range;
+
+@end
+
+NS_ASSUME_NONNULL_END
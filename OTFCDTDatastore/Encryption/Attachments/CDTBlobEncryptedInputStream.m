@@ -0,0 +1,237 @@
+//
+//  CDTBlobEncryptedInputStream.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTBlobEncryptedInputStream.h"
+//CommonCrypto must be import before Encrypted Data constants
+#import "CDTBlobEncryptedDataConstants.h"
+
+#import "CDTLogging.h"
+
+// Must be a multiple of the AES block size.
+#define kChunkSize (64 * 1024)
+
+CCCryptorRef CDTBlobEncryptedDataCreateCTRCryptor(CCOperation operation, NSData *key, NSData *iv,
+                                                 UInt64 block)
+{
+    // The counter is the IV as a 128-bit big-endian integer, plus the block number:
+    uint8_t counter[kCCBlockSizeAES128];
+    [iv getBytes:counter length:sizeof(counter)];
+    for (int i = kCCBlockSizeAES128 - 1; i >= 0 && block > 0; i--) {
+        UInt64 sum = counter[i] + (block & 0xFF);
+        counter[i] = (uint8_t)sum;
+        block = (block >> 8) + (sum >> 8);
+    }
+
+    CCCryptorRef cryptor = NULL;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    // kCCModeOptionCTR_BE is deprecated as big-endian is now the only option, but older releases
+    // of CommonCrypto require it.
+    CCCryptorStatus status = CCCryptorCreateWithMode(
+        operation, kCCModeCTR, kCCAlgorithmAES, ccNoPadding, counter, key.bytes, key.length, NULL,
+        0, 0, kCCModeOptionCTR_BE, &cryptor);
+#pragma GCC diagnostic pop
+    if (status != kCCSuccess) {
+        os_log_error(CDTOSLog, "AES-CTR context not created: %d", status);
+        return NULL;
+    }
+    return cryptor;
+}
+
+@implementation CDTBlobEncryptedInputStream {
+    NSFileHandle *_handle;
+    NSData *_key;
+    UInt8 _version;
+    NSData *_iv;
+    NSRange _range;
+
+    CCCryptorRef _cryptor;
+    NSUInteger _skip;       // decrypted bytes to drop before the start of the range
+    NSUInteger _remaining;  // bytes of the range not yet decrypted
+    NSStreamStatus _status;
+    NSError *_error;
+    __weak id<NSStreamDelegate> _delegate;
+    uint8_t _decrypted[kChunkSize];
+    NSUInteger _decryptedStart, _decryptedLength;
+}
+
+- (instancetype)initWithFileHandle:(NSFileHandle *)handle
+                               key:(NSData *)key
+                           version:(UInt8)version
+                                iv:(NSData *)iv
+                             range:(NSRange)range
+{
+    self = [super init];
+    if (self) {
+        _handle = handle;
+        _key = key;
+        _version = version;
+        _iv = iv;
+        _range = range;
+        _status = NSStreamStatusNotOpen;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self close];
+    [_handle closeFile];
+}
+
+- (BOOL)failWithError:(NSError *)error
+{
+    _error = error;
+    _status = NSStreamStatusError;
+    return NO;
+}
+
+- (BOOL)startDecrypting
+{
+    UInt64 block = _range.location / kCCBlockSizeAES128;
+    unsigned long long bodyStart = CDTBLOBENCRYPTEDDATA_ENCRYPTEDDATA_LOCATION;
+    if (_version == CDTBLOBENCRYPTEDDATA_VERSION_KEYED_CTR_VALUE) {
+        bodyStart = CDTBLOBENCRYPTEDDATA_KEYED_ENCRYPTEDDATA_LOCATION;
+        _cryptor = CDTBlobEncryptedDataCreateCTRCryptor(kCCDecrypt, _key, _iv, block);
+    } else if (_version == CDTBLOBENCRYPTEDDATA_VERSION_CTR_VALUE) {
+        _cryptor = CDTBlobEncryptedDataCreateCTRCryptor(kCCDecrypt, _key, _iv, block);
+    } else {
+        // In CBC each block is decrypted with the previous block of ciphertext:
+        NSData *blockIV = _iv;
+        if (block > 0) {
+            [_handle seekToFileOffset:bodyStart + (block - 1) * kCCBlockSizeAES128];
+            blockIV = [_handle readDataOfLength:kCCBlockSizeAES128];
+        }
+        if (blockIV.length == kCCBlockSizeAES128 &&
+            CCCryptorCreateWithMode(kCCDecrypt, kCCModeCBC, kCCAlgorithmAES, ccNoPadding,
+                                    blockIV.bytes, _key.bytes, _key.length, NULL, 0, 0, 0,
+                                    &_cryptor) != kCCSuccess) {
+            _cryptor = NULL;
+        }
+    }
+    if (!_cryptor) {
+        return [self failWithError:[NSError errorWithDomain:NSOSStatusErrorDomain
+                                                       code:kCCDecodeError
+                                                   userInfo:nil]];
+    }
+
+    [_handle seekToFileOffset:bodyStart + block * kCCBlockSizeAES128];
+    _skip = _range.location % kCCBlockSizeAES128;
+    _remaining = _range.length;
+    _decryptedStart = _decryptedLength = 0;
+    return YES;
+}
+
+- (void)stopDecrypting
+{
+    if (_cryptor) {
+        CCCryptorRelease(_cryptor);
+        _cryptor = NULL;
+    }
+}
+
+#pragma mark - NSStream
+
+- (void)open
+{
+    [self stopDecrypting];
+    _error = nil;
+    if ([self startDecrypting]) {
+        _status = NSStreamStatusOpen;
+    }
+}
+
+- (void)close
+{
+    [self stopDecrypting];
+    _status = NSStreamStatusClosed;
+}
+
+- (NSStreamStatus)streamStatus { return _status; }
+
+- (NSError *)streamError { return _error; }
+
+- (id<NSStreamDelegate>)delegate { return _delegate; }
+
+- (void)setDelegate:(id<NSStreamDelegate>)delegate { _delegate = delegate; }
+
+- (void)scheduleInRunLoop:(NSRunLoop *)aRunLoop forMode:(NSRunLoopMode)mode {}
+
+- (void)removeFromRunLoop:(NSRunLoop *)aRunLoop forMode:(NSRunLoopMode)mode {}
+
+- (id)propertyForKey:(NSStreamPropertyKey)key { return nil; }
+
+- (BOOL)setProperty:(id)property forKey:(NSStreamPropertyKey)key { return NO; }
+
+#pragma mark - NSInputStream
+
+- (BOOL)hasBytesAvailable { return _status == NSStreamStatusOpen; }
+
+- (BOOL)getBuffer:(uint8_t **)buffer length:(NSUInteger *)len { return NO; }
+
+- (NSInteger)read:(uint8_t *)buffer maxLength:(NSUInteger)len
+{
+    if (_status == NSStreamStatusError) return -1;
+    if (_status != NSStreamStatusOpen) return 0;
+
+    NSUInteger total = 0;
+    while (total < len) {
+        if (_decryptedLength == 0 && ![self decryptNextChunk]) break;
+        NSUInteger n = MIN(len - total, _decryptedLength);
+        memcpy(buffer + total, _decrypted + _decryptedStart, n);
+        _decryptedStart += n;
+        _decryptedLength -= n;
+        total += n;
+    }
+    if (_status == NSStreamStatusError) return -1;
+    if (total == 0) _status = NSStreamStatusAtEnd;
+    return total;
+}
+
+// Reads and decrypts the next chunk of the body into _decrypted. Returns NO at the end of the
+// range or on error.
+- (BOOL)decryptNextChunk
+{
+    while (_remaining > 0) {
+        // Only read as far as the block holding the end of the range:
+        NSUInteger wanted = _skip + _remaining;
+        wanted += (kCCBlockSizeAES128 - wanted % kCCBlockSizeAES128) % kCCBlockSizeAES128;
+        NSData *ciphertext = [_handle readDataOfLength:MIN(wanted, (NSUInteger)kChunkSize)];
+        if (ciphertext.length == 0) {
+            os_log_debug(CDTOSLog, "Encrypted attachment ended %lu bytes early",
+                         (unsigned long)_remaining);
+            return [self failWithError:[NSError errorWithDomain:NSPOSIXErrorDomain
+                                                           code:EIO
+                                                       userInfo:nil]];
+        }
+
+        size_t decryptedLength = 0;
+        if (CCCryptorUpdate(_cryptor, ciphertext.bytes, ciphertext.length, _decrypted,
+                            sizeof(_decrypted), &decryptedLength) != kCCSuccess) {
+            return [self failWithError:[NSError errorWithDomain:NSOSStatusErrorDomain
+                                                           code:kCCDecodeError
+                                                       userInfo:nil]];
+        }
+
+        NSUInteger skipped = MIN(_skip, (NSUInteger)decryptedLength);
+        _skip -= skipped;
+        _decryptedStart = skipped;
+        _decryptedLength = MIN(decryptedLength - skipped, _remaining);
+        _remaining -= _decryptedLength;
+        if (_decryptedLength > 0) return YES;
+    }
+    return NO;
+}
+
+@end
@@ -48,10 +48,32 @@
 - (instancetype)initWithEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
     NS_DESIGNATED_INITIALIZER;
 
+/** YES if the provider returned a key, so the blobs are ciphered. */
+@property (nonatomic, readonly, getter=isEncrypted) BOOL encrypted;
+
 - (id<CDTBlobReader>)readerWithPath:(NSString *)path;
 
 - (id<CDTBlobWriter>)writerWithPath:(NSString *)path;
 
+/**
+ Change the key of the blobs created from now on to the key returned by the provider.
+
+ Until every file has been re-encrypted, readers decrypt each file with the key it was written
+ with: the new key, or the key the factory had before this call. Writers always encrypt with the
+ new key.
+
+ @warning Only a change from one key to another is supported: a datastore's attachments can't be
+ encrypted or decrypted in place.
+ */
+- (void)changeEncryptionKeyToKeyOfProvider:(id<CDTEncryptionKeyProvider>)provider;
+
+/**
+ YES if the file at the path isn't encrypted with the factory's current key, so it has to be
+ re-encrypted, with a writer from this factory, for the key change to be complete. Always NO if
+ the key hasn't been changed.
+ */
+- (BOOL)blobNeedsRekeyingAtPath:(NSString *)path;
+
 /**
  Return an instance of this class or a subclass that inherits from this one.
  
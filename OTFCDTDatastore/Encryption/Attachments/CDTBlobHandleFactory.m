@@ -22,7 +22,11 @@
 
 @interface CDTBlobHandleFactory ()
 
-@property (strong, nonatomic, readonly) CDTEncryptionKey *encryptionKeyOrNil;
+/**
+ The key to encrypt with, followed by the key it replaced while the blobs are re-encrypted.
+ Replaced as a whole, so a blob gets a consistent pair when the key changes under it.
+ */
+@property (strong, atomic) NSArray<CDTEncryptionKey *> *keys;
 
 @end
 
@@ -37,23 +41,55 @@
 
     self = [super init];
     if (self) {
-        _encryptionKeyOrNil = [provider encryptionKey];
+        CDTEncryptionKey *key = [provider encryptionKey];
+        _keys = (key ? @[ key ] : @[]);
     }
 
     return self;
 }
 
 #pragma mark - Public methods
+- (BOOL)isEncrypted { return self.keys.count > 0; }
+
 - (id<CDTBlobReader>)readerWithPath:(NSString *)path { return [self blobWithPath:path]; }
 
 - (id<CDTBlobWriter>)writerWithPath:(NSString *)path { return [self blobWithPath:path]; }
 
+- (void)changeEncryptionKeyToKeyOfProvider:(id<CDTEncryptionKeyProvider>)provider
+{
+    NSArray<CDTEncryptionKey *> *keys = self.keys;
+    CDTEncryptionKey *key = [provider encryptionKey];
+    Assert(key && keys.count > 0, @"Only a change from one key to another is supported");
+
+    if (![key isEqual:keys[0]]) {
+        self.keys = @[ key, keys[0] ];
+    }
+}
+
+- (BOOL)blobNeedsRekeyingAtPath:(NSString *)path
+{
+    if (self.keys.count < 2) {
+        return NO;
+    }
+
+    CDTBlobEncryptedData *blob = (CDTBlobEncryptedData *)[self blobWithPath:path];
+    return ![blob isEncryptedWithEncryptionKey];
+}
+
 #pragma mark - Private methods
 - (id<CDTBlobReader, CDTBlobWriter>)blobWithPath:(NSString *)path
 {
-    return (self.encryptionKeyOrNil
-                ? [CDTBlobEncryptedData blobWithPath:path encryptionKey:self.encryptionKeyOrNil]
-                : [CDTBlobData blobWithPath:path]);
+    NSArray<CDTEncryptionKey *> *keys = self.keys;
+    if (keys.count == 0) {
+        return [CDTBlobData blobWithPath:path];
+    }
+
+    // CTR attachments can be streamed and range-read without decrypting the whole file, and
+    // naming the key lets them be re-encrypted one at a time when it changes
+    CDTBlobEncryptedData *blob = [CDTBlobEncryptedData blobWithPath:path encryptionKey:keys[0]];
+    blob.version = CDTBlobEncryptedDataVersionKeyedCTR;
+    blob.previousEncryptionKey = (keys.count > 1 ? keys[1] : nil);
+    return blob;
 }
 
 #pragma mark - Public class methods
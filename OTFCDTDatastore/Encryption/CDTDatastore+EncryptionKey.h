@@ -43,4 +43,34 @@
  */
 - (nullable id<CDTEncryptionKeyProvider>)encryptionKeyProvider;
 
+/**
+ * Changes the key an encrypted datastore is ciphered with to the key returned by `provider`,
+ * while the datastore stays in use. From then on, the datastore has to be opened with it.
+ *
+ * The query index database, if there is one, and the datastore's database are re-encrypted
+ * first, with SQLCipher's `PRAGMA rekey`, which rewrites every page; the database's read
+ * connections are closed meanwhile, so reads go through its writer connection, and no other
+ * process may have the datastore open. Then attachments are re-encrypted, one at a time, with
+ * `progress` called after each. New attachments are written with the new key from then on, and
+ * each attachment is read with the key it was written with until it's re-encrypted. The call
+ * returns once all of it is done.
+ *
+ * If the call fails before the databases are re-encrypted, the datastore keeps the old key.
+ * Once they are, the new key is the datastore's: the old one is kept in the database until every
+ * attachment has been re-encrypted, so if the call fails or the app stops part way through, the
+ * attachments are still readable when the datastore is opened with the new key, and the rest
+ * are re-encrypted then. CDTQIndexManager instances other than the one the datastore's query methods use can't read the
+ * index database once it has its new key, so have to be created again.
+ *
+ * @param provider returns the new key; it has to return a key, as must the datastore's current
+ *        provider: a datastore can't be encrypted or decrypted in place
+ * @param progress called as attachments are re-encrypted with how many have been done and the
+ *        total, or nil
+ * @param error will point to an NSError object in the case of an error
+ */
+- (BOOL)rekeyWithEncryptionKeyProvider:(nonnull id<CDTEncryptionKeyProvider>)provider
+                              progress:(nullable void (^)(NSUInteger rekeyedAttachments,
+                                                          NSUInteger totalAttachments))progress
+                                 error:(NSError *__nullable * __nullable)error;
+
 @end
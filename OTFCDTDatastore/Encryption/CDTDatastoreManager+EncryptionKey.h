@@ -28,7 +28,8 @@
  CDTEncryptionKeyProvider and returns nil when the key is requested.
  
  If a key is provided the first time the datastore is open, only this key will be valid the next
- time. If no key is informed, the datastore will not be cipher and it can not be cipher later on.
+ time, until it is changed with -[CDTDatastore rekeyWithEncryptionKeyProvider:progress:error:].
+ If no key is informed, the datastore will not be cipher and it can not be cipher later on.
  
  @param name datastore name
  @param provider it returns the key to cipher the datastore
@@ -46,4 +47,14 @@
        withEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
                            error:(NSError *__autoreleasing *)error;
 
+/**
+ As -datastoreNamed:withEncryptionKeyProvider:error:, with the given durability.
+
+ @see -[CDTDatastoreManager datastoreNamed:durability:error:]
+ */
+- (CDTDatastore *)datastoreNamed:(NSString *)name
+       withEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
+                      durability:(CDTDatastoreDurability)durability
+                           error:(NSError *__autoreleasing *)error;
+
 @end
@@ -0,0 +1,62 @@
+//
+//  CDTEncryptionCipherSettings.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ Whether SQLCipher wipes and locks the memory it allocates.
+ */
+typedef NS_ENUM(NSInteger, CDTEncryptionCipherMemorySecurity) {
+    /** Leave SQLCipher's own default in place. */
+    CDTEncryptionCipherMemorySecurityDefault = 0,
+    CDTEncryptionCipherMemorySecurityOn,
+    CDTEncryptionCipherMemorySecurityOff
+};
+
+/**
+ Tuning for the SQLCipher databases of an encrypted datastore. A key provider returns these from
+ its optional 'cipherSettings' method; without them, SQLCipher's defaults are used.
+
+ The key from a CDTEncryptionKey is always handed to SQLCipher as raw key material, so opening a
+ database never runs SQLCipher's own key derivation.
+
+ @see CDTEncryptionKeyProvider
+ */
+NS_ASSUME_NONNULL_BEGIN
+@interface CDTEncryptionCipherSettings : NSObject <NSCopying>
+
+/**
+ Page size, in bytes, for the encrypted databases: a power of two from 512 to 65536. Larger pages
+ mean fewer pages to decrypt for the same data. 0, the default, keeps SQLCipher's default.
+
+ An existing database with another page size is converted to this one when it is next opened.
+ */
+@property (nonatomic) NSUInteger pageSize;
+
+/**
+ Value for "PRAGMA cache_size": a number of pages if positive, or a number of KiB if negative. A
+ larger cache keeps more decrypted pages in memory. 0, the default, keeps SQLite's default.
+ */
+@property (nonatomic) NSInteger cacheSize;
+
+/**
+ Value for "PRAGMA cipher_memory_security". Turning it off avoids the cost of wiping freed memory.
+ It applies to every SQLCipher database in the process, and needs SQLCipher 4 or later; earlier
+ versions ignore it.
+ */
+@property (nonatomic) CDTEncryptionCipherMemorySecurity memorySecurity;
+
+@end
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,37 @@
+//
+//  CDTEncryptionCipherSettings.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#import "CDTEncryptionCipherSettings.h"
+
+@implementation CDTEncryptionCipherSettings
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    CDTEncryptionCipherSettings *copy = [[[self class] allocWithZone:zone] init];
+    copy.pageSize = self.pageSize;
+    copy.cacheSize = self.cacheSize;
+    copy.memorySecurity = self.memorySecurity;
+
+    return copy;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"%@, page_size: %lu, cache_size: %ld, memory_security: %ld",
+                                      [self class], (unsigned long)self.pageSize,
+                                      (long)self.cacheSize, (long)self.memorySecurity];
+}
+
+@end
@@ -17,6 +17,7 @@
 #import <Foundation/Foundation.h>
 
 #import "CDTEncryptionKey.h"
+#import "CDTEncryptionCipherSettings.h"
 
 @protocol CDTEncryptionKeyProvider
 
@@ -31,4 +32,14 @@
  */
 - (nullable CDTEncryptionKey *)encryptionKey;
 
+@optional
+
+/**
+ * Return the settings to apply to SQLCipher when a datastore is opened with this provider's key.
+ * If it returns nil, or is not implemented, SQLCipher's defaults are used.
+ *
+ * @return Cipher settings or nil
+ */
+- (nullable CDTEncryptionCipherSettings *)cipherSettings;
+
 @end
@@ -37,5 +37,10 @@ NS_ASSUME_NONNULL_BEGIN
 
 + (nullable instancetype)providerWithKey:(NSData *)key;
 
+/**
+ Settings to apply to SQLCipher along with the key. By default, nil.
+ */
+@property (copy, nonatomic, nullable) CDTEncryptionCipherSettings *cipherSettings;
+
 @end
 NS_ASSUME_NONNULL_END
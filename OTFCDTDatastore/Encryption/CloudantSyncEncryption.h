@@ -13,6 +13,7 @@
 //  either express or implied. See the License for the specific language governing permissions
 //  and limitations under the License.
 
+#import "CDTEncryptionCipherSettings.h"
 #import "CDTEncryptionKeyNilProvider.h"
 #import "CDTEncryptionKeychainProvider.h"
 #import "CDTEncryptionKeySimpleProvider.h"
@@ -21,12 +21,15 @@
 extern NSString *const FMDatabaseEncryptionKeyErrorDomain;
 
 /**
- Errors for 'setKeyWithProvider:error:'
+ Errors for 'setKeyWithProvider:error:', 'migrateDatabaseAtPath:toCipherSettingsOfProvider:error:'
+ and 'rekeyWithProvider:error:'
  */
 typedef NS_ENUM(NSInteger, FMDatabaseEncryptionKeyError) {
     FMDatabaseEncryptionKeyErrorKeyNotSet,
     FMDatabaseEncryptionKeyErrorDBCorruptedOrNoKeyProvided,
-    FMDatabaseEncryptionKeyErrorWrongKeyOrDBNotEncrypted
+    FMDatabaseEncryptionKeyErrorWrongKeyOrDBNotEncrypted,
+    FMDatabaseEncryptionKeyErrorMigrationFailed,
+    FMDatabaseEncryptionKeyErrorRekeyFailed
 };
 
 @interface FMDatabase (EncryptionKey)
@@ -34,7 +37,8 @@ typedef NS_ENUM(NSInteger, FMDatabaseEncryptionKeyError) {
 /**
  This method performs 3 steps:
  - Get an encryption key from the provider
- - Set the key (if there is any, a provider can return nil)
+ - Set the key (if there is any, a provider can return nil), along with the provider's cipher
+   settings
  - Check that the db can be read
 
  @param provider Returns the key to decipher the db (or nil)
@@ -44,4 +48,35 @@ typedef NS_ENUM(NSInteger, FMDatabaseEncryptionKeyError) {
  */
 - (BOOL)setKeyWithProvider:(id<CDTEncryptionKeyProvider>)provider error:(NSError **)error;
 
+/**
+ Converts an encrypted db to the page size in the provider's cipher settings, if it can only be
+ read with SQLCipher's default page size. It has to be called before the db is opened.
+
+ Nothing is done if the provider returns no key or no page size, if the db does not exist or it
+ already has the page size, or if it can not be read at all (opening it will then report why).
+
+ @param path Path to the db
+ @param provider Returns the key to decipher the db and the cipher settings
+ @param error Output param, it will contain an error if the method does not succeed
+
+ @return `YES` if success, `NO` on error.
+ */
++ (BOOL)migrateDatabaseAtPath:(NSString *)path
+    toCipherSettingsOfProvider:(id<CDTEncryptionKeyProvider>)provider
+                         error:(NSError **)error;
+
+/**
+ Re-encrypts an open, encrypted db with the key returned by the provider, using SQLCipher's
+ `PRAGMA rekey`. The db has to be open with its current key, and no other connection may have it
+ open, as its journal is switched out of WAL while every page is rewritten.
+
+ The page size the db has is kept: the provider's cipher settings are not applied.
+
+ @param provider Returns the new key
+ @param error Output param, it will contain an error if the method does not succeed
+
+ @return `YES` if success, `NO` on error, in which case the db keeps its current key.
+ */
+- (BOOL)rekeyWithProvider:(id<CDTEncryptionKeyProvider>)provider error:(NSError **)error;
+
 @end
@@ -24,6 +24,39 @@
 
 NSString *const FMDatabaseEncryptionKeyErrorDomain = @"FMDatabaseEncryptionKeyErrorDomain";
 
+#ifdef ENCRYPT_DATABASE
+static NSString *pragmaSetKey(CDTEncryptionKey *encryptionKey)
+{
+    NSString *hexEncryptionKey = TDHexFromBytes(encryptionKey.data.bytes, CDTENCRYPTIONKEY_KEYSIZE);
+
+    return [NSString stringWithFormat:@"PRAGMA key = \"x'%@'\";", hexEncryptionKey];
+}
+
+static BOOL execSQL(sqlite3 *db, NSString *sql)
+{
+    return (sqlite3_exec(db, sql.UTF8String, NULL, NULL, NULL) == SQLITE_OK);
+}
+
+static NSString *stringForQuery(sqlite3 *db, NSString *sql)
+{
+    NSString *value = nil;
+    sqlite3_stmt *stmt = NULL;
+    if ((sqlite3_prepare_v2(db, sql.UTF8String, -1, &stmt, NULL) == SQLITE_OK) &&
+        (sqlite3_step(stmt) == SQLITE_ROW) && sqlite3_column_text(stmt, 0)) {
+        value = [NSString stringWithUTF8String:(const char *)sqlite3_column_text(stmt, 0)];
+    }
+    sqlite3_finalize(stmt);
+
+    return value;
+}
+#endif
+
+static CDTEncryptionCipherSettings *cipherSettingsOfProvider(id<CDTEncryptionKeyProvider> provider)
+{
+    return ([provider respondsToSelector:@selector(cipherSettings)] ? [provider cipherSettings]
+                                                                     : nil);
+}
+
 #pragma mark - Public methods
 - (BOOL)setKeyWithProvider:(id<CDTEncryptionKeyProvider>)provider error:(NSError **)error
 {
@@ -32,10 +65,11 @@ NSString *const FMDatabaseEncryptionKeyErrorDomain = @"FMDatabaseEncryptionKeyEr
 
     // Get the key
     CDTEncryptionKey *encryptionKey = [provider encryptionKey];
+    CDTEncryptionCipherSettings *settings = cipherSettingsOfProvider(provider);
 
     // Set the key (if there is any)
     if (encryptionKey) {
-        success = [self setEncryptionKey:encryptionKey];
+        success = [self setEncryptionKey:encryptionKey withSettings:settings];
         if (!success) {
             os_log_error(CDTOSLog, "Key to decrypt DB at %{public}@ not set. DB can not be opened.", [self databasePath]);
 
@@ -73,6 +107,13 @@ NSString *const FMDatabaseEncryptionKeyErrorDomain = @"FMDatabaseEncryptionKeyEr
         }
     }
 
+    // The page cache holds decrypted pages, so it's worth setting even if the db is not encrypted
+    if (success && settings.cacheSize != 0) {
+        NSString *pragmaCacheSize =
+            [NSString stringWithFormat:@"PRAGMA cache_size = %ld;", (long)settings.cacheSize];
+        sqlite3_exec(self.sqliteHandle, pragmaCacheSize.UTF8String, NULL, NULL, NULL);
+    }
+
     // Return
     if (!success && error) {
         *error = thisError;
@@ -81,15 +122,132 @@ NSString *const FMDatabaseEncryptionKeyErrorDomain = @"FMDatabaseEncryptionKeyEr
     return success;
 }
 
+- (BOOL)rekeyWithProvider:(id<CDTEncryptionKeyProvider>)provider error:(NSError **)error
+{
+    CDTEncryptionKey *encryptionKey = [provider encryptionKey];
+    BOOL success = NO;
+
+#ifdef ENCRYPT_DATABASE
+    sqlite3 *db = self.sqliteHandle;
+    NSString *journalMode = stringForQuery(db, @"PRAGMA main.journal_mode;");
+    if (encryptionKey && journalMode) {
+        // Every page is rewritten with the new key, so the WAL has to be checkpointed out of the
+        // way first
+        BOOL wal = ([journalMode caseInsensitiveCompare:@"wal"] == NSOrderedSame);
+        success = (!wal || [stringForQuery(db, @"PRAGMA main.journal_mode = DELETE;")
+                               caseInsensitiveCompare:@"delete"] == NSOrderedSame);
+
+        NSString *hexEncryptionKey =
+            TDHexFromBytes(encryptionKey.data.bytes, CDTENCRYPTIONKEY_KEYSIZE);
+        success = success &&
+                  execSQL(db, [NSString stringWithFormat:@"PRAGMA rekey = \"x'%@'\";", hexEncryptionKey]);
+        success = success && execSQL(db, @"SELECT count(*) FROM sqlite_master;");
+
+        if (wal) {
+            execSQL(db, @"PRAGMA main.journal_mode = WAL;");
+        }
+    }
+#else
+    os_log_error(CDTOSLog, "This option is not available in standard SQLite, use SQLCipher instead");
+#endif
+
+    if (!success) {
+        os_log_error(CDTOSLog, "DB at %{public}@ could not be re-encrypted", [self databasePath]);
+
+        if (error) {
+            NSString *desc = NSLocalizedString(@"DB could not be re-encrypted", nil);
+            *error = [NSError errorWithDomain:FMDatabaseEncryptionKeyErrorDomain
+                                         code:FMDatabaseEncryptionKeyErrorRekeyFailed
+                                     userInfo:@{NSLocalizedDescriptionKey : desc}];
+        }
+    }
+
+    return success;
+}
+
++ (BOOL)migrateDatabaseAtPath:(NSString *)path
+    toCipherSettingsOfProvider:(id<CDTEncryptionKeyProvider>)provider
+                         error:(NSError **)error
+{
+    CDTEncryptionKey *encryptionKey = [provider encryptionKey];
+    NSUInteger pageSize = cipherSettingsOfProvider(provider).pageSize;
+    if (!encryptionKey || (pageSize == 0) ||
+        ![[NSFileManager defaultManager] fileExistsAtPath:path]) {
+        return YES;
+    }
+
+#ifdef ENCRYPT_DATABASE
+    if ([self canReadDatabaseAtPath:path withEncryptionKey:encryptionKey pageSize:pageSize] ||
+        ![self canReadDatabaseAtPath:path withEncryptionKey:encryptionKey pageSize:0]) {
+        return YES;
+    }
+
+    os_log_info(CDTOSLog, "Converting DB at %{public}@ to a page size of %{public}lu", path, (unsigned long)pageSize);
+
+    // Export to a new db alongside, then swap it in place of the old one
+    NSString *migratedPath = [path stringByAppendingString:@"-migrating"];
+    [self removeDatabaseFilesAtPath:migratedPath];
+
+    BOOL success = [self exportDatabaseAtPath:path
+                                       toPath:migratedPath
+                            withEncryptionKey:encryptionKey
+                                     pageSize:pageSize];
+    success = success &&
+              (rename(migratedPath.fileSystemRepresentation, path.fileSystemRepresentation) == 0);
+    if (success) {
+        // The export checkpointed the old db's WAL, which is empty and mustn't be applied to the
+        // new one; until the rename, the old db still needed it if anything went wrong
+        [[NSFileManager defaultManager] removeItemAtPath:[path stringByAppendingString:@"-wal"]
+                                                   error:nil];
+        [[NSFileManager defaultManager] removeItemAtPath:[path stringByAppendingString:@"-shm"]
+                                                   error:nil];
+    }
+    [self removeDatabaseFilesAtPath:migratedPath];
+
+    if (!success) {
+        os_log_error(CDTOSLog, "DB at %{public}@ could not be converted to a page size of %{public}lu", path, (unsigned long)pageSize);
+
+        if (error) {
+            NSString *desc = NSLocalizedString(@"DB could not be converted to the page size", nil);
+            *error = [NSError errorWithDomain:FMDatabaseEncryptionKeyErrorDomain
+                                         code:FMDatabaseEncryptionKeyErrorMigrationFailed
+                                     userInfo:@{NSLocalizedDescriptionKey : desc}];
+        }
+    }
+
+    return success;
+#else
+    return YES;
+#endif
+}
+
 #pragma mark - Private methods
 - (BOOL)setEncryptionKey:(CDTEncryptionKey *)encryptionKey
+            withSettings:(CDTEncryptionCipherSettings *)settings
 {
 #ifdef ENCRYPT_DATABASE
-    NSString *hexEncryptionKey = TDHexFromBytes(encryptionKey.data.bytes, CDTENCRYPTIONKEY_KEYSIZE);
-    NSString *pragmaSetKey =
-        [NSString stringWithFormat:@"PRAGMA key = \"x'%@'\";", hexEncryptionKey];
+    if (settings.memorySecurity != CDTEncryptionCipherMemorySecurityDefault) {
+        NSString *pragmaMemorySecurity = [NSString
+            stringWithFormat:@"PRAGMA cipher_memory_security = %@;",
+                             (settings.memorySecurity == CDTEncryptionCipherMemorySecurityOn
+                                  ? @"ON"
+                                  : @"OFF")];
+        sqlite3_exec(self.sqliteHandle, pragmaMemorySecurity.UTF8String, NULL, NULL, NULL);
+    }
+
+    // A raw key (x'...') is used as it is: SQLCipher does not derive a key from it
+    if (![self executeUpdate:pragmaSetKey(encryptionKey)]) {
+        return NO;
+    }
+
+    if (settings.pageSize != 0) {
+        NSString *pragmaPageSize = [NSString
+            stringWithFormat:@"PRAGMA cipher_page_size = %lu;", (unsigned long)settings.pageSize];
+        return (sqlite3_exec(self.sqliteHandle, pragmaPageSize.UTF8String, NULL, NULL, NULL) ==
+                SQLITE_OK);
+    }
 
-    return [self executeUpdate:pragmaSetKey];
+    return YES;
 #else
     os_log_error(CDTOSLog, "This option is not available in standard SQLite, use SQLCipher instead");
 
@@ -97,4 +255,76 @@ NSString *const FMDatabaseEncryptionKeyErrorDomain = @"FMDatabaseEncryptionKeyEr
 #endif
 }
 
+#ifdef ENCRYPT_DATABASE
++ (BOOL)canReadDatabaseAtPath:(NSString *)path
+            withEncryptionKey:(CDTEncryptionKey *)encryptionKey
+                     pageSize:(NSUInteger)pageSize
+{
+    sqlite3 *db = NULL;
+    BOOL success = (sqlite3_open_v2(path.fileSystemRepresentation, &db, SQLITE_OPEN_READONLY,
+                                    NULL) == SQLITE_OK);
+    success = success && execSQL(db, pragmaSetKey(encryptionKey));
+    if (success && (pageSize != 0)) {
+        success = execSQL(
+            db, [NSString stringWithFormat:@"PRAGMA cipher_page_size = %lu;", (unsigned long)pageSize]);
+    }
+    success = success && execSQL(db, @"SELECT count(*) FROM sqlite_master;");
+    sqlite3_close(db);
+
+    return success;
+}
+
+// sqlcipher_export copies the schema, the data and the user_version, but not the settings that are
+// in the header of the db file, so auto_vacuum and journal_mode are carried over here.
++ (BOOL)exportDatabaseAtPath:(NSString *)path
+                      toPath:(NSString *)exportPath
+           withEncryptionKey:(CDTEncryptionKey *)encryptionKey
+                    pageSize:(NSUInteger)pageSize
+{
+    sqlite3 *db = NULL;
+    BOOL success = (sqlite3_open_v2(path.fileSystemRepresentation, &db, SQLITE_OPEN_READWRITE,
+                                    NULL) == SQLITE_OK);
+    success = success && execSQL(db, pragmaSetKey(encryptionKey));
+
+    NSString *autoVacuum = (success ? stringForQuery(db, @"PRAGMA main.auto_vacuum;") : nil);
+    NSString *journalMode = (success ? stringForQuery(db, @"PRAGMA main.journal_mode;") : nil);
+    NSString *userVersion = (success ? stringForQuery(db, @"PRAGMA main.user_version;") : nil);
+    success = success && autoVacuum && journalMode && userVersion;
+
+    // Everything in the WAL goes into the main file first, so that nothing committed is lost if
+    // the WAL is removed; the first column is 1 if the checkpoint couldn't finish
+    NSString *checkpointBusy =
+        (success ? stringForQuery(db, @"PRAGMA main.wal_checkpoint(TRUNCATE);") : nil);
+    success = success && [checkpointBusy isEqualToString:@"0"];
+
+    NSString *hexEncryptionKey = TDHexFromBytes(encryptionKey.data.bytes, CDTENCRYPTIONKEY_KEYSIZE);
+    NSString *quotedExportPath =
+        [exportPath stringByReplacingOccurrencesOfString:@"'" withString:@"''"];
+    NSArray *statements = @[
+        [NSString stringWithFormat:@"ATTACH DATABASE '%@' AS migrated KEY \"x'%@'\";",
+                                   quotedExportPath, hexEncryptionKey],
+        [NSString stringWithFormat:@"PRAGMA migrated.cipher_page_size = %lu;", (unsigned long)pageSize],
+        [NSString stringWithFormat:@"PRAGMA migrated.auto_vacuum = %@;", autoVacuum],
+        @"SELECT sqlcipher_export('migrated');",
+        [NSString stringWithFormat:@"PRAGMA migrated.user_version = %@;", userVersion],
+        [NSString stringWithFormat:@"PRAGMA migrated.journal_mode = %@;", journalMode],
+        @"DETACH DATABASE migrated;"
+    ];
+    for (NSString *sql in statements) {
+        success = success && execSQL(db, sql);
+    }
+    sqlite3_close(db);
+
+    return success;
+}
+
++ (void)removeDatabaseFilesAtPath:(NSString *)path
+{
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    for (NSString *suffix in @[ @"", @"-wal", @"-shm", @"-journal" ]) {
+        [fileManager removeItemAtPath:[path stringByAppendingString:suffix] error:nil];
+    }
+}
+#endif
+
 @end
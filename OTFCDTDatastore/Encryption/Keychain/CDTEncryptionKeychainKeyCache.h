@@ -0,0 +1,59 @@
+//
+//  CDTEncryptionKeychainKeyCache.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "CDTEncryptionKey.h"
+
+/**
+ Keeps the DPKs unwrapped by CDTEncryptionKeychainProvider in memory for a while, so that opening
+ several datastores protected by the same key only goes to the keychain and derives the password
+ once.
+
+ Keys are cached by the identifier of their keychain entry, and are only handed back to callers
+ with the same password. Callers asking for a key that is already being derived wait for it
+ instead of deriving it again. On iOS, all keys are forgotten when the device is locked.
+ */
+NS_ASSUME_NONNULL_BEGIN
+@interface CDTEncryptionKeychainKeyCache : NSObject
+
++ (instancetype)sharedCache;
+
+/**
+ Return the key cached for an identifier and password, or if there isn't one, or it is older than
+ the lifetime, call the block to get one and cache what it returns.
+
+ @param identifier Identifier of the keychain entry holding the key
+ @param password The password protecting the key
+ @param lifetime Number of seconds a key is kept after being derived
+ @param derive Returns the key (or nil) from the keychain
+ */
+- (nullable CDTEncryptionKey *)keyForIdentifier:(NSString *)identifier
+                                       password:(NSString *)password
+                                       lifetime:(NSTimeInterval)lifetime
+                                   derivingWith:(CDTEncryptionKey *_Nullable (^)(void))derive;
+
+/**
+ Forget the key cached for an identifier, e.g. because it has been removed from the keychain.
+ */
+- (void)removeKeyForIdentifier:(NSString *)identifier;
+
+/**
+ Forget all cached keys.
+ */
+- (void)removeAllKeys;
+
+@end
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,166 @@
+//
+//  CDTEncryptionKeychainKeyCache.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#import <CommonCrypto/CommonDigest.h>
+#import <Security/Security.h>
+#if TARGET_OS_IPHONE
+#import <UIKit/UIKit.h>
+#endif
+
+#import "CDTEncryptionKeychainKeyCache.h"
+
+#import "CDTLogging.h"
+
+// Size (bytes) of the salt used to hash the password a key was cached for
+#define CDTENCRYPTION_KEYCHAIN_KEYCACHE_SALT_SIZE 16
+
+/**
+ The cached key for one identifier. Callers lock on it while the key is being derived, which is
+ what makes concurrent callers wait for that derivation.
+ */
+@interface CDTEncryptionKeychainKeyCacheEntry : NSObject
+
+@property (strong, nonatomic) CDTEncryptionKey *key;
+@property (strong, nonatomic) NSDate *expiryDate;
+@property (strong, nonatomic) NSData *passwordSalt;
+@property (strong, nonatomic) NSData *passwordHash;
+
+@end
+
+@implementation CDTEncryptionKeychainKeyCacheEntry
+@end
+
+@interface CDTEncryptionKeychainKeyCache ()
+
+@property (strong, nonatomic, readonly) NSMutableDictionary<NSString *, CDTEncryptionKeychainKeyCacheEntry *> *entries;
+
+@end
+
+@implementation CDTEncryptionKeychainKeyCache
+
+#pragma mark - Init method
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _entries = [NSMutableDictionary dictionary];
+
+#if TARGET_OS_IPHONE
+        [[NSNotificationCenter defaultCenter]
+            addObserver:self
+               selector:@selector(removeAllKeys)
+                   name:UIApplicationProtectedDataWillBecomeUnavailable
+                 object:nil];
+#endif
+    }
+
+    return self;
+}
+
+- (void)dealloc { [[NSNotificationCenter defaultCenter] removeObserver:self]; }
+
+#pragma mark - Public methods
+- (CDTEncryptionKey *)keyForIdentifier:(NSString *)identifier
+                              password:(NSString *)password
+                              lifetime:(NSTimeInterval)lifetime
+                          derivingWith:(CDTEncryptionKey * (^)(void))derive
+{
+    CDTEncryptionKeychainKeyCacheEntry *entry = nil;
+    @synchronized(self)
+    {
+        entry = self.entries[identifier];
+        if (!entry) {
+            entry = [[CDTEncryptionKeychainKeyCacheEntry alloc] init];
+            self.entries[identifier] = entry;
+        }
+    }
+
+    CDTEncryptionKey *key = nil;
+    @synchronized(entry)
+    {
+        if (entry.key && ([entry.expiryDate timeIntervalSinceNow] > 0) &&
+            [entry.passwordHash isEqualToData:[CDTEncryptionKeychainKeyCache
+                                                  hashForPassword:password
+                                                         withSalt:entry.passwordSalt]]) {
+            key = entry.key;
+        } else {
+            key = derive();
+            if (key) {
+                entry.key = key;
+                entry.expiryDate = [NSDate dateWithTimeIntervalSinceNow:lifetime];
+                entry.passwordSalt = [CDTEncryptionKeychainKeyCache generatePasswordSalt];
+                entry.passwordHash = [CDTEncryptionKeychainKeyCache hashForPassword:password
+                                                                           withSalt:entry.passwordSalt];
+            }
+        }
+    }
+
+    return key;
+}
+
+- (void)removeKeyForIdentifier:(NSString *)identifier
+{
+    @synchronized(self)
+    {
+        [self.entries removeObjectForKey:identifier];
+    }
+}
+
+- (void)removeAllKeys
+{
+    @synchronized(self)
+    {
+        if (self.entries.count > 0) {
+            os_log_debug(CDTOSLog, "Removing %{public}lu cached encryption keys", (unsigned long)self.entries.count);
+        }
+        [self.entries removeAllObjects];
+    }
+}
+
+#pragma mark - Public class methods
++ (instancetype)sharedCache
+{
+    static CDTEncryptionKeychainKeyCache *sharedCache = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+      sharedCache = [[CDTEncryptionKeychainKeyCache alloc] init];
+    });
+
+    return sharedCache;
+}
+
+#pragma mark - Private class methods
++ (NSData *)generatePasswordSalt
+{
+    NSMutableData *salt = [NSMutableData dataWithLength:CDTENCRYPTION_KEYCHAIN_KEYCACHE_SALT_SIZE];
+    if (SecRandomCopyBytes(kSecRandomDefault, salt.length, salt.mutableBytes) != errSecSuccess) {
+        os_log_error(CDTOSLog, "Random salt for the cached key not generated");
+    }
+
+    return salt;
+}
+
++ (NSData *)hashForPassword:(NSString *)password withSalt:(NSData *)salt
+{
+    NSMutableData *input = [NSMutableData dataWithData:salt];
+    [input appendData:[password dataUsingEncoding:NSUTF8StringEncoding]];
+
+    NSMutableData *hash = [NSMutableData dataWithLength:CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(input.bytes, (CC_LONG)input.length, hash.mutableBytes);
+
+    return hash;
+}
+
+@end
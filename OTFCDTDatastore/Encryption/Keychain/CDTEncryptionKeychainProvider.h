@@ -18,6 +18,9 @@
 
 #import "CDTEncryptionKeyProvider.h"
 
+// Default number of seconds an unwrapped key is kept in memory
+#define CDTENCRYPTION_KEYCHAINPROVIDER_KEYCACHE_LIFETIME 300
+
 /**
  This class conforms to protocol CDTEncryptionKeyProvider and it can be used to create an
  encrypted datastore.
@@ -30,12 +33,22 @@
  easy way to have more than one encryption key in the same app, the only condition is to provide
  different ids for each of them.
  
+ Unwrapping the key takes a keychain query and a PBKDF2 derivation of the password, so once
+ unwrapped it is kept in memory for keyCacheLifetime seconds, shared by all providers created with
+ the same identifier and password. On iOS, it is also forgotten as soon as the device is locked.
+ 
  @see CDTEncryptionKeyProvider
  @see CDTEncryptionKeychainManager
  @see CDTEncryptionKeychainStorage
  */
 @interface CDTEncryptionKeychainProvider : NSObject <CDTEncryptionKeyProvider>
 
+/**
+ Number of seconds an unwrapped key is kept in memory. 0 turns the cache off, so every call to
+ 'encryptionKey' goes to the keychain. By default, CDTENCRYPTION_KEYCHAINPROVIDER_KEYCACHE_LIFETIME.
+ */
+@property (assign, nonatomic) NSTimeInterval keyCacheLifetime;
+
 - (instancetype)init UNAVAILABLE_ATTRIBUTE;
 
 /**
@@ -51,4 +64,9 @@
  */
 + (instancetype)providerWithPassword:(NSString *)password forIdentifier:(NSString *)identifier;
 
+/**
+ Settings to apply to SQLCipher along with the key. By default, nil.
+ */
+@property (copy, nonatomic) CDTEncryptionCipherSettings *cipherSettings;
+
 @end
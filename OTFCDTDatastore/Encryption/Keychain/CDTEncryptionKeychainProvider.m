@@ -17,6 +17,7 @@
 #import "CDTEncryptionKeychainProvider.h"
 
 #import "CDTEncryptionKeychainManager.h"
+#import "CDTEncryptionKeychainKeyCache.h"
 
 #import "CDTLogging.h"
 
@@ -24,6 +25,7 @@
 
 @property (strong, nonatomic) NSString *password;
 @property (strong, nonatomic) CDTEncryptionKeychainManager *manager;
+@property (strong, nonatomic) NSString *identifier;
 
 @end
 
@@ -40,6 +42,7 @@
         if (password && manager) {
             _password = password;
             _manager = manager;
+            _keyCacheLifetime = CDTENCRYPTION_KEYCHAINPROVIDER_KEYCACHE_LIFETIME;
         } else {
             os_log_error(CDTOSLog, "All parameters are mandatory");
 
@@ -52,16 +55,34 @@
 
 #pragma mark - CDTEncryptionKeyProvider methods
 - (CDTEncryptionKey *)encryptionKey
+{
+    // Without an identifier, there is nothing to share the key with
+    if (!self.identifier || (self.keyCacheLifetime <= 0)) {
+        @synchronized(self)
+        {
+            return [self loadOrGenerateKey];
+        }
+    }
+
+    // The cache serialises callers with the same identifier, so this doesn't lock on self
+    __weak CDTEncryptionKeychainProvider *weakSelf = self;
+    return [[CDTEncryptionKeychainKeyCache sharedCache] keyForIdentifier:self.identifier
+                                                                password:self.password
+                                                                lifetime:self.keyCacheLifetime
+                                                            derivingWith:^CDTEncryptionKey * {
+                                                              return [weakSelf loadOrGenerateKey];
+                                                            }];
+}
+
+#pragma mark - Private methods
+- (CDTEncryptionKey *)loadOrGenerateKey
 {
     CDTEncryptionKey *key = nil;
 
-    @synchronized(self)
-    {
-        if ([self.manager keyExists]) {
-            key = [self.manager loadKeyUsingPassword:self.password];
-        } else {
-            key = [self.manager generateAndSaveKeyProtectedByPassword:self.password];
-        }
+    if ([self.manager keyExists]) {
+        key = [self.manager loadKeyUsingPassword:self.password];
+    } else {
+        key = [self.manager generateAndSaveKeyProtectedByPassword:self.password];
     }
 
     return key;
@@ -75,7 +96,11 @@
     CDTEncryptionKeychainManager *manager =
         [[CDTEncryptionKeychainManager alloc] initWithStorage:storage];
 
-    return [[[self class] alloc] initWithPassword:password forManager:manager];
+    CDTEncryptionKeychainProvider *provider =
+        [[[self class] alloc] initWithPassword:password forManager:manager];
+    provider.identifier = identifier;
+
+    return provider;
 }
 
 @end
@@ -15,6 +15,7 @@
 //
 
 #import "CDTEncryptionKeychainStorage.h"
+#import "CDTEncryptionKeychainKeyCache.h"
 
 #import "CDTLogging.h"
 
@@ -97,6 +98,9 @@
     BOOL success =
         [CDTEncryptionKeychainStorage deleteGenericPwWithService:self.service account:self.account];
 
+    // A key unwrapped from the data must not outlive it
+    [[CDTEncryptionKeychainKeyCache sharedCache] removeKeyForIdentifier:self.account];
+
     return success;
 }
 
@@ -0,0 +1,62 @@
+//
+//  CDTHTTPConnectionBudget.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A limit on the number of HTTP requests in flight at once, shared between several owners
+ (typically one CDTURLSession per replication).
+
+ When a slot frees up it goes to the waiting owner with the fewest requests in flight relative
+ to its weight, oldest waiter first on a tie, rather than to whichever thread happened to wait
+ first. An owner with a long queue of requests therefore can't starve one which only has a few,
+ and an owner of weight 2 gets twice the share of one of weight 1 while both are busy.
+
+ All methods are thread-safe.
+ */
+@interface CDTHTTPConnectionBudget : NSObject
+
+/** @param limit the maximum number of slots held at once; at least 1. */
+- (instancetype)initWithLimit:(NSUInteger)limit NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@property (readonly) NSUInteger limit;
+
+/** Number of slots currently held, across all owners. */
+@property (readonly) NSUInteger slotsInUse;
+
+/**
+ Blocks until a slot is granted to owner. Each call must be balanced by
+ -releaseSlotForOwner:.
+
+ @param owner identifies whose share the request counts against. Not retained.
+ @param weight owner's relative share of the budget; at least 1.
+ */
+- (void)acquireSlotForOwner:(id)owner weight:(NSUInteger)weight;
+
+/**
+ As -acquireSlotForOwner:weight:, but returns at once, calling handler on a global queue once
+ the slot is granted. Waiters of both kinds are granted slots in the same order.
+ */
+- (void)acquireSlotForOwner:(id)owner weight:(NSUInteger)weight handler:(dispatch_block_t)handler;
+
+/** Returns a slot acquired with -acquireSlotForOwner:weight:. */
+- (void)releaseSlotForOwner:(id)owner;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,151 @@
+//
+//  CDTHTTPConnectionBudget.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTHTTPConnectionBudget.h"
+
+@interface CDTHTTPConnectionBudgetWaiter : NSObject
+@property (nonatomic, strong) NSValue *owner;
+@property (nonatomic) NSUInteger weight;
+@property (nonatomic, copy) dispatch_block_t handler;  // nil for a blocked thread
+@end
+
+@implementation CDTHTTPConnectionBudgetWaiter
+@end
+
+@implementation CDTHTTPConnectionBudget {
+    NSCondition *_condition;
+    NSUInteger _slotsInUse;
+    NSMutableDictionary<NSValue *, NSNumber *> *_inFlight;     // by owner
+    NSMutableArray<CDTHTTPConnectionBudgetWaiter *> *_waiters;  // oldest first
+}
+
+- (instancetype)initWithLimit:(NSUInteger)limit
+{
+    self = [super init];
+    if (self) {
+        _limit = MAX(limit, (NSUInteger)1);
+        _condition = [[NSCondition alloc] init];
+        _inFlight = [NSMutableDictionary dictionary];
+        _waiters = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (NSUInteger)slotsInUse
+{
+    [_condition lock];
+    NSUInteger slotsInUse = _slotsInUse;
+    [_condition unlock];
+    return slotsInUse;
+}
+
+/** The waiter the next free slot should go to. Call with the condition locked. */
+- (CDTHTTPConnectionBudgetWaiter *)nextWaiter
+{
+    CDTHTTPConnectionBudgetWaiter *next = nil;
+    double nextShare = 0;
+    for (CDTHTTPConnectionBudgetWaiter *waiter in _waiters) {
+        double share = _inFlight[waiter.owner].doubleValue / waiter.weight;
+        if (!next || share < nextShare) {
+            next = waiter;
+            nextShare = share;
+        }
+    }
+    return next;
+}
+
+/** Gives waiter a slot. Call with the condition locked. */
+- (void)grantSlotToWaiter:(CDTHTTPConnectionBudgetWaiter *)waiter
+{
+    [_waiters removeObjectIdenticalTo:waiter];
+    _slotsInUse++;
+    _inFlight[waiter.owner] = @(_inFlight[waiter.owner].unsignedIntegerValue + 1);
+}
+
+/**
+ Grants free slots to waiters with handlers until the next waiter is a blocked thread, which
+ is woken to take its own, returning the handlers to call. Call with the condition locked.
+ */
+- (NSArray<dispatch_block_t> *)grantSlotsToHandlers
+{
+    NSMutableArray<dispatch_block_t> *handlers = [NSMutableArray array];
+    CDTHTTPConnectionBudgetWaiter *next;
+    while (_slotsInUse < _limit && (next = [self nextWaiter]) && next.handler) {
+        [self grantSlotToWaiter:next];
+        [handlers addObject:next.handler];
+    }
+    [_condition broadcast];
+    return handlers;
+}
+
++ (void)callHandlers:(NSArray<dispatch_block_t> *)handlers
+{
+    dispatch_queue_t queue = dispatch_get_global_queue(QOS_CLASS_UTILITY, 0);
+    for (dispatch_block_t handler in handlers) {
+        dispatch_async(queue, handler);
+    }
+}
+
+- (void)acquireSlotForOwner:(id)owner weight:(NSUInteger)weight
+{
+    CDTHTTPConnectionBudgetWaiter *waiter = [[CDTHTTPConnectionBudgetWaiter alloc] init];
+    waiter.owner = [NSValue valueWithNonretainedObject:owner];
+    waiter.weight = MAX(weight, (NSUInteger)1);
+
+    [_condition lock];
+    [_waiters addObject:waiter];
+    while (_slotsInUse >= _limit || [self nextWaiter] != waiter) {
+        [_condition wait];
+    }
+    [self grantSlotToWaiter:waiter];
+    // There may be more free slots, for which the next waiter has changed:
+    NSArray *handlers = [self grantSlotsToHandlers];
+    [_condition unlock];
+    [CDTHTTPConnectionBudget callHandlers:handlers];
+}
+
+- (void)acquireSlotForOwner:(id)owner weight:(NSUInteger)weight handler:(dispatch_block_t)handler
+{
+    CDTHTTPConnectionBudgetWaiter *waiter = [[CDTHTTPConnectionBudgetWaiter alloc] init];
+    waiter.owner = [NSValue valueWithNonretainedObject:owner];
+    waiter.weight = MAX(weight, (NSUInteger)1);
+    waiter.handler = handler;
+
+    [_condition lock];
+    [_waiters addObject:waiter];
+    NSArray *handlers = [self grantSlotsToHandlers];
+    [_condition unlock];
+    [CDTHTTPConnectionBudget callHandlers:handlers];
+}
+
+- (void)releaseSlotForOwner:(id)owner
+{
+    NSValue *key = [NSValue valueWithNonretainedObject:owner];
+
+    [_condition lock];
+    NSUInteger inFlight = _inFlight[key].unsignedIntegerValue;
+    if (inFlight > 0 && _slotsInUse > 0) {
+        _slotsInUse--;
+        if (inFlight > 1) {
+            _inFlight[key] = @(inFlight - 1);
+        } else {
+            [_inFlight removeObjectForKey:key];
+        }
+    }
+    NSArray *handlers = [self grantSlotsToHandlers];
+    [_condition unlock];
+    [CDTHTTPConnectionBudget callHandlers:handlers];
+}
+
+@end
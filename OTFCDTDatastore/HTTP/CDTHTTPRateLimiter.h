@@ -0,0 +1,54 @@
+//
+//  CDTHTTPRateLimiter.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Paces the requests sent to each host, to keep under a server's rate limit rather than
+ repeatedly hitting it.
+
+ Each host has a token bucket, which starts out unlimited. The first 429 response from a host
+ sets its rate a little below the rate requests were being sent at; further 429s lower it again,
+ at most once a second so that a burst of them from requests sent together only counts once.
+ Each successful response raises the rate slowly, so it creeps back up to the server's limit.
+ A Retry-After header stops all requests to the host until the time it gives.
+
+ One limiter shared by everything talking to a server lets its requests be paced together, as
+ the server counts them. All methods are thread-safe.
+ */
+@interface CDTHTTPRateLimiter : NSObject
+
+/** A limiter for the whole process, to share between CDTReplay429Interceptors. */
++ (CDTHTTPRateLimiter *)sharedLimiter;
+
+/**
+ Takes a token for a request to host, returning how long to wait before sending it: 0 if it may
+ be sent now. Requests are spaced out in the order they reserve tokens.
+ */
+- (NSTimeInterval)reserveRequestToHost:(NSString *)host;
+
+/** Records a 429 from host, with the delay of its Retry-After header, or 0 if it had none. */
+- (void)recordThrottledResponseFromHost:(NSString *)host retryAfter:(NSTimeInterval)retryAfter;
+
+/** Records a response from host which wasn't rate limited. */
+- (void)recordAcceptedResponseFromHost:(NSString *)host;
+
+/** Requests per second currently allowed to host, or 0 if it isn't limited. */
+- (double)requestRateForHost:(NSString *)host;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,176 @@
+//
+//  CDTHTTPRateLimiter.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTHTTPRateLimiter.h"
+
+#import "CDTLogging.h"
+
+/** Slowest rate a host is limited to, in requests per second. */
+static const double CDTHTTPRateLimiterMinimumRate = 1.0;
+
+/** Fraction of the rate which got a 429 to go down to. */
+static const double CDTHTTPRateLimiterDecrease = 0.8;
+
+/** Requests per second the rate goes up by each second while no 429s are received. */
+static const double CDTHTTPRateLimiterIncrease = 0.5;
+
+/** Period over which the rate requests are sent at is measured, and 429s counted once. */
+static const NSTimeInterval CDTHTTPRateLimiterWindow = 1.0;
+
+@interface CDTHTTPHostRateLimit : NSObject
+/** Requests per second, or 0 for unlimited. */
+@property (nonatomic) double rate;
+/** Tokens in the bucket; negative when requests have reserved tokens yet to be added. */
+@property (nonatomic) double tokens;
+@property (nonatomic) CFAbsoluteTime lastRefill;
+@property (nonatomic) CFAbsoluteTime lastDecrease;
+@property (nonatomic) CFAbsoluteTime pausedUntil;
+/** When recent requests were sent, within the last CDTHTTPRateLimiterWindow. */
+@property (nonatomic, strong) NSMutableArray<NSNumber *> *recentRequests;
+@end
+
+@implementation CDTHTTPHostRateLimit
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _recentRequests = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void)refillAt:(CFAbsoluteTime)now
+{
+    if (self.rate > 0) {
+        // At most a second's worth of tokens builds up, which bounds the burst after a lull.
+        double capacity = MAX(1.0, self.rate);
+        self.tokens = MIN(capacity, self.tokens + (now - self.lastRefill) * self.rate);
+    }
+    self.lastRefill = now;
+}
+
+- (void)pruneRequestsBefore:(CFAbsoluteTime)time
+{
+    NSUInteger stale = 0;
+    while (stale < self.recentRequests.count && self.recentRequests[stale].doubleValue < time) {
+        stale++;
+    }
+    [self.recentRequests removeObjectsInRange:NSMakeRange(0, stale)];
+}
+
+@end
+
+@implementation CDTHTTPRateLimiter {
+    // Host key to its limit; guarded by self.
+    NSMutableDictionary<NSString *, CDTHTTPHostRateLimit *> *_hosts;
+}
+
++ (CDTHTTPRateLimiter *)sharedLimiter
+{
+    static CDTHTTPRateLimiter *shared;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        shared = [[CDTHTTPRateLimiter alloc] init];
+    });
+    return shared;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _hosts = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (CDTHTTPHostRateLimit *)limitForHost:(NSString *)host
+{
+    CDTHTTPHostRateLimit *limit = _hosts[host];
+    if (!limit) {
+        limit = [[CDTHTTPHostRateLimit alloc] init];
+        limit.lastRefill = CFAbsoluteTimeGetCurrent();
+        _hosts[host] = limit;
+    }
+    return limit;
+}
+
+- (NSTimeInterval)reserveRequestToHost:(NSString *)host
+{
+    @synchronized(self)
+    {
+        CDTHTTPHostRateLimit *limit = [self limitForHost:host];
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+        NSTimeInterval wait = 0;
+        if (limit.rate > 0) {
+            [limit refillAt:now];
+            limit.tokens -= 1;
+            if (limit.tokens < 0) {
+                wait = -limit.tokens / limit.rate;
+            }
+        }
+        wait = MAX(wait, limit.pausedUntil - now);
+
+        [limit pruneRequestsBefore:now - CDTHTTPRateLimiterWindow];
+        [limit.recentRequests addObject:@(now + wait)];
+        return wait;
+    }
+}
+
+- (void)recordThrottledResponseFromHost:(NSString *)host retryAfter:(NSTimeInterval)retryAfter
+{
+    @synchronized(self)
+    {
+        CDTHTTPHostRateLimit *limit = [self limitForHost:host];
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+        if (retryAfter > 0) {
+            limit.pausedUntil = MAX(limit.pausedUntil, now + retryAfter);
+        }
+        if (now - limit.lastDecrease < CDTHTTPRateLimiterWindow) {
+            return;
+        }
+
+        // The rate we were sending at when the server objected, or the limit if that's lower.
+        [limit pruneRequestsBefore:now - CDTHTTPRateLimiterWindow];
+        double sent = limit.recentRequests.count / CDTHTTPRateLimiterWindow;
+        double current = limit.rate > 0 ? MIN(limit.rate, MAX(sent, 1.0)) : sent;
+        [limit refillAt:now];
+        limit.rate = MAX(CDTHTTPRateLimiterMinimumRate, current * CDTHTTPRateLimiterDecrease);
+        limit.tokens = MIN(limit.tokens, 0);
+        limit.lastDecrease = now;
+        os_log_info(CDTOSLog, "Rate limited by %{public}@; pacing requests at %{public}.2f/s",
+                    host, limit.rate);
+    }
+}
+
+- (void)recordAcceptedResponseFromHost:(NSString *)host
+{
+    @synchronized(self)
+    {
+        CDTHTTPHostRateLimit *limit = _hosts[host];
+        if (limit.rate > 0) {
+            // Spread over a second's responses, this adds CDTHTTPRateLimiterIncrease a second.
+            [limit refillAt:CFAbsoluteTimeGetCurrent()];
+            limit.rate += CDTHTTPRateLimiterIncrease / limit.rate;
+        }
+    }
+}
+
+- (double)requestRateForHost:(NSString *)host
+{
+    @synchronized(self) { return _hosts[host].rate; }
+}
+
+@end
@@ -0,0 +1,82 @@
+//
+//  CDTHTTPRequestScheduler.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/** Which requests to a host go first when more are waiting than can be in flight. */
+typedef NS_ENUM(NSUInteger, CDTHTTPRequestPriority) {
+    /** _changes feed requests, which the rest of a replication waits on. */
+    CDTHTTPRequestPriorityChanges = 0,
+    /** Fetching and sending documents: _bulk_get, _revs_diff, _bulk_docs and the like. */
+    CDTHTTPRequestPriorityDocuments,
+    /** Attachment downloads, and fetches of documents with their attachments inline. */
+    CDTHTTPRequestPriorityAttachments,
+};
+
+/**
+ Limits the number of HTTP requests in flight to each host, queueing the rest.
+
+ Scheduling never blocks: a request is queued with a block which is called, on a global queue,
+ once it may be sent. When a slot frees up it goes to the waiting request of the highest
+ priority; among those, to the one whose owner (typically a CDTURLSession) has the fewest
+ requests in flight to the host, oldest first on a tie. Attachment requests, which may take a
+ long time, are never given a host's last slot, so they can't hold up the changes feed and
+ document fetches behind them.
+
+ Hosts are scheduled independently, so a slow server doesn't hold up requests to others.
+
+ All methods are thread-safe.
+ */
+@interface CDTHTTPRequestScheduler : NSObject
+
+/** The scheduler used by CDTURLSessions which aren't given one, with 4 slots per host. */
++ (CDTHTTPRequestScheduler *)sharedScheduler;
+
+/** @param limit the maximum number of requests in flight to each host; at least 1. */
+- (instancetype)initWithLimitPerHost:(NSUInteger)limit NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@property (readonly) NSUInteger limitPerHost;
+
+/** The key requests to url's server are scheduled under: its scheme, host and port. */
++ (NSString *)hostKeyForURL:(NSURL *)url;
+
+/** Number of requests to host which have been started and not yet finished. */
+- (NSUInteger)requestsInFlightToHost:(NSString *)host;
+
+/** Number of requests to host waiting for a slot. */
+- (NSUInteger)requestsQueuedForHost:(NSString *)host;
+
+/**
+ Queues a request to host, and returns at once. Once the request may be sent, start is called
+ on a global queue; each call of start must be balanced by -requestFinishedForHost:.
+
+ @param owner identifies whose share of the host the request counts against. Not retained.
+ */
+- (void)scheduleRequestForHost:(NSString *)host
+                         owner:(id)owner
+                      priority:(CDTHTTPRequestPriority)priority
+                         start:(dispatch_block_t)start;
+
+/** Frees the slot of a request whose start block was called, starting the next. */
+- (void)requestFinishedForHost:(NSString *)host
+                         owner:(id)owner
+                      priority:(CDTHTTPRequestPriority)priority;
+
+@end
+
+NS_ASSUME_NONNULL_END
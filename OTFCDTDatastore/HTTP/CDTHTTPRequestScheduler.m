@@ -0,0 +1,200 @@
+//
+//  CDTHTTPRequestScheduler.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTHTTPRequestScheduler.h"
+
+#import "CDTLogging.h"
+
+@interface CDTHTTPScheduledRequest : NSObject
+@property (nonatomic, strong) NSValue *owner;
+@property (nonatomic) CDTHTTPRequestPriority priority;
+@property (nonatomic, copy) dispatch_block_t start;
+@end
+
+@implementation CDTHTTPScheduledRequest
+@end
+
+/** The requests to one host. */
+@interface CDTHTTPHostQueue : NSObject
+@property (nonatomic) NSUInteger inFlight;
+@property (nonatomic) NSUInteger attachmentsInFlight;
+@property (nonatomic, strong) NSMutableDictionary<NSValue *, NSNumber *> *inFlightByOwner;
+@property (nonatomic, strong) NSMutableArray<CDTHTTPScheduledRequest *> *waiting;  // oldest first
+@end
+
+@implementation CDTHTTPHostQueue
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _inFlightByOwner = [NSMutableDictionary dictionary];
+        _waiting = [NSMutableArray array];
+    }
+    return self;
+}
+@end
+
+@implementation CDTHTTPRequestScheduler {
+    NSMutableDictionary<NSString *, CDTHTTPHostQueue *> *_hosts;  // guarded by self
+}
+
++ (CDTHTTPRequestScheduler *)sharedScheduler
+{
+    static CDTHTTPRequestScheduler *shared;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        shared = [[CDTHTTPRequestScheduler alloc] initWithLimitPerHost:4];
+    });
+    return shared;
+}
+
+- (instancetype)initWithLimitPerHost:(NSUInteger)limit
+{
+    self = [super init];
+    if (self) {
+        _limitPerHost = MAX(limit, (NSUInteger)1);
+        _hosts = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
++ (NSString *)hostKeyForURL:(NSURL *)url
+{
+    return [NSString stringWithFormat:@"%@://%@:%@", url.scheme.lowercaseString,
+                                      url.host.lowercaseString, url.port ?: @""];
+}
+
+- (NSUInteger)requestsInFlightToHost:(NSString *)host
+{
+    @synchronized(self) { return _hosts[host].inFlight; }
+}
+
+- (NSUInteger)requestsQueuedForHost:(NSString *)host
+{
+    @synchronized(self) { return _hosts[host].waiting.count; }
+}
+
+/** Attachment requests may use all but one of a host's slots, unless it only has one. */
+- (NSUInteger)attachmentLimit { return MAX(_limitPerHost - 1, (NSUInteger)1); }
+
+/** The request the next free slot of queue should go to, if any may start. Call locked. */
+- (CDTHTTPScheduledRequest *)nextRequestInQueue:(CDTHTTPHostQueue *)queue
+{
+    if (queue.inFlight >= _limitPerHost) {
+        return nil;
+    }
+    BOOL attachmentsMayStart = queue.attachmentsInFlight < [self attachmentLimit];
+    CDTHTTPScheduledRequest *next = nil;
+    NSUInteger nextInFlight = 0;
+    for (CDTHTTPScheduledRequest *request in queue.waiting) {
+        if (request.priority == CDTHTTPRequestPriorityAttachments && !attachmentsMayStart) {
+            continue;
+        }
+        NSUInteger inFlight = queue.inFlightByOwner[request.owner].unsignedIntegerValue;
+        if (!next || request.priority < next.priority ||
+            (request.priority == next.priority && inFlight < nextInFlight)) {
+            next = request;
+            nextInFlight = inFlight;
+        }
+    }
+    return next;
+}
+
+/** Takes slots for as many of queue's waiting requests as may start. Call locked. */
+- (NSArray<dispatch_block_t> *)startRequestsInQueue:(CDTHTTPHostQueue *)queue
+{
+    NSMutableArray<dispatch_block_t> *starts = [NSMutableArray array];
+    CDTHTTPScheduledRequest *next;
+    while ((next = [self nextRequestInQueue:queue])) {
+        [queue.waiting removeObjectIdenticalTo:next];
+        queue.inFlight++;
+        if (next.priority == CDTHTTPRequestPriorityAttachments) {
+            queue.attachmentsInFlight++;
+        }
+        queue.inFlightByOwner[next.owner] =
+            @(queue.inFlightByOwner[next.owner].unsignedIntegerValue + 1);
+        [starts addObject:next.start];
+    }
+    return starts;
+}
+
++ (void)callStarts:(NSArray<dispatch_block_t> *)starts
+{
+    dispatch_queue_t queue = dispatch_get_global_queue(QOS_CLASS_UTILITY, 0);
+    for (dispatch_block_t start in starts) {
+        dispatch_async(queue, start);
+    }
+}
+
+- (void)scheduleRequestForHost:(NSString *)host
+                         owner:(id)owner
+                      priority:(CDTHTTPRequestPriority)priority
+                         start:(dispatch_block_t)start
+{
+    CDTHTTPScheduledRequest *request = [[CDTHTTPScheduledRequest alloc] init];
+    request.owner = [NSValue valueWithNonretainedObject:owner];
+    request.priority = priority;
+    request.start = start;
+
+    NSArray *starts;
+    @synchronized(self)
+    {
+        CDTHTTPHostQueue *queue = _hosts[host];
+        if (!queue) {
+            queue = [[CDTHTTPHostQueue alloc] init];
+            _hosts[host] = queue;
+        }
+        [queue.waiting addObject:request];
+        starts = [self startRequestsInQueue:queue];
+        if (starts.count == 0) {
+            os_log_debug(CDTOSLog, "Queued request to %{public}@ behind %lu in flight", host,
+                         (unsigned long)queue.inFlight);
+        }
+    }
+    [CDTHTTPRequestScheduler callStarts:starts];
+}
+
+- (void)requestFinishedForHost:(NSString *)host
+                         owner:(id)owner
+                      priority:(CDTHTTPRequestPriority)priority
+{
+    NSValue *key = [NSValue valueWithNonretainedObject:owner];
+
+    NSArray *starts;
+    @synchronized(self)
+    {
+        CDTHTTPHostQueue *queue = _hosts[host];
+        NSUInteger inFlight = queue.inFlightByOwner[key].unsignedIntegerValue;
+        if (inFlight == 0) {
+            return;
+        }
+        queue.inFlight--;
+        if (inFlight > 1) {
+            queue.inFlightByOwner[key] = @(inFlight - 1);
+        } else {
+            [queue.inFlightByOwner removeObjectForKey:key];
+        }
+        if (priority == CDTHTTPRequestPriorityAttachments && queue.attachmentsInFlight > 0) {
+            queue.attachmentsInFlight--;
+        }
+
+        starts = [self startRequestsInQueue:queue];
+        if (queue.inFlight == 0 && queue.waiting.count == 0) {
+            [_hosts removeObjectForKey:host];
+        }
+    }
+    [CDTHTTPRequestScheduler callStarts:starts];
+}
+
+@end
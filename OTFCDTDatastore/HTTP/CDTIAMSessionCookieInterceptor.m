@@ -69,29 +69,24 @@ static const NSInteger CDTIAMSessionCookieRequestTimeout = 600;
     return config;
 }
 
-- (CDTHTTPInterceptorContext *)interceptRequestInContext:(CDTHTTPInterceptorContext *)context
+- (NSString *)sessionCookieName { return @"IAMSession"; }
+
+- (NSArray<NSHTTPCookie *> *)newSessionCookiesForRequestURL:(NSURL *)requestURL
 {
-    if (self.shouldMakeSessionRequest) {
-        BOOL hasCookie = [self hasValidCookieWithName:@"IAMSession" forRequestURL: context.request.URL];
-        if (!hasCookie) {
-            // We don't have a cookie - first get the IAM bearer token
-            NSData *bearerToken = [self getBearerToken];
-            // Now get the _iam_session cookie
-            if (bearerToken != nil) {
-                [self setSessionRequestBody:bearerToken];
-                NSURLComponents *components =
-                [NSURLComponents componentsWithURL:context.request.URL resolvingAgainstBaseURL:NO];
-                components.path = @"/_iam_session";
-                NSURL *URL = [components URL];
-                self.cookies = [super startNewSessionAtURL:URL withBody:self.sessionRequestBody session:self.urlSession sessionStartedHandler:^(NSData * data){return [self hasSessionStarted:data];}];
-            } else {
-                // Wipe the cookies if we couldn't get a valid token
-                self.cookies = nil;
-            }
-        }
-        [context.request setAllHTTPHeaderFields: [NSHTTPCookie requestHeaderFieldsWithCookies:self.cookies]];
+    // We don't have a cookie - first get the IAM bearer token
+    NSData *bearerToken = [self getBearerToken];
+    if (bearerToken == nil) {
+        // No cookies if we couldn't get a valid token
+        return nil;
     }
-    return context;
+
+    // Now get the _iam_session cookie
+    [self setSessionRequestBody:bearerToken];
+    NSURLComponents *components =
+    [NSURLComponents componentsWithURL:requestURL resolvingAgainstBaseURL:NO];
+    components.path = @"/_iam_session";
+    NSURL *URL = [components URL];
+    return [super startNewSessionAtURL:URL withBody:self.sessionRequestBody session:self.urlSession sessionStartedHandler:^(NSData * data){return [self hasSessionStarted:data];}];
 }
 
 - (NSData *)getBearerToken {
@@ -18,13 +18,28 @@
 #import "CDTSessionCookieInterceptor.h"
 #import "CDTLogging.h"
 
+@class CDTHTTPRateLimiter;
 
+/**
+ Retries requests which get a 429 (too many requests) response.
 
+ On its own, each request is retried after an exponential back-off. Given a rate limiter, the
+ requests are instead paced through it: every request waits for its token before being sent,
+ 429s and their Retry-After headers slow the host's rate down, and retries wait for a token like
+ any other request. Interceptors sharing a limiter, such as
+ +[CDTHTTPRateLimiter sharedLimiter], pace all their requests to a server together.
+ */
 @interface CDTReplay429Interceptor : NSObject <CDTHTTPInterceptor>
 
+/** Rate limiter requests are paced through, or nil to back off each request on its own. */
+@property (nullable, readonly, strong) CDTHTTPRateLimiter *rateLimiter;
+
 + (nonnull instancetype)interceptor;
 - (nonnull instancetype)init;
 - (nonnull instancetype)initWithSleep:(NSTimeInterval)sleep
-                           maxRetries:(int)maxRetries NS_DESIGNATED_INITIALIZER;
+                           maxRetries:(int)maxRetries;
+- (nonnull instancetype)initWithSleep:(NSTimeInterval)sleep
+                           maxRetries:(int)maxRetries
+                          rateLimiter:(nullable CDTHTTPRateLimiter *)rateLimiter NS_DESIGNATED_INITIALIZER;
 
 @end
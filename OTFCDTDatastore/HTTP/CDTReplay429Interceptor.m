@@ -15,6 +15,8 @@
 //
 
 #import "CDTReplay429Interceptor.h"
+#import "CDTHTTPRateLimiter.h"
+#import "CDTHTTPRequestScheduler.h"
 
 static NSString *kSleepKey = @"com.cloudant.CDTRequestLimitInterceptor.sleep";
 static NSString *kRetryCountKey = @"com.cloudant.CDTRequestLimitInterceptor.retryCount";
@@ -46,19 +48,78 @@ static NSString *kRetryCountKey = @"com.cloudant.CDTRequestLimitInterceptor.retr
 
 - (instancetype)initWithSleep:(NSTimeInterval)initialSleep
                   maxRetries:(int)maxRetries;
+{
+    return [self initWithSleep:initialSleep maxRetries:maxRetries rateLimiter:nil];
+}
+
+- (instancetype)initWithSleep:(NSTimeInterval)initialSleep
+                   maxRetries:(int)maxRetries
+                  rateLimiter:(CDTHTTPRateLimiter *)rateLimiter
 {
     if (self = [super init]) {
         _initialSleep = initialSleep;
         _maxRetries = maxRetries;
+        _rateLimiter = rateLimiter;
     }
     return self;
 }
 
+/**
+ Seconds the Retry-After header of a response asks us to wait, given either as a number of
+ seconds or an HTTP date, or 0 if there's no header.
+ */
++ (NSTimeInterval)retryAfterForResponse:(NSHTTPURLResponse *)response
+{
+    NSString *retryAfter = response.allHeaderFields[@"Retry-After"];
+    if (retryAfter.length == 0) {
+        return 0;
+    }
+    NSScanner *scanner = [NSScanner scannerWithString:retryAfter];
+    double seconds;
+    if ([scanner scanDouble:&seconds] && scanner.isAtEnd) {
+        return MAX(seconds, 0);
+    }
+
+    static NSDateFormatter *formatter;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        formatter = [[NSDateFormatter alloc] init];
+        formatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+        formatter.timeZone = [NSTimeZone timeZoneForSecondsFromGMT:0];
+        formatter.dateFormat = @"EEE, dd MMM yyyy HH:mm:ss zzz";
+    });
+    NSDate *date;
+    @synchronized(formatter) { date = [formatter dateFromString:retryAfter]; }
+    return date ? MAX([date timeIntervalSinceNow], 0) : 0;
+}
+
+/**
+ * With a rate limiter, waits for a token before the request is sent
+ */
+- (CDTHTTPInterceptorContext *)interceptRequestInContext:(CDTHTTPInterceptorContext *)context
+{
+    if (self.rateLimiter) {
+        NSString *host = [CDTHTTPRequestScheduler hostKeyForURL:context.request.URL];
+        NSTimeInterval wait = [self.rateLimiter reserveRequestToHost:host];
+        if (wait > 0) {
+            os_log_debug(CDTOSLog, "Pacing request to %{public}@; sending in %{public}.3f seconds.",
+                         host, wait);
+            [NSThread sleepForTimeInterval:wait];
+        }
+    }
+    return context;
+}
+
 /**
  * Interceptor to retry after an exponential backoff if we receive a 429 error
  */
 - (CDTHTTPInterceptorContext *)interceptResponseInContext:(CDTHTTPInterceptorContext *)context
 {
+    NSString *host = self.rateLimiter ? [CDTHTTPRequestScheduler hostKeyForURL:context.request.URL] : nil;
+    if (host && context.response.statusCode != 429) {
+        [self.rateLimiter recordAcceptedResponseFromHost:host];
+    }
+
     if (context.response.statusCode == 429) {
 
         // if we are the first invocation in this pipeline, set some state
@@ -72,9 +133,23 @@ static NSString *kRetryCountKey = @"com.cloudant.CDTRequestLimitInterceptor.retr
         double sleep = [(NSNumber*)[context stateForKey:kSleepKey] doubleValue];
         int retryCount = [(NSNumber*)[context stateForKey:kRetryCountKey] intValue];
 
-        if (retryCount < self.maxRetries) {
+        if (host) {
+            [self.rateLimiter
+                recordThrottledResponseFromHost:host
+                                     retryAfter:[CDTReplay429Interceptor retryAfterForResponse:context.response]];
+        }
+
+        if (retryCount < self.maxRetries && host) {
+            // The retry waits for its token in -interceptRequestInContext:, like any request.
+            os_log_info(CDTOSLog, "429 error code (too many requests) received. Will retry when the rate limit allows.");
+            [context setState:@(retryCount+1) forKey:kRetryCountKey];
+            context.shouldRetry = true;
+        } else if (retryCount < self.maxRetries) {
             os_log_info(CDTOSLog, "429 error code (too many requests) received. Will retry in %{public}.3f seconds.", sleep);
             
+            CDTSignpostEvent("429Backoff", "%{public}@ sleep=%.3fs retry=%d",
+                             context.request.URL.path, sleep, retryCount + 1);
+
             // sleep for a short time before making next request
             [NSThread sleepForTimeInterval:sleep];
             [context setState:@(sleep*2) forKey:kSleepKey]; // exponential back-off
@@ -50,24 +50,15 @@
     return config;
 }
 
+- (NSString *)sessionCookieName { return @"AuthSession"; }
+
 /**
- The interceptor adds a session cookie to every request, unless we've encountered an error
- retrieving a cookie that doesn't look recoverable. If we don't yet have a session cookie,
- this method handles making a request to _session to retrieve one.
+ We don't have a cookie -- either a new session entirely or the old one is expiring -- so
+ make a request to _session to retrieve one.
  */
-- (CDTHTTPInterceptorContext *)interceptRequestInContext:(CDTHTTPInterceptorContext *)context
+- (NSArray<NSHTTPCookie *> *)newSessionCookiesForRequestURL:(NSURL *)requestURL
 {
-    if (self.shouldMakeSessionRequest) {
-        BOOL hasCookie = [self hasValidCookieWithName:@"AuthSession" forRequestURL: context.request.URL];
-        if (!hasCookie) {
-            // We don't have a cookie --
-            // either a new session entirely or the old one is expired (or nearly expired).
-            self.cookies = [self startNewSessionAtURL:context.request.URL];
-        }
-        [context.request setAllHTTPHeaderFields: [NSHTTPCookie requestHeaderFieldsWithCookies:self.cookies]];
-    }
-
-    return context;
+    return [self startNewSessionAtURL:requestURL];
 }
 
 /**
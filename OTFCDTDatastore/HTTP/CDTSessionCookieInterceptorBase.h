@@ -32,6 +32,25 @@
 /** Current session cookie. */
 @property (nullable, nonatomic, strong) NSArray<NSHTTPCookie *> *cookies;
 
+/** Name of the session cookie; sub-classes must over-ride this. */
+@property (nonnull, nonatomic, readonly) NSString *sessionCookieName;
+
+/**
+ Logs in, returning the session cookies for the server of `requestURL`, or nil on failure.
+ Sub-classes must over-ride this. It's only called by one thread at a time, and not on the
+ thread of a request.
+ */
+- (nullable NSArray<NSHTTPCookie *> *)newSessionCookiesForRequestURL:(nonnull NSURL *)requestURL;
+
+/**
+ Returns the cookies to send with a request to `requestURL`, logging in first if there are none
+ or they're about to expire. A cookie part way through its life is returned straight away, and
+ renewed in the background so requests don't wait for it to expire. However many requests find
+ the cookie needs renewing only one login is made, which any of them without a usable cookie
+ wait for.
+ */
+- (nullable NSArray<NSHTTPCookie *> *)sessionCookiesForRequestURL:(nonnull NSURL *)requestURL;
+
 - (nullable NSArray<NSHTTPCookie *> *)startNewSessionAtURL:(nonnull NSURL *)url
                                    withBody:(nonnull NSData *)body
                                     session:(nonnull NSURLSession *)session
@@ -22,8 +22,24 @@
 /** Number of seconds to wait for _session to respond. */
 static const NSInteger CDTSessionCookieRequestTimeout = 600;
 
+/** Cookies with less than this many seconds left aren't sent; requests wait for a new one. */
+static const NSTimeInterval CDTSessionCookieExpiryMargin = 300;
 
-@implementation CDTSessionCookieInterceptorBase
+/**
+ Fraction of a cookie's lifetime, before CDTSessionCookieExpiryMargin, in which it's renewed in
+ the background while still being sent.
+ */
+static const double CDTSessionCookieRefreshFraction = 0.25;
+
+
+@implementation CDTSessionCookieInterceptorBase {
+    // All guarded by self.
+    NSArray<NSHTTPCookie *> *_cookies;
+    NSDate *_cookiesReceived;
+    dispatch_group_t _refreshGroup;
+
+    dispatch_queue_t _refreshQueue;
+}
 
 
 - (instancetype)init
@@ -33,6 +49,7 @@ static const NSInteger CDTSessionCookieRequestTimeout = 600;
         NSURLSessionConfiguration *config =
         [NSURLSessionConfiguration ephemeralSessionConfiguration];
         [self setShouldMakeSessionRequest:YES];
+        _refreshQueue = dispatch_queue_create("com.cloudant.sync.session.refresh", DISPATCH_QUEUE_SERIAL);
         // allow sub-classes to set headers etc for the session
         config = [self customiseSessionConfig:config];
         [self setUrlSession:[NSURLSession sessionWithConfiguration:config]];
@@ -46,6 +63,113 @@ static const NSInteger CDTSessionCookieRequestTimeout = 600;
     return config;
 }
 
+- (NSArray<NSHTTPCookie *> *)cookies
+{
+    @synchronized(self) { return _cookies; }
+}
+
+- (void)setCookies:(NSArray<NSHTTPCookie *> *)cookies
+{
+    @synchronized(self)
+    {
+        _cookies = cookies;
+        _cookiesReceived = [NSDate date];
+    }
+}
+
+- (NSString *)sessionCookieName
+{
+    [NSException raise:NSInternalInconsistencyException
+                format:@"%@ must over-ride -sessionCookieName", NSStringFromClass([self class])];
+    return nil;
+}
+
+- (NSArray<NSHTTPCookie *> *)newSessionCookiesForRequestURL:(NSURL *)requestURL
+{
+    [NSException raise:NSInternalInconsistencyException
+                format:@"%@ must over-ride -newSessionCookiesForRequestURL:", NSStringFromClass([self class])];
+    return nil;
+}
+
+/**
+ The interceptor adds a session cookie to every request, unless we've encountered an error
+ retrieving a cookie that doesn't look recoverable.
+ */
+- (CDTHTTPInterceptorContext *)interceptRequestInContext:(CDTHTTPInterceptorContext *)context
+{
+    if (self.shouldMakeSessionRequest) {
+        NSArray<NSHTTPCookie *> *cookies = [self sessionCookiesForRequestURL:context.request.URL];
+        [context.request setAllHTTPHeaderFields:[NSHTTPCookie requestHeaderFieldsWithCookies:cookies]];
+    }
+    return context;
+}
+
+- (NSArray<NSHTTPCookie *> *)sessionCookiesForRequestURL:(NSURL *)requestURL
+{
+    NSArray<NSHTTPCookie *> *cookies = nil;
+    dispatch_group_t refresh = nil;
+    @synchronized(self)
+    {
+        BOOL usable = [self hasValidCookieWithName:self.sessionCookieName forRequestURL:requestURL];
+        if (usable) {
+            cookies = _cookies;
+        }
+        if (!usable || [self cookieWithName:self.sessionCookieName isDueForRefreshAt:[NSDate date]]) {
+            refresh = [self refreshSessionCookiesForRequestURL:requestURL];
+        }
+    }
+
+    if (!cookies && refresh) {
+        // Nothing we can send, so wait for the login; whoever started it, it's the same one.
+        dispatch_group_wait(refresh, DISPATCH_TIME_FOREVER);
+        cookies = self.cookies;
+    }
+    return cookies;
+}
+
+/** Whether the cookie, though still usable, is far enough through its life to be renewed. */
+- (BOOL)cookieWithName:(NSString *)cookieName isDueForRefreshAt:(NSDate *)now
+{
+    for (NSHTTPCookie *c in _cookies) {
+        if ([c.name isEqualToString:cookieName] && c.expiresDate && _cookiesReceived) {
+            NSTimeInterval lifetime = [c.expiresDate timeIntervalSinceDate:_cookiesReceived];
+            NSTimeInterval remaining = [c.expiresDate timeIntervalSinceDate:now];
+            return remaining < CDTSessionCookieExpiryMargin + lifetime * CDTSessionCookieRefreshFraction;
+        }
+    }
+    return NO;
+}
+
+/**
+ Starts a login on the refresh queue, unless one is already running, returning the group to
+ wait on for it. Call while synchronized on self.
+ */
+- (dispatch_group_t)refreshSessionCookiesForRequestURL:(NSURL *)requestURL
+{
+    if (_refreshGroup) {
+        return _refreshGroup;
+    }
+
+    os_log_debug(CDTOSLog, "Renewing %{public}@ cookie.", self.sessionCookieName);
+    dispatch_group_t group = dispatch_group_create();
+    _refreshGroup = group;
+    dispatch_group_enter(group);
+    dispatch_async(_refreshQueue, ^{
+        NSArray<NSHTTPCookie *> *cookies = [self newSessionCookiesForRequestURL:requestURL];
+        @synchronized(self)
+        {
+            // A failed renewal mustn't throw away a cookie which can still be sent.
+            if (cookies ||
+                ![self hasValidCookieWithName:self.sessionCookieName forRequestURL:requestURL]) {
+                self.cookies = cookies;
+            }
+            self->_refreshGroup = nil;
+        }
+        dispatch_group_leave(group);
+    });
+    return group;
+}
+
 - (BOOL)hasValidCookieWithName:(nonnull NSString*)cookieName forRequestURL:(nonnull NSURL*)requestUrl
 {
     os_log_debug(CDTOSLog, "Checking cookies.");
@@ -57,7 +181,7 @@ static const NSInteger CDTSessionCookieRequestTimeout = 600;
     // Get the existing cookies
     // Compare them to the current time and return YES if we should renew
     NSDate *timeNow = [NSDate date];
-    for (NSHTTPCookie* c in _cookies)
+    for (NSHTTPCookie* c in self.cookies)
     {
         if ([c.name isEqualToString: cookieName]) {
             os_log_debug(CDTOSLog, "Already have %{public}@ cookie.", cookieName);
@@ -101,7 +225,7 @@ static const NSInteger CDTSessionCookieRequestTimeout = 600;
     
     if (retryAndAttemptNewSession) {
         // Clear the cookies as we are no longer authorized
-        _cookies = nil;
+        self.cookies = nil;
         context.shouldRetry = YES;
     }
 
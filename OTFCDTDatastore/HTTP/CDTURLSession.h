@@ -16,8 +16,13 @@
 #import "CDTURLSessionTask.h"
 #import "CDTMacros.h"
 #import "CDTNSURLSessionConfigurationDelegate.h"
+#import "CDTHTTPRequestScheduler.h"
 
 @class CDTHTTPInterceptorContext;
+@class CDTHTTPConnectionBudget;
+@class CDTReplicationMetrics;
+@class CDTURLSessionPool;
+@class TDReplicationTrace;
 
 /**
  Façade class to NSURLSession, makes completion handlers run on
@@ -81,7 +86,57 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (void)disassociateTask:(NSURLSessionDataTask *)task;
 
-- (void) waitForFreeSlot;
+/**
+ * Resumes an NSURLSessionDataTask created by -createDataTaskWithRequest:associatedWithTask: once
+ * the requestScheduler, and then the connectionBudget if set, have a slot for it. Returns at
+ * once; `started` is called on a global queue just before the task is resumed. If the task is
+ * cancelled while it waits, it's dropped from the queue.
+ *
+ * @param task The task to resume.
+ * @param priority The task's place in the queue for its host.
+ * @param started Called as the task is resumed.
+ */
+- (void)resumeTask:(NSURLSessionDataTask *)task
+          priority:(CDTHTTPRequestPriority)priority
+           started:(void (^)(void))started;
+
+/**
+ * Schedules this session's requests to each host alongside those of other sessions. If nil, the
+ * sharedScheduler is used, allowing 4 requests in flight to each host. Set before making any
+ * requests.
+ */
+@property (nullable, nonatomic, strong) CDTHTTPRequestScheduler *requestScheduler;
+
+/**
+ * A limit on requests in flight shared with other sessions, across all hosts, applied after the
+ * requestScheduler. If nil, only the requestScheduler limits requests. Set before making any
+ * requests.
+ */
+@property (nullable, nonatomic, strong) CDTHTTPConnectionBudget *connectionBudget;
+
+/**
+ * This session's share of the connectionBudget relative to the other sessions using it.
+ * Defaults to 1.
+ */
+@property (nonatomic) NSUInteger connectionWeight;
+
+/**
+ * If set, requests are made using the pool's shared NSURLSession for their host, so connections
+ * are reused across CDTURLSessions, rather than an NSURLSession of this session's own. The pool's
+ * sessions aren't customised by the sessionConfigDelegate, so only set this for sessions without
+ * one. Set before making any requests.
+ */
+@property (nullable, nonatomic, strong) CDTURLSessionPool *connectionPool;
+
+/**
+ * If set, every request made with this session is recorded here when it completes.
+ */
+@property (nullable, nonatomic, strong) CDTReplicationMetrics *metrics;
+
+/**
+ * If set, every request made with this session, and every retry, is recorded here too.
+ */
+@property (nullable, nonatomic, strong) TDReplicationTrace *trace;
 
 - (void)finishTasksAndInvalidate;
 
@@ -16,24 +16,24 @@
 #import "CDTLogging.h"
 #import "CDTHTTPInterceptorContext.h"
 #import "CDTHTTPInterceptor.h"
+#import "CDTHTTPConnectionBudget.h"
+#import "CDTReplicationMetrics.h"
+#import "CDTURLSessionPool.h"
+#import "TDReplicationTrace.h"
 
 @interface CDTURLSession ()
 
-@property (nonatomic, strong) NSURLSession *session;
+@property (nonatomic, strong) NSURLSession *session;  // unless using a connectionPool
+@property (nonatomic, strong) NSObject<CDTNSURLSessionConfigurationDelegate> *sessionConfigDelegate;
 @property (nonatomic, strong) NSThread *thread;
 @property (nonatomic, strong) NSArray *interceptors;
 @property (nonatomic, strong) NSMapTable *taskMap;
-@property (nonatomic, strong) NSMutableDictionary<NSNumber*,NSMutableData*> *dataMap;
+@property (nonatomic, strong) NSMutableDictionary<NSValue*,NSMutableData*> *dataMap;
+// The scheduled request of each task which has been given a slot; guarded by itself.
+@property (nonatomic, strong) NSMutableDictionary<NSValue *, NSArray *> *slotMap;
 
 @end
 
-/* number of async tasks to launch at any given time
- * if more tasks than this limit are launched, they will block until
- * -URLSession:task:didCompleteWithError is called
- */
-static const int kAsyncTasks = 4;
-static dispatch_semaphore_t g_asyncTaskMonitor;
-
 @implementation CDTURLSession
 
 - (instancetype)init
@@ -47,51 +47,14 @@ static dispatch_semaphore_t g_asyncTaskMonitor;
                    requestInterceptors:(NSArray *)requestInterceptors
                  sessionConfigDelegate:(NSObject<CDTNSURLSessionConfigurationDelegate> *)sessionConfigDelegate
 {
-    static dispatch_once_t onceToken;
-    
-    dispatch_once (&onceToken, ^{
-        g_asyncTaskMonitor = dispatch_semaphore_create(kAsyncTasks);
-    });
-
     NSParameterAssert(thread);
     self = [super init];
     if (self) {
         _thread = thread;
+        _connectionWeight = 1;
         _interceptors = [NSArray arrayWithArray:requestInterceptors];
 
-        NSURLSessionConfiguration *config;
-        // Create a unique session id using the address of self.
-        NSString *sessionId = [NSString stringWithFormat:@"com.cloudant.sync.sessionid.%p", self];
-        if (getenv("CDT_TEST_ENABLE_OHHTTPSTUBS")) {
-            config = [NSURLSessionConfiguration defaultSessionConfiguration];
-        } else {
-            // Only compile this for iOS8.0 and above or OSX 10.10 and above
-#if (defined(__IPHONE_OS_VERSION_MAX_ALLOWED) && __IPHONE_OS_VERSION_MAX_ALLOWED >= 80000) \
- || (defined(__MAC_OS_X_VERSION_MAX_ALLOWED) && __MAC_OS_X_VERSION_MAX_ALLOWED >= 101000)
-            // NSURLSessionConfiguration:backgroundSessionConfigurationWithIdentifier was introduced in iOS 8.0
-            // to replace backgroundSessionConfiguration which was deprecated in iOS 8.0, so use the new version if
-            // available.
-            if ([[NSURLSessionConfiguration class] respondsToSelector:@selector(backgroundSessionConfigurationWithIdentifier:)]) {
-                config = [NSURLSessionConfiguration backgroundSessionConfigurationWithIdentifier:sessionId];
-            } else {
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-                // since the method is only called on platforms where its replacement is missing
-                // we supress the warning
-                config = [NSURLSessionConfiguration backgroundSessionConfiguration:sessionId];
-#pragma GCC pop
-            }
-#else
-        }
-        config = [NSURLSessionConfiguration backgroundSessionConfiguration:sessionId];
-#endif
-        }
-        [config setTimeoutIntervalForRequest:300];
-        [sessionConfigDelegate customiseNSURLSessionConfiguration:config];
-
-        _session = [NSURLSession sessionWithConfiguration:config
-                                                 delegate:self
-                                            delegateQueue:nil];
+        _sessionConfigDelegate = sessionConfigDelegate;
 
         // Configure taskMap to hold weak references to the underlying NSURLSessionDataTask objects
         // so we don't unnecessarily hold on to objects and that values are removed from
@@ -100,11 +63,37 @@ static dispatch_semaphore_t g_asyncTaskMonitor;
         
         // Strong map table to handle the queueing of data.
         _dataMap = [NSMutableDictionary dictionary];
+        _slotMap = [NSMutableDictionary dictionary];
     }
     return self;
 }
 
-- (void)finishTasksAndInvalidate { [self.session finishTasksAndInvalidate]; }
+- (NSURLSession *)session
+{
+    @synchronized(self) {
+        if (!_session) {
+            // Create a unique session id using the address of self.
+            NSString *sessionId =
+                [NSString stringWithFormat:@"com.cloudant.sync.sessionid.%p", self];
+            NSURLSessionConfiguration *config =
+                [CDTURLSessionPool sessionConfigurationWithIdentifier:sessionId];
+            [self.sessionConfigDelegate customiseNSURLSessionConfiguration:config];
+
+            _session =
+                [NSURLSession sessionWithConfiguration:config delegate:self delegateQueue:nil];
+        }
+        return _session;
+    }
+}
+
+- (void)finishTasksAndInvalidate
+{
+    // The pool's sessions outlive this one; our tasks there still finish, as they're retained by
+    // the pool until they complete.
+    if (!self.connectionPool) {
+        [self.session finishTasksAndInvalidate];
+    }
+}
 
 - (CDTURLSessionTask *)dataTaskWithRequest:(NSURLRequest *)request
                               taskDelegate:(NSObject<CDTURLSessionTaskDelegate> *)taskDelegate
@@ -120,8 +109,11 @@ static dispatch_semaphore_t g_asyncTaskMonitor;
                                  associatedWithTask:(CDTURLSessionTask *)task
 
 {
-    NSURLSessionDataTask *nsURLSessionTask = [self.session dataTaskWithRequest:request];
-    [self.taskMap setObject:task forKey:[NSNumber numberWithInteger:nsURLSessionTask.taskIdentifier]];
+    CDTURLSessionPool *pool = self.connectionPool;
+    NSURLSessionDataTask *nsURLSessionTask =
+        pool ? [pool dataTaskWithRequest:request delegate:self]
+             : [self.session dataTaskWithRequest:request];
+    [self.taskMap setObject:task forKey:[self keyForTask:nsURLSessionTask]];
     return nsURLSessionTask;
 }
 
@@ -129,10 +121,15 @@ static dispatch_semaphore_t g_asyncTaskMonitor;
 {
     // Unless we provide a queue from which to run the delegate this method will on be called in serial
     // see: https://developer.apple.com/library/ios/documentation/Foundation/Reference/NSURLSession_class/#//apple_ref/occ/clm/NSURLSession/sessionWithConfiguration:delegate:delegateQueue:
-    NSMutableData * storedData = [self.dataMap objectForKey:@(dataTask.taskIdentifier)];
+    CDTURLSessionTask *cdtURLSessionTask = [self getSessionTaskForTask:dataTask];
+    if ([cdtURLSessionTask processPartialData:data onThread:self.thread]) {
+        return;
+    }
+
+    NSMutableData * storedData = [self.dataMap objectForKey:[self keyForTask:dataTask]];
     if (!storedData) {
         storedData = [NSMutableData data];
-        [self.dataMap setObject:storedData forKey:@(dataTask.taskIdentifier)];
+        [self.dataMap setObject:storedData forKey:[self keyForTask:dataTask]];
     }
     
     [storedData appendData:data];
@@ -140,41 +137,139 @@ static dispatch_semaphore_t g_asyncTaskMonitor;
 
 - (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error
 {
-    CDTURLSessionTask *cdtURLSessionTask = [self getSessionTaskForId:task.taskIdentifier];
-    NSData * data = [self.dataMap objectForKey:@(task.taskIdentifier)];
+    CDTURLSessionTask *cdtURLSessionTask = [self getSessionTaskForTask:task];
+    NSData * data = [self.dataMap objectForKey:[self keyForTask:task]];
     //remove from map so it can be deallocated.
-    [self.dataMap removeObjectForKey:@(task.taskIdentifier)];
-    
+    [self.dataMap removeObjectForKey:[self keyForTask:task]];
+
+    CDTReplicationMetrics *metrics = self.metrics;
+    if (metrics && cdtURLSessionTask) {
+        NSHTTPURLResponse *response = (NSHTTPURLResponse *)task.response;
+        NSInteger statusCode =
+            [response isKindOfClass:[NSHTTPURLResponse class]] ? response.statusCode : 0;
+        [metrics recordRequestWithURL:task.originalRequest.URL
+                           statusCode:statusCode
+                               failed:(error != nil)
+                            bytesSent:task.countOfBytesSent
+                        bytesReceived:task.countOfBytesReceived
+                              latency:CFAbsoluteTimeGetCurrent() - cdtURLSessionTask.sentTime];
+    }
+    TDReplicationTrace *trace = self.trace;
+    if (trace && cdtURLSessionTask) {
+        NSHTTPURLResponse *response = (NSHTTPURLResponse *)task.response;
+        NSInteger statusCode =
+            [response isKindOfClass:[NSHTTPURLResponse class]] ? response.statusCode : 0;
+        NSTimeInterval latency = CFAbsoluteTimeGetCurrent() - cdtURLSessionTask.sentTime;
+        NSMutableDictionary *fields = [@{
+            @"endpoint" : [CDTReplicationMetrics endpointForURL:task.originalRequest.URL],
+            @"method" : task.originalRequest.HTTPMethod ?: @"GET",
+            @"status" : @(statusCode),
+            @"sent" : @(task.countOfBytesSent),
+            @"received" : @(task.countOfBytesReceived),
+            @"ms" : @(round(latency * 1000))
+        } mutableCopy];
+        if (error) fields[@"error"] = @(error.code);
+        [trace recordEvent:@"request" fields:fields];
+    }
+
     [cdtURLSessionTask processError:error onThread:self.thread];
     [cdtURLSessionTask processData:data];
     [cdtURLSessionTask completedThread:self.thread];
-    os_log_debug(CDTOSLog, "Signalling asyncTaskMonitor");
-    dispatch_semaphore_signal(g_asyncTaskMonitor);
+
+    NSArray *slot;
+    @synchronized(self.slotMap) {
+        slot = self.slotMap[[self keyForTask:task]];
+        [self.slotMap removeObjectForKey:[self keyForTask:task]];
+    }
+    if (slot) {
+        [self releaseSlotForHost:slot[0] priority:[slot[1] unsignedIntegerValue]];
+    }
 }
 
 - (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveResponse:(NSURLResponse *)response completionHandler:(void (^)(NSURLSessionResponseDisposition))completionHandler
 {
-    CDTURLSessionTask *cdtURLSessionTask = [self getSessionTaskForId:dataTask.taskIdentifier];
+    CDTURLSessionTask *cdtURLSessionTask = [self getSessionTaskForTask:dataTask];
     if (cdtURLSessionTask) {
         [cdtURLSessionTask processResponse:response onThread:self.thread];
     }
     completionHandler(NSURLSessionResponseAllow);
 }
 
-- (CDTURLSessionTask *)getSessionTaskForId:(NSUInteger)identifier
+/**
+ * Task identifiers are only unique within an NSURLSession, and with a connectionPool our tasks
+ * may come from several, so tasks are keyed by identity instead.
+ */
+- (NSValue *)keyForTask:(NSURLSessionTask *)task
 {
-    return [self.taskMap objectForKey:[NSNumber numberWithInteger:identifier]];
+    return [NSValue valueWithNonretainedObject:task];
+}
+
+- (CDTURLSessionTask *)getSessionTaskForTask:(NSURLSessionTask *)task
+{
+    return [self.taskMap objectForKey:[self keyForTask:task]];
 }
 
 - (void) disassociateTask:(nonnull NSURLSessionDataTask *)task
 {
-    [self.taskMap removeObjectForKey:[NSNumber numberWithInteger:task.taskIdentifier]];
+    [self.taskMap removeObjectForKey:[self keyForTask:task]];
     [task cancel];
 }
 
-- (void) waitForFreeSlot
+#pragma mark Scheduling
+
+- (CDTHTTPRequestScheduler *)scheduler
+{
+    return self.requestScheduler ?: [CDTHTTPRequestScheduler sharedScheduler];
+}
+
+- (void)resumeTask:(NSURLSessionDataTask *)task
+          priority:(CDTHTTPRequestPriority)priority
+           started:(void (^)(void))started
+{
+    NSString *host = [CDTHTTPRequestScheduler hostKeyForURL:task.originalRequest.URL];
+    os_log_debug(CDTOSLog, "Scheduling request to %{public}@", host);
+    // The blocks hold this session until they run, so the slots are always given back.
+    dispatch_block_t start = ^{
+        [self startTask:task host:host priority:priority started:started];
+    };
+    [self.scheduler scheduleRequestForHost:host
+                                     owner:self
+                                  priority:priority
+                                     start:^{
+                                         CDTHTTPConnectionBudget *budget = self.connectionBudget;
+                                         if (budget) {
+                                             [budget acquireSlotForOwner:self
+                                                                  weight:self.connectionWeight
+                                                                 handler:start];
+                                         } else {
+                                             start();
+                                         }
+                                     }];
+}
+
+- (void)startTask:(NSURLSessionDataTask *)task
+             host:(NSString *)host
+         priority:(CDTHTTPRequestPriority)priority
+          started:(void (^)(void))started
+{
+    // Checked and recorded together, so that a task cancelled meanwhile, whose completion only
+    // frees a slot it's recorded as holding, gives its slot back exactly once.
+    @synchronized(self.slotMap) {
+        if (task.state != NSURLSessionTaskStateSuspended) {
+            // Cancelled while it was queued.
+            [self releaseSlotForHost:host priority:priority];
+            return;
+        }
+        self.slotMap[[self keyForTask:task]] = @[ host, @(priority) ];
+    }
+    started();
+    [task resume];
+}
+
+- (void)releaseSlotForHost:(NSString *)host priority:(CDTHTTPRequestPriority)priority
 {
-    dispatch_semaphore_wait(g_asyncTaskMonitor, DISPATCH_TIME_FOREVER);
+    [self.connectionBudget releaseSlotForOwner:self];
+    [self.scheduler requestFinishedForHost:host owner:self priority:priority];
 }
 
 @end
@@ -0,0 +1,88 @@
+//
+//  CDTURLSessionPool.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Shares one NSURLSession per host between CDTURLSessions, so that their requests reuse the same
+ connections rather than each replication opening (and TLS-handshaking) its own.
+
+ NSURLSession pools connections per session and negotiates HTTP/2 by ALPN where the server
+ supports it, so with one session per host concurrent _bulk_get and attachment requests from
+ every replication to that host are multiplexed onto a single connection. Against an HTTP/1.1
+ server they share the session's keep-alive connections instead, at most
+ -maximumConnectionsForHost: of them.
+
+ Delegate callbacks for each task are forwarded to the CDTURLSession that created it. All methods
+ are thread-safe.
+ */
+@interface CDTURLSessionPool : NSObject <NSURLSessionDataDelegate>
+
+/** The pool used by replications. */
++ (instancetype)sharedPool;
+
+/**
+ Returns the configuration CDTURLSession uses for its NSURLSessions: a background configuration
+ (or a default one when stubbing HTTP in tests) with a 300s request timeout.
+ */
++ (NSURLSessionConfiguration *)sessionConfigurationWithIdentifier:(NSString *)identifier;
+
+/** Connections opened to a host whose limit hasn't been set with
+    -setMaximumConnections:forHost:. Defaults to 4. */
+@property (nonatomic) NSUInteger defaultMaximumConnectionsPerHost;
+
+/** Whether requests to HTTP/1.1 hosts are pipelined. Defaults to NO, as many proxies mishandle
+    pipelining; it makes no difference to HTTP/2 hosts. */
+@property (nonatomic) BOOL usesPipelining;
+
+/**
+ Limits the connections opened to host, i.e., the requests in flight to it at once over
+ HTTP/1.1. Takes effect for the host's session when it is next created, so set limits before
+ replicating.
+ */
+- (void)setMaximumConnections:(NSUInteger)maximum forHost:(NSString *)host;
+
+- (NSUInteger)maximumConnectionsForHost:(NSString *)host;
+
+/** The shared session for url's scheme, host and port, created if needed. */
+- (NSURLSession *)sessionForURL:(NSURL *)url;
+
+/**
+ Creates a data task in the shared session for the request's host, whose delegate callbacks are
+ sent to delegate until the task completes. The delegate is retained until then.
+ */
+- (NSURLSessionDataTask *)dataTaskWithRequest:(NSURLRequest *)request
+                                     delegate:(id<NSURLSessionDataDelegate>)delegate;
+
+/**
+ Opens a connection to url's host in its shared session, by a HEAD request of the server's root,
+ so that the DNS lookup and TCP and TLS handshakes are done before a replication's first request.
+ The connection is kept alive for the session's later requests, for as long as the server and
+ the system keep idle connections open.
+
+ completionHandler, if given, is called on an arbitrary queue once the request has finished;
+ with an error if no response was received.
+ */
+- (void)prewarmConnectionToURL:(NSURL *)url
+             completionHandler:(nullable void (^)(NSError *_Nullable error))completionHandler;
+
+/** Invalidates every shared session once its tasks have finished; later requests create new
+    ones. */
+- (void)finishTasksAndInvalidate;
+
+@end
+
+NS_ASSUME_NONNULL_END
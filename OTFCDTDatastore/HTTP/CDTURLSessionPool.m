@@ -0,0 +1,246 @@
+//
+//  CDTURLSessionPool.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTURLSessionPool.h"
+#import "CDTLogging.h"
+
+static const NSUInteger kDefaultMaximumConnectionsPerHost = 4;
+
+/** Timeout of the request opening a connection ahead of use; it's of no use once it's slow. */
+static const NSTimeInterval kPrewarmRequestTimeout = 30;
+
+/** Delegate of a pre-warming request, which only needs to know when it's done. */
+@interface CDTURLSessionPrewarmDelegate : NSObject <NSURLSessionDataDelegate>
+@property (nullable, nonatomic, copy) void (^completionHandler)(NSError *_Nullable error);
+@end
+
+@implementation CDTURLSessionPrewarmDelegate
+
+- (void)URLSession:(NSURLSession *)session
+                    task:(NSURLSessionTask *)task
+    didCompleteWithError:(NSError *)error
+{
+    if (self.completionHandler) {
+        self.completionHandler(error);
+    }
+}
+
+@end
+
+@implementation CDTURLSessionPool {
+    NSMutableDictionary<NSString *, NSURLSession *> *_sessions;  // by scheme://host:port
+    NSMutableDictionary<NSString *, NSNumber *> *_maximumConnections;  // by lowercase host
+    NSMapTable<NSURLSessionTask *, id<NSURLSessionDataDelegate>> *_delegates;
+}
+
++ (instancetype)sharedPool
+{
+    static CDTURLSessionPool *sharedPool;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedPool = [[CDTURLSessionPool alloc] init];
+    });
+    return sharedPool;
+}
+
++ (NSURLSessionConfiguration *)sessionConfigurationWithIdentifier:(NSString *)identifier
+{
+    NSURLSessionConfiguration *config;
+    if (getenv("CDT_TEST_ENABLE_OHHTTPSTUBS")) {
+        config = [NSURLSessionConfiguration defaultSessionConfiguration];
+    } else {
+        // Only compile this for iOS8.0 and above or OSX 10.10 and above
+#if (defined(__IPHONE_OS_VERSION_MAX_ALLOWED) && __IPHONE_OS_VERSION_MAX_ALLOWED >= 80000) \
+ || (defined(__MAC_OS_X_VERSION_MAX_ALLOWED) && __MAC_OS_X_VERSION_MAX_ALLOWED >= 101000)
+        // NSURLSessionConfiguration:backgroundSessionConfigurationWithIdentifier was introduced in iOS 8.0
+        // to replace backgroundSessionConfiguration which was deprecated in iOS 8.0, so use the new version if
+        // available.
+        if ([[NSURLSessionConfiguration class] respondsToSelector:@selector(backgroundSessionConfigurationWithIdentifier:)]) {
+            config = [NSURLSessionConfiguration backgroundSessionConfigurationWithIdentifier:identifier];
+        } else {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+            // since the method is only called on platforms where its replacement is missing
+            // we supress the warning
+            config = [NSURLSessionConfiguration backgroundSessionConfiguration:identifier];
+#pragma GCC pop
+        }
+#else
+        config = [NSURLSessionConfiguration backgroundSessionConfiguration:identifier];
+#endif
+    }
+    [config setTimeoutIntervalForRequest:300];
+    return config;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _defaultMaximumConnectionsPerHost = kDefaultMaximumConnectionsPerHost;
+        _sessions = [NSMutableDictionary dictionary];
+        _maximumConnections = [NSMutableDictionary dictionary];
+        // Tasks are removed when they complete; weak keys stop tasks which are never resumed
+        // from keeping their delegates alive.
+        _delegates = [NSMapTable weakToStrongObjectsMapTable];
+    }
+    return self;
+}
+
+- (void)setMaximumConnections:(NSUInteger)maximum forHost:(NSString *)host
+{
+    @synchronized(self) {
+        _maximumConnections[host.lowercaseString] = @(MAX(maximum, (NSUInteger)1));
+    }
+}
+
+- (NSUInteger)maximumConnectionsForHost:(NSString *)host
+{
+    @synchronized(self) {
+        NSNumber *maximum = _maximumConnections[host.lowercaseString];
+        return maximum ? maximum.unsignedIntegerValue : _defaultMaximumConnectionsPerHost;
+    }
+}
+
++ (NSString *)keyForURL:(NSURL *)url
+{
+    NSString *scheme = url.scheme.lowercaseString ?: @"";
+    NSNumber *port = url.port ?: ([scheme isEqualToString:@"https"] ? @443 : @80);
+    return [NSString stringWithFormat:@"%@://%@:%@", scheme, url.host.lowercaseString ?: @"", port];
+}
+
+- (NSURLSession *)sessionForURL:(NSURL *)url
+{
+    NSString *key = [[self class] keyForURL:url];
+    @synchronized(self) {
+        NSURLSession *session = _sessions[key];
+        if (!session) {
+            NSString *identifier =
+                [NSString stringWithFormat:@"com.cloudant.sync.sessionpool.%p.%@", self, key];
+            NSURLSessionConfiguration *config =
+                [[self class] sessionConfigurationWithIdentifier:identifier];
+            config.HTTPMaximumConnectionsPerHost = [self maximumConnectionsForHost:url.host ?: @""];
+            config.HTTPShouldUsePipelining = _usesPipelining;
+            session =
+                [NSURLSession sessionWithConfiguration:config delegate:self delegateQueue:nil];
+            _sessions[key] = session;
+            os_log_debug(CDTOSLog, "Created shared session for %{public}@", key);
+        }
+        return session;
+    }
+}
+
+- (NSURLSessionDataTask *)dataTaskWithRequest:(NSURLRequest *)request
+                                     delegate:(id<NSURLSessionDataDelegate>)delegate
+{
+    NSURLSessionDataTask *task = [[self sessionForURL:request.URL] dataTaskWithRequest:request];
+    @synchronized(self) {
+        [_delegates setObject:delegate forKey:task];
+    }
+    return task;
+}
+
+- (id<NSURLSessionDataDelegate>)delegateForTask:(NSURLSessionTask *)task
+{
+    @synchronized(self) {
+        return [_delegates objectForKey:task];
+    }
+}
+
+- (void)prewarmConnectionToURL:(NSURL *)url
+             completionHandler:(void (^)(NSError *_Nullable error))completionHandler
+{
+    NSURLComponents *components = [NSURLComponents componentsWithURL:url resolvingAgainstBaseURL:NO];
+    components.user = nil;
+    components.password = nil;
+    components.path = @"/";
+    components.query = nil;
+    components.fragment = nil;
+
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:components.URL];
+    request.HTTPMethod = @"HEAD";
+    request.HTTPShouldHandleCookies = NO;
+    request.timeoutInterval = kPrewarmRequestTimeout;
+
+    CDTURLSessionPrewarmDelegate *delegate = [[CDTURLSessionPrewarmDelegate alloc] init];
+    delegate.completionHandler = completionHandler;
+    os_log_debug(CDTOSLog, "Opening connection to %{public}@ ahead of use",
+                 [[self class] keyForURL:url]);
+    [[self dataTaskWithRequest:request delegate:delegate] resume];
+}
+
+- (void)finishTasksAndInvalidate
+{
+    NSArray<NSURLSession *> *sessions;
+    @synchronized(self) {
+        sessions = _sessions.allValues;
+        [_sessions removeAllObjects];
+    }
+    for (NSURLSession *session in sessions) {
+        [session finishTasksAndInvalidate];
+    }
+}
+
+#pragma mark - NSURLSessionDataDelegate
+
+- (void)URLSession:(NSURLSession *)session
+              dataTask:(NSURLSessionDataTask *)dataTask
+    didReceiveResponse:(NSURLResponse *)response
+     completionHandler:(void (^)(NSURLSessionResponseDisposition))completionHandler
+{
+    id<NSURLSessionDataDelegate> delegate = [self delegateForTask:dataTask];
+    if ([delegate respondsToSelector:_cmd]) {
+        [delegate URLSession:session
+                      dataTask:dataTask
+            didReceiveResponse:response
+             completionHandler:completionHandler];
+    } else {
+        completionHandler(NSURLSessionResponseAllow);
+    }
+}
+
+- (void)URLSession:(NSURLSession *)session
+          dataTask:(NSURLSessionDataTask *)dataTask
+    didReceiveData:(NSData *)data
+{
+    id<NSURLSessionDataDelegate> delegate = [self delegateForTask:dataTask];
+    if ([delegate respondsToSelector:_cmd]) {
+        [delegate URLSession:session dataTask:dataTask didReceiveData:data];
+    }
+}
+
+- (void)URLSession:(NSURLSession *)session
+                    task:(NSURLSessionTask *)task
+    didCompleteWithError:(NSError *)error
+{
+    id<NSURLSessionDataDelegate> delegate;
+    @synchronized(self) {
+        delegate = [_delegates objectForKey:task];
+        [_delegates removeObjectForKey:task];
+    }
+    if ([delegate respondsToSelector:_cmd]) {
+        [delegate URLSession:session task:task didCompleteWithError:error];
+    }
+}
+
+- (void)URLSession:(NSURLSession *)session didBecomeInvalidWithError:(NSError *)error
+{
+    @synchronized(self) {
+        for (NSString *key in _sessions.allKeys) {
+            if (_sessions[key] == session) [_sessions removeObjectForKey:key];
+        }
+    }
+}
+
+@end
@@ -16,6 +16,7 @@
 
 #import <Foundation/Foundation.h>
 #import "CDTMacros.h"
+#import "CDTHTTPRequestScheduler.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -25,12 +26,36 @@ NS_ASSUME_NONNULL_BEGIN
 - (void)receivedData:(nullable NSData *)data;
 - (void)receivedResponse:(nullable NSURLResponse *)response;
 - (void)requestDidError:(nullable NSError *)error;
+@optional
+/**
+ If the delegate implements this, the body of a successful (2xx) response is handed over in
+ chunks as it arrives rather than being buffered, and -receivedData: is later called with nil.
+ Error responses are still buffered so that response interceptors can inspect them.
+ */
+- (void)receivedPartialData:(NSData *)data;
+/**
+ Called before the first -receivedPartialData: of a streamed response, so the delegate can tell
+ e.g. a 206 Partial Content response from a 200 before the body arrives. -receivedResponse: is
+ only called once the whole response has arrived.
+ */
+- (void)receivedStreamingResponse:(NSHTTPURLResponse *)response;
 @end
 
 @interface CDTURLSessionTask : NSObject
 
 @property (nullable, nonatomic, weak) NSObject<CDTURLSessionTaskDelegate> *delegate;
 
+/*
+ * The request's place in the queue for its host. Defaults to CDTHTTPRequestPriorityDocuments.
+ * Set before calling -resume.
+ */
+@property (nonatomic) CDTHTTPRequestPriority priority;
+
+/*
+ * When the current attempt at the request was sent, after waiting for a free slot.
+ */
+@property (readonly) CFAbsoluteTime sentTime;
+
 /*
  * The current state of the task within the session.
  */
@@ -51,7 +76,8 @@ NS_ASSUME_NONNULL_BEGIN
                    interceptors:(nullable NSArray *)interceptors NS_DESIGNATED_INITIALIZER;
 
 /*
- * Resumes the execution of this task
+ * Resumes the execution of this task. The request is queued until the session has a slot for
+ * it; this doesn't block.
  */
 - (void)resume;
 
@@ -87,6 +113,14 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (void)processData:(nullable NSData*)data;
 
+/**
+ * Passes a chunk of the response body straight to the delegate on the given thread, if the
+ * delegate streams responses and the response was successful.
+ *
+ * @return YES if the chunk was passed on, NO if the caller should buffer it as usual.
+ */
+- (BOOL)processPartialData:(NSData *)data onThread:(NSThread *)thread;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -19,6 +19,8 @@
 #import "CDTHTTPInterceptor.h"
 #import "CDTLogging.h"
 #import "CDTURLSession.h"
+#import "CDTReplicationMetrics.h"
+#import "TDReplicationTrace.h"
 
 @interface CDTURLSessionTask ()
 
@@ -47,11 +49,15 @@
 
 @property (nonnull, nonatomic, strong) NSMutableDictionary *contextState;
 
+@property (readwrite) CFAbsoluteTime sentTime;
+
 
 #pragma mark properties for the current request
 @property (nullable, nonatomic, strong) NSHTTPURLResponse *response;
 @property (nullable, nonatomic, strong) NSError * requestError;
 @property (nullable, nonatomic, strong) NSData * responseData;
+// YES if the current response body is being passed to the delegate as it arrives
+@property (atomic) BOOL streamingResponse;
 
 @end
 
@@ -85,6 +91,7 @@ static const int responseInterceptorCancelledError = 2;
         _requestInterceptors = [self filterRequestInterceptors:interceptors];
         _responseInterceptors = [self filterResponseInterceptors:interceptors];
         _remainingRetries = 10;
+        _priority = CDTHTTPRequestPriorityDocuments;
         _contextState = [NSMutableDictionary dictionary];
     }
     return self;
@@ -101,10 +108,14 @@ static const int responseInterceptorCancelledError = 2;
             return;
         }
     }
-    os_log_debug(CDTOSLog, "Waiting on asyncTaskMonitor");
-    [self.session waitForFreeSlot];
-    os_log_debug(CDTOSLog, "Waiting on asyncTaskMonitor");
-    [self.inProgressTask resume];
+    [self.session resumeTask:self.inProgressTask
+                    priority:self.priority
+                     started:^{
+                         self.sentTime = CFAbsoluteTimeGetCurrent();
+                         CDTSignpostIntervalBegin(CDTSignpostIDForObject((__bridge const void *)self),
+                                                  "HTTPRequest", "%{public}@ %{public}@",
+                                                  self.request.HTTPMethod, self.request.URL.path);
+                     }];
 }
 - (void)cancel
 {
@@ -135,6 +146,7 @@ static const int responseInterceptorCancelledError = 2;
     self.response = nil;
     self.requestError = nil;
     self.responseData = nil;
+    self.streamingResponse = NO;
     __block CDTHTTPInterceptorContext *ctx =
         [[CDTHTTPInterceptorContext alloc] initWithRequest:[self.request mutableCopy]
                                                      state:self.contextState];
@@ -208,6 +220,28 @@ static const int responseInterceptorCancelledError = 2;
 - (void)processResponse:(NSURLResponse *)response onThread:(NSThread *)thread
 {
     self.response = (NSHTTPURLResponse*)response;
+    NSInteger statusCode = self.response.statusCode;
+    self.streamingResponse = statusCode >= 200 && statusCode < 300 &&
+                             [self.delegate respondsToSelector:@selector(receivedPartialData:)];
+    if (self.streamingResponse &&
+        [self.delegate respondsToSelector:@selector(receivedStreamingResponse:)]) {
+        [self.delegate performSelector:@selector(receivedStreamingResponse:)
+                              onThread:thread
+                            withObject:self.response
+                         waitUntilDone:NO];
+    }
+}
+
+- (BOOL)processPartialData:(NSData *)data onThread:(NSThread *)thread
+{
+    if (!self.streamingResponse) {
+        return NO;
+    }
+    [self.delegate performSelector:@selector(receivedPartialData:)
+                          onThread:thread
+                        withObject:[data copy]
+                     waitUntilDone:NO];
+    return YES;
 }
 
 - (void)processError:(NSError *)error onThread:(NSThread *)thread
@@ -216,6 +250,10 @@ static const int responseInterceptorCancelledError = 2;
 }
 
 - (void) completedThread:(NSThread *)thread {
+    // Each attempt at the request is its own interval, so retries show up separately.
+    CDTSignpostIntervalEnd(CDTSignpostIDForObject((__bridge const void *)self), "HTTPRequest",
+                           "status=%ld", (long)self.response.statusCode);
+
     // copy state from request interceptor context to response interceptor context
     __block CDTHTTPInterceptorContext *ctx =
     [[CDTHTTPInterceptorContext alloc] initWithRequest:[self.request mutableCopy]
@@ -240,12 +278,36 @@ static const int responseInterceptorCancelledError = 2;
         }
     }
     
-    if (ctx.shouldRetry && self.remainingRetries > 0) {
+    if (ctx.shouldRetry && self.streamingResponse) {
+        // The body has already been handed over, so there's nothing to replay it into.
+        os_log_debug(CDTOSLog, "Not retrying streamed response to %{public}@", self.request.URL);
+    }
+    if (ctx.shouldRetry && self.remainingRetries > 0 && !self.streamingResponse) {
         // retry
         self.remainingRetries--;
+        [self.session.metrics recordRetry];
+        [self.session.trace recordEvent:@"retry"
+                                 fields:@{
+                                     @"endpoint" :
+                                         [CDTReplicationMetrics endpointForURL:self.request.URL]
+                                 }];
         // makeRequest maintains the state across retries, even though it creates a fresh context
         self.inProgressTask = [self makeRequest];
-        [self.inProgressTask resume];
+        if (!self.inProgressTask) {
+            // An interceptor cancelled the retry, and has reported it.
+            self.finished = YES;
+            return;
+        }
+        // Queued like the first attempt; this attempt's slot is freed once this returns.
+        [self.session resumeTask:self.inProgressTask
+                        priority:self.priority
+                         started:^{
+                             self.sentTime = CFAbsoluteTimeGetCurrent();
+                             CDTSignpostIntervalBegin(
+                                 CDTSignpostIDForObject((__bridge const void *)self),
+                                 "HTTPRequest", "%{public}@ %{public}@ (retry)",
+                                 self.request.HTTPMethod, self.request.URL.path);
+                         }];
     } else {
         if( self.requestError){
             [self.delegate performSelector:@selector(requestDidError:)
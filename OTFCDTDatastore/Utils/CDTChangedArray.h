@@ -65,4 +65,11 @@
  */
 @property (nonatomic, getter=isChanged) bool changed;
 
+/**
+ Wrap an array, sharing rather than copying it; see CDTChangedDictionary's
+ `dictionaryWrappingContents:`. Neither `array` nor any container within it may be changed
+ after this is called.
+ */
++ (nonnull CDTChangedArray *)arrayWrappingContents:(nonnull NSArray *)array;
+
 @end
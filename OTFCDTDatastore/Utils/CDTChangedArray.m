@@ -20,11 +20,17 @@
 
 @interface CDTChangedArray ()
 
+/** The contents once this array has its own copy; nil while it shares them. */
 @property (nonatomic, strong) NSMutableArray *wrappedArray;
 
 @end
 
-@implementation CDTChangedArray
+@implementation CDTChangedArray {
+    // While the contents are shared: the array wrapped, and the wrappers made so far of the
+    // containers within it, by index.
+    NSArray *_sharedArray;
+    NSMutableDictionary<NSNumber *, id> *_childWrappers;
+}
 
 + (CDTChangedArray *)emptyArray
 {
@@ -51,42 +57,89 @@
 
 - (void)contentOfObjectDidChange:(NSObject *)object { self.changed = YES; }
 
+- (instancetype)initSharingArray:(NSArray *)array
+{
+    self = [self init];
+    if (self) {
+        _wrappedArray = nil;
+        _sharedArray = [array copy];
+    }
+    return self;
+}
+
++ (CDTChangedArray *)arrayWrappingContents:(NSArray *)array
+{
+    return [[CDTChangedArray alloc] initSharingArray:array];
+}
+
+/**
+ The contents, for changing. If they're still shared they're copied first, one level deep, with
+ the containers within wrapped rather than copied.
+ */
+- (NSMutableArray *)mutableContents
+{
+    if (!_wrappedArray) {
+        NSMutableArray *contents = [NSMutableArray arrayWithCapacity:_sharedArray.count];
+        [_sharedArray enumerateObjectsUsingBlock:^(id object, NSUInteger index, BOOL *stop) {
+            [contents addObject:self->_childWrappers[@(index)]
+                                    ?: CDTChangedWrapperForObject(object, self) ?: object];
+        }];
+        _wrappedArray = contents;
+        _sharedArray = nil;
+        _childWrappers = nil;
+    }
+    return _wrappedArray;
+}
+
 #pragma mark NSMutableArray primitives
 
 - (void)insertObject:(id)anObject atIndex:(NSUInteger)index
 {
     self.changed = YES;
-    [self.wrappedArray insertObject:anObject atIndex:index];
+    [self.mutableContents insertObject:anObject atIndex:index];
 }
 
 - (void)removeObjectAtIndex:(NSUInteger)index
 {
     self.changed = YES;
-    [self.wrappedArray removeObjectAtIndex:index];
+    [self.mutableContents removeObjectAtIndex:index];
 }
 
 - (void)addObject:(id)anObject
 {
     self.changed = YES;
-    [self.wrappedArray addObject:anObject];
+    [self.mutableContents addObject:anObject];
 }
 
 - (void)removeLastObject
 {
     self.changed = YES;
-    [self.wrappedArray removeLastObject];
+    [self.mutableContents removeLastObject];
 }
 
 - (void)replaceObjectAtIndex:(NSUInteger)index withObject:(id)anObject
 {
     self.changed = YES;
-    [self.wrappedArray replaceObjectAtIndex:index withObject:anObject];
+    [self.mutableContents replaceObjectAtIndex:index withObject:anObject];
 }
 
 #pragma mark NSArray primitives
 
-- (NSUInteger)count { return self.wrappedArray.count; }
+- (NSUInteger)count { return _wrappedArray ? _wrappedArray.count : _sharedArray.count; }
 
-- (id)objectAtIndex:(NSUInteger)index { return [self.wrappedArray objectAtIndex:index]; }
+- (id)objectAtIndex:(NSUInteger)index
+{
+    if (_wrappedArray) return [_wrappedArray objectAtIndex:index];
+
+    id wrapper = _childWrappers[@(index)];
+    if (wrapper) return wrapper;
+    id object = [_sharedArray objectAtIndex:index];
+    wrapper = CDTChangedWrapperForObject(object, self);
+    if (wrapper) {
+        if (!_childWrappers) _childWrappers = [NSMutableDictionary dictionary];
+        _childWrappers[@(index)] = wrapper;
+    }
+    return wrapper ?: object;
+}
 
 @end
@@ -64,4 +64,25 @@
  */
 + (CDTChangedDictionary *)dictionaryCopyingContents:(NSDictionary *)dictionary;
 
+/**
+ Wrap a nested JSON-compatible structure with Changed dictionary and array objects, copying
+ it only as it's changed.
+
+ Unlike `dictionaryCopyingContents:`, nothing is copied up front: the dictionary is shared,
+ and the containers within it are wrapped as they're read. A container is copied into a
+ mutable one only when it, or something within it, is first changed, so reading a large
+ structure allocates a wrapper for each container read and no more. Changes are still reported
+ up through the delegates as before.
+
+ Because it is shared, neither `dictionary` nor any container within it may be changed after
+ this is called; use it for structures freshly parsed from JSON.
+ */
++ (CDTChangedDictionary *)dictionaryWrappingContents:(NSDictionary *)dictionary;
+
 @end
+
+/**
+ Internal: returns a copy-on-write Changed wrapper of `object` with `parent` as its delegate,
+ if it's a dictionary or array not already wrapped; otherwise nil.
+ */
+id CDTChangedWrapperForObject(id object, NSObject<CDTChangedObserver> *parent);
@@ -20,11 +20,33 @@
 
 @interface CDTChangedDictionary ()
 
+/** The contents once this dictionary has its own copy; nil while it shares them. */
 @property (nonatomic, strong, readonly) NSMutableDictionary *wrappedDictionary;
 
 @end
 
-@implementation CDTChangedDictionary
+id CDTChangedWrapperForObject(id object, NSObject<CDTChangedObserver> *parent)
+{
+    if ([object isKindOfClass:[NSDictionary class]] &&
+        ![object isKindOfClass:[CDTChangedDictionary class]]) {
+        CDTChangedDictionary *wrapper = [CDTChangedDictionary dictionaryWrappingContents:object];
+        wrapper.delegate = parent;
+        return wrapper;
+    } else if ([object isKindOfClass:[NSArray class]] &&
+               ![object isKindOfClass:[CDTChangedArray class]]) {
+        CDTChangedArray *wrapper = [CDTChangedArray arrayWrappingContents:object];
+        wrapper.delegate = parent;
+        return wrapper;
+    }
+    return nil;
+}
+
+@implementation CDTChangedDictionary {
+    // While the contents are shared: the dictionary wrapped, and the wrappers made so far of the
+    // containers within it, returned again each time they're read.
+    NSDictionary *_sharedDictionary;
+    NSMutableDictionary *_childWrappers;
+}
 
 + (CDTChangedDictionary *)emptyDictionary
 {
@@ -51,18 +73,53 @@
 
 - (void)contentOfObjectDidChange:(NSObject *)object { self.changed = YES; }
 
+- (instancetype)initSharingDictionary:(NSDictionary *)dictionary
+{
+    self = [self init];
+    if (self) {
+        _wrappedDictionary = nil;
+        _sharedDictionary = [dictionary copy];
+    }
+    return self;
+}
+
++ (CDTChangedDictionary *)dictionaryWrappingContents:(NSDictionary *)dictionary
+{
+    return [[CDTChangedDictionary alloc] initSharingDictionary:dictionary];
+}
+
+/**
+ The contents, for changing. If they're still shared they're copied first, one level deep: the
+ containers within are wrapped rather than copied, so only this dictionary's path is copied.
+ */
+- (NSMutableDictionary *)mutableContents
+{
+    if (!_wrappedDictionary) {
+        NSMutableDictionary *contents =
+            [NSMutableDictionary dictionaryWithCapacity:_sharedDictionary.count];
+        [_sharedDictionary enumerateKeysAndObjectsUsingBlock:^(id key, id object, BOOL *stop) {
+            contents[key] = self->_childWrappers[key] ?: CDTChangedWrapperForObject(object, self)
+                                                          ?: object;
+        }];
+        _wrappedDictionary = contents;
+        _sharedDictionary = nil;
+        _childWrappers = nil;
+    }
+    return _wrappedDictionary;
+}
+
 #pragma mark NSMutableDictionary primitive methods
 
 - (void)setObject:(id)anObject forKey:(id<NSCopying>)aKey
 {
     self.changed = YES;
-    [self.wrappedDictionary setObject:anObject forKey:aKey];
+    [self.mutableContents setObject:anObject forKey:aKey];
 }
 
 - (void)removeObjectForKey:(id)aKey
 {
     self.changed = YES;
-    [self.wrappedDictionary removeObjectForKey:aKey];
+    [self.mutableContents removeObjectForKey:aKey];
 }
 
 #pragma mark NSDictionary primitive methods
@@ -79,11 +136,28 @@
     return self;
 }
 
-- (NSUInteger)count { return self.wrappedDictionary.count; }
+- (NSUInteger)count { return _wrappedDictionary ? _wrappedDictionary.count : _sharedDictionary.count; }
 
-- (id)objectForKey:(id)aKey { return [self.wrappedDictionary objectForKey:aKey]; }
+- (id)objectForKey:(id)aKey
+{
+    if (_wrappedDictionary) return [_wrappedDictionary objectForKey:aKey];
+
+    id wrapper = [_childWrappers objectForKey:aKey];
+    if (wrapper) return wrapper;
+    id object = [_sharedDictionary objectForKey:aKey];
+    wrapper = CDTChangedWrapperForObject(object, self);
+    if (wrapper) {
+        if (!_childWrappers) _childWrappers = [NSMutableDictionary dictionary];
+        [_childWrappers setObject:wrapper forKey:aKey];
+    }
+    return wrapper ?: object;
+}
 
-- (NSEnumerator *)keyEnumerator { return [self.wrappedDictionary keyEnumerator]; }
+- (NSEnumerator *)keyEnumerator
+{
+    return _wrappedDictionary ? [_wrappedDictionary keyEnumerator]
+                              : [_sharedDictionary keyEnumerator];
+}
 
 + (CDTChangedDictionary *)dictionaryCopyingContents:(NSDictionary *)dictionary
 {
@@ -16,6 +16,8 @@
 #import <Foundation/Foundation.h>
 #import "CDTDatastore.h"
 #import "CDTQIndexManager.h"
+#import "CDTQIndex.h"
+#import "CDTQLiveQuery.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -118,9 +120,12 @@ NS_ASSUME_NONNULL_BEGIN
 /**
  Create a new index based on an index type over a set of fields.
 
- Index type can be either CDTQIndexTypeJSON or CDTQIndexTypeText.  A CDTQIndexTypeText index
- provides
- the ability to perform text searches.
+ Index type can be CDTQIndexTypeJSON, CDTQIndexTypeMultiKey, CDTQIndexTypeText or
+ CDTQIndexTypeGeo.  A CDTQIndexTypeMultiKey index can index several array fields, and is needed
+ for $elemMatch.  A CDTQIndexTypeText index provides the ability to perform text searches.  A
+ CDTQIndexTypeGeo index, over a latitude and a longitude field in that order, is needed for
+ $geoWithin, as in { "$geoWithin" : { "$box" : [ [ 51.2, -0.5 ], [ 51.7, 0.3 ] ] } } or
+ { "$geoWithin" : { "$center" : [ [ 51.5, -0.1 ], 2000 ] } }, a radius in metres.
  */
 - (nullable NSString *)ensureIndexed:(NSArray<NSString *> *)fieldNames
                             withName:(NSString *)indexName
@@ -151,6 +156,57 @@ NS_ASSUME_NONNULL_BEGIN
                               ofType:(CDTQIndexType)type
                             settings:(NSDictionary *)indexSettings;
 
+/**
+ Create a partial index, which only indexes the documents matching `selector`.
+
+ A partial index is smaller and quicker to update than one of every document. It's only used by
+ queries whose selectors include all of `selector`'s clauses, as other queries might match
+ documents which aren't in it. For example, an index created with the selector
+ `@{ @"status" : @"active" }` can be used for
+ `@{ @"status" : @"active", @"age" : @{ @"$gt" : @30 } }`, but not for
+ `@{ @"age" : @{ @"$gt" : @30 } }`.
+
+ Text indexes can't be partial.
+ */
+- (nullable NSString *)ensureIndexed:(NSArray<NSString *> *)fieldNames
+                            withName:(NSString *)indexName
+                              ofType:(CDTQIndexType)type
+                            settings:(nullable NSDictionary *)indexSettings
+                            selector:(nullable NSDictionary *)selector;
+
+/**
+ Create a JSON index declaring the types of some of its fields, as CDTQFieldType numbers keyed
+ by field name. Typed fields are stored in columns of the matching type, and the index gets an
+ SQLite index leading with its first field, so range queries on that field are quick.
+
+ For example:
+
+     [ds ensureIndexed:@[ @"born", @"name" ]
+              withName:@"by_birth"
+            fieldTypes:@{ @"born" : @(CDTQFieldTypeDate) }];
+
+ A value of another type is indexed as if the field were missing, so the index won't find
+ documents by it; queries comparing a typed field with a value of another type don't use the
+ index.
+ */
+- (nullable NSString *)ensureIndexed:(NSArray<NSString *> *)fieldNames
+                            withName:(NSString *)indexName
+                          fieldTypes:(NSDictionary<NSString *, NSNumber *> *)fieldTypes;
+
+/**
+ Create several indexes at once, filling the new ones with a single pass over the datastore.
+ This is much quicker than creating them one at a time on a large datastore.
+
+ For example:
+
+     CDTQIndex *byName = [CDTQIndex index:@"by_name" withFields:@[ @"name" ]];
+     CDTQIndex *byAge = [CDTQIndex index:@"by_age" withFields:@[ @"age" ]];
+     [ds ensureIndexes:@[ byName, byAge ]];
+
+ @return the names of the indexes, or nil if any couldn't be created.
+ */
+- (nullable NSArray<NSString *> *)ensureIndexes:(NSArray<CDTQIndex *> *)indexes;
+
 /**
  Delete an index.
  */
@@ -166,6 +222,46 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (BOOL)updateAllIndexes;
 
+/**
+ Merge each text index into a single segment, so searches are as quick as they can be.
+
+ Updating a text index also merges part of it at a time, so it doesn't fragment as
+ documents change; this finishes the job at once. It's slow for a large index, so is best
+ called once a big change, such as a first replication, has been indexed.
+ */
+- (BOOL)optimizeTextIndexes;
+
+/**
+ How far each index is behind the datastore, as the number of sequences it has yet to
+ index, keyed by index name. An index is brought up to date (and its lag falls to 0) by the
+ next query which uses it, or by -updateAllIndexes.
+ */
+- (NSDictionary<NSString *, NSNumber *> *)indexSequenceLag;
+
+/**
+ Keep indexes up to date in the background.
+
+ When enabled, indexes are updated on a background queue shortly after the datastore
+ changes, so the cost of indexing a large replication isn't paid by the first query
+ afterwards. Queries still bring indexes fully up to date before they run, but will
+ usually find little left to do.
+
+ Disabled by default.
+ */
+@property (nonatomic, getter = isBackgroundIndexingEnabled) BOOL backgroundIndexingEnabled;
+
+/**
+ Cache the results of queries until the datastore next changes.
+
+ Plans of queries are always cached, so running a query again needn't validate and translate
+ it. When this is enabled, running a query again, with the same skip and limit, before anything
+ is written to the datastore returns the same result set without running any SQL. Pages after a
+ cursor aren't cached.
+
+ Disabled by default.
+ */
+@property (nonatomic, getter = isQueryResultCachingEnabled) BOOL queryResultCachingEnabled;
+
 /**
  Find documents matching a query.
  
@@ -184,6 +280,15 @@ NS_ASSUME_NONNULL_BEGIN
  See https://github.com/cloudant/CDTDatastore/blob/master/doc/query.md 
  for details of the query syntax and option meanings.
  
+ When a single index satisfies the query and sort and contains every one of the `fields`, the
+ results are read from the index without loading any documents. This needs every value the
+ index holds to be a string, number or null; once an array, object or boolean value has been
+ indexed the documents are always loaded. Results read from an index have no sequence number.
+
+ Sorting is done by an index containing every sort field. Without one, a query with a `limit`
+ loads each candidate document and keeps just the first `skip + limit` of them, so memory
+ doesn't grow with the number of matches; with no `limit`, the query fails.
+
  Failures during query (e.g., invalid query) are logged rather than
  error being returned.
  
@@ -195,6 +300,130 @@ NS_ASSUME_NONNULL_BEGIN
                           fields:(nullable NSArray *)fields
                             sort:(nullable NSArray *)sortDocument;
 
+/**
+ Find a page of documents matching a query, starting after a cursor.
+
+ Pass a nil cursor for the first page; each result set's `nextPageCursor` fetches the page
+ after it, and is nil once there are no more results. Each page costs about the same however
+ deep into the results it is, unlike paging with `skip`.
+
+ This requires a single index to contain every field used in both the query and the sort.
+ `nil` is returned for other queries.
+
+ @return Set of documents, or `nil` if there was an error.
+ */
+- (nullable CDTQResultSet *)find:(NSDictionary *)query
+                           limit:(NSUInteger)limit
+                          fields:(nullable NSArray *)fields
+                            sort:(nullable NSArray *)sortDocument
+                           after:(nullable CDTQQueryCursor *)cursor;
+
+/**
+ Find documents matching a query, stopping once `handle` is cancelled or runs out of time.
+
+ Use a new handle for each query, and cancel it when the results are no longer wanted, such as
+ when the text being searched for changes. A cancelled query returns `nil` and gives up the
+ index database promptly; enumerating its results stops once the handle is cancelled.
+
+ @return Set of documents, or `nil` if there was an error or the query was cancelled.
+ */
+- (nullable CDTQResultSet *)find:(NSDictionary *)query
+                            skip:(NSUInteger)skip
+                           limit:(NSUInteger)limit
+                          fields:(nullable NSArray *)fields
+                            sort:(nullable NSArray *)sortDocument
+                          handle:(nullable CDTQueryHandle *)handle;
+
+/**
+ Count the documents matching a query.
+
+ When indexes cover the whole query this is done in SQL, without loading any documents or
+ their IDs.
+
+ @return The number of matching documents, or `NSNotFound` if there was an error.
+ */
+- (NSUInteger)count:(NSDictionary *)query;
+
+/**
+ Returns those of `documentIds` whose documents match `selector`.
+
+ When indexes cover the selector this is done in SQL, without loading any documents.
+
+ @return The matching IDs, or nil if there was an error.
+ */
+- (nullable NSSet<NSString *> *)documentIdsMatching:(NSDictionary *)selector
+                                              among:(NSArray<NSString *> *)documentIds;
+
+/**
+ Calculate `$sum`, `$min`, `$max` or `$count` aggregates of indexed fields over the documents
+ matching a query, optionally grouped by another indexed field.
+
+ See CDTQIndexManager -aggregate:aggregates:groupBy: for details.
+
+ @return An array of result dictionaries, one per group, or `nil` if there was an error.
+ */
+- (nullable NSArray<NSDictionary *> *)aggregate:(NSDictionary *)query
+                                     aggregates:(NSDictionary<NSString *, NSDictionary *> *)aggregates
+                                        groupBy:(nullable NSString *)groupField;
+
+/**
+ Describe how a query would be executed, without running it.
+
+ See -explain:sort: for more details.
+ */
+- (nullable NSDictionary *)explain:(NSDictionary *)query;
+
+/**
+ Describe how a query with the given sort would be executed, without running it.
+
+ The plan shows which index each part of the selector uses, the SQL run against it, the
+ estimated number of matching rows where index statistics are available, and whether
+ documents will have to be loaded and matched by hand because no index covers part of the
+ selector. Indexes are brought up to date first, as for -find:.
+
+ The structure of the plan is meant to help diagnose slow queries and may change between
+ releases, so shouldn't be relied upon by application logic.
+
+ @return The plan, or `nil` if the query or sort document is invalid.
+ */
+- (nullable NSDictionary *)explain:(NSDictionary *)query sort:(nullable NSArray *)sortDocument;
+
+/**
+ Keep the results of a query up to date as documents change.
+
+ The handler is called on `queue`, first with the query's results, then each time documents
+ are written with how the results changed: which were deleted, inserted and updated, ordered
+ by the sort document. Only the changed documents are loaded and matched, so this is much
+ cheaper than running the query again after each change.
+
+     self.liveQuery = [ds liveQuery:@{ @"pet" : @"cat" }
+                               sort:@[ @{ @"name" : @"asc" } ]
+                              queue:nil
+                            handler:^(CDTQLiveQueryChanges *changes) {
+                                // Apply changes.deletedIndexes, insertedIndexes
+                                // and updatedIndexes to a table view.
+                            }];
+
+ The live query runs until it's stopped or deallocated.
+
+ @param queue the queue to call the handler on; the main queue if nil.
+ @return The live query, or `nil` if the query or sort document is invalid, or the query is a
+         text search.
+ */
+- (nullable CDTQLiveQuery *)liveQuery:(NSDictionary *)query
+                                 sort:(nullable NSArray *)sortDocument
+                                queue:(nullable dispatch_queue_t)queue
+                              handler:(CDTQLiveQueryHandler)handler;
+
+/**
+ Re-encrypts the index database the query methods use, if indexes have ever been created, with
+ the key returned by the provider. It's called by
+ -[CDTDatastore rekeyWithEncryptionKeyProvider:progress:error:], which changes the key of the
+ whole datastore and should be used instead.
+ */
+- (BOOL)rekeyIndexesWithEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
+                                        error:(NSError *__autoreleasing *)error;
+
 @end
 
 NS_ASSUME_NONNULL_END
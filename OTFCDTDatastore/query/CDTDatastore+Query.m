@@ -15,6 +15,8 @@
 //  and limitations under the License.
 
 #import "CDTDatastore+Query.h"
+#import "CDTDatastore+Internal.h"
+#import "CDTQQueryCache.h"
 #import <objc/runtime.h>
 
 @implementation CDTDatastore (Query)
@@ -81,6 +83,19 @@
                                   settings:indexSettings];
 }
 
+- (NSString *)ensureIndexed:(NSArray<NSString *> *)fieldNames
+                   withName:(NSString *)indexName
+                     ofType:(CDTQIndexType)type
+                   settings:(NSDictionary *)indexSettings
+                   selector:(NSDictionary *)selector
+{
+    return [self.CDTQManager ensureIndexed:fieldNames
+                                  withName:indexName
+                                    ofType:type
+                                  settings:indexSettings
+                                  selector:selector];
+}
+
 - (NSString *)ensureIndexed:(NSArray<NSString *> *)fieldNames
                    withName:(NSString *)indexName
                      ofType:(CDTQIndexType)type
@@ -88,6 +103,18 @@
     return [self.CDTQManager ensureIndexed:fieldNames withName:indexName ofType:type];
 }
 
+- (NSString *)ensureIndexed:(NSArray<NSString *> *)fieldNames
+                   withName:(NSString *)indexName
+                 fieldTypes:(NSDictionary<NSString *, NSNumber *> *)fieldTypes
+{
+    return [self.CDTQManager ensureIndexed:fieldNames withName:indexName fieldTypes:fieldTypes];
+}
+
+- (NSArray<NSString *> *)ensureIndexes:(NSArray<CDTQIndex *> *)indexes
+{
+    return [self.CDTQManager ensureIndexes:indexes];
+}
+
 - (CDTQResultSet *)find:(NSDictionary *)query
 {
     return [self.CDTQManager find:query];
@@ -102,6 +129,68 @@
     return [self.CDTQManager find:query skip:skip limit:limit fields:fields sort:sortDocument];
 }
 
+- (CDTQResultSet *)find:(NSDictionary *)query
+                  limit:(NSUInteger)limit
+                 fields:(NSArray *)fields
+                   sort:(NSArray *)sortDocument
+                  after:(CDTQQueryCursor *)cursor
+{
+    return [self.CDTQManager find:query limit:limit fields:fields sort:sortDocument after:cursor];
+}
+
+- (CDTQResultSet *)find:(NSDictionary *)query
+                   skip:(NSUInteger)skip
+                  limit:(NSUInteger)limit
+                 fields:(NSArray *)fields
+                   sort:(NSArray *)sortDocument
+                 handle:(CDTQueryHandle *)handle
+{
+    return [self.CDTQManager find:query
+                             skip:skip
+                            limit:limit
+                           fields:fields
+                             sort:sortDocument
+                            after:nil
+                           handle:handle];
+}
+
+- (NSUInteger)count:(NSDictionary *)query
+{
+    CDTQIndexManager *manager = self.CDTQManager;
+    return manager ? [manager count:query] : NSNotFound;
+}
+
+- (NSSet<NSString *> *)documentIdsMatching:(NSDictionary *)selector
+                                     among:(NSArray<NSString *> *)documentIds
+{
+    return [self.CDTQManager documentIdsMatching:selector among:documentIds];
+}
+
+- (NSArray<NSDictionary *> *)aggregate:(NSDictionary *)query
+                            aggregates:(NSDictionary<NSString *, NSDictionary *> *)aggregates
+                               groupBy:(NSString *)groupField
+{
+    return [self.CDTQManager aggregate:query aggregates:aggregates groupBy:groupField];
+}
+
+- (NSDictionary *)explain:(NSDictionary *)query
+{
+    return [self.CDTQManager explain:query];
+}
+
+- (NSDictionary *)explain:(NSDictionary *)query sort:(NSArray *)sortDocument
+{
+    return [self.CDTQManager explain:query sort:sortDocument];
+}
+
+- (CDTQLiveQuery *)liveQuery:(NSDictionary *)query
+                        sort:(NSArray *)sortDocument
+                       queue:(dispatch_queue_t)queue
+                     handler:(CDTQLiveQueryHandler)handler
+{
+    return [self.CDTQManager liveQuery:query sort:sortDocument queue:queue handler:handler];
+}
+
 - (BOOL)deleteIndexNamed:(NSString *)indexName
 {
     return [self.CDTQManager deleteIndexNamed:indexName];
@@ -112,4 +201,68 @@
     return [self.CDTQManager updateAllIndexes];
 }
 
+- (BOOL)optimizeTextIndexes
+{
+    return [self.CDTQManager optimizeTextIndexes];
+}
+
+- (NSDictionary<NSString *, NSNumber *> *)indexSequenceLag
+{
+    return [self.CDTQManager indexSequenceLag];
+}
+
+- (BOOL)isBackgroundIndexingEnabled
+{
+    return [self.CDTQManager isBackgroundIndexingEnabled];
+}
+
+- (void)setBackgroundIndexingEnabled:(BOOL)enabled
+{
+    [self.CDTQManager setBackgroundIndexingEnabled:enabled];
+}
+
+- (BOOL)isQueryResultCachingEnabled
+{
+    return self.CDTQManager.queryCache.resultCachingEnabled;
+}
+
+- (void)setQueryResultCachingEnabled:(BOOL)enabled
+{
+    self.CDTQManager.queryCache.resultCachingEnabled = enabled;
+}
+
+- (BOOL)rekeyIndexesWithEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
+                                        error:(NSError *__autoreleasing *)error
+{
+    if (![CDTQIndexManager hasIndexDatabaseForDatastore:self]) {
+        return YES;
+    }
+
+    CDTQIndexManager *manager = self.CDTQManager;
+    if (!manager) {
+        if (error) {
+            NSDictionary *userInfo = @{
+                NSLocalizedDescriptionKey :
+                    NSLocalizedString(@"Problem opening or creating database.", nil)
+            };
+            *error = [NSError errorWithDomain:CDTQIndexManagerErrorDomain
+                                         code:CDTQIndexErrorSqlError
+                                     userInfo:userInfo];
+        }
+        return NO;
+    }
+    return [manager rekeyWithEncryptionKeyProvider:provider error:error];
+}
+
+@end
+
+@implementation CDTDatastore (Query_Internal)
+
+- (void)openIndexesForPurge
+{
+    if ([CDTQIndexManager hasIndexDatabaseForDatastore:self]) {
+        [self CDTQManager];
+    }
+}
+
 @end
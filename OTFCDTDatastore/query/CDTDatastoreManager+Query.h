@@ -0,0 +1,73 @@
+//
+//  CDTDatastoreManager+Query.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "CDTDatastoreManager.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class CDTDocumentRevision;
+
+/** A document found by a query across datastores, and the datastore it was found in. */
+@interface CDTQFederatedResult : NSObject
+
+@property (nonatomic, strong, readonly) NSString *datastoreName;
+
+@property (nonatomic, strong, readonly) CDTDocumentRevision *revision;
+
+- (instancetype)initWithDatastoreName:(NSString *)datastoreName
+                             revision:(CDTDocumentRevision *)revision NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+/**
+ This category adds queries across several of a manager's datastores.
+ */
+@interface CDTDatastoreManager (Query)
+
+/**
+ Find documents matching a query in each of the named datastores, as if they were one.
+
+ The query is run against every datastore at once, each on its own index database connection,
+ as -[CDTDatastore find:skip:limit:fields:sort:] would run it, asking each for no more than
+ `skip + limit` results. Their results are then merged in the order of `sortDocument`, then by
+ document ID, then by the order of `names`, and `skip` and `limit` applied to the merged
+ results. Without a sort document, the results are those of each datastore in turn, in the
+ order of `names`.
+
+ The datastores need the indexes the query and sort use: each datastore's query is run
+ against its own indexes, and fails as it would run alone. When `fields` is given, the top
+ level field of each sort field is added to it, as the merge needs their values.
+
+ Unlike a CDTQResultSet, the results are loaded before this returns, so a query without a
+ `limit` holds all its documents in memory.
+
+ Failures during query (e.g., invalid query, or a datastore which can't be opened) are logged
+ rather than error being returned.
+
+ @param names the datastores to query, or nil for all of this manager's datastores
+ @return The merged results, or `nil` if the query failed in any of the datastores.
+ */
+- (nullable NSArray<CDTQFederatedResult *> *)find:(NSDictionary *)query
+                                inDatastoresNamed:(nullable NSArray<NSString *> *)names
+                                             skip:(NSUInteger)skip
+                                            limit:(NSUInteger)limit
+                                           fields:(nullable NSArray *)fields
+                                             sort:(nullable NSArray *)sortDocument;
+
+@end
+
+NS_ASSUME_NONNULL_END
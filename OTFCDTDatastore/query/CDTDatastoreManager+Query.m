@@ -0,0 +1,250 @@
+//
+//  CDTDatastoreManager+Query.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTDatastoreManager+Query.h"
+
+#import "CDTDatastore+Query.h"
+#import "CDTDocumentRevision.h"
+#import "CDTLogging.h"
+#import "CDTQResultSet.h"
+#import "CDTQValueExtractor.h"
+#import "CollectionUtils.h"
+
+@implementation CDTQFederatedResult
+
+- (instancetype)initWithDatastoreName:(NSString *)datastoreName
+                             revision:(CDTDocumentRevision *)revision
+{
+    self = [super init];
+    if (self) {
+        _datastoreName = datastoreName;
+        _revision = revision;
+    }
+    return self;
+}
+
+@end
+
+/** The next of one datastore's sorted results still to be merged. */
+@interface CDTQMergeCursor : NSObject
+
+@property (nonatomic) NSUInteger source;
+@property (nonatomic, strong) NSArray<CDTDocumentRevision *> *revisions;
+@property (nonatomic) NSUInteger position;
+@property (nonatomic, strong) NSArray *values;
+
+@end
+
+@implementation CDTQMergeCursor
+@end
+
+// The heap of the merge keeps each cursor's head sorting before, or level with, its children's.
+static void CDTQMergeSiftDown(NSMutableArray *heap, NSUInteger i, NSComparator order)
+{
+    NSUInteger n = heap.count;
+    while (YES) {
+        NSUInteger first = i;
+        for (NSUInteger child = 2 * i + 1; child <= 2 * i + 2 && child < n; child++) {
+            if (order(heap[child], heap[first]) == NSOrderedAscending) {
+                first = child;
+            }
+        }
+        if (first == i) {
+            return;
+        }
+        [heap exchangeObjectAtIndex:i withObjectAtIndex:first];
+        i = first;
+    }
+}
+
+@implementation CDTDatastoreManager (Query)
+
+- (NSArray<CDTQFederatedResult *> *)find:(NSDictionary *)query
+                       inDatastoresNamed:(NSArray<NSString *> *)names
+                                    skip:(NSUInteger)skip
+                                   limit:(NSUInteger)limit
+                                  fields:(NSArray *)fields
+                                    sort:(NSArray *)sortDocument
+{
+    names = names ?: [self allDatastores];
+
+    NSMutableArray<NSArray *> *sortPaths = [NSMutableArray array];
+    NSMutableArray<NSNumber *> *descending = [NSMutableArray array];
+    for (id orderClause in sortDocument) {
+        NSDictionary *clause = $castIf(NSDictionary, orderClause);
+        NSString *fieldName = clause.count == 1 ? $castIf(NSString, clause.allKeys[0]) : nil;
+        if (!fieldName) {
+            os_log_error(CDTOSLog, "Invalid sort document for federated query: %{public}@",
+                         sortDocument);
+            return nil;
+        }
+        [sortPaths addObject:[fieldName componentsSeparatedByString:@"."]];
+        NSString *direction = $castIf(NSString, clause[fieldName]);
+        [descending addObject:@([[direction lowercaseString] isEqualToString:@"desc"])];
+    }
+
+    if (fields && sortPaths.count > 0) {
+        NSMutableArray *withSortFields = [fields mutableCopy];
+        for (NSArray *path in sortPaths) {
+            NSString *topLevel = path[0];
+            if (![topLevel isEqualToString:@"_id"] && ![topLevel isEqualToString:@"_rev"] &&
+                ![withSortFields containsObject:topLevel]) {
+                [withSortFields addObject:topLevel];
+            }
+        }
+        fields = withSortFields;
+    }
+
+    // Datastores are opened one at a time, as opening takes the manager's locks anyway.
+    NSMutableArray<CDTDatastore *> *datastores = [NSMutableArray arrayWithCapacity:names.count];
+    for (NSString *name in names) {
+        NSError *error;
+        CDTDatastore *datastore = [self datastoreNamed:name error:&error];
+        if (!datastore) {
+            os_log_error(CDTOSLog, "Federated query couldn't open datastore %{public}@: %{public}@",
+                         name, error);
+            return nil;
+        }
+        [datastores addObject:datastore];
+    }
+
+    // Each datastore is queried on its own index database connection, so they run concurrently;
+    // any of them might hold the first results, so each is asked for the first skip + limit.
+    NSUInteger perDatastoreLimit = limit > 0 ? skip + limit : 0;
+    NSMutableArray *perDatastore = [NSMutableArray arrayWithCapacity:datastores.count];
+    for (NSUInteger i = 0; i < datastores.count; i++) {
+        [perDatastore addObject:[NSNull null]];
+    }
+    dispatch_apply(datastores.count, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0),
+                   ^(size_t i) {
+        CDTQResultSet *resultSet = [datastores[i] find:query
+                                                  skip:0
+                                                 limit:perDatastoreLimit
+                                                fields:fields
+                                                  sort:sortDocument];
+        if (!resultSet) {
+            return;
+        }
+        NSMutableArray *revisions = [NSMutableArray array];
+        [resultSet enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger idx,
+                                                BOOL *stop) {
+            [revisions addObject:rev];
+        }];
+        @synchronized(perDatastore) {
+            perDatastore[i] = revisions;
+        }
+    });
+
+    for (NSUInteger i = 0; i < perDatastore.count; i++) {
+        if (![perDatastore[i] isKindOfClass:[NSArray class]]) {
+            os_log_error(CDTOSLog, "Federated query failed in datastore %{public}@", names[i]);
+            return nil;
+        }
+    }
+
+    NSUInteger wanted = limit > 0 ? skip + limit : NSUIntegerMax;
+    NSMutableArray<CDTQFederatedResult *> *results = [NSMutableArray array];
+    NSUInteger seen = 0;
+
+    if (sortPaths.count == 0) {
+        for (NSUInteger i = 0; i < perDatastore.count && seen < wanted; i++) {
+            for (CDTDocumentRevision *rev in perDatastore[i]) {
+                if (seen++ >= skip) {
+                    [results addObject:[[CDTQFederatedResult alloc] initWithDatastoreName:names[i]
+                                                                                 revision:rev]];
+                }
+                if (seen >= wanted) {
+                    break;
+                }
+            }
+        }
+        return results;
+    }
+
+    // A k-way merge: a heap of each datastore's next result, ordered as the query's sort, then
+    // by ID, then by which datastore it came from so the order is total.
+    NSComparator order = ^NSComparisonResult(CDTQMergeCursor *a, CDTQMergeCursor *b) {
+        for (NSUInteger i = 0; i < sortPaths.count; i++) {
+            NSComparisonResult result =
+                [CDTQValueExtractor compareValue:a.values[i] toValue:b.values[i]];
+            if (result != NSOrderedSame) {
+                return [descending[i] boolValue] ? (NSComparisonResult)-result : result;
+            }
+        }
+        NSComparisonResult result = [a.revisions[a.position].docId
+            compare:b.revisions[b.position].docId
+            options:NSLiteralSearch];
+        if (result != NSOrderedSame) {
+            return result;
+        }
+        return a.source < b.source ? NSOrderedAscending : NSOrderedDescending;
+    };
+
+    NSMutableArray<CDTQMergeCursor *> *heap = [NSMutableArray array];
+    for (NSUInteger i = 0; i < perDatastore.count; i++) {
+        NSArray *revisions = perDatastore[i];
+        if (revisions.count > 0) {
+            CDTQMergeCursor *cursor = [[CDTQMergeCursor alloc] init];
+            cursor.source = i;
+            cursor.revisions = revisions;
+            cursor.values = [CDTDatastoreManager sortValuesAtPaths:sortPaths
+                                                        ofRevision:revisions[0]];
+            [heap addObject:cursor];
+        }
+    }
+    for (NSUInteger i = heap.count / 2; i-- > 0;) {
+        CDTQMergeSiftDown(heap, i, order);
+    }
+
+    while (heap.count > 0 && seen < wanted) {
+        CDTQMergeCursor *first = heap[0];
+        if (seen++ >= skip) {
+            [results addObject:[[CDTQFederatedResult alloc]
+                                   initWithDatastoreName:names[first.source]
+                                                revision:first.revisions[first.position]]];
+        }
+
+        first.position++;
+        if (first.position < first.revisions.count) {
+            first.values = [CDTDatastoreManager sortValuesAtPaths:sortPaths
+                                                       ofRevision:first.revisions[first.position]];
+        } else {
+            heap[0] = heap.lastObject;
+            [heap removeLastObject];
+        }
+        if (heap.count > 0) {
+            CDTQMergeSiftDown(heap, 0, order);
+        }
+    }
+    return results;
+}
+
++ (NSArray *)sortValuesAtPaths:(NSArray<NSArray *> *)paths ofRevision:(CDTDocumentRevision *)rev
+{
+    NSMutableArray *values = [NSMutableArray arrayWithCapacity:paths.count];
+    for (NSArray<NSString *> *path in paths) {
+        NSObject *value;
+        if (path.count == 1 && [path[0] isEqualToString:@"_id"]) {
+            value = rev.docId;
+        } else if (path.count == 1 && [path[0] isEqualToString:@"_rev"]) {
+            value = rev.revId;
+        } else {
+            value = [CDTQValueExtractor extractValueForFieldPath:path fromRevision:rev];
+        }
+        [values addObject:value ?: [NSNull null]];
+    }
+    return values;
+}
+
+@end
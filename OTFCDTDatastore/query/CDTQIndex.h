@@ -21,6 +21,10 @@ NS_ASSUME_NONNULL_BEGIN
 extern NSString *const kCDTQJsonType __deprecated;
 extern NSString *const kCDTQTextType __deprecated;
 
+/** Prefix of the names of the SQLite collation sequences sorting by a locale's rules; the
+    locale identifier follows it. */
+extern NSString *const kCDTQCollationSequencePrefix;
+
 /**
  * This class provides functionality to manage an index
  */
@@ -30,6 +34,10 @@ extern NSString *const kCDTQTextType __deprecated;
 @property (nonatomic, strong) NSString *indexName;
 @property (nonatomic, strong) NSString *indexType __deprecated;
 @property (nullable, nonatomic, strong) NSDictionary *indexSettings;
+/** For a partial index, the normalised selector documents must match to be indexed. */
+@property (nullable, nonatomic, strong) NSDictionary *selector;
+/** For a JSON index with typed fields, the name of each typed field's type, e.g. `integer`. */
+@property (nullable, nonatomic, strong) NSDictionary<NSString *, NSString *> *fieldTypes;
 @property (nonatomic) CDTQIndexType type;
 
 /**
@@ -82,8 +90,14 @@ extern NSString *const kCDTQTextType __deprecated;
  * @param indexName the index name
  * @param fieldNames the field names in the index
  * @param indexType the index type (json or text)
- * @param indexSettings the optional settings used to configure the index.
- *                      Only supported parameter is 'tokenize' for text indexes only.
+ * @param indexSettings the optional settings used to configure the index, for text indexes
+ *                      only: 'tokenize', the SQLite tokenizer; 'module', 'fts4' (the default)
+ *                      or 'fts5'; and 'prefix', the lengths of prefixes to index for prefix
+ *                      searches, separated by spaces, e.g. '2 3'. A geo index's fields are
+ *                      its latitude and longitude, in that order, and its settings are made
+ *                      from them. A JSON or multikey index takes 'collation', a locale
+ *                      identifier such as 'sv_SE': queries sorted by the index then order its
+ *                      strings as -compare:options:range:locale: does for that locale.
  * @return the Index object or nil if arguments passed in were invalid.
  */
 + (nullable instancetype)index:(NSString *)indexName
@@ -91,6 +105,39 @@ extern NSString *const kCDTQTextType __deprecated;
                           type:(CDTQIndexType)indexType
                   withSettings:(nullable NSDictionary *)indexSettings;
 
+/**
+ * As above, creating a partial index when `selector` is given.
+ *
+ * @param selector the query selector documents must match to be included in the index, or
+ *                 nil or an empty selector to index every document. Text and geo indexes
+ *                 can't be partial, and the selector can't contain a text or geo search.
+ * @return the Index object or nil if arguments passed in were invalid.
+ */
++ (nullable instancetype)index:(NSString *)indexName
+                    withFields:(NSArray *)fieldNames
+                          type:(CDTQIndexType)indexType
+                  withSettings:(nullable NSDictionary *)indexSettings
+                      selector:(nullable NSDictionary *)selector;
+
+/**
+ * Creates a JSON index declaring the types of some of its fields.
+ *
+ * @param fieldTypes CDTQFieldType numbers keyed by the names of the fields to type, each of
+ *                   which must be one of `fieldNames`, other than `_id` and `_rev`.
+ * @return the Index object or nil if arguments passed in were invalid.
+ */
++ (nullable instancetype)index:(NSString *)indexName
+                    withFields:(NSArray *)fieldNames
+                    fieldTypes:(NSDictionary<NSString *, NSNumber *> *)fieldTypes;
+
+/**
+ * Returns a value as a typed field's column stores it, or nil if it isn't of the type, in
+ * which case it's indexed as NULL.
+ *
+ * @param fieldType the name of the type, as in -fieldTypes
+ */
++ (nullable NSObject *)value:(NSObject *)value normalisedForFieldType:(NSString *)fieldType;
+
 /**
  * Compares the index type and accompanying settings with the passed in arguments.
  *
@@ -113,6 +160,38 @@ extern NSString *const kCDTQTextType __deprecated;
 - (BOOL)compareToIndexType:(CDTQIndexType)indexType
          withIndexSettings:(nullable NSString *)indexSettings;
 
+/**
+ * Parses the 'prefix' text index setting.
+ *
+ * @return the prefix lengths, or nil if the setting isn't valid
+ */
++ (nullable NSArray<NSNumber *> *)prefixLengthsForSetting:(NSString *)prefix;
+
+/**
+ * Whether text index settings choose an FTS5 virtual table rather than FTS4.
+ */
++ (BOOL)settingsUseFTS5:(nullable NSDictionary *)indexSettings;
+
+/**
+ * The latitude and longitude fields of a geo index, from its settings.
+ *
+ * @return the two field names, or nil if the settings aren't a geo index's
+ */
++ (nullable NSArray<NSString *> *)geoFieldNamesForSettings:(nullable NSDictionary *)indexSettings;
+
+/**
+ * The SQLite collation sequence a JSON or multikey index's string values are sorted with, from
+ * its 'collation' setting.
+ *
+ * @return the sequence's name, or nil if the index is sorted by binary comparison
+ */
++ (nullable NSString *)collationSequenceForSettings:(nullable NSDictionary *)indexSettings;
+
+/**
+ * Whether a selector uses an operator or field name anywhere within it, e.g., `$text`.
+ */
++ (BOOL)selector:(NSObject *)selector containsKey:(NSString *)key;
+
 /**
  * Converts the index settings to a JSON string
  *
@@ -120,6 +199,13 @@ extern NSString *const kCDTQTextType __deprecated;
  */
 - (nullable NSString *)settingsAsJSON;
 
+/**
+ * Converts the partial index selector to a JSON string
+ *
+ * @return the JSON representation of the selector, or nil if the index isn't partial
+ */
+- (nullable NSString *)selectorAsJSON;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -14,6 +14,8 @@
 
 #import "CDTQIndex.h"
 
+#import "CDTQQueryConstants.h"
+#import "CDTQQueryValidator.h"
 #import "CDTLogging.h"
 
 #import <os/log.h>
@@ -21,8 +23,20 @@
 NSString *const kCDTQJsonType = @"json";
 NSString *const kCDTQTextType = @"text";
 
+static NSString *const kCDTQMultiKeyType = @"multikey";
+static NSString *const kCDTQGeoType = @"geo";
+
 static NSString *const kCDTQTextTokenize = @"tokenize";
 static NSString *const kCDTQTextDefaultTokenizer = @"simple";
+static NSString *const kCDTQTextPrefix = @"prefix";
+static NSString *const kCDTQTextModule = @"module";
+
+static NSString *const kCDTQGeoLatitude = @"latitude";
+static NSString *const kCDTQGeoLongitude = @"longitude";
+
+static NSString *const kCDTQCollation = @"collation";
+
+NSString *const kCDTQCollationSequencePrefix = @"cdtq_collate_";
 
 @interface CDTQIndex ()
 
@@ -38,7 +52,7 @@ static NSString *const kCDTQTextDefaultTokenizer = @"simple";
     dispatch_once(&onceToken, ^{
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
-        validTypesArray = @[ kCDTQJsonType, kCDTQTextType ];
+        validTypesArray = @[ kCDTQJsonType, kCDTQTextType, kCDTQMultiKeyType, kCDTQGeoType ];
 #pragma clang diagnostic pop
     });
     return validTypesArray;
@@ -50,7 +64,7 @@ static NSString *const kCDTQTextDefaultTokenizer = @"simple";
     static NSArray *validSettingsArray = nil;
     static dispatch_once_t onceToken;
     dispatch_once(&onceToken, ^{
-        validSettingsArray = @[ kCDTQTextTokenize ];
+        validSettingsArray = @[ kCDTQTextTokenize, kCDTQTextPrefix, kCDTQTextModule ];
     });
     return validSettingsArray;
 }
@@ -109,6 +123,19 @@ static NSString *const kCDTQTextDefaultTokenizer = @"simple";
            withFields:(NSArray *)fieldNames
                  type:(CDTQIndexType)indexType
          withSettings:(NSDictionary *)indexSettings
+{
+    return [[self class] index:indexName
+                    withFields:fieldNames
+                          type:indexType
+                  withSettings:indexSettings
+                      selector:nil];
+}
+
++ (instancetype)index:(NSString *)indexName
+           withFields:(NSArray *)fieldNames
+                 type:(CDTQIndexType)indexType
+         withSettings:(NSDictionary *)indexSettings
+             selector:(NSDictionary *)selector
 {
     if (fieldNames.count == 0) {
         os_log_error(CDTOSLog, "No field names provided.");
@@ -120,8 +147,38 @@ static NSString *const kCDTQTextDefaultTokenizer = @"simple";
         return nil;
     }
 
-    if (indexType == CDTQIndexTypeJSON && indexSettings) {
-        os_log_debug(CDTOSLog, "Index type is JSON, index settings %{public}@ ignored.", indexSettings);
+    if (indexType == CDTQIndexTypeGeo) {
+        // The settings record which field is which, as the metadata doesn't keep their order.
+        if (fieldNames.count != 2 || ![fieldNames[0] isKindOfClass:[NSString class]] ||
+            ![fieldNames[1] isKindOfClass:[NSString class]]) {
+            os_log_error(CDTOSLog, "A geo index needs a latitude and a longitude field, found %{public}@.",
+                         fieldNames);
+            return nil;
+        }
+        if (indexSettings) {
+            os_log_debug(CDTOSLog, "Index type is geo, index settings %{public}@ ignored.",
+                         indexSettings);
+        }
+        indexSettings = @{ kCDTQGeoLatitude : fieldNames[0], kCDTQGeoLongitude : fieldNames[1] };
+    } else if ((indexType == CDTQIndexTypeJSON || indexType == CDTQIndexTypeMultiKey) &&
+               indexSettings[kCDTQCollation]) {
+        // The locale becomes part of an SQL identifier, so mustn't contain a quote.
+        NSString *locale = indexSettings[kCDTQCollation];
+        if (![locale isKindOfClass:[NSString class]] || locale.length == 0 ||
+            [locale containsString:@"\""]) {
+            os_log_error(CDTOSLog, "Invalid collation %{public}@ in index settings, use a locale "
+                                   "identifier, e.g. \"sv_SE\".",
+                         indexSettings[kCDTQCollation]);
+            return nil;
+        }
+        if (indexSettings.count > 1) {
+            os_log_debug(CDTOSLog, "Index type is %{public}@, index settings other than collation in %{public}@ ignored.",
+                         [CDTQIndexManager stringForIndexType:indexType], indexSettings);
+        }
+        indexSettings = @{ kCDTQCollation : [NSLocale canonicalLocaleIdentifierFromString:locale] };
+    } else if (indexType != CDTQIndexTypeText && indexSettings) {
+        os_log_debug(CDTOSLog, "Index type is %{public}@, index settings %{public}@ ignored.",
+                     [CDTQIndexManager stringForIndexType:indexType], indexSettings);
         indexSettings = nil;
     } else if (indexType == CDTQIndexTypeText) {
         if (!indexSettings) {
@@ -135,13 +192,210 @@ static NSString *const kCDTQTextDefaultTokenizer = @"simple";
                     return nil;
                 }
             }
+            NSString *module = indexSettings[kCDTQTextModule];
+            if (module && ![@[ @"fts4", @"fts5" ] containsObject:module]) {
+                os_log_error(CDTOSLog, "Invalid module %{public}@ in index settings, use fts4 or fts5.",
+                             module);
+                return nil;
+            }
+            if (indexSettings[kCDTQTextPrefix] &&
+                ![CDTQIndex prefixLengthsForSetting:indexSettings[kCDTQTextPrefix]]) {
+                os_log_error(CDTOSLog, "Invalid prefix %{public}@ in index settings, use prefix "
+                                       "lengths separated by spaces, e.g. \"2 3\".",
+                             indexSettings[kCDTQTextPrefix]);
+                return nil;
+            }
         }
     }
     
-    return [[[self class] alloc] initWithFields:fieldNames
-                                      indexName:indexName
-                                      indexType:indexType
-                                  indexSettings:indexSettings];
+    NSDictionary *normalisedSelector = nil;
+    if (selector.count > 0) {
+        if (indexType == CDTQIndexTypeText || indexType == CDTQIndexTypeGeo) {
+            os_log_error(CDTOSLog, "%{public}@ indexes can't be partial, selector %{public}@ rejected.",
+                         [CDTQIndexManager stringForIndexType:indexType], selector);
+            return nil;
+        }
+        normalisedSelector = [CDTQQueryValidator normaliseAndValidateQuery:selector];
+        if (!normalisedSelector || [CDTQIndex selector:normalisedSelector containsKey:TEXT] ||
+            [CDTQIndex selector:normalisedSelector containsKey:GEO_WITHIN]) {
+            os_log_error(CDTOSLog, "Invalid partial index selector %{public}@.", selector);
+            return nil;
+        }
+    }
+
+    CDTQIndex *index = [[[self class] alloc] initWithFields:fieldNames
+                                                  indexName:indexName
+                                                  indexType:indexType
+                                              indexSettings:indexSettings];
+    index.selector = normalisedSelector;
+    return index;
+}
+
++ (instancetype)index:(NSString *)indexName
+           withFields:(NSArray *)fieldNames
+           fieldTypes:(NSDictionary<NSString *, NSNumber *> *)fieldTypes
+{
+    CDTQIndex *index = [[self class] index:indexName withFields:fieldNames type:CDTQIndexTypeJSON];
+    if (!index || fieldTypes.count == 0) {
+        return index;
+    }
+
+    NSMutableSet *names = [NSMutableSet set];
+    for (NSObject *field in fieldNames) {
+        // Fields may be given with a direction, as @{ @"name": @"asc" }.
+        if ([field isKindOfClass:[NSDictionary class]]) {
+            [names addObjectsFromArray:((NSDictionary *)field).allKeys];
+        } else {
+            [names addObject:field];
+        }
+    }
+
+    NSMutableDictionary *typeNames = [NSMutableDictionary dictionary];
+    for (NSString *fieldName in fieldTypes) {
+        NSString *typeName = nil;
+        if ([fieldTypes[fieldName] isKindOfClass:[NSNumber class]]) {
+            typeName = [CDTQIndexManager
+                stringForFieldType:(CDTQFieldType)fieldTypes[fieldName].unsignedIntegerValue];
+        }
+        if (![names containsObject:fieldName] || [fieldName isEqualToString:@"_id"] ||
+            [fieldName isEqualToString:@"_rev"] || !typeName) {
+            os_log_error(CDTOSLog, "Invalid type %{public}@ for field %{public}@ of index %{public}@.",
+                         fieldTypes[fieldName], fieldName, indexName);
+            return nil;
+        }
+        typeNames[fieldName] = typeName;
+    }
+    index.fieldTypes = [NSDictionary dictionaryWithDictionary:typeNames];
+    return index;
+}
+
++ (NSObject *)value:(NSObject *)value normalisedForFieldType:(NSString *)fieldType
+{
+    BOOL isBoolean = CFGetTypeID((__bridge CFTypeRef)value) == CFBooleanGetTypeID();
+    if ([fieldType isEqualToString:@"text"]) {
+        return [value isKindOfClass:[NSString class]] ? value : nil;
+
+    } else if ([fieldType isEqualToString:@"integer"]) {
+        if (![value isKindOfClass:[NSNumber class]]) {
+            return nil;
+        }
+        double d = ((NSNumber *)value).doubleValue;
+        if (!isBoolean && (d != floor(d) || fabs(d) >= 9.2e18)) {
+            return nil;  // not integral, or NaN, infinite or too large for an int64
+        }
+        return @(((NSNumber *)value).longLongValue);
+
+    } else if ([fieldType isEqualToString:@"real"]) {
+        if (![value isKindOfClass:[NSNumber class]] || isBoolean) {
+            return nil;
+        }
+        return @(((NSNumber *)value).doubleValue);
+
+    } else if ([fieldType isEqualToString:@"date"]) {
+        if ([value isKindOfClass:[NSNumber class]] && !isBoolean) {
+            double ms = ((NSNumber *)value).doubleValue;
+            return isfinite(ms) && fabs(ms) < 9.2e18 ? @((long long)llround(ms)) : nil;
+        }
+        if ([value isKindOfClass:[NSString class]]) {
+            NSDate *date = [CDTQIndex dateFromISO8601String:(NSString *)value];
+            return date ? @((long long)llround(date.timeIntervalSince1970 * 1000)) : nil;
+        }
+    }
+    return nil;
+}
+
+/** Parses the common forms of ISO 8601 dates and times, returning nil for anything else. */
++ (NSDate *)dateFromISO8601String:(NSString *)string
+{
+    static NSArray<NSDateFormatter *> *formatters;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableArray *all = [NSMutableArray array];
+        for (NSString *format in @[
+                 @"yyyy-MM-dd'T'HH:mm:ss.SSSXXXXX", @"yyyy-MM-dd'T'HH:mm:ssXXXXX",
+                 @"yyyy-MM-dd'T'HH:mmXXXXX", @"yyyy-MM-dd"
+             ]) {
+            NSDateFormatter *formatter = [[NSDateFormatter alloc] init];
+            formatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+            formatter.timeZone = [NSTimeZone timeZoneForSecondsFromGMT:0];
+            formatter.dateFormat = format;
+            [all addObject:formatter];
+        }
+        formatters = [all copy];
+    });
+
+    for (NSDateFormatter *formatter in formatters) {
+        NSDate *date = [formatter dateFromString:string];
+        if (date) {
+            return date;
+        }
+    }
+    return nil;
+}
+
++ (NSArray<NSNumber *> *)prefixLengthsForSetting:(NSString *)prefix
+{
+    if (![prefix isKindOfClass:[NSString class]]) {
+        return nil;
+    }
+
+    NSMutableArray<NSNumber *> *lengths = [NSMutableArray array];
+    NSCharacterSet *separators = [NSCharacterSet characterSetWithCharactersInString:@" ,"];
+    NSCharacterSet *nonDigits = [[NSCharacterSet decimalDigitCharacterSet] invertedSet];
+    for (NSString *part in [prefix componentsSeparatedByCharactersInSet:separators]) {
+        if (part.length == 0) {
+            continue;
+        }
+        if ([part rangeOfCharacterFromSet:nonDigits].location != NSNotFound ||
+            part.integerValue < 1 || part.integerValue > 999) {
+            return nil;
+        }
+        [lengths addObject:@(part.integerValue)];
+    }
+    return lengths.count > 0 ? lengths : nil;
+}
+
++ (BOOL)settingsUseFTS5:(NSDictionary *)indexSettings
+{
+    return [indexSettings[kCDTQTextModule] isEqual:@"fts5"];
+}
+
++ (NSArray<NSString *> *)geoFieldNamesForSettings:(NSDictionary *)indexSettings
+{
+    NSString *latitude = indexSettings[kCDTQGeoLatitude];
+    NSString *longitude = indexSettings[kCDTQGeoLongitude];
+    if (![latitude isKindOfClass:[NSString class]] || ![longitude isKindOfClass:[NSString class]]) {
+        return nil;
+    }
+    return @[ latitude, longitude ];
+}
+
++ (NSString *)collationSequenceForSettings:(NSDictionary *)indexSettings
+{
+    NSString *locale = indexSettings[kCDTQCollation];
+    if (![locale isKindOfClass:[NSString class]]) {
+        return nil;
+    }
+    return [kCDTQCollationSequencePrefix stringByAppendingString:locale];
+}
+
++ (BOOL)selector:(NSObject *)selector containsKey:(NSString *)key
+{
+    if ([selector isKindOfClass:[NSDictionary class]]) {
+        NSDictionary *dict = (NSDictionary *)selector;
+        for (NSString *k in dict) {
+            if ([k isEqualToString:key] || [CDTQIndex selector:dict[k] containsKey:key]) {
+                return YES;
+            }
+        }
+    } else if ([selector isKindOfClass:[NSArray class]]) {
+        for (NSObject *item in (NSArray *)selector) {
+            if ([CDTQIndex selector:item containsKey:key]) {
+                return YES;
+            }
+        }
+    }
+    return NO;
 }
 
 -(BOOL) compareIndexTypeTo:(NSString *)indexType withIndexSettings:(NSString *)indexSettings
@@ -192,6 +446,21 @@ static NSString *const kCDTQTextDefaultTokenizer = @"simple";
     return [[NSString alloc] initWithData:settingsData encoding:NSUTF8StringEncoding];
 }
 
+- (nullable NSString *)selectorAsJSON
+{
+    if (!self.selector) {
+        return nil;
+    }
+    NSData *selectorData =
+        [NSJSONSerialization dataWithJSONObject:self.selector options:kNilOptions error:nil];
+    if (!selectorData) {
+        os_log_error(CDTOSLog, "Error processing partial index selector %{public}@", self.selector);
+        return nil;
+    }
+
+    return [[NSString alloc] initWithData:selectorData encoding:NSUTF8StringEncoding];
+}
+
 #pragma property overrides
 /*
  These overrides are needed to ensure both the string and  enum versions of the index type are
@@ -0,0 +1,104 @@
+//
+//  CDTQIndexAdvisor.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ The shape of the queries recorded by a CDTQIndexAdvisor: the fields they select on, the
+ operators applied to each and their sort, without any of the values they're compared with.
+ */
+@interface CDTQQueryShape : NSObject
+
+/** The operators used on each field of the selector, sorted, e.g. `@{ @"age" : @[ @"$gt" ] }`;
+    negated operators are prefixed with `$not`. */
+@property (nonatomic, readonly) NSDictionary<NSString *, NSArray<NSString *> *> *operatorsByField;
+
+/** The sort document of the queries, empty if they weren't sorted. */
+@property (nonatomic, readonly) NSArray<NSDictionary<NSString *, NSString *> *> *sort;
+
+/** Number of queries recorded with this shape. */
+@property (nonatomic, readonly) NSUInteger count;
+
+/** Number of those which couldn't be answered from indexes alone, so loaded documents to match or
+    sort them. */
+@property (nonatomic, readonly) NSUInteger unindexedCount;
+
+/** Total time the recorded queries took to run. */
+@property (nonatomic, readonly) NSTimeInterval totalDuration;
+
+/** Total number of candidate documents the indexes found for the recorded queries, before any
+    matching of the documents themselves, skip and limit; see CDTQResultSet.candidateCount. */
+@property (nonatomic, readonly) NSUInteger totalCandidateCount;
+
+/**
+ The fields of a JSON index which would answer queries of this shape, and sort them, in SQL:
+ those compared for equality first, then the others, then the sort fields. nil if no JSON index
+ would help, such as for a text search, a geo query, $size or $elemMatch.
+ */
+@property (nullable, nonatomic, readonly) NSArray<NSString *> *suggestedFieldNames;
+
+@end
+
+/**
+ Keeps the shapes of queries which were slow, or needed documents to be loaded to match or sort
+ them, with how often each was run and how long they took, so that indexes can be suggested for
+ the costliest. Only shapes are kept, never the values queried for.
+
+ The advisor is thread safe.
+ */
+@interface CDTQIndexAdvisor : NSObject
+
+/** Number of shapes kept; once there are this many, the one costing least so far is dropped to
+    make room for another. Defaults to 100. */
+@property (nonatomic) NSUInteger shapeCountLimit;
+
+/** Times a shape must have been recorded before an index is suggested for it. Defaults to 2. */
+@property (nonatomic) NSUInteger minimumQueryCount;
+
+/**
+ Records a query, adding to the counts of its shape.
+
+ @param query the selector as passed to -find:.
+ @param sortDocument the sort document, if any.
+ @param duration how long the query took.
+ @param candidateCount the candidateCount of its result set.
+ @param unindexed YES if documents had to be loaded to match or sort its results.
+ */
+- (void)recordQuery:(NSDictionary *)query
+               sort:(nullable NSArray<NSDictionary<NSString *, NSString *> *> *)sortDocument
+           duration:(NSTimeInterval)duration
+     candidateCount:(NSUInteger)candidateCount
+          unindexed:(BOOL)unindexed;
+
+/** The shapes recorded, costliest, by total duration, first. */
+- (NSArray<CDTQQueryShape *> *)shapes;
+
+/**
+ The fields of the JSON indexes to create, as passed to -ensureIndexed:, for the shapes recorded
+ at least minimumQueryCount times, costliest first. Shapes already answered by one of `indexes`,
+ which holds all of their suggested fields, are left out, as are suggestions whose fields are all
+ in the suggestion of a costlier shape, since its index would answer them as well.
+
+ @param indexes the existing indexes, as listed by CDTQIndexManager.
+ */
+- (NSArray<NSArray<NSString *> *> *)suggestedIndexesForIndexes:(NSDictionary *)indexes;
+
+/** Forgets every shape recorded, e.g. once the suggested indexes have been created. */
+- (void)removeAllShapes;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,266 @@
+//
+//  CDTQIndexAdvisor.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTQIndexAdvisor.h"
+
+#import "CDTQIndexCreator.h"
+#import "CDTQQueryConstants.h"
+#import "CDTQQueryValidator.h"
+#import "CDTLogging.h"
+
+@interface CDTQQueryShape ()
+
+@property (nonatomic, readwrite) NSDictionary<NSString *, NSArray<NSString *> *> *operatorsByField;
+@property (nonatomic, readwrite) NSArray<NSDictionary<NSString *, NSString *> *> *sort;
+@property (nonatomic, readwrite) NSUInteger count;
+@property (nonatomic, readwrite) NSUInteger unindexedCount;
+@property (nonatomic, readwrite) NSTimeInterval totalDuration;
+@property (nonatomic, readwrite) NSUInteger totalCandidateCount;
+@property (nullable, nonatomic, readwrite) NSArray<NSString *> *suggestedFieldNames;
+
+@end
+
+@implementation CDTQQueryShape
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@ %@ sort: %@ count: %lu unindexed: %lu duration: %.3fs>",
+                                      [self class], self.operatorsByField, self.sort,
+                                      (unsigned long)self.count, (unsigned long)self.unindexedCount,
+                                      self.totalDuration];
+}
+
+@end
+
+/**
+ Adds the fields of the terms of a normalised clause, and the operators applied to them, to
+ `operators`, descending into $and and $or.
+
+ @return NO if a term needs a search no JSON index can help with.
+ */
+static BOOL CDTQAddOperatorsOfTerms(NSArray *terms,
+                                    NSMutableDictionary<NSString *, NSMutableSet *> *operators)
+{
+    BOOL indexable = YES;
+    for (NSDictionary *term in terms) {
+        if (![term isKindOfClass:[NSDictionary class]] || term.count != 1) {
+            continue;
+        }
+        NSString *field = term.allKeys[0];
+        id value = term[field];
+
+        if ([field isEqualToString:AND] || [field isEqualToString:OR]) {
+            if ([value isKindOfClass:[NSArray class]] && !CDTQAddOperatorsOfTerms(value, operators)) {
+                indexable = NO;
+            }
+        } else if ([field.lowercaseString isEqualToString:TEXT] || [field isEqualToString:GEO_WITHIN]) {
+            indexable = NO;
+        } else if ([value isKindOfClass:[NSDictionary class]]) {
+            NSDictionary *predicate = value;
+            NSString *prefix = @"";
+            if ([predicate[NOT] isKindOfClass:[NSDictionary class]]) {
+                predicate = predicate[NOT];
+                prefix = NOT;
+            }
+            if (predicate[SIZE] || predicate[ELEM_MATCH]) {
+                indexable = NO;
+            }
+            NSMutableSet *fieldOperators = operators[field];
+            if (!fieldOperators) {
+                fieldOperators = [NSMutableSet set];
+                operators[field] = fieldOperators;
+            }
+            for (NSString *operator in predicate) {
+                [fieldOperators addObject:[prefix stringByAppendingString:operator]];
+            }
+        }
+    }
+    return indexable;
+}
+
+/**
+ The fields of a JSON index answering a query of a shape: equality fields first, as an index
+ leading with them narrows the rows soonest, then the other fields, then the sort fields. nil if
+ the shape can't use one.
+ */
+static NSArray<NSString *> *CDTQSuggestedFieldNames(NSDictionary<NSString *, NSArray *> *operators,
+                                                    NSArray<NSDictionary *> *sortDocument)
+{
+    NSMutableArray *equalities = [NSMutableArray array];
+    NSMutableArray *others = [NSMutableArray array];
+    for (NSString *field in [operators.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
+        BOOL equality = YES;
+        for (NSString *operator in operators[field]) {
+            if (!([operator isEqualToString:EQ] || [operator isEqualToString:IN])) {
+                equality = NO;
+            }
+        }
+        [(equality ? equalities : others) addObject:field];
+    }
+
+    NSMutableOrderedSet *fields = [NSMutableOrderedSet orderedSetWithArray:equalities];
+    [fields addObjectsFromArray:others];
+    for (NSDictionary *sortTerm in sortDocument) {
+        [fields addObjectsFromArray:sortTerm.allKeys];
+    }
+    // Every index already holds these
+    [fields removeObject:@"_id"];
+    [fields removeObject:@"_rev"];
+
+    if (fields.count == 0) {
+        return nil;
+    }
+    for (NSString *field in fields) {
+        if (![CDTQIndexCreator validFieldName:field]) {
+            return nil;
+        }
+    }
+    return fields.array;
+}
+
+@implementation CDTQIndexAdvisor {
+    NSMutableDictionary<NSString *, CDTQQueryShape *> *_shapes;  // guarded by self
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _shapes = [NSMutableDictionary dictionary];
+        _shapeCountLimit = 100;
+        _minimumQueryCount = 2;
+    }
+    return self;
+}
+
+- (void)recordQuery:(NSDictionary *)query
+               sort:(NSArray<NSDictionary<NSString *, NSString *> *> *)sortDocument
+           duration:(NSTimeInterval)duration
+     candidateCount:(NSUInteger)candidateCount
+          unindexed:(BOOL)unindexed
+{
+    NSDictionary *normalised = [CDTQQueryValidator normaliseAndValidateQuery:query];
+    if (!normalised) {
+        return;
+    }
+
+    NSMutableDictionary<NSString *, NSMutableSet *> *operatorSets = [NSMutableDictionary dictionary];
+    BOOL indexable = CDTQAddOperatorsOfTerms(@[ normalised ], operatorSets);
+    NSMutableDictionary<NSString *, NSArray *> *operators = [NSMutableDictionary dictionary];
+    for (NSString *field in operatorSets) {
+        operators[field] = [operatorSets[field].allObjects sortedArrayUsingSelector:@selector(compare:)];
+    }
+    NSArray *sort = sortDocument ?: @[];
+
+    NSMutableString *key = [NSMutableString string];
+    for (NSString *field in [operators.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
+        [key appendFormat:@"%@:%@,", field, [operators[field] componentsJoinedByString:@"|"]];
+    }
+    for (NSDictionary *sortTerm in sort) {
+        for (NSString *field in sortTerm) {
+            [key appendFormat:@";%@:%@", field, sortTerm[field]];
+        }
+    }
+    if (!indexable) {
+        [key appendString:@";unindexable"];
+    }
+
+    @synchronized(self) {
+        CDTQQueryShape *shape = _shapes[key];
+        if (!shape) {
+            if (_shapeCountLimit == 0) {
+                return;
+            }
+            if (_shapes.count >= _shapeCountLimit) {
+                NSString *cheapest = nil;
+                for (NSString *otherKey in _shapes) {
+                    if (!cheapest ||
+                        _shapes[otherKey].totalDuration < _shapes[cheapest].totalDuration) {
+                        cheapest = otherKey;
+                    }
+                }
+                [_shapes removeObjectForKey:cheapest];
+            }
+            shape = [[CDTQQueryShape alloc] init];
+            shape.operatorsByField = operators;
+            shape.sort = sort;
+            shape.suggestedFieldNames = indexable ? CDTQSuggestedFieldNames(operators, sort) : nil;
+            _shapes[key] = shape;
+        }
+        shape.count++;
+        if (unindexed) {
+            shape.unindexedCount++;
+        }
+        shape.totalDuration += duration;
+        shape.totalCandidateCount += candidateCount;
+    }
+}
+
+- (NSArray<CDTQQueryShape *> *)shapes
+{
+    NSArray *shapes;
+    @synchronized(self) {
+        shapes = _shapes.allValues;
+    }
+    return [shapes sortedArrayUsingComparator:^NSComparisonResult(CDTQQueryShape *a,
+                                                                  CDTQQueryShape *b) {
+        if (a.totalDuration == b.totalDuration) {
+            return NSOrderedSame;
+        }
+        return a.totalDuration > b.totalDuration ? NSOrderedAscending : NSOrderedDescending;
+    }];
+}
+
+- (NSArray<NSArray<NSString *> *> *)suggestedIndexesForIndexes:(NSDictionary *)indexes
+{
+    // Partial indexes only answer some queries, so aren't counted as answering a shape.
+    NSMutableArray<NSSet *> *covered = [NSMutableArray array];
+    for (NSDictionary *index in indexes.allValues) {
+        NSString *type = index[@"type"];
+        if (!index[@"selector"] && ([type isEqualToString:@"json"] || [type isEqualToString:@"multikey"])) {
+            [covered addObject:[NSSet setWithArray:index[@"fields"]]];
+        }
+    }
+
+    NSUInteger minimumQueryCount = self.minimumQueryCount;
+    NSMutableArray *suggestions = [NSMutableArray array];
+    for (CDTQQueryShape *shape in [self shapes]) {
+        NSArray *fields = shape.suggestedFieldNames;
+        if (!fields || shape.count < minimumQueryCount) {
+            continue;
+        }
+        NSSet *fieldSet = [NSSet setWithArray:fields];
+        BOOL answered = NO;
+        for (NSSet *existing in covered) {
+            if ([fieldSet isSubsetOfSet:existing]) {
+                answered = YES;
+                break;
+            }
+        }
+        if (!answered) {
+            [suggestions addObject:fields];
+            [covered addObject:fieldSet];
+        }
+    }
+    return suggestions;
+}
+
+- (void)removeAllShapes
+{
+    @synchronized(self) {
+        [_shapes removeAllObjects];
+    }
+}
+
+@end
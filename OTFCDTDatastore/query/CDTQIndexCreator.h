@@ -34,10 +34,25 @@ NS_ASSUME_NONNULL_BEGIN
                           inDatabase:(FMDatabaseQueue *)database
                        fromDatastore:(CDTDatastore *)datastore;
 
+/**
+ Add several indexes, filling those which are new with a single pass over the datastore.
+
+ @return the names of the indexes, or nil if any couldn't be created or updated.
+ */
++ (nullable NSArray<NSString *> *)ensureIndexes:(NSArray<CDTQIndex *> *)indexes
+                                     inDatabase:(FMDatabaseQueue *)database
+                                  fromDatastore:(CDTDatastore *)datastore;
+
 + (NSArray /*NSDictionary or NSString*/ *)removeDirectionsFromFields:(NSArray *)fieldNames;
 
 + (BOOL)validFieldName:(NSString *)fieldName;
 
+/**
+ Whether `index` can't be created alongside `existingIndexes`: there can be only one text index
+ and one geo index. JSON indexes are unlimited.
+ */
++ (BOOL)indexLimitReached:(CDTQIndex *)index basedOnIndexes:(NSDictionary *)existingIndexes;
+
 + (nullable NSArray<CDTQSqlParts *> *)
 insertMetadataStatementsForIndexName:(NSString *)indexName
                                 type:(NSString *)indexType
@@ -47,9 +62,32 @@ insertMetadataStatementsForIndexName:(NSString *)indexName
 + (nullable CDTQSqlParts *)createIndexTableStatementForIndexName:(NSString *)indexName
                                                       fieldNames:(NSArray<NSString *> *)fieldNames;
 
+/**
+ As above, declaring the columns of typed fields, `fieldTypes` mapping field names to type
+ names, with the matching affinity.
+ */
++ (nullable CDTQSqlParts *)createIndexTableStatementForIndexName:(NSString *)indexName
+                                                      fieldNames:(NSArray<NSString *> *)fieldNames
+                                                      fieldTypes:(nullable NSDictionary<NSString *, NSString *> *)fieldTypes;
+
 + (nullable CDTQSqlParts *)createIndexIndexStatementForIndexName:(NSString *)indexName
                                                       fieldNames:(NSArray<NSString *> *)fieldNames;
 
+/**
+ The SQLite index a typed index's table has as well, on its fields other than `_id` and `_rev`
+ in order, so that comparisons on the first of them seek.
+ */
++ (nullable CDTQSqlParts *)createSeekIndexStatementForIndexName:(NSString *)indexName
+                                                     fieldNames:(NSArray<NSString *> *)fieldNames;
+
+/**
+ The statements creating a geo index's R*Tree and the triggers which fill it from the index's
+ table, given the index's latitude and longitude fields.
+ */
++ (nullable NSArray<CDTQSqlParts *> *)
+createRTreeStatementsForIndexName:(NSString *)indexName
+                        geoFields:(NSArray<NSString *> *)geoFields;
+
 + (nullable CDTQSqlParts *)
 createVirtualTableStatementForIndexName:(NSString *)indexName
                              fieldNames:(NSArray<NSString *> *)fieldNames
@@ -16,6 +16,7 @@
 
 #import "CDTQIndexManager.h"
 #import "CDTQIndexUpdater.h"
+#import "CDTQValueExtractor.h"
 #import "CDTLogging.h"
 
 #import "CloudantSync.h"
@@ -51,6 +52,15 @@
     return [executor ensureIndexed:index];
 }
 
++ (NSArray<NSString *> *)ensureIndexes:(NSArray<CDTQIndex *> *)indexes
+                            inDatabase:(FMDatabaseQueue *)database
+                         fromDatastore:(CDTDatastore *)datastore
+{
+    CDTQIndexCreator *executor =
+        [[CDTQIndexCreator alloc] initWithDatabase:database datastore:datastore];
+    return [executor ensureIndexes:indexes];
+}
+
 #pragma mark Instance methods
 
 /**
@@ -65,15 +75,130 @@
     if (!index) {
         return nil;
     }
+    return [self ensureIndexes:@[ index ]].firstObject;
+}
 
+- (NSArray<NSString *> *)ensureIndexes:(NSArray<CDTQIndex *> *)indexes
+{
+    // Check every index before creating any, so a bad one doesn't leave the others half made.
+    NSDictionary *existingIndexes = [CDTQIndexManager listIndexesInDatabaseQueue:self.database];
+    NSMutableArray<NSArray *> *fieldNamesOfIndexes = [NSMutableArray array];
+    NSMutableSet *names = [NSMutableSet set];
+    NSString *newTextIndexName = nil;
+    NSString *newGeoIndexName = nil;
+    for (CDTQIndex *index in indexes) {
+        NSArray *fieldNames = [self fieldNamesForIndex:index];
+        if (!fieldNames) {
+            return nil;
+        }
+        if ([names containsObject:index.indexName]) {
+            os_log_error(CDTOSLog, "Cannot create two indexes named %{public}@", index.indexName);
+            return nil;
+        }
+        [names addObject:index.indexName];
+
+        // Check the index limit.  Limit is 1 for "text" and "geo" indexes and unlimited for
+        // "json" indexes.
+        // Then check whether the index already exists; it's used if it's the same, else fail.
+        if ([CDTQIndexCreator indexLimitReached:index basedOnIndexes:existingIndexes]) {
+            os_log_error(CDTOSLog, "Index limit reached.  Cannot create index %{public}@.", index.indexName);
+            return nil;
+        }
+        if (existingIndexes[index.indexName] != nil) {
+            if (![CDTQIndexCreator index:index
+                          withFieldNames:fieldNames
+                            isSameAsIndex:existingIndexes[index.indexName]]) {
+                return nil;
+            }
+        } else if ([CDTQIndexCreator isTextIndex:index]) {
+            if (newTextIndexName) {
+                os_log_error(CDTOSLog, "Cannot create text indexes %{public}@ and %{public}@.  One text index per datastore permitted.",
+                             newTextIndexName, index.indexName);
+                return nil;
+            }
+            newTextIndexName = index.indexName;
+        } else if (index.type == CDTQIndexTypeGeo) {
+            if (newGeoIndexName) {
+                os_log_error(CDTOSLog, "Cannot create geo indexes %{public}@ and %{public}@.  One geo index per datastore permitted.",
+                             newGeoIndexName, index.indexName);
+                return nil;
+            }
+            newGeoIndexName = index.indexName;
+        }
+        [fieldNamesOfIndexes addObject:fieldNames];
+    }
+
+    BOOL success = YES;
+    NSMutableSet *createdNames = [NSMutableSet set];
+    for (NSUInteger i = 0; i < indexes.count && success; i++) {
+        if (existingIndexes[indexes[i].indexName] == nil) {
+            success = [self createIndex:indexes[i] withFieldNames:fieldNamesOfIndexes[i]];
+            if (success) {
+                [createdNames addObject:indexes[i].indexName];
+            }
+        }
+    }
+
+    // New indexes are filled in one pass over the datastore before their SQLite indexes are
+    // created, then every index is brought up to date with anything changed in the meantime.
+    NSDictionary *allIndexes = [CDTQIndexManager listIndexesInDatabaseQueue:self.database];
+    if (createdNames.count > 0) {
+        NSDictionary *created = [CDTQIndexCreator indexes:allIndexes named:createdNames];
+        success = [CDTQIndexUpdater buildIndexes:created
+                                      inDatabase:_database
+                                   fromDatastore:_datastore] &&
+                  success;
+        // Even if the build failed, as updates rely on the SQLite index to find a document's rows.
+        success = [self createSQLiteIndexesForIndexes:created] && success;
+    }
+    if (success) {
+        success = [CDTQIndexUpdater updateAllIndexes:[CDTQIndexCreator indexes:allIndexes named:names]
+                                          inDatabase:_database
+                                       fromDatastore:_datastore];
+    }
+
+    return success ? [indexes valueForKey:@"indexName"] : nil;
+}
+
++ (BOOL)isTextIndex:(CDTQIndex *)index
+{
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
-    if ([index.indexType.lowercaseString isEqualToString:@"text"]) {
+    return [index.indexType.lowercaseString isEqualToString:kCDTQTextType];
 #pragma clang diagnostic pop
+}
+
++ (NSDictionary *)indexes:(NSDictionary *)indexes named:(NSSet *)names
+{
+    NSMutableDictionary *named = [NSMutableDictionary dictionary];
+    for (NSString *name in names) {
+        if (indexes[name]) {
+            named[name] = indexes[name];
+        }
+    }
+    return [NSDictionary dictionaryWithDictionary:named];
+}
+
+/**
+ Validates the index's field names, returning them with `_id` and `_rev` added, or nil if
+ they're invalid or the index can't be created in this database.
+ */
+- (NSArray *)fieldNamesForIndex:(CDTQIndex *)index
+{
+    if ([CDTQIndexCreator isTextIndex:index]) {
         if (![CDTQIndexManager ftsAvailableInDatabase:self.database]) {
             os_log_error(CDTOSLog, "Text search not supported.  To add support for text search, enable FTS compile options in SQLite.");
             return nil;
         }
+        if ([CDTQIndex settingsUseFTS5:index.indexSettings] &&
+            ![CDTQIndexManager fts5AvailableInDatabase:self.database]) {
+            os_log_error(CDTOSLog, "FTS5 text indexes not supported.  Enable the ENABLE_FTS5 compile option in SQLite, or use an FTS4 text index.");
+            return nil;
+        }
+    } else if (index.type == CDTQIndexTypeGeo &&
+               ![CDTQIndexManager rtreeAvailableInDatabase:self.database]) {
+        os_log_error(CDTOSLog, "Geo indexes not supported.  Enable the ENABLE_RTREE compile option in SQLite.");
+        return nil;
     }
 
     NSArray *fieldNames = [CDTQIndexCreator removeDirectionsFromFields:index.fieldNames];
@@ -104,37 +229,36 @@
         fieldNames = [NSArray arrayWithArray:tmp];
     }
 
-    // Check the index limit.  Limit is 1 for "text" indexes and unlimited for "json" indexes.
-    // Then check whether the index already exists; return success if it does and is same,
-    // else fail.
-    NSDictionary *existingIndexes = [CDTQIndexManager listIndexesInDatabaseQueue:self.database];
-    if ([CDTQIndexCreator indexLimitReached:index basedOnIndexes:existingIndexes]) {
-        os_log_error(CDTOSLog, "Index limit reached.  Cannot create index %{public}@.", index.indexName);
-        return nil;
-    }
-    if (existingIndexes[index.indexName] != nil) {
-        NSDictionary *existingIndex = existingIndexes[index.indexName];
-        NSString *existingType = existingIndex[@"type"];
-        NSString *existingSettings = existingIndex[@"settings"];
-        NSSet *existingFields = [NSSet setWithArray:existingIndex[@"fields"]];
-        NSSet *newFields = [NSSet setWithArray:fieldNames];
+    return fieldNames;
+}
+
+/** Whether an existing index, as listed by CDTQIndexManager, is the one being ensured. */
++ (BOOL)index:(CDTQIndex *)index
+    withFieldNames:(NSArray *)fieldNames
+     isSameAsIndex:(NSDictionary *)existingIndex
+{
+    NSString *existingType = existingIndex[@"type"];
+    NSString *existingSettings = existingIndex[@"settings"];
+    NSDictionary *existingSelector = existingIndex[@"selector"];
+    NSSet *existingFields = [NSSet setWithArray:existingIndex[@"fields"]];
+    NSSet *newFields = [NSSet setWithArray:fieldNames];
+    BOOL sameSelector = (!existingSelector && !index.selector) ||
+                        [existingSelector isEqualToDictionary:index.selector];
+    BOOL sameFieldTypes = [existingIndex[@"fieldTypes"] ?: @{} isEqualToDictionary:index.fieldTypes ?: @{}];
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
-        if ([existingFields isEqualToSet:newFields] &&
-            [index compareIndexTypeTo:existingType withIndexSettings:existingSettings]) {
+    return [existingFields isEqualToSet:newFields] && sameSelector && sameFieldTypes &&
+           [index compareIndexTypeTo:existingType withIndexSettings:existingSettings];
 #pragma clang diagnostic pop
-            BOOL success = [CDTQIndexUpdater updateIndex:index.indexName
-                                              withFields:fieldNames
-                                              inDatabase:_database
-                                           fromDatastore:_datastore
-                                                   error:nil];
-            return success ? index.indexName : nil;
-        } else {
-            return nil;
-        }
-    }
+}
 
+/**
+ Creates an index's metadata and table. The SQLite index on a JSON index's table is left until
+ the table has been filled, as building it once is much quicker than updating it on every insert.
+ */
+- (BOOL)createIndex:(CDTQIndex *)index withFieldNames:(NSArray *)fieldNames
+{
     __block BOOL success = YES;
 
     [_database inTransaction:^(FMDatabase *db, BOOL *rollback) {
@@ -153,13 +277,36 @@
                                      withArgumentsInArray:sql.placeholderValues];
         }
 
+        if (index.selector) {
+            NSString *selectorJSON = index.selectorAsJSON;
+            NSString *sql = @"UPDATE %@ SET partial_selector = ? WHERE index_name = ?;";
+            sql = [NSString stringWithFormat:sql, kCDTQIndexMetadataTableName];
+            success = success && selectorJSON &&
+                      [db executeUpdate:sql
+                          withArgumentsInArray:@[ selectorJSON, index.indexName ]];
+        }
+
+        for (NSString *fieldName in index.fieldTypes) {
+            NSString *sql =
+                @"UPDATE %@ SET field_type = ? WHERE index_name = ? AND field_name = ?;";
+            sql = [NSString stringWithFormat:sql, kCDTQIndexMetadataTableName];
+            success = success &&
+                      [db executeUpdate:sql
+                          withArgumentsInArray:@[
+                              index.fieldTypes[fieldName], index.indexName, fieldName
+                          ]];
+        }
+        if ([index.fieldTypes.allValues containsObject:@"date"]) {
+            // Dates aren't stored as they are in their documents.
+            NSString *sql = @"UPDATE %@ SET covering = 0 WHERE index_name = ?;";
+            sql = [NSString stringWithFormat:sql, kCDTQIndexMetadataTableName];
+            success = success && [db executeUpdate:sql withArgumentsInArray:@[ index.indexName ]];
+        }
+
         // Create SQLite data structures to support the index
-        // For JSON index type create a SQLite table and a SQLite index
+        // For JSON index type create a SQLite table, indexed once it's filled
         // For TEXT index type create a SQLite virtual table
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wdeprecated-declarations"
-        if ([index.indexType.lowercaseString isEqualToString:kCDTQTextType]) {
-#pragma clang diagnostic pop
+        if ([CDTQIndexCreator isTextIndex:index]) {
             // Create the virtual table for the TEXT index
             CDTQSqlParts *createVirtualTable =
             [CDTQIndexCreator createVirtualTableStatementForIndexName:index.indexName
@@ -171,17 +318,21 @@
             // Create the table for the index
             CDTQSqlParts *createTable =
             [CDTQIndexCreator createIndexTableStatementForIndexName:index.indexName
-                                                         fieldNames:fieldNames];
+                                                         fieldNames:fieldNames
+                                                         fieldTypes:index.fieldTypes];
             success = success && [db executeUpdate:createTable.sqlWithPlaceholders
                               withArgumentsInArray:createTable.placeholderValues];
-            
-            // Create the SQLite index on the index table
-            
-            CDTQSqlParts *createIndex =
-            [CDTQIndexCreator createIndexIndexStatementForIndexName:index.indexName
-                                                         fieldNames:fieldNames];
-            success = success && [db executeUpdate:createIndex.sqlWithPlaceholders
-                              withArgumentsInArray:createIndex.placeholderValues];
+
+            // A geo index's points go in an R*Tree, which triggers keep in step with the table
+            if (index.type == CDTQIndexTypeGeo) {
+                NSArray *geoFields = [CDTQIndex geoFieldNamesForSettings:index.indexSettings];
+                for (CDTQSqlParts *sql in
+                     [CDTQIndexCreator createRTreeStatementsForIndexName:index.indexName
+                                                              geoFields:geoFields]) {
+                    success = success && [db executeUpdate:sql.sqlWithPlaceholders
+                                      withArgumentsInArray:sql.placeholderValues];
+                }
+            }
         }
         
         if (!success) {
@@ -189,26 +340,51 @@
         }
     }];
 
-    // Update the new index if it's been created
-    if (success) {
-        success = success && [CDTQIndexUpdater updateIndex:index.indexName
-                                                withFields:fieldNames
-                                                inDatabase:_database
-                                             fromDatastore:_datastore
-                                                     error:nil];
-    }
+    return success;
+}
+
+/** Creates the SQLite index on the table of each of the JSON indexes, as listed by the manager. */
+- (BOOL)createSQLiteIndexesForIndexes:(NSDictionary *)indexes
+{
+    __block BOOL success = YES;
+    [_database inDatabase:^(FMDatabase *db) {
+        for (NSString *indexName in indexes) {
+            if ([indexes[indexName][@"type"] isEqualToString:@"text"]) {
+                continue;
+            }
+            CDTQSqlParts *createIndex =
+                [CDTQIndexCreator createIndexIndexStatementForIndexName:indexName
+                                                             fieldNames:indexes[indexName][@"fields"]];
+            success = success && [db executeUpdate:createIndex.sqlWithPlaceholders
+                              withArgumentsInArray:createIndex.placeholderValues];
 
-    return success ? index.indexName : nil;
+            // The index above leads with _id, for removing a document's rows, so a typed
+            // index also gets one its comparisons can seek.
+            if (indexes[indexName][@"fieldTypes"]) {
+                CDTQSqlParts *createSeekIndex = [CDTQIndexCreator
+                    createSeekIndexStatementForIndexName:indexName
+                                              fieldNames:indexes[indexName][@"fields"]];
+                success = success && createSeekIndex &&
+                          [db executeUpdate:createSeekIndex.sqlWithPlaceholders
+                              withArgumentsInArray:createSeekIndex.placeholderValues];
+            }
+        }
+    }];
+    return success;
 }
 
 /**
  Validate the field name string is usable.
 
- The only restriction so far is that the parts don't start with
- a $ sign, as this makes the query language ambiguous.
+ The parts mustn't start with a $ sign, as this makes the query language
+ ambiguous, and a name starting with @ must be a registered expression.
  */
 + (BOOL)validFieldName:(NSString *)fieldName
 {
+    if ([CDTQValueExtractor isExpressionFieldName:fieldName]) {
+        return [CDTQValueExtractor expressionsAreRegisteredForFieldNames:@[ fieldName ]];
+    }
+
     NSArray *parts = [fieldName componentsSeparatedByString:@"."];
     for (NSString *part in parts) {
         if ([part hasPrefix:@"$"]) {
@@ -244,7 +420,7 @@
 
 /**
  * Based on the proposed index and the list of existing indexes, this function checks
- * whether another index can be created.  Currently the limit for TEXT indexes is 1.
+ * whether another index can be created.  Currently the limit for TEXT and GEO indexes is 1.
  * JSON indexes are unlimited.
  *
  * @param existingIndexes the list of already existing indexes
@@ -270,6 +446,15 @@
                 return YES;
             }
         }
+    } else if (index.type == CDTQIndexTypeGeo) {
+        for (NSString *name in existingIndexes.allKeys) {
+            if ([existingIndexes[name][@"type"] isEqualToString:@"geo"] &&
+                ![name.lowercaseString isEqualToString:index.indexName.lowercaseString]) {
+                os_log_error(CDTOSLog, "The geo index %{public}@ already exists.  One geo index per datastore permitted.  Delete %{public}@ and recreate %{public}@",
+                             name, name, index.indexName);
+                return YES;
+            }
+        }
     }
     
     return NO;
@@ -293,16 +478,18 @@
     for (NSString *fieldName in fieldNames) {
         NSString *sql;
         NSArray *metaParameters;
+        // An empty JSON index covers its fields until a value it can't store exactly is indexed.
+        NSNumber *covering = @([indexType isEqualToString:@"json"]);
         if (indexSettings) {
             sql = @"INSERT INTO %@"
-                   " (index_name, index_type, index_settings, field_name, last_sequence) "
-                   "VALUES (?, ?, ?, ?, 0);";
-            metaParameters = @[ indexName, indexType, indexSettings, fieldName ];
+                   " (index_name, index_type, index_settings, field_name, last_sequence, covering) "
+                   "VALUES (?, ?, ?, ?, 0, ?);";
+            metaParameters = @[ indexName, indexType, indexSettings, fieldName, covering ];
         } else {
             sql = @"INSERT INTO %@"
-                   " (index_name, index_type, field_name, last_sequence) "
-                   "VALUES (?, ?, ?, 0);";
-            metaParameters = @[ indexName, indexType, fieldName ];
+                   " (index_name, index_type, field_name, last_sequence, covering) "
+                   "VALUES (?, ?, ?, 0, ?);";
+            metaParameters = @[ indexName, indexType, fieldName, covering ];
         }
         sql = [NSString stringWithFormat:sql, kCDTQIndexMetadataTableName];
         
@@ -315,6 +502,23 @@
 + (CDTQSqlParts *)createIndexTableStatementForIndexName:(NSString *)indexName
                                              fieldNames:(NSArray /*NSString*/ *)fieldNames
 {
+    return [CDTQIndexCreator createIndexTableStatementForIndexName:indexName
+                                                        fieldNames:fieldNames
+                                                        fieldTypes:nil];
+}
+
++ (CDTQSqlParts *)createIndexTableStatementForIndexName:(NSString *)indexName
+                                             fieldNames:(NSArray /*NSString*/ *)fieldNames
+                                             fieldTypes:(NSDictionary *)fieldTypes
+{
+    // Dates are stored as integer milliseconds.
+    NSDictionary *affinities = @{
+        @"text" : @"TEXT",
+        @"integer" : @"INTEGER",
+        @"real" : @"REAL",
+        @"date" : @"INTEGER"
+    };
+
     if (!indexName) {
         return nil;
     }
@@ -326,7 +530,8 @@
     NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
     NSMutableArray *clauses = [NSMutableArray array];
     for (NSString *fieldName in fieldNames) {
-        NSString *clause = [NSString stringWithFormat:@"\"%@\" NONE", fieldName];
+        NSString *affinity = affinities[fieldTypes[fieldName] ?: @""] ?: @"NONE";
+        NSString *clause = [NSString stringWithFormat:@"\"%@\" %@", fieldName, affinity];
         [clauses addObject:clause];
     }
 
@@ -360,6 +565,70 @@
     return [CDTQSqlParts partsForSql:sql parameters:@[]];
 }
 
++ (CDTQSqlParts *)createSeekIndexStatementForIndexName:(NSString *)indexName
+                                            fieldNames:(NSArray /*NSString*/ *)fieldNames
+{
+    NSMutableArray *clauses = [NSMutableArray array];
+    for (NSString *fieldName in fieldNames) {
+        if (![fieldName isEqualToString:@"_id"] && ![fieldName isEqualToString:@"_rev"]) {
+            [clauses addObject:[NSString stringWithFormat:@"\"%@\"", fieldName]];
+        }
+    }
+
+    if (!indexName || clauses.count == 0) {
+        return nil;
+    }
+
+    NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+    NSString *sqlIndexName = [tableName stringByAppendingString:@"_seek"];
+    NSString *sql =
+        [NSString stringWithFormat:@"CREATE INDEX \"%@\" ON \"%@\" ( %@ );", sqlIndexName,
+                                   tableName, [clauses componentsJoinedByString:@", "]];
+    return [CDTQSqlParts partsForSql:sql parameters:@[]];
+}
+
+/**
+ Returns the statements creating a geo index's R*Tree, of each row's point keyed by its rowid,
+ and the triggers keeping it up to date as rows are inserted, updated and deleted. A row's point
+ is only added if its latitude and longitude are both numbers.
+
+ @param geoFields the latitude and longitude fields
+ */
++ (NSArray<CDTQSqlParts *> *)createRTreeStatementsForIndexName:(NSString *)indexName
+                                                     geoFields:(NSArray<NSString *> *)geoFields
+{
+    if (!indexName || geoFields.count != 2) {
+        return nil;
+    }
+
+    NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+    NSString *rtreeName = [CDTQIndexManager rtreeTableNameForIndex:indexName];
+    NSString *point =
+        [NSString stringWithFormat:@"new.rowid, new.\"%@\", new.\"%@\", new.\"%@\", new.\"%@\"",
+                                   geoFields[0], geoFields[0], geoFields[1], geoFields[1]];
+    NSString *hasPoint =
+        [NSString stringWithFormat:@"typeof(new.\"%@\") IN ('integer', 'real') AND "
+                                   @"typeof(new.\"%@\") IN ('integer', 'real')",
+                                   geoFields[0], geoFields[1]];
+
+    NSArray *statements = @[
+        [NSString stringWithFormat:@"CREATE VIRTUAL TABLE \"%@\" USING rtree ( id, min_lat, max_lat, min_lon, max_lon );",
+                                   rtreeName],
+        [NSString stringWithFormat:@"CREATE TRIGGER \"%@_insert\" AFTER INSERT ON \"%@\" WHEN %@ BEGIN INSERT INTO \"%@\" VALUES ( %@ ); END;",
+                                   rtreeName, tableName, hasPoint, rtreeName, point],
+        [NSString stringWithFormat:@"CREATE TRIGGER \"%@_update\" AFTER UPDATE ON \"%@\" BEGIN DELETE FROM \"%@\" WHERE id = old.rowid; INSERT INTO \"%@\" SELECT %@ WHERE %@; END;",
+                                   rtreeName, tableName, rtreeName, rtreeName, point, hasPoint],
+        [NSString stringWithFormat:@"CREATE TRIGGER \"%@_delete\" AFTER DELETE ON \"%@\" BEGIN DELETE FROM \"%@\" WHERE id = old.rowid; END;",
+                                   rtreeName, tableName, rtreeName]
+    ];
+
+    NSMutableArray *result = [NSMutableArray array];
+    for (NSString *sql in statements) {
+        [result addObject:[CDTQSqlParts partsForSql:sql parameters:@[]]];
+    }
+    return result;
+}
+
 /**
  * This function generates the virtual table create SQL for the specified index.
  * Note:  Any column that contains an '=' will cause the statement to fail
@@ -367,8 +636,8 @@
  *
  * @param indexName the index name to be used when creating the SQLite virtual table
  * @param fieldNames the columns in the table
- * @param indexSettings the special settings to apply to the virtual table -
- *                      (only 'tokenize' is current supported)
+ * @param indexSettings the special settings to apply to the virtual table - 'tokenize',
+ *                      'prefix', and 'module', which chooses an FTS4 or FTS5 table
  * @return the SQL to create the SQLite virtual table
  */
 + (CDTQSqlParts *)createVirtualTableStatementForIndexName:(NSString *)indexName
@@ -389,17 +658,28 @@
         [clauses addObject:[NSString stringWithFormat:@"\"%@\"", fieldName]];
     }
     
-    NSMutableArray *settingsClauses = [NSMutableArray array];
-    for (NSString *parameter in indexSettings.allKeys) {
-        [settingsClauses addObject:[NSString stringWithFormat:@"%@=%@",
-                                    parameter,
-                                    indexSettings[parameter]]];
+    // FTS5 options are quoted strings, and it takes prefix lengths as "2 3" rather than "2,3".
+    BOOL fts5 = [CDTQIndex settingsUseFTS5:indexSettings];
+    NSArray *parameters = [indexSettings.allKeys sortedArrayUsingSelector:@selector(compare:)];
+    for (NSString *parameter in parameters) {
+        NSString *value = [NSString stringWithFormat:@"%@", indexSettings[parameter]];
+        if ([parameter.lowercaseString isEqualToString:@"module"]) {
+            continue;
+        } else if ([parameter.lowercaseString isEqualToString:@"prefix"]) {
+            NSArray *lengths = [CDTQIndex prefixLengthsForSetting:value];
+            value = fts5 ? [NSString stringWithFormat:@"'%@'", [lengths componentsJoinedByString:@" "]]
+                         : [NSString stringWithFormat:@"\"%@\"", [lengths componentsJoinedByString:@","]];
+        } else if (fts5) {
+            value = [NSString stringWithFormat:@"'%@'",
+                     [value stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+        }
+        [clauses addObject:[NSString stringWithFormat:@"%@=%@", parameter, value]];
     }
 
     NSString *sql =
-        [NSString stringWithFormat:@"CREATE VIRTUAL TABLE \"%@\" USING FTS4 ( %@, %@ );", tableName,
-                                   [clauses componentsJoinedByString:@", "],
-                                   [settingsClauses componentsJoinedByString:@", "]];
+        [NSString stringWithFormat:@"CREATE VIRTUAL TABLE \"%@\" USING %@ ( %@ );", tableName,
+                                   fts5 ? @"FTS5" : @"FTS4",
+                                   [clauses componentsJoinedByString:@", "]];
     return [CDTQSqlParts partsForSql:sql parameters:@[]];
 }
 
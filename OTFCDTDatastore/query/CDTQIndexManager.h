@@ -26,6 +26,13 @@ extern NSString *const kCDTQIndexMetadataTableName;
 
 @class CDTDatastore;
 @class CDTQResultSet;
+@class CDTQQueryCursor;
+@class CDTQQueryCache;
+@class CDTQIndexAdvisor;
+@class CDTQueryHandle;
+@class CDTQIndex;
+@class CDTQLiveQuery;
+@class CDTQLiveQueryChanges;
 @class CDTDocumentRevision;
 @class FMDatabaseQueue;
 @class FMDatabase;
@@ -42,9 +49,54 @@ typedef NS_ENUM(NSUInteger, CDTQIndexType) {
      * Denotes the index of type JSON.
      */
     CDTQIndexTypeJSON,
+    /**
+     * Denotes the index is of type multikey: like JSON, but with a row for every combination
+     * of the elements of the arrays the indexed fields pass through, so that $in, $all and
+     * $elemMatch over arrays, and arrays of objects, can use it.
+     */
+    CDTQIndexTypeMultiKey,
+    /**
+     * Denotes the index is of type geo: over two numeric fields, a latitude and a longitude in
+     * degrees, in that order, with an SQLite R*Tree so that $geoWithin searches of a box or a
+     * radius don't scan every row. Needs SQLite's ENABLE_RTREE compile option.
+     */
+    CDTQIndexTypeGeo,
 
 };
 
+/**
+ * Types a JSON index can declare for its fields. A typed field's column only holds values of
+ * its type, so range queries on it compare values of a single kind; values of other types are
+ * indexed as if the field were missing.
+ */
+typedef NS_ENUM(NSUInteger, CDTQFieldType) {
+    /**
+     * Strings.
+     */
+    CDTQFieldTypeText,
+    /**
+     * Numbers with integral values, and booleans, stored as 64-bit integers.
+     */
+    CDTQFieldTypeInteger,
+    /**
+     * Numbers, stored as doubles.
+     */
+    CDTQFieldTypeReal,
+    /**
+     * Dates, as ISO 8601 strings or numbers of milliseconds since 1970, stored as 64-bit
+     * integers of milliseconds since 1970. Queries and sorts on the field compare instants,
+     * whatever their time zones.
+     */
+    CDTQFieldTypeDate,
+};
+
+/**
+ * Computes the value of an expression field from a document body, returning a string, number,
+ * null or an array of them as a JSON field would hold, or nil if the document has no value.
+ * See +registerExpression:withName:.
+ */
+typedef id _Nullable (^CDTQExpressionBlock)(NSDictionary<NSString *, id> *body);
+
 @interface CDTQSqlParts : NSObject
 
 @property (nonatomic, strong) NSString *sqlWithPlaceholders;
@@ -74,7 +126,11 @@ typedef NS_ENUM(NSInteger, CDTQQueryError) {
     /**
      * Key provided could not be used to initialize index manager
      */
-    CDTQIndexErrorEncryptionKeyError = 4
+    CDTQIndexErrorEncryptionKeyError = 4,
+    /**
+     * A query could not be run, for example because it was invalid. The reason is logged.
+     */
+    CDTQQueryErrorQueryFailed = 5
 };
 
 /**
@@ -93,6 +149,38 @@ typedef NS_ENUM(NSInteger, CDTQQueryError) {
 @property (nonatomic, strong) FMDatabaseQueue *database;
 @property (nonatomic, readonly, getter = isTextSearchEnabled) BOOL textSearchEnabled;
 
+/**
+ When YES, indexes are brought up to date on a background queue whenever the datastore
+ changes, rather than only when a query is run. Queries then only have to index whatever
+ changed since the last background update. Defaults to NO.
+ */
+@property (nonatomic, getter = isBackgroundIndexingEnabled) BOOL backgroundIndexingEnabled;
+
+/**
+ When YES, each batch of revisions a pull replication inserts is indexed straight after it's
+ committed, on the replicator's thread, from the revision bodies it already decoded, rather than
+ loaded from the datastore again by a later update. Indexes are then current as soon as the
+ replication finishes, at the cost of a slower pull.
+
+ A batch is only indexed from its revisions while the indexes are up to date with everything
+ before it. Otherwise the indexes are brought up to date from the datastore, as for a query, so
+ the batches after it can be. Defaults to NO.
+ */
+@property (nonatomic, getter = isInlineIndexingEnabled) BOOL inlineIndexingEnabled;
+
+/**
+ Caches the indexes, their statistics and the plans of queries, so running the same query again
+ while the datastore hasn't changed needn't read or translate any of them. Results are cached
+ too once `queryCache.resultCachingEnabled` is set.
+ */
+@property (nonatomic, strong, readonly) CDTQQueryCache *queryCache;
+
+/**
+ Records the shapes of queries run by -find: which are slow, or can't be answered from the
+ indexes alone, so that -suggestedIndexes can name the indexes which would help the most.
+ */
+@property (nonatomic, strong, readonly) CDTQIndexAdvisor *indexAdvisor;
+
 /**
  Constructs a new CDTQIndexManager which indexes documents in `datastore`
  */
@@ -134,10 +222,98 @@ managerUsingDatastore:(CDTDatastore *)datastore
                      ofType:(CDTQIndexType)type
                    settings:(nullable NSDictionary *)indexSettings;
 
+/**
+ Creates a partial index, of only the documents which match `selector`. Queries use it only when
+ their selector requires everything `selector` does. Text indexes can't be partial.
+ */
+- (nullable NSString *)ensureIndexed:(NSArray<NSString *> *)fieldNames
+                            withName:(NSString *)indexName
+                              ofType:(CDTQIndexType)type
+                            settings:(nullable NSDictionary *)indexSettings
+                            selector:(nullable NSDictionary *)selector;
+
+/**
+ Creates a JSON index declaring the types of some of its fields, `fieldTypes` mapping field
+ names to CDTQFieldType numbers. A typed index's table also has an SQLite index leading with
+ its first field, so range and equality queries on that field seek rather than scan.
+ */
+- (nullable NSString *)ensureIndexed:(NSArray<NSString *> *)fieldNames
+                            withName:(NSString *)indexName
+                          fieldTypes:(NSDictionary<NSString *, NSNumber *> *)fieldTypes;
+
+/**
+ Registers a block computing a value from each document, such as a lower-cased name, the date
+ part of a timestamp or the length of an array, so it can be indexed and queried like a field.
+
+ `name` must start with `@` and not contain `.`; it's used in place of a field name, both in
+ the fields of an index and in selectors and sort documents, e.g.
+ `@{ @"@lowerName" : @"mike" }`. The block is run on a document's body when it's indexed, and
+ when a query falls back to matching documents which aren't indexed, so it must be safe to call
+ from any thread and always give the same value for the same body.
+
+ Expressions live for the process, shared by every index manager, and must be registered each
+ time the app starts, before any index using them is created, updated or queried: updating an
+ index over an expression which isn't registered fails. Registering another block under the
+ same name doesn't reindex documents already indexed; delete and recreate the indexes using it.
+
+ @return NO if the name isn't a valid expression name.
+ */
++ (BOOL)registerExpression:(CDTQExpressionBlock)expression withName:(NSString *)name;
+
++ (void)unregisterExpressionNamed:(NSString *)name;
+
+/**
+ Creates several indexes at once. Their definitions are all checked before any is created, and
+ the new ones are then filled by a single pass over the datastore, with their SQLite indexes
+ created once they're full, which is much quicker than creating them one at a time.
+
+ @return the names of the indexes, in the order given, or nil if any of them is invalid or
+         couldn't be created.
+ */
+- (nullable NSArray<NSString *> *)ensureIndexes:(NSArray<CDTQIndex *> *)indexes;
+
 - (BOOL)deleteIndexNamed:(NSString *)indexName;
 
+/**
+ The fields of the JSON indexes indexAdvisor suggests, each as passed to -ensureIndexed:, for the
+ costliest recorded queries first.
+ */
+- (NSArray<NSArray<NSString *> *> *)suggestedIndexes;
+
+/**
+ Creates the indexes -suggestedIndexes names, costliest first, until there are `budget` indexes
+ created this way. They're named `advised_` followed by a digest of their fields, and count
+ against the budget on later calls too, so calling this as the app starts adds no more than
+ `budget` indexes over the life of the datastore; delete some to make room. Indexes the limits on
+ index types wouldn't allow are skipped.
+
+ @return the names of the indexes created, or nil if they couldn't be.
+ */
+- (nullable NSArray<NSString *> *)ensureSuggestedIndexesWithBudget:(NSUInteger)budget;
+
 - (BOOL)updateAllIndexes;
 
+- (NSDictionary<NSString *, NSNumber *> *)indexSequenceLag;
+
+/**
+ Merges each text index into a single segment, so searches read it as quickly as they can.
+ Updates already merge text indexes a little at a time; this does all of it at once, and
+ takes a while for a large index, so is best run once a big change has been indexed.
+ */
+- (BOOL)optimizeTextIndexes;
+
+/**
+ Re-encrypts the index database with the key returned by the provider, which it is opened with
+ from then on, as part of -[CDTDatastore rekeyWithEncryptionKeyProvider:progress:error:]. Other
+ managers open on the same datastore can't read the database once it has its new key, so have
+ to be created again.
+ */
+- (BOOL)rekeyWithEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
+                                 error:(NSError *__autoreleasing *)error;
+
+/** YES if indexes have ever been created for the datastore, so it has an index database. */
++ (BOOL)hasIndexDatabaseForDatastore:(CDTDatastore *)datastore;
+
 - (nullable CDTQResultSet *)find:(NSDictionary *)query;
 
 - (nullable CDTQResultSet *)find:(NSDictionary *)query
@@ -146,12 +322,116 @@ managerUsingDatastore:(CDTDatastore *)datastore
                           fields:(nullable NSArray *)fields
                             sort:(nullable NSArray *)sortDocument;
 
+- (nullable CDTQResultSet *)find:(NSDictionary *)query
+                           limit:(NSUInteger)limit
+                          fields:(nullable NSArray *)fields
+                            sort:(nullable NSArray *)sortDocument
+                           after:(nullable CDTQQueryCursor *)cursor;
+
+/**
+ Runs a query which can be abandoned by cancelling `handle`, or by its time budget running out,
+ such as a search which is superseded as the user types. A cancelled query stops its SQL and
+ returns nil, giving up the index database quickly, and enumerating its results stops at the
+ next document once the handle is cancelled.
+
+ A result served from the result cache is returned under the handle too.
+
+ @param cursor the nextPageCursor of an earlier page of the query's results, or nil.
+ @param handle the handle to stop the query with, or nil for one which can't be stopped.
+ */
+- (nullable CDTQResultSet *)find:(NSDictionary *)query
+                            skip:(NSUInteger)skip
+                           limit:(NSUInteger)limit
+                          fields:(nullable NSArray *)fields
+                            sort:(nullable NSArray *)sortDocument
+                           after:(nullable CDTQQueryCursor *)cursor
+                          handle:(nullable CDTQueryHandle *)handle;
+
+/**
+ Counts the documents matching a query, in SQL when the indexes cover the query.
+
+ @return the count, or NSNotFound if there was an error.
+ */
+- (NSUInteger)count:(NSDictionary *)query;
+
+/**
+ Returns those of `documentIds` whose documents match `selector`. When the indexes cover the
+ selector the matches are found in SQL, and no documents are loaded.
+
+ @return the matching IDs, or nil if there was an error.
+ */
+- (nullable NSSet<NSString *> *)documentIdsMatching:(NSDictionary *)selector
+                                              among:(NSArray<NSString *> *)documentIds;
+
+/**
+ Calculates aggregates of indexed fields over the documents matching a query, optionally
+ grouped by the values of another field:
+
+     [im aggregate:@{ @"type" : @"order" }
+        aggregates:@{ @"total" : @{ @"$sum" : @"price" }, @"orders" : @{ @"$count" : @"_id" } }
+           groupBy:@"status"];
+
+ Each aggregate is one of `$sum`, `$min` or `$max` of a field, or `$count`, the number of
+ documents with a value for a field. Each element of an array field is aggregated, and
+ documents are grouped under each element of an array groupBy field. The result has a
+ dictionary for each group, in order of the group's value, containing the value of the groupBy
+ field and of each aggregate; without groupBy there's a single dictionary.
+
+ The aggregates are run in SQL over the JSON index with the fewest fields that contains the
+ groupBy field and every aggregated field. The query must be covered by indexes.
+
+ @return the results, or nil if there was an error.
+ */
+- (nullable NSArray<NSDictionary *> *)aggregate:(NSDictionary *)query
+                                     aggregates:(NSDictionary<NSString *, NSDictionary *> *)aggregates
+                                        groupBy:(nullable NSString *)groupField;
+
+- (nullable NSDictionary *)explain:(NSDictionary *)query;
+
+- (nullable NSDictionary *)explain:(NSDictionary *)query sort:(nullable NSArray *)sortDocument;
+
+/**
+ Runs a query and keeps its results up to date as the datastore changes, calling `handler` on
+ `queue` with the initial results, then with how they change. Only the documents which change
+ are matched against the selector, rather than running the whole query again.
+
+ The live query keeps running until it's stopped or deallocated, so the caller must keep it.
+
+ @param queue the queue to call the handler on; the main queue if nil.
+ @return the live query, or nil if the query or sort document is invalid or the query contains
+         a text search, which can't be matched against single documents.
+ */
+- (nullable CDTQLiveQuery *)liveQuery:(NSDictionary *)query
+                                 sort:(nullable NSArray *)sortDocument
+                                queue:(nullable dispatch_queue_t)queue
+                              handler:(void (^)(CDTQLiveQueryChanges *changes))handler;
+
 /** Internal */
 + (NSString *)tableNameForIndex:(NSString *)indexName;
 + (CDTQIndexType)indexTypeForString:(NSString *)string;
 + (NSString *)stringForIndexType:(CDTQIndexType)indexType;
+/** Internal: the name a field type is stored under, or nil if it isn't a CDTQFieldType. */
++ (nullable NSString *)stringForFieldType:(CDTQFieldType)fieldType;
 /** Internal */
 + (BOOL)ftsAvailableInDatabase:(FMDatabaseQueue *)db;
+/** Internal */
++ (BOOL)fts5AvailableInDatabase:(FMDatabaseQueue *)db;
+/** Internal: whether a -listIndexes entry is a text index using FTS5. */
++ (BOOL)isFTS5TextIndex:(NSDictionary *)indexDetails;
+/** Internal */
++ (BOOL)rtreeAvailableInDatabase:(FMDatabaseQueue *)db;
+/** Internal: the R*Tree table holding the points of a geo index. */
++ (NSString *)rtreeTableNameForIndex:(NSString *)indexName;
+/**
+ Internal: the latitude and longitude fields of a -listIndexes entry for a geo index, or nil if
+ it isn't one.
+ */
++ (nullable NSArray<NSString *> *)geoFieldNamesOfIndex:(NSDictionary *)indexDetails;
+/**
+ Internal: the collation sequence a -listIndexes entry's strings sort with, or nil if they sort
+ by binary comparison.
+ */
++ (nullable NSString *)collationOfIndex:(nullable NSDictionary *)indexDetails;
 
 @end
 NS_ASSUME_NONNULL_END
@@ -41,6 +41,22 @@
 // N.b.: _id and _rev are automatically added to all indexes to allow them to be used to
 // project CDTDocumentRevisions without the need to load a document from the datastore.
 //
+// The metadata's `covering` column is 1 while every value in a JSON index is exactly as it is in
+// its document, so queries projecting only indexed fields can be answered from the index alone.
+// It's cleared for good when an array, object or boolean value is indexed.
+//
+// A partial index's `partial_selector` column holds the normalised selector, as JSON, which a
+// document must match to be indexed. It's NULL for indexes of every document.
+//
+// The `field_type` column holds the type declared for the field, `text`, `integer`, `real` or
+// `date`, or NULL for an untyped field. Typed fields' columns are declared with the matching
+// affinity and hold normalised values: see CDTQIndex +value:normalisedForFieldType:.
+//
+// A geo index's table is like a JSON index's, its settings naming which of its two fields is the
+// latitude and which the longitude. Triggers on the table keep an R*Tree table of the rows'
+// points alongside it, keyed by rowid, so that $geoWithin can find the rows near a point without
+// scanning the table. Rows without a numeric latitude and longitude have no point.
+//
 
 #import "CDTQIndexManager.h"
 
@@ -49,6 +65,14 @@
 #import "CDTQIndexUpdater.h"
 #import "CDTQQueryExecutor.h"
 #import "CDTQIndexCreator.h"
+#import "CDTQIndexStatistics.h"
+#import "CDTQQueryCache.h"
+#import "CDTQIndexAdvisor.h"
+#import "CDTQValueExtractor.h"
+#import "CDTQLiveQuery.h"
+#import "CDTQQueryValidator.h"
+#import "CDTQQueryConstants.h"
+#import "CDTQQuerySqlTranslator.h"
 #import "CDTLogging.h"
 
 #import "CDTEncryptionKeyProvider.h"
@@ -56,6 +80,8 @@
 
 #import "TD_Database.h"
 #import "TD_Body.h"
+#import "TDMisc.h"
+#import "TDDatabaseQueue.h"
 
 #import "FMDatabase+EncryptionKey.h"
 
@@ -63,24 +89,111 @@
 #import <fmdb/FMDB.h>
 
 #import <objc/runtime.h>
+#import <sqlite3.h>
 
 NSString *const CDTQIndexManagerErrorDomain = @"CDTIndexManagerErrorDomain";
 
 NSString *const kCDTQIndexTablePrefix = @"_t_cloudant_sync_query_index_";
 NSString *const kCDTQIndexMetadataTableName = @"_t_cloudant_sync_query_metadata";
+static NSString *const kCDTQGeoTablePrefix = @"_t_cloudant_sync_query_rtree_";
 
 static NSString *const kCDTQExtensionName = @"com.cloudant.sync.query";
 static NSString *const kCDTQIndexFieldNamePattern = @"^[a-zA-Z][a-zA-Z0-9_]*$";
 
-static const int VERSION = 2;
+static const int VERSION = 5;
+
+// Prefix of the names of the indexes -ensureSuggestedIndexesWithBudget: creates
+static NSString *const kCDTQAdvisedIndexPrefix = @"advised_";
+
+// Most document IDs -documentIdsMatching:among: puts in an $in clause
+static const NSUInteger kCDTQDocumentIdLookupLimit = 500;
 
 @interface CDTQIndexManager ()
 
 @property (nonatomic, strong) NSRegularExpression *validFieldName;
 @property (readwrite) BOOL textSearchEnabled;
 
+/** Serialises index creation, deletion and updates, so concurrent updaters can't interleave. */
+@property (nonatomic, strong) NSObject *updateLock;
+@property (nonatomic, strong) dispatch_queue_t backgroundIndexingQueue;
+/** YES while a background update has been queued but hasn't started yet. */
+@property (nonatomic) BOOL backgroundUpdatePending;
+/** Index name -> CDTQIndexStatistics, refreshed as indexes change; guarded by updateLock. */
+@property (nonatomic, strong) NSMutableDictionary *statistics;
+@property (nonatomic, strong, readwrite) CDTQQueryCache *queryCache;
+@property (nonatomic, strong, readwrite) CDTQIndexAdvisor *indexAdvisor;
+/** The index database's data_version when the query cache was last used; guarded by updateLock. */
+@property (nonatomic) int64_t dataVersion;
+
 @end
 
+/**
+ cdtq_geo_distance(lat1, lon1, lat2, lon2): the distance in metres between two points given in
+ degrees, or NULL if any of the four isn't a number.
+ */
+static void CDTQGeoDistanceFunction(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    double degrees[4];
+    for (int i = 0; i < 4; i++) {
+        int type = sqlite3_value_type(argv[i]);
+        if (type != SQLITE_INTEGER && type != SQLITE_FLOAT) {
+            sqlite3_result_null(context);
+            return;
+        }
+        degrees[i] = sqlite3_value_double(argv[i]);
+    }
+    sqlite3_result_double(context, [CDTQQuerySqlTranslator metresFromLatitude:degrees[0]
+                                                                     longitude:degrees[1]
+                                                                    toLatitude:degrees[2]
+                                                                     longitude:degrees[3]]);
+}
+
+/**
+ Compares UTF-8 strings as -localizedCompare: does, for the locale passed as `context`, so the
+ order SQLite sorts an index's strings in is the one its users expect.
+ */
+static int CDTQLocalizedCollation(void *context, int length1, const void *bytes1, int length2,
+                                  const void *bytes2)
+{
+    @autoreleasepool {
+        NSString *string1 = [[NSString alloc] initWithBytesNoCopy:(void *)bytes1
+                                                           length:length1
+                                                         encoding:NSUTF8StringEncoding
+                                                     freeWhenDone:NO];
+        NSString *string2 = [[NSString alloc] initWithBytesNoCopy:(void *)bytes2
+                                                           length:length2
+                                                         encoding:NSUTF8StringEncoding
+                                                     freeWhenDone:NO];
+        if (!string1 || !string2) {
+            // Not valid UTF-8, so fall back to the binary order SQLite would have used.
+            int result = memcmp(bytes1, bytes2, MIN(length1, length2));
+            return result != 0 ? result : length1 - length2;
+        }
+        return (int)[string1 compare:string2
+                             options:0
+                               range:NSMakeRange(0, string1.length)
+                              locale:(__bridge NSLocale *)context];
+    }
+}
+
+static void CDTQReleaseLocale(void *context) { CFBridgingRelease(context); }
+
+/**
+ Registers the collation sequences of the indexes' locales as statements first use them, so
+ each database connection only defines the ones it needs.
+ */
+static void CDTQCollationNeeded(void *unused, sqlite3 *db, int textRep, const char *name)
+{
+    NSString *sequence = [NSString stringWithUTF8String:name];
+    if (![sequence hasPrefix:kCDTQCollationSequencePrefix]) {
+        return;
+    }
+    NSString *identifier = [sequence substringFromIndex:kCDTQCollationSequencePrefix.length];
+    NSLocale *locale = [NSLocale localeWithLocaleIdentifier:identifier];
+    sqlite3_create_collation_v2(db, name, SQLITE_UTF8, (void *)CFBridgingRetain(locale),
+                                CDTQLocalizedCollation, CDTQReleaseLocale);
+}
+
 @implementation CDTQSqlParts
 
 + (CDTQSqlParts *)partsForSql:(NSString *)sql parameters:(NSArray *)parameters
@@ -119,6 +232,17 @@ static const int VERSION = 2;
                                                      options:0
                                                        error:error];
             _textSearchEnabled = [CDTQIndexManager ftsAvailableInDatabase:_database];
+            _updateLock = [[NSObject alloc] init];
+            _statistics = [NSMutableDictionary dictionary];
+            _queryCache = [[CDTQQueryCache alloc] init];
+            _indexAdvisor = [[CDTQIndexAdvisor alloc] init];
+
+            // Purged documents leave no change to index, so their rows must go whether or not
+            // we're indexing in the background.
+            [[NSNotificationCenter defaultCenter] addObserver:self
+                                                     selector:@selector(documentsPurged:)
+                                                         name:TD_DatabasePurgedNotification
+                                                       object:datastore.database];
         } else {
             self = nil;
         }
@@ -129,11 +253,173 @@ static const int VERSION = 2;
 
 - (void)dealloc
 {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+
     // close the database.
     os_log_debug(CDTOSLog, "-dealloc CDTQIndexManager %{public}@", self);
     [self.database close];
 }
 
+#pragma mark Background indexing
+
+- (void)setBackgroundIndexingEnabled:(BOOL)enabled
+{
+    @synchronized(self)
+    {
+        if (enabled == _backgroundIndexingEnabled) {
+            return;
+        }
+        BOOL wasObserving = _backgroundIndexingEnabled || _inlineIndexingEnabled;
+        _backgroundIndexingEnabled = enabled;
+
+        if (enabled) {
+            if (!_backgroundIndexingQueue) {
+                _backgroundIndexingQueue = dispatch_queue_create(
+                    "com.cloudant.sync.query.indexing",
+                    dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL,
+                                                            QOS_CLASS_UTILITY, 0));
+            }
+            // Catch up with anything that changed while we weren't watching.
+            [self scheduleBackgroundUpdate];
+        }
+        [self observeChanges:enabled || _inlineIndexingEnabled wasObserving:wasObserving];
+    }
+}
+
+- (void)setInlineIndexingEnabled:(BOOL)enabled
+{
+    @synchronized(self)
+    {
+        if (enabled == _inlineIndexingEnabled) {
+            return;
+        }
+        BOOL wasObserving = _backgroundIndexingEnabled || _inlineIndexingEnabled;
+        _inlineIndexingEnabled = enabled;
+        [self observeChanges:enabled || _backgroundIndexingEnabled wasObserving:wasObserving];
+    }
+}
+
+- (void)observeChanges:(BOOL)observe wasObserving:(BOOL)wasObserving
+{
+    NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+    if (observe && !wasObserving) {
+        [center addObserver:self
+                   selector:@selector(databaseChanged:)
+                       name:TD_DatabaseChangeNotification
+                     object:self.datastore.database];
+    } else if (!observe && wasObserving) {
+        [center removeObserver:self name:TD_DatabaseChangeNotification object:nil];
+    }
+}
+
+- (void)databaseChanged:(NSNotification *)n
+{
+    // Only pulled revisions have a source.
+    if (self.isInlineIndexingEnabled && n.userInfo[@"source"]) {
+        // Reading the changes instead catches the indexes up, so the next batch can be inline.
+        if (![self indexCommittedRevisions:n.userInfo[@"revs"] winners:n.userInfo[@"winners"]] &&
+            ![self updateAllIndexes]) {
+            os_log_error(CDTOSLog, "Inline update of indexes failed");
+        }
+        return;
+    }
+    [self scheduleBackgroundUpdate];
+}
+
+- (void)documentsPurged:(NSNotification *)n
+{
+    NSArray<NSString *> *docIds = n.userInfo[@"docIDs"];
+    if (docIds.count == 0) {
+        return;
+    }
+
+    @synchronized(_updateLock)
+    {
+        CDTQIndexUpdater *updater =
+            [[CDTQIndexUpdater alloc] initWithDatabase:_database datastore:_datastore];
+        if (![updater deleteIndexEntriesForDocIds:docIds fromIndexes:[self listIndexes].allKeys]) {
+            os_log_error(CDTOSLog, "Removing purged documents from indexes failed");
+        }
+        // The last sequence didn't move, so cached results would still be served.
+        [_queryCache removeAllObjects];
+    }
+}
+
+/**
+ Indexes a batch of revisions from a change notification, which is posted on the thread that
+ committed them. Returns NO if they weren't indexed: see CDTQIndexUpdater
+ -updateAllIndexes:withWinners:committedFromSequence:toSequence:.
+ */
+- (BOOL)indexCommittedRevisions:(NSArray<TD_Revision *> *)revs winners:(NSArray *)winners
+{
+    if (revs.count == 0 || winners.count != revs.count) {
+        return NO;
+    }
+
+    SequenceNumber firstSequence = LLONG_MAX, lastSequence = 0;
+    NSMutableArray *winningRevisions = [NSMutableArray array];
+    for (NSUInteger i = 0; i < revs.count; i++) {
+        firstSequence = MIN(firstSequence, revs[i].sequence);
+        lastSequence = MAX(lastSequence, revs[i].sequence);
+
+        TD_Revision *winner = [winners[i] isKindOfClass:[TD_Revision class]] ? winners[i] : nil;
+        if (!winner) {
+            continue;  // the document's winner didn't change
+        }
+        if (!winner.deleted && !winner.body) {
+            return NO;  // an older revision, left winning by a deletion, which wasn't loaded
+        }
+        [winningRevisions addObject:[[CDTDocumentRevision alloc] initWithDocId:winner.docID
+                                                                    revisionId:winner.revID
+                                                                          body:winner.body.properties
+                                                                       deleted:winner.deleted
+                                                                   attachments:@{}
+                                                                      sequence:winner.sequence]];
+    }
+    // Committed in one transaction, a batch holds every sequence in its range.
+    if (firstSequence <= 0 || lastSequence - firstSequence + 1 != (SequenceNumber)revs.count) {
+        return NO;
+    }
+
+    @synchronized(_updateLock)
+    {
+        CDTQIndexUpdater *updater =
+            [[CDTQIndexUpdater alloc] initWithDatabase:_database datastore:_datastore];
+        return [updater updateAllIndexes:[self listIndexes]
+                             withWinners:winningRevisions
+                   committedFromSequence:firstSequence
+                              toSequence:lastSequence];
+    }
+}
+
+/**
+ Queues an update of all the indexes, unless one is already queued and yet to start, in which
+ case that one will see this change too. Bursts of changes (e.g., from a replication) therefore
+ cost a few incremental updates, not one per change.
+ */
+- (void)scheduleBackgroundUpdate
+{
+    @synchronized(self)
+    {
+        if (!_backgroundIndexingEnabled || _backgroundUpdatePending) {
+            return;
+        }
+        _backgroundUpdatePending = YES;
+    }
+
+    __weak CDTQIndexManager *weakSelf = self;
+    dispatch_async(self.backgroundIndexingQueue, ^{
+        CDTQIndexManager *strongSelf = weakSelf;
+        if (!strongSelf) {
+            return;
+        }
+        @synchronized(strongSelf) { strongSelf.backgroundUpdatePending = NO; }
+        if (strongSelf.isBackgroundIndexingEnabled && ![strongSelf updateAllIndexes]) {
+            os_log_error(CDTOSLog, "Background update of indexes failed");
+        }
+    });
+}
+
 #pragma mark List indexes
 
 /**
@@ -167,7 +453,8 @@ static const int VERSION = 2;
 
     NSMutableDictionary *indexes = [NSMutableDictionary dictionary];
 
-    NSString *sql = @"SELECT index_name, index_type, field_name, index_settings FROM %@;";
+    NSString *sql = @"SELECT index_name, index_type, field_name, index_settings, covering, "
+                    @"partial_selector, field_type FROM %@;";
     sql = [NSString stringWithFormat:sql, kCDTQIndexMetadataTableName];
     FMResultSet *rs = [db executeQuery:sql];
     while ([rs next]) {
@@ -175,21 +462,32 @@ static const int VERSION = 2;
         NSString *rowType = [rs stringForColumn:@"index_type"];
         NSString *rowField = [rs stringForColumn:@"field_name"];
         NSString *rowSettings = [rs stringForColumn:@"index_settings"];
+        BOOL rowCovering = [rs boolForColumn:@"covering"];
+        NSData *rowSelector = [rs dataForColumn:@"partial_selector"];
+        NSString *rowFieldType = [rs stringForColumn:@"field_type"];
 
         if (indexes[rowIndex] == nil) {
-            if (rowSettings) {
-                indexes[rowIndex] = @{@"type" : rowType,
-                                      @"name" : rowIndex,
-                                      @"fields" : [NSMutableArray array],
-                                      @"settings" : rowSettings};
-            } else {
-                indexes[rowIndex] = @{@"type" : rowType,
-                                      @"name" : rowIndex,
-                                      @"fields" : [NSMutableArray array]};
+            NSMutableDictionary *details = [@{@"type" : rowType,
+                                              @"name" : rowIndex,
+                                              @"fields" : [NSMutableArray array],
+                                              @"covering" : @(rowCovering)} mutableCopy];
+            details[@"settings"] = rowSettings;
+            if (rowSelector) {
+                details[@"selector"] =
+                    [NSJSONSerialization JSONObjectWithData:rowSelector options:0 error:nil];
             }
+            indexes[rowIndex] = details;
         }
 
         [indexes[rowIndex][@"fields"] addObject:rowField];
+        if (rowFieldType) {
+            NSMutableDictionary *fieldTypes = indexes[rowIndex][@"fieldTypes"];
+            if (!fieldTypes) {
+                fieldTypes = [NSMutableDictionary dictionary];
+                indexes[rowIndex][@"fieldTypes"] = fieldTypes;
+            }
+            fieldTypes[rowField] = rowFieldType;
+        }
     }
     [rs close];
 
@@ -197,20 +495,11 @@ static const int VERSION = 2;
 
     for (NSString *indexName in [indexes allKeys]) {
         NSMutableDictionary *details = indexes[indexName];
-        if (details[@"settings"]) {
-            indexes[indexName] = @{
-                @"type" : details[@"type"],
-                @"name" : details[@"name"],
-                @"fields" : [details[@"fields"] copy],  // -copy makes arrays immutable
-                @"settings" : details[@"settings"]
-            };
-        } else {
-            indexes[indexName] = @{
-                @"type" : details[@"type"],
-                @"name" : details[@"name"],
-                @"fields" : [details[@"fields"] copy]  // -copy makes arrays immutable
-            };
+        details[@"fields"] = [details[@"fields"] copy];  // -copy makes arrays immutable
+        if (details[@"fieldTypes"]) {
+            details[@"fieldTypes"] = [details[@"fieldTypes"] copy];
         }
+        indexes[indexName] = [details copy];
     }
 
     return [NSDictionary dictionaryWithDictionary:indexes];  // make dictionary immutable
@@ -243,9 +532,13 @@ static const int VERSION = 2;
  */
 - (NSString *)ensureIndexed:(NSArray * /* NSString */)fieldNames withName:(NSString *)indexName
 {
-    return [CDTQIndexCreator ensureIndexed:[CDTQIndex index:indexName withFields:fieldNames]
-                                inDatabase:_database
-                             fromDatastore:_datastore];
+    @synchronized(_updateLock)
+    {
+        [_queryCache removeAllObjects];
+        return [CDTQIndexCreator ensureIndexed:[CDTQIndex index:indexName withFields:fieldNames]
+                                    inDatabase:_database
+                                 fromDatastore:_datastore];
+    }
 }
 
 #pragma mark Deprecated methods
@@ -298,12 +591,54 @@ static const int VERSION = 2;
                      ofType:(CDTQIndexType)type
                    settings:(NSDictionary *)indexSettings
 {
-    return [CDTQIndexCreator ensureIndexed:[CDTQIndex index:indexName
-                                                 withFields:fieldNames
-                                                       type:type
-                                               withSettings:indexSettings]
-                                inDatabase:_database
-                             fromDatastore:_datastore];
+    return [self ensureIndexed:fieldNames
+                      withName:indexName
+                        ofType:type
+                      settings:indexSettings
+                      selector:nil];
+}
+
+- (NSString *)ensureIndexed:(NSArray<NSString *> *)fieldNames
+                   withName:(NSString *)indexName
+                     ofType:(CDTQIndexType)type
+                   settings:(NSDictionary *)indexSettings
+                   selector:(NSDictionary *)selector
+{
+    @synchronized(_updateLock)
+    {
+        [_queryCache removeAllObjects];
+        return [CDTQIndexCreator ensureIndexed:[CDTQIndex index:indexName
+                                                     withFields:fieldNames
+                                                           type:type
+                                                   withSettings:indexSettings
+                                                       selector:selector]
+                                    inDatabase:_database
+                                 fromDatastore:_datastore];
+    }
+}
+
+- (NSString *)ensureIndexed:(NSArray<NSString *> *)fieldNames
+                   withName:(NSString *)indexName
+                 fieldTypes:(NSDictionary<NSString *, NSNumber *> *)fieldTypes
+{
+    @synchronized(_updateLock)
+    {
+        [_queryCache removeAllObjects];
+        return [CDTQIndexCreator ensureIndexed:[CDTQIndex index:indexName
+                                                     withFields:fieldNames
+                                                     fieldTypes:fieldTypes]
+                                    inDatabase:_database
+                                 fromDatastore:_datastore];
+    }
+}
+
+- (NSArray<NSString *> *)ensureIndexes:(NSArray<CDTQIndex *> *)indexes
+{
+    @synchronized(_updateLock)
+    {
+        [_queryCache removeAllObjects];
+        return [CDTQIndexCreator ensureIndexes:indexes inDatabase:_database fromDatastore:_datastore];
+    }
 }
 
 + (CDTQIndexType)indexTypeForString:(NSString *)string
@@ -312,16 +647,36 @@ static const int VERSION = 2;
         return CDTQIndexTypeText;
     } else if ([string isEqualToString:@"json"]) {
         return CDTQIndexTypeJSON;
+    } else if ([string isEqualToString:@"multikey"]) {
+        return CDTQIndexTypeMultiKey;
+    } else if ([string isEqualToString:@"geo"]) {
+        return CDTQIndexTypeGeo;
     } else {
         @throw [NSException exceptionWithName:@"InvalidIndexException"
                                        reason:@"Index type provided is not a valid index type."
                                      userInfo:@{
-                                         @"Expected" : @"text or json",
+                                         @"Expected" : @"text, json, multikey or geo",
                                          @"Actual" : string
                                      }];
     }
 }
 
++ (NSString *)stringForFieldType:(CDTQFieldType)fieldType
+{
+    switch (fieldType) {
+        case CDTQFieldTypeText:
+            return @"text";
+        case CDTQFieldTypeInteger:
+            return @"integer";
+        case CDTQFieldTypeReal:
+            return @"real";
+        case CDTQFieldTypeDate:
+            return @"date";
+        default:
+            return nil;
+    }
+}
+
 + (NSString *)stringForIndexType:(CDTQIndexType)indexType
 {
     switch (indexType) {
@@ -329,20 +684,78 @@ static const int VERSION = 2;
             return @"text";
         case CDTQIndexTypeJSON:
             return @"json";
+        case CDTQIndexTypeMultiKey:
+            return @"multikey";
+        case CDTQIndexTypeGeo:
+            return @"geo";
         default:
             @throw [NSException exceptionWithName:@"InvalidIndexException"
                                            reason:@"Index type provided is not a valid index type."
                                          userInfo:@{
-                                             @"Expected" : @"CDTQIndexTypeText (int value 0) or "
-                                                           @"CDTQIndexTypeJSON (int value 1)",
+                                             @"Expected" : @"CDTQIndexTypeText (int value 0), "
+                                                           @"CDTQIndexTypeJSON (int value 1), "
+                                                           @"CDTQIndexTypeMultiKey (int value 2) or "
+                                                           @"CDTQIndexTypeGeo (int value 3)",
                                              @"Actual" : @(indexType)
                                          }];
     }
 }
 
+#pragma mark Index advice
+
+- (NSArray<NSArray<NSString *> *> *)suggestedIndexes
+{
+    return [_indexAdvisor suggestedIndexesForIndexes:[self listIndexes]];
+}
+
+- (NSArray<NSString *> *)ensureSuggestedIndexesWithBudget:(NSUInteger)budget
+{
+    NSDictionary *existingIndexes = [self listIndexes];
+    NSUInteger advisedCount = 0;
+    for (NSString *name in existingIndexes) {
+        if ([name hasPrefix:kCDTQAdvisedIndexPrefix]) {
+            advisedCount++;
+        }
+    }
+
+    NSMutableArray<CDTQIndex *> *indexes = [NSMutableArray array];
+    for (NSArray<NSString *> *fieldNames in
+         [_indexAdvisor suggestedIndexesForIndexes:existingIndexes]) {
+        if (advisedCount + indexes.count >= budget) {
+            break;
+        }
+        // Named by its fields, so the same suggestion always makes the same index.
+        NSData *fields = [[fieldNames componentsJoinedByString:@","]
+            dataUsingEncoding:NSUTF8StringEncoding];
+        NSString *indexName = [kCDTQAdvisedIndexPrefix
+            stringByAppendingString:[TDHexSHA1Digest(fields) substringToIndex:12]];
+        CDTQIndex *index = [CDTQIndex index:indexName withFields:fieldNames type:CDTQIndexTypeJSON];
+        if (!index || [CDTQIndexCreator indexLimitReached:index basedOnIndexes:existingIndexes]) {
+            continue;
+        }
+        [indexes addObject:index];
+    }
+    if (indexes.count == 0) {
+        return @[];
+    }
+
+    os_log_info(CDTOSLog, "Creating %{public}lu suggested indexes", (unsigned long)indexes.count);
+    return [self ensureIndexes:indexes];
+}
+
 #pragma mark Delete Indexes
 
 - (BOOL)deleteIndexNamed:(NSString *)indexName
+{
+    @synchronized(_updateLock)
+    {
+        [_statistics removeObjectForKey:indexName];
+        [_queryCache removeAllObjects];
+        return [self deleteIndexNamedLocked:indexName];
+    }
+}
+
+- (BOOL)deleteIndexNamedLocked:(NSString *)indexName
 {
     __block BOOL success = YES;
 
@@ -351,9 +764,12 @@ static const int VERSION = 2;
         NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
         NSString *sql;
 
-        // Drop the index table
+        // Drop the index table, and a geo index's R*Tree; the triggers go with the table
         sql = [NSString stringWithFormat:@"DROP TABLE \"%@\";", tableName];
         success = success && [db executeUpdate:sql withArgumentsInArray:@[]];
+        sql = [NSString stringWithFormat:@"DROP TABLE IF EXISTS \"%@\";",
+                                         [CDTQIndexManager rtreeTableNameForIndex:indexName]];
+        success = success && [db executeUpdate:sql withArgumentsInArray:@[]];
 
         // Delete the metadata entries
         sql = [NSString
@@ -377,9 +793,87 @@ static const int VERSION = 2;
 
     // To start with, assume top-level fields only
 
-    NSDictionary *indexes = [self listIndexes];
-    return
-        [CDTQIndexUpdater updateAllIndexes:indexes inDatabase:_database fromDatastore:_datastore];
+    // Held for the whole update, so a query waits for a background update that's in progress
+    // and then only indexes what's changed since, rather than racing it over the same changes.
+    @synchronized(_updateLock)
+    {
+        NSDictionary *indexes = [self listIndexes];
+        return [CDTQIndexUpdater updateAllIndexes:indexes
+                                       inDatabase:_database
+                                    fromDatastore:_datastore];
+    }
+}
+
+- (BOOL)optimizeTextIndexes
+{
+    @synchronized(_updateLock)
+    {
+        NSDictionary *indexes = [self listIndexes];
+        __block BOOL success = YES;
+        for (NSString *indexName in indexes) {
+            if (![indexes[indexName][@"type"] isEqualToString:@"text"]) {
+                continue;
+            }
+            // Merges every segment of the full-text index into one, same for FTS4 and FTS5.
+            NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+            NSString *sql = [NSString
+                stringWithFormat:@"INSERT INTO \"%@\" (\"%@\") VALUES ('optimize');", tableName,
+                                 tableName];
+            [_database inDatabase:^(FMDatabase *db) {
+                success = success && [db executeUpdate:sql];
+            }];
+            if (!success) {
+                os_log_error(CDTOSLog, "Failed to optimize text index %{public}@", indexName);
+                break;
+            }
+        }
+        return success;
+    }
+}
+
+- (BOOL)rekeyWithEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
+                                 error:(NSError *__autoreleasing *)error
+{
+    @synchronized(_updateLock)
+    {
+        __block BOOL success = NO;
+        __block NSError *thisError = nil;
+        [_database inDatabase:^(FMDatabase *db) {
+            success = [db rekeyWithProvider:provider error:&thisError];
+        }];
+        if (!success && error) {
+            *error = thisError;
+        }
+        return success;
+    }
+}
+
+- (NSDictionary<NSString *, NSNumber *> *)indexSequenceLag
+{
+    __block NSDictionary *sequences = nil;
+    [_database inDatabase:^(FMDatabase *db) {
+        sequences = [CDTQIndexManager lastSequencesInDatabase:db];
+    }];
+
+    // Read after the indexes' sequences, so an update racing us can only overstate the lag.
+    SequenceNumber lastSequence = _datastore.database.lastSequence;
+    NSMutableDictionary *lag = [NSMutableDictionary dictionary];
+    for (NSString *indexName in sequences) {
+        lag[indexName] = @(MAX(lastSequence - [sequences[indexName] longLongValue], 0));
+    }
+    return [NSDictionary dictionaryWithDictionary:lag];
+}
+
+#pragma mark Expressions
+
++ (BOOL)registerExpression:(CDTQExpressionBlock)expression withName:(NSString *)name
+{
+    return [CDTQValueExtractor registerExpression:expression withName:name];
+}
+
++ (void)unregisterExpressionNamed:(NSString *)name
+{
+    [CDTQValueExtractor unregisterExpressionNamed:name];
 }
 
 #pragma mark Query indexes
@@ -394,24 +888,341 @@ static const int VERSION = 2;
                   limit:(NSUInteger)limit
                  fields:(NSArray *)fields
                    sort:(NSArray *)sortDocument
+{
+    return [self find:query skip:skip limit:limit fields:fields sort:sortDocument after:nil];
+}
+
+- (CDTQResultSet *)find:(NSDictionary *)query
+                  limit:(NSUInteger)limit
+                 fields:(NSArray *)fields
+                   sort:(NSArray *)sortDocument
+                  after:(CDTQQueryCursor *)cursor
+{
+    return [self find:query skip:0 limit:limit fields:fields sort:sortDocument after:cursor];
+}
+
+- (CDTQResultSet *)find:(NSDictionary *)query
+                   skip:(NSUInteger)skip
+                  limit:(NSUInteger)limit
+                 fields:(NSArray *)fields
+                   sort:(NSArray *)sortDocument
+                  after:(CDTQQueryCursor *)cursor
+{
+    return [self find:query
+                 skip:skip
+                limit:limit
+               fields:fields
+                 sort:sortDocument
+                after:cursor
+               handle:nil];
+}
+
+- (CDTQResultSet *)find:(NSDictionary *)query
+                   skip:(NSUInteger)skip
+                  limit:(NSUInteger)limit
+                 fields:(NSArray *)fields
+                   sort:(NSArray *)sortDocument
+                  after:(CDTQQueryCursor *)cursor
+                 handle:(CDTQueryHandle *)handle
 {
     if (!query) {
         os_log_error(CDTOSLog, "-find called with nil selector; bailing.");
         return nil;
     }
+    if (handle.isCancelled) {
+        return nil;
+    }
 
-    if (![self updateAllIndexes]) {
+    NSDictionary *statistics;
+    SequenceNumber sequence;
+    NSDictionary *indexes = [self upToDateIndexesWithStatistics:&statistics sequence:&sequence];
+    if (!indexes) {
         return nil;
     }
 
+    // Pages after a cursor aren't cached, as the cursor is a position rather than a query.
+    NSString *resultKey = nil;
+    if (!cursor && _queryCache.resultCachingEnabled) {
+        resultKey = [CDTQQueryCache keyForQuery:query sort:sortDocument fields:fields];
+        CDTQResultSet *cached =
+            resultKey ? [_queryCache resultSetForKey:resultKey skip:skip limit:limit atSequence:sequence]
+                      : nil;
+        if (cached) {
+            return handle ? [cached resultSetWithHandle:handle] : cached;
+        }
+    }
+
+    CDTQQueryExecutor *queryExecutor =
+        [[CDTQQueryExecutor alloc] initWithDatabase:_database datastore:_datastore];
+    queryExecutor.statistics = statistics;
+    queryExecutor.cache = _queryCache;
+    queryExecutor.advisor = _indexAdvisor;
+    queryExecutor.handle = handle;
+    CDTQResultSet *result = [queryExecutor find:query
+                                   usingIndexes:indexes
+                                           skip:skip
+                                          limit:limit
+                                         fields:fields
+                                           sort:sortDocument
+                                          after:cursor];
+    if (result && resultKey) {
+        // Later finds must not be stopped by this one's handle.
+        CDTQResultSet *shared = handle ? [result resultSetWithHandle:nil] : result;
+        [_queryCache setResultSet:shared forKey:resultKey skip:skip limit:limit atSequence:sequence];
+    }
+    return result;
+}
+
+- (NSUInteger)count:(NSDictionary *)query
+{
+    if (!query) {
+        os_log_error(CDTOSLog, "-count called with nil selector; bailing.");
+        return NSNotFound;
+    }
+
+    NSDictionary *statistics;
+    SequenceNumber sequence;
+    NSDictionary *indexes = [self upToDateIndexesWithStatistics:&statistics sequence:&sequence];
+    if (!indexes) {
+        return NSNotFound;
+    }
+
     CDTQQueryExecutor *queryExecutor =
         [[CDTQQueryExecutor alloc] initWithDatabase:_database datastore:_datastore];
-    return [queryExecutor find:query
-                  usingIndexes:[self listIndexes]
-                          skip:skip
-                         limit:limit
-                        fields:fields
-                          sort:sortDocument];
+    queryExecutor.statistics = statistics;
+    return [queryExecutor count:query usingIndexes:indexes];
+}
+
+- (NSSet<NSString *> *)documentIdsMatching:(NSDictionary *)selector
+                                      among:(NSArray<NSString *> *)documentIds
+{
+    if (!selector) {
+        os_log_error(CDTOSLog, "-documentIdsMatching:among: called with nil selector; bailing.");
+        return nil;
+    }
+    if (documentIds.count == 0) {
+        return [NSSet set];
+    }
+
+    // A few IDs are looked up by _id, which every index includes; for many it's quicker to
+    // find all the matches and keep the ones asked about.
+    BOOL lookUp = documentIds.count <= kCDTQDocumentIdLookupLimit;
+    NSDictionary *query =
+        lookUp ? @{ @"$and" : @[ selector, @{ @"_id" : @{ @"$in" : documentIds } } ] } : selector;
+    CDTQResultSet *result = [self find:query];
+    if (!result) {
+        return nil;
+    }
+
+    NSMutableSet<NSString *> *matching = [NSMutableSet setWithArray:result.documentIds];
+    if (!lookUp) {
+        [matching intersectSet:[NSSet setWithArray:documentIds]];
+    }
+    return matching;
+}
+
+- (NSArray<NSDictionary *> *)aggregate:(NSDictionary *)query
+                            aggregates:(NSDictionary<NSString *, NSDictionary *> *)aggregates
+                               groupBy:(NSString *)groupField
+{
+    if (!query) {
+        os_log_error(CDTOSLog, "-aggregate called with nil selector; bailing.");
+        return nil;
+    }
+
+    NSDictionary *statistics;
+    SequenceNumber sequence;
+    NSDictionary *indexes = [self upToDateIndexesWithStatistics:&statistics sequence:&sequence];
+    if (!indexes) {
+        return nil;
+    }
+
+    CDTQQueryExecutor *queryExecutor =
+        [[CDTQQueryExecutor alloc] initWithDatabase:_database datastore:_datastore];
+    queryExecutor.statistics = statistics;
+    return [queryExecutor aggregate:query
+                         aggregates:aggregates
+                            groupBy:groupField
+                       usingIndexes:indexes];
+}
+
+- (NSDictionary *)explain:(NSDictionary *)query { return [self explain:query sort:nil]; }
+
+- (NSDictionary *)explain:(NSDictionary *)query sort:(NSArray *)sortDocument
+{
+    if (!query) {
+        os_log_error(CDTOSLog, "-explain called with nil selector; bailing.");
+        return nil;
+    }
+
+    // Bring the indexes up to date first so the statistics, and so the plan, match what
+    // -find: would use.
+    NSDictionary *statistics;
+    SequenceNumber sequence;
+    NSDictionary *indexes = [self upToDateIndexesWithStatistics:&statistics sequence:&sequence];
+    if (!indexes) {
+        return nil;
+    }
+
+    CDTQQueryExecutor *queryExecutor =
+        [[CDTQQueryExecutor alloc] initWithDatabase:_database datastore:_datastore];
+    queryExecutor.statistics = statistics;
+    return [queryExecutor explain:query usingIndexes:indexes sort:sortDocument];
+}
+
+/**
+ Brings the indexes up to date, returning their definitions, their statistics in `statistics`
+ and the datastore sequence they're up to date with in `sequence`.
+
+ While neither the datastore nor, through another manager, the index database have changed
+ since the last call, the indexes are still up to date and the query cache's snapshot of them
+ is returned without reading anything but the index database's data_version.
+
+ @return the indexes, or nil if they couldn't be updated.
+ */
+- (NSDictionary *)upToDateIndexesWithStatistics:(NSDictionary **)statistics
+                                       sequence:(SequenceNumber *)sequence
+{
+    @synchronized(_updateLock)
+    {
+        // Our own changes to the index database don't change its data_version, and we invalidate
+        // the cache for those ourselves; another connection's may have added or deleted indexes.
+        __block int64_t dataVersion = 0;
+        [_database inDatabase:^(FMDatabase *db) {
+            dataVersion = [db longForQuery:@"PRAGMA data_version;"];
+        }];
+        if (dataVersion != _dataVersion) {
+            [_queryCache removeAllObjects];
+            _dataVersion = dataVersion;
+        }
+
+        // Read before updating, so a write racing the update only makes the snapshot look older
+        // than it is.
+        SequenceNumber lastSequence = _datastore.database.lastSequence;
+        NSDictionary *indexStatistics = nil;
+        NSDictionary *indexes =
+            [_queryCache indexesAtSequence:lastSequence statistics:&indexStatistics];
+        if (!indexes) {
+            if (![self updateAllIndexes]) {
+                return nil;
+            }
+            indexes = [self listIndexes];
+            indexStatistics = [self statisticsForIndexes:indexes];
+            [_queryCache setIndexes:indexes statistics:indexStatistics atSequence:lastSequence];
+        }
+
+        *statistics = indexStatistics;
+        *sequence = lastSequence;
+        return indexes;
+    }
+}
+
+#pragma mark Live queries
+
+- (CDTQLiveQuery *)liveQuery:(NSDictionary *)query
+                        sort:(NSArray *)sortDocument
+                       queue:(dispatch_queue_t)queue
+                     handler:(void (^)(CDTQLiveQueryChanges *))handler
+{
+    if (!query) {
+        os_log_error(CDTOSLog, "-liveQuery called with nil selector; bailing.");
+        return nil;
+    }
+
+    if (![CDTQQueryExecutor validateSortDocument:sortDocument]) {
+        return nil;
+    }
+
+    NSDictionary *selector = [CDTQQueryValidator normaliseAndValidateQuery:query];
+    if (!selector) {
+        return nil;
+    }
+
+    // Text searches and their scores come from the FTS index, not the document.
+    BOOL sortsByTextScore = NO;
+    for (NSDictionary *clause in sortDocument) {
+        sortsByTextScore = sortsByTextScore || clause[TEXT_SCORE] != nil;
+    }
+    if ([CDTQIndex selector:selector containsKey:TEXT] || sortsByTextScore) {
+        os_log_error(CDTOSLog, "Live queries can't use text search: %{public}@", query);
+        return nil;
+    }
+    // As can only geo searches, which the matcher can't evaluate.
+    if ([CDTQIndex selector:selector containsKey:GEO_WITHIN]) {
+        os_log_error(CDTOSLog, "Live queries can't use %{public}@: %{public}@", GEO_WITHIN, query);
+        return nil;
+    }
+
+    CDTQLiveQuery *liveQuery =
+        [[CDTQLiveQuery alloc] initWithManager:self
+                                         query:query
+                                      selector:selector
+                                          sort:sortDocument
+                                         queue:queue ?: dispatch_get_main_queue()
+                                       handler:handler];
+    [liveQuery start];
+    return liveQuery;
+}
+
+#pragma mark Statistics
+
+/**
+ Returns statistics for the JSON indexes in `indexes`, gathering them for any index which
+ doesn't have them yet or whose statistics are stale. Gathering scans the index table, so it
+ is only repeated once a good proportion of the index has changed.
+ */
+- (NSDictionary *)statisticsForIndexes:(NSDictionary *)indexes
+{
+    @synchronized(_updateLock)
+    {
+        __block NSDictionary *sequences = nil;
+        [_database inDatabase:^(FMDatabase *db) {
+            sequences = [CDTQIndexManager lastSequencesInDatabase:db];
+            for (NSString *indexName in indexes) {
+                if ([indexes[indexName][@"type"] isEqualToString:@"text"]) {
+                    continue;  // text indexes are FTS tables, which we can't usefully count
+                }
+
+                SequenceNumber sequence = [sequences[indexName] longLongValue];
+                CDTQIndexStatistics *existing = _statistics[indexName];
+                if (existing && ![existing isStaleAtSequence:sequence]) {
+                    continue;
+                }
+
+                CDTQIndexStatistics *fresh =
+                    [CDTQIndexStatistics statisticsForIndex:indexName
+                                                 fieldNames:indexes[indexName][@"fields"]
+                                                   sequence:sequence
+                                                 inDatabase:db];
+                if (fresh) {
+                    _statistics[indexName] = fresh;
+                } else {
+                    [_statistics removeObjectForKey:indexName];
+                }
+            }
+        }];
+
+        NSMutableDictionary *result = [NSMutableDictionary dictionary];
+        for (NSString *indexName in indexes) {
+            if (_statistics[indexName]) {
+                result[indexName] = _statistics[indexName];
+            }
+        }
+        return [NSDictionary dictionaryWithDictionary:result];
+    }
+}
+
++ (NSDictionary /* NSString -> NSNumber */ *)lastSequencesInDatabase:(FMDatabase *)db
+{
+    NSMutableDictionary *sequences = [NSMutableDictionary dictionary];
+    NSString *sql = @"SELECT index_name, MAX(last_sequence) FROM %@ GROUP BY index_name;";
+    sql = [NSString stringWithFormat:sql, kCDTQIndexMetadataTableName];
+    FMResultSet *rs = [db executeQuery:sql];
+    while ([rs next]) {
+        sequences[[rs stringForColumnIndex:0]] = @([rs longLongIntForColumnIndex:1]);
+    }
+    [rs close];
+    return [NSDictionary dictionaryWithDictionary:sequences];
 }
 
 #pragma mark Utilities
@@ -422,11 +1233,69 @@ static const int VERSION = 2;
 }
 
 + (BOOL)ftsAvailableInDatabase:(FMDatabaseQueue *)db
+{
+    return [CDTQIndexManager compileOption:@"ENABLE_FTS3" availableInDatabase:db];
+}
+
++ (BOOL)fts5AvailableInDatabase:(FMDatabaseQueue *)db
+{
+    return [CDTQIndexManager compileOption:@"ENABLE_FTS5" availableInDatabase:db];
+}
+
++ (BOOL)isFTS5TextIndex:(NSDictionary *)indexDetails
+{
+    if (![indexDetails[@"type"] isEqualToString:@"text"] || !indexDetails[@"settings"]) {
+        return NO;
+    }
+    NSData *settings = [indexDetails[@"settings"] dataUsingEncoding:NSUTF8StringEncoding];
+    return [CDTQIndex
+        settingsUseFTS5:[NSJSONSerialization JSONObjectWithData:settings options:0 error:nil]];
+}
+
++ (BOOL)rtreeAvailableInDatabase:(FMDatabaseQueue *)db
+{
+    return [CDTQIndexManager compileOption:@"ENABLE_RTREE" availableInDatabase:db];
+}
+
++ (NSString *)rtreeTableNameForIndex:(NSString *)indexName
+{
+    // A prefix of its own, so neither this nor the tables R*Tree names after it can be an
+    // index's table, whatever the index is called.
+    return [kCDTQGeoTablePrefix stringByAppendingString:indexName];
+}
+
++ (NSArray<NSString *> *)geoFieldNamesOfIndex:(NSDictionary *)indexDetails
+{
+    if (![indexDetails[@"type"] isEqualToString:@"geo"] || !indexDetails[@"settings"]) {
+        return nil;
+    }
+    NSData *settings = [indexDetails[@"settings"] dataUsingEncoding:NSUTF8StringEncoding];
+    return [CDTQIndex
+        geoFieldNamesForSettings:[NSJSONSerialization JSONObjectWithData:settings
+                                                                 options:0
+                                                                   error:nil]];
+}
+
++ (NSString *)collationOfIndex:(NSDictionary *)indexDetails
+{
+    NSString *type = indexDetails[@"type"];
+    if (!([type isEqualToString:@"json"] || [type isEqualToString:@"multikey"]) ||
+        !indexDetails[@"settings"]) {
+        return nil;
+    }
+    NSData *settings = [indexDetails[@"settings"] dataUsingEncoding:NSUTF8StringEncoding];
+    return [CDTQIndex
+        collationSequenceForSettings:[NSJSONSerialization JSONObjectWithData:settings
+                                                                     options:0
+                                                                       error:nil]];
+}
+
++ (BOOL)compileOption:(NSString *)option availableInDatabase:(FMDatabaseQueue *)db
 {
     __block BOOL ftsOptionsExist = NO;
     
     [db inDatabase:^(FMDatabase *db) {
-        NSMutableArray *ftsCompileOptions = [NSMutableArray arrayWithArray:@[ @"ENABLE_FTS3" ] ];
+        NSMutableArray *ftsCompileOptions = [NSMutableArray arrayWithArray:@[ option ] ];
         FMResultSet *rs = [db executeQuery:@"PRAGMA compile_options;"];
         while ([rs next]) {
             NSString *compileOption = [rs stringForColumnIndex:0];
@@ -453,23 +1322,44 @@ static const int VERSION = 2;
 
 #pragma mark Setup methods
 
++ (NSString *)databasePathForDatastore:(CDTDatastore *)datastore
+{
+    NSString *dir = [datastore extensionDataFolder:kCDTQExtensionName];
+    return [NSString pathWithComponents:@[ dir, @"indexes.sqlite" ]];
+}
+
++ (BOOL)hasIndexDatabaseForDatastore:(CDTDatastore *)datastore
+{
+    NSString *filename = [CDTQIndexManager databasePathForDatastore:datastore];
+    return [[NSFileManager defaultManager] fileExistsAtPath:filename];
+}
+
 + (FMDatabaseQueue *)databaseQueueWithDatastore:(CDTDatastore *)datastore
                                           error:(NSError *__autoreleasing *)error
 {
-    NSString *dir = [datastore extensionDataFolder:kCDTQExtensionName];
-    [[NSFileManager defaultManager] createDirectoryAtPath:dir
+    NSString *filename = [CDTQIndexManager databasePathForDatastore:datastore];
+    [[NSFileManager defaultManager] createDirectoryAtPath:[filename stringByDeletingLastPathComponent]
                               withIntermediateDirectories:TRUE
                                                attributes:nil
                                                     error:nil];
-    NSString *filename = [NSString pathWithComponents:@[ dir, @"indexes.sqlite" ]];
 
-    id<CDTEncryptionKeyProvider> provider = [datastore encryptionKeyProvider];
-    FMDatabaseQueue *database = nil;
+    // The datastore's database has already been asked for the key, so it's taken from there
+    id<CDTEncryptionKeyProvider> provider =
+        datastore.database.connectionKeyProvider ?: [datastore encryptionKeyProvider];
+    TDDatabaseQueue *database = nil;
     NSError *thisError = nil;
     BOOL success = YES;
 
+    // The page size of an encrypted db can only be changed before it's opened
+    if (success) {
+        success = [FMDatabase migrateDatabaseAtPath:filename
+                         toCipherSettingsOfProvider:provider
+                                              error:&thisError];
+    }
+
     if (success) {
-        database = [[FMDatabaseQueue alloc] initWithPath:filename];
+        database = [[TDDatabaseQueue alloc] initWithPath:filename];
+        database.telemetry = datastore.database.queueTelemetry;
 
         success = (database != nil);
         if (!success) {
@@ -528,6 +1418,15 @@ static const int VERSION = 2;
       if (!success) {
           os_log_error(CDTOSLog, "Problem configuring database with encryption key: %{public}@", thisError);
       }
+      db.shouldCacheStatements = YES;
+
+      // Radius searches of geo indexes measure the distance to each point in the box around
+      // the circle with this.
+      sqlite3_create_function(db.sqliteHandle, "cdtq_geo_distance", 4,
+                              SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, CDTQGeoDistanceFunction,
+                              NULL, NULL);
+      // Indexes with a collation setting sort their strings with a sequence for its locale.
+      sqlite3_collation_needed(db.sqliteHandle, NULL, CDTQCollationNeeded);
     }];
 
     if (!success && error) {
@@ -567,6 +1466,18 @@ static const int VERSION = 2;
             success = success && [CDTQIndexManager migrate_1_2:db];
         }
 
+        if (version < 3) {
+            success = success && [CDTQIndexManager migrate_2_3:db];
+        }
+
+        if (version < 4) {
+            success = success && [CDTQIndexManager migrate_3_4:db];
+        }
+
+        if (version < 5) {
+            success = success && [CDTQIndexManager migrate_4_5:db];
+        }
+
         // Set user_version unconditionally
         NSString *sql = [NSString stringWithFormat:@"pragma user_version = %d", currentVersion];
         success = success && [db executeUpdate:sql];
@@ -595,4 +1506,26 @@ static const int VERSION = 2;
     return [db executeUpdate:SCHEMA_INDEX];
 }
 
++ (BOOL)migrate_2_3:(FMDatabase *)db
+{
+    // Existing indexes may already hold values which aren't as they are in their documents.
+    NSString *SCHEMA_INDEX = @"ALTER TABLE _t_cloudant_sync_query_metadata "
+                             @"        ADD COLUMN covering INTEGER NOT NULL DEFAULT 0;";
+    return [db executeUpdate:SCHEMA_INDEX];
+}
+
++ (BOOL)migrate_3_4:(FMDatabase *)db
+{
+    NSString *SCHEMA_INDEX = @"ALTER TABLE _t_cloudant_sync_query_metadata "
+                             @"        ADD COLUMN partial_selector TEXT NULL;";
+    return [db executeUpdate:SCHEMA_INDEX];
+}
+
++ (BOOL)migrate_4_5:(FMDatabase *)db
+{
+    NSString *SCHEMA_INDEX = @"ALTER TABLE _t_cloudant_sync_query_metadata "
+                             @"        ADD COLUMN field_type TEXT NULL;";
+    return [db executeUpdate:SCHEMA_INDEX];
+}
+
 @end
@@ -0,0 +1,83 @@
+//
+//  CDTQIndexStatistics.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+#import "CDTDefines.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class FMDatabase;
+
+/**
+ Row and value counts for a single JSON index table, used by the query translator to estimate
+ how many rows a clause will match and so choose between candidate indexes.
+
+ Statistics are a snapshot: they are gathered by a single scan of the index table and record
+ the index's last sequence at that point, so callers can decide when they've become stale.
+ */
+@interface CDTQIndexStatistics : NSObject
+
+/** Number of rows in the index table; array fields contribute a row per element. */
+@property (nonatomic, readonly) NSUInteger rowCount;
+
+/** Count of distinct non-null values for each indexed field. */
+@property (nonatomic, readonly) NSDictionary<NSString *, NSNumber *> *distinctCounts;
+
+/** Count of rows with a non-null value for each indexed field. */
+@property (nonatomic, readonly) NSDictionary<NSString *, NSNumber *> *nonNullCounts;
+
+/** The index's last_sequence when these statistics were gathered. */
+@property (nonatomic, readonly) SequenceNumber sequence;
+
+/**
+ Gathers statistics for an index by scanning its table.
+
+ @param indexName the index to scan.
+ @param fieldNames the index's fields.
+ @param sequence the index's current last_sequence.
+ @param db database holding the index.
+ @return the statistics, or nil if the table couldn't be read.
+ */
++ (nullable instancetype)statisticsForIndex:(NSString *)indexName
+                                 fieldNames:(NSArray<NSString *> *)fieldNames
+                                   sequence:(SequenceNumber)sequence
+                                 inDatabase:(FMDatabase *)db;
+
+- (instancetype)initWithRowCount:(NSUInteger)rowCount
+                  distinctCounts:(NSDictionary<NSString *, NSNumber *> *)distinctCounts
+                   nonNullCounts:(NSDictionary<NSString *, NSNumber *> *)nonNullCounts
+                        sequence:(SequenceNumber)sequence NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ YES once the index has moved on far enough from `sequence` that these statistics should be
+ gathered again: more than 100 changes, or more than a tenth of the rows.
+ */
+- (BOOL)isStaleAtSequence:(SequenceNumber)sequence;
+
+/**
+ Estimates the number of rows matching a normalised AND clause, such as
+ `@[ @{ @"name": @{ @"$eq": @"mike" } }, @{ @"age": @{ @"$gt": @12 } } ]`.
+
+ Terms are assumed to be independent. Equality uses the field's distinct value count; range
+ and other operators for which there's no useful statistic are assumed to match a third of
+ the rows.
+ */
+- (double)estimatedRowsForAndClause:(NSArray<NSDictionary *> *)clause;
+
+@end
+
+NS_ASSUME_NONNULL_END
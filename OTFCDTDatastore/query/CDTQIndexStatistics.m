@@ -0,0 +1,156 @@
+//
+//  CDTQIndexStatistics.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTQIndexStatistics.h"
+
+#import "CDTQIndexManager.h"
+#import "CDTQQueryConstants.h"
+#import "CDTQQuerySqlTranslator.h"
+#import "CDTLogging.h"
+
+#import <FMDB/FMDB.h>
+
+/** Fraction of rows assumed to match an operator we have no statistic for, e.g., $gt. */
+static const double kCDTQDefaultSelectivity = 1.0 / 3.0;
+
+/** Changes after which statistics are always refreshed, however large the index. */
+static const SequenceNumber kCDTQMinimumStaleChanges = 100;
+
+@implementation CDTQIndexStatistics
+
++ (instancetype)statisticsForIndex:(NSString *)indexName
+                        fieldNames:(NSArray<NSString *> *)fieldNames
+                          sequence:(SequenceNumber)sequence
+                        inDatabase:(FMDatabase *)db
+{
+    // One scan gathers everything: COUNT(*), then COUNT and COUNT(DISTINCT) for each field.
+    NSMutableArray *columns = [NSMutableArray arrayWithObject:@"COUNT(*)"];
+    for (NSString *fieldName in fieldNames) {
+        [columns addObject:[NSString stringWithFormat:@"COUNT(\"%@\")", fieldName]];
+        [columns addObject:[NSString stringWithFormat:@"COUNT(DISTINCT \"%@\")", fieldName]];
+    }
+    NSString *sql = [NSString stringWithFormat:@"SELECT %@ FROM \"%@\";",
+                                               [columns componentsJoinedByString:@", "],
+                                               [CDTQIndexManager tableNameForIndex:indexName]];
+
+    FMResultSet *rs = [db executeQuery:sql];
+    if (![rs next]) {
+        os_log_error(CDTOSLog, "Failed to gather statistics for index %{public}@: %{public}@", indexName, [db lastErrorMessage]);
+        [rs close];
+        return nil;
+    }
+
+    NSUInteger rowCount = (NSUInteger)[rs longLongIntForColumnIndex:0];
+    NSMutableDictionary *nonNullCounts = [NSMutableDictionary dictionary];
+    NSMutableDictionary *distinctCounts = [NSMutableDictionary dictionary];
+    [fieldNames enumerateObjectsUsingBlock:^(NSString *fieldName, NSUInteger idx, BOOL *stop) {
+        nonNullCounts[fieldName] = @([rs longLongIntForColumnIndex:(int)(1 + 2 * idx)]);
+        distinctCounts[fieldName] = @([rs longLongIntForColumnIndex:(int)(2 + 2 * idx)]);
+    }];
+    [rs close];
+
+    return [[CDTQIndexStatistics alloc] initWithRowCount:rowCount
+                                          distinctCounts:distinctCounts
+                                           nonNullCounts:nonNullCounts
+                                                sequence:sequence];
+}
+
+- (instancetype)initWithRowCount:(NSUInteger)rowCount
+                  distinctCounts:(NSDictionary<NSString *, NSNumber *> *)distinctCounts
+                   nonNullCounts:(NSDictionary<NSString *, NSNumber *> *)nonNullCounts
+                        sequence:(SequenceNumber)sequence
+{
+    self = [super init];
+    if (self) {
+        _rowCount = rowCount;
+        _distinctCounts = [distinctCounts copy];
+        _nonNullCounts = [nonNullCounts copy];
+        _sequence = sequence;
+    }
+    return self;
+}
+
+- (BOOL)isStaleAtSequence:(SequenceNumber)sequence
+{
+    if (sequence < _sequence) {
+        return YES;  // index was rebuilt
+    }
+    SequenceNumber threshold = MAX(kCDTQMinimumStaleChanges, (SequenceNumber)(_rowCount / 10));
+    return sequence - _sequence > threshold;
+}
+
+- (double)estimatedRowsForAndClause:(NSArray<NSDictionary *> *)clause
+{
+    double selectivity = 1.0;
+    for (NSDictionary *term in clause) {
+        if (term.count != 1) {
+            continue;
+        }
+        NSString *fieldName = term.allKeys[0];
+        NSDictionary *predicate = term[fieldName];
+        if ([predicate isKindOfClass:[NSDictionary class]]) {
+            selectivity *= [self selectivityOfPredicate:predicate forField:fieldName];
+        }
+    }
+    return _rowCount * selectivity;
+}
+
+- (double)selectivityOfPredicate:(NSDictionary *)predicate forField:(NSString *)fieldName
+{
+    if (_rowCount == 0 || predicate.count != 1) {
+        return 1.0;
+    }
+
+    NSString *operator = predicate.allKeys[0];
+    NSObject *operand = predicate[operator];
+    double distinct = MAX(1.0, [_distinctCounts[fieldName] doubleValue]);
+    double nonNull = [_nonNullCounts[fieldName] doubleValue] / _rowCount;
+
+    if ([operator isEqualToString:NOT] && [operand isKindOfClass:[NSDictionary class]]) {
+        return 1.0 - [self selectivityOfPredicate:(NSDictionary *)operand forField:fieldName];
+    } else if ([operator isEqualToString:EQ]) {
+        return nonNull / distinct;
+    } else if ([operator isEqualToString:NE]) {
+        return 1.0 - nonNull / distinct;
+    } else if ([operator isEqualToString:IN] && [operand isKindOfClass:[NSArray class]]) {
+        return MIN(1.0, ((NSArray *)operand).count / distinct) * nonNull;
+    } else if ([operator isEqualToString:NIN] && [operand isKindOfClass:[NSArray class]]) {
+        return 1.0 - MIN(1.0, ((NSArray *)operand).count / distinct) * nonNull;
+    } else if ([operator isEqualToString:EXISTS]) {
+        return [(NSNumber *)operand boolValue] ? nonNull : 1.0 - nonNull;
+    } else if ([operator isEqualToString:ALL]) {
+        // A match has rows holding each value, so it's no more common than any one of them.
+        return nonNull / distinct;
+    } else if ([operator isEqualToString:ELEM_MATCH] &&
+               [operand isKindOfClass:[NSDictionary class]]) {
+        double selectivity = 1.0;
+        for (NSDictionary *term in
+             [CDTQQuerySqlTranslator clausesForElemMatch:(NSDictionary *)operand
+                                                 onField:fieldName]) {
+            NSString *termField = term.allKeys[0];
+            selectivity *= [self selectivityOfPredicate:term[termField] forField:termField];
+        }
+        return selectivity;
+    } else {
+        return kCDTQDefaultSelectivity * nonNull;
+    }
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"rows: %lu distinct: %@ sequence: %lld",
+                                      (unsigned long)_rowCount, _distinctCounts, _sequence];
+}
+
+@end
@@ -24,6 +24,19 @@ NS_ASSUME_NONNULL_BEGIN
 @class CDTQSqlParts;
 @class FMDatabaseQueue;
 
+/** The most rows a multikey index will hold for a single document. */
+extern const NSUInteger kCDTQMultiKeyMaximumRows;
+
+/** How many pages of a text index each batch of updates merges at most. */
+extern const NSUInteger kCDTQTextIndexMergePages;
+
+/** How many revisions each transaction of an index build inserts. */
+extern const NSUInteger kCDTQBulkBuildBatchSize;
+
+/** How many deleted documents' rows each DELETE removes from an index, well within
+    SQLITE_MAX_VARIABLE_NUMBER (999). */
+extern const NSUInteger kCDTQMaxDocIdsPerDelete;
+
 /**
  Handles updating indexes for a given datastore.
  */
@@ -38,6 +51,14 @@ NS_ASSUME_NONNULL_BEGIN
               inDatabase:(FMDatabaseQueue *)database
            fromDatastore:(CDTDatastore *)datastore;
 
+/**
+ Fill newly created, empty indexes, keyed by name as listed by CDTQIndexManager, in one pass
+ over the datastore. See -buildIndexes:.
+ */
++ (BOOL)buildIndexes:(NSDictionary<NSString *, NSDictionary *> *)indexes
+          inDatabase:(FMDatabaseQueue *)database
+       fromDatastore:(CDTDatastore *)datastore;
+
 /**
  Update a single index.
 
@@ -59,10 +80,42 @@ NS_ASSUME_NONNULL_BEGIN
 /**
  Update all the indexes in a set.
 
+ The changes feed is read once for the whole set, rather than once per index, and
+ each batch of changes is written to every index in a single transaction.
+
  The indexes are assumed to already exist.
  */
 - (BOOL)updateAllIndexes:(NSDictionary<NSString *, NSArray<NSString *> *> *)indexes;
 
+/**
+ Fill newly created, empty indexes with the documents in the datastore.
+
+ The changes feed is read once, in sequence order, for all the indexes. As the indexes are
+ empty, rows are only inserted, without first deleting a document's old rows, in transactions
+ of kCDTQBulkBuildBatchSize revisions; JSON index tables are expected not to have their SQLite
+ index yet, which is quicker to create once they're full than to update on every insert.
+
+ Only documents up to the datastore's last sequence when the build starts are indexed, and that
+ is recorded as the indexes' last sequence, so documents changed during the build are indexed
+ by the next update, which replaces any rows they already have. That update needs the SQLite
+ indexes to find those rows, so they must be created before it.
+ */
+- (BOOL)buildIndexes:(NSDictionary<NSString *, NSDictionary *> *)indexes;
+
+/**
+ Update all the indexes in a set with a batch of revisions just committed together, from the
+ bodies the change notification gave them rather than by reading the changes feed.
+
+ `winners` are the new winning revisions of the documents the batch changed, in the order they
+ were inserted. The batch must be every change from `firstSequence` to `lastSequence`, and the
+ indexes are only updated if they're all up to date with the sequence before it; otherwise NO is
+ returned and nothing is written, leaving the changes to the next update.
+ */
+- (BOOL)updateAllIndexes:(NSDictionary<NSString *, NSDictionary *> *)indexes
+             withWinners:(NSArray<CDTDocumentRevision *> *)winners
+   committedFromSequence:(SequenceNumber)firstSequence
+              toSequence:(SequenceNumber)lastSequence;
+
 /**
  Update a single index.
 
@@ -72,12 +125,26 @@ NS_ASSUME_NONNULL_BEGIN
          withFields:(NSArray<NSString *> *)fieldNames
               error:(NSError *__autoreleasing __nullable *__nullable)error;
 
+/**
+ Remove the rows of documents which are gone without a change to say so, e.g., purged when they
+ expired, from every index in a set, in one transaction.
+ */
+- (BOOL)deleteIndexEntriesForDocIds:(NSArray<NSString *> *)docIds
+                        fromIndexes:(NSArray<NSString *> *)indexNames;
+
 /**
  Generate the DELETE statement to remove a documents entries from an index.
  */
 + (CDTQSqlParts *)partsToDeleteIndexEntriesForDocId:(NSString *)docId
                                           fromIndex:(NSString *)indexName;
 
+/**
+ Generate the DELETE statement to remove several documents' entries from an index at once. There
+ should be no more than kCDTQMaxDocIdsPerDelete documents.
+ */
++ (nullable CDTQSqlParts *)partsToDeleteIndexEntriesForDocIds:(NSArray<NSString *> *)docIds
+                                                    fromIndex:(NSString *)indexName;
+
 /**
  Generate the INSERT statement to add a document to an index.
  */
@@ -85,6 +152,55 @@ NS_ASSUME_NONNULL_BEGIN
                                                    inIndex:(NSString *)indexName
                                             withFieldNames:(NSArray<NSString *> *)fieldNames;
 
+/**
+ Generate the INSERT statements to add a document to an index, optionally as a multikey index.
+
+ A multikey index has a row for every combination of the elements of the arrays its fields
+ pass through. Fields under the same array, like `items.name` and `items.qty`, take their
+ values from the same element of it, so that a row describes a single element; fields under
+ different arrays are combined with every element of each other's. Returns nil if that is
+ more than kCDTQMultiKeyMaximumRows rows.
+ */
++ (nullable NSArray<CDTQSqlParts *> *)partsToIndexRevision:(CDTDocumentRevision *)rev
+                                                   inIndex:(NSString *)indexName
+                                            withFieldNames:(NSArray<NSString *> *)fieldNames
+                                                  multiKey:(BOOL)multiKey;
+
+/**
+ As above, storing the values of a JSON index's typed fields, `fieldTypes` mapping their names
+ to type names, as CDTQIndex +value:normalisedForFieldType: gives them.
+ */
++ (nullable NSArray<CDTQSqlParts *> *)partsToIndexRevision:(CDTDocumentRevision *)rev
+                                                   inIndex:(NSString *)indexName
+                                            withFieldNames:(NSArray<NSString *> *)fieldNames
+                                                  multiKey:(BOOL)multiKey
+                                                fieldTypes:(nullable NSDictionary<NSString *, NSString *> *)fieldTypes;
+
+/**
+ Whether the index's rows for the revision will hold each of its fields' values exactly as they
+ are in its body, which isn't the case for arrays, objects and booleans.
+ */
++ (BOOL)indexCanStoreValuesOfRevision:(CDTDocumentRevision *)rev
+                       withFieldNames:(NSArray<NSString *> *)fieldNames;
+
+/**
+ As above, for an index with typed fields, which can't store values of other types.
+ */
++ (BOOL)indexCanStoreValuesOfRevision:(CDTDocumentRevision *)rev
+                       withFieldNames:(NSArray<NSString *> *)fieldNames
+                           fieldTypes:(nullable NSDictionary<NSString *, NSString *> *)fieldTypes;
+
+/**
+ Generate the UPDATE statement recording that an index no longer covers its fields.
+ */
++ (CDTQSqlParts *)partsToClearCoveringOfIndex:(NSString *)indexName;
+
+/**
+ Generate the statement which does a step of incremental merging of a text index's segments,
+ writing at most kCDTQTextIndexMergePages pages, so the index doesn't fragment as it's updated.
+ */
++ (CDTQSqlParts *)partsToMergeTextIndex:(NSString *)indexName fts5:(BOOL)fts5;
+
 /**
  Return the sequence number for the given index
 
@@ -14,20 +14,46 @@
 
 #import "CDTQIndexUpdater.h"
 
+#import "CDTQIndex.h"
 #import "CDTQIndexManager.h"
 #import "CDTQResultSet.h"
+#import "CDTQUnindexedMatcher.h"
 #import "CDTQValueExtractor.h"
 #import "CDTFetchChanges.h"
 #import "CDTLogging.h"
+#import "CDTQueueTelemetry.h"
+#import "TD_Database.h"
 
 #import "CloudantSync.h"
 
 #import <FMDB/FMDB.h>
 
+const NSUInteger kCDTQMultiKeyMaximumRows = 1000;
+const NSUInteger kCDTQTextIndexMergePages = 500;
+const NSUInteger kCDTQBulkBuildBatchSize = 10000;
+const NSUInteger kCDTQMaxDocIdsPerDelete = 500;
+
+// Deleted documents collected from the changes feed before their rows are deleted together.
+static const NSUInteger kCDTQDeleteBatchSize = 5000;
+
 @interface CDTQIndexUpdater ()
 
 @property (nonatomic, strong) FMDatabaseQueue *database;
 @property (nonatomic, strong) CDTDatastore *datastore;
+/** Names of the indexes being updated which are multikey indexes. */
+@property (nonatomic, strong) NSMutableSet<NSString *> *multiKeyIndexNames;
+/** Matchers for the selectors of the partial indexes being updated, keyed by index name. */
+@property (nonatomic, strong)
+    NSMutableDictionary<NSString *, CDTQUnindexedMatcher *> *partialIndexMatchers;
+/** Whether each text index being updated uses FTS5, keyed by index name. */
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSNumber *> *textIndexUsesFTS5;
+/** The field types of the typed indexes being updated, keyed by index name. */
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSDictionary *> *fieldTypesForIndex;
+/** YES while filling new, empty indexes: rows are only inserted, never deleted. */
+@property (nonatomic) BOOL building;
+/** While building, the datastore's last sequence when the build started; later changes are
+    left for the next update. */
+@property (nonatomic) SequenceNumber buildSequence;
 
 @end
 
@@ -39,6 +65,10 @@
     if (self) {
         _database = database;
         _datastore = datastore;
+        _multiKeyIndexNames = [NSMutableSet set];
+        _partialIndexMatchers = [NSMutableDictionary dictionary];
+        _textIndexUsesFTS5 = [NSMutableDictionary dictionary];
+        _fieldTypesForIndex = [NSMutableDictionary dictionary];
     }
     return self;
 }
@@ -60,6 +90,15 @@
     return success;
 }
 
++ (BOOL)buildIndexes:(NSDictionary /*NSString -> NSDictionary*/ *)indexes
+          inDatabase:(FMDatabaseQueue *)database
+       fromDatastore:(CDTDatastore *)datastore
+{
+    CDTQIndexUpdater *updater =
+        [[CDTQIndexUpdater alloc] initWithDatabase:database datastore:datastore];
+    return [updater buildIndexes:indexes];
+}
+
 /**
  Update a single index.
 
@@ -81,13 +120,96 @@
 
 - (BOOL)updateAllIndexes:(NSDictionary /*NSString -> NSArray[NSString]*/ *)indexes
 {
-    BOOL success = YES;
+    CDTQueueOperationScope(CDTQueueOperationIndexUpdate);
+    if (indexes.count == 0) {
+        return YES;
+    }
+
+    NSMutableDictionary *fieldsForIndex = [NSMutableDictionary dictionary];
+    NSMutableDictionary *sequenceForIndex = [NSMutableDictionary dictionary];
+    for (NSString *indexName in indexes) {
+        fieldsForIndex[indexName] = indexes[indexName][@"fields"];
+        sequenceForIndex[indexName] = @([self sequenceNumberForIndex:indexName]);
+        [self noteIndex:indexName withDetails:indexes[indexName]];
+    }
+
+    return [self updateIndexes:fieldsForIndex startingSequences:sequenceForIndex];
+}
+
+- (BOOL)buildIndexes:(NSDictionary /*NSString -> NSDictionary*/ *)indexes
+{
+    CDTQueueOperationScope(CDTQueueOperationIndexUpdate);
+    if (indexes.count == 0) {
+        return YES;
+    }
+
+    NSMutableDictionary *fieldsForIndex = [NSMutableDictionary dictionary];
+    NSMutableDictionary *sequenceForIndex = [NSMutableDictionary dictionary];
+    for (NSString *indexName in indexes) {
+        fieldsForIndex[indexName] = indexes[indexName][@"fields"];
+        sequenceForIndex[indexName] = @0;
+        [self noteIndex:indexName withDetails:indexes[indexName]];
+    }
+
+    os_signpost_id_t signpost = CDTSignpostIDGenerate();
+    CDTSignpostIntervalBegin(signpost, "buildIndexes", "indexes=%lu",
+                             (unsigned long)indexes.count);
+    self.building = YES;
+    self.buildSequence = _datastore.database.lastSequence;
+    BOOL success = [self updateIndexes:fieldsForIndex startingSequences:sequenceForIndex];
+    self.building = NO;
+    CDTSignpostIntervalEnd(signpost, "buildIndexes", "succeeded=%d", success);
+    return success;
+}
+
+- (BOOL)updateAllIndexes:(NSDictionary /*NSString -> NSDictionary*/ *)indexes
+             withWinners:(NSArray<CDTDocumentRevision *> *)winners
+   committedFromSequence:(SequenceNumber)firstSequence
+              toSequence:(SequenceNumber)lastSequence
+{
+    CDTQueueOperationScope(CDTQueueOperationIndexUpdate);
+    if (indexes.count == 0) {
+        return YES;
+    }
+
+    NSMutableDictionary *fieldsForIndex = [NSMutableDictionary dictionary];
+    NSMutableDictionary *sequenceForIndex = [NSMutableDictionary dictionary];
+    for (NSString *indexName in indexes) {
+        // An index missing earlier changes has to read them from the datastore anyway.
+        if ([self sequenceNumberForIndex:indexName] != firstSequence - 1) {
+            return NO;
+        }
+        NSArray *fieldNames = indexes[indexName][@"fields"];
+        if (![CDTQValueExtractor expressionsAreRegisteredForFieldNames:fieldNames]) {
+            return NO;
+        }
+        fieldsForIndex[indexName] = fieldNames;
+        sequenceForIndex[indexName] = @(firstSequence - 1);
+        [self noteIndex:indexName withDetails:indexes[indexName]];
+    }
 
-    for (NSString *indexName in [indexes allKeys]) {
-        NSArray *fields = indexes[indexName][@"fields"];
-        success = [self updateIndex:indexName withFields:fields error:nil];
+    // Only the last winner of a document changed more than once in the batch is indexed.
+    NSMutableDictionary *winnerForDocId = [NSMutableDictionary dictionary];
+    for (CDTDocumentRevision *winner in winners) {
+        winnerForDocId[winner.docId] = winner;
+    }
+    NSMutableArray *updateBatch = [NSMutableArray array];
+    NSMutableArray *deleteBatch = [NSMutableArray array];
+    for (CDTDocumentRevision *winner in [winnerForDocId allValues]) {
+        if (winner.deleted) {
+            [deleteBatch addObject:winner.docId];
+        } else {
+            [updateBatch addObject:winner];
+        }
     }
 
+    BOOL success = [self processUpdateBatch:updateBatch
+                                 forIndexes:fieldsForIndex
+                          startingSequences:sequenceForIndex] &&
+                   [self processDeleteBatch:deleteBatch forIndexes:[fieldsForIndex allKeys]];
+    for (NSString *indexName in fieldsForIndex) {
+        success = success && [self updateMetadataForIndex:indexName lastSequence:lastSequence];
+    }
     return success;
 }
 
@@ -95,6 +217,10 @@
          withFields:(NSArray /* NSString */ *)fieldNames
               error:(NSError *__autoreleasing *)error
 {
+    CDTQueueOperationScope(CDTQueueOperationIndexUpdate);
+    NSDictionary *indexes = [CDTQIndexManager listIndexesInDatabaseQueue:_database];
+    [self noteIndex:indexName withDetails:indexes[indexName]];
+
     BOOL success = [self updateIndex:indexName
                           fieldNames:fieldNames
                     startingSequence:[self sequenceNumberForIndex:indexName]];
@@ -119,6 +245,10 @@
           fieldNames:(NSArray /* NSString */ *)fieldNames
     startingSequence:(SequenceNumber)lastSequence
 {
+    if (![CDTQValueExtractor expressionsAreRegisteredForFieldNames:fieldNames]) {
+        return NO;
+    }
+
     __block bool success = YES;
 
     NSString *lastSeqString = [[NSNumber numberWithLongLong:lastSequence] stringValue];
@@ -154,7 +284,7 @@
 
       [deleteBatch addObject:docId];
 
-      if (deleteBatch.count > 500) {
+      if (deleteBatch.count >= kCDTQDeleteBatchSize) {
           CDTQIndexUpdater *self = weakSelf;
           if (self) {
               success = success && [self processDeleteBatch:deleteBatch forIndex:indexName];
@@ -196,10 +326,44 @@
                 fieldNames:(NSArray /* NSString */ *)fieldNames
 {
     __block BOOL success = YES;
+    os_signpost_id_t signpost = CDTSignpostIDGenerate();
+    CDTSignpostIntervalBegin(signpost, "processUpdateBatch", "index=%{public}@ count=%lu",
+                             indexName, (unsigned long)updateBatch.count);
+
+    CDTQUnindexedMatcher *partialMatcher = self.partialIndexMatchers[indexName];
+    NSDictionary *fieldTypes = self.fieldTypesForIndex[indexName];
 
     [_database inTransaction:^(FMDatabase *db, BOOL *rollback) {
 
+        BOOL covering = YES;
         for (CDTDocumentRevision *revision in updateBatch) {
+            // A revision which doesn't match a partial index's selector isn't in the index.
+            NSArray *insertStatements = @[];
+            if (!partialMatcher || [partialMatcher matches:revision]) {
+                covering = covering && [CDTQIndexUpdater indexCanStoreValuesOfRevision:revision
+                                                                         withFieldNames:fieldNames
+                                                                             fieldTypes:fieldTypes];
+
+                // If we are indexing a document where one field is an array, we
+                // have multiple rows to insert into the index.
+                insertStatements =
+                    [CDTQIndexUpdater partsToIndexRevision:revision
+                                                   inIndex:indexName
+                                            withFieldNames:fieldNames
+                                                  multiKey:[self.multiKeyIndexNames
+                                                               containsObject:indexName]
+                                                fieldTypes:fieldTypes]
+                        ?: @[];
+            }
+
+            // Leave the rows alone if none of the indexed fields has changed.
+            if ([CDTQIndexUpdater updateRevisionOfUnchangedRowsOfRevision:revision
+                                                                  inIndex:indexName
+                                                                  inserts:insertStatements
+                                                                 database:db]) {
+                continue;
+            }
+
             // Delete existing values
             CDTQSqlParts *parts = [CDTQIndexUpdater partsToDeleteIndexEntriesForDocId:revision.docId
                                                                             fromIndex:indexName];
@@ -207,13 +371,6 @@
                 withArgumentsInArray:parts.placeholderValues];
 
             // Insert new values as the rev isn't deleted
-
-            // If we are indexing a document where one field is an array, we
-            // have multiple rows to insert into the index.
-            NSArray *insertStatements = [CDTQIndexUpdater partsToIndexRevision:revision
-                                                                       inIndex:indexName
-                                                                withFieldNames:fieldNames];
-
             for (CDTQSqlParts *insert in insertStatements) {
                 // partsToIndexRevision:... returns nil if there are no applicable fields to
                 // index
@@ -235,30 +392,294 @@
                 break;
             }
         }
+
+        if (success && !covering) {
+            CDTQSqlParts *parts = [CDTQIndexUpdater partsToClearCoveringOfIndex:indexName];
+            success = [db executeUpdate:parts.sqlWithPlaceholders
+                   withArgumentsInArray:parts.placeholderValues];
+            *rollback = !success;
+        }
+
+        NSNumber *fts5 = self.textIndexUsesFTS5[indexName];
+        if (success && fts5) {
+            CDTQSqlParts *parts =
+                [CDTQIndexUpdater partsToMergeTextIndex:indexName fts5:fts5.boolValue];
+            success = [db executeUpdate:parts.sqlWithPlaceholders
+                   withArgumentsInArray:parts.placeholderValues];
+            *rollback = !success;
+        }
     }];
 
+    CDTSignpostIntervalEnd(signpost, "processUpdateBatch", "succeeded=%d", success);
     return success;
 }
 
 - (BOOL)processDeleteBatch:(NSArray *)deleteBatch forIndex:(NSString *)indexName
 {
+    return [self processDeleteBatch:deleteBatch forIndexes:@[ indexName ]];
+}
+
+/**
+ Update several indexes from a single pass over the changes feed.
+
+ The feed is read from the lowest of the indexes' sequence numbers. A revision is only indexed
+ in the indexes which aren't already up to date with it, while deletions are applied to every
+ index, which is harmless for those that never saw the document.
+
+ The index rows for each batch of revisions are generated concurrently, as that involves
+ decoding every revision's body, and then all the indexes are written in one transaction.
+ */
+- (BOOL)updateIndexes:(NSDictionary /*NSString -> NSArray[NSString]*/ *)fieldsForIndex
+    startingSequences:(NSDictionary /*NSString -> NSNumber*/ *)sequenceForIndex
+{
+    // Documents indexed without the value of an expression would be missing from queries on it.
+    for (NSArray *fieldNames in [fieldsForIndex allValues]) {
+        if (![CDTQValueExtractor expressionsAreRegisteredForFieldNames:fieldNames]) {
+            return NO;
+        }
+    }
+
+    __block bool success = YES;
+
+    SequenceNumber lastSequence = LLONG_MAX;
+    for (NSNumber *sequence in [sequenceForIndex allValues]) {
+        lastSequence = MIN(lastSequence, sequence.longLongValue);
+    }
+
+    NSString *lastSeqString = [[NSNumber numberWithLongLong:lastSequence] stringValue];
+    CDTFetchChanges *fetcher =
+        [[CDTFetchChanges alloc] initWithDatastore:_datastore startSequenceValue:lastSeqString];
+
+    __weak CDTQIndexUpdater *weakSelf = self;
+
+    NSMutableArray *updateBatch = [NSMutableArray array];
+    NSMutableArray *deleteBatch = [NSMutableArray array];
+
+    // Building only inserts, so it can afford much bigger transactions. Documents changed since
+    // it started may already have rows, which the update after the build replaces.
+    BOOL building = self.building;
+    SequenceNumber buildSequence = self.buildSequence;
+    NSUInteger batchSize = building ? kCDTQBulkBuildBatchSize : 500;
+
+    fetcher.documentChangedBlock = ^(CDTDocumentRevision *revision) {
+        if (building && revision.sequence > buildSequence) {
+            return;
+        }
+        [updateBatch addObject:revision];
+
+        if (updateBatch.count > batchSize) {
+            CDTQIndexUpdater *self = weakSelf;
+            if (self) {
+                success = success && [self processUpdateBatch:updateBatch
+                                                    forIndexes:fieldsForIndex
+                                             startingSequences:sequenceForIndex];
+                [updateBatch removeAllObjects];
+            }
+        }
+    };
+
+    fetcher.documentWithIDWasDeletedBlock = ^(NSString *docId) {
+        if (building) {
+            return;  // a new index has no rows to delete
+        }
+        [deleteBatch addObject:docId];
+
+        if (deleteBatch.count >= kCDTQDeleteBatchSize) {
+            CDTQIndexUpdater *self = weakSelf;
+            if (self) {
+                success = success && [self processDeleteBatch:deleteBatch
+                                                   forIndexes:[fieldsForIndex allKeys]];
+                [deleteBatch removeAllObjects];
+            }
+        }
+    };
+
+    fetcher.fetchRecordChangesCompletionBlock = ^(NSString *newSeqVal, NSString *prevSeqVal,
+                                                  NSError *error) {
+
+        os_log_debug(CDTOSLog, "fetchRecordChangesCompletionBlock: <%{public}@,%{public}@>",
+                     [[fieldsForIndex allKeys] componentsJoinedByString:@","], newSeqVal);
+
+        CDTQIndexUpdater *self = weakSelf;
+        if (self) {
+            // Process any remaining updates and deletes
+            success = success && [self processUpdateBatch:updateBatch
+                                                forIndexes:fieldsForIndex
+                                         startingSequences:sequenceForIndex];
+            [updateBatch removeAllObjects];
+            success = success &&
+                      [self processDeleteBatch:deleteBatch forIndexes:[fieldsForIndex allKeys]];
+            [deleteBatch removeAllObjects];
+
+            if (success) {
+                for (NSString *indexName in fieldsForIndex) {
+                    SequenceNumber sequence = MAX([newSeqVal longLongValue],
+                                                  [sequenceForIndex[indexName] longLongValue]);
+                    [self updateMetadataForIndex:indexName
+                                    lastSequence:building ? buildSequence : sequence];
+                }
+            }
+        }
+    };
+
+    [fetcher start];  // Run NSOperation synchronously
+
+    return success;
+}
+
+- (BOOL)processUpdateBatch:(NSArray *)updateBatch
+                forIndexes:(NSDictionary /*NSString -> NSArray[NSString]*/ *)fieldsForIndex
+         startingSequences:(NSDictionary /*NSString -> NSNumber*/ *)sequenceForIndex
+{
+    if (updateBatch.count == 0) {
+        return YES;
+    }
+
+    NSArray *indexNames = [fieldsForIndex allKeys];
+    NSSet *multiKeyIndexNames = [self.multiKeyIndexNames copy];
+    NSDictionary *partialIndexMatchers = [self.partialIndexMatchers copy];
+    NSDictionary *fieldTypesForIndex = [self.fieldTypesForIndex copy];
+
+    // Build the INSERTs for every (revision, index) pair up front. Each revision is handled by
+    // only one iteration, so its body is only ever decoded on one thread.
+    NSMutableSet *notCovering = [NSMutableSet set];
+    NSMutableArray *insertsForRevision = [NSMutableArray arrayWithCapacity:updateBatch.count];
+    for (NSUInteger i = 0; i < updateBatch.count; i++) {
+        [insertsForRevision addObject:[NSNull null]];
+    }
+    dispatch_apply(updateBatch.count, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^(size_t i) {
+        @autoreleasepool {
+            CDTDocumentRevision *revision = updateBatch[i];
+            NSMutableDictionary *inserts = [NSMutableDictionary dictionary];
+            for (NSString *indexName in indexNames) {
+                if (revision.sequence <= [sequenceForIndex[indexName] longLongValue]) {
+                    continue;  // this index is already up to date with this revision
+                }
+                CDTQUnindexedMatcher *partialMatcher = partialIndexMatchers[indexName];
+                if (partialMatcher && ![partialMatcher matches:revision]) {
+                    inserts[indexName] = @[];  // only removes any rows of an earlier revision
+                    continue;
+                }
+                NSArray *parts =
+                    [CDTQIndexUpdater partsToIndexRevision:revision
+                                                   inIndex:indexName
+                                            withFieldNames:fieldsForIndex[indexName]
+                                                  multiKey:[multiKeyIndexNames
+                                                               containsObject:indexName]
+                                                fieldTypes:fieldTypesForIndex[indexName]];
+                inserts[indexName] = parts ?: @[];
+                if (![CDTQIndexUpdater indexCanStoreValuesOfRevision:revision
+                                                      withFieldNames:fieldsForIndex[indexName]
+                                                          fieldTypes:fieldTypesForIndex[indexName]]) {
+                    @synchronized(notCovering) { [notCovering addObject:indexName]; }
+                }
+            }
+            @synchronized(insertsForRevision) { insertsForRevision[i] = inserts; }
+        }
+    });
+
     __block BOOL success = YES;
 
     [_database inTransaction:^(FMDatabase *db, BOOL *rollback) {
 
-        for (NSString *docId in deleteBatch) {
-            // Delete existing values
-            CDTQSqlParts *parts =
-                [CDTQIndexUpdater partsToDeleteIndexEntriesForDocId:docId fromIndex:indexName];
-            [db executeUpdate:parts.sqlWithPlaceholders
-                withArgumentsInArray:parts.placeholderValues];
+        NSMutableSet *updatedIndexNames = [NSMutableSet set];
+        for (NSUInteger i = 0; i < updateBatch.count && success; i++) {
+            CDTDocumentRevision *revision = updateBatch[i];
+            NSDictionary *inserts = insertsForRevision[i];
+
+            for (NSString *indexName in inserts) {
+                // Delete existing values; while building there are none, and without the
+                // SQLite index each DELETE would scan the table. Rows whose indexed fields
+                // haven't changed are left alone.
+                if (!self.building) {
+                    if ([CDTQIndexUpdater updateRevisionOfUnchangedRowsOfRevision:revision
+                                                                          inIndex:indexName
+                                                                          inserts:inserts[indexName]
+                                                                         database:db]) {
+                        continue;
+                    }
+                    CDTQSqlParts *parts =
+                        [CDTQIndexUpdater partsToDeleteIndexEntriesForDocId:revision.docId
+                                                                  fromIndex:indexName];
+                    [db executeUpdate:parts.sqlWithPlaceholders
+                        withArgumentsInArray:parts.placeholderValues];
+                }
+                [updatedIndexNames addObject:indexName];
+
+                for (CDTQSqlParts *insert in inserts[indexName]) {
+                    success = success && [db executeUpdate:insert.sqlWithPlaceholders
+                                             withArgumentsInArray:insert.placeholderValues];
+
+                    if (!success) {
+                        os_log_error(CDTOSLog, "Updating index %{public}@ failed, CDTSqlParts: %{public}@",
+                                     indexName, insert);
+                        break;
+                    }
+                }
+
+                if (!success) {
+                    break;
+                }
+            }
+        }
+
+        for (NSString *indexName in notCovering) {
+            CDTQSqlParts *parts = [CDTQIndexUpdater partsToClearCoveringOfIndex:indexName];
+            success = success && [db executeUpdate:parts.sqlWithPlaceholders
+                                  withArgumentsInArray:parts.placeholderValues];
         }
 
+        for (NSString *indexName in updatedIndexNames) {
+            NSNumber *fts5 = self.textIndexUsesFTS5[indexName];
+            if (fts5) {
+                CDTQSqlParts *parts =
+                    [CDTQIndexUpdater partsToMergeTextIndex:indexName fts5:fts5.boolValue];
+                success = success && [db executeUpdate:parts.sqlWithPlaceholders
+                                      withArgumentsInArray:parts.placeholderValues];
+            }
+        }
+
+        if (!success) {
+            *rollback = YES;
+        }
     }];
 
     return success;
 }
 
+- (BOOL)deleteIndexEntriesForDocIds:(NSArray<NSString *> *)docIds
+                        fromIndexes:(NSArray<NSString *> *)indexNames
+{
+    return [self processDeleteBatch:docIds forIndexes:indexNames];
+}
+
+- (BOOL)processDeleteBatch:(NSArray *)deleteBatch forIndexes:(NSArray /* NSString */ *)indexNames
+{
+    if (deleteBatch.count == 0) {
+        return YES;
+    }
+
+    // Every index's rows go in one transaction, kCDTQMaxDocIdsPerDelete documents per DELETE.
+    [_database inTransaction:^(FMDatabase *db, BOOL *rollback) {
+
+        for (NSString *indexName in indexNames) {
+            for (NSUInteger offset = 0; offset < deleteBatch.count;
+                 offset += kCDTQMaxDocIdsPerDelete) {
+                NSRange range = NSMakeRange(
+                    offset, MIN(kCDTQMaxDocIdsPerDelete, deleteBatch.count - offset));
+                CDTQSqlParts *parts = [CDTQIndexUpdater
+                    partsToDeleteIndexEntriesForDocIds:[deleteBatch subarrayWithRange:range]
+                                             fromIndex:indexName];
+                [db executeUpdate:parts.sqlWithPlaceholders
+                    withArgumentsInArray:parts.placeholderValues];
+            }
+        }
+
+    }];
+
+    return YES;
+}
+
 + (CDTQSqlParts *)partsToDeleteIndexEntriesForDocId:(NSString *)docId
                                           fromIndex:(NSString *)indexName
 {
@@ -278,6 +699,179 @@
     return [CDTQSqlParts partsForSql:sqlDelete parameters:@[ docId ]];
 }
 
++ (CDTQSqlParts *)partsToDeleteIndexEntriesForDocIds:(NSArray<NSString *> *)docIds
+                                           fromIndex:(NSString *)indexName
+{
+    if (docIds.count == 0) {
+        return nil;
+    }
+
+    if (!indexName) {
+        return nil;
+    }
+
+    NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+
+    NSMutableArray *placeholders = [NSMutableArray arrayWithCapacity:docIds.count];
+    for (NSUInteger i = 0; i < docIds.count; i++) {
+        [placeholders addObject:@"?"];
+    }
+    NSString *sqlDelete = @"DELETE FROM \"%@\" WHERE _id IN ( %@ );";
+    sqlDelete = [NSString stringWithFormat:sqlDelete, tableName,
+                                           [placeholders componentsJoinedByString:@", "]];
+
+    return [CDTQSqlParts partsForSql:sqlDelete parameters:docIds];
+}
+
+/**
+ Returns the row an INSERT made by +createPartsForFieldNames:... or the multikey
+ +partsToIndexRevision:... would add, as a dictionary of column name to value, leaving out _rev,
+ or nil if the statement isn't one of those.
+ */
++ (nullable NSDictionary *)rowWithoutRevisionOfInsert:(CDTQSqlParts *)insert
+{
+    // INSERT INTO "table" ( "_id", "_rev", "field" ) VALUES ( ?, ?, ? );
+    NSString *sql = insert.sqlWithPlaceholders;
+    NSRange start = [sql rangeOfString:@"\" ( \""];
+    NSRange end = [sql rangeOfString:@"\" ) VALUES ( " options:NSBackwardsSearch];
+    if (start.location == NSNotFound || end.location == NSNotFound ||
+        end.location < NSMaxRange(start)) {
+        return nil;
+    }
+    NSRange columnsRange = NSMakeRange(NSMaxRange(start), end.location - NSMaxRange(start));
+    NSArray *columns =
+        [[sql substringWithRange:columnsRange] componentsSeparatedByString:@"\", \""];
+    if (columns.count != insert.placeholderValues.count) {
+        return nil;
+    }
+
+    NSMutableDictionary *row = [NSMutableDictionary dictionaryWithCapacity:columns.count];
+    for (NSUInteger i = 0; i < columns.count; i++) {
+        if (![columns[i] isEqualToString:@"_rev"]) {
+            row[columns[i]] = insert.placeholderValues[i];
+        }
+    }
+    return row;
+}
+
+/**
+ If the rows an index has for a revision's document hold the same values as the INSERTs would
+ add, only sets their _rev to the revision's, and returns YES; otherwise returns NO, leaving the
+ caller to replace the rows. Values which SQLite stores differently from how they're read back
+ only cause the rows to be replaced. Only call from within a transaction.
+ */
++ (BOOL)updateRevisionOfUnchangedRowsOfRevision:(CDTDocumentRevision *)revision
+                                        inIndex:(NSString *)indexName
+                                        inserts:(NSArray<CDTQSqlParts *> *)inserts
+                                       database:(FMDatabase *)db
+{
+    NSCountedSet *newRows = [NSCountedSet set];
+    for (CDTQSqlParts *insert in inserts) {
+        NSDictionary *row = [CDTQIndexUpdater rowWithoutRevisionOfInsert:insert];
+        if (!row) {
+            return NO;
+        }
+        [newRows addObject:row];
+    }
+
+    NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+    NSString *sql = [NSString stringWithFormat:@"SELECT * FROM \"%@\" WHERE _id = ?;", tableName];
+    FMResultSet *rs = [db executeQuery:sql withArgumentsInArray:@[ revision.docId ]];
+    if (!rs) {
+        return NO;
+    }
+    NSCountedSet *existingRows = [NSCountedSet set];
+    NSUInteger existingCount = 0;
+    BOOL sameRevision = YES;
+    while ([rs next]) {
+        NSMutableDictionary *row = [NSMutableDictionary dictionary];
+        for (int i = 0; i < rs.columnCount; i++) {
+            NSString *column = [rs columnNameForIndex:i];
+            id value = [rs objectForColumnIndex:i];
+            if ([column isEqualToString:@"_rev"]) {
+                sameRevision = sameRevision && [value isEqual:revision.revId];
+            } else if (value && value != [NSNull null]) {
+                row[column] = value;  // a missing field is stored as NULL
+            }
+        }
+        [existingRows addObject:row];
+        existingCount++;
+    }
+    [rs close];
+
+    if (existingCount != inserts.count) {
+        return NO;
+    }
+    for (NSDictionary *row in newRows) {
+        if ([existingRows countForObject:row] != [newRows countForObject:row]) {
+            return NO;
+        }
+    }
+
+    if (sameRevision || existingCount == 0) {
+        return YES;
+    }
+    sql = [NSString stringWithFormat:@"UPDATE \"%@\" SET _rev = ? WHERE _id = ?;", tableName];
+    return [db executeUpdate:sql withArgumentsInArray:@[ revision.revId, revision.docId ]];
+}
+
++ (BOOL)indexCanStoreValuesOfRevision:(CDTDocumentRevision *)rev
+                       withFieldNames:(NSArray *)fieldNames
+{
+    return [CDTQIndexUpdater indexCanStoreValuesOfRevision:rev
+                                            withFieldNames:fieldNames
+                                                fieldTypes:nil];
+}
+
++ (BOOL)indexCanStoreValuesOfRevision:(CDTDocumentRevision *)rev
+                       withFieldNames:(NSArray *)fieldNames
+                           fieldTypes:(NSDictionary *)fieldTypes
+{
+    for (NSString *fieldName in fieldNames) {
+        NSObject *value =
+            [CDTQValueExtractor extractValueForFieldName:fieldName fromDictionary:rev.body];
+        if (!value) {
+            continue;  // no value is stored as NULL, which projects as null anyway
+        }
+        if (fieldTypes[fieldName] &&
+            ![CDTQIndex value:value normalisedForFieldType:fieldTypes[fieldName]]) {
+            return NO;  // stored as NULL
+        }
+        // Arrays are split into a row per element, objects stored as their description and
+        // booleans as integers.
+        if (!([value isKindOfClass:[NSString class]] || [value isKindOfClass:[NSNumber class]] ||
+              value == [NSNull null]) ||
+            CFGetTypeID((__bridge CFTypeRef)value) == CFBooleanGetTypeID()) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
++ (CDTQSqlParts *)partsToMergeTextIndex:(NSString *)indexName fts5:(BOOL)fts5
+{
+    NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+    NSString *sql;
+    if (fts5) {
+        sql = [NSString stringWithFormat:@"INSERT INTO \"%@\" (\"%@\", rank) VALUES ('merge', %lu);",
+                                         tableName, tableName,
+                                         (unsigned long)kCDTQTextIndexMergePages];
+    } else {
+        // Only merges levels holding at least 8 segments.
+        sql = [NSString stringWithFormat:@"INSERT INTO \"%@\" (\"%@\") VALUES ('merge=%lu,8');",
+                                         tableName, tableName,
+                                         (unsigned long)kCDTQTextIndexMergePages];
+    }
+    return [CDTQSqlParts partsForSql:sql parameters:@[]];
+}
+
++ (CDTQSqlParts *)partsToClearCoveringOfIndex:(NSString *)indexName
+{
+    NSString *sql = @"UPDATE %@ SET covering = 0 WHERE index_name = ? AND covering = 1;";
+    sql = [NSString stringWithFormat:sql, kCDTQIndexMetadataTableName];
+    return [CDTQSqlParts partsForSql:sql parameters:@[ indexName ]];
+}
+
 /**
  Returns an array of insert statements to index a document in an index.
 
@@ -287,6 +881,17 @@
 + (nullable NSArray /*CDTQSqlParts*/ *)partsToIndexRevision:(CDTDocumentRevision *)rev
                                                     inIndex:(NSString *)indexName
                                              withFieldNames:(NSArray *)fieldNames
+{
+    return [CDTQIndexUpdater partsToIndexRevision:rev
+                                          inIndex:indexName
+                                   withFieldNames:fieldNames
+                                       fieldTypes:nil];
+}
+
++ (nullable NSArray /*CDTQSqlParts*/ *)partsToIndexRevision:(CDTDocumentRevision *)rev
+                                                    inIndex:(NSString *)indexName
+                                             withFieldNames:(NSArray *)fieldNames
+                                                 fieldTypes:(NSDictionary *)fieldTypes
 {
     if (!rev) {
         return nil;
@@ -341,13 +946,20 @@
             // need special-casing to get the values.
             NSArray *placeholders = @[ @"?", @"?", @"?" ];
             NSArray *includedFieldNames = @[ @"_id", @"_rev", arrayFieldName ];
-            NSArray *args = @[ rev.docId, rev.revId, value ];
+            NSObject *storedValue = value;
+            if (fieldTypes[arrayFieldName]) {
+                storedValue = [CDTQIndex value:value
+                        normalisedForFieldType:fieldTypes[arrayFieldName]]
+                                  ?: [NSNull null];
+            }
+            NSArray *args = @[ rev.docId, rev.revId, storedValue ];
             CDTQSqlParts *parts = [CDTQIndexUpdater createPartsForFieldNames:fieldNames
                                                        initialIncludedFields:includedFieldNames
                                                          initialPlaceholders:placeholders
                                                                  initialArgs:args
                                                                    indexName:indexName
-                                                                    revision:rev];
+                                                                    revision:rev
+                                                                  fieldTypes:fieldTypes];
             [insertStatements addObject:parts];
         }
     } else {
@@ -360,19 +972,177 @@
                                                      initialPlaceholders:@[ @"?", @"?" ]
                                                              initialArgs:@[ rev.docId, rev.revId ]
                                                                indexName:indexName
-                                                                revision:rev];
+                                                                revision:rev
+                                                              fieldTypes:fieldTypes];
         [insertStatements addObject:parts];
     }
     
     return insertStatements.copy;
 }
 
++ (nullable NSArray /*CDTQSqlParts*/ *)partsToIndexRevision:(CDTDocumentRevision *)rev
+                                                    inIndex:(NSString *)indexName
+                                             withFieldNames:(NSArray *)fieldNames
+                                                   multiKey:(BOOL)multiKey
+{
+    return [CDTQIndexUpdater partsToIndexRevision:rev
+                                          inIndex:indexName
+                                   withFieldNames:fieldNames
+                                         multiKey:multiKey
+                                       fieldTypes:nil];
+}
+
++ (nullable NSArray /*CDTQSqlParts*/ *)partsToIndexRevision:(CDTDocumentRevision *)rev
+                                                    inIndex:(NSString *)indexName
+                                             withFieldNames:(NSArray *)fieldNames
+                                                   multiKey:(BOOL)multiKey
+                                                 fieldTypes:(NSDictionary *)fieldTypes
+{
+    // Only JSON indexes have typed fields.
+    if (!multiKey) {
+        return [CDTQIndexUpdater partsToIndexRevision:rev
+                                              inIndex:indexName
+                                       withFieldNames:fieldNames
+                                           fieldTypes:fieldTypes];
+    }
+
+    if (!rev || !indexName || !fieldNames) {
+        return nil;
+    }
+
+    NSArray *rows = [CDTQIndexUpdater multiKeyRowsForBody:rev.body withFieldNames:fieldNames];
+    if (!rows) {
+        os_log_error(CDTOSLog, "Indexing %{public}@ in multikey index %{public}@ needs more than %lu rows; document not indexed",
+                     rev.docId, indexName, (unsigned long)kCDTQMultiKeyMaximumRows);
+        return nil;
+    }
+
+    NSMutableArray *insertStatements = [NSMutableArray arrayWithCapacity:rows.count];
+    for (NSDictionary *row in rows) {
+        NSMutableArray *sqlSafeFieldNames =
+            [NSMutableArray arrayWithObjects:@"\"_id\"", @"\"_rev\"", nil];
+        NSMutableArray *placeholders = [NSMutableArray arrayWithObjects:@"?", @"?", nil];
+        NSMutableArray *args = [NSMutableArray arrayWithObjects:rev.docId, rev.revId, nil];
+        for (NSString *fieldName in fieldNames) {
+            if (row[fieldName]) {
+                [sqlSafeFieldNames addObject:[NSString stringWithFormat:@"\"%@\"", fieldName]];
+                [placeholders addObject:@"?"];
+                [args addObject:row[fieldName]];
+            }
+        }
+
+        NSString *sql = @"INSERT INTO \"%@\" ( %@ ) VALUES ( %@ );";
+        sql = [NSString stringWithFormat:sql, [CDTQIndexManager tableNameForIndex:indexName],
+                                         [sqlSafeFieldNames componentsJoinedByString:@", "],
+                                         [placeholders componentsJoinedByString:@", "]];
+        [insertStatements addObject:[CDTQSqlParts partsForSql:sql parameters:args]];
+    }
+
+    return insertStatements.copy;
+}
+
+/**
+ Returns the rows of a multikey index for a document body, each a dictionary of field name to
+ value, or nil if there are more than kCDTQMultiKeyMaximumRows of them.
+
+ Each field is grouped by the first array its path passes through, and the rest of its path is
+ looked up in each element of that array. An empty array is treated as a missing field and
+ arrays within elements aren't expanded any further, so those values are left out.
+ */
++ (nullable NSArray<NSDictionary *> *)multiKeyRowsForBody:(NSDictionary *)body
+                                           withFieldNames:(NSArray *)fieldNames
+{
+    NSMutableDictionary *scalarValues = [NSMutableDictionary dictionary];
+    NSMutableArray *arrayPaths = [NSMutableArray array];  // in the order of the fields
+    NSMutableDictionary *arraysForPath = [NSMutableDictionary dictionary];
+    NSMutableDictionary *remaindersForPath = [NSMutableDictionary dictionary];
+
+    for (NSString *fieldName in fieldNames) {
+        // _id and _rev come from the revision rather than its body.
+        if ([fieldName isEqualToString:@"_id"] || [fieldName isEqualToString:@"_rev"]) {
+            continue;
+        }
+
+        NSArray *path = [fieldName componentsSeparatedByString:@"."];
+        NSObject *value = body;
+        NSUInteger depth = 0;
+        if ([CDTQValueExtractor isExpressionFieldName:fieldName]) {
+            // An expression's value stands for the whole path, and its arrays are expanded too.
+            value = [CDTQValueExtractor extractValueForFieldName:fieldName fromDictionary:body];
+            depth = path.count;
+        }
+        while (depth < path.count && [value isKindOfClass:[NSDictionary class]]) {
+            value = ((NSDictionary *)value)[path[depth++]];
+        }
+
+        if ([value isKindOfClass:[NSArray class]]) {
+            NSString *arrayPath =
+                [[path subarrayWithRange:NSMakeRange(0, depth)] componentsJoinedByString:@"."];
+            if (!arraysForPath[arrayPath]) {
+                [arrayPaths addObject:arrayPath];
+                arraysForPath[arrayPath] = value;
+                remaindersForPath[arrayPath] = [NSMutableDictionary dictionary];
+            }
+            remaindersForPath[arrayPath][fieldName] =
+                [path subarrayWithRange:NSMakeRange(depth, path.count - depth)];
+        } else if (depth == path.count && value) {
+            scalarValues[fieldName] = value;
+        }
+    }
+
+    NSArray *rows = @[ scalarValues ];
+    for (NSString *arrayPath in arrayPaths) {
+        NSDictionary *remainders = remaindersForPath[arrayPath];
+        NSMutableArray *elementValues = [NSMutableArray array];
+        for (NSObject *element in arraysForPath[arrayPath]) {
+            NSMutableDictionary *values = [NSMutableDictionary dictionary];
+            for (NSString *fieldName in remainders) {
+                NSArray *remainder = remainders[fieldName];
+                NSObject *value = element;
+                if (remainder.count > 0) {
+                    value = nil;
+                    if ([element isKindOfClass:[NSDictionary class]]) {
+                        value = [CDTQValueExtractor extractValueForFieldPath:remainder
+                                                              fromDictionary:(id)element];
+                    }
+                }
+                if (value && ![value isKindOfClass:[NSArray class]]) {
+                    values[fieldName] = value;
+                }
+            }
+            [elementValues addObject:values];
+        }
+
+        if (elementValues.count == 0) {
+            continue;
+        }
+        if (rows.count * elementValues.count > kCDTQMultiKeyMaximumRows) {
+            return nil;
+        }
+
+        // Every row so far is combined with every element of this array.
+        NSMutableArray *combined =
+            [NSMutableArray arrayWithCapacity:rows.count * elementValues.count];
+        for (NSDictionary *row in rows) {
+            for (NSDictionary *values in elementValues) {
+                NSMutableDictionary *combinedRow = [row mutableCopy];
+                [combinedRow addEntriesFromDictionary:values];
+                [combined addObject:combinedRow];
+            }
+        }
+        rows = combined;
+    }
+
+    return rows;
+}
+
 + (CDTQSqlParts *)createPartsForFieldNames:(NSArray *)fieldNames
                      initialIncludedFields:(NSArray *)initialIncludedFields
                        initialPlaceholders:(NSArray *)initialPlaceholders
                                initialArgs:(NSArray *)initialArgs
                                  indexName:(NSString *)indexName
                                   revision:(CDTDocumentRevision *)rev
+                                fieldTypes:(NSDictionary *)fieldTypes
 {
     NSMutableArray *includedFieldNames = [initialIncludedFields mutableCopy];
     NSMutableArray *placeholders = [initialPlaceholders mutableCopy];
@@ -388,6 +1158,10 @@
 
         NSObject *value = [CDTQValueExtractor extractValueForFieldName:fieldName
                                                         fromDictionary:rev.body];
+        if (value && fieldTypes[fieldName]) {
+            // A value of another type is left out, so stored as NULL
+            value = [CDTQIndex value:value normalisedForFieldType:fieldTypes[fieldName]];
+        }
         if (value && !([value isKindOfClass:[NSArray class]] && ((NSArray *)value).count == 0)) {
             // Only include a field with a value or a field with a populated array
             [includedFieldNames addObject:fieldName];
@@ -430,6 +1204,26 @@
     return result;
 }
 
+/**
+ Records how the index is updated from its listIndexes details: whether it's a multikey or text
+ index and, for a partial index, the matcher revisions must pass to be indexed.
+ */
+- (void)noteIndex:(NSString *)indexName withDetails:(NSDictionary *)details
+{
+    if ([details[@"type"] isEqualToString:@"multikey"]) {
+        [self.multiKeyIndexNames addObject:indexName];
+    } else if ([details[@"type"] isEqualToString:@"text"]) {
+        self.textIndexUsesFTS5[indexName] = @([CDTQIndexManager isFTS5TextIndex:details]);
+    }
+    if (details[@"selector"]) {
+        self.partialIndexMatchers[indexName] =
+            [CDTQUnindexedMatcher matcherWithSelector:details[@"selector"]];
+    }
+    if (details[@"fieldTypes"]) {
+        self.fieldTypesForIndex[indexName] = details[@"fieldTypes"];
+    }
+}
+
 - (BOOL)updateMetadataForIndex:(NSString *)indexName lastSequence:(SequenceNumber)lastSequence
 {
     __block BOOL success = TRUE;
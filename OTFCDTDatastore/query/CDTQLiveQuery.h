@@ -0,0 +1,98 @@
+//
+//  CDTQLiveQuery.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class CDTDocumentRevision;
+@class CDTQIndexManager;
+
+/**
+ How the results of a live query changed. The index sets are in the form a table or collection
+ view's batch updates take: deletions are indexes into the previous results, insertions and
+ updates indexes into the new ones. A document whose sort fields changed is deleted from its
+ old position and inserted at its new one, rather than updated.
+ */
+@interface CDTQLiveQueryChanges : NSObject
+
+/** All the documents now matching the query, ordered by the sort document, then by ID. */
+@property (nonatomic, strong, readonly) NSArray<CDTDocumentRevision *> *results;
+
+/** Indexes in the previous results of the documents which no longer match, or moved. */
+@property (nonatomic, strong, readonly) NSIndexSet *deletedIndexes;
+
+/** Indexes in `results` of the documents which now match, or moved. */
+@property (nonatomic, strong, readonly) NSIndexSet *insertedIndexes;
+
+/** Indexes in `results` of the documents which still match and were changed in place. */
+@property (nonatomic, strong, readonly) NSIndexSet *updatedIndexes;
+
+- (instancetype)initWithResults:(NSArray<CDTDocumentRevision *> *)results
+                 deletedIndexes:(NSIndexSet *)deletedIndexes
+                insertedIndexes:(NSIndexSet *)insertedIndexes
+                 updatedIndexes:(NSIndexSet *)updatedIndexes NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+typedef void (^CDTQLiveQueryHandler)(CDTQLiveQueryChanges *changes);
+
+/**
+ Keeps the results of a query up to date as the datastore changes.
+
+ The query is run once, and its results delivered to the handler as insertions. After that,
+ only the documents a change notification names are loaded and matched against the selector,
+ and the handler is given the difference to the results. Changes arriving close together are
+ delivered together.
+
+ Live queries are created with CDTQIndexManager -liveQuery:sort:queue:handler:. A live query
+ keeps running until it's stopped or deallocated.
+ */
+@interface CDTQLiveQuery : NSObject
+
+/** The normalised selector. */
+@property (nonatomic, strong, readonly) NSDictionary *selector;
+
+@property (nullable, nonatomic, strong, readonly) NSArray *sortDocument;
+
+/** The results most recently given to the handler. */
+@property (nonatomic, strong, readonly) NSArray<CDTDocumentRevision *> *results;
+
+/**
+ Internal: use CDTQIndexManager -liveQuery:sort:queue:handler:. `query` must be valid, and
+ `selector` its normalised form.
+ */
+- (instancetype)initWithManager:(CDTQIndexManager *)manager
+                          query:(NSDictionary *)query
+                       selector:(NSDictionary *)selector
+                           sort:(nullable NSArray *)sortDocument
+                          queue:(dispatch_queue_t)queue
+                        handler:(CDTQLiveQueryHandler)handler NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/** Internal: starts listening for changes and runs the query. */
+- (void)start;
+
+/**
+ Stops updating the results. The handler won't be called after this returns, though a call
+ already running on another queue may still finish.
+ */
+- (void)stop;
+
+@end
+
+NS_ASSUME_NONNULL_END
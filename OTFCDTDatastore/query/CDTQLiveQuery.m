@@ -0,0 +1,353 @@
+//
+//  CDTQLiveQuery.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTQLiveQuery.h"
+
+#import "CDTQIndexManager.h"
+#import "CDTQResultSet.h"
+#import "CDTQUnindexedMatcher.h"
+#import "CDTQValueExtractor.h"
+#import "CDTLogging.h"
+#import "CDTDatastore.h"
+#import "CDTDocumentRevision.h"
+
+#import "TD_Database.h"
+#import "TD_Revision.h"
+
+@implementation CDTQLiveQueryChanges
+
+- (instancetype)initWithResults:(NSArray<CDTDocumentRevision *> *)results
+                 deletedIndexes:(NSIndexSet *)deletedIndexes
+                insertedIndexes:(NSIndexSet *)insertedIndexes
+                 updatedIndexes:(NSIndexSet *)updatedIndexes
+{
+    self = [super init];
+    if (self) {
+        _results = results;
+        _deletedIndexes = deletedIndexes;
+        _insertedIndexes = insertedIndexes;
+        _updatedIndexes = updatedIndexes;
+    }
+    return self;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"%lu results, deleted: %@ inserted: %@ updated: %@",
+                                      (unsigned long)self.results.count, self.deletedIndexes,
+                                      self.insertedIndexes, self.updatedIndexes];
+}
+
+@end
+
+@interface CDTQLiveQuery ()
+
+@property (nonatomic, strong) CDTQIndexManager *manager;
+@property (nonatomic, strong) NSDictionary *query;
+@property (nonatomic, strong) CDTQUnindexedMatcher *matcher;
+/** For each sort clause, @[ field path, @(descending) ]. */
+@property (nonatomic, strong) NSArray<NSArray *> *sortFields;
+@property (nonatomic, copy) CDTQLiveQueryHandler handler;
+@property (nonatomic, strong) dispatch_queue_t handlerQueue;
+/** Serial; the initial query and the changes after it are run on this queue, in order. */
+@property (nonatomic, strong) dispatch_queue_t updateQueue;
+
+@end
+
+@implementation CDTQLiveQuery {
+    // Guarded by self.
+    NSMutableSet<NSString *> *_changedDocIds;
+    BOOL _updateScheduled;
+    BOOL _stopped;
+    NSArray<CDTDocumentRevision *> *_results;
+}
+
+- (instancetype)initWithManager:(CDTQIndexManager *)manager
+                          query:(NSDictionary *)query
+                       selector:(NSDictionary *)selector
+                           sort:(NSArray *)sortDocument
+                          queue:(dispatch_queue_t)queue
+                        handler:(CDTQLiveQueryHandler)handler
+{
+    self = [super init];
+    if (self) {
+        _manager = manager;
+        _query = query;
+        _selector = selector;
+        _sortDocument = sortDocument;
+        _matcher = [CDTQUnindexedMatcher matcherWithSelector:selector];
+        _handler = handler;
+        _handlerQueue = queue;
+        _updateQueue = dispatch_queue_create("com.cloudant.sync.query.live", DISPATCH_QUEUE_SERIAL);
+        _changedDocIds = [NSMutableSet set];
+        _results = @[];
+
+        NSMutableArray *sortFields = [NSMutableArray array];
+        for (NSDictionary *clause in sortDocument) {
+            NSString *fieldName = clause.allKeys.firstObject;
+            BOOL descending = [[clause[fieldName] uppercaseString] isEqualToString:@"DESC"];
+            [sortFields addObject:@[ fieldName, @(descending) ]];
+        }
+        _sortFields = [NSArray arrayWithArray:sortFields];
+    }
+    return self;
+}
+
+- (void)dealloc { [[NSNotificationCenter defaultCenter] removeObserver:self]; }
+
+- (NSArray<CDTDocumentRevision *> *)results
+{
+    @synchronized(self) { return _results; }
+}
+
+- (BOOL)isStopped
+{
+    @synchronized(self) { return _stopped; }
+}
+
+#pragma mark Running
+
+- (void)start
+{
+    // Listen first, so changes made while the query runs are applied after it.
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(databaseChanged:)
+                                                 name:TD_DatabaseChangeNotification
+                                               object:self.manager.datastore.database];
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(databaseChanged:)
+                                                 name:TD_DatabasePurgedNotification
+                                               object:self.manager.datastore.database];
+
+    __weak CDTQLiveQuery *weakSelf = self;
+    dispatch_async(self.updateQueue, ^{
+        [weakSelf runQuery];
+    });
+}
+
+- (void)stop
+{
+    @synchronized(self) { _stopped = YES; }
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+/** Must be called on the update queue. */
+- (void)runQuery
+{
+    if (self.isStopped) {
+        return;
+    }
+
+    CDTQResultSet *resultSet =
+        [self.manager find:self.query skip:0 limit:0 fields:nil sort:self.sortDocument];
+    if (!resultSet) {
+        os_log_error(CDTOSLog, "Live query %{public}@ failed to run", self.selector);
+    }
+
+    NSMutableArray<CDTDocumentRevision *> *results = [NSMutableArray array];
+    [resultSet enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger idx, BOOL *stop) {
+        [results addObject:rev];
+    }];
+    // The SQL sort orders a few values differently, e.g., mixed types, so we sort to match the
+    // order changes are merged in.
+    [results sortWithOptions:NSSortStable usingComparator:[self comparator]];
+
+    NSIndexSet *all = [NSIndexSet indexSetWithIndexesInRange:NSMakeRange(0, results.count)];
+    [self deliverResults:[NSArray arrayWithArray:results]
+          deletedIndexes:[NSIndexSet indexSet]
+         insertedIndexes:all
+          updatedIndexes:[NSIndexSet indexSet]];
+}
+
+- (void)databaseChanged:(NSNotification *)n
+{
+    NSArray<TD_Revision *> *revs = n.userInfo[@"revs"];
+    if (!revs) {
+        revs = n.userInfo[@"rev"] ? @[ n.userInfo[@"rev"] ] : @[];
+    }
+
+    @synchronized(self)
+    {
+        if (_stopped) {
+            return;
+        }
+        for (TD_Revision *rev in revs) {
+            [_changedDocIds addObject:rev.docID];
+        }
+        // A purge gives just the IDs, of documents which are now gone.
+        [_changedDocIds addObjectsFromArray:n.userInfo[@"docIDs"] ?: @[]];
+        // Changes arriving before the update runs are all applied by it.
+        if (_updateScheduled || _changedDocIds.count == 0) {
+            return;
+        }
+        _updateScheduled = YES;
+    }
+
+    __weak CDTQLiveQuery *weakSelf = self;
+    dispatch_async(self.updateQueue, ^{
+        [weakSelf applyChanges];
+    });
+}
+
+/**
+ Loads the winning revisions of the changed documents and merges those matching the selector
+ into the results. Must be called on the update queue.
+ */
+- (void)applyChanges
+{
+    NSSet<NSString *> *changedDocIds;
+    NSArray<CDTDocumentRevision *> *previous;
+    @synchronized(self)
+    {
+        changedDocIds = _changedDocIds;
+        _changedDocIds = [NSMutableSet set];
+        _updateScheduled = NO;
+        previous = _results;
+        if (_stopped) {
+            return;
+        }
+    }
+
+    NSMutableArray<CDTDocumentRevision *> *current = [NSMutableArray array];
+    for (CDTDocumentRevision *rev in
+         [self.manager.datastore getDocumentsWithIds:changedDocIds.allObjects]) {
+        if (!rev.deleted) {
+            [current addObject:rev];
+        }
+    }
+    NSMutableDictionary<NSString *, CDTDocumentRevision *> *matching =
+        [NSMutableDictionary dictionary];
+    [[self.matcher indexesOfMatchingRevisions:current]
+        enumerateIndexesUsingBlock:^(NSUInteger idx, BOOL *stop) {
+            matching[current[idx].docId] = current[idx];
+        }];
+
+    NSComparator comparator = [self comparator];
+    NSMutableArray<CDTDocumentRevision *> *results = [NSMutableArray array];
+    NSMutableIndexSet *deletedIndexes = [NSMutableIndexSet indexSet];
+    NSMutableSet<NSString *> *insertedDocIds = [NSMutableSet set];
+    NSMutableSet<NSString *> *updatedDocIds = [NSMutableSet set];
+
+    for (NSUInteger i = 0; i < previous.count; i++) {
+        CDTDocumentRevision *rev = previous[i];
+        if (![changedDocIds containsObject:rev.docId]) {
+            [results addObject:rev];
+            continue;
+        }
+
+        CDTDocumentRevision *now = matching[rev.docId];
+        [matching removeObjectForKey:rev.docId];
+        if (!now) {
+            [deletedIndexes addIndex:i];
+        } else if ([now.revId isEqualToString:rev.revId]) {
+            [results addObject:rev];  // e.g., a losing conflict revision was added
+        } else if (comparator(rev, now) == NSOrderedSame) {
+            [results addObject:now];
+            [updatedDocIds addObject:now.docId];
+        } else {
+            [deletedIndexes addIndex:i];
+            [results addObject:now];
+            [insertedDocIds addObject:now.docId];
+        }
+    }
+    for (CDTDocumentRevision *rev in matching.allValues) {
+        [results addObject:rev];
+        [insertedDocIds addObject:rev.docId];
+    }
+
+    if (deletedIndexes.count == 0 && insertedDocIds.count == 0 && updatedDocIds.count == 0) {
+        return;
+    }
+
+    [results sortWithOptions:NSSortStable usingComparator:comparator];
+    NSMutableIndexSet *insertedIndexes = [NSMutableIndexSet indexSet];
+    NSMutableIndexSet *updatedIndexes = [NSMutableIndexSet indexSet];
+    for (NSUInteger i = 0; i < results.count; i++) {
+        if ([insertedDocIds containsObject:results[i].docId]) {
+            [insertedIndexes addIndex:i];
+        } else if ([updatedDocIds containsObject:results[i].docId]) {
+            [updatedIndexes addIndex:i];
+        }
+    }
+
+    [self deliverResults:[NSArray arrayWithArray:results]
+          deletedIndexes:deletedIndexes
+         insertedIndexes:insertedIndexes
+          updatedIndexes:updatedIndexes];
+}
+
+/** Must be called on the update queue. */
+- (void)deliverResults:(NSArray<CDTDocumentRevision *> *)results
+        deletedIndexes:(NSIndexSet *)deletedIndexes
+       insertedIndexes:(NSIndexSet *)insertedIndexes
+        updatedIndexes:(NSIndexSet *)updatedIndexes
+{
+    CDTQLiveQueryChanges *changes = [[CDTQLiveQueryChanges alloc] initWithResults:results
+                                                                    deletedIndexes:deletedIndexes
+                                                                   insertedIndexes:insertedIndexes
+                                                                    updatedIndexes:updatedIndexes];
+    @synchronized(self) { _results = results; }
+    os_log_debug(CDTOSLog, "Live query %{public}@ changed: %{public}@", self.selector, changes);
+
+    // The handler is called on its queue in the order changes were made, as the update queue is
+    // serial and so are the calls it queues.
+    CDTQLiveQueryHandler handler = self.handler;
+    __weak CDTQLiveQuery *weakSelf = self;
+    dispatch_async(self.handlerQueue, ^{
+        CDTQLiveQuery *strongSelf = weakSelf;
+        if (strongSelf && !strongSelf.isStopped) {
+            handler(changes);
+        }
+    });
+}
+
+#pragma mark Ordering
+
+/**
+ Orders revisions by the sort document, then by document ID so the order is total: a revision
+ whose sort fields are unchanged keeps its place relative to the others.
+ */
+- (NSComparator)comparator
+{
+    NSMutableArray *paths = [NSMutableArray array];
+    NSMutableArray *descending = [NSMutableArray array];
+    for (NSArray *sortField in self.sortFields) {
+        [paths addObject:[sortField[0] componentsSeparatedByString:@"."]];
+        [descending addObject:sortField[1]];
+    }
+
+    return ^NSComparisonResult(CDTDocumentRevision *a, CDTDocumentRevision *b) {
+        for (NSUInteger i = 0; i < paths.count; i++) {
+            NSComparisonResult result = [CDTQValueExtractor
+                compareValue:[CDTQLiveQuery valueForFieldPath:paths[i] ofRevision:a]
+                     toValue:[CDTQLiveQuery valueForFieldPath:paths[i] ofRevision:b]];
+            if (result != NSOrderedSame) {
+                return [descending[i] boolValue] ? (NSComparisonResult)-result : result;
+            }
+        }
+        return [a.docId compare:b.docId options:NSLiteralSearch];
+    };
+}
+
++ (NSObject *)valueForFieldPath:(NSArray<NSString *> *)fieldPath ofRevision:(CDTDocumentRevision *)rev
+{
+    if (fieldPath.count == 1 && [fieldPath[0] isEqualToString:@"_id"]) {
+        return rev.docId;
+    } else if (fieldPath.count == 1 && [fieldPath[0] isEqualToString:@"_rev"]) {
+        return rev.revId;
+    }
+    return [CDTQValueExtractor extractValueForFieldPath:fieldPath fromRevision:rev];
+}
+
+@end
@@ -0,0 +1,117 @@
+//
+//  CDTQQueryCache.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+#import "CDTDefines.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class CDTQChildrenQueryNode;
+@class CDTQIndexStatistics;
+@class CDTQResultSet;
+
+/**
+ The validated and translated form of a query, as run by CDTQQueryExecutor -find:... .
+ */
+@interface CDTQQueryPlan : NSObject
+
+/** The normalised selector. */
+@property (nonatomic, strong) NSDictionary *selector;
+
+/** The normalised fields to project, or nil for whole documents. */
+@property (nullable, nonatomic, strong) NSArray *fields;
+
+/** The indexes which may be used for the selector, with unusable partial indexes removed. */
+@property (nonatomic, strong) NSDictionary *indexes;
+
+/** The translated query tree. */
+@property (nonatomic, strong) CDTQChildrenQueryNode *root;
+
+/** NO if documents need to be loaded and matched after the index queries. */
+@property (nonatomic) BOOL indexesCoverQuery;
+
+@end
+
+/**
+ Caches the work repeated each time the same query is run: the index definitions and their
+ statistics, the validated and translated plans of queries and, optionally, their results.
+
+ The index definitions and statistics are a snapshot taken at a datastore sequence: until the
+ datastore changes the indexes are already up to date and needn't be read again. Plans are kept
+ for as long as the indexes and statistics they were made with; results only until the datastore
+ changes. -removeAllObjects, for when an index is created or deleted, drops everything.
+
+ The cache is thread safe.
+ */
+@interface CDTQQueryCache : NSObject
+
+/** Number of plans kept; the least recently used are dropped first. Defaults to 100. */
+@property (nonatomic) NSUInteger planCountLimit;
+
+/** YES to cache result sets as well as plans. Defaults to NO. */
+@property (nonatomic, getter=isResultCachingEnabled) BOOL resultCachingEnabled;
+
+/** Number of result sets kept while result caching is enabled. Defaults to 20. */
+@property (nonatomic) NSUInteger resultCountLimit;
+
+/**
+ Returns the key for the plan of a query, from its selector, sort document and fields as the
+ caller passed them, or nil if they can't be serialised to JSON and so can't be cached.
+ */
++ (nullable NSString *)keyForQuery:(NSDictionary *)query
+                              sort:(nullable NSArray *)sortDocument
+                            fields:(nullable NSArray *)fields;
+
+- (nullable CDTQQueryPlan *)planForKey:(NSString *)key;
+
+- (void)setPlan:(CDTQQueryPlan *)plan forKey:(NSString *)key;
+
+/**
+ Returns the index definitions of the snapshot, and their statistics in `statistics`, if the
+ snapshot was taken at `sequence`; otherwise nil.
+ */
+- (nullable NSDictionary *)indexesAtSequence:(SequenceNumber)sequence
+                                  statistics:(NSDictionary *_Nullable *_Nonnull)statistics;
+
+/**
+ Records the indexes, brought up to date to `sequence`, and their statistics. Results of earlier
+ sequences are dropped, as are the plans if the indexes or statistics have changed.
+ */
+- (void)setIndexes:(NSDictionary *)indexes
+        statistics:(NSDictionary<NSString *, CDTQIndexStatistics *> *)statistics
+        atSequence:(SequenceNumber)sequence;
+
+/**
+ Returns the cached results of the query with plan key `key` and the given skip and limit, if
+ they were found at `sequence`.
+ */
+- (nullable CDTQResultSet *)resultSetForKey:(NSString *)key
+                                       skip:(NSUInteger)skip
+                                      limit:(NSUInteger)limit
+                                 atSequence:(SequenceNumber)sequence;
+
+/** Caches results, if result caching is enabled and `sequence` is that of the snapshot. */
+- (void)setResultSet:(CDTQResultSet *)resultSet
+              forKey:(NSString *)key
+                skip:(NSUInteger)skip
+               limit:(NSUInteger)limit
+          atSequence:(SequenceNumber)sequence;
+
+/** Drops the snapshot, plans and results. */
+- (void)removeAllObjects;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,185 @@
+//
+//  CDTQQueryCache.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "CDTQQueryCache.h"
+
+#import "CDTQResultSet.h"
+#import "CDTLogging.h"
+
+@implementation CDTQQueryPlan
+@end
+
+@implementation CDTQQueryCache {
+    NSCache<NSString *, CDTQQueryPlan *> *_plans;
+    NSCache<NSString *, CDTQResultSet *> *_results;
+
+    // The snapshot; all guarded by self.
+    BOOL _hasSnapshot;
+    SequenceNumber _sequence;
+    NSDictionary *_indexes;
+    NSDictionary *_statistics;
+    BOOL _resultCachingEnabled;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _plans = [[NSCache alloc] init];
+        _plans.countLimit = 100;
+        _results = [[NSCache alloc] init];
+        _results.countLimit = 20;
+    }
+    return self;
+}
+
+- (NSUInteger)planCountLimit { return _plans.countLimit; }
+
+- (void)setPlanCountLimit:(NSUInteger)planCountLimit { _plans.countLimit = planCountLimit; }
+
+- (NSUInteger)resultCountLimit { return _results.countLimit; }
+
+- (void)setResultCountLimit:(NSUInteger)resultCountLimit { _results.countLimit = resultCountLimit; }
+
+- (BOOL)isResultCachingEnabled
+{
+    @synchronized(self) { return _resultCachingEnabled; }
+}
+
+- (void)setResultCachingEnabled:(BOOL)enabled
+{
+    @synchronized(self)
+    {
+        _resultCachingEnabled = enabled;
+        if (!enabled) {
+            [_results removeAllObjects];
+        }
+    }
+}
+
+#pragma mark Plans
+
++ (NSString *)keyForQuery:(NSDictionary *)query sort:(NSArray *)sortDocument fields:(NSArray *)fields
+{
+    NSArray *parts = @[ query, sortDocument ?: [NSNull null], fields ?: [NSNull null] ];
+    if (![NSJSONSerialization isValidJSONObject:parts]) {
+        return nil;
+    }
+
+    // Without sorted keys equal selectors may serialise differently, which only costs a miss.
+    NSJSONWritingOptions options = 0;
+    if (@available(macOS 10.13, iOS 11.0, tvOS 11.0, watchOS 4.0, *)) {
+        options = NSJSONWritingSortedKeys;
+    }
+    NSData *json = [NSJSONSerialization dataWithJSONObject:parts options:options error:nil];
+    return json ? [[NSString alloc] initWithData:json encoding:NSUTF8StringEncoding] : nil;
+}
+
+- (CDTQQueryPlan *)planForKey:(NSString *)key { return [_plans objectForKey:key]; }
+
+- (void)setPlan:(CDTQQueryPlan *)plan forKey:(NSString *)key
+{
+    [_plans setObject:plan forKey:key];
+}
+
+#pragma mark Index snapshot
+
+- (NSDictionary *)indexesAtSequence:(SequenceNumber)sequence
+                         statistics:(NSDictionary *__autoreleasing *)statistics
+{
+    @synchronized(self)
+    {
+        if (!_hasSnapshot || _sequence != sequence) {
+            return nil;
+        }
+        *statistics = _statistics;
+        return _indexes;
+    }
+}
+
+- (void)setIndexes:(NSDictionary *)indexes
+        statistics:(NSDictionary *)statistics
+        atSequence:(SequenceNumber)sequence
+{
+    @synchronized(self)
+    {
+        // Plans depend on which indexes there are and, through the translator's choice of
+        // index and ordering of clauses, on their statistics.
+        if (!_hasSnapshot || ![_indexes isEqualToDictionary:indexes] ||
+            ![_statistics isEqualToDictionary:statistics]) {
+            os_log_debug(CDTOSLog, "Indexes or statistics changed; dropping cached query plans");
+            [_plans removeAllObjects];
+        }
+        if (!_hasSnapshot || _sequence != sequence) {
+            [_results removeAllObjects];
+        }
+        _hasSnapshot = YES;
+        _sequence = sequence;
+        _indexes = indexes;
+        _statistics = statistics;
+    }
+}
+
+#pragma mark Results
+
++ (NSString *)resultKeyForKey:(NSString *)key skip:(NSUInteger)skip limit:(NSUInteger)limit
+{
+    return [NSString stringWithFormat:@"%lu:%lu:%@", (unsigned long)skip, (unsigned long)limit, key];
+}
+
+- (CDTQResultSet *)resultSetForKey:(NSString *)key
+                              skip:(NSUInteger)skip
+                             limit:(NSUInteger)limit
+                        atSequence:(SequenceNumber)sequence
+{
+    @synchronized(self)
+    {
+        if (!_resultCachingEnabled || !_hasSnapshot || _sequence != sequence) {
+            return nil;
+        }
+        return [_results objectForKey:[CDTQQueryCache resultKeyForKey:key skip:skip limit:limit]];
+    }
+}
+
+- (void)setResultSet:(CDTQResultSet *)resultSet
+              forKey:(NSString *)key
+                skip:(NSUInteger)skip
+               limit:(NSUInteger)limit
+          atSequence:(SequenceNumber)sequence
+{
+    @synchronized(self)
+    {
+        if (!_resultCachingEnabled || !_hasSnapshot || _sequence != sequence) {
+            return;
+        }
+        [_results setObject:resultSet
+                     forKey:[CDTQQueryCache resultKeyForKey:key skip:skip limit:limit]];
+    }
+}
+
+#pragma mark Invalidation
+
+- (void)removeAllObjects
+{
+    @synchronized(self)
+    {
+        _hasSnapshot = NO;
+        _indexes = nil;
+        _statistics = nil;
+        [_plans removeAllObjects];
+        [_results removeAllObjects];
+    }
+}
+
+@end
@@ -44,8 +44,20 @@ extern NSString *const NIN;
 
 extern NSString *const SEARCH;
 
+extern NSString *const TEXT_SCORE;
+
 extern NSString *const MOD;
 
 extern NSString *const SIZE;
 
+extern NSString *const ALL;
+
+extern NSString *const ELEM_MATCH;
+
+extern NSString *const GEO_WITHIN;
+
+extern NSString *const BOX;
+
+extern NSString *const CENTER;
+
 NS_ASSUME_NONNULL_END
\ No newline at end of file
@@ -42,6 +42,18 @@ NSString *const NIN = @"$nin";
 
 NSString *const SEARCH = @"$search";
 
+NSString *const TEXT_SCORE = @"$textScore";
+
 NSString *const MOD = @"$mod";
 
 NSString *const SIZE = @"$size";
+
+NSString *const ALL = @"$all";
+
+NSString *const ELEM_MATCH = @"$elemMatch";
+
+NSString *const GEO_WITHIN = @"$geoWithin";
+
+NSString *const BOX = @"$box";
+
+NSString *const CENTER = @"$center";
@@ -19,6 +19,11 @@ NS_ASSUME_NONNULL_BEGIN
 @class CDTDatastore;
 @class CDTQResultSet;
 @class CDTQSqlParts;
+@class CDTQQueryCursor;
+@class CDTQIndexStatistics;
+@class CDTQQueryCache;
+@class CDTQIndexAdvisor;
+@class CDTQueryHandle;
 @class FMDatabaseQueue;
 
 /**
@@ -33,6 +38,32 @@ NS_ASSUME_NONNULL_BEGIN
 - (instancetype)initWithDatabase:(FMDatabaseQueue *)database
                        datastore:(CDTDatastore *)datastore;
 
+/**
+ Statistics for the indexes passed to -find:, keyed by index name. When set, they're used to
+ choose between indexes which could each satisfy part of a query and to order the execution
+ of AND clauses so the most selective runs first.
+ */
+@property (nullable, nonatomic, copy) NSDictionary<NSString *, CDTQIndexStatistics *> *statistics;
+
+/**
+ When set, -find: reuses the plans cached for a query rather than validating and translating it
+ again, and caches those it makes. The cache must be the one whose snapshot `indexes` and
+ `statistics` come from, as it only drops plans when the snapshot changes.
+ */
+@property (nullable, nonatomic, strong) CDTQQueryCache *cache;
+
+/**
+ When set, -find: records there the shape of each query it runs which is slow, by the
+ datastore's slow operation log, or has to load documents to match or sort its results.
+ */
+@property (nullable, nonatomic, strong) CDTQIndexAdvisor *advisor;
+
+/**
+ When set, -find: stops once the handle is cancelled and returns nil, and the result sets it
+ returns stop loading documents when it's cancelled later.
+ */
+@property (nullable, nonatomic, strong) CDTQueryHandle *handle;
+
 /**
  Execute the query passed using the selection of index definition provided.
 
@@ -54,6 +85,69 @@ NS_ASSUME_NONNULL_BEGIN
                             sort:(nullable NSArray<NSDictionary<NSString *, NSString *> *> *)
                                      sortDocument;
 
+/**
+ As above, but returning the results after `cursor`, which is the nextPageCursor of an earlier
+ result set of the same query.
+
+ When a single index satisfies both the selector and the sort, the sort, skip and limit are
+ applied in SQL and only the IDs of the requested page are loaded. Cursors can only be used
+ for such queries; for other queries this returns nil if a cursor is passed.
+ */
+- (nullable CDTQResultSet *)find:(NSDictionary<NSString *, NSObject *> *)query
+                    usingIndexes:(NSDictionary *)indexes
+                            skip:(NSUInteger)skip
+                           limit:(NSUInteger)limit
+                          fields:(nullable NSArray<NSString *> *)fields
+                            sort:(nullable NSArray<NSDictionary<NSString *, NSString *> *> *)
+                                     sortDocument
+                           after:(nullable CDTQQueryCursor *)cursor;
+
+/**
+ Describes how -find:usingIndexes:skip:limit:fields:sort: would execute a query, without
+ running it.
+
+ The dictionary contains the normalised `selector`; `indexesCoverQuery`, which is NO if
+ documents will be loaded and matched after the index queries; `strategy`, either `singleIndex`
+ when the sort and paging happen in SQL, with the `sql` and its `parameters`, or `tree`,
+ along with the `sortIndex` used to sort the results, if any, or `sortInMemory` if no index
+ holds every sort field, so a limited query sorts the documents as they're loaded; and `tree`,
+ the query tree. Each tree node has a `type` (`and`, `or`, `sql` or `allDocuments`), the `children` of
+ `and` and `or` nodes in execution order, the `index`, `sql` and `parameters` of `sql` nodes,
+ and `estimatedRows` when statistics are available.
+
+ @return the plan, or nil if the query or sort document is invalid.
+ */
+- (nullable NSDictionary *)explain:(NSDictionary<NSString *, NSObject *> *)query
+                      usingIndexes:(NSDictionary *)indexes
+                              sort:(nullable NSArray<NSDictionary<NSString *, NSString *> *> *)
+                                       sortDocument;
+
+/**
+ Counts the documents matching the query. Queries the indexes cover are counted in SQL without
+ loading any IDs; others are run as by -find:... and their results counted.
+
+ @return the count, or NSNotFound if the query is invalid.
+ */
+- (NSUInteger)count:(NSDictionary<NSString *, NSObject *> *)query
+       usingIndexes:(NSDictionary *)indexes;
+
+/**
+ Calculates aggregates over the documents matching the query, in SQL over a single JSON index
+ containing the groupBy field and the fields aggregated. See CDTQIndexManager -aggregate:... .
+
+ @return the aggregates, or nil if the query or aggregates are invalid, no index contains the
+         fields, or the query needs documents to be matched by hand.
+ */
+- (nullable NSArray<NSDictionary *> *)aggregate:(NSDictionary<NSString *, NSObject *> *)query
+                                     aggregates:(NSDictionary<NSString *, NSDictionary *> *)aggregates
+                                        groupBy:(nullable NSString *)groupField
+                                   usingIndexes:(NSDictionary *)indexes;
+
+/**
+ Checks a sort document is of the form `@[ @{ @"fieldName": @"asc" }, ... ]`, logging why if not.
+ */
++ (BOOL)validateSortDocument:(nullable NSArray<NSDictionary<NSString *, NSString *> *> *)sortDocument;
+
 /**
  Return SQL to get ordered list of docIds.
 
@@ -66,6 +160,32 @@ NS_ASSUME_NONNULL_BEGIN
                                  (NSArray<NSDictionary<NSString *, NSString *> *> *)sortDocument
                                 indexes:(NSDictionary<NSString *, NSString *> *)indexes;
 
+/**
+ As +sqlToSortIds:usingOrder:indexes:, but for the IDs selected by `idsSql`, such as those of a
+ query tree, which are kept to without being read out of SQLite first.
+ */
++ (nullable CDTQSqlParts *)sqlToSortIdsMatching:(CDTQSqlParts *)idsSql
+                                     usingOrder:
+                                         (NSArray<NSDictionary<NSString *, NSString *> *> *)sortDocument
+                                        indexes:(NSDictionary<NSString *, NSString *> *)indexes;
+
+/**
+ Return SQL to get the IDs of the documents matching the text search of `query`, ordered by
+ their bm25 relevance, most relevant first when `descending`. Requires an FTS5 text index.
+
+ @param query a normalised query with a top level text search clause.
+ */
++ (nullable CDTQSqlParts *)sqlToRankIdsByTextScoreOfQuery:(NSDictionary *)query
+                                               descending:(BOOL)descending
+                                                  indexes:(NSDictionary *)indexes;
+
+/** As +sqlToRankIdsByTextScoreOfQuery:descending:indexes:, keeping to the IDs selected by
+    `idsSql`, if any. */
++ (nullable CDTQSqlParts *)sqlToRankIdsMatching:(nullable CDTQSqlParts *)idsSql
+                             byTextScoreOfQuery:(NSDictionary *)query
+                                     descending:(BOOL)descending
+                                        indexes:(NSDictionary *)indexes;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -20,18 +20,70 @@
 #import "CDTQQuerySqlTranslator.h"
 #import "CDTLogging.h"
 #import "CDTQUnindexedMatcher.h"
+#import "CDTQProjectedDocumentRevision.h"
 #import "CDTDatastore.h"
 #import "CDTDocumentRevision.h"
 #import "CDTQQueryValidator.h"
+#import "CDTQQueryConstants.h"
+#import "CDTQQueryCache.h"
+#import "CDTQIndexAdvisor.h"
+#import "CDTSlowOperationLog.h"
+#import "CDTQueryHandle.h"
+#import "CDTQueueTelemetry.h"
+#import "CDTQValueExtractor.h"
+#import "TD_Database.h"
 
 #import <FMDB/FMDB.h>
 
 const NSUInteger kSmallResultSetSizeThreshold = 500;
+static const NSUInteger kInMemorySortBatchSize = 50;
+
+/** A document kept by an in-memory sort, with the values of its sort fields. */
+@interface CDTQSortCandidate : NSObject
+@property (nonatomic, strong) NSString *docId;
+@property (nonatomic, strong) NSArray *values;
+@end
+
+@implementation CDTQSortCandidate
+@end
+
+// The heap of -firstIds:... keeps each element sorting after, or level with, its children.
+static void CDTQSiftUp(NSMutableArray *heap, NSUInteger i, NSComparator order)
+{
+    while (i > 0) {
+        NSUInteger parent = (i - 1) / 2;
+        if (order(heap[parent], heap[i]) != NSOrderedAscending) {
+            break;
+        }
+        [heap exchangeObjectAtIndex:parent withObjectAtIndex:i];
+        i = parent;
+    }
+}
+
+static void CDTQSiftDown(NSMutableArray *heap, NSUInteger i, NSComparator order)
+{
+    NSUInteger n = heap.count;
+    while (YES) {
+        NSUInteger last = i;
+        for (NSUInteger child = 2 * i + 1; child <= 2 * i + 2 && child < n; child++) {
+            if (order(heap[last], heap[child]) == NSOrderedAscending) {
+                last = child;
+            }
+        }
+        if (last == i) {
+            break;
+        }
+        [heap exchangeObjectAtIndex:i withObjectAtIndex:last];
+        i = last;
+    }
+}
 
 @interface CDTQQueryExecutor ()
 
 @property (nonatomic, strong) FMDatabaseQueue *database;
 @property (nonatomic, strong) CDTDatastore *datastore;
+/** YES once -executeFind:... has had to match or sort documents it loaded. */
+@property (nonatomic) BOOL findWasUnindexed;
 
 @end
 
@@ -55,6 +107,117 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
                   limit:(NSUInteger)limit
                  fields:(NSArray *)fields
                    sort:(NSArray *)sortDocument
+{
+    return [self find:query
+         usingIndexes:indexes
+                 skip:skip
+                limit:limit
+               fields:fields
+                 sort:sortDocument
+                after:nil];
+}
+
+- (CDTQResultSet *)find:(NSDictionary *)query
+           usingIndexes:(NSDictionary *)indexes
+                   skip:(NSUInteger)skip
+                  limit:(NSUInteger)limit
+                 fields:(NSArray *)fields
+                   sort:(NSArray *)sortDocument
+                  after:(CDTQQueryCursor *)cursor
+{
+    CDTQueueOperationScope(CDTQueueOperationQuery);
+    os_signpost_id_t signpost = CDTSignpostIDGenerate();
+    CDTSignpostIntervalBegin(signpost, "find");
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    CDTQResultSet *result = [self executeFind:query
+                                 usingIndexes:indexes
+                                         skip:skip
+                                        limit:limit
+                                       fields:fields
+                                         sort:sortDocument
+                                        after:cursor];
+    NSTimeInterval duration = CFAbsoluteTimeGetCurrent() - start;
+    CDTSignpostIntervalEnd(signpost, "find", "succeeded=%d", result != nil);
+
+    CDTSlowOperationLog *log = self.datastore.database.slowOperationLog;
+    BOOL slow = result && [log isSlow:duration];
+    if (slow) {
+        [log recordOperation:[self slowOperationForFind:query
+                                           usingIndexes:indexes
+                                                   sort:sortDocument
+                                                 result:result
+                                               duration:duration]];
+    }
+    if (result && (slow || self.findWasUnindexed)) {
+        [self.advisor recordQuery:query
+                             sort:sortDocument
+                         duration:duration
+                   candidateCount:result.candidateCount
+                        unindexed:self.findWasUnindexed];
+    }
+    return result;
+}
+
+/**
+ Describes a find which took too long, for the slow operation log. The query is explained again
+ rather than having -executeFind:... keep its workings, so fast queries pay nothing for this.
+ */
+- (CDTSlowOperation *)slowOperationForFind:(NSDictionary *)query
+                              usingIndexes:(NSDictionary *)indexes
+                                      sort:(NSArray *)sortDocument
+                                    result:(CDTQResultSet *)result
+                                  duration:(NSTimeInterval)duration
+{
+    NSDictionary *explained = [self explain:query usingIndexes:indexes sort:sortDocument];
+
+    NSMutableArray *statements = [NSMutableArray array];
+    if (explained[@"sql"]) {
+        [statements addObject:@[ explained[@"sql"], explained[@"parameters"] ?: @[] ]];
+    } else if (explained[@"tree"]) {
+        [CDTQQueryExecutor addStatementsOfExplainedNode:explained[@"tree"] toArray:statements];
+    }
+
+    NSMutableArray *sql = [NSMutableArray array];
+    NSMutableArray *queryPlan = [NSMutableArray array];
+    [_database inDatabase:^(FMDatabase *db) {
+        for (NSArray *statement in statements) {
+            [sql addObject:statement[0]];
+            [queryPlan addObjectsFromArray:[CDTSlowOperationLog queryPlanForSQL:statement[0]
+                                                                      arguments:statement[1]
+                                                                     inDatabase:db]];
+        }
+    }];
+
+    NSMutableDictionary *details = [NSMutableDictionary dictionary];
+    details[@"selector"] = query;
+    details[@"sort"] = sortDocument;
+    details[@"strategy"] = explained[@"strategy"];
+    return [[CDTSlowOperation alloc] initWithOperation:@"find:"
+                                              duration:duration
+                                                   sql:sql
+                                             queryPlan:queryPlan
+                                              rowCount:result.candidateCount
+                                  usedUnindexedMatcher:![explained[@"indexesCoverQuery"] boolValue]
+                                               details:details];
+}
+
++ (void)addStatementsOfExplainedNode:(NSDictionary *)node toArray:(NSMutableArray *)statements
+{
+    if ([node[@"type"] isEqualToString:@"sql"]) {
+        [statements addObject:@[ node[@"sql"], node[@"parameters"] ?: @[] ]];
+    }
+    for (NSDictionary *child in node[@"children"]) {
+        [CDTQQueryExecutor addStatementsOfExplainedNode:child toArray:statements];
+    }
+}
+
+- (CDTQResultSet *)executeFind:(NSDictionary *)query
+                  usingIndexes:(NSDictionary *)indexes
+                          skip:(NSUInteger)skip
+                         limit:(NSUInteger)limit
+                        fields:(NSArray *)fields
+                          sort:(NSArray *)sortDocument
+                         after:(CDTQQueryCursor *)cursor
 {
     //
     // Validate inputs
@@ -64,41 +227,117 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
         return nil;  // validate logs the error if doc is invalid
     }
 
-    fields = [CDTQQueryExecutor normaliseFields:fields];
-
-    if (![CDTQQueryExecutor validateFields:fields]) {
-        return nil;  // validate logs error message
+    CDTQueryHandle *handle = self.handle;
+    if (handle.isCancelled) {
+        return nil;
     }
 
-    // normailse and validate query by passing into the executors
-
-    query = [CDTQQueryValidator normaliseAndValidateQuery:query];
-
-    if (!query) {
-        return nil;
+    // Keyed by the query as passed, so a cached plan needs no normalising either.
+    NSString *planKey =
+        self.cache ? [CDTQQueryCache keyForQuery:query sort:sortDocument fields:fields] : nil;
+    CDTQQueryPlan *plan = planKey ? [self.cache planForKey:planKey] : nil;
+    if (!plan) {
+        plan = [self planForQuery:query usingIndexes:indexes fields:fields];
+        if (!plan) {
+            return nil;
+        }
+        if (planKey) {
+            [self.cache setPlan:plan forKey:planKey];
+        }
     }
 
     //
     // Execute the query
     //
 
+    query = plan.selector;
+    indexes = plan.indexes;
+    fields = plan.fields;
+
     // YES if we need to run posthoc matcher
-    BOOL indexesCoverQuery;
+    BOOL indexesCoverQuery = plan.indexesCoverQuery;
+    CDTQChildrenQueryNode *root = plan.root;
+
+    // When one index satisfies both the selector and the sort, push the ordering, skip and
+    // limit into SQL rather than loading and sorting every matching ID.
+    CDTQSqlQueryNode *singleIndexNode = [CDTQQueryExecutor singleIndexNodeForTree:root];
+    if (indexesCoverQuery && singleIndexNode &&
+        [CDTQQueryExecutor index:singleIndexNode.indexName canSortBy:sortDocument indexes:indexes]) {
+        if (cursor && !([cursor.sortDocument isEqualToArray:sortDocument] ||
+                        (cursor.sortDocument.count == 0 && sortDocument.count == 0))) {
+            os_log_error(CDTOSLog, "Cursor %{public}@ was created for a query with a different sort", cursor);
+            return nil;
+        }
+        BOOL covered = fields && [CDTQQueryExecutor index:singleIndexNode.indexName
+                                             coversFields:fields
+                                                  indexes:indexes];
+        NSString *collation =
+            [CDTQIndexManager collationOfIndex:indexes[singleIndexNode.indexName]];
+        return [self findUsingSingleIndexNode:singleIndexNode
+                                     sortedBy:sortDocument
+                                    collation:collation
+                                        after:cursor
+                                         skip:skip
+                                        limit:limit
+                                       fields:fields
+                                      covered:covered];
+    }
 
-    CDTQChildrenQueryNode *root;
-    root = [self translateQuery:query indexes:indexes indexesCoverQuery:&indexesCoverQuery];
+    if (cursor) {
+        os_log_error(CDTOSLog, "Paging with a cursor requires the query and sort to be satisfied by a single index.");
+        return nil;
+    }
 
-    if (!root) {
+    // Without an index holding every sort field, a limited query keeps only the documents
+    // sorting first as they're loaded.
+    NSString *textScoreOrder = [CDTQQueryExecutor textScoreOrderOfSort:sortDocument];
+    BOOL sortInMemory =
+        sortDocument.count > 0 && !textScoreOrder &&
+        ![CDTQQueryExecutor chooseIndexForSort:sortDocument fromIndexes:indexes];
+    if (sortInMemory && limit == 0) {
+        os_log_error(CDTOSLog, "No single index can satisfy order %{public}@; pass a limit to sort without one", sortDocument);
         return nil;
     }
 
+    // A query sorted in SQL restricts the sort to the tree's IDs within the same statement, so
+    // they're never read out and hashed into a set only to be looked up in it again for each row
+    // of the sort index.
+    BOOL sortInSQL = textScoreOrder || (sortDocument.count > 0 && !sortInMemory);
+    CDTQSqlParts *treeSql = sortInSQL ? [self sqlForIdsOfQueryTree:root] : nil;
+
     __block NSArray *docIds;
 
     [_database inTransaction:^(FMDatabase *db, BOOL *rollback) {
+        [handle attachToDatabase:db];
+        if (treeSql) {
+            CDTQSqlParts *sorted;
+            if (textScoreOrder) {
+                BOOL descending = [textScoreOrder.uppercaseString isEqualToString:@"DESC"];
+                sorted = [CDTQQueryExecutor sqlToRankIdsMatching:treeSql
+                                              byTextScoreOfQuery:query
+                                                      descending:descending
+                                                         indexes:indexes];
+            } else {
+                sorted = [CDTQQueryExecutor sqlToSortIdsMatching:treeSql
+                                                      usingOrder:sortDocument
+                                                         indexes:indexes];
+            }
+            docIds = [CDTQQueryExecutor idsSelectedBy:sorted inDatabase:db];
+            [handle detachFromDatabase:db];
+            return;
+        }
+
         NSSet *docIdSet = [self executeQueryTree:root inDatabase:db];
 
         // sorting
-        if (sortDocument != nil && sortDocument.count > 0) {
+        if (textScoreOrder) {
+            BOOL descending = [textScoreOrder.uppercaseString isEqualToString:@"DESC"];
+            docIds = [CDTQQueryExecutor rankIds:docIdSet
+                             byTextScoreOfQuery:query
+                                     descending:descending
+                                        indexes:indexes
+                                     inDatabase:db];
+        } else if (sortDocument.count > 0 && !sortInMemory) {
             docIds = [CDTQQueryExecutor sortIds:docIdSet
                                       usingSort:sortDocument
                                         indexes:indexes
@@ -106,19 +345,30 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
         } else {
             docIds = [docIdSet allObjects];
         }
+        [handle detachFromDatabase:db];
     }];
 
-    // nil if an error during sorting
-    if (docIds == nil) {
+    // nil if an error during sorting; incomplete if cancelled
+    if (docIds == nil || handle.isCancelled) {
         return nil;
     }
 
     CDTQUnindexedMatcher *matcher = [self matcherForIndexCoverage:indexesCoverQuery selector:query];
 
+    self.findWasUnindexed = matcher != nil || sortInMemory;
     if (matcher) {
         os_log_debug(CDTOSLog, "Query could not be executed using indexes alone; falling back to filtering documents themselves. This will be VERY SLOW as each candidate document is loaded from the datastore and matched against the query selector.");
     }
 
+    if (sortInMemory) {
+        NSUInteger count = limit > NSUIntegerMax - skip ? NSUIntegerMax : skip + limit;
+        docIds = [self firstIds:docIds sortedBy:sortDocument count:count matcher:matcher];
+        if (!docIds) {
+            return nil;  // cancelled
+        }
+        matcher = nil;  // the documents kept have already matched
+    }
+
     CDTDatastore *ds = self.datastore;
     return [CDTQResultSet resultSetWithBlock:^(CDTQResultSetBuilder *b) {
         b.docIds = docIds;
@@ -127,9 +377,155 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
         b.skip = skip;
         b.limit = limit;
         b.matcher = matcher;
+        b.handle = handle;
     }];
 }
 
+/**
+ Validates and translates a query for -executeFind:... .
+
+ @return the plan, or nil if the fields or query are invalid.
+ */
+- (CDTQQueryPlan *)planForQuery:(NSDictionary *)query
+                   usingIndexes:(NSDictionary *)indexes
+                         fields:(NSArray *)fields
+{
+    fields = [CDTQQueryExecutor normaliseFields:fields];
+
+    if (![CDTQQueryExecutor validateFields:fields]) {
+        return nil;  // validate logs error message
+    }
+
+    // normailse and validate query by passing into the executors
+
+    query = [CDTQQueryValidator normaliseAndValidateQuery:query];
+
+    if (!query) {
+        return nil;
+    }
+
+    // A partial index which might be missing some results can't be used to find or sort them.
+    indexes = [CDTQQuerySqlTranslator indexes:indexes usableForQuery:query];
+
+    BOOL indexesCoverQuery;
+    CDTQChildrenQueryNode *root =
+        [self translateQuery:query indexes:indexes indexesCoverQuery:&indexesCoverQuery];
+
+    if (!root) {
+        return nil;
+    }
+
+    CDTQQueryPlan *plan = [[CDTQQueryPlan alloc] init];
+    plan.selector = query;
+    plan.fields = fields;
+    plan.indexes = indexes;
+    plan.root = root;
+    plan.indexesCoverQuery = indexesCoverQuery;
+    return plan;
+}
+
+- (NSDictionary *)explain:(NSDictionary *)query
+             usingIndexes:(NSDictionary *)indexes
+                     sort:(NSArray *)sortDocument
+{
+    if (![CDTQQueryExecutor validateSortDocument:sortDocument]) {
+        return nil;
+    }
+
+    query = [CDTQQueryValidator normaliseAndValidateQuery:query];
+    if (!query) {
+        return nil;
+    }
+    indexes = [CDTQQuerySqlTranslator indexes:indexes usableForQuery:query];
+
+    BOOL indexesCoverQuery;
+    CDTQChildrenQueryNode *root =
+        [self translateQuery:query indexes:indexes indexesCoverQuery:&indexesCoverQuery];
+    if (!root) {
+        return nil;
+    }
+
+    NSMutableDictionary *plan = [NSMutableDictionary dictionary];
+    plan[@"selector"] = query;
+    plan[@"indexesCoverQuery"] = @(indexesCoverQuery);
+    plan[@"tree"] = [CDTQQueryExecutor explainNode:root];
+
+    // Mirrors the choice made in -find:...
+    CDTQSqlQueryNode *singleIndexNode = [CDTQQueryExecutor singleIndexNodeForTree:root];
+    if (indexesCoverQuery && singleIndexNode &&
+        [CDTQQueryExecutor index:singleIndexNode.indexName canSortBy:sortDocument indexes:indexes]) {
+        NSString *collation =
+            [CDTQIndexManager collationOfIndex:indexes[singleIndexNode.indexName]];
+        CDTQSqlParts *sql = [CDTQQueryExecutor sqlForSingleIndexNode:singleIndexNode
+                                                            sortedBy:sortDocument
+                                                           collation:collation
+                                                               after:nil
+                                                                skip:0
+                                                               limit:0
+                                                          projecting:nil];
+        plan[@"strategy"] = @"singleIndex";
+        plan[@"sql"] = sql.sqlWithPlaceholders;
+        plan[@"parameters"] = sql.placeholderValues;
+    } else {
+        plan[@"strategy"] = @"tree";
+        CDTQSqlParts *sql = [CDTQQueryExecutor sqlForQueryTree:root];
+        if (sql) {
+            plan[@"sql"] = sql.sqlWithPlaceholders;
+            plan[@"parameters"] = sql.placeholderValues;
+        }
+        if ([CDTQQueryExecutor textScoreOrderOfSort:sortDocument]) {
+            NSString *textIndex = [CDTQQueryExecutor fts5TextIndexFromIndexes:indexes];
+            if (textIndex) {
+                plan[@"sortIndex"] = textIndex;
+            }
+        } else if (sortDocument.count > 0) {
+            NSString *sortIndex = [CDTQQueryExecutor chooseIndexForSort:sortDocument fromIndexes:indexes];
+            if (sortIndex) {
+                plan[@"sortIndex"] = sortIndex;
+            } else {
+                plan[@"sortInMemory"] = @YES;
+            }
+        }
+    }
+
+    return [NSDictionary dictionaryWithDictionary:plan];
+}
+
++ (NSDictionary *)explainNode:(CDTQQueryNode *)node
+{
+    NSMutableDictionary *explained = [NSMutableDictionary dictionary];
+    if ([node isKindOfClass:[CDTQChildrenQueryNode class]]) {
+        BOOL isAnd = [node isKindOfClass:[CDTQAndQueryNode class]];
+        explained[@"type"] = isAnd ? @"and" : @"or";
+
+        // Children are listed in the order they'll be run.
+        CDTQChildrenQueryNode *childrenNode = (CDTQChildrenQueryNode *)node;
+        NSArray *children = isAnd ? [CDTQQueryExecutor childrenInExecutionOrder:childrenNode]
+                                  : childrenNode.children;
+        NSMutableArray *explainedChildren = [NSMutableArray array];
+        for (CDTQQueryNode *child in children) {
+            [explainedChildren addObject:[CDTQQueryExecutor explainNode:child]];
+        }
+        explained[@"children"] = explainedChildren;
+    } else if ([node isKindOfClass:[CDTQSqlQueryNode class]]) {
+        CDTQSqlQueryNode *sqlNode = (CDTQSqlQueryNode *)node;
+        if (sqlNode.sql) {
+            explained[@"type"] = @"sql";
+            explained[@"sql"] = sqlNode.sql.sqlWithPlaceholders;
+            explained[@"parameters"] = sqlNode.sql.placeholderValues;
+        } else {
+            explained[@"type"] = @"allDocuments";
+        }
+        if (sqlNode.indexName) {
+            explained[@"index"] = sqlNode.indexName;
+        }
+    }
+    if (node.estimatedRows) {
+        explained[@"estimatedRows"] = node.estimatedRows;
+    }
+    return [NSDictionary dictionaryWithDictionary:explained];
+}
+
 // Method exists so we can override it in testing (to force indexesCoverQuery to false)
 - (CDTQChildrenQueryNode *)translateQuery:(NSDictionary *)query
                                   indexes:(NSDictionary *)indexes
@@ -138,6 +534,7 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
     CDTQChildrenQueryNode *root =
         (CDTQChildrenQueryNode *)[CDTQQuerySqlTranslator translateQuery:query
                                                            toUseIndexes:indexes
+                                                             statistics:self.statistics
                                                       indexesCoverQuery:indexesCoverQuery];
     return root;
 }
@@ -149,6 +546,189 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
     return indexesCoverQuery ? nil : [CDTQUnindexedMatcher matcherWithSelector:selector];
 }
 
+#pragma mark Counting and aggregation
+
+- (NSUInteger)count:(NSDictionary *)query usingIndexes:(NSDictionary *)indexes
+{
+    CDTQueueOperationScope(CDTQueueOperationQuery);
+    NSDictionary *normalised = [CDTQQueryValidator normaliseAndValidateQuery:query];
+    if (!normalised) {
+        return NSNotFound;
+    }
+    indexes = [CDTQQuerySqlTranslator indexes:indexes usableForQuery:normalised];
+
+    BOOL indexesCoverQuery;
+    CDTQChildrenQueryNode *root =
+        [self translateQuery:normalised indexes:indexes indexesCoverQuery:&indexesCoverQuery];
+    if (!root) {
+        return NSNotFound;
+    }
+
+    if (!indexesCoverQuery) {
+        // The documents have to be matched by hand, so they have to be loaded anyway.
+        CDTQResultSet *result = [self executeFind:query
+                                     usingIndexes:indexes
+                                             skip:0
+                                            limit:0
+                                           fields:nil
+                                             sort:nil
+                                            after:nil];
+        return result ? result.documentIds.count : NSNotFound;
+    }
+
+    CDTQSqlParts *tree = [CDTQQueryExecutor sqlForQueryTree:root];
+    if (!tree) {
+        return self.datastore.documentCount;
+    }
+
+    NSString *sql =
+        [NSString stringWithFormat:@"SELECT COUNT(DISTINCT _id) FROM (%@);", tree.sqlWithPlaceholders];
+    __block NSUInteger count = NSNotFound;
+    [_database inDatabase:^(FMDatabase *db) {
+        FMResultSet *rs = [db executeQuery:sql withArgumentsInArray:tree.placeholderValues];
+        if ([rs next]) {
+            count = (NSUInteger)[rs longLongIntForColumnIndex:0];
+        } else {
+            os_log_error(CDTOSLog, "Failed to count results of %{public}@: %{public}@", sql,
+                         [db lastErrorMessage]);
+        }
+        [rs close];
+    }];
+    return count;
+}
+
+/**
+ Aggregates the rows of one index which belong to the documents matching the query:
+
+ SELECT "g", SUM("f1"), COUNT(DISTINCT CASE WHEN "f2" IS NOT NULL THEN _id END)
+     FROM (SELECT DISTINCT _id, "g", "f1", "f2" FROM idx WHERE _id IN (query)) GROUP BY "g" ORDER BY "g";
+
+ The sub-select keeps one row per document, or per element where the document has an array.
+ */
+- (NSArray<NSDictionary *> *)aggregate:(NSDictionary *)query
+                            aggregates:(NSDictionary *)aggregates
+                               groupBy:(NSString *)groupField
+                          usingIndexes:(NSDictionary *)indexes
+{
+    CDTQueueOperationScope(CDTQueueOperationQuery);
+    NSDictionary *functions = @{ @"$sum" : @"SUM", @"$min" : @"MIN", @"$max" : @"MAX" };
+
+    NSArray *names = [aggregates allKeys];
+    NSMutableOrderedSet *columns = [NSMutableOrderedSet orderedSet];
+    NSMutableArray *selected = [NSMutableArray array];
+    if (groupField) {
+        [columns addObject:groupField];
+        [selected addObject:[NSString stringWithFormat:@"\"%@\"", groupField]];
+    }
+    for (NSString *name in names) {
+        NSDictionary *aggregate = aggregates[name];
+        NSString *operator = [aggregate isKindOfClass:[NSDictionary class]] && aggregate.count == 1
+                                 ? [aggregate allKeys][0]
+                                 : nil;
+        NSString *field = operator ? aggregate[operator] : nil;
+        if (![field isKindOfClass:[NSString class]] ||
+            !(functions[operator] || [operator isEqualToString:@"$count"])) {
+            os_log_error(CDTOSLog, "Invalid aggregate %{public}@: %{public}@", name, aggregate);
+            return nil;
+        }
+
+        [columns addObject:field];
+        if (functions[operator]) {
+            [selected addObject:[NSString stringWithFormat:@"%@(\"%@\")", functions[operator], field]];
+        } else {
+            // Documents with a value for the field, however many elements it has.
+            [selected addObject:[NSString stringWithFormat:
+                                     @"COUNT(DISTINCT CASE WHEN \"%@\" IS NOT NULL THEN _id END)", field]];
+        }
+    }
+
+    NSDictionary *normalised = [CDTQQueryValidator normaliseAndValidateQuery:query];
+    if (!normalised) {
+        return nil;
+    }
+    indexes = [CDTQQuerySqlTranslator indexes:indexes usableForQuery:normalised];
+
+    NSString *indexName =
+        [CDTQQueryExecutor chooseJSONIndexWithFields:[columns set] fromIndexes:indexes];
+    if (!indexName) {
+        os_log_error(CDTOSLog, "No JSON index contains all of the fields %{public}@ to aggregate", columns);
+        return nil;
+    }
+
+    BOOL indexesCoverQuery;
+    CDTQChildrenQueryNode *root =
+        [self translateQuery:normalised indexes:indexes indexesCoverQuery:&indexesCoverQuery];
+    if (!root) {
+        return nil;
+    }
+    if (!indexesCoverQuery) {
+        os_log_error(CDTOSLog, "Aggregating requires every field of the query %{public}@ to be indexed", normalised);
+        return nil;
+    }
+
+    CDTQSqlParts *tree = [CDTQQueryExecutor sqlForQueryTree:root];
+    NSMutableArray *quotedColumns = [NSMutableArray arrayWithObject:@"_id"];
+    for (NSString *column in columns) {
+        if ([column isEqualToString:@"_id"]) {
+            continue;
+        }
+        [quotedColumns addObject:[NSString stringWithFormat:@"\"%@\"", column]];
+    }
+    NSString *rows = [NSString stringWithFormat:@"SELECT DISTINCT %@ FROM \"%@\"",
+                                                [quotedColumns componentsJoinedByString:@", "],
+                                                [CDTQIndexManager tableNameForIndex:indexName]];
+    if (tree) {
+        rows = [rows stringByAppendingFormat:@" WHERE _id IN (%@)", tree.sqlWithPlaceholders];
+    }
+    NSString *sql = [NSString stringWithFormat:@"SELECT %@ FROM (%@)",
+                                               [selected componentsJoinedByString:@", "], rows];
+    if (groupField) {
+        sql = [sql stringByAppendingFormat:@" GROUP BY \"%@\" ORDER BY \"%@\"", groupField, groupField];
+    }
+
+    __block NSMutableArray *results = nil;
+    [_database inDatabase:^(FMDatabase *db) {
+        FMResultSet *rs = [db executeQuery:sql withArgumentsInArray:tree.placeholderValues ?: @[]];
+        if (!rs) {
+            os_log_error(CDTOSLog, "Failed to execute aggregation %{public}@: %{public}@", sql,
+                         [db lastErrorMessage]);
+            return;
+        }
+
+        results = [NSMutableArray array];
+        int firstAggregate = groupField ? 1 : 0;
+        while ([rs next]) {
+            NSMutableDictionary *result = [NSMutableDictionary dictionary];
+            if (groupField) {
+                result[groupField] = [rs objectForColumnIndex:0];
+            }
+            for (NSUInteger i = 0; i < names.count; i++) {
+                result[names[i]] = [rs objectForColumnIndex:firstAggregate + (int)i];
+            }
+            [results addObject:result];
+        }
+        [rs close];
+    }];
+    return results;
+}
+
+/** The JSON index with the fewest fields which contains all of `fields`, or nil if none does. */
++ (NSString *)chooseJSONIndexWithFields:(NSSet *)fields fromIndexes:(NSDictionary *)indexes
+{
+    NSString *chosenIndex = nil;
+    for (NSString *indexName in indexes) {
+        NSArray *indexFields = indexes[indexName][@"fields"];
+        if (![indexes[indexName][@"type"] isEqualToString:@"json"] ||
+            ![fields isSubsetOfSet:[NSSet setWithArray:indexFields]]) {
+            continue;
+        }
+        if (!chosenIndex || indexFields.count < [indexes[chosenIndex][@"fields"] count]) {
+            chosenIndex = indexName;
+        }
+    }
+    return chosenIndex;
+}
+
 #pragma mark Validation helpers
 
 + (BOOL)validateSortDocument:(NSArray /*NSDictionary*/ *)sortDocument
@@ -180,6 +760,11 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
             os_log_error(CDTOSLog, "Order direction %{public}@ not valid, use `asc` or `desc`", direction);
             return NO;
         }
+
+        if ([fieldName isEqualToString:TEXT_SCORE] && sortDocument.count > 1) {
+            os_log_error(CDTOSLog, "A sort by %{public}@ can't also sort by other fields", TEXT_SCORE);
+            return NO;
+        }
     }
 
     return YES;
@@ -219,64 +804,537 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
 
 - (NSSet *)executeQueryTree:(CDTQQueryNode *)node inDatabase:(FMDatabase *)db
 {
-    if ([node isKindOfClass:[CDTQAndQueryNode class]]) {
-        NSMutableSet *accumulator = nil;
+    // The whole tree runs as one statement, so only the IDs matching all of it are loaded, rather
+    // than those matching each clause.
+    CDTQSqlParts *sql = [self sqlForIdsOfQueryTree:node];
+    if (!sql) {
+        // No SQL exists so we are now forced to go directly to the
+        // document datastore to retrieve the list of document ids.
+        return [NSSet setWithArray:[self.datastore getAllDocumentIds]];
+    }
+
+    NSMutableSet *docIds = [NSMutableSet set];
+    FMResultSet *rs =
+        [db executeQuery:sql.sqlWithPlaceholders withArgumentsInArray:sql.placeholderValues];
+    if (!rs) {
+        os_log_error(CDTOSLog, "Error running query %{public}@: %{public}@", sql.sqlWithPlaceholders, db.lastErrorMessage);
+    }
+    while ([rs next]) {
+        [docIds addObject:[rs stringForColumnIndex:0]];
+    }
+    [rs close];
+    return docIds;
+}
+
+/**
+ Compiles a query tree into a single SELECT of the IDs of the documents matching it, which may
+ list a document more than once.
 
+ An AND selects its most selective child's IDs, keeping those `IN` each of the others. SQLite
+ only runs each `IN` sub-select the first time it's needed, so if the first child matches nothing
+ the rest are never run. An OR is the UNION of its children.
+
+ Returns nil if the tree matches every document, as does a clause with no SQL, so the IDs must
+ come from the datastore.
+ */
++ (CDTQSqlParts *)sqlForQueryTree:(CDTQQueryNode *)node
+{
+    if ([node isKindOfClass:[CDTQAndQueryNode class]]) {
         CDTQAndQueryNode *andNode = (CDTQAndQueryNode *)node;
-        for (CDTQQueryNode *node in andNode.children) {
-            NSSet *childIds = [self executeQueryTree:node inDatabase:db];
-            if (!accumulator) {
-                accumulator = [NSMutableSet setWithSet:childIds];
-            } else {
-                [accumulator intersectSet:childIds];
+        NSMutableArray<CDTQSqlParts *> *children = [NSMutableArray array];
+        for (CDTQQueryNode *child in [CDTQQueryExecutor childrenInExecutionOrder:andNode]) {
+            CDTQSqlParts *childSql = [CDTQQueryExecutor sqlForQueryTree:child];
+            // A child matching every document doesn't narrow the others down
+            if (childSql) {
+                [children addObject:childSql];
+            }
+        }
+        if (children.count == 0) {
+            return andNode.children.count > 0 ? nil : [CDTQQueryExecutor sqlMatchingNothing];
+        }
+        if (children.count == 1) {
+            return children[0];
+        }
+
+        NSMutableString *sql =
+            [NSMutableString stringWithFormat:@"SELECT _id FROM (%@) WHERE ",
+                                              children[0].sqlWithPlaceholders];
+        NSMutableArray *parameters = [children[0].placeholderValues mutableCopy];
+        for (NSUInteger i = 1; i < children.count; i++) {
+            [sql appendFormat:@"%@_id IN (%@)", (i > 1 ? @" AND " : @""),
+                              children[i].sqlWithPlaceholders];
+            [parameters addObjectsFromArray:children[i].placeholderValues];
+        }
+        return [CDTQSqlParts partsForSql:sql parameters:parameters];
+
+    } else if ([node isKindOfClass:[CDTQOrQueryNode class]]) {
+        CDTQOrQueryNode *orNode = (CDTQOrQueryNode *)node;
+        NSMutableArray *selects = [NSMutableArray array];
+        NSMutableArray *parameters = [NSMutableArray array];
+        for (CDTQQueryNode *child in orNode.children) {
+            CDTQSqlParts *childSql = [CDTQQueryExecutor sqlForQueryTree:child];
+            if (!childSql) {
+                return nil;  // one child matching everything means the OR does
             }
+            // Wrapped, as a compound SELECT can't be one part of another
+            [selects addObject:[NSString stringWithFormat:@"SELECT _id FROM (%@)",
+                                                          childSql.sqlWithPlaceholders]];
+            [parameters addObjectsFromArray:childSql.placeholderValues];
+        }
+        if (selects.count == 0) {
+            return [CDTQQueryExecutor sqlMatchingNothing];
+        }
+        return [CDTQSqlParts partsForSql:[selects componentsJoinedByString:@" UNION "]
+                              parameters:parameters];
 
-            // TODO optimisation is to bail here if accumlator is empty
+    } else if ([node isKindOfClass:[CDTQSqlQueryNode class]]) {
+        CDTQSqlParts *sqlParts = ((CDTQSqlQueryNode *)node).sql;
+        if (!sqlParts) {
+            return nil;
         }
+        // Statements are generated with a trailing semicolon, which can't go in a sub-select
+        NSCharacterSet *trailing = [NSCharacterSet characterSetWithCharactersInString:@"; \n"];
+        NSString *sql = [sqlParts.sqlWithPlaceholders stringByTrimmingCharactersInSet:trailing];
+        return [CDTQSqlParts partsForSql:sql parameters:sqlParts.placeholderValues ?: @[]];
 
-        return [NSSet setWithSet:accumulator];
+    } else {
+        return [CDTQQueryExecutor sqlMatchingNothing];
     }
-    if ([node isKindOfClass:[CDTQOrQueryNode class]]) {
-        NSMutableSet *accumulator = nil;
+}
 
-        CDTQOrQueryNode *andNode = (CDTQOrQueryNode *)node;
-        for (CDTQQueryNode *node in andNode.children) {
-            NSSet *childIds = [self executeQueryTree:node inDatabase:db];
-            if (!accumulator) {
-                accumulator = [NSMutableSet setWithSet:childIds];
-            } else {
-                [accumulator unionSet:childIds];
+/** The SELECT of the IDs of the documents matching a query tree, as +sqlForQueryTree:, for
+    queries executed by this executor. */
+- (CDTQSqlParts *)sqlForIdsOfQueryTree:(CDTQQueryNode *)node
+{
+    return [CDTQQueryExecutor sqlForQueryTree:node];
+}
+
+/** The IDs selected by the first column of a statement, which lists each once, in order; nil if
+    there's no statement or it fails. */
++ (NSArray *)idsSelectedBy:(CDTQSqlParts *)sql inDatabase:(FMDatabase *)db
+{
+    if (!sql) {
+        return nil;
+    }
+    FMResultSet *rs =
+        [db executeQuery:sql.sqlWithPlaceholders withArgumentsInArray:sql.placeholderValues];
+    if (!rs) {
+        os_log_error(CDTOSLog, "Error running query %{public}@: %{public}@", sql.sqlWithPlaceholders, db.lastErrorMessage);
+        return nil;
+    }
+    NSMutableArray *docIds = [NSMutableArray array];
+    while ([rs next]) {
+        [docIds addObject:[rs stringForColumnIndex:0]];
+    }
+    [rs close];
+    return docIds;
+}
+
++ (CDTQSqlParts *)sqlMatchingNothing
+{
+    return [CDTQSqlParts partsForSql:@"SELECT NULL AS _id LIMIT 0" parameters:@[]];
+}
+
+/**
+ Children ordered by ascending estimatedRows, with those that have no estimate last in their
+ original order.
+ */
++ (NSArray *)childrenInExecutionOrder:(CDTQChildrenQueryNode *)node
+{
+    return [node.children sortedArrayWithOptions:NSSortStable
+                                 usingComparator:^NSComparisonResult(CDTQQueryNode *a,
+                                                                     CDTQQueryNode *b) {
+                                     if (!a.estimatedRows || !b.estimatedRows) {
+                                         if (a.estimatedRows) {
+                                             return NSOrderedAscending;
+                                         }
+                                         return b.estimatedRows ? NSOrderedDescending
+                                                                : NSOrderedSame;
+                                     }
+                                     return [a.estimatedRows compare:b.estimatedRows];
+                                 }];
+}
+
+#pragma mark Single index queries
+
+/**
+ Returns the SQL node if the query tree is just one SQL query over a JSON index, otherwise nil.
+ */
++ (CDTQSqlQueryNode *)singleIndexNodeForTree:(CDTQChildrenQueryNode *)root
+{
+    if (root.children.count != 1) {
+        return nil;
+    }
+    CDTQSqlQueryNode *node = root.children[0];
+    if (![node isKindOfClass:[CDTQSqlQueryNode class]] || !node.indexName || !node.where) {
+        return nil;
+    }
+    return node;
+}
+
++ (BOOL)index:(NSString *)indexName
+     canSortBy:(NSArray /*NSDictionary*/ *)sortDocument
+       indexes:(NSDictionary *)indexes
+{
+    NSSet *providedFields = [NSSet setWithArray:indexes[indexName][@"fields"]];
+    for (NSDictionary *orderClause in sortDocument) {
+        if (![providedFields containsObject:[orderClause allKeys][0]]) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+/**
+ Whether the index holds the exact values of all of `fields`, so results projected to them can be
+ read from it alone.
+ */
++ (BOOL)index:(NSString *)indexName coversFields:(NSArray *)fields indexes:(NSDictionary *)indexes
+{
+    if (![indexes[indexName][@"covering"] boolValue]) {
+        return NO;
+    }
+    return [[NSSet setWithArray:fields] isSubsetOfSet:[NSSet setWithArray:indexes[indexName][@"fields"]]];
+}
+
+/** `column > value` for an ascending sort, or `<` for descending, where NULLs sort lowest. */
++ (NSString *)sqlForColumn:(NSString *)column
+                     after:(NSObject *)value
+                 ascending:(BOOL)ascending
+                parameters:(NSMutableArray *)parameters
+{
+    if (value == [NSNull null]) {
+        // Nothing sorts below NULL, so everything else is after it ascending, nothing descending.
+        return ascending ? [NSString stringWithFormat:@"%@ IS NOT NULL", column] : @"0";
+    }
+    [parameters addObject:value];
+    return ascending ? [NSString stringWithFormat:@"%@ > ?", column]
+                     : [NSString stringWithFormat:@"(%@ < ? OR %@ IS NULL)", column, column];
+}
+
++ (NSString *)sqlForColumn:(NSString *)column
+                    equals:(NSObject *)value
+                parameters:(NSMutableArray *)parameters
+{
+    if (value == [NSNull null]) {
+        return [NSString stringWithFormat:@"%@ IS NULL", column];
+    }
+    [parameters addObject:value];
+    return [NSString stringWithFormat:@"%@ = ?", column];
+}
+
+/**
+ Return SQL to get a page of ordered docIds, when a single index satisfies both the selector
+ and the sort, so the ordering, skip and limit can all be done by SQLite:
+
+ SELECT _id, MIN("f1"), MAX("f2") FROM idx WHERE (selector) GROUP BY _id HAVING (after cursor)
+     ORDER BY MIN("f1") ASC, MAX("f2") DESC, _id ASC LIMIT ? OFFSET ?;
+
+ A document has a row per value of an array field, so each document is sorted by its lowest
+ value for an ascending field and its highest for a descending one. Results are ordered by _id
+ after the sort fields so there is a total order for cursors. The keyset condition selecting
+ results after `cursor` is expanded to:
+
+ (MIN("f1") > ?) OR (MIN("f1") = ? AND MAX("f2") < ?) OR (... AND _id > ?)
+ */
++ (CDTQSqlParts *)sqlForSingleIndexNode:(CDTQSqlQueryNode *)node
+                               sortedBy:(NSArray /*NSDictionary*/ *)sortDocument
+                                  after:(CDTQQueryCursor *)cursor
+                                   skip:(NSUInteger)skip
+                                  limit:(NSUInteger)limit
+{
+    return [CDTQQueryExecutor sqlForSingleIndexNode:node
+                                           sortedBy:sortDocument
+                                          collation:nil
+                                              after:cursor
+                                               skip:skip
+                                              limit:limit
+                                         projecting:nil];
+}
+
+/**
+ As above, also selecting `_rev` and the `projectedColumns` after the sort values. The index must
+ cover them, as there's then a single row per document to take them from.
+
+ With a `collation`, the index's collation sequence, the sort values are compared with it, both
+ to order the results and to find those after the cursor:
+
+ SELECT _id, MIN("f1" COLLATE "c") COLLATE "c" FROM idx ...
+ */
++ (CDTQSqlParts *)sqlForSingleIndexNode:(CDTQSqlQueryNode *)node
+                               sortedBy:(NSArray /*NSDictionary*/ *)sortDocument
+                              collation:(NSString *)collation
+                                  after:(CDTQQueryCursor *)cursor
+                                   skip:(NSUInteger)skip
+                                  limit:(NSUInteger)limit
+                             projecting:(NSArray /*NSString*/ *)projectedColumns
+{
+    NSString *collate = collation ? [NSString stringWithFormat:@" COLLATE \"%@\"", collation] : @"";
+    NSMutableArray *columns = [NSMutableArray array];
+    NSMutableArray *ascending = [NSMutableArray array];
+    for (NSDictionary *orderClause in sortDocument) {
+        NSString *fieldName = [orderClause allKeys][0];
+        BOOL asc = [[orderClause[fieldName] uppercaseString] isEqualToString:@"ASC"];
+        // MIN and MAX pick values by their argument's collation, which their result then lacks.
+        [columns addObject:[NSString stringWithFormat:@"%@(\"%@\"%@)%@", asc ? @"MIN" : @"MAX",
+                                                      fieldName, collate, collate]];
+        [ascending addObject:@(asc)];
+    }
+
+    NSMutableArray *parameters = [NSMutableArray arrayWithArray:node.where.placeholderValues];
+    NSString *having = @"";
+
+    if (cursor) {
+        NSMutableArray *columnsWithId = [columns mutableCopy];
+        [columnsWithId addObject:@"_id"];
+        NSMutableArray *values = [cursor.sortValues mutableCopy];
+        [values addObject:cursor.docId];
+        NSMutableArray *orderAscending = [ascending mutableCopy];
+        [orderAscending addObject:@YES];
+
+        NSMutableArray *disjuncts = [NSMutableArray array];
+        for (NSUInteger i = 0; i < columnsWithId.count; i++) {
+            NSMutableArray *conjuncts = [NSMutableArray array];
+            for (NSUInteger j = 0; j < i; j++) {
+                [conjuncts addObject:[self sqlForColumn:columnsWithId[j]
+                                                 equals:values[j]
+                                             parameters:parameters]];
             }
+            [conjuncts addObject:[self sqlForColumn:columnsWithId[i]
+                                              after:values[i]
+                                          ascending:[orderAscending[i] boolValue]
+                                         parameters:parameters]];
+            [disjuncts addObject:[NSString stringWithFormat:@"(%@)",
+                                           [conjuncts componentsJoinedByString:@" AND "]]];
         }
+        having = [NSString stringWithFormat:@" HAVING %@", [disjuncts componentsJoinedByString:@" OR "]];
+    }
 
-        return [NSSet setWithSet:accumulator];
+    NSMutableArray *orderClauses = [NSMutableArray array];
+    for (NSUInteger i = 0; i < columns.count; i++) {
+        [orderClauses addObject:[NSString stringWithFormat:@"%@ %@", columns[i],
+                                                           [ascending[i] boolValue] ? @"ASC" : @"DESC"]];
+    }
+    [orderClauses addObject:@"_id ASC"];
+
+    NSMutableArray *selected = [NSMutableArray arrayWithObject:@"_id"];
+    [selected addObjectsFromArray:columns];
+    if (projectedColumns) {
+        [selected addObject:@"_rev"];
+        for (NSString *column in projectedColumns) {
+            [selected addObject:[NSString stringWithFormat:@"\"%@\"", column]];
+        }
+    }
 
-    } else if ([node isKindOfClass:[CDTQSqlQueryNode class]]) {
-        CDTQSqlQueryNode *sqlNode = (CDTQSqlQueryNode *)node;
-        NSMutableArray *docIds;
-        if (sqlNode.sql) {
-            CDTQSqlParts *sqlParts = sqlNode.sql;
-            FMResultSet *rs = [db executeQuery:sqlParts.sqlWithPlaceholders
-                          withArgumentsInArray:sqlParts.placeholderValues];
-            docIds = [NSMutableArray array];
-            while ([rs next]) {
-                [docIds addObject:[rs stringForColumn:@"_id"]];
+    NSString *sql = [NSString stringWithFormat:@"SELECT %@ FROM \"%@\" WHERE %@ GROUP BY _id%@ ORDER BY %@",
+                                               [selected componentsJoinedByString:@", "],
+                                               [CDTQIndexManager tableNameForIndex:node.indexName],
+                                               node.where.sqlWithPlaceholders, having,
+                                               [orderClauses componentsJoinedByString:@", "]];
+    if (limit > 0 || skip > 0) {
+        // LIMIT -1 is no limit; callers use NSUIntegerMax for that too.
+        BOOL limited = (limit > 0 && limit < NSIntegerMax);
+        sql = [sql stringByAppendingString:@" LIMIT ? OFFSET ?"];
+        [parameters addObject:(limited ? @(limit) : @(-1))];
+        [parameters addObject:@(skip)];
+    }
+
+    return [CDTQSqlParts partsForSql:[sql stringByAppendingString:@";"] parameters:parameters];
+}
+
+- (CDTQResultSet *)findUsingSingleIndexNode:(CDTQSqlQueryNode *)node
+                                   sortedBy:(NSArray /*NSDictionary*/ *)sortDocument
+                                  collation:(NSString *)collation
+                                      after:(CDTQQueryCursor *)cursor
+                                       skip:(NSUInteger)skip
+                                      limit:(NSUInteger)limit
+                                     fields:(NSArray *)fields
+                                    covered:(BOOL)covered
+{
+    // A covered query builds its results from the index, without loading a single document.
+    // Fields starting with _ are projected as null, as when they're taken from the body.
+    NSMutableArray *projectedColumns = nil;
+    if (covered) {
+        projectedColumns = [NSMutableArray array];
+        for (NSString *field in fields) {
+            if (![field hasPrefix:@"_"]) {
+                [projectedColumns addObject:field];
             }
-            [rs close];
-        } else {
-            // No SQL exists so we are now forced to go directly to the
-            // document datastore to retrieve the list of document ids.
-            docIds = [NSMutableArray arrayWithArray:[self.datastore getAllDocumentIds]];
         }
+    }
+    CDTQSqlParts *sql = [CDTQQueryExecutor sqlForSingleIndexNode:node
+                                                        sortedBy:sortDocument
+                                                       collation:collation
+                                                           after:cursor
+                                                            skip:skip
+                                                           limit:limit
+                                                      projecting:projectedColumns];
 
-        return [NSSet setWithArray:docIds];
-    } else {
+    CDTDatastore *ds = self.datastore;
+    __block NSMutableArray *docIds = nil;
+    __block NSMutableArray *revisions = nil;
+    __block CDTQQueryCursor *nextPageCursor = nil;
+    CDTQueryHandle *handle = self.handle;
+    [_database inDatabase:^(FMDatabase *db) {
+        [handle attachToDatabase:db];
+        FMResultSet *rs =
+            [db executeQuery:sql.sqlWithPlaceholders withArgumentsInArray:sql.placeholderValues];
+        if (!rs) {
+            os_log_error(CDTOSLog, "Failed to execute query %{public}@: %{public}@", sql,
+                         [db lastErrorMessage]);
+            [handle detachFromDatabase:db];
+            return;
+        }
+
+        docIds = [NSMutableArray array];
+        revisions = covered ? [NSMutableArray array] : nil;
+        NSArray *lastSortValues = nil;
+        while ([rs next]) {
+            [docIds addObject:[rs stringForColumnIndex:0]];
+            if (covered) {
+                [revisions addObject:[CDTQQueryExecutor revisionProjecting:fields
+                                                                fromColumns:projectedColumns
+                                                                     column:(int)sortDocument.count + 1
+                                                                  resultSet:rs
+                                                                  datastore:ds]];
+            }
+            if (limit > 0 && docIds.count == limit) {
+                NSMutableArray *values = [NSMutableArray arrayWithCapacity:sortDocument.count];
+                for (int i = 1; i <= (int)sortDocument.count; i++) {
+                    [values addObject:[rs objectForColumnIndex:i]];
+                }
+                lastSortValues = values;
+            }
+        }
+        [rs close];
+        [handle detachFromDatabase:db];
+
+        // A full page means there may be more results.
+        if (lastSortValues) {
+            nextPageCursor = [[CDTQQueryCursor alloc] initWithSortDocument:sortDocument
+                                                                sortValues:lastSortValues
+                                                                     docId:docIds.lastObject];
+        }
+    }];
+
+    if (!docIds || handle.isCancelled) {
         return nil;
     }
+
+    return [CDTQResultSet resultSetWithBlock:^(CDTQResultSetBuilder *b) {
+        b.docIds = docIds;
+        b.revisions = revisions;
+        b.datastore = ds;
+        b.fields = fields;
+        b.nextPageCursor = nextPageCursor;
+        b.handle = handle;
+    }];
+}
+
+/**
+ Builds a projected revision from a row selected with `projecting:`, whose `_rev` is at
+ `column`, followed by the `projectedColumns`.
+ */
++ (CDTDocumentRevision *)revisionProjecting:(NSArray *)fields
+                                fromColumns:(NSArray *)projectedColumns
+                                     column:(int)column
+                                  resultSet:(FMResultSet *)rs
+                                  datastore:(CDTDatastore *)datastore
+{
+    NSMutableDictionary *body = [NSMutableDictionary dictionaryWithCapacity:fields.count];
+    for (NSString *field in fields) {
+        body[field] = [NSNull null];
+    }
+    for (NSUInteger i = 0; i < projectedColumns.count; i++) {
+        body[projectedColumns[i]] = [rs objectForColumnIndex:column + 1 + (int)i];
+    }
+    return [[CDTQProjectedDocumentRevision alloc] initWithDocId:[rs stringForColumnIndex:0]
+                                                     revisionId:[rs stringForColumnIndex:column]
+                                                           body:body
+                                                        deleted:NO
+                                                    attachments:@{}
+                                                       sequence:0
+                                                      datastore:datastore];
 }
 
 #pragma mark Sorting
 
+/**
+ Returns the IDs of the first `count` of the documents, in the order of `sortDocument` and then
+ by ID, without an index to sort them, or nil if the query's handle was cancelled.
+
+ The documents are loaded a batch at a time, those not matching `matcher` dropped, and the rest
+ kept in a heap of at most `count` whose root is the one sorting last, so it's replaced whenever
+ a document sorting before it is found. Memory is bounded by `count` rather than the number of
+ candidates. Values compare as index columns do, except that arrays sort last rather than by
+ their elements.
+ */
+- (NSArray *)firstIds:(NSArray /*NSString*/ *)docIds
+             sortedBy:(NSArray /*NSDictionary*/ *)sortDocument
+                count:(NSUInteger)count
+              matcher:(CDTQUnindexedMatcher *)matcher
+{
+    NSMutableArray *fieldNames = [NSMutableArray arrayWithCapacity:sortDocument.count];
+    NSMutableArray *descending = [NSMutableArray arrayWithCapacity:sortDocument.count];
+    for (NSDictionary *orderClause in sortDocument) {
+        NSString *fieldName = [orderClause allKeys][0];
+        [fieldNames addObject:fieldName];
+        [descending addObject:@([[orderClause[fieldName] lowercaseString] isEqualToString:@"desc"])];
+    }
+
+    NSComparator order = ^NSComparisonResult(CDTQSortCandidate *a, CDTQSortCandidate *b) {
+        for (NSUInteger i = 0; i < fieldNames.count; i++) {
+            NSComparisonResult result =
+                [CDTQValueExtractor compareValue:a.values[i] toValue:b.values[i]];
+            if (result != NSOrderedSame) {
+                return [descending[i] boolValue] ? (NSComparisonResult)-result : result;
+            }
+        }
+        return [a.docId compare:b.docId options:NSLiteralSearch];
+    };
+
+    NSMutableArray *heap = [NSMutableArray arrayWithCapacity:MIN(count, docIds.count)];
+    CDTQueryHandle *handle = self.handle;
+    NSRange range = NSMakeRange(0, 0);
+    while (range.location < docIds.count) {
+        if (handle.isCancelled) {
+            return nil;
+        }
+        range.length = MIN(kInMemorySortBatchSize, docIds.count - range.location);
+        @autoreleasepool {
+            NSArray *docs = [self.datastore getDocumentsWithIds:[docIds subarrayWithRange:range]];
+            NSIndexSet *matching = matcher ? [matcher indexesOfMatchingRevisions:docs] : nil;
+            for (NSUInteger i = 0; i < docs.count; i++) {
+                if (matching && ![matching containsIndex:i]) {
+                    continue;
+                }
+                CDTDocumentRevision *rev = docs[i];
+                CDTQSortCandidate *candidate = [[CDTQSortCandidate alloc] init];
+                candidate.docId = rev.docId;
+                NSMutableArray *values = [NSMutableArray arrayWithCapacity:fieldNames.count];
+                for (NSString *fieldName in fieldNames) {
+                    NSObject *value =
+                        [CDTQValueExtractor extractValueForFieldName:fieldName fromRevision:rev];
+                    [values addObject:value ?: [NSNull null]];
+                }
+                candidate.values = values;
+
+                if (heap.count < count) {
+                    [heap addObject:candidate];
+                    CDTQSiftUp(heap, heap.count - 1, order);
+                } else if (order(candidate, heap[0]) == NSOrderedAscending) {
+                    heap[0] = candidate;
+                    CDTQSiftDown(heap, 0, order);
+                }
+            }
+        }
+        range.location += range.length;
+    }
+
+    [heap sortUsingComparator:order];
+    return [heap valueForKey:@"docId"];
+}
+
 /**
  Return ordered list of document IDs using provided indexes.
 
@@ -345,6 +1403,44 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
 + (CDTQSqlParts *)sqlToSortIds:(NSSet /*NSString*/ *)docIdSet
                     usingOrder:(NSArray /*NSDictionary*/ *)sortDocument
                        indexes:(NSDictionary *)indexes
+{
+    // If we have few results, it's more efficient to reduce the search space
+    // for SQLite. 500 placeholders should be a safe value.
+    NSMutableArray *parameters = [NSMutableArray array];
+
+    NSString *whereClause = @"";
+    if (docIdSet.count < kSmallResultSetSizeThreshold) {
+        NSMutableArray *placeholders = [NSMutableArray array];
+        for (NSString *docId in docIdSet) {
+            [placeholders addObject:@"?"];
+            [parameters addObject:docId];
+        }
+        whereClause = [NSString
+            stringWithFormat:@"WHERE _id IN (%@)", [placeholders componentsJoinedByString:@", "]];
+    }
+
+    return [CDTQQueryExecutor sqlToSortIdsWhere:whereClause
+                                     parameters:parameters
+                                     usingOrder:sortDocument
+                                        indexes:indexes];
+}
+
++ (CDTQSqlParts *)sqlToSortIdsMatching:(CDTQSqlParts *)idsSql
+                            usingOrder:(NSArray /*NSDictionary*/ *)sortDocument
+                               indexes:(NSDictionary *)indexes
+{
+    NSString *whereClause =
+        [NSString stringWithFormat:@"WHERE _id IN (%@)", idsSql.sqlWithPlaceholders];
+    return [CDTQQueryExecutor sqlToSortIdsWhere:whereClause
+                                     parameters:idsSql.placeholderValues
+                                     usingOrder:sortDocument
+                                        indexes:indexes];
+}
+
++ (CDTQSqlParts *)sqlToSortIdsWhere:(NSString *)whereClause
+                         parameters:(NSArray *)parameters
+                         usingOrder:(NSArray /*NSDictionary*/ *)sortDocument
+                            indexes:(NSDictionary *)indexes
 {
     NSString *chosenIndex = [CDTQQueryExecutor chooseIndexForSort:sortDocument fromIndexes:indexes];
     if (chosenIndex == nil) {
@@ -353,11 +1449,15 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
     }
 
     NSString *indexTable = [CDTQIndexManager tableNameForIndex:chosenIndex];
+    NSString *collation = [CDTQIndexManager collationOfIndex:indexes[chosenIndex]];
+    NSString *collate = collation ? [NSString stringWithFormat:@" COLLATE \"%@\"", collation] : @"";
 
     // for small result sets:
     // SELECT _id FROM idx WHERE _id IN (?, ?) ORDER BY fieldName ASC, fieldName2 DESC;
     // for large result sets:
     // SELECT _id FROM idx ORDER BY fieldName ASC, fieldName2 DESC;
+    // for the results of a query tree:
+    // SELECT _id FROM idx WHERE _id IN (SELECT _id ...) ORDER BY fieldName ASC;
 
     NSMutableArray *orderClauses = [NSMutableArray array];
     for (NSDictionary *orderClause in sortDocument) {
@@ -365,31 +1465,107 @@ const NSUInteger kSmallResultSetSizeThreshold = 500;
         NSString *direction = orderClause[fieldName];
 
         NSString *orderClause =
-            [NSString stringWithFormat:@"\"%@\" %@", fieldName, [direction uppercaseString]];
+            [NSString stringWithFormat:@"\"%@\"%@ %@", fieldName, collate, [direction uppercaseString]];
         [orderClauses addObject:orderClause];
     }
 
-    // If we have few results, it's more efficient to reduce the search space
-    // for SQLite. 500 placeholders should be a safe value.
-    NSMutableArray *parameters = [NSMutableArray array];
+    NSString *sql =
+        [NSString stringWithFormat:@"SELECT DISTINCT _id FROM \"%@\" %@ ORDER BY %@;", indexTable,
+                                   whereClause, [orderClauses componentsJoinedByString:@", "]];
+    return [CDTQSqlParts partsForSql:sql parameters:parameters];
+}
 
-    NSString *whereClause = @"";
-    if (docIdSet.count < kSmallResultSetSizeThreshold) {
-        NSMutableArray *placeholders = [NSMutableArray array];
-        for (NSString *docId in docIdSet) {
-            [placeholders addObject:@"?"];
-            [parameters addObject:docId];
+/** The direction of a sort by text search relevance, or nil for any other sort. */
++ (NSString *)textScoreOrderOfSort:(NSArray /*NSDictionary*/ *)sortDocument
+{
+    if (sortDocument.count != 1) {
+        return nil;
+    }
+    return sortDocument[0][TEXT_SCORE];
+}
+
++ (NSString *)fts5TextIndexFromIndexes:(NSDictionary *)indexes
+{
+    for (NSString *indexName in indexes) {
+        if ([CDTQIndexManager isFTS5TextIndex:indexes[indexName]]) {
+            return indexName;
+        }
+    }
+    return nil;
+}
+
++ (CDTQSqlParts *)sqlToRankIdsByTextScoreOfQuery:(NSDictionary *)query
+                                      descending:(BOOL)descending
+                                         indexes:(NSDictionary *)indexes
+{
+    return [CDTQQueryExecutor sqlToRankIdsMatching:nil
+                                byTextScoreOfQuery:query
+                                        descending:descending
+                                           indexes:indexes];
+}
+
++ (CDTQSqlParts *)sqlToRankIdsMatching:(CDTQSqlParts *)idsSql
+                    byTextScoreOfQuery:(NSDictionary *)query
+                            descending:(BOOL)descending
+                               indexes:(NSDictionary *)indexes
+{
+    NSString *search = nil;
+    for (NSDictionary *clause in query[AND]) {
+        if ([clause isKindOfClass:[NSDictionary class]] && clause[TEXT]) {
+            search = clause[TEXT][SEARCH];
         }
-        whereClause = [NSString
-            stringWithFormat:@"WHERE _id IN (%@)", [placeholders componentsJoinedByString:@", "]];
+    }
+    if (!search) {
+        os_log_error(CDTOSLog, "Sorting by %{public}@ needs a text search in the query's top level AND", TEXT_SCORE);
+        return nil;
     }
 
+    NSString *textIndex = [CDTQQueryExecutor fts5TextIndexFromIndexes:indexes];
+    if (!textIndex) {
+        os_log_error(CDTOSLog, "Sorting by %{public}@ needs an FTS5 text index", TEXT_SCORE);
+        return nil;
+    }
+
+    // bm25() is lower for more relevant documents.
+    NSString *table = [CDTQIndexManager tableNameForIndex:textIndex];
+    NSString *restriction = @"";
+    NSMutableArray *parameters = [NSMutableArray arrayWithObject:search];
+    if (idsSql) {
+        restriction = [NSString stringWithFormat:@" AND _id IN (%@)", idsSql.sqlWithPlaceholders];
+        [parameters addObjectsFromArray:idsSql.placeholderValues];
+    }
     NSString *sql =
-        [NSString stringWithFormat:@"SELECT DISTINCT _id FROM \"%@\" %@ ORDER BY %@;", indexTable,
-                                   whereClause, [orderClauses componentsJoinedByString:@", "]];
+        [NSString stringWithFormat:@"SELECT _id FROM \"%@\" WHERE \"%@\" MATCH ?%@ ORDER BY bm25(\"%@\") %@;",
+                                   table, table, restriction, table, descending ? @"ASC" : @"DESC"];
     return [CDTQSqlParts partsForSql:sql parameters:parameters];
 }
 
++ (NSArray *)rankIds:(NSSet /*NSString*/ *)docIdSet
+    byTextScoreOfQuery:(NSDictionary *)query
+            descending:(BOOL)descending
+               indexes:(NSDictionary *)indexes
+            inDatabase:(FMDatabase *)db
+{
+    CDTQSqlParts *rank = [CDTQQueryExecutor sqlToRankIdsByTextScoreOfQuery:query
+                                                                descending:descending
+                                                                   indexes:indexes];
+    if (!rank) {
+        return nil;
+    }
+
+    NSMutableOrderedSet *rankedIds = [NSMutableOrderedSet orderedSet];
+    FMResultSet *rs =
+        [db executeQuery:rank.sqlWithPlaceholders withArgumentsInArray:rank.placeholderValues];
+    while ([rs next]) {
+        NSString *docId = [rs stringForColumnIndex:0];
+        if ([docIdSet containsObject:docId]) {
+            [rankedIds addObject:docId];
+        }
+    }
+    [rs close];
+    return [rankedIds array];
+}
+
 + (NSString *)chooseIndexForSort:(NSArray /*NSDictionary*/ *)sortDocument
                      fromIndexes:(NSDictionary *)indexes
 {
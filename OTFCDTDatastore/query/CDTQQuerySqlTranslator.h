@@ -17,9 +17,16 @@
 NS_ASSUME_NONNULL_BEGIN
 
 @class CDTQSqlParts;
+@class CDTQIndexStatistics;
 
 @interface CDTQQueryNode : NSObject
 
+/**
+ Estimated number of index rows this node matches, or nil when there are no statistics for
+ the indexes it uses.
+ */
+@property (nullable, nonatomic, strong) NSNumber *estimatedRows;
+
 @end
 
 @interface CDTQChildrenQueryNode : CDTQQueryNode
@@ -40,6 +47,11 @@ NS_ASSUME_NONNULL_BEGIN
 
 @property (nonatomic, strong) CDTQSqlParts *sql;
 
+/** The JSON index `sql` selects from, or nil for text and all-documents nodes. */
+@property (nullable, nonatomic, strong) NSString *indexName;
+/** The WHERE clause of `sql`, so it can be reused in other statements over `indexName`. */
+@property (nullable, nonatomic, strong) CDTQSqlParts *where;
+
 @end
 
 /**
@@ -116,6 +128,27 @@ NS_ASSUME_NONNULL_BEGIN
                               toUseIndexes:(NSDictionary *)indexes
                          indexesCoverQuery:(BOOL *)indexesCoverQuery;
 
+/**
+ As above, but using `statistics` to choose the cheapest of several suitable indexes and to
+ fill in the estimatedRows of each node.
+
+ @param statistics statistics for some or all of `indexes`, keyed by index name.
+ */
++ (nullable CDTQQueryNode *)translateQuery:(NSDictionary *)query
+                              toUseIndexes:(NSDictionary *)indexes
+                                statistics:
+                                    (nullable NSDictionary<NSString *, CDTQIndexStatistics *> *)
+                                        statistics
+                         indexesCoverQuery:(BOOL *)indexesCoverQuery;
+
+/**
+ Returns `indexes` without the partial indexes which can't be used for `query`, as it might match
+ documents their selectors don't.
+
+ @param query a normalised query.
+ */
++ (NSDictionary *)indexes:(NSDictionary *)indexes usableForQuery:(NSDictionary *)query;
+
 /**
  Expand implicit operators in a query.
  */
@@ -132,6 +165,14 @@ NS_ASSUME_NONNULL_BEGIN
  */
 + (nullable NSArray *)fieldsForAndClause:(NSArray *)clause;
 
+/**
+ Returns the clauses of a normalised $elemMatch on `fieldName` with the field names they'd have
+ in an index, e.g., `items.name` for a `name` clause on `items`, or `items` itself for a clause
+ on the element.
+ */
++ (NSArray<NSDictionary *> *)clausesForElemMatch:(NSDictionary *)elemMatch
+                                         onField:(NSString *)fieldName;
+
 /**
  Checks for the existence of an operator in a query clause array
 */
@@ -149,12 +190,36 @@ NS_ASSUME_NONNULL_BEGIN
 + (nullable NSString *)chooseIndexForAndClause:(NSArray *)clause
                                    fromIndexes:(NSDictionary *)indexes;
 
+/**
+ Returns a normalised AND clause with the operands of comparisons on the index's typed fields
+ as the index stores them, e.g. dates as milliseconds, or nil if an operand isn't of its
+ field's type, so the index can't be used for the clause. Untyped indexes' clauses are
+ returned as they are.
+
+ @param index the index's entry in CDTQIndexManager -listIndexes.
+ */
++ (nullable NSArray *)clause:(NSArray *)clause normalisedForIndex:(NSDictionary *)index;
+
 /**
  Selects an index to use for a set of fields.
+
+ When several indexes contain all the fields, the narrowest is chosen, breaking ties by name
+ so the choice doesn't depend on dictionary ordering.
  */
 + (nullable NSString *)chooseIndexForFields:(NSSet *)neededFields
                                 fromIndexes:(NSDictionary *)indexes;
 
+/**
+ Selects an index to use for a set of fields, choosing the index which is cheapest to scan
+ according to `statistics`. Indexes without statistics are costed as if they had as many rows
+ as the largest index which does have them.
+ */
++ (nullable NSString *)chooseIndexForFields:(NSSet *)neededFields
+                                fromIndexes:(NSDictionary *)indexes
+                                 statistics:
+                                     (nullable NSDictionary<NSString *, CDTQIndexStatistics *> *)
+                                         statistics;
+
 /**
  Returns the SQL WHERE clause for a query.
  */
@@ -170,6 +235,22 @@ NS_ASSUME_NONNULL_BEGIN
 + (nullable CDTQSqlParts *)selectStatementForAndClause:(NSArray *)clause
                                             usingIndex:(NSString *)indexName;
 
+/**
+ Returns the SQL statement to find the IDs of the documents a normalised $geoWithin clause
+ matches, using the R*Tree of a geo index to narrow the search.
+
+ @param geoFields the index's latitude and longitude fields.
+ */
++ (nullable CDTQSqlParts *)selectStatementForGeoClause:(NSDictionary *)geoClause
+                                            usingIndex:(NSString *)indexName
+                                             geoFields:(NSArray<NSString *> *)geoFields;
+
+/** The great circle distance in metres between two points given in degrees. */
++ (double)metresFromLatitude:(double)lat1
+                   longitude:(double)lon1
+                  toLatitude:(double)lat2
+                   longitude:(double)lon2;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -16,10 +16,15 @@
 #import "CDTQQueryConstants.h"
 
 #import "CDTQQueryExecutor.h"
+#import "CDTQIndex.h"
 #import "CDTQIndexManager.h"
+#import "CDTQIndexStatistics.h"
 #import "CDTLogging.h"
 #import "CDTQQueryValidator.h"
 
+/** Mean radius of the Earth, which geo searches take to be a sphere. */
+static const double kCDTQEarthRadiusMetres = 6371008.8;
+
 @interface CDTQTranslatorState : NSObject
 
 @property (nonatomic) BOOL atLeastOneIndexUsed;       // if NO, need to generate a return all query
@@ -27,6 +32,9 @@
 @property (nonatomic) BOOL atLeastOneORIndexMissing;  //       we need to use posthoc matcher
 @property (nonatomic) BOOL textIndexRequired;         // A text index needed for a text search
 @property (nonatomic) BOOL textIndexMissing;          // if NO and is required, cannot perform query
+@property (nonatomic) BOOL geoIndexRequired;          // A geo index needed for a $geoWithin
+@property (nonatomic) BOOL geoIndexMissing;           // if NO and is required, cannot perform query
+@property (nonatomic, strong) NSDictionary *statistics;  // index name -> CDTQIndexStatistics
 
 @end
 
@@ -69,8 +77,21 @@
 + (CDTQQueryNode *)translateQuery:(NSDictionary *)query
                      toUseIndexes:(NSDictionary *)indexes
                 indexesCoverQuery:(BOOL *)indexesCoverQuery
+{
+    return [CDTQQuerySqlTranslator translateQuery:query
+                                     toUseIndexes:indexes
+                                       statistics:nil
+                                indexesCoverQuery:indexesCoverQuery];
+}
+
++ (CDTQQueryNode *)translateQuery:(NSDictionary *)query
+                     toUseIndexes:(NSDictionary *)indexes
+                       statistics:(NSDictionary *)statistics
+                indexesCoverQuery:(BOOL *)indexesCoverQuery
 {
     CDTQTranslatorState *state = [[CDTQTranslatorState alloc] init];
+    state.statistics = statistics;
+    indexes = [CDTQQuerySqlTranslator indexes:indexes usableForQuery:query];
 
     CDTQQueryNode *node =
         [CDTQQuerySqlTranslator translateQuery:query toUseIndexes:indexes state:state];
@@ -81,7 +102,13 @@
     } else if (state.textIndexRequired && state.atLeastOneIndexMissing) {
         os_log_error(CDTOSLog, "Query %{public}@ contains a text search but is missing json index(es).  All indexes must exist in order to execute a query containing a text search.  Create all necessary indexes for the query and re-execute.", query);
         return nil;
-    } else if (!state.textIndexRequired &&
+    } else if (state.geoIndexMissing) {
+        os_log_error(CDTOSLog, "No geo index defined, cannot execute query containing %{public}@.", GEO_WITHIN);
+        return nil;
+    } else if (state.geoIndexRequired && state.atLeastOneIndexMissing) {
+        os_log_error(CDTOSLog, "Query %{public}@ contains a geo search but is missing json index(es).  All indexes must exist in order to execute a query containing a geo search.  Create all necessary indexes for the query and re-execute.", query);
+        return nil;
+    } else if (!state.textIndexRequired && !state.geoIndexRequired &&
                   (!state.atLeastOneIndexUsed || state.atLeastOneORIndexMissing)) {
         // If we haven't used a single index or an OR clause is missing an index,
         // we need to return every document id, so that the post-hoc matcher can
@@ -89,16 +116,21 @@
         CDTQSqlQueryNode *sqlNode = [[CDTQSqlQueryNode alloc] init];
         NSSet *neededFields = [NSSet setWithObject:@"_id"];
         NSString *allDocsIndex = [CDTQQuerySqlTranslator chooseIndexForFields:neededFields
-                                                                  fromIndexes:indexes];
+                                                                  fromIndexes:indexes
+                                                                   statistics:statistics];
 
         if (allDocsIndex.length > 0) {
             NSString *tableName = [CDTQIndexManager tableNameForIndex:allDocsIndex];
             NSString *sql = [NSString stringWithFormat:@"SELECT _id FROM \"%@\";", tableName];
             sqlNode.sql = [CDTQSqlParts partsForSql:sql parameters:@[]];
+            sqlNode.estimatedRows = [CDTQQuerySqlTranslator estimatedRowsForAndClause:@[]
+                                                                           usingIndex:allDocsIndex
+                                                                                state:state];
         }
 
         CDTQAndQueryNode *root = [[CDTQAndQueryNode alloc] init];
         [root.children addObject:sqlNode];
+        root.estimatedRows = sqlNode.estimatedRows;
 
         *indexesCoverQuery = NO;
         return root;
@@ -108,6 +140,42 @@
     }
 }
 
++ (NSDictionary *)indexes:(NSDictionary *)indexes usableForQuery:(NSDictionary *)query
+{
+    NSMutableDictionary *usable = [NSMutableDictionary dictionary];
+    for (NSString *indexName in indexes) {
+        NSDictionary *selector = indexes[indexName][@"selector"];
+        if (!selector || [CDTQQuerySqlTranslator query:query impliesSelector:selector]) {
+            usable[indexName] = indexes[indexName];
+        }
+    }
+    return usable;
+}
+
+/**
+ Whether every document matching `query` matches `selector`, as far as we can tell cheaply: the
+ selector is the query, or each of its top level AND clauses is also one of the query's.
+ */
++ (BOOL)query:(NSDictionary *)query impliesSelector:(NSDictionary *)selector
+{
+    if ([query isEqualToDictionary:selector]) {
+        return YES;
+    }
+
+    NSArray *queryClauses = query[AND];
+    NSArray *selectorClauses = selector[AND];
+    if (selector.count != 1 || ![queryClauses isKindOfClass:[NSArray class]] ||
+        ![selectorClauses isKindOfClass:[NSArray class]]) {
+        return NO;
+    }
+    for (NSDictionary *clause in selectorClauses) {
+        if (![queryClauses containsObject:clause]) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
 + (CDTQQueryNode *)translateQuery:(NSDictionary *)query
                      toUseIndexes:(NSDictionary *)indexes
                             state:(CDTQTranslatorState *)state
@@ -128,12 +196,13 @@
         root = [[CDTQOrQueryNode alloc] init];
     }
 
-    // Compile a list of simple clauses to be handled below.  If a text clause is
+    // Compile a list of simple clauses to be handled below.  If a text or geo clause is
     // encountered, store it separately from the simple clauses since it will be
     // handled later on its own.
 
     NSMutableArray *basicClauses = [NSMutableArray array];
     __block NSObject *textClause = nil;
+    NSMutableArray *geoClauses = [NSMutableArray array];
     
     [clauses enumerateObjectsUsingBlock:^(id obj, NSUInteger idx, BOOL *stop) {
         NSDictionary *clause = (NSDictionary *)obj;
@@ -142,6 +211,8 @@
             [basicClauses addObject:clauses[idx]];
         } else if ([field.lowercaseString isEqualToString:TEXT]) {
             textClause = clauses[idx];
+        } else if ([field isEqualToString:GEO_WITHIN]) {
+            [geoClauses addObject:clauses[idx]];
         }
     }];
 
@@ -154,17 +225,24 @@
             // single SQL statement to use that index to satisfy the clauses.
             
             NSString *chosenIndex =
-            [CDTQQuerySqlTranslator chooseIndexForAndClause:basicClauses fromIndexes:indexes];
+            [CDTQQuerySqlTranslator chooseIndexForAndClause:basicClauses
+                                                fromIndexes:indexes
+                                                 statistics:state.statistics];
             if (!chosenIndex) {
                 state.atLeastOneIndexMissing = YES;
 
                 os_log_debug(CDTOSLog, "No single index contains all of %@; add index for these fields to query efficiently.", basicClauses);
             } else {
                 state.atLeastOneIndexUsed = YES;
-                
+
+                // Compare with values as a typed index stores them.
+                NSArray *indexClauses =
+                    [CDTQQuerySqlTranslator clause:basicClauses
+                                normalisedForIndex:indexes[chosenIndex]];
+
                 // Execute SQL on that index with appropriate values
                 CDTQSqlParts *select = [CDTQQuerySqlTranslator selectStatementForAndClause:
-                                        basicClauses usingIndex:chosenIndex];
+                                        indexClauses usingIndex:chosenIndex];
                 
                 if (!select) {
                     os_log_error(CDTOSLog, "Error generating SELECT clause for %{public}@", basicClauses);
@@ -173,6 +251,12 @@
                 
                 CDTQSqlQueryNode *sql = [[CDTQSqlQueryNode alloc] init];
                 sql.sql = select;
+                sql.indexName = chosenIndex;
+                sql.where = [CDTQQuerySqlTranslator wherePartsForAndClause:indexClauses
+                                                                usingIndex:chosenIndex];
+                sql.estimatedRows = [CDTQQuerySqlTranslator estimatedRowsForAndClause:indexClauses
+                                                                           usingIndex:chosenIndex
+                                                                                state:state];
                 
                 [root.children addObject:sql];
             }
@@ -192,7 +276,9 @@
                 NSArray *wrappedClause = @[ clause ];
                 
                 NSString *chosenIndex =
-                [CDTQQuerySqlTranslator chooseIndexForAndClause:wrappedClause fromIndexes:indexes];
+                [CDTQQuerySqlTranslator chooseIndexForAndClause:wrappedClause
+                                                    fromIndexes:indexes
+                                                     statistics:state.statistics];
                 if (!chosenIndex) {
                     state.atLeastOneIndexMissing = YES;
                     state.atLeastOneORIndexMissing = YES;
@@ -200,7 +286,9 @@
                     os_log_debug(CDTOSLog, "No single index contains all of %{public}@; add index for these fields to query efficiently.", basicClauses);
                 } else {
                     state.atLeastOneIndexUsed = YES;
-                    
+                    wrappedClause = [CDTQQuerySqlTranslator clause:wrappedClause
+                                                normalisedForIndex:indexes[chosenIndex]];
+
                     // Execute SQL on that index with appropriate values
                     CDTQSqlParts *select =
                     [CDTQQuerySqlTranslator selectStatementForAndClause:wrappedClause
@@ -213,6 +301,13 @@
                     
                     CDTQSqlQueryNode *sql = [[CDTQSqlQueryNode alloc] init];
                     sql.sql = select;
+                    sql.indexName = chosenIndex;
+                    sql.where = [CDTQQuerySqlTranslator wherePartsForAndClause:wrappedClause
+                                                                    usingIndex:chosenIndex];
+                    sql.estimatedRows =
+                        [CDTQQuerySqlTranslator estimatedRowsForAndClause:wrappedClause
+                                                               usingIndex:chosenIndex
+                                                                    state:state];
                     
                     [root.children addObject:sql];
                 }
@@ -246,6 +341,31 @@
         }
     }
 
+    // A geo clause such as { "$geoWithin" : { "$box" : [ [ 51, -1 ], [ 52, 0 ] ] } } searches
+    // the R*Tree of the geo index, so it's handled on its own like a text clause.
+    for (NSDictionary *geoClause in geoClauses) {
+        state.geoIndexRequired = YES;
+        NSString *geoIndex = [CDTQQuerySqlTranslator getGeoIndexFromIndexes:indexes];
+        if (!geoIndex) {
+            state.geoIndexMissing = YES;
+            break;
+        }
+
+        CDTQSqlParts *select = [CDTQQuerySqlTranslator
+            selectStatementForGeoClause:geoClause
+                             usingIndex:geoIndex
+                              geoFields:[CDTQIndexManager geoFieldNamesOfIndex:indexes[geoIndex]]];
+        if (!select) {
+            os_log_error(CDTOSLog, "Error generating SELECT clause for %{public}@", geoClause);
+            return nil;
+        }
+
+        CDTQSqlQueryNode *sql = [[CDTQSqlQueryNode alloc] init];
+        sql.sql = select;
+
+        [root.children addObject:sql];
+    }
+
     //
     // AND and OR subclauses are handled identically whatever the parent is.
     // We go through the query twice to order the OR clauses before the AND
@@ -276,22 +396,93 @@
         }
     }];
 
+    root.estimatedRows = [CDTQQuerySqlTranslator estimatedRowsForNode:root];
+
     return root;
 }
 
+#pragma mark Estimating result sizes
+
++ (NSNumber *)estimatedRowsForAndClause:(NSArray *)clause
+                             usingIndex:(NSString *)indexName
+                                  state:(CDTQTranslatorState *)state
+{
+    CDTQIndexStatistics *statistics = state.statistics[indexName];
+    if (!statistics) {
+        return nil;
+    }
+    return @([statistics estimatedRowsForAndClause:clause]);
+}
+
+/**
+ An AND matches at most as many rows as its smallest known child; an OR at most the sum of
+ its children, so it's unknown if any child is.
+ */
++ (NSNumber *)estimatedRowsForNode:(CDTQChildrenQueryNode *)node
+{
+    BOOL isAnd = [node isKindOfClass:[CDTQAndQueryNode class]];
+    NSNumber *estimate = nil;
+    for (CDTQQueryNode *child in node.children) {
+        if (!child.estimatedRows) {
+            if (isAnd) {
+                continue;
+            }
+            return nil;
+        }
+        if (!estimate) {
+            estimate = child.estimatedRows;
+        } else if (isAnd) {
+            estimate = @(MIN(estimate.doubleValue, child.estimatedRows.doubleValue));
+        } else {
+            estimate = @(estimate.doubleValue + child.estimatedRows.doubleValue);
+        }
+    }
+    return estimate;
+}
+
 #pragma mark Process single AND clause with no sub-clauses
 
 + (NSArray *)fieldsForAndClause:(NSArray *)clause
 {
     NSMutableArray *fieldNames = [NSMutableArray array];
     for (NSDictionary *term in clause) {
-        if (term.count == 1) {
-            [fieldNames addObject:term.allKeys[0]];
+        if (term.count != 1) {
+            continue;
+        }
+
+        // An $elemMatch, possibly negated, needs the fields of its clauses.
+        NSString *fieldName = term.allKeys[0];
+        NSDictionary *predicate = term[fieldName];
+        if ([predicate isKindOfClass:[NSDictionary class]] &&
+            [predicate[NOT] isKindOfClass:[NSDictionary class]]) {
+            predicate = predicate[NOT];
+        }
+        if ([predicate isKindOfClass:[NSDictionary class]] && predicate[ELEM_MATCH]) {
+            for (NSDictionary *elemClause in
+                 [self clausesForElemMatch:predicate[ELEM_MATCH] onField:fieldName]) {
+                [fieldNames addObject:elemClause.allKeys[0]];
+            }
+        } else {
+            [fieldNames addObject:fieldName];
         }
     }
     return [NSArray arrayWithArray:fieldNames];
 }
 
++ (NSArray<NSDictionary *> *)clausesForElemMatch:(NSDictionary *)elemMatch
+                                         onField:(NSString *)fieldName
+{
+    NSMutableArray *clauses = [NSMutableArray array];
+    for (NSDictionary *elemClause in elemMatch[AND]) {
+        NSString *subField = elemClause.allKeys[0];
+        NSString *indexField =
+            subField.length > 0 ? [NSString stringWithFormat:@"%@.%@", fieldName, subField]
+                                : fieldName;
+        [clauses addObject:@{indexField : elemClause[subField]}];
+    }
+    return [NSArray arrayWithArray:clauses];
+}
+
 + (BOOL)isOperator:(NSString *)operator inClause:(NSArray *)clause
 {
     BOOL found = NO;
@@ -314,6 +505,15 @@
 }
 
 + (NSString *)chooseIndexForAndClause:(NSArray *)clause fromIndexes:(NSDictionary *)indexes
+{
+    return [CDTQQuerySqlTranslator chooseIndexForAndClause:clause
+                                               fromIndexes:indexes
+                                                statistics:nil];
+}
+
++ (NSString *)chooseIndexForAndClause:(NSArray *)clause
+                          fromIndexes:(NSDictionary *)indexes
+                           statistics:(NSDictionary *)statistics
 {
     if ([CDTQQuerySqlTranslator isOperator:SIZE inClause:clause]) {
         os_log_info(CDTOSLog, "$size operator found in clause %{public}@.  Indexes are not used with $size operations.", clause);
@@ -326,13 +526,155 @@
         return nil;  // no point in querying empty set of fields
     }
 
-    return [CDTQQuerySqlTranslator chooseIndexForFields:neededFields fromIndexes:indexes];
+    // Only a multikey index's rows each describe a single element of an array of objects.
+    if ([CDTQQuerySqlTranslator isOperator:ELEM_MATCH inClause:clause]) {
+        NSMutableDictionary *multiKeyIndexes = [NSMutableDictionary dictionary];
+        for (NSString *indexName in indexes) {
+            if ([indexes[indexName][@"type"] isEqualToString:@"multikey"]) {
+                multiKeyIndexes[indexName] = indexes[indexName];
+            }
+        }
+        indexes = multiKeyIndexes;
+    }
+
+    // A typed index only holds values of its fields' types, so can't answer comparisons with
+    // other types.
+    NSMutableDictionary *comparableIndexes = [NSMutableDictionary dictionary];
+    for (NSString *indexName in indexes) {
+        if ([CDTQQuerySqlTranslator clause:clause normalisedForIndex:indexes[indexName]]) {
+            comparableIndexes[indexName] = indexes[indexName];
+        }
+    }
+
+    return [CDTQQuerySqlTranslator chooseIndexForFields:neededFields
+                                            fromIndexes:comparableIndexes
+                                             statistics:statistics
+                                                 clause:clause];
+}
+
++ (NSArray *)clause:(NSArray *)clause normalisedForIndex:(NSDictionary *)index
+{
+    NSDictionary *fieldTypes = index[@"fieldTypes"];
+    if (!fieldTypes) {
+        return clause;
+    }
+
+    NSMutableArray *normalised = [NSMutableArray arrayWithCapacity:clause.count];
+    for (NSDictionary *term in clause) {
+        NSString *fieldName = term.allKeys.firstObject;
+        NSString *fieldType = fieldTypes[fieldName];
+        if (!fieldType) {
+            [normalised addObject:term];
+            continue;
+        }
+
+        NSDictionary *predicate = term[fieldName];
+        BOOL negated = predicate[NOT] != nil;
+        if (negated) {
+            predicate = predicate[NOT];
+        }
+        predicate = [CDTQQuerySqlTranslator predicate:predicate normalisedForFieldType:fieldType];
+        if (!predicate) {
+            return nil;
+        }
+        [normalised addObject:@{ fieldName : negated ? @{ NOT : predicate } : predicate }];
+    }
+    return normalised;
+}
+
+/** Returns a single operator predicate with its operand as a typed field stores it, or nil. */
++ (NSDictionary *)predicate:(NSDictionary *)predicate normalisedForFieldType:(NSString *)fieldType
+{
+    if (predicate.count != 1) {
+        return nil;
+    }
+    NSString *operator = predicate.allKeys[0];
+    NSObject *operand = predicate[operator];
+
+    if ([@[ EQ, GT, GTE, LT, LTE ] containsObject:operator]) {
+        NSObject *value = [CDTQIndex value:operand normalisedForFieldType:fieldType];
+        return value ? @{ operator : value } : nil;
+    } else if ([operator isEqualToString:IN]) {
+        NSMutableArray *values = [NSMutableArray array];
+        for (NSObject *item in (NSArray *)operand) {
+            NSObject *value = [CDTQIndex value:item normalisedForFieldType:fieldType];
+            if (!value) {
+                return nil;
+            }
+            [values addObject:value];
+        }
+        return @{ operator : values };
+    } else if ([operator isEqualToString:MOD]) {
+        BOOL numeric = [fieldType isEqualToString:@"integer"] || [fieldType isEqualToString:@"real"];
+        return numeric ? predicate : nil;
+    } else if ([operator isEqualToString:EXISTS]) {
+        return predicate;
+    }
+    return nil;
+}
+
+/**
+ Returns the term of the clause which a typed index's seek index can find the rows for, a
+ comparison on the index's first field, or nil if there's none or the index isn't typed.
+ */
++ (NSDictionary *)seekTermInClause:(NSArray *)clause forIndex:(NSDictionary *)index
+{
+    if (!index[@"fieldTypes"]) {
+        return nil;
+    }
+
+    NSString *firstField = nil;
+    for (NSString *fieldName in index[@"fields"]) {
+        if (![fieldName isEqualToString:@"_id"] && ![fieldName isEqualToString:@"_rev"]) {
+            firstField = fieldName;
+            break;
+        }
+    }
+
+    for (NSDictionary *term in clause) {
+        NSDictionary *predicate = term[firstField];
+        if ([predicate isKindOfClass:[NSDictionary class]] && predicate.count == 1 &&
+            [@[ EQ, GT, GTE, LT, LTE, IN ] containsObject:predicate.allKeys[0]]) {
+            return term;
+        }
+    }
+    return nil;
 }
 
 + (NSString *)chooseIndexForFields:(NSSet *)neededFields fromIndexes:(NSDictionary *)indexes
 {
+    return [CDTQQuerySqlTranslator chooseIndexForFields:neededFields
+                                            fromIndexes:indexes
+                                             statistics:nil];
+}
+
++ (NSString *)chooseIndexForFields:(NSSet *)neededFields
+                       fromIndexes:(NSDictionary *)indexes
+                        statistics:(NSDictionary *)statistics
+{
+    return [CDTQQuerySqlTranslator chooseIndexForFields:neededFields
+                                            fromIndexes:indexes
+                                             statistics:statistics
+                                                 clause:nil];
+}
+
++ (NSString *)chooseIndexForFields:(NSSet *)neededFields
+                       fromIndexes:(NSDictionary *)indexes
+                        statistics:(NSDictionary *)statistics
+                            clause:(NSArray *)clause
+{
+    // Every query over an index table scans it, as the SQLite index on the table leads with
+    // _id, so the cost of using an index is its row count times its row width. Indexes we
+    // have no statistics for are assumed to be as large as the largest we do. The exception
+    // is a comparison on the first field of a typed index, whose rows its seek index finds.
+    NSUInteger largestRowCount = 1;
+    for (CDTQIndexStatistics *indexStatistics in statistics.allValues) {
+        largestRowCount = MAX(largestRowCount, indexStatistics.rowCount);
+    }
+
     NSString *chosenIndex = nil;
-    for (NSString *indexName in indexes) {
+    double chosenCost = 0;
+    for (NSString *indexName in [indexes.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
         
         // Don't choose a text index for a non-text query clause
         NSString *indexType = indexes[indexName][@"type"];
@@ -340,10 +682,25 @@
             continue;
         }
         
-        NSSet *providedFields = [NSSet setWithArray:indexes[indexName][@"fields"]];
-        if ([neededFields isSubsetOfSet:providedFields]) {
+        NSArray *fields = indexes[indexName][@"fields"];
+        NSSet *providedFields = [NSSet setWithArray:fields];
+        if (![neededFields isSubsetOfSet:providedFields]) {
+            continue;
+        }
+
+        CDTQIndexStatistics *indexStatistics = statistics[indexName];
+        double rows = indexStatistics ? indexStatistics.rowCount : largestRowCount;
+        NSDictionary *seekTerm =
+            [CDTQQuerySqlTranslator seekTermInClause:clause forIndex:indexes[indexName]];
+        if (seekTerm) {
+            rows = indexStatistics
+                       ? MIN(rows, [indexStatistics estimatedRowsForAndClause:@[ seekTerm ]])
+                       : rows / 3;
+        }
+        double cost = rows * providedFields.count;
+        if (!chosenIndex || cost < chosenCost) {
             chosenIndex = indexName;
-            break;
+            chosenCost = cost;
         }
     }
 
@@ -364,6 +721,16 @@
     return textIndex;
 }
 
++ (NSString *)getGeoIndexFromIndexes:(NSDictionary *)indexes
+{
+    for (NSString *indexName in [indexes.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
+        if ([indexes[indexName][@"type"] isEqualToString:@"geo"]) {
+            return indexName;
+        }
+    }
+    return nil;
+}
+
 + (CDTQSqlParts *)wherePartsForAndClause:(NSArray *)clause usingIndex:(NSString *)indexName
 {
     if (clause.count == 0) {
@@ -422,6 +789,18 @@
                     addObject:[self convertExistsToSqlClauseForFieldName:fieldName exists:exists]];
                     [sqlParameters addObject:negatedPredicate[operator]];
 
+            } else if ([operator isEqualToString:ALL] || [operator isEqualToString:ELEM_MATCH]) {
+                // Both select the matching documents' rows, so the negation is every other
+                // document.
+                NSString *subSelect = [CDTQQuerySqlTranslator subSelectForPredicate:negatedPredicate
+                                                                            onField:fieldName
+                                                                         usingIndex:indexName
+                                                            updatingParameterValues:sqlParameters];
+                if (!subSelect) {
+                    return nil;
+                }
+                [sqlClauses addObject:[NSString stringWithFormat:@"_id NOT IN (%@)", subSelect]];
+
             } else {
                 NSString *sqlClause;
                 NSString *sqlOperator = operatorMap[operator];
@@ -463,6 +842,20 @@
                                                                               exists:exists]];
                     [sqlParameters addObject:predicate[operator]];
 
+            } else if ([operator isEqualToString:ALL] || [operator isEqualToString:ELEM_MATCH]) {
+                // A row of a multikey index holds a single element of the array, so an
+                // $elemMatch's conditions all apply to the same row. That needn't be the row
+                // matching the rest of the clause, or another $elemMatch, so each gets its own
+                // sub-SELECT.
+                NSString *subSelect = [CDTQQuerySqlTranslator subSelectForPredicate:predicate
+                                                                            onField:fieldName
+                                                                         usingIndex:indexName
+                                                            updatingParameterValues:sqlParameters];
+                if (!subSelect) {
+                    return nil;
+                }
+                [sqlClauses addObject:[NSString stringWithFormat:@"_id IN (%@)", subSelect]];
+
             } else {
                 NSString *sqlClause;
                 NSString *sqlOperator = operatorMap[operator];
@@ -512,6 +905,38 @@
     return [NSString stringWithFormat:@"( %@ )", joined];
 }
 
+/**
+ * Returns a SELECT of the document IDs matching an $all or $elemMatch predicate on the
+ * field.  A document matches $all if its rows hold every one of the distinct values.
+ */
++ (NSString *)subSelectForPredicate:(NSDictionary *)predicate
+                            onField:(NSString *)fieldName
+                         usingIndex:(NSString *)indexName
+            updatingParameterValues:(NSMutableArray *)sqlParameters
+{
+    NSString *tableName = [CDTQIndexManager tableNameForIndex:indexName];
+
+    if (predicate[ALL]) {
+        NSArray *values = [[NSOrderedSet orderedSetWithArray:predicate[ALL]] array];
+        NSString *placeholders = [CDTQQuerySqlTranslator placeholdersForList:values
+                                                     updatingParameterValues:sqlParameters];
+        return [NSString stringWithFormat:@"SELECT _id FROM \"%@\" WHERE \"%@\" IN %@ "
+                                          @"GROUP BY _id HAVING COUNT(DISTINCT \"%@\") = %lu",
+                                          tableName, fieldName, placeholders, fieldName,
+                                          (unsigned long)values.count];
+    }
+
+    CDTQSqlParts *where = [CDTQQuerySqlTranslator
+        wherePartsForAndClause:[self clausesForElemMatch:predicate[ELEM_MATCH] onField:fieldName]
+                    usingIndex:indexName];
+    if (!where) {
+        return nil;
+    }
+    [sqlParameters addObjectsFromArray:where.placeholderValues];
+    return [NSString stringWithFormat:@"SELECT _id FROM \"%@\" WHERE %@", tableName,
+                                      where.sqlWithPlaceholders];
+}
+
 /**
  * WHERE clause representation of $not must be handled by using a
  * sub-SELECT statement of the operator which is then applied to
@@ -595,4 +1020,86 @@
     return parts;
 }
 
+#pragma mark Geo searches
+
++ (CDTQSqlParts *)selectStatementForGeoClause:(NSDictionary *)geoClause
+                                   usingIndex:(NSString *)indexName
+                                    geoFields:(NSArray<NSString *> *)geoFields
+{
+    if (!indexName || geoFields.count != 2) {
+        return nil;
+    }
+
+    NSString *latitude = geoFields[0];
+    NSString *longitude = geoFields[1];
+    NSDictionary *operand = geoClause[GEO_WITHIN];
+    double minLat, maxLat, minLon, maxLon;
+    NSString *exact;
+    NSArray *exactParameters;
+
+    if (operand[BOX]) {
+        NSArray *box = operand[BOX];
+        minLat = [box[0][0] doubleValue];
+        minLon = [box[0][1] doubleValue];
+        maxLat = [box[1][0] doubleValue];
+        maxLon = [box[1][1] doubleValue];
+        exact = [NSString stringWithFormat:@"t.\"%@\" BETWEEN ? AND ? AND t.\"%@\" BETWEEN ? AND ?",
+                                           latitude, longitude];
+        exactParameters = @[ @(minLat), @(maxLat), @(minLon), @(maxLon) ];
+
+    } else if (operand[CENTER]) {
+        double lat = [operand[CENTER][0][0] doubleValue];
+        double lon = [operand[CENTER][0][1] doubleValue];
+        double radius = [operand[CENTER][1] doubleValue];
+
+        // The R*Tree is searched for the box around the circle. It spans every longitude if
+        // it takes in a pole, or would cross the antimeridian.
+        double angle = radius / kCDTQEarthRadiusMetres;
+        double dLat = angle * 180 / M_PI;
+        minLat = MAX(-90, lat - dLat);
+        maxLat = MIN(90, lat + dLat);
+        minLon = -180;
+        maxLon = 180;
+        double sinDLon = sin(angle) / cos(lat * M_PI / 180);
+        if (minLat > -90 && maxLat < 90 && sinDLon < 1) {
+            double dLon = asin(sinDLon) * 180 / M_PI;
+            if (lon - dLon >= -180 && lon + dLon <= 180) {
+                minLon = lon - dLon;
+                maxLon = lon + dLon;
+            }
+        }
+        exact = [NSString stringWithFormat:@"cdtq_geo_distance(t.\"%@\", t.\"%@\", ?, ?) <= ?",
+                                           latitude, longitude];
+        exactParameters = @[ @(lat), @(lon), @(radius) ];
+
+    } else {
+        return nil;
+    }
+
+    // The R*Tree stores its points rounded outwards, so it finds a few more candidates than
+    // match, and each is checked against the exact values in the index's table.
+    NSString *sql = @"SELECT t._id FROM \"%@\" r CROSS JOIN \"%@\" t ON t.rowid = r.id "
+                     "WHERE r.max_lat >= ? AND r.min_lat <= ? AND r.max_lon >= ? AND r.min_lon <= ? "
+                     "AND %@;";
+    sql = [NSString stringWithFormat:sql, [CDTQIndexManager rtreeTableNameForIndex:indexName],
+                                     [CDTQIndexManager tableNameForIndex:indexName], exact];
+    NSMutableArray *parameters = [@[ @(minLat), @(maxLat), @(minLon), @(maxLon) ] mutableCopy];
+    [parameters addObjectsFromArray:exactParameters];
+    return [CDTQSqlParts partsForSql:sql parameters:parameters];
+}
+
++ (double)metresFromLatitude:(double)lat1
+                   longitude:(double)lon1
+                  toLatitude:(double)lat2
+                   longitude:(double)lon2
+{
+    // The haversine formula, which is well conditioned for small distances.
+    double phi1 = lat1 * M_PI / 180;
+    double phi2 = lat2 * M_PI / 180;
+    double sinDPhi = sin((phi2 - phi1) / 2);
+    double sinDLambda = sin((lon2 - lon1) * M_PI / 180 / 2);
+    double a = sinDPhi * sinDPhi + cos(phi1) * cos(phi2) * sinDLambda * sinDLambda;
+    return 2 * kCDTQEarthRadiusMetres * asin(MIN(1.0, sqrt(a)));
+}
+
 @end
@@ -54,6 +54,19 @@
         // and make
         //     [ {"field1": { "$eq": "mike"} }, ... ]
         predicates = [CDTQQueryValidator addImplicitEq:predicates];
+
+        // The selector inside an $elemMatch is normalised the same way, into an $and of the
+        // conditions a single array element has to meet. A bare operator applies to the
+        // element itself, which is written as the empty field name.
+        // Take
+        //     [ { "items": { "$elemMatch": { "name": "mike", "qty": { "$gt": 2 } } } }, ... ]
+        //     [ { "scores": { "$elemMatch": { "$gte": 80, "$lt": 85 } } }, ... ]
+        // and make
+        //     [ { "items": { "$elemMatch": { "$and": [ { "name": { "$eq": "mike" } },
+        //                                              { "qty": { "$gt": 2 } } ] } } }, ... ]
+        //     [ { "scores": { "$elemMatch": { "$and": [ { "": { "$gte": 80 } },
+        //                                               { "": { "$lt": 85 } } ] } } }, ... ]
+        predicates = [CDTQQueryValidator normaliseElemMatchOperators:predicates];
         
         // Then all shorthand operators like $ne, if present, need to be
         // converted to their logical longhand equivalent.
@@ -158,6 +171,78 @@
     return [NSArray arrayWithArray:accumulator];
 }
 
++ (NSArray *)normaliseElemMatchOperators:(NSArray *)clause
+{
+    NSMutableArray *accumulator = [NSMutableArray array];
+
+    for (NSDictionary *fieldClause in clause) {
+        if (![fieldClause isKindOfClass:[NSDictionary class]] || [fieldClause count] != 1) {
+            // if this isn't a dictionary, we don't know what to do so add the clause
+            // to the accumulator to be dealt with later as part of the final selector
+            // validation.
+            [accumulator addObject:fieldClause];
+            continue;
+        }
+
+        NSString *fieldName = fieldClause.allKeys[0];
+        NSObject *predicate = fieldClause[fieldName];
+        if ([fieldName hasPrefix:@"$"] && [predicate isKindOfClass:[NSArray class]]) {
+            predicate = [CDTQQueryValidator normaliseElemMatchOperators:(NSArray *)predicate];
+        } else if ([predicate isKindOfClass:[NSDictionary class]]) {
+            predicate = [CDTQQueryValidator normaliseElemMatchPredicate:(NSDictionary *)predicate];
+        }
+
+        [accumulator addObject:@{fieldName : predicate}];  // can't put nil in this
+    }
+
+    return [NSArray arrayWithArray:accumulator];
+}
+
+/**
+ * Normalises { "$elemMatch" : ... }, possibly inside $not operators, leaving any other
+ * predicate as it is.
+ */
++ (NSDictionary *)normaliseElemMatchPredicate:(NSDictionary *)predicate
+{
+    if (predicate.count != 1) {
+        return predicate;
+    }
+
+    NSString *operator = predicate.allKeys[0];
+    if ([operator isEqualToString:NOT] && [predicate[NOT] isKindOfClass:[NSDictionary class]]) {
+        return @{NOT : [CDTQQueryValidator normaliseElemMatchPredicate:predicate[NOT]]};
+    } else if (![operator isEqualToString:ELEM_MATCH] ||
+               ![predicate[ELEM_MATCH] isKindOfClass:[NSDictionary class]]) {
+        return predicate;
+    }
+
+    NSDictionary *elemSelector = predicate[ELEM_MATCH];
+    NSMutableArray *operatorClauses = [NSMutableArray array];
+    for (NSString *key in elemSelector) {
+        if ([key hasPrefix:@"$"] && ![key isEqualToString:AND] && ![key isEqualToString:OR]) {
+            [operatorClauses addObject:@{ @"" : @{key : elemSelector[key]} }];
+        }
+    }
+
+    NSObject *elemClauses = nil;
+    if (operatorClauses.count == elemSelector.count) {
+        elemClauses = operatorClauses;
+    } else if (operatorClauses.count == 0) {
+        elemClauses = [CDTQQueryValidator addImplicitAnd:elemSelector][AND];
+        if ([elemClauses isKindOfClass:[NSArray class]]) {
+            elemClauses = [CDTQQueryValidator addImplicitEq:(NSArray *)elemClauses];
+        }
+    }
+
+    // Anything else, like a mix of fields and operators, is left to fail validation.
+    if (![elemClauses isKindOfClass:[NSArray class]]) {
+        return predicate;
+    }
+    NSArray *normalised = [CDTQQueryValidator handleShortHandOperators:(NSArray *)elemClauses];
+    normalised = [CDTQQueryValidator compressMultipleNotOperators:normalised];
+    return @{ELEM_MATCH : @{AND : normalised}};
+}
+
 + (NSArray *)handleShortHandOperators:(NSArray *)clause
 {
     NSMutableArray *accumulator = [NSMutableArray array];
@@ -407,6 +492,8 @@
             
             valid = [CDTQQueryValidator validateTextClause:clause[key]
                                        withTextClauseLimit:textClauseLimitReached];
+        } else if ([key isEqualToString:GEO_WITHIN]) {
+            valid = [CDTQQueryValidator validateGeoWithinClause:clause[key]];
         } else {
             os_log_error(CDTOSLog, "%{public}@ operator cannot be a top level operator", key);
             break;
@@ -426,7 +513,8 @@
     // to { "$not" : { "$eq" : "blah" } } before reaching this validation.  So
     // operators like $ne and $nin will be negated $eq and $in by the time this
     // validation is reached.
-    NSArray *validOperators =  @[ EQ, LT, GT, EXISTS, NOT, GTE, LTE, IN, MOD, SIZE ];
+    NSArray *validOperators =
+        @[ EQ, LT, GT, EXISTS, NOT, GTE, LTE, IN, MOD, SIZE, ALL, ELEM_MATCH ];
 
     if ([clause count] == 1) {
         NSString *operator= [clause allKeys][0];
@@ -442,6 +530,12 @@
             } else if ([operator isEqualToString:IN]) {
                 return [clauseOperand isKindOfClass:[NSArray class]] &&
                        [CDTQQueryValidator validateListValues:clauseOperand];
+            } else if ([operator isEqualToString:ALL]) {
+                return [clauseOperand isKindOfClass:[NSArray class]] &&
+                       [(NSArray *)clauseOperand count] > 0 &&
+                       [CDTQQueryValidator validateListValues:clauseOperand];
+            } else if ([operator isEqualToString:ELEM_MATCH]) {
+                return [CDTQQueryValidator validateElemMatchOperand:clauseOperand];
             } else {
                 return [CDTQQueryValidator validatePredicateValue:clauseOperand
                                                       forOperator:operator];
@@ -452,6 +546,52 @@
     return NO;
 }
 
+/**
+ * Validates the normalised selector of an $elemMatch, which is an $and of simple
+ * comparisons, each of which a single element in the array must satisfy.  Negations
+ * aren't allowed, as "some element isn't" can't be answered from any single element's
+ * index row.
+ */
++ (BOOL)validateElemMatchOperand:(NSObject *)operand
+{
+    NSArray *validOperators = @[ EQ, LT, GT, GTE, LTE, IN ];
+
+    NSObject *clauses =
+        [operand isKindOfClass:[NSDictionary class]] && [(NSDictionary *)operand count] == 1
+            ? ((NSDictionary *)operand)[AND]
+            : nil;
+    if (![clauses isKindOfClass:[NSArray class]] || [(NSArray *)clauses count] == 0) {
+        os_log_error(CDTOSLog, "$elemMatch expects a non-empty selector, found %{public}@", operand);
+        return NO;
+    }
+
+    for (NSDictionary *clause in (NSArray *)clauses) {
+        if (![clause isKindOfClass:[NSDictionary class]] || clause.count != 1) {
+            os_log_error(CDTOSLog, "Invalid clause %{public}@ in $elemMatch", clause);
+            return NO;
+        }
+        NSString *fieldName = clause.allKeys[0];
+        NSDictionary *predicate = clause[fieldName];
+        // The empty field name is the element itself.
+        NSArray *parts =
+            fieldName.length > 0 ? [fieldName componentsSeparatedByString:@"."] : @[];
+        for (NSString *part in parts) {
+            if (part.length == 0 || [part hasPrefix:@"$"]) {
+                os_log_error(CDTOSLog, "Invalid field %{public}@ in $elemMatch", fieldName);
+                return NO;
+            }
+        }
+        if (![predicate isKindOfClass:[NSDictionary class]] || predicate.count != 1 ||
+            ![validOperators containsObject:predicate.allKeys[0]] ||
+            ![CDTQQueryValidator validateClause:predicate]) {
+            os_log_error(CDTOSLog, "$elemMatch only supports $eq, $lt, $lte, $gt, $gte and $in, found %{public}@", clause);
+            return NO;
+        }
+    }
+
+    return YES;
+}
+
 /**
  * This method handles the special case where a text search clause is encountered.
  * This case is special because a $text operator expects an NSDictionary value whose 
@@ -491,6 +631,52 @@
     return [CDTQQueryValidator validatePredicateValue:textClause[operator] forOperator:operator];
 }
 
+/**
+ * Validates the operand of a $geoWithin, which searches the geo index for the points in a box,
+ * { "$box" : [ [ minLat, minLon ], [ maxLat, maxLon ] ] }, or within a distance of a point,
+ * { "$center" : [ [ lat, lon ], radiusInMetres ] }.  A box can't cross the antimeridian.
+ *
+ * @param clause The operand to validate
+ * @return YES/NO whether the operand is valid
+ */
++ (BOOL)validateGeoWithinClause:(NSObject *)clause
+{
+    NSDictionary *geoClause = [clause isKindOfClass:[NSDictionary class]] ? (NSDictionary *)clause
+                                                                          : nil;
+    NSString *operator = geoClause.count == 1 ? geoClause.allKeys[0] : nil;
+    NSArray *operand = nil;
+    if (operator && [geoClause[operator] isKindOfClass:[NSArray class]]) {
+        operand = geoClause[operator];
+    }
+
+    if ([operator isEqualToString:BOX] && operand.count == 2 &&
+        [CDTQQueryValidator isGeoPoint:operand[0]] && [CDTQQueryValidator isGeoPoint:operand[1]]) {
+        NSArray *min = operand[0], *max = operand[1];
+        if ([min[0] doubleValue] <= [max[0] doubleValue] &&
+            [min[1] doubleValue] <= [max[1] doubleValue]) {
+            return YES;
+        }
+    } else if ([operator isEqualToString:CENTER] && operand.count == 2 &&
+               [CDTQQueryValidator isGeoPoint:operand[0]] &&
+               [operand[1] isKindOfClass:[NSNumber class]] && [operand[1] doubleValue] >= 0) {
+        return YES;
+    }
+
+    os_log_error(CDTOSLog, "$geoWithin expects { \"$box\" : [ [ minLat, minLon ], [ maxLat, maxLon ] ] } or { \"$center\" : [ [ lat, lon ], radiusInMetres ] }, found %{public}@", clause);
+    return NO;
+}
+
+/** Whether a value is [ latitude, longitude ], in degrees. */
++ (BOOL)isGeoPoint:(NSObject *)value
+{
+    if (![value isKindOfClass:[NSArray class]] || ((NSArray *)value).count != 2) {
+        return NO;
+    }
+    NSNumber *lat = ((NSArray *)value)[0], *lon = ((NSArray *)value)[1];
+    return [lat isKindOfClass:[NSNumber class]] && [lon isKindOfClass:[NSNumber class]] &&
+           fabs(lat.doubleValue) <= 90 && fabs(lon.doubleValue) <= 180;
+}
+
 + (BOOL)validateListValues:(NSArray *)listValues
 {
     BOOL valid = YES;
@@ -20,33 +20,69 @@ NS_ASSUME_NONNULL_BEGIN
 @class CDTQResultSetBuilder;
 @class CDTDocumentRevision;
 @class CDTQUnindexedMatcher;
+@class CDTQueryHandle;
 
 typedef void (^CDTQResultSetBuilderBlock)(CDTQResultSetBuilder *configuration);
 
+/**
+ Marks the position of the last result of a page of query results, so the next page can be
+ fetched by seeking directly to the results after it in the index (keyset pagination).
+
+ Fetching a page this way costs the same however far into the results it is, unlike using
+ `skip`, which has to step over every earlier result.
+ */
+@interface CDTQQueryCursor : NSObject
+
+/** The sort document of the query the cursor was created by. */
+@property (nullable, nonatomic, strong, readonly) NSArray *sortDocument;
+/** The values of the sort fields, in sort document order, for the last result. */
+@property (nonatomic, strong, readonly) NSArray *sortValues;
+/** The document ID of the last result, which breaks ties between equal sort values. */
+@property (nonatomic, strong, readonly) NSString *docId;
+
+- (instancetype)initWithSortDocument:(nullable NSArray *)sortDocument
+                          sortValues:(NSArray *)sortValues
+                               docId:(NSString *)docId;
+
+@end
+
 /**
  A simple object to aid construction of a CDTQResultSet.
  */
 @interface CDTQResultSetBuilder : NSObject
 
 @property (nullable, nonatomic, strong) NSArray *docIds;
+/**
+ The results themselves, for a query answered without loading documents. When set, `docIds`
+ must be their IDs, and fields, skip, limit and matcher aren't applied.
+ */
+@property (nullable, nonatomic, strong) NSArray<CDTDocumentRevision *> *revisions;
 @property (nullable, nonatomic, strong) CDTDatastore *datastore;
 @property (nullable, nonatomic, strong) NSArray *fields;
 @property (nonatomic) NSUInteger skip;
 @property (nonatomic) NSUInteger limit;
 @property (nullable, nonatomic, strong) CDTQUnindexedMatcher *matcher;
+@property (nullable, nonatomic, strong) CDTQQueryCursor *nextPageCursor;
+/** When set, loading and matching the documents stops once the handle is cancelled. */
+@property (nullable, nonatomic, strong) CDTQueryHandle *handle;
 
 @end
 
 /**
  Enumerator over documents resulting from query.
 
- Use -enumerateObjectsUsingBlock: to iterate results:
+ Use -enumerateObjectsUsingBlock: to iterate results, or -enumerateDocumentIdsUsingBlock: when
+ only the IDs are needed:
  
  [result enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger idx, BOOL *stop) {
     // rev: the result revision.
     // idx: the index of this result.
     // stop: set to YES to stop the iteration.
  }];
+
+ Documents are loaded and matched in batches, sized by how large the documents are, and the next
+ batch is loaded in the background while the block is given the results of the current one. The
+ block itself is always called on the enumerating thread.
  */
 @interface CDTQResultSet : NSObject {
     CDTDatastore *_datastore;
@@ -62,6 +98,49 @@ typedef void (^CDTQResultSetBuilderBlock)(CDTQResultSetBuilder *configuration);
 
 @property (nonatomic, strong, readonly) NSArray<NSString *> *documentIds;
 
+/**
+ Enumerates the IDs of the results, in order, without building an array of them.
+
+ When the indexes cover the query no documents are loaded at all. Otherwise they're loaded and
+ matched a batch at a time, and let go of before the next batch, so even a large result set is
+ enumerated in about constant memory. Fields aren't projected, and -handle is honoured as
+ for -enumerateObjectsUsingBlock:.
+ */
+- (void)enumerateDocumentIdsUsingBlock:(void (^)(NSString *docId, NSUInteger idx,
+                                                 BOOL *stop))block;
+
+/**
+ As -enumerateDocumentIdsUsingBlock:, but gives the IDs to the block in chunks of up to
+ `chunkSize`, which suits bulk operations such as deleting every matching document. A chunk
+ size of 0 is taken as 50.
+ */
+- (void)enumerateDocumentIdsInChunksOfSize:(NSUInteger)chunkSize
+                                usingBlock:(void (^)(NSArray<NSString *> *docIds,
+                                                     BOOL *stop))block;
+
+/**
+ Number of documents the indexes matched, before skip, limit and any matching of the documents
+ themselves are applied. Unlike -documentIds, this doesn't load any documents.
+ */
+@property (nonatomic, readonly) NSUInteger candidateCount;
+
+/**
+ If the query was limited and may have more results, a cursor to pass to
+ -find:limit:fields:sort:after: to get the next page. nil when there are no further results,
+ or when the query can't be paged using a cursor.
+ */
+@property (nullable, nonatomic, strong, readonly) CDTQQueryCursor *nextPageCursor;
+
+/**
+ The handle of the find which created the result set, if any. Once it's cancelled,
+ -enumerateObjectsUsingBlock: stops before loading any more documents, so -documentIds may
+ be incomplete.
+ */
+@property (nullable, nonatomic, strong, readonly) CDTQueryHandle *handle;
+
+/** Internal: the same results, enumerated under another handle, or none. */
+- (CDTQResultSet *)resultSetWithHandle:(nullable CDTQueryHandle *)handle;
+
 @end
 
 NS_ASSUME_NONNULL_END
\ No newline at end of file
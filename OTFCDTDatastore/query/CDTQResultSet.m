@@ -16,14 +16,63 @@
 #import "CDTLogging.h"
 #import "CDTQProjectedDocumentRevision.h"
 #import "CDTQUnindexedMatcher.h"
+#import "CDTQueryHandle.h"
+#import "CDTQueueTelemetry.h"
+#import "CDTDocumentRevision+Internal.h"
+#import "CDTDatastore+Internal.h"
+#import "TDJSON.h"
+#import "TD_Database.h"
 
 #import <CloudantSync.h>
 
+// Candidates loaded a batch at a time: the first batch holds this many, and later ones around
+// kCDTQResultSetBatchBytes of documents, within the min and max.
+static const NSUInteger kCDTQResultSetInitialBatchSize = 50;
+static const NSUInteger kCDTQResultSetMinBatchSize = 10;
+static const NSUInteger kCDTQResultSetMaxBatchSize = 500;
+static const NSUInteger kCDTQResultSetBatchBytes = 256 * 1024;
+
 @interface CDTQResultSet ()
 @property (nonatomic, strong, readwrite) NSArray *fields;
 @property (nonatomic) NSUInteger skip;
 @property (nonatomic) NSUInteger limit;
 @property (nonatomic, strong) CDTQUnindexedMatcher *matcher;
+@property (nonatomic, strong, readwrite) CDTQQueryCursor *nextPageCursor;
+@property (nonatomic, strong) NSArray<CDTDocumentRevision *> *revisions;
+@property (nonatomic, strong, readwrite) CDTQueryHandle *handle;
+@end
+
+// The documents of a batch of candidates, starting with the first, and which of them the matcher
+// matched; nil if there's no matcher.
+@interface CDTQResultSetBatch : NSObject
+@property (nonatomic, strong) NSArray<CDTDocumentRevision *> *docs;
+@property (nonatomic, strong) NSIndexSet *matching;
+@end
+
+@implementation CDTQResultSetBatch
+@end
+
+@implementation CDTQQueryCursor
+
+- (instancetype)initWithSortDocument:(NSArray *)sortDocument
+                          sortValues:(NSArray *)sortValues
+                               docId:(NSString *)docId
+{
+    self = [super init];
+    if (self) {
+        _sortDocument = [sortDocument copy];
+        _sortValues = [sortValues copy];
+        _docId = [docId copy];
+    }
+    return self;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<CDTQQueryCursor docId: %@ sortValues: %@>", self.docId,
+                                      self.sortValues];
+}
+
 @end
 
 @implementation CDTQResultSetBuilder
@@ -42,15 +91,22 @@
     self = [super init];
     if (self) {
         _originalDocumentIds = builder.docIds;
+        _revisions = builder.revisions;
         _datastore = builder.datastore;
         _fields = builder.fields;
         _skip = builder.skip;
         _limit = builder.limit;
         _matcher = builder.matcher;
+        _nextPageCursor = builder.nextPageCursor;
+        _handle = builder.handle;
+        // Keeps the datastore's manager from closing it while results might still be read
+        [_datastore resultSetCreated];
     }
     return self;
 }
 
+- (void)dealloc { [_datastore resultSetReleased]; }
+
 + (instancetype)resultSetWithBlock:(CDTQResultSetBuilderBlock)block
 {
     NSParameterAssert(block);
@@ -60,20 +116,124 @@
     return [builder build];
 }
 
+- (CDTQResultSet *)resultSetWithHandle:(CDTQueryHandle *)handle
+{
+    return [CDTQResultSet resultSetWithBlock:^(CDTQResultSetBuilder *b) {
+        b.docIds = self->_originalDocumentIds;
+        b.revisions = self.revisions;
+        b.datastore = self->_datastore;
+        b.fields = self.fields;
+        b.skip = self.skip;
+        b.limit = self.limit;
+        b.matcher = self.matcher;
+        b.nextPageCursor = self.nextPageCursor;
+        b.handle = handle;
+    }];
+}
+
+- (NSUInteger)candidateCount { return _originalDocumentIds.count; }
+
 - (NSArray /* NSString */ *)documentIds
 {
-    // This is implemented using -enumerateObjectsUsingBlock so that when we're using
+    // Without post hoc matching the indexes have decided the results, so the documents
+    // needn't be loaded just for their IDs.
+    if (!self.revisions && !self.matcher) {
+        NSArray *documentIds = _originalDocumentIds ?: @[];
+        NSUInteger start = MIN(self.skip, documentIds.count);
+        NSUInteger length = documentIds.count - start;
+        if (self.limit > 0) length = MIN(length, self.limit);
+        return [documentIds subarrayWithRange:NSMakeRange(start, length)];
+    }
+
+    // This is implemented using -enumerateDocumentIdsUsingBlock so that when we're using
     // skip, limit or post hoc matching the documentIds array is output correctly.
     NSMutableArray *accumulator = [NSMutableArray array];
-    [self enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger idx, BOOL *stop) {
-        [accumulator addObject:rev.docId];
+    [self enumerateDocumentIdsUsingBlock:^(NSString *docId, NSUInteger idx, BOOL *stop) {
+        [accumulator addObject:docId];
     }];
     return [NSArray arrayWithArray:accumulator];
 }
 
+- (void)enumerateDocumentIdsUsingBlock:(void (^)(NSString *docId, NSUInteger idx,
+                                                 BOOL *stop))block
+{
+    if (self.revisions) {
+        [self.revisions
+            enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger idx, BOOL *stop) {
+                block(rev.docId, idx, stop);
+            }];
+        return;
+    }
+
+    if (self.matcher) {
+        [self enumerateRevisionsProjecting:NO
+                                usingBlock:^(CDTDocumentRevision *rev, NSUInteger idx,
+                                             BOOL *stop) {
+                                    block(rev.docId, idx, stop);
+                                }];
+        return;
+    }
+
+    // The indexes have decided the results, so the IDs are all that's needed.
+    NSUInteger count = _originalDocumentIds.count;
+    NSUInteger start = MIN(self.skip, count);
+    NSUInteger end = count;
+    if (self.limit > 0 && self.limit < count - start) end = start + self.limit;
+    CDTQueryHandle *handle = self.handle;
+
+    BOOL stop = NO;
+    for (NSUInteger i = start; i < end && !stop; i++) {
+        if (handle.isCancelled) {
+            os_log_debug(CDTOSLog, "Query cancelled after %lu of %lu document IDs",
+                         (unsigned long)(i - start), (unsigned long)(end - start));
+            break;
+        }
+        block(_originalDocumentIds[i], i - start, &stop);
+    }
+}
+
+- (void)enumerateDocumentIdsInChunksOfSize:(NSUInteger)chunkSize
+                                usingBlock:(void (^)(NSArray<NSString *> *docIds,
+                                                     BOOL *stop))block
+{
+    if (chunkSize == 0) chunkSize = 50;
+
+    __block NSMutableArray *chunk = [NSMutableArray arrayWithCapacity:chunkSize];
+    __block BOOL stopped = NO;
+    [self enumerateDocumentIdsUsingBlock:^(NSString *docId, NSUInteger idx, BOOL *stop) {
+        [chunk addObject:docId];
+        if (chunk.count == chunkSize) {
+            block(chunk, &stopped);
+            chunk = [NSMutableArray arrayWithCapacity:chunkSize];
+            *stop = stopped;
+        }
+    }];
+    if (!stopped && chunk.count > 0) {
+        block(chunk, &stopped);
+    }
+}
+
 - (void)enumerateObjectsUsingBlock:(void (^)(CDTDocumentRevision *rev, NSUInteger idx,
                                              BOOL *stop))block
 {
+    [self enumerateRevisionsProjecting:YES usingBlock:block];
+}
+
+// Loads and matches the documents a batch at a time, projecting them when asked to. While the
+// block is given one batch's results the next batch is loaded and matched in the background, on
+// one of the database's read connections, so the block seldom waits for documents.
+- (void)enumerateRevisionsProjecting:(BOOL)project
+                          usingBlock:(void (^)(CDTDocumentRevision *rev, NSUInteger idx,
+                                               BOOL *stop))block
+{
+    if (self.revisions) {
+        [self.revisions enumerateObjectsUsingBlock:block];
+        return;
+    }
+
+    // Loading the documents is as much a part of the query as finding them.
+    CDTQueueOperationScope(CDTQueueOperationQuery);
+
     NSUInteger idx = 0;
 
     NSUInteger nSkipped = 0;   // used for skip
@@ -83,58 +243,177 @@
     NSUInteger skip = self.skip;
     NSUInteger limit = self.limit;
     CDTQUnindexedMatcher *matcher = self.matcher;
-    NSArray *fields = self.fields;
+    NSArray *fields = project ? self.fields : nil;
+    CDTQueryHandle *handle = self.handle;
+    NSUInteger count = _originalDocumentIds.count;
 
-    BOOL stop = NO;  // user stopped, or we returned `limit` results
-    NSUInteger batchSize = 50;
-    NSRange range = NSMakeRange(0, batchSize);
-    while (range.location < _originalDocumentIds.count) {
-        range.length = MIN(batchSize, _originalDocumentIds.count - range.location);
-        NSArray *batch = [_originalDocumentIds subarrayWithRange:range];
+    // Without a matcher to run over whole bodies, just the projected fields are read.
+    BOOL readProjected = fields && !matcher;
 
-        NSArray *docs = [_datastore getDocumentsWithIds:batch];
+    // Reads in a snapshot have to be made on this thread to see it. Without a matcher every
+    // candidate is a result, so none are prefetched past the last one limit leaves.
+    BOOL prefetch = !_datastore.database.isInReadSnapshot;
+    NSUInteger prefetchEnd = (limit > 0 && !matcher) ? skip + limit : NSUIntegerMax;
+    dispatch_queue_t prefetchQueue = dispatch_get_global_queue(QOS_CLASS_UTILITY, 0);
+    dispatch_group_t prefetching = dispatch_group_create();
+    __block CDTQResultSetBatch *prefetched = nil;
+    BOOL rangeIsPrefetched = NO;
 
-        for (CDTDocumentRevision *rev in docs) {
-            CDTDocumentRevision *innerRev = rev;  // allows us to replace later if projecting
+    BOOL stop = NO;  // user stopped, or we returned `limit` results
+    NSUInteger batchSize = kCDTQResultSetInitialBatchSize;
+    NSRange range = NSMakeRange(0, MIN(batchSize, count));
+    while (range.location < count) {
+        if (handle.isCancelled) {
+            os_log_debug(CDTOSLog, "Query cancelled after %lu of %lu candidate documents",
+                         (unsigned long)range.location, (unsigned long)count);
+            break;
+        }
 
-            // Apply post-hoc matcher
-            if (matcher && ![matcher matches:innerRev]) {
-                continue;
+        // Each batch's documents go once the batch is done, rather than when the caller's pool
+        // drains, so enumerating a large result set doesn't hold them all.
+        @autoreleasepool {
+            CDTQResultSetBatch *batch = nil;
+            if (rangeIsPrefetched) {
+                dispatch_group_wait(prefetching, DISPATCH_TIME_FOREVER);
+                batch = prefetched;
+                prefetched = nil;
             }
-
-            // Apply skip (skip == 0 means disable)
-            if (skip > 0 && nSkipped < skip) {
-                nSkipped++;
-                continue;
+            if (!batch) {
+                // Not prefetched, or the prefetch saw the handle cancelled
+                if (handle.isCancelled) break;
+                batch = [self loadBatchInRange:range readProjected:readProjected fields:fields];
             }
 
-            // Apply projection if result matches
-            if (fields) {
-                innerRev =
-                    [CDTQResultSet projectFields:self.fields fromRevision:rev datastore:_datastore];
+            batchSize = [CDTQResultSet batchSizeForBatch:batch];
+            NSUInteger nextLocation = NSMaxRange(range);
+            NSRange nextRange = NSMakeRange(nextLocation, MIN(batchSize, count - nextLocation));
+            rangeIsPrefetched = prefetch && nextRange.length > 0 && nextLocation < prefetchEnd;
+            if (rangeIsPrefetched) {
+                dispatch_group_async(prefetching, prefetchQueue, ^{
+                    CDTQueueOperationScope(CDTQueueOperationQuery);
+                    if (handle.isCancelled) return;
+                    prefetched = [self loadBatchInRange:nextRange
+                                          readProjected:readProjected
+                                                 fields:fields];
+                });
             }
+            range = nextRange;
 
-            // Run callback
-            block(innerRev, idx, &stop);
-            if (stop) {
-                break;
-            }
-            idx++;
+            NSArray *docs = batch.docs;
+            NSIndexSet *matching = batch.matching;
+            for (NSUInteger i = 0; i < docs.count; i++) {
+                CDTDocumentRevision *rev = docs[i];
+                CDTDocumentRevision *innerRev = rev;  // allows us to replace later if projecting
+
+                if (matching && ![matching containsIndex:i]) {
+                    continue;
+                }
+
+                // The matcher's already run over the batch, but projection and the callback can
+                // still be stopped for a handle cancelled meanwhile.
+                if (handle.isCancelled) {
+                    stop = YES;
+                    break;
+                }
+
+                // Apply skip (skip == 0 means disable)
+                if (skip > 0 && nSkipped < skip) {
+                    nSkipped++;
+                    continue;
+                }
 
-            // Apply limit (limit == 0 means disable)
-            nReturned++;
-            if (limit > 0 && nReturned >= limit) {
-                stop = YES;
-                break;
+                // Apply projection if result matches
+                if (readProjected) {
+                    innerRev = [CDTQResultSet fillMissingFields:fields
+                                                ofProjectedRevision:rev
+                                                          datastore:_datastore];
+                } else if (fields) {
+                    innerRev =
+                        [CDTQResultSet projectFields:fields fromRevision:rev datastore:_datastore];
+                }
+
+                // Run callback
+                block(innerRev, idx, &stop);
+                if (stop) {
+                    break;
+                }
+                idx++;
+
+                // Apply limit (limit == 0 means disable)
+                nReturned++;
+                if (limit > 0 && nReturned >= limit) {
+                    stop = YES;
+                    break;
+                }
             }
         }
 
         if (stop) {
             break;
         }
+    }
+
+    // A batch prefetched that won't be enumerated is still finished with before returning, so
+    // no reads of the result set outlive its enumeration.
+    dispatch_group_wait(prefetching, DISPATCH_TIME_FOREVER);
+}
+
+// Loads the candidates in range, and runs the post-hoc matcher over the whole batch at once.
+- (CDTQResultSetBatch *)loadBatchInRange:(NSRange)range
+                           readProjected:(BOOL)readProjected
+                                  fields:(NSArray *)fields
+{
+    CDTQResultSetBatch *batch = [[CDTQResultSetBatch alloc] init];
+    NSArray *docIds = [_originalDocumentIds subarrayWithRange:range];
+    batch.docs = readProjected ? [_datastore getDocumentsWithIds:docIds fields:fields]
+                               : [_datastore getDocumentsWithIds:docIds];
+    batch.matching = self.matcher ? [self.matcher indexesOfMatchingRevisions:batch.docs] : nil;
+    return batch;
+}
+
+// Sizes the next batch so it holds about kCDTQResultSetBatchBytes of documents, going by those
+// of the batch just loaded: large documents are loaded a few at a time, so the block isn't kept
+// waiting for the first of them, and small ones many at a time, to save on queries.
++ (NSUInteger)batchSizeForBatch:(CDTQResultSetBatch *)batch
+{
+    UInt64 bytes = 0;
+    NSUInteger measured = 0;
+    for (CDTDocumentRevision *rev in batch.docs) {
+        NSData *json = rev.unparsedBodyJSON;
+        if (json) {
+            bytes += json.length;
+            measured++;
+        }
+    }
+    // Projected or already parsed documents can't be measured
+    if (measured == 0 || bytes == 0) {
+        return kCDTQResultSetInitialBatchSize;
+    }
+    UInt64 size = (UInt64)kCDTQResultSetBatchBytes * measured / bytes;
+    return (NSUInteger)MAX(kCDTQResultSetMinBatchSize, MIN(size, kCDTQResultSetMaxBatchSize));
+}
 
-        range.location += range.length;
+// Fields missing from a document are NSNull in its projection, as -projectFields:... makes them.
++ (CDTDocumentRevision *)fillMissingFields:(NSArray *)fields
+                       ofProjectedRevision:(CDTDocumentRevision *)rev
+                                 datastore:(CDTDatastore *)datastore
+{
+    NSDictionary *body = rev.body;
+    if (body.count == fields.count) {
+        return rev;
+    }
+    NSMutableDictionary *projected = [NSMutableDictionary dictionaryWithCapacity:fields.count];
+    for (NSString *field in fields) {
+        id value = [field hasPrefix:@"_"] ? nil : body[field];
+        projected[field] = value ?: [NSNull null];
     }
+    return [[CDTQProjectedDocumentRevision alloc] initWithDocId:rev.docId
+                                                     revisionId:rev.revId
+                                                           body:projected
+                                                        deleted:rev.deleted
+                                                    attachments:rev.attachments
+                                                       sequence:rev.sequence
+                                                      datastore:datastore];
 }
 
 + (CDTDocumentRevision *)projectFields:(NSArray *)fields
@@ -142,7 +421,24 @@
                              datastore:(CDTDatastore *)datastore
 {
     // grab the dictionary filter fields and rebuild object
-    NSDictionary *body = [rev.body dictionaryWithValuesForKeys:fields];
+    NSDictionary *body = nil;
+    NSData *json = rev.unparsedBodyJSON;
+    if (json) {
+        // Only parse the projected fields out of the JSON rather than the whole body.
+        NSDictionary *values = [TDJSON dictionaryWithValuesForKeys:fields fromJSONDictionaryData:json];
+        if (values) {
+            NSMutableDictionary *projected = [NSMutableDictionary dictionaryWithCapacity:fields.count];
+            for (NSString *field in fields) {
+                // Match -dictionaryWithValuesForKeys:, which the full body path uses.
+                id value = [field hasPrefix:@"_"] ? nil : values[field];
+                projected[field] = value ?: [NSNull null];
+            }
+            body = projected;
+        }
+    }
+    if (!body) {
+        body = [rev.body dictionaryWithValuesForKeys:fields];
+    }
     return [[CDTQProjectedDocumentRevision alloc] initWithDocId:rev.docId
                                                      revisionId:rev.revId
                                                            body:body
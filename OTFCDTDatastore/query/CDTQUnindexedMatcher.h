@@ -36,7 +36,9 @@ NS_ASSUME_NONNULL_BEGIN
  matches that selector.
 
  The matcher works by first creating a simple tree, which is then
- executed against each document it's asked to match.
+ compiled into a tree of blocks with field paths split and comparison
+ functions chosen up front. Only the blocks are run against each
+ document it's asked to match.
 
 
  Some examples:
@@ -99,6 +101,13 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (BOOL)matches:(CDTDocumentRevision *)rev;
 
+/**
+ Returns the indexes of the revisions in `revisions` which match this matcher's selector.
+
+ Larger batches are matched concurrently, so the revisions mustn't be mutated while this runs.
+ */
+- (NSIndexSet *)indexesOfMatchingRevisions:(NSArray<CDTDocumentRevision *> *)revisions;
+
 @end
 
 NS_ASSUME_NONNULL_END
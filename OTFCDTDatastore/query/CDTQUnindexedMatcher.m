@@ -27,9 +27,32 @@
 
 @end
 
+/** Returns YES if `rev` satisfies a compiled part of the selector. */
+typedef BOOL (^CDTQMatchBlock)(CDTDocumentRevision *rev);
+
+/** Returns YES if a value from a document satisfies a compiled operator. */
+typedef BOOL (^CDTQValueMatchBlock)(NSObject *actual);
+
+/** Compares one value from a document with one value from the selector. */
+typedef BOOL (*CDTQComparator)(NSObject *actual, NSObject *expected);
+
+/** Batches smaller than this are matched on the calling thread. */
+static const NSUInteger kCDTQParallelMatchThreshold = 16;
+
+static BOOL CDTQCompareEq(NSObject *l, NSObject *r);
+static BOOL CDTQCompareLt(NSObject *l, NSObject *r);
+static BOOL CDTQCompareLte(NSObject *l, NSObject *r);
+static BOOL CDTQCompareGt(NSObject *l, NSObject *r);
+static BOOL CDTQCompareGte(NSObject *l, NSObject *r);
+static BOOL CDTQCompareMod(NSObject *l, NSObject *r);
+static BOOL CDTQCompareSize(NSObject *l, NSObject *r);
+static BOOL CDTQCompareExists(NSObject *l, NSObject *r);
+
 @interface CDTQUnindexedMatcher ()
 
 @property (nonatomic, strong) CDTQChildrenQueryNode *root;
+/** `root` compiled into blocks, so matching doesn't re-interpret the selector per document. */
+@property (nonatomic, copy) CDTQMatchBlock matchBlock;
 
 @end
 
@@ -47,6 +70,7 @@
 
     CDTQUnindexedMatcher *matcher = [[CDTQUnindexedMatcher alloc] init];
     matcher.root = root;
+    matcher.matchBlock = [CDTQUnindexedMatcher compileSelectorTree:root];
     return matcher;
 }
 
@@ -120,155 +144,264 @@
     return root;
 }
 
-#pragma mark Matching documents
+#pragma mark Compiling the tree
 
-- (BOOL)matches:(CDTDocumentRevision *)rev
++ (CDTQMatchBlock)compileSelectorTree:(CDTQQueryNode *)node
 {
-    return [self executeSelectorTree:self.root onRevision:rev];
-}
+    if ([node isKindOfClass:[CDTQAndQueryNode class]] ||
+        [node isKindOfClass:[CDTQOrQueryNode class]]) {
+        BOOL isAnd = [node isKindOfClass:[CDTQAndQueryNode class]];
+
+        NSMutableArray *compiled = [NSMutableArray array];
+        for (CDTQQueryNode *child in ((CDTQChildrenQueryNode *)node).children) {
+            [compiled addObject:[CDTQUnindexedMatcher compileSelectorTree:child]];
+        }
+        NSArray *children = [NSArray arrayWithArray:compiled];
+
+        // An empty AND matches everything and an empty OR nothing.
+        if (isAnd) {
+            return ^BOOL(CDTDocumentRevision *rev) {
+                for (CDTQMatchBlock child in children) {
+                    if (!child(rev)) {
+                        return NO;
+                    }
+                }
+                return YES;
+            };
+        } else {
+            return ^BOOL(CDTDocumentRevision *rev) {
+                for (CDTQMatchBlock child in children) {
+                    if (child(rev)) {
+                        return YES;
+                    }
+                }
+                return NO;
+            };
+        }
 
-#pragma mark Tree walking
+    } else if ([node isKindOfClass:[CDTQOperatorExpressionNode class]]) {
+        return [CDTQUnindexedMatcher
+            compileExpression:((CDTQOperatorExpressionNode *)node).expression];
 
-- (BOOL)executeSelectorTree:(CDTQQueryNode *)node onRevision:(CDTDocumentRevision *)rev
-{
-    if ([node isKindOfClass:[CDTQAndQueryNode class]]) {
-        BOOL passed = YES;
+    } else {
+        // We constructed the tree, so shouldn't end up here; error if we do.
+        os_log_error(CDTOSLog, "Found unexpected selector execution tree: %{public}@", node);
+        return ^BOOL(CDTDocumentRevision *rev) {
+            return NO;
+        };
+    }
+}
 
-        CDTQAndQueryNode *andNode = (CDTQAndQueryNode *)node;
++ (CDTQMatchBlock)compileExpression:(NSDictionary *)expression
+{
+    // Here we could have:
+    //   { fieldName: { operator: value } }
+    // or
+    //   { fieldName: { $not: { operator: value } } }
 
-//        if ([andNode.children count] == 0) {
-//            // well this isn't right, something has gone wrong
-//            return NO;
-//        }
+    NSString *fieldName = expression.allKeys[0];
+    NSDictionary *operatorExpression = expression[fieldName];
 
-        for (CDTQQueryNode *child in andNode.children) {
-            passed = passed && [self executeSelectorTree:child onRevision:rev];
-        }
+    NSString *operator= operatorExpression.allKeys[0];
 
-        return passed;
+    // First work out whether we need to invert the result when done
+    BOOL invertResult = [operator isEqualToString:NOT];
+    if (invertResult) {
+        operatorExpression = operatorExpression[NOT];
+        operator = operatorExpression.allKeys[0];
     }
-    if ([node isKindOfClass:[CDTQOrQueryNode class]]) {
-        BOOL passed = NO;
 
-        CDTQOrQueryNode *orNode = (CDTQOrQueryNode *)node;
-        for (CDTQQueryNode *child in orNode.children) {
-            passed = passed || [self executeSelectorTree:child onRevision:rev];
+    NSObject *expected = operatorExpression[operator];
+
+    // _id and _rev are special fields which come from attributes
+    // of the revision and not its body, otherwise split the path once here.
+    BOOL isDocId = [fieldName isEqualToString:@"_id"];
+    BOOL isRevId = [fieldName isEqualToString:@"_rev"];
+    NSArray *fieldPath = [fieldName componentsSeparatedByString:@"."];
+
+    CDTQValueMatchBlock match = [CDTQUnindexedMatcher compileOperator:operator
+                                                             expected:expected
+                                                         invertResult:invertResult];
+
+    return ^BOOL(CDTDocumentRevision *rev) {
+        if (isDocId) {
+            return match(rev.docId);
+        } else if (isRevId) {
+            return match(rev.revId);
         }
+        return match([CDTQValueExtractor extractValueForFieldPath:fieldPath fromRevision:rev]);
+    };
+}
 
-        return passed;
++ (CDTQValueMatchBlock)compileOperator:(NSString *)operator
+                              expected:(NSObject *)expected
+                          invertResult:(BOOL)invertResult
+{
+    if ([operator isEqualToString:MOD] || [operator isEqualToString:SIZE]) {
+        // If an operator like $mod or $size is found we need to treat the
+        // comparison as a special case.
+        //
+        // $mod: perform modulo arithmetic on the actual value using the first
+        //       element in the expected array as the divisor before comparing
+        //       the result to the second element in the expected array.
+        //
+        // $size: check whether the actual value is an array, then compare the
+        //        actual array size with the expected value.
+        CDTQComparator compare =
+            [operator isEqualToString:MOD] ? CDTQCompareMod : CDTQCompareSize;
+        return ^BOOL(NSObject *actual) {
+            BOOL passed = compare(actual, expected);
+            return invertResult ? !passed : passed;
+        };
+    }
 
-    } else if ([node isKindOfClass:[CDTQOperatorExpressionNode class]]) {
-        NSDictionary *expression = ((CDTQOperatorExpressionNode *)node).expression;
+    if ([operator isEqualToString:ELEM_MATCH]) {
+        return [CDTQUnindexedMatcher compileElemMatch:(NSDictionary *)expected
+                                         invertResult:invertResult];
+    }
 
-        // Here we could have:
-        //   { fieldName: { operator: value } }
-        // or
-        //   { fieldName: { $not: { operator: value } } }
+    // Since $in is the same as a series of $eq comparisons -
+    // Treat them the same by:
+    // - Ensuring that both expected and actual are NSArrays.
+    // - Convert the $in operator to the $eq operator.
+    NSArray *expectedItems =
+        [expected isKindOfClass:[NSArray class]] ? (NSArray *)expected : @[ expected ];
 
-        // Next evaluate the result
-        NSString *fieldName = expression.allKeys[0];
-        NSDictionary *operatorExpression = expression[fieldName];
+    // $all is a series of $eq comparisons too, but every one of them has to pass.
+    BOOL requireAll = [operator isEqualToString:ALL];
 
-        NSString *operator= operatorExpression.allKeys[0];
+    CDTQComparator compare = NULL;
+    if ([operator isEqualToString:EQ] || [operator isEqualToString:IN] || requireAll) {
+        compare = CDTQCompareEq;
+    } else if ([operator isEqualToString:LT]) {
+        compare = CDTQCompareLt;
+    } else if ([operator isEqualToString:LTE]) {
+        compare = CDTQCompareLte;
+    } else if ([operator isEqualToString:GT]) {
+        compare = CDTQCompareGt;
+    } else if ([operator isEqualToString:GTE]) {
+        compare = CDTQCompareGte;
+    } else if ([operator isEqualToString:EXISTS]) {
+        compare = CDTQCompareExists;
+    } else {
+        os_log_debug(CDTOSLog, "Found unexpected operator in selector: %{public}@", operator);
+        return ^BOOL(NSObject *actual) {
+            return invertResult;  // didn't understand
+        };
+    }
 
-        // First work out whether we need to invert the result when done
-        BOOL invertResult = [operator isEqualToString:NOT];
-        if (invertResult) {
-            operatorExpression = operatorExpression[NOT];
-            operator = operatorExpression.allKeys[0];
+    return ^BOOL(NSObject *actual) {
+        NSArray *actualItems = nil;
+        if ([actual isKindOfClass:[NSArray class]]) {
+            actualItems = (NSArray *)actual;
+        } else {
+            actualItems = actual ? @[ actual ] : @[ [NSNull null] ];
         }
 
-        NSObject *expected = operatorExpression[operator];
-        NSObject *actual = [CDTQValueExtractor extractValueForFieldName:fieldName fromRevision:rev];
-        
-        BOOL passed = NO;
-        NSArray *specialCaseOperators = @[ MOD, SIZE ];
-        if ([specialCaseOperators containsObject:operator]) {
-            // If an operator like $mod or $size is found we need to treat the
-            // comparison as a special case.
-            //
-            // $mod: perform modulo arithmetic on the actual value using the first
-            //       element in the expected array as the divisor before comparing
-            //       the result to the second element in the expected array.
-            //
-            // $size: check whether the actual value is an array, then compare the
-            //        actual array size with the expected value.
-            passed = [self actualValue:actual matchesOperator:operator andExpectedValue:expected];
-        } else {
-            // Since $in is the same as a series of $eq comparisons -
-            // Treat them the same by:
-            // - Ensuring that both expected and actual are NSArrays.
-            // - Convert the $in operator to the $eq operator.
-            if (![expected isKindOfClass:[NSArray class]]) {
-                expected = @[ expected ];
-            }
-            if (![actual isKindOfClass:[NSArray class]]) {
-                actual = actual ? @[ actual ] : @[ [NSNull null] ];
-            }
-            if ([operator isEqualToString:IN]) {
-                operator = EQ;
-            }
-            
-            for (NSObject *expectedItem in (NSArray *)expected) {
-                for (NSObject *actualItem in (NSArray *)actual) {
-                    // OR since any actual item can match any value in the expected NSArray
-                    passed = passed || [self actualValue:actualItem
-                                         matchesOperator:operator
-                                        andExpectedValue:expectedItem];
+        // Any actual item can match any value in the expected NSArray, or for $all
+        // every expected value has to match some actual item.
+        BOOL passed = requireAll;
+        for (NSObject *expectedItem in expectedItems) {
+            BOOL found = NO;
+            for (NSObject *actualItem in actualItems) {
+                if (compare(actualItem, expectedItem)) {
+                    found = YES;
+                    break;
                 }
             }
+            if (found != requireAll) {
+                passed = found;
+                break;
+            }
         }
         return invertResult ? !passed : passed;
-    } else {
-        // We constructed the tree, so shouldn't end up here; error if we do.
-        os_log_error(CDTOSLog, "Found unexpected selector execution tree: %{public}@", node);
-        return NO;
-    }
+    };
 }
 
-- (BOOL)actualValue:(NSObject *)actual
-     matchesOperator:(NSString *) operator
-    andExpectedValue:(NSObject *)expected
+/**
+ An $elemMatch passes if a single element of the array satisfies all of its normalised clauses,
+ where the clause on the empty field name is on the element itself.
+ */
++ (CDTQValueMatchBlock)compileElemMatch:(NSDictionary *)elemMatch invertResult:(BOOL)invertResult
 {
-    BOOL passed = NO;
-
-    if ([operator isEqualToString:EQ]) {
-        passed = [self eqL:actual R:expected];
-
-    } else if ([operator isEqualToString:LT]) {
-        passed = [self ltL:actual R:expected];
+    NSMutableArray *paths = [NSMutableArray array];
+    NSMutableArray *matches = [NSMutableArray array];
+    for (NSDictionary *clause in elemMatch[AND]) {
+        NSString *fieldName = clause.allKeys[0];
+        NSDictionary *operatorExpression = clause[fieldName];
+        NSString *operator = operatorExpression.allKeys[0];
+        [paths addObject:fieldName.length > 0 ? [fieldName componentsSeparatedByString:@"."]
+                                              : @[]];
+        [matches addObject:[CDTQUnindexedMatcher compileOperator:operator
+                                                        expected:operatorExpression[operator]
+                                                    invertResult:NO]];
+    }
 
-    } else if ([operator isEqualToString:LTE]) {
-        passed = [self lteL:actual R:expected];
+    return ^BOOL(NSObject *actual) {
+        BOOL passed = NO;
+        if ([actual isKindOfClass:[NSArray class]]) {
+            for (NSObject *element in (NSArray *)actual) {
+                passed = YES;
+                for (NSUInteger i = 0; i < paths.count && passed; i++) {
+                    NSArray *path = paths[i];
+                    NSObject *value = element;
+                    if (path.count > 0) {
+                        value = nil;
+                        if ([element isKindOfClass:[NSDictionary class]]) {
+                            value = [CDTQValueExtractor extractValueForFieldPath:path
+                                                                  fromDictionary:(id)element];
+                        }
+                    }
+                    CDTQValueMatchBlock match = matches[i];
+                    passed = match(value);
+                }
+                if (passed) {
+                    break;
+                }
+            }
+        }
+        return invertResult ? !passed : passed;
+    };
+}
 
-    } else if ([operator isEqualToString:GT]) {
-        passed = [self gtL:actual R:expected];
+#pragma mark Matching documents
 
-    } else if ([operator isEqualToString:GTE]) {
-        passed = [self gteL:actual R:expected];
-
-    } else if ([operator isEqualToString:MOD]) {
-        passed = [self modL:actual R:expected];
-        
-    } else if ([operator isEqualToString:SIZE]) {
-        passed = [self sizeL:actual R:expected];
-        
-    } else if ([operator isEqualToString:EXISTS]) {
-        BOOL expectedBool = [((NSNumber *)expected)boolValue];
-        BOOL exists = (![actual isEqual:[NSNull null]]);
-        passed = (exists == expectedBool);
+- (BOOL)matches:(CDTDocumentRevision *)rev { return self.matchBlock(rev); }
 
-    } else {
-        os_log_debug(CDTOSLog, "Found unexpected operator in selector: %{public}@", operator);
-        passed = NO;  // didn't understand
+- (NSIndexSet *)indexesOfMatchingRevisions:(NSArray<CDTDocumentRevision *> *)revisions
+{
+    NSUInteger count = revisions.count;
+    CDTQMatchBlock matchBlock = self.matchBlock;
+    NSMutableIndexSet *matching = [NSMutableIndexSet indexSet];
+
+    BOOL *results = count < kCDTQParallelMatchThreshold ? NULL : calloc(count, sizeof(BOOL));
+    if (!results) {
+        for (NSUInteger i = 0; i < count; i++) {
+            if (matchBlock(revisions[i])) {
+                [matching addIndex:i];
+            }
+        }
+        return matching;
     }
 
-    return passed;
+    // Each iteration only touches its own revision and slot, so they can run concurrently.
+    dispatch_apply(count, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t i) {
+        results[i] = matchBlock(revisions[i]);
+    });
+    for (NSUInteger i = 0; i < count; i++) {
+        if (results[i]) {
+            [matching addIndex:i];
+        }
+    }
+    free(results);
+    return matching;
 }
 
-#pragma mark matchers
+@end
 
-- (BOOL)eqL:(NSObject *)l R:(NSObject *)r { return [l isEqual:r]; }
+#pragma mark Comparators
+
+static BOOL CDTQCompareEq(NSObject *l, NSObject *r) { return [l isEqual:r]; }
 
 //
 // Try to respect SQLite's ordering semantics:
@@ -276,7 +409,7 @@
 //  2. INT/REAL
 //  3. TEXT
 //  4. BLOB
-- (BOOL)ltL:(NSObject *)l R:(NSObject *)r
+static BOOL CDTQCompareLt(NSObject *l, NSObject *r)
 {
     if ([l isEqual:[NSNull null]]) {
         return NO;  // NSNull fails all lt/gt/lte/gte tests
@@ -312,7 +445,7 @@
     }
 }
 
-- (BOOL)lteL:(NSObject *)l R:(NSObject *)r
+static BOOL CDTQCompareLte(NSObject *l, NSObject *r)
 {
     if ([l isEqual:[NSNull null]]) {
         return NO;  // NSNull fails all lt/gt/lte/gte tests
@@ -323,10 +456,10 @@
         return NO;  // Not sure how to compare values that are not numbers or strings
     }
 
-    return [self ltL:l R:r] || [l isEqual:r];
+    return CDTQCompareLt(l, r) || [l isEqual:r];
 }
 
-- (BOOL)gtL:(NSObject *)l R:(NSObject *)r
+static BOOL CDTQCompareGt(NSObject *l, NSObject *r)
 {
     if ([l isEqual:[NSNull null]]) {
         return NO;  // NSNull fails all lt/gt/lte/gte tests
@@ -337,10 +470,10 @@
         return NO;  // Not sure how to compare values that are not numbers or strings
     }
 
-    return ![self lteL:l R:r];
+    return !CDTQCompareLte(l, r);
 }
 
-- (BOOL)gteL:(NSObject *)l R:(NSObject *)r
+static BOOL CDTQCompareGte(NSObject *l, NSObject *r)
 {
     if ([l isEqual:[NSNull null]]) {
         return NO;  // NSNull fails all lt/gt/lte/gte tests
@@ -351,10 +484,10 @@
         return NO;  // Not sure how to compare values that are not numbers or strings
     }
 
-    return ![self ltL:l R:r];
+    return !CDTQCompareLt(l, r);
 }
 
-- (BOOL)modL:(NSObject *)l R:(NSObject *)r
+static BOOL CDTQCompareMod(NSObject *l, NSObject *r)
 {
     if (![l isKindOfClass:[NSNumber class]]) {
         return NO;
@@ -374,7 +507,7 @@
     return actualRemainder == expectedRemainder;
 }
 
-- (BOOL)sizeL:(NSObject *)l R:(NSObject *)r
+static BOOL CDTQCompareSize(NSObject *l, NSObject *r)
 {
     // The actual value must be an array and the expected value must be a number in
     // order to perform a size comparison.
@@ -388,4 +521,9 @@
     return [actualSize isEqualToNumber:expectedSize];
 }
 
-@end
+static BOOL CDTQCompareExists(NSObject *l, NSObject *r)
+{
+    BOOL expectedBool = [((NSNumber *)r)boolValue];
+    BOOL exists = (![l isEqual:[NSNull null]]);
+    return exists == expectedBool;
+}
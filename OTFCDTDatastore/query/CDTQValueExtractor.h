@@ -14,21 +14,61 @@
 
 #import <Foundation/Foundation.h>
 
+#import "CDTQIndexManager.h"
+
 NS_ASSUME_NONNULL_BEGIN
 
 @class CDTDocumentRevision;
 
 /**
  Extracts values from dictionaries using a field name.
+
+ A field name starting with `@` names an expression registered with
+ +registerExpression:withName:, whose value is computed from the whole body rather than looked
+ up in it.
  */
 @interface CDTQValueExtractor : NSObject
 
+/** The expressions behind CDTQIndexManager +registerExpression:withName:. */
++ (BOOL)registerExpression:(CDTQExpressionBlock)expression withName:(NSString *)name;
++ (void)unregisterExpressionNamed:(NSString *)name;
+
+/** YES if `fieldName` names an expression rather than a field, whether or not it's registered. */
++ (BOOL)isExpressionFieldName:(NSString *)fieldName;
+
+/**
+ Returns NO, logging which, if any of `fieldNames` is an expression that isn't registered, so an
+ index over them can't be updated.
+ */
++ (BOOL)expressionsAreRegisteredForFieldNames:(NSArray<NSString *> *)fieldNames;
+
 + (nullable NSObject *)extractValueForFieldName:(NSString *)possiblyDottedField
                                    fromRevision:(CDTDocumentRevision *)rev;
 
 + (nullable NSObject *)extractValueForFieldName:(NSString *)fieldName
                                  fromDictionary:(NSDictionary *)body;
 
+/**
+ As above, but for a field name already split on `.`, so callers extracting the same field
+ from many documents only split it once.
+ */
++ (nullable NSObject *)extractValueForFieldPath:(NSArray<NSString *> *)fieldPath
+                                 fromDictionary:(NSDictionary *)body;
+
+/**
+ Extracts a body field from a revision. If the revision's body is still unparsed binary JSON,
+ only the field's value is decoded; otherwise this is the same as extracting the field from
+ its body. Doesn't handle `_id` and `_rev`.
+ */
++ (nullable NSObject *)extractValueForFieldPath:(NSArray<NSString *> *)fieldPath
+                                   fromRevision:(CDTDocumentRevision *)rev;
+
+/**
+ Compares values in the order SQLite sorts index columns: missing values and nulls, then
+ numbers, then strings by their bytes. Anything else, e.g., arrays, sorts last, unordered.
+ */
++ (NSComparisonResult)compareValue:(nullable NSObject *)a toValue:(nullable NSObject *)b;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -16,9 +16,79 @@
 #import "CDTLogging.h"
 
 #import <CDTDocumentRevision.h>
+#import "CDTDocumentRevision+Internal.h"
+#import "TDBinaryJSON.h"
+
+static NSDictionary<NSString *, CDTQExpressionBlock> *sExpressions;
 
 @implementation CDTQValueExtractor
 
+#pragma mark Expressions
+
++ (BOOL)registerExpression:(CDTQExpressionBlock)expression withName:(NSString *)name
+{
+    if (![CDTQValueExtractor isExpressionFieldName:name] || name.length < 2 ||
+        [name rangeOfString:@"."].location != NSNotFound || !expression) {
+        os_log_error(CDTOSLog, "Invalid expression name %{public}@: it must start with @ and not contain .", name);
+        return NO;
+    }
+    @synchronized([CDTQValueExtractor class]) {
+        NSMutableDictionary *expressions =
+            [sExpressions mutableCopy] ?: [NSMutableDictionary dictionary];
+        expressions[name] = [expression copy];
+        sExpressions = [expressions copy];
+    }
+    return YES;
+}
+
++ (void)unregisterExpressionNamed:(NSString *)name
+{
+    @synchronized([CDTQValueExtractor class]) {
+        NSMutableDictionary *expressions = [sExpressions mutableCopy];
+        [expressions removeObjectForKey:name];
+        sExpressions = [expressions copy];
+    }
+}
+
++ (CDTQExpressionBlock)expressionNamed:(NSString *)name
+{
+    // The dictionary is replaced rather than changed, so it only needs locking to read the
+    // pointer.
+    NSDictionary *expressions;
+    @synchronized([CDTQValueExtractor class]) {
+        expressions = sExpressions;
+    }
+    return expressions[name];
+}
+
++ (BOOL)isExpressionFieldName:(NSString *)fieldName
+{
+    return fieldName.length > 0 && [fieldName characterAtIndex:0] == '@';
+}
+
++ (BOOL)expressionsAreRegisteredForFieldNames:(NSArray<NSString *> *)fieldNames
+{
+    for (NSString *fieldName in fieldNames) {
+        if ([CDTQValueExtractor isExpressionFieldName:fieldName] &&
+            ![CDTQValueExtractor expressionNamed:fieldName]) {
+            os_log_error(CDTOSLog, "Expression %{public}@ isn't registered; register it with +[CDTQIndexManager registerExpression:withName:]", fieldName);
+            return NO;
+        }
+    }
+    return YES;
+}
+
++ (NSObject *)valueOfExpressionNamed:(NSString *)name forBody:(NSDictionary *)body
+{
+    CDTQExpressionBlock expression = [CDTQValueExtractor expressionNamed:name];
+    if (!expression || !body) {
+        return nil;
+    }
+    return expression(body);
+}
+
+#pragma mark Fields
+
 + (NSObject *)extractValueForFieldName:(NSString *)possiblyDottedField
                           fromRevision:(CDTDocumentRevision *)rev
 {
@@ -29,13 +99,41 @@
     } else if ([possiblyDottedField isEqualToString:@"_rev"]) {
         return rev.revId;
     } else {
-        return [CDTQValueExtractor extractValueForFieldName:possiblyDottedField
-                                             fromDictionary:rev.body];
+        NSArray *fields = [possiblyDottedField componentsSeparatedByString:@"."];
+        return [CDTQValueExtractor extractValueForFieldPath:fields fromRevision:rev];
     }
 }
 
++ (NSObject *)extractValueForFieldPath:(NSArray<NSString *> *)fields
+                          fromRevision:(CDTDocumentRevision *)rev
+{
+    if (fields.count == 1 && [CDTQValueExtractor isExpressionFieldName:fields[0]]) {
+        return [CDTQValueExtractor valueOfExpressionNamed:fields[0] forBody:rev.body];
+    }
+
+    NSData *json = rev.unparsedBodyJSON;
+    if ([TDBinaryJSON isBinaryJSON:json]) {
+        // "_"-prefixed keys are never part of a revision's body.
+        if ([fields.firstObject hasPrefix:@"_"]) {
+            return nil;
+        }
+        return [TDBinaryJSON valueAtKeyPath:fields inData:json];
+    }
+    return [CDTQValueExtractor extractValueForFieldPath:fields fromDictionary:rev.body];
+}
+
 + (NSObject *)extractValueForFieldName:(NSString *)possiblyDottedField
                         fromDictionary:(NSDictionary *)body
+{
+    if ([CDTQValueExtractor isExpressionFieldName:possiblyDottedField]) {
+        return [CDTQValueExtractor valueOfExpressionNamed:possiblyDottedField forBody:body];
+    }
+    NSArray *fields = [possiblyDottedField componentsSeparatedByString:@"."];
+    return [CDTQValueExtractor extractValueForFieldPath:fields fromDictionary:body];
+}
+
++ (NSObject *)extractValueForFieldPath:(NSArray<NSString *> *)fields
+                        fromDictionary:(NSDictionary *)body
 {
     // The algorithm here is to split the fields into a "path" and a "lastSegment".
     // The path leads us to the final sub-document. We know that if we have either
@@ -44,24 +142,46 @@
     // that each level of the `path` results in a document rather than a value,
     // because if it's a value, we can't continue the selection process.
 
-    NSArray *fields = [possiblyDottedField componentsSeparatedByString:@"."];
-
-    NSRange pathLen;
-    pathLen.location = 0;
-    pathLen.length = fields.count - 1;
-    NSArray *path = [fields subarrayWithRange:pathLen];
-    NSString *lastSegment = [fields lastObject];
-
+    NSUInteger pathLength = fields.count - 1;
     NSDictionary *currentLevel = body;
-    for (NSString *field in path) {
-        currentLevel = currentLevel[field];
+    for (NSUInteger i = 0; i < pathLength; i++) {
+        currentLevel = currentLevel[fields[i]];
         if (currentLevel == nil || ![currentLevel isKindOfClass:[NSDictionary class]]) {
-            os_log_debug(CDTOSLog, "Could not extract field %@ from document %{public}@", possiblyDottedField, body);
+            os_log_debug(CDTOSLog, "Could not extract field %@ from document %{public}@", [fields componentsJoinedByString:@"."], body);
             return nil;  // we ran out of stuff before we reached the full path length
         }
     }
 
-    return currentLevel[lastSegment];
+    return currentLevel[fields[pathLength]];
+}
+
+#pragma mark Ordering
+
++ (NSComparisonResult)compareValue:(NSObject *)a toValue:(NSObject *)b
+{
+    NSInteger aClass = [CDTQValueExtractor sortClassOfValue:a];
+    NSInteger bClass = [CDTQValueExtractor sortClassOfValue:b];
+    if (aClass != bClass) {
+        return aClass < bClass ? NSOrderedAscending : NSOrderedDescending;
+    }
+    if (aClass == 1) {
+        return [(NSNumber *)a compare:(NSNumber *)b];
+    } else if (aClass == 2) {
+        return [(NSString *)a compare:(NSString *)b options:NSLiteralSearch];
+    }
+    return NSOrderedSame;
+}
+
++ (NSInteger)sortClassOfValue:(NSObject *)value
+{
+    if (!value || [value isKindOfClass:[NSNull class]]) {
+        return 0;
+    } else if ([value isKindOfClass:[NSNumber class]]) {
+        return 1;
+    } else if ([value isKindOfClass:[NSString class]]) {
+        return 2;
+    }
+    return 3;
 }
 
 @end
@@ -27,6 +27,9 @@
 - (void)changeTrackerReceivedChanges:(NSArray*)changes;
 - (void)changeTrackerStopped:(TDChangeTracker*)tracker;
 - (NSUInteger)sizeOfChangeQueue;
+/** YES while the client is holding as much as it wants to of what earlier changes led to; no
+    more changes are handed over until it returns NO, however short the change queue. */
+- (BOOL)changeQueueIsOverBudget;
 @end
 
 typedef enum TDChangeTrackerMode { kOneShot, kLongPoll, kContinuous } TDChangeTrackerMode;
@@ -40,14 +43,17 @@ typedef enum TDChangeTrackerMode { kOneShot, kLongPoll, kContinuous } TDChangeTr
     TDChangeTrackerMode _mode;
     id _lastSequenceID;
     unsigned _limit;
+    unsigned _prefetchDepth;
     NSError* _error;
     BOOL _includeConflicts;
     NSString* _filterName;
     NSDictionary* _filterParameters;
+    NSDictionary* _selector;
     NSTimeInterval _heartbeat;
     NSDictionary* _requestHeaders;
     id<TDAuthorizer> _authorizer;
     unsigned _retryCount;
+    BOOL _caughtUp;
 }
 
 - (id)initWithDatabaseURL:(NSURL*)databaseURL
@@ -66,10 +72,24 @@ typedef enum TDChangeTrackerMode { kOneShot, kLongPoll, kContinuous } TDChangeTr
 @property (strong, nonatomic) NSDictionary* requestHeaders;
 @property (strong, nonatomic) id<TDAuthorizer> authorizer;
 
+/** May be changed while the tracker runs, e.g. to kContinuous once a one-shot feed has caught up;
+    the tracker then goes on to read the continuous feed rather than stopping. A continuous feed
+    is read line by line as it arrives, on one connection for as long as the server keeps it open,
+    and without a limit. */
 @property (nonatomic) TDChangeTrackerMode mode;
 @property (copy) NSString* filterName;
 @property (copy) NSDictionary* filterParameters;
+/** A Mango selector to filter the feed with server-side, using the _selector filter. The selector
+    is sent in the body of a POST, as it may be too large for a URL. Can't be combined with
+    filterName or docIDs. */
+@property (copy) NSDictionary* selector;
 @property (nonatomic) unsigned limit;
+/** How many further pages of a limited one-shot feed may be fetched while earlier pages wait for
+    the client's change queue to drain; at most 2. The default, 0, fetches the next page only once
+    the previous one has been handed to the client. */
+@property (nonatomic) unsigned prefetchDepth;
+/** YES while the client is being handed the final page of a one-shot feed, and after. */
+@property (readonly, nonatomic) BOOL caughtUp;
 @property (nonatomic) NSTimeInterval heartbeat;
 @property (nonatomic) NSArray* docIDs;
 
@@ -83,9 +103,13 @@ typedef enum TDChangeTrackerMode { kOneShot, kLongPoll, kContinuous } TDChangeTr
 
 // Protected
 @property (readonly) NSString* changesFeedPath;
+- (NSString*)changesFeedPathSince:(id)sequenceID;
+/** The body to POST to changesFeedURL, or nil to GET it. */
+@property (readonly) NSData* changesFeedRequestBody;
 - (void)setUpstreamError:(NSString*)message;
 - (void)failedWithError:(NSError*)error;
 - (NSInteger)receivedPollResponse:(NSData*)body errorMessage:(NSString**)errorMessage;
+- (NSArray*)parsePollResponse:(NSData*)body errorMessage:(NSString**)errorMessage;
 - (BOOL)receivedChanges:(NSArray*)changes errorMessage:(NSString**)errorMessage;
 - (BOOL)receivedChange:(NSDictionary*)change;
 - (void)stopped;  // override this
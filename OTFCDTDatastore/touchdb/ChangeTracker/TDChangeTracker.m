@@ -31,6 +31,8 @@
 #define kInitialRetryDelay 2.0  // Initial retry delay (doubles after every subsequent failure)
 #define kMaxRetryDelay 300.0    // ...but will never get longer than this
 
+#define kMaxPrefetchDepth 2u  // Bounds memory: each prefetched page holds up to `limit` changes
+
 @interface TDChangeTracker ()
 @property (readwrite, copy, nonatomic) id lastSequenceID;
 @end
@@ -40,8 +42,9 @@
 @synthesize lastSequenceID = _lastSequenceID, databaseURL = _databaseURL, mode = _mode;
 @synthesize limit = _limit, heartbeat = _heartbeat, error = _error;
 @synthesize client = _client, filterName = _filterName, filterParameters = _filterParameters;
+@synthesize selector = _selector;
 @synthesize requestHeaders = _requestHeaders, authorizer = _authorizer;
-@synthesize docIDs = _docIDs;
+@synthesize docIDs = _docIDs, caughtUp = _caughtUp;
 
 - (id)initWithDatabaseURL:(NSURL*)databaseURL
                      mode:(TDChangeTrackerMode)mode
@@ -75,21 +78,30 @@
 
 - (NSString*)databaseName { return _databaseURL.path.lastPathComponent; }
 
-- (NSString*)changesFeedPath
+- (unsigned)prefetchDepth { return _prefetchDepth; }
+
+- (void)setPrefetchDepth:(unsigned)prefetchDepth
+{
+    _prefetchDepth = MIN(prefetchDepth, kMaxPrefetchDepth);
+}
+
+- (NSString*)changesFeedPath { return [self changesFeedPathSince:_lastSequenceID]; }
+
+- (NSString*)changesFeedPathSince:(id)seq
 {
     static NSString* const kModeNames[3] = { @"normal", @"longpoll", @"continuous" };
     NSMutableString* path;
     path = [NSMutableString stringWithFormat:@"_changes?feed=%@&heartbeat=%.0f", kModeNames[_mode],
                                              _heartbeat * 1000.0];
     if (_includeConflicts) [path appendString:@"&style=all_docs"];
-    id seq = _lastSequenceID;
     if (seq) {
         // BigCouch is now using arrays as sequence IDs. These need to be sent back JSON-encoded.
         if ([seq isKindOfClass:[NSArray class]] || [seq isKindOfClass:[NSDictionary class]])
             seq = [TDJSON stringWithJSONObject:seq options:0 error:nil];
         [path appendFormat:@"&since=%@", TDEscapeURLParam([seq description])];
     }
-    if (_limit > 0) [path appendFormat:@"&limit=%u", _limit];
+    // A continuous feed is read as it arrives, so needn't be split into pages.
+    if (_limit > 0 && _mode != kContinuous) [path appendFormat:@"&limit=%u", _limit];
     if (_filterName) {
         [path appendFormat:@"&filter=%@", TDEscapeURLParam(_filterName)];
         for (NSString* key in _filterParameters) {
@@ -110,6 +122,14 @@
         }
     }
 
+    if (_selector) {
+        if (_filterName || _docIDs) {
+            os_log_info(CDTOSLog, "You can't set both a replication filter or doc_ids and a selector, since a selector uses the internal _selector filter.");
+        } else {
+            [path appendString:@"&filter=_selector"];
+        }
+    }
+
     if (_docIDs) {
         if (_filterName) {
             os_log_info(CDTOSLog, "You can't set both a replication filter and doc_ids, since doc_ids uses the internal _doc_ids filter.");
@@ -130,6 +150,17 @@
 
 - (NSURL*)changesFeedURL { return TDAppendToURL(_databaseURL, self.changesFeedPath); }
 
+- (NSData*)changesFeedRequestBody
+{
+    if (!_selector || _filterName || _docIDs) return nil;
+    NSError* error;
+    NSData* body = [TDJSON dataWithJSONObject:@{ @"selector" : _selector } options:0 error:&error];
+    if (!body) {
+        os_log_info(CDTOSLog, "Illegal selector %{public}@, %{public}@", _selector, [error localizedDescription]);
+    }
+    return body;
+}
+
 - (NSString*)description
 {
     return [NSString stringWithFormat:@"%@[%p %@]", [self class], self, self.databaseName];
@@ -230,25 +261,32 @@
 }
 
 - (NSInteger)receivedPollResponse:(NSData*)body errorMessage:(NSString**)errorMessage
+{
+    NSArray* changes = [self parsePollResponse:body errorMessage:errorMessage];
+    if (!changes) return -1;
+    if (![self receivedChanges:changes errorMessage:errorMessage]) return -1;
+    return changes.count;
+}
+
+- (NSArray*)parsePollResponse:(NSData*)body errorMessage:(NSString**)errorMessage
 {
     if (!body) {
         *errorMessage = @"No body in response";
-        return -1;
+        return nil;
     }
     NSError* error;
     id changeObj = [TDJSON JSONObjectWithData:body options:0 error:&error];
     if (!changeObj) {
         *errorMessage = $sprintf(@"JSON parse error: %@", error.localizedDescription);
-        return -1;
+        return nil;
     }
     NSDictionary* changeDict = $castIf(NSDictionary, changeObj);
     NSArray* changes = $castIf(NSArray, changeDict[@"results"]);
     if (!changes) {
         *errorMessage = @"No 'changes' array in response";
-        return -1;
+        return nil;
     }
-    if (![self receivedChanges:changes errorMessage:errorMessage]) return -1;
-    return changes.count;
+    return changes;
 }
 
 @end
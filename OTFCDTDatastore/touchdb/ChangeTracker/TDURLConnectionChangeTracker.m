@@ -24,6 +24,7 @@
 #import "MYURLUtils.h"
 #import <string.h>
 #import "TDJSON.h"
+#import "TDStreamingJSONParser.h"
 #import "CDTLogging.h"
 #import "TDMisc.h"
 #import "CDTURLSession.h"
@@ -32,6 +33,11 @@
 #define kMaxRetries 6
 #define kInitialRetryDelay 0.2
 
+// When a continuous feed closes without having sent any changes, wait before reconnecting: this
+// long at first, doubling each time the feed goes idle, up to the maximum.
+#define kInitialIdleReconnectDelay 1.0
+#define kMaxIdleReconnectDelay 60.0
+
 @interface TDURLConnectionChangeTracker()
 @property (strong, nonatomic) NSMutableData* inputBuffer;
 @property (strong, nonatomic) NSMutableURLRequest *request;
@@ -39,6 +45,24 @@
 @property (nonatomic, readwrite) NSUInteger totalRetries;
 @property (nonatomic, strong) CDTURLSession * session;
 @property (nonatomic, strong) CDTURLSessionTask * task;
+// Pages parsed but not yet handed to the client, oldest first
+@property (nonatomic, strong) NSMutableArray<NSArray*>* pendingPages;
+// Sequence to ask for the next page from; ahead of lastSequenceID while pages are pending
+@property (nonatomic, copy) id nextSequenceID;
+// The last page fetched was full, so there are more to fetch
+@property (nonatomic) BOOL morePages;
+@property (nonatomic) unsigned requestedLimit;
+// Parses a successful response as it arrives, collecting its changes into streamedChanges
+@property (nonatomic, strong) TDStreamingJSONParser* parser;
+@property (nonatomic, strong) NSMutableArray* streamedChanges;
+@property (nonatomic) BOOL streamedResponse;
+// Continuous mode: the part of the feed after its last complete line
+@property (nonatomic, strong) NSMutableData* lineBuffer;
+// Continuous mode: whether this connection has sent any changes, and how many in a row haven't
+@property (nonatomic) BOOL connectionReceivedChanges;
+@property (nonatomic) unsigned idleConnectionCount;
+// Continuous mode: the feed closed and -start is scheduled
+@property (nonatomic) BOOL awaitingReconnect;
 @end
 
 static const int kChangeQueueThreshold = 500;
@@ -63,10 +87,17 @@ static const float kChangeQueuePollingRate = 0.1f;
 
     if(self){
         _session = session;
+        _pendingPages = [NSMutableArray array];
     }
     return self;
 }
 
+- (NSURL*)changesFeedURL
+{
+    if (!self.nextSequenceID) return [super changesFeedURL];
+    return TDAppendToURL(_databaseURL, [self changesFeedPathSince:self.nextSequenceID]);
+}
+
 
 - (BOOL)start
 {
@@ -75,11 +106,24 @@ static const float kChangeQueuePollingRate = 0.1f;
 
         os_log_info(CDTOSLog, "%{public}@: Starting...", [self class]);
         [super start];
+        self.awaitingReconnect = NO;
 
         NSURL* url = self.changesFeedURL;
+        self.requestedLimit = _limit;
         self.request = [[NSMutableURLRequest alloc] initWithURL:url];
         self.request.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
-        self.request.HTTPMethod = @"GET";
+        if (_mode == kContinuous) {
+            // The connection stays open, with only heartbeats on it while nothing changes.
+            self.request.timeoutInterval = MAX(_heartbeat * 1.5, self.request.timeoutInterval);
+        }
+        NSData* body = self.changesFeedRequestBody;
+        if (body) {
+            self.request.HTTPMethod = @"POST";
+            self.request.HTTPBody = body;
+            [self.request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+        } else {
+            self.request.HTTPMethod = @"GET";
+        }
 
         // Add headers from my .requestHeaders property:
         for(NSString *key in self.requestHeaders) {
@@ -99,10 +143,20 @@ static const float kChangeQueuePollingRate = 0.1f;
         }
 
         self.task = [self.session dataTaskWithRequest:self.request taskDelegate:self];
+        self.task.priority = CDTHTTPRequestPriorityChanges;
 
         [self.task resume];
 
         self.inputBuffer = [NSMutableData dataWithCapacity:0];
+        self.lineBuffer = _mode == kContinuous ? [NSMutableData data] : nil;
+        self.connectionReceivedChanges = NO;
+        NSMutableArray* changes = [NSMutableArray array];
+        self.streamedChanges = changes;
+        self.streamedResponse = NO;
+        self.parser = [[TDStreamingJSONParser alloc] initWithArrayKey:@"results"
+                                                            onElement:^(id change) {
+                                                                [changes addObject:change];
+                                                            }];
 
         self.startTime = [NSDate date];
         os_log_info(CDTOSLog, "%{public}@: Started... <%{public}@>", self, TDCleanURLtoString(url));
@@ -117,6 +171,9 @@ static const float kChangeQueuePollingRate = 0.1f;
     }
     self.task = nil;
     self.inputBuffer = nil;
+    self.parser = nil;
+    self.streamedChanges = nil;
+    self.lineBuffer = nil;
 }
 
 - (void)stop
@@ -125,6 +182,12 @@ static const float kChangeQueuePollingRate = 0.1f;
         [NSObject cancelPreviousPerformRequestsWithTarget:self
                                                  selector:@selector(start)
                                                    object:nil];  // cancel pending retries
+        [NSObject cancelPreviousPerformRequestsWithTarget:self
+                                                 selector:@selector(processPendingPages)
+                                                   object:nil];
+        // Undelivered pages are simply dropped; the client's checkpoint hasn't seen them.
+        [self.pendingPages removeAllObjects];
+        self.morePages = NO;
         if (self.task) {
             os_log_info(CDTOSLog, "%{public}@: stop", [self class]);
             [self clearConnection];
@@ -234,6 +297,101 @@ didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge
     }
 }
 
+-(void)receivedPartialData:(NSData *)data
+{
+    // Successful responses are parsed as they arrive, so a large page needn't be held in full
+    // and then parsed all at once.
+    self.streamedResponse = YES;
+    if (self.lineBuffer) {
+        [self receivedContinuousData:data];
+    } else {
+        [self.parser parseData:data];
+    }
+}
+
+// A continuous feed is a line of JSON per change, with empty lines as heartbeats. Complete lines
+// are handed over as they arrive, along with any others that came in the same chunk.
+- (void)receivedContinuousData:(NSData*)data
+{
+    NSMutableData* buffer = self.lineBuffer;
+    [buffer appendData:data];
+
+    NSMutableArray* changes = [NSMutableArray array];
+    const char* bytes = buffer.bytes;
+    NSUInteger length = buffer.length, start = 0;
+    for (NSUInteger i = 0; i < length; i++) {
+        if (bytes[i] != '\n') continue;
+        NSData* line = [buffer subdataWithRange:NSMakeRange(start, i - start)];
+        start = i + 1;
+        // Anything complete, a heartbeat included, shows the connection is healthy.
+        _retryCount = 0;
+        if (![self parseContinuousLine:line into:changes]) return;
+    }
+    [buffer replaceBytesInRange:NSMakeRange(0, start) withBytes:NULL length:0];
+
+    if (changes.count > 0) {
+        [self receivedContinuousChanges:changes];
+    }
+}
+
+// Adds a change from a line of a continuous feed, ignoring heartbeats and the last_seq line.
+// Stops the tracker and returns NO if the line isn't valid.
+- (BOOL)parseContinuousLine:(NSData*)line into:(NSMutableArray*)changes
+{
+    NSString* text = [[[NSString alloc] initWithData:line encoding:NSUTF8StringEncoding]
+        stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
+    if (text.length == 0) {
+        os_log_debug(CDTOSLog, "%{public}@: heartbeat", self);
+        return YES;
+    }
+    NSDictionary* change = $castIf(NSDictionary, [TDJSON JSONObjectWithData:line options:0 error:NULL]);
+    if (change[@"seq"]) {
+        [changes addObject:change];
+        return YES;
+    }
+    if (change[@"last_seq"]) {
+        // The server closing the feed, e.g. on a timeout; we'll reconnect when it ends.
+        return YES;
+    }
+    [self setUpstreamError:$sprintf(@"Invalid line in continuous feed: %@", text)];
+    [self clearConnection];
+    [self.pendingPages removeAllObjects];
+    [self stopped];
+    return NO;
+}
+
+- (void)receivedContinuousChanges:(NSArray*)changes
+{
+    self.connectionReceivedChanges = YES;
+    self.idleConnectionCount = 0;
+    self.nextSequenceID = [changes.lastObject objectForKey:@"seq"];
+    [self.pendingPages addObject:changes];
+    [self processPendingPages];
+}
+
+// The server closed a continuous feed. If it sent nothing, it may be a while before there's
+// anything to send, so reconnect after a delay which grows each time that happens.
+- (void)continuousFeedEnded
+{
+    if (self.lineBuffer.length > 0) {
+        NSMutableArray* changes = [NSMutableArray array];
+        if (![self parseContinuousLine:self.lineBuffer into:changes]) return;
+        if (changes.count > 0) [self receivedContinuousChanges:changes];
+    }
+    NSTimeInterval delay = 0;
+    if (!self.connectionReceivedChanges) {
+        delay = kInitialIdleReconnectDelay * (1 << MIN(self.idleConnectionCount, 16u));
+        delay = MIN(delay, kMaxIdleReconnectDelay);
+        self.idleConnectionCount++;
+    }
+    [self clearConnection];
+
+    os_log_debug(CDTOSLog, "%{public}@: continuous feed ended; reconnecting in %{public}.1f sec", self, delay);
+    self.awaitingReconnect = YES;
+    [self performSelector:@selector(start) withObject:nil afterDelay:delay];
+    if (self.pendingPages.count > 0) [self scheduleProcessPendingPages];
+}
+
 -(void)receivedData:(NSData *)data
 {
     os_log_debug(CDTOSLog, "%{public}@: didReceiveData: %{public}ld bytes", [self class], (unsigned long)[data length]);
@@ -246,14 +404,26 @@ didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge
 {
     //parse the input buffer into JSON (or NSArray of changes?)
     os_log_debug(CDTOSLog, "%{public}@: didFinishLoading, %{public}u bytes", self, (unsigned)self.inputBuffer.length);
+
+    if (self.lineBuffer && self.streamedResponse) {
+        [self continuousFeedEnded];
+        return;
+    }
     
-    BOOL restart = NO;
     NSString* errorMessage = nil;
-    NSInteger numChanges = [self receivedPollResponse:self.inputBuffer errorMessage:&errorMessage];
+    NSArray* changes = nil;
+    if (self.streamedResponse) {
+        if (self.parser.finished) changes = [self.streamedChanges copy];
+        errorMessage = self.parser.errorMessage ?: @"Response ended unexpectedly";
+    } else {
+        changes = [self parsePollResponse:self.inputBuffer errorMessage:&errorMessage];
+    }
     
-    if (numChanges < 0) {
+    if (!changes) {
         // unparseable response. See if it gets special handling:
-        if ([self receivedDataBeginsCorrectly]) {
+        BOOL beganCorrectly = self.streamedResponse ? self.parser.foundArray
+                                                    : [self receivedDataBeginsCorrectly];
+        if (beganCorrectly) {
             
             // The response at least starts out as what we'd expect, so it looks like the connection
             // was closed unexpectedly before the full response was sent.
@@ -269,36 +439,99 @@ didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge
         
         // Otherwise report an upstream unparseable-response error
         [self setUpstreamError:errorMessage];
+        [self clearConnection];
+        [self.pendingPages removeAllObjects];
+        self.morePages = NO;
+        [self stopped];
+        return;
     }
-    else {
-        // Poll again if there was no error, and it looks like we
-        // ran out of changes due to a _limit rather than because we hit the end.
-        restart = numChanges == (NSInteger)_limit;
+
+    // Poll again if it looks like we ran out of changes due to a _limit rather than because we
+    // hit the end. Compare with the limit this page was requested with, as the client may have
+    // changed it since.
+    self.morePages = self.requestedLimit > 0 && changes.count == self.requestedLimit;
+    if (changes.count > 0) {
+        self.nextSequenceID = [changes.lastObject objectForKey:@"seq"];
     }
-    
+    [self.pendingPages addObject:changes];
     [self clearConnection];
 
-    if (restart) {
-        // Throttle the rate at which we get the list of changes. If we already have more than
-        // kChangeQueueThreshold changes to be processed, wait until we fall below that threshold
-        // before we get any more. Note that this is not a hard limit, and the number of changes may
-        // exceed kChangeQueueThreshold, but it won't go vastly above the threshold. This saves us
-        // from consuming large amounts of memory by allocating a TDPulledRevision for each
-        // change we are waiting to pull and keeps our peak memory usage much smaller during
-        // pulls of large numbers of changes.
-        if ([_client respondsToSelector:@selector(sizeOfChangeQueue)]) {
-            while ([_client sizeOfChangeQueue] > kChangeQueueThreshold &&
-                   [[NSRunLoop currentRunLoop]
-                          runMode:NSDefaultRunLoopMode
-                       beforeDate:[NSDate dateWithTimeIntervalSinceNow:kChangeQueuePollingRate]])
-                ;
+    [self processPendingPages];
+}
+
+// Hands pending pages to the client while its change queue has room, and fetches further pages
+// while fewer than prefetchDepth are waiting.
+//
+// Throttle the rate at which we get the list of changes. If we already have more than
+// kChangeQueueThreshold changes to be processed, wait until we fall below that threshold
+// before we hand over any more. Note that this is not a hard limit, and the number of changes may
+// exceed kChangeQueueThreshold, but it won't go vastly above the threshold. This saves us
+// from consuming large amounts of memory by allocating a TDPulledRevision for each
+// change we are waiting to pull and keeps our peak memory usage much smaller during
+// pulls of large numbers of changes. Pages are only prefetched up to prefetchDepth, so at most
+// that many pages are held here too. The client can also hold changes back for its own reasons,
+// such as the memory taken by revisions it has fetched but not yet stored.
+- (void)processPendingPages
+{
+    while (self.pendingPages.count > 0 && ![self changeQueueIsFull]) {
+        NSArray* changes = self.pendingPages[0];
+        [self.pendingPages removeObjectAtIndex:0];
+        _caughtUp = self.pendingPages.count == 0 && !self.morePages;
+
+        NSString* errorMessage = nil;
+        if (![self receivedChanges:changes errorMessage:&errorMessage]) {
+            [self setUpstreamError:errorMessage];
+            [self.pendingPages removeAllObjects];
+            self.morePages = NO;
+            break;
+        }
+    }
+
+    if (self.task) {
+        // A page is on its way, or a continuous feed is open; we'll be back when more arrives,
+        // or when the change queue has room for what's waiting.
+        if (self.pendingPages.count > 0) [self scheduleProcessPendingPages];
+        return;
+    }
+
+    if (self.morePages) {
+        // With no prefetch, wait for the page to be handed over and the queue to have room.
+        NSUInteger depth = MAX(_prefetchDepth, [self changeQueueIsFull] ? 0u : 1u);
+        if (self.pendingPages.count < depth) {
+            [self start];  // Next poll...
+            return;
+        }
+    } else if (self.pendingPages.count == 0) {
+        if (_mode == kOneShot) {
+            [self stopped];
+        } else if (!self.awaitingReconnect) {
+            [self start];  // Caught up; go on listening
         }
+        return;
+    }
 
-        [self start];  // Next poll...
-    } else {
-        [self stopped];
+    [self scheduleProcessPendingPages];
+}
+
+- (void)scheduleProcessPendingPages
+{
+    [NSObject cancelPreviousPerformRequestsWithTarget:self
+                                             selector:@selector(processPendingPages)
+                                               object:nil];
+    [self performSelector:@selector(processPendingPages)
+               withObject:nil
+               afterDelay:kChangeQueuePollingRate];
+}
+
+- (BOOL)changeQueueIsFull
+{
+    id<TDChangeTrackerClient> client = _client;
+    if ([client respondsToSelector:@selector(changeQueueIsOverBudget)] &&
+        [client changeQueueIsOverBudget]) {
+        return YES;
     }
-    
+    return [client respondsToSelector:@selector(sizeOfChangeQueue)] &&
+           [client sizeOfChangeQueue] > kChangeQueueThreshold;
 }
 
 -(void) requestDidError:(NSError *)error
@@ -0,0 +1,64 @@
+//
+//  TDAdaptiveBatchController.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+#import "CDTHTTPInterceptor.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Tunes the pull replicator's batch sizes and concurrency from what it observes of the network.
+
+ The puller reports each bulk fetch it completes, with the number of revisions fetched and how
+ long the request took. From these the controller keeps a smoothed per-connection
+ throughput, which sizes bulk fetches so each takes roughly the same wall-clock time, and a
+ smoothed per-revision latency, compared against the best seen so far to detect queueing on the
+ link. Concurrency grows by one connection after each clean round of requests and shrinks by
+ one when latency inflates; it halves when the server answers 429 Too Many Requests.
+
+ The controller is also a response interceptor, so it sees 429 responses which
+ CDTReplay429Interceptor goes on to retry and which never reach the puller.
+
+ All methods are thread-safe.
+ */
+@interface TDAdaptiveBatchController : NSObject <CDTHTTPInterceptor>
+
+/** Number of revisions to request in one _bulk_get or _all_docs fetch. */
+@property (readonly) NSUInteger bulkFetchSize;
+
+/** Maximum number of revision fetches to have in flight at once. */
+@property (readonly) NSUInteger maxConnections;
+
+/**
+ ?limit= for the next _changes request: enough changes to give every connection one bulk fetch,
+ so the feed keeps the fetchers busy without parsing more than a round ahead.
+ */
+@property (readonly) unsigned changesFeedLimit;
+
+/** Fraction of the responses seen recently which were 429s. */
+@property (readonly) double throttledRate;
+
+/** Starts from the replicator's historical fixed settings: 50 revisions per fetch, 12 connections. */
+- (instancetype)init;
+
+/** Records a successful bulk fetch of `count` revisions which took `duration` seconds. */
+- (void)recordFetchOfRevisions:(NSUInteger)count duration:(NSTimeInterval)duration;
+
+/** Records a 429 response from the server. */
+- (void)recordThrottled;
+
+@end
+
+NS_ASSUME_NONNULL_END
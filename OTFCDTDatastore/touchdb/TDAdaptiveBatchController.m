@@ -0,0 +1,161 @@
+//
+//  TDAdaptiveBatchController.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDAdaptiveBatchController.h"
+
+#import "CDTHTTPInterceptorContext.h"
+#import "CDTLogging.h"
+
+// Starting points, matching the puller's fixed settings.
+static const NSUInteger kInitialBulkFetchSize = 50;
+static const NSUInteger kInitialMaxConnections = 12;
+
+static const NSUInteger kMinBulkFetchSize = 10;
+static const NSUInteger kMaxBulkFetchSize = 500;
+static const NSUInteger kMinConnections = 1;
+static const NSUInteger kMaxConnections = 24;
+
+static const unsigned kMinChangesFeedLimit = 100;
+static const unsigned kMaxChangesFeedLimit = 5000;
+
+// Bulk fetches are sized to take about this long at the measured throughput: long enough that
+// request overhead is small, short enough that a stalled fetch doesn't hold up much.
+static const NSTimeInterval kTargetFetchDuration = 2.0;
+
+// Weight given to each new sample in the moving averages.
+static const double kSmoothing = 0.25;
+
+// Per-revision latency this many times the best seen means requests are queueing.
+static const double kLatencyInflation = 2.0;
+
+@interface TDAdaptiveBatchController () {
+    NSUInteger _bulkFetchSize;
+    NSUInteger _maxConnections;
+    double _throughput;        // revisions per second per connection, smoothed; 0 until measured
+    double _latency;           // seconds per revision, smoothed; 0 until measured
+    double _bestLatency;       // lowest smoothed per-revision latency seen
+    NSUInteger _cleanFetches;  // fetches since concurrency last changed
+    double _throttledRate;
+}
+@end
+
+@implementation TDAdaptiveBatchController
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _bulkFetchSize = kInitialBulkFetchSize;
+        _maxConnections = kInitialMaxConnections;
+    }
+    return self;
+}
+
+- (NSUInteger)bulkFetchSize
+{
+    @synchronized(self) {
+        return _bulkFetchSize;
+    }
+}
+
+- (NSUInteger)maxConnections
+{
+    @synchronized(self) {
+        return _maxConnections;
+    }
+}
+
+- (unsigned)changesFeedLimit
+{
+    @synchronized(self) {
+        NSUInteger limit = _bulkFetchSize * _maxConnections;
+        return (unsigned)MIN(MAX(limit, kMinChangesFeedLimit), kMaxChangesFeedLimit);
+    }
+}
+
+- (double)throttledRate
+{
+    @synchronized(self) {
+        return _throttledRate;
+    }
+}
+
+- (void)recordFetchOfRevisions:(NSUInteger)count duration:(NSTimeInterval)duration
+{
+    if (count == 0 || duration <= 0) {
+        return;
+    }
+
+    @synchronized(self) {
+        double rate = count / duration;
+        double latency = duration / count;
+        _throughput = _throughput > 0 ? _throughput + kSmoothing * (rate - _throughput) : rate;
+        _latency = _latency > 0 ? _latency + kSmoothing * (latency - _latency) : latency;
+        _bestLatency = _bestLatency > 0 ? MIN(_bestLatency, _latency) : _latency;
+
+        NSUInteger size = (NSUInteger)(_throughput * kTargetFetchDuration);
+        _bulkFetchSize = MIN(MAX(size, kMinBulkFetchSize), kMaxBulkFetchSize);
+
+        if (_latency > _bestLatency * kLatencyInflation) {
+            // Adding connections has stopped buying throughput and just lengthens queues.
+            if (_maxConnections > kMinConnections) {
+                _maxConnections--;
+                os_log_debug(CDTOSLog, "%{public}@: latency up, now %{public}lu connections", self,
+                             (unsigned long)_maxConnections);
+            }
+            _cleanFetches = 0;
+        } else if (++_cleanFetches >= _maxConnections) {
+            // A full round of fetches went through without trouble; probe for more.
+            if (_maxConnections < kMaxConnections) {
+                _maxConnections++;
+            }
+            _cleanFetches = 0;
+        }
+    }
+}
+
+- (void)recordThrottled
+{
+    @synchronized(self) {
+        _maxConnections = MAX(kMinConnections, _maxConnections / 2);
+        _cleanFetches = 0;
+        os_log_info(CDTOSLog, "%{public}@: throttled by server, now %{public}lu connections", self,
+                    (unsigned long)_maxConnections);
+    }
+}
+
+#pragma mark CDTHTTPInterceptor
+
+- (CDTHTTPInterceptorContext *)interceptResponseInContext:(CDTHTTPInterceptorContext *)context
+{
+    BOOL throttled = context.response.statusCode == 429;
+    @synchronized(self) {
+        _throttledRate += kSmoothing * ((throttled ? 1.0 : 0.0) - _throttledRate);
+    }
+    if (throttled) {
+        [self recordThrottled];
+    }
+    return context;
+}
+
+- (NSString *)description
+{
+    @synchronized(self) {
+        return [NSString stringWithFormat:@"%@ [bulk=%lu, connections=%lu]", [self class],
+                                          (unsigned long)_bulkFetchSize,
+                                          (unsigned long)_maxConnections];
+    }
+}
+
+@end
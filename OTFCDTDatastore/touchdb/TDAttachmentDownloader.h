@@ -0,0 +1,48 @@
+//
+//  TDAttachmentDownloader.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDRemoteRequest.h"
+
+@class TD_Database, TDBlobStoreWriter;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/** Downloads the contents of a single attachment into a TDBlobStoreWriter, for an attachment that
+    was left pending when its revision was inserted.
+
+    The contents stream into the writer, which hashes them, as they arrive. If given a partial
+    path, they are also written there, and a later download of the same attachment, e.g. a retry
+    or the next replication, asks with a Range request for only the bytes it doesn't have yet,
+    feeding those it has to its writer first. The completed contents are checked against the
+    expected length and MD5 digest, if known. */
+@interface TDAttachmentDownloader : TDRemoteRequest
+
+- (instancetype)initWithSession:(CDTURLSession*)session
+                            URL:(NSURL*)url
+                       database:(TD_Database*)database
+                    partialPath:(nullable NSString*)partialPath
+                 expectedLength:(UInt64)expectedLength
+                 expectedDigest:(nullable NSString*)digest
+                 requestHeaders:(nullable NSDictionary*)requestHeaders
+                   onCompletion:(TDRemoteRequestCompletionBlock)onCompletion;
+
+/** On success, the finished writer holding the contents, ready to be installed. */
+@property (readonly, nullable) TDBlobStoreWriter* writer;
+
+/** Removes the partial file, once its contents have been installed or turned out to be bad. */
+- (void)deletePartialFile;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,227 @@
+//
+//  TDAttachmentDownloader.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDAttachmentDownloader.h"
+#import "TDBlobStore.h"
+#import "TDInternal.h"
+#import "TDMisc.h"
+#import "CollectionUtils.h"
+#import "CDTLogging.h"
+
+// HTTP status of a response to a Range request that sends only the range
+static const NSInteger kHTTPStatusPartialContent = 206;
+
+// Size of the reads that feed the bytes of an earlier attempt into the blob store
+static const NSUInteger kPartialFileCopyChunkSize = 64 * 1024;
+
+@implementation TDAttachmentDownloader {
+    TD_Database* _db;
+    NSString* _partialPath;
+    UInt64 _expectedLength;
+    NSString* _expectedDigest;
+    NSFileHandle* _partialFile;
+    UInt64 _resumeOffset;
+    TDBlobStoreWriter* _writer;
+}
+
+- (instancetype)initWithSession:(CDTURLSession*)session
+                            URL:(NSURL*)url
+                       database:(TD_Database*)database
+                    partialPath:(NSString*)partialPath
+                 expectedLength:(UInt64)expectedLength
+                 expectedDigest:(NSString*)digest
+                 requestHeaders:(NSDictionary*)requestHeaders
+                   onCompletion:(TDRemoteRequestCompletionBlock)onCompletion
+{
+    self = [super initWithSession:session
+                           method:@"GET"
+                              URL:url
+                             body:nil
+                   requestHeaders:requestHeaders
+                     onCompletion:onCompletion];
+    if (self) {
+        _db = database;
+        _partialPath = [partialPath copy];
+        _expectedLength = expectedLength;
+        _expectedDigest = [digest hasPrefix:@"md5-"] ? [digest copy] : nil;
+        self.priority = CDTHTTPRequestPriorityAttachments;
+        // Ranges count the bytes as sent, so they mustn't be decoded on the way in
+        [_request setValue:@"identity" forHTTPHeaderField:@"Accept-Encoding"];
+    }
+    return self;
+}
+
+- (TDBlobStoreWriter*)writer { return _writer; }
+
+- (void)start
+{
+    if (!_request) return;  // -clearSession already called
+
+    // Each attempt picks up from whatever the previous ones left in the partial file
+    [_writer cancel];
+    _writer = nil;
+    [_partialFile closeFile];
+    _partialFile = nil;
+    _resumeOffset = 0;
+    if (_partialPath) {
+        NSDictionary* attributes =
+            [[NSFileManager defaultManager] attributesOfItemAtPath:_partialPath error:NULL];
+        _resumeOffset = attributes.fileSize;
+    }
+    if (_resumeOffset > 0) {
+        [_request setValue:$sprintf(@"bytes=%llu-", _resumeOffset) forHTTPHeaderField:@"Range"];
+        // CouchDB's ETag for an attachment is its MD5 digest; if it doesn't match, we get it all
+        NSString* etag = _expectedDigest ? $sprintf(@"\"%@\"", [_expectedDigest substringFromIndex:4])
+                                         : nil;
+        [_request setValue:etag forHTTPHeaderField:@"If-Range"];
+        os_log_debug(CDTOSLog, "%{public}@: Resuming from byte %{public}llu", self, _resumeOffset);
+    } else {
+        [_request setValue:nil forHTTPHeaderField:@"Range"];
+        [_request setValue:nil forHTTPHeaderField:@"If-Range"];
+    }
+    [super start];
+}
+
+- (void)clearSession
+{
+    [_partialFile closeFile];
+    _partialFile = nil;
+    [super clearSession];
+}
+
+- (void)deletePartialFile
+{
+    if (_partialPath) [[NSFileManager defaultManager] removeItemAtPath:_partialPath error:NULL];
+}
+
+#pragma mark - URL CONNECTION CALLBACKS:
+
+- (void)receivedStreamingResponse:(NSHTTPURLResponse*)response
+{
+    BOOL resumed = (response.statusCode == kHTTPStatusPartialContent && _resumeOffset > 0);
+    _writer = [_db attachmentWriter];
+    if (!_partialPath) return;
+
+    NSFileManager* fmgr = [NSFileManager defaultManager];
+    if (!resumed) {
+        // The server sent the whole attachment, so start the file again
+        [fmgr createDirectoryAtPath:[_partialPath stringByDeletingLastPathComponent]
+            withIntermediateDirectories:YES
+                             attributes:nil
+                                  error:NULL];
+        [fmgr createFileAtPath:_partialPath contents:nil attributes:nil];
+    }
+    _partialFile = [NSFileHandle fileHandleForWritingAtPath:_partialPath];
+    if (!_partialFile) {
+        os_log_error(CDTOSLog, "%{public}@: Couldn't write %{public}@", self, _partialPath);
+        [self failWithStatus:kTDStatusAttachmentError];
+        return;
+    }
+    [_partialFile truncateFileAtOffset:(resumed ? _resumeOffset : 0)];
+    if (resumed && ![self appendPartialFileToWriter]) {
+        [self failWithStatus:kTDStatusAttachmentError];
+    }
+}
+
+// Abandons the contents received so far, leaving the partial file for a retry
+- (void)failWithStatus:(TDStatus)status
+{
+    [_partialFile closeFile];
+    _partialFile = nil;
+    [_writer cancel];
+    _writer = nil;
+    [self cancelWithStatus:status];
+}
+
+// Feeds what earlier attempts downloaded to the writer, ahead of the rest of the contents
+- (BOOL)appendPartialFileToWriter
+{
+    NSFileHandle* input = [NSFileHandle fileHandleForReadingAtPath:_partialPath];
+    @try {
+        UInt64 remaining = _resumeOffset;
+        while (remaining > 0) {
+            NSData* chunk =
+                [input readDataOfLength:(NSUInteger)MIN(remaining, kPartialFileCopyChunkSize)];
+            if (chunk.length == 0) return NO;  // shorter than when the request was made
+            [_writer appendData:chunk];
+            remaining -= chunk.length;
+        }
+        return YES;
+    } @catch (NSException* x) {
+        os_log_error(CDTOSLog, "%{public}@: Couldn't read %{public}@: %{public}@", self,
+                     _partialPath, x);
+        return NO;
+    } @finally {
+        [input closeFile];
+    }
+}
+
+- (void)receivedPartialData:(NSData*)data
+{
+    if (!_writer) return;  // already failed
+    // The writer hashes the contents as they arrive, and the partial file keeps them for a retry
+    [_writer appendData:data];
+    if (!_partialFile) return;
+    @try {
+        [_partialFile writeData:data];
+    } @catch (NSException* x) {
+        os_log_error(CDTOSLog, "%{public}@: Couldn't write %{public}@: %{public}@", self,
+                     _partialPath, x);
+        [self failWithStatus:kTDStatusInsufficientStorage];
+    }
+}
+
+- (void)receivedData:(NSData*)data
+{
+    [super receivedData:data];
+    if (TDStatusIsError(_status) || !_request) return;  // already failed
+
+    TDStatus status = [self finishWriting];
+    if (TDStatusIsError(status)) {
+        [self cancelWithStatus:status];
+        return;
+    }
+    [self clearSession];
+    [self respondWithResult:self error:nil];
+}
+
+- (void)requestDidError:(NSError*)error
+{
+    // The server won't serve the range, e.g. because what we have is already too long:
+    if (error.code == kTDStatusRangeNotSatisfiable && $equal(error.domain, TDHTTPErrorDomain))
+        [self deletePartialFile];
+    [super requestDidError:error];
+}
+
+// Finishes the writer, then checks what was downloaded
+- (TDStatus)finishWriting
+{
+    [_partialFile closeFile];
+    _partialFile = nil;
+    if (!_writer) _writer = [_db attachmentWriter];  // empty response
+    [_writer finish];
+
+    if ((_expectedLength > 0 && _writer.length != _expectedLength) ||
+        (_expectedDigest && !$equal(_writer.MD5DigestString, _expectedDigest))) {
+        os_log_info(CDTOSLog, "%{public}@: Downloaded %{public}llu bytes with digest %{public}@; expected %{public}llu, %{public}@",
+                    self, _writer.length, _writer.MD5DigestString, _expectedLength, _expectedDigest);
+        [_writer cancel];
+        _writer = nil;
+        [self deletePartialFile];
+        return kTDStatusUpstreamError;
+    }
+    return kTDStatusOK;
+}
+
+@end
@@ -14,6 +14,15 @@
 + (NSData *)decode:(const char *)string length:(size_t)inputLength;
 + (NSData *)decode:(NSString *)string;
 
+/** Encodes into `output`, which must have room for `(length + 2) / 3 * 4` characters, and returns
+    the number of characters written. */
++ (size_t)encode:(const void *)input length:(size_t)length intoBuffer:(uint8_t *)output;
+
+/** Decodes into `output`, which must have room for `inputLength * 3 / 4` bytes, and returns the
+    number of bytes written, or -1 if the input isn't valid. Trailing '=' characters are ignored,
+    so a long input can be decoded a few multiples of 4 characters at a time. */
++ (ssize_t)decode:(const char *)string length:(size_t)inputLength intoBuffer:(uint8_t *)output;
+
 /** Decodes the URL-safe Base64 variant that uses '-' and '_' instead of '+' and '/', and omits
  * trailing '=' characters. */
 + (NSData *)decodeURLSafe:(NSString *)string;
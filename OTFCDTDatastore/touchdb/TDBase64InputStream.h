@@ -0,0 +1,43 @@
+//
+//  TDBase64InputStream.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+@protocol CDTBlobReader;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ An input stream that reads an attachment from the blob store and returns it base64-encoded, a
+ chunk at a time, so that it can be inlined into a JSON request body without loading the whole
+ attachment into memory.
+
+ It must be read synchronously, as TDMultiStreamWriter does; it can't be scheduled on a run loop.
+ Unlike other streams it can be opened again after it has been closed, which starts it over from
+ the beginning of the attachment, so a request body containing it can be resent.
+ */
+@interface TDBase64InputStream : NSInputStream
+
+/** Returns nil if the blob can't be read. */
+- (nullable instancetype)initWithBlob:(id<CDTBlobReader>)blob;
+
+/** The number of bytes the stream will return. */
+@property (readonly) UInt64 length;
+
+/** The base64-encoded length of the given number of bytes. */
++ (UInt64)encodedLengthForLength:(UInt64)length;
+
+@end
+
+NS_ASSUME_NONNULL_END
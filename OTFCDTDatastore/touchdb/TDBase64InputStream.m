@@ -0,0 +1,150 @@
+//
+//  TDBase64InputStream.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDBase64InputStream.h"
+
+#import "CDTBlobReader.h"
+#import "TDBase64.h"
+
+// Must be a multiple of 3, so that only the final chunk is padded.
+#define kRawChunkSize (3 * 8192)
+#define kEncodedChunkSize (4 * 8192)
+
+@implementation TDBase64InputStream {
+    id<CDTBlobReader> _blob;
+    NSInputStream *_source;
+    UInt64 _sourceLength;
+    BOOL _sourceAtEnd;
+    NSStreamStatus _status;
+    NSError *_error;
+    __weak id<NSStreamDelegate> _delegate;
+    uint8_t _raw[kRawChunkSize];
+    NSUInteger _rawLength;
+    uint8_t _encoded[kEncodedChunkSize];
+    NSUInteger _encodedStart, _encodedLength;
+}
+
++ (UInt64)encodedLengthForLength:(UInt64)length { return (length + 2) / 3 * 4; }
+
+- (instancetype)initWithBlob:(id<CDTBlobReader>)blob
+{
+    self = [super init];
+    if (self) {
+        _blob = blob;
+        _source = [blob inputStreamWithOutputLength:&_sourceLength];
+        if (!_source) {
+            return nil;
+        }
+        _status = NSStreamStatusNotOpen;
+    }
+    return self;
+}
+
+- (UInt64)length { return [[self class] encodedLengthForLength:_sourceLength]; }
+
+#pragma mark - NSStream
+
+- (void)open
+{
+    if (_status == NSStreamStatusClosed || _status == NSStreamStatusAtEnd ||
+        _status == NSStreamStatusError) {
+        // Start over, e.g. because the request is being retried:
+        [_source close];
+        _source = [_blob inputStreamWithOutputLength:&_sourceLength];
+    }
+    _sourceAtEnd = NO;
+    _rawLength = _encodedStart = _encodedLength = 0;
+    _error = nil;
+    if (!_source) {
+        _status = NSStreamStatusError;
+        return;
+    }
+    [_source open];
+    _status = NSStreamStatusOpen;
+}
+
+- (void)close
+{
+    [_source close];
+    _status = NSStreamStatusClosed;
+}
+
+- (NSStreamStatus)streamStatus { return _status; }
+
+- (NSError *)streamError { return _error ?: _source.streamError; }
+
+- (id<NSStreamDelegate>)delegate { return _delegate; }
+
+- (void)setDelegate:(id<NSStreamDelegate>)delegate { _delegate = delegate; }
+
+- (void)scheduleInRunLoop:(NSRunLoop *)aRunLoop forMode:(NSRunLoopMode)mode {}
+
+- (void)removeFromRunLoop:(NSRunLoop *)aRunLoop forMode:(NSRunLoopMode)mode {}
+
+- (id)propertyForKey:(NSStreamPropertyKey)key { return nil; }
+
+- (BOOL)setProperty:(id)property forKey:(NSStreamPropertyKey)key { return NO; }
+
+#pragma mark - NSInputStream
+
+- (BOOL)hasBytesAvailable { return _status == NSStreamStatusOpen; }
+
+- (BOOL)getBuffer:(uint8_t **)buffer length:(NSUInteger *)len { return NO; }
+
+- (NSInteger)read:(uint8_t *)buffer maxLength:(NSUInteger)len
+{
+    if (_status == NSStreamStatusError) return -1;
+    if (_status != NSStreamStatusOpen) return 0;
+
+    NSUInteger total = 0;
+    while (total < len) {
+        if (_encodedLength == 0 && ![self encodeNextChunk]) break;
+        NSUInteger n = MIN(len - total, _encodedLength);
+        memcpy(buffer + total, _encoded + _encodedStart, n);
+        _encodedStart += n;
+        _encodedLength -= n;
+        total += n;
+    }
+    if (_status == NSStreamStatusError) return -1;
+    if (total == 0) _status = NSStreamStatusAtEnd;
+    return total;
+}
+
+// Reads the next chunk of the blob and fills _encoded from it. Returns NO at the end or on error.
+- (BOOL)encodeNextChunk
+{
+    while (!_sourceAtEnd && _rawLength < kRawChunkSize) {
+        NSInteger bytesRead = [_source read:_raw + _rawLength maxLength:kRawChunkSize - _rawLength];
+        if (bytesRead < 0) {
+            _error = _source.streamError;
+            _status = NSStreamStatusError;
+            return NO;
+        } else if (bytesRead == 0) {
+            _sourceAtEnd = YES;
+        } else {
+            _rawLength += bytesRead;
+        }
+    }
+
+    // Leave a partial group for the next chunk, unless there won't be one:
+    NSUInteger toEncode = _sourceAtEnd ? _rawLength : _rawLength - _rawLength % 3;
+    if (toEncode == 0) return NO;
+    _encodedLength = [TDBase64 encode:_raw length:toEncode intoBuffer:_encoded];
+    _encodedStart = 0;
+    memmove(_raw, _raw + toEncode, _rawLength - toEncode);
+    _rawLength -= toEncode;
+    return YES;
+}
+
+@end
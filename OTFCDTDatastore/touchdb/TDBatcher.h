@@ -11,7 +11,13 @@
 #import <Foundation/Foundation.h>
 
 /** Utility that queues up objects until the queue fills up or a time interval elapses,
-    then passes objects, in groups of its capacity, to a client-supplied processor block. */
+    then passes objects, in groups of its capacity, to a client-supplied processor block.
+
+    The queue is full once it holds `capacity` objects or, if a byteLimit and sizeOfObject block
+    are set, once their sizes add up to the limit; the delay bounds how long the first object
+    queued waits. Objects may be queued from any thread without blocking: they're pushed onto a
+    lock-free stack, and the processor is always called on the thread which created the batcher,
+    which must run its runloop. */
 @interface TDBatcher : NSObject {
     NSUInteger _capacity;
     NSTimeInterval _delay;
@@ -27,6 +33,21 @@
 
 @property (readonly) NSUInteger count;
 
+/** Total size, by sizeOfObject, of the objects queued and not yet passed to the processor block.
+    Exact only on the batcher's own thread; elsewhere it may lag objects being queued. */
+@property (readonly) UInt64 bytes;
+
+/** Maximum number of objects passed to the processor block at once. */
+@property NSUInteger capacity;
+
+/** Maximum total size of the objects passed to the processor block at once, though a single
+    object larger than this is still passed on its own. 0, the default, for no limit. */
+@property UInt64 byteLimit;
+
+/** Returns the size of an object, counted against the byteLimit. Called on the thread queueing
+    the object, so it should be cheap and thread-safe. Set it before queueing anything. */
+@property (nonatomic, copy) UInt64 (^sizeOfObject)(id object);
+
 - (void)queueObject:(id)object;
 - (void)queueObjects:(NSArray*)objects;
 
@@ -16,8 +16,26 @@
 //  and limitations under the License.
 
 #import "TDBatcher.h"
+#import "CDTLogging.h"
 
-@implementation TDBatcher
+#import <stdatomic.h>
+
+/** An object queued from any thread, not yet moved to the inbox. */
+typedef struct TDBatcherNode {
+    struct TDBatcherNode* next;
+    void* object;  // retained
+    UInt64 size;
+} TDBatcherNode;
+
+@implementation TDBatcher {
+    NSThread* _thread;                     // where the processor is called
+    _Atomic(TDBatcherNode*) _incoming;     // lock-free stack of objects queued, newest first
+    _Atomic(NSUInteger) _incomingCount;
+    _Atomic(UInt64) _incomingBytes;
+    atomic_bool _wakeUpScheduled;
+    NSMutableArray<NSNumber*>* _inboxSizes;  // parallel to _inbox, if there's a sizeOfObject
+    UInt64 _inboxBytes;
+}
 
 - (id)initWithCapacity:(NSUInteger)capacity
                  delay:(NSTimeInterval)delay
@@ -28,10 +46,101 @@
         _capacity = capacity;
         _delay = delay;
         _processor = [block copy];
+        _thread = [NSThread currentThread];
+        atomic_init(&_incoming, NULL);
+        atomic_init(&_incomingCount, 0);
+        atomic_init(&_incomingBytes, 0);
+        atomic_init(&_wakeUpScheduled, false);
     }
     return self;
 }
 
+- (void)dealloc
+{
+    TDBatcherNode* node = atomic_exchange(&_incoming, NULL);
+    while (node) {
+        TDBatcherNode* next = node->next;
+        CFBridgingRelease(node->object);
+        free(node);
+        node = next;
+    }
+}
+
+/** Moves the objects queued from any thread into the inbox, in the order they were queued.
+    Only called on _thread. */
+- (void)drainIncoming
+{
+    TDBatcherNode* node = atomic_exchange(&_incoming, NULL);
+    if (!node) return;
+
+    // The stack is newest first; reverse it.
+    TDBatcherNode* reversed = NULL;
+    while (node) {
+        TDBatcherNode* next = node->next;
+        node->next = reversed;
+        reversed = node;
+        node = next;
+    }
+
+    if (!_inbox) _inbox = [[NSMutableArray alloc] init];
+    NSUInteger count = 0;
+    UInt64 bytes = 0;
+    for (node = reversed; node;) {
+        [_inbox addObject:CFBridgingRelease(node->object)];
+        if (_inboxSizes) [_inboxSizes addObject:@(node->size)];
+        count++;
+        bytes += node->size;
+        TDBatcherNode* next = node->next;
+        free(node);
+        node = next;
+    }
+    _inboxBytes += bytes;
+    atomic_fetch_sub(&_incomingCount, count);
+    atomic_fetch_sub(&_incomingBytes, bytes);
+}
+
+- (BOOL)isFull
+{
+    return _inbox.count >= _capacity || (_byteLimit > 0 && _inboxBytes >= _byteLimit);
+}
+
+/** How many objects from the start of the inbox fit in one batch. */
+- (NSUInteger)batchCount
+{
+    NSUInteger count = MIN(_inbox.count, _capacity);
+    if (_byteLimit == 0 || !_inboxSizes) return count;
+
+    UInt64 bytes = 0;
+    for (NSUInteger i = 0; i < count; i++) {
+        bytes += _inboxSizes[i].unsignedLongLongValue;
+        if (bytes > _byteLimit) return MAX(i, (NSUInteger)1);
+    }
+    return count;
+}
+
+/** Takes the first `count` objects out of the inbox. */
+- (NSArray*)removeFromInbox:(NSUInteger)count
+{
+    NSArray* objects;
+    if (count == _inbox.count) {
+        objects = _inbox;
+        _inbox = nil;
+        _inboxSizes = _sizeOfObject ? [[NSMutableArray alloc] init] : nil;
+        _inboxBytes = 0;
+    } else {
+        NSRange range = NSMakeRange(0, count);
+        objects = [_inbox subarrayWithRange:range];
+        [_inbox removeObjectsInRange:range];
+        if (_inboxSizes) {
+            for (NSNumber* size in [_inboxSizes subarrayWithRange:range]) {
+                _inboxBytes -= size.unsignedLongLongValue;
+            }
+            [_inboxSizes removeObjectsInRange:range];
+        }
+    }
+    return objects;
+}
+
 - (void)unschedule
 {
     _scheduled = false;
@@ -53,38 +162,82 @@
 - (void)processNow
 {
     _scheduled = false;
-    NSArray* toProcess;
+    [self drainIncoming];
     NSUInteger count = _inbox.count;
     if (count == 0) {
         return;
-    } else if (count <= _capacity) {
-        toProcess = _inbox;
-        _inbox = nil;
-    } else {
-        toProcess = [_inbox subarrayWithRange:NSMakeRange(0, _capacity)];
-        [_inbox removeObjectsInRange:NSMakeRange(0, _capacity)];
+    }
+    NSArray* toProcess = [self removeFromInbox:[self batchCount]];
+    if (_inbox.count > 0) {
         // There are more objects left, so schedule them Real Soon:
         [self scheduleWithDelay:0.0];
     }
+    os_signpost_id_t signpost = CDTSignpostIDGenerate();
+    CDTSignpostIntervalBegin(signpost, "processBatch", "count=%lu", (unsigned long)toProcess.count);
     _processor(toProcess);
+    CDTSignpostIntervalEnd(signpost, "processBatch");
+}
+
+/** Looks at newly queued objects, on _thread: processes them if the inbox is full, otherwise
+    makes sure they'll be processed within the delay. */
+- (void)inboxChanged
+{
+    [self drainIncoming];
+    if (_inbox.count == 0) return;
+    if ([self isFull]) {
+        [self unschedule];
+        [self processNow];
+    } else {
+        [self scheduleWithDelay:_delay];
+    }
+}
+
+- (void)wakeUp
+{
+    atomic_store(&_wakeUpScheduled, false);
+    [self inboxChanged];
 }
 
 - (void)queueObjects:(NSArray*)objects
 {
     if (objects.count == 0) return;
-    if (!_inbox) _inbox = [[NSMutableArray alloc] init];
-    [_inbox addObjectsFromArray:objects];
 
-    if (_inbox.count < _capacity)
-        [self scheduleWithDelay:_delay];
-    else {
-        [self unschedule];
-        [self processNow];
+    UInt64 (^sizeOfObject)(id) = _sizeOfObject;
+    UInt64 bytes = 0;
+    for (id object in objects) {
+        TDBatcherNode* node = malloc(sizeof(TDBatcherNode));
+        node->object = (void*)CFBridgingRetain(object);
+        node->size = sizeOfObject ? sizeOfObject(object) : 0;
+        bytes += node->size;
+        node->next = atomic_load(&_incoming);
+        while (!atomic_compare_exchange_weak(&_incoming, &node->next, node)) {
+        }
+    }
+    atomic_fetch_add(&_incomingCount, objects.count);
+    atomic_fetch_add(&_incomingBytes, bytes);
+
+    if ([NSThread currentThread] == _thread) {
+        [self inboxChanged];
+    } else if (!atomic_exchange(&_wakeUpScheduled, true)) {
+        [self performSelector:@selector(wakeUp)
+                     onThread:_thread
+                   withObject:nil
+                waitUntilDone:NO];
     }
 }
 
 - (void)queueObject:(id)object { [self queueObjects:@[ object ]]; }
 
+- (void)setSizeOfObject:(UInt64 (^)(id))sizeOfObject
+{
+    _sizeOfObject = [sizeOfObject copy];
+    if (_sizeOfObject && !_inboxSizes) {
+        // Objects already in the inbox count as nothing.
+        _inboxSizes = [[NSMutableArray alloc] init];
+        for (NSUInteger i = 0; i < _inbox.count; i++) [_inboxSizes addObject:@0];
+    }
+}
+
 - (void)flush
 {
     [self unschedule];
@@ -93,14 +246,16 @@
 
 - (void)flushAll
 {
+    [self drainIncoming];
     if (_inbox.count > 0) {
         [self unschedule];
-        NSArray* toProcess = _inbox;
-        _inbox = nil;
+        NSArray* toProcess = [self removeFromInbox:_inbox.count];
         _processor(toProcess);
     }
 }
 
-- (NSUInteger)count { return _inbox.count; }
+- (NSUInteger)count { return _inbox.count + atomic_load(&_incomingCount); }
+
+- (UInt64)bytes { return _inboxBytes + atomic_load(&_incomingBytes); }
 
 @end
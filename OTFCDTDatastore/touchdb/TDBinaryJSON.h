@@ -0,0 +1,72 @@
+//
+//  TDBinaryJSON.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+#import "TDJSON.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A compact binary encoding of JSON objects, which revision bodies can be stored in instead of
+ JSON text (see TD_Database.storesBinaryBodies).
+
+ Every array and dictionary starts with a table of the offsets of its elements, dictionary
+ entries being sorted by key, so a single field can be found and decoded, by index or by binary
+ search, without decoding anything else in the document.
+
+ Numbers keep their types, so the canonical JSON of a decoded body is byte for byte the JSON it
+ was encoded from; that's what revision IDs are computed from and what gets replicated.
+
+ Encoded data starts with a zero byte, which JSON text never does, so the two can be told apart.
+ */
+@interface TDBinaryJSON : NSObject
+
+/** Adds to the dictionary keys which every decoded dictionary shares one string for, rather than
+    allocating a string for each time they're decoded. Decoding looks keys up in the table by
+    their bytes, straight from the encoded data, so it's meant for the field names most documents
+    have; the _-prefixed properties and attachment properties are always in it. */
++ (void)registerSharedKeys:(NSArray<NSString*>*)keys;
+
+/** The keys decoded dictionaries share strings for. */
++ (NSArray<NSString*>*)sharedKeys;
+
+/** YES if the data is binary JSON rather than JSON text. */
++ (BOOL)isBinaryJSON:(nullable NSData*)data;
+
+/** Encodes a tree of JSON objects, or returns nil if it contains anything that can't be
+    represented (such as a string that isn't valid Unicode). */
++ (nullable NSData*)dataWithJSONObject:(id)object;
+
+/** Encodes the object parsed from JSON text. */
++ (nullable NSData*)dataWithJSONData:(NSData*)json;
+
+/** Decodes binary JSON; only TDJSONReadingMutableContainers is looked at in the options. */
++ (nullable id)JSONObjectWithData:(NSData*)data options:(TDJSONReadingOptions)options;
+
+/** The canonical JSON of the decoded object. */
++ (nullable NSData*)canonicalJSONWithData:(NSData*)data;
+
+/** Like +[TDJSON dictionaryWithValuesForKeys:fromJSONDictionaryData:], for binary JSON: only the
+    values of the given top-level keys are decoded. Returns nil if the data isn't a dictionary. */
++ (nullable NSDictionary*)dictionaryWithValuesForKeys:(NSArray<NSString*>*)keys
+                                             fromData:(NSData*)data;
+
+/** Decodes just the value at the end of a path of dictionary keys, or returns nil if the path
+    leads through anything but dictionaries or the key is missing. */
++ (nullable id)valueAtKeyPath:(NSArray<NSString*>*)path inData:(NSData*)data;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,597 @@
+//
+//  TDBinaryJSON.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDBinaryJSON.h"
+
+#import "TDCanonicalJSON.h"
+
+// Layout, all integers little-endian:
+//
+//   data       := "\0TB" version:u8 value
+//   value      := tag:u8 payload
+//   null, false, true: no payload
+//   int64, uint64, double: 8 bytes
+//   decimal    := length:u32 ASCII digits       (numbers whose exact text has to be kept)
+//   string     := length:u32 UTF-8
+//   array      := size:u32 count:u32 offset:u32[count] element...
+//   dictionary := size:u32 count:u32 offset:u32[count] (key:string value)...
+//
+// A container's size counts the bytes after the size field itself. Offsets are from the start of
+// the first element or entry, and a dictionary's entries are sorted by the bytes of their keys.
+
+static const uint8_t kHeader[4] = {0, 'T', 'B', 1};
+
+enum {
+    kTagNull = 0,
+    kTagFalse,
+    kTagTrue,
+    kTagInt64,
+    kTagUInt64,
+    kTagDouble,
+    kTagDecimal,
+    kTagString,
+    kTagArray,
+    kTagDictionary
+};
+
+// Containers are limited to this depth, so that corrupt data can't overflow the stack:
+#define kMaxDepth 512
+
+#pragma mark - ENCODING
+
+static void appendUInt32(NSMutableData* output, uint32_t value)
+{
+    uint32_t le = CFSwapInt32HostToLittle(value);
+    [output appendBytes:&le length:sizeof(le)];
+}
+
+static void appendUInt64(NSMutableData* output, uint64_t value)
+{
+    uint64_t le = CFSwapInt64HostToLittle(value);
+    [output appendBytes:&le length:sizeof(le)];
+}
+
+static void patchUInt32(NSMutableData* output, NSUInteger offset, uint32_t value)
+{
+    uint32_t le = CFSwapInt32HostToLittle(value);
+    [output replaceBytesInRange:NSMakeRange(offset, sizeof(le)) withBytes:&le];
+}
+
+static BOOL appendString(NSMutableData* output, uint8_t tag, NSString* string)
+{
+    NSData* utf8 = [string dataUsingEncoding:NSUTF8StringEncoding];
+    if (!utf8 || utf8.length > UINT32_MAX) return NO;
+    [output appendBytes:&tag length:1];
+    appendUInt32(output, (uint32_t)utf8.length);
+    [output appendData:utf8];
+    return YES;
+}
+
+static BOOL encodeValue(NSMutableData* output, id object, int depth);
+
+/** Writes the tag, size, count and a blank offset table; returns where the size is. */
+static NSUInteger beginContainer(NSMutableData* output, uint8_t tag, NSUInteger count)
+{
+    [output appendBytes:&tag length:1];
+    NSUInteger start = output.length;
+    appendUInt32(output, 0);
+    appendUInt32(output, (uint32_t)count);
+    [output increaseLengthBy:count * sizeof(uint32_t)];
+    return start;
+}
+
+static BOOL endContainer(NSMutableData* output, NSUInteger start)
+{
+    NSUInteger size = output.length - start - sizeof(uint32_t);
+    if (size > UINT32_MAX) return NO;
+    patchUInt32(output, start, (uint32_t)size);
+    return YES;
+}
+
+static BOOL encodeArray(NSMutableData* output, NSArray* array, int depth)
+{
+    NSUInteger count = array.count;
+    NSUInteger start = beginContainer(output, kTagArray, count);
+    NSUInteger table = start + 2 * sizeof(uint32_t);
+    NSUInteger elements = table + count * sizeof(uint32_t);
+    NSUInteger i = 0;
+    for (id item in array) {
+        patchUInt32(output, table + i++ * sizeof(uint32_t), (uint32_t)(output.length - elements));
+        if (!encodeValue(output, item, depth + 1)) return NO;
+    }
+    return endContainer(output, start);
+}
+
+static BOOL encodeDictionary(NSMutableData* output, NSDictionary* dict, int depth)
+{
+    NSMutableArray* keys = [NSMutableArray arrayWithCapacity:dict.count];
+    for (id key in dict) {
+        if (![key isKindOfClass:[NSString class]]) return NO;
+        NSData* utf8 = [key dataUsingEncoding:NSUTF8StringEncoding];
+        if (!utf8) return NO;
+        [keys addObject:@[ utf8, key ]];
+    }
+    [keys sortUsingComparator:^NSComparisonResult(NSArray* a, NSArray* b) {
+        NSData* k1 = a[0];
+        NSData* k2 = b[0];
+        int result = memcmp(k1.bytes, k2.bytes, MIN(k1.length, k2.length));
+        if (result == 0) return k1.length < k2.length ? -1 : (k1.length > k2.length ? 1 : 0);
+        return result < 0 ? NSOrderedAscending : NSOrderedDescending;
+    }];
+
+    NSUInteger count = keys.count;
+    NSUInteger start = beginContainer(output, kTagDictionary, count);
+    NSUInteger table = start + 2 * sizeof(uint32_t);
+    NSUInteger entries = table + count * sizeof(uint32_t);
+    for (NSUInteger i = 0; i < count; i++) {
+        patchUInt32(output, table + i * sizeof(uint32_t), (uint32_t)(output.length - entries));
+        NSData* utf8 = keys[i][0];
+        if (utf8.length > UINT32_MAX) return NO;
+        appendUInt32(output, (uint32_t)utf8.length);
+        [output appendData:utf8];
+        if (!encodeValue(output, dict[keys[i][1]], depth + 1)) return NO;
+    }
+    return endContainer(output, start);
+}
+
+static BOOL encodeNumber(NSMutableData* output, NSNumber* number)
+{
+    uint8_t tag;
+    // Mirrors how TDCanonicalJSON writes numbers, so that decoding gives back the same JSON
+    if ([number isKindOfClass:[NSDecimalNumber class]]) {
+        return appendString(output, kTagDecimal, number.stringValue);
+    }
+    switch (number.objCType[0]) {
+        case 'c':
+            tag = number.boolValue ? kTagTrue : kTagFalse;
+            [output appendBytes:&tag length:1];
+            return YES;
+        case 'C':
+        case 's':
+        case 'S':
+        case 'i':
+        case 'I':
+        case 'l':
+        case 'L':
+        case 'q':
+            tag = kTagInt64;
+            [output appendBytes:&tag length:1];
+            appendUInt64(output, (uint64_t)number.longLongValue);
+            return YES;
+        case 'Q':
+            tag = kTagUInt64;
+            [output appendBytes:&tag length:1];
+            appendUInt64(output, number.unsignedLongLongValue);
+            return YES;
+        case 'd': {
+            tag = kTagDouble;
+            [output appendBytes:&tag length:1];
+            double value = number.doubleValue;
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            appendUInt64(output, bits);
+            return YES;
+        }
+        default:
+            // A float's text isn't that of the double it widens to
+            return appendString(output, kTagDecimal, number.stringValue);
+    }
+}
+
+static BOOL encodeValue(NSMutableData* output, id object, int depth)
+{
+    if (depth > kMaxDepth) return NO;
+    if ([object isKindOfClass:[NSString class]]) {
+        return appendString(output, kTagString, object);
+    } else if ([object isKindOfClass:[NSNumber class]]) {
+        return encodeNumber(output, object);
+    } else if ([object isKindOfClass:[NSDictionary class]]) {
+        return encodeDictionary(output, object, depth);
+    } else if ([object isKindOfClass:[NSArray class]]) {
+        return encodeArray(output, object, depth);
+    } else if ([object isKindOfClass:[NSNull class]]) {
+        uint8_t tag = kTagNull;
+        [output appendBytes:&tag length:1];
+        return YES;
+    }
+    return NO;
+}
+
+#pragma mark - DECODING
+
+typedef struct {
+    const uint8_t* pos;
+    const uint8_t* end;
+} TDBinaryCursor;
+
+static BOOL readUInt32(TDBinaryCursor* cursor, uint32_t* outValue)
+{
+    if (cursor->end - cursor->pos < (ptrdiff_t)sizeof(uint32_t)) return NO;
+    uint32_t le;
+    memcpy(&le, cursor->pos, sizeof(le));
+    *outValue = CFSwapInt32LittleToHost(le);
+    cursor->pos += sizeof(le);
+    return YES;
+}
+
+static BOOL readUInt64(TDBinaryCursor* cursor, uint64_t* outValue)
+{
+    if (cursor->end - cursor->pos < (ptrdiff_t)sizeof(uint64_t)) return NO;
+    uint64_t le;
+    memcpy(&le, cursor->pos, sizeof(le));
+    *outValue = CFSwapInt64LittleToHost(le);
+    cursor->pos += sizeof(le);
+    return YES;
+}
+
+/** Reads a u32 length and points `bytes` at that many bytes. */
+static BOOL readBytes(TDBinaryCursor* cursor, const uint8_t** bytes, uint32_t* length)
+{
+    if (!readUInt32(cursor, length) || (uint64_t)(cursor->end - cursor->pos) < *length) return NO;
+    *bytes = cursor->pos;
+    cursor->pos += *length;
+    return YES;
+}
+
+/** A container's elements: `count` offsets in `table`, relative to `base`, within [base, end). */
+typedef struct {
+    uint32_t count;
+    const uint8_t* table;
+    const uint8_t* base;
+    const uint8_t* end;
+} TDBinaryContainer;
+
+static BOOL readContainer(TDBinaryCursor* cursor, TDBinaryContainer* container)
+{
+    uint32_t size;
+    if (!readUInt32(cursor, &size) || (uint64_t)(cursor->end - cursor->pos) < size) return NO;
+    const uint8_t* end = cursor->pos + size;
+    TDBinaryCursor inner = {cursor->pos, end};
+    if (!readUInt32(&inner, &container->count)) return NO;
+    if ((uint64_t)(end - inner.pos) < (uint64_t)container->count * sizeof(uint32_t)) return NO;
+    container->table = inner.pos;
+    container->base = inner.pos + container->count * sizeof(uint32_t);
+    container->end = end;
+    cursor->pos = end;
+    return YES;
+}
+
+/** A cursor at the i'th element of a container. */
+static BOOL elementCursor(const TDBinaryContainer* container, uint32_t i, TDBinaryCursor* cursor)
+{
+    uint32_t le;
+    memcpy(&le, container->table + i * sizeof(uint32_t), sizeof(le));
+    uint32_t offset = CFSwapInt32LittleToHost(le);
+    if ((ptrdiff_t)offset >= container->end - container->base) return NO;
+    cursor->pos = container->base + offset;
+    cursor->end = container->end;
+    return YES;
+}
+
+#pragma mark - SHARED KEYS
+
+/** The UTF-8 bytes of a dictionary key, by which shared keys are looked up without making a
+    string first. */
+typedef struct {
+    const uint8_t* bytes;
+    uint32_t length;
+} TDKeyBytes;
+
+static CFHashCode hashKeyBytes(const void* value)
+{
+    const TDKeyBytes* key = value;
+    CFHashCode hash = 2166136261u;  // FNV-1a
+    for (uint32_t i = 0; i < key->length; i++) hash = (hash ^ key->bytes[i]) * 16777619u;
+    return hash;
+}
+
+static Boolean equalKeyBytes(const void* a, const void* b)
+{
+    const TDKeyBytes *keyA = a, *keyB = b;
+    return keyA->length == keyB->length && memcmp(keyA->bytes, keyB->bytes, keyA->length) == 0;
+}
+
+/** An immutable table of the key strings shared by every decoded dictionary; registering more
+    keys replaces it. */
+@interface TDSharedKeyTable : NSObject {
+   @public
+    CFDictionaryRef _table;  // TDKeyBytes* -> NSString*
+}
+- (instancetype)initWithKeys:(NSArray<NSString*>*)keys;
+@property (readonly) NSArray<NSString*>* keys;
+@end
+
+@implementation TDSharedKeyTable {
+    NSArray<NSData*>* _utf8Keys;  // what the TDKeyBytes point into
+    NSData* _entries;             // the TDKeyBytes themselves
+}
+
+- (instancetype)initWithKeys:(NSArray<NSString*>*)keys
+{
+    if (self = [super init]) {
+        NSMutableOrderedSet* uniqueKeys = [NSMutableOrderedSet orderedSetWithCapacity:keys.count];
+        for (NSString* key in keys) [uniqueKeys addObject:[key copy]];
+        _keys = [uniqueKeys.array copy];
+        NSMutableArray* utf8Keys = [NSMutableArray arrayWithCapacity:_keys.count];
+        NSMutableData* entries = [NSMutableData dataWithLength:_keys.count * sizeof(TDKeyBytes)];
+        TDKeyBytes* entry = entries.mutableBytes;
+        const void** tableKeys = calloc(_keys.count ?: 1, sizeof(void*));
+        const void** tableValues = calloc(_keys.count ?: 1, sizeof(void*));
+        CFIndex count = 0;
+        for (NSString* key in _keys) {
+            NSData* utf8 = [key dataUsingEncoding:NSUTF8StringEncoding];
+            if (!utf8) continue;
+            [utf8Keys addObject:utf8];
+            entry[count] = (TDKeyBytes){utf8.bytes, (uint32_t)utf8.length};
+            tableKeys[count] = &entry[count];
+            tableValues[count] = (__bridge const void*)key;
+            count++;
+        }
+        CFDictionaryKeyCallBacks keyCallBacks = {
+            .version = 0, .hash = hashKeyBytes, .equal = equalKeyBytes};
+        _table = CFDictionaryCreate(NULL, tableKeys, tableValues, count, &keyCallBacks,
+                                    &kCFTypeDictionaryValueCallBacks);
+        free(tableKeys);
+        free(tableValues);
+        _utf8Keys = utf8Keys;
+        _entries = entries;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (_table) CFRelease(_table);
+}
+
+@end
+
+static TDSharedKeyTable* sSharedKeys;
+
+static TDSharedKeyTable* currentSharedKeys(void)
+{
+    @synchronized([TDBinaryJSON class])
+    {
+        return sSharedKeys;
+    }
+}
+
+#pragma mark - DECODING VALUES
+
+static id decodeValue(TDBinaryCursor* cursor, BOOL mutableContainers, CFDictionaryRef sharedKeys,
+                      int depth);
+
+static NSString* decodeString(TDBinaryCursor* cursor)
+{
+    const uint8_t* bytes;
+    uint32_t length;
+    if (!readBytes(cursor, &bytes, &length)) return nil;
+    return [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding];
+}
+
+/** Decodes a dictionary key, returning the shared string for it if there is one. */
+static NSString* decodeKey(TDBinaryCursor* cursor, CFDictionaryRef sharedKeys)
+{
+    const uint8_t* bytes;
+    uint32_t length;
+    if (!readBytes(cursor, &bytes, &length)) return nil;
+    if (sharedKeys) {
+        TDKeyBytes probe = {bytes, length};
+        NSString* shared = (__bridge NSString*)CFDictionaryGetValue(sharedKeys, &probe);
+        if (shared) return shared;
+    }
+    return [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding];
+}
+
+static id decodeArray(TDBinaryCursor* cursor, BOOL mutableContainers, CFDictionaryRef sharedKeys,
+                      int depth)
+{
+    TDBinaryContainer container;
+    if (!readContainer(cursor, &container)) return nil;
+    NSMutableArray* array = [NSMutableArray arrayWithCapacity:container.count];
+    for (uint32_t i = 0; i < container.count; i++) {
+        TDBinaryCursor element;
+        if (!elementCursor(&container, i, &element)) return nil;
+        id value = decodeValue(&element, mutableContainers, sharedKeys, depth + 1);
+        if (!value) return nil;
+        [array addObject:value];
+    }
+    return mutableContainers ? array : [array copy];
+}
+
+static id decodeDictionary(TDBinaryCursor* cursor, BOOL mutableContainers,
+                           CFDictionaryRef sharedKeys, int depth)
+{
+    TDBinaryContainer container;
+    if (!readContainer(cursor, &container)) return nil;
+    NSMutableDictionary* dict = [NSMutableDictionary dictionaryWithCapacity:container.count];
+    for (uint32_t i = 0; i < container.count; i++) {
+        TDBinaryCursor entry;
+        if (!elementCursor(&container, i, &entry)) return nil;
+        NSString* key = decodeKey(&entry, sharedKeys);
+        if (!key) return nil;
+        id value = decodeValue(&entry, mutableContainers, sharedKeys, depth + 1);
+        if (!value) return nil;
+        dict[key] = value;
+    }
+    return mutableContainers ? dict : [dict copy];
+}
+
+static id decodeValue(TDBinaryCursor* cursor, BOOL mutableContainers, CFDictionaryRef sharedKeys,
+                      int depth)
+{
+    if (depth > kMaxDepth || cursor->pos >= cursor->end) return nil;
+    uint64_t bits;
+    switch (*cursor->pos++) {
+        case kTagNull:
+            return [NSNull null];
+        case kTagFalse:
+            return @NO;
+        case kTagTrue:
+            return @YES;
+        case kTagInt64:
+            return readUInt64(cursor, &bits) ? @((long long)bits) : nil;
+        case kTagUInt64:
+            return readUInt64(cursor, &bits) ? @((unsigned long long)bits) : nil;
+        case kTagDouble: {
+            if (!readUInt64(cursor, &bits)) return nil;
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            return @(value);
+        }
+        case kTagDecimal: {
+            NSString* digits = decodeString(cursor);
+            return digits ? [NSDecimalNumber decimalNumberWithString:digits] : nil;
+        }
+        case kTagString:
+            return decodeString(cursor);
+        case kTagArray:
+            return decodeArray(cursor, mutableContainers, sharedKeys, depth);
+        case kTagDictionary:
+            return decodeDictionary(cursor, mutableContainers, sharedKeys, depth);
+        default:
+            return nil;
+    }
+}
+
+/** A cursor at the start of the encoded root value, or NO if the header is wrong. */
+static BOOL rootCursor(NSData* data, TDBinaryCursor* cursor)
+{
+    if (![TDBinaryJSON isBinaryJSON:data]) return NO;
+    cursor->pos = (const uint8_t*)data.bytes + sizeof(kHeader);
+    cursor->end = (const uint8_t*)data.bytes + data.length;
+    return YES;
+}
+
+/** Points the cursor at the value of `key`, if the cursor is at a dictionary that has it. */
+static BOOL findKey(TDBinaryCursor* cursor, NSData* key)
+{
+    if (cursor->pos >= cursor->end || *cursor->pos++ != kTagDictionary) return NO;
+    TDBinaryContainer container;
+    if (!readContainer(cursor, &container)) return NO;
+
+    uint32_t low = 0, high = container.count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        TDBinaryCursor entry;
+        const uint8_t* bytes;
+        uint32_t length;
+        if (!elementCursor(&container, mid, &entry) || !readBytes(&entry, &bytes, &length)) {
+            return NO;
+        }
+        int result = memcmp(bytes, key.bytes, MIN(length, key.length));
+        if (result == 0) result = (length > key.length) - (length < key.length);
+        if (result == 0) {
+            *cursor = entry;
+            return YES;
+        } else if (result < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return NO;
+}
+
+@implementation TDBinaryJSON
+
++ (void)initialize
+{
+    if (self == [TDBinaryJSON class]) {
+        sSharedKeys = [[TDSharedKeyTable alloc] initWithKeys:@[
+            @"_id", @"_rev", @"_deleted", @"_attachments", @"_revisions", @"_conflicts",
+            @"_local_seq", @"content_type", @"digest", @"length", @"revpos", @"stub",
+            @"encoding", @"encoded_length", @"follows", @"data"
+        ]];
+    }
+}
+
++ (void)registerSharedKeys:(NSArray<NSString*>*)keys
+{
+    @synchronized([TDBinaryJSON class])
+    {
+        sSharedKeys = [[TDSharedKeyTable alloc]
+            initWithKeys:[sSharedKeys.keys arrayByAddingObjectsFromArray:keys]];
+    }
+}
+
++ (NSArray<NSString*>*)sharedKeys
+{
+    return currentSharedKeys().keys;
+}
+
++ (BOOL)isBinaryJSON:(NSData*)data
+{
+    return data.length > sizeof(kHeader) && memcmp(data.bytes, kHeader, sizeof(kHeader)) == 0;
+}
+
++ (NSData*)dataWithJSONObject:(id)object
+{
+    NSMutableData* output = [NSMutableData dataWithBytes:kHeader length:sizeof(kHeader)];
+    return encodeValue(output, object, 0) ? output : nil;
+}
+
++ (NSData*)dataWithJSONData:(NSData*)json
+{
+    id object = [TDJSON JSONObjectWithData:json options:0 error:NULL];
+    return object ? [self dataWithJSONObject:object] : nil;
+}
+
++ (id)JSONObjectWithData:(NSData*)data options:(TDJSONReadingOptions)options
+{
+    TDBinaryCursor cursor;
+    if (!rootCursor(data, &cursor)) return nil;
+    TDSharedKeyTable* sharedKeys = currentSharedKeys();
+    return decodeValue(&cursor, (options & TDJSONReadingMutableContainers) != 0,
+                       sharedKeys->_table, 0);
+}
+
++ (NSData*)canonicalJSONWithData:(NSData*)data
+{
+    id object = [self JSONObjectWithData:data options:0];
+    return object ? [TDCanonicalJSON canonicalData:object] : nil;
+}
+
++ (NSDictionary*)dictionaryWithValuesForKeys:(NSArray<NSString*>*)keys fromData:(NSData*)data
+{
+    TDBinaryCursor root;
+    if (!rootCursor(data, &root) || root.pos >= root.end || *root.pos != kTagDictionary) {
+        return nil;
+    }
+    TDSharedKeyTable* sharedKeys = currentSharedKeys();
+    NSMutableDictionary* result = [NSMutableDictionary dictionaryWithCapacity:keys.count];
+    for (NSString* key in keys) {
+        NSData* utf8 = [key dataUsingEncoding:NSUTF8StringEncoding];
+        TDBinaryCursor cursor = root;
+        if (!utf8 || !findKey(&cursor, utf8)) continue;
+        id value = decodeValue(&cursor, NO, sharedKeys->_table, 1);
+        if (!value) return nil;
+        result[key] = value;
+    }
+    return result;
+}
+
++ (id)valueAtKeyPath:(NSArray<NSString*>*)path inData:(NSData*)data
+{
+    TDBinaryCursor cursor;
+    if (path.count == 0 || !rootCursor(data, &cursor)) return nil;
+    for (NSString* key in path) {
+        NSData* utf8 = [key dataUsingEncoding:NSUTF8StringEncoding];
+        if (!utf8 || !findKey(&cursor, utf8)) return nil;
+    }
+    TDSharedKeyTable* sharedKeys = currentSharedKeys();
+    return decodeValue(&cursor, NO, sharedKeys->_table, (int)path.count);
+}
+
+@end
@@ -28,7 +28,8 @@
 extern NSString *const CDTBlobStoreErrorDomain;
 
 typedef NS_ENUM(NSInteger, CDTBlobStoreError) {
-    CDTBlobStoreErrorNoFilenameGenerated
+    CDTBlobStoreErrorNoFilenameGenerated,
+    CDTBlobStoreErrorRekeyFailed
 };
 
 /** Key identifying a data blob. This happens to be a SHA-1 digest. */
@@ -37,8 +38,11 @@ typedef struct TDBlobKey
     uint8_t bytes[CC_SHA1_DIGEST_LENGTH];
 } TDBlobKey;
 
+@class TDSharedBlobStore, TDBlobFilenameCache;
+
 /** A persistent content-addressable store for arbitrary-size data blobs.
-    Each blob is stored as a file named by its SHA-1 digest. */
+    Each blob is stored as a file named by its SHA-1 digest, or, if it is smaller than
+    inlineThreshold, in the database itself. */
 @interface TDBlobStore : NSObject {
     NSString* _tempDir;
 }
@@ -55,6 +59,43 @@ typedef struct TDBlobKey
     encryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
                     error:(NSError **)outError;
 
+/**
+ Store shared with other databases that blobs are added to as they are installed, so identical
+ attachments are only kept once on disk. It is ignored if the blobs are encrypted.
+
+ @see TDSharedBlobStore
+ */
+@property (strong, nonatomic) TDSharedBlobStore *sharedStore;
+
+/**
+ Cache of the filenames of blobs, so reading one doesn't need a query to find its file. Blobs are
+ looked up in the database if it is nil.
+
+ @see TDBlobFilenameCache
+ */
+@property (strong, nonatomic) TDBlobFilenameCache *filenameCache;
+
+/** YES if the blobs are encrypted on disk. */
+@property (readonly, nonatomic) BOOL encrypted;
+
+/**
+ Blobs stored from then on which are shorter than this many bytes are kept in a table of the
+ database rather than in files of their own, which saves a file, its inode and the rest of its
+ last disk block for each, and lets them be read without opening a file. They are encrypted along
+ with the rest of the database if it is. Blobs already stored stay where they are. 0, the
+ default, stores every blob in a file.
+ */
+@property (atomic) NSUInteger inlineThreshold;
+
+/**
+ If YES, files written from then on are put in two levels of subdirectories named by the start of
+ their filename (see 'TD_Database:shardedBlobFilename:'), rather than all in the store's
+ directory, so that looking up, listing and deleting files stays quick however many attachments
+ there are. Files already written stay where they are until
+ 'TD_Database:moveBlobFilesToShardedLayoutWithError:' moves them. Defaults to NO.
+ */
+@property (atomic) BOOL shardsFiles;
+
 /**
  Return a reader for the attachment represented by the provided key.
  
@@ -67,6 +108,16 @@ typedef struct TDBlobKey
  */
 - (id<CDTBlobReader>)blobForKey:(TDBlobKey)key withDatabase:(FMDatabase *)db;
 
+/**
+ Look up the filenames of many blobs with one query, ahead of reading them with
+ -blobForKey:withDatabase:, so that those don't need a query each. Does nothing without a
+ filename cache, or within a write transaction.
+
+ @param keys Keys of the blobs, each the bytes of a TDBlobKey
+ @param db A database
+ */
+- (void)prefetchFilenamesForKeys:(NSArray<NSData *> *)keys withDatabase:(FMDatabase *)db;
+
 /**
  Save to disk the data passed a parameter and also returns the key for the new attachment.
  
@@ -108,6 +159,76 @@ typedef struct TDBlobKey
  */
 - (BOOL)deleteBlobsExceptWithKeys:(NSSet*)keysToKeep withDatabase:(FMDatabase *)db;
 
+/**
+ Delete the files of attachments whose rows have already been removed from the database, e.g. by
+ 'TD_Database:markUnusedBlobFilenamesForDeletionInDatabase:'. Files that are already gone are
+ ignored. It does not touch the database, so it can run off the database queue.
+
+ @param filenames Names of the files to delete
+
+ @return The number of files deleted
+ */
+- (NSUInteger)deleteBlobFilesNamed:(NSArray<NSString *> *)filenames;
+
+/**
+ Hard-link an attachment's file under another filename, creating the directories it is in. A file
+ already at the new name is replaced, as no row of the database can refer to it yet. It does not
+ touch the database.
+
+ @param filename Name of the file, as in the database
+ @param newFilename Name to link it as
+
+ @return YES if the file is linked or there is no file with that name, NO if there is an error
+ */
+- (BOOL)linkBlobFileNamed:(NSString *)filename toFilename:(NSString *)newFilename;
+
+/**
+ Encrypt attachments written from now on with the key returned by the provider, rather than the
+ key the store was created with. Existing attachments stay readable, and are re-encrypted one by
+ one with -writeRekeyedCopyOfBlobWithFilename:error: and
+ -installRekeyedCopyAtPath:ofBlobWithKey:filename:withDatabase:.
+
+ @warning The store must be encrypted, and the provider must return a key.
+ */
+- (void)changeEncryptionKeyToKeyOfProvider:(id<CDTEncryptionKeyProvider>)provider;
+
+/**
+ YES if the attachment's file is still encrypted with the key the store had before
+ -changeEncryptionKeyToKeyOfProvider:.
+
+ @param filename Name of the file, as in the database
+ */
+- (BOOL)blobNeedsRekeyingWithFilename:(NSString *)filename;
+
+/**
+ Write a copy of the attachment next to it, encrypted with the store's current key. It does not
+ touch the database, so it can run off the database queue while the attachment is read.
+
+ @param filename Name of the file, as in the database
+ @param outError It will point to an error if the file can't be read or the copy written
+
+ @return The path of the copy, or nil if there is an error
+ */
+- (NSString *)writeRekeyedCopyOfBlobWithFilename:(NSString *)filename
+                                           error:(NSError *__autoreleasing *)outError;
+
+/**
+ Replace the attachment's file with the copy made by -writeRekeyedCopyOfBlobWithFilename:error:,
+ if the database still has the attachment in that file; otherwise the copy is deleted. Readers
+ already open keep reading the file they opened.
+
+ @param copyPath The path of the copy
+ @param key Key of the attachment
+ @param filename Name of the file the copy was made from
+ @param db A database
+
+ @return YES if the copy was installed or was no longer needed, NO if there is an error
+ */
+- (BOOL)installRekeyedCopyAtPath:(NSString *)copyPath
+                   ofBlobWithKey:(TDBlobKey)key
+                        filename:(NSString *)filename
+                    withDatabase:(FMDatabase *)db;
+
 @end
 
 typedef struct
@@ -116,24 +237,52 @@ typedef struct
 } TDMD5Key;
 
 /** Lets you stream a large attachment to a TDBlobStore asynchronously, e.g. from a network
- * download. */
+ * download. Data is hashed on the calling thread while it is encrypted (if the store is) and
+ * written to disk on a private queue, so the two overlap. For an encrypted store, small appends
+ * are gathered into chunks big enough to be encrypted on several cores at once. */
 @interface TDBlobStoreWriter : NSObject {
    @private
     TDBlobStore* _store;
     NSString* _tempPath;
     id<CDTBlobWriter> _blobWriter;
+    dispatch_queue_t _writeQueue;
+    dispatch_semaphore_t _pendingWrites;
+    NSMutableData* _unwrittenData;
     UInt64 _length;
     CC_SHA1_CTX _shaCtx;
-    CC_SHA256_CTX _sha256Ctx;
+    CC_MD5_CTX _md5Ctx;
+    BOOL _computesMD5Digest;
     TDBlobKey _blobKey;
     TDMD5Key _MD5Digest;
 }
 
 - (id)initWithStore:(TDBlobStore*)store;
 
+/** Returns a finished writer for a blob the store's shared store already holds, identified by an
+    attachment's "digest" property, so that it can be installed without downloading it again.
+    Returns nil if there is no shared store or it doesn't have the blob. */
+- (id)initWithStore:(TDBlobStore*)store sharedBlobWithDigest:(NSString*)digest;
+
+/** Returns a finished writer for a blob another store holds, read with that store's database, so
+    that it can be installed in this one. The blob file is hard-linked (or copied) where neither
+    store is encrypted, and otherwise read and written again. Returns nil if the other store
+    doesn't have the blob. */
+- (id)initWithStore:(TDBlobStore*)store
+    copyingBlobWithKey:(TDBlobKey)key
+             fromStore:(TDBlobStore*)sourceStore
+          withDatabase:(FMDatabase*)sourceDb;
+
+/** Whether to compute the MD5 digest as well as the SHA-1 blob key. Defaults to YES; set it to NO
+    before appending any data if the attachment's digest is already known to be SHA-1. */
+@property (nonatomic) BOOL computesMD5Digest;
+
 /** Appends data to the blob. Call this when new data is available. */
 - (void)appendData:(NSData*)data;
 
+/** Appends the data a Base64 string encodes, decoding it a chunk at a time rather than all at
+    once. Returns NO if the string isn't valid Base64; the writer should then be cancelled. */
+- (BOOL)appendBase64String:(NSString*)base64;
+
 /** Call this after all the data has been added. */
 - (void)finish;
 
@@ -160,8 +309,12 @@ typedef struct
 @property (readonly) TDBlobKey blobKey;
 
 /** After finishing, this is the MD5 digest of the blob, in base64 with an "md5-" prefix.
-    (This is useful for compatibility with CouchDB, which stores MD5 digests of attachments.) */
+    (This is useful for compatibility with CouchDB, which stores MD5 digests of attachments.)
+    Nil unless computesMD5Digest is set. */
 @property (readonly) NSString* MD5DigestString;
 @property (readonly) NSString* SHA1DigestString;
 
+/** The MD5DigestString if it was computed, else the SHA1DigestString. */
+@property (readonly) NSString* digestString;
+
 @end
@@ -17,6 +17,7 @@
 //  and limitations under the License.
 
 #import "TDBlobStore.h"
+#import "TDSharedBlobStore.h"
 #import "TDBase64.h"
 #import "TDMisc.h"
 #import "CDTLogging.h"
@@ -36,11 +37,74 @@
 
 NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
 
+// Chunks a TDBlobStoreWriter may have waiting to be written to disk
+static const long kMaxPendingWrites = 4;
+
+// Size a TDBlobStoreWriter for an encrypted store gathers appends up to, before they're encrypted
+// and written; CDTBlobEncryptedData spreads data this large across cores
+static const NSUInteger kEncryptedWriteChunkSize = 1024 * 1024;
+
+// Characters of Base64 a TDBlobStoreWriter decodes at a time; a multiple of 4
+static const NSUInteger kBase64DecodeChunkLength = 64 * 1024;
+
+// Size of the reads when an attachment is re-encrypted
+static const NSUInteger kRekeyChunkSize = 64 * 1024;
+
+// Extension of the copy of an attachment that is being re-encrypted
+static NSString *const kRekeyingExtension = @"rekeying";
+
+/** Reads a blob stored in the database, from the copy loaded with its row. */
+@interface TDInlineBlobReader : NSObject <CDTBlobReader>
+
+- (instancetype)initWithData:(NSData *)data;
+
+@end
+
+@implementation TDInlineBlobReader {
+    NSData *_data;
+}
+
+- (instancetype)initWithData:(NSData *)data
+{
+    self = [super init];
+    if (self) {
+        _data = data;
+    }
+    return self;
+}
+
+- (NSData *)dataWithError:(NSError *__autoreleasing *)error { return _data; }
+
+- (NSInputStream *)inputStreamWithOutputLength:(UInt64 *)outputLength
+{
+    if (outputLength) {
+        *outputLength = _data.length;
+    }
+    return [NSInputStream inputStreamWithData:_data];
+}
+
+- (NSData *)dataInRange:(NSRange)range error:(NSError *__autoreleasing *)error
+{
+    NSUInteger location = MIN(range.location, _data.length);
+    NSUInteger length = MIN(range.length, _data.length - location);
+    return [_data subdataWithRange:NSMakeRange(location, length)];
+}
+
+@end
+
 @interface TDBlobStore ()
 
 @property (strong, nonatomic, readonly) NSString *path;
 @property (strong, nonatomic, readonly) CDTBlobHandleFactory *blobHandleFactory;
 
+- (NSString *)filenameForKey:(TDBlobKey)key withDatabase:(FMDatabase *)db;
+
+- (BOOL)createDirectoryForBlobPath:(NSString *)blobPath;
+
+- (BOOL)copyBlobAtPath:(NSString *)srcPath
+                toPath:(NSString *)dstPath
+                 error:(NSError *__autoreleasing *)outError;
+
 @end
 
 @implementation TDBlobStore
@@ -90,6 +154,14 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
     return key;
 }
 
+- (BOOL)encrypted { return _blobHandleFactory.encrypted; }
+
+- (TDSharedBlobStore *)sharedStore
+{
+    // Encrypted files are only readable with this database's key, so they can't be shared
+    return _blobHandleFactory.encrypted ? nil : _sharedStore;
+}
+
 + (NSString *)blobPathWithStorePath:(NSString *)storePath blobFilename:(NSString *)blobFilename
 {
     NSString *blobPath = nil;
@@ -101,9 +173,78 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
     return blobPath;
 }
 
+/** Creates the subdirectories of a sharded file, so it can be written or moved there. */
+- (BOOL)createDirectoryForBlobPath:(NSString *)blobPath
+{
+    NSString *directory = [blobPath stringByDeletingLastPathComponent];
+    if ([directory isEqualToString:_path]) {
+        return YES;
+    }
+
+    NSError *error = nil;
+    if (![[NSFileManager defaultManager] createDirectoryAtPath:directory
+                                   withIntermediateDirectories:YES
+                                                    attributes:nil
+                                                         error:&error]) {
+        os_log_error(CDTOSLog, "Can not create dir %{public}@: %{public}@", directory, error);
+        return NO;
+    }
+
+    return YES;
+}
+
+- (NSString *)filenameForKey:(TDBlobKey)key withDatabase:(FMDatabase *)db
+{
+    TDBlobFilenameCache *cache = self.filenameCache;
+    NSData *keyData = [NSData dataWithBytes:key.bytes length:sizeof(key.bytes)];
+    NSString *filename = [cache filenameForKey:keyData];
+    if (filename) {
+        return filename;
+    }
+
+    // Taken before the row is read, so that a removal racing with the read is noticed
+    NSUInteger generation = cache ? [cache generationForDatabase:db] : NSNotFound;
+    filename = [TD_Database filenameForKey:key inBlobFilenamesTableInDatabase:db];
+    if (filename && generation != NSNotFound) {
+        [cache setFilenames:@{keyData : filename} generation:generation];
+    }
+
+    return filename;
+}
+
+- (void)prefetchFilenamesForKeys:(NSArray<NSData *> *)keys withDatabase:(FMDatabase *)db
+{
+    TDBlobFilenameCache *cache = self.filenameCache;
+    NSUInteger generation = cache ? [cache generationForDatabase:db] : NSNotFound;
+    if (generation == NSNotFound) {
+        return;
+    }
+
+    NSMutableArray *missing = [NSMutableArray arrayWithCapacity:keys.count];
+    for (NSData *key in keys) {
+        if (![cache filenameForKey:key]) {
+            [missing addObject:key];
+        }
+    }
+    if (missing.count == 0) {
+        return;
+    }
+
+    NSDictionary *filenames =
+        [TD_Database filenamesForKeys:missing inBlobFilenamesTableInDatabase:db];
+    if (filenames) {
+        [cache setFilenames:filenames generation:generation];
+    }
+}
+
 - (id<CDTBlobReader>)blobForKey:(TDBlobKey)key withDatabase:(FMDatabase *)db
 {
-    NSString *filename = [TD_Database filenameForKey:key inBlobFilenamesTableInDatabase:db];
+    NSString *filename = [self filenameForKey:key withDatabase:db];
+    if ([TD_Database isInlineBlobFilename:filename]) {
+        NSData *data = [TD_Database inlineDataForKey:key inBlobInlineTableInDatabase:db];
+        return (data ? [[TDInlineBlobReader alloc] initWithData:data] : nil);
+    }
+
     NSString *blobPath = [TDBlobStore blobPathWithStorePath:_path blobFilename:filename];
 
     id<CDTBlobReader> reader = [_blobHandleFactory readerWithPath:blobPath];
@@ -119,7 +260,7 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
     // Search filename
     TDBlobKey thisKey = [TDBlobStore keyForBlob:blob];
 
-    NSString *filename = [TD_Database filenameForKey:thisKey inBlobFilenamesTableInDatabase:db];
+    NSString *filename = [self filenameForKey:thisKey withDatabase:db];
     if (filename) {
         os_log_debug(CDTOSLog, "Key already exists with filename %{public}@", filename);
 
@@ -130,8 +271,30 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
         return YES;
     }
 
+    if (blob.length < self.inlineThreshold) {
+        filename = [TD_Database generateAndInsertInlineFilenameBasedOnKey:thisKey
+                                                                     data:blob
+                                         intoBlobFilenamesTableInDatabase:db];
+        if (!filename) {
+            os_log_error(CDTOSLog, "Inline blob not stored: %{public}@", db.lastErrorMessage);
+
+            if (outError) {
+                *outError = [TDBlobStore errorNoFilenameGenerated];
+            }
+
+            return NO;
+        }
+
+        if (outKey) {
+            *outKey = thisKey;
+        }
+
+        return YES;
+    }
+
     // Create new if not exists
     filename = [TD_Database generateAndInsertRandomFilenameBasedOnKey:thisKey
+                                                              sharded:self.shardsFiles
                                      intoBlobFilenamesTableInDatabase:db];
     if (!filename) {
         os_log_error(CDTOSLog, "No filename generated");
@@ -149,10 +312,12 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
 
     // Save to disk
     NSError *thisError = nil;
-    if (![writer writeEntireBlobWithData:blob error:&thisError]) {
+    if (![self createDirectoryForBlobPath:blobPath] ||
+        ![writer writeEntireBlobWithData:blob error:&thisError]) {
         os_log_error(CDTOSLog, "Data not stored in %{public}@: %{public}@", blobPath, thisError);
 
         [TD_Database deleteRowForKey:thisKey inBlobFilenamesTableInDatabase:db];
+        [self.filenameCache removeAllFilenames];
 
         if (outError) {
             *outError = thisError;
@@ -161,6 +326,14 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
         return NO;
     }
 
+    if (self.sharedStore) {
+        TDMD5Key md5;
+        CC_MD5(blob.bytes, (CC_LONG)blob.length, md5.bytes);
+        NSString *md5Digest =
+            [@"md5-" stringByAppendingString:[TDBase64 encode:&md5 length:sizeof(md5)]];
+        [self.sharedStore addBlobAtPath:blobPath withKey:thisKey MD5Digest:md5Digest];
+    }
+
     // Return
     if (outKey) {
         *outKey = thisKey;
@@ -207,6 +380,8 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
         }
     }
 
+    [self.filenameCache removeAllFilenames];
+
     // Delete attachments from disk. In fact, this method will delete all the files in the folder
     // but the exception
     // NOTICE: If for some reason one of the files is not deleted and later we generate the same
@@ -218,7 +393,168 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
     return success;
 }
 
+- (NSUInteger)deleteBlobFilesNamed:(NSArray<NSString *> *)filenames
+{
+    NSFileManager *defaultManager = [NSFileManager defaultManager];
+    NSUInteger deleted = 0;
+
+    for (NSString *filename in filenames) {
+        NSString *filePath = [TDBlobStore blobPathWithStorePath:_path blobFilename:filename];
+
+        NSError *thisError = nil;
+        if ([defaultManager removeItemAtPath:filePath error:&thisError]) {
+            deleted++;
+        } else if ([defaultManager fileExistsAtPath:filePath]) {
+            os_log_error(CDTOSLog, "%{public}@: Failed to delete '%{public}@': %{public}@", self,
+                         filename, thisError);
+        }
+    }
+
+    return deleted;
+}
+
+- (BOOL)linkBlobFileNamed:(NSString *)filename toFilename:(NSString *)newFilename
+{
+    NSString *blobPath = [TDBlobStore blobPathWithStorePath:_path blobFilename:filename];
+    NSString *newPath = [TDBlobStore blobPathWithStorePath:_path blobFilename:newFilename];
+    if (![self createDirectoryForBlobPath:newPath]) {
+        return NO;
+    }
+
+    // Left by an earlier attempt that was rolled back
+    unlink(newPath.fileSystemRepresentation);
+
+    if (link(blobPath.fileSystemRepresentation, newPath.fileSystemRepresentation) != 0) {
+        if (errno == ENOENT && ![[NSFileManager defaultManager] fileExistsAtPath:blobPath]) {
+            os_log_debug(CDTOSLog, "No file %{public}@ to link to %{public}@", filename, newFilename);
+            return YES;
+        }
+        os_log_error(CDTOSLog, "%{public}@ not linked to %{public}@: %{public}s", filename,
+                     newFilename, strerror(errno));
+        return NO;
+    }
+
+    return YES;
+}
+
+- (void)changeEncryptionKeyToKeyOfProvider:(id<CDTEncryptionKeyProvider>)provider
+{
+    [_blobHandleFactory changeEncryptionKeyToKeyOfProvider:provider];
+}
+
+- (BOOL)blobNeedsRekeyingWithFilename:(NSString *)filename
+{
+    // Re-encrypted with the rest of the database
+    if ([TD_Database isInlineBlobFilename:filename]) {
+        return NO;
+    }
+
+    NSString *blobPath = [TDBlobStore blobPathWithStorePath:_path blobFilename:filename];
+
+    return [_blobHandleFactory blobNeedsRekeyingAtPath:blobPath];
+}
+
+- (NSString *)writeRekeyedCopyOfBlobWithFilename:(NSString *)filename
+                                           error:(NSError *__autoreleasing *)outError
+{
+    NSString *blobPath = [TDBlobStore blobPathWithStorePath:_path blobFilename:filename];
+    NSString *copyPath = [blobPath stringByAppendingPathExtension:kRekeyingExtension];
+
+    return ([self copyBlobAtPath:blobPath toPath:copyPath error:outError] ? copyPath : nil);
+}
+
+- (BOOL)installRekeyedCopyAtPath:(NSString *)copyPath
+                   ofBlobWithKey:(TDBlobKey)key
+                        filename:(NSString *)filename
+                    withDatabase:(FMDatabase *)db
+{
+    // The attachment may have been deleted, e.g. by a compaction, since the copy was made
+    NSString *currentFilename = [TD_Database filenameForKey:key inBlobFilenamesTableInDatabase:db];
+    if (![currentFilename isEqualToString:filename]) {
+        os_log_debug(CDTOSLog, "Attachment %{public}@ removed while re-encrypted", filename);
+
+        [[NSFileManager defaultManager] removeItemAtPath:copyPath error:NULL];
+
+        return YES;
+    }
+
+    // rename() replaces the file atomically, and leaves open handles on the old one
+    NSString *blobPath = [TDBlobStore blobPathWithStorePath:_path blobFilename:filename];
+    if (rename(copyPath.fileSystemRepresentation, blobPath.fileSystemRepresentation) != 0) {
+        os_log_error(CDTOSLog, "Re-encrypted copy not moved to %{public}@: %{public}s", blobPath,
+                     strerror(errno));
+
+        [[NSFileManager defaultManager] removeItemAtPath:copyPath error:NULL];
+
+        return NO;
+    }
+
+    return YES;
+}
+
+/** Decrypt the file at one path, and write its content to another with the current key. */
+- (BOOL)copyBlobAtPath:(NSString *)srcPath
+                toPath:(NSString *)dstPath
+                 error:(NSError *__autoreleasing *)outError
+{
+    UInt64 length = 0;
+    NSInputStream *input =
+        [[_blobHandleFactory readerWithPath:srcPath] inputStreamWithOutputLength:&length];
+    id<CDTBlobWriter> writer = [_blobHandleFactory writerWithPath:dstPath];
+    if (!input || ![writer openForWriting]) {
+        os_log_error(CDTOSLog, "Can not re-encrypt %{public}@", srcPath);
+
+        if (outError) {
+            *outError = [TDBlobStore errorRekeyFailed];
+        }
+
+        return NO;
+    }
+
+    [input open];
+    NSMutableData *buffer = [NSMutableData dataWithLength:kRekeyChunkSize];
+    UInt64 copied = 0;
+    BOOL success = YES;
+    while (success) {
+        NSInteger read = [input read:buffer.mutableBytes maxLength:buffer.length];
+        if (read <= 0) {
+            success = (read == 0);
+            break;
+        }
+
+        success = [writer appendData:[buffer subdataWithRange:NSMakeRange(0, read)]];
+        copied += read;
+    }
+    [input close];
+    [writer close];
+
+    if (!success || copied != length) {
+        os_log_error(CDTOSLog, "Re-encrypting %{public}@ failed after %llu of %llu bytes", srcPath,
+                     copied, length);
+
+        [[NSFileManager defaultManager] removeItemAtPath:dstPath error:NULL];
+
+        if (outError) {
+            *outError = [TDBlobStore errorRekeyFailed];
+        }
+
+        return NO;
+    }
+
+    return YES;
+}
+
 + (void)deleteFilesNotInSet:(NSSet*)filesToKeep fromPath:(NSString *)path
+{
+    [TDBlobStore deleteFilesNotInSet:filesToKeep fromPath:path shardPrefix:@"" depth:0];
+}
+
+/** Deletes the files of one directory of the store; `shardPrefix` is its path relative to the
+    store's directory, and `depth` the number of levels of subdirectories it's down. */
++ (void)deleteFilesNotInSet:(NSSet*)filesToKeep
+                   fromPath:(NSString *)path
+                shardPrefix:(NSString *)shardPrefix
+                      depth:(NSUInteger)depth
 {
     NSFileManager* defaultManager = [NSFileManager defaultManager];
 
@@ -232,13 +568,26 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
 
     // Delete all files but exceptions
     for (NSString* filename in currentFiles) {
-        if ([filesToKeep containsObject:filename]) {
+        NSString* shardedFilename = [shardPrefix stringByAppendingPathComponent:filename];
+        if ([filesToKeep containsObject:shardedFilename]) {
             // Do not delete file. It is an exception.
             continue;
         }
 
         NSString* filePath = [TDBlobStore blobPathWithStorePath:path blobFilename:filename];
 
+        // The subdirectories of the sharded layout are only emptied, so the files kept in them
+        // stay where they are
+        BOOL isDir = NO;
+        if (depth < 2 && [TDBlobStore isShardDirectoryName:filename] &&
+            [defaultManager fileExistsAtPath:filePath isDirectory:&isDir] && isDir) {
+            [TDBlobStore deleteFilesNotInSet:filesToKeep
+                                    fromPath:filePath
+                                 shardPrefix:shardedFilename
+                                       depth:depth + 1];
+            continue;
+        }
+
         if (![defaultManager removeItemAtPath:filePath error:&thisError]) {
             os_log_error(CDTOSLog, "%{public}@: Failed to delete '%{public}@' not related to an attachment: %{public}@", self,
                          filename, thisError);
@@ -246,6 +595,17 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
     }
 }
 
+/** YES if the name is that of a subdirectory of the sharded layout: two lowercase hex digits. */
++ (BOOL)isShardDirectoryName:(NSString *)name
+{
+    if (name.length != 2) {
+        return NO;
+    }
+    NSCharacterSet *notHex =
+        [[NSCharacterSet characterSetWithCharactersInString:@"0123456789abcdef"] invertedSet];
+    return [name rangeOfCharacterFromSet:notHex].location == NSNotFound;
+}
+
 - (NSString*)tempDir
 {
     if (!_tempDir) {
@@ -277,11 +637,23 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
                            userInfo:userInfo];
 }
 
++ (NSError *)errorRekeyFailed
+{
+    NSDictionary *userInfo = @{
+        NSLocalizedDescriptionKey :
+            NSLocalizedString(@"Attachment not re-encrypted", @"Attachment not re-encrypted")
+    };
+
+    return [NSError errorWithDomain:CDTBlobStoreErrorDomain
+                               code:CDTBlobStoreErrorRekeyFailed
+                           userInfo:userInfo];
+}
+
 @end
 
 @implementation TDBlobStoreWriter
 
-@synthesize length = _length, blobKey = _blobKey;
+@synthesize length = _length, blobKey = _blobKey, computesMD5Digest = _computesMD5Digest;
 
 - (id)initWithStore:(TDBlobStore*)store
 {
@@ -289,7 +661,10 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
     if (self) {
         _store = store;
         CC_SHA1_Init(&_shaCtx);
-        CC_SHA256_Init(&_sha256Ctx);
+        CC_MD5_Init(&_md5Ctx);
+        _computesMD5Digest = YES;
+        _writeQueue = dispatch_queue_create("com.cloudant.sync.blobstorewriter", DISPATCH_QUEUE_SERIAL);
+        _pendingWrites = dispatch_semaphore_create(kMaxPendingWrites);
 
         // Open a temporary file in the store's temporary directory:
         NSString* filename = [TDCreateUUID() stringByAppendingPathExtension:@"blobtmp"];
@@ -302,23 +677,195 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
         if (![_blobWriter openForWriting]) {
             return nil;
         }
+        // Ends when the file is closed, so it covers the whole download or copy of the blob:
+        CDTSignpostIntervalBegin(CDTSignpostIDForObject((__bridge const void*)self), "blobWrite");
+    }
+    return self;
+}
+
+- (id)initWithStore:(TDBlobStore*)store sharedBlobWithDigest:(NSString*)digest
+{
+    TDSharedBlobStore* sharedStore = store.sharedStore;
+    TDBlobKey key;
+    if (!sharedStore || ![sharedStore getKey:&key forDigest:digest]) {
+        return nil;
+    }
+
+    self = [super init];
+    if (self) {
+        _store = store;
+        _writeQueue = dispatch_queue_create("com.cloudant.sync.blobstorewriter", DISPATCH_QUEUE_SERIAL);
+        _blobKey = key;
+
+        NSString* filename = [TDCreateUUID() stringByAppendingPathExtension:@"blobtmp"];
+        NSString* tempPath = [_store.tempDir stringByAppendingPathComponent:filename];
+        if (![sharedStore linkBlobWithKey:key toPath:tempPath length:&_length]) {
+            return nil;
+        }
+        _tempPath = [tempPath copy];
+    }
+    return self;
+}
+
+- (id)initWithStore:(TDBlobStore*)store
+    copyingBlobWithKey:(TDBlobKey)key
+             fromStore:(TDBlobStore*)sourceStore
+          withDatabase:(FMDatabase*)sourceDb
+{
+    NSString* sourceFilename = [sourceStore filenameForKey:key withDatabase:sourceDb];
+    if (store.encrypted || sourceStore.encrypted || [TD_Database isInlineBlobFilename:sourceFilename]) {
+        // The file is only the same blob with the same (lack of a) key, so copy it via a reader;
+        // a blob in the other store's database has no file to link:
+        NSInputStream* input =
+            [[sourceStore blobForKey:key withDatabase:sourceDb] inputStreamWithOutputLength:NULL];
+        if (!input) {
+            return nil;
+        }
+        self = [self initWithStore:store];
+        if (!self) {
+            return nil;
+        }
+        _computesMD5Digest = NO;
+
+        [input open];
+        NSMutableData* buffer = [NSMutableData dataWithLength:kRekeyChunkSize];
+        NSInteger read;
+        while ((read = [input read:buffer.mutableBytes maxLength:buffer.length]) > 0) {
+            [self appendData:[buffer subdataWithRange:NSMakeRange(0, read)]];
+        }
+        [input close];
+        [self finish];
+        if (read < 0 || memcmp(_blobKey.bytes, key.bytes, sizeof(key.bytes)) != 0) {
+            [self cancel];
+            return nil;
+        }
+        return self;
+    }
+
+    NSFileManager* fmgr = [NSFileManager defaultManager];
+    NSString* sourcePath =
+        [TDBlobStore blobPathWithStorePath:sourceStore.path blobFilename:sourceFilename];
+    NSDictionary* attributes = sourcePath ? [fmgr attributesOfItemAtPath:sourcePath error:NULL] : nil;
+    if (!attributes) {
+        return nil;
+    }
+
+    self = [super init];
+    if (self) {
+        _store = store;
+        _writeQueue = dispatch_queue_create("com.cloudant.sync.blobstorewriter", DISPATCH_QUEUE_SERIAL);
+        _blobKey = key;
+        _length = attributes.fileSize;
+
+        NSString* filename = [TDCreateUUID() stringByAppendingPathExtension:@"blobtmp"];
+        NSString* tempPath = [_store.tempDir stringByAppendingPathComponent:filename];
+        NSError* error = nil;
+        // Hard links can't cross volumes, e.g. if the datastores are on different ones:
+        if (![fmgr linkItemAtPath:sourcePath toPath:tempPath error:NULL] &&
+            ![fmgr copyItemAtPath:sourcePath toPath:tempPath error:&error]) {
+            os_log_error(CDTOSLog, "Couldn't link blob %{public}@ to %{public}@: %{public}@",
+                         sourcePath, tempPath, error);
+            return nil;
+        }
+        _tempPath = [tempPath copy];
     }
     return self;
 }
 
+- (void)writeData:(NSData*)data
+{
+    // Bound how far the file can lag behind, so a fast download doesn't pile up in memory:
+    dispatch_semaphore_wait(_pendingWrites, DISPATCH_TIME_FOREVER);
+    id<CDTBlobWriter> blobWriter = _blobWriter;
+    dispatch_semaphore_t pendingWrites = _pendingWrites;
+    dispatch_async(_writeQueue, ^{
+        [blobWriter appendData:data];
+        dispatch_semaphore_signal(pendingWrites);
+    });
+}
+
 - (void)appendData:(NSData*)data
 {
-    [_blobWriter appendData:data];
     NSUInteger dataLen = data.length;
+    if (_store.encrypted && dataLen < kEncryptedWriteChunkSize) {
+        if (!_unwrittenData) {
+            _unwrittenData = [NSMutableData dataWithCapacity:kEncryptedWriteChunkSize];
+        }
+        [_unwrittenData appendData:data];
+        if (_unwrittenData.length >= kEncryptedWriteChunkSize) {
+            [self writeData:_unwrittenData];
+            _unwrittenData = nil;
+        }
+    } else {
+        if (_unwrittenData) {
+            [self writeData:_unwrittenData];
+            _unwrittenData = nil;
+        }
+        // The write holds on to the data until it's done, so it mustn't change underneath it:
+        [self writeData:[data copy]];
+    }
+
     _length += dataLen;
     CC_SHA1_Update(&_shaCtx, data.bytes, (CC_LONG)dataLen);
-    CC_SHA256_Update(&_sha256Ctx, data.bytes, (CC_LONG)dataLen);
+    if (_computesMD5Digest) {
+        CC_MD5_Update(&_md5Ctx, data.bytes, (CC_LONG)dataLen);
+    }
+}
+
+- (BOOL)appendBase64String:(NSString*)base64
+{
+    NSUInteger length = base64.length;
+    if (length % 4 != 0) return NO;
+
+    // Each chunk is taken from the string as it's needed, rather than converting it all at once
+    NSMutableData* encoded = [NSMutableData dataWithLength:kBase64DecodeChunkLength];
+    for (NSUInteger pos = 0; pos < length; pos += kBase64DecodeChunkLength) {
+        @autoreleasepool
+        {
+            NSRange range = NSMakeRange(pos, MIN(kBase64DecodeChunkLength, length - pos));
+            NSUInteger used;
+            if (![base64 getBytes:encoded.mutableBytes
+                        maxLength:range.length
+                       usedLength:&used
+                         encoding:NSASCIIStringEncoding
+                          options:0
+                            range:range
+                   remainingRange:NULL] ||
+                used != range.length) {
+                return NO;  // not ASCII
+            }
+            // Decoded into a buffer of its own, which the write can then hold on to uncopied
+            uint8_t* decoded = malloc(used / 4 * 3);
+            if (!decoded) return NO;
+            ssize_t decodedLength = [TDBase64 decode:encoded.bytes length:used intoBuffer:decoded];
+            if (decodedLength < 0) {
+                free(decoded);
+                return NO;
+            }
+            [self appendData:[NSData dataWithBytesNoCopy:decoded
+                                                  length:(NSUInteger)decodedLength
+                                            freeWhenDone:YES]];
+        }
+    }
+    return YES;
 }
 
 - (void)closeFile
 {
-    [_blobWriter close];
+    if (_unwrittenData && _blobWriter) {
+        [self writeData:_unwrittenData];
+    }
+    _unwrittenData = nil;
+
+    id<CDTBlobWriter> blobWriter = _blobWriter;
     _blobWriter = nil;
+    dispatch_sync(_writeQueue, ^{
+        [blobWriter close];
+    });
+    if (blobWriter) {
+        CDTSignpostIntervalEnd(CDTSignpostIDForObject((__bridge const void*)self), "blobWrite",
+                               "length=%llu", (unsigned long long)_length);
+    }
 }
 
 - (void)finish
@@ -326,15 +873,22 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
     Assert(_blobWriter, @"Already finished");
     [self closeFile];
     CC_SHA1_Final(_blobKey.bytes, &_shaCtx);
-    CC_SHA256_Final(_blobKey.bytes, &_sha256Ctx);
+    if (_computesMD5Digest) {
+        CC_MD5_Final(_MD5Digest.bytes, &_md5Ctx);
+    }
 }
 
 - (NSString*)MD5DigestString
 {
+    if (!_computesMD5Digest) {
+        return nil;
+    }
     return
         [@"md5-" stringByAppendingString:[TDBase64 encode:&_MD5Digest length:sizeof(_MD5Digest)]];
 }
 
+- (NSString*)digestString { return self.MD5DigestString ?: self.SHA1DigestString; }
+
 - (NSString*)SHA1DigestString
 {
     return [@"sha1-" stringByAppendingString:[TDBase64 encode:&_blobKey length:sizeof(_blobKey)]];
@@ -358,6 +912,10 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
         return YES;
     }
 
+    if (_length < _store.inlineThreshold) {
+        return [self installInlineWithDatabase:db];
+    }
+
     // Create if not exists
     filename = [self generateAndInsertRandomFilenameInDatabase:db];
     if (!filename) {
@@ -368,6 +926,25 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
         return NO;
     }
 
+    // The store's key was changed while the blob was written, so it's written again with the new
+    // one: the pass that re-encrypts the store's attachments may already have gone by
+    if ([_store.blobHandleFactory blobNeedsRekeyingAtPath:_tempPath]) {
+        NSString *rekeyedPath = [_tempPath stringByAppendingPathExtension:kRekeyingExtension];
+        NSError *error = nil;
+        if (![_store copyBlobAtPath:_tempPath toPath:rekeyedPath error:&error] ||
+            rename(rekeyedPath.fileSystemRepresentation, _tempPath.fileSystemRepresentation) != 0) {
+            os_log_error(CDTOSLog, "Blob not re-encrypted before install: %{public}@", error);
+
+            [[NSFileManager defaultManager] removeItemAtPath:rekeyedPath error:NULL];
+
+            [self deleteFilenameInDatabase:db];
+
+            [self cancel];
+
+            return NO;
+        }
+    }
+
     // Check there is not a file in the destination path with the same filename
     NSString *dstPath = [TDBlobStore blobPathWithStorePath:_store.path blobFilename:filename];
 
@@ -394,7 +971,8 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
     }
 
     // Move temp file to correct location in blob store:
-    if (![defaultManager moveItemAtPath:_tempPath toPath:dstPath error:&error]) {
+    if (![_store createDirectoryForBlobPath:dstPath] ||
+        ![defaultManager moveItemAtPath:_tempPath toPath:dstPath error:&error]) {
         os_log_error(CDTOSLog, "File not moved to final destination %{public}@: %{public}@", dstPath, error);
 
         [self deleteFilenameInDatabase:db];
@@ -404,14 +982,46 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
         return NO;
     }
 
+    [_store.sharedStore addBlobAtPath:dstPath withKey:_blobKey MD5Digest:self.MD5DigestString];
+
     // Return
     _tempPath = nil;
 
     return YES;
 }
 
+/** Installs the finished blob in the database, rather than moving its file into the store. */
+- (BOOL)installInlineWithDatabase:(FMDatabase *)db
+{
+    // Read back with the key it was written with, even if the store's has changed since
+    NSError *error = nil;
+    NSData *data = [[_store.blobHandleFactory readerWithPath:_tempPath] dataWithError:&error];
+    if (!data || data.length != _length) {
+        os_log_error(CDTOSLog, "Blob at %{public}@ not read to store inline: %{public}@", _tempPath,
+                     error);
+
+        [self cancel];
+
+        return NO;
+    }
+
+    NSString *filename = [TD_Database generateAndInsertInlineFilenameBasedOnKey:_blobKey
+                                                                           data:data
+                                               intoBlobFilenamesTableInDatabase:db];
+    [self cancel];  // deletes the temporary file
+
+    if (!filename) {
+        os_log_error(CDTOSLog, "Inline blob not stored: %{public}@", db.lastErrorMessage);
+
+        return NO;
+    }
+
+    return YES;
+}
+
 - (void)cancel
 {
+    _unwrittenData = nil;  // no point encrypting what's about to be deleted
     [self closeFile];
     if (_tempPath) {
         [[NSFileManager defaultManager] removeItemAtPath:_tempPath error:NULL];
@@ -429,18 +1039,21 @@ NSString *const CDTBlobStoreErrorDomain = @"CDTBlobStoreErrorDomain";
 
 - (NSString *)filenameInDatabase:(FMDatabase *)db
 {
-    return [TD_Database filenameForKey:_blobKey inBlobFilenamesTableInDatabase:db];
+    return [_store filenameForKey:_blobKey withDatabase:db];
 }
 
 - (NSString *)generateAndInsertRandomFilenameInDatabase:(FMDatabase *)db
 {
     return [TD_Database generateAndInsertRandomFilenameBasedOnKey:_blobKey
+                                                          sharded:_store.shardsFiles
                                  intoBlobFilenamesTableInDatabase:db];
 }
 
 - (BOOL)deleteFilenameInDatabase:(FMDatabase *)db
 {
-    return [TD_Database deleteRowForKey:_blobKey inBlobFilenamesTableInDatabase:db];
+    BOOL success = [TD_Database deleteRowForKey:_blobKey inBlobFilenamesTableInDatabase:db];
+    [_store.filenameCache removeAllFilenames];
+    return success;
 }
 
 @end
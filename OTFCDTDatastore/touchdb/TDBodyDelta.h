@@ -0,0 +1,53 @@
+//
+//  TDBodyDelta.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+#import "CDTDefines.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A binary diff of a stored revision body against the stored body of another revision, its base,
+ which non-current revision bodies can be stored as instead (see
+ TD_Database.storesHistoryAsDeltas).
+
+ A delta is a list of instructions building the body: copy a run of bytes from the base, or
+ insert bytes the base doesn't have. Runs are found by indexing the base in blocks of 16 bytes,
+ as git's deltas do, which finds most of what a document's edits leave unchanged.
+
+ Deltas start with a 1 byte, which neither JSON text nor binary JSON does, so they can be told
+ apart from full bodies; the base's sequence follows it.
+ */
+@interface TDBodyDelta : NSObject
+
+/** YES if the data is a delta rather than a full body. */
++ (BOOL)isDelta:(nullable NSData*)data;
+
+/** A delta building `data` from `base`, the body of the revision at `baseSequence`, or nil if it
+    wouldn't be much smaller than `data`. */
++ (nullable NSData*)deltaOfData:(NSData*)data
+                       fromBase:(NSData*)base
+                   baseSequence:(SequenceNumber)baseSequence;
+
+/** The sequence of the revision whose body the delta applies to, or 0 if it isn't a delta. */
++ (SequenceNumber)baseSequenceOfDelta:(NSData*)delta;
+
+/** The body the delta builds from its base, or nil if the delta is malformed or was made from
+    another base. */
++ (nullable NSData*)dataByApplyingDelta:(NSData*)delta toBase:(NSData*)base;
+
+@end
+
+NS_ASSUME_NONNULL_END
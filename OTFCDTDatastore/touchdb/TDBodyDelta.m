@@ -0,0 +1,192 @@
+//
+//  TDBodyDelta.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDBodyDelta.h"
+
+// Layout: the marker, then varints of the base's sequence, the base's length and the built body's
+// length, then the instructions. Each starts with a varint of (length << 1 | isCopy), followed by
+// a varint of the offset in the base to copy from, or by the bytes to insert.
+static const uint8_t kDeltaMarker = 0x01;
+
+// Runs shorter than a block aren't worth a copy instruction
+static const NSUInteger kBlockSize = 16;
+
+// A delta has to save at least a quarter of the body to be stored instead of it
+static const NSUInteger kMaxDeltaPercentage = 75;
+
+static void appendVarint(NSMutableData* output, uint64_t value)
+{
+    uint8_t buffer[10];
+    size_t length = 0;
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        buffer[length++] = value ? (byte | 0x80) : byte;
+    } while (value);
+    [output appendBytes:buffer length:length];
+}
+
+static BOOL readVarint(const uint8_t** pos, const uint8_t* end, uint64_t* outValue)
+{
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (*pos >= end) return NO;
+        uint8_t byte = *(*pos)++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *outValue = value;
+            return YES;
+        }
+    }
+    return NO;
+}
+
+static uint32_t hashBlock(const uint8_t* bytes)
+{
+    uint32_t hash = 2166136261u;  // FNV-1a
+    for (NSUInteger i = 0; i < kBlockSize; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void appendInsert(NSMutableData* output, const uint8_t* bytes, NSUInteger length)
+{
+    if (length == 0) return;
+    appendVarint(output, (uint64_t)length << 1);
+    [output appendBytes:bytes length:length];
+}
+
+static void appendCopy(NSMutableData* output, NSUInteger offset, NSUInteger length)
+{
+    appendVarint(output, (uint64_t)length << 1 | 1);
+    appendVarint(output, offset);
+}
+
+@implementation TDBodyDelta
+
++ (BOOL)isDelta:(NSData*)data
+{
+    return data.length > 1 && ((const uint8_t*)data.bytes)[0] == kDeltaMarker;
+}
+
++ (NSData*)deltaOfData:(NSData*)data fromBase:(NSData*)base baseSequence:(SequenceNumber)baseSequence
+{
+    const uint8_t* target = data.bytes;
+    const uint8_t* source = base.bytes;
+    NSUInteger targetLength = data.length, sourceLength = base.length;
+    if (sourceLength < kBlockSize || targetLength < kBlockSize || sourceLength > UINT32_MAX) {
+        return nil;
+    }
+
+    // Open addressing, keeping the first of identical blocks; a slot holds its offset + 1.
+    NSUInteger blockCount = sourceLength / kBlockSize;
+    NSUInteger slotCount = 1;
+    while (slotCount < blockCount * 2) slotCount <<= 1;
+    uint32_t* slots = calloc(slotCount, sizeof(uint32_t));
+    if (!slots) return nil;
+    for (NSUInteger block = 0; block < blockCount; block++) {
+        const uint8_t* bytes = source + block * kBlockSize;
+        NSUInteger slot = hashBlock(bytes) & (slotCount - 1);
+        while (slots[slot] && memcmp(source + slots[slot] - 1, bytes, kBlockSize) != 0) {
+            slot = (slot + 1) & (slotCount - 1);
+        }
+        if (!slots[slot]) slots[slot] = (uint32_t)(block * kBlockSize + 1);
+    }
+
+    NSMutableData* delta = [NSMutableData dataWithCapacity:targetLength / 4];
+    [delta appendBytes:&kDeltaMarker length:1];
+    appendVarint(delta, (uint64_t)baseSequence);
+    appendVarint(delta, sourceLength);
+    appendVarint(delta, targetLength);
+
+    NSUInteger maxLength = targetLength * kMaxDeltaPercentage / 100;
+    NSUInteger pos = 0, insertStart = 0;
+    while (pos + kBlockSize <= targetLength && delta.length < maxLength) {
+        NSUInteger slot = hashBlock(target + pos) & (slotCount - 1);
+        while (slots[slot] && memcmp(source + slots[slot] - 1, target + pos, kBlockSize) != 0) {
+            slot = (slot + 1) & (slotCount - 1);
+        }
+        if (!slots[slot]) {
+            pos++;
+            continue;
+        }
+
+        // Grow the match both ways: forwards as far as the bytes agree, and backwards over what
+        // would otherwise be inserted.
+        NSUInteger offset = slots[slot] - 1, length = kBlockSize;
+        while (pos + length < targetLength && offset + length < sourceLength &&
+               target[pos + length] == source[offset + length]) {
+            length++;
+        }
+        while (pos > insertStart && offset > 0 && target[pos - 1] == source[offset - 1]) {
+            pos--;
+            offset--;
+            length++;
+        }
+        appendInsert(delta, target + insertStart, pos - insertStart);
+        appendCopy(delta, offset, length);
+        pos += length;
+        insertStart = pos;
+    }
+    free(slots);
+    appendInsert(delta, target + insertStart, targetLength - insertStart);
+
+    return delta.length < maxLength ? delta : nil;
+}
+
++ (SequenceNumber)baseSequenceOfDelta:(NSData*)delta
+{
+    if (![self isDelta:delta]) return 0;
+    const uint8_t* pos = (const uint8_t*)delta.bytes + 1;
+    uint64_t sequence;
+    if (!readVarint(&pos, (const uint8_t*)delta.bytes + delta.length, &sequence)) return 0;
+    return (SequenceNumber)sequence;
+}
+
++ (NSData*)dataByApplyingDelta:(NSData*)delta toBase:(NSData*)base
+{
+    if (![self isDelta:delta]) return nil;
+    const uint8_t* pos = (const uint8_t*)delta.bytes + 1;
+    const uint8_t* end = (const uint8_t*)delta.bytes + delta.length;
+    uint64_t sequence, sourceLength, targetLength;
+    if (!readVarint(&pos, end, &sequence) || !readVarint(&pos, end, &sourceLength) ||
+        !readVarint(&pos, end, &targetLength) || sourceLength != base.length) {
+        return nil;
+    }
+
+    const uint8_t* source = base.bytes;
+    NSMutableData* output = [NSMutableData dataWithCapacity:(NSUInteger)targetLength];
+    while (pos < end) {
+        uint64_t instruction;
+        if (!readVarint(&pos, end, &instruction)) return nil;
+        uint64_t length = instruction >> 1;
+        if (output.length + length > targetLength) return nil;
+        if (instruction & 1) {
+            uint64_t offset;
+            if (!readVarint(&pos, end, &offset) || offset > sourceLength ||
+                length > sourceLength - offset) {
+                return nil;
+            }
+            [output appendBytes:source + offset length:(NSUInteger)length];
+        } else {
+            if (length > (uint64_t)(end - pos)) return nil;
+            [output appendBytes:pos length:(NSUInteger)length];
+            pos += length;
+        }
+    }
+    return output.length == targetLength ? output : nil;
+}
+
+@end
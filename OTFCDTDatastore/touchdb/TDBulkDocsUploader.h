@@ -0,0 +1,47 @@
+//
+//  TDBulkDocsUploader.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDRemoteRequest.h"
+
+@class TDBase64InputStream;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A _bulk_docs POST whose body is streamed rather than built in memory. Attachments marked
+ "follows" are inlined as base64 "data" read from the blob store as the body is sent, so a batch
+ of documents with large attachments can be pushed in one request. The documents are sent with
+ "new_edits":false. The completion block's result is the parsed _bulk_docs response.
+ */
+@interface TDBulkDocsUploader : TDRemoteJSONRequest
+
+- (instancetype)initWithSession:(CDTURLSession *)session
+                            URL:(NSURL *)url
+                 requestHeaders:(nullable NSDictionary *)requestHeaders
+                   onCompletion:(TDRemoteRequestCompletionBlock)onCompletion;
+
+/** Appends a document to the request, which must not have been started.
+    @param properties  The document, in the form _bulk_docs expects.
+    @param streams  The contents of the document's "follows" attachments, keyed by name. */
+- (void)addDocument:(NSDictionary *)properties
+    followingAttachments:(NSDictionary<NSString *, TDBase64InputStream *> *)streams;
+
+@property (readonly) NSUInteger documentCount;
+
+/** The length of the request body so far. */
+@property (readonly) SInt64 length;
+
+@end
+
+NS_ASSUME_NONNULL_END
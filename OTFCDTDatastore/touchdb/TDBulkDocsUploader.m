@@ -0,0 +1,129 @@
+//
+//  TDBulkDocsUploader.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDBulkDocsUploader.h"
+
+#import "CDTLogging.h"
+#import "CollectionUtils.h"
+#import "TDBase64InputStream.h"
+#import "TDJSON.h"
+#import "TDMisc.h"
+#import "TDMultiStreamWriter.h"
+#import "Test.h"
+
+@implementation TDBulkDocsUploader {
+    TDMultiStreamWriter *_writer;
+    NSString *_placeholderPrefix;
+    NSUInteger _placeholderCount;
+    BOOL _bodyFinished;
+}
+
+- (instancetype)initWithSession:(CDTURLSession *)session
+                            URL:(NSURL *)url
+                 requestHeaders:(NSDictionary *)requestHeaders
+                   onCompletion:(TDRemoteRequestCompletionBlock)onCompletion
+{
+    self = [super initWithSession:session
+                           method:@"POST"
+                              URL:url
+                             body:nil
+                   requestHeaders:requestHeaders
+                     onCompletion:onCompletion];
+    if (self) {
+        _writer = [[TDMultiStreamWriter alloc] init];
+        [_writer addData:[@"{\"new_edits\":false,\"docs\":[" dataUsingEncoding:NSUTF8StringEncoding]];
+        // Attachment data is written as a placeholder string first; it can't appear anywhere else.
+        _placeholderPrefix = [TDCreateUUID() stringByReplacingOccurrencesOfString:@"-" withString:@""];
+        [_request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+    }
+    return self;
+}
+
+- (SInt64)length { return _writer.length; }
+
+- (void)addDocument:(NSDictionary *)properties
+    followingAttachments:(NSDictionary<NSString *, TDBase64InputStream *> *)streams
+{
+    Assert(!_bodyFinished, @"Can't add a document to a started request");
+
+    NSMutableDictionary *doc = [properties mutableCopy];
+    NSMutableDictionary *attachments = [properties[@"_attachments"] mutableCopy];
+    NSMutableDictionary<NSString *, TDBase64InputStream *> *placeholders = $mdict();
+    for (NSString *name in streams) {
+        NSMutableDictionary *attachment = [attachments[name] mutableCopy];
+        [attachment removeObjectForKey:@"follows"];
+        NSString *placeholder = $sprintf(@"%@%lu", _placeholderPrefix, (unsigned long)_placeholderCount++);
+        attachment[@"data"] = placeholder;
+        attachments[name] = attachment;
+        placeholders[placeholder] = streams[name];
+    }
+    if (attachments) doc[@"_attachments"] = attachments;
+    NSData *json = [TDJSON dataWithJSONObject:doc options:0 error:NULL];
+
+    // Find where each placeholder ended up, and splice its stream in there instead:
+    NSMutableArray<NSValue *> *ranges = [NSMutableArray arrayWithCapacity:placeholders.count];
+    NSMutableDictionary<NSValue *, TDBase64InputStream *> *streamsByRange = $mdict();
+    for (NSString *placeholder in placeholders) {
+        NSRange range = [json rangeOfData:[placeholder dataUsingEncoding:NSUTF8StringEncoding]
+                                  options:0
+                                    range:NSMakeRange(0, json.length)];
+        Assert(range.location != NSNotFound);
+        NSValue *key = [NSValue valueWithRange:range];
+        [ranges addObject:key];
+        streamsByRange[key] = placeholders[placeholder];
+    }
+    [ranges sortUsingComparator:^NSComparisonResult(NSValue *a, NSValue *b) {
+        NSUInteger la = a.rangeValue.location, lb = b.rangeValue.location;
+        return la < lb ? NSOrderedAscending : (la > lb ? NSOrderedDescending : NSOrderedSame);
+    }];
+
+    if (_documentCount > 0) [_writer addData:[@"," dataUsingEncoding:NSUTF8StringEncoding]];
+    NSUInteger pos = 0;
+    for (NSValue *key in ranges) {
+        NSRange range = key.rangeValue;
+        TDBase64InputStream *stream = streamsByRange[key];
+        [_writer addData:[json subdataWithRange:NSMakeRange(pos, range.location - pos)]];
+        [_writer addStream:stream length:stream.length];
+        pos = NSMaxRange(range);
+    }
+    [_writer addData:[json subdataWithRange:NSMakeRange(pos, json.length - pos)]];
+    _documentCount++;
+}
+
+- (void)start
+{
+    if (!_bodyFinished) {
+        _bodyFinished = YES;
+        [_writer addData:[@"]}" dataUsingEncoding:NSUTF8StringEncoding]];
+        // As for TDMultipartUploader, give the length so the body isn't sent chunked.
+        [_request setValue:$sprintf(@"%lld", _writer.length) forHTTPHeaderField:@"Content-Length"];
+    }
+    // Retries start over from the beginning of the body:
+    [_writer close];
+    _request.HTTPBodyStream = [_writer openForInputStream];
+    [super start];
+}
+
+- (void)requestDidError:(NSError *)error
+{
+    if ($equal(error.domain, NSURLErrorDomain) &&
+        error.code == NSURLErrorRequestBodyStreamExhausted) {
+        // Report why reading an attachment failed, if it did:
+        NSError *writerError = _writer.error;
+        if (writerError) error = writerError;
+    }
+    [super requestDidError:error];
+}
+
+@end
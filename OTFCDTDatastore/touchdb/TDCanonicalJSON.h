@@ -34,10 +34,17 @@
 /** Canonical form of UTF-8 encoded JSON data from the input object tree. */
 @property (readonly) NSData* canonicalData;
 
+/** The same as .canonicalData, but always generated by the original, much slower, Objective-C
+    encoder rather than the byte-level one. Only for checking that the two agree. */
+@property (readonly) NSData* slowCanonicalData;
+
 /** Convenience method that instantiates a TDCanonicalJSON object and uses it to encode the object.
  */
 + (NSData*)canonicalData:(id)rootObject;
 
+/** Convenience method for .slowCanonicalData. */
++ (NSData*)slowCanonicalData:(id)rootObject;
+
 /** Convenience method that instantiates a TDCanonicalJSON object and uses it to encode the object,
  * returning a string. */
 + (NSString*)canonicalString:(id)rootObject;
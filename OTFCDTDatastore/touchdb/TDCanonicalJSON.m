@@ -23,6 +23,358 @@
 - (void)encode:(id)object;
 @end
 
+static NSComparisonResult compareCanonStrings(id s1, id s2, void* context);
+
+#pragma mark - FAST ENCODER
+
+// The fast encoder writes UTF-8 straight into a byte buffer. It produces exactly the same bytes as
+// the Objective-C encoder below, which it falls back to for anything it doesn't handle (an object
+// of a type JSON can't represent, or a string with an unpaired surrogate), so that those cases
+// behave just as they always have.
+
+typedef struct {
+    uint8_t* bytes;
+    size_t length;
+    size_t capacity;
+} TDCanonicalBuffer;
+
+typedef struct {
+    TDCanonicalBuffer* output;
+    TDCanonicalBuffer* scratch;  // UTF-8 of dictionary keys being sorted; used as a stack
+    __unsafe_unretained NSString* ignoreKeyPrefix;
+    __unsafe_unretained NSArray* whitelistedKeys;
+} TDCanonicalEncoder;
+
+typedef struct {
+    const void* key;
+    const void* value;
+    size_t offset;  // of the key's UTF-8 in the scratch buffer
+    size_t length;
+    const uint8_t* bytes;  // set once all the keys are in the scratch buffer
+} TDCanonicalEntry;
+
+// The buffers are kept for the next call on the same thread, unless they grew unusually large:
+#define kMaxRetainedBufferSize (256 * 1024)
+
+// Dictionaries with up to this many keys sort them on the stack:
+#define kMaxStackEntries 32
+
+static _Thread_local TDCanonicalBuffer sOutputBuffer, sScratchBuffer;
+
+static bool reserve(TDCanonicalBuffer* buf, size_t extra)
+{
+    if (buf->length + extra <= buf->capacity) return true;
+    size_t capacity = MAX(MAX(buf->capacity * 2, buf->length + extra), (size_t)1024);
+    uint8_t* bytes = realloc(buf->bytes, capacity);
+    if (!bytes) return false;
+    buf->bytes = bytes;
+    buf->capacity = capacity;
+    return true;
+}
+
+static inline bool append(TDCanonicalBuffer* buf, const void* bytes, size_t length)
+{
+    if (!reserve(buf, length)) return false;
+    memcpy(buf->bytes + buf->length, bytes, length);
+    buf->length += length;
+    return true;
+}
+
+#define appendLiteral(BUF, STR) append((BUF), (STR), sizeof(STR) - 1)
+
+static void trimBuffer(TDCanonicalBuffer* buf)
+{
+    if (buf->capacity > kMaxRetainedBufferSize) {
+        free(buf->bytes);
+        buf->bytes = NULL;
+        buf->capacity = 0;
+    }
+    buf->length = 0;
+}
+
+// Appends a string's UTF-8, unescaped, returning its length in bytes. Fails if the string has an
+// unpaired surrogate, which can't be represented in UTF-8.
+static bool appendUTF8(TDCanonicalBuffer* buf, NSString* str, size_t* outLength)
+{
+    NSUInteger nChars = str.length;
+    *outLength = 0;
+    if (nChars == 0) return true;
+    size_t maxLength = nChars * 3;
+    if (!reserve(buf, maxLength)) return false;
+    NSUInteger used = 0;
+    NSRange remaining;
+    BOOL ok = [str getBytes:buf->bytes + buf->length
+                  maxLength:maxLength
+                 usedLength:&used
+                   encoding:NSUTF8StringEncoding
+                    options:0
+                      range:NSMakeRange(0, nChars)
+             remainingRange:&remaining];
+    if (!ok || remaining.length > 0) return false;
+    buf->length += used;
+    *outLength = used;
+    return true;
+}
+
+// Returns the offset of the first byte that has to be escaped: a control character, '"' or '\\'.
+// Eight bytes are tested at once; UTF-8 multi-byte sequences never match, since all their bytes
+// have the top bit set.
+static size_t findEscape(const uint8_t* bytes, size_t length)
+{
+    static const uint64_t kOnes = 0x0101010101010101ull, kHighBits = 0x8080808080808080ull;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        uint64_t control = (word - kOnes * 0x20) & ~word;
+        uint64_t quote = word ^ (kOnes * '"');
+        quote = (quote - kOnes) & ~quote;
+        uint64_t backslash = word ^ (kOnes * '\\');
+        backslash = (backslash - kOnes) & ~backslash;
+        if ((control | quote | backslash) & kHighBits) break;
+    }
+    for (; i < length; i++) {
+        uint8_t c = bytes[i];
+        if (c < 0x20 || c == '"' || c == '\\') return i;
+    }
+    return length;
+}
+
+static bool isASCII(const uint8_t* bytes, size_t length)
+{
+    size_t i = 0;
+    uint64_t bits = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        bits |= word;
+    }
+    for (; i < length; i++) bits |= bytes[i];
+    return (bits & 0x8080808080808080ull) == 0;
+}
+
+// Appends the bytes of a string, escaped as -encodeString: does, without the quotes.
+static bool appendEscaped(TDCanonicalBuffer* buf, const uint8_t* bytes, size_t length)
+{
+    while (length > 0) {
+        size_t n = findEscape(bytes, length);
+        if (!append(buf, bytes, n)) return false;
+        if (n == length) break;
+        bool ok;
+        switch (bytes[n]) {
+            case '"':
+                ok = appendLiteral(buf, "\\\"");
+                break;
+            case '\\':
+                ok = appendLiteral(buf, "\\\\");
+                break;
+            case '\r':
+                ok = appendLiteral(buf, "\\r");
+                break;
+            case '\n':
+                ok = appendLiteral(buf, "\\n");
+                break;
+            default: {
+                char escaped[7];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", bytes[n]);
+                ok = append(buf, escaped, 6);
+                break;
+            }
+        }
+        if (!ok) return false;
+        bytes += n + 1;
+        length -= n + 1;
+    }
+    return true;
+}
+
+static bool encodeFastString(TDCanonicalEncoder* encoder, NSString* str)
+{
+    TDCanonicalBuffer* output = encoder->output;
+    if (!appendLiteral(output, "\"")) return false;
+    size_t start = output->length, length;
+    if (!appendUTF8(output, str, &length)) return false;
+    size_t escape = findEscape(output->bytes + start, length);
+    if (escape < length) {
+        // Move the rest out of the way and write it again, escaped:
+        TDCanonicalBuffer* scratch = encoder->scratch;
+        size_t scratchStart = scratch->length;
+        if (!append(scratch, output->bytes + start + escape, length - escape)) return false;
+        output->length = start + escape;
+        bool ok = appendEscaped(output, scratch->bytes + scratchStart, length - escape);
+        scratch->length = scratchStart;
+        if (!ok) return false;
+    }
+    return appendLiteral(output, "\"");
+}
+
+static bool encodeFastNumber(TDCanonicalEncoder* encoder, NSNumber* number)
+{
+    // Integers are formatted here, the same as -stringValue does; anything else is left to it.
+    char digits[24];
+    int length;
+    switch (number.objCType[0]) {
+        case 'c':
+            return number.boolValue ? appendLiteral(encoder->output, "true")
+                                    : appendLiteral(encoder->output, "false");
+        case 'C':
+        case 's':
+        case 'S':
+        case 'i':
+        case 'I':
+        case 'l':
+        case 'L':
+        case 'q':
+            length = snprintf(digits, sizeof(digits), "%lld", number.longLongValue);
+            return append(encoder->output, digits, length);
+        case 'Q':
+            length = snprintf(digits, sizeof(digits), "%llu", number.unsignedLongLongValue);
+            return append(encoder->output, digits, length);
+        default: {
+            size_t ignored;
+            return appendUTF8(encoder->output, number.stringValue, &ignored);
+        }
+    }
+}
+
+static bool encodeFastObject(TDCanonicalEncoder* encoder, id object);
+
+static bool encodeFastArray(TDCanonicalEncoder* encoder, NSArray* array)
+{
+    if (!appendLiteral(encoder->output, "[")) return false;
+    BOOL first = YES;
+    for (id item in array) {
+        if (first)
+            first = NO;
+        else if (!appendLiteral(encoder->output, ","))
+            return false;
+        if (!encodeFastObject(encoder, item)) return false;
+    }
+    return appendLiteral(encoder->output, "]");
+}
+
+static int compareASCIIEntries(const void* a, const void* b)
+{
+    const TDCanonicalEntry* e1 = a;
+    const TDCanonicalEntry* e2 = b;
+    int result = memcmp(e1->bytes, e2->bytes, MIN(e1->length, e2->length));
+    if (result == 0) result = (e1->length > e2->length) - (e1->length < e2->length);
+    return result;
+}
+
+static int compareEntries(const void* a, const void* b)
+{
+    const TDCanonicalEntry* e1 = a;
+    const TDCanonicalEntry* e2 = b;
+    return (int)compareCanonStrings((__bridge id)e1->key, (__bridge id)e2->key, NULL);
+}
+
+static bool encodeFastDictionaryEntries(TDCanonicalEncoder* encoder, TDCanonicalEntry* entries,
+                                        CFIndex count)
+{
+    TDCanonicalBuffer* scratch = encoder->scratch;
+    CFIndex nEntries = 0;
+    bool allASCII = true;
+    for (CFIndex i = 0; i < count; i++) {
+        NSString* key = (__bridge NSString*)entries[i].key;
+        if (![key isKindOfClass:[NSString class]]) return false;
+        if (encoder->ignoreKeyPrefix && [key hasPrefix:encoder->ignoreKeyPrefix] &&
+            ![encoder->whitelistedKeys containsObject:key])
+            continue;
+        TDCanonicalEntry* entry = &entries[nEntries++];
+        *entry = entries[i];
+        entry->offset = scratch->length;
+        if (!appendUTF8(scratch, key, &entry->length)) return false;
+        allASCII = allASCII && isASCII(scratch->bytes + entry->offset, entry->length);
+    }
+
+    // Byte order is the same as NSLiteralSearch's UTF-16 order for ASCII, but not beyond:
+    for (CFIndex i = 0; i < nEntries; i++) entries[i].bytes = scratch->bytes + entries[i].offset;
+    qsort(entries, nEntries, sizeof(TDCanonicalEntry),
+          allASCII ? compareASCIIEntries : compareEntries);
+
+    TDCanonicalBuffer* output = encoder->output;
+    for (CFIndex i = 0; i < nEntries; i++) {
+        if (i > 0 && !appendLiteral(output, ",")) return false;
+        // The scratch buffer may move as values are encoded, so the key is found by its offset:
+        if (!appendLiteral(output, "\"") ||
+            !appendEscaped(output, scratch->bytes + entries[i].offset, entries[i].length) ||
+            !appendLiteral(output, "\":") ||
+            !encodeFastObject(encoder, (__bridge id)entries[i].value))
+            return false;
+    }
+    return true;
+}
+
+static bool encodeFastDictionary(TDCanonicalEncoder* encoder, NSDictionary* dict)
+{
+    CFIndex count = CFDictionaryGetCount((__bridge CFDictionaryRef)dict);
+    const void* stackKeys[kMaxStackEntries];
+    const void* stackValues[kMaxStackEntries];
+    TDCanonicalEntry stackEntries[kMaxStackEntries];
+    const void** keys = stackKeys;
+    const void** values = stackValues;
+    TDCanonicalEntry* entries = stackEntries;
+    if (count > kMaxStackEntries) {
+        keys = malloc(count * sizeof(const void*));
+        values = malloc(count * sizeof(const void*));
+        entries = malloc(count * sizeof(TDCanonicalEntry));
+    }
+
+    bool ok = keys && values && entries;
+    if (ok) {
+        CFDictionaryGetKeysAndValues((__bridge CFDictionaryRef)dict, keys, values);
+        for (CFIndex i = 0; i < count; i++) {
+            entries[i].key = keys[i];
+            entries[i].value = values[i];
+        }
+        size_t scratchStart = encoder->scratch->length;
+        ok = appendLiteral(encoder->output, "{") &&
+             encodeFastDictionaryEntries(encoder, entries, count) &&
+             appendLiteral(encoder->output, "}");
+        encoder->scratch->length = scratchStart;
+    }
+
+    if (count > kMaxStackEntries) {
+        free(keys);
+        free(values);
+        free(entries);
+    }
+    return ok;
+}
+
+static bool encodeFastObject(TDCanonicalEncoder* encoder, id object)
+{
+    if ([object isKindOfClass:[NSString class]]) {
+        return encodeFastString(encoder, object);
+    } else if ([object isKindOfClass:[NSNumber class]]) {
+        return encodeFastNumber(encoder, object);
+    } else if ([object isKindOfClass:[NSNull class]]) {
+        return appendLiteral(encoder->output, "null");
+    } else if ([object isKindOfClass:[NSDictionary class]]) {
+        return encodeFastDictionary(encoder, object);
+    } else if ([object isKindOfClass:[NSArray class]]) {
+        return encodeFastArray(encoder, object);
+    }
+    return false;
+}
+
+// Returns nil if the object has to go through the Objective-C encoder instead.
+static NSData* fastCanonicalData(id object, NSString* ignoreKeyPrefix, NSArray* whitelistedKeys)
+{
+    TDCanonicalEncoder encoder = {&sOutputBuffer, &sScratchBuffer, ignoreKeyPrefix,
+                                  whitelistedKeys};
+    sOutputBuffer.length = sScratchBuffer.length = 0;
+    NSData* result = nil;
+    if (encodeFastObject(&encoder, object))
+        result = [NSData dataWithBytes:sOutputBuffer.bytes length:sOutputBuffer.length];
+    trimBuffer(&sOutputBuffer);
+    trimBuffer(&sScratchBuffer);
+    return result;
+}
+
+#pragma mark - ENCODER
+
 @implementation TDCanonicalJSON
 
 - (id)initWithObject:(id)object
@@ -178,11 +530,20 @@ static NSComparisonResult compareCanonStrings(id s1, id s2, void* context)
 
 - (NSString*)canonicalString
 {
+    NSData* data = fastCanonicalData(_input, _ignoreKeyPrefix, _whitelistedKeys);
+    if (data) return [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
     [self encode];
     return [_output copy];
 }
 
 - (NSData*)canonicalData
+{
+    NSData* data = fastCanonicalData(_input, _ignoreKeyPrefix, _whitelistedKeys);
+    if (data) return data;
+    return self.slowCanonicalData;
+}
+
+- (NSData*)slowCanonicalData
 {
     [self encode];
     return [_output dataUsingEncoding:NSUTF8StringEncoding];
@@ -195,6 +556,11 @@ static NSComparisonResult compareCanonStrings(id s1, id s2, void* context)
     return result;
 }
 
++ (NSData*)slowCanonicalData:(id)rootObject
+{
+    return [[self alloc] initWithObject:rootObject].slowCanonicalData;
+}
+
 + (NSData*)canonicalData:(id)rootObject
 {
     TDCanonicalJSON* encoder = [[self alloc] initWithObject:rootObject];
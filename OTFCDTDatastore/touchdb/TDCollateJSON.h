@@ -20,6 +20,13 @@ int TDCollateJSON(void *context, int len1, const void *chars1, int len2, const v
 int TDCollateJSONLimited(void *context, int len1, const void *chars1, int len2, const void *chars2,
                          unsigned arrayLimit);
 
+/** Encodes a JSON value as bytes whose memcmp order is the order TDCollateJSON gives it in the
+    same mode, so that a view can index it as a BLOB instead of calling back into the collator.
+    Only the Raw and ASCII modes can be encoded this way; returns nil for kTDCollateJSON_Unicode,
+    whose string order depends on the current locale, or if the JSON can't be parsed.
+    The first byte of the key identifies the mode it was encoded in. */
+NSData *TDCollateJSONSortKey(void *context, int len, const void *chars);
+
 // CouchDB's default collation rules, including Unicode collation for strings
 #define kTDCollateJSON_Unicode ((void *)0)
 
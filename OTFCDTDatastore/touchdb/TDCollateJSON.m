@@ -216,6 +216,75 @@ static double readNumber(const char* start, const char* end, char** endOfNumber)
     return result;
 }
 
+// Returns the length of the byte-identical prefix of the first n bytes of a and b, comparing a
+// machine word at a time:
+static size_t commonPrefixLength(const char* a, const char* b, size_t n)
+{
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+        uint64_t wa, wb;
+        memcpy(&wa, a + i, sizeof(wa));
+        memcpy(&wb, b + i, sizeof(wb));
+        uint64_t diff = wa ^ wb;
+        if (diff) {
+#if __LITTLE_ENDIAN__
+            return i + (__builtin_ctzll(diff) >> 3);
+#else
+            return i + (__builtin_clzll(diff) >> 3);
+#endif
+        }
+    }
+    while (i < n && a[i] == b[i]) ++i;
+    return i;
+}
+
+// Scans a prefix both inputs share and finds the last position past it where a token starts,
+// along with the depth and array index the collator would have reached there. Tokens before that
+// point are byte-identical, so they collate equal in every mode and needn't be parsed again.
+// Returns NO if the shared tokens already decide the comparison (as equal).
+static BOOL skipCommonPrefix(const char* str, size_t prefixLength, unsigned arrayLimit,
+                             size_t* outOffset, int* outDepth, unsigned* outArrayIndex)
+{
+    int depth = 0;
+    unsigned arrayIndex = 0;
+    BOOL inString = NO;
+    for (size_t i = 0; i < prefixLength; ++i) {
+        char c = str[i];
+        if (inString) {
+            if (c == '\\')
+                ++i;
+            else if (c == '"')
+                inString = NO;
+            continue;
+        }
+        switch (c) {
+            case '"':
+                inString = YES;
+                continue;
+            case '[':
+            case '{':
+                ++depth;
+                break;
+            case ']':
+            case '}':
+                if (depth == 1 && (++arrayIndex >= arrayLimit)) return NO;
+                if (--depth <= 0) return NO;
+                break;
+            case ',':
+                if (depth == 1 && (++arrayIndex >= arrayLimit)) return NO;
+                break;
+            case ':':
+                break;
+            default:
+                continue;
+        }
+        *outOffset = i + 1;
+        *outDepth = depth;
+        *outArrayIndex = arrayIndex;
+    }
+    return YES;
+}
+
 int TDCollateJSONLimited(void* context, int len1, const void* chars1, int len2, const void* chars2,
                          unsigned arrayLimit)
 {
@@ -224,6 +293,15 @@ int TDCollateJSONLimited(void* context, int len1, const void* chars1, int len2,
     int depth = 0;
     unsigned arrayIndex = 0;
 
+    // Keys in an index tend to share long prefixes, so skip past the tokens the two have in common
+    // before parsing anything:
+    size_t prefixLength = commonPrefixLength(str1, str2, (size_t)MIN(len1, len2));
+    if (prefixLength == (size_t)len1 && len1 == len2) return 0;
+    size_t offset = 0;
+    if (!skipCommonPrefix(str1, prefixLength, arrayLimit, &offset, &depth, &arrayIndex)) return 0;
+    str1 += offset;
+    str2 += offset;
+
     do {
         // Get the types of the next token in each string:
         ValueType type1 = valueTypeOf(*str1);
@@ -307,3 +385,105 @@ int TDCollateJSON(void* context, int len1, const void* chars1, int len2, const v
 {
     return TDCollateJSONLimited(context, len1, chars1, len2, chars2, UINT_MAX);
 }
+
+#pragma mark - SORT KEYS:
+
+static void appendSortKeyByte(NSMutableData* key, uint8_t byte) { [key appendBytes:&byte length:1]; }
+
+static uint8_t sortKeyTypeByte(void* context, ValueType type)
+{
+    // Every type byte is above the 0x00 that terminates a string:
+    if (context == kTDCollateJSON_Raw)
+        return (uint8_t)(kRawOrderOfValueType[type] + 5);
+    else
+        return (uint8_t)(type + 1);
+}
+
+static BOOL appendSortKeyNumber(NSMutableData* key, double n)
+{
+    if (n != n) return NO;  // NaN doesn't collate consistently with anything
+    if (n == 0.0) n = 0.0;  // -0 and 0 collate equal
+    // Flip the sign bit of positive numbers and every bit of negative ones, so that the big-endian
+    // bytes of the IEEE 754 representation sort in numeric order:
+    uint64_t bits;
+    memcpy(&bits, &n, sizeof(bits));
+    bits = (bits & (1ull << 63)) ? ~bits : (bits | (1ull << 63));
+    uint8_t bytes[sizeof(bits)];
+    for (unsigned i = 0; i < sizeof(bits); ++i) bytes[i] = (uint8_t)(bits >> (56 - 8 * i));
+    [key appendBytes:bytes length:sizeof(bytes)];
+    return YES;
+}
+
+static void appendSortKeyString(NSMutableData* key, const char** in)
+{
+    const char* str = *in;
+    while (true) {
+        char c = *++str;
+        if (c == '"') break;
+        if (c == '\\') c = convertEscape(&str);
+        // compareStringsASCII compares (possibly signed) chars, so map them onto unsigned bytes in
+        // the same order, then escape 0x00 and 0x01 so that 0x00 can end the string:
+        uint8_t b = (uint8_t)c;
+        if (CHAR_MIN < 0) b ^= 0x80;
+        if (b <= 0x01) {
+            appendSortKeyByte(key, 0x01);
+            ++b;
+        }
+        appendSortKeyByte(key, b);
+    }
+    appendSortKeyByte(key, 0x00);
+    *in = str + 1;
+}
+
+NSData* TDCollateJSONSortKey(void* context, int len, const void* chars)
+{
+    if (context != kTDCollateJSON_Raw && context != kTDCollateJSON_ASCII) return nil;
+
+    const char* str = chars;
+    const char* end = str + len;
+    NSMutableData* key = [NSMutableData dataWithCapacity:len + 8];
+    appendSortKeyByte(key, (uint8_t)(uintptr_t)context);
+    int depth = 0;
+
+    do {
+        if (str >= end) return nil;
+        ValueType type = valueTypeOf(*str);
+        if (type != kComma && type != kColon) appendSortKeyByte(key, sortKeyTypeByte(context, type));
+        switch (type) {
+            case kNull:
+            case kTrue:
+                str += 4;
+                break;
+            case kFalse:
+                str += 5;
+                break;
+            case kNumber: {
+                char* next;
+                double n = (depth == 0) ? readNumber(str, end, &next) : strtod(str, &next);
+                if (next == str || !appendSortKeyNumber(key, n)) return nil;
+                str = next;
+                break;
+            }
+            case kString:
+                appendSortKeyString(key, &str);
+                break;
+            case kArray:
+            case kObject:
+                ++str;
+                ++depth;
+                break;
+            case kEndArray:
+            case kEndObject:
+                ++str;
+                --depth;
+                break;
+            case kComma:
+            case kColon:
+                ++str;
+                break;
+            case kIllegal:
+                return nil;
+        }
+    } while (depth > 0);
+    return key;
+}
@@ -0,0 +1,65 @@
+//
+//  TDDatabaseQueue.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <fmdb/FMDatabaseQueue.h>
+
+@class CDTQueueTelemetry, CDTSlowOperationLog, TDProcessChangeNotifier, TDWALCheckpointer;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ An FMDatabaseQueue which keeps count of the transactions run through -inTransaction: and
+ -inDeferredTransaction:, and of how long they took. A transaction is timed from when its block
+ starts running, so time spent waiting for the queue isn't included, to when it has been
+ committed or rolled back.
+
+ The counters are safe to read from any thread.
+ */
+@interface TDDatabaseQueue : FMDatabaseQueue
+
+@property (readonly) NSUInteger transactionCount;
+@property (readonly) NSUInteger rolledBackTransactionCount;
+@property (readonly) NSTimeInterval totalTransactionTime;
+@property (readonly) NSTimeInterval maxTransactionTime;
+
+/** As -inTransaction:, but returns whether the transaction was committed: NO if the block set
+    `rollback`, or if the commit itself failed (when the disk is full, say), in which case the
+    transaction is rolled back. FMDatabaseQueue's own methods don't report failed commits. */
+- (BOOL)inCheckedTransaction:(void (^)(FMDatabase *db, BOOL *rollback))block;
+
+/** As -inCheckedTransaction:, but with foreign key constraints not enforced while the block runs.
+    SQLite ignores changes to the foreign_keys setting inside a transaction, so the block can't
+    turn them off itself. */
+- (BOOL)inTransactionWithoutForeignKeyChecks:(void (^)(FMDatabase *db, BOOL *rollback))block;
+
+/** As -inDatabase:, but counting the block's wait for the queue from `submitted`, when the
+    caller began waiting for it, e.g. for a free connection in a pool. */
+- (void)inDatabase:(void (^)(FMDatabase *db))block submittedAt:(CFAbsoluteTime)submitted;
+
+/** If set, every block run on the queue has its wait and run time recorded in it, under the
+    operation current on the submitting thread. */
+@property (weak, nullable) CDTQueueTelemetry *telemetry;
+
+/** If set, transactions taking longer than the log's threshold are recorded in it. */
+@property (weak, nullable) CDTSlowOperationLog *slowOperationLog;
+
+/** If set, told about every transaction committed, so it can checkpoint once they stop. */
+@property (weak, nullable) TDWALCheckpointer *checkpointer;
+
+/** If set, told about every transaction committed, so other processes hear of it. */
+@property (weak, nullable) TDProcessChangeNotifier *processNotifier;
+
+@end
+
+NS_ASSUME_NONNULL_END
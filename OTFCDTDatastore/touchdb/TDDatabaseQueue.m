@@ -0,0 +1,193 @@
+//
+//  TDDatabaseQueue.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDDatabaseQueue.h"
+#import "CDTLogging.h"
+#import "CDTQueueTelemetry.h"
+#import "CDTSlowOperationLog.h"
+#import "TDWALCheckpointer.h"
+#import "TDProcessChangeNotifier.h"
+
+@implementation TDDatabaseQueue {
+    NSUInteger _transactionCount, _rolledBackTransactionCount;
+    NSTimeInterval _totalTransactionTime, _maxTransactionTime;
+}
+
+- (NSUInteger)transactionCount { @synchronized(self) { return _transactionCount; } }
+- (NSUInteger)rolledBackTransactionCount { @synchronized(self) { return _rolledBackTransactionCount; } }
+- (NSTimeInterval)totalTransactionTime { @synchronized(self) { return _totalTransactionTime; } }
+- (NSTimeInterval)maxTransactionTime { @synchronized(self) { return _maxTransactionTime; } }
+
+- (void)inDatabase:(void (^)(FMDatabase *db))block
+{
+    [self inDatabase:block submittedAt:CFAbsoluteTimeGetCurrent()];
+}
+
+- (void)inDatabase:(void (^)(FMDatabase *db))block submittedAt:(CFAbsoluteTime)submitted
+{
+    CDTQueueOperation operation = CDTQueueCurrentOperation();
+    os_signpost_id_t signpost = [self beginWaitOfOperation:operation];
+    __block CFAbsoluteTime start = 0;
+    [super inDatabase:^(FMDatabase *db) {
+        start = [self beginHoldOfOperation:operation signpost:signpost];
+        block(db);
+    }];
+    [self recordOperation:operation submittedAt:submitted startedAt:start signpost:signpost];
+}
+
+- (void)inTransaction:(void (^)(FMDatabase *db, BOOL *rollback))block
+{
+    CFAbsoluteTime submitted = CFAbsoluteTimeGetCurrent();
+    CDTQueueOperation operation = CDTQueueCurrentOperation();
+    os_signpost_id_t signpost = [self beginWaitOfOperation:operation];
+    __block CFAbsoluteTime start = 0;
+    __block BOOL rolledBack = NO;
+    [super inTransaction:^(FMDatabase *db, BOOL *rollback) {
+        start = [self beginHoldOfOperation:operation signpost:signpost];
+        block(db, rollback);
+        rolledBack = *rollback;
+    }];
+    [self recordOperation:operation submittedAt:submitted startedAt:start signpost:signpost];
+    [self recordTransactionStartedAt:start rolledBack:rolledBack];
+}
+
+- (void)inDeferredTransaction:(void (^)(FMDatabase *db, BOOL *rollback))block
+{
+    CFAbsoluteTime submitted = CFAbsoluteTimeGetCurrent();
+    CDTQueueOperation operation = CDTQueueCurrentOperation();
+    os_signpost_id_t signpost = [self beginWaitOfOperation:operation];
+    __block CFAbsoluteTime start = 0;
+    __block BOOL rolledBack = NO;
+    [super inDeferredTransaction:^(FMDatabase *db, BOOL *rollback) {
+        start = [self beginHoldOfOperation:operation signpost:signpost];
+        block(db, rollback);
+        rolledBack = *rollback;
+    }];
+    [self recordOperation:operation submittedAt:submitted startedAt:start signpost:signpost];
+    [self recordTransactionStartedAt:start rolledBack:rolledBack];
+}
+
+- (BOOL)inCheckedTransaction:(void (^)(FMDatabase *db, BOOL *rollback))block
+{
+    return [self inCheckedTransaction:block checkingForeignKeys:YES];
+}
+
+- (BOOL)inTransactionWithoutForeignKeyChecks:(void (^)(FMDatabase *db, BOOL *rollback))block
+{
+    return [self inCheckedTransaction:block checkingForeignKeys:NO];
+}
+
+- (BOOL)inCheckedTransaction:(void (^)(FMDatabase *db, BOOL *rollback))block
+         checkingForeignKeys:(BOOL)checkForeignKeys
+{
+    __block CFAbsoluteTime start = 0;
+    __block BOOL rolledBack = NO;
+    [self inDatabase:^(FMDatabase *db) {
+        if (!checkForeignKeys) [db executeUpdate:@"PRAGMA foreign_keys = OFF"];
+        if ([db beginTransaction]) {
+            start = CFAbsoluteTimeGetCurrent();
+            block(db, &rolledBack);
+            if (rolledBack) {
+                [db rollback];
+            } else if (![db commit]) {
+                [db rollback];
+                rolledBack = YES;
+            }
+        } else {
+            rolledBack = YES;
+        }
+        if (!checkForeignKeys) [db executeUpdate:@"PRAGMA foreign_keys = ON"];
+    }];
+    [self recordTransactionStartedAt:start rolledBack:rolledBack];
+    return !rolledBack;
+}
+
+#pragma mark - Telemetry
+
+// Returns OS_SIGNPOST_ID_NULL unless the telemetry emits signposts.
+- (os_signpost_id_t)beginWaitOfOperation:(CDTQueueOperation)operation
+{
+    if (!self.telemetry.emitsSignposts) return OS_SIGNPOST_ID_NULL;
+    os_signpost_id_t signpost = CDTSignpostIDGenerate();
+    CDTSignpostIntervalBegin(signpost, "queueWait", "operation=%{public}@",
+                             [CDTQueueTelemetry nameOfOperation:operation]);
+    return signpost;
+}
+
+// Called on the queue as the block starts; returns when it started.
+- (CFAbsoluteTime)beginHoldOfOperation:(CDTQueueOperation)operation
+                              signpost:(os_signpost_id_t)signpost
+{
+    if (signpost != OS_SIGNPOST_ID_NULL) {
+        CDTSignpostIntervalEnd(signpost, "queueWait");
+        CDTSignpostIntervalBegin(signpost, "queueHold", "operation=%{public}@",
+                                 [CDTQueueTelemetry nameOfOperation:operation]);
+    }
+    return CFAbsoluteTimeGetCurrent();
+}
+
+- (void)recordOperation:(CDTQueueOperation)operation
+            submittedAt:(CFAbsoluteTime)submitted
+              startedAt:(CFAbsoluteTime)start
+               signpost:(os_signpost_id_t)signpost
+{
+    if (start == 0) {
+        return;  // the block never ran
+    }
+    if (signpost != OS_SIGNPOST_ID_NULL) {
+        CDTSignpostIntervalEnd(signpost, "queueHold");
+    }
+    [self.telemetry recordOperation:operation
+                           waitTime:MAX(start - submitted, 0)
+                           holdTime:CFAbsoluteTimeGetCurrent() - start];
+}
+
+#pragma mark - Transactions
+
+- (void)recordTransactionStartedAt:(CFAbsoluteTime)start rolledBack:(BOOL)rolledBack
+{
+    if (start == 0) {
+        return;  // the block never ran
+    }
+    NSTimeInterval duration = CFAbsoluteTimeGetCurrent() - start;
+    @synchronized(self)
+    {
+        _transactionCount++;
+        if (rolledBack) _rolledBackTransactionCount++;
+        _totalTransactionTime += duration;
+        _maxTransactionTime = MAX(_maxTransactionTime, duration);
+    }
+    if (!rolledBack) {
+        [self.checkpointer databaseWasWritten];
+        [self.processNotifier databaseWasWritten];
+    }
+
+    CDTSlowOperationLog *log = self.slowOperationLog;
+    if ([log isSlow:duration]) {
+        // The call stack is the only clue to which transaction this was.
+        NSDictionary *details = @{
+            @"rolledBack" : @(rolledBack),
+            @"callStack" : [NSThread callStackSymbols]
+        };
+        [log recordOperation:[[CDTSlowOperation alloc] initWithOperation:@"transaction"
+                                                                duration:duration
+                                                                     sql:@[]
+                                                               queryPlan:@[]
+                                                                rowCount:0
+                                                    usedUnindexedMatcher:NO
+                                                                 details:details]];
+    }
+}
+
+@end
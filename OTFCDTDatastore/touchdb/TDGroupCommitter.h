@@ -0,0 +1,54 @@
+//
+//  TDGroupCommitter.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "TDStatus.h"
+
+@class FMDatabase, TDDatabaseQueue;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Runs small write transactions from concurrent writers together in a single SQLite transaction,
+ so that they share one commit.
+
+ The first writer to arrive waits up to `window` for others, or until there are `maxWrites` of
+ them, then opens the transaction. Each writer's block is run in turn, on the writer's own thread,
+ inside a savepoint of its own: a block returning an error status rolls back only its own changes,
+ as if it had run in a transaction by itself. No writer returns until the whole transaction has
+ been committed, so a write is never acknowledged before it is durable. If the commit fails,
+ every write in it fails with kTDStatusDBError.
+
+ Blocks see the changes of writes committed with them, in the order they arrived, just as they
+ would if each had run in its own transaction one after the other.
+ */
+@interface TDGroupCommitter : NSObject
+
+/** How long the first writer of a group waits for others to join it. Defaults to 0, which only
+    groups writers that arrived while the previous group was being committed. TD_Database only
+    uses group commit when this is more than 0. */
+@property NSTimeInterval window;
+
+/** Most writes committed together. A group is committed as soon as it has this many, without
+    waiting for the rest of the window. Defaults to 64. */
+@property NSUInteger maxWrites;
+
+/** Runs the block as part of a group transaction on `queue`, returning once that has been
+    committed. Returns the block's status, kTDStatusException if it raised an exception, or
+    kTDStatusDBError if the transaction couldn't be started or committed. */
+- (TDStatus)inTransaction:(TDStatus (^)(FMDatabase *db))block onQueue:(TDDatabaseQueue *)queue;
+
+@end
+
+NS_ASSUME_NONNULL_END
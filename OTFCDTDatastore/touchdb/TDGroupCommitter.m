@@ -0,0 +1,183 @@
+//
+//  TDGroupCommitter.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDGroupCommitter.h"
+#import "TDDatabaseQueue.h"
+#import "CDTLogging.h"
+
+#import <fmdb/FMDatabase.h>
+
+static NSString* const kTDGroupSavepoint = @"td_group_write";
+
+typedef NS_ENUM(NSInteger, TDGroupWriteState) {
+    kTDGroupWriteQueued,   // waiting to be picked up by a group
+    kTDGroupWriteGrouped,  // in the group being committed, waiting for its turn
+    kTDGroupWriteRunning,  // its writer should run the block now, against `db`
+    kTDGroupWriteRan,      // the block has returned `status`
+    kTDGroupWriteDone      // the group has been committed or rolled back
+};
+
+/** A writer waiting for, or taking part in, a group transaction. */
+@interface TDGroupWrite : NSObject
+@property (copy) TDStatus (^block)(FMDatabase*);
+@property TDGroupWriteState state;
+@property TDStatus status;
+@property (strong) FMDatabase* db;
+@end
+
+@implementation TDGroupWrite
+@end
+
+@implementation TDGroupCommitter {
+    NSCondition* _condition;
+    NSMutableArray<TDGroupWrite*>* _queued;
+    BOOL _committing;  // some writer is collecting or committing a group
+}
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        _condition = [[NSCondition alloc] init];
+        _queued = [NSMutableArray array];
+        _maxWrites = 64;
+    }
+    return self;
+}
+
+- (TDStatus)inTransaction:(TDStatus (^)(FMDatabase*))block onQueue:(TDDatabaseQueue*)queue
+{
+    TDGroupWrite* write = [[TDGroupWrite alloc] init];
+    write.block = block;
+
+    [_condition lock];
+    [_queued addObject:write];
+    [_condition broadcast];  // the writer collecting a group may be waiting for one more
+
+    while (write.state != kTDGroupWriteDone) {
+        if (write.state == kTDGroupWriteRunning) {
+            // Run on this thread, so the block's autoreleased results live as long as the caller
+            // expects them to.
+            [_condition unlock];
+            TDStatus status = [self runWrite:write inDatabase:write.db];
+            [_condition lock];
+            write.status = status;
+            write.state = kTDGroupWriteRan;
+            [_condition broadcast];
+        } else if (write.state == kTDGroupWriteQueued && !_committing) {
+            _committing = YES;
+            NSArray* group = [self collectGroup];
+            [_condition unlock];
+            [self commitGroup:group containing:write onQueue:queue];
+            [_condition lock];
+            _committing = NO;
+            [_condition broadcast];
+        } else {
+            [_condition wait];
+        }
+    }
+    [_condition unlock];
+    return write.status;
+}
+
+/** Waits for the group to fill up or for the window to close, then takes the writes in it. Must
+    be called with the lock held. */
+- (NSArray*)collectGroup
+{
+    NSUInteger maxWrites = MAX(self.maxWrites, 1u);
+    NSDate* deadline = [NSDate dateWithTimeIntervalSinceNow:self.window];
+    while (_queued.count < maxWrites && [_condition waitUntilDate:deadline]) {
+    }
+
+    NSRange range = NSMakeRange(0, MIN(_queued.count, maxWrites));
+    NSArray* group = [_queued subarrayWithRange:range];
+    [_queued removeObjectsInRange:range];
+    for (TDGroupWrite* write in group) write.state = kTDGroupWriteGrouped;
+    return group;
+}
+
+- (void)commitGroup:(NSArray*)group
+         containing:(TDGroupWrite*)own
+            onQueue:(TDDatabaseQueue*)queue
+{
+    os_signpost_id_t signpost = CDTSignpostIDGenerate();
+    CDTSignpostIntervalBegin(signpost, "groupCommit", "count=%lu", (unsigned long)group.count);
+
+    BOOL committed = [queue inCheckedTransaction:^(FMDatabase* db, BOOL* rollback) {
+        for (TDGroupWrite* write in group) {
+            if (![db startSavePointWithName:kTDGroupSavepoint error:NULL]) {
+                [self finishWrite:write status:kTDStatusDBError];
+                continue;
+            }
+
+            TDStatus status;
+            if (write == own) {
+                status = [self runWrite:write inDatabase:db];
+            } else {
+                // Hand the connection to the writer's thread and wait for it to finish with it.
+                NSCondition* condition = self->_condition;
+                [condition lock];
+                write.db = db;
+                write.state = kTDGroupWriteRunning;
+                [condition broadcast];
+                while (write.state != kTDGroupWriteRan) [condition wait];
+                write.db = nil;
+                status = write.status;
+                [condition unlock];
+            }
+
+            if (TDStatusIsError(status)) {
+                [db rollbackToSavePointWithName:kTDGroupSavepoint error:NULL];
+            }
+            [db releaseSavePointWithName:kTDGroupSavepoint error:NULL];
+            [self finishWrite:write status:status];
+        }
+    }];
+
+    if (!committed) {
+        os_log_error(CDTOSLog, "Group commit of %lu writes failed", (unsigned long)group.count);
+    }
+
+    [_condition lock];
+    for (TDGroupWrite* write in group) {
+        if (!committed && !TDStatusIsError(write.status)) write.status = kTDStatusDBError;
+        write.state = kTDGroupWriteDone;
+    }
+    [_condition broadcast];
+    [_condition unlock];
+
+    CDTSignpostIntervalEnd(signpost, "groupCommit", "committed=%d", committed);
+}
+
+/** Records the outcome of a write's savepoint, ahead of the group being committed. */
+- (void)finishWrite:(TDGroupWrite*)write status:(TDStatus)status
+{
+    [_condition lock];
+    write.status = status;
+    write.state = kTDGroupWriteRan;
+    [_condition unlock];
+}
+
+- (TDStatus)runWrite:(TDGroupWrite*)write inDatabase:(FMDatabase*)db
+{
+    @try {
+        return write.block(db);
+    }
+    @catch (NSException* x)
+    {
+        os_log_debug(CDTOSLog, "Exception raised during -inTransaction: %{public}@", x);
+        return kTDStatusException;
+    }
+}
+
+@end
@@ -17,7 +17,27 @@
 #import "TDRemoteRequest.h"
 #import "TDBlobStore.h"
 
-@class TD_Attachment;
+@class TD_Attachment, TDBlobStore, TDDatabaseQueue, TDWALCheckpointer, TDLocalDocument;
+
+/** What revs.json holds for a body stored out of line, in the bodies table (see
+    TD_Database.outOfLineBodyThreshold). JSON text never starts with a 0 byte, and binary JSON,
+    which does, is always longer than one. */
+#define kTDOutOfLineBodyMarkerSQL "x'00'"
+
+/** The first byte of a body stored as a TDBodyDelta (see TD_Database.storesHistoryAsDeltas). */
+#define kTDBodyDeltaMarkerSQL "x'01'"
+
+/** What revs.json holds for a body moved into the database's archive (see TD_Database+Archive). */
+#define kTDArchivedBodyMarkerSQL "x'02'"
+
+/** SQL for a revision's stored body, wherever it's kept, in place of revs.json in the columns of a
+    query on revs. Bodies kept inline cost no more to read than before. */
+#define kTDRevsBodySQL                                                                             \
+    "(CASE WHEN revs.json = " kTDOutOfLineBodyMarkerSQL                                           \
+    " THEN (SELECT bodies.json FROM bodies WHERE bodies.sequence=revs.sequence)"                 \
+    " WHEN revs.json = " kTDArchivedBodyMarkerSQL                                                 \
+    " THEN (SELECT json FROM archived_bodies WHERE archived_bodies.sequence=revs.sequence)"      \
+    " ELSE revs.json END)"
 
 NS_ASSUME_NONNULL_BEGIN
 @interface TD_Database ()
@@ -26,6 +46,57 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (BOOL)openFMDBWithEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider;
 
+/** A provider of the key and cipher settings `provider` gives now, asking it for them only once. */
++ (id<CDTEncryptionKeyProvider>)resolvedEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider;
+
+/** Opens the pool of read-only connections used by -inReadTransaction:. Must be called once the
+    writer connection is open and the schema is up to date. */
+- (void)openReadConnectionsWithEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider;
+
+/** Closes the pool of read-only connections, waiting for in-flight reads to finish. */
+- (void)closeReadConnections;
+
+/** Sizes the page caches and memory maps of the open connections to memoryBudget and mmapSize. */
+- (void)applyMemoryBudget;
+
+/** Directory the database's attachment blobs are stored in. */
+@property (readonly) NSString* attachmentStorePath;
+
+/** Directory the attachment blobs of the database at `path` are stored in. */
++ (NSString*)attachmentStorePathWithDatabasePath:(NSString*)path;
+
+/** The archive database file of the database at `path`, which may not exist. */
++ (NSString*)archivePathWithDatabasePath:(NSString*)path;
+
+/** Deletes the database file at `path`, its WAL and shared memory files, its archive, and its
+    attachments. */
++ (void)removeDatabaseFilesAtPath:(NSString*)path;
+
+/** Gives a connection the temporary archived_bodies view that kTDRevsBodySQL looks archived
+    bodies up in: over the attached archive if the database has one, or if `create`, after
+    creating it; otherwise empty. Can't be called inside a transaction. */
+- (BOOL)attachArchiveInDatabase:(FMDatabase*)db create:(BOOL)create;
+
+/** Opens a connection to the database file at `path`, creating it unless `readOnly`. */
++ (TDDatabaseQueue*)queueForDatabaseAtPath:(NSString*)path readOnly:(BOOL)readOnly;
+
+/** The database's attachment blob store, opened on first use; nil if the database is closed or
+    the store couldn't be opened. */
+@property (readonly, nullable) TDBlobStore* attachmentStore;
+
+/** Checkpoints the write-ahead log when the database is idle and after replications; nil if the
+    database is closed or read-only. */
+@property (readonly, nullable) TDWALCheckpointer* walCheckpointer;
+
+/** Directory for the partly downloaded contents of pending attachments, so their downloads can be
+    resumed; nil if the database's attachments are encrypted, as the partial files aren't. */
+@property (readonly, nullable) NSString* partialAttachmentDownloadsPath;
+
+/** Runs the block on the writer connection, unless the database is closed, in which case it
+    returns NO without running it. For background work that must not outlive the database; it
+    must not be called from a -close or -deleteDatabase: path. */
+- (BOOL)inDatabaseIfOpen:(void (^)(FMDatabase* db))block;
+
 /** Must be called from within a queue -inDatabase: or -inTransaction: **/
 - (SInt64)getDocNumericID:(NSString*)docID database:(FMDatabase*)db;
 
@@ -60,15 +131,68 @@ NS_ASSUME_NONNULL_BEGIN
                                            options:(TDContentOptions)options
                                         inDatabase:(FMDatabase*)db;
 
+/** A revision's stored JSON as read from kTDRevsBodySQL, with any TDBodyDelta it is stored as
+    applied to its base, and any delta that is, in turn. nil if a base has gone.
+    Must be called from within a queue -inDatabase: or -inTransaction: **/
+- (nullable NSData*)expandedStoredJSON:(nullable NSData*)json inDatabase:(FMDatabase*)db;
+
+/** The _id, _rev, _attachments etc. properties that -documentPropertiesFromJSON:... adds to a
+    revision's stored JSON.
+    Must be called from within a queue -inDatabase: or -inTransaction: **/
+- (NSDictionary*)extraPropertiesForRevision:(TD_Revision*)rev
+                                    options:(TDContentOptions)options
+                                 inDatabase:(FMDatabase*)db;
+
+/** As above, but taking the revision's "_attachments" from those read for many revisions by
+    -getAttachmentDictsForSequences:options:inDatabase:, and its history from those read by
+    -getRevisionHistoriesOfRevisions:database:, if they're given. */
+- (NSDictionary*)extraPropertiesForRevision:(TD_Revision*)rev
+                                    options:(TDContentOptions)options
+                      prefetchedAttachments:(nullable NSDictionary*)prefetchedAttachments
+                        prefetchedHistories:(nullable NSDictionary*)prefetchedHistories
+                                 inDatabase:(FMDatabase*)db;
+
+/** Parses a revision's stored JSON and adds previously gathered extra properties to it. Doesn't
+    use the database, so it can be called from any thread. */
++ (NSDictionary*)documentPropertiesFromJSON:(nullable NSData*)json
+                            extraProperties:(NSDictionary*)extra;
+
 /** Must be called from within a queue -inDatabase: or -inTransaction: **/
 - (nullable NSString*)winningRevIDOfDocNumericID:(SInt64)docNumericID
                                        isDeleted:(BOOL*)outIsDeleted
                                         database:(FMDatabase*)database;
 @end
 
+@interface TD_Database (Conflicts_Internal)
+/** Records whether the document now has conflicting leaf revisions, after its revision tree has
+    changed. Must be called from within a queue -inTransaction: **/
+- (BOOL)updateConflictsForDocNumericID:(SInt64)docNumericID database:(FMDatabase*)db;
+/** Whether the document has conflicting leaf revisions, from what -updateConflictsForDocNumericID:
+    last recorded. Must be called from within a queue -inDatabase: or -inTransaction: **/
+- (BOOL)isConflictedDocumentID:(NSString*)docID database:(FMDatabase*)db;
+@end
+
 @interface TD_Database (Insertion_Internal)
 - (nullable NSData*)encodeDocumentJSON:(TD_Revision*)rev;
 - (TDStatus)validateRevision:(TD_Revision*)newRev previousRevision:(TD_Revision*_Nullable)oldRev;
+
+/** Called whenever a process writes to a multiProcess database, to catch up with what others
+    wrote. */
+- (void)noteWritesByOtherProcesses;
+
+/** Posts a TD_DatabasePurgedNotification for the documents, once their purge has committed. */
+- (void)notifyPurgedDocumentIDs:(NSArray<NSString*>*)docIDs;
+
+/** Stores the body of the revision at `sequence` as a delta against that of the revision at
+    `baseSequence`, if that's much smaller. Called once the revision is no longer current. */
+- (BOOL)storeBodyOfSequence:(SequenceNumber)sequence
+      asDeltaAgainstSequence:(SequenceNumber)baseSequence
+                    database:(FMDatabase*)db;
+@end
+
+@interface TD_Database (LocalDocs_Internal)
+/** Writes the documents to the localdocs table in one transaction. */
+- (TDStatus)writeLocalDocuments:(NSDictionary<NSString*, TDLocalDocument*>*)documents;
 @end
 
 @interface TD_Database (Attachments_Internal)
@@ -98,7 +222,38 @@ NS_ASSUME_NONNULL_BEGIN
 - (TDStatus)copyAttachmentsFromSequence:(SequenceNumber)fromSequence
                              toSequence:(SequenceNumber)toSequence
                              inDatabase:(FMDatabase*)db;
+/** Copies the named attachments, sharing the old sequence's rows if they're all of them. */
+- (TDStatus)copyAttachmentsNamed:(NSArray<NSString*>*)names
+                    fromSequence:(SequenceNumber)fromSequence
+                      toSequence:(SequenceNumber)toSequence
+                      inDatabase:(FMDatabase*)db;
+- (TDStatus)copyAttachmentsNamed:(NSArray<NSString*>*)names
+                   fromSequences:(NSArray<NSNumber*>*)fromSequences
+                      toSequence:(SequenceNumber)toSequence
+                      inDatabase:(FMDatabase*)db;
+/** Gives a revision attachments rows of its own, to be changed without affecting others. */
+- (TDStatus)separateAttachmentsOfSequence:(SequenceNumber)sequence inDatabase:(FMDatabase*)db;
 - (BOOL)inlineFollowingAttachmentsIn:(TD_Revision*)rev error:(NSError**)outError;
+
+/** Records the attachments a pulled revision was inserted without, as returned by
+    -documentDeferringAttachments:pendingAttachments:, for downloading later. */
+- (TDStatus)addPendingAttachmentDownloads:(NSDictionary*)pendingAttachments
+                              forSequence:(SequenceNumber)sequence
+                               inDatabase:(FMDatabase*)db;
+
+/** Deletes, on a background queue and a batch at a time, the files the last
+    -garbageCollectAttachments: marked for deletion. */
+- (void)sweepDeletedAttachments;
+
+/** Looks up the filenames of the blobs of the attachments of many revisions with one query,
+    before their blobs are read one attachment at a time. */
+- (void)prefetchBlobFilenamesForSequences:(NSArray*)sequences inDatabase:(FMDatabase*)db;
+@end
+
+@interface TD_Database (Rekey_Internal)
+/** Looks up the attachment key recorded by -beginRekeyWithError:, so that the attachment store is
+    opened able to read attachments under both keys. Called as the database opens. */
+- (void)loadUnfinishedRekey;
 @end
 
 @interface TD_Database (Replication_Internal)
@@ -107,9 +262,19 @@ NS_ASSUME_NONNULL_BEGIN
     (nonnull NSString *)checkpointID;
 - (BOOL)saveCheckpointDocument:(nonnull NSDictionary<NSString *, NSObject *> *)checkpoint
                          error:(NSError *__autoreleasing *)error;
+/** The local sequences a pusher has recorded as already present on the remote, beyond the
+    checkpoint stored under the same ID. */
+- (nullable NSIndexSet *)knownRemoteSequencesForCheckpointID:(nonnull NSString *)checkpointID;
+- (BOOL)saveKnownRemoteSequences:(nonnull NSIndexSet *)sequences
+                 forCheckpointID:(nonnull NSString *)checkpointID
+                           error:(NSError *__autoreleasing *)error;
 - (BOOL)deleteCheckpointDocunemtWithID:(NSString *)checkpointID
                                  error:(NSError *__autoreleasing *)error;
 + (NSString*)joinQuotedStrings:(NSArray*)strings;
+/** Returns the contents of an SQL "IN (...)" list for strings, appending the values to bind to
+    args. Short lists are bound as padded "?" placeholders so the statement can be cached; very long
+    lists fall back to +joinQuotedStrings:. */
++ (NSString*)placeholdersForStrings:(NSArray*)strings arguments:(NSMutableArray*)args;
 @end
 
 @interface TD_View ()
@@ -132,17 +297,45 @@ NS_ASSUME_NONNULL_BEGIN
 @property (readwrite, nonatomic) NSUInteger changesProcessed, changesTotal;
 - (void)maybeCreateRemoteDB;
 - (void)beginReplicating;
+- (void)fetchRemoteCheckpointDoc;
+- (void)saveLastSequence;
+- (NSString*)remoteCheckpointDocID;
 - (void)addToInbox:(TD_Revision*)rev;
 - (void)addRevsToInbox:(TD_RevisionList*)revs;
 - (void)processInbox:(nullable TD_RevisionList*)inbox;  // override this
+// Adds what only this device needs to resume to a checkpoint about to be saved locally.
+- (void)addToLocalCheckpoint:(NSMutableDictionary*)checkpoint;  // override this
+// Called with the local checkpoint the replication is resuming from, if it is.
+- (void)resumeFromLocalCheckpoint:(NSDictionary*)checkpoint;  // override this
+// Adds what makes this replication's checkpoint differ from others between the same databases.
+- (void)addToRemoteCheckpointSpec:(NSMutableDictionary*)spec;  // override this
+- (TDRemoteJSONRequest*)sendAsyncRequest:(NSString*)method
+                                    path:(NSString*)relativePath
+                                    body:(id _Nullable)body
+                            onCompletion:(TDRemoteRequestCompletionBlock)onCompletion;
+// If arrayKey is given, streams the response: each element of that top-level array is passed to
+// onElement as it arrives, and the completion block's result is the element count.
+- (TDRemoteJSONRequest*)sendAsyncRequest:(NSString*)method
+                                    path:(NSString*)relativePath
+                                    body:(id _Nullable)body
+                          streamingArray:(NSString* _Nullable)arrayKey
+                               onElement:(void (^_Nullable)(id element))onElement
+                            onCompletion:(TDRemoteRequestCompletionBlock)onCompletion;
+// As above, with elementTransform applied to each element on the decodePool before onElement.
 - (TDRemoteJSONRequest*)sendAsyncRequest:(NSString*)method
                                     path:(NSString*)relativePath
                                     body:(id _Nullable)body
+                          streamingArray:(NSString*)arrayKey
+                        elementTransform:(id _Nullable (^_Nullable)(id element))elementTransform
+                               onElement:(void (^)(id element))onElement
                             onCompletion:(TDRemoteRequestCompletionBlock)onCompletion;
+- (BOOL)compressesRequestBodyForPath:(NSString*)relativePath;  // override this
 - (void)addRemoteRequest:(TDRemoteRequest*)request;
 - (void)removeRemoteRequest:(TDRemoteRequest*)request;
 - (void)asyncTaskStarted;
 - (void)asyncTasksFinished:(NSUInteger)numTasks;
+// Runs the block on the replicator's thread, which must have been started.
+- (void)performBlockOnReplicatorThread:(void (^)(void))block;
 - (void)stopped;
 - (void)databaseClosing;
 - (void)revisionFailed;  // subclasses call this if a transfer fails
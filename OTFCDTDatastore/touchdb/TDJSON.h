@@ -65,6 +65,27 @@ typedef NSUInteger TDJSONWritingOptions;
     But it will generate invalid JSON if the input JSON begins or ends with whitespace, or if the
    dictionary contains any keys that are already in the original JSON. */
 + (NSData *)appendDictionary:(NSDictionary *)dict toJSONDictionaryData:(NSData *)json;
+
+/** Given JSON data representing a dictionary, returns a dictionary of just the given top-level keys
+    that are present in it. Only the values of those keys are parsed; the rest of the JSON is
+    skipped over without building any objects, so this is much cheaper than parsing the whole
+    dictionary when only a few keys are needed.
+    Returns nil if the data isn't a JSON dictionary. */
++ (NSDictionary *)dictionaryWithValuesForKeys:(NSArray *)keys fromJSONDictionaryData:(NSData *)json;
+
+/** As +dictionaryWithValuesForKeys:fromJSONDictionaryData:, for fields which may be dotted paths
+    into nested dictionaries: "a.b" gives `{"a": {"b": ...}}` holding just that of "a". Fields
+    missing from the JSON are left out. Of binary JSON, only the values at the paths are decoded.
+    Returns nil if the data isn't a JSON dictionary. */
++ (NSDictionary *)dictionaryWithValuesForFields:(NSArray<NSString *> *)fields
+                         fromJSONDictionaryData:(NSData *)json;
+
+/** Given JSON data representing a dictionary, returns it without the given top-level keys. Like
+    -appendDictionary:toJSONDictionaryData:, the JSON isn't parsed or regenerated: the remaining
+    entries are copied as they are. The result never begins or ends with whitespace, so it can be
+    passed on to -appendDictionary:toJSONDictionaryData:.
+    Returns nil if the data isn't a JSON dictionary. */
++ (NSData *)dataByRemovingKeys:(NSSet *)keys fromJSONDictionaryData:(NSData *)json;
 @end
 
 /** Wrapper for an NSArray of JSON data, that avoids having to parse the data if it's not used.
@@ -16,6 +16,7 @@
 //  Modifications for this distribution by Cloudant, Inc., Copyright (c) 2014 Cloudant, Inc.
 
 #import "TDJSON.h"
+#import "TDBinaryJSON.h"
 #import "CollectionUtils.h"
 #import "Test.h"
 
@@ -94,6 +95,209 @@
     return newJson;
 }
 
+static const uint8_t* skipWhitespace(const uint8_t* pos, const uint8_t* end)
+{
+    while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\n' || *pos == '\r')) ++pos;
+    return pos;
+}
+
+// Given a pointer to an opening quote, returns a pointer just past the closing quote.
+static const uint8_t* skipString(const uint8_t* pos, const uint8_t* end)
+{
+    for (++pos; pos < end; ++pos) {
+        if (*pos == '\\')
+            ++pos;
+        else if (*pos == '"')
+            return pos + 1;
+    }
+    return NULL;
+}
+
+// Returns a pointer just past the JSON value starting at pos, without parsing it.
+static const uint8_t* skipValue(const uint8_t* pos, const uint8_t* end)
+{
+    if (pos >= end) return NULL;
+    if (*pos == '"') return skipString(pos, end);
+    if (*pos == '{' || *pos == '[') {
+        int depth = 0;
+        while (pos < end) {
+            uint8_t c = *pos;
+            if (c == '"') {
+                pos = skipString(pos, end);
+                if (!pos) return NULL;
+                continue;
+            }
+            if (c == '{' || c == '[')
+                ++depth;
+            else if ((c == '}' || c == ']') && --depth == 0)
+                return pos + 1;
+            ++pos;
+        }
+        return NULL;
+    }
+    // Number, true, false or null:
+    while (pos < end && *pos != ',' && *pos != '}' && *pos != ']' && *pos != ' ' && *pos != '\t' &&
+           *pos != '\n' && *pos != '\r')
+        ++pos;
+    return pos;
+}
+
+// Calls the block with the key, and the ranges of the whole entry and of its value, of each entry
+// in a JSON dictionary, without parsing the values; the block returns NO to stop.
+// Returns NO if the data isn't a JSON dictionary (or a value the block wanted couldn't be parsed).
+typedef BOOL (^TDJSONEntryBlock)(NSString* key, NSRange entry, NSRange value);
+
+static BOOL enumerateDictionaryEntries(NSData* json, TDJSONEntryBlock block)
+{
+    const uint8_t* start = json.bytes;
+    const uint8_t* end = start + json.length;
+    const uint8_t* pos = skipWhitespace(start, end);
+    if (pos >= end || *pos++ != '{') return NO;
+
+    pos = skipWhitespace(pos, end);
+    if (pos < end && *pos == '}') return YES;
+    while (pos < end) {
+        // Key:
+        if (*pos != '"') return NO;
+        const uint8_t* entryStart = pos;
+        const uint8_t* keyEnd = skipString(pos, end);
+        if (!keyEnd) return NO;
+        NSString* key;
+        if (memchr(pos, '\\', keyEnd - pos)) {
+            // Let the real parser deal with escape sequences:
+            NSData* keyJSON = [json subdataWithRange:NSMakeRange(pos - start, keyEnd - pos)];
+            key = [TDJSON JSONObjectWithData:keyJSON options:TDJSONReadingAllowFragments error:NULL];
+        } else {
+            key = [[NSString alloc] initWithBytes:pos + 1
+                                           length:keyEnd - pos - 2
+                                         encoding:NSUTF8StringEncoding];
+        }
+        if (![key isKindOfClass:[NSString class]]) return NO;
+
+        pos = skipWhitespace(keyEnd, end);
+        if (pos >= end || *pos++ != ':') return NO;
+
+        // Value:
+        pos = skipWhitespace(pos, end);
+        const uint8_t* valueEnd = skipValue(pos, end);
+        if (!valueEnd || valueEnd == pos) return NO;
+        if (!block(key, NSMakeRange(entryStart - start, valueEnd - entryStart),
+                   NSMakeRange(pos - start, valueEnd - pos)))
+            return NO;
+
+        pos = skipWhitespace(valueEnd, end);
+        if (pos >= end) return NO;
+        if (*pos == '}') return YES;
+        if (*pos++ != ',') return NO;
+        pos = skipWhitespace(pos, end);
+    }
+    return NO;
+}
+
++ (NSDictionary*)dictionaryWithValuesForKeys:(NSArray*)keys fromJSONDictionaryData:(NSData*)json
+{
+    if ([TDBinaryJSON isBinaryJSON:json]) {
+        return [TDBinaryJSON dictionaryWithValuesForKeys:keys fromData:json];
+    }
+    NSSet* wanted = [NSSet setWithArray:keys];
+    NSMutableDictionary* result = [NSMutableDictionary dictionaryWithCapacity:wanted.count];
+    BOOL ok = enumerateDictionaryEntries(json, ^BOOL(NSString* key, NSRange entry, NSRange value) {
+        // Values are only parsed if they're wanted:
+        if (![wanted member:key]) return YES;
+        id object = [self JSONObjectWithData:[json subdataWithRange:value]
+                                     options:TDJSONReadingAllowFragments
+                                       error:NULL];
+        if (!object) return NO;
+        result[key] = object;
+        return YES;
+    });
+    return ok ? result : nil;
+}
+
+// Sets the value at the end of a path into dict, making the dictionaries along the way.
+static void setValueAtPath(NSMutableDictionary* dict, NSArray<NSString*>* path, id value)
+{
+    for (NSUInteger i = 0; i + 1 < path.count; i++) {
+        NSMutableDictionary* next = dict[path[i]];
+        if (!next) dict[path[i]] = next = [NSMutableDictionary dictionary];
+        dict = next;
+    }
+    dict[path.lastObject] = value;
+}
+
++ (NSDictionary*)dictionaryWithValuesForFields:(NSArray<NSString*>*)fields
+                        fromJSONDictionaryData:(NSData*)json
+{
+    // A field within another that's asked for is in it already, so it's skipped; then the
+    // dictionaries along each path are only ever ones made here.
+    NSSet* wanted = [NSSet setWithArray:fields];
+    NSMutableArray* paths = [NSMutableArray arrayWithCapacity:fields.count];
+    NSMutableOrderedSet* topLevelKeys = [NSMutableOrderedSet orderedSetWithCapacity:fields.count];
+    for (NSString* field in wanted) {
+        NSArray* path = [field componentsSeparatedByString:@"."];
+        BOOL within = NO;
+        for (NSUInteger i = 1; i < path.count && !within; i++) {
+            NSArray* prefix = [path subarrayWithRange:NSMakeRange(0, i)];
+            within = [wanted member:[prefix componentsJoinedByString:@"."]] != nil;
+        }
+        if (within) continue;
+        [paths addObject:path];
+        [topLevelKeys addObject:path[0]];
+    }
+
+    BOOL binary = [TDBinaryJSON isBinaryJSON:json];
+    NSDictionary* topLevel;
+    if (binary) {
+        // Checks it's a dictionary; the values are then decoded from each path's end:
+        if (![TDBinaryJSON dictionaryWithValuesForKeys:@[] fromData:json]) return nil;
+    } else {
+        topLevel = [self dictionaryWithValuesForKeys:topLevelKeys.array fromJSONDictionaryData:json];
+        if (!topLevel) return nil;
+    }
+
+    NSMutableDictionary* result = [NSMutableDictionary dictionaryWithCapacity:topLevelKeys.count];
+    for (NSArray<NSString*>* path in paths) {
+        id value;
+        if (binary) {
+            value = [TDBinaryJSON valueAtKeyPath:path inData:json];
+        } else {
+            value = topLevel[path[0]];
+            for (NSUInteger i = 1; i < path.count && value; i++) {
+                value = [value isKindOfClass:[NSDictionary class]] ? value[path[i]] : nil;
+            }
+        }
+        if (value) setValueAtPath(result, path, value);
+    }
+    return result;
+}
+
++ (NSData*)dataByRemovingKeys:(NSSet*)keys fromJSONDictionaryData:(NSData*)json
+{
+    NSMutableArray* keptEntries = [NSMutableArray array];
+    __block BOOL removedAny = NO;
+    BOOL ok = enumerateDictionaryEntries(json, ^BOOL(NSString* key, NSRange entry, NSRange value) {
+        if ([keys member:key])
+            removedAny = YES;
+        else
+            [keptEntries addObject:[NSValue valueWithRange:entry]];
+        return YES;
+    });
+    if (!ok) return nil;
+    const uint8_t* bytes = json.bytes;
+    if (!removedAny && bytes[0] == '{' && bytes[json.length - 1] == '}') return json;
+
+    // Copy the remaining entries verbatim, dropping any whitespace between them:
+    NSMutableData* result = [NSMutableData dataWithCapacity:json.length];
+    [result appendBytes:"{" length:1];
+    for (NSValue* entry in keptEntries) {
+        NSRange range = entry.rangeValue;
+        if (result.length > 1) [result appendBytes:"," length:1];
+        [result appendBytes:bytes + range.location length:range.length];
+    }
+    [result appendBytes:"}" length:1];
+    return result;
+}
+
 @end
 
 @implementation TDLazyArrayOfJSON
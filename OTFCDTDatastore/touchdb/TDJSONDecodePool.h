@@ -0,0 +1,85 @@
+//
+//  TDJSONDecodePool.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A bounded pool of workers for decoding JSON response bodies, and building objects such as
+ TD_Revisions from them, off the replicator threads. A replicator's thread would otherwise decode
+ all its responses itself, using one core however many others are idle, while the rest of the
+ replication waits on it.
+
+ Work is submitted through a TDJSONDecodeSequence, which hands the results back in order.
+ */
+@interface TDJSONDecodePool : NSObject
+
+/** The pool shared by replications, with a worker per active processor. */
++ (instancetype)sharedPool;
+
+- (instancetype)initWithMaximumWorkers:(NSUInteger)maximumWorkers NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/** The most decodes run at once. */
+@property (readonly, nonatomic) NSUInteger maximumWorkers;
+
+@end
+
+/** Builds the result to hand back from a decoded JSON value, on a worker. Returning nil leaves
+    the value out. */
+typedef id _Nullable (^TDJSONDecodeTransform)(id json);
+
+/**
+ Decodes a series of JSON values, e.g. the elements of a streamed response, on a pool's workers,
+ and passes the results to a block on the thread which created the sequence, in the order they
+ were submitted. That thread must run its run loop, as a replicator's thread does. With no pool,
+ each value is decoded and passed to the block straight away.
+
+ All methods must be called on the thread which created the sequence.
+ */
+@interface TDJSONDecodeSequence : NSObject
+
+/**
+ @param pool  The pool to decode on, or nil to decode on the calling thread.
+ @param transform  Applied to each decoded value on the worker, or nil to pass values on as they
+   are.
+ @param onResult  Called with each result, or with the error of a value which couldn't be
+   decoded. Results the transform left out aren't passed on.
+ */
+- (instancetype)initWithPool:(nullable TDJSONDecodePool *)pool
+                   transform:(nullable TDJSONDecodeTransform)transform
+                    onResult:(void (^)(id _Nullable result, NSError *_Nullable error))onResult
+    NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/** Decodes json, which needn't outlive the call. */
+- (void)decodeData:(NSData *)json;
+
+/** How many values have been submitted but not yet passed on. */
+@property (readonly, nonatomic) NSUInteger pendingCount;
+
+/** Calls block once every value submitted so far has been passed on; straight away if there
+    are none pending. */
+- (void)whenDrained:(void (^)(void))block;
+
+/** Stops passing on results, including those still being decoded. */
+- (void)cancel;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,160 @@
+//
+//  TDJSONDecodePool.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+
+#import "TDJSONDecodePool.h"
+
+#import "TDJSON.h"
+
+@interface TDJSONDecodePool ()
+- (void)addOperationWithBlock:(void (^)(void))block;
+@end
+
+@implementation TDJSONDecodePool {
+    NSOperationQueue *_queue;
+}
+
++ (instancetype)sharedPool
+{
+    static TDJSONDecodePool *sharedPool;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedPool = [[TDJSONDecodePool alloc]
+            initWithMaximumWorkers:[NSProcessInfo processInfo].activeProcessorCount];
+    });
+    return sharedPool;
+}
+
+- (instancetype)initWithMaximumWorkers:(NSUInteger)maximumWorkers
+{
+    self = [super init];
+    if (self) {
+        _maximumWorkers = MAX(maximumWorkers, (NSUInteger)1);
+        _queue = [[NSOperationQueue alloc] init];
+        _queue.name = @"com.cloudant.sync.jsondecode";
+        _queue.maxConcurrentOperationCount = (NSInteger)_maximumWorkers;
+        _queue.qualityOfService = NSQualityOfServiceUtility;
+    }
+    return self;
+}
+
+- (void)addOperationWithBlock:(void (^)(void))block { [_queue addOperationWithBlock:block]; }
+
+@end
+
+static id decodeJSON(NSData *json, TDJSONDecodeTransform transform, NSError **outError)
+{
+    id value = [TDJSON JSONObjectWithData:json options:TDJSONReadingAllowFragments error:outError];
+    return (value && transform) ? transform(value) : value;
+}
+
+@implementation TDJSONDecodeSequence {
+    TDJSONDecodePool *_pool;
+    TDJSONDecodeTransform _transform;
+    void (^_onResult)(id, NSError *);
+    NSThread *_thread;
+
+    // Only used on _thread:
+    NSUInteger _submitted;
+    NSUInteger _passedOn;
+    NSMutableDictionary<NSNumber *, NSArray *> *_decoded;  // [result, error] by index, out of order
+    NSMutableArray<void (^)(void)> *_drainBlocks;
+    BOOL _cancelled;
+}
+
+- (instancetype)initWithPool:(TDJSONDecodePool *)pool
+                   transform:(TDJSONDecodeTransform)transform
+                    onResult:(void (^)(id, NSError *))onResult
+{
+    self = [super init];
+    if (self) {
+        _pool = pool;
+        _transform = [transform copy];
+        _onResult = [onResult copy];
+        _thread = [NSThread currentThread];
+        _decoded = [NSMutableDictionary dictionary];
+        _drainBlocks = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (NSUInteger)pendingCount { return _submitted - _passedOn; }
+
+- (void)decodeData:(NSData *)json
+{
+    if (_cancelled) return;
+
+    NSUInteger index = _submitted++;
+    if (!_pool) {
+        NSError *error = nil;
+        id result = decodeJSON(json, _transform, &error);
+        [self decodedIndex:index result:result error:error];
+        return;
+    }
+
+    NSData *copy = [json copy];  // the caller's bytes may be reused once this returns
+    TDJSONDecodeTransform transform = _transform;
+    [_pool addOperationWithBlock:^{
+        NSError *error = nil;
+        id result = decodeJSON(copy, transform, &error);
+        void (^decoded)(void) = ^{
+            [self decodedIndex:index result:result error:error];
+        };
+        [self performSelector:@selector(performBlock:)
+                     onThread:self->_thread
+                   withObject:[decoded copy]
+                waitUntilDone:NO];
+    }];
+}
+
+- (void)performBlock:(void (^)(void))block { block(); }
+
+- (void)decodedIndex:(NSUInteger)index result:(id)result error:(NSError *)error
+{
+    if (_cancelled) return;
+    _decoded[@(index)] = @[ result ?: [NSNull null], error ?: [NSNull null] ];
+
+    // Pass on whatever is now next in order:
+    NSArray *next;
+    while (!_cancelled && (next = _decoded[@(_passedOn)])) {
+        [_decoded removeObjectForKey:@(_passedOn)];
+        _passedOn++;
+        id nextResult = (next[0] != [NSNull null]) ? next[0] : nil;
+        NSError *nextError = (next[1] != [NSNull null]) ? next[1] : nil;
+        if (nextResult || nextError) _onResult(nextResult, nextError);
+    }
+    if (_passedOn == _submitted) [self runDrainBlocks];
+}
+
+- (void)whenDrained:(void (^)(void))block
+{
+    [_drainBlocks addObject:[block copy]];
+    if (_passedOn == _submitted) [self runDrainBlocks];
+}
+
+- (void)runDrainBlocks
+{
+    NSArray *blocks = _drainBlocks;
+    _drainBlocks = [NSMutableArray array];
+    for (void (^block)(void) in blocks) block();
+}
+
+- (void)cancel
+{
+    _cancelled = YES;
+    [_decoded removeAllObjects];
+    [_drainBlocks removeAllObjects];
+}
+
+@end
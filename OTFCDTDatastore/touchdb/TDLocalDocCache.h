@@ -0,0 +1,77 @@
+//
+//  TDLocalDocCache.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/** A local document's current revision ID and JSON, as stored; neither if it doesn't exist. */
+@interface TDLocalDocument : NSObject
+
+- (instancetype)initWithRevID:(nullable NSString*)revID json:(nullable NSData*)json;
+
+@property (readonly, copy, nullable) NSString* revID;
+@property (readonly, nullable) NSData* json;
+
+@end
+
+/**
+ A write-behind cache of a database's local documents.
+
+ Local documents are cached as they're read, and updated as they're written. Writes are marked
+ dirty and the flush handler is called once they've been waiting `flushDelay`, so a document
+ written many times in quick succession is written to the database once, and many documents
+ written together are written in one transaction. Dirty documents are never dropped from the
+ cache; clean ones are beyond a hundred or so.
+
+ The cache is safe to use from several threads. Callers checking a document and then updating
+ it synchronize on the cache around the two.
+ */
+@interface TDLocalDocCache : NSObject
+
+/** @param flushHandler Called on a background queue to write the dirty documents. */
+- (instancetype)initWithFlushHandler:(void (^)(void))flushHandler NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/** How long writes wait before being flushed. Defaults to 1 second. At 0 or less, writes aren't
+    cached as dirty: the database writes them through itself. */
+@property NSTimeInterval flushDelay;
+
+/** The cached state of a document, dirty or clean, or nil if it isn't cached. */
+- (nullable TDLocalDocument*)documentWithID:(NSString*)docID;
+
+/** Caches a document as it is in the database. */
+- (void)setDocument:(TDLocalDocument*)document forID:(NSString*)docID;
+
+/** Caches a document which has yet to be written, and schedules a flush. */
+- (void)updateDocument:(TDLocalDocument*)document forID:(NSString*)docID;
+
+/** The documents waiting to be written. */
+- (NSDictionary<NSString*, TDLocalDocument*>*)dirtyDocuments;
+
+/** Marks documents returned by -dirtyDocuments clean once they've been written, unless they've
+    been updated again since. */
+- (void)documentsWereWritten:(NSDictionary<NSString*, TDLocalDocument*>*)documents;
+
+/** Drops the documents as they were read from the database, keeping those yet to be written; for
+    when another process may have changed them. */
+- (void)removeCleanDocuments;
+
+/** Drops every document, dirty or not, and cancels a pending flush. */
+- (void)removeAllDocuments;
+
+@end
+
+NS_ASSUME_NONNULL_END
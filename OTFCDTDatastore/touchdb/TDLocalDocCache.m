@@ -0,0 +1,136 @@
+//
+//  TDLocalDocCache.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDLocalDocCache.h"
+
+/** Number of clean documents kept. */
+static const NSUInteger kCleanDocumentCapacity = 100;
+
+@implementation TDLocalDocument
+
+- (instancetype)initWithRevID:(NSString*)revID json:(NSData*)json
+{
+    if (self = [super init]) {
+        _revID = [revID copy];
+        _json = json;
+    }
+    return self;
+}
+
+@end
+
+@implementation TDLocalDocCache {
+    // All guarded by self.
+    NSMutableDictionary<NSString*, TDLocalDocument*>* _dirty;
+    NSCache<NSString*, TDLocalDocument*>* _clean;
+    BOOL _flushScheduled;
+    NSUInteger _generation;  // bumped by -removeAllDocuments, so a pending flush is dropped
+
+    void (^_flushHandler)(void);
+    dispatch_queue_t _flushQueue;
+}
+
+- (instancetype)initWithFlushHandler:(void (^)(void))flushHandler
+{
+    if (self = [super init]) {
+        _dirty = [NSMutableDictionary dictionary];
+        _clean = [[NSCache alloc] init];
+        _clean.countLimit = kCleanDocumentCapacity;
+        _flushHandler = [flushHandler copy];
+        _flushQueue = dispatch_queue_create("com.cloudant.sync.db.localdocs",
+                                            dispatch_queue_attr_make_with_qos_class(
+                                                DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0));
+        _flushDelay = 1.0;
+    }
+    return self;
+}
+
+- (TDLocalDocument*)documentWithID:(NSString*)docID
+{
+    @synchronized(self) { return _dirty[docID] ?: [_clean objectForKey:docID]; }
+}
+
+- (void)setDocument:(TDLocalDocument*)document forID:(NSString*)docID
+{
+    @synchronized(self)
+    {
+        [_dirty removeObjectForKey:docID];
+        [_clean setObject:document forKey:docID];
+    }
+}
+
+- (void)updateDocument:(TDLocalDocument*)document forID:(NSString*)docID
+{
+    NSTimeInterval delay = self.flushDelay;
+    NSUInteger generation;
+    @synchronized(self)
+    {
+        [_clean removeObjectForKey:docID];
+        _dirty[docID] = document;
+        if (_flushScheduled) return;
+        _flushScheduled = YES;
+        generation = _generation;
+    }
+
+    // Writes made before the flush runs go in it too.
+    __weak TDLocalDocCache* weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(MAX(delay, 0) * NSEC_PER_SEC)),
+                   _flushQueue, ^{
+                       TDLocalDocCache* strongSelf = weakSelf;
+                       if (!strongSelf) return;
+                       @synchronized(strongSelf)
+                       {
+                           if (strongSelf->_generation != generation) return;
+                           strongSelf->_flushScheduled = NO;
+                       }
+                       strongSelf->_flushHandler();
+                   });
+}
+
+- (NSDictionary<NSString*, TDLocalDocument*>*)dirtyDocuments
+{
+    @synchronized(self) { return [_dirty copy]; }
+}
+
+- (void)documentsWereWritten:(NSDictionary<NSString*, TDLocalDocument*>*)documents
+{
+    @synchronized(self)
+    {
+        [documents enumerateKeysAndObjectsUsingBlock:^(NSString* docID, TDLocalDocument* doc,
+                                                       BOOL* stop) {
+            if (self->_dirty[docID] == doc) {
+                [self->_dirty removeObjectForKey:docID];
+                [self->_clean setObject:doc forKey:docID];
+            }
+        }];
+    }
+}
+
+- (void)removeCleanDocuments
+{
+    @synchronized(self) { [_clean removeAllObjects]; }
+}
+
+- (void)removeAllDocuments
+{
+    @synchronized(self)
+    {
+        [_dirty removeAllObjects];
+        [_clean removeAllObjects];
+        _flushScheduled = NO;
+        _generation++;
+    }
+}
+
+@end
@@ -13,6 +13,12 @@ extern NSString* const TDHTTPErrorDomain;
 
 NSString* TDCreateUUID(void);
 
+/** Returns a UUID in the same form as TDCreateUUID, but laid out as a version 7 UUID: the time in
+    milliseconds comes first, then a counter, then random bits. Each ID sorts after the ones made
+    before it in this process, even within the same millisecond, so IDs made together sit next to
+    each other in an index. */
+NSString* TDCreateTimeOrderedUUID(void);
+
 NSData* TDSHA1Digest(NSData* input);
 NSData* TDSHA256Digest(NSData* input);
 
@@ -20,6 +20,7 @@
 
 #import "CollectionUtils.h"
 #import <errno.h>
+#import <pthread.h>
 
 #import <CommonCrypto/CommonDigest.h>
 #import <CommonCrypto/CommonHMAC.h>
@@ -47,6 +48,34 @@ NSString* TDCreateUUID()
 #endif
 }
 
+NSString* TDCreateTimeOrderedUUID(void)
+{
+    static pthread_mutex_t sLock = PTHREAD_MUTEX_INITIALIZER;
+    static UInt64 sLastMillis;
+    static UInt16 sCounter;
+
+    UInt64 now = (UInt64)([[NSDate date] timeIntervalSince1970] * 1000.0);
+    pthread_mutex_lock(&sLock);
+    if (now > sLastMillis) {
+        sLastMillis = now;
+        sCounter = (UInt16)arc4random_uniform(0x800);  // leaves room to count up in this millisecond
+    } else if (++sCounter > 0xFFF) {
+        // Out of counter, or the clock went back: borrow from the next millisecond.
+        sLastMillis++;
+        sCounter = (UInt16)arc4random_uniform(0x800);
+    }
+    UInt64 millis = sLastMillis;
+    UInt16 counter = sCounter;
+    pthread_mutex_unlock(&sLock);
+
+    UInt64 random;
+    arc4random_buf(&random, sizeof(random));
+    return [NSString stringWithFormat:@"%08X-%04X-%04X-%04X-%012llX", (unsigned)(millis >> 16),
+                                      (unsigned)(millis & 0xFFFF), 0x7000 | counter,
+                                      (unsigned)(0x8000 | (random & 0x3FFF)),
+                                      (random >> 16) & 0xFFFFFFFFFFFFull];
+}
+
 NSData* TDSHA1Digest(NSData* input)
 {
     unsigned char digest[CC_SHA1_DIGEST_LENGTH];
@@ -0,0 +1,37 @@
+//
+//  TDMultiInputStream.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ An input stream that returns the contents of a sequence of inputs one after another: NSData
+ objects, file URLs and other input streams. Reads are served straight from the inputs into the
+ reader's buffer; files are read from their descriptors with a single read() of whatever length is
+ asked for. That makes it suitable as the HTTPBodyStream of a request for a large upload, which
+ the HTTP layer then reads on its own thread.
+
+ The stream can be read synchronously or scheduled on a run loop. Like TDBase64InputStream it can
+ be opened again after it has been closed, which starts it over from the first input, so a request
+ body can be resent; input streams among the inputs are closed and opened again.
+ */
+@interface TDMultiInputStream : NSInputStream
+
+/** `inputs` contains NSData objects, file NSURLs and NSInputStreams. */
+- (instancetype)initWithInputs:(NSArray *)inputs;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,293 @@
+//
+//  TDMultiInputStream.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDMultiInputStream.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+@implementation TDMultiInputStream {
+    NSArray *_inputs;
+    NSUInteger _nextInputIndex;
+    NSData *_currentData;
+    NSUInteger _dataOffset;
+    int _fd;
+    NSInputStream *_currentStream;
+    NSStreamStatus _status;
+    NSError *_error;
+    __weak id<NSStreamDelegate> _delegate;
+
+    // Run loop event delivery:
+    NSMutableArray *_runLoops;  // of @[ runLoop, mode ], both as CF objects
+    NSStreamEvent _pendingEvents;
+    CFOptionFlags _clientFlags;
+    CFReadStreamClientCallBack _clientCallback;
+    CFStreamClientContext _clientContext;
+}
+
+- (instancetype)initWithInputs:(NSArray *)inputs
+{
+    self = [super init];
+    if (self) {
+        _inputs = [inputs copy];
+        _fd = -1;
+        _status = NSStreamStatusNotOpen;
+        _runLoops = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self closeCurrentInput];
+    [self setClientContext:NULL];
+}
+
+#pragma mark - Inputs
+
+- (void)closeCurrentInput
+{
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+    [_currentStream close];
+    _currentStream = nil;
+    _currentData = nil;
+}
+
+// Closes the current input and opens the next. Returns NO at the end, or if it couldn't be opened.
+- (BOOL)openNextInput
+{
+    [self closeCurrentInput];
+    if (_nextInputIndex >= _inputs.count) return NO;
+    id input = _inputs[_nextInputIndex++];
+
+    if ([input isKindOfClass:[NSData class]]) {
+        _currentData = input;
+        _dataOffset = 0;
+    } else if ([input isKindOfClass:[NSURL class]] && [input isFileURL]) {
+        _fd = open([input fileSystemRepresentation], O_RDONLY | O_CLOEXEC);
+        if (_fd < 0) {
+            [self failWithErrno];
+            return NO;
+        }
+#ifdef F_RDAHEAD
+        fcntl(_fd, F_RDAHEAD, 1);  // the file is read straight through
+#endif
+    } else if ([input isKindOfClass:[NSInputStream class]]) {
+        _currentStream = input;
+        [_currentStream open];
+    } else {
+        NSAssert(NO, @"Invalid input class %@ for TDMultiInputStream", [input class]);
+        return NO;
+    }
+    return YES;
+}
+
+// Reads from the current input. Returns 0 at its end, or -1 on error.
+- (NSInteger)readCurrentInput:(uint8_t *)buffer maxLength:(NSUInteger)len
+{
+    if (_currentData) {
+        NSUInteger n = MIN(len, _currentData.length - _dataOffset);
+        memcpy(buffer, (const uint8_t *)_currentData.bytes + _dataOffset, n);
+        _dataOffset += n;
+        return n;
+    } else if (_fd >= 0) {
+        ssize_t n;
+        do {
+            n = read(_fd, buffer, len);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) [self failWithErrno];
+        return n;
+    } else if (_currentStream) {
+        NSInteger n = [_currentStream read:buffer maxLength:len];
+        if (n < 0) [self failWithError:_currentStream.streamError];
+        return n;
+    }
+    return 0;
+}
+
+- (void)failWithErrno
+{
+    [self failWithError:[NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil]];
+}
+
+- (void)failWithError:(NSError *)error
+{
+    _error = error;
+    _status = NSStreamStatusError;
+    [self closeCurrentInput];
+    [self postEvents:NSStreamEventErrorOccurred];
+}
+
+#pragma mark - NSStream
+
+- (void)open
+{
+    // Opening again after closing starts over, e.g. because the request is being retried:
+    [self closeCurrentInput];
+    _nextInputIndex = 0;
+    _error = nil;
+    _status = NSStreamStatusOpen;
+    if ([self openNextInput]) {
+        [self postEvents:NSStreamEventOpenCompleted | NSStreamEventHasBytesAvailable];
+    }
+}
+
+- (void)close
+{
+    [self closeCurrentInput];
+    _status = NSStreamStatusClosed;
+    _pendingEvents = 0;
+}
+
+- (NSStreamStatus)streamStatus { return _status; }
+
+- (NSError *)streamError { return _error; }
+
+- (id<NSStreamDelegate>)delegate { return _delegate; }
+
+- (void)setDelegate:(id<NSStreamDelegate>)delegate { _delegate = delegate; }
+
+- (id)propertyForKey:(NSStreamPropertyKey)key { return nil; }
+
+- (BOOL)setProperty:(id)property forKey:(NSStreamPropertyKey)key { return NO; }
+
+#pragma mark - NSInputStream
+
+- (BOOL)hasBytesAvailable { return _status == NSStreamStatusOpen; }
+
+- (BOOL)getBuffer:(uint8_t **)buffer length:(NSUInteger *)len { return NO; }
+
+- (NSInteger)read:(uint8_t *)buffer maxLength:(NSUInteger)len
+{
+    if (_status == NSStreamStatusError) return -1;
+    if (_status != NSStreamStatusOpen) return 0;
+
+    NSUInteger total = 0;
+    while (total < len) {
+        NSInteger n = [self readCurrentInput:buffer + total maxLength:len - total];
+        if (n < 0) {
+            return -1;
+        } else if (n > 0) {
+            total += n;
+        } else if (![self openNextInput]) {
+            break;
+        }
+    }
+    if (_status == NSStreamStatusError) return -1;
+    if (total == 0) {
+        _status = NSStreamStatusAtEnd;
+        [self postEvents:NSStreamEventEndEncountered];
+    } else {
+        [self postEvents:NSStreamEventHasBytesAvailable];
+    }
+    return total;
+}
+
+#pragma mark - Run loop events
+
+- (void)scheduleInRunLoop:(NSRunLoop *)aRunLoop forMode:(NSRunLoopMode)mode
+{
+    [self _scheduleInCFRunLoop:[aRunLoop getCFRunLoop] forMode:(__bridge CFStringRef)mode];
+}
+
+- (void)removeFromRunLoop:(NSRunLoop *)aRunLoop forMode:(NSRunLoopMode)mode
+{
+    [self _unscheduleFromCFRunLoop:[aRunLoop getCFRunLoop] forMode:(__bridge CFStringRef)mode];
+}
+
+// CFNetwork schedules and listens to request body streams through the CFReadStream API, which
+// calls these on NSInputStream subclasses.
+
+- (void)_scheduleInCFRunLoop:(CFRunLoopRef)runLoop forMode:(CFStringRef)mode
+{
+    [_runLoops addObject:@[ (__bridge id)runLoop, (__bridge id)mode ]];
+    if (_pendingEvents) [self performEventsInRunLoop:runLoop mode:mode];
+}
+
+- (void)_unscheduleFromCFRunLoop:(CFRunLoopRef)runLoop forMode:(CFStringRef)mode
+{
+    [_runLoops removeObject:@[ (__bridge id)runLoop, (__bridge id)mode ]];
+}
+
+- (BOOL)_setCFClientFlags:(CFOptionFlags)flags
+                 callback:(CFReadStreamClientCallBack)callback
+                  context:(CFStreamClientContext *)context
+{
+    _clientFlags = callback ? flags : 0;
+    _clientCallback = callback;
+    [self setClientContext:callback ? context : NULL];
+    return YES;
+}
+
+- (void)setClientContext:(CFStreamClientContext *)context
+{
+    if (_clientContext.info && _clientContext.release) _clientContext.release(_clientContext.info);
+    memset(&_clientContext, 0, sizeof(_clientContext));
+    if (context) {
+        _clientContext = *context;
+        if (_clientContext.info && _clientContext.retain) {
+            _clientContext.info = (void *)_clientContext.retain(_clientContext.info);
+        }
+    }
+}
+
+// Queues events to be delivered on the run loops the stream is scheduled on. Events are only
+// delivered for as long as the stream is open, and are coalesced until then.
+- (void)postEvents:(NSStreamEvent)events
+{
+    BOOL alreadyPending = (_pendingEvents != 0);
+    _pendingEvents |= events;
+    if (alreadyPending) return;
+    for (NSArray *entry in _runLoops) {
+        [self performEventsInRunLoop:(__bridge CFRunLoopRef)entry[0]
+                                mode:(__bridge CFStringRef)entry[1]];
+    }
+}
+
+- (void)performEventsInRunLoop:(CFRunLoopRef)runLoop mode:(CFStringRef)mode
+{
+    __weak TDMultiInputStream *weakSelf = self;
+    CFRunLoopPerformBlock(runLoop, mode, ^{
+        [weakSelf deliverPendingEvents];
+    });
+    CFRunLoopWakeUp(runLoop);
+}
+
+- (void)deliverPendingEvents
+{
+    NSStreamEvent events = _pendingEvents;
+    _pendingEvents = 0;
+    // Events are delivered in the order they happen, and a read from a handler can queue more:
+    static const NSStreamEvent kOrder[] = {NSStreamEventOpenCompleted,
+                                           NSStreamEventHasBytesAvailable,
+                                           NSStreamEventErrorOccurred,
+                                           NSStreamEventEndEncountered};
+    for (size_t i = 0; i < sizeof(kOrder) / sizeof(kOrder[0]); i++) {
+        if (!(events & kOrder[i]) || _status == NSStreamStatusClosed) continue;
+        id<NSStreamDelegate> delegate = _delegate;
+        if ([delegate respondsToSelector:@selector(stream:handleEvent:)]) {
+            [delegate stream:self handleEvent:kOrder[i]];
+        }
+        // CFStreamEventType and NSStreamEvent have the same values:
+        if (_clientCallback && (_clientFlags & kOrder[i])) {
+            _clientCallback((__bridge CFReadStreamRef)self, (CFStreamEventType)kOrder[i],
+                            _clientContext.info);
+        }
+    }
+}
+
+@end
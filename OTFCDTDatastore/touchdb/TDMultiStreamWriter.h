@@ -43,7 +43,7 @@
 @property (readonly) SInt64 length;
 
 /** Returns an input stream; reading from this will return the contents of all added streams in
-   sequence.
+   sequence, read from them directly (see TDMultiInputStream) without going through the buffer.
     This stream can be set as the HTTPBodyStream of an NSURLRequest.
     It is the caller's responsibility to close the returned stream. */
 - (NSInputStream*)openForInputStream;
@@ -16,6 +16,7 @@
 //  Modifications for this distribution by Cloudant, Inc., Copyright (c) 2014 Cloudant, Inc.
 
 #import "TDMultiStreamWriter.h"
+#import "TDMultiInputStream.h"
 #import "CDTLogging.h"
 #import "Test.h"
 
@@ -27,7 +28,7 @@
 
 @implementation TDMultiStreamWriter
 
-@synthesize error = _error, length = _length;
+@synthesize length = _length;
 
 - (id)initWithBufferSize:(NSUInteger)bufferSize
 {
@@ -85,14 +86,25 @@
 
 - (BOOL)addFile:(NSString*)path { return [self addFileURL:[NSURL fileURLWithPath:path]]; }
 
+- (NSError*)error
+{
+    @synchronized(self) { return _error ?: _input.streamError; }
+}
+
+- (void)setError:(NSError*)error
+{
+    @synchronized(self) { _error = error; }
+}
+
 #pragma mark - OPENING:
 
-- (BOOL)isOpen { return _output.delegate != nil; }
+- (BOOL)isOpen { return _input != nil || _output.delegate != nil; }
 
 - (void)opened
 {
     _error = nil;
     _totalBytesWritten = 0;
+    if (!_output) return;  // read through -openForInputStream; there's nothing to copy
 
     _output.delegate = self;
     [_output scheduleInRunLoop:[NSRunLoop currentRunLoop] forMode:NSDefaultRunLoopMode];
@@ -103,17 +115,11 @@
 {
     if (_input) return _input;
     Assert(!_output, @"Already open");
-#ifdef GNUSTEP
-    Assert(NO, @"Unimplemented CFStreamCreateBoundPair");  // TODO: Add this to GNUstep base fw
-#else
-    CFReadStreamRef cfInput;
-    CFWriteStreamRef cfOutput;
-    CFStreamCreateBoundPair(NULL, &cfInput, &cfOutput, _bufferSize);
-    _input = CFBridgingRelease(cfInput);
-    _output = CFBridgingRelease(cfOutput);
-#endif
-    os_log_info(CDTOSLog, "%{public}@: Opened input=%{public}p, output=%{public}p", self, _input, _output);
+    // The reader gets the inputs directly, rather than through a bound pair of streams and a
+    // copy into _buffer. -opened comes first, as subclasses may add final inputs in it.
     [self opened];
+    _input = [[TDMultiInputStream alloc] initWithInputs:_inputs];
+    os_log_info(CDTOSLog, "%{public}@: Opened input=%{public}p", self, _input);
     return _input;
 }
 
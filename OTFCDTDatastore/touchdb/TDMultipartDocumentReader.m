@@ -201,6 +201,7 @@
     else {
         os_log_info(CDTOSLog, "%{public}@: Starting attachment #%{public}u...", self, (unsigned)_attachmentsByDigest.count + 1);
         _curAttachment = [_database attachmentWriter];
+        _curAttachment.computesMD5Digest = [self needsMD5Digests];
 
         // See whether the attachment name is in the headers.
         NSString* disposition = headers[@"Content-Disposition"];
@@ -232,7 +233,7 @@
         // Finished downloading an attachment. Remember the association from the MD5 digest
         // (which appears in the body's _attachments dict) to the blob-store key of the data.
         [_curAttachment finish];
-        NSString* md5Str = _curAttachment.MD5DigestString;
+        NSString* md5Str = _curAttachment.digestString;
 #ifndef MY_DISABLE_LOGGING
         TDBlobKey key = _curAttachment.blobKey;
         NSData* keyData = [NSData dataWithBytes:&key length:sizeof(key)];
@@ -268,6 +269,21 @@
     return YES;
 }
 
+/** Whether the attachment bodies need MD5 digests to match them up with the document's
+    _attachments, i.e. unless every attachment that follows already has a SHA-1 digest. */
+- (BOOL)needsMD5Digests
+{
+    NSDictionary* attachments = $castIf(NSDictionary, _document[@"_attachments"]);
+    for (NSString* attachmentName in attachments) {
+        NSDictionary* attachment = $castIf(NSDictionary, attachments[attachmentName]);
+        if ([attachment[@"follows"] isEqual:$true] &&
+            ![$castIf(NSString, attachment[@"digest"]) hasPrefix:@"sha1-"]) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
 - (BOOL)registerAttachments
 {
     NSDictionary* attachments = _document[@"_attachments"];
@@ -285,7 +301,7 @@
             TDBlobStoreWriter* writer = _attachmentsByName[attachmentName];
             if (writer) {
                 // Identified the MIME body by the filename in its Disposition header:
-                NSString* actualDigest = writer.MD5DigestString;
+                NSString* actualDigest = writer.digestString;
                 if (digest && !$equal(digest, actualDigest) &&
                     !$equal(digest, writer.SHA1DigestString)) {
                     os_log_debug(CDTOSLog, "%{public}@: Attachment '%{public}@' has incorrect MD5 digest (%{public}@; should be %{public}@)", self, attachmentName, digest, actualDigest);
@@ -302,7 +318,7 @@
             } else if (attachments.count == 1 && _attachmentsByDigest.count == 1) {
                 // Else there's only one attachment, so just assume it matches & use it:
                 writer = [_attachmentsByDigest allValues][0];
-                attachment[@"digest"] = writer.MD5DigestString;
+                attachment[@"digest"] = writer.digestString;
             } else {
                 // No digest metatata, no filename in MIME body; give up:
                 os_log_debug(CDTOSLog, "%{public}@: Attachment '%{public}@' has no digest metadata; cannot identify MIME body", self, attachmentName);
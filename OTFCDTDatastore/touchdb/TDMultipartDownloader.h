@@ -10,11 +10,14 @@
 @class TDMultipartDocumentReader, TD_Database;
 
 /** Downloads a remote CouchDB document in multipart format.
-    Attachments are added to the database, but the document body isn't. */
+    Attachments are added to the database, but the document body isn't. A successful response is
+    parsed as it arrives, so each attachment streams into a blob store writer, which hashes it as
+    it goes, rather than the whole response being held in memory. */
 @interface TDMultipartDownloader : TDRemoteRequest {
    @private
     TD_Database* _db;
     TDMultipartDocumentReader* _reader;
+    BOOL _streaming;
 }
 
 - (instancetype)initWithSession:(CDTURLSession*) session
@@ -40,6 +40,8 @@
         _db = database;
         _reader = [[TDMultipartDocumentReader alloc] initWithDatabase:_db];
         [_request setValue:@"multipart/related, application/json" forHTTPHeaderField:@"Accept"];
+        // Documents are fetched one by one like this for the sake of their attachments:
+        self.priority = CDTHTTPRequestPriorityAttachments;
     }
     return self;
 }
@@ -48,31 +50,66 @@
 
 - (NSDictionary *)document { return _reader.document; }
 
+- (void)start
+{
+    if (!_request) return;  // -clearSession already called
+
+    // A retry starts reading the document afresh, as an earlier attempt may have got partway:
+    _reader = [[TDMultipartDocumentReader alloc] initWithDatabase:_db];
+    _streaming = NO;
+    [super start];
+}
+
+/** Sets the reader's content type from a successful response's headers. */
+- (BOOL)setContentTypeFromResponse:(NSHTTPURLResponse *)response
+{
+    NSString *contentType = response.allHeaderFields[@"Content-Type"];
+    if ([contentType hasPrefix:@"text/plain"])
+        contentType = nil;  // Workaround for CouchDB returning JSON docs with text/plain type
+    if (![_reader setContentType:contentType]) {
+        os_log_info(CDTOSLog, "%{public}@ got invalid Content-Type '%{public}@'", self, contentType);
+        [self cancelWithStatus:(int)_reader.status];
+        return NO;
+    }
+    return YES;
+}
+
 #pragma mark - URL CONNECTION CALLBACKS:
 
+- (void)receivedStreamingResponse:(NSHTTPURLResponse *)response
+{
+    // Check the content type to see whether it's a multipart response:
+    _streaming = YES;
+    [self setContentTypeFromResponse:response];
+}
+
+- (void)receivedPartialData:(NSData *)data
+{
+    if (TDStatusIsError(_reader.status)) return;  // already failed
+    if (![_reader appendData:data]) [self cancelWithStatus:(int)_reader.status];
+}
+
 - (void)receivedResponse:(NSURLResponse *)response
 {
     TDStatus status = (TDStatus)((NSHTTPURLResponse *)response).statusCode;
-    if (status < 300) {
-        // Check the content type to see whether it's a multipart response:
-        NSDictionary *headers = [(NSHTTPURLResponse *)response allHeaderFields];
-        NSString *contentType = headers[@"Content-Type"];
-        if ([contentType hasPrefix:@"text/plain"])
-            contentType = nil;  // Workaround for CouchDB returning JSON docs with text/plain type
-        if (![_reader setContentType:contentType]) {
-            os_log_info(CDTOSLog, "%{public}@ got invalid Content-Type '%{public}@'", self, contentType);
-            [self cancelWithStatus:(int)_reader.status];
-            return;
-        }
+    if (status < 300 && !_streaming) {
+        // A successful response is normally streamed, and its content type already checked
+        if (![self setContentTypeFromResponse:(NSHTTPURLResponse *)response]) return;
     }
-    
+
     [super receivedResponse:response];
 }
 
 - (void)receivedData:(NSData *)data
 {
     [super receivedData:data];
-    if (![_reader appendData:data]) [self cancelWithStatus:(int)_reader.status];
+    if (TDStatusIsError(_status) || TDStatusIsError(_reader.status) || !_request)
+        return;  // already failed
+    // The body of a streamed response has already been read, and data is nil:
+    if (data && ![_reader appendData:data]) {
+        [self cancelWithStatus:(int)_reader.status];
+        return;
+    }
 
     os_log_debug(CDTOSLog, "%{public}@: Finished loading (%{public}u attachments)", self, (unsigned)_reader.attachmentCount);
     if (![_reader finish]) {
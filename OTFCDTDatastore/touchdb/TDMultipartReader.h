@@ -16,7 +16,9 @@
    @private
     __weak id<TDMultipartReaderDelegate> _delegate;
     NSData* _boundary;
-    NSMutableData* _buffer;
+    NSMutableData* _buffer;  // unparsed bytes left over from earlier calls to -appendData:
+    NSData* _chunk;          // data passed to the current -appendData: call
+    NSUInteger _chunkPos;    // offset in _chunk of the bytes after those in _buffer
     NSMutableDictionary* _headers;
     int _state;
     NSString* _error;
@@ -52,7 +54,9 @@
 /** This method is called when a part's headers have been parsed, before its data is parsed. */
 - (void)startedPart:(NSDictionary*)headers;
 
-/** This method is called to append data to a part's body. */
+/** This method is called to append data to a part's body. The data is usually a slice of that
+    passed to -appendData:, sharing its bytes, so copy it rather than keeping it if only a small
+    part is needed. */
 - (void)appendToPart:(NSData*)data;
 
 /** This method is called when a part is complete. */
@@ -42,6 +42,41 @@ static NSString* trim(NSString* str)
     return [str stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
 }
 
+/** Returns the first occurrence of `pattern` in `bytes`, or NULL. memchr, which libc vectorises,
+    skips to each candidate first byte; only those are compared in full. */
+static const uint8_t* findBytes(const uint8_t* bytes, NSUInteger length, const uint8_t* pattern,
+                                NSUInteger patternLength)
+{
+    if (patternLength == 0 || length < patternLength) return NULL;
+    const uint8_t* end = bytes + length - patternLength + 1;  // past the last possible match
+    for (const uint8_t* p = bytes; p < end; p++) {
+        p = memchr(p, pattern[0], end - p);
+        if (!p) break;
+        if (memcmp(p + 1, pattern + 1, patternLength - 1) == 0) return p;
+    }
+    return NULL;
+}
+
+/** Returns the length of the longest end of `bytes` which could be the start of `pattern`. */
+static NSUInteger partialMatchLength(const uint8_t* bytes, NSUInteger length, NSData* pattern)
+{
+    for (NSUInteger n = MIN(length, pattern.length - 1); n > 0; n--) {
+        if (memcmp(bytes + length - n, pattern.bytes, n) == 0) return n;
+    }
+    return 0;
+}
+
+/** Returns the bytes of `data` in `range` without copying them; the slice keeps `data` alive. */
+static NSData* slice(NSData* data, NSRange range)
+{
+    if (range.location == 0 && range.length == data.length) return data;
+    return [[NSData alloc] initWithBytesNoCopy:(void*)((const uint8_t*)data.bytes + range.location)
+                                        length:range.length
+                                   deallocator:^(void* bytes, NSUInteger length) {
+                                       (void)data;
+                                   }];
+}
+
 @implementation TDMultipartReader
 
 static NSData* kCRLFCRLF;
@@ -68,6 +103,7 @@ static NSData* kCRLFCRLF;
 - (void)close
 {
     _buffer = nil;
+    _chunk = nil;
     _headers = nil;
     _boundary = nil;
 }
@@ -127,26 +163,88 @@ static NSData* kCRLFCRLF;
     return YES;
 }
 
-- (NSRange)searchFor:(NSData*)pattern from:(NSUInteger)start
+// The methods below work on the unparsed input: the bytes of _buffer followed by those of _chunk
+// from _chunkPos. Offsets are from the start of _buffer. _buffer only holds what can't be parsed
+// until more data arrives (the start of a header block, or the bytes which might be the start of a
+// boundary), so it stays small and data in part bodies is scanned in place, without being copied.
+
+- (const uint8_t*)chunkBytes { return (const uint8_t*)_chunk.bytes + _chunkPos; }
+
+- (NSUInteger)chunkLength { return _chunk.length - _chunkPos; }
+
+/** Returns the offset of the first occurrence of `pattern` in the input, or NSNotFound. _buffer
+    must already have been searched, so only matches which end in _chunk are looked for. */
+- (NSUInteger)searchFor:(NSData*)pattern
+{
+    const uint8_t* pat = pattern.bytes;
+    NSUInteger patLen = pattern.length;
+    NSUInteger bufLen = _buffer.length;
+    NSUInteger chunkLen = self.chunkLength;
+
+    // A match starting in _buffer would start in its last patLen-1 bytes:
+    const uint8_t* buf = _buffer.bytes;
+    for (NSUInteger i = (bufLen >= patLen ? bufLen - patLen + 1 : 0); i < bufLen; i++) {
+        NSUInteger inBuf = bufLen - i, inChunk = patLen - inBuf;
+        if (inChunk <= chunkLen && memcmp(buf + i, pat, inBuf) == 0 &&
+            memcmp(self.chunkBytes, pat + inBuf, inChunk) == 0)
+            return i;
+    }
+
+    const uint8_t* match = findBytes(self.chunkBytes, chunkLen, pat, patLen);
+    return match ? bufLen + (match - self.chunkBytes) : NSNotFound;
+}
+
+/** Moves bytes from _chunk into _buffer until it holds `length`, or _chunk runs out. */
+- (void)bufferUpTo:(NSUInteger)length
 {
-    return [_buffer rangeOfData:pattern options:0 range:NSMakeRange(start, _buffer.length - start)];
+    if (_buffer.length >= length) return;
+    NSUInteger n = MIN(length - _buffer.length, self.chunkLength);
+    [_buffer appendBytes:self.chunkBytes length:n];
+    _chunkPos += n;
 }
 
-- (void)deleteUpThrough:(NSRange)r
+/** Passes the input up to `end` to the delegate, sharing the bytes of _chunk. */
+- (void)appendToPartUpTo:(NSUInteger)end
 {
-    [_buffer replaceBytesInRange:NSMakeRange(0, NSMaxRange(r)) withBytes:NULL length:0];
+    NSUInteger bufLen = _buffer.length;
+    if (bufLen > 0) {
+        NSUInteger n = MIN(end, bufLen);
+        [_delegate appendToPart:[_buffer subdataWithRange:NSMakeRange(0, n)]];
+    }
+    if (end > bufLen) {
+        [_delegate appendToPart:slice(_chunk, NSMakeRange(_chunkPos, end - bufLen))];
+    }
 }
 
-- (void)trimBuffer
+/** Discards the input up to `end`. */
+- (void)consumeUpTo:(NSUInteger)end
 {
     NSUInteger bufLen = _buffer.length;
-    NSUInteger boundaryLen = _boundary.length;
-    if (bufLen > boundaryLen) {
-        // Leave enough bytes in _buffer that we can find an incomplete boundary string
-        NSRange trim = NSMakeRange(0, bufLen - boundaryLen);
-        [_delegate appendToPart:[_buffer subdataWithRange:trim]];
-        [self deleteUpThrough:trim];
+    if (end < bufLen) {
+        [_buffer replaceBytesInRange:NSMakeRange(0, end) withBytes:NULL length:0];
+    } else {
+        _buffer.length = 0;
+        _chunkPos += end - bufLen;
+    }
+}
+
+/** Consumes all the input but the end which could be the start of a boundary, passing it to the
+    delegate if `inBody`. The input mustn't contain a whole boundary. */
+- (void)consumeAllButPartialBoundary:(BOOL)inBody
+{
+    NSUInteger chunkLen = self.chunkLength;
+    NSUInteger keep;
+    if (chunkLen < _boundary.length) {
+        // The partial boundary might start in _buffer, which stays short enough to search again.
+        [self bufferUpTo:_buffer.length + chunkLen];
+        keep = partialMatchLength(_buffer.bytes, _buffer.length, _boundary);
+    } else {
+        keep = partialMatchLength(self.chunkBytes, chunkLen, _boundary);
     }
+    NSUInteger end = _buffer.length + self.chunkLength - keep;
+    if (inBody && end > 0) [self appendToPartUpTo:end];
+    [self consumeUpTo:end];
+    [self bufferUpTo:keep];
 }
 
 - (NSString*)error { return _error; }
@@ -161,23 +259,23 @@ static NSData* kCRLFCRLF;
 - (void)appendData:(NSData*)data
 {
     if (!_buffer) return;
-    NSUInteger newDataLen = data.length;
-    if (newDataLen == 0) return;
-    [_buffer appendData:data];
+    if (data.length == 0) return;
+    // Part bodies are slices of the data, so it mustn't change under the delegate; copying
+    // immutable data is free.
+    _chunk = [data copy];
+    _chunkPos = 0;
 
     int nextState;
     do {
         nextState = -1;
-        NSUInteger bufLen = _buffer.length;
         switch (_state) {
             case kAtStart: {
                 // The entire message might start with a boundary without a leading CRLF.
                 NSUInteger testLen = _boundary.length - 2;
-                if (bufLen >= testLen) {
+                [self bufferUpTo:testLen];
+                if (_buffer.length >= testLen) {
                     if (memcmp(_buffer.bytes, _boundary.bytes + 2, testLen) == 0) {
-                        [_buffer replaceBytesInRange:NSMakeRange(0, testLen)
-                                           withBytes:NULL
-                                              length:0];
+                        _buffer.length = 0;
                         nextState = kInHeaders;
                     } else {
                         nextState = kInPrologue;
@@ -189,43 +287,45 @@ static NSData* kCRLFCRLF;
             case kInBody: {
                 // Look for the next part boundary in the data we just added and the ending bytes of
                 // the previous data (in case the boundary string is split across calls)
-                if (bufLen < _boundary.length) break;
-                NSInteger start = MAX(0, (NSInteger)(bufLen - newDataLen - _boundary.length));
-                NSRange r = [self searchFor:_boundary from:start];
-                if (r.length > 0) {
+                NSUInteger location = [self searchFor:_boundary];
+                if (location != NSNotFound) {
                     if (_state == kInBody) {
-                        [_delegate
-                            appendToPart:[_buffer subdataWithRange:NSMakeRange(0, r.location)]];
+                        if (location > 0) [self appendToPartUpTo:location];
                         [_delegate finishedPart];
                     }
-                    [self deleteUpThrough:r];
+                    [self consumeUpTo:location + _boundary.length];
                     nextState = kInHeaders;
                 } else {
-                    [self trimBuffer];
+                    [self consumeAllButPartialBoundary:(_state == kInBody)];
                 }
                 break;
             }
 
             case kInHeaders: {
                 // First check for the end-of-message string ("--" after separator):
-                if (bufLen >= 2 && memcmp(_buffer.bytes, "--", 2) == 0) {
+                [self bufferUpTo:2];
+                if (_buffer.length < 2) break;
+                if (memcmp(_buffer.bytes, "--", 2) == 0) {
                     _state = kAtEnd;
                     [self close];
                     return;
                 }
                 // Otherwise look for two CRLFs that delimit the end of the headers:
-                NSRange r = [self searchFor:kCRLFCRLF from:0];
-                if (r.length > 0) {
-                    NSString* headers = [[NSString alloc] initWithBytesNoCopy:(void*)_buffer.bytes
-                                                                       length:r.location
-                                                                     encoding:NSUTF8StringEncoding
-                                                                 freeWhenDone:NO];
-                    BOOL ok = [self parseHeaders:headers];
-                    if (!ok) return;  // parseHeaders already set .error
-                    [self deleteUpThrough:r];
-                    [_delegate startedPart:_headers];
-                    nextState = kInBody;
+                NSUInteger location = [self searchFor:kCRLFCRLF];
+                if (location == NSNotFound) {
+                    [self bufferUpTo:_buffer.length + self.chunkLength];
+                    break;
                 }
+                [self bufferUpTo:location + kCRLFCRLF.length];
+                NSString* headers = [[NSString alloc] initWithBytesNoCopy:(void*)_buffer.bytes
+                                                                   length:location
+                                                                 encoding:NSUTF8StringEncoding
+                                                             freeWhenDone:NO];
+                BOOL ok = [self parseHeaders:headers];
+                if (!ok) return;  // parseHeaders already set .error
+                [self consumeUpTo:location + kCRLFCRLF.length];
+                [_delegate startedPart:_headers];
+                nextState = kInBody;
                 break;
             }
 
@@ -234,7 +334,8 @@ static NSData* kCRLFCRLF;
                 return;
         }
         if (nextState > 0) _state = nextState;
-    } while (nextState >= 0 && _buffer.length > 0);
+    } while (nextState >= 0 && _buffer && (_buffer.length > 0 || self.chunkLength > 0));
+    _chunk = nil;
 }
 
 - (BOOL)finished { return _state == kAtEnd; }
@@ -0,0 +1,44 @@
+//
+//  TDProcessChangeNotifier.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Lets the processes that have the same database file open, such as an app and its extensions
+ sharing an App Group container, tell each other when they write to it.
+
+ The notifications are Darwin notifications (see notify(3)) named after the file's path, and carry
+ nothing: whoever receives one looks at the database to see what changed. A process receives its
+ own notifications too, and the system may deliver several posted close together as one.
+ */
+@interface TDProcessChangeNotifier : NSObject
+
+/** Starts listening for writes to the database at `path`. The handler is called on a serial
+    background queue. Returns nil if the notification couldn't be registered for. */
+- (nullable instancetype)initWithPath:(NSString *)path handler:(void (^)(void))handler;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/** Tells every process with the database open, this one included, that a write transaction was
+    committed. */
+- (void)databaseWasWritten;
+
+/** Stops posting and calling the handler, though a call already queued may still run. */
+- (void)cancel;
+
+@end
+
+NS_ASSUME_NONNULL_END
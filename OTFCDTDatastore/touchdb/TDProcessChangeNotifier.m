@@ -0,0 +1,76 @@
+//
+//  TDProcessChangeNotifier.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDProcessChangeNotifier.h"
+#import "TDMisc.h"
+#import "CDTLogging.h"
+
+#import <notify.h>
+
+@implementation TDProcessChangeNotifier {
+    NSString* _name;
+    int _token;
+    BOOL _cancelled;  // guarded by self
+}
+
++ (NSString*)notificationNameForPath:(NSString*)path
+{
+    // Each process may reach the file by a different path, e.g. through /private/var or /var
+    NSString* resolved = path.stringByStandardizingPath.stringByResolvingSymlinksInPath;
+    NSString* digest = TDHexSHA1Digest([resolved dataUsingEncoding:NSUTF8StringEncoding]);
+    return [@"com.cloudant.sync.db.changed." stringByAppendingString:digest];
+}
+
+- (instancetype)initWithPath:(NSString*)path handler:(void (^)(void))handler
+{
+    if (self = [super init]) {
+        _name = [TDProcessChangeNotifier notificationNameForPath:path];
+        dispatch_queue_t queue = dispatch_queue_create(
+            "com.cloudant.sync.db.processchanges",
+            dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0));
+        void (^block)(void) = [handler copy];
+        uint32_t status = notify_register_dispatch(_name.UTF8String, &_token, queue, ^(int token) {
+            block();
+        });
+        if (status != NOTIFY_STATUS_OK) {
+            os_log_error(CDTOSLog, "Couldn't listen for other processes' writes to %{public}@: %u",
+                         path, status);
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc { [self cancel]; }
+
+- (void)databaseWasWritten
+{
+    @synchronized(self)
+    {
+        if (_cancelled) return;
+    }
+    notify_post(_name.UTF8String);
+}
+
+- (void)cancel
+{
+    @synchronized(self)
+    {
+        if (_cancelled) return;
+        _cancelled = YES;
+        notify_cancel(_token);
+    }
+}
+
+@end
@@ -10,7 +10,8 @@
 
 #import "TDReplicator.h"
 #import "TD_Revision.h"
-@class TDChangeTracker, TDSequenceMap;
+@class FMDatabase;
+@class TDChangeTracker, TDSequenceMap, TDAdaptiveBatchController, CDTReplicationEstimate;
 
 /** Replicator that pulls from a remote CouchDB. */
 @interface TDPuller : TDReplicator {
@@ -21,13 +22,77 @@
     NSMutableArray* _revsToPull;         // Queue of TDPulledRevisions to download
     NSMutableArray* _deletedRevsToPull;  // Separate lower-priority of deleted TDPulledRevisions
     NSMutableArray* _bulkRevsToPull;     // TDPulledRevisions that can be fetched in bulk - 'all docs trick' for first rev
+    NSMutableArray* _bulkDeletedRevsToPull;  // Deleted TDPulledRevisions to try fetching via _all_docs
     NSMutableArray* _bulkGetRevs;        // <docid,revid> pairs to pull if the /_bulk_get endpoint is supported
     NSUInteger _httpConnectionCount;     // Number of active NSURLConnections
     TDBatcher* _downloadsToInsert;       // Queue of TDPulledRevisions, with bodies, to insert in DB
+    NSMutableSet* _attachmentDownloads;  // Keys of pending attachments being downloaded
+    NSMutableSet* _failedAttachmentDownloads;  // Keys of pending attachments not to retry this time
+    NSSet* _insertedAfterCheckpoint;     // Remote sequences an earlier run inserted past its checkpoint
+    NSMutableDictionary* _branchChecks;  // Fake sequence -> number of local branches being checked
 }
 
 @property BOOL bulkGetSupported;
 
+/** If set, sizes the _changes feed pages and bulk fetches, and limits concurrent fetches, in
+    place of the fixed defaults. The controller should also be one of the replicator's
+    interceptors, so that it sees the server's 429 responses. */
+@property (strong) TDAdaptiveBatchController* batchController;
+
+/** Number of _changes pages to fetch ahead of those waiting to be processed; see
+    TDChangeTracker.prefetchDepth. */
+@property unsigned changesFeedPrefetchDepth;
+
+/** Most revisions read from the _changes feed and not yet stored locally, whether waiting to be
+    fetched, being fetched or waiting to be inserted. Once there are this many, the feed isn't
+    read any further until some have been inserted. 0 for no limit. Defaults to 5000. */
+@property NSUInteger maxPendingRevisions;
+
+/** Most bytes, estimated, of fetched revisions waiting to be inserted. Once there are this many,
+    no more revisions are fetched, nor is the _changes feed read, until they've been inserted.
+    0 for no limit. Defaults to 32MB. */
+@property UInt64 maxPendingBytes;
+
+/** If set, revisions are fetched without the attachments the local database lacks, and inserted
+    straight away; the attachments are then downloaded separately, a few at a time, resuming
+    interrupted downloads where possible. Until all its attachments have arrived, a revision isn't
+    pushed anywhere else. */
+@property BOOL deferAttachmentDownloads;
+
+/** If set, the _changes feed is read with style=main_only, so only the winning revision of each
+    document is fetched. When a pulled winner leaves other live branches in the local document,
+    each is fetched again with latest=true, so that a deletion made remotely to resolve a conflict
+    reaches the local database too; the checkpoint doesn't pass the winner until then. Pulls with
+    and without this keep separate checkpoints. */
+@property BOOL winningRevisionsOnly;
+
+/** If set, the puller fetches the current revisions of just these documents, with _bulk_get,
+    instead of reading the _changes feed; no checkpoint is read or saved. The replication fails
+    if the server doesn't support _bulk_get. */
+@property (copy) NSArray* docIDsToFetch;
+
+/** If set, revisions of documents for which this returns YES are fetched before the others
+    waiting to be, whenever the next fetches are started. It's called on the replicator's thread. */
+@property (copy) BOOL (^prioritizesDocID)(NSString* docID);
+
+/** If set, called within the transaction that inserts a batch of pulled revisions, for each
+    document one of them has left in conflict, so that the conflict can be resolved before the
+    batch is committed. */
+@property (copy) void (^resolvesConflictsOfDocID)(NSString* docID, FMDatabase* db);
+
+/** Instead of replicating, estimates what a replication would have to pull, from the local
+    checkpoint, the remote database's info and the first `sampleSize` changes after the
+    checkpoint, with their documents. The replicator thread must have been started; the
+    replicator stops once it's called onCompletion, on that thread. */
+- (void)estimatePendingWorkWithSampleSize:(NSUInteger)sampleSize
+                             onCompletion:(void (^)(CDTReplicationEstimate* estimate,
+                                                    NSError* error))onCompletion;
+
+/*
+ Private so no docs. Used by the tests, whose stubbed servers change what they support.
+ */
++ (void)forgetServerCapabilities;
+
 @end
 
 /** A revision received from a remote server during a pull. Tracks the opaque remote sequence ID. */
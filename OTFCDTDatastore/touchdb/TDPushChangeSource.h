@@ -0,0 +1,64 @@
+//
+//  TDPushChangeSource.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import "TD_Database.h"
+
+@class TD_Revision, TD_RevisionList;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Reads the changes, and loads and encodes the revisions, that several pushers of one database
+ to different targets all need, once for them all: e.g. to push to a primary and a backup server.
+ Each pusher still asks its own target which revisions it's missing, and keeps its own
+ checkpoint.
+
+ The changes read for one pusher answer the others, if their checkpoints aren't behind it, for
+ as long as the database doesn't change. The revisions loaded for one are kept, as their JSON,
+ until each of the other pushers has asked for them, or until a few hundred more (or some
+ megabytes of them) have been loaded, since a pusher whose target already has them never asks.
+
+ The source is safe to use from several threads, as each pusher runs on its own.
+ */
+@interface TDPushChangeSource : NSObject
+
+/**
+ @param pusherCount The number of pushers that will share the source.
+ */
+- (instancetype)initWithDatabase:(TD_Database*)db
+                     pusherCount:(NSUInteger)pusherCount NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@property (readonly) TD_Database* database;
+
+/** As -[TD_Database changesSinceSequence:options:filter:params:] with conflicts included and no
+    filter, as a pusher reads them. The revisions are new objects for each caller, so they're
+    free to be modified. */
+- (nullable TD_RevisionList*)changesSinceSequence:(SequenceNumber)lastSequence;
+
+/** As -[TD_Database loadRevisionBodies:options:], taking bodies another pusher caused to be
+    loaded with the same options where there are any. */
+- (nullable NSArray<NSNumber*>*)loadRevisionBodies:(NSArray<TD_Revision*>*)revs
+                                           options:(TDContentOptions)options;
+
+/** Number of revisions whose bodies were loaded by way of the source, and of those which were
+    taken from another pusher's load. */
+@property (readonly) NSUInteger revisionsLoaded;
+@property (readonly) NSUInteger revisionsShared;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,183 @@
+//
+//  TDPushChangeSource.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDPushChangeSource.h"
+
+#import "TD_Body.h"
+#import "TD_Revision.h"
+#import "TDStatus.h"
+
+// Bodies kept for pushers which haven't asked for them yet; beyond either the oldest are dropped.
+static const NSUInteger kMaxSharedBodies = 500;
+static const NSUInteger kMaxSharedBodyBytes = 16 * 1024 * 1024;
+
+@interface TDPushChangeSource ()
+
+@property (readwrite) NSUInteger revisionsLoaded;
+@property (readwrite) NSUInteger revisionsShared;
+
+@end
+
+/** The revisions are handed out only as copies, since they're mutable. */
+static TD_Revision* copyRevision(TD_Revision* rev)
+{
+    TD_Revision* copy =
+        [[TD_Revision alloc] initWithDocID:rev.docID revID:rev.revID deleted:rev.deleted];
+    copy.sequence = rev.sequence;
+    return copy;
+}
+
+@implementation TDPushChangeSource {
+    NSUInteger _pusherCount;
+
+    // The last changes read, since _changesSince when the database's last sequence was
+    // _changesDBSequence, and how many pushers have been given them
+    TD_RevisionList* _changes;
+    SequenceNumber _changesSince;
+    SequenceNumber _changesDBSequence;
+    NSUInteger _changesReaders;
+
+    // Sequence -> JSON of the revision, loaded with _bodyOptions, and how many more pushers may
+    // ask for it; sequences oldest first
+    NSMutableDictionary<NSNumber*, NSData*>* _bodies;
+    NSMutableDictionary<NSNumber*, NSNumber*>* _bodyReaders;
+    NSMutableOrderedSet<NSNumber*>* _bodySequences;
+    NSUInteger _bodyBytes;
+    TDContentOptions _bodyOptions;
+    BOOL _hasBodyOptions;
+}
+
+- (instancetype)initWithDatabase:(TD_Database*)db pusherCount:(NSUInteger)pusherCount
+{
+    self = [super init];
+    if (self) {
+        _database = db;
+        _pusherCount = MAX(pusherCount, (NSUInteger)1);
+        _bodies = [NSMutableDictionary dictionary];
+        _bodyReaders = [NSMutableDictionary dictionary];
+        _bodySequences = [NSMutableOrderedSet orderedSet];
+    }
+    return self;
+}
+
+- (TD_RevisionList*)changesSinceSequence:(SequenceNumber)lastSequence
+{
+    TD_RevisionList* changes;
+    // A pusher asking while another's read is under way waits for it, to share it:
+    @synchronized(self) {
+        if (!_changes || lastSequence < _changesSince ||
+            _database.lastSequence != _changesDBSequence) {
+            // Taken before the read, so that a change racing with it makes the read stale
+            SequenceNumber dbSequence = _database.lastSequence;
+            TDChangesOptions options = kDefaultTDChangesOptions;
+            options.includeConflicts = YES;
+            _changes = [_database changesSinceSequence:lastSequence
+                                               options:&options
+                                                filter:nil
+                                                params:nil];
+            if (!_changes) return nil;
+            _changesSince = lastSequence;
+            _changesDBSequence = dbSequence;
+            _changesReaders = 0;
+        }
+        changes = _changes;
+        if (++_changesReaders >= _pusherCount) _changes = nil;
+    }
+
+    // The list isn't changed once it's read, so can be copied from outside the lock
+    TD_RevisionList* result = [[TD_RevisionList alloc] init];
+    for (TD_Revision* rev in changes) {
+        if (rev.sequence > lastSequence) [result addRev:copyRevision(rev)];
+    }
+    return result;
+}
+
+- (NSArray<NSNumber*>*)loadRevisionBodies:(NSArray<TD_Revision*>*)revs
+                                  options:(TDContentOptions)options
+{
+    if (revs.count == 0) return @[];
+
+    @synchronized(self) {
+        if (!_hasBodyOptions) {
+            _bodyOptions = options;
+            _hasBodyOptions = YES;
+        }
+        BOOL shared = (options == _bodyOptions);
+
+        NSMutableArray* statuses = [NSMutableArray arrayWithCapacity:revs.count];
+        NSMutableArray* unloaded = [NSMutableArray arrayWithCapacity:revs.count];
+        for (TD_Revision* rev in revs) {
+            NSNumber* sequence = @(rev.sequence);
+            NSData* json = shared ? _bodies[sequence] : nil;
+            if (json) {
+                // Each pusher gets a body of its own, since bodies parse themselves lazily
+                rev.body = [TD_Body bodyWithJSON:json];
+                [self takeBodyOfSequence:sequence];
+                [statuses addObject:@(kTDStatusOK)];
+            } else {
+                [unloaded addObject:rev];
+                [statuses addObject:[NSNull null]];
+            }
+        }
+        self.revisionsLoaded += revs.count;
+        self.revisionsShared += revs.count - unloaded.count;
+        if (unloaded.count == 0) return statuses;
+
+        NSArray* loadStatuses = [_database loadRevisionBodies:unloaded options:options];
+        if (!loadStatuses) return nil;
+        NSUInteger next = 0;
+        for (NSUInteger i = 0; i < statuses.count; i++) {
+            if (statuses[i] == [NSNull null]) statuses[i] = loadStatuses[next++];
+        }
+
+        if (shared && _pusherCount > 1) {
+            for (NSUInteger i = 0; i < unloaded.count; i++) {
+                TD_Revision* rev = unloaded[i];
+                if (TDStatusIsError([loadStatuses[i] intValue]) || rev.missing) continue;
+                // Encoded once here, rather than by each pusher
+                NSData* json = rev.asJSON;
+                if (!json) continue;
+                NSNumber* sequence = @(rev.sequence);
+                _bodies[sequence] = json;
+                _bodyReaders[sequence] = @(_pusherCount - 1);
+                [_bodySequences addObject:sequence];
+                _bodyBytes += json.length;
+            }
+            while (_bodySequences.count > kMaxSharedBodies || _bodyBytes > kMaxSharedBodyBytes) {
+                [self removeBodyOfSequence:_bodySequences.firstObject];
+            }
+        }
+        return statuses;
+    }
+}
+
+- (void)takeBodyOfSequence:(NSNumber*)sequence
+{
+    NSUInteger readers = _bodyReaders[sequence].unsignedIntegerValue;
+    if (readers <= 1) {
+        [self removeBodyOfSequence:sequence];
+    } else {
+        _bodyReaders[sequence] = @(readers - 1);
+    }
+}
+
+- (void)removeBodyOfSequence:(NSNumber*)sequence
+{
+    _bodyBytes -= _bodies[sequence].length;
+    [_bodies removeObjectForKey:sequence];
+    [_bodyReaders removeObjectForKey:sequence];
+    [_bodySequences removeObject:sequence];
+}
+
+@end
@@ -11,16 +11,24 @@
 #import "TDReplicator.h"
 #import "TDMisc.h"
 
+@class TDRemoteRequest, TDPushChangeSource;
+
 /** Replicator that pushes to a remote CouchDB. */
 @interface TDPusher : TDReplicator {
     BOOL _createTarget;
     BOOL _creatingTarget;
     BOOL _observing;
-    BOOL _uploading;
-    NSMutableArray* _uploaderQueue;
+    NSUInteger _uploadsInFlight;
+    NSMutableArray<TDRemoteRequest*>* _uploaderQueue;  // Revisions with attachments, not started
+    NSUInteger _batchesInFlight;
+    NSMutableArray<TD_RevisionList*>* _batchQueue;  // Inbox batches not yet diffed
+    dispatch_queue_t _bodyLoadQueue;
     BOOL _dontSendMultipart;
+    BOOL _dontSendBulkAttachments;
     NSMutableIndexSet* _pendingSequences;
     SequenceNumber _maxPendingSequence;
+    NSMutableIndexSet* _knownSequences;  // Beyond the checkpoint, but already on the remote
+    BOOL _knownSequencesChanged;
 
     /** YES if all further documents with attachments should:
        * Be sent via multipart/related
@@ -31,9 +39,36 @@
 
 @property BOOL createTarget;
 
+/** The most revisions-with-attachments uploads, whether _bulk_docs batches or multipart
+    documents, to have in flight at once. Defaults to 4; 0 is taken as 1. */
+@property (nonatomic) NSUInteger maxConcurrentUploads;
+
+/** The most inbox batches to have between their _revs_diff request and their _bulk_docs
+    response at once, so that the next batch is diffed and its bodies loaded while one is
+    uploaded. Defaults to 2; 0 is taken as 1, which handles one batch at a time. */
+@property (nonatomic) NSUInteger maxBatchesInFlight;
+
+/** Revisions with an attachment at least this long are uploaded on their own as streamed
+    multipart; those whose attachments are all shorter go inline in _bulk_docs batches.
+    Defaults to 1MB. */
+@property (nonatomic) UInt64 multipartAttachmentLength;
+
 /** Block called to filter document revisions that are pushed to the remote server. */
 @property (nonatomic, copy) TD_FilterBlock _Nullable filter;
 
+/** Picks, from the IDs of changed documents, those to push; nil if it couldn't. */
+typedef NSSet<NSString*>* _Nullable (^TDDocIDsFilterBlock)(NSArray<NSString*>* _Nonnull docIDs);
+
+/** Filters the documents pushed by ID, e.g. by running a query against local indexes, so that
+    unlike -filter the revisions of documents that aren't pushed are never loaded. Ignored if
+    -filter is set. If it fails the replication stops with an error. */
+@property (nonatomic, copy) TDDocIDsFilterBlock _Nullable docIDsFilter;
+
+/** Shares reading the changes and loading the revisions with other pushers of the same database,
+    if set. Ignored if it's for a different database; its changes are ignored if -filter is set,
+    as they're unfiltered. */
+@property (nonatomic, strong) TDPushChangeSource* _Nullable changeSource;
+
 /** Completion Block to return results. It returns two values Response and Error. Both are optional objects and can have nil value.*/
 typedef void(^ __nonnull ReplicatorTestCompletionHandler)(id __nullable response, NSError* __nullable error);
 
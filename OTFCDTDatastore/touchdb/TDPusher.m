@@ -19,22 +19,53 @@
 #import "TD_Database.h"
 #import "TD_Database+Insertion.h"
 #import "TD_Revision.h"
+#import "TD_Body.h"
 #import "TDBatcher.h"
+#import "TDBase64InputStream.h"
+#import "TDBulkDocsUploader.h"
 #import "TDMultipartUploader.h"
+#import "TDPushChangeSource.h"
 #import "TDInternal.h"
 #import "TDCanonicalJSON.h"
 #import "CDTLogging.h"
 #import "CollectionUtils.h"
 #import "Test.h"
 
+// A _bulk_docs request with inline attachments is closed once its body reaches this size:
+#define kMaxBulkDocsAttachmentBytes (8 * 1024 * 1024)
+
+static NSString* commonAncestorRevID(TD_Revision* rev, NSArray* possibleRevIDs);
+
 @interface TDPusher ()
 - (BOOL)uploadMultipartRevision:(TD_Revision*)rev;
+- (TDPushChangeSource*)sharedChangeSource;
 @end
 
+#define kDefaultMaxConcurrentUploads 4u
+#define kDefaultMaxBatchesInFlight 2u
+#define kDefaultMultipartAttachmentLength (1024 * 1024)
+
 @implementation TDPusher
 
 @synthesize createTarget = _createTarget;
 
+- (instancetype)initWithDB:(TD_Database*)db
+                    remote:(NSURL*)remote
+                      push:(BOOL)push
+                continuous:(BOOL)continuous
+              interceptors:(NSArray*)interceptors
+{
+    if (self = [super initWithDB:db remote:remote push:push continuous:continuous interceptors:interceptors])
+    {
+        _maxConcurrentUploads = kDefaultMaxConcurrentUploads;
+        _multipartAttachmentLength = kDefaultMultipartAttachmentLength;
+        _maxBatchesInFlight = kDefaultMaxBatchesInFlight;
+        _bodyLoadQueue = dispatch_queue_create("com.cloudant.sync.push.bodies",
+                                               DISPATCH_QUEUE_SERIAL);
+    }
+    return self;
+}
+
 - (BOOL)isPush { return YES; }
 
 // This is called before beginReplicating, if the target db might not exist
@@ -69,17 +100,26 @@
     if (_creatingTarget) return;
 
     _pendingSequences = [NSMutableIndexSet indexSet];
+    // The changes are read again below, so any batches still waiting would be pushed twice:
+    [_batchQueue removeAllObjects];
     // in TDPusher, _lastSequence is always an NSNumber
     _maxPendingSequence = [(NSNumber*)_lastSequence longLongValue];
+    [self loadKnownSequences];
 
     // Include conflicts so all conflicting revisions are replicated too
     TDChangesOptions options = kDefaultTDChangesOptions;
     options.includeConflicts = YES;
     // Process existing changes since the last push:
-    [self addRevsToInbox:[_db changesSinceSequence:_maxPendingSequence
-                                           options:&options
-                                            filter:self.filter
-                                            params:_filterParameters]];
+    TDPushChangeSource* changeSource = self.sharedChangeSource;
+    TD_RevisionList* changes =
+        (changeSource && !self.filter) ? [changeSource changesSinceSequence:_maxPendingSequence]
+                                       : [_db changesSinceSequence:_maxPendingSequence
+                                                           options:&options
+                                                            filter:self.filter
+                                                            params:_filterParameters];
+    changes = [self changesPassingDocIDsFilter:changes];
+    if (!changes) return;
+    [self addRevsToInbox:changes];
     [_batcher flush];  // process up to the first 100 revs
 
     // Now listen for future changes (in continuous mode):
@@ -96,6 +136,78 @@
 #endif
 }
 
+// The change source, if it's one for this database
+- (TDPushChangeSource*)sharedChangeSource
+{
+    return (_changeSource.database == _db) ? _changeSource : nil;
+}
+
+// Keeps the changes to documents the docIDsFilter picks. Returns nil, having stopped, if it fails.
+- (TD_RevisionList*)changesPassingDocIDsFilter:(TD_RevisionList*)changes
+{
+    if (!_docIDsFilter || self.filter || changes.count == 0) return changes;
+
+    NSArray* docIDs = [[NSOrderedSet orderedSetWithArray:changes.allDocIDs] array];
+    NSSet* passing = _docIDsFilter(docIDs);
+    if (!passing) {
+        os_log_error(CDTOSLog, "%{public}@: Couldn't pick the changed documents to push", self);
+        self.error = TDStatusToNSErrorWithInfo(kTDStatusBadRequest, nil, @{
+            NSLocalizedFailureReasonErrorKey : @"The documents to push couldn't be selected."
+        });
+        [self stop];
+        return nil;
+    }
+
+    TD_RevisionList* result = [[TD_RevisionList alloc] init];
+    for (TD_Revision* rev in changes) {
+        if ([passing containsObject:rev.docID]) [result addRev:rev];
+    }
+    os_log_debug(CDTOSLog, "%{public}@: %{public}u of %{public}u changed documents selected to push",
+                 self, (unsigned)passing.count, (unsigned)docIDs.count);
+    return result;
+}
+
+// Revisions past the checkpoint that were confirmed on the remote, by _revs_diff or by uploading
+// them, are remembered in the local database so they needn't be diffed again after a restart.
+- (void)loadKnownSequences
+{
+    NSString* checkpointID = self.remoteCheckpointDocID;
+    if (!_lastSequence) {
+        // Not resuming from a checkpoint the remote agreed to, e.g. because the remote database
+        // was recreated, so it may not have any of them any more.
+        _knownSequences = [NSMutableIndexSet indexSet];
+        if ([_db knownRemoteSequencesForCheckpointID:checkpointID].count > 0) {
+            _knownSequencesChanged = YES;
+            [self saveKnownSequences];
+        }
+        return;
+    }
+    if (!_knownSequences) {
+        _knownSequences = [[_db knownRemoteSequencesForCheckpointID:checkpointID] mutableCopy]
+                              ?: [NSMutableIndexSet indexSet];
+        [_knownSequences removeIndexesInRange:NSMakeRange(0, (NSUInteger)_maxPendingSequence + 1)];
+        os_log_debug(CDTOSLog, "%{public}@: %{public}u revisions past the checkpoint are known to the remote", self, (unsigned)_knownSequences.count);
+    }
+}
+
+- (void)saveKnownSequences
+{
+    if (!_knownSequencesChanged || !_db) return;
+    _knownSequencesChanged = NO;
+    NSError* error;
+    if (![_db saveKnownRemoteSequences:_knownSequences
+                       forCheckpointID:self.remoteCheckpointDocID
+                                 error:&error]) {
+        os_log_debug(CDTOSLog, "%{public}@: Failed to save known revisions: %{public}@", self, error);
+    }
+}
+
+- (void)saveLastSequence
+{
+    [self saveKnownSequences];
+    [super saveLastSequence];
+}
+
 - (void)stopObserving
 {
     if (_observing) {
@@ -125,9 +237,12 @@
 - (void)stop
 {
     _uploaderQueue = nil;
-    _uploading = NO;
+    _uploadsInFlight = 0;
     [self stopObserving];
     [super stop];
+    // After super has flushed the inbox, so it doesn't queue batches again:
+    _batchQueue = nil;
+    _batchesInFlight = 0;
 }
 
 // Adds a local revision to the "pending" set that are awaiting upload:
@@ -155,23 +270,86 @@
         else
             --maxCompleted;
         self.lastSequence = [NSNumber numberWithUnsignedLongLong:maxCompleted];
+        // The checkpoint covers these now:
+        [_knownSequences removeIndexesInRange:NSMakeRange(0, (NSUInteger)maxCompleted + 1)];
+    } else {
+        // Stuck behind an earlier revision, so remember it's done in case we're interrupted:
+        [_knownSequences addIndex:(NSUInteger)seq];
+        if (!_knownSequencesChanged) {
+            _knownSequencesChanged = YES;
+            [self performSelector:@selector(saveKnownSequences) withObject:nil afterDelay:5.0];
+        }
     }
 }
 
+// Revision lists and document bodies, which may be large and compress well.
+- (BOOL)compressesRequestBodyForPath:(NSString*)path
+{
+    return $equal(path, @"_revs_diff") || $equal(path, @"_bulk_docs");
+}
+
 - (void)dbChanged:(NSNotification*)n
 {
     NSDictionary* userInfo = n.userInfo;
     // Skip revisions that originally came from the database I'm syncing to:
     if ([userInfo[@"source"] isEqual:_remote]) return;
-    TD_Revision* rev = userInfo[@"rev"];
+    NSArray* revs = userInfo[@"revs"] ?: (userInfo[@"rev"] ? @[ userInfo[@"rev"] ] : @[]);
+    BOOL pickedByID = _docIDsFilter && !self.filter;
+    if (pickedByID) {
+        revs = [self changesPassingDocIDsFilter:[[TD_RevisionList alloc] initWithArray:revs]]
+                   .allRevisions;
+    }
 
-    if (!self.filter || !self.filter(rev, _filterParameters)) return;
+    for (TD_Revision* rev in revs) {
+        if (!pickedByID && (!self.filter || !self.filter(rev, _filterParameters))) continue;
 
-    os_log_debug(CDTOSLog, "%{public}@: Queuing #%{public}lld %{public}@", self, rev.sequence, rev);
-    [self addToInbox:rev];
+        os_log_debug(CDTOSLog, "%{public}@: Queuing #%{public}lld %{public}@", self, rev.sequence, rev);
+        [self addToInbox:rev];
+    }
 }
 
 - (void)processInbox:(TD_RevisionList*)changes
+{
+    TD_RevisionList* unknownChanges = [[TD_RevisionList alloc] init];
+    for (TD_Revision* rev in changes) {
+        [self addPending:rev];
+        if ([_knownSequences containsIndex:(NSUInteger)rev.sequence]) {
+            // An earlier session already found the remote has this one:
+            [self removePending:rev];
+            continue;
+        }
+        [unknownChanges addRev:rev];
+    }
+    if (unknownChanges.count == 0) return;
+
+    // Its sequences are pending already, so the checkpoint can't pass them while it waits:
+    if (!_batchQueue) _batchQueue = [[NSMutableArray alloc] init];
+    [_batchQueue addObject:unknownChanges];
+    [self startNextBatch];
+}
+
+// Batches are pipelined: once one's missing revisions are being uploaded, the next one's
+// _revs_diff and body loading can go ahead, up to maxBatchesInFlight batches at once.
+- (void)startNextBatch
+{
+    NSUInteger maxBatches = MAX(_maxBatchesInFlight, 1u);
+    while (_batchesInFlight < maxBatches && _batchQueue.count > 0) {
+        _batchesInFlight++;
+        TD_RevisionList* changes = _batchQueue[0];
+        [_batchQueue removeObjectAtIndex:0];
+        [self diffBatch:changes];
+    }
+}
+
+- (void)batchFinished
+{
+    // Batches stopped by -stop still complete, after the count was reset:
+    if (_batchesInFlight > 0) _batchesInFlight--;
+    [self startNextBatch];
+}
+
+// Asks the remote which of a batch's revisions it's missing, then sends those.
+- (void)diffBatch:(TD_RevisionList*)changes
 {
     // Generate a set of doc/rev IDs in the JSON format that _revs_diff wants:
     // <http://wiki.apache.org/couchdb/HttpPostRevsDiff>
@@ -184,7 +362,6 @@
             diffs[docID] = revs;
         }
         [revs addObject:rev.revID];
-        [self addPending:rev];
     }
 
     // Call _revs_diff on the target db:
@@ -196,89 +373,139 @@
                   if (error) {
                       self.error = error;
                       [self revisionFailed];
+                      [self batchFinished];
                   } else if (results.count) {
-                      // Go through the list of local changes again, selecting the ones the
-                      // destination server
-                      // said were missing and mapping them to a JSON dictionary in the form
-                      // _bulk_docs wants:
-                      TD_RevisionList* revsToSend = [[TD_RevisionList alloc] init];
-                      NSArray* docsToSend = [changes.allRevisions my_map:^id(TD_Revision* rev) {
-                          NSDictionary* properties;
-                          @autoreleasepool
-                          {
-                              // Is this revision in the server's 'missing' list?
-                              NSDictionary* revResults = results[rev.docID];
-                              NSArray* missing = revResults[@"missing"];
-                              if (![missing containsObject:[rev revID]]) {
-                                  [self removePending:rev];
-                                  return nil;
-                              }
-
-                              // Get the revision's properties:
-                              TDContentOptions options = kTDIncludeAttachments | kTDIncludeRevs;
-                              if (!self->_dontSendMultipart) options |= kTDBigAttachmentsFollow;
-                              if ([self->_db loadRevisionBody:rev options:options] >= 300) {
-                                  os_log_debug(CDTOSLog, "%{public}@: Couldn't get local contents of %{public}@", self, rev);
-                                  [self revisionFailed];
-                                  return nil;
-                              }
-                              properties = rev.properties;
-                              Assert(properties[@"_revisions"]);
-
-                              // Strip any attachments already known to the target db:
-                              if (properties[@"_attachments"]) {
-                                  if (self->_sendAllDocumentsWithAttachmentsAsMultipart) {
-                                      // We saw an error which indicates we should send all
-                                      // documents
-                                      // with attachments using multipart/related AND include all
-                                      // attachment data (no stubs)
-                                      // A combination of revpos=0 and attachmentsFollow=YES will
-                                      // add
-                                      // follows to all attachments, causing uploadMultipartRevision
-                                      // to
-                                      // send data inline.
-                                      [TD_Database stubOutAttachmentsIn:rev
-                                                           beforeRevPos:0
-                                                      attachmentsFollow:YES];
-                                      properties = rev.properties;
-                                      if ([self uploadMultipartRevision:rev]) {
-                                          return nil;
-                                      }
-                                  } else {
-                                      // If we're still churning along fine -- which we should be --
-                                      // stub
-                                      // out attachments that we're sure the remote has by finding
-                                      // the
-                                      // common ancestor and stubbing out those older than that.
-                                      NSArray* possible = revResults[@"possible_ancestors"];
-                                      int minRevPos = findCommonAncestor(rev, possible);
-                                      [TD_Database stubOutAttachmentsIn:rev
-                                                           beforeRevPos:minRevPos + 1
-                                                      attachmentsFollow:NO];
-                                      properties = rev.properties;
-                                      // If the rev has huge attachments, send it under separate
-                                      // cover:
-                                      if (!self->_dontSendMultipart && [self uploadMultipartRevision:rev])
-                                          return nil;
-                                  }
-                              }
-                          }
-                          Assert(properties[@"_id"]);
-                          [revsToSend addRev:rev];
-                          return properties;
-                      }];
-
-                      // Post the revisions to the destination:
-                      [self uploadBulkDocs:docsToSend changes:revsToSend];
-
+                      [self loadMissingRevisionsOf:changes revsDiff:results];
                   } else {
                       // None of the revisions are new to the remote
                       for (TD_Revision* rev in changes.allRevisions) [self removePending:rev];
+                      [self batchFinished];
                   }
                   [self asyncTasksFinished:1];
               }];
 }
 
+// The missing revisions' bodies, and their attachments, are all loaded in one transaction rather
+// than with queries apiece. That's done off the replicator's thread, so meanwhile it can go on
+// sending the requests and handling the responses of the other batches in flight.
+- (void)loadMissingRevisionsOf:(TD_RevisionList*)changes revsDiff:(NSDictionary*)results
+{
+    TDContentOptions options = kTDIncludeAttachments | kTDIncludeRevs;
+    if (!_dontSendMultipart) options |= kTDBigAttachmentsFollow;
+    NSArray* missingRevs = [changes.allRevisions my_map:^id(TD_Revision* rev) {
+        NSArray* missing = results[rev.docID][@"missing"];
+        return [missing containsObject:rev.revID] ? rev : nil;
+    }];
+    TDPushChangeSource* changeSource = self.sharedChangeSource;
+    TD_Database* db = _db;
+
+    [self asyncTaskStarted];
+    dispatch_async(_bodyLoadQueue, ^{
+        NSArray* loadStatuses = changeSource
+                                    ? [changeSource loadRevisionBodies:missingRevs options:options]
+                                    : [db loadRevisionBodies:missingRevs options:options];
+        [self performBlockOnReplicatorThread:^{
+            // Stopped while they were loading, so their requests couldn't be cancelled:
+            if (self.threadCanceled) {
+                [self batchFinished];
+                [self asyncTasksFinished:1];
+                return;
+            }
+            NSMutableSet* unloadedRevs = [NSMutableSet set];
+            [missingRevs enumerateObjectsUsingBlock:^(TD_Revision* rev, NSUInteger i, BOOL* stop) {
+                if (!loadStatuses || [loadStatuses[i] intValue] >= 300) [unloadedRevs addObject:rev];
+            }];
+            [self sendMissingRevisionsOf:changes revsDiff:results unloaded:unloadedRevs];
+            [self asyncTasksFinished:1];
+        }];
+    });
+}
+
+// Goes through the list of local changes again, selecting the ones the destination server said
+// were missing and mapping them to the JSON of the document in the form _bulk_docs wants.
+- (void)sendMissingRevisionsOf:(TD_RevisionList*)changes
+                      revsDiff:(NSDictionary*)results
+                      unloaded:(NSSet*)unloadedRevs
+{
+    TD_RevisionList* revsToSend = [[TD_RevisionList alloc] init];
+    TD_RevisionList* revsWithAttachments = [[TD_RevisionList alloc] init];
+
+    NSArray* docsToSend = [changes.allRevisions my_map:^id(TD_Revision* rev) {
+        NSData* json;
+        @autoreleasepool
+        {
+            // Is this revision in the server's 'missing' list?
+            NSDictionary* revResults = results[rev.docID];
+            NSArray* missing = revResults[@"missing"];
+            if (![missing containsObject:[rev revID]]) {
+                [self removePending:rev];
+                return nil;
+            }
+
+            // A revision pulled with its attachments deferred can't be pushed until they've all
+            // been downloaded:
+            if ([self->_db hasPendingAttachmentDownloadsForSequence:rev.sequence]) {
+                os_log_debug(CDTOSLog, "%{public}@: Attachments of %{public}@ are still downloading", self, rev);
+                [self revisionFailed];
+                return nil;
+            }
+
+            // Its properties were loaded by -loadMissingRevisionsOf:revsDiff:
+            if ([unloadedRevs containsObject:rev]) {
+                os_log_debug(CDTOSLog, "%{public}@: Couldn't get local contents of %{public}@", self, rev);
+                [self revisionFailed];
+                return nil;
+            }
+            // The body stays as the JSON it was loaded as (with _revisions etc. spliced in);
+            // only _attachments is ever parsed out of it, and stubbing them out splices them
+            // back in:
+            TD_Body* body = rev.body;
+
+            // Strip any attachments already known to the target db:
+            if ([body valuesForKeys:@[ @"_attachments" ]].count) {
+                if (self->_sendAllDocumentsWithAttachmentsAsMultipart) {
+                    // We saw an error which indicates we should send all documents with
+                    // attachments using multipart/related AND include all attachment data (no
+                    // stubs). A combination of revpos=0 and attachmentsFollow=YES will add
+                    // follows to all attachments, causing uploadMultipartRevision to send data
+                    // inline.
+                    [TD_Database stubOutAttachmentsIn:rev beforeRevPos:0 attachmentsFollow:YES];
+                    if ([self uploadRevision:rev
+                            withAttachmentsIn:revsWithAttachments
+                            possibleAncestors:nil]) {
+                        return nil;
+                    }
+                } else {
+                    // If we're still churning along fine -- which we should be -- stub out
+                    // attachments that we're sure the remote has by finding the common
+                    // ancestor and stubbing out those older than that.
+                    NSArray* possible = revResults[@"possible_ancestors"];
+                    int minRevPos = findCommonAncestor(rev, possible);
+                    [TD_Database stubOutAttachmentsIn:rev
+                                         beforeRevPos:minRevPos + 1
+                                    attachmentsFollow:NO];
+                    // If the rev has huge attachments, send it under separate cover:
+                    if (!self->_dontSendMultipart &&
+                        [self uploadRevision:rev
+                            withAttachmentsIn:revsWithAttachments
+                            possibleAncestors:possible])
+                        return nil;
+                }
+            }
+            json = rev.asJSON;
+        }
+        Assert(json);
+        [revsToSend addRev:rev];
+        return json;
+    }];
+
+    // Post the revisions to the destination:
+    [self uploadBulkDocs:docsToSend
+                 changes:revsToSend
+            onCompletion:^{ [self batchFinished]; }];
+    [self uploadBulkDocsWithAttachments:revsWithAttachments];
+}
+
 // MARK: - These are the testing functions to test DB Proxy API's, We're passing empty parameters here just to check if the API's are working fine and not giving any kind of errors.
 
 - (void)testRevsDiff: (ReplicatorTestCompletionHandler) completionHandler {
@@ -300,105 +527,235 @@
  Using "new_edits":NO means the server will add the revisions verbatim, that is,
  using the rev ID we send rather than creating new ones.
 
- @param docsToSend Contains document dictionaries in the format _bulk_docs expects
-    them, including conflicting revisions. This is passed as-is into the _bulk_docs
-    call.
+ @param docsToSend Contains the JSON of the documents in the format _bulk_docs expects
+    them, including conflicting revisions. This is spliced as-is into the _bulk_docs
+    call, so the documents aren't parsed and re-encoded.
  @param changes Contains the list of TD_Revision objects for the documents we are
     sending.
+ @param onCompletion Called once the response has been handled, or at once if there's nothing
+    to send.
  */
-- (void)uploadBulkDocs:(NSArray*)docsToSend changes:(TD_RevisionList*)changes
+- (void)uploadBulkDocs:(NSArray*)docsToSend
+               changes:(TD_RevisionList*)changes
+          onCompletion:(void (^)(void))onCompletion
 {
     NSUInteger numDocsToSend = docsToSend.count;
-    if (numDocsToSend == 0) return;
+    if (numDocsToSend == 0) {
+        onCompletion();
+        return;
+    }
     os_log_info(CDTOSLog, "%{public}@: Sending %{public}u revisions", self, (unsigned)numDocsToSend);
     os_log_debug(CDTOSLog, "%{public}@: Sending %{public}@", self, changes.allRevisions);
     self.changesTotal += numDocsToSend;
     [self asyncTaskStarted];
+    NSMutableData* body = [NSMutableData dataWithCapacity:numDocsToSend * 256];
+    [body appendData:[@"{\"new_edits\":false,\"docs\":[" dataUsingEncoding:NSUTF8StringEncoding]];
+    for (NSUInteger i = 0; i < numDocsToSend; i++) {
+        if (i > 0) [body appendBytes:"," length:1];
+        [body appendData:docsToSend[i]];
+    }
+    [body appendBytes:"]}" length:2];
     [self sendAsyncRequest:@"POST"
                       path:@"_bulk_docs"
-                      body:$dict({ @"docs", docsToSend }, { @"new_edits", $false })
+                      body:body
               onCompletion:^(NSDictionary* response, NSError* error) {
+                  [self bulkDocsCompleted:$castIf(NSArray, response) error:error changes:changes];
+                  onCompletion();
+                  [self asyncTasksFinished:1];
+              }];
+}
 
-                  TD_RevisionList* revisionsToRetry = [[TD_RevisionList alloc] init];
-
-                  if (!error) {
-                      NSMutableSet* failedIDs = [NSMutableSet set];
-
-                      // _bulk_docs response is really an array, not a dictionary
-                      for (NSDictionary* item in $castIf(NSArray, response)) {
-                          TDStatus status = statusFromBulkDocsResponseItem(item);
-
-                          if (!TDStatusIsError(status)) {
-                              continue;
-                          }
-
-                          // This item (doc) failed to save correctly
-                          os_log_debug(CDTOSLog, "%{public}@: _bulk_docs got an error: %{public}@", self, item);
-
-                          NSString* docID;
-                          switch (status) {
-                              // 403/Forbidden means validation failed; don't treat it as an error
-                              // because I did my job in sending the revision. Other statuses are
-                              // actual replication errors.
-                              case kTDStatusForbidden:
-                              case kTDStatusUnauthorized:
-                                  break;
-
-                              // 412 is likely to mean that the attachment stubs we sent were
-                              // rejected by CouchDB. We need to resend the rev with all current
-                              // attachments using multipart/related. If this fails, we really
-                              // failed.
-                              case kTDStatusDuplicate:
-                                  docID = item[@"id"];
-                                  for (TD_Revision* rev in [changes revsWithDocID:docID]) {
-                                      [revisionsToRetry addRev:rev];
-                                  }
-                                  self->_sendAllDocumentsWithAttachmentsAsMultipart = YES;
-
-                                  // The rev also failed, so don't remove from pending
-                                  [failedIDs addObject:docID];
-
-                                  break;
-
-                              // Replication error
-                              default:
-                                  docID = item[@"id"];
-                                  [failedIDs addObject:docID];
-                                  break;
-                          }
-                      }
-
-                      // Remove from the pending list all the revs that didn't fail
-                      for (TD_Revision* rev in changes.allRevisions) {
-                          if (![failedIDs containsObject:rev.docID]) {
-                              [self removePending:rev];
-                          }
-                      }
-
-                      os_log_debug(CDTOSLog, "%{public}@: Sent %{public}@", self, changes.allRevisions);
-
-                  } else if (error && error.code == kTDStatusDuplicate) {
-                      // A 412 for the whole batch means we don't know what caused the
-                      // failure. Therefore retry all, and be sure to send all attachment
-                      // data, as the 412 is caused by mismatched stubs.
-                      for (TD_Revision* rev in changes.allRevisions) {
-                          [revisionsToRetry addRev:rev];
-                      }
-                      self->_sendAllDocumentsWithAttachmentsAsMultipart = YES;
-                  } else if (error) {
-                      // Another error in the request as a whole; fail replication.
-                      self.error = error;
-                      [self revisionFailed];
-                  }
+// Handles the response to a _bulk_docs request for the given revisions.
+- (void)bulkDocsCompleted:(NSArray*)response
+                    error:(NSError*)error
+                  changes:(TD_RevisionList*)changes
+{
+    TD_RevisionList* revisionsToRetry = [[TD_RevisionList alloc] init];
 
-                  self.changesProcessed += (numDocsToSend - revisionsToRetry.count);
+    if (!error) {
+        NSMutableSet* failedIDs = [NSMutableSet set];
 
-                  if (revisionsToRetry.count > 0) {
-                      [self addRevsToInbox:revisionsToRetry];
-                  }
+        // _bulk_docs response is really an array, not a dictionary
+        for (NSDictionary* item in response) {
+            TDStatus status = statusFromBulkDocsResponseItem(item);
 
-                  [self asyncTasksFinished:1];
-              }];
+            if (!TDStatusIsError(status)) {
+                continue;
+            }
+
+            // This item (doc) failed to save correctly
+            os_log_debug(CDTOSLog, "%{public}@: _bulk_docs got an error: %{public}@", self, item);
+
+            NSString* docID;
+            switch (status) {
+                // 403/Forbidden means validation failed; don't treat it as an error
+                // because I did my job in sending the revision. Other statuses are
+                // actual replication errors.
+                case kTDStatusForbidden:
+                case kTDStatusUnauthorized:
+                    break;
+
+                // 412 is likely to mean that the attachment stubs we sent were
+                // rejected by CouchDB. We need to resend the rev with all current
+                // attachments using multipart/related. If this fails, we really
+                // failed.
+                case kTDStatusDuplicate:
+                    docID = item[@"id"];
+                    for (TD_Revision* rev in [changes revsWithDocID:docID]) {
+                        [revisionsToRetry addRev:rev];
+                    }
+                    _sendAllDocumentsWithAttachmentsAsMultipart = YES;
+
+                    // The rev also failed, so don't remove from pending
+                    [failedIDs addObject:docID];
+
+                    break;
+
+                // Replication error
+                default:
+                    docID = item[@"id"];
+                    [failedIDs addObject:docID];
+                    break;
+            }
+        }
+
+        // Remove from the pending list all the revs that didn't fail
+        for (TD_Revision* rev in changes.allRevisions) {
+            if (![failedIDs containsObject:rev.docID]) {
+                [self removePending:rev];
+            }
+        }
+
+        os_log_debug(CDTOSLog, "%{public}@: Sent %{public}@", self, changes.allRevisions);
+
+    } else if (error && error.code == kTDStatusDuplicate) {
+        // A 412 for the whole batch means we don't know what caused the
+        // failure. Therefore retry all, and be sure to send all attachment
+        // data, as the 412 is caused by mismatched stubs.
+        for (TD_Revision* rev in changes.allRevisions) {
+            [revisionsToRetry addRev:rev];
+        }
+        _sendAllDocumentsWithAttachmentsAsMultipart = YES;
+    } else if (error) {
+        // Another error in the request as a whole; fail replication.
+        self.error = error;
+        [self revisionFailed];
+    }
+
+    self.changesProcessed += (changes.count - revisionsToRetry.count);
+
+    if (revisionsToRetry.count > 0) {
+        [self addRevsToInbox:revisionsToRetry];
+    }
+}
+
+/**
+ Uploads revisions whose attachment contents follow, using _bulk_docs requests that inline the
+ attachments as base64 streamed from the blob store. A large batch is split so that several
+ requests can be sent at once. Attachments the remote already has were stubbed out beforehand.
+ */
+- (void)uploadBulkDocsWithAttachments:(TD_RevisionList*)revs
+{
+    TDBulkDocsUploader* uploader = nil;
+    TD_RevisionList* batch = nil;
+    for (TD_Revision* rev in revs.allRevisions) {
+        NSMutableDictionary* streams = $mdict();
+        NSDictionary* attachments = rev[@"_attachments"];
+        for (NSString* attachmentName in attachments) {
+            NSDictionary* attachment = attachments[attachmentName];
+            if (!attachment[@"follows"]) continue;
+            id<CDTBlobReader> blob = [_db blobForAttachmentDict:attachment];
+            TDBase64InputStream* stream = blob ? [[TDBase64InputStream alloc] initWithBlob:blob] : nil;
+            if (!stream) {
+                streams = nil;
+                break;
+            }
+            streams[attachmentName] = stream;
+        }
+        if (!streams) {
+            os_log_debug(CDTOSLog, "%{public}@: Couldn't read attachments of %{public}@", self, rev);
+            [self revisionFailed];
+            continue;
+        }
+
+        if (!uploader) {
+            batch = [[TD_RevisionList alloc] init];
+            uploader = [self bulkDocsUploaderForChanges:batch];
+        }
+        [uploader addDocument:rev.properties followingAttachments:streams];
+        [batch addRev:rev];
+        if (uploader.length >= kMaxBulkDocsAttachmentBytes) {
+            [self startBulkDocsUploader:uploader changes:batch];
+            uploader = nil;
+        }
+    }
+    if (uploader) [self startBulkDocsUploader:uploader changes:batch];
+}
+
+- (TDBulkDocsUploader*)bulkDocsUploaderForChanges:(TD_RevisionList*)changes
+{
+    __block TDBulkDocsUploader* uploader = nil;
+    uploader = [[TDBulkDocsUploader alloc]
+        initWithSession:self.session
+                    URL:TDAppendToURL(_remote, @"_bulk_docs")
+         requestHeaders:self.requestHeaders
+           onCompletion:^(id response, NSError* error) {
+               [self removeRemoteRequest:uploader];
+               uploader = nil;
+               if ($equal(error.domain, TDHTTPErrorDomain) &&
+                   (error.code == kTDStatusBadRequest || error.code == kTDStatusRequestTooLarge ||
+                    error.code == kTDStatusUnsupportedType)) {
+                   // Server won't take attachments inline like this; send them one at a time:
+                   os_log_info(CDTOSLog, "%{public}@: _bulk_docs with attachments failed (%{public}ld); sending them separately", self, (long)error.code);
+                   self->_dontSendBulkAttachments = YES;
+                   self.changesTotal -= changes.count;
+                   for (TD_Revision* rev in changes.allRevisions) {
+                       [self uploadMultipartRevision:rev];
+                   }
+               } else {
+                   [self bulkDocsCompleted:$castIf(NSArray, response) error:error changes:changes];
+               }
+               [self asyncTasksFinished:1];
+               [self uploadFinished];
+           }];
+    uploader.authorizer = _authorizer;
+    return uploader;
+}
+
+- (void)startBulkDocsUploader:(TDBulkDocsUploader*)uploader changes:(TD_RevisionList*)changes
+{
+    os_log_info(CDTOSLog, "%{public}@: Queuing %{public}u revisions with attachments (%{public}lldkb)", self, (unsigned)changes.count, uploader.length / 1024);
+    self.changesTotal += changes.count;
+    [self asyncTaskStarted];
+    [self addRemoteRequest:uploader];
+    [self queueUpload:uploader];
+}
+
+// If the revision has attachments whose contents follow, adds it to batch to be sent by
+// -uploadBulkDocsWithAttachments:, or uploads it on its own if any of them is too big to inline
+// or the server can't take them inline. possibleAncestors are those _revs_diff gave, if the
+// attachments the remote has in them may be left out.
+- (BOOL)uploadRevision:(TD_Revision*)rev
+     withAttachmentsIn:(TD_RevisionList*)batch
+     possibleAncestors:(NSArray*)possibleAncestors
+{
+    if (_dontSendBulkAttachments) return [self uploadMultipartRevision:rev];
+    NSDictionary* attachments = [rev.body valuesForKeys:@[ @"_attachments" ]][@"_attachments"];
+    BOOL follows = NO;
+    for (NSString* attachmentName in attachments) {
+        NSDictionary* attachment = attachments[attachmentName];
+        if (!attachment[@"follows"]) continue;
+        follows = YES;
+        NSNumber* length = $castIf(NSNumber, attachment[@"encoded_length"])
+                               ?: $castIf(NSNumber, attachment[@"length"]);
+        if (length.unsignedLongLongValue >= _multipartAttachmentLength) {
+            [self uploadMultipartRevision:rev
+                    checkingAttachmentsOf:commonAncestorRevID(rev, possibleAncestors)];
+            return YES;
+        }
+    }
+    if (follows) [batch addRev:rev];
+    return follows;
 }
 
 static TDStatus statusFromBulkDocsResponseItem(NSDictionary* item)
@@ -419,6 +776,37 @@ static TDStatus statusFromBulkDocsResponseItem(NSDictionary* item)
         return kTDStatusUpstreamError;
 }
 
+// Before streaming a revision's big attachments, gets the revision the remote has that it
+// descends from, which is where the server fills in stubs from. Attachments which it already has
+// with the same digest, such as ones saved again unchanged, are sent as stubs instead.
+- (void)uploadMultipartRevision:(TD_Revision*)rev checkingAttachmentsOf:(NSString*)ancestorRevID
+{
+    if (!ancestorRevID || _sendAllDocumentsWithAttachmentsAsMultipart) {
+        [self uploadMultipartRevision:rev];
+        return;
+    }
+
+    [self asyncTaskStarted];
+    NSString* path =
+        $sprintf(@"%@?rev=%@", TDEscapeID(rev.docID), TDEscapeURLParam(ancestorRevID));
+    [self sendAsyncRequest:@"GET"
+                      path:path
+                      body:nil
+              onCompletion:^(NSDictionary* remoteDoc, NSError* error) {
+                  if (error) {
+                      // Not a reason to fail; the attachments just all get sent.
+                      os_log_debug(CDTOSLog, "%{public}@: Couldn't get %{public}@ to check attachments: %{public}@", self, path, error);
+                  } else {
+                      [self->_db stubOutAttachmentsIn:rev
+                            matchingRemoteAttachments:$castIf(NSDictionary,
+                                                              remoteDoc[@"_attachments"])];
+                  }
+                  // If every attachment was stubbed out there's nothing to stream:
+                  if (![self uploadMultipartRevision:rev]) [self uploadJSONRevision:rev];
+                  [self asyncTasksFinished:1];
+              }];
+}
+
 - (BOOL)uploadMultipartRevision:(TD_Revision*)rev
 {
     // Find all the attachments with "follows" instead of a body, and put 'em in a multipart stream.
@@ -472,6 +860,17 @@ static TDStatus statusFromBulkDocsResponseItem(NSDictionary* item)
                                                 // JSON.
                                                 self->_dontSendMultipart = YES;
                                                 [self uploadJSONRevision:rev];
+                                            } else if ($equal(error.domain, TDHTTPErrorDomain) &&
+                                                       error.code == kTDStatusDuplicate &&
+                                                       !self->_sendAllDocumentsWithAttachmentsAsMultipart) {
+                                                // The stubs were rejected, as in
+                                                // -bulkDocsCompleted:; send it again with all
+                                                // of its attachments:
+                                                self->_sendAllDocumentsWithAttachmentsAsMultipart = YES;
+                                                TD_RevisionList* retry =
+                                                    [[TD_RevisionList alloc] initWithArray:@[ rev ]];
+                                                [self addRevsToInbox:retry];
+                                                self.changesProcessed--;
                                             } else {
                                                 self.error = error;
                                                 [self revisionFailed];
@@ -484,16 +883,12 @@ static TDStatus statusFromBulkDocsResponseItem(NSDictionary* item)
                                         [self asyncTasksFinished:1];
                                         [self removeRemoteRequest:uploader];
 
-                                        self->_uploading = NO;
-                                        [self startNextUpload];
+                                        [self uploadFinished];
                                     }];
     uploader.authorizer = _authorizer;
     [self addRemoteRequest:uploader];
     os_log_debug(CDTOSLog, "%{public}@: Queuing %{public}@ (multipart, %{public}lldkb)", self, uploader, bodyStream.length / 1024);
-    
-    if (!_uploaderQueue) _uploaderQueue = [[NSMutableArray alloc] init];
-    [_uploaderQueue addObject:uploader];
-    [self startNextUpload];
+    [self queueUpload:uploader];
     return YES;
 }
 
@@ -526,17 +921,42 @@ static TDStatus statusFromBulkDocsResponseItem(NSDictionary* item)
               }];
 }
 
+// Uploads of revisions with attachments, whether batched or multipart, share one queue so that
+// no more than maxConcurrentUploads of them are sent at once, over the session's connections.
+- (void)queueUpload:(TDRemoteRequest*)uploader
+{
+    if (!_uploaderQueue) _uploaderQueue = [[NSMutableArray alloc] init];
+    [_uploaderQueue addObject:uploader];
+    [self startNextUpload];
+}
+
 - (void)startNextUpload
 {
-    if (!_uploading && _uploaderQueue.count > 0) {
-        _uploading = YES;
-        TDMultipartUploader* uploader = _uploaderQueue[0];
+    NSUInteger maxUploads = MAX(_maxConcurrentUploads, 1u);
+    while (_uploadsInFlight < maxUploads && _uploaderQueue.count > 0) {
+        _uploadsInFlight++;
+        TDRemoteRequest* uploader = _uploaderQueue[0];
+        [_uploaderQueue removeObjectAtIndex:0];
         os_log_debug(CDTOSLog, "%{public}@: Starting %{public}@", self, uploader);
         [uploader start];
-        [_uploaderQueue removeObjectAtIndex:0];
     }
 }
 
+- (void)uploadFinished
+{
+    // Uploads stopped by -stop still complete, after the count was reset:
+    if (_uploadsInFlight > 0) _uploadsInFlight--;
+    [self startNextUpload];
+}
+
+// Given a revision and an array of revIDs, returns the latest common ancestor revID, or nil.
+static NSString* commonAncestorRevID(TD_Revision* rev, NSArray* possibleRevIDs)
+{
+    if (possibleRevIDs.count == 0) return nil;
+    NSArray* history = [TD_Database parseCouchDBRevisionHistory:rev.properties];
+    return [history firstObjectCommonWithArray:possibleRevIDs];
+}
+
 // Given a revision and an array of revIDs, finds the latest common ancestor revID
 // and returns its generation #. If there is none, returns 0.
 // static designation was removed in order to use this function outside of this file
@@ -546,9 +966,7 @@ static TDStatus statusFromBulkDocsResponseItem(NSDictionary* item)
 // Adam Cox, Cloudant, Inc. (2014)
 extern int findCommonAncestor(TD_Revision* rev, NSArray* possibleRevIDs)
 {
-    if (possibleRevIDs.count == 0) return 0;
-    NSArray* history = [TD_Database parseCouchDBRevisionHistory:rev.properties];
-    NSString* ancestorID = [history firstObjectCommonWithArray:possibleRevIDs];
+    NSString* ancestorID = commonAncestorRevID(rev, possibleRevIDs);
     if (!ancestorID) return 0;
     int generation;
     if (![TD_Revision parseRevID:ancestorID intoGeneration:&generation andSuffix:NULL])
@@ -0,0 +1,70 @@
+//
+//  TDReadConnectionPool.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+@class FMDatabase, FMDatabaseQueue;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A fixed-size pool of read-only connections to a database in WAL mode.
+
+ Each connection is an FMDatabaseQueue, so a connection is only ever used by one thread at a
+ time, but different callers can read concurrently with each other and with the writer
+ connection. Callers block while all the connections are checked out.
+ */
+@interface TDReadConnectionPool : NSObject
+
+/** Number of connections in the pool. */
+@property (nonatomic, readonly) NSUInteger count;
+
+/**
+ Creates a pool taking ownership of the given queues. The queues must already be open and fully
+ configured (encryption key set, collations registered).
+ */
+- (instancetype)initWithQueues:(NSArray<FMDatabaseQueue *> *)queues NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ Runs the block on an idle connection, waiting for one to become available if needed.
+
+ @return NO if the pool has been closed, in which case the block did not run.
+ */
+- (BOOL)inDatabase:(void (^)(FMDatabase *db))block;
+
+/**
+ Runs the block within a deferred transaction on an idle connection, so every statement the
+ block executes reads from the same snapshot of the database. The transaction is always
+ committed; the connections are read-only so there is nothing to roll back.
+
+ @return NO if the pool has been closed, in which case the block did not run.
+ */
+- (BOOL)inReadTransaction:(void (^)(FMDatabase *db))block;
+
+/**
+ Runs the block on every connection in turn, e.g. to gather per-connection statistics. Each
+ connection may be in use by a reader, in which case this waits for it.
+
+ @return NO if the pool has been closed, in which case the block did not run.
+ */
+- (BOOL)inEachDatabase:(void (^)(FMDatabase *db))block;
+
+/** Waits for all in-flight readers to finish, then closes every connection. */
+- (void)close;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,139 @@
+//
+//  TDReadConnectionPool.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDReadConnectionPool.h"
+#import "TDDatabaseQueue.h"
+
+#import <fmdb/FMDatabase.h>
+#import <fmdb/FMDatabaseQueue.h>
+
+@interface TDReadConnectionPool ()
+
+@property (nonatomic, strong) NSArray<FMDatabaseQueue *> *queues;
+@property (nonatomic, strong) NSMutableArray<FMDatabaseQueue *> *idleQueues;
+@property (nonatomic, strong) dispatch_semaphore_t available;
+@property (nonatomic) BOOL closed;
+
+@end
+
+@implementation TDReadConnectionPool
+
+- (instancetype)initWithQueues:(NSArray<FMDatabaseQueue *> *)queues
+{
+    self = [super init];
+    if (self) {
+        _queues = [queues copy];
+        _idleQueues = [queues mutableCopy];
+        _available = dispatch_semaphore_create(queues.count);
+    }
+    return self;
+}
+
+- (NSUInteger)count { return self.queues.count; }
+
+- (FMDatabaseQueue *)checkOut
+{
+    dispatch_semaphore_wait(self.available, DISPATCH_TIME_FOREVER);
+    FMDatabaseQueue *queue = nil;
+    @synchronized(self)
+    {
+        if (!self.closed) {
+            queue = self.idleQueues.lastObject;
+            [self.idleQueues removeLastObject];
+        }
+    }
+    if (!queue) {
+        dispatch_semaphore_signal(self.available);
+    }
+    return queue;
+}
+
+- (void)checkIn:(FMDatabaseQueue *)queue
+{
+    @synchronized(self) { [self.idleQueues addObject:queue]; }
+    dispatch_semaphore_signal(self.available);
+}
+
+- (BOOL)inDatabase:(void (^)(FMDatabase *db))block
+{
+    CFAbsoluteTime submitted = CFAbsoluteTimeGetCurrent();
+    FMDatabaseQueue *queue = [self checkOut];
+    if (!queue) {
+        return NO;
+    }
+    @try {
+        // So the time waiting for a free connection counts as waiting for the queue
+        if ([queue isKindOfClass:[TDDatabaseQueue class]]) {
+            [(TDDatabaseQueue *)queue inDatabase:block submittedAt:submitted];
+        } else {
+            [queue inDatabase:block];
+        }
+    } @finally {
+        [self checkIn:queue];
+    }
+    return YES;
+}
+
+- (BOOL)inReadTransaction:(void (^)(FMDatabase *db))block
+{
+    return [self inDatabase:^(FMDatabase *db) {
+        [db beginDeferredTransaction];
+        @try {
+            block(db);
+        } @finally {
+            [db commit];
+        }
+    }];
+}
+
+- (BOOL)inEachDatabase:(void (^)(FMDatabase *db))block
+{
+    // Holding a permit keeps -close from closing the connections underneath us.
+    dispatch_semaphore_wait(self.available, DISPATCH_TIME_FOREVER);
+    BOOL closed;
+    @synchronized(self) { closed = self.closed; }
+    if (!closed) {
+        for (FMDatabaseQueue *queue in self.queues) {
+            [queue inDatabase:block];
+        }
+    }
+    dispatch_semaphore_signal(self.available);
+    return !closed;
+}
+
+- (void)close
+{
+    @synchronized(self)
+    {
+        if (self.closed) {
+            return;
+        }
+        self.closed = YES;
+    }
+
+    // Taking every permit guarantees no reader is still using a connection.
+    for (NSUInteger i = 0; i < self.queues.count; i++) {
+        dispatch_semaphore_wait(self.available, DISPATCH_TIME_FOREVER);
+    }
+    for (FMDatabaseQueue *queue in self.queues) {
+        [queue close];
+    }
+    for (NSUInteger i = 0; i < self.queues.count; i++) {
+        dispatch_semaphore_signal(self.available);
+    }
+}
+
+- (void)dealloc { [self close]; }
+
+@end
@@ -9,6 +9,7 @@
 #import <Foundation/Foundation.h>
 #import "CDTURLSession.h"
 @protocol TDAuthorizer;
+@class TDJSONDecodePool, TDJSONDecodeSequence;
 
 /** The signature of the completion block called by a TDRemoteRequest.
     @param result  On success, a 'result' object; by default this is the TDRemoteRequest iself, but
@@ -41,6 +42,17 @@ typedef void (^TDRemoteRequestCompletionBlock)(id result, NSError* error);
 
 @property (strong, nonatomic) id<TDAuthorizer> authorizer;
 
+/** The request's place in the queue for its host. Defaults to CDTHTTPRequestPriorityDocuments. */
+@property (nonatomic) CDTHTTPRequestPriority priority;
+
+/** If YES, the body is gzipped on a background queue before the request is first sent, and sent
+ * with `Content-Encoding: gzip`. Small bodies are sent as they are. If the server responds 415
+ * Unsupported Media Type the request is sent again uncompressed. Defaults to NO. */
+@property (nonatomic) BOOL compressBody;
+
+/** YES if the server refused the compressed body, and it was sent again uncompressed. */
+@property (readonly, nonatomic) BOOL compressionRejected;
+
 /** In some cases a kTDStatusNotFound Not Found is an expected condition and shouldn't be logged;
  * call this to suppress that log message. */
 - (void)dontLog404;
@@ -71,9 +83,41 @@ typedef void (^TDRemoteRequestCompletionBlock)(id result, NSError* error);
 @end
 
 /** A request that parses its response body as JSON.
-    The parsed object will be returned as the first parameter of the completion block. */
+    The parsed object will be returned as the first parameter of the completion block.
+    The request body is encoded as JSON, unless it's NSData, which is sent as it is. */
 @interface TDRemoteJSONRequest : TDRemoteRequest {
    @private
     NSMutableData* _jsonBuffer;
+    TDJSONDecodeSequence* _decodeSequence;
 }
+
+/** Pool to decode the response on, rather than on the thread the request was started on; only
+    used for responses large enough to be worth the hop. The completion block is still called on
+    the request's thread. */
+@property (strong, nonatomic) TDJSONDecodePool* decodePool;
+
+@end
+
+/** A JSON request for a response of the form `{"<key>": [...]}` which may be very large, such as
+    a _bulk_get. Each element of the array is passed to the onElement block as soon as it has
+    arrived, rather than the whole body being buffered and parsed at the end. On success the
+    completion block's result is the number of elements.
+    If the request is retried after a failure, elements seen in the failed attempt may be passed
+    again. */
+@interface TDRemoteJSONStreamingRequest : TDRemoteJSONRequest
+
+- (instancetype)initWithSession:(CDTURLSession*)session
+                         method:(NSString*)method
+                            URL:(NSURL*)url
+                           body:(id)body
+                 requestHeaders:(NSDictionary*)requestHeaders
+                       arrayKey:(NSString*)arrayKey
+                      onElement:(void (^)(id element))onElement
+                   onCompletion:(TDRemoteRequestCompletionBlock)onCompletion;
+
+/** Applied to each element as it's decoded, on the decodePool's workers if there is one; the
+    onElement block is passed what it returns, unless that's nil. E.g. to build TD_Revisions from
+    the elements in parallel. The elements still reach onElement in order. */
+@property (copy, nonatomic) id (^elementTransform)(id element);
+
 @end
@@ -28,20 +28,36 @@
 #import "Test.h"
 #import "MYURLUtils.h"
 #import "TDJSON.h"
+#import "TDStreamingJSONParser.h"
+#import "TDJSONDecodePool.h"
 
 #import "CDTDatastore.h"
 #import "CDTLogging.h"
 #import "CDTURLSession.h"
+#import "CDTReplicationMetrics.h"
+#import "TDReplicationTrace.h"
+
+#import <GoogleToolboxForMac/GTMNSData+zlib.h>
+
+/** Responses shorter than this are decoded on the request's own thread even with a decodePool,
+    as handing them to a worker would cost about as much as decoding them. */
+static const NSUInteger kMinPooledDecodeLength = 16 * 1024;
 
 // Max number of retry attempts for a transient failure, and the backoff time formula
 #define kMaxRetries 2
 #define RetryDelay(COUNT) (4 << (COUNT))  // COUNT starts at 0
 
+// Bodies shorter than this aren't worth compressing
+static const NSUInteger kMinCompressibleBodyLength = 1024;
+
 @interface TDRemoteRequest()
 
 @property CDTURLSession *session;
 @property (nonatomic, strong) CDTURLSessionTask *task;
 
+/** The body as it was before being compressed, while the compressed one is being sent. */
+@property (nonatomic, strong) NSData *uncompressedBody;
+
 @end
 
 
@@ -83,6 +99,7 @@
             [_request setValue:value forHTTPHeaderField:key];
         }];
         _session = session;
+        _priority = CDTHTTPRequestPriorityDocuments;
     }
     return self;
 }
@@ -103,13 +120,55 @@
 - (void)start
 {
     if (!_request) return;  // -clearConnection already called
+    if (_compressBody) {
+        [self compressBodyAndStart];
+        return;
+    }
     os_log_debug(CDTOSLog, "%{public}@: Starting...", self);
 
     self.task = [self.session dataTaskWithRequest:_request taskDelegate:self];
+    self.task.priority = self.priority;
     [self.task resume];
 
 }
 
+/** Gzips the body away from the replicator thread, then starts the request on it. */
+- (void)compressBodyAndStart
+{
+    _compressBody = NO;  // compressed once; retries send the same body
+    NSData *body = _request.HTTPBody;
+    if (body.length < kMinCompressibleBodyLength) {
+        [self start];
+        return;
+    }
+
+    NSThread *thread = [NSThread currentThread];
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        NSError *error = nil;
+        NSData *compressed = [NSData gtm_dataByGzippingData:body error:&error];
+        if (!compressed) {
+            os_log_debug(CDTOSLog, "%{public}@: Couldn't compress body: %{public}@", self, error);
+        }
+        [self performSelector:@selector(startWithCompressedBody:)
+                     onThread:thread
+                   withObject:compressed
+                waitUntilDone:NO];
+    });
+}
+
+- (void)startWithCompressedBody:(NSData *)compressed
+{
+    if (!_request) return;  // stopped while compressing
+    if (compressed && compressed.length < _request.HTTPBody.length) {
+        os_log_debug(CDTOSLog, "%{public}@: Compressed body from %{public}lu to %{public}lu bytes", self,
+                     (unsigned long)_request.HTTPBody.length, (unsigned long)compressed.length);
+        self.uncompressedBody = _request.HTTPBody;
+        _request.HTTPBody = compressed;
+        [_request setValue:@"gzip" forHTTPHeaderField:@"Content-Encoding"];
+    }
+    [self start];
+}
+
 - (void)clearSession
 {
     _request = nil;
@@ -180,6 +239,12 @@
     if (_retryCount >= kMaxRetries) return NO;
     NSTimeInterval delay = RetryDelay(_retryCount);
     ++_retryCount;
+    [self.session.metrics recordRetry];
+    [self.session.trace recordEvent:@"retry"
+                             fields:@{
+                                 @"endpoint" : [CDTReplicationMetrics endpointForURL:_request.URL],
+                                 @"delay" : @(delay)
+                             }];
     os_log_debug(CDTOSLog, "%{public}@: Will retry in %{public}g sec", self, delay);
     [self startAfterDelay:delay];
     return YES;
@@ -241,6 +306,18 @@
           $equal(error.domain, TDHTTPErrorDomain)))
         os_log_debug(CDTOSLog, "%{public}@: Got error. domain %{public}@, code %{public}@", self, error.domain, @(error.code));
 
+    // A server which can't read a gzipped body may still take it uncompressed:
+    if (_request && self.uncompressedBody && error.code == kTDStatusUnsupportedType &&
+        $equal(error.domain, TDHTTPErrorDomain)) {
+        os_log_info(CDTOSLog, "%{public}@: Server refused compressed body; sending it uncompressed", self);
+        _request.HTTPBody = self.uncompressedBody;
+        [_request setValue:nil forHTTPHeaderField:@"Content-Encoding"];
+        self.uncompressedBody = nil;
+        _compressionRejected = YES;
+        [self startAfterDelay:0];
+        return;
+    }
+
     // If the error is likely transient, retry:
     if (TDMayBeTransientError(error) && [self retry]) return;
 
@@ -265,8 +342,12 @@
     if(self){
         
         [_request setValue:@"application/json" forHTTPHeaderField:@"Accept"];
+        // NSURLSession inflates a gzipped response before we see it.
+        [_request setValue:@"gzip" forHTTPHeaderField:@"Accept-Encoding"];
         if (body) {
-            _request.HTTPBody = [TDJSON dataWithJSONObject:body options:0 error:NULL];
+            _request.HTTPBody = [body isKindOfClass:[NSData class]]
+                                    ? body
+                                    : [TDJSON dataWithJSONObject:body options:0 error:NULL];
             [_request addValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
         }
         
@@ -282,13 +363,44 @@
     [super clearSession];
 }
 
+- (void)stop
+{
+    [_decodeSequence cancel];
+    _decodeSequence = nil;
+    [super stop];
+}
+
 - (void)receivedData:(NSData *)data
 {
     [super receivedData:data];
+    // An error status was dealt with by -receivedResponse:, which may have retried the request.
+    if (TDStatusIsError(_status)) return;
     if (!_jsonBuffer)
         _jsonBuffer = [[NSMutableData alloc] initWithCapacity:MAX(data.length, 8192u)];
     [_jsonBuffer appendData:data];
 
+    if (_decodePool && _jsonBuffer.length >= kMinPooledDecodeLength) {
+        NSData* json = _jsonBuffer;
+        __weak TDRemoteJSONRequest* weakSelf = self;
+        _decodeSequence = [[TDJSONDecodeSequence alloc]
+            initWithPool:_decodePool
+               transform:nil
+                onResult:^(id result, NSError* decodeError) {
+                    TDRemoteJSONRequest* strongSelf = weakSelf;
+                    if (!strongSelf) return;
+                    NSError* error = nil;
+                    if (!result) {
+                        os_log_debug(CDTOSLog, "%{public}@: %{public}@ %{public}@ returned unparseable data: %{public}@", strongSelf, strongSelf->_request.HTTPMethod, TDCleanURLtoString(strongSelf->_request.URL), decodeError);
+                        error = TDStatusToNSError(kTDStatusUpstreamError, strongSelf->_request.URL);
+                    }
+                    strongSelf->_decodeSequence = nil;
+                    [strongSelf respondWithResult:result error:error];
+                }];
+        [_decodeSequence decodeData:json];
+        [self clearSession];
+        return;
+    }
+
     id result = nil;
     NSError *error = nil;
     if (_jsonBuffer.length > 0) {
@@ -305,3 +417,105 @@
 }
 
 @end
+
+
+@implementation TDRemoteJSONStreamingRequest {
+    NSString* _arrayKey;
+    void (^_onElement)(id);
+    TDStreamingJSONParser* _parser;
+    TDJSONDecodeSequence* _elementSequence;
+    NSError* _elementError;
+}
+
+- (instancetype)initWithSession:(CDTURLSession*)session
+                         method:(NSString*)method
+                            URL:(NSURL*)url
+                           body:(id)body
+                 requestHeaders:(NSDictionary*)requestHeaders
+                       arrayKey:(NSString*)arrayKey
+                      onElement:(void (^)(id))onElement
+                   onCompletion:(TDRemoteRequestCompletionBlock)onCompletion
+{
+    self = [super initWithSession:session
+                           method:method
+                              URL:url
+                             body:body
+                   requestHeaders:requestHeaders
+                     onCompletion:onCompletion];
+    if (self) {
+        _arrayKey = [arrayKey copy];
+        _onElement = [onElement copy];
+    }
+    return self;
+}
+
+- (void)start
+{
+    // Each attempt parses its response afresh.
+    [_elementSequence cancel];
+    _elementError = nil;
+    void (^onElement)(id) = _onElement;
+    __weak TDRemoteJSONStreamingRequest* weakSelf = self;
+    _elementSequence = [[TDJSONDecodeSequence alloc]
+        initWithPool:self.decodePool
+           transform:_elementTransform
+            onResult:^(id element, NSError* error) {
+                TDRemoteJSONStreamingRequest* strongSelf = weakSelf;
+                if (!strongSelf) return;
+                if (error) {
+                    if (!strongSelf->_elementError) strongSelf->_elementError = error;
+                } else if (!strongSelf->_elementError) {
+                    onElement(element);
+                }
+            }];
+    _parser = [[TDStreamingJSONParser alloc] initWithArrayKey:_arrayKey
+                                               decodeSequence:_elementSequence];
+    [super start];
+}
+
+- (void)stop
+{
+    [_elementSequence cancel];
+    [super stop];
+}
+
+- (void)receivedPartialData:(NSData*)data
+{
+    if (![_parser parseData:data]) {
+        os_log_debug(CDTOSLog, "%{public}@: unparseable response: %{public}@", self, _parser.errorMessage);
+    }
+}
+
+- (void)receivedData:(NSData*)data
+{
+    // An error status was dealt with by -receivedResponse:, which may have retried the request.
+    if (TDStatusIsError(_status)) return;
+    // A successful response will have been streamed already; anything else arrives whole.
+    if (data.length > 0) [_parser parseData:data];
+
+    if (!_parser.finished) {
+        os_log_debug(CDTOSLog, "%{public}@: %{public}@ %{public}@ returned unparseable data: %{public}@", self, _request.HTTPMethod, TDCleanURLtoString(_request.URL), _parser.errorMessage);
+        [self clearSession];
+        [self respondWithResult:nil error:TDStatusToNSError(kTDStatusUpstreamError, _request.URL)];
+        return;
+    }
+
+    // Completes once the elements still being decoded have been passed on.
+    NSNumber* count = @(_parser.elementCount);
+    [self clearSession];
+    __weak TDRemoteJSONStreamingRequest* weakSelf = self;
+    [_elementSequence whenDrained:^{
+        TDRemoteJSONStreamingRequest* strongSelf = weakSelf;
+        if (!strongSelf) return;
+        if (strongSelf->_elementError) {
+            os_log_debug(CDTOSLog, "%{public}@: %{public}@ %{public}@ returned an unparseable element: %{public}@", strongSelf, strongSelf->_request.HTTPMethod, TDCleanURLtoString(strongSelf->_request.URL), strongSelf->_elementError);
+            [strongSelf respondWithResult:nil
+                                    error:TDStatusToNSError(kTDStatusUpstreamError,
+                                                            strongSelf->_request.URL)];
+        } else {
+            [strongSelf respondWithResult:count error:nil];
+        }
+    }];
+}
+
+@end
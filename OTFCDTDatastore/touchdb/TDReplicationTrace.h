@@ -0,0 +1,65 @@
+//
+//  TDReplicationTrace.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Records what a replication did, and when, to a file, so traces can be collected from devices
+ and inspected afterwards to see where a replication stalled.
+
+ The file holds one JSON object per line, appended to whatever it already holds. Each has the
+ event's name in `e` and the seconds since the trace was opened in `t`, then the event's own
+ fields; the first line written by each trace is an `open` event whose `date` is the time it
+ was opened, in seconds since 1970. The replicator records:
+
+ - `start` and `stop` of each replication, with its direction and, on stopping, the changes
+   processed and any error;
+ - `request` for each HTTP request completed, with its `endpoint` (as CDTReplicationMetrics
+   names it), `method`, `status`, bytes `sent` and `received`, and latency `ms`;
+ - `retry` of a request, with its endpoint;
+ - `changes` for each page of the _changes feed, with the number of changes and revisions;
+ - `flush` of the inbox batcher, with the revisions processed and the time taken;
+ - `insert` of pulled revisions into the local database, with their count and time taken;
+ - `checkpoint` when a checkpoint is saved, with the sequence and whether it's `local` only.
+
+ Lines are buffered and written on a background queue. Writing stops, after a `truncated`
+ event, once the file reaches maximumFileSize. Safe to use from any thread.
+ */
+@interface TDReplicationTrace : NSObject
+
+/** Opens the trace file, creating it if need be. */
+- (nullable instancetype)initWithURL:(NSURL*)url error:(NSError**)error NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@property (readonly) NSURL* url;
+
+/** Size past which nothing more is written to the file. Defaults to 10MB. */
+@property UInt64 maximumFileSize;
+
+/** Appends an event. The fields must be JSON-compatible; numbers, strings and booleans keep the
+    trace compact. */
+- (void)recordEvent:(NSString*)event fields:(nullable NSDictionary<NSString*, id>*)fields;
+
+/** Writes any buffered events to the file, returning once they're written. */
+- (void)flush;
+
+/** Flushes then closes the file; later events are ignored. */
+- (void)close;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,136 @@
+//
+//  TDReplicationTrace.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDReplicationTrace.h"
+#import "CDTLogging.h"
+
+#define kDefaultMaximumFileSize (10 * 1024 * 1024)
+#define kBufferSize (16 * 1024)
+
+// Written in place of the event which would take the file past its maximum size.
+static const char kTruncatedLine[] = "{\"e\":\"truncated\"}";
+
+@implementation TDReplicationTrace {
+    dispatch_queue_t _queue;
+    NSFileHandle* _file;  // nil once closed, or once writing failed
+    NSMutableData* _buffer;
+    UInt64 _fileSize;
+    CFAbsoluteTime _openTime;
+    BOOL _truncated;
+}
+
+- (instancetype)initWithURL:(NSURL*)url error:(NSError**)outError
+{
+    self = [super init];
+    if (self) {
+        _url = [url copy];
+        NSFileManager* fm = [NSFileManager defaultManager];
+        if (![fm fileExistsAtPath:url.path] && ![fm createFileAtPath:url.path
+                                                            contents:nil
+                                                          attributes:nil]) {
+            if (outError) {
+                *outError = [NSError errorWithDomain:NSCocoaErrorDomain
+                                                code:NSFileWriteUnknownError
+                                            userInfo:@{NSFilePathErrorKey : url.path}];
+            }
+            return nil;
+        }
+        _file = [NSFileHandle fileHandleForWritingToURL:url error:outError];
+        if (!_file) return nil;
+        _fileSize = [_file seekToEndOfFile];
+        _buffer = [NSMutableData dataWithCapacity:kBufferSize];
+        _maximumFileSize = kDefaultMaximumFileSize;
+        _queue = dispatch_queue_create("com.cloudant.sync.replication.trace",
+                                       dispatch_queue_attr_make_with_qos_class(
+                                           DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0));
+        _openTime = CFAbsoluteTimeGetCurrent();
+        NSTimeInterval date = [NSDate date].timeIntervalSince1970;
+        [self recordEvent:@"open" fields:@{ @"date" : @(round(date * 1000) / 1000) }];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    // Every queued event holds a reference, so none are left to run.
+    [self writeBuffer];
+    [_file closeFile];
+}
+
+- (void)recordEvent:(NSString*)event fields:(NSDictionary<NSString*, id>*)fields
+{
+    NSTimeInterval time = CFAbsoluteTimeGetCurrent() - _openTime;
+    NSMutableDictionary* line = fields ? [fields mutableCopy] : [NSMutableDictionary dictionary];
+    line[@"e"] = event;
+    line[@"t"] = @(round(time * 1000) / 1000);
+    dispatch_async(_queue, ^{
+        [self appendLine:line];
+    });
+}
+
+// Must be called on _queue.
+- (void)appendLine:(NSDictionary*)line
+{
+    if (!_file || _truncated) return;
+    NSError* error;
+    NSData* json = [NSJSONSerialization dataWithJSONObject:line options:0 error:&error];
+    if (!json) {
+        os_log_error(CDTOSLog, "Replication trace event not recorded: %{public}@", error);
+        return;
+    }
+    // Room is always left for the truncated line after this one.
+    if (_fileSize + _buffer.length + json.length + sizeof(kTruncatedLine) + 1 > _maximumFileSize) {
+        _truncated = YES;
+        json = [NSData dataWithBytes:kTruncatedLine length:strlen(kTruncatedLine)];
+    }
+    [_buffer appendData:json];
+    [_buffer appendBytes:"\n" length:1];
+    if (_buffer.length >= kBufferSize || _truncated) {
+        [self writeBuffer];
+    }
+}
+
+// Must be called on _queue.
+- (void)writeBuffer
+{
+    if (!_file || _buffer.length == 0) return;
+    @try {
+        [_file writeData:_buffer];
+        _fileSize += _buffer.length;
+    } @catch (NSException* x) {
+        os_log_error(CDTOSLog, "Replication trace %{public}@ not written, so stopped: %{public}@", _url.path, x);
+        [_file closeFile];
+        _file = nil;
+    }
+    _buffer.length = 0;
+}
+
+- (void)flush
+{
+    dispatch_sync(_queue, ^{
+        [self writeBuffer];
+        [self->_file synchronizeFile];
+    });
+}
+
+- (void)close
+{
+    dispatch_sync(_queue, ^{
+        [self writeBuffer];
+        [self->_file closeFile];
+        self->_file = nil;
+    });
+}
+
+@end
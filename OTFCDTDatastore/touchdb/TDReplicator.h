@@ -11,7 +11,8 @@
 #import <Foundation/Foundation.h>
 #import "CDTURLSession.h"
 
-@class TD_Database, TD_RevisionList, TDBatcher, TDReachability;
+@class TD_Database, TD_RevisionList, TDBatcher, TDReachability, CDTHTTPConnectionBudget;
+@class CDTReplicationMetrics, TDReplicationTrace, TDJSONDecodePool;
 @protocol TDAuthorizer;
 
 /** Posted when replicator starts running. */
@@ -32,6 +33,7 @@ extern NSString* _Nullable TDReplicatorStoppedNotification;
     BOOL _continuous;
     NSString* _filterName;
     NSDictionary* _filterParameters;
+    NSDictionary* _selector;
     NSArray* _docIDs;
     NSObject* _lastSequence;
     BOOL _lastSequenceChanged;
@@ -50,6 +52,9 @@ extern NSString* _Nullable TDReplicatorStoppedNotification;
     NSDictionary* _requestHeaders;
    @private
     TDReachability* _host;
+    NSUInteger _changesAtCheckpoint;
+    UInt64 _bytesAtCheckpoint;
+    BOOL _remoteCheckpointBehind;  // a local-only checkpoint is ahead of the remote one
 }
 
 + (NSString*_Nullable)progressChangedNotification;
@@ -67,6 +72,9 @@ extern NSString* _Nullable TDReplicatorStoppedNotification;
 @property (readonly) BOOL continuous;
 @property (copy) NSString* _Nullable filterName;
 @property (copy) NSDictionary* _Nullable filterParameters;
+/** Mango selector the remote filters a pull with; see TDChangeTracker.selector. A push's
+    selector is matched locally, by TDPusher.docIDsFilter, and only goes into the checkpoint ID. */
+@property (copy) NSDictionary* _Nullable selector;
 @property (copy) NSArray* _Nullable docIDs;
 
 /** Whether to ignore saved changes feed checkpoints */
@@ -78,6 +86,48 @@ extern NSString* _Nullable TDReplicatorStoppedNotification;
 @property (nonatomic, strong,readonly) CDTURLSession * _Nullable session;
 @property (nonatomic, weak) NSObject<CDTNSURLSessionConfigurationDelegate> * _Nullable sessionConfigDelegate;
 
+/** Optional limit on HTTP requests in flight, shared with other replicators. Set before starting. */
+@property (nonatomic, strong) CDTHTTPConnectionBudget * _Nullable connectionBudget;
+
+/** This replicator's share of the connectionBudget. Defaults to 1. */
+@property (nonatomic) NSUInteger connectionWeight;
+
+/** If YES, large request bodies are sent gzipped, for the requests the subclass compresses (the
+    pusher's _revs_diff and _bulk_docs). Turned off if the server refuses them. Defaults to NO. */
+@property (nonatomic) BOOL compressRequestBodies;
+
+/** Seconds after the checkpointed sequence changes that a checkpoint is saved. Defaults to 5. */
+@property (nonatomic) NSTimeInterval checkpointInterval;
+
+/** If more than 0, a checkpoint is saved as soon as this many more changes have been processed
+    since the last one, without waiting for checkpointInterval. */
+@property (nonatomic) NSUInteger checkpointAfterChanges;
+
+/** If more than 0, a checkpoint is saved as soon as this many more bytes have been sent and
+    received since the last one, without waiting for checkpointInterval. */
+@property (nonatomic) UInt64 checkpointAfterBytes;
+
+/** If YES, checkpoints saved while revisions are being transferred are only written to the local
+    database, which is enough for this replicator to resume from. The remote checkpoint document
+    is brought up to date when the replicator goes idle or stops. Defaults to NO. */
+@property (nonatomic) BOOL localInterimCheckpoints;
+
+/** Saves a checkpoint straight away if the checkpointed sequence has changed since the last one,
+    on the replicator's thread. Called when the app resigns active or enters the background, as
+    it may be killed without further notice. */
+- (void)checkpointNow;
+
+/** Throughput and latency figures for this replicator, updated as it runs. */
+@property (readonly, nonatomic) CDTReplicationMetrics* _Nonnull metrics;
+
+/** If set, the replicator's requests, changes pages, batches, inserts and checkpoints are
+    recorded in it as they happen; it's flushed when the replicator stops. Set before starting. */
+@property (nonatomic, strong) TDReplicationTrace* _Nullable trace;
+
+/** Pool that large responses are decoded on, and revisions of _bulk_get responses built on, off
+    the replicator's thread. Defaults to the shared pool; nil decodes everything on the thread. */
+@property (nonatomic, strong) TDJSONDecodePool* _Nullable decodePool;
+
 /** Access to the replicator's NSThread execution state.*/
 /** NSThread.executing*/
 -(BOOL) threadExecuting;
@@ -19,6 +19,8 @@
 #import "TDReplicator.h"
 #import <Foundation/Foundation.h>
 #import "CDTLogging.h"
+#import "CDTReplicationMetrics.h"
+#import "CDTURLSessionPool.h"
 #import "CDTURLSession.h"
 #import "CollectionUtils.h"
 #import "MYURLUtils.h"
@@ -27,12 +29,15 @@
 #import "TDBatcher.h"
 #import "TDCanonicalJSON.h"
 #import "TDInternal.h"
+#import "TDJSONDecodePool.h"
 #import "TDMisc.h"
 #import "TDPuller.h"
 #import "TDPusher.h"
 #import "TDReachability.h"
 #import "TDRemoteRequest.h"
+#import "TDReplicationTrace.h"
 #import "TD_Database+Replication.h"
+#import "TD_Database+Snapshot.h"
 #import "Test.h"
 
 #if TARGET_OS_IPHONE
@@ -63,8 +68,6 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
 @property (nonatomic, strong) NSArray* interceptors;
 
 - (void) updateActive;
-- (void) fetchRemoteCheckpointDoc;
-- (void) saveLastSequence;
 @end
 
 @implementation TDReplicator
@@ -105,6 +108,10 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
         _replicatorStopped = NO;
         _interceptors = interceptors;
         _heartbeat = nil;
+        _connectionWeight = 1;
+        _checkpointInterval = 5.0;
+        _metrics = [[CDTReplicationMetrics alloc] init];
+        _decodePool = [TDJSONDecodePool sharedPool];
     }
     return self;
 }
@@ -129,12 +136,23 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
     [self stop];
 }
 
+- (void)performBlockOnReplicatorThread:(void (^)(void))block
+{
+    [self performSelector:@selector(performBlock:)
+                 onThread:_replicatorThread
+               withObject:[block copy]
+            waitUntilDone:NO];
+}
+
+- (void)performBlock:(void (^)(void))block { block(); }
+
 - (NSString*) description {
     return $sprintf(@"%@ [%@]", [self class], TDCleanURLtoString(_remote));
 }
 
 
 @synthesize db=_db, remote=_remote, filterName=_filterName, filterParameters=_filterParameters, docIDs = _docIDs;
+@synthesize selector=_selector;
 @synthesize running=_running, online=_online, active=_active, continuous=_continuous;
 @synthesize error=_error, sessionID=_sessionID;
 @synthesize changesProcessed=_changesProcessed, changesTotal=_changesTotal;
@@ -151,7 +169,8 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
 {
     return _db == other->_db && $equal(_remote, other->_remote) && self.isPush == other.isPush &&
            _continuous == other->_continuous && $equal(_filterName, other->_filterName) &&
-           $equal(_filterParameters, other->_filterParameters) && _reset == other->_reset &&
+           $equal(_filterParameters, other->_filterParameters) &&
+           $equal(_selector, other->_selector) && _reset == other->_reset &&
            [_heartbeat isEqualToNumber:other->_heartbeat] && $equal(_docIDs, other->_docIDs) &&
            $equal(_requestHeaders, other->_requestHeaders);
 }
@@ -163,13 +182,50 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
     if (!$equal(lastSequence, _lastSequence)) {
         os_log_debug(CDTOSLog, "%{public}@: Setting lastSequence to %{public}@ (from %{public}@)", self, lastSequence, _lastSequence);
         _lastSequence = [lastSequence copy];
-        if (!_lastSequenceChanged) {
+        if (self.checkpointIsDue) {
+            // Enough work to lose that it's saved now, rather than when the timer fires
+            [NSObject cancelPreviousPerformRequestsWithTarget:self
+                                                     selector:@selector(saveLastSequence)
+                                                       object:nil];
+            _lastSequenceChanged = YES;
+            [self saveLastSequence];
+        } else if (!_lastSequenceChanged) {
             _lastSequenceChanged = YES;
-            [self performSelector:@selector(saveLastSequence) withObject:nil afterDelay:5.0];
+            [self performSelector:@selector(saveLastSequence)
+                       withObject:nil
+                       afterDelay:_checkpointInterval];
         }
     }
 }
 
+- (UInt64)bytesTransferred { return _metrics.bytesSent + _metrics.bytesReceived; }
+
+- (BOOL)checkpointIsDue
+{
+    return (_checkpointAfterChanges > 0 &&
+            _changesProcessed - _changesAtCheckpoint >= _checkpointAfterChanges) ||
+           (_checkpointAfterBytes > 0 &&
+            self.bytesTransferred - _bytesAtCheckpoint >= _checkpointAfterBytes);
+}
+
+- (void)checkpointNow
+{
+    //this can be called from another thread, but we need to execute it the replicator's thread
+    [self performSelector:@selector(checkpointNowOnMyThread)
+                 onThread:_replicatorThread
+               withObject:nil
+            waitUntilDone:NO];
+}
+
+- (void)checkpointNowOnMyThread
+{
+    if (!_lastSequenceChanged) return;
+    [NSObject cancelPreviousPerformRequestsWithTarget:self
+                                             selector:@selector(saveLastSequence)
+                                               object:nil];
+    [self saveLastSequence];
+}
+
 - (void)postProgressChanged
 {
     os_log_debug(CDTOSLog, "%{public}@: postProgressChanged (%{public}u/%{public}u, active=%{public}d (batch=%{public}u, net=%{public}u), online=%{public}d)", self, (unsigned)_changesProcessed, (unsigned)_changesTotal, _active, (unsigned)_batcher.count, _asyncTaskCount, _online);
@@ -185,6 +241,7 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
 - (void)setChangesProcessed:(NSUInteger)processed
 {
     _changesProcessed = processed;
+    [_metrics recordDocumentsProcessed:processed];
     [self postProgressChanged];
 }
 
@@ -244,6 +301,16 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
     [[NSNotificationCenter defaultCenter] addObserver: self selector: @selector(databaseWasDeleted:)
                                                  name: TD_DatabaseWillBeDeletedNotification
                                                object: _db];
+#if TARGET_OS_IPHONE
+    // The app may be suspended or killed after these, losing the work since the last checkpoint
+    for (NSString* name in @[ UIApplicationWillResignActiveNotification,
+                              UIApplicationDidEnterBackgroundNotification ]) {
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(checkpointNow)
+                                                     name:name
+                                                   object:nil];
+    }
+#endif
 }
 
 -(void) checkIfNotCanceledThenStart
@@ -270,14 +337,29 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
 }
 
 
+- (CDTURLSession*)makeSession
+{
+    CDTURLSession* session =
+        [[CDTURLSession alloc] initWithCallbackThread:_replicatorThread
+                                  requestInterceptors:self.interceptors
+                                sessionConfigDelegate:self.sessionConfigDelegate];
+    session.connectionBudget = self.connectionBudget;
+    session.connectionWeight = self.connectionWeight;
+    session.metrics = _metrics;
+    session.trace = _trace;
+    if (!self.sessionConfigDelegate) {
+        // Share connections with other replications to the same host.
+        session.connectionPool = [CDTURLSessionPool sharedPool];
+    }
+    return session;
+}
+
 /**
  * Start a thread for each replicator
  * Taken from TDServer.m.
  */
 - (void) runReplicatorThread:(dispatch_group_t)taskGroup {
-    self.session = [[CDTURLSession alloc] initWithCallbackThread:_replicatorThread
-                                             requestInterceptors:self.interceptors
-                                           sessionConfigDelegate:self.sessionConfigDelegate];
+    self.session = [self makeSession];
     @autoreleasepool {
         os_log_info(CDTOSLog, "TDReplicator thread starting...");
         
@@ -350,8 +432,16 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
                                              delay:kProcessDelay
                                          processor:^(NSArray* inbox) {
         os_log_debug(CDTOSLog, "*** %{public}@: BEGIN processInbox (%{public}u sequences)", self, (unsigned)inbox.count);
+        CFAbsoluteTime flushStart = CFAbsoluteTimeGetCurrent();
         TD_RevisionList* revs = [[TD_RevisionList alloc] initWithArray:inbox];
         [self processInbox:revs];
+        [self->_metrics recordQueueDepth:self->_batcher.count];
+        [self->_trace recordEvent:@"flush"
+                           fields:@{
+                               @"revs" : @(inbox.count),
+                               @"queued" : @(self->_batcher.count),
+                               @"ms" : @(round((CFAbsoluteTimeGetCurrent() - flushStart) * 1000))
+                           }];
         os_log_debug(CDTOSLog, "*** %{public}@: END processInbox (lastSequence=%{public}@)", self, self->_lastSequence);
         [self updateActive];
     }];
@@ -364,6 +454,13 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
     }
 
     _startTime = CFAbsoluteTimeGetCurrent();
+    [_metrics restart];
+    [_trace recordEvent:@"start"
+                 fields:@{
+                     @"session" : _sessionID ?: @"",
+                     @"push" : @(self.isPush),
+                     @"continuous" : @(_continuous)
+                 }];
 
     [[NSNotificationCenter defaultCenter] postNotificationName:TDReplicatorStartedNotification
                                                         object:self];
@@ -431,6 +528,14 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
                                      beforeDate: [NSDate dateWithTimeIntervalSinceNow:0.1]];
         }
 
+        NSMutableDictionary* stopFields = [@{
+            @"session" : _sessionID ?: @"",
+            @"changes" : @(_changesProcessed)
+        } mutableCopy];
+        if (_error) stopFields[@"error"] = $sprintf(@"%@ %ld", _error.domain, (long)_error.code);
+        [_trace recordEvent:@"stop" fields:stopFields];
+        [_trace flush];
+
         // post "stopped" notification after saving last sequence number so it's guaranteed to be
         // up-to-date for anyone waiting on the replicator to stop
         [[NSNotificationCenter defaultCenter] postNotificationName:TDReplicatorStoppedNotification
@@ -531,14 +636,18 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
             // Replicator is now idle. If it's not continuous, stop.
             if (!_continuous) {
                 [self stopped];
-            } else if (_revisionsFailed > 0) {
-                os_log_info(CDTOSLog, "%{public}@: Failed to xfer %{public}u revisions; will retry in %{public}g sec", self, _revisionsFailed, kRetryDelay);
-                [NSObject cancelPreviousPerformRequestsWithTarget:self
-                                                         selector:@selector(retryIfReady)
-                                                           object:nil];
-                [self performSelector:@selector(retryIfReady)
-                           withObject:nil
-                           afterDelay:kRetryDelay];
+            } else {
+                // It may be idle for a long time, so the remote checkpoint catches up now
+                if (_remoteCheckpointBehind) [self saveLastSequence];
+                if (_revisionsFailed > 0) {
+                    os_log_info(CDTOSLog, "%{public}@: Failed to xfer %{public}u revisions; will retry in %{public}g sec", self, _revisionsFailed, kRetryDelay);
+                    [NSObject cancelPreviousPerformRequestsWithTarget:self
+                                                             selector:@selector(retryIfReady)
+                                                               object:nil];
+                    [self performSelector:@selector(retryIfReady)
+                               withObject:nil
+                               afterDelay:kRetryDelay];
+                }
             }
         }
     }
@@ -562,6 +671,7 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
 {
     Assert(_running);
     [_batcher queueObject:rev];
+    [_metrics recordQueueDepth:_batcher.count];
     [self updateActive];
 }
 
@@ -570,6 +680,7 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
     Assert(_running);
     os_log_debug(CDTOSLog, "%{public}@: Received %{public}llu revs", self, (UInt64)revs.count);
     [_batcher queueObjects:revs.allRevisions];
+    [_metrics recordQueueDepth:_batcher.count];
     [self updateActive];
 }
 
@@ -646,6 +757,38 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
                                     path:(NSString*)path
                                     body:(id)body
                             onCompletion:(TDRemoteRequestCompletionBlock)onCompletion
+{
+    return [self sendAsyncRequest:method
+                             path:path
+                             body:body
+                    streamingArray:nil
+                        onElement:nil
+                     onCompletion:onCompletion];
+}
+
+- (TDRemoteJSONRequest*)sendAsyncRequest:(NSString*)method
+                                    path:(NSString*)path
+                                    body:(id)body
+                          streamingArray:(NSString*)arrayKey
+                               onElement:(void (^)(id element))onElement
+                            onCompletion:(TDRemoteRequestCompletionBlock)onCompletion
+{
+    return [self sendAsyncRequest:method
+                             path:path
+                             body:body
+                   streamingArray:arrayKey
+                 elementTransform:nil
+                        onElement:onElement
+                     onCompletion:onCompletion];
+}
+
+- (TDRemoteJSONRequest*)sendAsyncRequest:(NSString*)method
+                                    path:(NSString*)path
+                                    body:(id)body
+                          streamingArray:(NSString*)arrayKey
+                        elementTransform:(id (^)(id element))elementTransform
+                               onElement:(void (^)(id element))onElement
+                            onCompletion:(TDRemoteRequestCompletionBlock)onCompletion
 {
     os_log_info(CDTOSLog, "%{public}@: %{public}@ %{public}@", self, method, path);
     NSURL* url;
@@ -661,30 +804,48 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
     __weak TDReplicator* weakSelf = self;
     __block TDRemoteJSONRequest* req = nil;
     if (!self.session) {
-        self.session = [[CDTURLSession alloc] initWithCallbackThread:_replicatorThread
-                                                 requestInterceptors:self.interceptors
-                                               sessionConfigDelegate:self.sessionConfigDelegate];
-    }
-    req = [[TDRemoteJSONRequest alloc] initWithSession:self.session method:method
-                                                  URL:url
-                                                 body:body
-                                       requestHeaders:self.requestHeaders
-                                         onCompletion:^(id result, NSError* error) {
-                                             TDReplicator* strongSelf = weakSelf;
-                                             [strongSelf removeRemoteRequest:req];
-                                             id<TDAuthorizer> auth = req.authorizer;
-                                             if (auth && auth != self->_authorizer && error.code != 401) {
-                                                 os_log_info(CDTOSLog, "%{public}@: Updated to %{public}@", self, auth);
-                                                 self->_authorizer = auth;
-                                             }
-                                             onCompletion(result, error);
-                                         }];
+        self.session = [self makeSession];
+    }
+    TDRemoteRequestCompletionBlock completion = ^(id result, NSError* error) {
+        TDReplicator* strongSelf = weakSelf;
+        [strongSelf removeRemoteRequest:req];
+        id<TDAuthorizer> auth = req.authorizer;
+        if (auth && auth != self->_authorizer && error.code != 401) {
+            os_log_info(CDTOSLog, "%{public}@: Updated to %{public}@", self, auth);
+            self->_authorizer = auth;
+        }
+        if (req.compressionRejected) {
+            strongSelf.compressRequestBodies = NO;
+        }
+        onCompletion(result, error);
+    };
+    if (arrayKey) {
+        req = [[TDRemoteJSONStreamingRequest alloc] initWithSession:self.session
+                                                             method:method
+                                                                URL:url
+                                                               body:body
+                                                     requestHeaders:self.requestHeaders
+                                                           arrayKey:arrayKey
+                                                          onElement:onElement
+                                                       onCompletion:completion];
+        ((TDRemoteJSONStreamingRequest*)req).elementTransform = elementTransform;
+    } else {
+        req = [[TDRemoteJSONRequest alloc] initWithSession:self.session method:method
+                                                      URL:url
+                                                     body:body
+                                           requestHeaders:self.requestHeaders
+                                             onCompletion:completion];
+    }
     req.authorizer = _authorizer;
+    req.decodePool = _decodePool;
+    req.compressBody = body && self.compressRequestBodies && [self compressesRequestBodyForPath:path];
     [self addRemoteRequest:req];
     [req start];
     return req;
 }
 
+- (BOOL)compressesRequestBodyForPath:(NSString*)path { return NO; }
+
 - (void)addRemoteRequest:(TDRemoteRequest*)request
 {
     if (!_remoteRequests) _remoteRequests = [[NSMutableArray alloc] init];
@@ -724,11 +885,22 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
     It's based on the local database UUID (the private one, to make the result unguessable),
     the remote database's URL, and the filter name and parameters (if any). */
 - (NSString*)remoteCheckpointDocID
+{
+    return [self remoteCheckpointDocIDWithLocalUUID:_db.privateUUID];
+}
+
+- (NSString*)remoteCheckpointDocIDWithLocalUUID:(NSString*)localUUID
 {
     NSMutableDictionary* spec =
-        $mdict({ @"localUUID", _db.privateUUID }, { @"remoteURL", _remote.absoluteString },
+        $mdict({ @"localUUID", localUUID }, { @"remoteURL", _remote.absoluteString },
                { @"push", @(self.isPush) }, { @"filter", _filterName },
                { @"filterParams", _filterParameters });
+    if (_selector) {
+        // Each selector reads a different subset of the feed, so needs its own checkpoint. Only
+        // added when set, so that unfiltered replications keep their existing checkpoints.
+        spec[@"selector"] = TDHexSHA1Digest([TDCanonicalJSON canonicalData:_selector]);
+    }
+    [self addToRemoteCheckpointSpec:spec];
     return TDHexSHA1Digest([TDCanonicalJSON canonicalData:spec]);
 }
 
@@ -755,11 +927,22 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
     NSString* checkpointID = self.remoteCheckpointDocID;
     NSDictionary<NSString*, NSObject*>* localCheckpoint =
         [_db checkpointDocumentWithID:checkpointID];
+    // A database installed from a snapshot already has what the snapshot's pulls fetched, so
+    // until it has checkpointed under its own ID a pull can carry on from theirs.
+    BOOL seededFromSnapshot = NO;
+    NSString* snapshotUUID = self.isPush || localCheckpoint ? nil : _db.snapshotUUID;
+    if (snapshotUUID) {
+        localCheckpoint =
+            [_db checkpointDocumentWithID:[self remoteCheckpointDocIDWithLocalUUID:snapshotUUID]];
+        seededFromSnapshot = (localCheckpoint != nil);
+    }
     NSObject* localLastSequence = localCheckpoint[@"source_last_seq"];
     if (!localLastSequence) {
         // local doc is in the old format
         localLastSequence = localCheckpoint[@"seq"];
     }
+    // Saved by -saveLocalCheckpoint, over the remote checkpoint in the rest of the document
+    NSObject* localOnlySequence = localCheckpoint[@"local_last_seq"];
 
     [self asyncTaskStarted];
     TDRemoteJSONRequest* request = [self
@@ -783,9 +966,20 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
                         remoteLastSequence = response[@"seq"];
                     }
 
-                    if ($equal(remoteLastSequence, localLastSequence)) {
+                    if (localOnlySequence && $equal(response[@"session_id"], localCheckpoint[@"session_id"]) &&
+                        $equal(remoteLastSequence, localLastSequence)) {
+                        // The remote checkpoint is still the one the local one was saved over
+                        self->_lastSequence = localOnlySequence;
+                        self->_remoteCheckpointBehind = YES;
+                        [self resumeFromLocalCheckpoint:localCheckpoint];
+                        os_log_info(CDTOSLog, "%{public}@: Replicating from local lastSequence=%{public}@", self, localOnlySequence);
+                    } else if ($equal(remoteLastSequence, localLastSequence)) {
                         self->_lastSequence = localLastSequence;
+                        if (localCheckpoint) [self resumeFromLocalCheckpoint:localCheckpoint];
                         os_log_info(CDTOSLog, "%{public}@: Replicating from lastSequence=%{public}@", self, self->_lastSequence);
+                    } else if (seededFromSnapshot && !remoteLastSequence && localLastSequence) {
+                        self.lastSequence = localLastSequence;
+                        os_log_info(CDTOSLog, "%{public}@: Replicating from snapshot's lastSequence=%{public}@", self, localLastSequence);
                     } else {
                         // traverse the history object looking for the last session where the
                         // session ids match.
@@ -833,6 +1027,40 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
 @synthesize savingCheckpoint = _savingCheckpoint;  // for unit tests
 #endif
 
+- (void)addToLocalCheckpoint:(NSMutableDictionary*)checkpoint {}
+
+- (void)resumeFromLocalCheckpoint:(NSDictionary*)checkpoint {}
+
+- (void)addToRemoteCheckpointSpec:(NSMutableDictionary*)spec {}
+
+// Records the sequence in the local checkpoint only, saving the remote PUT while revisions are
+// still being transferred. The remote checkpoint it was saved over is kept, so that on the next
+// run the local sequence is only trusted while the remote checkpoint is still that one.
+- (void)saveLocalCheckpoint
+{
+    if (!_lastSequenceChanged || !_db) return;
+    _lastSequenceChanged = NO;
+    _changesAtCheckpoint = _changesProcessed;
+    _bytesAtCheckpoint = self.bytesTransferred;
+
+    NSMutableDictionary* body = [self.remoteCheckpoint mutableCopy];
+    if (!body || body[@"error"]) body = [NSMutableDictionary dictionary];
+    body[@"_id"] = [@"_local/" stringByAppendingString:self.remoteCheckpointDocID];
+    body[@"local_last_seq"] = _lastSequence;
+    [self addToLocalCheckpoint:body];
+
+    os_log_info(CDTOSLog, "%{public}@ checkpointing sequence=%{public}@ locally", self, _lastSequence);
+    [_trace recordEvent:@"checkpoint"
+                 fields:@{ @"seq" : $sprintf(@"%@", _lastSequence), @"local" : @YES }];
+    NSError* error;
+    if ([_db saveCheckpointDocument:body error:&error]) {
+        _remoteCheckpointBehind = YES;
+    } else {
+        os_log_debug(CDTOSLog, "Failed to save checkpoint to local database. Error was %{public}@", error);
+        _lastSequenceChanged = YES;  // so the remote save still includes it
+    }
+}
+
 - (void)saveLastSequence
 {
     // Replication Protocol V3 check point documents.
@@ -856,16 +1084,26 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
     // source_last_seq (number): Last processed Checkpoint. Shortcut to the recorded_seq field of
     // the latest history object. Required
 
-    if (!_lastSequenceChanged) return;
+    if (_localInterimCheckpoints && _running && _active) {
+        [self saveLocalCheckpoint];
+        return;
+    }
+    if (!_lastSequenceChanged && !_remoteCheckpointBehind) return;
     if (_savingCheckpoint) {
         // If a save is already in progress, don't do anything. (The completion block will trigger
         // another save after the first one finishes.)
         _overdueForSave = YES;
         return;
     }
-    _lastSequenceChanged = _overdueForSave = NO;
+    _lastSequenceChanged = _overdueForSave = _remoteCheckpointBehind = NO;
+    _changesAtCheckpoint = _changesProcessed;
+    _bytesAtCheckpoint = self.bytesTransferred;
 
     os_log_info(CDTOSLog, "%{public}@ checkpointing sequence=%{public}@", self, _lastSequence);
+    [_trace recordEvent:@"checkpoint"
+                 fields:@{ @"seq" : $sprintf(@"%@", _lastSequence), @"local" : @NO }];
+    CDTSignpostEvent("checkpoint", "%{public}@ sequence=%{public}@", self.isPush ? @"push" : @"pull",
+                     _lastSequence);
     NSMutableDictionary* body = [self.remoteCheckpoint mutableCopy];
 
     if (body) {
@@ -922,8 +1160,10 @@ NSString* TDReplicatorStartedNotification = @"TDReplicatorStarted";
                           os_log_debug(CDTOSLog, "%{public}@: Can't save checkpoint to local database because response doesn't contain id: %{public}@", self, response);
                       }
                       self.remoteCheckpoint = body;
+                      NSMutableDictionary* localBody = [body mutableCopy];
+                      [self addToLocalCheckpoint:localBody];
                       NSError *err;
-                      if (ID && ![self.db saveCheckpointDocument:body error:&err]) {
+                      if (ID && ![self.db saveCheckpointDocument:localBody error:&err]) {
                           os_log_debug(CDTOSLog, "Failed to save checkpoint to local database. Error was %{public}@", err);
                       }
                   }
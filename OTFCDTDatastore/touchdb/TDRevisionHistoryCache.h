@@ -0,0 +1,68 @@
+//
+//  TDRevisionHistoryCache.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+@class TD_Revision;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ An in-memory cache of revision histories, holding the most recently used documents.
+
+ Once a revision is stored its ancestry never changes, so a cached history stays valid until
+ revisions are purged or compaction drops ancestors' bodies; the database removes the affected
+ documents when that happens. Each removal bumps the generation: a reader passes the generation
+ it saw before starting its read, so a history read from a snapshot older than the latest
+ removal is not stored.
+
+ The cache is safe to use from several threads.
+ */
+@interface TDRevisionHistoryCache : NSObject
+
+/**
+ @param capacity Number of documents kept; the least recently used are dropped beyond that.
+ */
+- (instancetype)initWithCapacity:(NSUInteger)capacity NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/** Incremented every time documents are removed from the cache. */
+@property (readonly) NSUInteger generation;
+
+/**
+ Returns the history of a revision, starting with the revision itself and ending with the
+ oldest known ancestor, or nil if it isn't cached. The revisions are new objects each time so
+ callers are free to modify them.
+ */
+- (nullable NSArray<TD_Revision*>*)historyOfRevision:(TD_Revision*)rev;
+
+/**
+ Caches the history of a revision, as returned by -[TD_Database getRevisionHistory:], which
+ also answers for each of its ancestors.
+
+ @param generation The generation seen before the history was read; if documents have been
+        removed since then, the history is not stored.
+ */
+- (void)setHistory:(NSArray<TD_Revision*>*)history
+        ofRevision:(TD_Revision*)rev
+        generation:(NSUInteger)generation;
+
+- (void)removeDocumentID:(NSString*)docID;
+
+- (void)removeAllDocuments;
+
+@end
+
+NS_ASSUME_NONNULL_END
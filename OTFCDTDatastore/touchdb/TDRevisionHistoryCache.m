@@ -0,0 +1,145 @@
+//
+//  TDRevisionHistoryCache.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDRevisionHistoryCache.h"
+
+#import "TD_Revision.h"
+
+// Past this many revIDs a document's histories are dropped and cached again from scratch.
+static const NSUInteger kMaxRevisionsPerDocument = 2048;
+
+@interface TDRevisionHistoryCache ()
+
+@property (nonatomic, readonly) NSUInteger capacity;
+
+// docID -> (revID -> history containing that revID); all of a history's revIDs share its array
+@property (nonatomic, strong, readonly)
+    NSMutableDictionary<NSString*, NSMutableDictionary<NSString*, NSArray<TD_Revision*>*>*>*
+        documents;
+
+// docIDs, least recently used first
+@property (nonatomic, strong, readonly) NSMutableOrderedSet<NSString*>* recentDocIDs;
+
+@property (readwrite) NSUInteger generation;
+
+@end
+
+/** The revisions are shared between callers only as copies, since they're mutable. */
+static NSArray<TD_Revision*>* copyHistory(NSArray<TD_Revision*>* history, NSUInteger start)
+{
+    NSMutableArray<TD_Revision*>* copies = [NSMutableArray arrayWithCapacity:history.count - start];
+    for (NSUInteger i = start; i < history.count; i++) {
+        TD_Revision* rev = history[i];
+        TD_Revision* copy =
+            [[TD_Revision alloc] initWithDocID:rev.docID revID:rev.revID deleted:rev.deleted];
+        copy.sequence = rev.sequence;
+        copy.missing = rev.missing;
+        [copies addObject:copy];
+    }
+    return copies;
+}
+
+@implementation TDRevisionHistoryCache
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity
+{
+    self = [super init];
+    if (self) {
+        _capacity = MAX(capacity, 1u);
+        _documents = [NSMutableDictionary dictionary];
+        _recentDocIDs = [NSMutableOrderedSet orderedSet];
+    }
+    return self;
+}
+
+- (NSArray<TD_Revision*>*)historyOfRevision:(TD_Revision*)rev
+{
+    NSString* docID = rev.docID;
+    NSString* revID = rev.revID;
+    if (!docID || !revID) return nil;
+
+    NSArray<TD_Revision*>* history;
+    @synchronized(self)
+    {
+        history = self.documents[docID][revID];
+        if (!history) return nil;
+        [self touchDocumentID:docID];
+    }
+
+    NSUInteger start = [history indexOfObjectPassingTest:^BOOL(TD_Revision* cached, NSUInteger i,
+                                                               BOOL* stop) {
+        return [cached.revID isEqualToString:revID];
+    }];
+    return copyHistory(history, start);
+}
+
+- (void)setHistory:(NSArray<TD_Revision*>*)history
+        ofRevision:(TD_Revision*)rev
+        generation:(NSUInteger)generation
+{
+    NSString* docID = rev.docID;
+    if (!docID || history.count == 0) return;
+    history = copyHistory(history, 0);
+
+    @synchronized(self)
+    {
+        if (generation != self.generation) return;
+
+        NSMutableDictionary* revisions = self.documents[docID];
+        if (!revisions || revisions.count + history.count > kMaxRevisionsPerDocument) {
+            revisions = [NSMutableDictionary dictionary];
+            self.documents[docID] = revisions;
+        }
+        for (TD_Revision* ancestor in history) {
+            revisions[ancestor.revID] = history;
+        }
+        [self touchDocumentID:docID];
+
+        while (self.recentDocIDs.count > self.capacity) {
+            [self.documents removeObjectForKey:self.recentDocIDs.firstObject];
+            [self.recentDocIDs removeObjectAtIndex:0];
+        }
+    }
+}
+
+- (void)removeDocumentID:(NSString*)docID
+{
+    @synchronized(self)
+    {
+        [self.documents removeObjectForKey:docID];
+        [self.recentDocIDs removeObject:docID];
+        self.generation++;
+    }
+}
+
+- (void)removeAllDocuments
+{
+    @synchronized(self)
+    {
+        [self.documents removeAllObjects];
+        [self.recentDocIDs removeAllObjects];
+        self.generation++;
+    }
+}
+
+#pragma mark - Private
+
+/** Must be called while holding the lock. */
+- (void)touchDocumentID:(NSString*)docID
+{
+    [self.recentDocIDs removeObject:docID];
+    [self.recentDocIDs addObject:docID];
+}
+
+@end
@@ -10,12 +10,19 @@
 
 /** A data structure representing a type of array that allows object values to be added to the end,
  * and removed in arbitrary order; it's used by the replicator to keep track of which revisions have
- * been transferred and what sequences to checkpoint. */
+ * been transferred and what sequences to checkpoint.
+ *
+ * The values from the checkpointed sequence to the last are kept in a ring buffer, which grows as
+ * needed, so adding and removing a sequence, and finding the checkpointed one, take constant time
+ * however many sequences are outstanding. */
 @interface TDSequenceMap : NSObject {
-    NSMutableIndexSet* _sequences;   // Sequence numbers currently in the map
-    NSUInteger _lastSequence;        // last generated sequence
-    NSMutableArray* _values;         // values of remaining sequences
-    NSUInteger _firstValueSequence;  // sequence # of first item in _values
+    NSMutableArray* _values;       // ring of values, NSNull where there's none
+    BOOL* _removed;                // parallel to _values: YES once the sequence is removed
+    NSUInteger _capacity;          // size of the ring
+    NSUInteger _head;              // index in the ring of the checkpointed sequence
+    SequenceNumber _checkpointed;  // maximum consecutively-removed sequence
+    SequenceNumber _lastSequence;  // last generated sequence
+    NSUInteger _pendingCount;      // sequences added but not yet removed
 }
 
 - (id)init;
@@ -29,6 +36,9 @@
 
 @property (readonly) BOOL isEmpty;
 
+/** Number of sequences added but not yet removed. */
+@property (readonly) NSUInteger pendingCount;
+
 /** Returns the maximum consecutively-removed sequence number.
     This is one less than the minimum remaining sequence number. */
 - (SequenceNumber)checkpointedSequence;
@@ -36,4 +46,8 @@
 /** Returns the value associated with the checkpointedSequence. */
 - (id)checkpointedValue;
 
+/** Returns the values, distinct, of the sequences after the checkpointedSequence that have been
+    removed, leaving out those a remaining sequence also has. */
+- (NSArray*)removedValuesAfterCheckpoint;
+
 @end
@@ -20,51 +20,115 @@
 
 @implementation TDSequenceMap
 
+static const NSUInteger kInitialCapacity = 100;
+
 - (id)init
 {
     self = [super init];
     if (self) {
-        _sequences = [[NSMutableIndexSet alloc] init];
-        _values = [[NSMutableArray alloc] initWithCapacity:100];
-        _firstValueSequence = 1;
+        _capacity = kInitialCapacity;
+        _values = [[NSMutableArray alloc] initWithCapacity:_capacity];
+        for (NSUInteger i = 0; i < _capacity; i++) {
+            [_values addObject:[NSNull null]];
+        }
+        _removed = calloc(_capacity, sizeof(BOOL));
+        _removed[0] = YES;  // sequence 0, checkpointed from the start
     }
     return self;
 }
 
+- (void)dealloc { free(_removed); }
+
+/** The index in the ring of a sequence between the checkpointed and the last. */
+static inline NSUInteger slotOf(TDSequenceMap* map, SequenceNumber sequence)
+{
+    return (map->_head + (NSUInteger)(sequence - map->_checkpointed)) % map->_capacity;
+}
+
+/** Doubles the ring, unwrapping it so the checkpointed sequence is at the start. */
+- (void)grow
+{
+    NSUInteger newCapacity = _capacity * 2;
+    NSMutableArray* values = [[NSMutableArray alloc] initWithCapacity:newCapacity];
+    BOOL* removed = calloc(newCapacity, sizeof(BOOL));
+    for (NSUInteger i = 0; i < _capacity; i++) {
+        NSUInteger slot = (_head + i) % _capacity;
+        [values addObject:_values[slot]];
+        removed[i] = _removed[slot];
+    }
+    for (NSUInteger i = _capacity; i < newCapacity; i++) {
+        [values addObject:[NSNull null]];
+    }
+    free(_removed);
+    _values = values;
+    _removed = removed;
+    _capacity = newCapacity;
+    _head = 0;
+}
+
 - (SequenceNumber)addValue:(id)value
 {
-    [_sequences addIndex:++_lastSequence];
-    [_values addObject:value];
+    if ((NSUInteger)(_lastSequence - _checkpointed) + 1 == _capacity) {
+        [self grow];
+    }
+    NSUInteger slot = slotOf(self, ++_lastSequence);
+    _values[slot] = value ?: [NSNull null];
+    _removed[slot] = NO;
+    _pendingCount++;
     return _lastSequence;
 }
 
 - (void)removeSequence:(SequenceNumber)sequence
 {
-    Assert(sequence > 0 && sequence <= (SequenceNumber)_lastSequence,
-           @"Invalid sequence %lld (latest is %u)", sequence, _lastSequence);
-    [_sequences removeIndex:(NSUInteger)sequence];
+    Assert(sequence > 0 && sequence <= _lastSequence, @"Invalid sequence %lld (latest is %lld)",
+           sequence, _lastSequence);
+    if (sequence <= _checkpointed) {
+        return;
+    }
+    NSUInteger slot = slotOf(self, sequence);
+    if (_removed[slot]) {
+        return;
+    }
+    _removed[slot] = YES;
+    _pendingCount--;
+
+    // Advance past the removed prefix; each sequence is passed over once, so this is constant
+    // time amortised over the removals. Only the checkpointed sequence's value is kept.
+    while (_checkpointed < _lastSequence && _removed[(_head + 1) % _capacity]) {
+        _values[_head] = [NSNull null];
+        _head = (_head + 1) % _capacity;
+        _checkpointed++;
+    }
 }
 
-- (BOOL)isEmpty { return _sequences.firstIndex == NSNotFound; }
+- (BOOL)isEmpty { return _pendingCount == 0; }
+
+- (NSUInteger)pendingCount { return _pendingCount; }
 
-- (SequenceNumber)checkpointedSequence
+- (SequenceNumber)checkpointedSequence { return _checkpointed; }
+
+- (id)checkpointedValue
 {
-    NSUInteger sequence = _sequences.firstIndex;
-    sequence = (sequence == NSNotFound) ? _lastSequence : sequence - 1;
-
-    if (sequence > _firstValueSequence) {
-        // Garbage-collect inaccessible values:
-        NSUInteger numToRemove = sequence - _firstValueSequence;
-        [_values removeObjectsInRange:NSMakeRange(0, numToRemove)];
-        _firstValueSequence += numToRemove;
-    }
-    return sequence;
+    id value = _values[_head];
+    return (value == [NSNull null]) ? nil : value;
 }
 
-- (id)checkpointedValue
+- (NSArray*)removedValuesAfterCheckpoint
 {
-    NSInteger index = (NSInteger)([self checkpointedSequence] - _firstValueSequence);
-    return (index >= 0) ? _values[index] : nil;
+    NSMutableOrderedSet* removed = [NSMutableOrderedSet orderedSet];
+    NSMutableSet* remaining = [NSMutableSet set];
+    for (SequenceNumber sequence = _checkpointed + 1; sequence <= _lastSequence; sequence++) {
+        NSUInteger slot = slotOf(self, sequence);
+        id value = _values[slot];
+        if (value == [NSNull null]) continue;
+        if (_removed[slot]) {
+            [removed addObject:value];
+        } else {
+            [remaining addObject:value];
+        }
+    }
+    [removed minusSet:remaining];
+    return removed.array;
 }
 
 @end
@@ -0,0 +1,80 @@
+//
+//  TDSharedBlobStore.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+#import "TDBlobStore.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ A content-addressed store of attachment blobs shared by all the databases of a
+ TD_DatabaseManager, so that an attachment held by several of them is only stored once.
+
+ Each blob is a file named by the hex SHA-1 TDBlobKey. The blob files of the databases' own
+ TDBlobStores are hard links to these, so the file system's link count is the reference count:
+ a blob whose link count has dropped to one is no longer used by any database and is removed by
+ -deleteUnreferencedBlobs. The store also remembers the MD5 digest of each blob, which is what
+ CouchDB reports for attachments, so a replicator can tell that an attachment it is about to
+ download is already present.
+
+ Only unencrypted blob stores share their blobs; encrypted files are specific to their key.
+ */
+@interface TDSharedBlobStore : NSObject
+
+/**
+ @param dir Directory for the shared blobs; it is created if it does not exist.
+ */
+- (nullable instancetype)initWithPath:(NSString *)dir error:(NSError *__autoreleasing *)outError;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@property (readonly) NSString *path;
+
+/**
+ Adds a blob that has just been installed in a database's blob store. If the shared store already
+ has it, the file at `path` is replaced by a link to the shared copy; otherwise the shared store
+ links to the file. Failures are logged and otherwise ignored, as the database keeps its own copy.
+
+ @param path Path of the installed blob file.
+ @param key The blob's key.
+ @param MD5Digest The blob's digest in the form the "digest" attachment property uses, or nil.
+ */
+- (void)addBlobAtPath:(NSString *)path withKey:(TDBlobKey)key MD5Digest:(nullable NSString *)MD5Digest;
+
+/**
+ Looks up a blob by an attachment's "digest" property, which may be either "sha1-" or "md5-".
+
+ @return YES and the key, if the shared store has the blob.
+ */
+- (BOOL)getKey:(TDBlobKey *)outKey forDigest:(NSString *)digest;
+
+/**
+ Creates a link to a shared blob, e.g. at a temporary path from which a TDBlobStoreWriter will
+ install it.
+
+ @return YES if the blob is in the store and was linked to (or, across volumes, copied to) `path`.
+ */
+- (BOOL)linkBlobWithKey:(TDBlobKey)key toPath:(NSString *)path length:(nullable UInt64 *)outLength;
+
+/**
+ Deletes the blobs no database links to any more.
+
+ @return The number of blobs deleted.
+ */
+- (NSUInteger)deleteUnreferencedBlobs;
+
+@end
+
+NS_ASSUME_NONNULL_END
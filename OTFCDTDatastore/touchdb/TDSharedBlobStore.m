@@ -0,0 +1,193 @@
+//
+//  TDSharedBlobStore.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDSharedBlobStore.h"
+
+#import "TDBase64.h"
+#import "TDMisc.h"
+#import "CDTLogging.h"
+#import "CollectionUtils.h"
+
+// Subdirectory mapping the hex MD5 digest of each blob to its key
+static NSString *const kDigestsDirName = @"digests";
+
+@implementation TDSharedBlobStore {
+    NSString *_digestsPath;
+}
+
+- (instancetype)initWithPath:(NSString *)dir error:(NSError *__autoreleasing *)outError
+{
+    NSParameterAssert(dir);
+
+    self = [super init];
+    if (self) {
+        _path = [dir copy];
+        _digestsPath = [_path stringByAppendingPathComponent:kDigestsDirName];
+        if (![[NSFileManager defaultManager] createDirectoryAtPath:_digestsPath
+                                       withIntermediateDirectories:YES
+                                                        attributes:nil
+                                                             error:outError]) {
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (NSString *)description { return $sprintf(@"%@[%@]", [self class], _path); }
+
+- (NSString *)pathForKey:(TDBlobKey)key
+{
+    return [_path stringByAppendingPathComponent:TDHexFromBytes(key.bytes, sizeof(key.bytes))];
+}
+
+- (NSString *)pathForMD5Digest:(NSString *)digest
+{
+    if (![digest hasPrefix:@"md5-"]) {
+        return nil;
+    }
+    NSData *md5 = [TDBase64 decode:[digest substringFromIndex:4]];
+    if (md5.length != CC_MD5_DIGEST_LENGTH) {
+        return nil;
+    }
+    return [_digestsPath stringByAppendingPathComponent:TDHexFromBytes(md5.bytes, md5.length)];
+}
+
+- (void)addBlobAtPath:(NSString *)path withKey:(TDBlobKey)key MD5Digest:(NSString *)MD5Digest
+{
+    NSFileManager *fmgr = [NSFileManager defaultManager];
+    NSString *sharedPath = [self pathForKey:key];
+    NSError *error = nil;
+
+    @synchronized(self) {
+        if ([fmgr fileExistsAtPath:sharedPath]) {
+            // Swap the database's copy for a link to ours. Link beside it first so the blob
+            // never goes missing, then rename over it.
+            NSString *tmpPath = [path stringByAppendingPathExtension:@"link"];
+            [fmgr removeItemAtPath:tmpPath error:NULL];
+            if (![fmgr linkItemAtPath:sharedPath toPath:tmpPath error:&error] ||
+                rename(tmpPath.fileSystemRepresentation, path.fileSystemRepresentation) != 0) {
+                os_log_error(CDTOSLog, "%{public}@: Couldn't link %{public}@ to shared blob: %{public}@",
+                             self, path, error);
+                [fmgr removeItemAtPath:tmpPath error:NULL];
+                return;
+            }
+        } else if (![fmgr linkItemAtPath:path toPath:sharedPath error:&error]) {
+            os_log_error(CDTOSLog, "%{public}@: Couldn't share blob %{public}@: %{public}@", self,
+                         path, error);
+            return;
+        }
+
+        NSString *digestPath = [self pathForMD5Digest:MD5Digest];
+        if (digestPath && ![fmgr fileExistsAtPath:digestPath]) {
+            NSData *keyData = [NSData dataWithBytes:key.bytes length:sizeof(key.bytes)];
+            [keyData writeToFile:digestPath atomically:YES];
+        }
+    }
+}
+
+- (BOOL)getKey:(TDBlobKey *)outKey forDigest:(NSString *)digest
+{
+    TDBlobKey key;
+    if ([digest hasPrefix:@"sha1-"]) {
+        NSData *keyData = [TDBase64 decode:[digest substringFromIndex:5]];
+        if (keyData.length != sizeof(key.bytes)) {
+            return NO;
+        }
+        memcpy(key.bytes, keyData.bytes, sizeof(key.bytes));
+    } else {
+        NSString *digestPath = [self pathForMD5Digest:digest];
+        NSData *keyData = digestPath ? [NSData dataWithContentsOfFile:digestPath] : nil;
+        if (keyData.length != sizeof(key.bytes)) {
+            return NO;
+        }
+        memcpy(key.bytes, keyData.bytes, sizeof(key.bytes));
+    }
+
+    if (![[NSFileManager defaultManager] fileExistsAtPath:[self pathForKey:key]]) {
+        return NO;
+    }
+    if (outKey) {
+        *outKey = key;
+    }
+    return YES;
+}
+
+- (BOOL)linkBlobWithKey:(TDBlobKey)key toPath:(NSString *)path length:(UInt64 *)outLength
+{
+    NSFileManager *fmgr = [NSFileManager defaultManager];
+    NSString *sharedPath = [self pathForKey:key];
+    NSError *error = nil;
+
+    @synchronized(self) {
+        NSDictionary *attributes = [fmgr attributesOfItemAtPath:sharedPath error:&error];
+        if (!attributes) {
+            return NO;
+        }
+        if (![fmgr linkItemAtPath:sharedPath toPath:path error:&error]) {
+            // Hard links can't cross volumes, e.g. if the temporary directory is elsewhere:
+            error = nil;
+            if (![fmgr copyItemAtPath:sharedPath toPath:path error:&error]) {
+                os_log_error(CDTOSLog, "%{public}@: Couldn't link shared blob to %{public}@: %{public}@",
+                             self, path, error);
+                return NO;
+            }
+        }
+        if (outLength) {
+            *outLength = attributes.fileSize;
+        }
+        return YES;
+    }
+}
+
+- (NSUInteger)deleteUnreferencedBlobs
+{
+    NSFileManager *fmgr = [NSFileManager defaultManager];
+    NSUInteger deleted = 0;
+
+    @synchronized(self) {
+        for (NSString *filename in [fmgr contentsOfDirectoryAtPath:_path error:NULL]) {
+            if ([filename isEqualToString:kDigestsDirName]) {
+                continue;
+            }
+            NSString *blobPath = [_path stringByAppendingPathComponent:filename];
+            NSDictionary *attributes = [fmgr attributesOfItemAtPath:blobPath error:NULL];
+            if ([attributes[NSFileReferenceCount] unsignedIntegerValue] <= 1 &&
+                [fmgr removeItemAtPath:blobPath error:NULL]) {
+                deleted++;
+            }
+        }
+
+        // Forget the digests of blobs that have gone:
+        for (NSString *filename in [fmgr contentsOfDirectoryAtPath:_digestsPath error:NULL]) {
+            NSString *digestPath = [_digestsPath stringByAppendingPathComponent:filename];
+            NSData *keyData = [NSData dataWithContentsOfFile:digestPath];
+            TDBlobKey key;
+            if (keyData.length == sizeof(key.bytes)) {
+                memcpy(key.bytes, keyData.bytes, sizeof(key.bytes));
+                if ([fmgr fileExistsAtPath:[self pathForKey:key]]) {
+                    continue;
+                }
+            }
+            [fmgr removeItemAtPath:digestPath error:NULL];
+        }
+    }
+
+    if (deleted > 0) {
+        os_log_info(CDTOSLog, "%{public}@: Deleted %{public}lu unreferenced blobs", self,
+                    (unsigned long)deleted);
+    }
+    return deleted;
+}
+
+@end
@@ -31,7 +31,9 @@ typedef NS_ENUM(NSInteger, TDStatus) {
     kTDStatusNotAcceptable = 406,
     kTDStatusConflict = 409,
     kTDStatusDuplicate = 412,  // Formally known as "Precondition Failed"
+    kTDStatusRequestTooLarge = 413,
     kTDStatusUnsupportedType = 415,
+    kTDStatusRangeNotSatisfiable = 416,
     kTDStatusServerError = 500,
     kTDStatusInsufficientStorage = 507,
 
@@ -43,6 +45,7 @@ typedef NS_ENUM(NSInteger, TDStatus) {
     kTDStatusBadID = 494,
     kTDStatusBadParam = 495,
     kTDStatusDeleted = 496,                   // Document deleted
+    kTDStatusCancelled = 497,                 // Query cancelled or out of time
     kTDStatusUpstreamError = 589,             // Error from remote replication server
     kTDStatusDBError = 590,                   // SQLite error
     kTDStatusCorruptError = 591,              // bad data in database
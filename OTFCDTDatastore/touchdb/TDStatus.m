@@ -44,6 +44,7 @@ static const struct StatusMapEntry kStatusMap[] = {
     {kTDStatusBadID, 400, "Invalid database/document/revision ID"},
     {kTDStatusBadParam, 400, "Invalid parameter in JSON body"},
     {kTDStatusDeleted, 404, "deleted"},
+    {kTDStatusCancelled, 408, "Query cancelled"},
     {kTDStatusUpstreamError, 502, "Invalid response from remote replication server"},
     {kTDStatusDBError, 500, "Database error!"},
     {kTDStatusCorruptError, 500, "Invalid data in database"},
@@ -0,0 +1,66 @@
+//
+//  TDStreamingJSONParser.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+@class TDJSONDecodeSequence;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Incrementally parses a JSON object of the form `{..., "<key>": [elem, elem, ...], ...}` as its
+ bytes arrive, handing each element of the named array to a block as soon as it is complete.
+
+ This is the shape of both the _changes feed (`results`) and _bulk_get (`results`) responses.
+ Only one element is ever buffered, so memory use is bounded by the largest element rather than
+ the whole response. The scanner only finds element boundaries; each element is decoded with
+ TDJSON. Other top-level values are skipped.
+ */
+@interface TDStreamingJSONParser : NSObject
+
+/**
+ @param arrayKey the top-level key whose array elements should be reported.
+ @param onElement called, on the thread calling -parseData:, with each decoded element in order.
+ */
+- (instancetype)initWithArrayKey:(NSString *)arrayKey onElement:(void (^)(id element))onElement;
+
+/**
+ Hands the JSON of each element to a decode sequence rather than decoding it itself, so that the
+ elements are decoded on the sequence's pool while the response is still being scanned. The
+ sequence passes on the decoded elements, and any decoding errors.
+ */
+- (instancetype)initWithArrayKey:(NSString *)arrayKey
+                  decodeSequence:(TDJSONDecodeSequence *)decodeSequence;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/** Feeds the next chunk of the response. Returns NO once the input is known to be invalid. */
+- (BOOL)parseData:(NSData *)data;
+
+/** YES once the closing brace of the top-level object has been seen. */
+@property (readonly) BOOL finished;
+
+/** YES once the opening bracket of the named array has been seen, i.e., the response looks like
+    what was expected even if it was then cut short. */
+@property (readonly) BOOL foundArray;
+
+/** Number of elements reported so far. */
+@property (readonly) NSUInteger elementCount;
+
+/** Describes why parsing failed, if it did. */
+@property (readonly, nullable) NSString *errorMessage;
+
+@end
+
+NS_ASSUME_NONNULL_END
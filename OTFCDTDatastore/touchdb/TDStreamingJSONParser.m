@@ -0,0 +1,263 @@
+//
+//  TDStreamingJSONParser.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDStreamingJSONParser.h"
+
+#import "TDJSON.h"
+#import "TDJSONDecodePool.h"
+
+typedef enum {
+    kStateStart,       // before the top-level '{'
+    kStateKeyOrEnd,    // expecting a key or the closing '}'
+    kStateKey,         // inside a top-level key
+    kStateColon,       // expecting ':' after a key
+    kStateValue,       // expecting a top-level value
+    kStateSkipValue,   // inside a top-level value we're not interested in
+    kStateAfterValue,  // expecting ',' or '}' after a top-level value
+    kStateArray,       // inside the named array, between elements
+    kStateElement,     // inside an element of the named array
+    kStateDone,        // seen the closing '}'
+    kStateError
+} TDStreamingJSONState;
+
+static inline BOOL isJSONSpace(uint8_t c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+@interface TDStreamingJSONParser ()
+@property (readwrite) BOOL foundArray;
+@property (readwrite) NSUInteger elementCount;
+@property (readwrite, nullable) NSString *errorMessage;
+@end
+
+@implementation TDStreamingJSONParser {
+    NSData *_arrayKey;
+    void (^_onElement)(id);
+    TDJSONDecodeSequence *_decodeSequence;
+    TDStreamingJSONState _state;
+    NSMutableData *_key;
+    NSMutableData *_element;  // the start of an element that spans chunks
+    NSUInteger _nesting;      // brackets and braces open within the current value
+    BOOL _inString;
+    BOOL _escaped;
+}
+
+- (instancetype)initWithArrayKey:(NSString *)arrayKey onElement:(void (^)(id))onElement
+{
+    self = [super init];
+    if (self) {
+        _arrayKey = [arrayKey dataUsingEncoding:NSUTF8StringEncoding];
+        _onElement = [onElement copy];
+        _state = kStateStart;
+        _key = [NSMutableData data];
+        _element = [NSMutableData data];
+    }
+    return self;
+}
+
+- (instancetype)initWithArrayKey:(NSString *)arrayKey
+                  decodeSequence:(TDJSONDecodeSequence *)decodeSequence
+{
+    self = [self initWithArrayKey:arrayKey onElement:^(id element){
+    }];
+    if (self) {
+        _decodeSequence = decodeSequence;
+    }
+    return self;
+}
+
+- (BOOL)finished { return _state == kStateDone; }
+
+- (BOOL)failWithMessage:(NSString *)message
+{
+    _state = kStateError;
+    self.errorMessage = message;
+    return NO;
+}
+
+- (BOOL)parseData:(NSData *)data
+{
+    if (_state == kStateError) return NO;
+
+    const uint8_t *bytes = data.bytes;
+    NSUInteger length = data.length;
+    NSUInteger elementStart = (_state == kStateElement) ? 0 : NSNotFound;
+
+    NSUInteger i = 0;
+    while (i < length) {
+        uint8_t c = bytes[i];
+        switch (_state) {
+            case kStateStart:
+                if (c == '{') {
+                    _state = kStateKeyOrEnd;
+                } else if (!isJSONSpace(c)) {
+                    return [self failWithMessage:@"Response is not a JSON object"];
+                }
+                break;
+
+            case kStateKeyOrEnd:
+                if (c == '"') {
+                    _key.length = 0;
+                    _state = kStateKey;
+                } else if (c == '}') {
+                    _state = kStateDone;
+                } else if (!isJSONSpace(c)) {
+                    return [self failWithMessage:@"Expected a key"];
+                }
+                break;
+
+            case kStateKey:
+                if (_escaped) {
+                    _escaped = NO;
+                } else if (c == '\\') {
+                    _escaped = YES;
+                } else if (c == '"') {
+                    _state = kStateColon;
+                    break;
+                }
+                [_key appendBytes:&c length:1];
+                break;
+
+            case kStateColon:
+                if (c == ':') {
+                    _state = kStateValue;
+                } else if (!isJSONSpace(c)) {
+                    return [self failWithMessage:@"Expected ':' after a key"];
+                }
+                break;
+
+            case kStateValue:
+                if (isJSONSpace(c)) break;
+                if (c == '[' && [_key isEqualToData:_arrayKey]) {
+                    self.foundArray = YES;
+                    _state = kStateArray;
+                    break;
+                }
+                _state = kStateSkipValue;
+                _nesting = 0;
+                _inString = NO;
+                continue;  // rescan c as the start of the value
+
+            case kStateArray:
+                if (c == ']') {
+                    _state = kStateAfterValue;
+                } else if (c != ',' && !isJSONSpace(c)) {
+                    _state = kStateElement;
+                    _nesting = 0;
+                    _inString = NO;
+                    elementStart = i;
+                    continue;  // rescan c as the start of the element
+                }
+                break;
+
+            case kStateSkipValue:
+            case kStateElement: {
+                BOOL complete = NO;    // the value ends with c
+                BOOL terminated = NO;  // the value ended before c, which belongs to the parent
+                if (_inString) {
+                    if (_escaped) {
+                        _escaped = NO;
+                    } else if (c == '\\') {
+                        _escaped = YES;
+                    } else if (c == '"') {
+                        _inString = NO;
+                        complete = _nesting == 0;
+                    }
+                } else if (c == '"') {
+                    _inString = YES;
+                } else if (c == '{' || c == '[') {
+                    _nesting++;
+                } else if (c == '}' || c == ']') {
+                    if (_nesting == 0) {
+                        terminated = YES;  // a scalar, closed by its parent
+                    } else {
+                        complete = --_nesting == 0;
+                    }
+                } else if (c == ',' && _nesting == 0) {
+                    terminated = YES;
+                }
+
+                if (!complete && !terminated) break;
+
+                if (_state == kStateElement) {
+                    NSUInteger end = complete ? i + 1 : i;
+                    if (![self emitBytes:bytes + elementStart length:end - elementStart]) {
+                        return NO;
+                    }
+                    elementStart = NSNotFound;
+                    _state = kStateArray;
+                } else {
+                    _state = kStateAfterValue;
+                }
+                if (terminated) continue;  // let the parent see c
+                break;
+            }
+
+            case kStateAfterValue:
+                if (c == ',') {
+                    _state = kStateKeyOrEnd;
+                } else if (c == '}') {
+                    _state = kStateDone;
+                } else if (!isJSONSpace(c)) {
+                    return [self failWithMessage:@"Expected ',' or '}' after a value"];
+                }
+                break;
+
+            case kStateDone:
+                if (!isJSONSpace(c)) {
+                    return [self failWithMessage:@"Unexpected data after the end of the response"];
+                }
+                break;
+
+            case kStateError:
+                return NO;
+        }
+        i++;
+    }
+
+    if (_state == kStateElement && elementStart != NSNotFound) {
+        [_element appendBytes:bytes + elementStart length:length - elementStart];
+    }
+    return YES;
+}
+
+- (BOOL)emitBytes:(const uint8_t *)bytes length:(NSUInteger)length
+{
+    NSData *json;
+    if (_element.length > 0) {
+        [_element appendBytes:bytes length:length];
+        json = _element;
+    } else {
+        json = [NSData dataWithBytesNoCopy:(void *)bytes length:length freeWhenDone:NO];
+    }
+
+    if (_decodeSequence) {
+        [_decodeSequence decodeData:json];
+        _element.length = 0;
+        self.elementCount++;
+        return YES;
+    }
+
+    NSError *error = nil;
+    id element = [TDJSON JSONObjectWithData:json options:TDJSONReadingAllowFragments error:&error];
+    _element.length = 0;
+    if (!element) {
+        return [self failWithMessage:[NSString stringWithFormat:@"JSON parse error: %@",
+                                                                error.localizedDescription]];
+    }
+
+    self.elementCount++;
+    _onElement(element);
+    return YES;
+}
+
+@end
@@ -0,0 +1,56 @@
+//
+//  TDWALCheckpointer.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+@class FMDatabaseQueue;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Keeps a database's write-ahead log short, so reads don't slow down as it grows.
+
+ SQLite's own automatic checkpoints run as part of a commit, and can't finish while readers are
+ using the frames at the end of the log: during a long pull replication with reads going on the
+ log can keep growing. Once the database has gone `idleDelay` without a write, the checkpointer
+ runs a passive checkpoint, which neither waits for nor blocks readers, so the next write can
+ start the log again from the beginning. -truncate, for after a replication, also waits for
+ readers to finish and shrinks the file to nothing.
+
+ Checkpoints run on a background queue.
+ */
+@interface TDWALCheckpointer : NSObject
+
+- (instancetype)initWithQueue:(FMDatabaseQueue *)queue;
+
+/** How long after the last write the passive checkpoint runs. Defaults to 1 second; 0 stops
+    idle checkpoints. */
+@property NSTimeInterval idleDelay;
+
+/** Number of checkpoints run so far, passive or truncating. */
+@property (readonly) NSUInteger checkpointCount;
+
+/** Tells the checkpointer that a write transaction was committed. */
+- (void)databaseWasWritten;
+
+/** Soon, checkpoints the whole log and truncates it. */
+- (void)truncate;
+
+/** Runs no more checkpoints. Must be called before the queue is closed; waits for a checkpoint
+    that has started to finish. */
+- (void)cancel;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,111 @@
+//
+//  TDWALCheckpointer.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TDWALCheckpointer.h"
+#import "CDTLogging.h"
+#import "CDTQueueTelemetry.h"
+
+#import <fmdb/FMDatabase.h>
+#import <fmdb/FMDatabaseQueue.h>
+
+@implementation TDWALCheckpointer {
+    FMDatabaseQueue* _queue;  // nil once cancelled
+    dispatch_queue_t _checkpointQueue;
+    NSUInteger _writeGeneration;
+    NSUInteger _checkpointCount;
+}
+
+- (instancetype)initWithQueue:(FMDatabaseQueue*)queue
+{
+    if (self = [super init]) {
+        _queue = queue;
+        _checkpointQueue = dispatch_queue_create("com.cloudant.sync.db.checkpoint",
+                                                 dispatch_queue_attr_make_with_qos_class(
+                                                     DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0));
+        _idleDelay = 1.0;
+    }
+    return self;
+}
+
+- (NSUInteger)checkpointCount { @synchronized(self) { return _checkpointCount; } }
+
+- (void)databaseWasWritten
+{
+    NSTimeInterval delay = self.idleDelay;
+    NSUInteger generation;
+    @synchronized(self)
+    {
+        if (!_queue || delay <= 0) return;
+        generation = ++_writeGeneration;
+    }
+
+    __weak TDWALCheckpointer* weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)),
+                   _checkpointQueue, ^{
+                       TDWALCheckpointer* strongSelf = weakSelf;
+                       if (!strongSelf) return;
+                       @synchronized(strongSelf)
+                       {
+                           // Written to again since: not idle yet.
+                           if (strongSelf->_writeGeneration != generation) return;
+                       }
+                       [strongSelf checkpointWithMode:@"PASSIVE"];
+                   });
+}
+
+- (void)truncate
+{
+    __weak TDWALCheckpointer* weakSelf = self;
+    dispatch_async(_checkpointQueue, ^{
+        [weakSelf checkpointWithMode:@"TRUNCATE"];
+    });
+}
+
+- (void)cancel
+{
+    @synchronized(self) { _queue = nil; }
+    // Wait for a checkpoint already running:
+    dispatch_sync(_checkpointQueue, ^{
+    });
+}
+
+/** Must be called on the checkpoint queue. */
+- (void)checkpointWithMode:(NSString*)mode
+{
+    FMDatabaseQueue* queue;
+    @synchronized(self) { queue = _queue; }
+    if (!queue) return;
+
+    CDTQueueOperationScope(CDTQueueOperationCheckpoint);
+    os_signpost_id_t signpost = CDTSignpostIDGenerate();
+    CDTSignpostIntervalBegin(signpost, "walCheckpoint", "mode=%{public}@", mode);
+    __block int busy = -1, logFrames = -1, checkpointedFrames = -1;
+    [queue inDatabase:^(FMDatabase* db) {
+        FMResultSet* r =
+            [db executeQuery:[NSString stringWithFormat:@"PRAGMA wal_checkpoint(%@)", mode]];
+        if ([r next]) {
+            busy = [r intForColumnIndex:0];
+            logFrames = [r intForColumnIndex:1];
+            checkpointedFrames = [r intForColumnIndex:2];
+        }
+        [r close];
+    }];
+    @synchronized(self) { _checkpointCount++; }
+    CDTSignpostIntervalEnd(signpost, "walCheckpoint", "busy=%d log=%d checkpointed=%d", busy,
+                           logFrames, checkpointedFrames);
+    os_log_debug(CDTOSLog, "WAL checkpoint (%{public}@): busy=%d, %d of %d frames checkpointed",
+                 mode, busy, checkpointedFrames, logFrames);
+}
+
+@end
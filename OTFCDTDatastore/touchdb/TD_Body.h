@@ -18,6 +18,8 @@
 
 - (id)initWithProperties:(NSDictionary*)properties;
 - (id)initWithArray:(NSArray*)array;
+/** The data may also be binary JSON, as revision bodies can be stored in (see TDBinaryJSON);
+    it's decoded by -asObject and converted to canonical JSON by -asJSON. */
 - (id)initWithJSON:(NSData*)json;
 
 + (TD_Body*)bodyWithProperties:(id)properties;
@@ -25,6 +27,12 @@
 
 @property (readonly) BOOL isValidJSON;
 @property (readonly) NSData* asJSON;
+/** The data the body was created from, JSON or binary JSON, without converting it; for code that
+    can read either. Falls back to -asJSON for a body created from properties. */
+@property (readonly) NSData* asStoredData;
+/** The length of the JSON or binary JSON the body holds, or 0 if it only holds properties. Cheap,
+    for estimating how much memory the body takes. */
+@property (readonly) NSUInteger storedLength;
 @property (readonly) NSData* asPrettyJSON;
 @property (readonly) NSString* asJSONString;
 @property (readonly) id asObject;
@@ -33,4 +41,13 @@
 @property (readonly) NSDictionary* properties;
 - (id)objectForKeyedSubscript:(NSString*)key;  // enables subscript access in Xcode 4.4+
 
+/** The values of just the given top-level properties that are present. If the body hasn't been
+    parsed yet, only those values are parsed, and the body stays unparsed. */
+- (NSDictionary*)valuesForKeys:(NSArray*)keys;
+
+/** A new body with the given top-level properties set and the given keys removed. A body that
+    hasn't been parsed yet is edited as JSON, by splicing, so neither body gets parsed. Bodies are
+    immutable, so this one can go on being shared by the revisions that have it. */
+- (TD_Body*)bodyBySettingProperties:(NSDictionary*)properties removingKeys:(NSArray*)keys;
+
 @end
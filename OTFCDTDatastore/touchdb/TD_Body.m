@@ -17,6 +17,8 @@
 
 #import "TD_Body.h"
 #import "TDJSON.h"
+#import "TDBinaryJSON.h"
+#import "TDCanonicalJSON.h"
 #import "CDTLogging.h"
 #import "CollectionUtils.h"
 
@@ -55,7 +57,9 @@
 {
     // Yes, this is just like asObject except it doesn't warn.
     if (!_object && !_error) {
-        _object = [[TDJSON JSONObjectWithData:_json options:0 error:NULL] copy];
+        _object = [TDBinaryJSON isBinaryJSON:_json]
+                      ? [TDBinaryJSON JSONObjectWithData:_json options:0]
+                      : [[TDJSON JSONObjectWithData:_json options:0 error:NULL] copy];
         if (!_object) {
             _error = YES;
         }
@@ -65,6 +69,16 @@
 
 - (NSData*)asJSON
 {
+    if ([TDBinaryJSON isBinaryJSON:_json]) {
+        // Canonical, so it's the JSON the revision ID was computed from
+        id object = self.asObject;
+        NSData* json = object ? [TDCanonicalJSON canonicalData:object] : nil;
+        if (!json) {
+            _error = YES;
+            return nil;
+        }
+        _json = json;
+    }
     if (!_json && !_error) {
         _json = [[TDJSON dataWithJSONObject:_object options:0 error:NULL] copy];
         if (!_json) {
@@ -91,13 +105,19 @@
     return self.asJSON;
 }
 
+- (NSData*)asStoredData { return _json ?: self.asJSON; }
+
+- (NSUInteger)storedLength { return _json.length; }
+
 - (NSString*)asJSONString { return self.asJSON.my_UTF8ToString; }
 
 - (id)asObject
 {
     if (!_object && !_error) {
         NSError* error = nil;
-        _object = [[TDJSON JSONObjectWithData:_json options:0 error:&error] copy];
+        _object = [TDBinaryJSON isBinaryJSON:_json]
+                      ? [TDBinaryJSON JSONObjectWithData:_json options:0]
+                      : [[TDJSON JSONObjectWithData:_json options:0 error:&error] copy];
         if (!_object) {
             const char *msg = [NSString stringWithFormat:@"TD_Body: couldn't parse JSON: %@ (error=%@)",
                                [_json my_UTF8ToString], error].UTF8String;
@@ -119,4 +139,35 @@
 
 - (id)objectForKeyedSubscript:(NSString*)key { return (self.properties)[key]; }
 
+- (NSDictionary*)valuesForKeys:(NSArray*)keys
+{
+    if (!_object && _json.length > 0) {
+        NSDictionary* values = [TDJSON dictionaryWithValuesForKeys:keys fromJSONDictionaryData:_json];
+        if (values) return values;
+    }
+    NSDictionary* properties = self.properties;
+    NSMutableDictionary* values = [NSMutableDictionary dictionaryWithCapacity:keys.count];
+    for (NSString* key in keys) {
+        id value = properties[key];
+        if (value) values[key] = value;
+    }
+    return values;
+}
+
+- (TD_Body*)bodyBySettingProperties:(NSDictionary*)properties removingKeys:(NSArray*)keys
+{
+    if (!_object && _json.length > 0 && ![TDBinaryJSON isBinaryJSON:_json]) {
+        NSMutableSet* replacedKeys = [NSMutableSet setWithArray:properties.allKeys];
+        if (keys) [replacedKeys addObjectsFromArray:keys];
+        NSData* json = [TDJSON dataByRemovingKeys:replacedKeys fromJSONDictionaryData:_json];
+        if (json) json = [TDJSON appendDictionary:properties toJSONDictionaryData:json];
+        if (json) return [[TD_Body alloc] initWithJSON:json];
+    }
+    NSMutableDictionary* nuProperties = [self.properties mutableCopy];
+    if (!nuProperties) return nil;
+    if (keys) [nuProperties removeObjectsForKeys:keys];
+    [nuProperties addEntriesFromDictionary:properties];
+    return [[TD_Body alloc] initWithProperties:nuProperties];
+}
+
 @end
@@ -0,0 +1,50 @@
+//
+//  TD_Database+Archive.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/** The bodies of documents that are seldom read can be moved out of the database file, into its
+    archive: a second SQLite file beside it, attached to every connection. An archived revision
+    keeps its row of revs, holding kTDArchivedBodyMarkerSQL in place of its body, so it's listed,
+    queried and replicated as before, and kTDRevsBodySQL reads its body from the archive. That
+    keeps the database file, its WAL and the page cache down to the bodies in use.
+
+    Bodies stored as deltas are small, so they stay where they are. The space of archived bodies
+    whose revisions have since been purged or compacted is given back to the archive the next
+    time documents are archived. */
+@interface TD_Database (Archive)
+
+/** Whether the database has an archive. */
+@property (readonly) BOOL hasArchive;
+
+/** Moves the bodies of every revision of the documents with a current revision that passes
+    `test` into the archive, creating it if need be. Current revisions are looked at, with their
+    bodies, in sequence order, and archived a batch per short write transaction. Encrypted,
+    read-only, in-memory and multi-process databases can't have an archive.
+    @param test  Called outside any transaction, so it may read from the database.
+    @param outDocIDs  On return, the IDs of the documents archived. May be NULL.
+    @return  YES, or NO with outError set. */
+- (BOOL)archiveDocumentsPassingTest:(BOOL (^)(TD_Revision* rev))test
+                archivedDocumentIDs:(NSArray<NSString*>* _Nullable* _Nullable)outDocIDs
+                              error:(NSError**)outError;
+
+/** Writes the bodies that the archive at `archivePath` holds for revisions marked archived back
+    into revs, so that a copy of an archived database can be read without its archive. */
+- (BOOL)restoreBodiesFromArchiveAtPath:(NSString*)archivePath error:(NSError**)outError;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,212 @@
+//
+//  TD_Database+Archive.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database+Archive.h"
+#import "TDInternal.h"
+#import "TD_Body.h"
+#import "TDReadConnectionPool.h"
+#import "CDTLogging.h"
+#import <fmdb/FMDatabase.h>
+#import <fmdb/FMDatabaseAdditions.h>
+#import <fmdb/FMDatabaseQueue.h>
+#import <fmdb/FMResultSet.h>
+#import "FMDatabase+LongLong.h"
+
+static const NSUInteger kArchiveBatchSize = 100;
+
+/** Bodies that can be archived: whole ones, kept in revs or out of line, not archived yet. */
+#define kArchivableBodySQL                                                                         \
+    "revs.json IS NOT NULL AND revs.json IS NOT " kTDArchivedBodyMarkerSQL                        \
+    " AND substr(revs.json, 1, 1) IS NOT " kTDBodyDeltaMarkerSQL
+
+static NSError* archiveError(TDStatus status, NSString* reason)
+{
+    return TDStatusToNSErrorWithInfo(status, nil, @{NSLocalizedFailureReasonErrorKey : reason});
+}
+
+@implementation TD_Database (Archive)
+
+- (BOOL)hasArchive
+{
+    return [[NSFileManager defaultManager]
+        fileExistsAtPath:[TD_Database archivePathWithDatabasePath:_path]];
+}
+
+- (BOOL)archiveDocumentsPassingTest:(BOOL (^)(TD_Revision*))test
+                archivedDocumentIDs:(NSArray<NSString*>**)outDocIDs
+                              error:(NSError**)outError
+{
+    if (outDocIDs) *outDocIDs = nil;
+    if (!self.isOpen) {
+        if (outError) *outError = archiveError(kTDStatusNotFound, @"Database isn't open");
+        return NO;
+    }
+    if (_encrypted || _readOnly || self.inMemory || self.multiProcess) {
+        if (outError) {
+            *outError = archiveError(kTDStatusForbidden,
+                                     @"Encrypted, read-only, in-memory and multi-process "
+                                     @"databases can't be archived");
+        }
+        return NO;
+    }
+    if (![self openArchive:outError]) return NO;
+
+    // Copies left by purges and compaction, or by archiving that was cut short, go first
+    TDStatus status = [self inTransaction:^TDStatus(FMDatabase* db) {
+        return [db executeUpdate:@"DELETE FROM archive.bodies WHERE NOT EXISTS (SELECT 1 FROM revs "
+                                  "WHERE revs.sequence=archive.bodies.sequence AND revs.json = "
+                                  kTDArchivedBodyMarkerSQL ")"]
+                   ? kTDStatusOK
+                   : kTDStatusDBError;
+    }];
+
+    NSMutableOrderedSet<NSString*>* archivedDocIDs = [NSMutableOrderedSet orderedSet];
+    __block SequenceNumber lastSequence = 0;
+    __block BOOL more = !TDStatusIsError(status);
+    while (more) {
+        __block NSMutableArray<TD_Revision*>* revs = nil;
+        __block NSMutableArray<NSNumber*>* revDocNumericIDs = nil;
+        [self inReadTransaction:^(FMDatabase* db) {
+            FMResultSet* r = [db executeQuery:@"SELECT revs.doc_id, docid, revid, deleted, sequence, "
+                                               kTDRevsBodySQL " FROM revs, docs "
+                                               "WHERE docs.doc_id=revs.doc_id AND current=1 "
+                                               "AND sequence>? AND revs.json IS NOT "
+                                               kTDArchivedBodyMarkerSQL
+                                               " ORDER BY sequence LIMIT ?",
+                                              @(lastSequence), @(kArchiveBatchSize)];
+            if (!r) return;
+            revs = [NSMutableArray arrayWithCapacity:kArchiveBatchSize];
+            revDocNumericIDs = [NSMutableArray arrayWithCapacity:kArchiveBatchSize];
+            while ([r next]) {
+                @autoreleasepool
+                {
+                    BOOL deleted = [r boolForColumnIndex:3];
+                    TD_Revision* rev = [[TD_Revision alloc] initWithDocID:[r stringForColumnIndex:1]
+                                                                    revID:[r stringForColumnIndex:2]
+                                                                  deleted:deleted];
+                    rev.sequence = [r longLongIntForColumnIndex:4];
+                    if (!deleted) {
+                        NSData* json = [r dataForColumnIndex:5];
+                        if (json) rev.body = [TD_Body bodyWithJSON:json];
+                    }
+                    [revs addObject:rev];
+                    [revDocNumericIDs addObject:@([r longLongIntForColumnIndex:0])];
+                    lastSequence = rev.sequence;
+                }
+            }
+            [r close];
+        }];
+        if (!revs) {
+            status = kTDStatusDBError;
+            break;
+        }
+        more = (revs.count == kArchiveBatchSize);
+
+        // Tested outside the read transaction, so the test is free to read the database itself
+        NSMutableDictionary<NSNumber*, NSString*>* passed = [NSMutableDictionary dictionary];
+        for (NSUInteger i = 0; i < revs.count; i++) {
+            if (test(revs[i])) passed[revDocNumericIDs[i]] = revs[i].docID;
+        }
+        if (passed.count == 0) continue;
+
+        status = [self archiveBodiesOfDocNumericIDs:passed.allKeys];
+        if (TDStatusIsError(status)) break;
+        [archivedDocIDs addObjectsFromArray:passed.allValues];
+    }
+
+    if (TDStatusIsError(status)) {
+        if (outError) *outError = archiveError(status, @"Documents couldn't be archived");
+        return NO;
+    }
+    os_log_info(CDTOSLog, "%{public}@: Archived %lu documents", self,
+                (unsigned long)archivedDocIDs.count);
+    if (outDocIDs) *outDocIDs = archivedDocIDs.array;
+    return YES;
+}
+
+// caller: -archiveDocumentsPassingTest:archivedDocumentIDs:error:. Attaches the archive to every
+// connection, creating it if need be, before any body is marked archived.
+- (BOOL)openArchive:(NSError**)outError
+{
+    __block BOOL ok = YES;
+    __block NSError* error = nil;
+    __block BOOL created = NO;
+    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        if (self->_archiveAttached) return;
+        ok = [self attachArchiveInDatabase:db create:YES];
+        if (!ok) error = db.lastError;
+        self->_archiveAttached = created = ok;
+    }];
+    if (ok && created) {
+        [_readPool inEachDatabase:^(FMDatabase* db) {
+            if (ok && ![self attachArchiveInDatabase:db create:NO]) {
+                ok = NO;
+                error = db.lastError;
+            }
+        }];
+    }
+    if (!ok) {
+        os_log_error(CDTOSLog, "%{public}@: Couldn't open archive: %{public}@", self, error);
+        if (outError) *outError = error ?: archiveError(kTDStatusDBError, @"Archive not opened");
+    }
+    return ok;
+}
+
+// caller: -archiveDocumentsPassingTest:archivedDocumentIDs:error:
+- (TDStatus)archiveBodiesOfDocNumericIDs:(NSArray<NSNumber*>*)docNumericIDs
+{
+    NSString* docIDList = [docNumericIDs componentsJoinedByString:@","];
+    // Copied and marked in transactions of their own, in that order, as a transaction only
+    // commits atomically across attached databases that aren't in WAL mode. A crash between the
+    // two leaves copies that nothing is marked as archived in, which the next archiving sweeps.
+    TDStatus status = [self inTransaction:^TDStatus(FMDatabase* db) {
+        return [db executeUpdate:$sprintf(@"INSERT OR REPLACE INTO archive.bodies (sequence, json) "
+                                           "SELECT sequence, " kTDRevsBodySQL " FROM revs "
+                                           "WHERE doc_id IN (%@) AND " kArchivableBodySQL,
+                                          docIDList)]
+                   ? kTDStatusOK
+                   : kTDStatusDBError;
+    }];
+    if (TDStatusIsError(status)) return status;
+    // The bodies trigger drops the copies of bodies that were stored out of line
+    return [self inTransaction:^TDStatus(FMDatabase* db) {
+        return [db executeUpdate:$sprintf(@"UPDATE revs SET json=" kTDArchivedBodyMarkerSQL " "
+                                           "WHERE doc_id IN (%@) AND " kArchivableBodySQL " "
+                                           "AND sequence IN (SELECT sequence FROM archive.bodies)",
+                                          docIDList)]
+                   ? kTDStatusOK
+                   : kTDStatusDBError;
+    }];
+}
+
+- (BOOL)restoreBodiesFromArchiveAtPath:(NSString*)archivePath error:(NSError**)outError
+{
+    __block BOOL ok = NO;
+    __block NSError* error = nil;
+    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        if (![db executeUpdate:@"ATTACH DATABASE ? AS restored", archivePath]) {
+            error = db.lastError;
+            return;
+        }
+        ok = [db executeUpdate:@"UPDATE revs SET json=(SELECT json FROM restored.bodies "
+                                "WHERE restored.bodies.sequence=revs.sequence) "
+                                "WHERE json = " kTDArchivedBodyMarkerSQL];
+        if (!ok) error = db.lastError;
+        [db executeUpdate:@"DETACH DATABASE restored"];
+    }];
+    if (!ok && outError) *outError = error;
+    return ok;
+}
+
+@end
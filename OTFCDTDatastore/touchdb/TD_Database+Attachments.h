@@ -22,6 +22,11 @@
 /** Creates a TDBlobStoreWriter object that can be used to stream an attachment to the store. */
 - (TDBlobStoreWriter *)attachmentWriter;
 
+/** Returns the contents of an attachment gzipped, if compressibleAttachmentTypes includes its type
+    and compressing saves space; otherwise nil, and it should be stored as it is. Compression is
+    deterministic, so the same contents always produce the same blob and digest. */
+- (NSData *)compressedAttachment:(NSData *)contents ofType:(NSString *)contentType;
+
 /** Creates TD_Attachment objects from the revision's '_attachments' property. */
 - (NSDictionary *)attachmentsFromRevision:(TD_Revision *)rev
                                inDatabase:(FMDatabase *)db
@@ -34,11 +39,51 @@
             withParentSequence:(SequenceNumber)parentSequence
                     inDatabase:(FMDatabase *)db;
 
+/** Prepares a document fetched from a remote database without its attachment bodies. If the shared
+    attachment store holds every attachment whose stub the document has, the stubs are replaced
+    by "follows" attachments, installed from the shared store on insertion, and the new document
+    is returned. Returns the document itself if it has no attachments, or nil if the attachments
+    would have to be downloaded. */
+- (NSDictionary *)documentLinkingSharedAttachments:(NSDictionary *)doc;
+
+/** Prepares a document fetched with stubs for all its attachments, so that it can be inserted
+    before the contents of those it lacks have been downloaded. Stubs of attachments the nearest
+    local ancestor revision already has are kept, and attachments the shared attachment store
+    holds are linked as by -documentLinkingSharedAttachments:. The others are removed from the
+    document and returned in outPending, keyed by name, to be set as the new revision's
+    pendingAttachments. Returns the document itself if nothing needed changing. */
+- (NSDictionary *)documentDeferringAttachments:(NSDictionary *)doc
+                            pendingAttachments:(NSDictionary *__autoreleasing *)outPending;
+
+/** Attachments of inserted revisions that are still to be downloaded, oldest revision first. Each
+    is a dictionary with the keys "sequence", "docID", "revID", "name", "content_type",
+    "encoding", "length", "revpos" and "digest"; the last few may be missing. */
+- (NSArray<NSDictionary *> *)pendingAttachmentDownloadsWithLimit:(NSUInteger)limit;
+
+/** Installs the downloaded contents of a pending attachment, as returned by
+    -pendingAttachmentDownloadsWithLimit:, adding it to its revision and to any other revision
+    waiting for an attachment with the same digest. */
+- (TDStatus)installPendingAttachmentDownload:(NSDictionary *)pending
+                                  withWriter:(TDBlobStoreWriter *)writer;
+
+/** Stops waiting for a pending attachment, e.g. because the remote no longer has it. */
+- (TDStatus)forgetPendingAttachmentDownload:(NSDictionary *)pending;
+
+/** YES if the revision with the sequence is still waiting for some of its attachments. */
+- (BOOL)hasPendingAttachmentDownloadsForSequence:(SequenceNumber)sequence;
+
 /** Constructs an "_attachments" dictionary for a revision, to be inserted in its JSON body. */
 - (NSDictionary *)getAttachmentDictForSequence:(SequenceNumber)sequence
                                        options:(TDContentOptions)options
                                     inDatabase:(FMDatabase *)db;
 
+/** Constructs the "_attachments" dictionaries of many revisions with one query, keyed by their
+    sequences (NSNumbers). Revisions without attachments have no entry. Returns nil on error. */
+- (NSDictionary<NSNumber *, NSDictionary *> *)
+    getAttachmentDictsForSequences:(NSArray<NSNumber *> *)sequences
+                           options:(TDContentOptions)options
+                        inDatabase:(FMDatabase *)db;
+
 /** Modifies a TD_Revision's _attachments dictionary by changing all attachments with revpos <
  * minRevPos into stubs; and if 'attachmentsFollow' is true, the remaining attachments will be
  * modified to _not_ be stubs but include a "follows" key instead of a body. */
@@ -46,6 +91,13 @@
                 beforeRevPos:(int)minRevPos
            attachmentsFollow:(BOOL)attachmentsFollow;
 
+/** Changes into stubs those attachments of a revision with a "follows" key which are already in
+ * `remoteAttachments`, the _attachments of a remote revision, under the same name and digest.
+ * The remote's digests are MD5s, so an attachment is only read to digest it if its length and
+ * encoding match the remote one's. Returns YES if any were stubbed out. */
+- (BOOL)stubOutAttachmentsIn:(TD_Revision *)rev
+    matchingRemoteAttachments:(NSDictionary *)remoteAttachments;
+
 /** Generates a MIME multipart writer for a revision, with separate body parts for each attachment
  * whose "follows" property is set. */
 - (TDMultipartWriter *)multipartWriterForRevision:(TD_Revision *)rev
@@ -71,7 +123,9 @@
  * its blob. */
 - (id<CDTBlobReader>)blobForAttachmentDict:(NSDictionary *)attachmentDict;
 
-/** Deletes obsolete attachments from the database and blob store. */
+/** Deletes obsolete attachments from the database, and marks their files for deletion by a
+    background sweep, so this doesn't block the database for as long as it takes to delete them.
+    Once the transaction has committed the caller must empty the blob filename cache. */
 - (TDStatus)garbageCollectAttachments:(FMDatabase *)db;
 
 /** Updates or deletes an attachment, creating a new document revision in the process.
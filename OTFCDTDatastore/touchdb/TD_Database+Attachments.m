@@ -31,6 +31,8 @@
 #import "TD_Database+Insertion.h"
 #import "TDBase64.h"
 #import "TDBlobStore.h"
+#import "TDSharedBlobStore.h"
+#import "TD_Database+BlobFilenames.h"
 #import "TD_Attachment.h"
 #import "TD_Body.h"
 #import "TDMultipartWriter.h"
@@ -47,14 +49,24 @@
 
 #import "CDTLogging.h"
 
+// Files the attachment sweep deletes between visits to the database
+static const NSUInteger kAttachmentSweepBatchSize = 64;
+
 // Length that constitutes a 'big' attachment
 #define kBigAttachmentLength (16 * 1024)
 
+// Below this, the gzip header and trailer outweigh what compression saves
+static const NSUInteger kMinCompressibleAttachmentLength = 64;
+
+// Inline attachments with at least this much Base64 are decoded into the blob store a chunk at a
+// time; smaller ones are decoded whole, which saves the blob writer's temporary file
+static const NSUInteger kMinStreamedAttachmentLength = 256 * 1024;
+
 @implementation TD_Database (Attachments)
 
 - (TDBlobStoreWriter*)attachmentWriter
 {
-    return [[TDBlobStoreWriter alloc] initWithStore:_attachments];
+    return [[TDBlobStoreWriter alloc] initWithStore:self.attachmentStore];
 }
 
 - (void)rememberAttachmentWritersForDigests:(NSDictionary*)blobsByDigests
@@ -123,12 +135,244 @@
     }
 }
 
+- (NSDictionary*)documentLinkingSharedAttachments:(NSDictionary*)doc
+{
+    NSDictionary* attachments = $castIf(NSDictionary, doc[@"_attachments"]);
+    if (attachments.count == 0) return doc;
+    if (!self.attachmentStore.sharedStore) return nil;
+
+    NSMutableDictionary* writers = $mdict();
+    NSMutableDictionary* linkedAttachments = $mdict();
+    for (NSString* name in attachments) {
+        NSDictionary* attachment = $castIf(NSDictionary, attachments[name]);
+        NSString* digest = $castIf(NSString, attachment[@"digest"]);
+        if (!digest || ![attachment[@"stub"] isEqual:$true]) return nil;
+
+        TDBlobStoreWriter* writer = writers[digest];
+        if (!writer) {
+            writer = [[TDBlobStoreWriter alloc] initWithStore:self.attachmentStore
+                                         sharedBlobWithDigest:digest];
+            if (!writer) return nil;
+            writers[digest] = writer;
+        }
+
+        NSMutableDictionary* linkedAttachment = [attachment mutableCopy];
+        [linkedAttachment removeObjectForKey:@"stub"];
+        linkedAttachment[@"follows"] = $true;
+        linkedAttachments[name] = linkedAttachment;
+    }
+
+    os_log_debug(CDTOSLog, "%{public}@: Linking %{public}u shared attachments of %{public}@", self,
+                 (unsigned)writers.count, doc[@"_id"]);
+    [self rememberAttachmentWritersForDigests:writers];
+    NSMutableDictionary* linkedDoc = [doc mutableCopy];
+    linkedDoc[@"_attachments"] = linkedAttachments;
+    return linkedDoc;
+}
+
+#pragma mark - PENDING DOWNLOADS:
+
+- (NSDictionary*)documentDeferringAttachments:(NSDictionary*)doc
+                           pendingAttachments:(NSDictionary* __autoreleasing*)outPending
+{
+    *outPending = nil;
+    NSDictionary* attachments = $castIf(NSDictionary, doc[@"_attachments"]);
+    if (attachments.count == 0) return doc;
+
+    // Stubs are resolved against the nearest ancestor we have, as -forceInsert: does:
+    NSString* docID = $castIf(NSString, doc[@"_id"]);
+    NSArray* history = [TD_Database parseCouchDBRevisionHistory:doc];
+    NSMutableDictionary* parentRevpos = $mdict();
+    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        SInt64 docNumericID = docID ? [self getDocNumericID:docID database:db] : 0;
+        if (docNumericID <= 0) return;
+        for (NSUInteger i = 1; i < history.count; i++) {
+            SequenceNumber parent = [self getSequenceOfDocument:docNumericID
+                                                       revision:history[i]
+                                                    onlyCurrent:NO
+                                                       database:db];
+            if (parent <= 0) continue;
+            FMResultSet* r =
+                [db executeQuery:@"SELECT filename, revpos FROM attachments WHERE sequence="
+                                  "(SELECT attachments_sequence FROM revs WHERE sequence=?)",
+                                 @(parent)];
+            while ([r next]) {
+                parentRevpos[[r stringForColumnIndex:0]] = @([r intForColumnIndex:1]);
+            }
+            [r close];
+            break;
+        }
+    }];
+
+    NSMutableDictionary* writers = $mdict();
+    NSMutableDictionary* keptAttachments = $mdict();
+    NSMutableDictionary* pending = $mdict();
+    for (NSString* name in attachments) {
+        NSDictionary* attachment = $castIf(NSDictionary, attachments[name]);
+        NSNumber* revpos = $castIf(NSNumber, attachment[@"revpos"]);
+        if (![attachment[@"stub"] isEqual:$true] ||
+            (revpos && [parentRevpos[name] isEqual:revpos])) {
+            keptAttachments[name] = attachment;
+            continue;
+        }
+
+        NSString* digest = $castIf(NSString, attachment[@"digest"]);
+        TDBlobStoreWriter* writer = digest ? writers[digest] : nil;
+        if (!writer && digest && self.attachmentStore.sharedStore) {
+            writer = [[TDBlobStoreWriter alloc] initWithStore:self.attachmentStore
+                                         sharedBlobWithDigest:digest];
+            if (writer) writers[digest] = writer;
+        }
+        if (writer) {
+            NSMutableDictionary* linkedAttachment = [attachment mutableCopy];
+            [linkedAttachment removeObjectForKey:@"stub"];
+            linkedAttachment[@"follows"] = $true;
+            keptAttachments[name] = linkedAttachment;
+        } else {
+            pending[name] = attachment;
+        }
+    }
+    if (writers.count == 0 && pending.count == 0) return doc;
+
+    [self rememberAttachmentWritersForDigests:writers];
+    NSMutableDictionary* deferredDoc = [doc mutableCopy];
+    if (keptAttachments.count > 0)
+        deferredDoc[@"_attachments"] = keptAttachments;
+    else
+        [deferredDoc removeObjectForKey:@"_attachments"];
+    if (pending.count > 0) *outPending = pending;
+    return deferredDoc;
+}
+
+- (TDStatus)addPendingAttachmentDownloads:(NSDictionary*)pendingAttachments
+                              forSequence:(SequenceNumber)sequence
+                               inDatabase:(FMDatabase*)db
+{
+    for (NSString* name in pendingAttachments) {
+        NSDictionary* attachment = pendingAttachments[name];
+        TDAttachmentEncoding encoding = $equal(attachment[@"encoding"], @"gzip")
+                                            ? kTDAttachmentEncodingGZIP
+                                            : kTDAttachmentEncodingNone;
+        if (![db executeUpdate:@"INSERT OR REPLACE INTO attachments_pending_download "
+                                "(sequence, filename, type, encoding, length, revpos, digest) "
+                                "VALUES (?, ?, ?, ?, ?, ?, ?)",
+                               @(sequence), name, $castIf(NSString, attachment[@"content_type"]),
+                               @(encoding), $castIf(NSNumber, attachment[@"length"]),
+                               $castIf(NSNumber, attachment[@"revpos"]) ?: @0,
+                               $castIf(NSString, attachment[@"digest"])]) {
+            return kTDStatusDBError;
+        }
+    }
+    return kTDStatusOK;
+}
+
+- (NSArray<NSDictionary*>*)pendingAttachmentDownloadsWithLimit:(NSUInteger)limit
+{
+    NSMutableArray* pending = [NSMutableArray array];
+    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        FMResultSet* r = [db executeQuery:
+                @"SELECT p.sequence, docs.docid, revs.revid, p.filename, p.type, "
+                 "p.encoding, p.length, p.revpos, p.digest "
+                 "FROM attachments_pending_download p, revs, docs "
+                 "WHERE revs.sequence=p.sequence AND docs.doc_id=revs.doc_id "
+                 "ORDER BY p.sequence LIMIT ?",
+                @(limit)];
+        while ([r next]) {
+            [pending addObject:$dict({ @"sequence", @([r longLongIntForColumnIndex:0]) },
+                                     { @"docID", [r stringForColumnIndex:1] },
+                                     { @"revID", [r stringForColumnIndex:2] },
+                                     { @"name", [r stringForColumnIndex:3] },
+                                     { @"content_type", [r stringForColumnIndex:4] },
+                                     { @"encoding", @([r intForColumnIndex:5]) },
+                                     { @"length", [r objectForColumnIndex:6] },
+                                     { @"revpos", @([r intForColumnIndex:7]) },
+                                     { @"digest", [r stringForColumnIndex:8] })];
+        }
+        [r close];
+    }];
+    return pending;
+}
+
+- (TDStatus)installPendingAttachmentDownload:(NSDictionary*)pending
+                                  withWriter:(TDBlobStoreWriter*)writer
+{
+    NSString* digest = $castIf(NSString, pending[@"digest"]);
+    __weak TD_Database* weakSelf = self;
+    return [self inTransaction:^TDStatus(FMDatabase* db) {
+        // Every revision waiting for the same contents gets them at once:
+        FMResultSet* r;
+        if (digest) {
+            r = [db executeQuery:@"SELECT sequence, filename, type, revpos "
+                                  "FROM attachments_pending_download WHERE digest=?",
+                                 digest];
+        } else {
+            r = [db executeQuery:@"SELECT sequence, filename, type, revpos "
+                                  "FROM attachments_pending_download "
+                                  "WHERE sequence=? AND filename=?",
+                                 pending[@"sequence"], pending[@"name"]];
+        }
+        if (!r) return kTDStatusDBError;
+        NSMutableArray* attachments = [NSMutableArray array];
+        NSMutableArray* sequences = [NSMutableArray array];
+        while ([r next]) {
+            TD_Attachment* attachment =
+                [[TD_Attachment alloc] initWithName:[r stringForColumnIndex:1]
+                                        contentType:[r stringForColumnIndex:2]];
+            attachment->blobKey = writer.blobKey;
+            attachment->length = writer.length;
+            attachment->revpos = [r intForColumnIndex:3];
+            [attachments addObject:attachment];
+            [sequences addObject:@([r longLongIntForColumnIndex:0])];
+        }
+        [r close];
+        if (attachments.count == 0) return kTDStatusNotFound;  // installed or gone meanwhile
+
+        if (![writer installWithDatabase:db]) return kTDStatusAttachmentError;
+        for (NSUInteger i = 0; i < attachments.count; i++) {
+            TD_Attachment* attachment = attachments[i];
+            TDStatus status = [weakSelf insertAttachment:attachment
+                                             forSequence:[sequences[i] longLongValue]
+                                              inDatabase:db];
+            if (TDStatusIsError(status)) return status;
+            if (![db executeUpdate:@"DELETE FROM attachments_pending_download "
+                                    "WHERE sequence=? AND filename=?",
+                                   sequences[i], attachment.name]) {
+                return kTDStatusDBError;
+            }
+        }
+        os_log_debug(CDTOSLog, "%{public}@: Installed downloaded attachment '%{public}@' in %{public}u revisions",
+                     weakSelf, pending[@"name"], (unsigned)attachments.count);
+        return kTDStatusOK;
+    }];
+}
+
+- (TDStatus)forgetPendingAttachmentDownload:(NSDictionary*)pending
+{
+    return [self inTransaction:^TDStatus(FMDatabase* db) {
+        BOOL ok = [db executeUpdate:@"DELETE FROM attachments_pending_download "
+                                     "WHERE sequence=? AND filename=?",
+                                    pending[@"sequence"], pending[@"name"]];
+        return ok ? kTDStatusOK : kTDStatusDBError;
+    }];
+}
+
+- (BOOL)hasPendingAttachmentDownloadsForSequence:(SequenceNumber)sequence
+{
+    __block BOOL hasPending = NO;
+    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        hasPending = [db boolForQuery:@"SELECT count(*) FROM attachments_pending_download "
+                                       "WHERE sequence=?",
+                                      @(sequence)];
+    }];
+    return hasPending;
+}
+
 - (NSUInteger)blobCount
 {
     __block NSUInteger n = 0;
     
     [self.fmdbQueue inDatabase:^(FMDatabase *db) {
-        n = [self->_attachments countWithDatabase:db];
+        n = [self.attachmentStore countWithDatabase:db];
     }];
     
     return n;
@@ -139,7 +383,7 @@
     __block id<CDTBlobReader> reader = nil;
     
     [self.fmdbQueue inDatabase:^(FMDatabase *db) {
-        reader = [self->_attachments blobForKey:key withDatabase:db];
+        reader = [self.attachmentStore blobForKey:key withDatabase:db];
     }];
     
     return reader;
@@ -147,7 +391,7 @@
 
 - (id<CDTBlobReader>)blobForKey:(TDBlobKey)key withDatabase:(FMDatabase *)db
 {
-    id<CDTBlobReader> reader = [_attachments blobForKey:key withDatabase:db];
+    id<CDTBlobReader> reader = [self.attachmentStore blobForKey:key withDatabase:db];
     
     return reader;
 }
@@ -171,7 +415,7 @@
     __block BOOL success = YES;
 
     [self.fmdbQueue inDatabase:^(FMDatabase *db) {
-      success = [self->_attachments storeBlob:blob creatingKey:outKey withDatabase:db error:outError];
+      success = [self.attachmentStore storeBlob:blob creatingKey:outKey withDatabase:db error:outError];
     }];
 
     return success;
@@ -182,11 +426,71 @@
      withDatabase:(FMDatabase *)db
             error:(NSError *__autoreleasing *)outError
 {
-    BOOL success = [_attachments storeBlob:blob creatingKey:outKey withDatabase:db error:outError];
+    BOOL success = [self.attachmentStore storeBlob:blob creatingKey:outKey withDatabase:db error:outError];
 
     return success;
 }
 
+/**
+ Returns the sequence whose rows in the attachments table are the attachments of the revision
+ with `sequence`, or 0 if it has none. Revisions whose attachments were left alone share the
+ rows of the revision they were first stored for.
+ */
+- (SequenceNumber)attachmentsSequenceOfSequence:(SequenceNumber)sequence
+                                     inDatabase:(FMDatabase*)db
+{
+    return [db longLongForQuery:@"SELECT attachments_sequence FROM revs WHERE sequence=?",
+                                @(sequence)];
+}
+
+/** Copies the attachments rows of `fromSequence` to ones for `toSequence`. */
+- (BOOL)copyAttachmentRowsOfSequence:(SequenceNumber)fromSequence
+                          toSequence:(SequenceNumber)toSequence
+                          inDatabase:(FMDatabase*)db
+{
+    return [db executeUpdate:
+                   @"INSERT INTO attachments "
+                    "(sequence, filename, key, type, encoding, encoded_Length, length, revpos) "
+                    "SELECT ?, filename, key, type, encoding, encoded_Length, length, revpos "
+                    "FROM attachments WHERE sequence=?",
+                   @(toSequence), @(fromSequence)];
+}
+
+/**
+ Gives the revision with `sequence` rows in the attachments table of its own, which no other
+ revision shares, so that they can be added to or changed. Shared rows are copied; if other
+ revisions share the revision's own rows, the copy is theirs instead.
+ */
+- (TDStatus)separateAttachmentsOfSequence:(SequenceNumber)sequence inDatabase:(FMDatabase*)db
+{
+    Assert(sequence > 0);
+    SequenceNumber shared = [self attachmentsSequenceOfSequence:sequence inDatabase:db];
+    if (shared == sequence) {
+        SequenceNumber other =
+            [db longLongForQuery:@"SELECT min(sequence) FROM revs "
+                                  "WHERE attachments_sequence=? AND sequence<>?",
+                                 @(sequence), @(sequence)];
+        if (other <= 0) return kTDStatusOK;
+        if (![self copyAttachmentRowsOfSequence:sequence toSequence:other inDatabase:db] ||
+            ![db executeUpdate:@"UPDATE revs SET attachments_sequence=? "
+                                "WHERE attachments_sequence=? AND sequence<>?",
+                               @(other), @(sequence), @(sequence)]) {
+            return kTDStatusDBError;
+        }
+        return kTDStatusOK;
+    }
+    if (shared > 0 && ![self copyAttachmentRowsOfSequence:shared
+                                               toSequence:sequence
+                                               inDatabase:db]) {
+        return kTDStatusDBError;
+    }
+    if (![db executeUpdate:@"UPDATE revs SET attachments_sequence=? WHERE sequence=?",
+                           @(sequence), @(sequence)]) {
+        return kTDStatusDBError;
+    }
+    return kTDStatusOK;
+}
+
 /**
  All this does is insert the row in the attachments table for the
  attachment. It should be called when the attachment isn't already
@@ -198,6 +502,8 @@
 {
     Assert(sequence > 0);
     Assert(attachment.isValid);
+    TDStatus status = [self separateAttachmentsOfSequence:sequence inDatabase:db];
+    if (TDStatusIsError(status)) return status;
     NSData* keyData = [NSData dataWithBytes:&attachment->blobKey length:sizeof(TDBlobKey)];
     id encodedLengthObj = attachment->encoding ? @(attachment->encodedLength) : nil;
 
@@ -234,13 +540,15 @@
     Assert(toSequence > fromSequence);
     if (fromSequence <= 0) return kTDStatusNotFound;
 
-    TDStatus result = kTDStatusOK;
+    TDStatus result = [self separateAttachmentsOfSequence:toSequence inDatabase:db];
+    if (TDStatusIsError(result)) return result;
 
     if (![db executeUpdate:
                  @"INSERT INTO attachments "
                   "(sequence, filename, key, type, encoding, encoded_Length, length, revpos) "
                   "SELECT ?, ?, key, type, encoding, encoded_Length, length, revpos "
-                  "FROM attachments WHERE sequence=? AND filename=?",
+                  "FROM attachments WHERE sequence="
+                  "(SELECT attachments_sequence FROM revs WHERE sequence=?) AND filename=?",
                  @(toSequence), name, @(fromSequence), name]) {
         result = kTDStatusDBError;
     }
@@ -255,7 +563,8 @@
 }
 
 /**
- Copy all attachments from the old sequence to the new sequence.
+ Copy all attachments from the old sequence to the new sequence. A new sequence without
+ attachments of its own just shares the old one's rows, however many there are.
  */
 - (TDStatus)copyAttachmentsFromSequence:(SequenceNumber)fromSequence
                              toSequence:(SequenceNumber)toSequence
@@ -265,18 +574,99 @@
     Assert(toSequence > fromSequence);
     if (fromSequence <= 0) return kTDStatusNotFound;
 
-    TDStatus result = kTDStatusOK;
+    SequenceNumber shared = [self attachmentsSequenceOfSequence:fromSequence inDatabase:db];
+    if (shared <= 0) return kTDStatusOK;
 
-    if (![db executeUpdate:
-                 @"INSERT INTO attachments "
-                  "(sequence, filename, key, type, encoding, encoded_Length, length, revpos) "
-                  "SELECT ?, filename, key, type, encoding, encoded_Length, length, revpos "
-                  "FROM attachments WHERE sequence=?",
-                 @(toSequence), @(fromSequence)]) {
-        result = kTDStatusDBError;
+    if ([self attachmentsSequenceOfSequence:toSequence inDatabase:db] <= 0) {
+        if (![db executeUpdate:@"UPDATE revs SET attachments_sequence=? WHERE sequence=?",
+                               @(shared), @(toSequence)]) {
+            return kTDStatusDBError;
+        }
+        return kTDStatusOK;
     }
 
-    return result;
+    TDStatus result = [self separateAttachmentsOfSequence:toSequence inDatabase:db];
+    if (TDStatusIsError(result)) return result;
+    if (![self copyAttachmentRowsOfSequence:shared toSequence:toSequence inDatabase:db]) {
+        return kTDStatusDBError;
+    }
+    return kTDStatusOK;
+}
+
+/**
+ Copies the named attachments of the old sequence to the new one. If they're all the old
+ sequence's attachments and the new one has none yet, which is the case for any update leaving
+ attachments alone, the new sequence shares the old one's rows rather than copying them.
+
+ Returns kTDStatusNotFound if one of the names isn't an attachment of the old sequence.
+ */
+- (TDStatus)copyAttachmentsNamed:(NSArray<NSString*>*)names
+                    fromSequence:(SequenceNumber)fromSequence
+                      toSequence:(SequenceNumber)toSequence
+                      inDatabase:(FMDatabase*)db
+{
+    Assert(toSequence > 0);
+    Assert(toSequence > fromSequence);
+    if (names.count == 0) return kTDStatusOK;
+    if (fromSequence <= 0) return kTDStatusNotFound;
+
+    SequenceNumber shared = [self attachmentsSequenceOfSequence:fromSequence inDatabase:db];
+    if (shared > 0 && [self attachmentsSequenceOfSequence:toSequence inDatabase:db] <= 0) {
+        NSMutableSet* filenames = [NSMutableSet set];
+        FMResultSet* r =
+            [db executeQuery:@"SELECT filename FROM attachments WHERE sequence=?", @(shared)];
+        if (!r) return kTDStatusDBError;
+        while ([r next]) {
+            [filenames addObject:[r stringForColumnIndex:0]];
+        }
+        [r close];
+        if ([filenames isEqualToSet:[NSSet setWithArray:names]]) {
+            if (![db executeUpdate:@"UPDATE revs SET attachments_sequence=? WHERE sequence=?",
+                                   @(shared), @(toSequence)]) {
+                return kTDStatusDBError;
+            }
+            return kTDStatusOK;
+        }
+    }
+
+    for (NSString* name in names) {
+        TDStatus status = [self copyAttachmentNamed:name
+                                       fromSequence:fromSequence
+                                         toSequence:toSequence
+                                         inDatabase:db];
+        if (TDStatusIsError(status)) return status;
+    }
+    return kTDStatusOK;
+}
+
+/**
+ As -copyAttachmentsNamed:fromSequence:toSequence:inDatabase:, for attachments coming from
+ different revisions: `fromSequences` has the sequence each of `names` is copied from.
+ */
+- (TDStatus)copyAttachmentsNamed:(NSArray<NSString*>*)names
+                   fromSequences:(NSArray<NSNumber*>*)fromSequences
+                      toSequence:(SequenceNumber)toSequence
+                      inDatabase:(FMDatabase*)db
+{
+    Assert(names.count == fromSequences.count);
+    NSMutableDictionary<NSNumber*, NSMutableArray*>* namesBySequence = $mdict();
+    for (NSUInteger i = 0; i < names.count; i++) {
+        NSMutableArray* group = namesBySequence[fromSequences[i]];
+        if (!group) {
+            group = [NSMutableArray array];
+            namesBySequence[fromSequences[i]] = group;
+        }
+        [group addObject:names[i]];
+    }
+    for (NSNumber* fromSequence in
+         [namesBySequence.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
+        TDStatus status = [self copyAttachmentsNamed:namesBySequence[fromSequence]
+                                        fromSequence:fromSequence.longLongValue
+                                          toSequence:toSequence
+                                          inDatabase:db];
+        if (TDStatusIsError(status)) return status;
+    }
+    return kTDStatusOK;
 }
 
 /**
@@ -316,7 +706,8 @@
     [_fmdbQueue inDatabase:^(FMDatabase* db) {
         FMResultSet* r =
             [db executeQuery:
-                    @"SELECT key, type, encoding FROM attachments WHERE sequence=? AND filename=?",
+                    @"SELECT key, type, encoding FROM attachments WHERE sequence="
+                     "(SELECT attachments_sequence FROM revs WHERE sequence=?) AND filename=?",
                     @(sequence), filename];
         if (!r) {
             *outStatus = kTDStatusDBError;
@@ -333,7 +724,7 @@
                 *outStatus = kTDStatusCorruptError;
                 return;
             }
-            blob = [self->_attachments blobForKey:*(TDBlobKey*)keyData.bytes withDatabase:db];
+            blob = [self.attachmentStore blobForKey:*(TDBlobKey*)keyData.bytes withDatabase:db];
             *outStatus = kTDStatusOK;
             if (outType) *outType = [r stringForColumnIndex:1];
 
@@ -387,8 +778,9 @@
  Constructs an "_attachments" dictionary for a revision, to be inserted in its JSON body.
 
  This generates the dict for a seq because a seq is the autoincrement key
- in the revs table. So it's basically a quick way to get a given rev. It's
- a foreign key in the attachments table.
+ in the revs table. So it's basically a quick way to get a given rev. Its
+ rows in the attachments table may be shared with other revisions, through
+ revs.attachments_sequence.
  */
 - (NSDictionary*)getAttachmentDictForSequence:(SequenceNumber)sequence
                                       options:(TDContentOptions)options
@@ -399,61 +791,132 @@
 
     FMResultSet* r =
         [db executeQuery:@"SELECT filename, key, type, encoding, length, encoded_length, revpos "
-                          "FROM attachments WHERE sequence=?",
+                          "FROM attachments WHERE sequence="
+                          "(SELECT attachments_sequence FROM revs WHERE sequence=?)",
                          @(sequence)];
     if (!r) return nil;
     if (![r next]) {
         [r close];
         return nil;
     }
-    BOOL decodeAttachments = !(options & kTDLeaveAttachmentsEncoded);
     attachments = $mdict();
     do {
-        NSData* keyData = [r dataNoCopyForColumnIndex:1];
-        NSString* digestStr = [@"sha1-" stringByAppendingString:[TDBase64 encode:keyData]];
-        TDAttachmentEncoding encoding = [r intForColumnIndex:3];
-        UInt64 length = [r longLongIntForColumnIndex:4];
-        UInt64 encodedLength = [r longLongIntForColumnIndex:5];
-
-        // Get the attachment contents if asked to:
-        NSData* data = nil;
-        BOOL dataSuppressed = NO;
-        if (options & kTDIncludeAttachments) {
-            UInt64 effectiveLength = (encoding && !decodeAttachments) ? encodedLength : length;
-            if ((options & kTDBigAttachmentsFollow) && effectiveLength >= kBigAttachmentLength) {
-                dataSuppressed = YES;
-            } else {
-                id<CDTBlobReader> blob = [_attachments blobForKey:*(TDBlobKey*)keyData.bytes
-                                                     withDatabase:db];
-                data = (blob ? [blob dataWithError:nil] : nil);
-                if (!data)
-                    os_log_debug(CDTOSLog, "TD_Database: Failed to get attachment for key %{public}@", keyData);
-            }
-        }
+        [self addAttachmentFromRow:r to:attachments options:options inDatabase:db];
+    } while ([r next]);
+    [r close];
 
-        NSString* encodingStr = nil;
-        id encodedLengthObj = nil;
-        if (encoding != kTDAttachmentEncodingNone) {
-            // Decode the attachment if it's included in the dict:
-            if (data && decodeAttachments) {
-                data = [self decodeAttachment:data encoding:encoding];
-            } else {
-                encodingStr = @"gzip";  // the only encoding I know
-                encodedLengthObj = @(encodedLength);
-            }
+    return attachments;
+}
+
+/**
+ As -getAttachmentDictForSequence:... for each of many sequences, in a single query, so that
+ revisions loaded in bulk don't cost a query apiece. Sequences of revisions without attachments
+ are left out of the result.
+ */
+- (NSDictionary*)getAttachmentDictsForSequences:(NSArray*)sequences
+                                        options:(TDContentOptions)options
+                                     inDatabase:(FMDatabase*)db
+{
+    NSMutableDictionary* result = [NSMutableDictionary dictionary];
+    if (sequences.count == 0) return result;
+
+    // The sequences are integers, so are safe to put in the SQL, and not being parameters there
+    // can be any number of them. Revisions sharing rows each get their own copy of them.
+    NSString* sql = $sprintf(@"SELECT a.filename, a.key, a.type, a.encoding, a.length, "
+                              "a.encoded_length, a.revpos, revs.sequence "
+                              "FROM revs JOIN attachments a ON a.sequence=revs.attachments_sequence "
+                              "WHERE revs.sequence IN (%@) ORDER BY revs.sequence",
+                             [sequences componentsJoinedByString:@","]);
+    // The blobs are read a row at a time, so find all their files first
+    if (options & kTDIncludeAttachments) {
+        [self prefetchBlobFilenamesForSequences:sequences inDatabase:db];
+    }
+    FMResultSet* r = [db executeQuery:sql];
+    if (!r) return nil;
+    SequenceNumber lastSequence = 0;
+    NSMutableDictionary* attachments = nil;
+    while ([r next]) {
+        SequenceNumber sequence = [r longLongIntForColumnIndex:7];
+        if (sequence != lastSequence) {
+            lastSequence = sequence;
+            attachments = $mdict();
+            result[@(sequence)] = attachments;
         }
+        [self addAttachmentFromRow:r to:attachments options:options inDatabase:db];
+    }
+    [r close];
+    return result;
+}
 
-        attachments[[r stringForColumnIndex:0]] =
-            $dict({ @"stub", ((data || dataSuppressed) ? nil : $true) },
-                  { @"data", (data ? [TDBase64 encode:data] : nil) },
-                  { @"follows", (dataSuppressed ? $true : nil) }, { @"digest", digestStr },
-                  { @"content_type", [r stringForColumnIndex:2] }, { @"encoding", encodingStr },
-                  { @"length", @(length) }, { @"encoded_length", encodedLengthObj },
-                  { @"revpos", @([r intForColumnIndex:6]) });
-    } while ([r next]);
+- (void)prefetchBlobFilenamesForSequences:(NSArray*)sequences inDatabase:(FMDatabase*)db
+{
+    TDBlobStore* store = self.attachmentStore;
+    if (!store.filenameCache || sequences.count == 0) return;
+
+    NSString* sql = $sprintf(@"SELECT DISTINCT a.key FROM revs JOIN attachments a "
+                              "ON a.sequence=revs.attachments_sequence "
+                              "WHERE revs.sequence IN (%@)",
+                             [sequences componentsJoinedByString:@","]);
+    FMResultSet* r = [db executeQuery:sql];
+    if (!r) return;
+    NSMutableArray* keys = [NSMutableArray array];
+    while ([r next]) {
+        NSData* keyData = [r dataForColumnIndex:0];
+        if (keyData.length == sizeof(TDBlobKey)) [keys addObject:keyData];
+    }
     [r close];
+    [store prefetchFilenamesForKeys:keys withDatabase:db];
+}
 
-    return attachments;
+/** Adds the "_attachments" entry for the current row of a query whose first columns are
+    filename, key, type, encoding, length, encoded_length and revpos. */
+- (void)addAttachmentFromRow:(FMResultSet*)r
+                          to:(NSMutableDictionary*)attachments
+                     options:(TDContentOptions)options
+                  inDatabase:(FMDatabase*)db
+{
+    BOOL decodeAttachments = !(options & kTDLeaveAttachmentsEncoded);
+    NSData* keyData = [r dataNoCopyForColumnIndex:1];
+    NSString* digestStr = [@"sha1-" stringByAppendingString:[TDBase64 encode:keyData]];
+    TDAttachmentEncoding encoding = [r intForColumnIndex:3];
+    UInt64 length = [r longLongIntForColumnIndex:4];
+    UInt64 encodedLength = [r longLongIntForColumnIndex:5];
+
+    // Get the attachment contents if asked to:
+    NSData* data = nil;
+    BOOL dataSuppressed = NO;
+    if (options & kTDIncludeAttachments) {
+        UInt64 effectiveLength = (encoding && !decodeAttachments) ? encodedLength : length;
+        if ((options & kTDBigAttachmentsFollow) && effectiveLength >= kBigAttachmentLength) {
+            dataSuppressed = YES;
+        } else {
+            id<CDTBlobReader> blob = [self.attachmentStore blobForKey:*(TDBlobKey*)keyData.bytes
+                                                         withDatabase:db];
+            data = (blob ? [blob dataWithError:nil] : nil);
+            if (!data)
+                os_log_debug(CDTOSLog, "TD_Database: Failed to get attachment for key %{public}@", keyData);
+        }
+    }
+
+    NSString* encodingStr = nil;
+    id encodedLengthObj = nil;
+    if (encoding != kTDAttachmentEncodingNone) {
+        // Decode the attachment if it's included in the dict:
+        if (data && decodeAttachments) {
+            data = [self decodeAttachment:data encoding:encoding];
+        } else {
+            encodingStr = @"gzip";  // the only encoding I know
+            encodedLengthObj = @(encodedLength);
+        }
+    }
+
+    attachments[[r stringForColumnIndex:0]] =
+        $dict({ @"stub", ((data || dataSuppressed) ? nil : $true) },
+              { @"data", (data ? [TDBase64 encode:data] : nil) },
+              { @"follows", (dataSuppressed ? $true : nil) }, { @"digest", digestStr },
+              { @"content_type", [r stringForColumnIndex:2] }, { @"encoding", encodingStr },
+              { @"length", @(length) }, { @"encoded_length", encodedLengthObj },
+              { @"revpos", @([r intForColumnIndex:6]) });
 }
 
 /**
@@ -480,9 +943,11 @@
 + (BOOL)mutateAttachmentsIn:(TD_Revision*)rev
                   withBlock:(NSDictionary* (^)(NSString*, NSDictionary*))block
 {
-    NSDictionary* properties = rev.properties;
-    NSMutableDictionary* editedProperties = nil;
-    NSDictionary* attachments = (id)properties[@"_attachments"];
+    // Only _attachments is parsed out of the body, and it's spliced back in afterwards,
+    // so the rest of the document is never decoded and re-encoded:
+    TD_Body* body = rev.body;
+    NSDictionary* attachments =
+        $castIf(NSDictionary, [body valuesForKeys:@[ @"_attachments" ]][@"_attachments"]);
     NSMutableDictionary* editedAttachments = nil;
     for (NSString* name in attachments) {
         @autoreleasepool
@@ -493,18 +958,14 @@
                 return NO;  // block canceled
             }
             if (editedAttachment != attachment) {
-                if (!editedProperties) {
-                    // Make the document properties and _attachments dictionary mutable:
-                    editedProperties = [properties mutableCopy];
-                    editedAttachments = [attachments mutableCopy];
-                    editedProperties[@"_attachments"] = editedAttachments;
-                }
+                if (!editedAttachments) editedAttachments = [attachments mutableCopy];
                 editedAttachments[name] = editedAttachment;
             }
         }
     }
-    if (editedProperties) {
-        rev.properties = editedProperties;
+    if (editedAttachments) {
+        rev.body = [body bodyBySettingProperties:@{ @"_attachments" : editedAttachments }
+                                    removingKeys:nil];
         return YES;
     }
     return NO;
@@ -542,6 +1003,53 @@
                     }];
 }
 
+- (BOOL)stubOutAttachmentsIn:(TD_Revision*)rev
+    matchingRemoteAttachments:(NSDictionary*)remoteAttachments
+{
+    if (remoteAttachments.count == 0) return NO;
+    return [[self class]
+        mutateAttachmentsIn:rev
+                  withBlock:^NSDictionary*(NSString* name, NSDictionary* attachment) {
+                      NSDictionary* remote = $castIf(NSDictionary, remoteAttachments[name]);
+                      if (!attachment[@"follows"] || !remote) return attachment;
+                      if (!$equal(remote[@"length"], attachment[@"length"]) ||
+                          !$equal(remote[@"encoding"], attachment[@"encoding"]))
+                          return attachment;
+                      NSString* digest = [self MD5DigestOfAttachmentDict:attachment];
+                      if (!digest || !$equal(digest, remote[@"digest"])) return attachment;
+
+                      NSMutableDictionary* editedAttachment = [attachment mutableCopy];
+                      [editedAttachment removeObjectForKey:@"follows"];
+                      editedAttachment[@"stub"] = $true;
+                      os_log_debug(CDTOSLog, "Stubbed out attachment %{public}@/'%{public}@': remote has %{public}@", rev, name, digest);
+                      return editedAttachment;
+                  }];
+}
+
+// The MD5 digest of an attachment's contents as stored, in the form CouchDB gives it.
+- (NSString*)MD5DigestOfAttachmentDict:(NSDictionary*)attachment
+{
+    UInt64 length;
+    NSInputStream* stream =
+        [[self blobForAttachmentDict:attachment] inputStreamWithOutputLength:&length];
+    if (!stream) return nil;
+
+    CC_MD5_CTX ctx;
+    CC_MD5_Init(&ctx);
+    uint8_t buffer[32768];
+    NSInteger bytesRead;
+    [stream open];
+    while ((bytesRead = [stream read:buffer maxLength:sizeof(buffer)]) > 0) {
+        CC_MD5_Update(&ctx, buffer, (CC_LONG)bytesRead);
+    }
+    [stream close];
+    if (bytesRead < 0) return nil;
+
+    TDMD5Key md5;
+    CC_MD5_Final(md5.bytes, &ctx);
+    return [@"md5-" stringByAppendingString:[TDBase64 encode:&md5 length:sizeof(md5)]];
+}
+
 // Replaces the "follows" key with the real attachment data in all attachments to 'doc'.
 - (BOOL)inlineFollowingAttachmentsIn:(TD_Revision *)rev error:(NSError **)outError
 {
@@ -572,6 +1080,47 @@
     return (error == nil);
 }
 
+/** YES if compressibleAttachmentTypes includes the content type. */
+- (BOOL)compressesAttachmentsOfType:(NSString*)contentType
+{
+    NSArray* types = self.compressibleAttachmentTypes;
+    if (types.count == 0) return NO;
+
+    // Parameters such as "; charset=utf-8" don't affect the choice
+    NSString* type = [contentType componentsSeparatedByString:@";"].firstObject;
+    type = [type stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]]
+               .lowercaseString;
+    if (type.length == 0) return NO;
+
+    BOOL compressible = NO;
+    for (NSString* pattern in types) {
+        NSString* lowerPattern = pattern.lowercaseString;
+        if ([lowerPattern hasSuffix:@"*"]) {
+            compressible = [type hasPrefix:[lowerPattern substringToIndex:lowerPattern.length - 1]];
+        } else {
+            compressible = [type isEqualToString:lowerPattern];
+        }
+        if (compressible) break;
+    }
+    return compressible;
+}
+
+- (NSData*)compressedAttachment:(NSData*)contents ofType:(NSString*)contentType
+{
+    if (contents.length < kMinCompressibleAttachmentLength ||
+        ![self compressesAttachmentsOfType:contentType]) {
+        return nil;
+    }
+
+    NSError* error;
+    NSData* compressed = [NSData gtm_dataByGzippingData:contents error:&error];
+    if (!compressed) {
+        os_log_debug(CDTOSLog, "%{public}@: Couldn't compress attachment: %{public}@", self, error);
+        return nil;
+    }
+    return compressed.length < contents.length ? compressed : nil;
+}
+
 /**
  Takes a TD_Revision and inserts the attachments contained
  in the revision into the attachment blob store and creates
@@ -603,7 +1152,29 @@
             [[TD_Attachment alloc] initWithName:name contentType:contentType];
 
         NSString* newContentsBase64 = $castIf(NSString, attachInfo[@"data"]);
-        if (newContentsBase64) {
+        if (newContentsBase64.length >= kMinStreamedAttachmentLength &&
+            (attachInfo[@"encoding"] || ![self compressesAttachmentsOfType:contentType])) {
+            // A large inline attachment that won't be compressed is decoded straight into the
+            // blob store, so neither it nor its decoded contents are held in memory a second time:
+            TDBlobStoreWriter* writer = self.attachmentWriter;
+            if (!writer) {
+                status = kTDStatusAttachmentError;
+                break;
+            }
+            writer.computesMD5Digest = NO;
+            if (![writer appendBase64String:newContentsBase64]) {
+                [writer cancel];
+                status = kTDStatusBadEncoding;
+                break;
+            }
+            [writer finish];
+            if (![writer installWithDatabase:db]) {
+                status = kTDStatusAttachmentError;
+                break;
+            }
+            attachment->blobKey = writer.blobKey;
+            attachment->length = writer.length;
+        } else if (newContentsBase64) {
             // If there's inline attachment data, decode and store it:
             @autoreleasepool
             {
@@ -613,6 +1184,15 @@
                     break;
                 }
                 attachment->length = newContents.length;
+                NSData* compressed = attachInfo[@"encoding"]
+                                         ? nil
+                                         : [self compressedAttachment:newContents
+                                                               ofType:contentType];
+                if (compressed) {
+                    attachment->encoding = kTDAttachmentEncodingGZIP;
+                    attachment->encodedLength = compressed.length;
+                    newContents = compressed;
+                }
                 if (![self storeBlob:newContents
                          creatingKey:&attachment->blobKey
                         withDatabase:db]) {
@@ -678,8 +1258,8 @@
     unsigned generation = rev.generation;
     Assert(generation > 0, @"Missing generation in rev %@", rev);
 
+    NSMutableArray* stubNames = [NSMutableArray array];
     for (NSString* name in revAttachments) {
-        TDStatus status;
         TD_Attachment* attachment = attachments[name];
         if (attachment) {
             // Determine the revpos, i.e. generation # this was added in. Usually this is
@@ -692,18 +1272,21 @@
             }
 
             // Finally insert the attachment:
-            status = [self insertAttachment:attachment forSequence:newSequence inDatabase:db];
+            TDStatus status =
+                [self insertAttachment:attachment forSequence:newSequence inDatabase:db];
+            if (TDStatusIsError(status)) return status;
         } else {
-            // It's just a stub, so copy the previous revision's attachment entry:
-            //? Should I enforce that the type and digest (if any) match?
-            status = [self copyAttachmentNamed:name
-                                  fromSequence:parentSequence
-                                    toSequence:newSequence
-                                    inDatabase:db];
+            [stubNames addObject:name];
         }
-        if (TDStatusIsError(status)) return status;
     }
-    return kTDStatusOK;
+
+    // Stubs get the previous revision's attachment entries, which are shared rather than
+    // copied if they're all of them and nothing new was added:
+    //? Should I enforce that the type and digest (if any) match?
+    return [self copyAttachmentsNamed:stubNames
+                         fromSequence:parentSequence
+                           toSequence:newSequence
+                           inDatabase:db];
 }
 
 - (TDMultipartWriter*)multipartWriterForRevision:(TD_Revision*)rev
@@ -793,28 +1376,76 @@
  */
 - (TDStatus)garbageCollectAttachments:(FMDatabase*)db
 {
-    // First delete attachment rows for already-cleared revisions:
+    // First delete attachment rows no revision left uncleared still has:
     // OPT: Could start after last sequence# we GC'd up to
 
-    [db executeUpdate:@"DELETE FROM attachments WHERE sequence IN "
-                       "(SELECT sequence from revs WHERE json IS null)"];
+    [db executeUpdate:@"UPDATE revs SET attachments_sequence=NULL "
+                       "WHERE json IS null AND attachments_sequence IS NOT NULL"];
+    [db executeUpdate:@"DELETE FROM attachments WHERE NOT EXISTS "
+                       "(SELECT 1 FROM revs WHERE revs.attachments_sequence=attachments.sequence)"];
 
-    // Now collect all remaining attachment IDs and tell the store to delete all but these:
-    FMResultSet* r = [db executeQuery:@"SELECT DISTINCT key FROM attachments"];
-    if (!r) {
+    // Now move the blobs no attachment refers to any more to the pending-delete table. Listing
+    // and deleting their files can take seconds, so that's left to the sweep:
+    if (![TD_Database markUnusedBlobFilenamesForDeletionInDatabase:db]) {
         return kTDStatusDBError;
     }
-    NSMutableSet* allKeys = [NSMutableSet set];
-    while ([r next]) {
-        [allKeys addObject:[r dataForColumnIndex:0]];
-    }
-    [r close];
-    BOOL blobDeleted = [_attachments deleteBlobsExceptWithKeys:allKeys withDatabase:db];
-    if (!blobDeleted) {
-        return kTDStatusAttachmentError;
-    }
-    os_log_info(CDTOSLog, "Unneeded attachment blobs deleted");
+    os_log_info(CDTOSLog, "Unneeded attachment blobs marked for deletion");
+    [self sweepDeletedAttachments];
     return kTDStatusOK;
 }
 
+- (void)sweepDeletedAttachments
+{
+    // One queue for all databases, so sweeps run one at a time and never overlap for a database
+    static dispatch_queue_t sweepQueue;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        dispatch_queue_attr_t attr = dispatch_queue_attr_make_with_qos_class(
+            DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0);
+        sweepQueue = dispatch_queue_create("com.cloudant.sync.attachmentsweep", attr);
+    });
+
+    __weak TD_Database* weakSelf = self;
+    dispatch_async(sweepQueue, ^{
+        NSUInteger deleted = 0;
+        TDBlobStore* store = nil;
+        while (YES) {
+            TD_Database* strongSelf = weakSelf;
+            if (!strongSelf) break;
+            NSUInteger count = [strongSelf sweepDeletedAttachmentsBatchWithStore:&store];
+            if (count == 0) break;
+            deleted += count;
+        }
+        if (deleted > 0) {
+            os_log_info(CDTOSLog, "Swept %{public}lu deleted attachment blobs",
+                        (unsigned long)deleted);
+            // Deleting those may have released the last links to some shared blobs:
+            [store.sharedStore deleteUnreferencedBlobs];
+        }
+    });
+}
+
+// Each batch only holds the database for two short statements; the files are deleted in between,
+// off the database queue. Returns the number of filenames handled, or 0 when done or closed.
+- (NSUInteger)sweepDeletedAttachmentsBatchWithStore:(TDBlobStore**)outStore
+{
+    __block NSArray* filenames = nil;
+    __block TDBlobStore* store = nil;
+    BOOL open = [self inDatabaseIfOpen:^(FMDatabase* db) {
+        filenames = [TD_Database pendingDeleteBlobFilenamesWithLimit:kAttachmentSweepBatchSize
+                                                          inDatabase:db];
+        if (filenames.count > 0) store = self.attachmentStore;
+    }];
+    if (!open || filenames.count == 0) return 0;
+
+    [store deleteBlobFilesNamed:filenames];
+    *outStore = store;
+
+    __block BOOL ok = NO;
+    [self inDatabaseIfOpen:^(FMDatabase* db) {
+        ok = [TD_Database deletePendingDeleteBlobFilenames:filenames inDatabase:db];
+    }];
+    return ok ? filenames.count : 0;
+}
+
 @end
@@ -0,0 +1,45 @@
+//
+//  TD_Database+Backup.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/** Called after each step of a backup with how many pages of the database are left to copy, out
+    of how many there are. */
+typedef void (^TDBackupProgressBlock)(int remainingPages, int totalPages);
+
+@interface TD_Database (Backup)
+
+/** Copies this open database, while it's in use, to a new database file at `path`, its archive
+    (see TD_Database+Archive) beside it, and its attachments to the attachment directory that goes
+    with that path. The copy can be installed with -replaceWithDatabaseFile:withAttachments:error:.
+
+    The database is copied with SQLite's online backup API, `pagesPerStep` pages at a time, on the
+    writer connection. Writes made through this database between steps flow into the copy without
+    starting it again, and the writer is released after every step, so writers are only ever held
+    up for one step. Attachment files are cloned or hard-linked where the file system allows,
+    which is safe as blob files are never changed once written, and copied otherwise. The archive
+    is copied last, in one go, from a read connection.
+
+    Runs on the calling thread until the backup is done; the database mustn't be closed meanwhile.
+    Fails if there is already a file at `path`. Encrypted databases are copied with their key. */
+- (BOOL)backupToPath:(NSString*)path
+        pagesPerStep:(int)pagesPerStep
+            progress:(nullable TDBackupProgressBlock)progress
+               error:(NSError**)outError;
+
+@end
+
+NS_ASSUME_NONNULL_END
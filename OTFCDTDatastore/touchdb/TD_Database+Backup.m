@@ -0,0 +1,165 @@
+//
+//  TD_Database+Backup.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database+Backup.h"
+#import "TDInternal.h"
+#import "TDReadConnectionPool.h"
+#import "TD_Database+Archive.h"
+#import "TDStatus.h"
+#import "FMDatabase+EncryptionKey.h"
+#import "CDTLogging.h"
+#import <fmdb/FMDatabase.h>
+#import <fmdb/FMDatabaseQueue.h>
+#import <sqlite3.h>
+#include <unistd.h>
+#if __has_include(<sys/clonefile.h>)
+#include <sys/clonefile.h>
+#endif
+
+static NSError* backupError(TDStatus status, NSString* reason)
+{
+    return TDStatusToNSErrorWithInfo(status, nil, @{NSLocalizedFailureReasonErrorKey : reason});
+}
+
+// Blob files are never modified, so a clone or hard link is as good as a copy
+static BOOL cloneOrLinkFile(NSString* src, NSString* dst, NSError** outError)
+{
+    const char* srcPath = src.fileSystemRepresentation;
+    const char* dstPath = dst.fileSystemRepresentation;
+#if __has_include(<sys/clonefile.h>)
+    if (clonefile(srcPath, dstPath, 0) == 0) return YES;
+#endif
+    if (link(srcPath, dstPath) == 0) return YES;
+    return [[NSFileManager defaultManager] copyItemAtPath:src toPath:dst error:outError];
+}
+
+static BOOL cloneOrLinkDirectory(NSString* src, NSString* dst, NSError** outError)
+{
+    NSFileManager* fmgr = [NSFileManager defaultManager];
+    if (![fmgr createDirectoryAtPath:dst withIntermediateDirectories:YES attributes:nil error:outError]) {
+        return NO;
+    }
+    NSDirectoryEnumerator* files = [fmgr enumeratorAtPath:src];
+    for (NSString* file in files) {
+        NSString* dstFile = [dst stringByAppendingPathComponent:file];
+        NSString* type = files.fileAttributes.fileType;
+        if ([type isEqualToString:NSFileTypeDirectory]) {
+            if (![fmgr createDirectoryAtPath:dstFile withIntermediateDirectories:YES attributes:nil error:outError]) {
+                return NO;
+            }
+        } else if ([type isEqualToString:NSFileTypeRegular]) {
+            if (!cloneOrLinkFile([src stringByAppendingPathComponent:file], dstFile, outError)) {
+                return NO;
+            }
+        }
+    }
+    return YES;
+}
+
+@implementation TD_Database (Backup)
+
+- (BOOL)backupToPath:(NSString*)path
+        pagesPerStep:(int)pagesPerStep
+            progress:(TDBackupProgressBlock)progress
+               error:(NSError**)outError
+{
+    NSParameterAssert(pagesPerStep > 0);
+    if (!self.isOpen) {
+        if (outError) *outError = backupError(kTDStatusNotFound, @"Database isn't open");
+        return NO;
+    }
+    NSFileManager* fmgr = [NSFileManager defaultManager];
+    NSString* attachmentsPath = [TD_Database attachmentStorePathWithDatabasePath:path];
+    NSString* archivePath = [TD_Database archivePathWithDatabasePath:path];
+    if ([fmgr fileExistsAtPath:path] || [fmgr fileExistsAtPath:attachmentsPath] ||
+        [fmgr fileExistsAtPath:archivePath]) {
+        if (outError) *outError = backupError(kTDStatusDuplicate, @"Backup already exists");
+        return NO;
+    }
+
+    FMDatabase* dest = [FMDatabase databaseWithPath:path];
+    if (![dest openWithFlags:SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE] ||
+        ![dest setKeyWithProvider:_keyProviderToOpenDB error:outError]) {
+        if (outError && !*outError) *outError = dest.lastError;
+        [dest close];
+        [TD_Database removeDatabaseFilesAtPath:path];
+        return NO;
+    }
+
+    // Backing up from the writer connection, rather than a connection of its own, is what lets
+    // writes carry on: SQLite copies pages they change into the backup as they commit, where
+    // a write through any other connection would start the backup over.
+    __block sqlite3_backup* backup = NULL;
+    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        backup = sqlite3_backup_init(dest.sqliteHandle, "main", db.sqliteHandle, "main");
+    }];
+    if (!backup) {
+        if (outError) *outError = dest.lastError;
+        [dest close];
+        [TD_Database removeDatabaseFilesAtPath:path];
+        return NO;
+    }
+
+    __block int rc = SQLITE_OK;
+    NSUInteger steps = 0;
+    while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+        __block int remaining = 0, total = 0;
+        [_fmdbQueue inDatabase:^(FMDatabase* db) {
+            rc = sqlite3_backup_step(backup, pagesPerStep);
+            remaining = sqlite3_backup_remaining(backup);
+            total = sqlite3_backup_pagecount(backup);
+        }];
+        steps++;
+        if (progress) progress(remaining, total);
+        if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+            usleep(10000);
+        } else if (rc == SQLITE_OK) {
+            // Let queued writers have the connection before the next step
+            sched_yield();
+        }
+    }
+    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        sqlite3_backup_finish(backup);
+    }];
+    BOOL ok = (rc == SQLITE_DONE);
+    if (!ok && outError) {
+        *outError = backupError(kTDStatusDBError, @(sqlite3_errstr(rc)));
+    }
+    [dest close];
+
+    // The archive is copied after the database, so it holds every body the copy marks archived
+    if (ok && self.hasArchive) {
+        __block NSError* error = nil;
+        void (^vacuumInto)(FMDatabase*) = ^(FMDatabase* db) {
+            if (![db executeUpdate:@"VACUUM archive INTO ?", archivePath]) error = db.lastError;
+        };
+        if (_readPool.count == 0 || ![_readPool inDatabase:vacuumInto]) {
+            [_fmdbQueue inDatabase:vacuumInto];
+        }
+        ok = (error == nil);
+        if (!ok && outError) *outError = error;
+    }
+    if (ok && [fmgr fileExistsAtPath:self.attachmentStorePath]) {
+        ok = cloneOrLinkDirectory(self.attachmentStorePath, attachmentsPath, outError);
+    }
+    if (!ok) {
+        [TD_Database removeDatabaseFilesAtPath:path];
+        return NO;
+    }
+    os_log_info(CDTOSLog, "%{public}@: Backed up to %{public}@ in %lu steps", self, path,
+                (unsigned long)steps);
+    return YES;
+}
+
+@end
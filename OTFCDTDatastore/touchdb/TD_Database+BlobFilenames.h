@@ -30,6 +30,21 @@ extern NSString *const TDDatabaseBlobFilenamesColumnFilename;
 /** File extension for attachments saved to disk */
 extern NSString *const TDDatabaseBlobFilenamesFileExtension;
 
+/** Name of the table listing the files of deleted attachments that are yet to be removed from
+ disk */
+extern NSString *const TDDatabaseBlobPendingDeletesTableName;
+
+/** Name of the table holding the content of attachments stored in the database rather than in a
+ file; their key is related to a filename with extension TDDatabaseBlobInlineFileExtension */
+extern NSString *const TDDatabaseBlobInlineTableName;
+
+/** Second column of TDDatabaseBlobInlineTableName, after the key: data */
+extern NSString *const TDDatabaseBlobInlineColumnData;
+
+/** File extension of the filenames of attachments in TDDatabaseBlobInlineTableName. There is no
+ file with that name. */
+extern NSString *const TDDatabaseBlobInlineFileExtension;
+
 /**
  This is an utility class that defines all the required methods to create and interact with a table
  for relating keys and filenames.
@@ -45,6 +60,64 @@ extern NSString *const TDDatabaseBlobFilenamesFileExtension;
  */
 + (NSString *)sqlCommandToCreateBlobFilenamesTable;
 
+/**
+ Execute the SQL command returned by this method to create table
+ TDDatabaseBlobPendingDeletesTableName
+
+ @return A SQL command
+ */
++ (NSString *)sqlCommandToCreateBlobPendingDeletesTable;
+
+/**
+ Execute the SQL command returned by this method to create table TDDatabaseBlobInlineTableName
+
+ @return A SQL command
+ */
++ (NSString *)sqlCommandToCreateBlobInlineTable;
+
+/**
+ YES if the filename is that of an attachment stored in TDDatabaseBlobInlineTableName.
+
+ @param filename Filename as in TDDatabaseBlobFilenamesTableName
+ */
++ (BOOL)isInlineBlobFilename:(NSString *)filename;
+
+/**
+ Mark phase of the attachment collector: moves the filenames of all the keys that are no longer
+ in table 'attachments' from TDDatabaseBlobFilenamesTableName to
+ TDDatabaseBlobPendingDeletesTableName. It runs entirely in SQL; the files are left on disk.
+ Attachments stored in TDDatabaseBlobInlineTableName have no file, so they are deleted straight
+ away.
+
+ @param db Database with both tables
+
+ @return YES if it succeeds or NO if there is an error
+ */
++ (BOOL)markUnusedBlobFilenamesForDeletionInDatabase:(FMDatabase *)db;
+
+/**
+ Return up to 'limit' filenames from TDDatabaseBlobPendingDeletesTableName
+
+ @param limit Maximum number of filenames to return
+ @param db Database with table TDDatabaseBlobPendingDeletesTableName
+
+ @return Array of filenames, empty if there is nothing to delete
+ */
++ (NSArray<NSString *> *)pendingDeleteBlobFilenamesWithLimit:(NSUInteger)limit
+                                                  inDatabase:(FMDatabase *)db;
+
+/**
+ Remove the filenames passed as a parameter from TDDatabaseBlobPendingDeletesTableName, once their
+ files have been deleted.
+
+ @param filenames Filenames to remove
+ @param db Database with table TDDatabaseBlobPendingDeletesTableName
+
+ @return YES if it succeeds or NO if there is an error
+ */
++ (BOOL)deletePendingDeleteBlobFilenames:(NSArray<NSString *> *)filenames
+                              inDatabase:(FMDatabase *)db;
+
 /**
  This method:
  - Generate a filename as the hexadecimal representation of the provided key plus extension
@@ -73,6 +146,86 @@ extern NSString *const TDDatabaseBlobFilenamesFileExtension;
 + (NSString *)generateAndInsertRandomFilenameBasedOnKey:(TDBlobKey)key
                        intoBlobFilenamesTableInDatabase:(FMDatabase *)db;
 
+/**
+ As 'TD_Database:generateAndInsertRandomFilenameBasedOnKey:intoBlobFilenamesTableInDatabase:',
+ but if 'sharded' is YES the filename is put in the subdirectories given by
+ 'TD_Database:shardedBlobFilename:', e.g. '3f/f2/3ff2...blob'.
+
+ @param key Key for the filename
+ @param sharded YES to generate a filename in subdirectories
+ @param db Database with table TDDatabaseBlobFilenamesTableName
+
+ @return A new filename or nil if there is an error
+ */
++ (NSString *)generateAndInsertRandomFilenameBasedOnKey:(TDBlobKey)key
+                                                sharded:(BOOL)sharded
+                       intoBlobFilenamesTableInDatabase:(FMDatabase *)db;
+
+/**
+ The filename a file of the attachment store is moved to in the sharded layout: in two levels of
+ subdirectories named by the first two and the next two characters of its name, so that no
+ directory holds more than a few files, however many attachments there are. Filenames that are
+ already sharded, or are of inline attachments, are returned as they are.
+
+ @param filename Filename as in TDDatabaseBlobFilenamesTableName
+ */
++ (NSString *)shardedBlobFilename:(NSString *)filename;
+
+/**
+ Return up to 'limit' rows of TDDatabaseBlobFilenamesTableName whose files are not in the sharded
+ layout yet. Rows of inline attachments are left out, as they have no file.
+
+ @param limit Maximum number of rows to return
+ @param db Database with table TDDatabaseBlobFilenamesTableName
+
+ @return Array of TD_DatabaseBlobFilenameRow, empty if every file is sharded
+ */
++ (NSArray *)unshardedRowsInBlobFilenamesTableWithLimit:(NSUInteger)limit
+                                             inDatabase:(FMDatabase *)db;
+
+/**
+ Change the filename related to a key, once its file has been linked under the new name. The old
+ filename is added to TDDatabaseBlobPendingDeletesTableName, so the sweep deletes the old file.
+
+ @param filename New filename
+ @param key Key of the row to update
+ @param oldFilename Filename the row has now
+ @param db Database with both tables
+
+ @return YES if the row is updated or NO if there is an error
+ */
++ (BOOL)replaceFilename:(NSString *)oldFilename
+                      withFilename:(NSString *)filename
+                            forKey:(TDBlobKey)key
+    inBlobFilenamesTableInDatabase:(FMDatabase *)db;
+
+/**
+ This method:
+ - Generate a filename as the hexadecimal representation of the provided key plus extension
+ TDDatabaseBlobInlineFileExtension
+ - Insert the filename with the key passed a parameter into TDDatabaseBlobFilenamesTableName
+ - Insert the data with the key into TDDatabaseBlobInlineTableName
+
+ @param key Key for the filename
+ @param data Content of the attachment
+ @param db Database with both tables
+
+ @return A new filename or nil if there is an error
+ */
++ (NSString *)generateAndInsertInlineFilenameBasedOnKey:(TDBlobKey)key
+                                                   data:(NSData *)data
+                       intoBlobFilenamesTableInDatabase:(FMDatabase *)db;
+
+/**
+ Look for the content of an attachment stored in TDDatabaseBlobInlineTableName
+
+ @param key Key for the attachment
+ @param db Database with table TDDatabaseBlobInlineTableName
+
+ @return The content or nil if the key is not found
+ */
++ (NSData *)inlineDataForKey:(TDBlobKey)key inBlobInlineTableInDatabase:(FMDatabase *)db;
+
 /**
  Count the number of rows/entries in the table TDDatabaseBlobFilenamesTableName
  
@@ -104,6 +257,18 @@ extern NSString *const TDDatabaseBlobFilenamesFileExtension;
  */
 + (NSString *)filenameForKey:(TDBlobKey)key inBlobFilenamesTableInDatabase:(FMDatabase *)db;
 
+/**
+ Look for the filenames related to many keys at once, with one query per few hundred keys rather
+ than one per key
+
+ @param keys Keys for the filenames, each the bytes of a TDBlobKey
+ @param db Database with table TDDatabaseBlobFilenamesTableName
+
+ @return Filenames by key; keys that are not found are left out
+ */
++ (NSDictionary<NSData *, NSString *> *)filenamesForKeys:(NSArray<NSData *> *)keys
+                          inBlobFilenamesTableInDatabase:(FMDatabase *)db;
+
 /**
  Insert a row in TDDatabaseBlobFilenamesTableName with the filename and key provided
  
@@ -118,7 +283,8 @@ extern NSString *const TDDatabaseBlobFilenamesFileExtension;
     intoBlobFilenamesTableInDatabase:(FMDatabase *)db;
 
 /**
- Look for a row with a key equal to the key passed as a parameter and delete it.
+ Look for a row with a key equal to the key passed as a parameter and delete it, along with its
+ content in TDDatabaseBlobInlineTableName if it has any.
  
  @param key Key for the row to delete
  @param db Database with table TDDatabaseBlobFilenamesTableName
@@ -127,17 +293,35 @@ extern NSString *const TDDatabaseBlobFilenamesFileExtension;
  */
 + (BOOL)deleteRowForKey:(TDBlobKey)key inBlobFilenamesTableInDatabase:(FMDatabase *)db;
 
+/**
+ Moves the files of the attachment store into the sharded layout (see
+ 'TD_Database:shardedBlobFilename:'), a batch at a time, while the database is in use. Each file
+ is hard-linked under its new name and its row updated in one short transaction; the old names are
+ left to the sweep to delete, like those of deleted attachments, so readers that already looked
+ one up can still open it for a while. Set TDBlobStore's shardsFiles as well, so that files
+ written from then on are sharded too.
+
+ Calling this again after it fails carries on where it stopped. Runs on the calling thread until
+ every file has been moved.
+
+ @param outError It will point to an error if a file can't be linked or a row updated
+
+ @return YES if every file is in the sharded layout
+ */
+- (BOOL)moveBlobFilesToShardedLayoutWithError:(NSError **)outError;
+
 @end
 
 /**
- This is an auxiliary class only used by: 'TD_Database:rowsInBlobFilenamesTableInDatabase:'
+ This is an auxiliary class only used by: 'TD_Database:rowsInBlobFilenamesTableInDatabase:' and
+ 'TD_Database:unshardedRowsInBlobFilenamesTableWithLimit:inDatabase:'
  */
 @interface TD_DatabaseBlobFilenameRow : NSObject
 
 @property (assign, nonatomic, readonly) TDBlobKey key;
 @property (strong, nonatomic, readonly) NSString *blobFilename;
 
-- (instancetype)init UNAVAILABLE_ATTRIBUTE;
+- (instancetype)init NS_UNAVAILABLE;
 
 - (instancetype)initWithKey:(TDBlobKey)key
                blobFilename:(NSString *)blobFilename NS_DESIGNATED_INITIALIZER;
@@ -145,3 +329,54 @@ extern NSString *const TDDatabaseBlobFilenamesFileExtension;
 + (instancetype)rowWithKey:(TDBlobKey)key blobFilename:(NSString *)blobFilename;
 
 @end
+
+/**
+ An in-memory map from keys to the filenames in TDDatabaseBlobFilenamesTableName, so that reading
+ an attachment doesn't cost a query to find its file. It is filled as filenames are looked up.
+
+ A key's filename never changes while its row exists, so only rows that are deleted can make an
+ entry wrong; whoever deletes them calls -removeAllFilenames afterwards, which bumps the
+ generation. Only rows known to be committed are cached: a lookup passes the generation seen
+ before its snapshot of the database was taken, so that filenames read from a snapshot older than
+ the latest removal are not stored.
+
+ The cache is safe to use from several threads.
+ */
+@interface TDBlobFilenameCache : NSObject
+
+/** @param countLimit Number of filenames kept */
+- (instancetype)initWithCountLimit:(NSUInteger)countLimit NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/** Incremented every time the cache is emptied. */
+@property (readonly) NSUInteger generation;
+
+- (NSString *)filenameForKey:(NSData *)key;
+
+/**
+ Caches filenames read from the database.
+
+ @param generation The generation returned by -generationForDatabase: before they were read; if
+ the cache has been emptied since, they are not stored.
+ */
+- (void)setFilenames:(NSDictionary<NSData *, NSString *> *)filenames
+          generation:(NSUInteger)generation;
+
+- (void)removeAllFilenames;
+
+/**
+ The generation filenames read through a connection may be cached under, or NSNotFound if they
+ mustn't be because they may yet be rolled back. Outside a transaction rows are committed; read
+ transactions say which generation their snapshot is of with
+ +setSnapshotGeneration:forDatabase:.
+ */
+- (NSUInteger)generationForDatabase:(FMDatabase *)db;
+
+/**
+ Records the generation a read transaction on `db` was started at, before its snapshot is taken;
+ NSNotFound clears it when the transaction ends.
+ */
++ (void)setSnapshotGeneration:(NSUInteger)generation forDatabase:(FMDatabase *)db;
+
+@end
@@ -21,12 +21,25 @@
 
 #import "TDMisc.h"
 #import "CDTMisc.h"
+#import "TDInternal.h"
+#import "TDStatus.h"
 
 #import <CommonCrypto/CommonDigest.h>
+#import <objc/runtime.h>
+#import <sqlite3.h>
 #import "CDTLogging.h"
 
 #define TDDATABASE_MAX_NUMBER_OF_TRIES_TO_GENERATE_AVAILABLE_FILENAME 200
 
+// Well below SQLITE_MAX_VARIABLE_NUMBER, which is 999 in older builds
+#define TDDATABASE_MAX_KEYS_PER_FILENAMES_QUERY 500
+
+// Files moved into the sharded layout per transaction
+#define TDDATABASE_SHARDING_BATCH_SIZE 200
+
+// Characters of a filename naming each level of its subdirectories in the sharded layout
+#define TDDATABASE_SHARD_NAME_LENGTH 2
+
 NSString *const TDDatabaseBlobFilenamesTableName = @"attachments_key_filename";
 
 NSString *const TDDatabaseBlobFilenamesColumnKey = @"key";
@@ -34,6 +47,14 @@ NSString *const TDDatabaseBlobFilenamesColumnFilename = @"filename";
 
 NSString *const TDDatabaseBlobFilenamesFileExtension = @"blob";
 
+NSString *const TDDatabaseBlobPendingDeletesTableName = @"attachments_pending_delete";
+
+NSString *const TDDatabaseBlobInlineTableName = @"attachments_inline";
+
+NSString *const TDDatabaseBlobInlineColumnData = @"data";
+
+NSString *const TDDatabaseBlobInlineFileExtension = @"inline";
+
 @implementation TD_Database (BlobFilenames)
 
 #pragma mark - Public class methods
@@ -47,6 +68,97 @@ NSString *const TDDatabaseBlobFilenamesFileExtension = @"blob";
     return cmd;
 }
 
++ (NSString *)sqlCommandToCreateBlobPendingDeletesTable
+{
+    NSString *cmd =
+        [NSString stringWithFormat:@"CREATE TABLE %@ (%@ TEXT PRIMARY KEY)",
+                                   TDDatabaseBlobPendingDeletesTableName,
+                                   TDDatabaseBlobFilenamesColumnFilename];
+
+    return cmd;
+}
+
++ (NSString *)sqlCommandToCreateBlobInlineTable
+{
+    NSString *cmd =
+        [NSString stringWithFormat:@"CREATE TABLE %@ (%@ TEXT PRIMARY KEY, %@ BLOB NOT NULL)",
+                                   TDDatabaseBlobInlineTableName, TDDatabaseBlobFilenamesColumnKey,
+                                   TDDatabaseBlobInlineColumnData];
+
+    return cmd;
+}
+
++ (BOOL)isInlineBlobFilename:(NSString *)filename
+{
+    return [filename.pathExtension isEqualToString:TDDatabaseBlobInlineFileExtension];
+}
+
++ (BOOL)markUnusedBlobFilenamesForDeletionInDatabase:(FMDatabase *)db
+{
+    // 'attachments' stores the keys as blobs, TDDatabaseBlobFilenamesTableName as lowercase hex
+    NSString *unused = @"NOT IN (SELECT DISTINCT lower(hex(key)) FROM attachments)";
+    NSString *deleteInline = [NSString
+        stringWithFormat:@"DELETE FROM %@ WHERE %@ %@", TDDatabaseBlobInlineTableName,
+                         TDDatabaseBlobFilenamesColumnKey, unused];
+    NSString *mark = [NSString
+        stringWithFormat:@"INSERT OR IGNORE INTO %@ (%@) SELECT %@ FROM %@ WHERE %@ %@ AND %@ "
+                         @"NOT LIKE '%%.%@'",
+                         TDDatabaseBlobPendingDeletesTableName,
+                         TDDatabaseBlobFilenamesColumnFilename,
+                         TDDatabaseBlobFilenamesColumnFilename, TDDatabaseBlobFilenamesTableName,
+                         TDDatabaseBlobFilenamesColumnKey, unused,
+                         TDDatabaseBlobFilenamesColumnFilename, TDDatabaseBlobInlineFileExtension];
+    NSString *unlinkInline = [NSString
+        stringWithFormat:@"DELETE FROM %@ WHERE %@ %@ AND %@ LIKE '%%.%@'",
+                         TDDatabaseBlobFilenamesTableName, TDDatabaseBlobFilenamesColumnKey, unused,
+                         TDDatabaseBlobFilenamesColumnFilename, TDDatabaseBlobInlineFileExtension];
+    NSString *unlink = [NSString
+        stringWithFormat:@"DELETE FROM %@ WHERE %@ IN (SELECT %@ FROM %@)",
+                         TDDatabaseBlobFilenamesTableName, TDDatabaseBlobFilenamesColumnFilename,
+                         TDDatabaseBlobFilenamesColumnFilename,
+                         TDDatabaseBlobPendingDeletesTableName];
+
+    return [db executeUpdate:deleteInline] && [db executeUpdate:mark] &&
+           [db executeUpdate:unlinkInline] && [db executeUpdate:unlink];
+}
+
++ (NSArray<NSString *> *)pendingDeleteBlobFilenamesWithLimit:(NSUInteger)limit
+                                                  inDatabase:(FMDatabase *)db
+{
+    NSMutableArray *filenames = [NSMutableArray array];
+
+    NSString *query =
+        [NSString stringWithFormat:@"SELECT %@ FROM %@ LIMIT ?",
+                                   TDDatabaseBlobFilenamesColumnFilename,
+                                   TDDatabaseBlobPendingDeletesTableName];
+    FMResultSet *r = [db executeQuery:query, @(limit)];
+
+    @try {
+        while ([r next]) {
+            [filenames addObject:[r stringForColumnIndex:0]];
+        }
+    }
+    @finally { [r close]; }
+
+    return filenames;
+}
+
++ (BOOL)deletePendingDeleteBlobFilenames:(NSArray<NSString *> *)filenames
+                              inDatabase:(FMDatabase *)db
+{
+    NSString *update = [NSString
+        stringWithFormat:@"DELETE FROM %@ WHERE %@ = ?", TDDatabaseBlobPendingDeletesTableName,
+                         TDDatabaseBlobFilenamesColumnFilename];
+
+    for (NSString *filename in filenames) {
+        if (![db executeUpdate:update, filename]) {
+            return NO;
+        }
+    }
+
+    return YES;
+}
+
 + (NSString *)generateAndInsertFilenameBasedOnKey:(TDBlobKey)key
                  intoBlobFilenamesTableInDatabase:(FMDatabase *)db
 {
@@ -61,6 +173,15 @@ NSString *const TDDatabaseBlobFilenamesFileExtension = @"blob";
 
 + (NSString *)generateAndInsertRandomFilenameBasedOnKey:(TDBlobKey)key
                        intoBlobFilenamesTableInDatabase:(FMDatabase *)db
+{
+    return [TD_Database generateAndInsertRandomFilenameBasedOnKey:key
+                                                          sharded:NO
+                                 intoBlobFilenamesTableInDatabase:db];
+}
+
++ (NSString *)generateAndInsertRandomFilenameBasedOnKey:(TDBlobKey)key
+                                                sharded:(BOOL)sharded
+                       intoBlobFilenamesTableInDatabase:(FMDatabase *)db
 {
     NSString *hexKey = TDHexFromBytes(key.bytes, sizeof(key.bytes));
 
@@ -69,6 +190,9 @@ NSString *const TDDatabaseBlobFilenamesFileExtension = @"blob";
     for (NSInteger i = 0;
          !filename && (i < TDDATABASE_MAX_NUMBER_OF_TRIES_TO_GENERATE_AVAILABLE_FILENAME); i++) {
         filename = [TD_Database generateRandomBlobFilename];
+        if (sharded) {
+            filename = [TD_Database shardedBlobFilename:filename];
+        }
 
         BOOL success = [TD_Database insertFilename:filename
                                         withHexKey:hexKey
@@ -85,6 +209,186 @@ NSString *const TDDatabaseBlobFilenamesFileExtension = @"blob";
     return filename;
 }
 
++ (NSString *)shardedBlobFilename:(NSString *)filename
+{
+    NSUInteger prefixLength = 2 * TDDATABASE_SHARD_NAME_LENGTH;
+    if (filename.length <= prefixLength || [filename containsString:@"/"] ||
+        [TD_Database isInlineBlobFilename:filename]) {
+        return filename;
+    }
+
+    NSString *first = [filename substringToIndex:TDDATABASE_SHARD_NAME_LENGTH];
+    NSString *second = [filename
+        substringWithRange:NSMakeRange(TDDATABASE_SHARD_NAME_LENGTH, TDDATABASE_SHARD_NAME_LENGTH)];
+
+    return [NSString pathWithComponents:@[ first, second, filename ]];
+}
+
++ (NSArray *)unshardedRowsInBlobFilenamesTableWithLimit:(NSUInteger)limit
+                                             inDatabase:(FMDatabase *)db
+{
+    NSMutableArray *rows = [NSMutableArray array];
+
+    NSString *query = [NSString
+        stringWithFormat:@"SELECT %@, %@ FROM %@ WHERE %@ NOT LIKE '%%/%%' AND %@ NOT LIKE '%%.%@' "
+                         @"LIMIT ?",
+                         TDDatabaseBlobFilenamesColumnKey, TDDatabaseBlobFilenamesColumnFilename,
+                         TDDatabaseBlobFilenamesTableName, TDDatabaseBlobFilenamesColumnFilename,
+                         TDDatabaseBlobFilenamesColumnFilename, TDDatabaseBlobInlineFileExtension];
+    FMResultSet *r = [db executeQuery:query, @(limit)];
+    if (!r) {
+        return nil;
+    }
+
+    @try {
+        while ([r next]) {
+            NSData *keyData = dataFromHexadecimalString([r stringForColumnIndex:0]);
+
+            TDBlobKey key;
+            [keyData getBytes:key.bytes length:CC_SHA1_DIGEST_LENGTH];
+
+            [rows addObject:[TD_DatabaseBlobFilenameRow rowWithKey:key
+                                                      blobFilename:[r stringForColumnIndex:1]]];
+        }
+    }
+    @finally { [r close]; }
+
+    return rows;
+}
+
++ (BOOL)replaceFilename:(NSString *)oldFilename
+                      withFilename:(NSString *)filename
+                            forKey:(TDBlobKey)key
+    inBlobFilenamesTableInDatabase:(FMDatabase *)db
+{
+    NSString *update = [NSString
+        stringWithFormat:@"UPDATE %@ SET %@ = ? WHERE %@ = ? AND %@ = ?",
+                         TDDatabaseBlobFilenamesTableName, TDDatabaseBlobFilenamesColumnFilename,
+                         TDDatabaseBlobFilenamesColumnKey, TDDatabaseBlobFilenamesColumnFilename];
+    NSString *markOld = [NSString
+        stringWithFormat:@"INSERT OR IGNORE INTO %@ (%@) VALUES (?)",
+                         TDDatabaseBlobPendingDeletesTableName,
+                         TDDatabaseBlobFilenamesColumnFilename];
+
+    NSString *hexKey = TDHexFromBytes(key.bytes, sizeof(key.bytes));
+
+    return [db executeUpdate:update, filename, hexKey, oldFilename] && db.changes == 1 &&
+           [db executeUpdate:markOld, oldFilename];
+}
+
+- (BOOL)moveBlobFilesToShardedLayoutWithError:(NSError **)outError
+{
+    TDBlobStore *store = self.attachmentStore;
+    if (!store) {
+        if (outError) {
+            *outError = TDStatusToNSErrorWithInfo(kTDStatusNotFound, nil, @{
+                NSLocalizedFailureReasonErrorKey : @"Attachment store isn't open"
+            });
+        }
+        return NO;
+    }
+
+    NSUInteger moved = 0;
+    while (YES) {
+        __block NSUInteger count = 0;
+        __block NSMutableArray *linked = [NSMutableArray array];
+        TDStatus status = [self inTransaction:^TDStatus(FMDatabase *db) {
+            NSArray *rows =
+                [TD_Database unshardedRowsInBlobFilenamesTableWithLimit:TDDATABASE_SHARDING_BATCH_SIZE
+                                                             inDatabase:db];
+            if (!rows) {
+                return kTDStatusDBError;
+            }
+            for (TD_DatabaseBlobFilenameRow *row in rows) {
+                NSString *filename = [TD_Database shardedBlobFilename:row.blobFilename];
+                if (![store linkBlobFileNamed:row.blobFilename toFilename:filename]) {
+                    return kTDStatusAttachmentError;
+                }
+                [linked addObject:filename];
+                if (![TD_Database replaceFilename:row.blobFilename
+                                     withFilename:filename
+                                           forKey:row.key
+                   inBlobFilenamesTableInDatabase:db]) {
+                    return kTDStatusDBError;
+                }
+            }
+            count = rows.count;
+            return kTDStatusOK;
+        }];
+        [store.filenameCache removeAllFilenames];
+
+        if (TDStatusIsError(status)) {
+            // The rows still name the old files, so the new links are of no use
+            [store deleteBlobFilesNamed:linked];
+            os_log_error(CDTOSLog, "%{public}@: Attachment files not moved to the sharded layout: %d",
+                         self, status);
+            if (outError) {
+                *outError = TDStatusToNSErrorWithInfo(status, nil, @{
+                    NSLocalizedFailureReasonErrorKey : @"Attachment files not moved"
+                });
+            }
+            return NO;
+        }
+        if (count == 0) {
+            break;
+        }
+        moved += count;
+    }
+
+    if (moved > 0) {
+        os_log_info(CDTOSLog, "%{public}@: Moved %lu attachment files to the sharded layout", self,
+                    (unsigned long)moved);
+        [self sweepDeletedAttachments];
+    }
+    return YES;
+}
+
++ (NSString *)generateAndInsertInlineFilenameBasedOnKey:(TDBlobKey)key
+                                                   data:(NSData *)data
+                       intoBlobFilenamesTableInDatabase:(FMDatabase *)db
+{
+    NSString *hexKey = TDHexFromBytes(key.bytes, sizeof(key.bytes));
+    NSString *filename = [hexKey stringByAppendingPathExtension:TDDatabaseBlobInlineFileExtension];
+
+    if (![TD_Database insertFilename:filename
+                          withHexKey:hexKey
+        intoBlobFilenamesTableInDatabase:db]) {
+        return nil;
+    }
+
+    NSString *update = [NSString
+        stringWithFormat:@"INSERT OR REPLACE INTO %@ (%@, %@) VALUES (?, ?)",
+                         TDDatabaseBlobInlineTableName, TDDatabaseBlobFilenamesColumnKey,
+                         TDDatabaseBlobInlineColumnData];
+    if (![db executeUpdate:update, hexKey, data]) {
+        [TD_Database deleteRowForKey:key inBlobFilenamesTableInDatabase:db];
+        return nil;
+    }
+
+    return filename;
+}
+
++ (NSData *)inlineDataForKey:(TDBlobKey)key inBlobInlineTableInDatabase:(FMDatabase *)db
+{
+    NSData *data = nil;
+
+    NSString *query = [NSString
+        stringWithFormat:@"SELECT %@ FROM %@ WHERE %@ = ?", TDDatabaseBlobInlineColumnData,
+                         TDDatabaseBlobInlineTableName, TDDatabaseBlobFilenamesColumnKey];
+
+    FMResultSet *r = [db executeQuery:query, TDHexFromBytes(key.bytes, sizeof(key.bytes))];
+
+    @try {
+        if ([r next]) {
+            // sqlite3_column_blob() gives no bytes for an empty blob
+            data = [r dataForColumnIndex:0] ?: [NSData data];
+        }
+    }
+    @finally { [r close]; }
+
+    return data;
+}
+
 + (NSUInteger)countRowsInBlobFilenamesTableInDatabase:(FMDatabase *)db
 {
     NSUInteger count = 0;
@@ -157,6 +461,53 @@ NSString *const TDDatabaseBlobFilenamesFileExtension = @"blob";
     return filename;
 }
 
++ (NSDictionary<NSData *, NSString *> *)filenamesForKeys:(NSArray<NSData *> *)keys
+                          inBlobFilenamesTableInDatabase:(FMDatabase *)db
+{
+    NSMutableDictionary *filenames = [NSMutableDictionary dictionaryWithCapacity:keys.count];
+
+    for (NSUInteger start = 0; start < keys.count;
+         start += TDDATABASE_MAX_KEYS_PER_FILENAMES_QUERY) {
+        NSUInteger length = MIN(TDDATABASE_MAX_KEYS_PER_FILENAMES_QUERY, keys.count - start);
+
+        NSMutableArray *hexKeys = [NSMutableArray arrayWithCapacity:length];
+        NSMutableDictionary *keysByHexKey = [NSMutableDictionary dictionaryWithCapacity:length];
+        for (NSData *key in [keys subarrayWithRange:NSMakeRange(start, length)]) {
+            NSString *hexKey = TDHexFromBytes(key.bytes, key.length);
+            [hexKeys addObject:hexKey];
+            keysByHexKey[hexKey] = key;
+        }
+
+        NSMutableArray *placeholders = [NSMutableArray arrayWithCapacity:length];
+        for (NSUInteger i = 0; i < length; i++) {
+            [placeholders addObject:@"?"];
+        }
+        NSString *query = [NSString
+            stringWithFormat:@"SELECT %@, %@ FROM %@ WHERE %@ IN (%@)",
+                             TDDatabaseBlobFilenamesColumnKey,
+                             TDDatabaseBlobFilenamesColumnFilename,
+                             TDDatabaseBlobFilenamesTableName, TDDatabaseBlobFilenamesColumnKey,
+                             [placeholders componentsJoinedByString:@","]];
+
+        FMResultSet *r = [db executeQuery:query withArgumentsInArray:hexKeys];
+        if (!r) {
+            return nil;
+        }
+
+        @try {
+            while ([r next]) {
+                NSData *key = keysByHexKey[[r stringForColumnIndex:0]];
+                if (key) {
+                    filenames[key] = [r stringForColumnIndex:1];
+                }
+            }
+        }
+        @finally { [r close]; }
+    }
+
+    return filenames;
+}
+
 + (BOOL)insertFilename:(NSString *)filename
                              withKey:(TDBlobKey)key
     intoBlobFilenamesTableInDatabase:(FMDatabase *)db
@@ -179,6 +530,11 @@ NSString *const TDDatabaseBlobFilenamesFileExtension = @"blob";
     NSDictionary *parameters = @{TDDatabaseBlobFilenamesColumnKey : hexKey};
 
     BOOL success = [db executeUpdate:update withParameterDictionary:parameters];
+
+    NSString *deleteInline = [NSString
+        stringWithFormat:@"DELETE FROM %@ WHERE %@ = :%@", TDDatabaseBlobInlineTableName,
+                         TDDatabaseBlobFilenamesColumnKey, TDDatabaseBlobFilenamesColumnKey];
+    success = [db executeUpdate:deleteInline withParameterDictionary:parameters] && success;
     
     return success;
 }
@@ -261,3 +617,73 @@ NSString *const TDDatabaseBlobFilenamesFileExtension = @"blob";
 }
 
 @end
+
+static char kBlobFilenameCacheGenerationKey;
+
+@implementation TDBlobFilenameCache {
+    NSCache<NSData *, NSString *> *_filenames;
+    NSUInteger _generation;  // guarded by self
+}
+
+- (instancetype)initWithCountLimit:(NSUInteger)countLimit
+{
+    self = [super init];
+    if (self) {
+        _filenames = [[NSCache alloc] init];
+        _filenames.countLimit = countLimit;
+    }
+    return self;
+}
+
+- (NSUInteger)generation
+{
+    @synchronized(self) { return _generation; }
+}
+
+- (NSString *)filenameForKey:(NSData *)key { return [_filenames objectForKey:key]; }
+
+- (void)setFilenames:(NSDictionary<NSData *, NSString *> *)filenames
+          generation:(NSUInteger)generation
+{
+    @synchronized(self)
+    {
+        if (generation != _generation) {
+            return;
+        }
+        for (NSData *key in filenames) {
+            [_filenames setObject:filenames[key] forKey:key];
+        }
+    }
+}
+
+- (void)removeAllFilenames
+{
+    @synchronized(self)
+    {
+        _generation++;
+        [_filenames removeAllObjects];
+    }
+}
+
+- (NSUInteger)generationForDatabase:(FMDatabase *)db
+{
+    NSNumber *generation = objc_getAssociatedObject(db, &kBlobFilenameCacheGenerationKey);
+    if (generation) {
+        return generation.unsignedIntegerValue;
+    }
+    // Outside a transaction the writer only sees committed rows, and rows are only deleted by
+    // the writer. Within one, the rows read may yet be rolled back.
+    if (sqlite3_get_autocommit(db.sqliteHandle)) {
+        return self.generation;
+    }
+    return NSNotFound;
+}
+
++ (void)setSnapshotGeneration:(NSUInteger)generation forDatabase:(FMDatabase *)db
+{
+    objc_setAssociatedObject(db, &kBlobFilenameCacheGenerationKey,
+                             generation == NSNotFound ? nil : @(generation),
+                             OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+}
+
+@end
@@ -14,7 +14,9 @@
 //  and limitations under the License.
 
 #import "TD_Database+Conflicts.h"
+#import "TDInternal.h"
 #import <fmdb/FMDatabase.h>
+#import <fmdb/FMDatabaseAdditions.h>
 #import <fmdb/FMResultSet.h>
 #import <fmdb/FMDatabaseQueue.h>
 
@@ -23,25 +25,48 @@
 /** Only call from within a queued transaction **/
 - (NSArray *)getConflictedDocumentIdsWithDatabase:(FMDatabase *)db
 {
-    NSString *sql = @"SELECT docs.docid, COUNT(*) " @"FROM docs,revs "
-        @"WHERE revs.doc_id = docs.doc_id AND deleted = 0 " @"AND revs.sequence NOT IN "
-        @"(SELECT DISTINCT parent FROM revs " @"WHERE parent NOT NULL) "
-        @"GROUP BY docs.docid HAVING COUNT(*) > 1";
-    FMResultSet *r = [db executeQuery:sql];
+    FMResultSet *r = [db executeQuery:@"SELECT docs.docid FROM conflicts, docs "
+                                       "WHERE docs.doc_id = conflicts.doc_id ORDER BY docs.docid"];
     if (!r) return nil;
     NSMutableArray *docs = [[NSMutableArray alloc] init];
     while ([r next]) {
-        [docs addObject:[r stringForColumn:@"docid"]];
+        [docs addObject:[r stringForColumnIndex:0]];
     }
     [r close];
     return docs;
 }
 
+/** Only call from within a queued transaction **/
+- (BOOL)updateConflictsForDocNumericID:(SInt64)docNumericID database:(FMDatabase *)db
+{
+    // A document is in conflict while more than one of its leaf revisions isn't a deletion:
+    int leaves = [db intForQuery:@"SELECT COUNT(*) FROM revs WHERE doc_id=? AND deleted=0 "
+                                  "AND sequence NOT IN (SELECT parent FROM revs "
+                                  "WHERE doc_id=? AND parent NOT NULL)",
+                                 @(docNumericID), @(docNumericID)];
+    if (leaves > 1)
+        return [db executeUpdate:@"INSERT OR IGNORE INTO conflicts (doc_id) VALUES (?)",
+                                 @(docNumericID)];
+    else
+        return [db executeUpdate:@"DELETE FROM conflicts WHERE doc_id=?", @(docNumericID)];
+}
+
+/** Only call from within a queued transaction **/
+- (BOOL)isConflictedDocumentID:(NSString *)docID database:(FMDatabase *)db
+{
+    FMResultSet *r = [db executeQuery:@"SELECT 1 FROM conflicts, docs "
+                                       "WHERE docs.doc_id = conflicts.doc_id AND docs.docid = ?",
+                                      docID];
+    BOOL conflicted = [r next];
+    [r close];
+    return conflicted;
+}
+
 - (NSArray *)getConflictedDocumentIds
 {
     __block NSArray *result;
     __weak TD_Database *weakSelf = self;
-    [_fmdbQueue inDatabase:^(FMDatabase *db) {
+    [self inReadTransaction:^(FMDatabase *db) {
         TD_Database *strongSelf = weakSelf;
         result = [strongSelf getConflictedDocumentIdsWithDatabase:db];
     }];
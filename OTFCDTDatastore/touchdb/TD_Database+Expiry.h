@@ -0,0 +1,46 @@
+//
+//  TD_Database+Expiry.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/** Documents can be given a time at which they expire, kept in the expiries table, which is
+    indexed by that time. Expired documents are purged, as -purgeRevisions:result: does, rather
+    than deleted, so no tombstones are left to be replicated. An expiry belongs to the document,
+    not the revision: it is kept as the document is updated, until it is changed or cleared. */
+@interface TD_Database (Expiry)
+
+/** Sets when the document with this ID expires, or with a nil date that it never does.
+    @return  kTDStatusOK, kTDStatusNotFound if there is no such document, or an error status. */
+- (TDStatus)setExpiryDate:(nullable NSDate*)date forDocumentID:(NSString*)docID;
+
+/** When the document with this ID expires, or nil if it never does. */
+- (nullable NSDate*)expiryDateOfDocumentID:(NSString*)docID;
+
+/** Purges documents which expired before `date`, earliest first, a batch per short write
+    transaction, until they're all gone or the time budget runs out. A
+    TD_DatabasePurgedNotification is posted for each batch, as it commits.
+    @param timeBudget  Roughly how long the call may take; it stops after the batch in progress.
+    @param outDocIDs  On return, the IDs of the documents purged. May be NULL.
+    @param outFinished  On return, YES if no expired documents are left. May be NULL.
+    @return  kTDStatusOK, or an error status. */
+- (TDStatus)purgeDocumentsExpiredBefore:(NSDate*)date
+                             timeBudget:(NSTimeInterval)timeBudget
+                      purgedDocumentIDs:(NSArray<NSString*>* _Nullable* _Nullable)outDocIDs
+                               finished:(nullable BOOL*)outFinished;
+
+@end
+
+NS_ASSUME_NONNULL_END
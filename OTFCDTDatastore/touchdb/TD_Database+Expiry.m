@@ -0,0 +1,123 @@
+//
+//  TD_Database+Expiry.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database+Expiry.h"
+#import "TD_Database+Insertion.h"
+#import "TDInternal.h"
+#import "TDRevisionHistoryCache.h"
+#import "CDTLogging.h"
+#import <fmdb/FMDatabase.h>
+#import <fmdb/FMDatabaseAdditions.h>
+#import "FMDatabase+LongLong.h"
+
+static const NSUInteger kExpiryPurgeBatchSize = 100;
+
+@implementation TD_Database (Expiry)
+
+- (TDStatus)setExpiryDate:(NSDate*)date forDocumentID:(NSString*)docID
+{
+    if (!self.isOpen) return kTDStatusNotFound;
+    __weak TD_Database* weakSelf = self;
+    return [self inTransaction:^TDStatus(FMDatabase* db) {
+        SInt64 docNumericID = [weakSelf getDocNumericID:docID database:db];
+        if (docNumericID <= 0) return kTDStatusNotFound;
+        BOOL ok = date ? [db executeUpdate:@"INSERT OR REPLACE INTO expiries (doc_id, expires_at) "
+                                            "VALUES (?, ?)",
+                                           @(docNumericID), @(date.timeIntervalSince1970)]
+                       : [db executeUpdate:@"DELETE FROM expiries WHERE doc_id=?", @(docNumericID)];
+        return ok ? kTDStatusOK : kTDStatusDBError;
+    }];
+}
+
+- (NSDate*)expiryDateOfDocumentID:(NSString*)docID
+{
+    if (!self.isOpen) return nil;
+    __block NSDate* date = nil;
+    [self inReadTransaction:^(FMDatabase* db) {
+        FMResultSet* r = [db executeQuery:@"SELECT expires_at FROM expiries "
+                                           "JOIN docs ON docs.doc_id = expiries.doc_id "
+                                           "WHERE docs.docid=?",
+                                          docID];
+        if ([r next]) {
+            date = [NSDate dateWithTimeIntervalSince1970:[r doubleForColumnIndex:0]];
+        }
+        [r close];
+    }];
+    return date;
+}
+
+- (TDStatus)purgeDocumentsExpiredBefore:(NSDate*)date
+                             timeBudget:(NSTimeInterval)timeBudget
+                      purgedDocumentIDs:(NSArray<NSString*>**)outDocIDs
+                               finished:(BOOL*)outFinished
+{
+    if (outDocIDs) *outDocIDs = nil;
+    if (outFinished) *outFinished = NO;
+    if (!self.isOpen) return kTDStatusNotFound;
+
+    CFAbsoluteTime deadline = CFAbsoluteTimeGetCurrent() + timeBudget;
+    NSTimeInterval before = date.timeIntervalSince1970;
+    NSMutableArray<NSString*>* purgedDocIDs = [NSMutableArray array];
+    BOOL finished = NO;
+    TDStatus status = kTDStatusOK;
+    __weak TD_Database* weakSelf = self;
+    while (!finished && CFAbsoluteTimeGetCurrent() < deadline) {
+        NSMutableDictionary* purged = [NSMutableDictionary dictionary];
+        __block NSUInteger found = 0;
+        // Looked up in the same transaction as the purge, so an expiry put off in the meantime
+        // is honoured
+        status = [self inTransaction:^TDStatus(FMDatabase* db) {
+            FMResultSet* r = [db executeQuery:
+                @"SELECT expiries.doc_id, docs.docid FROM expiries "
+                 "LEFT JOIN docs ON docs.doc_id = expiries.doc_id "
+                 "WHERE expiries.expires_at < ? ORDER BY expiries.expires_at LIMIT ?",
+                @(before), @(kExpiryPurgeBatchSize)];
+            if (!r) return kTDStatusDBError;
+            NSMutableArray<NSNumber*>* docNumericIDs = [NSMutableArray array];
+            NSMutableDictionary* docsToRevs = [NSMutableDictionary dictionary];
+            while ([r next]) {
+                found++;
+                [docNumericIDs addObject:@([r longLongIntForColumnIndex:0])];
+                // Without foreign keys, as for a bulk load, the document may have gone already
+                NSString* docID = [r stringForColumnIndex:1];
+                if (docID) docsToRevs[docID] = @[ @"*" ];
+            }
+            [r close];
+
+            TDStatus purgeStatus = [weakSelf purgeRevisions:docsToRevs result:purged database:db];
+            if (TDStatusIsError(purgeStatus)) return purgeStatus;
+            for (NSNumber* docNumericID in docNumericIDs) {
+                if (![db executeUpdate:@"DELETE FROM expiries WHERE doc_id=?", docNumericID]) {
+                    return kTDStatusDBError;
+                }
+            }
+            return kTDStatusOK;
+        }];
+        if (TDStatusIsError(status)) break;
+
+        // Once committed, so that readers still on the old snapshot don't cache them again
+        for (NSString* docID in purged) [_historyCache removeDocumentID:docID];
+        [self notifyPurgedDocumentIDs:purged.allKeys];
+        [purgedDocIDs addObjectsFromArray:purged.allKeys];
+        finished = found < kExpiryPurgeBatchSize;
+    }
+
+    os_log_info(CDTOSLog, "%{public}@: Purged %lu expired documents%{public}@", self,
+                (unsigned long)purgedDocIDs.count, finished ? @"" : @"; more to do");
+    if (outDocIDs) *outDocIDs = purgedDocIDs;
+    if (outFinished) *outFinished = finished;
+    return status;
+}
+
+@end
@@ -19,7 +19,8 @@ typedef BOOL (^TD_ValidationBlock)(TD_Revision* newRevision, id<TD_ValidationCon
 
 + (BOOL)isValidDocumentID:(NSString*)str;
 
-+ (NSString*)generateDocumentID;
+/** Returns an ID for a new document: from documentIDGenerator, or otherwise a random UUID. */
+- (NSString*)generateDocumentID;
 
 /** Stores a new (or initial) revision of a document. This is what's invoked by a PUT or POST. As
    with those, the previous revision ID must be supplied when necessary and the call will fail if it
@@ -37,11 +38,54 @@ typedef BOOL (^TD_ValidationBlock)(TD_Revision* newRevision, id<TD_ValidationCon
               allowConflict:(BOOL)allowConflict
                      status:(TDStatus*)outStatus;
 
+/** Stores several new revisions in a single transaction, posting a single coalesced
+    TD_DatabaseChangeNotification once they are all committed. The JSON bodies are encoded, and
+    revision IDs generated, concurrently before the transaction starts.
+    If any revision fails, the whole batch is rolled back.
+    @param revisions  The revisions to add, as for -putRevision:prevRevisionID:allowConflict:status:.
+    @param prevRevIDs  The ID of the revision each one replaces, using NSNull for new documents; or
+   nil if all the revisions are new documents. Must be the same length as revisions otherwise.
+    @param allowConflict  As for -putRevision:prevRevisionID:allowConflict:status:.
+    @param block  Optional; called within the transaction after each revision has been inserted,
+   e.g. to store its attachments. Returning an error status rolls back the whole batch.
+    @param outStatus  On return, kTDStatusOK, or the status of the first revision that failed.
+    @param outFailedIndex  Optional; on failure, the index of the revision that failed.
+    @return  The new TD_Revisions, in the same order as revisions, or nil on failure. */
+- (NSArray<TD_Revision*>*)putRevisions:(NSArray<TD_Revision*>*)revisions
+                       prevRevisionIDs:(NSArray*)prevRevIDs
+                         allowConflict:(BOOL)allowConflict
+                           afterInsert:(TDStatus (^)(NSUInteger index, TD_Revision* newRev,
+                                                     FMDatabase* db))block
+                                status:(TDStatus*)outStatus
+                           failedIndex:(NSUInteger*)outFailedIndex;
+
 /** Inserts an already-existing revision replicated from a remote database. It must already have a
  * revision ID. This may create a conflict! The revision's history must be given; ancestor revision
  * IDs that don't already exist locally will create phantom revisions with no content. */
 - (TDStatus)forceInsert:(TD_Revision*)rev revisionHistory:(NSArray*)history source:(NSURL*)source;
 
+/** Inserts several existing revisions, as for -forceInsert:revisionHistory:source:, in a single
+    transaction, posting a single coalesced TD_DatabaseChangeNotification for those that succeed.
+    The local revisions of all the documents are looked up with one query, and the JSON bodies
+    are encoded concurrently before the transaction starts.
+    Unlike -putRevisions:, a revision that fails doesn't roll back the others.
+    @param revs  The revisions to insert; each must already have a revision ID.
+    @param histories  The revision history of each revision, or NSNull if it has none. Must be the
+   same length as revs.
+    @return  The status of each insertion, as NSNumbers in the same order as revs. */
+- (NSArray<NSNumber*>*)forceInsertRevisions:(NSArray<TD_Revision*>*)revs
+                          revisionHistories:(NSArray*)histories
+                                     source:(NSURL*)source;
+
+/** As -forceInsertRevisions:revisionHistories:source:, calling block within the transaction after
+    each revision has been inserted, e.g. to resolve a conflict it has created. Returning an error
+    status rolls back just that revision, whose status it becomes. */
+- (NSArray<NSNumber*>*)forceInsertRevisions:(NSArray<TD_Revision*>*)revs
+                          revisionHistories:(NSArray*)histories
+                                     source:(NSURL*)source
+                                afterInsert:(TDStatus (^)(NSUInteger index, TD_Revision* rev,
+                                                          FMDatabase* db))block;
+
 /** Parses the _revisions dict from a document into an array of revision ID strings */
 + (NSArray*)parseCouchDBRevisionHistory:(NSDictionary*)docProperties;
 
@@ -49,9 +93,42 @@ typedef BOOL (^TD_ValidationBlock)(TD_Revision* newRevision, id<TD_ValidationCon
 - (void)defineValidation:(NSString*)validationName asBlock:(TD_ValidationBlock)validationBlock;
 - (TD_ValidationBlock)validationNamed:(NSString*)validationName;
 
-/** Compacts the database storage by removing the bodies and attachments of obsolete revisions. */
+/** Compacts the database storage by removing the bodies and attachments of obsolete revisions,
+    and the revisions beyond revsLimit, then gives the free pages back to the file system. The
+    file is only rewritten with a full VACUUM the first time a database created before
+    incremental vacuuming is compacted, which converts it. */
 - (TDStatus)compact;
 
+/** Gives up to `pages` free pages (all of them if 0) back to the file system with PRAGMA
+    incremental_vacuum, holding the writer connection only while it does. Does nothing to
+    databases that haven't been converted to incremental vacuuming yet.
+    @param outFreePages  On return, how many free pages are left; may be NULL. */
+- (TDStatus)incrementalVacuumPages:(int)pages freePagesLeft:(NSUInteger*)outFreePages;
+
+/** Rewrites the whole database file with VACUUM, converting it to incremental vacuuming if it
+    isn't yet. Unlike incremental vacuuming this defragments the file, but it holds the database
+    for as long as it takes and needs as much free disk space again as the file, so it's never
+    done unasked. */
+- (TDStatus)vacuum;
+
+/** Does a bounded share of the work of -compact, so it can be spread over time without blocking
+    writers for long. Revisions beyond revsLimit are deleted and revision bodies removed in short
+    transactions, then attachments are collected, then free pages are returned to the file system
+    with PRAGMA incremental_vacuum.
+    Progress is kept between calls; call it again until it reports that it has finished.
+    Databases created before incremental vacuuming was enabled only shrink after a full -compact.
+    @param timeBudget  Roughly how long the step may take; it stops after the batch in progress.
+    @param rowBudget  Maximum number of revisions to delete or bodies to remove, or 0 for no limit.
+    @param outFinished  On return, YES if there was nothing left to compact.
+    @return  kTDStatusOK, or an error status. */
+- (TDStatus)compactWithTimeBudget:(NSTimeInterval)timeBudget
+                        rowBudget:(NSUInteger)rowBudget
+                         finished:(BOOL*)outFinished;
+
+/** The fraction of the bytes of revision bodies that belong to obsolete revisions, i.e. the share
+    compaction would reclaim. Scans the revs table, so don't call it on the main thread. */
+- (double)obsoleteRevisionBodyRatio;
+
 /** Purges specific revisions, which deletes them completely from the local database _without_
    adding a "tombstone" revision. It's as though they were never there.
     @param docsToRevs  A dictionary mapping document IDs to arrays of revision IDs.
@@ -59,6 +136,12 @@ typedef BOOL (^TD_ValidationBlock)(TD_Revision* newRevision, id<TD_ValidationCon
    containing the doc/revision IDs that were actually removed. */
 - (TDStatus)purgeRevisions:(NSDictionary*)docsToRevs result:(NSDictionary**)outResult;
 
+/** As -purgeRevisions:result:, within a transaction the caller has open, adding what was removed
+    to `result`. The caller has to drop the documents from the history cache once it commits. */
+- (TDStatus)purgeRevisions:(NSDictionary*)docsToRevs
+                    result:(NSMutableDictionary*)result
+                  database:(FMDatabase*)db;
+
 /**
  Public method that should be used when you wish to make multiple putRevisions within a single
  database transation via TD_Database -inTransaction:
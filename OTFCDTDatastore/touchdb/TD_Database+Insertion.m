@@ -21,22 +21,30 @@
 #import <sqlite3.h>
 #import "TD_Database+Insertion.h"
 #import "TD_Database+Attachments.h"
+#import "TD_Database+BlobFilenames.h"
 #import "TD_Revision.h"
 #import "TDCanonicalJSON.h"
+#import "TDBinaryJSON.h"
+#import "TDBodyDelta.h"
 #import "TD_Attachment.h"
 #import "TDInternal.h"
 #import "TDMisc.h"
+#import "TDRevisionHistoryCache.h"
+#import "TDDatabaseQueue.h"
+#import "CDTQueueTelemetry.h"
 #import "Test.h"
 
 #import <fmdb/FMDatabase.h>
 #import <fmdb/FMDatabaseAdditions.h>
 #import <fmdb/FMDatabaseQueue.h>
+#import "FMDatabase+LongLong.h"
 
 #import "CDTLogging.h"
 
 #import <CommonCrypto/CommonDigest.h>
 
 NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
+NSString* const TD_DatabasePurgedNotification = @"TD_DatabasePurged";
 
 @interface TD_ValidationContext : NSObject <TD_ValidationContext> {
    @private
@@ -54,6 +62,9 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
 @property (copy) NSString* errorMessage;
 @end
 
+/** The validation status of a revision whose validations are yet to be run. */
+static const TDStatus kTDStatusNotValidated = (TDStatus)0;
+
 @implementation TD_Database (Insertion)
 
 #pragma mark - DOCUMENT & REV IDS:
@@ -67,8 +78,12 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
     // "_local/*" is not a valid document ID. Local docs have their own API and shouldn't get here.
 }
 
-/** Generates a new document ID at random. */
-+ (NSString*)generateDocumentID { return TDCreateUUID(); }
+/** Generates a new document ID, with the documentIDGenerator if there is one. */
+- (NSString*)generateDocumentID
+{
+    NSString* (^generator)(void) = self.documentIDGenerator;
+    return generator ? generator() : TDCreateUUID();
+}
 
 /** Given an existing revision ID, generates an ID for the next revision.
     Returns nil if prevID is invalid. */
@@ -148,8 +163,10 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
     This has all the special keys like "_id" stripped out. */
 - (NSData*)encodeDocumentJSON:(TD_Revision*)rev
 {
+    // Called concurrently by -putRevisions:..., so the sets must be initialised exactly once.
     static NSSet* sSpecialKeysToRemove, *sSpecialKeysToLeave;
-    if (!sSpecialKeysToRemove) {
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
         sSpecialKeysToRemove =
             [[NSSet alloc] initWithObjects:@"_id", @"_rev", @"_attachments", @"_deleted",
                                            @"_revisions", @"_revs_info", @"_conflicts",
@@ -157,7 +174,7 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
         sSpecialKeysToLeave =
             [[NSSet alloc] initWithObjects:@"_replication_id", @"_replication_state",
                                            @"_replication_state_time", @"_replication_stats", nil];
-    }
+    });
 
     NSDictionary* origProps = rev.properties;
     if (!origProps) return nil;
@@ -214,6 +231,16 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
     return nil;  // no change
 }
 
+/** Posts a single local NSNotification for several revisions committed together. */
+- (void)notifyChanges:(NSArray*)revs source:(NSURL*)source winningRevs:(NSArray*)winningRevs
+{
+    NSDictionary* userInfo =
+        $dict({ @"revs", revs }, { @"source", source }, { @"winners", winningRevs });
+    [[NSNotificationCenter defaultCenter] postNotificationName:TD_DatabaseChangeNotification
+                                                        object:self
+                                                      userInfo:userInfo];
+}
+
 /** Posts a local NSNotification of a new revision of a document. */
 - (void)notifyChange:(TD_Revision*)rev source:(NSURL*)source winningRev:(TD_Revision*)winningRev
 {
@@ -224,6 +251,133 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
                                                       userInfo:userInfo];
 }
 
+- (void)notifyPurgedDocumentIDs:(NSArray<NSString*>*)docIDs
+{
+    if (docIDs.count == 0) return;
+    [[NSNotificationCenter defaultCenter] postNotificationName:TD_DatabasePurgedNotification
+                                                        object:self
+                                                      userInfo:@{ @"docIDs" : docIDs }];
+}
+
+/** Called once some process, this one or another, has written to the database. If another one
+    did, drops what may have been cached from before the write, and posts a change notification
+    for the new leaf revisions it added. */
+- (void)noteWritesByOtherProcesses
+{
+    __block NSMutableArray* revs = nil;
+    __block NSMutableArray* winners = nil;
+    BOOL ran = [self inDatabaseIfOpen:^(FMDatabase* db) {
+        // data_version changes only when another connection commits, and all of this process's
+        // writes go through this one:
+        SInt64 dataVersion = [db longLongForQuery:@"PRAGMA data_version"];
+        if (dataVersion == self->_dataVersion) return;
+        self->_dataVersion = dataVersion;
+
+        // Leaves added since last time, except those this process inserted itself. No write
+        // transaction is open while this runs, so those are all committed or rolled back by now.
+        revs = [NSMutableArray array];
+        winners = [NSMutableArray array];
+        NSMutableArray* docNumericIDs = [NSMutableArray array];
+        FMResultSet* r = [db executeQuery:@"SELECT revs.sequence, docs.docid, revs.revid, "
+                                           "revs.deleted, revs.doc_id FROM revs, docs "
+                                           "WHERE revs.sequence > ? AND revs.current = 1 AND "
+                                           "docs.doc_id = revs.doc_id ORDER BY revs.sequence",
+                                          @(self->_otherProcessSequence)];
+        while ([r next]) {
+            SequenceNumber sequence = [r longLongIntForColumnIndex:0];
+            NSString* docID = [r stringForColumnIndex:1];
+            NSString* revID = [r stringForColumnIndex:2];
+            if ($equal(self->_revsWrittenHere[@(sequence)], (@[ docID, revID ]))) continue;
+            TD_Revision* rev = [[TD_Revision alloc] initWithDocID:docID
+                                                            revID:revID
+                                                          deleted:[r boolForColumnIndex:3]];
+            rev.sequence = sequence;
+            [revs addObject:rev];
+            [docNumericIDs addObject:@([r longLongIntForColumnIndex:4])];
+        }
+        [r close];
+        self->_otherProcessSequence = [self lastSequenceInDatabase:db];
+        [self->_revsWrittenHere removeAllObjects];
+
+        for (NSUInteger i = 0; i < revs.count; i++) {
+            BOOL deleted;
+            TD_Revision* rev = revs[i];
+            NSString* winner = [self winningRevIDOfDocNumericID:[docNumericIDs[i] longLongValue]
+                                                      isDeleted:&deleted
+                                                       database:db];
+            [winners addObject:($equal(winner, rev.revID) ? rev : [NSNull null])];
+        }
+    }];
+    if (!ran || !revs) return;
+
+    os_log_debug(CDTOSLog, "%{public}@ written to by another process; %lu new revisions", self,
+                 (unsigned long)revs.count);
+    // It may have purged or compacted revisions, garbage collected attachments, or written
+    // local documents, too:
+    [_historyCache removeAllDocuments];
+    [_localDocCache removeCleanDocuments];
+    [_blobFilenameCache removeAllFilenames];
+    if (revs.count > 0) [self notifyChanges:revs source:nil winningRevs:winners];
+}
+
+- (BOOL)storeBodyOfSequence:(SequenceNumber)sequence
+      asDeltaAgainstSequence:(SequenceNumber)baseSequence
+                    database:(FMDatabase*)db
+{
+    if (!self.storesHistoryAsDeltas) return YES;
+    // An archived body stays archived, rather than coming back into revs as a delta
+    if (_archiveAttached &&
+        [db boolForQuery:@"SELECT json = " kTDArchivedBodyMarkerSQL " FROM revs WHERE sequence=?",
+                         @(sequence)]) {
+        return YES;
+    }
+    NSData* json =
+        [db dataForQuery:@"SELECT " kTDRevsBodySQL " FROM revs WHERE sequence=?", @(sequence)];
+    NSData* base =
+        [db dataForQuery:@"SELECT " kTDRevsBodySQL " FROM revs WHERE sequence=?", @(baseSequence)];
+    if ([TDBodyDelta isDelta:json] || [TDBodyDelta isDelta:base]) return YES;
+    NSData* delta = base ? [TDBodyDelta deltaOfData:json fromBase:base baseSequence:baseSequence]
+                         : nil;
+    if (!delta) return YES;
+    // Deltas are always kept in revs; the trigger drops a body stored out of line
+    return [db executeUpdate:@"UPDATE revs SET json=? WHERE sequence=?", delta, @(sequence)];
+}
+
+// caller: -purgeRevisions:result:database:. Stores whole the bodies of the revisions that are kept
+// but are stored as deltas against revisions about to be purged.
+- (BOOL)expandDeltasOfDocNumericID:(SInt64)docNumericID
+                  basedOnSequences:(NSSet*)purgedSequences
+                          database:(FMDatabase*)db
+{
+    FMResultSet* r = [db executeQuery:@"SELECT sequence, json FROM revs "
+                                       "WHERE doc_id=? AND substr(json, 1, 1)=" kTDBodyDeltaMarkerSQL,
+                                      @(docNumericID)];
+    if (!r) return NO;
+    NSMutableDictionary* deltas = [NSMutableDictionary dictionary];
+    while ([r next]) {
+        NSNumber* sequence = @([r longLongIntForColumnIndex:0]);
+        NSData* delta = [r dataForColumnIndex:1];
+        if (![purgedSequences containsObject:sequence] &&
+            [purgedSequences containsObject:@([TDBodyDelta baseSequenceOfDelta:delta])]) {
+            deltas[sequence] = delta;
+        }
+    }
+    [r close];
+
+    // All rebuilt before any is stored, as one may be the base of another
+    NSMutableDictionary* bodies = [NSMutableDictionary dictionary];
+    for (NSNumber* sequence in deltas) {
+        bodies[sequence] = [self expandedStoredJSON:deltas[sequence] inDatabase:db] ?: [NSNull null];
+    }
+    for (NSNumber* sequence in bodies) {
+        NSData* json = $castIf(NSData, bodies[sequence]);  // NULL, as compacted, if it's lost
+        if (![db executeUpdate:@"UPDATE revs SET json=? WHERE sequence=?", json, sequence]) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
 // Raw row insertion. Returns new sequence, or 0 on error
 - (SequenceNumber)insertRevision:(TD_Revision*)rev
                     docNumericID:(SInt64)docNumericID
@@ -233,6 +387,17 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
                         database:(FMDatabase*)db
                            error:(NSError* __autoreleasing*)error
 {
+    if (json.length > 0 && self.storesBinaryBodies) {
+        // Bodies that can't be encoded are kept as JSON, which can be read just the same
+        json = [TDBinaryJSON dataWithJSONData:json] ?: json;
+    }
+    // A body kept out of line leaves the marker in revs, for kTDRevsBodySQL to find it by
+    NSUInteger threshold = self.outOfLineBodyThreshold;
+    NSData* body = nil;
+    if (threshold > 0 && json.length >= threshold) {
+        body = json;
+        json = [NSData dataWithBytes:"\0" length:1];
+    }
     if (![db executeUpdate:@"INSERT INTO revs (doc_id, revid, parent, current, deleted, json) "
                             "VALUES (?, ?, ?, ?, ?, ?)"
             withErrorAndBindings:error, @(docNumericID), rev.revID,
@@ -240,7 +405,14 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
                                  @(rev.deleted), json]) {
         return 0;
     }
-    return rev.sequence = db.lastInsertRowId;
+    rev.sequence = db.lastInsertRowId;
+    if (body && ![db executeUpdate:@"INSERT INTO bodies (sequence, json) VALUES (?, ?)"
+              withErrorAndBindings:error, @(rev.sequence), body]) {
+        return 0;
+    }
+    // So -noteWritesByOtherProcesses can tell this process's own revisions from theirs
+    if (current && _revsWrittenHere) _revsWrittenHere[@(rev.sequence)] = @[ rev.docID, rev.revID ];
+    return rev.sequence;
 }
 
 /** Public method to add a new revision of a document. */
@@ -281,26 +453,68 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
                      status:(TDStatus*)outStatus
                    database:(FMDatabase*)db
              withWinningRev:(TD_Revision**)winningRev
+{
+    return [self putRevision:rev
+              prevRevisionID:previousRevID
+               allowConflict:allowConflict
+                      status:outStatus
+                    database:db
+              withWinningRev:winningRev
+                 encodedJSON:nil
+              candidateRevID:nil
+            validationStatus:kTDStatusNotValidated];
+}
+
+/** Checks the docID and body of a revision to be put, before anything is looked up. */
+- (TDStatus)checkPutOf:(TD_Revision*)rev prevRevisionID:(NSString*)previousRevID
+{
+    BOOL deleted = rev.deleted;
+    if (!rev || (previousRevID && !rev.docID) || (deleted && !rev.docID) ||
+        (rev.docID && ![TD_Database isValidDocumentID:rev.docID]))
+        return kTDStatusBadID;
+    if (rev.body == nil && !deleted) return kTDStatusBadJSON;
+    return kTDStatusOK;
+}
+
+/** The revision a new revision replacing previousRevID is validated against. Only its IDs are
+    filled in; validation blocks load its body when they ask for it. */
+- (TD_Revision*)validationParentOf:(TD_Revision*)rev prevRevisionID:(NSString*)previousRevID
+{
+    if (!previousRevID) return nil;
+    return [[TD_Revision alloc] initWithDocID:rev.docID revID:previousRevID deleted:NO];
+}
 
+/**
+ As above, but optionally taking the output of -encodeDocumentJSON: for rev, and a revision ID
+ generated up front by -candidateRevIDForRevision:JSON:prevID:. The candidate is only used when
+ it is known to be correct, i.e. the revision has no attachments and really does replace the
+ revision the candidate was generated for. A validationStatus other than kTDStatusNotValidated
+ is the result of validating rev already, against the revision previousRevID names; it's used
+ once previousRevID is found to be current, in place of running the validations again.
+ */
+- (TD_Revision*)putRevision:(TD_Revision*)rev
+             prevRevisionID:(NSString*)previousRevID
+              allowConflict:(BOOL)allowConflict
+                     status:(TDStatus*)outStatus
+                   database:(FMDatabase*)db
+             withWinningRev:(TD_Revision**)winningRev
+                encodedJSON:(NSData*)encodedJSON
+             candidateRevID:(NSString*)candidateRevID
+           validationStatus:(TDStatus)validationStatus
 {
+    NSString* requestedPrevRevID = previousRevID;
     os_log_info(CDTOSLog, "PUT rev=%{public}@, prevRevID=%{public}@, allowConflict=%{public}d", rev,
                 previousRevID, allowConflict);
     Assert(outStatus);
 
     BOOL deleted = rev.deleted;
 
-    if (!rev || (previousRevID && !rev.docID) || (deleted && !rev.docID) ||
-        (rev.docID && ![TD_Database isValidDocumentID:rev.docID])) {
-        *outStatus = kTDStatusBadID;
-        return nil;
-    }
-
-    if (rev.body == nil && !deleted) {
-        *outStatus = kTDStatusBadJSON;
+    TDStatus status = [self checkPutOf:rev prevRevisionID:previousRevID];
+    if (TDStatusIsError(status)) {
+        *outStatus = status;
         return nil;
     }
 
-    TDStatus status;
     NSString* docID = rev.docID;
 
     //// PART I: In which are performed lookups and validations prior to the insert...
@@ -338,11 +552,13 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
             return nil;
         }
 
-        if (_validations.count > 0) {
+        if (validationStatus != kTDStatusNotValidated || _validations.count > 0) {
             // Fetch the previous revision and validate the new one against it:
-            TD_Revision* prevRev =
-                [[TD_Revision alloc] initWithDocID:docID revID:previousRevID deleted:NO];
-            status = [self validateRevision:rev previousRevision:prevRev];
+            status = validationStatus;
+            if (status == kTDStatusNotValidated) {
+                TD_Revision* prevRev = [self validationParentOf:rev prevRevisionID:previousRevID];
+                status = [self validateRevision:rev previousRevision:prevRev];
+            }
             if (TDStatusIsError(status)) {
                 *outStatus = status;
                 return nil;
@@ -360,7 +576,9 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
         }
 
         // Validate:
-        status = [self validateRevision:rev previousRevision:nil];
+        status = validationStatus;
+        if (status == kTDStatusNotValidated)
+            status = [self validateRevision:rev previousRevision:nil];
         if (TDStatusIsError(status)) {
             *outStatus = status;
             return nil;
@@ -395,7 +613,7 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
             }
         } else {
             // Inserting first revision, with no docID given (POST): generate a unique docID:
-            docID = [[self class] generateDocumentID];
+            docID = [self generateDocumentID];
             NSError* error = nil;
             docNumericID = [self insertDocumentID:docID inDatabase:db error:&error];
             if (error) {
@@ -420,15 +638,22 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
     // Bump the revID and update the JSON:
     NSData* json = nil;
     if (rev.properties) {
-        json = [self encodeDocumentJSON:rev];
+        json = encodedJSON ?: [self encodeDocumentJSON:rev];
         if (!json) {
             *outStatus = kTDStatusBadJSON;
             return nil;
         }
         if (json.length == 2 && memcmp(json.bytes, "{}", 2) == 0) json = nil;
     }
-    NSString* newRevID =
-        [self generateIDForRevision:rev withJSON:json attachments:attachments prevID:previousRevID];
+    NSString* newRevID = nil;
+    if (candidateRevID && attachments.count == 0 && $equal(previousRevID, requestedPrevRevID)) {
+        newRevID = candidateRevID;
+    } else {
+        newRevID = [self generateIDForRevision:rev
+                                      withJSON:json
+                                   attachments:attachments
+                                        prevID:previousRevID];
+    }
     if (!newRevID) {
         *outStatus = kTDStatusBadID;  // invalid previous revID (no numeric prefix)
         return nil;
@@ -471,7 +696,8 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
 
     // Make replaced rev non-current:
     if (parentSequence > 0) {
-        if (![db executeUpdate:@"UPDATE revs SET current=0 WHERE sequence=?", @(parentSequence)]) {
+        if (![db executeUpdate:@"UPDATE revs SET current=0 WHERE sequence=?", @(parentSequence)] ||
+            ![self storeBodyOfSequence:parentSequence asDeltaAgainstSequence:sequence database:db]) {
             if (db.lastErrorCode == SQLITE_FULL) {
                 *outStatus = kTDStatusInsufficientStorage;
             } else {
@@ -491,6 +717,12 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
         return nil;
     }
 
+    if (![self updateConflictsForDocNumericID:docNumericID database:db] ||
+        ![self stemRevisionsAfterInserting:rev docNumericID:docNumericID database:db]) {
+        *outStatus = kTDStatusDBError;
+        return nil;
+    }
+
     // Success!
     *outStatus = deleted ? kTDStatusOK : kTDStatusCreated;
 
@@ -512,63 +744,407 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
               allowConflict:(BOOL)allowConflict
                      status:(TDStatus*)outStatus
 {
+    CDTQueueOperationScope(CDTQueueOperationPut);
     // Reassign variables passed in that we (possibly) modify to __block variables.
     __block TD_Revision* winningRev = nil;
     __block TD_Revision* newRev = nil;
 
     *outStatus =
         kTDStatusDBError;  // default error is Internal Server Error, if we return nil below
+    os_signpost_id_t signpost = CDTSignpostIDGenerate();
+    CDTSignpostIntervalBegin(signpost, "putRevision");
+
+    // Encoding the body and digesting it into the new revision ID don't touch the database, so do
+    // them before taking the write lock rather than while other writers wait on it. The candidate
+    // ID is only used if previousRevID turns out to be current and there are no attachments.
+    BOOL wellFormed = !TDStatusIsError([self checkPutOf:revToInsert prevRevisionID:previousRevID]);
+    NSData* json = nil;
+    NSString* candidateRevID = nil;
+    if (wellFormed) {
+        json = revToInsert.properties ? [self encodeDocumentJSON:revToInsert] : nil;
+        candidateRevID =
+            [self candidateRevIDForRevision:revToInsert JSON:json prevID:previousRevID];
+    }
+
+    // Validate ahead of taking the write lock, if asked to; the transaction still checks that
+    // previousRevID is current before the result is used.
+    TDStatus validationStatus = kTDStatusNotValidated;
+    if (self.validatesConcurrently && _validations.count > 0 && wellFormed) {
+        TD_Revision* prevRev = [self validationParentOf:revToInsert prevRevisionID:previousRevID];
+        validationStatus = [[self validateRevisionsConcurrently:@[ revToInsert ]
+                                              previousRevisions:@[ prevRev ?: [NSNull null] ]][0]
+            intValue];
+    }
+
     __weak TD_Database* weakSelf = self;
-    [_fmdbQueue inTransaction:^(FMDatabase* db, BOOL* rollback) {
+    // Through -inTransaction:, so that single writes can be group committed
+    TDStatus status = [self inTransaction:^TDStatus(FMDatabase* db) {
         TD_Database* strongSelf = weakSelf;
         newRev = [strongSelf putRevision:revToInsert
                           prevRevisionID:previousRevID
                            allowConflict:allowConflict
                                   status:outStatus
                                 database:db
-                          withWinningRev:&winningRev];
-
-        bool success = (*outStatus < 300);
-        if (!success) {
-            *rollback = !success;
-        }
+                          withWinningRev:&winningRev
+                             encodedJSON:json
+                          candidateRevID:candidateRevID
+                        validationStatus:validationStatus];
+        return *outStatus;
     }];
+    if (TDStatusIsError(status)) *outStatus = status;
 
-    if (TDStatusIsError(*outStatus)) return nil;
+    if (TDStatusIsError(*outStatus)) {
+        CDTSignpostIntervalEnd(signpost, "putRevision", "status=%d", *outStatus);
+        return nil;
+    }
 
     //// EPILOGUE: A change notification is sent...
     [self notifyChange:newRev source:nil winningRev:winningRev];
+    CDTSignpostIntervalEnd(signpost, "putRevision", "status=%d", *outStatus);
     return newRev;
 }
 
-/** Public method to add an existing revision of a document (probably being pulled). */
+/** Generates the revision ID rev would get if it has no attachments and replaces prevID. Returns nil
+    if the revision can't be known up front (it has attachments, or its JSON is invalid). */
+- (NSString*)candidateRevIDForRevision:(TD_Revision*)rev
+                                  JSON:(NSData*)json
+                                prevID:(NSString*)prevID
+{
+    if (rev[@"_attachments"] || (rev.properties && !json)) return nil;
+    if (json.length == 2 && memcmp(json.bytes, "{}", 2) == 0) json = nil;
+    return [self generateIDForRevision:rev withJSON:json attachments:nil prevID:prevID];
+}
+
+/** Public method to add several new revisions in a single transaction. */
+- (NSArray<TD_Revision*>*)putRevisions:(NSArray<TD_Revision*>*)revisions
+                       prevRevisionIDs:(NSArray*)prevRevIDs
+                         allowConflict:(BOOL)allowConflict
+                           afterInsert:(TDStatus (^)(NSUInteger index, TD_Revision* newRev,
+                                                     FMDatabase* db))block
+                                status:(TDStatus*)outStatus
+                           failedIndex:(NSUInteger*)outFailedIndex
+{
+    CDTQueueOperationScope(CDTQueueOperationPut);
+    Assert(outStatus);
+    Assert(!prevRevIDs || prevRevIDs.count == revisions.count);
+    NSUInteger count = revisions.count;
+    if (count == 0) {
+        *outStatus = kTDStatusOK;
+        return @[];
+    }
+    os_signpost_id_t signpost = CDTSignpostIDGenerate();
+    CDTSignpostIntervalBegin(signpost, "putRevisions", "count=%lu", (unsigned long)count);
+
+    // Canonical JSON encoding and SHA256 digests dominate the cost of an insert and don't touch
+    // the database, so do them concurrently before entering the (serial) transaction:
+    NSMutableArray* jsons = [NSMutableArray arrayWithCapacity:count];
+    NSMutableArray* candidateRevIDs = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [jsons addObject:[NSNull null]];
+        [candidateRevIDs addObject:[NSNull null]];
+    }
+    dispatch_apply(count, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^(size_t i) {
+        @autoreleasepool
+        {
+            TD_Revision* rev = revisions[i];
+            NSString* prevRevID = $castIf(NSString, prevRevIDs[i]);
+            NSData* json = rev.properties ? [self encodeDocumentJSON:rev] : nil;
+            NSString* revID = [self candidateRevIDForRevision:rev JSON:json prevID:prevRevID];
+            @synchronized(jsons)
+            {
+                if (json) jsons[i] = json;
+                if (revID) candidateRevIDs[i] = revID;
+            }
+        }
+    });
+
+    // So can validation, if it's been asked for: each revision is checked against the one it
+    // replaces, which the transaction then confirms is still current.
+    NSArray* validationStatuses = nil;
+    if (self.validatesConcurrently && _validations.count > 0) {
+        NSMutableArray* toValidate = [NSMutableArray arrayWithCapacity:count];
+        NSMutableArray* prevRevs = [NSMutableArray arrayWithCapacity:count];
+        for (NSUInteger i = 0; i < count; i++) {
+            TD_Revision* rev = revisions[i];
+            NSString* prevRevID = $castIf(NSString, prevRevIDs[i]);
+            BOOL valid = !TDStatusIsError([self checkPutOf:rev prevRevisionID:prevRevID]);
+            TD_Revision* prevRev = [self validationParentOf:rev prevRevisionID:prevRevID];
+            [toValidate addObject:(valid ? rev : [NSNull null])];
+            [prevRevs addObject:(prevRev ?: [NSNull null])];
+        }
+        validationStatuses = [self validateRevisionsConcurrently:toValidate
+                                               previousRevisions:prevRevs];
+    }
+
+    __block NSMutableArray* newRevs = [NSMutableArray arrayWithCapacity:count];
+    __block NSMutableArray* winningRevs = [NSMutableArray arrayWithCapacity:count];
+    __block NSUInteger failedIndex = NSNotFound;
+    *outStatus = kTDStatusDBError;
+    __weak TD_Database* weakSelf = self;
+    [_fmdbQueue inTransaction:^(FMDatabase* db, BOOL* rollback) {
+        TD_Database* strongSelf = weakSelf;
+        *rollback = YES;
+        for (NSUInteger i = 0; i < count; i++) {
+            @autoreleasepool
+            {
+                TD_Revision* winningRev = nil;
+                TD_Revision* newRev =
+                    [strongSelf putRevision:revisions[i]
+                             prevRevisionID:$castIf(NSString, prevRevIDs[i])
+                              allowConflict:allowConflict
+                                     status:outStatus
+                                   database:db
+                             withWinningRev:&winningRev
+                                encodedJSON:$castIf(NSData, jsons[i])
+                             candidateRevID:$castIf(NSString, candidateRevIDs[i])
+                           validationStatus:(validationStatuses
+                                                 ? (TDStatus)[validationStatuses[i] intValue]
+                                                 : kTDStatusNotValidated)];
+                if (TDStatusIsError(*outStatus) || !newRev) {
+                    // A nil revision with an OK status is a duplicate insert; treat it as a
+                    // conflict as the caller can't be given a revision back.
+                    if (!TDStatusIsError(*outStatus)) *outStatus = kTDStatusConflict;
+                    failedIndex = i;
+                    return;
+                }
+                if (block) {
+                    TDStatus status = block(i, newRev, db);
+                    if (TDStatusIsError(status)) {
+                        *outStatus = status;
+                        failedIndex = i;
+                        return;
+                    }
+                }
+                [newRevs addObject:newRev];
+                [winningRevs addObject:(winningRev ?: [NSNull null])];
+            }
+        }
+        *outStatus = kTDStatusOK;
+        *rollback = NO;
+    }];
+
+    if (TDStatusIsError(*outStatus)) {
+        if (outFailedIndex) *outFailedIndex = failedIndex;
+        CDTSignpostIntervalEnd(signpost, "putRevisions", "status=%d", *outStatus);
+        return nil;
+    }
+
+    //// EPILOGUE: A single change notification is sent for the whole batch...
+    [self notifyChanges:newRevs source:nil winningRevs:winningRevs];
+    CDTSignpostIntervalEnd(signpost, "putRevisions", "status=%d", *outStatus);
+    return newRevs;
+}
+
+/** Runs a transaction that force-inserts revisions. With kTDDurabilityBulkLoad, foreign key
+    constraints aren't checked while it runs. */
+- (void)inForceInsertTransaction:(void (^)(FMDatabase* db, BOOL* rollback))block
+{
+    TDDatabaseQueue* queue = $castIf(TDDatabaseQueue, _fmdbQueue);
+    if (self.durability == kTDDurabilityBulkLoad && queue) {
+        [queue inTransactionWithoutForeignKeyChecks:block];
+    } else {
+        [_fmdbQueue inTransaction:block];
+    }
+}
+
+/** Checks the docID, revID and history of a revision to be force-inserted, filling in the
+    history if it's missing. */
+- (TDStatus)checkForceInsertOf:(TD_Revision*)rev revisionHistory:(NSArray**)ioHistory
+{
+    NSString* revID = rev.revID;
+    if (![TD_Database isValidDocumentID:rev.docID] || !revID) return kTDStatusBadID;
+    NSArray* history = *ioHistory;
+    if (history.count == 0)
+        *ioHistory = @[ revID ];
+    else if (!$equal(history[0], revID))
+        return kTDStatusBadID;
+    return kTDStatusOK;
+}
+
+/** The latest common ancestor of a revision to be force-inserted, which it's validated against:
+    the newest revision of its history that's known locally, or nil if there's none. */
+- (TD_Revision*)validationParentOf:(TD_Revision*)rev
+                   revisionHistory:(NSArray*)history
+                         localRevs:(TD_RevisionList*)localRevs
+{
+    for (NSUInteger i = 1; i < history.count; ++i) {
+        TD_Revision* oldRev = [localRevs revWithDocID:rev.docID revID:history[i]];
+        if (oldRev) return oldRev;
+    }
+    return nil;
+}
+
+/** Only call from within a queued transaction.
+    The body of -forceInsert:revisionHistory:source:, given the document's row-id and all its
+    locally-known revisions (or a docNumericID <= 0 if the document doesn't exist yet), and
+    optionally the already-encoded JSON of rev and the result of validating it against its latest
+    common ancestor in localRevs. Returns kTDStatusCreated on success, in which case the caller
+    must commit; on failure, the caller must roll back. */
 - (TDStatus)forceInsert:(TD_Revision*)rev
         revisionHistory:(NSArray*)history  // in *reverse* order, starting with rev's revID
-                 source:(NSURL*)source
+           docNumericID:(SInt64)docNumericID
+              localRevs:(TD_RevisionList*)localRevs
+            encodedJSON:(NSData*)encodedJSON
+       validationStatus:(TDStatus)validationStatus
+               database:(FMDatabase*)db
+             winningRev:(TD_Revision**)outWinningRev
 {
     NSString* docID = rev.docID;
-    NSString* revID = rev.revID;
-    if (![TD_Database isValidDocumentID:docID] || !revID) return kTDStatusBadID;
-
+    NSUInteger limit = self.revsLimit;
+    if (limit > 0 && history.count > limit) {
+        // Ancestors beyond the limit would only be stemmed again, unless they're needed to reach
+        // the newest revision known here and join rev to the local tree rather than start a
+        // second one beside it
+        NSUInteger keep = limit;
+        for (NSUInteger i = 1; i < history.count; ++i) {
+            if ([localRevs revWithDocID:docID revID:history[i]]) {
+                keep = MAX(keep, i + 1);
+                break;
+            }
+        }
+        history = [history subarrayWithRange:NSMakeRange(0, keep)];
+    }
     NSUInteger historyCount = history.count;
-    if (historyCount == 0) {
-        history = @[ revID ];
-        historyCount = 1;
-    } else if (!$equal(history[0], revID))
-        return kTDStatusBadID;
 
+    if (docNumericID <= 0) {
+        docNumericID = [self insertDocumentID:docID inDatabase:db error:NULL];
+        if (docNumericID <= 0) {
+            return db.lastErrorCode == SQLITE_FULL ? kTDStatusInsufficientStorage
+                                                   : kTDStatusDBError;
+        }
+    }
+
+    // Validate against the latest common ancestor:
+    if (validationStatus == kTDStatusNotValidated && _validations.count > 0) {
+        TD_Revision* oldRev =
+            [self validationParentOf:rev revisionHistory:history localRevs:localRevs];
+        validationStatus = [self validateRevision:rev previousRevision:oldRev];
+    }
+    if (TDStatusIsError(validationStatus)) return validationStatus;
+
+    // Look up which rev is the winner, before this insertion
+    // OPT: This rev ID could be cached in the 'docs' row
+    BOOL oldWinnerWasDeletion;
+    NSString* oldWinningRevID = [self winningRevIDOfDocNumericID:docNumericID
+                                                       isDeleted:&oldWinnerWasDeletion
+                                                        database:db];
+
+    // Walk through the remote history in chronological order, matching each revision ID to
+    // a local revision. When the list diverges, start creating blank local revisions to
+    // fill
+    // in the local history:
+    SequenceNumber sequence = 0;
+    SequenceNumber localParentSequence = 0;
+    for (NSInteger i = historyCount - 1; i >= 0; --i) {
+        NSString* revID = history[i];
+        TD_Revision* localRev = [localRevs revWithDocID:docID revID:revID];
+        if (localRev) {
+            // This revision is known locally. Remember its sequence as the parent of the
+            // next one:
+            sequence = localRev.sequence;
+            Assert(sequence > 0);
+            localParentSequence = sequence;
+
+        } else {
+            // This revision isn't known, so add it:
+            TD_Revision* newRev;
+            NSData* json = nil;
+            BOOL current = NO;
+            if (i == 0) {
+                // Hey, this is the leaf revision we're inserting:
+                newRev = rev;
+                json = encodedJSON ?: [self encodeDocumentJSON:rev];
+                if (!json) return kTDStatusBadJSON;
+                current = YES;
+            } else {
+                // It's an intermediate parent, so insert a stub:
+                newRev = [[TD_Revision alloc] initWithDocID:docID revID:revID deleted:NO];
+            }
+
+            // Insert it:
+            sequence = [self insertRevision:newRev
+                               docNumericID:docNumericID
+                             parentSequence:sequence
+                                    current:current
+                                       JSON:json
+                                   database:db
+                                      error:NULL];
+            if (sequence <= 0) {
+                return db.lastErrorCode == SQLITE_FULL ? kTDStatusInsufficientStorage
+                                                       : kTDStatusDBError;
+            }
+            newRev.sequence = sequence;
+
+            if (i == 0) {
+                // Write any changed attachments for the new revision. As the parent
+                // sequence use
+                // the latest local revision (this is to copy attachments from):
+                TDStatus status;
+                NSDictionary* attachments =
+                    [self attachmentsFromRevision:rev inDatabase:db status:&status];
+                if (attachments)
+                    status = [self processAttachments:attachments
+                                          forRevision:rev
+                                   withParentSequence:localParentSequence
+                                           inDatabase:db];
+                if (!TDStatusIsError(status) && rev.pendingAttachments.count > 0)
+                    status = [self addPendingAttachmentDownloads:rev.pendingAttachments
+                                                     forSequence:sequence
+                                                      inDatabase:db];
+                if (TDStatusIsError(status)) return status;
+            }
+        }
+    }
+
+    // Mark the latest local rev as no longer current:
+    if (localParentSequence > 0 && localParentSequence != sequence) {
+        if (![db executeUpdate:@"UPDATE revs SET current=0 WHERE sequence=?",
+                               @(localParentSequence)] ||
+            ![self storeBodyOfSequence:localParentSequence
+                asDeltaAgainstSequence:sequence
+                              database:db]) {
+            return db.lastErrorCode == SQLITE_FULL ? kTDStatusInsufficientStorage
+                                                   : kTDStatusDBError;
+        }
+    }
+
+    if (![self updateConflictsForDocNumericID:docNumericID database:db] ||
+        ![self stemRevisionsAfterInserting:rev docNumericID:docNumericID database:db]) {
+        return db.lastErrorCode == SQLITE_FULL ? kTDStatusInsufficientStorage : kTDStatusDBError;
+    }
+
+    // Figure out what the new winning rev ID is:
+    *outWinningRev = [self winnerWithDocID:docNumericID
+                                 oldWinner:oldWinningRevID
+                                oldDeleted:oldWinnerWasDeletion
+                                    newRev:rev
+                                  database:db];
+    return kTDStatusCreated;
+}
+
+/** Public method to add an existing revision of a document (probably being pulled). */
+- (TDStatus)forceInsert:(TD_Revision*)rev
+        revisionHistory:(NSArray*)history  // in *reverse* order, starting with rev's revID
+                 source:(NSURL*)source
+{
+    CDTQueueOperationScope(CDTQueueOperationForceInsert);
+    TDStatus status = [self checkForceInsertOf:rev revisionHistory:&history];
+    if (TDStatusIsError(status)) return status;
+
+    os_signpost_id_t signpost = CDTSignpostIDGenerate();
+    CDTSignpostIntervalBegin(signpost, "forceInsert");
     __block TD_Revision* winningRev = nil;
     __block TDStatus result = kTDStatusCreated;
     __weak TD_Database* weakSelf = self;
-    [_fmdbQueue inTransaction:^(FMDatabase* db, BOOL* rollback) {
+    [self inForceInsertTransaction:^(FMDatabase* db, BOOL* rollback) {
         TD_Database* strongSelf = weakSelf;
         BOOL success = NO;
         @try {
             // First look up the document's row-id and all locally-known revisions of it:
             TD_RevisionList* localRevs = nil;
-            SInt64 docNumericID = [strongSelf getDocNumericID:docID database:db];
+            SInt64 docNumericID = [strongSelf getDocNumericID:rev.docID database:db];
             if (docNumericID > 0) {
-                localRevs = [strongSelf getAllRevisionsOfDocumentID:docID
+                localRevs = [strongSelf getAllRevisionsOfDocumentID:rev.docID
                                                           numericID:docNumericID
                                                         onlyCurrent:NO
                                                      excludeDeleted:NO
@@ -577,150 +1153,339 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
                     result = kTDStatusDBError;
                     return;
                 }
-            } else {
-                docNumericID = [strongSelf insertDocumentID:docID inDatabase:db error:NULL];
-                if (docNumericID <= 0) {
-                    if (db.lastErrorCode == SQLITE_FULL)
-                        result = kTDStatusInsufficientStorage;
-                    else
-                        result = kTDStatusDBError;
-                    return;
-                }
             }
 
-            // Validate against the latest common ancestor:
-            if (self->_validations.count > 0) {
-                TD_Revision* oldRev = nil;
-                for (NSUInteger i = 1; i < historyCount; ++i) {
-                    oldRev = [localRevs revWithDocID:docID revID:history[i]];
-                    if (oldRev) break;
-                }
-                TDStatus status = [strongSelf validateRevision:rev previousRevision:oldRev];
-                if (TDStatusIsError(status)) {
-                    result = status;
-                    return;
-                }
+            result = [strongSelf forceInsert:rev
+                             revisionHistory:history
+                                docNumericID:docNumericID
+                                   localRevs:localRevs
+                                 encodedJSON:nil
+                            validationStatus:kTDStatusNotValidated
+                                    database:db
+                                  winningRev:&winningRev];
+            success = !TDStatusIsError(result);
+        }
+        @finally { *rollback = !success; }
+    }];
+
+    // Notify and return:
+    [self notifyChange:rev source:source winningRev:winningRev];
+    CDTSignpostIntervalEnd(signpost, "forceInsert", "status=%d", result);
+    return result;
+}
+
+/** Only call from within a queued transaction.
+    Looks up the row-ids and all locally-known revisions of a set of documents in one query,
+    returning a dictionary mapping each docID to @[ docNumericID, TD_RevisionList ]. Documents
+    that don't exist locally are absent. Returns nil on a database error. */
+- (NSDictionary*)getAllRevisionsOfDocumentIDs:(NSArray*)docIDs database:(FMDatabase*)db
+{
+    NSMutableArray* args = [NSMutableArray arrayWithCapacity:docIDs.count];
+    NSString* sql = $sprintf(@"SELECT docs.docid, docs.doc_id, revs.sequence, revs.revid, "
+                              "revs.deleted FROM docs LEFT JOIN revs ON revs.doc_id = docs.doc_id "
+                              "WHERE docs.docid IN (%@) ORDER BY revs.sequence DESC",
+                             [TD_Database placeholdersForStrings:docIDs arguments:args]);
+    FMResultSet* r = [db executeQuery:sql withArgumentsInArray:args];
+    if (!r) return nil;
+
+    NSMutableDictionary* result = [NSMutableDictionary dictionaryWithCapacity:docIDs.count];
+    while ([r next]) {
+        @autoreleasepool
+        {
+            NSString* docID = [r stringForColumnIndex:0];
+            NSArray* entry = result[docID];
+            if (!entry) {
+                entry = @[ @([r longLongIntForColumnIndex:1]), [[TD_RevisionList alloc] init] ];
+                result[docID] = entry;
             }
+            if ([r columnIndexIsNull:2]) continue;  // a document with no revisions
+            TD_Revision* rev = [[TD_Revision alloc] initWithDocID:docID
+                                                            revID:[r stringForColumnIndex:3]
+                                                          deleted:[r boolForColumnIndex:4]];
+            rev.sequence = [r longLongIntForColumnIndex:2];
+            [entry[1] addRev:rev];
+        }
+    }
+    [r close];
+    return result;
+}
 
-            // Look up which rev is the winner, before this insertion
-            // OPT: This rev ID could be cached in the 'docs' row
-            BOOL oldWinnerWasDeletion;
-            NSString* oldWinningRevID = [strongSelf winningRevIDOfDocNumericID:docNumericID
-                                                                     isDeleted:&oldWinnerWasDeletion
-                                                                      database:db];
-
-            // Walk through the remote history in chronological order, matching each revision ID to
-            // a local revision. When the list diverges, start creating blank local revisions to
-            // fill
-            // in the local history:
-            SequenceNumber sequence = 0;
-            SequenceNumber localParentSequence = 0;
-            for (NSInteger i = historyCount - 1; i >= 0; --i) {
-                NSString* revID = history[i];
-                TD_Revision* localRev = [localRevs revWithDocID:docID revID:revID];
-                if (localRev) {
-                    // This revision is known locally. Remember its sequence as the parent of the
-                    // next one:
-                    sequence = localRev.sequence;
-                    Assert(sequence > 0);
-                    localParentSequence = sequence;
+/** Public method to add several existing revisions (probably being pulled) in one transaction. */
+- (NSArray<NSNumber*>*)forceInsertRevisions:(NSArray<TD_Revision*>*)revs
+                          revisionHistories:(NSArray*)histories
+                                     source:(NSURL*)source
+{
+    return [self forceInsertRevisions:revs revisionHistories:histories source:source afterInsert:nil];
+}
 
-                } else {
-                    // This revision isn't known, so add it:
-                    TD_Revision* newRev;
-                    NSData* json = nil;
-                    BOOL current = NO;
-                    if (i == 0) {
-                        // Hey, this is the leaf revision we're inserting:
-                        newRev = rev;
-                        json = [strongSelf encodeDocumentJSON:rev];
-                        if (!json) {
-                            result = kTDStatusBadJSON;
-                            return;
-                        }
-                        current = YES;
-                    } else {
-                        // It's an intermediate parent, so insert a stub:
-                        newRev = [[TD_Revision alloc] initWithDocID:docID revID:revID deleted:NO];
-                    }
+- (NSArray<NSNumber*>*)forceInsertRevisions:(NSArray<TD_Revision*>*)revs
+                          revisionHistories:(NSArray*)histories
+                                     source:(NSURL*)source
+                                afterInsert:(TDStatus (^)(NSUInteger index, TD_Revision* rev,
+                                                          FMDatabase* db))block
+{
+    CDTQueueOperationScope(CDTQueueOperationForceInsert);
+    Assert(histories.count == revs.count);
+    NSUInteger count = revs.count;
+    if (count == 0) return @[];
+    os_signpost_id_t signpost = CDTSignpostIDGenerate();
+    CDTSignpostIntervalBegin(signpost, "forceInsertRevisions", "count=%lu", (unsigned long)count);
+
+    NSMutableArray* statuses = [NSMutableArray arrayWithCapacity:count];
+    NSMutableArray* checkedHistories = [NSMutableArray arrayWithCapacity:count];
+    NSMutableArray* jsons = [NSMutableArray arrayWithCapacity:count];
+    NSMutableOrderedSet* docIDs = [NSMutableOrderedSet orderedSetWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        NSArray* history = $castIf(NSArray, histories[i]);
+        TDStatus status = [self checkForceInsertOf:revs[i] revisionHistory:&history];
+        [statuses addObject:@(status)];
+        [checkedHistories addObject:(history ?: [NSNull null])];
+        [jsons addObject:[NSNull null]];
+        if (!TDStatusIsError(status)) [docIDs addObject:revs[i].docID];
+    }
 
-                    // Insert it:
-                    sequence = [strongSelf insertRevision:newRev
-                                             docNumericID:docNumericID
-                                           parentSequence:sequence
-                                                  current:current
-                                                     JSON:json
-                                                 database:db
-                                                    error:NULL];
-                    if (sequence <= 0) {
-                        if (db.lastErrorCode == SQLITE_FULL)
-                            result = kTDStatusInsufficientStorage;
-                        else
-                            result = kTDStatusDBError;
-                        return;
-                    }
-                    newRev.sequence = sequence;
-
-                    if (i == 0) {
-                        // Write any changed attachments for the new revision. As the parent
-                        // sequence use
-                        // the latest local revision (this is to copy attachments from):
-                        TDStatus status;
-                        NSDictionary* attachments =
-                            [strongSelf attachmentsFromRevision:rev inDatabase:db status:&status];
-                        if (attachments)
-                            status = [strongSelf processAttachments:attachments
-                                                        forRevision:rev
-                                                 withParentSequence:localParentSequence
-                                                         inDatabase:db];
-                        if (TDStatusIsError(status)) {
-                            result = status;
-                            return;
-                        }
-                    }
+    // Encode the JSON bodies concurrently before entering the (serial) transaction, as
+    // -putRevisions: does:
+    dispatch_apply(count, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^(size_t i) {
+        @autoreleasepool
+        {
+            if (TDStatusIsError([statuses[i] intValue])) return;
+            NSData* json = [self encodeDocumentJSON:revs[i]];
+            if (json) {
+                @synchronized(jsons) { jsons[i] = json; }
+            }
+        }
+    });
+
+    // Validate the batch concurrently too, if asked to, against each document's latest common
+    // ancestor as of now. Only a document's first revision in the batch can be: later ones may
+    // descend from it. The transaction validates again any whose ancestor has changed since.
+    NSArray* validationStatuses = nil;
+    NSMutableArray* validationParents = nil;
+    if (self.validatesConcurrently && _validations.count > 0 && docIDs.count > 0) {
+        __block NSDictionary* localDocs = nil;
+        [self inReadTransaction:^(FMDatabase* db) {
+            localDocs = [self getAllRevisionsOfDocumentIDs:docIDs.array database:db];
+        }];
+        if (localDocs) {
+            NSMutableArray* toValidate = [NSMutableArray arrayWithCapacity:count];
+            validationParents = [NSMutableArray arrayWithCapacity:count];
+            NSMutableSet* seenDocIDs = [NSMutableSet set];
+            for (NSUInteger i = 0; i < count; i++) {
+                TD_Revision* rev = revs[i];
+                TD_Revision* parent = nil;
+                BOOL first = !TDStatusIsError([statuses[i] intValue]) &&
+                             ![seenDocIDs containsObject:rev.docID];
+                if (first) {
+                    [seenDocIDs addObject:rev.docID];
+                    parent = [self validationParentOf:rev
+                                      revisionHistory:checkedHistories[i]
+                                            localRevs:localDocs[rev.docID][1]];
                 }
+                [toValidate addObject:(first ? rev : [NSNull null])];
+                [validationParents addObject:(parent ?: [NSNull null])];
             }
+            validationStatuses = [self validateRevisionsConcurrently:toValidate
+                                                   previousRevisions:validationParents];
+        }
+    }
 
-            // Mark the latest local rev as no longer current:
-            if (localParentSequence > 0 && localParentSequence != sequence) {
-                if (![db executeUpdate:@"UPDATE revs SET current=0 WHERE sequence=?",
-                                       @(localParentSequence)]) {
-                    if (db.lastErrorCode == SQLITE_FULL)
-                        result = kTDStatusInsufficientStorage;
-                    else
-                        result = kTDStatusDBError;
-                    return;
-                }
+    NSMutableArray* newRevs = [NSMutableArray arrayWithCapacity:count];
+    NSMutableArray* winningRevs = [NSMutableArray arrayWithCapacity:count];
+    __weak TD_Database* weakSelf = self;
+    [self inForceInsertTransaction:^(FMDatabase* db, BOOL* rollback) {
+        TD_Database* strongSelf = weakSelf;
+        // Look up every document's local revisions at once, rather than with two queries per
+        // revision:
+        NSMutableDictionary* localDocs = [[strongSelf getAllRevisionsOfDocumentIDs:docIDs.array
+                                                                          database:db] mutableCopy];
+        if (!localDocs) {
+            for (NSUInteger i = 0; i < count; i++) {
+                if (!TDStatusIsError([statuses[i] intValue])) statuses[i] = @(kTDStatusDBError);
             }
+            *rollback = YES;
+            return;
+        }
+        NSMutableSet* insertedDocIDs = [NSMutableSet set];
+
+        for (NSUInteger i = 0; i < count; i++) {
+            if (TDStatusIsError([statuses[i] intValue])) continue;
+            @autoreleasepool
+            {
+                TD_Revision* rev = revs[i];
+                NSString* docID = rev.docID;
+
+                // The batch lookup is stale for a document already written in this batch, so look
+                // it up again:
+                SInt64 docNumericID = 0;
+                TD_RevisionList* localRevs = nil;
+                NSArray* entry = localDocs[docID];
+                if (entry) {
+                    docNumericID = [entry[0] longLongValue];
+                    localRevs = entry[1];
+                } else if ([insertedDocIDs containsObject:docID]) {
+                    docNumericID = [strongSelf getDocNumericID:docID database:db];
+                    if (docNumericID > 0) {
+                        localRevs = [strongSelf getAllRevisionsOfDocumentID:docID
+                                                                  numericID:docNumericID
+                                                                onlyCurrent:NO
+                                                             excludeDeleted:NO
+                                                                   database:db];
+                    }
+                }
 
-            // Figure out what the new winning rev ID is:
-            winningRev = [strongSelf winnerWithDocID:docNumericID
-                                           oldWinner:oldWinningRevID
-                                          oldDeleted:oldWinnerWasDeletion
-                                              newRev:rev
-                                            database:db];
+                // A revision validated up front only needs its ancestor to be the same one:
+                TDStatus validationStatus = kTDStatusNotValidated;
+                if (validationStatuses) {
+                    TD_Revision* parent = [strongSelf validationParentOf:rev
+                                                         revisionHistory:checkedHistories[i]
+                                                               localRevs:localRevs];
+                    if ($equal(parent.revID, $castIf(TD_Revision, validationParents[i]).revID))
+                        validationStatus = [validationStatuses[i] intValue];
+                }
 
-            success = YES;
+                // Each revision gets its own savepoint, so that one which fails (e.g. validation)
+                // is rolled back without losing the rest of the batch:
+                TDStatus status = kTDStatusDBError;
+                TD_Revision* winningRev = nil;
+                if ((docNumericID <= 0 || localRevs) &&
+                    [db executeUpdate:@"SAVEPOINT forceInsert"]) {
+                    status = [strongSelf forceInsert:rev
+                                     revisionHistory:checkedHistories[i]
+                                        docNumericID:docNumericID
+                                           localRevs:localRevs
+                                         encodedJSON:$castIf(NSData, jsons[i])
+                                    validationStatus:validationStatus
+                                            database:db
+                                          winningRev:&winningRev];
+                    if (!TDStatusIsError(status) && block) {
+                        TDStatus blockStatus = block(i, rev, db);
+                        if (TDStatusIsError(blockStatus)) status = blockStatus;
+                    }
+                    if (TDStatusIsError(status)) {
+                        [db executeUpdate:@"ROLLBACK TO forceInsert"];
+                    }
+                    [db executeUpdate:@"RELEASE forceInsert"];
+                }
+                statuses[i] = @(status);
+                [localDocs removeObjectForKey:docID];
+                [insertedDocIDs addObject:docID];
+                if (!TDStatusIsError(status)) {
+                    [newRevs addObject:rev];
+                    [winningRevs addObject:(winningRev ?: [NSNull null])];
+                }
+            }
         }
-        @finally { *rollback = !success; }
+        *rollback = NO;
     }];
 
-    // Notify and return:
-    [self notifyChange:rev source:source winningRev:winningRev];
-    return result;
+    //// EPILOGUE: A single change notification is sent for the whole batch...
+    if (newRevs.count > 0) [self notifyChanges:newRevs source:source winningRevs:winningRevs];
+    CDTSignpostIntervalEnd(signpost, "forceInsertRevisions", "inserted=%lu",
+                           (unsigned long)newRevs.count);
+    return statuses;
 }
 
 #pragma mark - PURGING / COMPACTING:
 
+enum {
+    kCompactionPhaseStems = 0,     // deleting revisions older than revsLimit allows
+    kCompactionPhaseBodies,        // removing the JSON of non-current revisions
+    kCompactionPhaseAttachments,   // collecting the attachments only they referred to
+    kCompactionPhaseVacuum         // giving free pages back to the file system
+};
+
+// Revision bodies removed per transaction, and pages freed per incremental_vacuum
+static const NSUInteger kCompactionBatchSize = 256;
+static const int kCompactionVacuumPages = 256;
+
+// Databases created before auto_vacuum was set to INCREMENTAL (2) need one full VACUUM to switch
+static BOOL isIncrementallyVacuumed(FMDatabase* db)
+{
+    return [db intForQuery:@"PRAGMA auto_vacuum"] == 2;
+}
+
+// Frees up to `pages` pages, or all of them if `pages` is 0
+static BOOL incrementalVacuum(FMDatabase* db, int pages)
+{
+    NSString* sql = pages > 0 ? $sprintf(@"PRAGMA incremental_vacuum(%d)", pages)
+                              : @"PRAGMA incremental_vacuum";
+    FMResultSet* rset = [db executeQuery:sql];
+    while ([rset next]) {
+    }
+    [rset close];
+    return !db.hadError;
+}
+
+static BOOL fullVacuum(FMDatabase* db)
+{
+    return [db executeUpdate:@"PRAGMA auto_vacuum = INCREMENTAL"] && [db executeUpdate:@"VACUUM"];
+}
+
+// callers: -compact, -compactWithTimeBudget:rowBudget:finished:, -stemRevisionsAfterInserting:...
+/** Deletes the revisions of the documents with numeric IDs in (firstDocNumericID,
+    lastDocNumericID] that are more than `limit` generations back from every one of their leaves,
+    as CouchDB's revs_limit does. Their descendants' parents become NULL, so revision histories
+    simply stop there. Returns how many revisions were deleted, or -1 on error. */
+- (NSInteger)stemRevisionsOfDocNumericIDsAfter:(SInt64)firstDocNumericID
+                                          upTo:(SInt64)lastDocNumericID
+                                         limit:(NSUInteger)limit
+                                      database:(FMDatabase*)db
+{
+    // Only ancestors of leaves go, so leaves and the conflicts they make are left alone
+    BOOL ok = [db executeUpdate:
+        @"WITH RECURSIVE ancestors(sequence, parent, depth) AS ("
+         "SELECT sequence, parent, 1 FROM revs WHERE doc_id > ? AND doc_id <= ? AND current=1 "
+         "UNION ALL SELECT revs.sequence, revs.parent, ancestors.depth + 1 "
+         "FROM revs JOIN ancestors ON revs.sequence = ancestors.parent) "
+         "DELETE FROM revs WHERE sequence IN "
+         "(SELECT sequence FROM ancestors GROUP BY sequence HAVING MIN(depth) > ?)",
+        @(firstDocNumericID), @(lastDocNumericID), @(limit)];
+    return ok ? db.changes : -1;
+}
+
+// callers: -putRevision:..., -forceInsert:revisionHistory:docNumericID:...
+- (BOOL)stemRevisionsAfterInserting:(TD_Revision*)rev
+                       docNumericID:(SInt64)docNumericID
+                           database:(FMDatabase*)db
+{
+    NSUInteger limit = self.revsLimit;
+    // Bulk loads run without foreign key checks, which would leave parents pointing at deleted
+    // revisions, so those documents wait for compaction
+    if (!self.stemsRevisionsOnInsert || limit == 0 || rev.generation <= limit ||
+        self.durability == kTDDurabilityBulkLoad) {
+        return YES;
+    }
+    NSInteger stemmed =
+        [self stemRevisionsOfDocNumericIDsAfter:docNumericID - 1 upTo:docNumericID limit:limit database:db];
+    if (stemmed > 0) [_historyCache removeDocumentID:rev.docID];
+    return stemmed >= 0;
+}
+
 - (TDStatus)compact
 {
+    CDTQueueOperationScope(CDTQueueOperationCompaction);
     // Can't delete any rows because that would lose revision tree history.
     // But we can remove the JSON of non-current revisions, which is most of the space.
 
+    // The WAL checkpoint and VACUUM below need the readers out of the way; reads go through the
+    // writer connection until compaction is over.
+    [self closeReadConnections];
+
     __block TDStatus result;
     __weak TD_Database* weakSelf = self;
+    NSUInteger limit = self.revsLimit;
     [_fmdbQueue inDatabase:^(FMDatabase* db) {
         TD_Database* strongSelf = weakSelf;
+        if (limit > 0) {
+            os_log_info(CDTOSLog, "TD_Database: Stemming revisions beyond revsLimit=%lu...",
+                        (unsigned long)limit);
+            if ([strongSelf stemRevisionsOfDocNumericIDsAfter:0 upTo:INT64_MAX limit:limit database:db] < 0) {
+                result = kTDStatusDBError;
+                return;
+            }
+        }
+
         os_log_info(CDTOSLog, "TD_Database: Deleting JSON of old revisions...");
         if (![db executeUpdate:@"UPDATE revs SET json=null WHERE current=0"]) {
             result = kTDStatusDBError;
@@ -740,14 +1505,28 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
         }
         @finally { [rset close]; }
 
-        os_log_info(CDTOSLog, "Vacuuming SQLite database...");
-        if (![db executeUpdate:@"VACUUM"]) {
+        // Incremental databases just give their free pages back, without rewriting the file.
+        // Older ones get the one full VACUUM that converts them, once, so that from then on
+        // they can shrink in bounded steps too.
+        BOOL ok;
+        if (isIncrementallyVacuumed(db)) {
+            os_log_info(CDTOSLog, "Freeing unused pages...");
+            ok = incrementalVacuum(db, 0);
+        } else {
+            os_log_info(CDTOSLog, "Vacuuming SQLite database to convert it to incremental vacuuming...");
+            ok = fullVacuum(db);
+        }
+        if (!ok) {
             result = kTDStatusDBError;
             return;
         }
     }];
+    [_historyCache removeAllDocuments];  // cached ancestors' bodies may have gone
+    [_blobFilenameCache removeAllFilenames];  // and the blobs no attachment uses any more
 
     if (result == kTDStatusDBError) {
+        [self openReadConnectionsWithEncryptionKeyProvider:_keyProviderToOpenDB];
+        [self applyMemoryBudget];
         return result;
     }
 
@@ -757,11 +1536,167 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
     [_fmdbQueue close];
 
     if (![self openFMDBWithEncryptionKeyProvider:_keyProviderToOpenDB]) return kTDStatusDBError;
+    [self openReadConnectionsWithEncryptionKeyProvider:_keyProviderToOpenDB];
+    [self applyMemoryBudget];
 
     os_log_info(CDTOSLog, "...Finished database compaction.");
+    _compactionPhase = kCompactionPhaseStems;
+    _compactionSequence = 0;
     return result;
 }
 
+- (TDStatus)compactWithTimeBudget:(NSTimeInterval)timeBudget
+                        rowBudget:(NSUInteger)rowBudget
+                         finished:(BOOL*)outFinished
+{
+    CDTQueueOperationScope(CDTQueueOperationCompaction);
+    if (!self.isOpen) return kTDStatusNotFound;
+
+    CFAbsoluteTime deadline = CFAbsoluteTimeGetCurrent() + timeBudget;
+    NSUInteger rowsLeft = rowBudget > 0 ? rowBudget : NSUIntegerMax;
+    TDStatus status = kTDStatusOK;
+    __block BOOL finished = NO;
+
+    // Steps scheduled in the background and steps called by the app take turns
+    @synchronized(self) {
+        while (!finished && rowsLeft > 0 && CFAbsoluteTimeGetCurrent() < deadline) {
+            if (_compactionPhase == kCompactionPhaseStems) {
+                // Walk up the documents' numeric IDs, a batch of documents per transaction
+                NSUInteger limit = self.revsLimit;
+                __block NSInteger stemmed = 0;
+                status = [self inTransaction:^TDStatus(FMDatabase* db) {
+                    SInt64 last = limit == 0 ? 0 : [db longLongForQuery:
+                        @"SELECT MAX(doc_id) FROM (SELECT doc_id FROM docs WHERE doc_id > ? "
+                         "ORDER BY doc_id LIMIT ?)",
+                        @(self->_compactionSequence), @(kCompactionBatchSize)];
+                    if (last == 0) {
+                        self->_compactionPhase = kCompactionPhaseBodies;
+                        self->_compactionSequence = 0;
+                        return kTDStatusOK;
+                    }
+                    stemmed = [self stemRevisionsOfDocNumericIDsAfter:self->_compactionSequence
+                                                                 upTo:last
+                                                                limit:limit
+                                                             database:db];
+                    if (stemmed < 0) return kTDStatusDBError;
+                    self->_compactionSequence = last;
+                    return kTDStatusOK;
+                }];
+                if (stemmed > 0) [_historyCache removeAllDocuments];
+                rowsLeft -= MIN(rowsLeft, (NSUInteger)MAX(stemmed, 0));
+
+            } else if (_compactionPhase == kCompactionPhaseBodies) {
+                // Walk up the sequence, so each batch is a range scan of the primary key
+                NSUInteger batchSize = MIN(rowsLeft, kCompactionBatchSize);
+                __block NSUInteger stripped = 0;
+                status = [self inTransaction:^TDStatus(FMDatabase* db) {
+                    SequenceNumber last = [db longLongForQuery:
+                        @"SELECT MAX(sequence) FROM (SELECT sequence FROM revs WHERE sequence > ? "
+                         "AND current=0 AND json IS NOT NULL ORDER BY sequence LIMIT ?)",
+                        @(self->_compactionSequence), @(batchSize)];
+                    if (last == 0) {
+                        self->_compactionPhase = kCompactionPhaseAttachments;
+                        return kTDStatusOK;
+                    }
+                    if (![db executeUpdate:@"UPDATE revs SET json=null WHERE sequence > ? AND "
+                                            "sequence <= ? AND current=0",
+                                           @(self->_compactionSequence), @(last)]) {
+                        return kTDStatusDBError;
+                    }
+                    stripped = db.changes;
+                    self->_compactionSequence = last;
+                    return kTDStatusOK;
+                }];
+                if (stripped > 0) [_historyCache removeAllDocuments];
+                rowsLeft -= MIN(rowsLeft, stripped);
+
+            } else if (_compactionPhase == kCompactionPhaseAttachments) {
+                // Only marks the blobs; their files are deleted by a background sweep
+                __weak TD_Database* weakSelf = self;
+                status = [self inTransaction:^TDStatus(FMDatabase* db) {
+                    return [weakSelf garbageCollectAttachments:db];
+                }];
+                [_blobFilenameCache removeAllFilenames];
+                if (!TDStatusIsError(status)) _compactionPhase = kCompactionPhaseVacuum;
+
+            } else {
+                __block BOOL ok = YES;
+                [_fmdbQueue inDatabase:^(FMDatabase* db) {
+                    // Only incremental databases can give pages back without a full VACUUM
+                    if (!isIncrementallyVacuumed(db) ||
+                        [db intForQuery:@"PRAGMA freelist_count"] == 0) {
+                        FMResultSet* rset = [db executeQuery:@"PRAGMA wal_checkpoint(PASSIVE)"];
+                        [rset close];
+                        finished = YES;
+                        return;
+                    }
+                    ok = incrementalVacuum(db, kCompactionVacuumPages);
+                }];
+                if (!ok) status = kTDStatusDBError;
+            }
+
+            if (TDStatusIsError(status)) break;
+        }
+
+        if (finished) {
+            os_log_info(CDTOSLog, "%{public}@: Finished incremental compaction", self);
+            _compactionPhase = kCompactionPhaseStems;
+            _compactionSequence = 0;
+        }
+    }
+    if (outFinished) *outFinished = finished;
+    return status;
+}
+
+- (TDStatus)incrementalVacuumPages:(int)pages freePagesLeft:(NSUInteger*)outFreePages
+{
+    __block TDStatus status = kTDStatusOK;
+    __block NSUInteger freePages = 0;
+    BOOL ran = [self inDatabaseIfOpen:^(FMDatabase* db) {
+        if (!isIncrementallyVacuumed(db)) return;
+        if (!incrementalVacuum(db, pages)) {
+            status = kTDStatusDBError;
+            return;
+        }
+        freePages = (NSUInteger)[db intForQuery:@"PRAGMA freelist_count"];
+    }];
+    if (outFreePages) *outFreePages = freePages;
+    return ran ? status : kTDStatusNotFound;
+}
+
+- (TDStatus)vacuum
+{
+    if (!self.isOpen) return kTDStatusNotFound;
+
+    // VACUUM needs the readers out of the way, as in -compact
+    [self closeReadConnections];
+    __block BOOL ok;
+    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        os_log_info(CDTOSLog, "%{public}@: Vacuuming SQLite database...", self);
+        ok = fullVacuum(db);
+    }];
+    [self openReadConnectionsWithEncryptionKeyProvider:_keyProviderToOpenDB];
+    [self applyMemoryBudget];
+    return ok ? kTDStatusOK : kTDStatusDBError;
+}
+
+- (double)obsoleteRevisionBodyRatio
+{
+    __block SInt64 obsolete = 0, total = 0;
+    [self inReadTransaction:^(FMDatabase* db) {
+        FMResultSet* r = [db executeQuery:@"SELECT SUM(CASE WHEN current=0 THEN "
+                                           "length(ifnull(bodies.json, revs.json)) ELSE 0 END), "
+                                           "SUM(length(ifnull(bodies.json, revs.json))) "
+                                           "FROM revs LEFT JOIN bodies USING (sequence)"];
+        if ([r next]) {
+            obsolete = [r longLongIntForColumnIndex:0];
+            total = [r longLongIntForColumnIndex:1];
+        }
+        [r close];
+    }];
+    return total > 0 ? (double)obsolete / total : 0.0;
+}
+
 - (TDStatus)purgeRevisions:(NSDictionary*)docsToRevs result:(NSDictionary**)outResult
 {
     // <http://wiki.apache.org/couchdb/Purge_Documents>
@@ -770,76 +1705,93 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
     if (docsToRevs.count == 0) return kTDStatusOK;
 
     __weak TD_Database* weakSelf = self;
-    return [self inTransaction:^TDStatus(FMDatabase* db) {
-        TD_Database* strongSelf = weakSelf;
-        for (NSString* docID in docsToRevs) {
-            SInt64 docNumericID = [strongSelf getDocNumericID:docID database:db];
-            if (!docNumericID) {
-                continue;  // no such document; skip it
+    TDStatus status = [self inTransaction:^TDStatus(FMDatabase* db) {
+        return [weakSelf purgeRevisions:docsToRevs result:result database:db];
+    }];
+    // Once committed, so that readers still on the old snapshot don't cache it again
+    for (NSString* docID in docsToRevs) [_historyCache removeDocumentID:docID];
+    return status;
+}
+
+- (TDStatus)purgeRevisions:(NSDictionary*)docsToRevs
+                    result:(NSMutableDictionary*)result
+                  database:(FMDatabase*)db
+{
+    for (NSString* docID in docsToRevs) {
+        SInt64 docNumericID = [self getDocNumericID:docID database:db];
+        if (!docNumericID) {
+            continue;  // no such document; skip it
+        }
+        NSArray* revsPurged;
+        NSArray* revIDs = $castIf(NSArray, docsToRevs[docID]);
+        if (!revIDs) {
+            return kTDStatusBadParam;
+        } else if (revIDs.count == 0) {
+            revsPurged = @[];
+        } else if ([revIDs containsObject:@"*"]) {
+            // Delete all revisions if magic "*" revision ID is given:
+            if (![db executeUpdate:@"DELETE FROM revs WHERE doc_id=?", @(docNumericID)]) {
+                return kTDStatusDBError;
             }
-            NSArray* revsPurged;
-            NSArray* revIDs = $castIf(NSArray, docsToRevs[docID]);
-            if (!revIDs) {
-                return kTDStatusBadParam;
-            } else if (revIDs.count == 0) {
-                revsPurged = @[];
-            } else if ([revIDs containsObject:@"*"]) {
-                // Delete all revisions if magic "*" revision ID is given:
-                if (![db executeUpdate:@"DELETE FROM revs WHERE doc_id=?", @(docNumericID)]) {
-                    return kTDStatusDBError;
-                }
-                revsPurged = @[ @"*" ];
+            revsPurged = @[ @"*" ];
 
-            } else {
-                // Iterate over all the revisions of the doc, in reverse sequence order.
-                // Keep track of all the sequences to delete, i.e. the given revs and ancestors,
-                // but not any non-given leaf revs or their ancestors.
-                FMResultSet* r = [db executeQuery:@"SELECT revid, sequence, parent FROM revs "
-                                                   "WHERE doc_id=? ORDER BY sequence DESC",
-                                                  @(docNumericID)];
-                if (!r) return kTDStatusDBError;
-                NSMutableSet* seqsToPurge = [NSMutableSet set];
-                NSMutableSet* seqsToKeep = [NSMutableSet set];
-                NSMutableSet* revsToPurge = [NSMutableSet set];
-                while ([r next]) {
-                    NSString* revID = [r stringForColumnIndex:0];
-                    id sequence = @([r longLongIntForColumnIndex:1]);
-                    id parent = @([r longLongIntForColumnIndex:2]);
-                    if (([seqsToPurge containsObject:sequence] || [revIDs containsObject:revID]) &&
-                        ![seqsToKeep containsObject:sequence]) {
-                        // Purge it and maybe its parent:
-                        [seqsToPurge addObject:sequence];
-                        [revsToPurge addObject:revID];
-                        if ([parent longLongValue] > 0) [seqsToPurge addObject:parent];
-                    } else {
-                        // Keep it and its parent:
-                        [seqsToPurge removeObject:sequence];
-                        [revsToPurge removeObject:revID];
-                        [seqsToKeep addObject:parent];
-                    }
+        } else {
+            // Iterate over all the revisions of the doc, in reverse sequence order.
+            // Keep track of all the sequences to delete, i.e. the given revs and ancestors,
+            // but not any non-given leaf revs or their ancestors.
+            FMResultSet* r = [db executeQuery:@"SELECT revid, sequence, parent FROM revs "
+                                               "WHERE doc_id=? ORDER BY sequence DESC",
+                                              @(docNumericID)];
+            if (!r) return kTDStatusDBError;
+            NSMutableSet* seqsToPurge = [NSMutableSet set];
+            NSMutableSet* seqsToKeep = [NSMutableSet set];
+            NSMutableSet* revsToPurge = [NSMutableSet set];
+            while ([r next]) {
+                NSString* revID = [r stringForColumnIndex:0];
+                id sequence = @([r longLongIntForColumnIndex:1]);
+                id parent = @([r longLongIntForColumnIndex:2]);
+                if (([seqsToPurge containsObject:sequence] || [revIDs containsObject:revID]) &&
+                    ![seqsToKeep containsObject:sequence]) {
+                    // Purge it and maybe its parent:
+                    [seqsToPurge addObject:sequence];
+                    [revsToPurge addObject:revID];
+                    if ([parent longLongValue] > 0) [seqsToPurge addObject:parent];
+                } else {
+                    // Keep it and its parent:
+                    [seqsToPurge removeObject:sequence];
+                    [revsToPurge removeObject:revID];
+                    [seqsToKeep addObject:parent];
                 }
-                [r close];
-                [seqsToPurge minusSet:seqsToKeep];
-
-                os_log_info(CDTOSLog, "Purging doc '%{public}@' revs (%{public}@); asked for (%{public}@)", docID,
-                            [revsToPurge.allObjects componentsJoinedByString:@", "],
-                            [revIDs componentsJoinedByString:@", "]);
-
-                if (seqsToPurge.count) {
-                    // Now delete the sequences to be purged.
-                    NSString* sql =
-                        $sprintf(@"DELETE FROM revs WHERE sequence in (%@)",
-                                 [seqsToPurge.allObjects componentsJoinedByString:@","]);
-                    if (![db executeUpdate:sql]) return kTDStatusDBError;
-                    if ((NSUInteger)db.changes != seqsToPurge.count)
-                        os_log_debug(CDTOSLog, "purgeRevisions: Only %{public}i sequences deleted of (%{public}@)", db.changes, [seqsToPurge.allObjects componentsJoinedByString:@","]);
+            }
+            [r close];
+            [seqsToPurge minusSet:seqsToKeep];
+
+            os_log_info(CDTOSLog, "Purging doc '%{public}@' revs (%{public}@); asked for (%{public}@)", docID,
+                        [revsToPurge.allObjects componentsJoinedByString:@", "],
+                        [revIDs componentsJoinedByString:@", "]);
+
+            if (seqsToPurge.count) {
+                if (![self expandDeltasOfDocNumericID:docNumericID
+                                     basedOnSequences:seqsToPurge
+                                             database:db]) {
+                    return kTDStatusDBError;
                 }
-                revsPurged = revsToPurge.allObjects;
+                // Now delete the sequences to be purged.
+                NSString* sql =
+                    $sprintf(@"DELETE FROM revs WHERE sequence in (%@)",
+                             [seqsToPurge.allObjects componentsJoinedByString:@","]);
+                if (![db executeUpdate:sql]) return kTDStatusDBError;
+                if ((NSUInteger)db.changes != seqsToPurge.count)
+                    os_log_debug(CDTOSLog, "purgeRevisions: Only %{public}i sequences deleted of (%{public}@)", db.changes, [seqsToPurge.allObjects componentsJoinedByString:@","]);
             }
-            result[docID] = revsPurged;
+            revsPurged = revsToPurge.allObjects;
         }
-        return kTDStatusOK;
-    }];
+        if (![self updateConflictsForDocNumericID:docNumericID database:db]) {
+            return kTDStatusDBError;
+        }
+        result[docID] = revsPurged;
+    }
+    return kTDStatusOK;
 }
 
 #pragma mark - VALIDATION:
@@ -859,6 +1811,69 @@ NSString* const TD_DatabaseChangeNotification = @"TD_DatabaseChange";
     return _validations[validationName];
 }
 
+/** Runs the validations of several revisions at once, outside any transaction, returning their
+    statuses. Every block is called concurrently, each with its own context, on revisions whose
+    bodies are loaded beforehand. oldRevs holds what each revision is validated against, or
+    NSNull for nothing; a revision given as NSNull is skipped, with kTDStatusNotValidated. */
+- (NSArray<NSNumber*>*)validateRevisionsConcurrently:(NSArray*)revs
+                                   previousRevisions:(NSArray*)oldRevs
+{
+    Assert(revs.count == oldRevs.count);
+    NSUInteger count = revs.count;
+    NSArray<TD_ValidationBlock>* validations = _validations.allValues;
+    NSUInteger validationCount = validations.count;
+    NSMutableArray* statuses = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [statuses addObject:@($castIf(TD_Revision, revs[i]) ? kTDStatusOK : kTDStatusNotValidated)];
+    }
+    if (count == 0 || validationCount == 0) return statuses;
+
+    // The blocks share the revisions, so nothing may be lazily loaded or parsed while they run:
+    dispatch_queue_t queue = dispatch_get_global_queue(QOS_CLASS_UTILITY, 0);
+    dispatch_apply(count, queue, ^(size_t i) {
+        @autoreleasepool
+        {
+            TD_Revision* rev = $castIf(TD_Revision, revs[i]);
+            TD_Revision* oldRev = $castIf(TD_Revision, oldRevs[i]);
+            if (!rev) return;
+            (void)rev.properties;
+            if (oldRev) {
+                [self loadRevisionBody:oldRev options:0];
+                (void)oldRev.properties;
+            }
+        }
+    });
+
+    TDStatus* results = calloc(count * validationCount, sizeof(TDStatus));
+    dispatch_apply(count * validationCount, queue, ^(size_t k) {
+        @autoreleasepool
+        {
+            NSUInteger i = k / validationCount;
+            TD_Revision* rev = $castIf(TD_Revision, revs[i]);
+            if (!rev) return;
+            TD_ValidationContext* context = [[TD_ValidationContext alloc]
+                initWithDatabase:self
+                        revision:$castIf(TD_Revision, oldRevs[i])
+                     newRevision:rev];
+            TD_ValidationBlock validation = validations[k % validationCount];
+            results[k] = validation(rev, context) ? kTDStatusOK : context.errorType;
+        }
+    });
+
+    // As when run one by one, the first block in order to reject a revision decides its status:
+    for (NSUInteger i = 0; i < count; i++) {
+        for (NSUInteger j = 0; j < validationCount; j++) {
+            TDStatus status = results[i * validationCount + j];
+            if (status != kTDStatusOK && status != kTDStatusNotValidated) {
+                statuses[i] = @(status);
+                break;
+            }
+        }
+    }
+    free(results);
+    return statuses;
+}
+
 - (TDStatus)validateRevision:(TD_Revision*)newRev previousRevision:(TD_Revision*)oldRev
 {
     if (_validations.count == 0) return kTDStatusOK;
@@ -18,6 +18,23 @@
                    prevRevisionID:(NSString *)prevRevID
                            status:(TDStatus *)outStatus;
 
+/** Saves several local documents at once: either all of them or, if any can't be saved, none.
+    Each revision's revID is that of the revision it replaces, or nil to create the document; a
+    deleted revision deletes it. Returns the saved revisions in order, or nil with the status of
+    the first that couldn't be saved. */
+- (NSArray<TD_Revision *> *)putLocalRevisions:(NSArray<TD_Revision *> *)revisions
+                                       status:(TDStatus *)outStatus;
+
 - (TDStatus)deleteLocalDocumentWithID:(NSString *)docID revisionID:(NSString *)revID;
 
+/** Local documents are cached, and by default written to the database in the background up to
+    this long after they're saved, so frequent saves don't each take a write transaction. 0 writes
+    every save before it returns. Saves not yet written when the database closes are written then;
+    a crash may lose them. Defaults to 1 second. */
+@property NSTimeInterval localDocumentFlushDelay;
+
+/** Writes any local documents waiting to be written now. */
+- (TDStatus)flushLocalDocuments;
+
 @end
+
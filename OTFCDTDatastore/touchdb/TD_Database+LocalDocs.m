@@ -20,6 +20,8 @@
 #import "TD_Body.h"
 #import "TDInternal.h"
 #import "TDJSON.h"
+#import "TDLocalDocCache.h"
+#import "CDTLogging.h"
 #import "Test.h"
 
 #import <fmdb/FMDatabase.h>
@@ -28,36 +30,56 @@
 
 @implementation TD_Database (LocalDocs)
 
-- (TD_Revision *)getLocalDocumentWithID:(NSString *)docID revisionID:(NSString *)revID
+- (NSTimeInterval)localDocumentFlushDelay { return _localDocCache.flushDelay; }
+
+- (void)setLocalDocumentFlushDelay:(NSTimeInterval)delay { _localDocCache.flushDelay = delay; }
+
+/** The document from the cache, or else the database. Call synchronized on the cache. */
+- (TDLocalDocument *)localDocumentWithID:(NSString *)docID
 {
-    __block TD_Revision *result;
+    TDLocalDocument *doc = [_localDocCache documentWithID:docID];
+    if (doc) return doc;
+
+    __block NSString *revID = nil;
+    __block NSData *json = nil;
     [_fmdbQueue inDatabase:^(FMDatabase *db) {
         FMResultSet *r =
             [db executeQuery:@"SELECT revid, json FROM localdocs WHERE docid=?", docID];
         if ([r next]) {
-            NSString *gotRevID = [r stringForColumnIndex:0];
-            if (revID && !$equal(revID, gotRevID)) {
-                return;
-            }
-            NSData *json = [r dataNoCopyForColumnIndex:1];
-            NSMutableDictionary *properties;
-            if (json.length == 0 || (json.length == 2 && memcmp(json.bytes, "{}", 2) == 0)) {
-                properties = $mdict();  // workaround for issue #44
-            } else {
-                properties = [TDJSON JSONObjectWithData:json
-                                                options:TDJSONReadingMutableContainers
-                                                  error:NULL];
-                if (!properties) {
-                    return;
-                }
-            }
-            properties[@"_id"] = docID;
-            properties[@"_rev"] = gotRevID;
-            result = [[TD_Revision alloc] initWithDocID:docID revID:gotRevID deleted:NO];
-            result.properties = properties;
+            revID = [r stringForColumnIndex:0];
+            json = [r dataForColumnIndex:1];
         }
         [r close];
     }];
+    doc = [[TDLocalDocument alloc] initWithRevID:revID json:json];
+    [_localDocCache setDocument:doc forID:docID];
+    return doc;
+}
+
+- (TD_Revision *)getLocalDocumentWithID:(NSString *)docID revisionID:(NSString *)revID
+{
+    TDLocalDocument *doc;
+    @synchronized(_localDocCache) { doc = [self localDocumentWithID:docID]; }
+    NSString *gotRevID = doc.revID;
+    if (!gotRevID || (revID && !$equal(revID, gotRevID))) {
+        return nil;
+    }
+
+    NSData *json = doc.json;
+    NSMutableDictionary *properties;
+    if (json.length == 0 || (json.length == 2 && memcmp(json.bytes, "{}", 2) == 0)) {
+        properties = $mdict();  // workaround for issue #44
+    } else {
+        properties =
+            [TDJSON JSONObjectWithData:json options:TDJSONReadingMutableContainers error:NULL];
+        if (!properties) {
+            return nil;
+        }
+    }
+    properties[@"_id"] = docID;
+    properties[@"_rev"] = gotRevID;
+    TD_Revision *result = [[TD_Revision alloc] initWithDocID:docID revID:gotRevID deleted:NO];
+    result.properties = properties;
     return result;
 }
 
@@ -65,90 +87,149 @@
                    prevRevisionID:(NSString *)prevRevID
                            status:(TDStatus *)outStatus
 {
-    NSString *docID = revision.docID;
-    if (![docID hasPrefix:@"_local/"]) {
-        *outStatus = kTDStatusBadID;
+    TD_Revision *replacing = [revision copyWithDocID:revision.docID revID:prevRevID];
+    NSArray<TD_Revision *> *saved = [self putLocalRevisions:@[ replacing ] status:outStatus];
+    if (!saved) {
         return nil;
     }
-    if (!revision.deleted) {
-        // PUT:
-        NSData *json = [self encodeDocumentJSON:revision];
-        __block TD_Revision *result;
-        [_fmdbQueue inDatabase:^(FMDatabase *db) {
+    return revision.deleted ? revision : saved[0];
+}
+
+- (NSArray<TD_Revision *> *)putLocalRevisions:(NSArray<TD_Revision *> *)revisions
+                                       status:(TDStatus *)outStatus
+{
+    NSMutableArray<TD_Revision *> *saved = [NSMutableArray arrayWithCapacity:revisions.count];
+    NSMutableDictionary<NSString *, TDLocalDocument *> *updates = [NSMutableDictionary dictionary];
+    TDStatus status = kTDStatusOK;
+
+    @synchronized(_localDocCache)
+    {
+        for (TD_Revision *revision in revisions) {
+            NSString *docID = revision.docID;
+            NSString *prevRevID = revision.revID;
+            if (![docID hasPrefix:@"_local/"]) {
+                *outStatus = kTDStatusBadID;
+                return nil;
+            }
+            // Later revisions of a document in the same call replace the earlier ones.
+            NSString *currentRevID = (updates[docID] ?: [self localDocumentWithID:docID]).revID;
+
+            if (revision.deleted) {
+                if (!prevRevID || !$equal(prevRevID, currentRevID)) {
+                    *outStatus = currentRevID ? kTDStatusConflict : kTDStatusNotFound;
+                    return nil;
+                }
+                updates[docID] = [[TDLocalDocument alloc] initWithRevID:nil json:nil];
+                [saved addObject:revision];
+                continue;
+            }
+
             NSString *newRevID;
             if (prevRevID) {
                 unsigned generation = [TD_Revision generationFromRevID:prevRevID];
                 if (generation == 0) {
                     *outStatus = kTDStatusBadID;
-                    return;
+                    return nil;
                 }
                 newRevID = $sprintf(@"%d-local", ++generation);
-                if (![db executeUpdate:@"UPDATE localdocs SET revid=?, json=? "
-                                        "WHERE docid=? AND revid=?",
-                                       newRevID, json, docID, prevRevID]) {
-                    if (db.lastErrorCode == SQLITE_FULL)
-                        *outStatus = kTDStatusInsufficientStorage;
-                    else
-                        *outStatus = kTDStatusDBError;
-                    return;
-                }
             } else {
                 newRevID = @"1-local";
-                // The docid column is unique so the insert will be a no-op if there is already
-                // a doc with this ID.
-                if (![db executeUpdate:@"INSERT OR IGNORE INTO localdocs (docid, revid, json) "
-                                        "VALUES (?, ?, ?)",
-                                       docID, newRevID, json]) {
-                    if (db.lastErrorCode == SQLITE_FULL)
-                        *outStatus = kTDStatusInsufficientStorage;
-                    else
-                        *outStatus = kTDStatusDBError;
-                    return;
-                }
             }
-            if (db.changes == 0) {
+            if (!$equal(prevRevID, currentRevID)) {
                 *outStatus = kTDStatusConflict;
-                return;
+                return nil;
+            }
+            NSData *json = [self encodeDocumentJSON:revision];
+            if (!json) {
+                *outStatus = kTDStatusBadJSON;
+                return nil;
             }
-            *outStatus = kTDStatusCreated;
-            result = [revision copyWithDocID:docID revID:newRevID];
-        }];
+            updates[docID] = [[TDLocalDocument alloc] initWithRevID:newRevID json:json];
+            [saved addObject:[revision copyWithDocID:docID revID:newRevID]];
+            status = kTDStatusCreated;
+        }
 
-        return result;
-    } else {
-        // DELETE:
-        *outStatus = [self deleteLocalDocumentWithID:docID revisionID:prevRevID];
-        return *outStatus < 300 ? revision : nil;
+        if (_localDocCache.flushDelay > 0) {
+            [updates enumerateKeysAndObjectsUsingBlock:^(NSString *docID, TDLocalDocument *doc,
+                                                         BOOL *stop) {
+                [self->_localDocCache updateDocument:doc forID:docID];
+            }];
+        } else {
+            TDStatus written = [self writeLocalDocuments:updates];
+            if (TDStatusIsError(written)) {
+                *outStatus = written;
+                return nil;
+            }
+            [updates enumerateKeysAndObjectsUsingBlock:^(NSString *docID, TDLocalDocument *doc,
+                                                         BOOL *stop) {
+                [self->_localDocCache setDocument:doc forID:docID];
+            }];
+        }
     }
+
+    *outStatus = status;
+    return saved;
 }
 
 - (TDStatus)deleteLocalDocumentWithID:(NSString *)docID revisionID:(NSString *)revID
 {
     if (!docID) return kTDStatusBadID;
-    if (!revID) {
-        // Didn't specify a revision to delete: kTDStatusNotFound or a kTDStatusConflict, depending
-        return [self getLocalDocumentWithID:docID revisionID:nil] ? kTDStatusConflict
-                                                                  : kTDStatusNotFound;
-    }
+    TD_Revision *deletion = [[TD_Revision alloc] initWithDocID:docID revID:revID deleted:YES];
+    TDStatus status;
+    [self putLocalRevisions:@[ deletion ] status:&status];
+    return status;
+}
 
-    __block TDStatus result = kTDStatusOK;
-    __block bool delete_successful = NO;
-    [_fmdbQueue inDatabase:^(FMDatabase *db) {
+- (TDStatus)flushLocalDocuments
+{
+    NSDictionary<NSString *, TDLocalDocument *> *dirty = [_localDocCache dirtyDocuments];
+    if (dirty.count == 0) return kTDStatusOK;
 
-        if (![db executeUpdate:@"DELETE FROM localdocs WHERE docid=? AND revid=?", docID, revID]) {
-            result = kTDStatusDBError;
-            return;
+    __block TDStatus status = kTDStatusDBError;  // if the database isn't open
+    [self inDatabaseIfOpen:^(FMDatabase *db) {
+        if (![db beginTransaction]) return;
+        status = [self writeLocalDocuments:dirty toDatabase:db];
+        if (TDStatusIsError(status)) {
+            [db rollback];
+        } else if (![db commit]) {
+            status = kTDStatusDBError;
         }
-
-        delete_successful = (db.changes > 0);
     }];
-
-    if (!delete_successful) {
-        return [self getLocalDocumentWithID:docID revisionID:nil] ? kTDStatusConflict
-                                                                  : kTDStatusNotFound;
+    if (TDStatusIsError(status)) {
+        os_log_error(CDTOSLog, "Couldn't write %{public}lu local documents, status %{public}d",
+                     (unsigned long)dirty.count, status);
+    } else {
+        [_localDocCache documentsWereWritten:dirty];
     }
+    return status;
+}
 
-    return result;
+- (TDStatus)writeLocalDocuments:(NSDictionary<NSString *, TDLocalDocument *> *)documents
+{
+    return [self inTransaction:^TDStatus(FMDatabase *db) {
+        return [self writeLocalDocuments:documents toDatabase:db];
+    }];
+}
+
+/** Writes the documents on db; the caller begins and ends the transaction. */
+- (TDStatus)writeLocalDocuments:(NSDictionary<NSString *, TDLocalDocument *> *)documents
+                     toDatabase:(FMDatabase *)db
+{
+    __block TDStatus status = kTDStatusOK;
+    [documents enumerateKeysAndObjectsUsingBlock:^(NSString *docID, TDLocalDocument *doc,
+                                                   BOOL *stop) {
+        BOOL ok = doc.revID
+                      ? [db executeUpdate:@"INSERT OR REPLACE INTO localdocs (docid, revid, json) "
+                                           "VALUES (?, ?, ?)",
+                                          docID, doc.revID, doc.json]
+                      : [db executeUpdate:@"DELETE FROM localdocs WHERE docid=?", docID];
+        if (!ok) {
+            status = db.lastErrorCode == SQLITE_FULL ? kTDStatusInsufficientStorage
+                                                     : kTDStatusDBError;
+            *stop = YES;
+        }
+    }];
+    return status;
 }
 
 @end
@@ -0,0 +1,41 @@
+//
+//  TD_Database+LocalReplication.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/** Replication between two databases in the same process, without a TDReplicator. The source's
+    changes feed is read a batch at a time, the revisions the target lacks are found with
+    -findMissingRevisions:, and they're force-inserted into the target from their loaded bodies
+    and revision histories. Attachments aren't encoded at all: their blobs are hard-linked (or
+    copied) from one attachment store to the other by key. */
+@interface TD_Database (LocalReplication)
+
+/** Replicates every revision `target` is missing into it, continuing from the checkpoint the
+    last replication to it saved. The checkpoint is saved in this database after each batch, like
+    a pusher's local checkpoint, under -checkpointIDForLocalReplicationTo:.
+    Revisions rejected by the target's validation are skipped, as they are by a pull.
+    @param outCount  On return, how many revisions were inserted into the target. May be NULL.
+    @return  YES, or NO with outError set. */
+- (BOOL)replicateToDatabase:(TD_Database*)target
+        revisionsReplicated:(NSUInteger* _Nullable)outCount
+                      error:(NSError**)outError;
+
+/** The ID of the checkpoint -replicateToDatabase:revisionsReplicated:error: saves for `target`. */
+- (NSString*)checkpointIDForLocalReplicationTo:(TD_Database*)target;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,215 @@
+//
+//  TD_Database+LocalReplication.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database+LocalReplication.h"
+#import "TD_Database+Insertion.h"
+#import "TD_Database+Replication.h"
+#import "TDInternal.h"
+#import "TDBase64.h"
+#import "TDBlobStore.h"
+#import "CDTLogging.h"
+#import "CollectionUtils.h"
+
+// Documents read from the source's changes feed at a time
+static const unsigned kLocalReplicationBatchSize = 200;
+
+static NSError* localReplicationError(TDStatus status, NSString* reason)
+{
+    return TDStatusToNSErrorWithInfo(status, nil, @{NSLocalizedFailureReasonErrorKey : reason});
+}
+
+@implementation TD_Database (LocalReplication)
+
+- (NSString*)checkpointIDForLocalReplicationTo:(TD_Database*)target
+{
+    return [@"local-" stringByAppendingString:target.privateUUID];
+}
+
+- (BOOL)replicateToDatabase:(TD_Database*)target
+        revisionsReplicated:(NSUInteger*)outCount
+                      error:(NSError**)outError
+{
+    if (outCount) *outCount = 0;
+    if (target == self) {
+        if (outError)
+            *outError = localReplicationError(kTDStatusBadParam, @"Can't replicate to itself");
+        return NO;
+    }
+    if (!self.isOpen || !target.isOpen) {
+        if (outError) *outError = localReplicationError(kTDStatusNotFound, @"Database not open");
+        return NO;
+    }
+
+    NSString* checkpointID = [self checkpointIDForLocalReplicationTo:target];
+    NSDictionary* checkpoint = [self checkpointDocumentWithID:checkpointID];
+    SequenceNumber lastSequence =
+        MAX([$castIf(NSNumber, checkpoint[@"source_last_seq"]) longLongValue], 0);
+    NSURL* source = self.path ? [NSURL fileURLWithPath:self.path] : nil;
+
+    TDChangesOptions options = kDefaultTDChangesOptions;
+    options.limit = kLocalReplicationBatchSize;
+    options.includeConflicts = YES;
+    NSUInteger replicated = 0;
+    for (;;) {
+        @autoreleasepool
+        {
+            TD_RevisionList* changes = [self changesSinceSequence:lastSequence
+                                                          options:&options
+                                                           filter:nil
+                                                           params:nil];
+            if (!changes) {
+                if (outError) *outError = TDStatusToNSError(kTDStatusDBError, nil);
+                return NO;
+            }
+            if (changes.count == 0) break;
+            SequenceNumber batchSequence = lastSequence;
+            for (TD_Revision* rev in changes) {
+                batchSequence = MAX(batchSequence, rev.sequence);
+            }
+
+            if (![target findMissingRevisions:changes]) {
+                if (outError) *outError = TDStatusToNSError(kTDStatusDBError, nil);
+                return NO;
+            }
+            TDStatus status = [self insertRevisions:changes.allRevisions
+                                         intoTarget:target
+                                             source:source
+                                           inserted:&replicated];
+            if (TDStatusIsError(status)) {
+                if (outError) *outError = TDStatusToNSError(status, nil);
+                return NO;
+            }
+
+            NSDictionary* body = @{
+                @"_id" : [@"_local/" stringByAppendingString:checkpointID],
+                @"source_last_seq" : @(batchSequence)
+            };
+            if (![self saveCheckpointDocument:body error:outError]) return NO;
+            lastSequence = batchSequence;
+        }
+    }
+
+    os_log_info(CDTOSLog, "%{public}@: Replicated %{public}u revisions to %{public}@ up to "
+                "sequence %lld", self, (unsigned)replicated, target, lastSequence);
+    if (outCount) *outCount = replicated;
+    return YES;
+}
+
+/** Loads the revisions, which the target is missing, with their histories, and force-inserts
+    them into it in one batch. Their attachments follow, from blobs copied from this database's
+    attachment store into writers the target installs. */
+- (TDStatus)insertRevisions:(NSArray<TD_Revision*>*)revs
+                 intoTarget:(TD_Database*)target
+                     source:(NSURL*)source
+                   inserted:(NSUInteger*)ioInserted
+{
+    if (revs.count == 0) return kTDStatusOK;
+    NSArray* loadStatuses = [self loadRevisionBodies:revs options:kTDIncludeRevs];
+    if (!loadStatuses) return kTDStatusDBError;
+
+    NSMutableArray* inserts = [NSMutableArray arrayWithCapacity:revs.count];
+    NSMutableArray* histories = [NSMutableArray arrayWithCapacity:revs.count];
+    NSMutableDictionary* writers = $mdict();
+    __block TDStatus status = kTDStatusOK;
+    [self inReadTransaction:^(FMDatabase* db) {
+        for (NSUInteger i = 0; i < revs.count; i++) {
+            TD_Revision* rev = revs[i];
+            TDStatus loadStatus = [loadStatuses[i] intValue];
+            if (TDStatusIsError(loadStatus)) {
+                os_log_debug(CDTOSLog, "%{public}@: Couldn't load %{public}@ to replicate it",
+                             self, rev);
+                status = loadStatus;
+                return;
+            }
+
+            NSDictionary* properties = rev.properties;
+            NSDictionary* doc = [self documentCopyingAttachments:properties
+                                                      toDatabase:target
+                                                         writers:writers
+                                                        database:db];
+            if (!doc) {
+                status = kTDStatusAttachmentError;
+                return;
+            }
+            [inserts addObject:(doc == properties ? rev
+                                                      : [TD_Revision revisionWithProperties:doc])];
+            [histories addObject:([TD_Database parseCouchDBRevisionHistory:doc] ?: [NSNull null])];
+        }
+    }];
+    if (TDStatusIsError(status)) return status;
+
+    [target rememberAttachmentWritersForDigests:writers];
+    NSArray* statuses =
+        [target forceInsertRevisions:inserts revisionHistories:histories source:source];
+    for (NSUInteger i = 0; i < inserts.count; i++) {
+        TDStatus insertStatus = [statuses[i] intValue];
+        if (insertStatus == kTDStatusForbidden) {
+            os_log_info(CDTOSLog, "%{public}@: Rev failed validation: %{public}@", target,
+                        inserts[i]);
+        } else if (TDStatusIsError(insertStatus)) {
+            os_log_debug(CDTOSLog, "%{public}@ failed to write %{public}@: status=%{public}d",
+                         target, inserts[i], (int)insertStatus);
+            status = insertStatus;
+        } else {
+            ++*ioInserted;
+        }
+    }
+    return status;
+}
+
+/** Returns the document with its attachment stubs turned into ones which follow, adding a writer
+    to `writers` for the blob of each, or the document itself if it has no attachments. Returns nil
+    if a blob can't be copied. */
+- (NSDictionary*)documentCopyingAttachments:(NSDictionary*)doc
+                                 toDatabase:(TD_Database*)target
+                                    writers:(NSMutableDictionary*)writers
+                                   database:(FMDatabase*)db
+{
+    NSDictionary* attachments = $castIf(NSDictionary, doc[@"_attachments"]);
+    if (attachments.count == 0) return doc;
+
+    NSMutableDictionary* copiedAttachments = $mdict();
+    for (NSString* name in attachments) {
+        NSDictionary* attachment = $castIf(NSDictionary, attachments[name]);
+        NSString* digest = $castIf(NSString, attachment[@"digest"]);
+        if (![digest hasPrefix:@"sha1-"]) return nil;
+
+        if (!writers[digest]) {
+            NSData* keyData = [TDBase64 decode:[digest substringFromIndex:5]];
+            if (keyData.length != sizeof(TDBlobKey)) return nil;
+            TDBlobStoreWriter* writer =
+                [[TDBlobStoreWriter alloc] initWithStore:target.attachmentStore
+                                      copyingBlobWithKey:*(TDBlobKey*)keyData.bytes
+                                               fromStore:self.attachmentStore
+                                            withDatabase:db];
+            if (!writer) {
+                os_log_debug(CDTOSLog, "%{public}@: Couldn't copy attachment %{public}@ of "
+                             "%{public}@", self, name, doc[@"_id"]);
+                return nil;
+            }
+            writers[digest] = writer;
+        }
+
+        NSMutableDictionary* copiedAttachment = [attachment mutableCopy];
+        [copiedAttachment removeObjectForKey:@"stub"];
+        copiedAttachment[@"follows"] = $true;
+        copiedAttachments[name] = copiedAttachment;
+    }
+
+    NSMutableDictionary* copiedDoc = [doc mutableCopy];
+    copiedDoc[@"_attachments"] = copiedAttachments;
+    return copiedDoc;
+}
+
+@end
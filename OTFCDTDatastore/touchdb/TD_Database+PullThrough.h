@@ -0,0 +1,44 @@
+//
+//  TD_Database+PullThrough.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/** Documents fetched on demand from a remote database ("pulled through") are recorded in the
+    pulled_through table with the sequence they were inserted at and when, so that they can be
+    evicted again once they're old enough. A document changed since, locally or by a replication,
+    is the database's own and is never evicted. */
+@interface TD_Database (PullThrough)
+
+/** Returns those of `docIDs` whose documents the database holds other than as unchanged pulled
+    through copies, so which shouldn't be fetched and recorded as pulled through. */
+- (NSSet<NSString*>*)heldDocumentIDsAmong:(NSArray<NSString*>*)docIDs;
+
+/** Records that the documents with these IDs have just been fetched, at their current sequences.
+    IDs of documents the database doesn't have, because the remote didn't either, are skipped. */
+- (TDStatus)notePulledThroughDocumentIDs:(NSArray<NSString*>*)docIDs;
+
+/** Removes documents pulled through before `date` and not changed since, with their revision
+    history, as -purgeRevisions:result: does; documents that have changed stop being recorded as
+    pulled through. A TD_DatabasePurgedNotification is posted for the evicted documents.
+    @param date  Only documents fetched before this are evicted.
+    @param outDocIDs  On return, the IDs of the documents evicted. May be NULL.
+    @return  kTDStatusOK, or an error status. */
+- (TDStatus)evictPulledThroughDocumentsFetchedBefore:(NSDate*)date
+                                  evictedDocumentIDs:(NSArray<NSString*>* _Nullable* _Nullable)outDocIDs;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,124 @@
+//
+//  TD_Database+PullThrough.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database+PullThrough.h"
+#import "TDInternal.h"
+#import "TDRevisionHistoryCache.h"
+#import "CDTLogging.h"
+#import <fmdb/FMDatabase.h>
+#import <fmdb/FMDatabaseAdditions.h>
+#import "FMDatabase+LongLong.h"
+
+@implementation TD_Database (PullThrough)
+
+- (NSSet<NSString*>*)heldDocumentIDsAmong:(NSArray<NSString*>*)docIDs
+{
+    NSMutableSet<NSString*>* held = [NSMutableSet set];
+    if (!self.isOpen) return held;
+    [self inReadTransaction:^(FMDatabase* db) {
+        for (NSString* docID in docIDs) {
+            // Held unless there's no document, or it's a pulled through copy nothing has changed
+            BOOL isHeld = [db boolForQuery:
+                @"SELECT EXISTS (SELECT 1 FROM docs WHERE docid=? AND NOT EXISTS ("
+                 "SELECT 1 FROM pulled_through WHERE pulled_through.doc_id = docs.doc_id "
+                 "AND NOT EXISTS (SELECT 1 FROM revs WHERE revs.doc_id = docs.doc_id "
+                 "AND revs.sequence > pulled_through.sequence)))",
+                docID];
+            if (isHeld) [held addObject:docID];
+        }
+    }];
+    return held;
+}
+
+- (TDStatus)notePulledThroughDocumentIDs:(NSArray<NSString*>*)docIDs
+{
+    if (docIDs.count == 0) return kTDStatusOK;
+    NSTimeInterval now = [NSDate date].timeIntervalSince1970;
+    return [self inTransaction:^TDStatus(FMDatabase* db) {
+        for (NSString* docID in docIDs) {
+            if (![db executeUpdate:
+                    @"INSERT OR REPLACE INTO pulled_through (doc_id, sequence, fetched_at) "
+                     "SELECT docs.doc_id, MAX(revs.sequence), ? FROM docs "
+                     "JOIN revs ON revs.doc_id = docs.doc_id WHERE docs.docid=? "
+                     "GROUP BY docs.doc_id",
+                    @(now), docID]) {
+                return kTDStatusDBError;
+            }
+        }
+        return kTDStatusOK;
+    }];
+}
+
+- (TDStatus)evictPulledThroughDocumentsFetchedBefore:(NSDate*)date
+                                  evictedDocumentIDs:(NSArray<NSString*>**)outDocIDs
+{
+    if (outDocIDs) *outDocIDs = nil;
+    if (!self.isOpen) return kTDStatusNotFound;
+
+    NSTimeInterval before = date.timeIntervalSince1970;
+    NSMutableArray<NSString*>* evictedDocIDs = [NSMutableArray array];
+    // Looked up in the same transaction as the eviction, so a change made in the meantime
+    // can't be lost
+    TDStatus status = [self inTransaction:^TDStatus(FMDatabase* db) {
+        // Changed documents are the database's own now
+        if (![db executeUpdate:
+                @"DELETE FROM pulled_through WHERE EXISTS (SELECT 1 FROM revs "
+                 "WHERE revs.doc_id = pulled_through.doc_id "
+                 "AND revs.sequence > pulled_through.sequence)"]) {
+            return kTDStatusDBError;
+        }
+
+        FMResultSet* r = [db executeQuery:
+            @"SELECT pulled_through.doc_id, docs.docid FROM pulled_through "
+             "JOIN docs ON docs.doc_id = pulled_through.doc_id "
+             "WHERE pulled_through.fetched_at < ?",
+            @(before)];
+        if (!r) return kTDStatusDBError;
+        NSMutableArray<NSNumber*>* docNumericIDs = [NSMutableArray array];
+        while ([r next]) {
+            [docNumericIDs addObject:@([r longLongIntForColumnIndex:0])];
+            [evictedDocIDs addObject:[r stringForColumnIndex:1]];
+        }
+        [r close];
+
+        // The rows hanging off the document's revisions are deleted here rather than left to
+        // ON DELETE CASCADE, which does nothing while foreign keys are off for a bulk load. The
+        // triggers on revs release its attachments and out-of-line bodies either way.
+        for (NSNumber* docNumericID in docNumericIDs) {
+            if (![db executeUpdate:@"DELETE FROM attachments_pending_download WHERE sequence IN "
+                                    "(SELECT sequence FROM revs WHERE doc_id=?)", docNumericID] ||
+                ![db executeUpdate:@"DELETE FROM maps WHERE sequence IN "
+                                    "(SELECT sequence FROM revs WHERE doc_id=?)", docNumericID] ||
+                ![db executeUpdate:@"DELETE FROM tombstones WHERE sequence IN "
+                                    "(SELECT sequence FROM revs WHERE doc_id=?)", docNumericID] ||
+                ![db executeUpdate:@"DELETE FROM revs WHERE doc_id=?", docNumericID] ||
+                ![db executeUpdate:@"DELETE FROM expiries WHERE doc_id=?", docNumericID] ||
+                ![db executeUpdate:@"DELETE FROM pulled_through WHERE doc_id=?", docNumericID] ||
+                ![db executeUpdate:@"DELETE FROM docs WHERE doc_id=?", docNumericID]) {
+                return kTDStatusDBError;
+            }
+        }
+        return kTDStatusOK;
+    }];
+    if (TDStatusIsError(status)) return status;
+
+    for (NSString* docID in evictedDocIDs) [_historyCache removeDocumentID:docID];
+    [self notifyPurgedDocumentIDs:evictedDocIDs];
+    os_log_info(CDTOSLog, "%{public}@: Evicted %lu pulled through documents", self,
+                (unsigned long)evictedDocIDs.count);
+    if (outDocIDs) *outDocIDs = evictedDocIDs;
+    return kTDStatusOK;
+}
+
+@end
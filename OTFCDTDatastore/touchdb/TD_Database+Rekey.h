@@ -0,0 +1,69 @@
+//
+//  TD_Database+Rekey.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database.h"
+
+#import "CDTEncryptionKeyProvider.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/** Called as attachments are re-encrypted with how many have been done, out of how many there
+    are. */
+typedef void (^TDRekeyProgressBlock)(NSUInteger rekeyedAttachments, NSUInteger totalAttachments);
+
+/** A key change goes -beginRekeyWithError:, -rekeyWithEncryptionKeyProvider:error:, then
+    -rekeyAttachmentsWithEncryptionKeyProvider:progress:error:. The database is only readable with
+    one key, so it's changed first; the attachments' old key is kept in the database until they've
+    all been re-encrypted, so a rekey cut short between the two leaves them readable once the
+    database is opened with the new key, and is finished by calling
+    -rekeyAttachmentsWithEncryptionKeyProvider:progress:error: again with it. */
+@interface TD_Database (Rekey)
+
+/** Records the key attachments are encrypted with, the database's, ahead of a rekey. Fails if an
+    earlier rekey hasn't finished re-encrypting attachments: see hasUnfinishedRekey. */
+- (BOOL)beginRekeyWithError:(NSError**)outError;
+
+/** Forgets the key recorded by -beginRekeyWithError:, for a rekey given up before the database's
+    key was changed. */
+- (void)abandonRekey;
+
+/** YES if a rekey changed the database's key but hasn't yet re-encrypted every attachment. */
+@property (readonly) BOOL hasUnfinishedRekey;
+
+/** Starts encrypting attachments with the key returned by `provider`, then re-encrypts those
+    already stored, one at a time, while the database is in use. Each is decrypted into a new file
+    off the writer queue, which is only taken to swap the file in, so writers are only held up
+    for a rename at a time. An attachment is read with its old key until its file is swapped, so
+    readers never see one it can't decrypt.
+
+    Attachments already encrypted with the new key are skipped, so calling this again after it
+    fails carries on where it stopped; once they're all done, the key recorded by
+    -beginRekeyWithError: is forgotten. Runs on the calling thread until every attachment is
+    done; the database mustn't be closed meanwhile. */
+- (BOOL)rekeyAttachmentsWithEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
+                                         progress:(nullable TDRekeyProgressBlock)progress
+                                            error:(NSError**)outError;
+
+/** Re-encrypts the database with the key returned by `provider`, with SQLCipher's `PRAGMA rekey`
+    on the writer connection. The read connections are closed meanwhile, so reads go through the
+    writer, and are reopened with the new key, which the database is opened with from then on.
+
+    Like -vacuum, this rewrites every page, so it takes as long. No other process may have the
+    database open. */
+- (BOOL)rekeyWithEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
+                                 error:(NSError**)outError;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,211 @@
+//
+//  TD_Database+Rekey.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database+Rekey.h"
+#import "TD_Database+BlobFilenames.h"
+#import "TDInternal.h"
+#import "TDBlobStore.h"
+#import "TDStatus.h"
+#import "FMDatabase+EncryptionKey.h"
+#import "CDTEncryptionKeySimpleProvider.h"
+#import "CDTLogging.h"
+#import <fmdb/FMDatabase.h>
+#import <fmdb/FMDatabaseQueue.h>
+
+// The info row holding the key of the attachments not yet re-encrypted by an unfinished rekey
+static NSString* const kPreviousAttachmentKeyInfoKey = @"rekeyPreviousAttachmentKey";
+
+static NSError* rekeyError(TDStatus status, NSString* reason)
+{
+    return TDStatusToNSErrorWithInfo(status, nil, @{NSLocalizedFailureReasonErrorKey : reason});
+}
+
+@implementation TD_Database (Rekey)
+
+- (BOOL)beginRekeyWithError:(NSError**)outError
+{
+    if (!self.isOpen) {
+        if (outError) *outError = rekeyError(kTDStatusNotFound, @"Database isn't open");
+        return NO;
+    }
+    if (self.hasUnfinishedRekey) {
+        if (outError) {
+            *outError = rekeyError(kTDStatusBadRequest, @"An earlier rekey hasn't finished");
+        }
+        return NO;
+    }
+    NSData* keyData = [_keyProviderToOpenDB encryptionKey].data;
+    if (!keyData) {
+        if (outError) *outError = rekeyError(kTDStatusBadParam, @"Database isn't encrypted");
+        return NO;
+    }
+
+    // Kept in the database, so it's only readable with the database's key, old or new
+    TDStatus status = [self inTransaction:^TDStatus(FMDatabase* db) {
+        return [db executeUpdate:@"INSERT OR REPLACE INTO info (key, value) VALUES (?, ?)",
+                                 kPreviousAttachmentKeyInfoKey, keyData]
+                   ? kTDStatusOK
+                   : kTDStatusDBError;
+    }];
+    if (TDStatusIsError(status)) {
+        if (outError) *outError = rekeyError(status, @"Attachment key not recorded");
+        return NO;
+    }
+    @synchronized(_attachmentsLock) {
+        _previousAttachmentKeyProvider = [CDTEncryptionKeySimpleProvider providerWithKey:keyData];
+    }
+    return YES;
+}
+
+- (void)abandonRekey { [self forgetPreviousAttachmentKey]; }
+
+- (BOOL)hasUnfinishedRekey
+{
+    @synchronized(_attachmentsLock) { return _previousAttachmentKeyProvider != nil; }
+}
+
+- (void)loadUnfinishedRekey
+{
+    __block NSData* keyData;
+    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        keyData = [db dataForQuery:@"SELECT value FROM info WHERE key=?",
+                                   kPreviousAttachmentKeyInfoKey];
+    }];
+    if (keyData) {
+        os_log_info(CDTOSLog, "%{public}@: Some attachments are still under the key before the "
+                              "last rekey", self);
+    }
+    @synchronized(_attachmentsLock) {
+        _previousAttachmentKeyProvider =
+            keyData ? [CDTEncryptionKeySimpleProvider providerWithKey:keyData] : nil;
+    }
+}
+
+- (BOOL)forgetPreviousAttachmentKey
+{
+    TDStatus status = [self inTransaction:^TDStatus(FMDatabase* db) {
+        return [db executeUpdate:@"DELETE FROM info WHERE key=?", kPreviousAttachmentKeyInfoKey]
+                   ? kTDStatusOK
+                   : kTDStatusDBError;
+    }];
+    if (TDStatusIsError(status)) return NO;
+    @synchronized(_attachmentsLock) { _previousAttachmentKeyProvider = nil; }
+    return YES;
+}
+
+- (BOOL)rekeyAttachmentsWithEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
+                                         progress:(TDRekeyProgressBlock)progress
+                                            error:(NSError**)outError
+{
+    if (!self.isOpen) {
+        if (outError) *outError = rekeyError(kTDStatusNotFound, @"Database isn't open");
+        return NO;
+    }
+    TDBlobStore* store = self.attachmentStore;
+    if (!store.encrypted || ![provider encryptionKey]) {
+        if (outError) {
+            *outError = rekeyError(kTDStatusBadParam, @"Attachments aren't encrypted, or no key");
+        }
+        return NO;
+    }
+
+    // Changed on the writer queue, so every blob installed after the list is taken is written
+    // with the new key, or re-encrypted as it's installed
+    __block NSArray* rows;
+    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        [store changeEncryptionKeyToKeyOfProvider:provider];
+        rows = [TD_Database rowsInBlobFilenamesTableInDatabase:db];
+    }];
+    if (!rows) {
+        if (outError) *outError = rekeyError(kTDStatusDBError, @"Attachments not listed");
+        return NO;
+    }
+
+    NSUInteger done = 0, skipped = 0;
+    if (progress) progress(0, rows.count);
+    for (TD_DatabaseBlobFilenameRow* row in rows) {
+        @autoreleasepool {
+            if ([store blobNeedsRekeyingWithFilename:row.blobFilename]) {
+                NSError* error = nil;
+                NSString* copyPath = [store writeRekeyedCopyOfBlobWithFilename:row.blobFilename
+                                                                         error:&error];
+                __block BOOL ok = NO;
+                [_fmdbQueue inDatabase:^(FMDatabase* db) {
+                    if (copyPath) {
+                        ok = [store installRekeyedCopyAtPath:copyPath
+                                               ofBlobWithKey:row.key
+                                                    filename:row.blobFilename
+                                                withDatabase:db];
+                    } else {
+                        // Fine if the attachment was deleted before it could be read
+                        NSString* filename = [TD_Database filenameForKey:row.key
+                                          inBlobFilenamesTableInDatabase:db];
+                        ok = ![filename isEqualToString:row.blobFilename];
+                    }
+                }];
+                if (!ok) {
+                    if (outError) {
+                        *outError = error ?: rekeyError(kTDStatusAttachmentError,
+                                                        @"Attachment not re-encrypted");
+                    }
+                    return NO;
+                }
+            } else {
+                skipped++;
+            }
+        }
+        done++;
+        if (progress) progress(done, rows.count);
+    }
+    os_log_info(CDTOSLog, "%{public}@: Re-encrypted %lu attachments, %lu already done", self,
+                (unsigned long)(done - skipped), (unsigned long)skipped);
+    if (self.hasUnfinishedRekey && ![self forgetPreviousAttachmentKey]) {
+        if (outError) *outError = rekeyError(kTDStatusDBError, @"Rekey not recorded as finished");
+        return NO;
+    }
+    return YES;
+}
+
+- (BOOL)rekeyWithEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
+                                 error:(NSError**)outError
+{
+    if (!self.isOpen) {
+        if (outError) *outError = rekeyError(kTDStatusNotFound, @"Database isn't open");
+        return NO;
+    }
+    if (!_encrypted || ![provider encryptionKey]) {
+        if (outError) {
+            *outError = rekeyError(kTDStatusBadParam, @"Database isn't encrypted, or no key");
+        }
+        return NO;
+    }
+
+    // The journal is switched out of WAL for the rekey, which needs the readers out of the way,
+    // as in -compact
+    [self closeReadConnections];
+    provider = [TD_Database resolvedEncryptionKeyProvider:provider];
+    __block BOOL ok;
+    __block NSError* error = nil;
+    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        os_log_info(CDTOSLog, "%{public}@: Re-encrypting SQLite database...", self);
+        ok = [db rekeyWithProvider:provider error:&error];
+        if (ok) _keyProviderToOpenDB = provider;
+    }];
+    [self openReadConnectionsWithEncryptionKeyProvider:_keyProviderToOpenDB];
+    [self applyMemoryBudget];
+    if (!ok && outError) *outError = error;
+    return ok;
+}
+
+@end
@@ -19,6 +19,8 @@
 
 - (void)addActiveReplicator:(TDReplicator*)repl;
 
+/** Removes from `revs` the revisions the database already has, matching each document ID and
+    revision ID pair with one query for up to a few hundred pairs. */
 - (BOOL)findMissingRevisions:(TD_RevisionList*)revs;
 
 @end
@@ -19,6 +19,7 @@
 #import "TD_Database+Replication.h"
 #import "TDInternal.h"
 #import "TDPuller.h"
+#import "TDWALCheckpointer.h"
 #import "TDJSON.h"
 #import "CollectionUtils.h"
 
@@ -61,6 +62,10 @@
 - (void)replicatorDidStop:(NSNotification *)n
 {
     TDReplicator *repl = n.object;
+    if (repl.db == self) {
+        // A replication can leave a long log behind it; get rid of it while things are quiet.
+        [self.walCheckpointer truncate];
+    }
     if (repl.error)  // Leave it around a while so clients can see the error
         [_activeReplicators performSelector:@selector(removeObjectIdenticalTo:)
                                  withObject:repl
@@ -107,14 +112,74 @@
 
     __block bool result;
     [self.fmdbQueue inDatabase:^(FMDatabase *db) {
+      // Carry known_revs over, because REPLACE deletes the old row first.
       result = [db executeUpdate:@"INSERT OR REPLACE INTO replicators (remote, push, "
-                        @"last_sequence) VALUES (?, -1, ?)"
-          withErrorAndBindings:error, remote, checkpointData];
+                        @"last_sequence, known_revs) VALUES (?, -1, ?, "
+                        @"(SELECT known_revs FROM replicators WHERE remote=?))"
+          withErrorAndBindings:error, remote, checkpointData, remote];
     }];
 
     return result;
 }
 
+- (NSIndexSet *)knownRemoteSequencesForCheckpointID:(NSString *)checkpointID
+{
+    NSParameterAssert(checkpointID);
+
+    __block NSData *knownJson = nil;
+    [_fmdbQueue inDatabase:^(FMDatabase *db) {
+        knownJson =
+            [db dataForQuery:@"SELECT known_revs FROM replicators WHERE remote=?", checkpointID];
+    }];
+    if (knownJson == nil) {
+        return nil;
+    }
+
+    // Stored as a JSON array of [first, count] ranges
+    NSArray *ranges = $castIf(NSArray, [TDJSON JSONObjectWithData:knownJson options:0 error:nil]);
+    if (!ranges) {
+        return nil;
+    }
+    NSMutableIndexSet *sequences = [NSMutableIndexSet indexSet];
+    for (NSArray *range in ranges) {
+        if (![range isKindOfClass:[NSArray class]] || range.count != 2) {
+            return nil;
+        }
+        [sequences addIndexesInRange:NSMakeRange([range[0] unsignedIntegerValue],
+                                                 [range[1] unsignedIntegerValue])];
+    }
+    return sequences;
+}
+
+- (BOOL)saveKnownRemoteSequences:(NSIndexSet *)sequences
+                 forCheckpointID:(NSString *)checkpointID
+                           error:(NSError *__autoreleasing *)error
+{
+    NSParameterAssert(sequences);
+    NSParameterAssert(checkpointID);
+
+    NSMutableArray *ranges = [NSMutableArray array];
+    [sequences enumerateRangesUsingBlock:^(NSRange range, BOOL *stop) {
+        [ranges addObject:@[ @(range.location), @(range.length) ]];
+    }];
+    NSData *knownJson = [TDJSON dataWithJSONObject:ranges options:0 error:error];
+    if (!knownJson) {
+        return NO;
+    }
+
+    __block BOOL result;
+    [_fmdbQueue inTransaction:^(FMDatabase *db, BOOL *rollback) {
+        // The checkpoint row may not exist yet if nothing has been checkpointed.
+        result = [db executeUpdate:@"INSERT OR IGNORE INTO replicators (remote, push) "
+                                   @"VALUES (?, -1)"
+              withErrorAndBindings:error, checkpointID] &&
+                 [db executeUpdate:@"UPDATE replicators SET known_revs=? WHERE remote=?"
+              withErrorAndBindings:error, knownJson, checkpointID];
+        *rollback = !result;
+    }];
+    return result;
+}
+
 + (NSString *)joinQuotedStrings:(NSArray *)strings
 {
     if (strings.count == 0) return @"";
@@ -136,35 +201,89 @@
     return result;
 }
 
+// Lists longer than this are spliced into the SQL rather than bound, which keeps statements with
+// two lists well within SQLITE_MAX_VARIABLE_NUMBER (999).
+#define kMaxBoundListCount 256
+
++ (NSString *)placeholdersForStrings:(NSArray *)strings arguments:(NSMutableArray *)args
+{
+    if (strings.count > kMaxBoundListCount) return [self joinQuotedStrings:strings];
+
+    // Pad the list with NULLs (which never match an IN) up to the next power of two, so that only
+    // a handful of distinct statements exist and they stay in the statement cache.
+    NSUInteger padded = 1;
+    while (padded < strings.count) padded <<= 1;
+    NSMutableString *placeholders = [NSMutableString stringWithCapacity:padded * 2];
+    for (NSUInteger i = 0; i < padded; i++) {
+        [placeholders appendString:(i ? @",?" : @"?")];
+        [args addObject:(i < strings.count ? strings[i] : [NSNull null])];
+    }
+    return placeholders;
+}
+
+// Most (docid, revid) pairs bound to one statement of -findMissingRevisions:, well within
+// SQLITE_MAX_VARIABLE_NUMBER (999).
+#define kMaxBoundPairCount 256
+
++ (NSString *)pairPlaceholdersForRevisions:(NSArray<TD_Revision *> *)revs
+                                 arguments:(NSMutableArray *)args
+{
+    // Padded with rows of NULLs, which never match, as -placeholdersForStrings:arguments: does
+    NSUInteger padded = 1;
+    while (padded < revs.count) padded <<= 1;
+    NSMutableString *placeholders = [NSMutableString stringWithCapacity:padded * 8];
+    for (NSUInteger i = 0; i < padded; i++) {
+        [placeholders appendString:(i ? @",(?,?)" : @"(?,?)")];
+        if (i < revs.count) {
+            [args addObject:revs[i].docID];
+            [args addObject:revs[i].revID];
+        } else {
+            [args addObject:[NSNull null]];
+            [args addObject:[NSNull null]];
+        }
+    }
+    return placeholders;
+}
+
 - (BOOL)findMissingRevisions:(TD_RevisionList *)revs
 {
     if (revs.count == 0) return YES;
 
+    NSArray<TD_Revision *> *allRevs = [revs.allRevisions copy];
     __block BOOL result = YES;
-    [_fmdbQueue inDatabase:^(FMDatabase *db) {
-        NSString *sql = $sprintf(@"SELECT docid, revid FROM revs, docs "
-                                  "WHERE revid in (%@) AND docid IN (%@) "
-                                  "AND revs.doc_id == docs.doc_id",
-                                 [TD_Database joinQuotedStrings:revs.allRevIDs],
-                                 [TD_Database joinQuotedStrings:revs.allDocIDs]);
-        // ?? Not sure sqlite will optimize this fully. May need a first query that looks up all
-        // the numeric doc_ids from the docids.
-        FMResultSet *r = [db executeQuery:sql];
-        if (!r) {
-            result = NO;
-            return;
-        }
-        while ([r next]) {
-            @autoreleasepool
-            {
-                TD_Revision *rev =
-                    [revs revWithDocID:[r stringForColumnIndex:0] revID:[r stringForColumnIndex:1]];
-                if (rev) {
-                    [revs removeRev:rev];
+    [self inReadTransaction:^(FMDatabase *db) {
+        // The pairs are joined to docs and revs through their indexes, so each one costs a
+        // couple of index lookups, and nothing matches a docid and revid of different pairs.
+        for (NSUInteger start = 0; start < allRevs.count; start += kMaxBoundPairCount) {
+            NSRange range =
+                NSMakeRange(start, MIN(kMaxBoundPairCount, allRevs.count - start));
+            NSMutableArray *args = [NSMutableArray array];
+            NSString *pairs =
+                [TD_Database pairPlaceholdersForRevisions:[allRevs subarrayWithRange:range]
+                                                arguments:args];
+            NSString *sql = $sprintf(@"WITH wanted(docid, revid) AS (VALUES %@) "
+                                      "SELECT wanted.docid, wanted.revid FROM wanted "
+                                      "JOIN docs ON docs.docid = wanted.docid "
+                                      "JOIN revs ON revs.doc_id = docs.doc_id "
+                                      "AND revs.revid = wanted.revid",
+                                     pairs);
+            FMResultSet *r = [db executeQuery:sql withArgumentsInArray:args];
+            if (!r) {
+                result = NO;
+                return;
+            }
+            while ([r next]) {
+                @autoreleasepool
+                {
+                    TD_Revision *rev = [revs revWithDocID:[r stringForColumnIndex:0]
+                                                    revID:[r stringForColumnIndex:1]];
+                    if (rev) {
+                        [revs removeRev:rev];
+                    }
                 }
             }
+            [r close];
         }
-        [r close];
     }];
     return result;
 }
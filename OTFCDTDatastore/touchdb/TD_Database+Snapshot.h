@@ -0,0 +1,51 @@
+//
+//  TD_Database+Snapshot.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/** Name of the manifest within a snapshot directory. */
+extern NSString* const kTDSnapshotManifestName;
+
+/**
+ Snapshots are for shipping a database that has already been replicated, so that a new install
+ can start from it rather than pulling everything from the server.
+
+ A snapshot is a directory holding a compacted and vacuumed copy of the database file, a copy of
+ its attachments, and a manifest.json giving the snapshot's format, the database's last sequence
+ and document count, and the last source sequence of each replication checkpoint it contains.
+ */
+@interface TD_Database (Snapshot)
+
+/** Writes a snapshot of this open database into `directory`, which is created if need be but
+    mustn't already hold a snapshot. The copy is read from one read transaction's view of the
+    database, so writes can carry on meanwhile. Encrypted databases can't be exported, as every
+    install of the snapshot would share the key. */
+- (BOOL)exportSnapshotToDirectory:(NSString*)directory error:(NSError**)outError;
+
+/** Installs the snapshot in `directory` as this database, which must be closed and not exist yet.
+
+    The installed copy is given new UUIDs, so that it replicates as a database of its own rather
+    than sharing push checkpoints with every other install. The UUID it had is kept as
+    snapshotUUID, under which pull replications find the snapshot's checkpoints and carry on from
+    them, fetching only what has changed on the server since the snapshot was made. */
+- (BOOL)importSnapshotFromDirectory:(NSString*)directory error:(NSError**)outError;
+
+/** The private UUID of the database this one was imported from as a snapshot, or nil. */
+@property (readonly, nullable) NSString* snapshotUUID;
+
+@end
+
+NS_ASSUME_NONNULL_END
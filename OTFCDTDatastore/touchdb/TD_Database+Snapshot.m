@@ -0,0 +1,229 @@
+//
+//  TD_Database+Snapshot.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database+Snapshot.h"
+#import "TD_Database+Archive.h"
+#import "TD_Database+Insertion.h"
+#import "TDInternal.h"
+#import "TDJSON.h"
+#import "TDMisc.h"
+#import "TDDatabaseQueue.h"
+#import "TDReadConnectionPool.h"
+#import "CDTEncryptionKeyNilProvider.h"
+#import "CDTLogging.h"
+#import <fmdb/FMDatabase.h>
+#import <fmdb/FMDatabaseAdditions.h>
+#import <fmdb/FMDatabaseQueue.h>
+#import <fmdb/FMResultSet.h>
+
+NSString* const kTDSnapshotManifestName = @"manifest.json";
+
+static NSString* const kSnapshotDatabaseName = @"snapshot.touchdb";
+static const NSInteger kSnapshotFormat = 1;
+
+static NSError* snapshotError(TDStatus status, NSString* reason)
+{
+    return TDStatusToNSErrorWithInfo(status, nil, @{NSLocalizedFailureReasonErrorKey : reason});
+}
+
+@implementation TD_Database (Snapshot)
+
+- (BOOL)exportSnapshotToDirectory:(NSString*)directory error:(NSError**)outError
+{
+    if (!self.isOpen) {
+        if (outError) *outError = snapshotError(kTDStatusNotFound, @"Database isn't open");
+        return NO;
+    }
+    if (_encrypted) {
+        if (outError) {
+            *outError = snapshotError(kTDStatusForbidden, @"Encrypted databases can't be exported");
+        }
+        return NO;
+    }
+
+    NSFileManager* fmgr = [NSFileManager defaultManager];
+    NSString* dbPath = [directory stringByAppendingPathComponent:kSnapshotDatabaseName];
+    NSString* manifestPath = [directory stringByAppendingPathComponent:kTDSnapshotManifestName];
+    if (![fmgr createDirectoryAtPath:directory
+            withIntermediateDirectories:YES
+                             attributes:nil
+                                  error:outError]) {
+        return NO;
+    }
+    if ([fmgr fileExistsAtPath:dbPath] || [fmgr fileExistsAtPath:manifestPath]) {
+        if (outError) *outError = snapshotError(kTDStatusDuplicate, @"Snapshot already exists");
+        return NO;
+    }
+
+    // VACUUM INTO can't run in a transaction, but it reads one consistent view of the database
+    // all the same. A read connection leaves the writer free while it does.
+    __block BOOL copied = NO;
+    __block NSError* error = nil;
+    void (^vacuumInto)(FMDatabase*) = ^(FMDatabase* db) {
+        copied = [db executeUpdate:@"VACUUM INTO ?", dbPath];
+        if (!copied) error = db.lastError;
+    };
+    if (_readPool.count == 0 || ![_readPool inDatabase:vacuumInto]) {
+        [_fmdbQueue inDatabase:vacuumInto];
+    }
+    if (!copied) {
+        os_log_error(CDTOSLog, "%{public}@: Couldn't copy database into snapshot: %{public}@", self, error);
+        if (outError) *outError = error;
+        return NO;
+    }
+
+    // Blobs are never changed once written, so copying them after the database can at worst
+    // pick up blobs the copy doesn't use, and compacting it below deletes those again.
+    NSString* attachmentsPath = [TD_Database attachmentStorePathWithDatabasePath:dbPath];
+    if ([fmgr fileExistsAtPath:self.attachmentStorePath] &&
+        ![fmgr copyItemAtPath:self.attachmentStorePath toPath:attachmentsPath error:outError]) {
+        [TD_Database removeDatabaseFilesAtPath:dbPath];
+        return NO;
+    }
+
+    // A snapshot keeps archived bodies in its database. They're read from the archive after the
+    // database was copied, so every body the copy marks archived is there, unless its revision
+    // has been compacted away in the meantime, which compacting the copy does too.
+    TD_Database* snapshot = [[TD_Database alloc] initWithPath:dbPath];
+    NSDictionary* manifest = nil;
+    if ([snapshot openWithEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]]) {
+        if ((!self.hasArchive ||
+             [snapshot restoreBodiesFromArchiveAtPath:[TD_Database archivePathWithDatabasePath:_path]
+                                                error:nil]) &&
+            [snapshot compact] == kTDStatusOK) {
+            manifest = [snapshot snapshotManifest];
+        }
+        [snapshot close];
+    }
+    NSData* manifestJSON =
+        manifest ? [TDJSON dataWithJSONObject:manifest options:TDJSONWritingPrettyPrinted error:outError]
+                 : nil;
+    if (!manifestJSON || ![manifestJSON writeToFile:manifestPath options:NSDataWritingAtomic error:outError]) {
+        if (!manifest && outError) {
+            *outError = snapshotError(kTDStatusDBError, @"Couldn't compact the snapshot");
+        }
+        [TD_Database removeDatabaseFilesAtPath:dbPath];
+        return NO;
+    }
+    os_log_info(CDTOSLog, "%{public}@: Exported snapshot at sequence %{public}@ to %{public}@", self,
+                manifest[@"last_sequence"], directory);
+    return YES;
+}
+
+// callers: -exportSnapshotToDirectory:error:, on the open snapshot copy
+- (NSDictionary*)snapshotManifest
+{
+    __block NSDictionary* manifest = nil;
+    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        NSMutableDictionary* checkpoints = [NSMutableDictionary dictionary];
+        FMResultSet* r = [db executeQuery:@"SELECT remote, last_sequence FROM replicators"];
+        while ([r next]) {
+            NSData* json = [r dataForColumnIndex:1];
+            NSDictionary* checkpoint =
+                json ? $castIf(NSDictionary, [TDJSON JSONObjectWithData:json options:0 error:nil])
+                     : nil;
+            id sequence = checkpoint[@"source_last_seq"] ?: checkpoint[@"seq"];
+            if (sequence) checkpoints[[r stringForColumnIndex:0]] = sequence;
+        }
+        [r close];
+
+        manifest = @{
+            @"format" : @(kSnapshotFormat),
+            @"database" : kSnapshotDatabaseName,
+            @"attachments" : [TD_Database attachmentStorePathWithDatabasePath:kSnapshotDatabaseName],
+            @"created" : [[[NSISO8601DateFormatter alloc] init] stringFromDate:[NSDate date]],
+            @"private_uuid" : [db stringForQuery:@"SELECT value FROM info WHERE key='privateUUID'"],
+            @"last_sequence" : @([db longLongForQuery:@"SELECT MAX(sequence) FROM revs"]),
+            @"document_count" :
+                @([db longLongForQuery:@"SELECT COUNT(*) FROM docs WHERE EXISTS (SELECT 1 FROM "
+                                       @"revs WHERE revs.doc_id=docs.doc_id AND current=1 AND "
+                                       @"deleted=0)"]),
+            @"checkpoints" : checkpoints
+        };
+    }];
+    return manifest;
+}
+
+- (BOOL)importSnapshotFromDirectory:(NSString*)directory error:(NSError**)outError
+{
+    Assert(![self isOpen], @"Already-open database cannot be replaced");
+    if (self.inMemory) {
+        if (outError) *outError = snapshotError(kTDStatusBadRequest, @"Database is in memory");
+        return NO;
+    }
+    if (self.exists) {
+        if (outError) *outError = snapshotError(kTDStatusDuplicate, @"Database already exists");
+        return NO;
+    }
+
+    NSString* manifestPath = [directory stringByAppendingPathComponent:kTDSnapshotManifestName];
+    NSData* manifestJSON = [NSData dataWithContentsOfFile:manifestPath options:0 error:outError];
+    if (!manifestJSON) return NO;
+    NSDictionary* manifest =
+        $castIf(NSDictionary, [TDJSON JSONObjectWithData:manifestJSON options:0 error:outError]);
+    NSString* dbName = $castIf(NSString, manifest[@"database"]);
+    NSString* uuid = $castIf(NSString, manifest[@"private_uuid"]);
+    if ([manifest[@"format"] integerValue] != kSnapshotFormat || !dbName || !uuid) {
+        if (outError) *outError = snapshotError(kTDStatusBadRequest, @"Not a snapshot manifest");
+        return NO;
+    }
+    NSString* dbPath = [directory stringByAppendingPathComponent:dbName];
+    NSString* attachmentsPath = nil;
+    NSString* attachmentsName = $castIf(NSString, manifest[@"attachments"]);
+    if (attachmentsName) {
+        attachmentsPath = [directory stringByAppendingPathComponent:attachmentsName];
+        if (![[NSFileManager defaultManager] fileExistsAtPath:attachmentsPath]) attachmentsPath = nil;
+    }
+
+    if (![self replaceWithDatabaseFile:dbPath withAttachments:attachmentsPath error:outError]) {
+        [TD_Database removeDatabaseFilesAtPath:_path];
+        return NO;
+    }
+
+    // Give the copy an identity of its own, remembering the snapshot's for its checkpoints
+    __block BOOL ok = NO;
+    FMDatabaseQueue* queue = [TD_Database queueForDatabaseAtPath:_path readOnly:NO];
+    [queue inTransaction:^(FMDatabase* db, BOOL* rollback) {
+        NSString* current = [db stringForQuery:@"SELECT value FROM info WHERE key='privateUUID'"];
+        ok = [current isEqualToString:uuid] &&
+             [db executeUpdate:@"INSERT OR REPLACE INTO info (key, value) VALUES ('snapshotUUID', ?)",
+                               uuid] &&
+             [db executeUpdate:@"UPDATE info SET value=? WHERE key='privateUUID'", TDCreateUUID()] &&
+             [db executeUpdate:@"UPDATE info SET value=? WHERE key='publicUUID'", TDCreateUUID()];
+        *rollback = !ok;
+    }];
+    [queue close];
+
+    if (!ok) {
+        if (outError) {
+            *outError = snapshotError(kTDStatusCorruptError, @"Snapshot doesn't match its manifest");
+        }
+        [TD_Database removeDatabaseFilesAtPath:_path];
+        return NO;
+    }
+    os_log_info(CDTOSLog, "%{public}@: Imported snapshot at sequence %{public}@ from %{public}@", self,
+                manifest[@"last_sequence"], directory);
+    return YES;
+}
+
+- (NSString*)snapshotUUID
+{
+    __block NSString* result;
+    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        result = [db stringForQuery:@"SELECT value FROM info WHERE key='snapshotUUID'"];
+    }];
+    return result;
+}
+
+@end
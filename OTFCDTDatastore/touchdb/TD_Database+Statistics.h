@@ -0,0 +1,52 @@
+//
+//  TD_Database+Statistics.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Cheap-to-gather figures about a database's storage and use, none of which need a table scan.
+ */
+@interface TD_Database (Statistics)
+
+/** Size in bytes of the main database file. */
+@property (readonly) UInt64 fileSize;
+
+/** Size in bytes of the write-ahead log, which is 0 once it has been checkpointed and truncated. */
+@property (readonly) UInt64 walFileSize;
+
+/** Bytes within the database file on its free list, which VACUUM would give back. */
+@property (readonly) UInt64 freeSpace;
+
+/** Total size in bytes of the files in the attachment store. */
+@property (readonly) UInt64 attachmentStoreSize;
+
+/** For each view, keyed by name, how many sequences it is behind the database. */
+@property (readonly) NSDictionary<NSString*, NSNumber*>* viewSequenceLag;
+
+/** Page cache hits and misses summed over the writer and every read connection since they were
+    opened. Either may be NULL. */
+- (void)getPageCacheHits:(nullable UInt64*)outHits misses:(nullable UInt64*)outMisses;
+
+/** Transactions run on the writer connection since the database was opened, and how long they
+    took. Any of the out parameters may be NULL. */
+- (void)getTransactionCount:(nullable NSUInteger*)outCount
+                 rolledBack:(nullable NSUInteger*)outRolledBack
+                  totalTime:(nullable NSTimeInterval*)outTotalTime
+                    maxTime:(nullable NSTimeInterval*)outMaxTime;
+
+@end
+
+NS_ASSUME_NONNULL_END
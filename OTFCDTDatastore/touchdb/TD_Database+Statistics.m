@@ -0,0 +1,109 @@
+//
+//  TD_Database+Statistics.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database+Statistics.h"
+#import "TDInternal.h"
+#import "TDDatabaseQueue.h"
+#import "TDReadConnectionPool.h"
+#import <fmdb/FMDatabase.h>
+#import <fmdb/FMDatabaseAdditions.h>
+#import <fmdb/FMResultSet.h>
+#import <sqlite3.h>
+
+static UInt64 fileSizeAtPath(NSString* path)
+{
+    NSDictionary* attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path error:nil];
+    return attributes.fileSize;
+}
+
+@implementation TD_Database (Statistics)
+
+- (UInt64)fileSize { return fileSizeAtPath(_path); }
+
+- (UInt64)walFileSize { return fileSizeAtPath([_path stringByAppendingString:@"-wal"]); }
+
+- (UInt64)freeSpace
+{
+    __block UInt64 result = 0;
+    [self inReadTransaction:^(FMDatabase* db) {
+        result = (UInt64)[db longLongForQuery:@"PRAGMA freelist_count"] *
+                 (UInt64)[db longLongForQuery:@"PRAGMA page_size"];
+    }];
+    return result;
+}
+
+- (UInt64)attachmentStoreSize
+{
+    UInt64 result = 0;
+    NSDirectoryEnumerator* files =
+        [[NSFileManager defaultManager] enumeratorAtPath:self.attachmentStorePath];
+    while ([files nextObject]) {
+        if ([files.fileAttributes.fileType isEqualToString:NSFileTypeRegular]) {
+            result += files.fileAttributes.fileSize;
+        }
+    }
+    return result;
+}
+
+- (NSDictionary<NSString*, NSNumber*>*)viewSequenceLag
+{
+    NSMutableDictionary* result = [NSMutableDictionary dictionary];
+    [self inReadTransaction:^(FMDatabase* db) {
+        // Read in the same snapshot as the views, so a concurrent write can't make a lag negative.
+        SequenceNumber lastSequence = [db longLongForQuery:@"SELECT MAX(sequence) FROM revs"];
+        FMResultSet* r = [db executeQuery:@"SELECT name, lastSequence FROM views"];
+        while ([r next]) {
+            SequenceNumber viewSequence = [r longLongIntForColumnIndex:1];
+            result[[r stringForColumnIndex:0]] = @(MAX(lastSequence - viewSequence, 0));
+        }
+        [r close];
+    }];
+    return result;
+}
+
+- (void)getPageCacheHits:(UInt64*)outHits misses:(UInt64*)outMisses
+{
+    __block UInt64 hits = 0, misses = 0;
+    void (^addCounts)(FMDatabase*) = ^(FMDatabase* db) {
+        int current, highwater;
+        if (sqlite3_db_status(db.sqliteHandle, SQLITE_DBSTATUS_CACHE_HIT, &current, &highwater,
+                              0) == SQLITE_OK) {
+            hits += (UInt64)current;
+        }
+        if (sqlite3_db_status(db.sqliteHandle, SQLITE_DBSTATUS_CACHE_MISS, &current, &highwater,
+                              0) == SQLITE_OK) {
+            misses += (UInt64)current;
+        }
+    };
+    [self inDatabaseIfOpen:addCounts];
+    [_readPool inEachDatabase:addCounts];
+    if (outHits) *outHits = hits;
+    if (outMisses) *outMisses = misses;
+}
+
+- (void)getTransactionCount:(NSUInteger*)outCount
+                 rolledBack:(NSUInteger*)outRolledBack
+                  totalTime:(NSTimeInterval*)outTotalTime
+                    maxTime:(NSTimeInterval*)outMaxTime
+{
+    TDDatabaseQueue* queue = [_fmdbQueue isKindOfClass:[TDDatabaseQueue class]]
+                                 ? (TDDatabaseQueue*)_fmdbQueue
+                                 : nil;
+    if (outCount) *outCount = queue.transactionCount;
+    if (outRolledBack) *outRolledBack = queue.rolledBackTransactionCount;
+    if (outTotalTime) *outTotalTime = queue.totalTransactionTime;
+    if (outMaxTime) *outMaxTime = queue.maxTransactionTime;
+}
+
+@end
@@ -0,0 +1,49 @@
+//
+//  TD_Database+Tombstones.h
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/** The local document in which -purgeTombstonesDeletedBefore:... keeps its place. */
+extern NSString* const kTDTombstonePurgeProgressDocID;
+
+@interface TD_Database (Tombstones)
+
+/** Purges documents that were deleted a while ago, removing them and their revision history
+    completely, as -purgeRevisions:result: does. A document is purged once every one of its leaf
+    revisions is a tombstone and the newest of them was inserted before `date`; documents with a
+    live conflicting revision are left alone.
+    Tombstones are looked at in sequence order, a batch per short write transaction, until the
+    time budget runs out. The last sequence looked at is saved in a local document, so the next
+    call carries on from there even if the database was closed in between. Once every tombstone
+    has been looked at the place is forgotten, and the next call starts again from the first.
+    @param date  Only tombstones inserted before this are purged.
+    @param checkpointID  If not nil, only tombstones that a push replication with this checkpoint
+        ID has already sent to the remote are purged, i.e. those up to its checkpointed sequence
+        or recorded as known to the remote. Tombstones that haven't been pushed are skipped on
+        this pass and looked at again on the next.
+    @param timeBudget  Roughly how long the call may take; it stops after the batch in progress.
+    @param outPurged  On return, how many documents were purged. May be NULL.
+    @param outFinished  On return, YES if every tombstone has been looked at. May be NULL.
+    @return  kTDStatusOK, or an error status. */
+- (TDStatus)purgeTombstonesDeletedBefore:(NSDate*)date
+                      pushedToCheckpoint:(nullable NSString*)checkpointID
+                              timeBudget:(NSTimeInterval)timeBudget
+                                  purged:(nullable NSUInteger*)outPurged
+                                finished:(nullable BOOL*)outFinished;
+
+@end
+
+NS_ASSUME_NONNULL_END
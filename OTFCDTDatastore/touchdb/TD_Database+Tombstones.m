@@ -0,0 +1,147 @@
+//
+//  TD_Database+Tombstones.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "TD_Database+Tombstones.h"
+#import "TD_Database+LocalDocs.h"
+#import "TD_Revision.h"
+#import "TDInternal.h"
+#import "TDRevisionHistoryCache.h"
+#import "TDMisc.h"
+#import "CDTLogging.h"
+#import <fmdb/FMDatabase.h>
+#import <fmdb/FMDatabaseAdditions.h>
+#import "FMDatabase+LongLong.h"
+
+NSString* const kTDTombstonePurgeProgressDocID = @"_local/_tombstone_purge";
+
+static const NSUInteger kTombstonePurgeBatchSize = 100;
+
+/** The highest sequence a push checkpoint records, or 0 if it has none. */
+static SequenceNumber checkpointedSequence(NSDictionary* checkpoint)
+{
+    // The pusher's sequences are local ones, although older checkpoints stored them as strings
+    id sequence = checkpoint[@"source_last_seq"] ?: checkpoint[@"lastSequence"];
+    if ([sequence isKindOfClass:[NSNumber class]] || [sequence isKindOfClass:[NSString class]]) {
+        return MAX([sequence longLongValue], 0);
+    }
+    return 0;
+}
+
+@implementation TD_Database (Tombstones)
+
+- (TDStatus)purgeTombstonesDeletedBefore:(NSDate*)date
+                      pushedToCheckpoint:(NSString*)checkpointID
+                              timeBudget:(NSTimeInterval)timeBudget
+                                  purged:(NSUInteger*)outPurged
+                                finished:(BOOL*)outFinished
+{
+    if (outPurged) *outPurged = 0;
+    if (outFinished) *outFinished = NO;
+    if (!self.isOpen) return kTDStatusNotFound;
+
+    CFAbsoluteTime deadline = CFAbsoluteTimeGetCurrent() + timeBudget;
+    SequenceNumber pushedSequence = INT64_MAX;
+    NSIndexSet* knownSequences = nil;
+    if (checkpointID) {
+        pushedSequence = checkpointedSequence([self checkpointDocumentWithID:checkpointID]);
+        knownSequences = [self knownRemoteSequencesForCheckpointID:checkpointID];
+    }
+
+    // A place saved for a different checkpoint may have skipped tombstones this one has pushed
+    TD_Revision* progress =
+        [self getLocalDocumentWithID:kTDTombstonePurgeProgressDocID revisionID:nil];
+    NSString* progressCheckpoint = checkpointID ?: @"";
+    SequenceNumber cursor = 0;
+    if ($equal(progress.properties[@"checkpoint"], progressCheckpoint)) {
+        cursor = [$castIf(NSNumber, progress.properties[@"sequence"]) longLongValue];
+    }
+    os_log_debug(CDTOSLog, "%{public}@: Purging tombstones from before %{public}@ after sequence %lld",
+                 self, date, cursor);
+
+    NSTimeInterval before = date.timeIntervalSince1970;
+    NSUInteger purged = 0;
+    BOOL finished = NO;
+    TDStatus status = kTDStatusOK;
+    while (!finished && CFAbsoluteTimeGetCurrent() < deadline) {
+        NSMutableArray<NSString*>* purgedDocIDs = [NSMutableArray array];
+        __block SequenceNumber last = cursor;
+        __block NSUInteger found = 0;
+        // Looked up in the same transaction as the purge, so a document resurrected in the
+        // meantime can't be lost
+        status = [self inTransaction:^TDStatus(FMDatabase* db) {
+            FMResultSet* r = [db executeQuery:
+                @"SELECT tombstones.sequence, revs.doc_id, docs.docid FROM tombstones "
+                 "JOIN revs ON revs.sequence = tombstones.sequence "
+                 "JOIN docs ON docs.doc_id = revs.doc_id "
+                 "WHERE tombstones.sequence > ? AND tombstones.deleted_at < ? AND revs.current=1 "
+                 "AND NOT EXISTS (SELECT 1 FROM revs AS leaf WHERE leaf.doc_id = revs.doc_id "
+                 "AND leaf.current=1 AND (leaf.deleted=0 OR leaf.sequence > revs.sequence)) "
+                 "ORDER BY tombstones.sequence LIMIT ?",
+                @(cursor), @(before), @(kTombstonePurgeBatchSize)];
+            if (!r) return kTDStatusDBError;
+            NSMutableArray<NSNumber*>* docNumericIDs = [NSMutableArray array];
+            while ([r next]) {
+                SequenceNumber sequence = [r longLongIntForColumnIndex:0];
+                last = sequence;
+                found++;
+                if (sequence <= pushedSequence ||
+                    [knownSequences containsIndex:(NSUInteger)sequence]) {
+                    [docNumericIDs addObject:@([r longLongIntForColumnIndex:1])];
+                    [purgedDocIDs addObject:[r stringForColumnIndex:2]];
+                }
+            }
+            [r close];
+
+            // Foreign keys may be off for a bulk load, so the revisions go before the document
+            for (NSNumber* docNumericID in docNumericIDs) {
+                if (![db executeUpdate:@"DELETE FROM revs WHERE doc_id=?", docNumericID] ||
+                    ![db executeUpdate:@"DELETE FROM docs WHERE doc_id=?", docNumericID]) {
+                    return kTDStatusDBError;
+                }
+            }
+            return kTDStatusOK;
+        }];
+        if (TDStatusIsError(status)) break;
+
+        for (NSString* docID in purgedDocIDs) [_historyCache removeDocumentID:docID];
+        purged += purgedDocIDs.count;
+        cursor = last;
+        finished = found < kTombstonePurgeBatchSize;
+    }
+
+    // Saved even after an error, so that the batches already done needn't be looked at again
+    TDStatus saved;
+    if (finished) {
+        saved = progress ? [self deleteLocalDocumentWithID:kTDTombstonePurgeProgressDocID
+                                                revisionID:progress.revID]
+                         : kTDStatusOK;
+    } else {
+        TD_Revision* rev = [[TD_Revision alloc] initWithDocID:kTDTombstonePurgeProgressDocID
+                                                        revID:nil
+                                                      deleted:NO];
+        rev.properties = @{ @"sequence" : @(cursor), @"checkpoint" : progressCheckpoint };
+        [self putLocalRevision:rev prevRevisionID:progress.revID status:&saved];
+    }
+    if (TDStatusIsError(saved)) {
+        os_log_error(CDTOSLog, "%{public}@: Couldn't save tombstone purge progress: %d", self, saved);
+    }
+
+    os_log_info(CDTOSLog, "%{public}@: Purged %lu tombstones%{public}@", self,
+                (unsigned long)purged, finished ? @"" : @"; more to look at");
+    if (outPurged) *outPurged = purged;
+    if (outFinished) *outFinished = finished;
+    return status;
+}
+
+@end
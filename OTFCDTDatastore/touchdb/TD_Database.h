@@ -23,15 +23,25 @@
 
 @protocol CDTEncryptionKeyProvider;
 
-@class FMDatabase, FMDatabaseQueue, TD_View, TDBlobStore;
+@class FMDatabase, FMDatabaseQueue, TD_View, TDBlobStore, TDReadConnectionPool, TDSharedBlobStore;
+@class TDRevisionHistoryCache, CDTQueueTelemetry, CDTSlowOperationLog, TDGroupCommitter, TDWALCheckpointer;
+@class TDLocalDocCache, TDProcessChangeNotifier, TDBlobFilenameCache;
 
 struct TDQueryOptions;  // declared in TD_View.h
 
 /** NSNotification posted when a document is updated.
     UserInfo keys: @"rev": the new TD_Revision, @"source": NSURL of remote db pulled from,
-    @"winner": new winning TD_Revision, _if_ it changed (often same as rev). */
+    @"winner": new winning TD_Revision, _if_ it changed (often same as rev).
+    When several revisions are committed together (e.g. -putRevisions:...), a single notification
+    is posted instead, with keys @"revs": NSArray of the new TD_Revisions, and @"winners": NSArray
+    of the same length holding the new winning TD_Revision for each, or NSNull if unchanged. */
 extern NSString* const TD_DatabaseChangeNotification;
 
+/** NSNotification posted when documents are purged without being asked for, as when they expire,
+    which leaves nothing in the changes feed for the documents' indexes to see.
+    UserInfo keys: @"docIDs": NSArray of the IDs of the purged documents. */
+extern NSString* const TD_DatabasePurgedNotification;
+
 /** NSNotification posted when a database is closing. */
 extern NSString* const TD_DatabaseWillCloseNotification;
 
@@ -49,6 +59,7 @@ enum {
     kTDLeaveAttachmentsEncoded = 32,  // i.e. don't decode
     kTDBigAttachmentsFollow = 64,     // i.e. add 'follows' key instead of data for big ones
     kTDNoBody = 128,                  // omit regular doc body properties
+    kTDStoredBody = 256,              // body as stored, unparsed and without '_' properties
 };
 
 /** Options for _changes feed (-changesSinceSequence:). */
@@ -63,6 +74,19 @@ typedef struct TDChangesOptions
 
 extern const TDChangesOptions kDefaultTDChangesOptions;
 
+/** How hard the database works to make each commit survive a crash or power loss. */
+typedef NS_ENUM(NSInteger, TDDurability) {
+    /** Commits are synced to disk before they return (synchronous=FULL, SQLite's default). */
+    kTDDurabilityFull = 0,
+    /** Commits are synced at WAL checkpoints only (synchronous=NORMAL). The database can't be
+        corrupted, but the last commits before a power loss may be lost. */
+    kTDDurabilityNormal,
+    /** Nothing is synced (synchronous=OFF), and foreign key constraints aren't checked while
+        replicated revisions are force-inserted. For bulk imports and databases that can be
+        thrown away: after a power loss the database may be corrupt. */
+    kTDDurabilityBulkLoad,
+};
+
 /** A TouchDB database. */
 @interface TD_Database : NSObject {
 
@@ -70,7 +94,9 @@ extern const TDChangesOptions kDefaultTDChangesOptions;
     NSString* _path;
     NSString* _name;
     FMDatabaseQueue* _fmdbQueue;
+    TDReadConnectionPool* _readPool;
     id<CDTEncryptionKeyProvider> _keyProviderToOpenDB;
+    id<CDTEncryptionKeyProvider> _previousAttachmentKeyProvider;  // while a rekey is unfinished
     BOOL _readOnly;
     int _transactionLevel;
     NSMutableDictionary* _views;
@@ -78,6 +104,31 @@ extern const TDChangesOptions kDefaultTDChangesOptions;
     TDBlobStore* _attachments;
     NSMutableDictionary* _pendingAttachmentsByDigest;
     NSMutableArray* _activeReplicators;
+    int _compactionPhase;
+    SequenceNumber _compactionSequence;  // or, while stemming, the last doc_id stemmed
+    TDRevisionHistoryCache* _historyCache;
+    TDBlobFilenameCache* _blobFilenameCache;
+    CDTSlowOperationLog* _slowOperationLog;
+    CDTQueueTelemetry* _queueTelemetry;
+    NSObject* _attachmentsLock;
+    TDGroupCommitter* _groupCommitter;
+    TDDurability _durability;
+    UInt64 _memoryBudget;
+    UInt64 _mmapSize;
+    NSUInteger _inlineAttachmentThreshold;
+    BOOL _shardsAttachmentFiles;
+    BOOL _encrypted;
+    BOOL _archiveAttached;  // whether the writer connection has the archive attached
+    TDWALCheckpointer* _walCheckpointer;
+    TDLocalDocCache* _localDocCache;
+    TDProcessChangeNotifier* _processNotifier;
+    // Only used on the writer queue, in multi-process mode:
+    SInt64 _dataVersion;                   // the writer's PRAGMA data_version when last checked
+    SequenceNumber _otherProcessSequence;  // the last sequence looked at for others' changes
+    NSMutableDictionary* _revsWrittenHere; // sequence -> @[docID, revID] of leaves inserted
+    // Only used with inMemory:
+    NSString* _memoryURI;     // the shared-cache URI every connection to the database opens
+    FMDatabase* _memoryKeeper; // a connection kept open so the database outlives -close
 }
 
 - (id)initWithPath:(NSString*)path;
@@ -120,6 +171,21 @@ extern const TDChangesOptions kDefaultTDChangesOptions;
  */
 + (BOOL)deleteClosedDatabaseAtPath:(NSString *)path error:(NSError **)outError;
 
+/**
+ * Closes the database and moves its files, with its attachments, into a directory on the same
+ * volume. Renaming them takes no time whatever they hold, and leaves the path free for a new
+ * database; the caller deletes the directory when it will.
+ *
+ * @param directory an existing directory, which mustn't already hold a database of the same name
+ * @param outError will point to an NSError object in case of error.
+ */
+- (BOOL)moveDatabaseToDirectory:(NSString *)directory error:(NSError **)outError;
+
+/** As -moveDatabaseToDirectory:error:, for a database no instance is bound to. */
++ (BOOL)moveClosedDatabaseAtPath:(NSString *)path
+                     toDirectory:(NSString *)directory
+                           error:(NSError **)outError;
+
 /**
  * Create an empty database, i.e. it deletes all previous content and creates a new database
  *
@@ -134,13 +200,103 @@ extern const TDChangesOptions kDefaultTDChangesOptions;
 /** Should the database file be opened in read-only mode? */
 @property BOOL readOnly;
 
+/** Store for attachments shared with the other databases of the same manager, or nil. Must be set
+    before the database is opened. */
+@property (strong) TDSharedBlobStore* sharedAttachmentStore;
+
+/** If YES, the database is opened to be shared with other processes, such as an app's extensions
+    that open it from an App Group container. A write by any of them is broadcast (see
+    TDProcessChangeNotifier) to the others, which then drop what they'd cached from before it and
+    post a TD_DatabaseChangeNotification for the revisions it added. Local documents are written
+    straight through rather than behind. Must be set before the database is opened. */
+@property BOOL multiProcess;
+
+/** If YES, the database is kept in memory rather than in the file at `path`, which is never
+    written; attachments are still kept in the directories beside it. The database lasts until it
+    is deleted or this object goes, so it survives -close and compaction. It can't be encrypted,
+    and multiProcess is ignored. Must be set before the database is opened. */
+@property BOOL inMemory;
+
+/** How long a connection waits for a lock that another connection to the file holds, before
+    failing with SQLITE_BUSY. In WAL mode reads never wait for writes, so within one process this
+    only matters to checkpoints; across processes, writers also wait for each other. Defaults to 2
+    seconds, or 10 with multiProcess. Must be set before the database is opened. */
+@property (nonatomic) NSTimeInterval busyTimeout;
+
+/** MIME types of attachments to store gzip-compressed, as CouchDB's "compressible_types" setting
+    lists them: exact types such as "application/json", or prefixes such as "text/*". Attachments
+    that already arrive encoded are stored as they are. nil, the default, compresses nothing. */
+@property (copy) NSArray<NSString*>* compressibleAttachmentTypes;
+
+/** If YES, new revision bodies are stored as binary JSON (see TDBinaryJSON) rather than JSON
+    text, so they are read without parsing and single fields can be read on their own. Bodies
+    already stored in either form can always be read. Defaults to NO. */
+@property BOOL storesBinaryBodies;
+
+/** New revision bodies of at least this many bytes, as stored, are kept in the bodies table
+    rather than in their row of revs, so that a few very large documents don't spread overflow
+    pages through revs and slow down the scans of it that don't read bodies, such as those of
+    -changesSinceSequence:. Bodies already stored stay where they are. 0, the default, keeps every
+    body inline. Databases with bodies stored out of line can't be read by versions of this library
+    before schema version 214. */
+@property NSUInteger outOfLineBodyThreshold;
+
+/** Attachments stored from then on which are shorter than this many bytes are kept in the
+    attachments_inline table rather than in files of the attachment store (see
+    TDBlobStore.inlineThreshold). Attachments already stored stay where they are. 0, the default,
+    stores every attachment in a file. Databases with attachments stored inline can't be read by
+    versions of this library before schema version 215. */
+@property NSUInteger inlineAttachmentThreshold;
+
+/** If YES, attachment files written from then on are put in subdirectories of the attachment
+    store (see TDBlobStore.shardsFiles); -moveBlobFilesToShardedLayoutWithError: moves those
+    already written. Defaults to NO. Databases with sharded attachment files mustn't be compacted
+    by versions of this library before schema version 215, which would delete the
+    subdirectories. */
+@property BOOL shardsAttachmentFiles;
+
+/** If YES, the body of a revision that stops being current, when a child is added to it, is
+    stored from then on as a TDBodyDelta against the body of the revision that replaced it, when
+    that is much smaller; such bodies are rebuilt whenever they're read. Compaction still removes
+    them. Defaults to NO. Databases with bodies stored as deltas can't be read by versions of this
+    library before schema version 214. */
+@property BOOL storesHistoryAsDeltas;
+
+/** While the database is open, a provider of the key and cipher settings it was opened with.
+    The provider given to open the database is asked for its key once, as that may mean a key
+    derivation or a trip to the keychain; this holds on to the result, so other connections to
+    the database, such as the query index database's, can be opened with it at no extra cost. */
+@property (readonly, nullable) id<CDTEncryptionKeyProvider> connectionKeyProvider;
+
+/** Most generations of revisions kept back from each leaf, like CouchDB's revs_limit: older
+    ancestors are deleted by -compact and -compactWithTimeBudget:rowBudget:finished:, and pulled
+    revision histories are cut down to it. Replication is unaffected, as only the recent history
+    is needed to find common ancestors, though a conflicting edit made longer ago than that
+    shows up as a separate branch. 0, the default, keeps every revision. */
+@property NSUInteger revsLimit;
+
+/** If YES, and revsLimit is set, a document's old revisions are stemmed as each new revision of
+    it is inserted, rather than waiting for compaction. Defaults to NO. */
+@property BOOL stemsRevisionsOnInsert;
+
+/** Makes the IDs of documents created without one. nil, the default, uses TDCreateUUID. */
+@property (copy) NSString* (^documentIDGenerator)(void);
+
+/** If YES, validation blocks run concurrently and before the write transaction rather than one
+    by one inside it: for a local write ahead of taking the write lock, for pulled revisions over
+    the whole batch at once. The transaction then only checks that the revision validated against
+    is still the parent, validating again if it isn't. The blocks must then be safe to call on any
+    thread, and several at once on the same revision. Defaults to NO. */
+@property BOOL validatesConcurrently;
+
 @property (nonatomic, readonly) FMDatabaseQueue* fmdbQueue;
 
 /** Replaces the database with a copy of another database.
     This is primarily used to install a canned database on first launch of an app, in which case you
    should first check .exists to avoid replacing the database if it exists already. The canned
    database would have been copied into your app bundle at build time.
-    @param databasePath  Path of the database file that should replace this one.
+    @param databasePath  Path of the database file that should replace this one. Its archive, if
+   it has one, is copied along with it.
     @param attachmentsPath  Path of the associated attachments directory, or nil if there are no
    attachments.
     @param outError  If an error occurs, it will be stored into this parameter on return.
@@ -154,15 +310,76 @@ extern const TDChangesOptions kDefaultTDChangesOptions;
 @property (readonly) BOOL exists;
 
 @property (readonly) NSUInteger documentCount;
+/** Number of documents whose leaf revisions are all deletions. */
+@property (readonly) NSUInteger deletedDocumentCount;
+/** Number of documents with more than one non-deleted leaf revision. */
+@property (readonly) NSUInteger conflictedDocumentCount;
+/** Number of revisions stored, including deleted and non-leaf ones. */
+@property (readonly) NSUInteger revisionCount;
 @property (readonly) SequenceNumber lastSequence;
+/** Operations on the database that took longer than the log's threshold. */
+@property (readonly) CDTSlowOperationLog* slowOperationLog;
+/** How long work waited for, and then held, each of the database's connections. */
+@property (readonly) CDTQueueTelemetry* queueTelemetry;
 @property (readonly) NSString* privateUUID;
 @property (readonly) NSString* publicUUID;
 
 /** Executes the block within a database transaction.
     If the block returns a non-OK status, the transaction is aborted/rolled back.
-    Any exception raised by the block will be caught and treated as kTDStatusException. */
+    Any exception raised by the block will be caught and treated as kTDStatusException.
+    With group commit on, the transaction may be shared with blocks from other threads; the block's
+    changes are still rolled back on their own if it fails, and it returns once they're committed. */
 - (TDStatus)inTransaction:(TDStatus (^)(FMDatabase*))block;
 
+/** Group commit: while this is more than 0, writes made through -inTransaction: (which include
+    single document inserts, updates and deletes) from concurrent threads wait up to this long for
+    each other and are committed in one transaction. See TDGroupCommitter. Defaults to 0, off. */
+@property NSTimeInterval groupCommitWindow;
+
+/** Most writes committed in one group. Defaults to 64. */
+@property NSUInteger groupCommitMaxWrites;
+
+/** Durability of commits to the database. Can be changed while the database is open, but not
+    from within a transaction. Defaults to kTDDurabilityFull. */
+@property (nonatomic) TDDurability durability;
+
+/** Makes every commit so far durable, whatever the durability setting, by syncing the WAL and
+    checkpointing it into the database file. Waits for readers and writers to let it finish;
+    returns kTDStatusDBError if it couldn't. */
+- (TDStatus)checkpoint;
+
+/** Bytes of memory SQLite may use for this database: it's shared out as the page caches of the
+    writer and read connections. Can be changed while the database is open. 0, the default, leaves
+    SQLite's own defaults. */
+@property (nonatomic) UInt64 memoryBudget;
+
+/** How many bytes of the file the connections map into memory, and read from there rather than
+    with read() calls copying into their page caches. Can be changed while the database is open.
+    Ignored for encrypted databases, whose pages have to be decrypted into the cache anyway.
+    Defaults to 0, no mapping. */
+@property (nonatomic) UInt64 mmapSize;
+
+/** Frees the memory that can be got back without closing the database: SQLite's page caches and
+    cached statements on every connection, and the revision history cache. Waits for the writer
+    and readers to be idle, so it's best not called from the main thread. */
+- (void)releaseMemory;
+
+/** Executes the block on one of the database's read-only connections, so it can run concurrently
+    with writers and with other readers. All statements run by the block see the same snapshot of
+    the database. Falls back to the writer connection if no read connections are available (e.g.
+    the journal mode is not WAL). The block must not modify the database. */
+- (void)inReadTransaction:(void (^)(FMDatabase*))block;
+
+/** Executes the block with one read transaction open on a read-only connection, which every
+    -inReadTransaction: the block makes on the same thread joins rather than starting its own, so
+    they all see one snapshot of the database, however writers carry on meanwhile. Nests, joining
+    the snapshot already open. Without read connections the block just runs, as reads are made on
+    the writer connection then. The block must not modify the database. */
+- (void)inReadSnapshot:(void (^)(void))block;
+
+/** YES within a block run by -inReadSnapshot: on this thread. */
+@property (nonatomic, readonly, getter=isInReadSnapshot) BOOL inReadSnapshot;
+
 // DOCUMENTS:
 
 - (TD_Revision*)getDocumentWithID:(NSString*)docID
@@ -186,11 +403,23 @@ extern const TDChangesOptions kDefaultTDChangesOptions;
                      options:(TDContentOptions)options
                     database:(FMDatabase*)db;
 
+/** As -loadRevisionBody:options: for each of the revisions, in one read transaction and reading
+    their bodies, and the attachments of them all, with a query apiece rather than a pair per
+    revision. Returns the status of each revision, in the same order, or nil on a database error.
+    Do not call from within a queued transaction. */
+- (NSArray<NSNumber*>*)loadRevisionBodies:(NSArray<TD_Revision*>*)revs
+                                  options:(TDContentOptions)options;
+
 /** Returns an array of TDRevs in reverse chronological order,
  starting with the given revision. */
 - (NSArray*)getRevisionHistory:(TD_Revision*)rev;
 - (NSArray*)getRevisionHistory:(TD_Revision*)rev database:(FMDatabase*)db;
 
+/** The histories of many revisions, as -getRevisionHistory: returns them, keyed by each
+    revision's sequence, which must be set. Those which aren't cached are read with one query. */
+- (NSDictionary<NSNumber*, NSArray*>*)getRevisionHistoriesOfRevisions:(NSArray<TD_Revision*>*)revs
+                                                             database:(FMDatabase*)db;
+
 /** Returns the revision history as a _revisions dictionary, as returned by the REST API's
  * ?revs=true option. */
 - (NSDictionary*)getRevisionHistoryDict:(TD_Revision*)rev inDatabase:(FMDatabase*)db;
@@ -223,6 +452,15 @@ extern const TDChangesOptions kDefaultTDChangesOptions;
     Does not return revisions whose bodies have been compacted away, or deletion markers. */
 - (NSArray*)getPossibleAncestorRevisionIDs:(TD_Revision*)rev limit:(unsigned)limit;
 
+/** Same as the method above for each of a number of revisions, looked up in one read transaction.
+    Returns an array in the order of revs, with an empty array for each revision which has no
+    possible ancestors. */
+- (NSArray<NSArray*>*)getPossibleAncestorRevisionIDsOfRevisions:(NSArray<TD_Revision*>*)revs
+                                                          limit:(unsigned)limit;
+
+/** Returns those of docIDs which name documents the database has, whether deleted or not. */
+- (NSSet<NSString*>*)existingDocumentIDsAmong:(NSArray<NSString*>*)docIDs;
+
 /** Returns the most recent member of revIDs that appears in rev's ancestry. */
 - (NSString*)findCommonAncestorOf:(TD_Revision*)rev
                        withRevIDs:(NSArray*)revIDs
@@ -234,6 +472,43 @@ extern const TDChangesOptions kDefaultTDChangesOptions;
 
 - (NSDictionary*)getDocsWithIDs:(NSArray*)docIDs options:(const struct TDQueryOptions*)options;
 
+/** Calls the block with the winning revision of each document -getDocsWithIDs:options: would
+    return, in the same order, but without building any rows: the block is called with batches of
+    revisions as they're read, inside the read transaction, with the database to make any further
+    queries in, such as for the attachments of the whole batch. With options->includeDocs the
+    revisions have their sequences, and their bodies as stored, unparsed, or with options->fields
+    just those fields, parsed. Given doc IDs which don't exist are skipped. */
+- (TDStatus)enumerateDocsWithIDs:(NSArray*)docIDs
+                         options:(const struct TDQueryOptions*)options
+                      usingBlock:(void (^)(NSArray<TD_Revision*>* revs, FMDatabase* db))block;
+
+/** Returns the winning revision of each of the given documents, in the order of docIDs; documents
+    which don't exist are left out. Deleted winners are returned without a body. The body of each
+    other revision is its stored JSON, which is not parsed, and which doesn't include the special
+    "_"-prefixed properties. */
+- (NSArray*)getWinningRevisionsWithDocIDs:(NSArray*)docIDs;
+
+/** As -getWinningRevisionsWithDocIDs:, with bodies holding just the given top-level or dotted
+    fields, as +[TDJSON dictionaryWithValuesForFields:fromJSONDictionaryData:] picks them. The
+    fields are parsed straight from the rows, so the rest of each body is never copied or
+    decoded. nil fields gives the whole stored bodies. */
+- (NSArray*)getWinningRevisionsWithDocIDs:(NSArray*)docIDs fields:(NSArray<NSString*>*)fields;
+
+/** Calls the block with the winning, non-deleted revision of every document, in docID order.
+    Revisions are read pageSize documents at a time, each page in its own read transaction, so
+    memory use is bounded by the page size rather than the size of the database. The block is
+    called outside of any database transaction, so it may itself use the database.
+    Documents created or deleted during the enumeration may or may not be seen.
+    @param descending  Whether to enumerate in descending docID order.
+    @param pageSize  Number of documents to read per page.
+    @param options  Content options used to expand each revision's body.
+    @param block  Called for each revision. Set *stop to YES to end the enumeration early.
+    @return  kTDStatusOK, or an error status if a page couldn't be read. */
+- (TDStatus)enumerateDocumentsDescending:(BOOL)descending
+                                pageSize:(NSUInteger)pageSize
+                                 options:(TDContentOptions)options
+                              usingBlock:(void (^)(TD_Revision* rev, BOOL* stop))block;
+
 - (TD_View*)viewNamed:(NSString*)name;
 
 - (TD_View*)existingViewNamed:(NSString*)name;
@@ -252,4 +527,17 @@ extern const TDChangesOptions kDefaultTDChangesOptions;
                                   filter:(TD_FilterBlock)filter
                                   params:(NSDictionary*)filterParams;
 
+/** Calls the block with the winning revision of each document changed since lastSequence, in
+    order of the document's latest change, up to `limit` documents. The changes and their winners
+    are read by a single query in one read transaction; the block is then called outside of it, so
+    it may itself use the database. `sequence` is that of the document's latest change, which is
+    the sequence to continue from; the winner's own sequence may be earlier. Deleted winners have
+    no body; the body of the others is their stored JSON, which is not parsed.
+    @return  kTDStatusOK, or an error status if the changes couldn't be read. */
+- (TDStatus)enumerateWinningChangesSinceSequence:(SequenceNumber)lastSequence
+                                           limit:(NSUInteger)limit
+                                      usingBlock:(void (^)(SequenceNumber sequence,
+                                                           TD_Revision* winner,
+                                                           BOOL* stop))block;
+
 @end
@@ -21,6 +21,7 @@
 //  Modifications for this distribution by Cloudant, Inc., Copyright (c) 2014 Cloudant, Inc.
 
 #import <sqlite3.h>
+#import <objc/runtime.h>
 #import "TD_Database.h"
 #import "TD_Database+Attachments.h"
 #import "TD_Database+BlobFilenames.h"
@@ -28,8 +29,20 @@
 #import "TD_Revision.h"
 #import "TDCollateJSON.h"
 #import "TDBlobStore.h"
+#import "TDReadConnectionPool.h"
+#import "TDDatabaseQueue.h"
+#import "TDGroupCommitter.h"
+#import "TDWALCheckpointer.h"
+#import "TDProcessChangeNotifier.h"
+#import "CDTQueueTelemetry.h"
+#import "CDTSlowOperationLog.h"
+#import "TDRevisionHistoryCache.h"
+#import "TDLocalDocCache.h"
+#import "TD_Database+LocalDocs.h"
 #import "TDMisc.h"
 #import "TDJSON.h"
+#import "TDBinaryJSON.h"
+#import "TDBodyDelta.h"
 #import "Test.h"
 
 #import <fmdb/FMDatabase.h>
@@ -38,11 +51,41 @@
 #import "FMDatabase+EncryptionKey.h"
 #import <fmdb/FMDatabaseQueue.h>
 #import "CDTEncryptionKeyProvider.h"
+#import "CDTEncryptionKeyNilProvider.h"
+#import "CDTEncryptionKeySimpleProvider.h"
 #import "CDTLogging.h"
 
 NSString* const TD_DatabaseWillCloseNotification = @"TD_DatabaseWillClose";
 NSString* const TD_DatabaseWillBeDeletedNotification = @"TD_DatabaseWillBeDeleted";
 
+// Upper bound on the number of read-only connections opened alongside the writer:
+#define kMaxReadConnections 4
+
+// Number of documents whose revision histories are kept in memory
+#define kHistoryCacheCapacity 100
+
+// Number of attachment blobs whose filenames are kept in memory
+#define kBlobFilenameCacheCapacity 1000
+
+// Size the -wal file is cut back to whenever the log starts again from the beginning
+#define kJournalSizeLimit (4 * 1024 * 1024)
+
+// Default busyTimeouts: FMDB's own, and one long enough for another process's write transactions
+#define kDefaultBusyTimeout 2.0
+#define kMultiProcessBusyTimeout 10.0
+
+// Number of revisions expanded together, with one query for all their attachments
+#define kExpandBatchSize 100
+
+// Schema version the migrations in -openWithEncryptionKeyProvider: bring a database up to. Must
+// be kept in step with the last of them.
+#define kSchemaVersion 215
+
+// Associated with a read connection for the duration of -inReadTransaction:
+static char kHistoryCacheGenerationKey;
+
+extern NSDictionary* makeRevisionHistoryDict(NSArray* history);
+
 //@interface FMDatabaseCreator : NSObject
 //@end
 //@implementation FMDatabaseCreator
@@ -90,6 +133,14 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
     return [fmgr removeItemAtPath:path error:outError] || ![fmgr fileExistsAtPath:path];
 }
 
+static BOOL moveItemIfExists(NSString* path, NSString* directory, NSError** outError)
+{
+    NSFileManager* fmgr = [NSFileManager defaultManager];
+    NSString* destination = [directory stringByAppendingPathComponent:path.lastPathComponent];
+    return [fmgr moveItemAtPath:path toPath:destination error:outError] ||
+           ![fmgr fileExistsAtPath:path];
+}
+
 - (NSString*)attachmentStorePath
 {
     return [TD_Database attachmentStorePathWithDatabasePath:_path];
@@ -100,12 +151,40 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
     return [[path stringByDeletingPathExtension] stringByAppendingString:@" attachments"];
 }
 
++ (NSString *)archivePathWithDatabasePath:(NSString *)path
+{
+    return [[path stringByDeletingPathExtension] stringByAppendingPathExtension:@"archive"];
+}
+
++ (void)removeDatabaseFilesAtPath:(NSString *)path
+{
+    NSString *archivePath = [self archivePathWithDatabasePath:path];
+    for (NSString *suffix in @[ @"", @"-wal", @"-shm" ]) {
+        removeItemIfExists([path stringByAppendingString:suffix], NULL);
+        removeItemIfExists([archivePath stringByAppendingString:suffix], NULL);
+    }
+    removeItemIfExists([self attachmentStorePathWithDatabasePath:path], NULL);
+}
+
++ (NSString *)partialAttachmentDownloadsPathWithDatabasePath:(NSString *)path
+{
+    return [[path stringByDeletingPathExtension] stringByAppendingString:@" partial attachments"];
+}
+
+- (NSString*)partialAttachmentDownloadsPath
+{
+    // Partial downloads are kept in the clear, so encrypted databases don't keep them
+    if (self.attachmentStore.encrypted) return nil;
+    return [TD_Database partialAttachmentDownloadsPathWithDatabasePath:_path];
+}
+
 + (instancetype)createEmptyDBAtPath:(NSString*)path
           withEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
 {
     if (!removeItemIfExists(path, NULL)) return nil;
     TD_Database* db = [[self alloc] initWithPath:path];
     if (!removeItemIfExists(db.attachmentStorePath, NULL)) return nil;
+    if (!removeItemIfExists([self archivePathWithDatabasePath:path], NULL)) return nil;
     if (![db openWithEncryptionKeyProvider:provider]) return nil;
     return db;
 }
@@ -123,13 +202,28 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
             _pendingAttachmentsByDigest = nil;
         }
         _queue = dispatch_queue_create("com.cloudant.sync.db", NULL); //Serial dispatch queue.
+        _historyCache = [[TDRevisionHistoryCache alloc] initWithCapacity:kHistoryCacheCapacity];
+        _blobFilenameCache =
+            [[TDBlobFilenameCache alloc] initWithCountLimit:kBlobFilenameCacheCapacity];
+        _slowOperationLog = [[CDTSlowOperationLog alloc] init];
+        _queueTelemetry = [[CDTQueueTelemetry alloc] init];
+        _attachmentsLock = [[NSObject alloc] init];
+        _groupCommitter = [[TDGroupCommitter alloc] init];
+        __weak TD_Database* weakSelf = self;
+        _localDocCache = [[TDLocalDocCache alloc] initWithFlushHandler:^{
+            [weakSelf flushLocalDocuments];
+        }];
     }
     return self;
 }
 
 - (NSString*)description { return $sprintf(@"%@[%@]", [self class], _path); }
 
-- (BOOL)exists { return [TD_Database existsDatabaseAtPath:_path]; }
+- (BOOL)exists
+{
+    if (_inMemory) return _memoryKeeper != nil;
+    return [TD_Database existsDatabaseAtPath:_path];
+}
 
 + (BOOL)existsDatabaseAtPath:(NSString *)path
 {
@@ -142,11 +236,17 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
 {
     Assert(![self isOpen], @"Already-open database cannot be replaced");
     NSString* dstAttachmentsPath = self.attachmentStorePath;
+    // A backup's archive is beside it, where a database's always is
+    NSString* archivePath = [TD_Database archivePathWithDatabasePath:databasePath];
+    NSString* dstArchivePath = [TD_Database archivePathWithDatabasePath:_path];
     NSFileManager* fmgr = [NSFileManager defaultManager];
     return [fmgr copyItemAtPath:databasePath toPath:_path error:outError] &&
            removeItemIfExists(dstAttachmentsPath, outError) &&
            (!attachmentsPath ||
-            [fmgr copyItemAtPath:attachmentsPath toPath:dstAttachmentsPath error:outError]);
+            [fmgr copyItemAtPath:attachmentsPath toPath:dstAttachmentsPath error:outError]) &&
+           removeItemIfExists(dstArchivePath, outError) &&
+           (![fmgr fileExistsAtPath:archivePath] ||
+            [fmgr copyItemAtPath:archivePath toPath:dstArchivePath error:outError]);
 }
 
 #pragma mark - OPENING AND MIGRATING DB SCHEMA
@@ -207,18 +307,107 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
     return YES;
 }
 
+static NSString* TDSynchronousPragma(TDDurability durability)
+{
+    switch (durability) {
+        case kTDDurabilityNormal:
+            return @"PRAGMA synchronous = NORMAL";
+        case kTDDurabilityBulkLoad:
+            return @"PRAGMA synchronous = OFF";
+        default:
+            return @"PRAGMA synchronous = FULL";
+    }
+}
+
+static void applyMemoryBudget(FMDatabase* db, UInt64 budget, NSUInteger connections,
+                              UInt64 mmapSize)
+{
+    // Negative cache sizes are in KiB; without a budget, SQLite's default of 2000KiB
+    long long cacheKiB = budget > 0 ? MAX((long long)(budget / connections / 1024), 64LL) : 2000;
+    [db executeUpdate:$sprintf(@"PRAGMA cache_size = -%lld", cacheKiB)];
+    // The connections all map the same file, so they share the mapped pages. The pragma returns
+    // the size SQLite settled on, which is capped by SQLITE_MAX_MMAP_SIZE:
+    [[db executeQuery:$sprintf(@"PRAGMA mmap_size = %llu", mmapSize)] close];
+}
+
+static void registerCollations(FMDatabase* db)
+{
+    sqlite3_create_collation(db.sqliteHandle, "JSON", SQLITE_UTF8, kTDCollateJSON_Unicode,
+                             TDCollateJSON);
+    sqlite3_create_collation(db.sqliteHandle, "JSON_RAW", SQLITE_UTF8, kTDCollateJSON_Raw,
+                             TDCollateJSON);
+    sqlite3_create_collation(db.sqliteHandle, "JSON_ASCII", SQLITE_UTF8, kTDCollateJSON_ASCII,
+                             TDCollateJSON);
+    sqlite3_create_collation(db.sqliteHandle, "REVID", SQLITE_UTF8, NULL, TDCollateRevIDs);
+}
+
+// callers: -openFMDBWithEncryptionKeyProvider:, -openReadConnectionsWithEncryptionKeyProvider:,
+// -createArchive:
+- (BOOL)attachArchiveInDatabase:(FMDatabase*)db create:(BOOL)create
+{
+    NSString* archivePath = [TD_Database archivePathWithDatabasePath:_path];
+    BOOL attach = !_inMemory && (create || [[NSFileManager defaultManager] fileExistsAtPath:archivePath]);
+    if (attach && ![db executeUpdate:@"ATTACH DATABASE ? AS archive", archivePath]) {
+        os_log_error(CDTOSLog, "Couldn't attach archive of %{public}@: %{public}@", _path, db.lastError);
+        return NO;
+    }
+    if (attach && sqlite3_db_readonly(db.sqliteHandle, "main") == 0) {
+        // The archive has a WAL of its own, for readers to carry on while bodies are moved to it
+        [db stringForQuery:@"PRAGMA archive.journal_mode = WAL"];
+        if (![db executeUpdate:@"CREATE TABLE IF NOT EXISTS archive.bodies ( \
+                                    sequence INTEGER PRIMARY KEY, \
+                                    json BLOB NOT NULL)"]) {
+            return NO;
+        }
+    }
+    [db executeUpdate:@"DROP VIEW IF EXISTS temp.archived_bodies"];
+    return [db executeUpdate:attach ? @"CREATE TEMP VIEW archived_bodies AS "
+                                       "SELECT sequence, json FROM archive.bodies"
+                                    : @"CREATE TEMP VIEW archived_bodies AS "
+                                       "SELECT 0 AS sequence, NULL AS json WHERE 0"];
+}
+
+// callers: -openFMDBWithEncryptionKeyProvider:, -rekeyWithEncryptionKeyProvider:error:
++ (id<CDTEncryptionKeyProvider>)resolvedEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
+{
+    CDTEncryptionKey* key = [provider encryptionKey];
+    if (!key) {
+        return [CDTEncryptionKeyNilProvider provider];
+    }
+    CDTEncryptionKeySimpleProvider* resolved = [CDTEncryptionKeySimpleProvider providerWithKey:key.data];
+    if ([provider respondsToSelector:@selector(cipherSettings)]) {
+        resolved.cipherSettings = [provider cipherSettings];
+    }
+    return resolved;
+}
+
 // callers: -open, -compact
 - (BOOL)openFMDBWithEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
 {
     __block BOOL result = YES;
 
+    // Every connection opened from here on uses the same key, so it's only asked for once:
+    provider = [TD_Database resolvedEncryptionKeyProvider:provider];
+
 
+    NSTimeInterval busyTimeout = self.busyTimeout;
     dispatch_sync(self.queue, ^{
         // Create database
-        FMDatabaseQueue* queue = nil;
+        TDDatabaseQueue* queue = nil;
+
+        // Convert an encrypted db to the provider's page size, if it doesn't have it yet, as it
+        // can't be read with that page size otherwise:
+        if (result && !_readOnly && !_inMemory) {
+            NSError* error = nil;
+            result = [FMDatabase migrateDatabaseAtPath:_path toCipherSettingsOfProvider:provider error:&error];
+            if (!result) {
+                os_log_error(CDTOSLog, "Page size not changed for DB at %{public}@: %{public}@", self->_path, error);
+            }
+        }
 
         if (result) {
-            queue = [TD_Database queueForDatabaseAtPath:_path readOnly:_readOnly];
+            queue = _inMemory ? [self queueForMemoryDatabase]
+                              : [TD_Database queueForDatabaseAtPath:_path readOnly:_readOnly];
 
             result = (queue != nil);
         }
@@ -234,16 +423,23 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
             }];
         }
 
-        // Register CouchDB-compatible JSON collation functions:
+        // Register CouchDB-compatible JSON collation functions, and keep compiled statements
+        // around between calls:
+        if (result) {
+            [queue inDatabase:^(FMDatabase* db) {
+                registerCollations(db);
+                db.shouldCacheStatements = YES;
+                db.maxBusyRetryTimeInterval = busyTimeout;
+            }];
+        }
+
+        // Archived bodies are read through the view on every connection
         if (result) {
             [queue inDatabase:^(FMDatabase* db) {
-                sqlite3_create_collation(db.sqliteHandle, "JSON", SQLITE_UTF8, kTDCollateJSON_Unicode,
-                        TDCollateJSON);
-                sqlite3_create_collation(db.sqliteHandle, "JSON_RAW", SQLITE_UTF8, kTDCollateJSON_Raw,
-                        TDCollateJSON);
-                sqlite3_create_collation(db.sqliteHandle, "JSON_ASCII", SQLITE_UTF8, kTDCollateJSON_ASCII,
-                        TDCollateJSON);
-                sqlite3_create_collation(db.sqliteHandle, "REVID", SQLITE_UTF8, NULL, TDCollateRevIDs);
+                result = [self attachArchiveInDatabase:db create:NO];
+                self->_archiveAttached =
+                    result && [db stringForQuery:@"SELECT file FROM pragma_database_list "
+                                                  "WHERE name='archive'"] != nil;
             }];
         }
 
@@ -258,8 +454,24 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
             }];
         }
 
+        if (result) {
+            TDDurability durability = _durability;
+            [queue inDatabase:^(FMDatabase* db) {
+                [db executeUpdate:TDSynchronousPragma(durability)];
+                // Otherwise the -wal file stays as big as the log ever got
+                [[db executeQuery:$sprintf(@"PRAGMA journal_size_limit = %d", kJournalSizeLimit)]
+                    close];
+            }];
+        }
+
         // Assign properties (if everything was OK)
         if (result) {
+            queue.slowOperationLog = _slowOperationLog;
+            queue.telemetry = _queueTelemetry;
+            if (!_readOnly) {
+                _walCheckpointer = [[TDWALCheckpointer alloc] initWithQueue:queue];
+                queue.checkpointer = _walCheckpointer;
+            }
             _fmdbQueue = queue;
             _keyProviderToOpenDB = provider;
         } else if (queue) {
@@ -272,6 +484,62 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
     return result;
 }
 
+// callers: -open, -compact. Must be called after the schema has been migrated, as readers can only
+// run alongside the writer once the database is in WAL mode. Failing to open the readers is not
+// fatal: reads will then go through the writer connection, as they always used to.
+- (void)openReadConnectionsWithEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
+{
+    __block NSString* journalMode = nil;
+    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        journalMode = [db stringForQuery:@"PRAGMA journal_mode"];
+    }];
+    if (![journalMode.lowercaseString isEqualToString:@"wal"]) {
+        os_log_debug(CDTOSLog, "Not opening read connections for %{public}@ (journal_mode=%{public}@)", _path, journalMode);
+        return;
+    }
+
+    NSUInteger count = MIN(MAX([NSProcessInfo processInfo].activeProcessorCount, 2), kMaxReadConnections);
+    NSTimeInterval busyTimeout = self.busyTimeout;
+    NSMutableArray* queues = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        TDDatabaseQueue* queue = [TD_Database queueForDatabaseAtPath:_path readOnly:YES];
+        if (!queue) {
+            break;
+        }
+        queue.telemetry = _queueTelemetry;
+
+        __block BOOL configured = NO;
+        [queue inDatabase:^(FMDatabase* db) {
+            NSError* error = nil;
+            if (![db setKeyWithProvider:provider error:&error]) {
+                os_log_error(CDTOSLog, "Key not set for read connection to %{public}@: %{public}@", self->_path, error);
+                return;
+            }
+            registerCollations(db);
+            db.shouldCacheStatements = YES;
+            db.maxBusyRetryTimeInterval = busyTimeout;
+            configured = [self attachArchiveInDatabase:db create:NO];
+        }];
+        if (!configured) {
+            [queue close];
+            break;
+        }
+        [queues addObject:queue];
+    }
+
+    if (queues.count == 0) {
+        return;
+    }
+    _readPool = [[TDReadConnectionPool alloc] initWithQueues:queues];
+    os_log_debug(CDTOSLog, "Opened %{public}lu read connections for %{public}@", (unsigned long)queues.count, _path);
+}
+
+- (void)closeReadConnections
+{
+    [_readPool close];
+    _readPool = nil;
+}
+
 // callers: many things
 - (BOOL)isOpenWithEncryptionKeyProvider:(id<CDTEncryptionKeyProvider>)provider
 {
@@ -313,11 +581,44 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
     if ([self isOpen]) {
          return [self isOpenWithEncryptionKeyProvider:provider];
     }
+
+    if (_inMemory && [provider encryptionKey] != nil) {
+        os_log_error(CDTOSLog, "In-memory DB %{public}@ can't be encrypted", _path);
+        return NO;
+    }
     
     if (![self openFMDBWithEncryptionKeyProvider:provider]) {
         return NO;
     }
 
+    // Databases that are already up to date, i.e. almost every one opened, don't need the
+    // exclusive transaction the migrations run in:
+    __block int currentVersion = 0;
+    [self.fmdbQueue inDatabase:^(FMDatabase* db) {
+        currentVersion = [db intForQuery:@"PRAGMA user_version"];
+    }];
+    if (currentVersion != kSchemaVersion && ![self migrateSchema]) {
+        return NO;
+    }
+
+#if DEBUG
+    [self.fmdbQueue inDatabase:^(FMDatabase* db) { db.crashOnErrors = YES; }];
+#endif
+
+    _encrypted = ([_keyProviderToOpenDB encryptionKey] != nil);
+    if (_encrypted) [self loadUnfinishedRekey];
+    [self openReadConnectionsWithEncryptionKeyProvider:_keyProviderToOpenDB];
+    [self applyMemoryBudget];
+    if (_multiProcess && !_inMemory) [self startObservingOtherProcesses];
+    self.open = YES;
+    // Finish any sweep that was cut short when the database was last closed
+    if (!_readOnly) [self sweepDeletedAttachments];
+    return YES;
+}
+
+/** Brings the schema up to kSchemaVersion. Called by -openWithEncryptionKeyProvider:. */
+- (BOOL)migrateSchema
+{
     __block BOOL result = YES;
     __weak TD_Database* weakSelf = self;
     [self.fmdbQueue inTransaction:^(FMDatabase* db, BOOL* rollback) {
@@ -341,7 +642,10 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
             // First-time initialization:
             // (Note: Declaring revs.sequence as AUTOINCREMENT means the values will always be
             // monotonically increasing, never reused. See <http://www.sqlite.org/autoinc.html>)
+            // auto_vacuum has to be set before the first table is created; INCREMENTAL lets
+            // compaction give free pages back a few at a time.
             NSString* schema = @"\
+                PRAGMA auto_vacuum = INCREMENTAL; \
                 CREATE TABLE docs ( \
                     doc_id INTEGER PRIMARY KEY, \
                     docid TEXT UNIQUE NOT NULL); \
@@ -503,36 +807,476 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
                 }
             }
             
-            // dbVersion = 200;
+            dbVersion = 200;
         }
-        
-#if DEBUG
-        db.crashOnErrors = YES;
-#endif
-        
-        // Open attachment store:
-        NSString* attachmentsPath = strongSelf.attachmentStorePath;
-        NSError* error;
-        self->_attachments = [[TDBlobStore alloc] initWithPath:attachmentsPath
-                                         encryptionKeyProvider:provider
-                                                         error:&error];
-        if (!self->_attachments) {
-            os_log_debug(CDTOSLog, "%{public}@: Couldn't open attachment store at %{public}@",
-                         self, self.attachmentStorePath);
-            [db close];
-            result = NO;
-            return;
+
+        if (dbVersion < 201) {
+            // Version 201: added replicators.known_revs, the local sequences a pusher has
+            // confirmed are on the remote since its last checkpoint
+            NSString* sql = @"ALTER TABLE replicators ADD COLUMN known_revs BLOB";
+            if (![strongSelf migrateWithUpdates:sql queries:nil version:201 inDatabase:db]) {
+                result = NO;
+                return;
+            }
+            dbVersion = 201;
+        }
+
+        if (dbVersion < 202) {
+            // Version 202: added attachments_pending_delete, the files of deleted attachments
+            // that the background sweep has yet to remove
+            NSString* sql = [TD_Database sqlCommandToCreateBlobPendingDeletesTable];
+            if (![strongSelf migrateWithUpdates:sql queries:nil version:202 inDatabase:db]) {
+                result = NO;
+                return;
+            }
+            dbVersion = 202;
+        }
+
+        if (dbVersion < 203) {
+            // Version 203: added attachments_pending_download, the attachments of pulled
+            // revisions that were inserted before their contents had been downloaded
+            NSString* sql = @"CREATE TABLE attachments_pending_download ( \
+                                sequence INTEGER NOT NULL REFERENCES revs(sequence) ON DELETE CASCADE, \
+                                filename TEXT NOT NULL, \
+                                type TEXT, \
+                                encoding INTEGER DEFAULT 0, \
+                                length INTEGER, \
+                                revpos INTEGER DEFAULT 0, \
+                                digest TEXT, \
+                                UNIQUE (sequence, filename)); \
+                            CREATE INDEX attachments_pending_download_digest \
+                                ON attachments_pending_download(digest)";
+            if (![strongSelf migrateWithUpdates:sql queries:nil version:203 inDatabase:db]) {
+                result = NO;
+                return;
+            }
+            dbVersion = 203;
+        }
+
+        if (dbVersion < 204) {
+            // Version 204: added maps.sort_key, a memcmp-ordered encoding of the key for views
+            // whose collation can be encoded that way
+            NSString* sql = @"ALTER TABLE maps ADD COLUMN sort_key BLOB; \
+                              CREATE INDEX maps_sort_keys ON maps(view_id, sort_key)";
+            if (![strongSelf migrateWithUpdates:sql queries:nil version:204 inDatabase:db]) {
+                result = NO;
+                return;
+            }
+            dbVersion = 204;
+        }
+
+        if (dbVersion < 205) {
+            // Version 205: added maps_reduced, a running count/total/min/max of each key's values
+            // for views with a built-in reduce, kept up to date by triggers on maps while the
+            // view's reduce_cached flag is set
+            // The triggers contain semicolons of their own, so can't go through
+            // -migrateWithUpdates:, which splits its statements on them.
+            NSArray* statements = @[
+                @"ALTER TABLE views ADD COLUMN reduce_cached BOOLEAN DEFAULT 0",
+                @"CREATE TABLE maps_reduced ( \
+                    view_id INTEGER NOT NULL REFERENCES views(view_id) ON DELETE CASCADE, \
+                    key TEXT NOT NULL COLLATE JSON, \
+                    row_count INTEGER NOT NULL DEFAULT 0, \
+                    total REAL NOT NULL DEFAULT 0, \
+                    total_squares REAL NOT NULL DEFAULT 0, \
+                    minimum REAL, \
+                    maximum REAL, \
+                    UNIQUE (view_id, key))",
+                @"CREATE TRIGGER maps_reduced_insert AFTER INSERT ON maps \
+                    WHEN (SELECT reduce_cached FROM views WHERE view_id=NEW.view_id) \
+                BEGIN \
+                    INSERT OR IGNORE INTO maps_reduced (view_id, key) VALUES (NEW.view_id, NEW.key); \
+                    UPDATE maps_reduced SET row_count=row_count+1, \
+                        total=total+ifnull(CAST(NEW.value AS REAL), 0), \
+                        total_squares=total_squares+ifnull(CAST(NEW.value AS REAL), 0) \
+                                                   *ifnull(CAST(NEW.value AS REAL), 0), \
+                        minimum=min(ifnull(minimum, ifnull(CAST(NEW.value AS REAL), 0)), \
+                                    ifnull(CAST(NEW.value AS REAL), 0)), \
+                        maximum=max(ifnull(maximum, ifnull(CAST(NEW.value AS REAL), 0)), \
+                                    ifnull(CAST(NEW.value AS REAL), 0)) \
+                        WHERE view_id=NEW.view_id AND key=NEW.key; \
+                END",
+                @"CREATE TRIGGER maps_reduced_delete AFTER DELETE ON maps \
+                    WHEN (SELECT reduce_cached FROM views WHERE view_id=OLD.view_id) \
+                BEGIN \
+                    UPDATE maps_reduced SET row_count=row_count-1, \
+                        total=total-ifnull(CAST(OLD.value AS REAL), 0), \
+                        total_squares=total_squares-ifnull(CAST(OLD.value AS REAL), 0) \
+                                                   *ifnull(CAST(OLD.value AS REAL), 0), \
+                        minimum=CASE WHEN ifnull(CAST(OLD.value AS REAL), 0) > minimum THEN minimum \
+                            ELSE (SELECT min(ifnull(CAST(value AS REAL), 0)) FROM maps \
+                                  WHERE view_id=OLD.view_id AND key=OLD.key) END, \
+                        maximum=CASE WHEN ifnull(CAST(OLD.value AS REAL), 0) < maximum THEN maximum \
+                            ELSE (SELECT max(ifnull(CAST(value AS REAL), 0)) FROM maps \
+                                  WHERE view_id=OLD.view_id AND key=OLD.key) END \
+                        WHERE view_id=OLD.view_id AND key=OLD.key; \
+                    DELETE FROM maps_reduced \
+                        WHERE view_id=OLD.view_id AND key=OLD.key AND row_count<=0; \
+                END"
+            ];
+            for (NSString* statement in statements) {
+                if (![db executeUpdate:statement]) {
+                    os_log_debug(CDTOSLog, "TD_Database: Could not migrate schema of %{public}@ to version 205. SQLite error: %{public}@", strongSelf->_path, db.lastErrorMessage);
+                    [db close];
+                    result = NO;
+                    return;
+                }
+            }
+            if (![strongSelf migrateWithUpdates:nil queries:nil version:205 inDatabase:db]) {
+                result = NO;
+                return;
+            }
+            dbVersion = 205;
+        }
+
+        if (dbVersion < 206) {
+            // Version 206: added conflicts, the documents with more than one non-deleted leaf
+            // revision, kept up to date as revisions are inserted and purged
+            NSString* sql = @"CREATE TABLE conflicts ( \
+                                doc_id INTEGER PRIMARY KEY REFERENCES docs(doc_id) ON DELETE CASCADE); \
+                              INSERT INTO conflicts (doc_id) \
+                                SELECT doc_id FROM revs WHERE deleted = 0 AND sequence NOT IN \
+                                    (SELECT DISTINCT parent FROM revs WHERE parent NOT NULL) \
+                                GROUP BY doc_id HAVING COUNT(*) > 1";
+            if (![strongSelf migrateWithUpdates:sql queries:nil version:206 inDatabase:db]) {
+                result = NO;
+                return;
+            }
+            dbVersion = 206;
+        }
+
+        if (dbVersion < 207) {
+            // Version 207: added doc_counts, a single row holding the number of documents with a
+            // non-deleted leaf revision and the number of revisions, kept up to date by triggers
+            // on revs so that they can be read without scanning the table
+            NSArray* statements = @[
+                @"CREATE TABLE doc_counts ( \
+                    docs INTEGER NOT NULL DEFAULT 0, \
+                    revs INTEGER NOT NULL DEFAULT 0)",
+                @"INSERT INTO doc_counts (docs, revs) VALUES ( \
+                    (SELECT COUNT(DISTINCT doc_id) FROM revs WHERE current=1 AND deleted=0), \
+                    (SELECT COUNT(*) FROM revs))",
+                // A document starts counting when it gets its first live leaf...
+                @"CREATE TRIGGER doc_counts_insert AFTER INSERT ON revs \
+                BEGIN \
+                    UPDATE doc_counts SET revs=revs+1, \
+                        docs=docs+(NEW.current=1 AND NEW.deleted=0 AND \
+                            (SELECT COUNT(*) FROM revs \
+                             WHERE doc_id=NEW.doc_id AND current=1 AND deleted=0)=1); \
+                END",
+                @"CREATE TRIGGER doc_counts_update AFTER UPDATE OF current, deleted ON revs \
+                    WHEN (OLD.current=1 AND OLD.deleted=0) != (NEW.current=1 AND NEW.deleted=0) \
+                BEGIN \
+                    UPDATE doc_counts SET docs=docs+CASE \
+                        WHEN NEW.current=1 AND NEW.deleted=0 THEN \
+                            ((SELECT COUNT(*) FROM revs \
+                              WHERE doc_id=NEW.doc_id AND current=1 AND deleted=0)=1) \
+                        ELSE -(NOT EXISTS (SELECT 1 FROM revs \
+                              WHERE doc_id=NEW.doc_id AND current=1 AND deleted=0)) END; \
+                END",
+                // ...and stops when it loses its last one.
+                @"CREATE TRIGGER doc_counts_delete AFTER DELETE ON revs \
+                BEGIN \
+                    UPDATE doc_counts SET revs=revs-1, \
+                        docs=docs-(OLD.current=1 AND OLD.deleted=0 AND NOT EXISTS \
+                            (SELECT 1 FROM revs \
+                             WHERE doc_id=OLD.doc_id AND current=1 AND deleted=0)); \
+                END"
+            ];
+            for (NSString* statement in statements) {
+                if (![db executeUpdate:statement]) {
+                    os_log_debug(CDTOSLog, "TD_Database: Could not migrate schema of %{public}@ to version 207. SQLite error: %{public}@", strongSelf->_path, db.lastErrorMessage);
+                    [db close];
+                    result = NO;
+                    return;
+                }
+            }
+            if (![strongSelf migrateWithUpdates:nil queries:nil version:207 inDatabase:db]) {
+                result = NO;
+                return;
+            }
+            dbVersion = 207;
+        }
+
+        if (dbVersion < 208) {
+            // Version 208: revs_winner covers the winning-revision and conflict lookups, which
+            // filter on doc_id, current and deleted and read revid and sequence, so they're
+            // answered from the index without reading rows, and their JSON, from revs. It
+            // replaces revs_current, a prefix of it. The indexes duplicating the automatic ones
+            // of UNIQUE columns are dropped.
+            NSString* sql = @"CREATE INDEX revs_winner                                 ON revs(doc_id, current, deleted, revid DESC, sequence);                               DROP INDEX IF EXISTS revs_current;                               DROP INDEX IF EXISTS docs_docid;                               DROP INDEX IF EXISTS localdocs_by_docid;                               DROP INDEX IF EXISTS views_by_name";
+            if (![strongSelf migrateWithUpdates:sql queries:nil version:208 inDatabase:db]) {
+                result = NO;
+                return;
+            }
+            dbVersion = 208;
+        }
+
+        if (dbVersion < 209) {
+            // Version 209: added tombstones, when each deleted revision was inserted, so that
+            // tombstones can be purged once they're old enough. Those already there count from
+            // the upgrade. The expression is the Unix time in seconds, as julianday has been in
+            // every SQLite version and unixepoch hasn't.
+            NSArray* statements = @[
+                @"CREATE TABLE tombstones ( \
+                    sequence INTEGER PRIMARY KEY REFERENCES revs(sequence) ON DELETE CASCADE, \
+                    deleted_at REAL NOT NULL)",
+                @"INSERT INTO tombstones (sequence, deleted_at) \
+                    SELECT sequence, (julianday('now') - 2440587.5) * 86400.0 \
+                    FROM revs WHERE deleted=1",
+                @"CREATE TRIGGER tombstones_insert AFTER INSERT ON revs WHEN NEW.deleted=1 \
+                BEGIN \
+                    INSERT OR REPLACE INTO tombstones (sequence, deleted_at) \
+                        VALUES (NEW.sequence, (julianday('now') - 2440587.5) * 86400.0); \
+                END"
+            ];
+            for (NSString* statement in statements) {
+                if (![db executeUpdate:statement]) {
+                    os_log_debug(CDTOSLog, "TD_Database: Could not migrate schema of %{public}@ to version 209. SQLite error: %{public}@", strongSelf->_path, db.lastErrorMessage);
+                    [db close];
+                    result = NO;
+                    return;
+                }
+            }
+            if (![strongSelf migrateWithUpdates:nil queries:nil version:209 inDatabase:db]) {
+                result = NO;
+                return;
+            }
+            dbVersion = 209;
+        }
+
+        if (dbVersion < 210) {
+            // Version 210: revisions share attachment rows. revs.attachments_sequence is the
+            // sequence whose rows in attachments a revision has, NULL if it has none, so that a
+            // revision which leaves its attachments alone doesn't copy them all. A trigger deletes
+            // the rows with the last revision sharing them, rather than with the one they were
+            // made for, so attachments is rebuilt without its foreign key.
+            NSArray* statements = @[
+                @"CREATE TABLE attachments_shared ( \
+                    sequence INTEGER NOT NULL, \
+                    filename TEXT NOT NULL, \
+                    key BLOB NOT NULL, \
+                    type TEXT, \
+                    length INTEGER NOT NULL, \
+                    revpos INTEGER DEFAULT 0, \
+                    encoding INTEGER DEFAULT 0, \
+                    encoded_length INTEGER)",
+                @"INSERT INTO attachments_shared \
+                    (sequence, filename, key, type, length, revpos, encoding, encoded_length) \
+                    SELECT sequence, filename, key, type, length, revpos, encoding, encoded_length \
+                    FROM attachments",
+                @"DROP TABLE attachments",
+                @"ALTER TABLE attachments_shared RENAME TO attachments",
+                @"CREATE INDEX attachments_by_sequence ON attachments(sequence, filename)",
+                @"ALTER TABLE revs ADD COLUMN attachments_sequence INTEGER",
+                @"UPDATE revs SET attachments_sequence=sequence \
+                    WHERE sequence IN (SELECT DISTINCT sequence FROM attachments)",
+                @"CREATE INDEX revs_attachments ON revs(attachments_sequence) \
+                    WHERE attachments_sequence IS NOT NULL",
+                @"CREATE TRIGGER attachments_release AFTER DELETE ON revs \
+                    WHEN OLD.attachments_sequence IS NOT NULL \
+                BEGIN \
+                    DELETE FROM attachments WHERE sequence=OLD.attachments_sequence \
+                        AND NOT EXISTS (SELECT 1 FROM revs \
+                                        WHERE attachments_sequence=OLD.attachments_sequence); \
+                END"
+            ];
+            for (NSString* statement in statements) {
+                if (![db executeUpdate:statement]) {
+                    os_log_debug(CDTOSLog, "TD_Database: Could not migrate schema of %{public}@ to version 210. SQLite error: %{public}@", strongSelf->_path, db.lastErrorMessage);
+                    [db close];
+                    result = NO;
+                    return;
+                }
+            }
+            if (![strongSelf migrateWithUpdates:nil queries:nil version:210 inDatabase:db]) {
+                result = NO;
+                return;
+            }
+            dbVersion = 210;
+        }
+
+        if (dbVersion < 211) {
+            // Version 211: added pulled_through, the documents fetched on demand from a remote,
+            // with the sequence they were inserted at and when, so they can be evicted again
+            // while unchanged.
+            NSArray* statements = @[
+                @"CREATE TABLE pulled_through ( \
+                    doc_id INTEGER PRIMARY KEY REFERENCES docs(doc_id) ON DELETE CASCADE, \
+                    sequence INTEGER NOT NULL, \
+                    fetched_at REAL NOT NULL)"
+            ];
+            for (NSString* statement in statements) {
+                if (![db executeUpdate:statement]) {
+                    os_log_debug(CDTOSLog, "TD_Database: Could not migrate schema of %{public}@ to version 211. SQLite error: %{public}@", strongSelf->_path, db.lastErrorMessage);
+                    [db close];
+                    result = NO;
+                    return;
+                }
+            }
+            if (![strongSelf migrateWithUpdates:nil queries:nil version:211 inDatabase:db]) {
+                result = NO;
+                return;
+            }
+            dbVersion = 211;
+        }
+
+        if (dbVersion < 212) {
+            // Version 212: doc_counts also holds the number of documents with any leaf revision,
+            // deleted or not, and the number in conflict, so that tombstones and conflicts can
+            // be counted without a scan. The triggers on revs are separate from those keeping
+            // the live count, and only do anything when a leaf changes.
+            NSArray* statements = @[
+                @"ALTER TABLE doc_counts ADD COLUMN all_docs INTEGER NOT NULL DEFAULT 0",
+                @"ALTER TABLE doc_counts ADD COLUMN conflicted INTEGER NOT NULL DEFAULT 0",
+                @"UPDATE doc_counts SET \
+                    all_docs=(SELECT COUNT(DISTINCT doc_id) FROM revs WHERE current=1), \
+                    conflicted=(SELECT COUNT(*) FROM conflicts)",
+                @"CREATE TRIGGER doc_counts_all_insert AFTER INSERT ON revs WHEN NEW.current=1 \
+                BEGIN \
+                    UPDATE doc_counts SET all_docs=all_docs+((SELECT COUNT(*) FROM revs \
+                        WHERE doc_id=NEW.doc_id AND current=1)=1); \
+                END",
+                @"CREATE TRIGGER doc_counts_all_update AFTER UPDATE OF current ON revs \
+                    WHEN OLD.current != NEW.current \
+                BEGIN \
+                    UPDATE doc_counts SET all_docs=all_docs+CASE \
+                        WHEN NEW.current=1 THEN \
+                            ((SELECT COUNT(*) FROM revs WHERE doc_id=NEW.doc_id AND current=1)=1) \
+                        ELSE -(NOT EXISTS (SELECT 1 FROM revs \
+                              WHERE doc_id=NEW.doc_id AND current=1)) END; \
+                END",
+                @"CREATE TRIGGER doc_counts_all_delete AFTER DELETE ON revs WHEN OLD.current=1 \
+                BEGIN \
+                    UPDATE doc_counts SET all_docs=all_docs-(NOT EXISTS (SELECT 1 FROM revs \
+                        WHERE doc_id=OLD.doc_id AND current=1)); \
+                END",
+                @"CREATE TRIGGER doc_counts_conflicts_insert AFTER INSERT ON conflicts \
+                BEGIN \
+                    UPDATE doc_counts SET conflicted=conflicted+1; \
+                END",
+                @"CREATE TRIGGER doc_counts_conflicts_delete AFTER DELETE ON conflicts \
+                BEGIN \
+                    UPDATE doc_counts SET conflicted=conflicted-1; \
+                END"
+            ];
+            for (NSString* statement in statements) {
+                if (![db executeUpdate:statement]) {
+                    os_log_debug(CDTOSLog, "TD_Database: Could not migrate schema of %{public}@ to version 212. SQLite error: %{public}@", strongSelf->_path, db.lastErrorMessage);
+                    [db close];
+                    result = NO;
+                    return;
+                }
+            }
+            if (![strongSelf migrateWithUpdates:nil queries:nil version:212 inDatabase:db]) {
+                result = NO;
+                return;
+            }
+            dbVersion = 212;
+        }
+
+        if (dbVersion < 213) {
+            // Version 213: added expiries, when documents given a time to live expire, indexed
+            // by that time so the expired ones can be found without a scan.
+            NSArray* statements = @[
+                @"CREATE TABLE expiries ( \
+                    doc_id INTEGER PRIMARY KEY REFERENCES docs(doc_id) ON DELETE CASCADE, \
+                    expires_at REAL NOT NULL)",
+                @"CREATE INDEX expiries_by_time ON expiries(expires_at)"
+            ];
+            for (NSString* statement in statements) {
+                if (![db executeUpdate:statement]) {
+                    os_log_debug(CDTOSLog, "TD_Database: Could not migrate schema of %{public}@ to version 213. SQLite error: %{public}@", strongSelf->_path, db.lastErrorMessage);
+                    [db close];
+                    result = NO;
+                    return;
+                }
+            }
+            if (![strongSelf migrateWithUpdates:nil queries:nil version:213 inDatabase:db]) {
+                result = NO;
+                return;
+            }
+            dbVersion = 213;
+        }
+
+        if (dbVersion < 214) {
+            // Version 214: added bodies, for revision bodies too large to keep in revs; their row
+            // of revs holds a marker instead. The triggers drop a body along with its revision,
+            // or when compaction clears the revision's body.
+            NSArray* statements = @[
+                @"CREATE TABLE bodies ( \
+                    sequence INTEGER PRIMARY KEY, \
+                    json BLOB NOT NULL)",
+                @"CREATE TRIGGER bodies_release_update AFTER UPDATE OF json ON revs \
+                    WHEN OLD.json = " kTDOutOfLineBodyMarkerSQL " \
+                        AND NEW.json IS NOT " kTDOutOfLineBodyMarkerSQL " \
+                BEGIN \
+                    DELETE FROM bodies WHERE sequence=OLD.sequence; \
+                END",
+                @"CREATE TRIGGER bodies_release_delete AFTER DELETE ON revs \
+                    WHEN OLD.json = " kTDOutOfLineBodyMarkerSQL " \
+                BEGIN \
+                    DELETE FROM bodies WHERE sequence=OLD.sequence; \
+                END"
+            ];
+            for (NSString* statement in statements) {
+                if (![db executeUpdate:statement]) {
+                    os_log_debug(CDTOSLog, "TD_Database: Could not migrate schema of %{public}@ to version 214. SQLite error: %{public}@", strongSelf->_path, db.lastErrorMessage);
+                    [db close];
+                    result = NO;
+                    return;
+                }
+            }
+            if (![strongSelf migrateWithUpdates:nil queries:nil version:214 inDatabase:db]) {
+                result = NO;
+                return;
+            }
+            dbVersion = 214;
+        }
+
+        if (dbVersion < 215) {
+            // Version 215: added attachments_inline, the content of attachments small enough to
+            // be kept in the database rather than in files of their own
+            NSString* sql = [TD_Database sqlCommandToCreateBlobInlineTable];
+            if (![strongSelf migrateWithUpdates:sql queries:nil version:215 inDatabase:db]) {
+                result = NO;
+                return;
+            }
+            // dbVersion = 215;
         }
 
         // Transaction has completed successfully, setting rollback to NO to prevent rollback.
         *rollback = NO;
     }];
-    
-    if (result) {
-        self.open = YES;
-        return YES;
-    } else {
-        return NO;
+    return result;
+}
+
+- (TDBlobStore*)attachmentStore
+{
+    // Opened on first use, as many databases never have attachments read or written between
+    // being opened and closed
+    @synchronized(_attachmentsLock) {
+        if (!_attachments && _keyProviderToOpenDB) {
+            NSError* error;
+            // Attachments a rekey hadn't got to yet are still under the key it recorded
+            id<CDTEncryptionKeyProvider> provider =
+                _previousAttachmentKeyProvider ?: _keyProviderToOpenDB;
+            _attachments = [[TDBlobStore alloc] initWithPath:self.attachmentStorePath
+                                       encryptionKeyProvider:provider
+                                                       error:&error];
+            if (!_attachments) {
+                os_log_error(CDTOSLog, "%{public}@: Couldn't open attachment store at %{public}@: %{public}@",
+                             self, self.attachmentStorePath, error);
+            }
+            if (_previousAttachmentKeyProvider) {
+                [_attachments changeEncryptionKeyToKeyOfProvider:_keyProviderToOpenDB];
+            }
+            _attachments.sharedStore = self.sharedAttachmentStore;
+            _attachments.filenameCache = _blobFilenameCache;
+            _attachments.inlineThreshold = _inlineAttachmentThreshold;
+            _attachments.shardsFiles = _shardsAttachmentFiles;
+        }
+        return _attachments;
     }
 }
 
@@ -567,12 +1311,34 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
 
     _activeReplicators = nil;
 
+    [self closeReadConnections];
+
+    // Local documents still waiting to be written, before the queue goes:
+    NSDictionary* unwritten = [_localDocCache dirtyDocuments];
+    if (unwritten.count > 0 && TDStatusIsError([self writeLocalDocuments:unwritten])) {
+        os_log_error(CDTOSLog, "Couldn't write %{public}lu local documents to %{public}@",
+                     (unsigned long)unwritten.count, _path);
+    }
+    [_localDocCache removeAllDocuments];
+
+    [_walCheckpointer cancel];
+    _walCheckpointer = nil;
+
+    [_processNotifier cancel];
+    _processNotifier = nil;
+
     [_fmdbQueue close];
     _fmdbQueue = nil;
 
     _keyProviderToOpenDB = nil;
 
-    _attachments = nil;
+    @synchronized(_attachmentsLock) {
+        _attachments = nil;
+        _previousAttachmentKeyProvider = nil;
+    }
+
+    [_historyCache removeAllDocuments];
+    [_blobFilenameCache removeAllFilenames];
 
     self.open = NO;
     _transactionLevel = 0;
@@ -606,10 +1372,73 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
         return NO;
     }
 
+    if (_inMemory) {
+        [self discardMemoryDatabase];
+        return removeItemIfExists(self.attachmentStorePath, outError) &&
+               removeItemIfExists([TD_Database partialAttachmentDownloadsPathWithDatabasePath:_path],
+                                  outError);
+    }
+
     return [[self class] deleteClosedDatabaseAtPath:_path error:outError];
 
 }
 
+- (BOOL)moveDatabaseToDirectory:(NSString *)directory error:(NSError **)outError
+{
+    __block BOOL result = NO;
+    __block NSError *strongError = nil;
+    dispatch_sync(self.queue, ^{
+        [[NSNotificationCenter defaultCenter] postNotificationName:TD_DatabaseWillBeDeletedNotification
+                                                            object:self];
+        if (self.open && ![self closeInternal]) {
+            os_log_error(CDTOSLog, "Database at path %{public}@ could not be closed", self->_path);
+            return;
+        }
+        NSError *innerError = nil;
+        if (self->_inMemory) {
+            // There's no file to move, only the attachments beside where it would be
+            [self discardMemoryDatabase];
+            NSString *path = self->_path;
+            result = moveItemIfExists([TD_Database attachmentStorePathWithDatabasePath:path],
+                                      directory, &innerError) &&
+                     moveItemIfExists([TD_Database partialAttachmentDownloadsPathWithDatabasePath:path],
+                                      directory, &innerError);
+        } else {
+            result = [[self class] moveClosedDatabaseAtPath:self->_path
+                                                toDirectory:directory
+                                                      error:&innerError];
+        }
+        if (innerError) strongError = innerError;
+    });
+    if (outError != nil) *outError = strongError;
+    return result;
+}
+
++ (BOOL)moveClosedDatabaseAtPath:(NSString *)path
+                     toDirectory:(NSString *)directory
+                           error:(NSError **)outError
+{
+    os_log_info(CDTOSLog, "Moving %{public}@ to %{public}@", path, directory);
+
+    if (![TD_Database existsDatabaseAtPath:path]) {
+        return YES;
+    }
+
+    // The journal goes before the database, so a new database at the path can't pick up a stale
+    // one if this is cut short.
+    NSString *attachmentsPath = [TD_Database attachmentStorePathWithDatabasePath:path];
+    NSString *partialsPath = [TD_Database partialAttachmentDownloadsPathWithDatabasePath:path];
+    NSString *archivePath = [TD_Database archivePathWithDatabasePath:path];
+    return (moveItemIfExists([path stringByAppendingString:@"-wal"], directory, outError) &&
+            moveItemIfExists([path stringByAppendingString:@"-shm"], directory, outError) &&
+            moveItemIfExists(path, directory, outError) &&
+            moveItemIfExists([archivePath stringByAppendingString:@"-wal"], directory, outError) &&
+            moveItemIfExists([archivePath stringByAppendingString:@"-shm"], directory, outError) &&
+            moveItemIfExists(archivePath, directory, outError) &&
+            moveItemIfExists(attachmentsPath, directory, outError) &&
+            moveItemIfExists(partialsPath, directory, outError));
+}
+
 + (BOOL)deleteClosedDatabaseAtPath:(NSString *)path error:(NSError **)outError
 {
     os_log_info(CDTOSLog, "Deleting %{public}@", path);
@@ -618,34 +1447,209 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
 
     if ([TD_Database existsDatabaseAtPath:path]) {
         NSString *attachmentsPath = [TD_Database attachmentStorePathWithDatabasePath:path];
+        NSString *partialsPath = [TD_Database partialAttachmentDownloadsPathWithDatabasePath:path];
 
         // Delete the database file, and the associated temp files if they are present.
         success =
             (removeItemIfExists(path, outError) && removeItemIfExists(attachmentsPath, outError) &&
+             removeItemIfExists(partialsPath, outError) &&
              removeItemIfExists([path stringByAppendingString:@"-wal"], outError) &&
              removeItemIfExists([path stringByAppendingString:@"-shm"], outError));
+        NSString *archivePath = [TD_Database archivePathWithDatabasePath:path];
+        for (NSString *suffix in @[ @"", @"-wal", @"-shm" ]) {
+            success = success &&
+                      removeItemIfExists([archivePath stringByAppendingString:suffix], outError);
+        }
     }
 
     return success;
 }
 
-- (void)dealloc
+- (void)dealloc
+{
+    os_log_debug(CDTOSLog, "-dealloc TD_Database %{public}@", self);
+    if (self.isOpen) {
+        os_log_debug(CDTOSLog, "dealloced without being closed first! %{public}@", self);
+        [self close];
+    }
+    [_memoryKeeper close];
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+@synthesize path = _path, name = _name, readOnly = _readOnly;
+
+- (id<CDTEncryptionKeyProvider>)connectionKeyProvider
+{
+    return self.isOpen ? _keyProviderToOpenDB : nil;
+}
+
+- (BOOL)inDatabaseIfOpen:(void (^)(FMDatabase*))block
+{
+    __block BOOL ran = NO;
+    CFAbsoluteTime submitted = CFAbsoluteTimeGetCurrent();
+    // -close runs on self.queue, so the database can't be closed while the block runs
+    dispatch_sync(self.queue, ^{
+        if (self.isOpen) {
+            TDDatabaseQueue* queue = $castIf(TDDatabaseQueue, self->_fmdbQueue);
+            if (queue) {
+                [queue inDatabase:block submittedAt:submitted];
+            } else {
+                [self->_fmdbQueue inDatabase:block];
+            }
+            ran = YES;
+        }
+    });
+    return ran;
+}
+
+- (TDDurability)durability { return _durability; }
+
+- (void)setDurability:(TDDurability)durability
+{
+    _durability = durability;
+    [self inDatabaseIfOpen:^(FMDatabase* db) {
+        [db executeUpdate:TDSynchronousPragma(durability)];
+    }];
+}
+
+- (UInt64)memoryBudget { return _memoryBudget; }
+
+- (void)setMemoryBudget:(UInt64)memoryBudget
+{
+    _memoryBudget = memoryBudget;
+    // -close runs on self.queue, so the connections can't go while they're changed
+    dispatch_sync(self.queue, ^{
+        if (self.isOpen) [self applyMemoryBudget];
+    });
+}
+
+- (UInt64)mmapSize { return _mmapSize; }
+
+- (NSTimeInterval)busyTimeout
+{
+    if (_busyTimeout > 0) return _busyTimeout;
+    return _multiProcess ? kMultiProcessBusyTimeout : kDefaultBusyTimeout;
+}
+
+// caller: -openWithEncryptionKeyProvider:, with multiProcess set
+- (void)startObservingOtherProcesses
+{
+    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        self->_dataVersion = [db longLongForQuery:@"PRAGMA data_version"];
+        self->_otherProcessSequence = [self lastSequenceInDatabase:db];
+        self->_revsWrittenHere = [NSMutableDictionary dictionary];
+    }];
+    // So the other processes see local documents as soon as they're written
+    _localDocCache.flushDelay = 0;
+
+    __weak TD_Database* weakSelf = self;
+    _processNotifier =
+        [[TDProcessChangeNotifier alloc] initWithPath:_path
+                                              handler:^{
+                                                  [weakSelf noteWritesByOtherProcesses];
+                                              }];
+    $castIf(TDDatabaseQueue, _fmdbQueue).processNotifier = _processNotifier;
+}
+
+- (NSUInteger)inlineAttachmentThreshold
+{
+    @synchronized(_attachmentsLock) { return _inlineAttachmentThreshold; }
+}
+
+- (void)setInlineAttachmentThreshold:(NSUInteger)inlineAttachmentThreshold
+{
+    @synchronized(_attachmentsLock)
+    {
+        _inlineAttachmentThreshold = inlineAttachmentThreshold;
+        _attachments.inlineThreshold = inlineAttachmentThreshold;
+    }
+}
+
+- (BOOL)shardsAttachmentFiles
+{
+    @synchronized(_attachmentsLock) { return _shardsAttachmentFiles; }
+}
+
+- (void)setShardsAttachmentFiles:(BOOL)shardsAttachmentFiles
+{
+    @synchronized(_attachmentsLock)
+    {
+        _shardsAttachmentFiles = shardsAttachmentFiles;
+        _attachments.shardsFiles = shardsAttachmentFiles;
+    }
+}
+
+- (void)setMmapSize:(UInt64)mmapSize
+{
+    _mmapSize = mmapSize;
+    dispatch_sync(self.queue, ^{
+        if (self.isOpen) [self applyMemoryBudget];
+    });
+}
+
+// callers: -openWithEncryptionKeyProvider:, -compact, -setMemoryBudget:, -setMmapSize:
+- (void)applyMemoryBudget
+{
+    UInt64 budget = _memoryBudget;
+    NSUInteger connections = 1 + _readPool.count;
+    // SQLCipher decrypts each page into the page cache, so there's nothing to gain from mapping
+    UInt64 mmapSize = _encrypted ? 0 : _mmapSize;
+    void (^apply)(FMDatabase*) = ^(FMDatabase* db) {
+        applyMemoryBudget(db, budget, connections, mmapSize);
+    };
+    [_fmdbQueue inDatabase:apply];
+    [_readPool inEachDatabase:apply];
+}
+
+- (void)releaseMemory
+{
+    [_historyCache removeAllDocuments];
+    dispatch_sync(self.queue, ^{
+        if (!self.isOpen) return;
+        __block int released = 0;
+        void (^release)(FMDatabase*) = ^(FMDatabase* db) {
+            [db clearCachedStatements];
+            sqlite3_db_release_memory(db.sqliteHandle);
+            released++;
+        };
+        [self->_fmdbQueue inDatabase:release];
+        [self->_readPool inEachDatabase:release];
+        os_log_debug(CDTOSLog, "Released memory of %d connections to %{public}@", released, self->_path);
+    });
+}
+
+- (TDStatus)checkpoint
 {
-    os_log_debug(CDTOSLog, "-dealloc TD_Database %{public}@", self);
-    if (self.isOpen) {
-        os_log_debug(CDTOSLog, "dealloced without being closed first! %{public}@", self);
-        [self close];
-    }
-    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    CDTQueueOperationScope(CDTQueueOperationCheckpoint);
+    __block TDStatus status = kTDStatusDBError;
+    TDDurability durability = _durability;
+    [self inDatabaseIfOpen:^(FMDatabase* db) {
+        // A checkpoint only syncs the WAL and the database file if synchronous is on:
+        [db executeUpdate:@"PRAGMA synchronous = FULL"];
+        FMResultSet* r = [db executeQuery:@"PRAGMA wal_checkpoint(FULL)"];
+        // The first column is 1 if readers or writers stopped the checkpoint finishing
+        if ([r next] && [r intForColumnIndex:0] == 0) status = kTDStatusOK;
+        [r close];
+        [db executeUpdate:TDSynchronousPragma(durability)];
+    }];
+    return status;
 }
 
-@synthesize path = _path, name = _name, readOnly = _readOnly;
+- (NSTimeInterval)groupCommitWindow { return _groupCommitter.window; }
+- (void)setGroupCommitWindow:(NSTimeInterval)window { _groupCommitter.window = window; }
+- (NSUInteger)groupCommitMaxWrites { return _groupCommitter.maxWrites; }
+- (void)setGroupCommitMaxWrites:(NSUInteger)maxWrites { _groupCommitter.maxWrites = maxWrites; }
 
 - (TDStatus)inTransaction:(TDStatus (^)(FMDatabase*))block
 {
-    __block TDStatus status;
+    FMDatabaseQueue* queue = _fmdbQueue;
+    if (_groupCommitter.window > 0 && [queue isKindOfClass:[TDDatabaseQueue class]]) {
+        return [_groupCommitter inTransaction:block onQueue:(TDDatabaseQueue*)queue];
+    }
+
+    __block TDStatus status = kTDStatusDBError;  // if the database isn't open
 
-    [_fmdbQueue inTransaction:^(FMDatabase* db, BOOL* rollback) {
+    [queue inTransaction:^(FMDatabase* db, BOOL* rollback) {
         @try {
             status = block(db);
         }
@@ -659,6 +1663,62 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
     return status;
 }
 
+// The read connection of the snapshot this thread has open on the database, if any. Kept per
+// thread, since a snapshot's connection is only for the thread whose block it runs.
+- (FMDatabase*)readSnapshotDatabase
+{
+    return NSThread.currentThread.threadDictionary[[NSValue valueWithNonretainedObject:self]];
+}
+
+- (BOOL)isInReadSnapshot { return [self readSnapshotDatabase] != nil; }
+
+- (void)inReadSnapshot:(void (^)(void))block
+{
+    if (!_readPool || self.isInReadSnapshot) {
+        block();
+        return;
+    }
+    NSValue* key = [NSValue valueWithNonretainedObject:self];
+    [self inReadTransaction:^(FMDatabase* db) {
+        NSMutableDictionary* threadDictionary = NSThread.currentThread.threadDictionary;
+        threadDictionary[key] = db;
+        @try {
+            block();
+        } @finally {
+            [threadDictionary removeObjectForKey:key];
+        }
+    }];
+}
+
+- (void)inReadTransaction:(void (^)(FMDatabase*))block
+{
+    FMDatabase* snapshot = [self readSnapshotDatabase];
+    if (snapshot) {
+        block(snapshot);
+        return;
+    }
+    TDReadConnectionPool* pool = _readPool;
+    // Taken before the snapshot is, so a history read while revisions are being purged or
+    // compacted away is recognised as stale
+    NSUInteger generation = _historyCache.generation;
+    NSUInteger filenameGeneration = _blobFilenameCache.generation;
+    if (pool && [pool inReadTransaction:^(FMDatabase* db) {
+            objc_setAssociatedObject(db, &kHistoryCacheGenerationKey, @(generation),
+                                     OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+            [TDBlobFilenameCache setSnapshotGeneration:filenameGeneration forDatabase:db];
+            @try {
+                block(db);
+            } @finally {
+                objc_setAssociatedObject(db, &kHistoryCacheGenerationKey, nil,
+                                         OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+                [TDBlobFilenameCache setSnapshotGeneration:NSNotFound forDatabase:db];
+            }
+        }]) {
+        return;
+    }
+    [_fmdbQueue inDatabase:block];
+}
+
 - (NSString*)privateUUID
 {
     __block NSString* result;
@@ -679,24 +1739,33 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
 
 #pragma mark - GETTING DOCUMENTS:
 
-- (NSUInteger)documentCount
+// Reads a count from doc_counts. Its row is kept up to date by triggers on revs and conflicts, so
+// there's no need to count them.
+- (NSUInteger)docCount:(NSString*)expression
 {
     __block NSUInteger result = NSNotFound;
-    [_fmdbQueue inDatabase:^(FMDatabase* db) {
-        FMResultSet* r = [db executeQuery:@"SELECT COUNT(DISTINCT doc_id) FROM revs "
-                                           "WHERE current=1 AND deleted=0"];
+    [self inReadTransaction:^(FMDatabase* db) {
+        FMResultSet* r = [db executeQuery:$sprintf(@"SELECT %@ FROM doc_counts", expression)];
         if ([r next]) {
-            result = [r intForColumnIndex:0];
+            result = (NSUInteger)[r longLongIntForColumnIndex:0];
         }
         [r close];
     }];
     return result;
 }
 
+- (NSUInteger)documentCount { return [self docCount:@"docs"]; }
+
+- (NSUInteger)deletedDocumentCount { return [self docCount:@"all_docs - docs"]; }
+
+- (NSUInteger)conflictedDocumentCount { return [self docCount:@"conflicted"]; }
+
+- (NSUInteger)revisionCount { return [self docCount:@"revs"]; }
+
 - (SequenceNumber)lastSequence
 {
     __block SequenceNumber result = 0;
-    [_fmdbQueue inDatabase:^(FMDatabase* db) { result = [self lastSequenceInDatabase:db]; }];
+    [self inReadTransaction:^(FMDatabase* db) { result = [self lastSequenceInDatabase:db]; }];
     return result;
 }
 
@@ -711,6 +1780,19 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
 - (NSDictionary*)extraPropertiesForRevision:(TD_Revision*)rev
                                     options:(TDContentOptions)options
                                  inDatabase:(FMDatabase*)db
+{
+    return [self extraPropertiesForRevision:rev
+                                    options:options
+                      prefetchedAttachments:nil
+                        prefetchedHistories:nil
+                                 inDatabase:db];
+}
+
+- (NSDictionary*)extraPropertiesForRevision:(TD_Revision*)rev
+                                    options:(TDContentOptions)options
+                      prefetchedAttachments:(NSDictionary*)prefetchedAttachments
+                        prefetchedHistories:(NSDictionary*)prefetchedHistories
+                                 inDatabase:(FMDatabase*)db
 {
     NSString* docID = rev.docID;
     NSString* revID = rev.revID;
@@ -720,19 +1802,26 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
 
     // Get attachment metadata, and optionally the contents:
     NSDictionary* attachmentsDict =
-        [self getAttachmentDictForSequence:sequence options:options inDatabase:db];
+        prefetchedAttachments
+            ? prefetchedAttachments[@(sequence)]
+            : [self getAttachmentDictForSequence:sequence options:options inDatabase:db];
 
     // Get more optional stuff to put in the properties:
     // OPT: This probably ends up making redundant SQL queries if multiple options are enabled.
     id localSeq = nil, revs = nil, revsInfo = nil, conflicts = nil;
     if (options & kTDIncludeLocalSeq) localSeq = @(sequence);
 
+    NSArray* history = prefetchedHistories[@(sequence)];
+    if (!history && (options & (kTDIncludeRevs | kTDIncludeRevsInfo))) {
+        history = [self getRevisionHistory:rev database:db];
+    }
+
     if (options & kTDIncludeRevs) {
-        revs = [self getRevisionHistoryDict:rev inDatabase:db];
+        revs = makeRevisionHistoryDict(history);
     }
 
     if (options & kTDIncludeRevsInfo) {
-        revsInfo = [[self getRevisionHistory:rev] my_map:^id(TD_Revision* rev) {
+        revsInfo = [history my_map:^id(TD_Revision* rev) {
             NSString* status = @"available";
             if (rev.deleted)
                 status = @"deleted";
@@ -766,8 +1855,31 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
                  options:(TDContentOptions)options
               inDatabase:(FMDatabase*)db
 {
-    NSDictionary* extra = [self extraPropertiesForRevision:rev options:options inDatabase:db];
-    if (json.length > 0) {
+    [self expandStoredJSON:json
+              intoRevision:rev
+                   options:options
+     prefetchedAttachments:nil
+       prefetchedHistories:nil
+                inDatabase:db];
+}
+
+/** Only call from within a queued transaction **/
+- (void)expandStoredJSON:(NSData*)json
+             intoRevision:(TD_Revision*)rev
+                  options:(TDContentOptions)options
+    prefetchedAttachments:(NSDictionary*)prefetchedAttachments
+      prefetchedHistories:(NSDictionary*)prefetchedHistories
+               inDatabase:(FMDatabase*)db
+{
+    if ([TDBodyDelta isDelta:json]) json = [self expandedStoredJSON:json inDatabase:db];
+    NSDictionary* extra = [self extraPropertiesForRevision:rev
+                                                   options:options
+                                     prefetchedAttachments:prefetchedAttachments
+                                       prefetchedHistories:prefetchedHistories
+                                                inDatabase:db];
+    if ([TDBinaryJSON isBinaryJSON:json]) {
+        rev.properties = [[self class] documentPropertiesFromJSON:json extraProperties:extra];
+    } else if (json.length > 0) {
         rev.asJSON = [TDJSON appendDictionary:extra toJSONDictionaryData:json];
     } else {
         rev.properties = extra;
@@ -775,6 +1887,34 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
     }
 }
 
+/** As -expandStoredJSON:... for each of the revisions, whose stored JSONs are given in the same
+    order (NSNull for none), reading the attachments of them all with one query.
+    Only call from within a queued transaction **/
+- (void)expandStoredJSONs:(NSArray*)jsons
+            intoRevisions:(NSArray<TD_Revision*>*)revs
+                  options:(TDContentOptions)options
+               inDatabase:(FMDatabase*)db
+{
+    Assert(jsons.count == revs.count);
+    NSArray* sequences = [revs my_map:^id(TD_Revision* rev) { return @(rev.sequence); }];
+    NSDictionary* attachments =
+        [self getAttachmentDictsForSequences:sequences options:options inDatabase:db];
+    NSDictionary* histories = (options & (kTDIncludeRevs | kTDIncludeRevsInfo))
+                                  ? [self getRevisionHistoriesOfRevisions:revs database:db]
+                                  : nil;
+    [revs enumerateObjectsUsingBlock:^(TD_Revision* rev, NSUInteger i, BOOL* stop) {
+        @autoreleasepool
+        {
+            [self expandStoredJSON:$castIf(NSData, jsons[i])
+                      intoRevision:rev
+                           options:options
+             prefetchedAttachments:attachments
+               prefetchedHistories:histories
+                        inDatabase:db];
+        }
+    }];
+}
+
 - (NSDictionary*)documentPropertiesFromJSON:(NSData*)json
                                       docID:(NSString*)docID
                                       revID:(NSString*)revID
@@ -783,17 +1923,50 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
                                     options:(TDContentOptions)options
                                  inDatabase:(FMDatabase*)db
 {
+    if ([TDBodyDelta isDelta:json]) json = [self expandedStoredJSON:json inDatabase:db];
     TD_Revision* rev = [[TD_Revision alloc] initWithDocID:docID revID:revID deleted:deleted];
     rev.sequence = sequence;
     rev.missing = (json == nil);
     NSDictionary* extra = [self extraPropertiesForRevision:rev options:options inDatabase:db];
+    return [[self class] documentPropertiesFromJSON:json extraProperties:extra];
+}
+
+- (NSData*)expandedStoredJSON:(NSData*)json inDatabase:(FMDatabase*)db
+{
+    // Each delta's base may be a delta too, back to the revision that's stored whole; they're
+    // applied from there, without recursing, as a document edited often has a long chain.
+    // A base is always a later revision than the delta made from it.
+    NSMutableArray<NSData*>* deltas = [NSMutableArray array];
+    SequenceNumber lastBase = 0;
+    while ([TDBodyDelta isDelta:json]) {
+        [deltas addObject:json];
+        SequenceNumber base = [TDBodyDelta baseSequenceOfDelta:json];
+        json = base > lastBase
+            ? [db dataForQuery:@"SELECT " kTDRevsBodySQL " FROM revs WHERE sequence=?", @(base)]
+            : nil;
+        lastBase = base;
+    }
+    for (NSData* delta in deltas.reverseObjectEnumerator) {
+        if (!json) break;
+        json = [TDBodyDelta dataByApplyingDelta:delta toBase:json];
+    }
+    if (!json && deltas.count > 0) {
+        os_log_error(CDTOSLog, "%{public}@: Couldn't rebuild a revision body from its delta", self);
+    }
+    return json;
+}
+
++ (NSDictionary*)documentPropertiesFromJSON:(NSData*)json extraProperties:(NSDictionary*)extra
+{
     if (json.length == 0 || (json.length == 2 && memcmp(json.bytes, "{}", 2) == 0))
         return extra;  // optimization, and workaround for issue #44
     NSMutableDictionary* docProperties =
-        [TDJSON JSONObjectWithData:json options:TDJSONReadingMutableContainers error:NULL];
+        [TDBinaryJSON isBinaryJSON:json]
+            ? [TDBinaryJSON JSONObjectWithData:json options:TDJSONReadingMutableContainers]
+            : [TDJSON JSONObjectWithData:json options:TDJSONReadingMutableContainers error:NULL];
     if (!docProperties) {
-        os_log_debug(CDTOSLog, "Unparseable JSON for doc=%{public}@, rev=%{public}@: %{public}@", docID, revID,
-                     [json my_UTF8ToString]);
+        os_log_debug(CDTOSLog, "Unparseable JSON for doc=%{public}@, rev=%{public}@: %{public}@",
+                     extra[@"_id"], extra[@"_rev"], [json my_UTF8ToString]);
         return extra;
     }
     [docProperties addEntriesFromDictionary:extra];
@@ -808,7 +1981,7 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
 {
     __block TD_Revision* result;
     __weak TD_Database* weakSelf = self;
-    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+    [self inReadTransaction:^(FMDatabase* db) {
         TD_Database* strongSelf = weakSelf;
         result = [strongSelf getDocumentWithID:docID
                                     revisionID:revID
@@ -828,7 +2001,7 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
 {
     TD_Revision* result = nil;
     NSMutableString* sql = [NSMutableString stringWithString:@"SELECT revid, deleted, sequence"];
-    if (!(options & kTDNoBody)) [sql appendString:@", json"];
+    if (!(options & kTDNoBody)) [sql appendString:@", " kTDRevsBodySQL];
     if (revID)
         [sql appendString:@" FROM revs, docs "
                            "WHERE docs.docid=? AND revs.doc_id=docs.doc_id AND revid=? AND json "
@@ -852,7 +2025,15 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
         result = [[TD_Revision alloc] initWithDocID:docID revID:revID deleted:deleted];
         result.sequence = [r longLongIntForColumnIndex:2];
 
-        if (options != kTDNoBody) {
+        if (options & kTDStoredBody) {
+            // -dataForColumnIndex: copies, as the body outlives the result set:
+            NSData* json = [r dataForColumnIndex:3];
+            if ([TDBodyDelta isDelta:json]) json = [self expandedStoredJSON:json inDatabase:db];
+            if (json)
+                result.body = [TD_Body bodyWithJSON:json];
+            else
+                result.missing = true;
+        } else if (options != kTDNoBody) {
             NSData* json = nil;
             if (!(options & kTDNoBody)) json = [r dataNoCopyForColumnIndex:3];
             [self expandStoredJSON:json intoRevision:result options:options inDatabase:db];
@@ -868,7 +2049,7 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
 {
     __block TD_Revision* result;
     __weak TD_Database* weakSelf = self;
-    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+    [self inReadTransaction:^(FMDatabase* db) {
         TD_Database* strongSelf = weakSelf;
         result = [strongSelf getDocumentWithID:docID revisionID:revID database:db];
     }];
@@ -909,7 +2090,7 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
 
     if ([self isOpen]) {
         __weak TD_Database* weakSelf = self;
-        [_fmdbQueue inDatabase:^(FMDatabase* db) {
+        [self inReadTransaction:^(FMDatabase* db) {
           __strong TD_Database* strongSelf = weakSelf;
           if (strongSelf) {
               result = [strongSelf loadRevisionBody:rev options:options database:db];
@@ -930,7 +2111,7 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
     if (rev.body && options == 0) return kTDStatusOK;
     Assert(rev.docID && rev.revID);
     FMResultSet* r =
-        [db executeQuery:@"SELECT sequence, json FROM revs, docs "
+        [db executeQuery:@"SELECT sequence, " kTDRevsBodySQL " FROM revs, docs "
                           "WHERE revid=? AND docs.docid=? AND revs.doc_id=docs.doc_id LIMIT 1",
                          rev.revID, rev.docID];
     if (!r) return kTDStatusDBError;
@@ -948,6 +2129,49 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
     return status;
 }
 
+- (NSArray<NSNumber*>*)loadRevisionBodies:(NSArray<TD_Revision*>*)revs
+                                  options:(TDContentOptions)options
+{
+    if (revs.count == 0) return @[];
+    __block NSMutableArray* statuses = nil;
+    [self inReadTransaction:^(FMDatabase* db) {
+        // Revisions are looked up by sequence where they have one, all with one query:
+        NSMutableArray* sequences = [NSMutableArray arrayWithCapacity:revs.count];
+        for (TD_Revision* rev in revs) {
+            if (rev.sequence > 0) [sequences addObject:@(rev.sequence)];
+        }
+        NSMutableDictionary* jsons = [NSMutableDictionary dictionaryWithCapacity:sequences.count];
+        if (sequences.count > 0) {
+            FMResultSet* r = [db executeQuery:$sprintf(@"SELECT sequence, " kTDRevsBodySQL
+                                                        " FROM revs WHERE sequence IN (%@)",
+                                                       [sequences componentsJoinedByString:@","])];
+            if (!r) return;
+            while ([r next]) {
+                // -dataForColumnIndex: copies, as the JSON outlives the row:
+                jsons[@([r longLongIntForColumnIndex:0])] =
+                    [r dataForColumnIndex:1] ?: [NSNull null];
+            }
+            [r close];
+        }
+
+        statuses = [NSMutableArray arrayWithCapacity:revs.count];
+        NSMutableArray* found = [NSMutableArray arrayWithCapacity:jsons.count];
+        NSMutableArray* foundJSONs = [NSMutableArray arrayWithCapacity:jsons.count];
+        for (TD_Revision* rev in revs) {
+            id json = rev.sequence > 0 ? jsons[@(rev.sequence)] : nil;
+            if (json) {
+                [found addObject:rev];
+                [foundJSONs addObject:json];
+                [statuses addObject:@(kTDStatusOK)];
+            } else {
+                [statuses addObject:@([self loadRevisionBody:rev options:options database:db])];
+            }
+        }
+        [self expandStoredJSONs:foundJSONs intoRevisions:found options:options inDatabase:db];
+    }];
+    return statuses;
+}
+
 /** Only call from within a queued transaction **/
 - (SInt64)getDocNumericID:(NSString*)docID database:(FMDatabase*)db
 {
@@ -1013,7 +2237,7 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
 {
     __block TD_RevisionList* result;
     __weak TD_Database* weakSelf = self;
-    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+    [self inReadTransaction:^(FMDatabase* db) {
         TD_Database* strongSelf = weakSelf;
         result = [strongSelf getAllRevisionsOfDocumentID:docID
                                              onlyCurrent:onlyCurrent
@@ -1043,6 +2267,21 @@ static BOOL removeItemIfExists(NSString* path, NSError** outError)
     }
 }
 
+// A body of just the given fields of a row's stored JSON. They're parsed straight from SQLite's
+// buffer, as they're copied out of it, so the rest of the body is never copied at all.
+static TD_Body* projectedBody(FMResultSet* r, int column, NSArray<NSString*>* fields)
+{
+    NSData* json = [r dataNoCopyForColumnIndex:column];
+    if (!json) return nil;
+    NSDictionary* properties =
+        [TDJSON dictionaryWithValuesForFields:fields fromJSONDictionaryData:json];
+    if (!properties) {
+        os_log_error(CDTOSLog, "Couldn't read the fields of a stored body");
+        return nil;
+    }
+    return [[TD_Body alloc] initWithProperties:properties];
+}
+
 static NSArray* revIDsFromResultSet(FMResultSet* r)
 {
     if (!r) return nil;
@@ -1057,13 +2296,47 @@ static NSArray* revIDsFromResultSet(FMResultSet* r)
 {
     __block NSArray* result;
     __weak TD_Database* weakSelf = self;
-    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+    [self inReadTransaction:^(FMDatabase* db) {
         TD_Database* strongSelf = weakSelf;
         result = [strongSelf getPossibleAncestorRevisionIDs:rev limit:limit database:db];
     }];
     return result;
 }
 
+- (NSArray<NSArray*>*)getPossibleAncestorRevisionIDsOfRevisions:(NSArray<TD_Revision*>*)revs
+                                                          limit:(unsigned)limit
+{
+    NSMutableArray* result = [NSMutableArray arrayWithCapacity:revs.count];
+    __weak TD_Database* weakSelf = self;
+    [self inReadTransaction:^(FMDatabase* db) {
+        TD_Database* strongSelf = weakSelf;
+        for (TD_Revision* rev in revs) {
+            NSArray* revIDs = [strongSelf getPossibleAncestorRevisionIDs:rev
+                                                                   limit:limit
+                                                                database:db];
+            [result addObject:(revIDs ?: @[])];
+        }
+    }];
+    // Filled out in case the transaction couldn't be made, so the result still lines up with revs
+    while (result.count < revs.count) [result addObject:@[]];
+    return result;
+}
+
+- (NSSet<NSString*>*)existingDocumentIDsAmong:(NSArray<NSString*>*)docIDs
+{
+    NSMutableSet* result = [NSMutableSet setWithCapacity:docIDs.count];
+    if (docIDs.count == 0) return result;
+    NSMutableArray* args = $marray();
+    NSString* sql = $sprintf(@"SELECT docid FROM docs WHERE docid IN (%@)",
+                             [TD_Database placeholdersForStrings:docIDs arguments:args]);
+    [self inReadTransaction:^(FMDatabase* db) {
+        FMResultSet* r = [db executeQuery:sql withArgumentsInArray:args];
+        while ([r next]) [result addObject:[r stringForColumnIndex:0]];
+        [r close];
+    }];
+    return result;
+}
+
 /** Only call from within a queued transaction **/
 - (NSArray*)getPossibleAncestorRevisionIDs:(TD_Revision*)rev
                                      limit:(unsigned)limit
@@ -1089,24 +2362,41 @@ static NSArray* revIDsFromResultSet(FMResultSet* r)
     if (revIDs.count == 0) return nil;
     SInt64 docNumericID = [self getDocNumericID:rev.docID database:db];
     if (docNumericID <= 0) return nil;
+    NSMutableArray* args = [NSMutableArray arrayWithObject:@(docNumericID)];
     NSString* sql = $sprintf(@"SELECT revid FROM revs "
                               "WHERE doc_id=? and revid in (%@) and revid <= ? "
                               "ORDER BY revid DESC LIMIT 1",
-                             [TD_Database joinQuotedStrings:revIDs]);
-    return [db stringForQuery:sql, @(docNumericID), rev.revID];
+                             [TD_Database placeholdersForStrings:revIDs arguments:args]);
+    [args addObject:rev.revID];
+    FMResultSet* r = [db executeQuery:sql withArgumentsInArray:args];
+    NSString* result = [r next] ? [r stringForColumnIndex:0] : nil;
+    [r close];
+    return result;
 }
 
 - (NSArray*)getRevisionHistory:(TD_Revision*)rev
 {
     __block NSArray* result;
     __weak TD_Database* weakSelf = self;
-    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+    [self inReadTransaction:^(FMDatabase* db) {
         TD_Database* strongSelf = weakSelf;
         result = [strongSelf getRevisionHistory:rev database:db];
     }];
     return result;
 }
 
+/** The history cache generation a history read through this connection may be stored under,
+    or NSNotFound if it mustn't be cached. */
+- (NSUInteger)historyCacheGenerationForDatabase:(FMDatabase*)db
+{
+    NSNumber* generation = objc_getAssociatedObject(db, &kHistoryCacheGenerationKey);
+    if (generation) return generation.unsignedIntegerValue;
+    // Outside a transaction the writer only sees committed rows, and purging and compaction
+    // are queued behind it. Within one, the rows read may yet be rolled back.
+    if (sqlite3_get_autocommit(db.sqliteHandle)) return _historyCache.generation;
+    return NSNotFound;
+}
+
 /** Only call from within a queued transaction **/
 - (NSArray*)getRevisionHistory:(TD_Revision*)rev database:(FMDatabase*)db
 {
@@ -1114,39 +2404,102 @@ static NSArray* revIDsFromResultSet(FMResultSet* r)
     NSString* revID = rev.revID;
     Assert(revID && docID);
 
+    NSArray* cached = [_historyCache historyOfRevision:rev];
+    if (cached) return cached;
+    NSUInteger generation = [self historyCacheGenerationForDatabase:db];
+
     SInt64 docNumericID = [self getDocNumericID:docID database:db];
     if (docNumericID < 0)
         return nil;
     else if (docNumericID == 0)
         return @[];
 
-    FMResultSet* r = [db executeQuery:@"SELECT sequence, parent, revid, deleted, json isnull "
-                                       "FROM revs WHERE doc_id=? ORDER BY sequence DESC",
-                                      @(docNumericID)];
+    // Follow the parent links from the revision in one query, rather than ordering all of the
+    // document's revisions by sequence and picking out the ancestors
+    FMResultSet* r = [db executeQuery:@"WITH RECURSIVE history(sequence, parent, revid, deleted, "
+                                       "missing) AS ("
+                                       " SELECT sequence, parent, revid, deleted, json isnull"
+                                       " FROM revs WHERE doc_id=? AND revid=?"
+                                       " UNION ALL"
+                                       " SELECT revs.sequence, revs.parent, revs.revid,"
+                                       " revs.deleted, revs.json isnull"
+                                       " FROM revs, history WHERE revs.sequence=history.parent)"
+                                       " SELECT sequence, revid, deleted, missing FROM history",
+                                      @(docNumericID), revID];
     if (!r) return nil;
-    SequenceNumber lastSequence = 0;
     NSMutableArray* history = $marray();
     while ([r next]) {
-        SequenceNumber sequence = [r longLongIntForColumnIndex:0];
-        BOOL matches;
-        if (lastSequence == 0)
-            matches = ($equal(revID, [r stringForColumnIndex:2]));
+        TD_Revision* rev = [[TD_Revision alloc] initWithDocID:docID
+                                                        revID:[r stringForColumnIndex:1]
+                                                      deleted:[r boolForColumnIndex:2]];
+        rev.sequence = [r longLongIntForColumnIndex:0];
+        rev.missing = [r boolForColumnIndex:3];
+        [history addObject:rev];
+    }
+    [r close];
+
+    if (generation != NSNotFound) {
+        [_historyCache setHistory:history ofRevision:rev generation:generation];
+    }
+    return history;
+}
+
+/** Only call from within a queued transaction **/
+- (NSDictionary<NSNumber*, NSArray*>*)getRevisionHistoriesOfRevisions:(NSArray<TD_Revision*>*)revs
+                                                             database:(FMDatabase*)db
+{
+    NSMutableDictionary* histories = [NSMutableDictionary dictionaryWithCapacity:revs.count];
+    NSMutableDictionary* uncached = [NSMutableDictionary dictionary];
+    for (TD_Revision* rev in revs) {
+        Assert(rev.sequence > 0);
+        NSArray* cached = [_historyCache historyOfRevision:rev];
+        if (cached)
+            histories[@(rev.sequence)] = cached;
         else
-            matches = (sequence == lastSequence);
-        if (matches) {
-            NSString* revID = [r stringForColumnIndex:2];
-            BOOL deleted = [r boolForColumnIndex:3];
-            TD_Revision* rev =
-                [[TD_Revision alloc] initWithDocID:docID revID:revID deleted:deleted];
-            rev.sequence = sequence;
-            rev.missing = [r boolForColumnIndex:4];
-            [history addObject:rev];
-            lastSequence = [r longLongIntForColumnIndex:1];
-            if (lastSequence == 0) break;
+            uncached[@(rev.sequence)] = rev;
+    }
+    if (uncached.count == 0) return histories;
+    NSUInteger generation = [self historyCacheGenerationForDatabase:db];
+
+    // As -getRevisionHistory:database: does, but following the parent links from all of the
+    // revisions at once; each row carries the sequence it started from, and its distance from it.
+    NSString* sql = $sprintf(@"WITH RECURSIVE history(origin, depth, sequence, parent, revid, "
+                              "deleted, missing) AS ("
+                              " SELECT sequence, 0, sequence, parent, revid, deleted, json isnull"
+                              " FROM revs WHERE sequence IN (%@)"
+                              " UNION ALL"
+                              " SELECT history.origin, history.depth + 1, revs.sequence,"
+                              " revs.parent, revs.revid, revs.deleted, revs.json isnull"
+                              " FROM revs, history WHERE revs.sequence=history.parent)"
+                              " SELECT origin, sequence, revid, deleted, missing FROM history"
+                              " ORDER BY origin, depth",
+                             [uncached.allKeys componentsJoinedByString:@","]);
+    FMResultSet* r = [db executeQuery:sql];
+    if (!r) return histories;
+    NSMutableDictionary* read = [NSMutableDictionary dictionaryWithCapacity:uncached.count];
+    while ([r next]) {
+        NSNumber* origin = @([r longLongIntForColumnIndex:0]);
+        TD_Revision* rev = [[TD_Revision alloc] initWithDocID:[uncached[origin] docID]
+                                                        revID:[r stringForColumnIndex:2]
+                                                      deleted:[r boolForColumnIndex:3]];
+        rev.sequence = [r longLongIntForColumnIndex:1];
+        rev.missing = [r boolForColumnIndex:4];
+        NSMutableArray* history = read[origin];
+        if (!history) {
+            history = $marray();
+            read[origin] = history;
         }
+        [history addObject:rev];
     }
     [r close];
-    return history;
+
+    [read enumerateKeysAndObjectsUsingBlock:^(NSNumber* origin, NSArray* history, BOOL* stop) {
+        histories[origin] = history;
+        if (generation != NSNotFound) {
+            [self->_historyCache setHistory:history ofRevision:uncached[origin] generation:generation];
+        }
+    }];
+    return histories;
 }
 
 // static designation was removed in order to use this function outside of this file
@@ -1229,7 +2582,7 @@ const TDChangesOptions kDefaultTDChangesOptions = {UINT_MAX, 0, NO, NO, YES};
 {
     __block TD_RevisionList* result;
     __weak TD_Database* weakSelf = self;
-    [_fmdbQueue inDatabase:^(FMDatabase* db) {
+    [self inReadTransaction:^(FMDatabase* db) {
         TD_Database* strongSelf = weakSelf;
         result = [strongSelf changesSinceSequence:lastSequence
                                           options:options
@@ -1256,10 +2609,28 @@ const TDChangesOptions kDefaultTDChangesOptions = {UINT_MAX, 0, NO, NO, YES};
                   "WHERE sequence > ? AND current=1 "
                   "AND revs.doc_id = docs.doc_id "
                   "ORDER BY revs.doc_id, revid DESC",
-                 (includeDocs ? @", json" : @""));
+                 (includeDocs ? @", " kTDRevsBodySQL : @""));
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
     FMResultSet* r = [db executeQuery:sql, @(lastSequence)];
     if (!r) return nil;
     TD_RevisionList* changes = [[TD_RevisionList alloc] init];
+
+    // With the docs, revisions are expanded a batch at a time, so that their attachments can be
+    // read together rather than with a query apiece:
+    NSMutableArray* pendingRevs = [NSMutableArray arrayWithCapacity:kExpandBatchSize];
+    NSMutableArray* pendingJSONs = [NSMutableArray arrayWithCapacity:kExpandBatchSize];
+    void (^expandPending)(void) = ^{
+        [self expandStoredJSONs:pendingJSONs
+                  intoRevisions:pendingRevs
+                        options:options->contentOptions
+                     inDatabase:db];
+        for (TD_Revision* rev in pendingRevs) {
+            if (!filter || filter(rev, filterParams)) [changes addRev:rev];
+        }
+        [pendingRevs removeAllObjects];
+        [pendingJSONs removeAllObjects];
+    };
+
     int64_t lastDocID = 0;
     while ([r next]) {
         @autoreleasepool
@@ -1276,23 +2647,124 @@ const TDChangesOptions kDefaultTDChangesOptions = {UINT_MAX, 0, NO, NO, YES};
                                                           deleted:[r boolForColumnIndex:4]];
             rev.sequence = [r longLongIntForColumnIndex:0];
             if (includeDocs) {
-                [self expandStoredJSON:[r dataNoCopyForColumnIndex:5]
-                          intoRevision:rev
-                               options:options->contentOptions
-                            inDatabase:db];
+                // -dataForColumnIndex: copies, as the JSON outlives the row:
+                [pendingRevs addObject:rev];
+                [pendingJSONs addObject:[r dataForColumnIndex:5] ?: [NSNull null]];
+                if (pendingRevs.count >= kExpandBatchSize) expandPending();
+            } else if (!filter || filter(rev, filterParams)) {
+                [changes addRev:rev];
             }
-            if (!filter || filter(rev, filterParams)) [changes addRev:rev];
         }
     }
     [r close];
+    if (pendingRevs.count > 0) expandPending();
 
     if (options->sortBySequence) {
         [changes sortBySequence];
         [changes limit:options->limit];
     }
+
+    [self recordIfSlow:@"changesSinceSequence:"
+             startedAt:start
+                   sql:sql
+             arguments:@[ @(lastSequence) ]
+              rowCount:changes.count
+               details:@{ @"since" : @(lastSequence), @"filtered" : @(filter != NULL) }
+            inDatabase:db];
     return changes;
 }
 
+- (TDStatus)enumerateWinningChangesSinceSequence:(SequenceNumber)lastSequence
+                                           limit:(NSUInteger)limit
+                                      usingBlock:(void (^)(SequenceNumber sequence,
+                                                           TD_Revision* winner,
+                                                           BOOL* stop))block
+{
+    // The documents changed since lastSequence, by their latest change, each joined to its
+    // winner: the current revision which isn't deleted, if any, with the highest revID.
+    NSString* sql =
+        @"SELECT changes.seq, docid, revid, deleted, revs.sequence, " kTDRevsBodySQL
+         " FROM (SELECT doc_id, MAX(sequence) AS seq FROM revs "
+         "      WHERE sequence > ? AND current=1 GROUP BY doc_id ORDER BY seq LIMIT ?) AS changes, "
+         "docs, revs "
+         "WHERE docs.doc_id = changes.doc_id AND revs.sequence = "
+         "(SELECT sequence FROM revs WHERE revs.doc_id = changes.doc_id AND current=1 "
+         " ORDER BY deleted ASC, revid DESC LIMIT 1) "
+         "ORDER BY changes.seq";
+    NSArray* args = @[ @(lastSequence), @(limit) ];
+
+    __block NSMutableArray* sequences = nil;
+    __block NSMutableArray* winners = nil;
+    [self inReadTransaction:^(FMDatabase* db) {
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        FMResultSet* r = [db executeQuery:sql withArgumentsInArray:args];
+        if (!r) return;
+        sequences = [NSMutableArray arrayWithCapacity:limit];
+        winners = [NSMutableArray arrayWithCapacity:limit];
+        while ([r next]) {
+            @autoreleasepool
+            {
+                BOOL deleted = [r boolForColumnIndex:3];
+                TD_Revision* rev = [[TD_Revision alloc] initWithDocID:[r stringForColumnIndex:1]
+                                                                revID:[r stringForColumnIndex:2]
+                                                              deleted:deleted];
+                rev.sequence = [r longLongIntForColumnIndex:4];
+                if (!deleted) {
+                    // -dataForColumnIndex: copies, as the body outlives the result set:
+                    NSData* json = [r dataForColumnIndex:5];
+                    if (json) rev.body = [TD_Body bodyWithJSON:json];
+                }
+                [sequences addObject:@([r longLongIntForColumnIndex:0])];
+                [winners addObject:rev];
+            }
+        }
+        [r close];
+
+        [self recordIfSlow:@"enumerateWinningChangesSinceSequence:"
+                 startedAt:start
+                       sql:sql
+                 arguments:args
+                  rowCount:winners.count
+                   details:@{ @"since" : @(lastSequence) }
+                inDatabase:db];
+    }];
+
+    if (!winners) return kTDStatusDBError;
+
+    BOOL stop = NO;
+    for (NSUInteger i = 0; i < winners.count && !stop; i++) {
+        @autoreleasepool
+        {
+            block([sequences[i] longLongValue], winners[i], &stop);
+        }
+    }
+    return kTDStatusOK;
+}
+
+/** Records the statement in the slow operation log, with its query plan, if it took longer than
+    the log's threshold. Must run on the connection that ran the statement. */
+- (void)recordIfSlow:(NSString*)operation
+           startedAt:(CFAbsoluteTime)start
+                 sql:(NSString*)sql
+           arguments:(NSArray*)arguments
+            rowCount:(NSUInteger)rowCount
+             details:(NSDictionary*)details
+          inDatabase:(FMDatabase*)db
+{
+    NSTimeInterval duration = CFAbsoluteTimeGetCurrent() - start;
+    if (![_slowOperationLog isSlow:duration]) {
+        return;
+    }
+    NSArray* plan = [CDTSlowOperationLog queryPlanForSQL:sql arguments:arguments inDatabase:db];
+    [_slowOperationLog recordOperation:[[CDTSlowOperation alloc] initWithOperation:operation
+                                                                          duration:duration
+                                                                               sql:@[ sql ]
+                                                                         queryPlan:plan
+                                                                          rowCount:rowCount
+                                                              usedUnindexedMatcher:NO
+                                                                           details:details]];
+}
+
 #pragma mark - VIEWS:
 
 - (TD_View*)registerView:(TD_View*)view
@@ -1382,28 +2854,30 @@ const TDChangesOptions kDefaultTDChangesOptions = {UINT_MAX, 0, NO, NO, YES};
     return view;
 }
 
-// FIX: This has a lot of code in common with -[TD_View queryWithOptions:status:]. Unify the two!
-- (NSDictionary*)getDocsWithIDs:(NSArray*)docIDs options:(const TDQueryOptions*)options
+// Returns the SELECT statement for -getDocsWithIDs:options: and -enumerateDocsWithIDs:..., and
+// adds its arguments to `args`.
+- (NSString*)allDocsSQLForDocIDs:(NSArray*)docIDs
+                         options:(const TDQueryOptions*)options
+                       arguments:(NSMutableArray*)args
 {
-    if (!options) options = &kDefaultTDQueryOptions;
-
-    // Generate the SELECT statement, based on the options:
     NSMutableString* sql = [@"SELECT revs.doc_id, docid, revid" mutableCopy];
-    if (options->includeDocs) [sql appendString:@", json, sequence"];
+    if (options->includeDocs) [sql appendString:@", " kTDRevsBodySQL ", sequence"];
     if (options->includeDeletedDocs) [sql appendString:@", deleted"];
     [sql appendString:@" FROM revs, docs WHERE"];
-    if (docIDs) [sql appendFormat:@" docid IN (%@) AND", [TD_Database joinQuotedStrings:docIDs]];
+    if (docIDs) {
+        [sql appendFormat:@" docid IN (%@) AND",
+                          [TD_Database placeholdersForStrings:docIDs arguments:args]];
+    }
     [sql appendString:@" docs.doc_id = revs.doc_id AND current=1"];
     if (!options->includeDeletedDocs) [sql appendString:@" AND deleted=0"];
 
-    NSMutableArray* args = $marray();
     id minKey = options->startKey, maxKey = options->endKey;
-    BOOL inclusiveMin = YES, inclusiveMax = options->inclusiveEnd;
+    BOOL inclusiveMin = !options->exclusiveStart, inclusiveMax = options->inclusiveEnd;
     if (options->descending) {
         minKey = maxKey;
         maxKey = options->startKey;
         inclusiveMin = inclusiveMax;
-        inclusiveMax = YES;
+        inclusiveMax = !options->exclusiveStart;
     }
     if (minKey) {
         Assert([minKey isKindOfClass:[NSString class]]);
@@ -1421,13 +2895,23 @@ const TDChangesOptions kDefaultTDChangesOptions = {UINT_MAX, 0, NO, NO, YES};
                       (options->includeDeletedDocs ? @"deleted ASC," : @"")];
     [args addObject:@(options->limit)];
     [args addObject:@(options->skip)];
+    return sql;
+}
+
+// FIX: This has a lot of code in common with -[TD_View queryWithOptions:status:]. Unify the two!
+- (NSDictionary*)getDocsWithIDs:(NSArray*)docIDs options:(const TDQueryOptions*)options
+{
+    if (!options) options = &kDefaultTDQueryOptions;
+
+    NSMutableArray* args = $marray();
+    NSString* sql = [self allDocsSQLForDocIDs:docIDs options:options arguments:args];
 
     __block SequenceNumber update_seq = 0;
     __block NSMutableArray* rows = $marray();
 
-    [_fmdbQueue inTransaction:^(FMDatabase* db, BOOL* rollback) {
-        if (options->updateSeq)
-            update_seq = self.lastSequence;  // TODO: needs to be atomic with the following SELECT
+    [self inReadTransaction:^(FMDatabase* db) {
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        if (options->updateSeq) update_seq = [self lastSequenceInDatabase:db];
 
         // Now run the database query:
         FMResultSet* r = [db executeQuery:sql withArgumentsInArray:args];
@@ -1496,6 +2980,14 @@ const TDChangesOptions kDefaultTDChangesOptions = {UINT_MAX, 0, NO, NO, YES};
                 [rows addObject:change];
             }
         }
+
+        [self recordIfSlow:@"getDocsWithIDs:"
+                 startedAt:start
+                       sql:sql
+                 arguments:args
+                  rowCount:rows.count
+                   details:@{ @"docIDCount" : @(docIDs.count) }
+                inDatabase:db];
     }];
 
     NSUInteger totalRows = rows.count;  //??? Is this true, or does it ignore limit/offset?
@@ -1504,14 +2996,226 @@ const TDChangesOptions kDefaultTDChangesOptions = {UINT_MAX, 0, NO, NO, YES};
                  { @"update_seq", update_seq ? @(update_seq) : nil });
 }
 
+- (TDStatus)enumerateDocsWithIDs:(NSArray*)docIDs
+                         options:(const TDQueryOptions*)options
+                      usingBlock:(void (^)(NSArray<TD_Revision*>* revs, FMDatabase* db))block
+{
+    if (!options) options = &kDefaultTDQueryOptions;
+
+    NSMutableArray* args = $marray();
+    NSString* sql = [self allDocsSQLForDocIDs:docIDs options:options arguments:args];
+
+    __block TDStatus status = kTDStatusOK;
+    [self inReadTransaction:^(FMDatabase* db) {
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        FMResultSet* r = [db executeQuery:sql withArgumentsInArray:args];
+        if (!r) {
+            status = kTDStatusDBError;
+            return;
+        }
+
+        // Given doc IDs, the revisions are held until they can be put into that order; otherwise
+        // each batch is passed on as soon as it's read.
+        NSMutableDictionary* found = docIDs ? [NSMutableDictionary dictionaryWithCapacity:docIDs.count] : nil;
+        NSMutableArray* batch = [NSMutableArray arrayWithCapacity:kExpandBatchSize];
+        void (^addToBatch)(TD_Revision*) = ^(TD_Revision* rev) {
+            [batch addObject:rev];
+            if (batch.count >= kExpandBatchSize) {
+                block([batch copy], db);
+                [batch removeAllObjects];
+            }
+        };
+        NSUInteger count = 0;
+        int64_t lastDocID = 0;
+        while ([r next]) {
+            @autoreleasepool
+            {
+                // Only count the first rev for a given doc (the rest will be losing conflicts):
+                int64_t docNumericID = [r longLongIntForColumnIndex:0];
+                if (docNumericID == lastDocID) continue;
+                lastDocID = docNumericID;
+
+                BOOL deleted = options->includeDeletedDocs && [r boolForColumn:@"deleted"];
+                TD_Revision* rev = [[TD_Revision alloc] initWithDocID:[r stringForColumnIndex:1]
+                                                                revID:[r stringForColumnIndex:2]
+                                                              deleted:deleted];
+                if (options->includeDocs) {
+                    rev.sequence = [r longLongIntForColumnIndex:4];
+                    if (!deleted && options->fields) {
+                        rev.body = projectedBody(r, 3, options->fields);
+                    } else if (!deleted) {
+                        // -dataForColumnIndex: copies, as the body outlives the result set:
+                        NSData* json = [r dataForColumnIndex:3];
+                        if (json) rev.body = [TD_Body bodyWithJSON:json];
+                    }
+                }
+                if (found)
+                    found[rev.docID] = rev;
+                else
+                    addToBatch(rev);
+                count++;
+            }
+        }
+        [r close];
+
+        // As for -getDocsWithIDs:, given IDs of deleted documents get deleted revisions:
+        for (NSString* docID in docIDs) {
+            @autoreleasepool
+            {
+                TD_Revision* rev = found[docID];
+                if (!rev) {
+                    SInt64 docNumericID = [self getDocNumericID:docID database:db];
+                    if (docNumericID <= 0) continue;
+                    BOOL deleted;
+                    NSString* revID = [self winningRevIDOfDocNumericID:docNumericID
+                                                             isDeleted:&deleted
+                                                              database:db];
+                    if (!revID) continue;
+                    rev = [[TD_Revision alloc] initWithDocID:docID revID:revID deleted:YES];
+                }
+                addToBatch(rev);
+            }
+        }
+        if (batch.count > 0) block([batch copy], db);
+
+        [self recordIfSlow:@"getDocsWithIDs:"
+                 startedAt:start
+                       sql:sql
+                 arguments:args
+                  rowCount:count
+                   details:@{ @"docIDCount" : @(docIDs.count) }
+                inDatabase:db];
+    }];
+    return status;
+}
+
+- (NSArray*)getWinningRevisionsWithDocIDs:(NSArray*)docIDs
+{
+    return [self getWinningRevisionsWithDocIDs:docIDs fields:nil];
+}
+
+- (NSArray*)getWinningRevisionsWithDocIDs:(NSArray*)docIDs fields:(NSArray<NSString*>*)fields
+{
+    if (docIDs.count == 0) return @[];
+
+    NSMutableArray* args = $marray();
+    // Non-deleted revisions sort first, so the first row for each doc is its winner:
+    NSString* sql = $sprintf(@"SELECT revs.doc_id, docid, revid, deleted, sequence, " kTDRevsBodySQL
+                              " FROM revs, docs WHERE docid IN (%@) "
+                              "AND docs.doc_id = revs.doc_id AND current=1 "
+                              "ORDER BY docs.doc_id, deleted ASC, revid DESC",
+                             [TD_Database placeholdersForStrings:docIDs arguments:args]);
+
+    NSMutableDictionary* winners = [NSMutableDictionary dictionaryWithCapacity:docIDs.count];
+    [self inReadTransaction:^(FMDatabase* db) {
+        FMResultSet* r = [db executeQuery:sql withArgumentsInArray:args];
+        int64_t lastDocID = 0;
+        while ([r next]) {
+            int64_t docNumericID = [r longLongIntForColumnIndex:0];
+            if (docNumericID == lastDocID) continue;
+            lastDocID = docNumericID;
+
+            BOOL deleted = [r boolForColumnIndex:3];
+            TD_Revision* rev = [[TD_Revision alloc] initWithDocID:[r stringForColumnIndex:1]
+                                                            revID:[r stringForColumnIndex:2]
+                                                          deleted:deleted];
+            rev.sequence = [r longLongIntForColumnIndex:4];
+            if (!deleted && fields) {
+                rev.body = projectedBody(r, 5, fields);
+            } else if (!deleted) {
+                // -dataForColumnIndex: copies, as the body outlives the result set:
+                NSData* json = [r dataForColumnIndex:5];
+                if (json) rev.body = [TD_Body bodyWithJSON:json];
+            }
+            winners[rev.docID] = rev;
+        }
+        [r close];
+    }];
+
+    NSMutableArray* result = [NSMutableArray arrayWithCapacity:docIDs.count];
+    for (NSString* docID in docIDs) {
+        TD_Revision* rev = winners[docID];
+        if (rev) [result addObject:rev];
+    }
+    return result;
+}
+
 - (NSDictionary*)getAllDocs:(const TDQueryOptions*)options
 {
     return [self getDocsWithIDs:nil options:options];
 }
 
+- (TDStatus)enumerateDocumentsDescending:(BOOL)descending
+                                pageSize:(NSUInteger)pageSize
+                                 options:(TDContentOptions)options
+                              usingBlock:(void (^)(TD_Revision* rev, BOOL* stop))block
+{
+    Assert(pageSize > 0);
+    NSString* order = descending ? @"DESC" : @"ASC";
+    NSString* firstPageSQL =
+        $sprintf(@"SELECT revs.doc_id, docid, revid, sequence, " kTDRevsBodySQL " FROM revs, docs "
+                  "WHERE docs.doc_id = revs.doc_id AND current=1 AND deleted=0 "
+                  "ORDER BY docid %@, revid DESC LIMIT ?",
+                 order);
+    // Pages are keyed on the last docID seen rather than using OFFSET, so each page is an index
+    // seek rather than a rescan of everything before it:
+    NSString* nextPageSQL =
+        $sprintf(@"SELECT revs.doc_id, docid, revid, sequence, " kTDRevsBodySQL " FROM revs, docs "
+                  "WHERE docid %@ ? AND docs.doc_id = revs.doc_id AND current=1 AND deleted=0 "
+                  "ORDER BY docid %@, revid DESC LIMIT ?",
+                 (descending ? @"<" : @">"), order);
+
+    __block NSString* lastDocID = nil;
+    BOOL stop = NO;
+    while (!stop) {
+        __block NSMutableArray* page = nil;
+        [self inReadTransaction:^(FMDatabase* db) {
+            FMResultSet* r = lastDocID
+                                 ? [db executeQuery:nextPageSQL, lastDocID, @(pageSize)]
+                                 : [db executeQuery:firstPageSQL, @(pageSize)];
+            if (!r) return;
+            page = [NSMutableArray arrayWithCapacity:pageSize];
+            NSMutableArray* jsons = [NSMutableArray arrayWithCapacity:pageSize];
+            int64_t lastNumericID = 0;
+            while ([r next]) {
+                @autoreleasepool
+                {
+                    // Only the first rev for a given doc is the winner; the rest are conflicts:
+                    int64_t docNumericID = [r longLongIntForColumnIndex:0];
+                    if (docNumericID == lastNumericID) continue;
+                    lastNumericID = docNumericID;
+
+                    TD_Revision* rev = [[TD_Revision alloc] initWithDocID:[r stringForColumnIndex:1]
+                                                                    revID:[r stringForColumnIndex:2]
+                                                                  deleted:NO];
+                    rev.sequence = [r longLongIntForColumnIndex:3];
+                    [page addObject:rev];
+                    [jsons addObject:[r dataForColumnIndex:4] ?: [NSNull null]];
+                }
+            }
+            [r close];
+            // The page's attachments are all read with one query:
+            [self expandStoredJSONs:jsons intoRevisions:page options:options inDatabase:db];
+        }];
+
+        if (!page) return kTDStatusDBError;
+        if (page.count == 0) break;
+
+        for (TD_Revision* rev in page) {
+            @autoreleasepool
+            {
+                block(rev, &stop);
+            }
+            if (stop) break;
+        }
+        lastDocID = [page.lastObject docID];
+    }
+    return kTDStatusOK;
+}
+
 #pragma mark - QUEUE:
 
-+ (FMDatabaseQueue *)queueForDatabaseAtPath:(NSString *)path readOnly:(BOOL)readOnly
++ (TDDatabaseQueue *)queueForDatabaseAtPath:(NSString *)path readOnly:(BOOL)readOnly
 {
 #ifdef SQLITE_OPEN_FILEPROTECTION_COMPLETEUNLESSOPEN
     int flags = SQLITE_OPEN_FILEPROTECTION_COMPLETEUNLESSOPEN;
@@ -1525,10 +3229,38 @@ const TDChangesOptions kDefaultTDChangesOptions = {UINT_MAX, 0, NO, NO, YES};
     }
     os_log_debug(CDTOSLog, "Open %{public}@ (flags=%{public}X)", path, flags);
 
-    FMDatabaseQueue *queue = [FMDatabaseQueue databaseQueueWithPath:path flags:flags];
+    TDDatabaseQueue *queue = [TDDatabaseQueue databaseQueueWithPath:path flags:flags];
 
     return queue;
 }
 
+// caller: -openFMDBWithEncryptionKeyProvider:, with inMemory set. The first connection to a
+// shared-cache memory database creates it, and it goes when the last one closes, so the keeper is
+// opened first and stays open until the database is deleted.
+- (TDDatabaseQueue *)queueForMemoryDatabase
+{
+    int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI;
+    if (!_memoryKeeper) {
+        _memoryURI = $sprintf(@"file:cdt-%@?mode=memory&cache=shared", TDCreateUUID());
+        FMDatabase* keeper = [FMDatabase databaseWithPath:_memoryURI];
+        if (![keeper openWithFlags:flags]) {
+            os_log_error(CDTOSLog, "Couldn't create in-memory DB for %{public}@: %{public}@", _path,
+                         keeper.lastError);
+            return nil;
+        }
+        _memoryKeeper = keeper;
+    }
+    os_log_debug(CDTOSLog, "Open %{public}@ in memory (%{public}@)", _path, _memoryURI);
+    return [TDDatabaseQueue databaseQueueWithPath:_memoryURI flags:flags];
+}
+
+// callers: -deleteDatabaseInternal:, -moveDatabaseToDirectory:error:, once the database is closed
+- (void)discardMemoryDatabase
+{
+    [_memoryKeeper close];
+    _memoryKeeper = nil;
+    _memoryURI = nil;
+}
+
 - (void)clearPendingAttachments { _pendingAttachmentsByDigest = nil; }
 @end
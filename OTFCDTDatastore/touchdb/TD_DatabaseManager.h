@@ -11,7 +11,7 @@
 #import <Foundation/Foundation.h>
 #import "TDStatus.h"
 
-@class TD_Database, TDReplicator;
+@class TD_Database, TDReplicator, TDSharedBlobStore;
 //@class TDReplicatorManager;
 
 typedef struct TD_DatabaseManagerOptions
@@ -42,6 +42,24 @@ extern NSUInteger const kTD_DatabaseManagerErrorCodeInvalidName;
 
 @property (readonly) NSString* directory;
 
+/** Creates (or opens) a store in the directory for attachments shared by the databases, so that an
+    attachment held by several of them is only kept, and replicated, once. Databases returned by
+    -databaseNamed: from then on use it; those already opened keep their own attachments.
+    Encrypted databases never share their attachments. */
+- (BOOL)enableSharedAttachmentStore:(NSError**)outError;
+
+/** The shared attachment store, if enabled. */
+@property (readonly) TDSharedBlobStore* sharedAttachmentStore;
+
+/** If YES, databases returned by -databaseNamed: from then on are opened in multi-process mode
+    (see TD_Database.multiProcess), for a directory that other processes use too. */
+@property BOOL multiProcess;
+
+/** If YES, databases returned by -databaseNamed: from then on are kept in memory (see
+    TD_Database.inMemory), with only their attachments in the directory. -allDatabaseNames then
+    lists the in-memory databases that have been opened, rather than the directory's files. */
+@property BOOL inMemory;
+
 /**
  * Returns a database:
  * - If the database is cached, it will return this database. The database may or may not be open.
@@ -58,6 +76,20 @@ extern NSUInteger const kTD_DatabaseManagerErrorCodeInvalidName;
 
 - (BOOL)deleteDatabaseNamed:(NSString*)name error:(NSError *__autoreleasing *)error;
 
+/**
+ * Like -deleteDatabaseNamed:error:, but only moves the database's files into a new directory in
+ * the trash, which is emptied on a background queue; the name can be used again at once. Other
+ * files to go with the database can be moved into the returned directory before calling
+ * -emptyTrashDirectory:.
+ *
+ * return the directory the database was moved to, or nil if there was an error
+ */
+- (NSString*)trashDatabaseNamed:(NSString*)name error:(NSError *__autoreleasing *)error;
+
+/** Deletes a directory returned by -trashDatabaseNamed:error: on a background queue, then any
+    shared attachments the database held the last links to. */
+- (void)emptyTrashDirectory:(NSString*)trashDirectory;
+
 @property (readonly) NSArray* allDatabaseNames;
 @property (readonly) NSArray* allOpenDatabases;
 
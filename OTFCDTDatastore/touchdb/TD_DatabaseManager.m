@@ -20,6 +20,7 @@
 
 #import "TD_DatabaseManager.h"
 #import "TD_Database.h"
+#import "TDSharedBlobStore.h"
 #import "TDPusher.h"
 #import "TDInternal.h"
 #import "TDMisc.h"
@@ -37,6 +38,8 @@ const NSString* TD_Server = @"TD_Server";
 @implementation TD_DatabaseManager
 
 #define kDBExtension @"touchdb"
+#define kSharedAttachmentsDirName @"shared attachments"
+#define kTrashDirName @"trash"
 
 // http://wiki.apache.org/couchdb/HTTP_database_API#Naming_and_Addressing
 #define kLegalChars @"abcdefghijklmnopqrstuvwxyz0123456789_$()+-/"
@@ -95,10 +98,35 @@ static NSCharacterSet* kIllegalNameChars;
                 return nil;
             }
         }
+        [self emptyLeftoverTrash];
     }
     return self;
 }
 
+- (dispatch_queue_t)trashQueue
+{
+    static dispatch_queue_t queue;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        dispatch_queue_attr_t attr =
+            dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0);
+        queue = dispatch_queue_create("com.cloudant.sync.trash", attr);
+    });
+    return queue;
+}
+
+// Whatever trash an earlier launch didn't get round to deleting
+- (void)emptyLeftoverTrash
+{
+    if (_options.readOnly) return;
+    NSString* trashPath = [_dir stringByAppendingPathComponent:kTrashDirName];
+    NSArray* leftovers = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:trashPath
+                                                                             error:NULL];
+    for (NSString* filename in leftovers) {
+        [self emptyTrashDirectory:[trashPath stringByAppendingPathComponent:filename]];
+    }
+}
+
 - (void)dealloc
 {
     os_log_info(CDTOSLog, "@DEALLOC %{public}@", self);
@@ -107,6 +135,17 @@ static NSCharacterSet* kIllegalNameChars;
 
 @synthesize directory = _dir;
 
+- (BOOL)enableSharedAttachmentStore:(NSError**)outError
+{
+    @synchronized(self) {
+        if (!_sharedAttachmentStore) {
+            NSString* path = [_dir stringByAppendingPathComponent:kSharedAttachmentsDirName];
+            _sharedAttachmentStore = [[TDSharedBlobStore alloc] initWithPath:path error:outError];
+        }
+        return _sharedAttachmentStore != nil;
+    }
+}
+
 #pragma mark - DATABASES:
 
 + (BOOL)isValidDatabaseName:(NSString*)name
@@ -143,6 +182,9 @@ static NSCharacterSet* kIllegalNameChars;
                 } else {
                     db.name = name;
                     db.readOnly = _options.readOnly;
+                    db.sharedAttachmentStore = _sharedAttachmentStore;
+                    db.multiProcess = self.multiProcess;
+                    db.inMemory = self.inMemory;
                     
                     _databases[name] = db;
                 }
@@ -183,12 +225,86 @@ static NSCharacterSet* kIllegalNameChars;
             }
         }
         
+        if (success) {
+            // Its attachments may have been the last links to some shared ones
+            [_sharedAttachmentStore deleteUnreferencedBlobs];
+        }
         return success;
     }
 }
 
+- (NSString*)trashDatabaseNamed:(NSString*)name error:(NSError *__autoreleasing *)error
+{
+    @synchronized(self) {
+        NSString *path = [self pathForName:name];
+        if (!path) {
+            if (error) {
+                NSDictionary *userInfo = @{
+                    NSLocalizedDescriptionKey : NSLocalizedString(@"Couldn't delete database.", nil),
+                    NSLocalizedFailureReasonErrorKey : NSLocalizedString(@"Invalid name?", nil),
+                    NSLocalizedRecoverySuggestionErrorKey : NSLocalizedString(@"Invalid name?", nil)
+                };
+                *error = [NSError errorWithDomain:kTD_DatabaseManagerErrorDomain
+                                             code:kTD_DatabaseManagerErrorCodeInvalidName
+                                         userInfo:userInfo];
+            }
+            return nil;
+        }
+
+        // A directory of its own, so databases trashed under the same name don't collide
+        NSString *trashDirectory = [[_dir stringByAppendingPathComponent:kTrashDirName]
+            stringByAppendingPathComponent:TDCreateUUID()];
+        if (![[NSFileManager defaultManager] createDirectoryAtPath:trashDirectory
+                                       withIntermediateDirectories:YES
+                                                        attributes:nil
+                                                             error:error]) {
+            return nil;
+        }
+
+        BOOL success;
+        TD_Database *db = _databases[name];
+        if (db) {
+            success = [db moveDatabaseToDirectory:trashDirectory error:error];
+            if (success) {
+                [_databases removeObjectForKey:name];
+            }
+        } else {
+            success = [TD_Database moveClosedDatabaseAtPath:path
+                                                toDirectory:trashDirectory
+                                                      error:error];
+        }
+        if (!success) {
+            // Whatever was moved is deleted rather than put back, as the delete had begun
+            [self emptyTrashDirectory:trashDirectory];
+            return nil;
+        }
+        return trashDirectory;
+    }
+}
+
+- (void)emptyTrashDirectory:(NSString*)trashDirectory
+{
+    TDSharedBlobStore* sharedStore = self.sharedAttachmentStore;
+    dispatch_async([self trashQueue], ^{
+        NSError* error;
+        if (![[NSFileManager defaultManager] removeItemAtPath:trashDirectory error:&error]) {
+            os_log_error(CDTOSLog, "Couldn't empty trash %{public}@: %{public}@", trashDirectory, error);
+        }
+        // Its attachments may have been the last links to some shared ones
+        [sharedStore deleteUnreferencedBlobs];
+    });
+}
+
 - (NSArray*)allDatabaseNames
 {
+    if (self.inMemory) {
+        @synchronized(self) {
+            return [_databases keysOfEntriesPassingTest:^BOOL(NSString* name, TD_Database* db,
+                                                              BOOL* stop) {
+                return db.exists;
+            }].allObjects;
+        }
+    }
     NSArray* files = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:_dir error:NULL];
     files = [files pathsMatchingExtensions:@[ kDBExtension ]];
     return [files my_map:^(id filename) {
@@ -40,6 +40,12 @@
 
 @property SequenceNumber sequence;
 
+/** Attachments of a pulled revision that were left out of its _attachments so it could be
+    inserted before they are downloaded, keyed by name; see
+    -[TD_Database documentDeferringAttachments:pendingAttachments:]. They are recorded for
+    download in the same transaction as the revision is inserted. */
+@property (copy) NSDictionary* pendingAttachments;
+
 - (NSComparisonResult)compareSequences:(TD_Revision*)rev;
 
 /** Generation number: 1 for a new document, 2 for the 2nd revision, ...
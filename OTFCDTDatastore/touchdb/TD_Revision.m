@@ -129,13 +129,10 @@
     Assert(!_docID || $equal(_docID, docID));
     TD_Revision* rev = [[[self class] alloc] initWithDocID:docID revID:revID deleted:_deleted];
 
-    // Update the _id and _rev in the new object's JSON:
-    NSDictionary* properties = self.properties;
-    NSMutableDictionary* nuProperties =
-        properties ? [properties mutableCopy] : [[NSMutableDictionary alloc] init];
-    [nuProperties setValue:docID forKey:@"_id"];
-    [nuProperties setValue:revID forKey:@"_rev"];
-    rev.properties = nuProperties;
+    // Update the _id and _rev in the new object's JSON, without parsing it if it's unparsed:
+    NSDictionary* idAndRev = @{ @"_id" : docID, @"_rev" : revID };
+    TD_Body* body = [_body bodyBySettingProperties:idAndRev removingKeys:nil];
+    rev.body = body ?: [TD_Body bodyWithProperties:idAndRev];
 
     return rev;
 }
@@ -11,6 +11,8 @@
 #import <Foundation/Foundation.h>
 #import "TD_Database.h"
 
+@class CDTQueryHandle;
+
 typedef void (^TDMapEmitBlock)(id key, id value);
 
 /** A "map" function called when a document is to be added to a view.
@@ -31,6 +33,9 @@ typedef struct TDQueryOptions
 {
     __unsafe_unretained id startKey;
     __unsafe_unretained id endKey;
+    // With startKey, rows of that key start at this doc ID, so a page can continue where the
+    // last stopped; only used by regular views.
+    __unsafe_unretained NSString* startKeyDocID;
     __unsafe_unretained NSArray* keys;
     unsigned skip;
     unsigned limit;
@@ -40,9 +45,14 @@ typedef struct TDQueryOptions
     BOOL includeDocs;
     BOOL updateSeq;
     BOOL inclusiveEnd;
+    BOOL exclusiveStart;  // leaves out startKey itself; only used by _all_docs
     BOOL reduce;
     BOOL group;
     BOOL includeDeletedDocs;  // only works with _all_docs, not regular views
+    __unsafe_unretained CDTQueryHandle* handle;  // only used by -[TD_View queryWithOptions:]
+    // With includeDocs, just these top-level or dotted fields of the bodies; nil for all of them.
+    // Only used by -[TD_Database enumerateDocsWithIDs:options:usingBlock:]
+    __unsafe_unretained NSArray<NSString*>* fields;
 } TDQueryOptions;
 
 extern const TDQueryOptions kDefaultTDQueryOptions;
@@ -69,6 +79,7 @@ typedef enum {
     TDReduceBlock _reduceBlock;
     TDViewCollation _collation;
     TDContentOptions _mapContentOptions;
+    BOOL _mapBlockIsThreadSafe;
 }
 
 - (void)deleteView;
@@ -82,6 +93,11 @@ typedef enum {
 @property TDViewCollation collation;
 @property TDContentOptions mapContentOptions;
 
+/** Set this if the map block can be called on several threads at once, and doesn't touch the
+    database. -updateIndex will then parse documents and run the map block over batches of them
+    concurrently, instead of one at a time on the database queue. Defaults to NO. */
+@property BOOL mapBlockIsThreadSafe;
+
 - (BOOL)setMapBlock:(TDMapBlock)mapBlock
         reduceBlock:(TDReduceBlock)reduceBlock
             version:(NSString*)version;
@@ -102,14 +118,42 @@ typedef enum {
 @property (readonly) SequenceNumber lastSequenceIndexed;
 
 /** Queries the view. Does NOT first update the index.
-    @param options  The options to use.
+    @param options  The options to use. If its handle is cancelled, the query stops, returns nil
+   and sets the status to kTDStatusCancelled.
     @return  An array of result rows -- each is a dictionary with "key" and "value" keys, and
    possibly "id" and "doc". */
 - (NSArray*)queryWithOptions:(const TDQueryOptions*)options status:(TDStatus*)outStatus;
 
+/** Queries the view like -queryWithOptions:status:, but hands each row to the block as it's read
+    rather than building an array of them all, until the block sets *stop. Rows of equal keys are
+    ordered by doc ID. Only for regular queries: reducing or grouping is a kTDStatusBadParam.
+    The block is called on the database queue, so it mustn't use the database itself.
+    @return  200 if the query ran, kTDStatusCancelled if its handle was cancelled, else an error */
+- (TDStatus)enumerateRowsWithOptions:(const TDQueryOptions*)options
+                          usingBlock:(void (^)(NSDictionary* row, BOOL* stop))block;
+
+/** Queries one page of the view: up to options->limit rows, continuing from options->startKey and
+    options->startKeyDocID. Only the page's rows are read from the index, however far into it they
+    are, unlike paging with skip.
+    @param outNextStartKey  Set to the key to start the next page at, or nil after the last page.
+    @param outNextStartKeyDocID  Set to the doc ID to start the next page at, with the key.
+    @return  The page's rows, as from -queryWithOptions:status:, or nil on error. */
+- (NSArray*)queryPageWithOptions:(const TDQueryOptions*)options
+                    nextStartKey:(id*)outNextStartKey
+               nextStartKeyDocID:(NSString**)outNextStartKeyDocID
+                          status:(TDStatus*)outStatus;
+
 /** Utility function to use in reduce blocks. Totals an array of NSNumbers. */
 + (NSNumber*)totalValues:(NSArray*)values;
 
+/** CouchDB's built-in "_count", "_sum" and "_stats" reduce functions, which -compileFromProperties:
+    also recognises by name. A view using one of these keeps a running reduction of each key's rows
+    as its index is updated, so reduced and grouped queries over whole keys visit one row per key
+    rather than one per emitted value. */
++ (TDReduceBlock)countReduceBlock;
++ (TDReduceBlock)sumReduceBlock;
++ (TDReduceBlock)statsReduceBlock;
+
 + (void)setCompiler:(id<TDViewCompiler>)compiler;
 + (id<TDViewCompiler>)compiler;
 
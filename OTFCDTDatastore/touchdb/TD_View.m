@@ -30,9 +30,12 @@
 #import "FMDatabase+LongLong.h"
 
 #import "CDTLogging.h"
+#import "CDTQueryHandle.h"
+#import "CDTQueueTelemetry.h"
 #import "Test.h"
 
 #define kReduceBatchSize 100
+#define kMapBatchSize 256
 
 const TDQueryOptions kDefaultTDQueryOptions = {
     .limit = UINT_MAX,
@@ -42,7 +45,35 @@ const TDQueryOptions kDefaultTDQueryOptions = {
 
 static id<TDViewCompiler> sCompiler;
 
-@interface TD_View ()
+static void* collationContext(TDViewCollation collation)
+{
+    switch (collation) {
+        case kTDViewCollationRaw:
+            return kTDCollateJSON_Raw;
+        case kTDViewCollationASCII:
+            return kTDCollateJSON_ASCII;
+        default:
+            return kTDCollateJSON_Unicode;
+    }
+}
+
+static NSData* sortKeyForJSON(void* context, NSString* json)
+{
+    if (context == kTDCollateJSON_Unicode) return nil;
+    const char* chars = json.UTF8String;
+    return TDCollateJSONSortKey(context, (int)strlen(chars), chars);
+}
+
+typedef enum {
+    kTDBuiltInReduceNone,
+    kTDBuiltInReduceCount,
+    kTDBuiltInReduceSum,
+    kTDBuiltInReduceStats
+} TDBuiltInReduce;
+
+@interface TD_View () {
+    TDBuiltInReduce _builtInReduce;
+}
 
 /** Must be called from within FMDatabaseQueue block */
 - (SequenceNumber)lastSequenceIndexedInDatabase:(FMDatabase*)db;
@@ -65,7 +96,8 @@ static id<TDViewCompiler> sCompiler;
 }
 
 @synthesize database = _db, name = _name, mapBlock = _mapBlock, reduceBlock = _reduceBlock,
-            collation = _collation, mapContentOptions = _mapContentOptions;
+            collation = _collation, mapContentOptions = _mapContentOptions,
+            mapBlockIsThreadSafe = _mapBlockIsThreadSafe;
 
 - (int)viewID
 {
@@ -104,6 +136,14 @@ static id<TDViewCompiler> sCompiler;
     Assert(version);
     _mapBlock = mapBlock;        // copied implicitly in ARC
     _reduceBlock = reduceBlock;  // copied implicitly in ARC
+    if (reduceBlock && reduceBlock == [TD_View countReduceBlock])
+        _builtInReduce = kTDBuiltInReduceCount;
+    else if (reduceBlock && reduceBlock == [TD_View sumReduceBlock])
+        _builtInReduce = kTDBuiltInReduceSum;
+    else if (reduceBlock && reduceBlock == [TD_View statsReduceBlock])
+        _builtInReduce = kTDBuiltInReduceStats;
+    else
+        _builtInReduce = kTDBuiltInReduceNone;
 
     // The DB has to be open to read/write on it. A key provider is necessary to open a DB.
     // If the DB was created with a datastore, the following validation will always be true.
@@ -145,7 +185,13 @@ static id<TDViewCompiler> sCompiler;
     }
     NSString* reduceSource = viewProps[@"reduce"];
     TDReduceBlock reduceBlock = NULL;
-    if (reduceSource) {
+    if ($equal(reduceSource, @"_count"))
+        reduceBlock = [TD_View countReduceBlock];
+    else if ($equal(reduceSource, @"_sum"))
+        reduceBlock = [TD_View sumReduceBlock];
+    else if ($equal(reduceSource, @"_stats"))
+        reduceBlock = [TD_View statsReduceBlock];
+    else if (reduceSource) {
         reduceBlock = [[TD_View compiler] compileReduceFunction:reduceSource language:language];
         if (!reduceBlock) {
             os_log_debug(CDTOSLog, "View %{public}@ has unknown reduce function: %{public}@", _name, reduceSource);
@@ -168,6 +214,8 @@ static id<TDViewCompiler> sCompiler;
 {
     if (self.viewID <= 0) return;
     [_db.fmdbQueue inTransaction:^(FMDatabase* db, BOOL* rollback) {
+        [db executeUpdate:@"UPDATE views SET reduce_cached=0 WHERE view_id=?", @(self->_viewID)];
+        [db executeUpdate:@"DELETE FROM maps_reduced WHERE view_id=?", @(self->_viewID)];
         [db executeUpdate:@"DELETE FROM maps WHERE view_id=?", @(self->_viewID)];
         [db executeUpdate:@"UPDATE views SET lastsequence=0 WHERE view_id=?", @(self->_viewID)];
     }];
@@ -203,6 +251,7 @@ static id fromJSON(NSData* json)
 
 - (TDStatus)updateIndex
 {
+    CDTQueueOperationScope(CDTQueueOperationIndexUpdate);
     os_log_info(CDTOSLog, "Re-indexing view %{public}@ ...", _name);
     Assert(_mapBlock, @"Cannot reindex view '%@' which has no map block set", _name);
 
@@ -233,6 +282,22 @@ static id fromJSON(NSData* json)
                 status = kTDStatusDBError;
                 return;
             }
+            // The maps_reduced triggers keep a built-in reduce's per-key reductions up to date as
+            // rows come and go. They're switched off while the index is wiped, or if the view no
+            // longer has a built-in reduce, and rebuilt in one go at the end:
+            const BOOL cacheReduce = (self->_builtInReduce != kTDBuiltInReduceNone);
+            BOOL reduceCached =
+                [fmdb boolForQuery:@"SELECT reduce_cached FROM views WHERE view_id=?", @(viewID)];
+            if (reduceCached && (lastSequence == 0 || !cacheReduce)) {
+                if (![fmdb executeUpdate:@"UPDATE views SET reduce_cached=0 WHERE view_id=?",
+                                         @(viewID)] ||
+                    ![fmdb executeUpdate:@"DELETE FROM maps_reduced WHERE view_id=?", @(viewID)]) {
+                    status = kTDStatusDBError;
+                    return;
+                }
+                reduceCached = NO;
+            }
+
             BOOL ok;
             if (lastSequence == 0) {
                 // If the lastSequence has been reset to 0, make sure to remove all map results:
@@ -254,22 +319,96 @@ static id fromJSON(NSData* json)
 
             // This is the emit() block, which gets called from within the user-defined map() block
             // that's called down below.
+            void* sortKeyContext = collationContext(strongSelf->_collation);
+            BOOL (^insertRow)(NSString*, NSString*, SequenceNumber) =
+                ^BOOL(NSString* keyJSON, NSString* valueJSON, SequenceNumber rowSequence) {
+                    os_log_info(CDTOSLog, "    emit(%{public}@, %{public}@)", keyJSON, valueJSON);
+                    id sortKey = sortKeyForJSON(sortKeyContext, keyJSON) ?: $null;
+                    if (![fmdb executeUpdate:@"INSERT INTO maps (view_id, sequence, key, value, "
+                                              "sort_key) VALUES (?, ?, ?, ?, ?)",
+                                             @(viewID), @(rowSequence), keyJSON, valueJSON, sortKey])
+                        return NO;
+                    ++inserted;
+                    return YES;
+                };
             TDMapEmitBlock emit = ^(id key, id value) {
                 if (!key) key = $null;
-                NSString* keyJSON = toJSONString(key);
-                NSString* valueJSON = toJSONString(value);
-                os_log_info(CDTOSLog, "    emit(%{public}@, %{public}@)", keyJSON, valueJSON);
-                if ([fmdb executeUpdate:@"INSERT INTO maps (view_id, sequence, key, value) VALUES "
-                                         "(?, ?, ?, ?)",
-                                        @(viewID), @(sequence), keyJSON, valueJSON])
-                    ++inserted;
-                else
-                    emitFailed = YES;
+                if (!insertRow(toJSONString(key), toJSONString(value), sequence)) emitFailed = YES;
+            };
+
+            // A thread-safe map block is run over batches of revisions concurrently instead. Only
+            // the parsing and mapping leave this queue; the revisions are read here beforehand,
+            // and their emitted rows are inserted here afterwards in the order they were read.
+            const BOOL concurrent = strongSelf->_mapBlockIsThreadSafe;
+            TDMapBlock mapBlock = strongSelf->_mapBlock;
+            NSMutableArray* batchSequences = [NSMutableArray array];
+            NSMutableArray* batchJSONs = [NSMutableArray array];
+            NSMutableArray* batchRevs = [NSMutableArray array];
+            NSMutableArray* batchConflicts = [NSMutableArray array];
+            BOOL (^mapBatch)(void) = ^BOOL {
+                NSUInteger count = batchSequences.count;
+                // The database-dependent properties are gathered here, with the attachments of
+                // the whole batch read by one query:
+                TD_Database* tddb = self->_db;
+                TDContentOptions options = self->_mapContentOptions;
+                NSDictionary* attachments = [tddb getAttachmentDictsForSequences:batchSequences
+                                                                         options:options
+                                                                      inDatabase:fmdb];
+                NSMutableArray* batchExtras = [NSMutableArray arrayWithCapacity:count];
+                for (TD_Revision* rev in batchRevs) {
+                    [batchExtras addObject:[tddb extraPropertiesForRevision:rev
+                                                                    options:options
+                                                      prefetchedAttachments:attachments
+                                                        prefetchedHistories:nil
+                                                                 inDatabase:fmdb]];
+                }
+                NSMutableArray* emittedRows = [NSMutableArray arrayWithCapacity:count];
+                for (NSUInteger i = 0; i < count; i++) {
+                    [emittedRows addObject:[NSNull null]];
+                }
+                dispatch_apply(count, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^(size_t i) {
+                    @autoreleasepool
+                    {
+                        NSDictionary* properties =
+                            [TD_Database documentPropertiesFromJSON:$castIf(NSData, batchJSONs[i])
+                                                    extraProperties:batchExtras[i]];
+                        NSArray* conflicts = $castIf(NSArray, batchConflicts[i]);
+                        if (conflicts) {
+                            NSMutableDictionary* mutableProps = [properties mutableCopy];
+                            mutableProps[@"_conflicts"] = conflicts;
+                            properties = mutableProps;
+                        }
+                        NSMutableArray* rows = [NSMutableArray array];
+                        mapBlock(properties, ^(id key, id value) {
+                            if (!key) key = $null;
+                            [rows addObject:@[ toJSONString(key) ?: $null, toJSONString(value) ?: $null ]];
+                        });
+                        @synchronized(emittedRows)
+                        {
+                            emittedRows[i] = rows;
+                        }
+                    }
+                });
+
+                for (NSUInteger i = 0; i < count; i++) {
+                    SequenceNumber rowSequence = [batchSequences[i] longLongValue];
+                    for (NSArray* row in emittedRows[i]) {
+                        if (!insertRow($castIf(NSString, row[0]), $castIf(NSString, row[1]),
+                                       rowSequence))
+                            return NO;
+                    }
+                }
+                [batchSequences removeAllObjects];
+                [batchJSONs removeAllObjects];
+                [batchRevs removeAllObjects];
+                [batchConflicts removeAllObjects];
+                return YES;
             };
 
             // Now scan every revision added since the last time the view was indexed:
             r = [fmdb
-                executeQuery:@"SELECT revs.doc_id, sequence, docid, revid, json FROM revs, docs "
+                executeQuery:@"SELECT revs.doc_id, sequence, docid, revid, " kTDRevsBodySQL
+                              " FROM revs, docs "
                               "WHERE sequence>? AND current!=0 AND deleted=0 "
                               "AND revs.doc_id = docs.doc_id "
                               "ORDER BY revs.doc_id, revid DESC",
@@ -331,7 +470,7 @@ static id fromJSON(NSData* json)
                                     revID = oldRevID;
                                     sequence = oldSequence;
                                     json = [fmdb
-                                        dataForQuery:@"SELECT json FROM revs WHERE sequence=?",
+                                        dataForQuery:@"SELECT " kTDRevsBodySQL " FROM revs WHERE sequence=?",
                                                      @(sequence)];
                                 }
                             }
@@ -346,6 +485,23 @@ static id fromJSON(NSData* json)
                         }
                     }
 
+                    if (concurrent) {
+                        // The JSON is parsed along with the mapping, and the database-dependent
+                        // properties gathered for the whole batch:
+                        TD_Revision* rev =
+                            [[TD_Revision alloc] initWithDocID:docID revID:revID deleted:NO];
+                        rev.sequence = sequence;
+                        [batchSequences addObject:@(sequence)];
+                        [batchJSONs addObject:json ?: $null];
+                        [batchRevs addObject:rev];
+                        [batchConflicts addObject:conflicts ?: $null];
+                        if (batchSequences.count >= kMapBatchSize && !mapBatch()) {
+                            status = kTDStatusCallbackError;
+                            return;
+                        }
+                        continue;
+                    }
+
                     // Get the document properties, to pass to the map function:
                     NSDictionary* properties = [self->_db documentPropertiesFromJSON:json
                                                                          docID:docID
@@ -376,6 +532,26 @@ static id fromJSON(NSData* json)
                 }
             }
 
+            if (batchSequences.count > 0 && !mapBatch()) {
+                status = kTDStatusCallbackError;
+                return;
+            }
+
+            if (cacheReduce && !reduceCached) {
+                if (![fmdb executeUpdate:@"INSERT INTO maps_reduced (view_id, key, row_count, total, "
+                                          "total_squares, minimum, maximum) "
+                                          "SELECT view_id, key, count(*), total(v), total(v * v), "
+                                          "min(v), max(v) FROM (SELECT view_id, key, "
+                                          "ifnull(CAST(value AS REAL), 0) AS v FROM maps "
+                                          "WHERE view_id=?) GROUP BY key COLLATE JSON",
+                                         @(viewID)] ||
+                    ![fmdb executeUpdate:@"UPDATE views SET reduce_cached=1 WHERE view_id=?",
+                                         @(viewID)]) {
+                    status = kTDStatusDBError;
+                    return;
+                }
+            }
+
             // Finally, record the last revision sequence number that was indexed:
             if (![fmdb executeUpdate:@"UPDATE views SET lastSequence=? WHERE view_id=?",
                                      @(dbMaxSequence), @(viewID)]) {
@@ -391,7 +567,7 @@ static id fromJSON(NSData* json)
             [r close];
             if (status >= kTDStatusBadRequest)
                 os_log_debug(CDTOSLog, "TouchDB: Failed to rebuild view '%{public}@': %{public}@", self->_name, @(status));
-            *rollback = (status < kTDStatusBadRequest);
+            *rollback = (status >= kTDStatusBadRequest);
         }
     }];
     return status;
@@ -399,6 +575,28 @@ static id fromJSON(NSData* json)
 
 #pragma mark - QUERYING:
 
+/** Whether every row of the index has a sort_key in this view's collation, so that it can be
+    ordered with a plain BLOB comparison. Rows emitted before sort keys were stored, or while the
+    view had a different collation, have to go through the JSON collator instead.
+    Must be called from within a FMDatabaseQueue block **/
+- (BOOL)canQueryBySortKeyInDatabase:(FMDatabase*)fmdb
+{
+    void* context = collationContext(_collation);
+    if (context == kTDCollateJSON_Unicode) return NO;
+
+    // The first byte of a sort key identifies its collation, and NULLs sort first, so the lowest
+    // and highest keys are enough to vouch for all of them:
+    NSData* lowest = [fmdb
+        dataForQuery:@"SELECT sort_key FROM maps WHERE view_id=? ORDER BY sort_key LIMIT 1",
+                     @(_viewID)];
+    NSData* highest = [fmdb
+        dataForQuery:@"SELECT sort_key FROM maps WHERE view_id=? ORDER BY sort_key DESC LIMIT 1",
+                     @(_viewID)];
+    const uint8_t mode = (uint8_t)(uintptr_t)context;
+    return lowest.length > 0 && highest.length > 0 && ((const uint8_t*)lowest.bytes)[0] == mode &&
+           ((const uint8_t*)highest.bytes)[0] == mode;
+}
+
 /** Must be called from within a FMDatabaseQueue block **/
 - (FMResultSet*)resultSetWithOptions:(const TDQueryOptions*)options
                               status:(TDStatus*)outStatus
@@ -414,8 +612,15 @@ static id fromJSON(NSData* json)
     else if (_collation == kTDViewCollationRaw)
         collationStr = @" COLLATE JSON_RAW";
 
+    // Where the index has sort keys, range and order by them instead, which SQLite can compare
+    // with memcmp rather than calling the collator:
+    BOOL bySortKey = [self canQueryBySortKeyInDatabase:fmdb];
+    void* sortKeyContext = collationContext(_collation);
+    NSString* orderColumn = bySortKey ? @"sort_key" : @"key";
+    if (bySortKey) collationStr = @"";
+
     NSMutableString* sql = [NSMutableString stringWithString:@"SELECT key, value, docid"];
-    if (options->includeDocs) [sql appendString:@", revid, json, revs.sequence"];
+    if (options->includeDocs) [sql appendString:@", revid, " kTDRevsBodySQL ", revs.sequence"];
     [sql appendString:@" FROM maps, revs, docs WHERE maps.view_id=?"];
     NSMutableArray* args = $marray(@(_viewID));
 
@@ -430,6 +635,7 @@ static id fromJSON(NSData* json)
         [sql appendString:@")"];
     }
 
+    BOOL reduced = options->reduce || options->group || options->groupLevel > 0;
     id minKey = options->startKey, maxKey = options->endKey;
     BOOL inclusiveMin = YES, inclusiveMax = options->inclusiveEnd;
     if (options->descending) {
@@ -438,21 +644,42 @@ static id fromJSON(NSData* json)
         inclusiveMin = inclusiveMax;
         inclusiveMax = YES;
     }
+    if (options->startKey && options->startKeyDocID && !options->keys && !reduced) {
+        // Continuing a page: past the start key, or at it from the doc ID on. The key stays the
+        // leading term so that the range is still read from the index.
+        NSString* startKeyJSON = toJSONString(options->startKey);
+        id startArg = bySortKey ? sortKeyForJSON(sortKeyContext, startKeyJSON) : startKeyJSON;
+        NSString* cmp = options->descending ? @"<" : @">";
+        [sql appendFormat:@" AND %@ %@= ?%@ AND (%@ %@ ?%@ OR docs.docid %@= ?)", orderColumn, cmp,
+                          collationStr, orderColumn, cmp, collationStr, cmp];
+        [args addObjectsFromArray:@[ startArg, startArg, options->startKeyDocID ]];
+        if (options->descending)
+            maxKey = nil;
+        else
+            minKey = nil;
+    }
     if (minKey) {
-        [sql appendString:(inclusiveMin ? @" AND key >= ?" : @" AND key > ?")];
+        [sql appendFormat:(inclusiveMin ? @" AND %@ >= ?" : @" AND %@ > ?"), orderColumn];
         [sql appendString:collationStr];
-        [args addObject:toJSONString(minKey)];
+        NSString* minKeyJSON = toJSONString(minKey);
+        [args addObject:(bySortKey ? sortKeyForJSON(sortKeyContext, minKeyJSON) : minKeyJSON)];
     }
     if (maxKey) {
-        [sql appendString:(inclusiveMax ? @" AND key <= ?" : @" AND key < ?")];
+        [sql appendFormat:(inclusiveMax ? @" AND %@ <= ?" : @" AND %@ < ?"), orderColumn];
         [sql appendString:collationStr];
-        [args addObject:toJSONString(maxKey)];
+        NSString* maxKeyJSON = toJSONString(maxKey);
+        [args addObject:(bySortKey ? sortKeyForJSON(sortKeyContext, maxKeyJSON) : maxKeyJSON)];
     }
 
     [sql appendString:@" AND revs.sequence = maps.sequence AND docs.doc_id = revs.doc_id "
-                       "ORDER BY key"];
+                       "ORDER BY "];
+    [sql appendString:orderColumn];
     [sql appendString:collationStr];
     if (options->descending) [sql appendString:@" DESC"];
+    if (!reduced) {
+        // A stable order for rows of the same key, for paging through them by doc ID.
+        [sql appendString:options->descending ? @", docs.docid DESC" : @", docs.docid"];
+    }
     if (options->limit != kDefaultTDQueryOptions.limit) {
         [sql appendString:@" LIMIT ?"];
         [args addObject:@(options->limit)];
@@ -471,74 +698,182 @@ static id fromJSON(NSData* json)
 
 - (NSArray*)queryWithOptions:(const TDQueryOptions*)options status:(TDStatus*)outStatus
 {
+    CDTQueueOperationScope(CDTQueueOperationQuery);
     if (!options) options = &kDefaultTDQueryOptions;
 
-    __block NSMutableArray* rows;
+    __block NSArray* rows;
     __weak TD_View* weakSelf = self;
+    CDTQueryHandle* handle = options->handle;
     [_db.fmdbQueue inDatabase:^(FMDatabase* db) {
-        TD_View* strongSelf = weakSelf;
-        FMResultSet* r = [strongSelf resultSetWithOptions:options status:outStatus database:db];
-        if (!r) {
-            return;
+        [handle attachToDatabase:db];
+        rows = [weakSelf rowsWithOptions:options status:outStatus database:db];
+        [handle detachFromDatabase:db];
+    }];
+
+    // A cancelled handle makes the statements fail part way through, so whatever they returned
+    // is incomplete.
+    if (handle.isCancelled) {
+        os_log_info(CDTOSLog, "Query %{public}@: Cancelled", _name);
+        *outStatus = kTDStatusCancelled;
+        return nil;
+    }
+    return rows;
+}
+
+/** Must be called from within a FMDatabaseQueue block **/
+- (NSMutableArray*)rowsWithOptions:(const TDQueryOptions*)options
+                            status:(TDStatus*)outStatus
+                          database:(FMDatabase*)db
+{
+    NSMutableArray* rows;
+    FMResultSet* r = [self resultSetWithOptions:options status:outStatus database:db];
+    if (!r) {
+        return nil;
+    }
+
+    unsigned groupLevel = options->groupLevel;
+    bool group = options->group || groupLevel > 0;
+    if (options->reduce || group) {
+        // Reduced or grouped query:
+        // Reduced or grouped query:
+        if (!self->_reduceBlock && !group) {
+            os_log_debug(CDTOSLog, "Cannot use reduce option in view %{public}@ which has no reduce block defined", self->_name);
+            *outStatus = kTDStatusBadParam;
+            return nil;
+        }
+        if ([self canUseCachedReductionsForOptions:options database:db]) {
+            [r close];
+            r = [self cachedReductionsWithOptions:options database:db];
+            if (!r) {
+                *outStatus = kTDStatusDBError;
+                return nil;
+            }
+            rows = [self reducedQueryFromCache:r group:group groupLevel:groupLevel];
+        } else {
+            rows = [self reducedQuery:r group:group groupLevel:groupLevel];
         }
 
-        unsigned groupLevel = options->groupLevel;
-        bool group = options->group || groupLevel > 0;
-        if (options->reduce || group) {
-            // Reduced or grouped query:
-            // Reduced or grouped query:
-            if (!self->_reduceBlock && !group) {
-                os_log_debug(CDTOSLog, "Cannot use reduce option in view %{public}@ which has no reduce block defined", self->_name);
-                *outStatus = kTDStatusBadParam;
-                return;
+    } else {
+        // Regular query:
+        rows = $marray();
+        while ([r next]) {
+            @autoreleasepool
+            {
+                [rows addObject:[self rowFromResultSet:r options:options database:db]];
             }
-            rows = [strongSelf reducedQuery:r group:group groupLevel:groupLevel];
+        }
+    }
+
+    [r close];
+    *outStatus = kTDStatusOK;
+    os_log_info(CDTOSLog, "Query %{public}@: Returning %{public}u rows", self->_name, (unsigned)rows.count);
+    return rows;
+}
 
+/** The row of a regular query at the result set's current row.
+    Must be called from within a FMDatabaseQueue block **/
+- (NSDictionary*)rowFromResultSet:(FMResultSet*)r
+                          options:(const TDQueryOptions*)options
+                         database:(FMDatabase*)db
+{
+    id key = fromJSON([r dataNoCopyForColumnIndex:0]);
+    id value = fromJSON([r dataNoCopyForColumnIndex:1]);
+    Assert(key);
+    NSString* docID = [r stringForColumnIndex:2];
+    id docContents = nil;
+    if (options->includeDocs) {
+        NSString* linkedID = $castIf(NSDictionary, value)[@"_id"];
+        if (linkedID) {
+            // Linked document:
+            // http://wiki.apache.org/couchdb/Introduction_to_CouchDB_views#Linked_documents
+            NSString* linkedRev = value[@"_rev"];  // usually nil
+            TDStatus linkedStatus;
+            TD_Revision* linked = [_db getDocumentWithID:linkedID
+                                              revisionID:linkedRev
+                                                 options:options->content
+                                                  status:&linkedStatus];
+            docContents = linked ? linked.properties : $null;
         } else {
-            // Regular query:
-            rows = $marray();
-            while ([r next]) {
-                @autoreleasepool
-                {
-                    id key = fromJSON([r dataNoCopyForColumnIndex:0]);
-                    id value = fromJSON([r dataNoCopyForColumnIndex:1]);
-                    Assert(key);
-                    NSString* docID = [r stringForColumnIndex:2];
-                    id docContents = nil;
-                    if (options->includeDocs) {
-                        NSString* linkedID = $castIf(NSDictionary, value)[@"_id"];
-                        if (linkedID) {
-                            // Linked document:
-                            // http://wiki.apache.org/couchdb/Introduction_to_CouchDB_views#Linked_documents
-                            NSString* linkedRev = value[@"_rev"];  // usually nil
-                            TDStatus linkedStatus;
-                            TD_Revision* linked = [self->_db getDocumentWithID:linkedID
-                                                                    revisionID:linkedRev
-                                                                       options:options->content
-                                                                        status:&linkedStatus];
-                            docContents = linked ? linked.properties : $null;
-                        } else {
-                            docContents =
-                                [self->_db documentPropertiesFromJSON:[r dataNoCopyForColumnIndex:4]
-                                                                docID:docID
-                                                                revID:[r stringForColumnIndex:3]
-                                                              deleted:NO
-                                                             sequence:[r longLongIntForColumnIndex:5]
-                                                              options:options->content
-                                                           inDatabase:db];
-                        }
-                    }
-                    os_log_debug(CDTOSLog, "Query %{public}@: Found row with key=%{public}@, value=%{public}@, id=%{public}@", self->_name, toJSONString(key), toJSONString(value), toJSONString(docID));
-                    [rows addObject:$dict({ @"id", docID }, { @"key", key }, { @"value", value },
-                                          { @"doc", docContents })];
-                }
-            }
+            docContents = [_db documentPropertiesFromJSON:[r dataNoCopyForColumnIndex:4]
+                                                    docID:docID
+                                                    revID:[r stringForColumnIndex:3]
+                                                  deleted:NO
+                                                 sequence:[r longLongIntForColumnIndex:5]
+                                                  options:options->content
+                                               inDatabase:db];
         }
+    }
+    os_log_debug(CDTOSLog, "Query %{public}@: Found row with key=%{public}@, value=%{public}@, id=%{public}@", _name, toJSONString(key), toJSONString(value), toJSONString(docID));
+    return $dict({ @"id", docID }, { @"key", key }, { @"value", value }, { @"doc", docContents });
+}
+
+- (TDStatus)enumerateRowsWithOptions:(const TDQueryOptions*)options
+                          usingBlock:(void (^)(NSDictionary* row, BOOL* stop))block
+{
+    CDTQueueOperationScope(CDTQueueOperationQuery);
+    if (!options) options = &kDefaultTDQueryOptions;
+    if (options->reduce || options->group || options->groupLevel > 0) {
+        os_log_debug(CDTOSLog, "Cannot stream the rows of a reduced query of view %{public}@", _name);
+        return kTDStatusBadParam;
+    }
 
+    __block TDStatus status = kTDStatusOK;
+    __block unsigned count = 0;
+    __weak TD_View* weakSelf = self;
+    CDTQueryHandle* handle = options->handle;
+    [_db.fmdbQueue inDatabase:^(FMDatabase* db) {
+        [handle attachToDatabase:db];
+        FMResultSet* r = [weakSelf resultSetWithOptions:options status:&status database:db];
+        BOOL stop = NO;
+        while (!stop && [r next]) {
+            @autoreleasepool
+            {
+                block([weakSelf rowFromResultSet:r options:options database:db], &stop);
+                count++;
+            }
+        }
         [r close];
-        *outStatus = kTDStatusOK;
-        os_log_info(CDTOSLog, "Query %{public}@: Returning %{public}u rows", self->_name, (unsigned)rows.count);
+        [handle detachFromDatabase:db];
     }];
+
+    // As with -queryWithOptions:status:, a cancelled handle may have cut the rows short.
+    if (handle.isCancelled) {
+        os_log_info(CDTOSLog, "Query %{public}@: Cancelled", _name);
+        return kTDStatusCancelled;
+    }
+    os_log_info(CDTOSLog, "Query %{public}@: Streamed %{public}u rows", _name, count);
+    return status;
+}
+
+- (NSArray*)queryPageWithOptions:(const TDQueryOptions*)options
+                    nextStartKey:(id*)outNextStartKey
+               nextStartKeyDocID:(NSString**)outNextStartKeyDocID
+                          status:(TDStatus*)outStatus
+{
+    if (!options) options = &kDefaultTDQueryOptions;
+
+    // One row more than the page, to know where the next one starts:
+    TDQueryOptions pageOptions = *options;
+    unsigned limit = options->limit;
+    if (limit != kDefaultTDQueryOptions.limit) pageOptions.limit = limit + 1;
+
+    NSMutableArray* rows = $marray();
+    __block id nextKey = nil;
+    __block NSString* nextDocID = nil;
+    TDStatus status = [self enumerateRowsWithOptions:&pageOptions
+                                          usingBlock:^(NSDictionary* row, BOOL* stop) {
+                                              if (rows.count == limit) {
+                                                  nextKey = row[@"key"];
+                                                  nextDocID = row[@"id"];
+                                                  *stop = YES;
+                                              } else {
+                                                  [rows addObject:row];
+                                              }
+                                          }];
+    *outStatus = status;
+    if (TDStatusIsError(status)) return nil;
+    if (outNextStartKey) *outNextStartKey = nextKey;
+    if (outNextStartKeyDocID) *outNextStartKeyDocID = nextDocID;
     return rows;
 }
 
@@ -617,6 +952,119 @@ static id groupKey(NSData* keyJSON, unsigned groupLevel)
     return rows;
 }
 
+/** Whether a reduced query can be answered from the per-key reductions in maps_reduced, rather
+    than by reducing every row. That needs a built-in reduce and a query that covers whole keys in
+    the order maps_reduced is indexed in.
+    Must be called from within a FMDatabaseQueue block **/
+- (BOOL)canUseCachedReductionsForOptions:(const TDQueryOptions*)options database:(FMDatabase*)fmdb
+{
+    if (_builtInReduce == kTDBuiltInReduceNone || _collation != kTDViewCollationUnicode)
+        return NO;
+    if (options->keys || options->skip > 0 || options->limit != kDefaultTDQueryOptions.limit)
+        return NO;
+    return [fmdb boolForQuery:@"SELECT reduce_cached FROM views WHERE view_id=?", @(_viewID)];
+}
+
+/** Must be called from within a FMDatabaseQueue block **/
+- (FMResultSet*)cachedReductionsWithOptions:(const TDQueryOptions*)options
+                                   database:(FMDatabase*)fmdb
+{
+    NSMutableString* sql = [NSMutableString
+        stringWithString:@"SELECT key, row_count, total, total_squares, minimum, maximum "
+                          "FROM maps_reduced WHERE view_id=?"];
+    NSMutableArray* args = $marray(@(_viewID));
+
+    id minKey = options->startKey, maxKey = options->endKey;
+    BOOL inclusiveMin = YES, inclusiveMax = options->inclusiveEnd;
+    if (options->descending) {
+        minKey = maxKey;
+        maxKey = options->startKey;
+        inclusiveMin = inclusiveMax;
+        inclusiveMax = YES;
+    }
+    if (minKey) {
+        [sql appendString:(inclusiveMin ? @" AND key >= ?" : @" AND key > ?")];
+        [args addObject:toJSONString(minKey)];
+    }
+    if (maxKey) {
+        [sql appendString:(inclusiveMax ? @" AND key <= ?" : @" AND key < ?")];
+        [args addObject:toJSONString(maxKey)];
+    }
+    [sql appendString:@" ORDER BY key"];
+    if (options->descending) [sql appendString:@" DESC"];
+
+    os_log_info(CDTOSLog, "Query %{public}@: %{public}@\n\tArguments: %{public}@", _name, sql, args);
+    return [fmdb executeQuery:sql withArgumentsInArray:args];
+}
+
+// The value the built-in reduce would have produced for the rows summarised by these totals
+static id builtInReduction(TDBuiltInReduce reduce, long long count, double total,
+                           double totalSquares, double minimum, double maximum)
+{
+    switch (reduce) {
+        case kTDBuiltInReduceCount:
+            return @(count);
+        case kTDBuiltInReduceSum:
+            return @(total);
+        case kTDBuiltInReduceStats:
+            return @{
+                @"sum" : @(total),
+                @"count" : @(count),
+                @"min" : @(minimum),
+                @"max" : @(maximum),
+                @"sumsqr" : @(totalSquares)
+            };
+        default:
+            return $null;
+    }
+}
+
+- (NSMutableArray*)reducedQueryFromCache:(FMResultSet*)r
+                                   group:(BOOL)group
+                              groupLevel:(unsigned)groupLevel
+{
+    NSData* lastKeyData = nil;
+    long long count = 0;
+    double total = 0, totalSquares = 0, minimum = 0, maximum = 0;
+
+    NSMutableArray* rows = $marray();
+    while ([r next]) {
+        @autoreleasepool
+        {
+            NSData* keyData = [r dataForColumnIndex:0];
+            Assert(keyData);
+            if (group && !groupTogether(keyData, lastKeyData, groupLevel)) {
+                if (lastKeyData) {
+                    // This key starts a new group, so record the last one:
+                    [rows addObject:$dict({ @"key", groupKey(lastKeyData, groupLevel) },
+                                          { @"value", builtInReduction(_builtInReduce, count, total,
+                                                                       totalSquares, minimum,
+                                                                       maximum) })];
+                    count = 0;
+                }
+                lastKeyData = [keyData copy];
+            }
+            double keyMinimum = [r doubleForColumnIndex:4], keyMaximum = [r doubleForColumnIndex:5];
+            minimum = (count == 0) ? keyMinimum : MIN(minimum, keyMinimum);
+            maximum = (count == 0) ? keyMaximum : MAX(maximum, keyMaximum);
+            if (count == 0) total = totalSquares = 0;
+            count += [r longLongIntForColumnIndex:1];
+            total += [r doubleForColumnIndex:2];
+            totalSquares += [r doubleForColumnIndex:3];
+        }
+    }
+    [r close];
+
+    if (count > 0) {
+        // Finish the last group (or the entire list, if no grouping):
+        id key = group ? groupKey(lastKeyData, groupLevel) : $null;
+        [rows addObject:$dict({ @"key", key },
+                              { @"value", builtInReduction(_builtInReduce, count, total,
+                                                           totalSquares, minimum, maximum) })];
+    }
+    return rows;
+}
+
 #pragma mark - OTHER:
 
 // This is really just for unit tests & debugging
@@ -651,6 +1099,58 @@ static id groupKey(NSData* keyJSON, unsigned groupLevel)
     return @(total);
 }
 
++ (TDReduceBlock)countReduceBlock
+{
+    static TDReduceBlock sCount;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sCount = ^id(NSArray* keys, NSArray* values, BOOL rereduce) {
+            return rereduce ? [TD_View totalValues:values] : @(values.count);
+        };
+    });
+    return sCount;
+}
+
++ (TDReduceBlock)sumReduceBlock
+{
+    static TDReduceBlock sSum;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sSum = ^id(NSArray* keys, NSArray* values, BOOL rereduce) {
+            return [TD_View totalValues:values];
+        };
+    });
+    return sSum;
+}
+
++ (TDReduceBlock)statsReduceBlock
+{
+    static TDReduceBlock sStats;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sStats = ^id(NSArray* keys, NSArray* values, BOOL rereduce) {
+            long long count = 0;
+            double total = 0, totalSquares = 0, minimum = 0, maximum = 0;
+            for (id value in values) {
+                NSDictionary* stats = rereduce ? $castIf(NSDictionary, value) : nil;
+                long long n = stats ? [stats[@"count"] longLongValue] : 1;
+                if (n == 0) continue;
+                double x = stats ? 0 : [$castIf(NSNumber, value) doubleValue];
+                double low = stats ? [stats[@"min"] doubleValue] : x;
+                double high = stats ? [stats[@"max"] doubleValue] : x;
+                minimum = (count == 0) ? low : MIN(minimum, low);
+                maximum = (count == 0) ? high : MAX(maximum, high);
+                count += n;
+                total += stats ? [stats[@"sum"] doubleValue] : x;
+                totalSquares += stats ? [stats[@"sumsqr"] doubleValue] : x * x;
+            }
+            return builtInReduction(kTDBuiltInReduceStats, count, total, totalSquares, minimum,
+                                    maximum);
+        };
+    });
+    return sStats;
+}
+
 + (void)setCompiler:(id<TDViewCompiler>)compiler { sCompiler = compiler; }
 
 + (id<TDViewCompiler>)compiler { return sCompiler; }
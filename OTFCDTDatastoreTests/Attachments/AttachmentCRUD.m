@@ -23,8 +23,10 @@
 #import "AmazonMD5Util.h"
 
 #import "TD_Database+BlobFilenames.h"
+#import "TDInternal.h"
 
 #import "CDTMisc.h"
+#import "FMDatabaseAdditions.h"
 
 @interface AttachmentCRUD : CloudantSyncTests
 
@@ -550,6 +552,121 @@
     XCTAssertEqualObjects(retrievedMD5, inputMD5, @"Received MD5s");
 }
 
+- (void)testCompressibleAttachmentsAreStoredGzipped
+{
+    NSError *error = nil;
+    self.datastore.compressibleAttachmentTypes = @[ @"text/*", @"application/json" ];
+
+    NSMutableString *log = [NSMutableString string];
+    for (int i = 0; i < 1000; i++) {
+        [log appendFormat:@"%d: request handled\n", i];
+    }
+    NSData *text = [log dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *image = [NSData dataWithContentsOfFile:[[NSBundle bundleForClass:[self class]]
+                                                       pathForResource:@"bonsai-boston"
+                                                                ofType:@"jpg"]];
+
+    CDTDocumentRevision *document = [CDTDocumentRevision revision];
+    document.body = [@{ @"hello" : @"world" } mutableCopy];
+    document.attachments = [@{
+        @"log" : [[CDTUnsavedDataAttachment alloc] initWithData:text
+                                                           name:@"log"
+                                                           type:@"text/plain; charset=utf-8"],
+        @"image" : [[CDTUnsavedDataAttachment alloc] initWithData:image
+                                                             name:@"image"
+                                                             type:@"image/jpg"]
+    } mutableCopy];
+    CDTDocumentRevision *rev = [self.datastore createDocumentFromRevision:document error:&error];
+    XCTAssertNotNil(rev, @"Error creating document: %@", error);
+
+    CDTSavedAttachment *log1 = rev.attachments[@"log"];
+    CDTSavedAttachment *image1 = rev.attachments[@"image"];
+    XCTAssertEqual(log1.encoding, kTDAttachmentEncodingGZIP);
+    XCTAssertEqual(log1.size, (NSInteger)text.length);
+    XCTAssertEqualObjects([log1 dataFromAttachmentContent], text);
+    XCTAssertEqual(image1.encoding, kTDAttachmentEncodingNone);
+    XCTAssertEqualObjects([image1 dataFromAttachmentContent], image);
+
+    // The blob holds the compressed bytes:
+    TDBlobKey key;
+    memcpy(key.bytes, log1.key.bytes, sizeof(key.bytes));
+    NSData *blob = [[self.datastore.database blobForKey:key] dataWithError:nil];
+    XCTAssertLessThan(blob.length, text.length / 4);
+
+    // The same contents give the same digest:
+    CDTDocumentRevision *again = [CDTDocumentRevision revision];
+    again.body = [@{ @"hello" : @"again" } mutableCopy];
+    again.attachments = [@{
+        @"log" : [[CDTUnsavedDataAttachment alloc] initWithData:text name:@"log" type:@"text/plain"]
+    } mutableCopy];
+    CDTDocumentRevision *rev2 = [self.datastore createDocumentFromRevision:again error:&error];
+    XCTAssertEqualObjects([rev2.attachments[@"log"] key], log1.key);
+}
+
+- (NSData *)readAllWithReader:(CDTAttachmentReader *)reader
+{
+    NSMutableData *content = [NSMutableData data];
+    dispatch_queue_t queue = dispatch_queue_create("reader-test", DISPATCH_QUEUE_SERIAL);
+    __block BOOL ended = NO;
+    while (!ended) {
+        XCTestExpectation *read = [self expectationWithDescription:@"chunk read"];
+        [reader readNextChunkOnQueue:queue
+                   completionHandler:^(NSData *chunk, NSError *error) {
+                       XCTAssertNotNil(chunk, @"Error reading chunk: %@", error);
+                       [content appendData:chunk];
+                       ended = (chunk.length == 0);
+                       [read fulfill];
+                   }];
+        [self waitForExpectationsWithTimeout:10 handler:nil];
+    }
+    return content;
+}
+
+- (void)testReaderReadsContentInChunks
+{
+    NSError *error = nil;
+    self.datastore.compressibleAttachmentTypes = @[ @"text/*" ];
+
+    NSMutableString *log = [NSMutableString string];
+    for (int i = 0; i < 5000; i++) {
+        [log appendFormat:@"%d: request handled\n", i];
+    }
+    NSData *text = [log dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *image = [NSData dataWithContentsOfFile:[[NSBundle bundleForClass:[self class]]
+                                                       pathForResource:@"bonsai-boston"
+                                                                ofType:@"jpg"]];
+
+    CDTDocumentRevision *document = [CDTDocumentRevision revision];
+    document.body = [@{ @"hello" : @"world" } mutableCopy];
+    document.attachments = [@{
+        @"log" : [[CDTUnsavedDataAttachment alloc] initWithData:text name:@"log" type:@"text/plain"],
+        @"image" : [[CDTUnsavedDataAttachment alloc] initWithData:image
+                                                             name:@"image"
+                                                             type:@"image/jpg"]
+    } mutableCopy];
+    CDTDocumentRevision *rev = [self.datastore createDocumentFromRevision:document error:&error];
+    XCTAssertNotNil(rev, @"Error creating document: %@", error);
+
+    CDTSavedAttachment *log1 = rev.attachments[@"log"];
+    XCTAssertEqual(log1.encoding, kTDAttachmentEncodingGZIP);
+    CDTAttachmentReader *reader = [log1 readerWithChunkSize:1000 readAheadDepth:3];
+    XCTAssertEqualObjects([self readAllWithReader:reader], text);
+
+    reader = [rev.attachments[@"image"] readerWithChunkSize:4096 readAheadDepth:2];
+    XCTAssertEqualObjects([self readAllWithReader:reader], image);
+
+    // Once closed, the reader answers that the content has ended:
+    reader = [rev.attachments[@"image"] readerWithChunkSize:4096 readAheadDepth:2];
+    [reader close];
+    XCTestExpectation *closed = [self expectationWithDescription:@"closed reader read"];
+    [reader readNextChunkOnQueue:dispatch_get_main_queue()
+               completionHandler:^(NSData *chunk, NSError *error) {
+                   XCTAssertEqualObjects(chunk, [NSData data]);
+                   [closed fulfill];
+               }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+}
+
 - (void)testUpdate
 {
     NSError *error = nil;
@@ -1094,6 +1211,140 @@
 }
 
 
+- (void)testBulkReadsGetEachDocumentsOwnAttachments
+{
+    NSError *error = nil;
+    NSMutableArray *docIds = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 3; i++) {
+        NSString *docId = [NSString stringWithFormat:@"doc%lu", (unsigned long)i];
+        CDTDocumentRevision *document = [CDTDocumentRevision revisionWithDocId:docId];
+        document.body = [@{ @"index" : @(i) } mutableCopy];
+        document.attachments = [NSMutableDictionary dictionary];
+        // doc0 has no attachments, doc1 one, doc2 two:
+        for (NSUInteger j = 0; j < i; j++) {
+            NSString *name = [NSString stringWithFormat:@"attachment%lu", (unsigned long)j];
+            NSString *content =
+                [NSString stringWithFormat:@"%lu-%lu", (unsigned long)i, (unsigned long)j];
+            NSData *data = [content dataUsingEncoding:NSUTF8StringEncoding];
+            document.attachments[name] =
+                [[CDTUnsavedDataAttachment alloc] initWithData:data name:name type:@"text/plain"];
+        }
+        XCTAssertNotNil([self.datastore createDocumentFromRevision:document error:&error]);
+        [docIds addObject:document.docId];
+    }
+
+    void (^check)(NSArray *) = ^(NSArray *revisions) {
+        XCTAssertEqual(revisions.count, (NSUInteger)3);
+        for (CDTDocumentRevision *revision in revisions) {
+            NSUInteger index = [revision.body[@"index"] unsignedIntegerValue];
+            XCTAssertEqual(revision.attachments.count, index);
+            for (NSString *name in revision.attachments) {
+                NSData *data = [revision.attachments[name] dataFromAttachmentContent];
+                NSString *expected = [NSString stringWithFormat:@"%lu-%@", (unsigned long)index,
+                                      [name substringFromIndex:@"attachment".length]];
+                XCTAssertEqualObjects([[NSString alloc] initWithData:data
+                                                            encoding:NSUTF8StringEncoding],
+                                      expected);
+            }
+        }
+    };
+    check([self.datastore getDocumentsWithIds:docIds]);
+    check([self.datastore getAllDocuments]);
+    NSMutableArray *enumerated = [NSMutableArray array];
+    XCTAssertTrue([self.datastore enumerateAllDocumentsDescending:NO
+                                                       usingBlock:^(CDTDocumentRevision *revision,
+                                                                    BOOL *stop) {
+                                                           [enumerated addObject:revision];
+                                                       }
+                                                            error:&error]);
+    check(enumerated);
+
+    // The "_attachments" dictionaries read for many sequences at once are those read one by one:
+    TD_Database *db = self.datastore.database;
+    NSArray *seqs = [[self.datastore getDocumentsWithIds:docIds] valueForKey:@"sequence"];
+    [db inReadTransaction:^(FMDatabase *fmdb) {
+        NSDictionary *batched =
+            [db getAttachmentDictsForSequences:seqs options:0 inDatabase:fmdb];
+        for (NSNumber *seq in seqs) {
+            XCTAssertEqualObjects(batched[seq],
+                                  [db getAttachmentDictForSequence:seq.longLongValue
+                                                           options:0
+                                                        inDatabase:fmdb]);
+        }
+    }];
+}
+
+- (void)testUpdatesLeavingAttachmentsAloneShareTheirRows
+{
+    NSError *error = nil;
+    CDTDocumentRevision *document = [CDTDocumentRevision revisionWithDocId:@"shared"];
+    document.body = [@{ @"generation" : @1 } mutableCopy];
+    document.attachments = [NSMutableDictionary dictionary];
+    for (NSString *name in @[ @"a", @"b" ]) {
+        NSData *data = [name dataUsingEncoding:NSUTF8StringEncoding];
+        document.attachments[name] =
+            [[CDTUnsavedDataAttachment alloc] initWithData:data name:name type:@"text/plain"];
+    }
+    CDTDocumentRevision *rev = [self.datastore createDocumentFromRevision:document error:&error];
+    XCTAssertNotNil(rev);
+
+    int (^attachmentRows)(void) = ^int {
+        __block int rows;
+        [self.dbutil.queue inDatabase:^(FMDatabase *db) {
+            rows = [db intForQuery:@"SELECT count(*) FROM attachments"];
+        }];
+        return rows;
+    };
+    void (^check)(CDTDocumentRevision *, NSArray *) =
+        ^(CDTDocumentRevision *revision, NSArray *names) {
+            CDTDocumentRevision *read = [self.datastore getDocumentWithId:revision.docId
+                                                                      rev:revision.revId
+                                                                    error:nil];
+            NSArray *readNames =
+                [read.attachments.allKeys sortedArrayUsingSelector:@selector(compare:)];
+            XCTAssertEqualObjects(readNames, names);
+            for (NSString *name in names) {
+                NSData *data = [read.attachments[name] dataFromAttachmentContent];
+                XCTAssertEqualObjects([[NSString alloc] initWithData:data
+                                                            encoding:NSUTF8StringEncoding],
+                                      name);
+            }
+        };
+
+    // Updates which only change the body don't add rows, yet each revision has the attachments:
+    CDTDocumentRevision *rev1 = rev;
+    for (int generation = 2; generation <= 3; generation++) {
+        document = [rev copy];
+        document.body = [@{ @"generation" : @(generation) } mutableCopy];
+        rev = [self.datastore updateDocumentFromRevision:document error:&error];
+        XCTAssertNotNil(rev);
+    }
+    XCTAssertEqual(attachmentRows(), 2);
+    check(rev1, @[ @"a", @"b" ]);
+    check(rev, @[ @"a", @"b" ]);
+
+    // Compacting away the revision the rows were made for keeps them for those sharing them:
+    XCTAssertTrue([self.datastore compactWithError:&error]);
+    XCTAssertEqual(attachmentRows(), 2);
+    check(rev, @[ @"a", @"b" ]);
+
+    // One which adds an attachment has rows of its own, and the shared ones go once unused:
+    document = [rev copy];
+    NSData *data = [@"c" dataUsingEncoding:NSUTF8StringEncoding];
+    NSMutableDictionary *attachments = [rev.attachments mutableCopy];
+    attachments[@"c"] =
+        [[CDTUnsavedDataAttachment alloc] initWithData:data name:@"c" type:@"text/plain"];
+    document.attachments = attachments;
+    CDTDocumentRevision *rev4 = [self.datastore updateDocumentFromRevision:document error:&error];
+    XCTAssertNotNil(rev4);
+    XCTAssertEqual(attachmentRows(), 5);
+    check(rev, @[ @"a", @"b" ]);
+    check(rev4, @[ @"a", @"b", @"c" ]);
+    XCTAssertTrue([self.datastore compactWithError:&error]);
+    XCTAssertEqual(attachmentRows(), 3);
+    check(rev4, @[ @"a", @"b", @"c" ]);
+}
+
 #pragma mark - Utilities
 
 - (NSString*)tempFileName
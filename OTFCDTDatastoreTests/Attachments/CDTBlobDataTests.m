@@ -241,6 +241,41 @@
     XCTAssertNotNil(error, @"An error must be informed");
 }
 
+- (void)testDataInRangeReturnsExpectedData
+{
+    NSData *data = [self.blobForNotEmptyFile dataInRange:NSMakeRange(6, 3) error:nil];
+    XCTAssertEqualObjects(data, [@"ips" dataUsingEncoding:NSASCIIStringEncoding]);
+
+    data = [self.blobForNotEmptyFile dataInRange:NSMakeRange(6, 100) error:nil];
+    XCTAssertEqualObjects(data, [@"ipsum" dataUsingEncoding:NSASCIIStringEncoding],
+                          @"The range is truncated at the end of the file");
+
+    data = [self.blobForNotEmptyFile dataInRange:NSMakeRange(100, 1) error:nil];
+    XCTAssertEqualObjects(data, [NSData data], @"A range beyond the end is empty");
+}
+
+- (void)testDataInRangeFailsIfBlobIsOpen
+{
+    [self.blobForNotEmptyFile openForWriting];
+
+    NSError *error = nil;
+    XCTAssertNil([self.blobForNotEmptyFile dataInRange:NSMakeRange(0, 1) error:&error],
+                 @"Blob can not be read if it is open");
+    XCTAssertEqual(error.code, CDTBlobDataErrorOperationNotPossibleIfBlobIsOpen);
+}
+
+- (void)testDataWithErrorReflectsTheLatestWrite
+{
+    XCTAssertNotNil([self.blobForNotEmptyFile dataWithError:nil]);
+
+    [self.blobForNotEmptyFile writeEntireBlobWithData:self.data error:nil];
+    XCTAssertEqualObjects([self.blobForNotEmptyFile dataWithError:nil], self.data);
+
+    [self.blobForNotEmptyFile openForWriting];
+    [self.blobForNotEmptyFile close];
+    XCTAssertEqualObjects([self.blobForNotEmptyFile dataWithError:nil], [NSData data]);
+}
+
 - (void)testInputStreamWithOutputLengthFailsIfBlobIsOpen
 {
     [self.blobForNotEmptyFile openForWriting];
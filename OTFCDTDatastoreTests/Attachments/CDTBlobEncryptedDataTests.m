@@ -227,7 +227,8 @@
 {
     NSMutableData *fileData = [NSMutableData dataWithData:self.headerData];
 
-    CDTBLOBENCRYPTEDDATA_VERSION_TYPE wrongVersion = (CDTBLOBENCRYPTEDDATA_VERSION_VALUE + 1);
+    CDTBLOBENCRYPTEDDATA_VERSION_TYPE wrongVersion =
+        (CDTBLOBENCRYPTEDDATA_VERSION_KEYED_CTR_VALUE + 1);
     [fileData replaceBytesInRange:NSMakeRange(CDTBLOBENCRYPTEDDATA_VERSION_LOCATION,
                                               sizeof(CDTBLOBENCRYPTEDDATA_VERSION_TYPE))
                         withBytes:&wrongVersion];
@@ -287,6 +288,194 @@
                  @"File must exist in order to create an input stream");
 }
 
+- (void)testDataInRangeReturnsExpectedData
+{
+    for (NSUInteger location = 0; location <= self.plainData.length; location++) {
+        for (NSUInteger length = 0; location + length <= self.plainData.length + 2; length++) {
+            NSError *error = nil;
+            NSData *data =
+                [self.blobForNotEmptyFile dataInRange:NSMakeRange(location, length) error:&error];
+
+            NSRange expected =
+                NSMakeRange(location, MIN(length, self.plainData.length - location));
+            XCTAssertEqualObjects(data, [self.plainData subdataWithRange:expected],
+                                  @"Unexpected result for range (%lu, %lu)",
+                                  (unsigned long)location, (unsigned long)length);
+            XCTAssertNil(error, @"No error to report");
+        }
+    }
+}
+
+- (void)testDataInRangeFailsIfPaddingIsCorrupted
+{
+    NSMutableData *fileData = [NSMutableData dataWithData:self.headerData];
+    [fileData appendData:[self.encryptedData subdataWithRange:NSMakeRange(0, 16)]];
+    [fileData writeToFile:self.pathToNotEmptyFile atomically:YES];
+
+    NSError *error = nil;
+    NSData *data = [self.blobForNotEmptyFile dataInRange:NSMakeRange(0, 4) error:&error];
+
+    XCTAssertNil(data, @"The first block decrypted as the last one has no valid padding");
+    XCTAssertTrue(error && [error.domain isEqualToString:CDTBlobEncryptedDataErrorDomain] &&
+                  (error.code == CDTBlobEncryptedDataErrorCorrupted));
+}
+
+- (void)testInputStreamWithOutputLengthReturnsExpectedData
+{
+    UInt64 length = 0;
+    NSInputStream *stream = [self.blobForNotEmptyFile inputStreamWithOutputLength:&length];
+
+    XCTAssertEqual(length, (UInt64)self.plainData.length,
+                   @"The length excludes the padding, without decrypting the whole file");
+    XCTAssertEqualObjects([self dataFromStream:stream], self.plainData, @"Unexpected result");
+    XCTAssertEqualObjects([self dataFromStream:stream], self.plainData,
+                          @"The stream can be read again after it is closed");
+}
+
+- (void)testCTRBlobRoundTrips
+{
+    NSMutableData *plainData = [NSMutableData data];
+    for (int i = 0; i < 10000; i++) {
+        [plainData appendData:self.plainData];
+    }
+
+    self.blobForNotPrexistingFile.version = CDTBlobEncryptedDataVersionCTR;
+    [self.blobForNotPrexistingFile openForWriting];
+    for (NSUInteger i = 0; i < plainData.length; i += 1000) {
+        NSRange range = NSMakeRange(i, MIN((NSUInteger)1000, plainData.length - i));
+        [self.blobForNotPrexistingFile appendData:[plainData subdataWithRange:range]];
+    }
+    [self.blobForNotPrexistingFile close];
+
+    NSData *fileData = [NSData dataWithContentsOfFile:self.pathToNonExistingFile];
+    CDTBLOBENCRYPTEDDATA_VERSION_TYPE version;
+    [fileData getBytes:&version length:sizeof(version)];
+    XCTAssertEqual(version, CDTBLOBENCRYPTEDDATA_VERSION_CTR_VALUE);
+    XCTAssertEqual(fileData.length, self.headerData.length + plainData.length,
+                   @"CTR adds no padding");
+
+    CDTBlobEncryptedData *reader =
+        [CDTBlobEncryptedData blobWithPath:self.pathToNonExistingFile
+                             encryptionKey:self.encryptionKey];
+    XCTAssertEqualObjects([reader dataWithError:nil], plainData);
+
+    UInt64 length = 0;
+    NSInputStream *stream = [reader inputStreamWithOutputLength:&length];
+    XCTAssertEqual(length, (UInt64)plainData.length);
+    XCTAssertEqualObjects([self dataFromStream:stream], plainData);
+
+    NSRange range = NSMakeRange(123457, 70001);  // not block aligned, spans chunks
+    XCTAssertEqualObjects([reader dataInRange:range error:nil],
+                          [plainData subdataWithRange:range]);
+}
+
+- (void)testCTRWriteEntireBlobMatchesAppendedData
+{
+    self.blobForNotPrexistingFile.version = CDTBlobEncryptedDataVersionCTR;
+    [self.blobForNotPrexistingFile writeEntireBlobWithData:self.plainData error:nil];
+    NSData *fileData = [NSData dataWithContentsOfFile:self.pathToNonExistingFile];
+
+    [self.blobForNotPrexistingFile openForWriting];
+    [self.blobForNotPrexistingFile appendData:[self.plainData subdataWithRange:NSMakeRange(0, 5)]];
+    [self.blobForNotPrexistingFile
+        appendData:[self.plainData subdataWithRange:NSMakeRange(5, self.plainData.length - 5)]];
+    [self.blobForNotPrexistingFile close];
+
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:self.pathToNonExistingFile], fileData);
+    XCTAssertEqualObjects([self.blobForNotPrexistingFile dataWithError:nil], self.plainData);
+}
+
+- (void)testCTRLargeAppendsMatchEntireBlobEncryptedInSlices
+{
+    // Several slices, the last of them short, appended after an unaligned start
+    NSMutableData *plainData = [NSMutableData dataWithLength:3 * 1024 * 1024 + 1001];
+    uint8_t *bytes = plainData.mutableBytes;
+    for (NSUInteger i = 0; i < plainData.length; i++) {
+        bytes[i] = (uint8_t)(i * 31);
+    }
+
+    self.blobForNotPrexistingFile.version = CDTBlobEncryptedDataVersionCTR;
+    [self.blobForNotPrexistingFile writeEntireBlobWithData:plainData error:nil];
+    NSData *fileData = [NSData dataWithContentsOfFile:self.pathToNonExistingFile];
+
+    NSUInteger large = 2 * 1024 * 1024 + 5;
+    [self.blobForNotPrexistingFile openForWriting];
+    [self.blobForNotPrexistingFile appendData:[plainData subdataWithRange:NSMakeRange(0, 7)]];
+    [self.blobForNotPrexistingFile appendData:[plainData subdataWithRange:NSMakeRange(7, large)]];
+    [self.blobForNotPrexistingFile
+        appendData:[plainData subdataWithRange:NSMakeRange(7 + large,
+                                                           plainData.length - 7 - large)]];
+    [self.blobForNotPrexistingFile close];
+
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:self.pathToNonExistingFile], fileData);
+    XCTAssertEqualObjects([self.blobForNotPrexistingFile dataWithError:nil], plainData);
+}
+
+- (void)testKeyedCTRBlobNamesItsKey
+{
+    self.blobForNotPrexistingFile.version = CDTBlobEncryptedDataVersionKeyedCTR;
+    [self.blobForNotPrexistingFile writeEntireBlobWithData:self.plainData error:nil];
+
+    NSData *fileData = [NSData dataWithContentsOfFile:self.pathToNonExistingFile];
+    CDTBLOBENCRYPTEDDATA_VERSION_TYPE version;
+    [fileData getBytes:&version length:sizeof(version)];
+    XCTAssertEqual(version, CDTBLOBENCRYPTEDDATA_VERSION_KEYED_CTR_VALUE);
+    XCTAssertEqual(fileData.length,
+                   CDTBLOBENCRYPTEDDATA_KEYED_ENCRYPTEDDATA_LOCATION + self.plainData.length);
+
+    XCTAssertTrue([self.blobForNotPrexistingFile isEncryptedWithEncryptionKey]);
+    XCTAssertEqualObjects([self.blobForNotPrexistingFile dataWithError:nil], self.plainData);
+    NSRange range = NSMakeRange(3, 10);
+    XCTAssertEqualObjects([self.blobForNotPrexistingFile dataInRange:range error:nil],
+                          [self.plainData subdataWithRange:range]);
+}
+
+- (void)testKeyedCTRBlobIsReadWithPreviousKey
+{
+    self.blobForNotPrexistingFile.version = CDTBlobEncryptedDataVersionKeyedCTR;
+    [self.blobForNotPrexistingFile writeEntireBlobWithData:self.plainData error:nil];
+
+    CDTEncryptionKey *otherKey = [[CDTHelperFixedKeyProvider provider] encryptionKey];
+    CDTBlobEncryptedData *reader =
+        [CDTBlobEncryptedData blobWithPath:self.pathToNonExistingFile encryptionKey:otherKey];
+    reader.previousEncryptionKey = self.encryptionKey;
+
+    XCTAssertFalse([reader isEncryptedWithEncryptionKey],
+                   @"The file is encrypted with the previous key, so needs re-encrypting");
+    XCTAssertEqualObjects([reader dataWithError:nil], self.plainData);
+    XCTAssertEqualObjects([self dataFromStream:[reader inputStreamWithOutputLength:nil]],
+                          self.plainData);
+}
+
+- (void)testKeyedCTRBlobFailsWithAnotherKey
+{
+    self.blobForNotPrexistingFile.version = CDTBlobEncryptedDataVersionKeyedCTR;
+    [self.blobForNotPrexistingFile writeEntireBlobWithData:self.plainData error:nil];
+
+    CDTEncryptionKey *otherKey = [[CDTHelperFixedKeyProvider provider] encryptionKey];
+    CDTBlobEncryptedData *reader =
+        [CDTBlobEncryptedData blobWithPath:self.pathToNonExistingFile encryptionKey:otherKey];
+
+    NSError *error = nil;
+    XCTAssertNil([reader dataWithError:&error]);
+    XCTAssertEqualObjects(error.domain, CDTBlobEncryptedDataErrorDomain);
+    XCTAssertEqual(error.code, CDTBlobEncryptedDataErrorWrongKey);
+    XCTAssertNil([reader inputStreamWithOutputLength:nil]);
+}
+
+- (void)testUnkeyedBlobIsReadWithPreviousKey
+{
+    CDTEncryptionKey *otherKey = [[CDTHelperFixedKeyProvider provider] encryptionKey];
+    CDTBlobEncryptedData *reader =
+        [CDTBlobEncryptedData blobWithPath:self.pathToNotEmptyFile encryptionKey:otherKey];
+    reader.previousEncryptionKey = self.encryptionKey;
+
+    XCTAssertFalse([reader isEncryptedWithEncryptionKey]);
+    XCTAssertFalse([self.blobForNotEmptyFile isEncryptedWithEncryptionKey],
+                   @"Files from before keys were named always need re-encrypting");
+    XCTAssertEqualObjects([reader dataWithError:nil], self.plainData);
+}
+
 - (void)testWriteEntireBlobWithDataFailsIfBlobIsOpen
 {
     [self.blobForNotEmptyFile openForWriting];
@@ -579,6 +768,19 @@
                   @"The blob creates a file, it is user responsability to delete it");
 }
 
+- (NSData *)dataFromStream:(NSInputStream *)stream
+{
+    NSMutableData *data = [NSMutableData data];
+    uint8_t buffer[1000];
+    NSInteger bytesRead;
+    [stream open];
+    while ((bytesRead = [stream read:buffer maxLength:sizeof(buffer)]) > 0) {
+        [data appendBytes:buffer length:bytesRead];
+    }
+    [stream close];
+    return data;
+}
+
 @end
 
 @implementation CDTBlobCustomEncryptedData
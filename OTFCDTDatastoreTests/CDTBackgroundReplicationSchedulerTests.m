@@ -0,0 +1,109 @@
+//
+//  CDTBackgroundReplicationSchedulerTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import "CloudantSyncTests.h"
+#import "CDTBackgroundReplicationScheduler.h"
+#import "CDTDatastore.h"
+#import "CDTPullReplication.h"
+#import "CDTReplicatorFactory.h"
+
+@interface CDTBackgroundReplicationSchedulerTests : CloudantSyncTests
+@property (nonatomic, strong) NSUserDefaults *userDefaults;
+@property (nonatomic, copy) NSString *suiteName;
+@property (nonatomic, strong) CDTBackgroundReplicationScheduler *scheduler;
+@property (nonatomic, strong) CDTDatastore *datastore;
+@end
+
+@implementation CDTBackgroundReplicationSchedulerTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.suiteName = [NSString stringWithFormat:@"CDTBackgroundReplicationSchedulerTests.%@",
+                                                [NSUUID UUID].UUIDString];
+    self.userDefaults = [[NSUserDefaults alloc] initWithSuiteName:self.suiteName];
+    CDTReplicatorFactory *factory =
+        [[CDTReplicatorFactory alloc] initWithDatastoreManager:self.factory];
+    self.scheduler =
+        [[CDTBackgroundReplicationScheduler alloc] initWithReplicatorFactory:factory
+                                                                userDefaults:self.userDefaults];
+    self.datastore = [self.factory datastoreNamed:@"background" error:nil];
+}
+
+- (void)tearDown
+{
+    [self.userDefaults removePersistentDomainForName:self.suiteName];
+    [super tearDown];
+}
+
+- (void)addPullWithIdentifier:(NSString *)identifier priority:(CDTReplicationPriority)priority
+{
+    // Doesn't need to be real, the replications aren't run.
+    NSURL *remote = [NSURL URLWithString:@"http://example.com/background"];
+    CDTPullReplication *pull = [CDTPullReplication replicationWithSource:remote
+                                                                  target:self.datastore];
+    pull.priority = priority;
+    [self.scheduler addReplication:pull identifier:identifier];
+}
+
+- (void)testRunOrderIsMostOverdueFirst
+{
+    [self addPullWithIdentifier:@"hourAgo" priority:CDTReplicationPriorityNormal];
+    [self addPullWithIdentifier:@"minuteAgo" priority:CDTReplicationPriorityHigh];
+    [self addPullWithIdentifier:@"never" priority:CDTReplicationPriorityLow];
+    [self addPullWithIdentifier:@"neverHigh" priority:CDTReplicationPriorityHigh];
+    [self addPullWithIdentifier:@"longAgoHigh" priority:CDTReplicationPriorityHigh];
+
+    NSDate *now = [NSDate date];
+    [self.scheduler setLastCompletion:[now dateByAddingTimeInterval:-3600]
+          ofReplicationWithIdentifier:@"hourAgo"];
+    [self.scheduler setLastCompletion:[now dateByAddingTimeInterval:-60]
+          ofReplicationWithIdentifier:@"minuteAgo"];
+    [self.scheduler setLastCompletion:[now dateByAddingTimeInterval:-2000]
+          ofReplicationWithIdentifier:@"longAgoHigh"];
+
+    // High priority weighs twice normal, so over half an hour is more overdue than an hour.
+    XCTAssertEqualObjects(self.scheduler.identifiersInRunOrder,
+                          (@[ @"neverHigh", @"never", @"longAgoHigh", @"hourAgo", @"minuteAgo" ]));
+
+    [self.scheduler removeReplicationWithIdentifier:@"neverHigh"];
+    [self.scheduler setLastCompletion:nil ofReplicationWithIdentifier:@"minuteAgo"];
+    XCTAssertNil([self.scheduler lastCompletionOfReplicationWithIdentifier:@"minuteAgo"]);
+    XCTAssertEqualObjects(self.scheduler.identifiersInRunOrder,
+                          (@[ @"minuteAgo", @"never", @"longAgoHigh", @"hourAgo" ]));
+}
+
+- (void)testRunWithNothingToDoCompletes
+{
+    XCTestExpectation *finished = [self expectationWithDescription:@"run finished"];
+    XCTestExpectation *refused = [self expectationWithDescription:@"second run refused"];
+    [self.scheduler addDatastoreForMaintenance:self.datastore];
+    [self.scheduler runWithTimeBudget:5
+                          maintenance:YES
+                    completionHandler:^(BOOL completed) {
+                        XCTAssertTrue(completed);
+                        [finished fulfill];
+                    }];
+    [self.scheduler runWithTimeBudget:5
+                          maintenance:NO
+                    completionHandler:^(BOOL completed) {
+                        XCTAssertFalse(completed);
+                        [refused fulfill];
+                    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    XCTAssertFalse(self.scheduler.isRunning);
+}
+
+@end
@@ -0,0 +1,468 @@
+//
+//  CDTCodecBenchmarks.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+#include <mach/mach_time.h>
+#include <pthread.h>
+
+#import "CloudantSyncTests.h"
+#import "CDTDocumentRevision.h"
+#import "CDTQQueryValidator.h"
+#import "CDTQUnindexedMatcher.h"
+#import "CDTQValueExtractor.h"
+#import "TDBase64.h"
+#import "TDCanonicalJSON.h"
+#import "TDCollateJSON.h"
+#import "TDJSON.h"
+#import "TDMultipartReader.h"
+#import "Version.h"
+
+/*
+ Microbenchmarks of the codecs and matchers under every read, write and replication, so that
+ changes to them can be compared against a baseline.
+
+ Like CDTDatastoreBenchmarks they only run when CDT_BENCHMARK_OUTPUT is set (see
+ `rake benchmarkosx`); their results are written next to that file, with "-codecs" added to its
+ name. The corpora are generated from a fixed seed, so every run works on the same data. Each
+ benchmark reports the median and fastest nanoseconds per operation over kSamples passes, and
+ the bytes and blocks malloc'd per operation, counted in a separate pass so that counting them
+ doesn't slow the timed ones.
+ */
+
+static NSString *const kOutputVariable = @"CDT_BENCHMARK_OUTPUT";
+
+static const uint64_t kSeed = 0x5eed0f1cdb5eed01ULL;
+static const NSUInteger kCorpusSize = 1000;
+static const NSUInteger kSamples = 5;
+
+static NSMutableArray<NSDictionary *> *results;
+
+#pragma mark - Allocation counting
+
+// libmalloc calls malloc_logger, if it's set, on every allocation and free; it's how the
+// allocation instruments see them. Declared in libmalloc's stack_logging.h, which isn't shipped.
+typedef void(malloc_logger_t)(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3,
+                              uintptr_t result, uint32_t num_hot_frames_to_skip);
+extern malloc_logger_t *malloc_logger;
+
+#define kMallocLogTypeAllocate 2
+#define kMallocLogTypeDeallocate 4
+
+static pthread_t countedThread;
+static uint64_t countedBytes, countedBlocks;
+static malloc_logger_t *previousLogger;
+
+static void countAllocation(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3,
+                            uintptr_t result, uint32_t skip)
+{
+    if (previousLogger) previousLogger(type, arg1, arg2, arg3, result, skip);
+    if (!(type & kMallocLogTypeAllocate) || !pthread_equal(pthread_self(), countedThread)) return;
+    // A realloc is logged as both, with the new size in arg3; otherwise the size is in arg2.
+    countedBytes += (type & kMallocLogTypeDeallocate) ? arg3 : arg2;
+    countedBlocks++;
+}
+
+#pragma mark - Corpora
+
+/** xorshift64*, so the corpora don't depend on the platform's random number generators. */
+static uint64_t nextRandom(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static NSString *randomWord(uint64_t *state)
+{
+    static NSArray<NSString *> *words;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        words = @[ @"apple", @"Banana", @"cherry", @"café", @"delta", @"Écho", @"fox", @"golf",
+                   @"hôtel", @"india", @"Juliet", @"kilo", @"lima", @"mike", @"naïve", @"oscar",
+                   @"papa", @"quebec", @"Romeo", @"sierra", @"tango", @"übung", @"victor", @"x" ];
+    });
+    return words[nextRandom(state) % words.count];
+}
+
+static NSString *randomSentence(uint64_t *state, NSUInteger maxWords)
+{
+    NSUInteger count = 1 + nextRandom(state) % maxWords;
+    NSMutableArray *words = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) [words addObject:randomWord(state)];
+    return [words componentsJoinedByString:@" "];
+}
+
+/**
+ A document body like an app's: a few scalars, a short list and a small nested object. The
+ values are drawn one statement at a time, as the order a literal's elements are evaluated in
+ isn't defined.
+ */
+static NSDictionary *randomBody(uint64_t *state)
+{
+    NSMutableDictionary *body = [NSMutableDictionary dictionary];
+    body[@"name"] = randomWord(state);
+    body[@"age"] = @(nextRandom(state) % 90);
+    body[@"score"] = @((double)(nextRandom(state) % 100000) / 100);
+    body[@"active"] = @(nextRandom(state) % 2 == 0);
+    NSUInteger tagCount = nextRandom(state) % 5;
+    NSMutableArray *tags = [NSMutableArray arrayWithCapacity:tagCount];
+    for (NSUInteger i = 0; i < tagCount; i++) [tags addObject:randomWord(state)];
+    body[@"tags"] = tags;
+    body[@"notes"] = randomSentence(state, 30);
+    NSMutableDictionary *address = [NSMutableDictionary dictionary];
+    address[@"town"] = randomWord(state);
+    address[@"street"] = randomSentence(state, 3);
+    address[@"number"] = @(nextRandom(state) % 200);
+    body[@"address"] = address;
+    return body;
+}
+
+static NSData *randomBytes(uint64_t *state, NSUInteger length)
+{
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    uint8_t *bytes = data.mutableBytes;
+    for (NSUInteger i = 0; i < length; i++) bytes[i] = (uint8_t)nextRandom(state);
+    return data;
+}
+
+#pragma mark -
+
+/** Throws the parts away, so only the reader is measured. */
+@interface CDTBenchmarkMultipartSink : NSObject <TDMultipartReaderDelegate>
+@property (nonatomic) NSUInteger parts;
+@end
+
+@implementation CDTBenchmarkMultipartSink
+- (void)startedPart:(NSDictionary *)headers { self.parts++; }
+- (void)appendToPart:(NSData *)data {}
+- (void)finishedPart {}
+@end
+
+@interface CDTCodecBenchmarks : CloudantSyncTests
+
+@property (nonatomic, strong) NSArray<NSDictionary *> *bodies;
+@property (nonatomic, strong) NSArray<NSData *> *bodiesJSON;
+
+@end
+
+@implementation CDTCodecBenchmarks
+
++ (XCTestSuite *)defaultTestSuite
+{
+    if (!NSProcessInfo.processInfo.environment[kOutputVariable]) {
+        return [XCTestSuite testSuiteWithName:NSStringFromClass(self)];
+    }
+    return [super defaultTestSuite];
+}
+
++ (void)setUp
+{
+    [super setUp];
+    results = [NSMutableArray array];
+}
+
++ (void)tearDown
+{
+    NSString *path = NSProcessInfo.processInfo.environment[kOutputVariable];
+    if (path && results.count > 0) {
+        NSDictionary *report = @{
+            @"version" : @CLOUDANT_SYNC_VERSION,
+            @"date" : [[[NSISO8601DateFormatter alloc] init] stringFromDate:[NSDate date]],
+            @"os" : NSProcessInfo.processInfo.operatingSystemVersionString,
+            @"seed" : @(kSeed),
+            @"benchmarks" : results
+        };
+        NSString *codecsPath = [[path.stringByDeletingPathExtension
+            stringByAppendingString:@"-codecs"] stringByAppendingPathExtension:@"json"];
+        NSData *json = [NSJSONSerialization dataWithJSONObject:report
+                                                       options:NSJSONWritingPrettyPrinted
+                                                         error:nil];
+        [json writeToFile:codecsPath atomically:YES];
+    }
+    results = nil;
+    [super tearDown];
+}
+
+- (void)setUp
+{
+    [super setUp];
+    uint64_t state = kSeed;
+    NSMutableArray *bodies = [NSMutableArray arrayWithCapacity:kCorpusSize];
+    NSMutableArray *bodiesJSON = [NSMutableArray arrayWithCapacity:kCorpusSize];
+    for (NSUInteger i = 0; i < kCorpusSize; i++) {
+        NSDictionary *body = randomBody(&state);
+        [bodies addObject:body];
+        [bodiesJSON addObject:[TDJSON dataWithJSONObject:body options:0 error:nil]];
+    }
+    self.bodies = bodies;
+    self.bodiesJSON = bodiesJSON;
+}
+
+#pragma mark Measuring
+
+static double nanosecondsFromTicks(uint64_t ticks)
+{
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) mach_timebase_info(&timebase);
+    return (double)ticks * timebase.numer / timebase.denom;
+}
+
+/**
+ Runs the block `operations` times in each of kSamples timed passes, after one pass counting
+ what it allocates, and records the results under `name`.
+
+ @param bytes the bytes each operation processes, if it's useful to report the throughput
+ */
+- (void)measure:(NSString *)name
+     operations:(NSUInteger)operations
+          bytes:(NSUInteger)bytes
+          block:(void (^)(NSUInteger op))block
+{
+    // The counting pass doubles as the warm-up.
+    @autoreleasepool
+    {
+        countedThread = pthread_self();
+        countedBytes = countedBlocks = 0;
+        previousLogger = malloc_logger;
+        malloc_logger = countAllocation;
+        for (NSUInteger i = 0; i < operations; i++) block(i);
+        malloc_logger = previousLogger;
+    }
+    double bytesPerOp = (double)countedBytes / operations;
+    double blocksPerOp = (double)countedBlocks / operations;
+
+    NSMutableArray<NSNumber *> *passes = [NSMutableArray arrayWithCapacity:kSamples];
+    for (NSUInteger s = 0; s < kSamples; s++) {
+        @autoreleasepool
+        {
+            uint64_t start = mach_absolute_time();
+            for (NSUInteger i = 0; i < operations; i++) block(i);
+            uint64_t elapsed = mach_absolute_time() - start;
+            [passes addObject:@(nanosecondsFromTicks(elapsed) / operations)];
+        }
+    }
+    [passes sortUsingSelector:@selector(compare:)];
+    double median = passes[kSamples / 2].doubleValue;
+
+    NSMutableDictionary *result = [@{
+        @"name" : name,
+        @"samples" : @(kSamples),
+        @"operations" : @(operations),
+        @"ns_per_op" : @(median),
+        @"min_ns_per_op" : passes[0],
+        @"bytes_allocated_per_op" : @(bytesPerOp),
+        @"allocations_per_op" : @(blocksPerOp)
+    } mutableCopy];
+    if (bytes > 0 && median > 0) {
+        result[@"mb_per_sec"] = @(bytes / median * 1e9 / (1024 * 1024));
+    }
+    [results addObject:result];
+    NSLog(@"Benchmark %@", result);
+}
+
+#pragma mark JSON
+
+- (void)testCanonicalJSON
+{
+    NSArray *bodies = self.bodies;
+    [self measure:@"canonical_json.canonical_data"
+       operations:kCorpusSize * 10
+            bytes:0
+            block:^(NSUInteger op) {
+                [TDCanonicalJSON canonicalData:bodies[op % kCorpusSize]];
+            }];
+}
+
+- (void)testJSONParseAndSerialize
+{
+    NSArray *bodies = self.bodies;
+    NSArray<NSData *> *bodiesJSON = self.bodiesJSON;
+    NSUInteger averageLength = [[bodiesJSON valueForKeyPath:@"@avg.length"] unsignedIntegerValue];
+    [self measure:@"json.parse"
+       operations:kCorpusSize * 10
+            bytes:averageLength
+            block:^(NSUInteger op) {
+                [TDJSON JSONObjectWithData:bodiesJSON[op % kCorpusSize] options:0 error:nil];
+            }];
+    [self measure:@"json.serialize"
+       operations:kCorpusSize * 10
+            bytes:averageLength
+            block:^(NSUInteger op) {
+                [TDJSON dataWithJSONObject:bodies[op % kCorpusSize] options:0 error:nil];
+            }];
+}
+
+- (void)testCollateJSON
+{
+    // View keys like an app's: a string, then a number, then a longer string.
+    uint64_t state = kSeed;
+    NSMutableArray<NSData *> *keys = [NSMutableArray arrayWithCapacity:kCorpusSize];
+    for (NSDictionary *body in self.bodies) {
+        // Half the keys share their first element, so comparisons often have to look further.
+        NSString *first = nextRandom(&state) % 2 ? @"mike" : body[@"name"];
+        [keys addObject:[TDJSON dataWithJSONObject:@[ first, body[@"age"], body[@"notes"] ]
+                                           options:0
+                                             error:nil]];
+    }
+    NSDictionary *modes = @{
+        @"collate_json.unicode" : [NSValue valueWithPointer:kTDCollateJSON_Unicode],
+        @"collate_json.raw" : [NSValue valueWithPointer:kTDCollateJSON_Raw],
+        @"collate_json.ascii" : [NSValue valueWithPointer:kTDCollateJSON_ASCII]
+    };
+    for (NSString *name in [modes.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
+        void *mode = [modes[name] pointerValue];
+        [self measure:name
+           operations:kCorpusSize * 100
+                bytes:0
+                block:^(NSUInteger op) {
+                    NSData *a = keys[op % kCorpusSize];
+                    NSData *b = keys[(op / kCorpusSize + op * 7) % kCorpusSize];
+                    TDCollateJSON(mode, (int)a.length, a.bytes, (int)b.length, b.bytes);
+                }];
+    }
+}
+
+#pragma mark Base64
+
+- (void)testBase64
+{
+    uint64_t state = kSeed;
+    for (NSNumber *size in @[ @64, @4096, @262144 ]) {
+        NSUInteger length = size.unsignedIntegerValue;
+        NSData *data = randomBytes(&state, length);
+        NSString *encoded = [TDBase64 encode:data];
+        NSUInteger operations = MAX((4096 * 1000) / length, 10u);
+        [self measure:[NSString stringWithFormat:@"base64.encode_%lu", (unsigned long)length]
+           operations:operations
+                bytes:length
+                block:^(NSUInteger op) {
+                    [TDBase64 encode:data];
+                }];
+        [self measure:[NSString stringWithFormat:@"base64.decode_%lu", (unsigned long)length]
+           operations:operations
+                bytes:length
+                block:^(NSUInteger op) {
+                    [TDBase64 decode:encoded];
+                }];
+    }
+}
+
+#pragma mark Multipart
+
+- (void)testMultipartReader
+{
+    // A document with attachments as the replicator is sent it: a JSON part, then binary ones.
+    uint64_t state = kSeed;
+    NSMutableData *mime = [NSMutableData data];
+    NSData *boundary = [@"\r\n--BENCHMARKBOUNDARY" dataUsingEncoding:NSUTF8StringEncoding];
+    [mime appendData:[@"--BENCHMARKBOUNDARY\r\nContent-Type: application/json\r\n\r\n"
+                         dataUsingEncoding:NSUTF8StringEncoding]];
+    [mime appendData:self.bodiesJSON[0]];
+    for (NSUInteger i = 0; i < 8; i++) {
+        NSString *headers = [NSString
+            stringWithFormat:@"\r\nContent-Disposition: attachment; filename=\"%lu\"\r\n\r\n",
+                             (unsigned long)i];
+        [mime appendData:boundary];
+        [mime appendData:[headers dataUsingEncoding:NSUTF8StringEncoding]];
+        [mime appendData:randomBytes(&state, 32 * 1024)];
+    }
+    [mime appendData:boundary];
+    [mime appendData:[@"--" dataUsingEncoding:NSUTF8StringEncoding]];
+
+    // The size NSURLSession typically hands over data in.
+    const NSUInteger chunkSize = 16 * 1024;
+    NSMutableArray<NSData *> *chunks = [NSMutableArray array];
+    for (NSUInteger pos = 0; pos < mime.length; pos += chunkSize) {
+        [chunks addObject:[mime subdataWithRange:NSMakeRange(pos, MIN(chunkSize, mime.length - pos))]];
+    }
+
+    [self measure:@"multipart_reader.append_data_264k"
+       operations:200
+            bytes:mime.length
+            block:^(NSUInteger op) {
+                CDTBenchmarkMultipartSink *sink = [[CDTBenchmarkMultipartSink alloc] init];
+                TDMultipartReader *reader = [[TDMultipartReader alloc]
+                    initWithContentType:@"multipart/related; boundary=\"BENCHMARKBOUNDARY\""
+                               delegate:sink];
+                for (NSData *chunk in chunks) [reader appendData:chunk];
+                XCTAssertTrue(reader.finished && sink.parts == 9, @"%@", reader.error);
+            }];
+}
+
+#pragma mark Query
+
+- (NSArray<CDTDocumentRevision *> *)revisions
+{
+    NSMutableArray *revs = [NSMutableArray arrayWithCapacity:kCorpusSize];
+    [self.bodies enumerateObjectsUsingBlock:^(NSDictionary *body, NSUInteger i, BOOL *stop) {
+        NSString *docId = [NSString stringWithFormat:@"doc-%06lu", (unsigned long)i];
+        CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:docId];
+        rev.body = [body mutableCopy];
+        [revs addObject:rev];
+    }];
+    return revs;
+}
+
+- (void)testUnindexedMatcher
+{
+    NSArray<CDTDocumentRevision *> *revs = [self revisions];
+    NSDictionary *selectors = @{
+        @"unindexed_matcher.equality" : @{ @"name" : @"mike" },
+        @"unindexed_matcher.compound" : @{
+            @"$and" : @[
+                @{ @"age" : @{ @"$gt" : @30 } },
+                @{ @"address.number" : @{ @"$lt" : @100 } },
+                @{ @"active" : @YES }
+            ]
+        },
+        @"unindexed_matcher.or_in" : @{
+            @"$or" : @[
+                @{ @"tags" : @{ @"$in" : @[ @"café", @"tango" ] } },
+                @{ @"address.town" : @{ @"$ne" : @"lima" } }
+            ]
+        },
+        @"unindexed_matcher.arrays" : @{
+            @"tags" : @{ @"$size" : @2 },
+            @"address.street" : @{ @"$nin" : @[ @"mike", @"fox golf" ] }
+        }
+    };
+    for (NSString *name in [selectors.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
+        NSDictionary *selector = [CDTQQueryValidator normaliseAndValidateQuery:selectors[name]];
+        CDTQUnindexedMatcher *matcher = [CDTQUnindexedMatcher matcherWithSelector:selector];
+        XCTAssertNotNil(matcher, @"%@", name);
+        [self measure:name
+           operations:kCorpusSize * 10
+                bytes:0
+                block:^(NSUInteger op) {
+                    [matcher matches:revs[op % kCorpusSize]];
+                }];
+    }
+}
+
+- (void)testValueExtractor
+{
+    NSArray<CDTDocumentRevision *> *revs = [self revisions];
+    for (NSString *field in @[ @"name", @"address.town", @"address.missing.field" ]) {
+        [self measure:[NSString stringWithFormat:@"value_extractor.%@", field]
+           operations:kCorpusSize * 100
+                bytes:0
+                block:^(NSUInteger op) {
+                    [CDTQValueExtractor extractValueForFieldName:field
+                                                    fromRevision:revs[op % kCorpusSize]];
+                }];
+    }
+}
+
+@end
@@ -0,0 +1,202 @@
+//
+//  CDTDatastoreAsyncTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "CloudantSyncTests.h"
+
+#import "CDTDatastore.h"
+#import "CDTDatastore+Async.h"
+#import "CDTDatastore+Query.h"
+#import "CDTDocumentRevision.h"
+
+@interface CDTDatastoreAsyncTests : CloudantSyncTests
+@property (nonatomic, strong) CDTDatastore *datastore;
+@end
+
+@implementation CDTDatastoreAsyncTests
+
+- (void)setUp
+{
+    [super setUp];
+    NSError *error;
+    self.datastore = [self.factory datastoreNamed:@"async" error:&error];
+    XCTAssertNotNil(self.datastore, @"datastore is nil");
+}
+
+- (void)tearDown
+{
+    self.datastore = nil;
+    [super tearDown];
+}
+
+- (CDTDocumentRevision *)revisionNamed:(NSString *)name
+{
+    CDTDocumentRevision *rev = [CDTDocumentRevision revision];
+    rev.body = [@{ @"name" : name } mutableCopy];
+    return rev;
+}
+
+- (void)testCRUD
+{
+    __block CDTDocumentRevision *saved;
+    XCTestExpectation *created = [self expectationWithDescription:@"created"];
+    [self.datastore createDocumentFromRevision:[self revisionNamed:@"mike"]
+                              qualityOfService:NSQualityOfServiceUserInitiated
+                             completionHandler:^(CDTDocumentRevision *rev, NSError *error) {
+                                 XCTAssertNil(error);
+                                 saved = rev;
+                                 [created fulfill];
+                             }];
+    [self waitForExpectationsWithTimeout:10.0 handler:nil];
+    XCTAssertNotNil(saved);
+
+    XCTestExpectation *read = [self expectationWithDescription:@"read"];
+    [self.datastore getDocumentWithId:saved.docId
+                     qualityOfService:NSQualityOfServiceUserInitiated
+                    completionHandler:^(CDTDocumentRevision *rev, NSError *error) {
+                        XCTAssertNil(error);
+                        XCTAssertEqualObjects(rev.body[@"name"], @"mike");
+                        [read fulfill];
+                    }];
+    [self waitForExpectationsWithTimeout:10.0 handler:nil];
+
+    saved.body[@"name"] = @"fred";
+    XCTestExpectation *updated = [self expectationWithDescription:@"updated"];
+    [self.datastore updateDocumentFromRevision:saved
+                              qualityOfService:NSQualityOfServiceDefault
+                             completionHandler:^(CDTDocumentRevision *rev, NSError *error) {
+                                 XCTAssertNil(error);
+                                 XCTAssertTrue([rev.revId hasPrefix:@"2-"]);
+                                 saved = rev;
+                                 [updated fulfill];
+                             }];
+    [self waitForExpectationsWithTimeout:10.0 handler:nil];
+
+    XCTestExpectation *deleted = [self expectationWithDescription:@"deleted"];
+    [self.datastore deleteDocumentFromRevision:saved
+                              qualityOfService:NSQualityOfServiceBackground
+                             completionHandler:^(CDTDocumentRevision *rev, NSError *error) {
+                                 XCTAssertNil(error);
+                                 XCTAssertTrue(rev.deleted);
+                                 [deleted fulfill];
+                             }];
+    [self waitForExpectationsWithTimeout:10.0 handler:nil];
+
+    XCTestExpectation *missing = [self expectationWithDescription:@"missing"];
+    [self.datastore getDocumentWithId:saved.docId
+                     qualityOfService:NSQualityOfServiceUserInitiated
+                    completionHandler:^(CDTDocumentRevision *rev, NSError *error) {
+                        XCTAssertNil(rev);
+                        XCTAssertNotNil(error);
+                        [missing fulfill];
+                    }];
+    [self waitForExpectationsWithTimeout:10.0 handler:nil];
+}
+
+- (void)testBulkGetAndFind
+{
+    NSError *error;
+    NSMutableArray *docIds = [NSMutableArray array];
+    for (NSString *name in @[ @"mike", @"fred", @"bill" ]) {
+        CDTDocumentRevision *rev =
+            [self.datastore createDocumentFromRevision:[self revisionNamed:name] error:&error];
+        [docIds addObject:rev.docId];
+    }
+    XCTAssertNotNil([self.datastore ensureIndexed:@[ @"name" ] withName:@"names"]);
+
+    XCTestExpectation *bulk = [self expectationWithDescription:@"bulk get"];
+    [self.datastore getDocumentsWithIds:docIds
+                       qualityOfService:NSQualityOfServiceUtility
+                      completionHandler:^(NSArray<CDTDocumentRevision *> *revs) {
+                          XCTAssertEqualObjects([revs valueForKey:@"docId"], docIds);
+                          [bulk fulfill];
+                      }];
+
+    XCTestExpectation *found = [self expectationWithDescription:@"found"];
+    [self.datastore find:@{ @"name" : @"fred" }
+                     skip:0
+                    limit:0
+                   fields:nil
+                     sort:nil
+         qualityOfService:NSQualityOfServiceUserInitiated
+        completionHandler:^(NSArray<CDTDocumentRevision *> *revs, NSError *error) {
+            XCTAssertNil(error);
+            XCTAssertEqual(revs.count, (NSUInteger)1);
+            XCTAssertEqualObjects(revs.firstObject.body[@"name"], @"fred");
+            [found fulfill];
+        }];
+
+    XCTestExpectation *failed = [self expectationWithDescription:@"failed"];
+    [self.datastore find:@{ @"name" : @{ @"$bogus" : @1 } }
+                     skip:0
+                    limit:0
+                   fields:nil
+                     sort:nil
+         qualityOfService:NSQualityOfServiceUserInitiated
+        completionHandler:^(NSArray<CDTDocumentRevision *> *revs, NSError *error) {
+            XCTAssertNil(revs);
+            XCTAssertEqualObjects(error.domain, CDTQIndexManagerErrorDomain);
+            XCTAssertEqual(error.code, CDTQQueryErrorQueryFailed);
+            [failed fulfill];
+        }];
+    [self waitForExpectationsWithTimeout:10.0 handler:nil];
+}
+
+- (void)testCompact
+{
+    XCTestExpectation *compacted = [self expectationWithDescription:@"compacted"];
+    [self.datastore compactWithQualityOfService:NSQualityOfServiceBackground
+                              completionHandler:^(NSError *error) {
+                                  XCTAssertNil(error);
+                                  [compacted fulfill];
+                              }];
+    [self waitForExpectationsWithTimeout:10.0 handler:nil];
+}
+
+- (void)testUserInitiatedWritesGoAheadOfBackgroundWrites
+{
+    // Hold up the write queue until the other writes have been queued behind it.
+    dispatch_semaphore_t started = dispatch_semaphore_create(0);
+    dispatch_semaphore_t release = dispatch_semaphore_create(0);
+    [self.datastore createDocumentFromRevision:[self revisionNamed:@"first"]
+                              qualityOfService:NSQualityOfServiceBackground
+                             completionHandler:^(CDTDocumentRevision *rev, NSError *error) {
+                                 dispatch_semaphore_signal(started);
+                                 dispatch_semaphore_wait(release, DISPATCH_TIME_FOREVER);
+                             }];
+    dispatch_semaphore_wait(started, DISPATCH_TIME_FOREVER);
+
+    NSMutableArray *order = [NSMutableArray array];
+    XCTestExpectation *background = [self expectationWithDescription:@"background"];
+    XCTestExpectation *userInitiated = [self expectationWithDescription:@"user initiated"];
+    [self.datastore createDocumentFromRevision:[self revisionNamed:@"background"]
+                              qualityOfService:NSQualityOfServiceBackground
+                             completionHandler:^(CDTDocumentRevision *rev, NSError *error) {
+                                 @synchronized(order) { [order addObject:@"background"]; }
+                                 [background fulfill];
+                             }];
+    [self.datastore createDocumentFromRevision:[self revisionNamed:@"user"]
+                              qualityOfService:NSQualityOfServiceUserInitiated
+                             completionHandler:^(CDTDocumentRevision *rev, NSError *error) {
+                                 @synchronized(order) { [order addObject:@"user"]; }
+                                 [userInitiated fulfill];
+                             }];
+    dispatch_semaphore_signal(release);
+    [self waitForExpectationsWithTimeout:10.0 handler:nil];
+
+    XCTAssertEqualObjects(order, (@[ @"user", @"background" ]));
+}
+
+@end
@@ -0,0 +1,388 @@
+//
+//  CDTDatastoreBenchmarks.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+#include <sys/resource.h>
+#include <sys/sysctl.h>
+
+#import "CloudantSyncTests.h"
+#import "CDTDatastore.h"
+#import "CDTDatastore+Query.h"
+#import "CDTDatastoreManager.h"
+#import "CDTDatastoreManager+EncryptionKey.h"
+#import "CDTDocumentRevision.h"
+#import "CDTAttachment.h"
+#import "CDTQResultSet.h"
+#import "CDTHelperFixedKeyProvider.h"
+#import "TD_Database.h"
+#import "TD_View.h"
+#import "Version.h"
+
+/*
+ End-to-end benchmarks of the datastore's main operations.
+
+ They only run when the CDT_BENCHMARK_OUTPUT environment variable names the file the results
+ are to be written to, as JSON (see `rake benchmarkosx`); otherwise the suite is empty. Each
+ benchmark reports its median and 99th percentile latency, its throughput and the process's
+ peak resident memory so far, so that runs against different releases can be compared.
+
+ CDT_BENCHMARK_DOCS sets the number of documents each benchmark works on (default 10000).
+ */
+
+static NSString *const kOutputVariable = @"CDT_BENCHMARK_OUTPUT";
+static NSString *const kDocCountVariable = @"CDT_BENCHMARK_DOCS";
+
+static NSMutableArray<NSDictionary *> *results;
+
+@interface CDTDatastoreBenchmarks : CloudantSyncTests
+
+@property (nonatomic) NSUInteger docCount;
+
+@end
+
+@implementation CDTDatastoreBenchmarks
+
++ (XCTestSuite *)defaultTestSuite
+{
+    if (!NSProcessInfo.processInfo.environment[kOutputVariable]) {
+        return [XCTestSuite testSuiteWithName:NSStringFromClass(self)];
+    }
+    return [super defaultTestSuite];
+}
+
++ (void)setUp
+{
+    [super setUp];
+    results = [NSMutableArray array];
+}
+
++ (void)tearDown
+{
+    NSString *path = NSProcessInfo.processInfo.environment[kOutputVariable];
+    if (path && results.count > 0) {
+        NSDictionary *report = @{
+            @"version" : @CLOUDANT_SYNC_VERSION,
+            @"date" : [[[NSISO8601DateFormatter alloc] init] stringFromDate:[NSDate date]],
+            @"machine" : [self machine],
+            @"os" : NSProcessInfo.processInfo.operatingSystemVersionString,
+            @"benchmarks" : results
+        };
+        NSData *json = [NSJSONSerialization dataWithJSONObject:report
+                                                       options:NSJSONWritingPrettyPrinted
+                                                         error:nil];
+        [json writeToFile:path atomically:YES];
+    }
+    results = nil;
+    [super tearDown];
+}
+
++ (NSString *)machine
+{
+    char model[256];
+    size_t length = sizeof(model);
+    if (sysctlbyname("hw.machine", model, &length, NULL, 0) != 0) return @"unknown";
+    return @(model);
+}
+
+- (void)setUp
+{
+    [super setUp];
+    NSInteger docCount = NSProcessInfo.processInfo.environment[kDocCountVariable].integerValue;
+    self.docCount = docCount > 0 ? (NSUInteger)docCount : 10000;
+}
+
+#pragma mark Measuring
+
+static uint64_t peakResidentBytes(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return (uint64_t)usage.ru_maxrss;  // in bytes on Darwin, unlike Linux
+}
+
+static double percentile(NSArray<NSNumber *> *sorted, double p)
+{
+    NSUInteger rank = (NSUInteger)ceil(p * sorted.count);
+    return sorted[MAX(rank, 1u) - 1].doubleValue;
+}
+
+/**
+ Runs the block `samples` times, timing each run, and records the results under `name`.
+
+ @param operations how many operations (documents, usually) each run of the block deals with,
+        for working out the throughput
+ */
+- (void)measure:(NSString *)name
+        samples:(NSUInteger)samples
+     operations:(NSUInteger)operations
+          block:(void (^)(NSUInteger sample))block
+{
+    NSMutableArray<NSNumber *> *latencies = [NSMutableArray arrayWithCapacity:samples];
+    CFAbsoluteTime total = 0;
+    for (NSUInteger i = 0; i < samples; i++) {
+        @autoreleasepool
+        {
+            CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+            block(i);
+            CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+            total += elapsed;
+            [latencies addObject:@(elapsed * 1000)];
+        }
+    }
+    [latencies sortUsingSelector:@selector(compare:)];
+
+    NSDictionary *result = @{
+        @"name" : name,
+        @"samples" : @(samples),
+        @"operations" : @(samples * operations),
+        @"p50_ms" : @(percentile(latencies, 0.5)),
+        @"p99_ms" : @(percentile(latencies, 0.99)),
+        @"mean_ms" : @(total * 1000 / samples),
+        @"ops_per_sec" : @(total > 0 ? samples * operations / total : 0),
+        @"peak_rss_bytes" : @(peakResidentBytes())
+    };
+    [results addObject:result];
+    NSLog(@"Benchmark %@", result);
+}
+
+#pragma mark Fixtures
+
+- (CDTDocumentRevision *)revisionWithNumber:(NSUInteger)n
+{
+    NSString *docId = [NSString stringWithFormat:@"doc-%06lu", (unsigned long)n];
+    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:docId];
+    rev.body = [@{
+        @"name" : (n % 2) ? @"mike" : @"fred",
+        @"age" : @(n % 90),
+        @"docNumber" : @(n),
+        @"pet" : @[ @"cat", @"dog", @"fish" ][n % 3],
+        @"address" : @{ @"town" : @"Bristol", @"street" : @"High Street", @"number" : @(n % 200) }
+    } mutableCopy];
+    return rev;
+}
+
+- (CDTDatastore *)datastoreNamed:(NSString *)name
+{
+    NSError *error;
+    CDTDatastore *datastore = [self.factory datastoreNamed:name error:&error];
+    XCTAssertNotNil(datastore, @"%@", error);
+    return datastore;
+}
+
+/** A datastore holding docCount documents, created in bulk. */
+- (CDTDatastore *)populatedDatastoreNamed:(NSString *)name
+{
+    CDTDatastore *datastore = [self datastoreNamed:name];
+    const NSUInteger batchSize = 1000;
+    for (NSUInteger start = 0; start < self.docCount; start += batchSize) {
+        @autoreleasepool
+        {
+            NSMutableArray *revs = [NSMutableArray arrayWithCapacity:batchSize];
+            for (NSUInteger n = start; n < MIN(start + batchSize, self.docCount); n++) {
+                [revs addObject:[self revisionWithNumber:n]];
+            }
+            XCTAssertNotNil([datastore createDocumentsFromRevisions:revs error:nil]);
+        }
+    }
+    return datastore;
+}
+
+- (NSArray<NSString *> *)docIdsFrom:(NSUInteger)start count:(NSUInteger)count
+{
+    NSMutableArray *docIds = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger n = start; n < start + count; n++) {
+        unsigned long number = n % self.docCount;
+        [docIds addObject:[NSString stringWithFormat:@"doc-%06lu", number]];
+    }
+    return docIds;
+}
+
+#pragma mark Writes
+
+- (void)testSingleWrites
+{
+    CDTDatastore *datastore = [self datastoreNamed:@"single_writes"];
+    [self measure:@"write.single"
+          samples:self.docCount
+       operations:1
+            block:^(NSUInteger sample) {
+                [datastore createDocumentFromRevision:[self revisionWithNumber:sample] error:nil];
+            }];
+}
+
+- (void)testBulkWrites
+{
+    CDTDatastore *datastore = [self datastoreNamed:@"bulk_writes"];
+    const NSUInteger batchSize = 500;
+    [self measure:@"write.bulk_500"
+          samples:MAX(self.docCount / batchSize, 1u)
+       operations:batchSize
+            block:^(NSUInteger sample) {
+                NSMutableArray *revs = [NSMutableArray arrayWithCapacity:batchSize];
+                for (NSUInteger n = 0; n < batchSize; n++) {
+                    [revs addObject:[self revisionWithNumber:sample * batchSize + n]];
+                }
+                [datastore createDocumentsFromRevisions:revs error:nil];
+            }];
+}
+
+#pragma mark Reads
+
+- (void)testGetDocumentsWithIds
+{
+    CDTDatastore *datastore = [self populatedDatastoreNamed:@"get_documents"];
+    for (NSNumber *batchSize in @[ @1, @10, @100, @1000 ]) {
+        NSUInteger size = batchSize.unsignedIntegerValue;
+        [self measure:[NSString stringWithFormat:@"read.get_documents_%lu", (unsigned long)size]
+              samples:MAX(MIN(self.docCount / size, 1000u), 1u)
+           operations:size
+                block:^(NSUInteger sample) {
+                    NSArray *docIds = [self docIdsFrom:sample * size count:size];
+                    XCTAssertEqual([datastore getDocumentsWithIds:docIds].count, size);
+                }];
+    }
+}
+
+- (void)testGetAllDocuments
+{
+    CDTDatastore *datastore = [self populatedDatastoreNamed:@"all_documents"];
+    [self measure:@"read.all_documents"
+          samples:10
+       operations:self.docCount
+            block:^(NSUInteger sample) {
+                XCTAssertEqual([datastore getAllDocuments].count, self.docCount);
+            }];
+}
+
+#pragma mark Query
+
+- (void)testQuery
+{
+    CDTDatastore *datastore = [self populatedDatastoreNamed:@"query"];
+    [self measure:@"query.index_build"
+          samples:1
+       operations:self.docCount
+            block:^(NSUInteger sample) {
+                XCTAssertNotNil([datastore ensureIndexed:@[ @"name", @"age", @"pet" ]
+                                                withName:@"benchmark"]);
+            }];
+
+    NSDictionary *indexed = @{ @"name" : @"mike", @"age" : @{@"$gt" : @45} };
+    [self measure:@"query.find_indexed"
+          samples:100
+       operations:1
+            block:^(NSUInteger sample) {
+                XCTAssertGreaterThan([datastore find:indexed].documentIds.count, 0u);
+            }];
+
+    NSDictionary *unindexed = @{ @"name" : @"mike", @"address.number" : @{@"$lt" : @10} };
+    [self measure:@"query.find_unindexed"
+          samples:20
+       operations:1
+            block:^(NSUInteger sample) {
+                XCTAssertGreaterThan([datastore find:unindexed].documentIds.count, 0u);
+            }];
+}
+
+#pragma mark Compaction
+
+- (void)testCompaction
+{
+    CDTDatastore *datastore = [self populatedDatastoreNamed:@"compaction"];
+    // Give every document a non-current revision for compaction to strip:
+    for (CDTDocumentRevision *rev in [datastore getAllDocuments]) {
+        @autoreleasepool
+        {
+            rev.body[@"updated"] = @YES;
+            [datastore updateDocumentFromRevision:rev error:nil];
+        }
+    }
+    [self measure:@"compaction"
+          samples:1
+       operations:self.docCount
+            block:^(NSUInteger sample) {
+                XCTAssertTrue([datastore compactWithError:nil]);
+            }];
+}
+
+#pragma mark Attachments
+
+- (void)measureAttachmentsInDatastore:(CDTDatastore *)datastore named:(NSString *)name
+{
+    NSMutableData *data = [NSMutableData dataWithLength:256 * 1024];
+    arc4random_buf(data.mutableBytes, data.length);
+    NSUInteger count = MAX(MIN(self.docCount / 10, 500u), 1u);
+
+    [self measure:[NSString stringWithFormat:@"attachments.%@.write_256k", name]
+          samples:count
+       operations:1
+            block:^(NSUInteger sample) {
+                CDTDocumentRevision *rev = [self revisionWithNumber:sample];
+                rev.attachments[@"blob"] =
+                    [[CDTUnsavedDataAttachment alloc] initWithData:data
+                                                              name:@"blob"
+                                                              type:@"application/octet-stream"];
+                XCTAssertNotNil([datastore createDocumentFromRevision:rev error:nil]);
+            }];
+
+    [self measure:[NSString stringWithFormat:@"attachments.%@.read_256k", name]
+          samples:count
+       operations:1
+            block:^(NSUInteger sample) {
+                NSString *docId = [self docIdsFrom:sample count:1][0];
+                CDTDocumentRevision *rev = [datastore getDocumentWithId:docId error:nil];
+                XCTAssertEqual([rev.attachments[@"blob"] dataFromAttachmentContent].length,
+                               data.length);
+            }];
+}
+
+- (void)testAttachments
+{
+    [self measureAttachmentsInDatastore:[self datastoreNamed:@"attachments"] named:@"plain"];
+}
+
+#if defined ENCRYPT_DATABASE
+- (void)testEncryptedAttachments
+{
+    // Attachments of an encrypted datastore are stored as CDTBlobEncryptedData
+    NSError *error;
+    CDTDatastore *datastore =
+        [self.factory datastoreNamed:@"encrypted_attachments"
+            withEncryptionKeyProvider:[CDTHelperFixedKeyProvider provider]
+                                error:&error];
+    XCTAssertNotNil(datastore, @"%@", error);
+    [self measureAttachmentsInDatastore:datastore named:@"encrypted"];
+}
+#endif
+
+#pragma mark Views
+
+- (void)testViewUpdateIndex
+{
+    CDTDatastore *datastore = [self populatedDatastoreNamed:@"views"];
+    TD_View *view = [datastore.database viewNamed:@"benchmark"];
+    [view setMapBlock:^(NSDictionary *doc, TDMapEmitBlock emit) {
+        emit(@[ doc[@"pet"], doc[@"age"] ], doc[@"docNumber"]);
+    }
+          reduceBlock:nil
+              version:@"1"];
+    [self measure:@"view.update_index"
+          samples:1
+       operations:self.docCount
+            block:^(NSUInteger sample) {
+                XCTAssertLessThan([view updateIndex], kTDStatusBadRequest);
+            }];
+}
+
+@end
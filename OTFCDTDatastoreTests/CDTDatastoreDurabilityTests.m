@@ -0,0 +1,158 @@
+//
+//  CDTDatastoreDurabilityTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import "CloudantSyncTests.h"
+#import "CDTDatastore.h"
+#import "CDTDatastoreManager.h"
+#import "CDTDocumentRevision.h"
+#import "TD_Body.h"
+#import "TD_Database.h"
+#import "TD_Database+Insertion.h"
+#import "TD_Revision.h"
+#import <fmdb/FMDB.h>
+
+@interface CDTDatastoreDurabilityTests : CloudantSyncTests
+@end
+
+@implementation CDTDatastoreDurabilityTests
+
+- (int)intForQuery:(NSString *)sql inDatastore:(CDTDatastore *)datastore
+{
+    __block int result = -1;
+    [datastore.database.fmdbQueue inDatabase:^(FMDatabase *db) {
+        result = [db intForQuery:sql];
+    }];
+    return result;
+}
+
+- (void)testDurabilityIsFullByDefault
+{
+    NSError *error;
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"durabilitydefault" error:&error];
+    XCTAssertNotNil(datastore);
+    XCTAssertEqual(datastore.durability, CDTDatastoreDurabilityFull);
+    XCTAssertEqual([self intForQuery:@"PRAGMA synchronous" inDatastore:datastore], 2);
+}
+
+- (void)testDurabilityCanBeChosenWhenOpeningAndChanged
+{
+    NSError *error;
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"durability"
+                                                durability:CDTDatastoreDurabilityNormal
+                                                     error:&error];
+    XCTAssertNotNil(datastore);
+    XCTAssertEqual([self intForQuery:@"PRAGMA synchronous" inDatastore:datastore], 1);
+
+    datastore.durability = CDTDatastoreDurabilityBulkLoad;
+    XCTAssertEqual([self intForQuery:@"PRAGMA synchronous" inDatastore:datastore], 0);
+
+    // Reopening without asking for a durability keeps the current one.
+    XCTAssertEqual([self.factory datastoreNamed:@"durability" error:&error], datastore);
+    XCTAssertEqual(datastore.durability, CDTDatastoreDurabilityBulkLoad);
+
+    // Checkpoints sync however durable commits are, and leave the setting as it was.
+    CDTDocumentRevision *rev = [CDTDocumentRevision revision];
+    rev.body = [@{ @"name" : @"mike" } mutableCopy];
+    XCTAssertNotNil([datastore createDocumentFromRevision:rev error:&error]);
+    XCTAssertTrue([datastore checkpointWithError:&error], @"%@", error);
+    XCTAssertEqual([self intForQuery:@"PRAGMA synchronous" inDatastore:datastore], 0);
+}
+
+- (void)testBulkLoadForceInsertsWithoutForeignKeyChecksOnlyWhileInserting
+{
+    NSError *error;
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"durabilitybulk"
+                                                durability:CDTDatastoreDurabilityBulkLoad
+                                                     error:&error];
+    XCTAssertNotNil(datastore);
+
+    TD_Revision *rev = [[TD_Revision alloc] initWithDocID:@"doc1" revID:@"2-bbbb" deleted:NO];
+    rev.body = [[TD_Body alloc] initWithProperties:@{ @"_id" : @"doc1", @"_rev" : @"2-bbbb" }];
+    TDStatus status =
+        [datastore.database forceInsert:rev revisionHistory:@[ @"2-bbbb", @"1-aaaa" ] source:nil];
+    XCTAssertFalse(TDStatusIsError(status));
+
+    CDTDocumentRevision *saved = [datastore getDocumentWithId:@"doc1" error:&error];
+    XCTAssertEqualObjects(saved.revId, @"2-bbbb");
+    XCTAssertEqual([self intForQuery:@"PRAGMA foreign_keys" inDatastore:datastore], 1);
+}
+
+- (void)testMemoryBudgetSizesThePageCache
+{
+    NSError *error;
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"memorybudget" error:&error];
+    XCTAssertNotNil(datastore);
+    XCTAssertEqual([self intForQuery:@"PRAGMA cache_size" inDatastore:datastore], 2000);
+
+    // Negative sizes are in KiB; the budget is shared with the read connections.
+    datastore.memoryBudget = 8 * 1024 * 1024;
+    int cacheSize = [self intForQuery:@"PRAGMA cache_size" inDatastore:datastore];
+    XCTAssertLessThan(cacheSize, 0);
+    XCTAssertGreaterThanOrEqual(cacheSize, -8 * 1024);
+
+    datastore.memoryBudget = 0;
+    XCTAssertEqual([self intForQuery:@"PRAGMA cache_size" inDatastore:datastore], 2000);
+}
+
+- (void)testManagerSharesMemoryBudgetBetweenOpenDatastores
+{
+    NSError *error;
+    CDTDatastore *first = [self.factory datastoreNamed:@"memorybudgetfirst" error:&error];
+    self.factory.memoryBudget = 16 * 1024 * 1024;
+    XCTAssertEqual(first.memoryBudget, (UInt64)16 * 1024 * 1024);
+
+    CDTDatastore *second = [self.factory datastoreNamed:@"memorybudgetsecond" error:&error];
+    XCTAssertEqual(first.memoryBudget, (UInt64)8 * 1024 * 1024);
+    XCTAssertEqual(second.memoryBudget, (UInt64)8 * 1024 * 1024);
+
+    [self.factory closeDatastoreNamed:@"memorybudgetsecond"];
+    XCTAssertEqual(first.memoryBudget, (UInt64)16 * 1024 * 1024);
+}
+
+- (void)testReleaseMemoryLeavesDatastoreUsable
+{
+    NSError *error;
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"releasememory" error:&error];
+    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"doc1"];
+    rev.body = [@{ @"name" : @"mike" } mutableCopy];
+    XCTAssertNotNil([datastore createDocumentFromRevision:rev error:&error]);
+
+    [datastore.database releaseMemory];
+    [datastore releaseMemory];
+
+    CDTDocumentRevision *saved = [datastore getDocumentWithId:@"doc1" error:&error];
+    XCTAssertEqualObjects(saved.body[@"name"], @"mike");
+}
+
+- (void)testMmapSizeCanBeChosenWhenOpeningAndChanged
+{
+    NSError *error;
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"mmap" error:&error];
+    XCTAssertEqual([self intForQuery:@"PRAGMA mmap_size" inDatastore:datastore], 0);
+
+    XCTAssertEqual([self.factory datastoreNamed:@"mmap" mmapSize:1024 * 1024 error:&error],
+                   datastore);
+    XCTAssertEqual(datastore.mmapSize, (UInt64)1024 * 1024);
+    XCTAssertEqual([self intForQuery:@"PRAGMA mmap_size" inDatastore:datastore], 1024 * 1024);
+
+    // Setting a memory budget doesn't change the mapping.
+    datastore.memoryBudget = 4 * 1024 * 1024;
+    XCTAssertEqual([self intForQuery:@"PRAGMA mmap_size" inDatastore:datastore], 1024 * 1024);
+
+    datastore.mmapSize = 0;
+    XCTAssertEqual([self intForQuery:@"PRAGMA mmap_size" inDatastore:datastore], 0);
+}
+
+@end
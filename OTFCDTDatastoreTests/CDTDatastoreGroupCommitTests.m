@@ -0,0 +1,121 @@
+//
+//  CDTDatastoreGroupCommitTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "CloudantSyncTests.h"
+
+#import "CDTDatastore.h"
+#import "CDTDatastoreStatistics.h"
+#import "CDTDocumentRevision.h"
+
+@interface CDTDatastoreGroupCommitTests : CloudantSyncTests
+@property (nonatomic, strong) CDTDatastore *datastore;
+@end
+
+@implementation CDTDatastoreGroupCommitTests
+
+- (void)setUp
+{
+    [super setUp];
+    NSError *error;
+    self.datastore = [self.factory datastoreNamed:@"groupcommit" error:&error];
+    XCTAssertNotNil(self.datastore, @"datastore is nil");
+    self.datastore.groupCommitWindow = 0.05;
+}
+
+- (void)tearDown
+{
+    self.datastore = nil;
+    [super tearDown];
+}
+
+- (CDTDocumentRevision *)revisionWithIndex:(NSUInteger)i
+{
+    NSString *docId = [NSString stringWithFormat:@"doc%lu", (unsigned long)i];
+    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:docId];
+    rev.body = [@{ @"index" : @(i) } mutableCopy];
+    return rev;
+}
+
+- (void)testConcurrentWritesShareTransactions
+{
+    NSUInteger count = 40;
+    NSUInteger transactionsBefore = self.datastore.statistics.transactionCount;
+
+    __block NSUInteger saved = 0;
+    dispatch_apply(count, dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^(size_t i) {
+        NSError *error;
+        CDTDocumentRevision *rev =
+            [self.datastore createDocumentFromRevision:[self revisionWithIndex:i] error:&error];
+        XCTAssertNotNil(rev, @"%@", error);
+        @synchronized(self) { if (rev) saved++; }
+    });
+
+    XCTAssertEqual(saved, count);
+    XCTAssertEqual(self.datastore.documentCount, count);
+    XCTAssertLessThan(self.datastore.statistics.transactionCount - transactionsBefore, count);
+
+    for (NSUInteger i = 0; i < count; i++) {
+        NSString *docId = [NSString stringWithFormat:@"doc%lu", (unsigned long)i];
+        CDTDocumentRevision *rev = [self.datastore getDocumentWithId:docId error:nil];
+        XCTAssertEqualObjects(rev.body[@"index"], @(i));
+    }
+}
+
+- (void)testConflictingWriteFailsOnItsOwn
+{
+    NSError *error;
+    CDTDocumentRevision *original =
+        [self.datastore createDocumentFromRevision:[self revisionWithIndex:0] error:&error];
+    XCTAssertNotNil(original);
+
+    // Updates of the same revision, likely in the same group: exactly one may win.
+    NSUInteger count = 8;
+    __block NSUInteger updated = 0, conflicted = 0;
+    dispatch_apply(count, dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^(size_t i) {
+        CDTDocumentRevision *rev =
+            [CDTDocumentRevision revisionWithDocId:original.docId revId:original.revId];
+        rev.body = [@{ @"writer" : @(i) } mutableCopy];
+        NSError *updateError;
+        CDTDocumentRevision *result =
+            [self.datastore updateDocumentFromRevision:rev error:&updateError];
+        @synchronized(self)
+        {
+            if (result) {
+                updated++;
+            } else if (updateError.code == 409) {
+                conflicted++;
+            }
+        }
+    });
+    XCTAssertEqual(updated, (NSUInteger)1);
+    XCTAssertEqual(conflicted, count - 1);
+
+    // Writes that don't conflict aren't affected by the ones that do.
+    dispatch_apply(count, dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^(size_t i) {
+        NSError *createError;
+        CDTDocumentRevision *rev = [self revisionWithIndex:i % 2 ? i : 0];
+        CDTDocumentRevision *result =
+            [self.datastore createDocumentFromRevision:rev error:&createError];
+        if (i % 2) {
+            XCTAssertNotNil(result, @"%@", createError);
+        } else {
+            XCTAssertNil(result);
+        }
+    });
+    XCTAssertEqual(self.datastore.documentCount, 1 + count / 2);
+}
+
+@end
@@ -0,0 +1,176 @@
+//
+//  CDTDatastoreSnapshotTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import "CloudantSyncTests.h"
+#import "CDTAttachment.h"
+#import "CDTDatastore.h"
+#import "CDTDatastoreManager.h"
+#import "CDTDocumentRevision.h"
+#import "TD_Database.h"
+#import "TD_Database+Snapshot.h"
+#import "TD_DatabaseManager.h"
+#import "TDInternal.h"
+#import "TDJSON.h"
+
+@interface CDTDatastoreSnapshotTests : CloudantSyncTests
+@property (nonatomic, strong) NSString *snapshotPath;
+@end
+
+@implementation CDTDatastoreSnapshotTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.snapshotPath = [NSTemporaryDirectory()
+        stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtPath:self.snapshotPath error:nil];
+    [super tearDown];
+}
+
+- (CDTDatastore *)sourceDatastore
+{
+    NSError *error;
+    CDTDatastore *source = [self.factory datastoreNamed:@"snapshotsource" error:&error];
+    for (NSUInteger i = 0; i < 10; i++) {
+        CDTDocumentRevision *rev =
+            [CDTDocumentRevision revisionWithDocId:[NSString stringWithFormat:@"doc%lu", (unsigned long)i]];
+        rev.body = [@{ @"index" : @(i) } mutableCopy];
+        XCTAssertNotNil([source createDocumentFromRevision:rev error:&error], @"%@", error);
+    }
+
+    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"withattachment"];
+    rev.body = [@{ @"name" : @"mike" } mutableCopy];
+    rev.attachments[@"note.txt"] =
+        [[CDTUnsavedDataAttachment alloc] initWithData:[@"hello" dataUsingEncoding:NSUTF8StringEncoding]
+                                                  name:@"note.txt"
+                                                  type:@"text/plain"];
+    XCTAssertNotNil([source createDocumentFromRevision:rev error:&error], @"%@", error);
+
+    NSDictionary *checkpoint =
+        @{ @"_id" : @"_local/pullcheckpoint", @"source_last_seq" : @"42-abcdef" };
+    XCTAssertTrue([source.database saveCheckpointDocument:checkpoint error:&error], @"%@", error);
+    return source;
+}
+
+- (void)testExportWritesManifest
+{
+    CDTDatastore *source = [self sourceDatastore];
+    NSError *error;
+    XCTAssertTrue([source exportSnapshotToDirectory:self.snapshotPath error:&error], @"%@", error);
+
+    NSData *json = [NSData
+        dataWithContentsOfFile:[self.snapshotPath stringByAppendingPathComponent:kTDSnapshotManifestName]];
+    NSDictionary *manifest = [TDJSON JSONObjectWithData:json options:0 error:nil];
+    XCTAssertEqualObjects(manifest[@"format"], @1);
+    XCTAssertEqualObjects(manifest[@"document_count"], @11);
+    XCTAssertEqualObjects(manifest[@"last_sequence"], @(source.database.lastSequence));
+    XCTAssertEqualObjects(manifest[@"checkpoints"], @{ @"pullcheckpoint" : @"42-abcdef" });
+
+    // A second export into the same directory is refused.
+    XCTAssertFalse([source exportSnapshotToDirectory:self.snapshotPath error:&error]);
+}
+
+- (void)testImportInstallsSnapshotWithItsOwnIdentity
+{
+    CDTDatastore *source = [self sourceDatastore];
+    NSError *error;
+    XCTAssertTrue([source exportSnapshotToDirectory:self.snapshotPath error:&error], @"%@", error);
+
+    CDTDatastore *copy =
+        [self.factory datastoreNamed:@"snapshotcopy" fromSnapshotAtPath:self.snapshotPath error:&error];
+    XCTAssertNotNil(copy, @"%@", error);
+    XCTAssertEqual(copy.documentCount, (NSUInteger)11);
+    CDTDocumentRevision *rev = [copy getDocumentWithId:@"withattachment" error:&error];
+    XCTAssertEqualObjects([rev.attachments[@"note.txt"] dataFromAttachmentContent],
+                          [@"hello" dataUsingEncoding:NSUTF8StringEncoding]);
+
+    XCTAssertNotEqualObjects(copy.database.privateUUID, source.database.privateUUID);
+    XCTAssertNotEqualObjects(copy.database.publicUUID, source.database.publicUUID);
+    XCTAssertEqualObjects(copy.database.snapshotUUID, source.database.privateUUID);
+    XCTAssertEqualObjects([copy.database checkpointDocumentWithID:@"pullcheckpoint"][@"source_last_seq"],
+                          @"42-abcdef");
+    XCTAssertNil(source.database.snapshotUUID);
+}
+
+- (void)testImportLeavesExistingDatastoreAlone
+{
+    CDTDatastore *source = [self sourceDatastore];
+    NSError *error;
+    XCTAssertTrue([source exportSnapshotToDirectory:self.snapshotPath error:&error], @"%@", error);
+
+    CDTDatastore *existing = [self.factory datastoreNamed:@"snapshotexisting" error:&error];
+    XCTAssertEqual(
+        [self.factory datastoreNamed:@"snapshotexisting" fromSnapshotAtPath:self.snapshotPath error:&error],
+        existing);
+    XCTAssertEqual(existing.documentCount, (NSUInteger)0);
+}
+
+- (void)testImportRejectsMissingSnapshot
+{
+    NSError *error;
+    XCTAssertNil([self.factory datastoreNamed:@"snapshotmissing"
+                           fromSnapshotAtPath:self.snapshotPath
+                                        error:&error]);
+    XCTAssertNotNil(error);
+    TD_Database *db = [self.factory.manager databaseNamed:@"snapshotmissing"];
+    XCTAssertFalse(db.exists);
+}
+
+- (void)testBackupIncludesWritesMadeWhileItRuns
+{
+    CDTDatastore *source = [self sourceDatastore];
+    NSString *backupPath = [self.snapshotPath stringByAppendingPathComponent:@"backup.touchdb"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:self.snapshotPath
+                              withIntermediateDirectories:YES
+                                               attributes:nil
+                                                    error:nil];
+
+    __block NSUInteger steps = 0;
+    __block NSUInteger written = 0;
+    NSError *error;
+    BOOL ok = [source backupToPath:backupPath
+                      pagesPerStep:1
+                          progress:^(int remainingPages, int totalPages) {
+                              steps++;
+                              XCTAssertLessThanOrEqual(remainingPages, totalPages);
+                              // Writers get the database between steps
+                              CDTDocumentRevision *rev = [CDTDocumentRevision revision];
+                              rev.body = [@{ @"step" : @(steps) } mutableCopy];
+                              if ([source createDocumentFromRevision:rev error:nil]) written++;
+                          }
+                             error:&error];
+    XCTAssertTrue(ok, @"%@", error);
+    XCTAssertGreaterThan(steps, (NSUInteger)1);
+    XCTAssertEqual(written, steps);
+
+    XCTAssertFalse([source backupToPath:backupPath pagesPerStep:1 progress:nil error:&error]);
+
+    CDTDatastoreManager *manager =
+        [[CDTDatastoreManager alloc] initWithDirectory:self.snapshotPath error:&error];
+    CDTDatastore *backup = [manager datastoreNamed:@"backup" error:&error];
+    XCTAssertNotNil(backup, @"%@", error);
+    // All but the write after the last step made it into the copy
+    XCTAssertEqual(backup.documentCount, 11 + written - 1);
+    CDTDocumentRevision *rev = [backup getDocumentWithId:@"withattachment" error:&error];
+    XCTAssertEqualObjects([rev.attachments[@"note.txt"] dataFromAttachmentContent],
+                          [@"hello" dataUsingEncoding:NSUTF8StringEncoding]);
+    XCTAssertEqualObjects(backup.database.privateUUID, source.database.privateUUID);
+}
+
+@end
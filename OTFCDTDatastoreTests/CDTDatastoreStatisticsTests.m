@@ -0,0 +1,205 @@
+//
+//  CDTDatastoreStatisticsTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "CloudantSyncTests.h"
+
+#import "CDTDatastore.h"
+#import "CDTDatastore+Query.h"
+#import "CDTDatastoreStatistics.h"
+#import "CDTDocumentRevision.h"
+#import "CDTQueueTelemetry.h"
+#import "TD_Body.h"
+#import "TD_Database.h"
+#import "TD_Database+Insertion.h"
+#import "TD_Revision.h"
+
+#import <fmdb/FMDB.h>
+
+@interface CDTDatastoreStatisticsTests : CloudantSyncTests
+@property (nonatomic, strong) CDTDatastore *datastore;
+@end
+
+@implementation CDTDatastoreStatisticsTests
+
+- (void)setUp
+{
+    [super setUp];
+    NSError *error;
+    self.datastore = [self.factory datastoreNamed:@"statistics" error:&error];
+    XCTAssertNotNil(self.datastore, @"datastore is nil");
+}
+
+- (void)tearDown
+{
+    self.datastore = nil;
+    [super tearDown];
+}
+
+/** Checks the counts kept by triggers match counting the revs table. */
+- (void)assertCountsMatchScan
+{
+    __block NSUInteger docs = 0, revs = 0, allDocs = 0, conflicted = 0;
+    [self.datastore.database.fmdbQueue inDatabase:^(FMDatabase *db) {
+        docs = [db intForQuery:@"SELECT COUNT(DISTINCT doc_id) FROM revs "
+                                "WHERE current=1 AND deleted=0"];
+        revs = [db intForQuery:@"SELECT COUNT(*) FROM revs"];
+        allDocs = [db intForQuery:@"SELECT COUNT(DISTINCT doc_id) FROM revs WHERE current=1"];
+        conflicted = [db intForQuery:@"SELECT COUNT(*) FROM conflicts"];
+    }];
+    CDTDatastoreStatistics *statistics = self.datastore.statistics;
+    XCTAssertEqual(statistics.documentCount, docs);
+    XCTAssertEqual(statistics.revisionCount, revs);
+    XCTAssertEqual(statistics.deletedDocumentCount, allDocs - docs);
+    XCTAssertEqual(statistics.conflictedDocumentCount, conflicted);
+    XCTAssertEqual(self.datastore.documentCount, docs);
+}
+
+- (void)testCountsFollowChanges
+{
+    NSError *error;
+    [self assertCountsMatchScan];
+
+    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"doc1"];
+    rev.body = [@{ @"hello" : @"world" } mutableCopy];
+    CDTDocumentRevision *saved = [self.datastore createDocumentFromRevision:rev error:&error];
+    XCTAssertNotNil(saved);
+    NSString *firstRevID = saved.revId;
+    rev = [CDTDocumentRevision revisionWithDocId:@"doc2"];
+    rev.body = [@{ @"hello" : @"again" } mutableCopy];
+    XCTAssertNotNil([self.datastore createDocumentFromRevision:rev error:&error]);
+    [self assertCountsMatchScan];
+    XCTAssertEqual(self.datastore.statistics.documentCount, (NSUInteger)2);
+
+    saved.body = [@{ @"hello" : @"there" } mutableCopy];
+    saved = [self.datastore updateDocumentFromRevision:saved error:&error];
+    XCTAssertNotNil(saved);
+    [self assertCountsMatchScan];
+    XCTAssertEqual(self.datastore.statistics.revisionCount, (NSUInteger)3);
+
+    XCTAssertNotNil([self.datastore deleteDocumentFromRevision:saved error:&error]);
+    [self assertCountsMatchScan];
+    XCTAssertEqual(self.datastore.statistics.documentCount, (NSUInteger)1);
+    XCTAssertEqual(self.datastore.statistics.deletedDocumentCount, (NSUInteger)1);
+
+    // A conflicting branch brings the deleted document back...
+    TD_Revision *conflict = [[TD_Revision alloc] initWithDocID:@"doc1" revID:@"2-zzzz" deleted:NO];
+    conflict.body =
+        [[TD_Body alloc] initWithProperties:@{ @"_id" : @"doc1", @"_rev" : @"2-zzzz" }];
+    TDStatus status = [self.datastore.database forceInsert:conflict
+                                           revisionHistory:@[ @"2-zzzz", firstRevID ]
+                                                    source:nil];
+    XCTAssertFalse(TDStatusIsError(status));
+    [self assertCountsMatchScan];
+    XCTAssertEqual(self.datastore.statistics.documentCount, (NSUInteger)2);
+    XCTAssertEqual(self.datastore.statistics.deletedDocumentCount, (NSUInteger)0);
+
+    // ...and a second one doesn't count it twice.
+    TD_Revision *another = [[TD_Revision alloc] initWithDocID:@"doc1" revID:@"2-yyyy" deleted:NO];
+    another.body =
+        [[TD_Body alloc] initWithProperties:@{ @"_id" : @"doc1", @"_rev" : @"2-yyyy" }];
+    status = [self.datastore.database forceInsert:another
+                                  revisionHistory:@[ @"2-yyyy", firstRevID ]
+                                           source:nil];
+    XCTAssertFalse(TDStatusIsError(status));
+    [self assertCountsMatchScan];
+    XCTAssertEqual(self.datastore.statistics.documentCount, (NSUInteger)2);
+    XCTAssertEqual(self.datastore.statistics.conflictedDocumentCount, (NSUInteger)1);
+
+    NSDictionary *result;
+    status = [self.datastore.database purgeRevisions:@{ @"doc2" : @[ @"*" ] } result:&result];
+    XCTAssertFalse(TDStatusIsError(status));
+    [self assertCountsMatchScan];
+    XCTAssertEqual(self.datastore.statistics.documentCount, (NSUInteger)1);
+}
+
+- (void)testSizesAndTransactions
+{
+    NSError *error;
+    CDTDatastoreStatistics *before = self.datastore.statistics;
+    XCTAssertGreaterThan(before.databaseFileSize, (UInt64)0);
+
+    for (int i = 0; i < 10; i++) {
+        CDTDocumentRevision *rev = [CDTDocumentRevision revision];
+        rev.body = [@{ @"i" : @(i) } mutableCopy];
+        XCTAssertNotNil([self.datastore createDocumentFromRevision:rev error:&error]);
+    }
+
+    CDTDatastoreStatistics *after = self.datastore.statistics;
+    XCTAssertGreaterThanOrEqual(after.transactionCount, before.transactionCount + 10);
+    XCTAssertGreaterThan(after.totalTransactionTime, before.totalTransactionTime);
+    XCTAssertGreaterThanOrEqual(after.totalTransactionTime, after.maxTransactionTime);
+    XCTAssertGreaterThan(after.pageCacheHits + after.pageCacheMisses, (UInt64)0);
+    XCTAssertGreaterThanOrEqual(after.pageCacheHitRate, 0.0);
+    XCTAssertLessThanOrEqual(after.pageCacheHitRate, 1.0);
+    XCTAssertEqual(after.lastSequence, before.lastSequence + 10);
+}
+
+- (void)testIndexSequenceLag
+{
+    NSError *error;
+    XCTAssertNotNil([self.datastore ensureIndexed:@[ @"name" ] withName:@"names"]);
+    XCTAssertTrue([self.datastore updateAllIndexes]);
+    XCTAssertEqualObjects(self.datastore.indexSequenceLag, @{ @"names" : @0 });
+
+    for (int i = 0; i < 3; i++) {
+        CDTDocumentRevision *rev = [CDTDocumentRevision revision];
+        rev.body = [@{ @"name" : [NSString stringWithFormat:@"name%d", i] } mutableCopy];
+        XCTAssertNotNil([self.datastore createDocumentFromRevision:rev error:&error]);
+    }
+    XCTAssertEqualObjects(self.datastore.indexSequenceLag, @{ @"names" : @3 });
+
+    XCTAssertTrue([self.datastore updateAllIndexes]);
+    XCTAssertEqualObjects(self.datastore.indexSequenceLag, @{ @"names" : @0 });
+}
+
+- (void)testQueueTimingsByOperation
+{
+    NSError *error;
+    XCTAssertNotNil([self.datastore ensureIndexed:@[ @"name" ] withName:@"names"]);
+    [self.datastore.queueTelemetry reset];
+    XCTAssertEqual(self.datastore.statistics.queueTimings.count, (NSUInteger)0);
+
+    for (int i = 0; i < 5; i++) {
+        CDTDocumentRevision *rev = [CDTDocumentRevision revision];
+        rev.body = [@{ @"name" : [NSString stringWithFormat:@"name%d", i] } mutableCopy];
+        XCTAssertNotNil([self.datastore createDocumentFromRevision:rev error:&error]);
+    }
+    XCTAssertTrue([self.datastore updateAllIndexes]);
+    XCTAssertEqual([self.datastore find:@{ @"name" : @"name1" }].documentIds.count, (NSUInteger)1);
+
+    NSDictionary<NSString *, CDTQueueTimings *> *timings = self.datastore.statistics.queueTimings;
+    XCTAssertGreaterThanOrEqual(timings[@"put"].count, (NSUInteger)5);
+    XCTAssertGreaterThan(timings[@"indexUpdate"].count, (NSUInteger)0);
+    XCTAssertGreaterThan(timings[@"query"].count, (NSUInteger)0);
+
+    for (CDTQueueTimings *timing in timings.allValues) {
+        XCTAssertEqual(timing.waitHistogram.count, (NSUInteger)kCDTQueueHistogramBuckets);
+        NSUInteger waits = 0, holds = 0;
+        for (NSUInteger i = 0; i < kCDTQueueHistogramBuckets; i++) {
+            waits += timing.waitHistogram[i].unsignedIntegerValue;
+            holds += timing.holdHistogram[i].unsignedIntegerValue;
+        }
+        XCTAssertEqual(waits, timing.count, @"%@", timing.operation);
+        XCTAssertEqual(holds, timing.count, @"%@", timing.operation);
+        XCTAssertGreaterThanOrEqual(timing.totalHoldTime, timing.maxHoldTime);
+        XCTAssertGreaterThanOrEqual(timing.totalWaitTime, timing.maxWaitTime);
+    }
+    XCTAssertEqualWithAccuracy([CDTQueueTimings upperBoundOfBucket:0], 10e-6, 1e-9);
+    XCTAssertEqualWithAccuracy([CDTQueueTimings upperBoundOfBucket:10], 10.24e-3, 1e-9);
+    XCTAssertTrue(isinf([CDTQueueTimings upperBoundOfBucket:kCDTQueueHistogramBuckets - 1]));
+}
+
+@end
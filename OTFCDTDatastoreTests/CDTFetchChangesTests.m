@@ -22,6 +22,10 @@
 #import <OTFCDTDatastore/CDTDatastore.h>
 #import <OTFCDTDatastore/TD_DatabaseManager.h>
 #import <OTFCDTDatastore/CDTDocumentRevision.h>
+#import <OTFCDTDatastore/TD_Body.h>
+#import <OTFCDTDatastore/TD_Revision.h>
+#import <OTFCDTDatastore/TD_Database.h>
+#import <OTFCDTDatastore/TD_Database+Insertion.h>
 
 #define CDTFETCHANGESTESTS_TOTALDOCCOUNT 1100
 #define CDTFETCHANGESTESTS_DELETEDOCCOUNT 5
@@ -238,6 +242,53 @@
                    @"%i documents were deleted", 0);
 }
 
+- (void)testConflictedDocumentGetsItsWinner
+{
+    // A tombstone on a longer, conflicting branch has the highest revID, but the live revision
+    // wins.
+    NSString *docId = [CDTFetchChangesTests docIdWithIndex:CDTFETCHANGESTESTS_TOTALDOCCOUNT - 1];
+    CDTDocumentRevision *live = [self.datastore getDocumentWithId:docId error:nil];
+    TD_Revision *tombstone = [[TD_Revision alloc] initWithDocID:docId revID:@"3-zzzz" deleted:YES];
+    tombstone.body = [[TD_Body alloc] initWithProperties:@{
+        @"_id" : docId,
+        @"_rev" : @"3-zzzz",
+        @"_deleted" : @YES
+    }];
+    TDStatus status = [self.datastore.database forceInsert:tombstone
+                                           revisionHistory:@[ @"3-zzzz", @"2-zzzz", @"1-zzzz" ]
+                                                    source:nil];
+    XCTAssertFalse(TDStatusIsError(status));
+
+    CDTFetchChanges *fetchChanges =
+        [[CDTFetchChanges alloc] initWithDatastore:self.datastore
+                                startSequenceValue:self.startSequenceValue];
+
+    __block CDTDocumentRevision *changed = nil;
+    fetchChanges.documentChangedBlock = ^(CDTDocumentRevision *revision) {
+      if ([revision.docId isEqualToString:docId]) changed = revision;
+    };
+
+    __block BOOL deleted = NO;
+    fetchChanges.documentWithIDWasDeletedBlock = ^(NSString *deletedId) {
+      if ([deletedId isEqualToString:docId]) deleted = YES;
+    };
+
+    __block NSString *blockNewSequenceValue = nil;
+    fetchChanges.fetchRecordChangesCompletionBlock =
+        ^(NSString *newSequenceValue, NSString *startSequenceValue, NSError *fetchError) {
+          blockNewSequenceValue = newSequenceValue;
+        };
+
+    [fetchChanges start];
+
+    XCTAssertFalse(deleted);
+    XCTAssertEqualObjects(changed.revId, live.revId);
+    XCTAssertEqualObjects(changed.body, live.body);
+    // The feed continues from the tombstone, the document's latest change.
+    XCTAssertEqual([blockNewSequenceValue longLongValue],
+                   self.datastore.database.lastSequence);
+}
+
 #pragma mark - Private class methods
 + (void)populateDatastore:(CDTDatastore *)datastore withDocuments:(NSUInteger)counter
 {
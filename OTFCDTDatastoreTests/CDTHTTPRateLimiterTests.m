@@ -0,0 +1,88 @@
+//
+//  CDTHTTPRateLimiterTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import "CDTHTTPRateLimiter.h"
+
+static NSString *const host = @"https://example.cloudant.com:443";
+
+@interface CDTHTTPRateLimiterTests : XCTestCase
+@end
+
+@implementation CDTHTTPRateLimiterTests
+
+- (void)testHostsAreUnlimitedUntilThrottled
+{
+    CDTHTTPRateLimiter *limiter = [[CDTHTTPRateLimiter alloc] init];
+    for (int i = 0; i < 50; i++) {
+        XCTAssertEqual([limiter reserveRequestToHost:host], 0);
+    }
+    XCTAssertEqual([limiter requestRateForHost:host], 0);
+}
+
+- (void)testThrottlingPacesRequestsBelowTheRateSent
+{
+    CDTHTTPRateLimiter *limiter = [[CDTHTTPRateLimiter alloc] init];
+    for (int i = 0; i < 10; i++) {
+        [limiter reserveRequestToHost:host];
+    }
+    [limiter recordThrottledResponseFromHost:host retryAfter:0];
+    XCTAssertEqualWithAccuracy([limiter requestRateForHost:host], 8, 0.01);
+
+    // Requests reserved together are spaced out at the new rate.
+    NSTimeInterval first = [limiter reserveRequestToHost:host];
+    NSTimeInterval second = [limiter reserveRequestToHost:host];
+    XCTAssertEqualWithAccuracy(first, 0.125, 0.01);
+    XCTAssertEqualWithAccuracy(second - first, 0.125, 0.01);
+
+    // Other hosts aren't affected.
+    XCTAssertEqual([limiter reserveRequestToHost:@"https://other.cloudant.com:443"], 0);
+}
+
+- (void)testBurstOfThrottledResponsesCountsOnce
+{
+    CDTHTTPRateLimiter *limiter = [[CDTHTTPRateLimiter alloc] init];
+    for (int i = 0; i < 10; i++) {
+        [limiter reserveRequestToHost:host];
+    }
+    for (int i = 0; i < 10; i++) {
+        [limiter recordThrottledResponseFromHost:host retryAfter:0];
+    }
+    XCTAssertEqualWithAccuracy([limiter requestRateForHost:host], 8, 0.01);
+}
+
+- (void)testRetryAfterPausesTheHost
+{
+    CDTHTTPRateLimiter *limiter = [[CDTHTTPRateLimiter alloc] init];
+    [limiter recordThrottledResponseFromHost:host retryAfter:2];
+    XCTAssertEqualWithAccuracy([limiter reserveRequestToHost:host], 2, 0.1);
+}
+
+- (void)testAcceptedResponsesRaiseTheRate
+{
+    CDTHTTPRateLimiter *limiter = [[CDTHTTPRateLimiter alloc] init];
+    for (int i = 0; i < 10; i++) {
+        [limiter reserveRequestToHost:host];
+    }
+    [limiter recordThrottledResponseFromHost:host retryAfter:0];
+    double throttled = [limiter requestRateForHost:host];
+
+    for (int i = 0; i < 8; i++) {
+        [limiter recordAcceptedResponseFromHost:host];
+    }
+    // A second's worth of responses at the throttled rate adds about half a request a second.
+    XCTAssertEqualWithAccuracy([limiter requestRateForHost:host] - throttled, 0.5, 0.05);
+}
+
+@end
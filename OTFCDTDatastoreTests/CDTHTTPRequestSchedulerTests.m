@@ -0,0 +1,127 @@
+//
+//  CDTHTTPRequestSchedulerTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import "CDTHTTPRequestScheduler.h"
+
+@interface CDTHTTPRequestSchedulerTests : XCTestCase
+@property (nonatomic, strong) NSMutableArray *started;
+@end
+
+@implementation CDTHTTPRequestSchedulerTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.started = [NSMutableArray array];
+}
+
+- (void)schedule:(NSString *)name
+         forHost:(NSString *)host
+           owner:(id)owner
+        priority:(CDTHTTPRequestPriority)priority
+     inScheduler:(CDTHTTPRequestScheduler *)scheduler
+{
+    NSMutableArray *started = self.started;
+    [scheduler scheduleRequestForHost:host
+                                owner:owner
+                             priority:priority
+                                start:^{
+                                    @synchronized(started) { [started addObject:name]; }
+                                }];
+}
+
+/** Start blocks run on a global queue. */
+- (NSArray *)startedAfterWaiting
+{
+    [NSThread sleepForTimeInterval:0.1];
+    @synchronized(self.started) { return [self.started copy]; }
+}
+
+- (void)testHighestPriorityRequestGoesFirst
+{
+    CDTHTTPRequestScheduler *scheduler = [[CDTHTTPRequestScheduler alloc] initWithLimitPerHost:1];
+    NSObject *owner = [[NSObject alloc] init];
+    [self schedule:@"first" forHost:@"a" owner:owner priority:CDTHTTPRequestPriorityDocuments
+        inScheduler:scheduler];
+    [self schedule:@"attachment" forHost:@"a" owner:owner priority:CDTHTTPRequestPriorityAttachments
+        inScheduler:scheduler];
+    [self schedule:@"documents" forHost:@"a" owner:owner priority:CDTHTTPRequestPriorityDocuments
+        inScheduler:scheduler];
+    [self schedule:@"changes" forHost:@"a" owner:owner priority:CDTHTTPRequestPriorityChanges
+        inScheduler:scheduler];
+
+    // Scheduling doesn't block, and only the first request is in flight.
+    XCTAssertEqualObjects([self startedAfterWaiting], @[ @"first" ]);
+    XCTAssertEqual([scheduler requestsQueuedForHost:@"a"], (NSUInteger)3);
+
+    for (NSUInteger i = 0; i < 3; i++) {
+        [scheduler requestFinishedForHost:@"a" owner:owner priority:CDTHTTPRequestPriorityDocuments];
+        [self startedAfterWaiting];
+    }
+    XCTAssertEqualObjects([self startedAfterWaiting],
+                          (@[ @"first", @"changes", @"documents", @"attachment" ]));
+}
+
+- (void)testHostsAreScheduledIndependently
+{
+    CDTHTTPRequestScheduler *scheduler = [[CDTHTTPRequestScheduler alloc] initWithLimitPerHost:1];
+    NSObject *owner = [[NSObject alloc] init];
+    [self schedule:@"slow" forHost:@"a" owner:owner priority:CDTHTTPRequestPriorityDocuments
+        inScheduler:scheduler];
+    [self schedule:@"queued" forHost:@"a" owner:owner priority:CDTHTTPRequestPriorityDocuments
+        inScheduler:scheduler];
+    [self schedule:@"other" forHost:@"b" owner:owner priority:CDTHTTPRequestPriorityDocuments
+        inScheduler:scheduler];
+
+    XCTAssertEqualObjects([NSSet setWithArray:[self startedAfterWaiting]],
+                          ([NSSet setWithObjects:@"slow", @"other", nil]));
+    XCTAssertEqual([scheduler requestsInFlightToHost:@"a"], (NSUInteger)1);
+    XCTAssertEqual([scheduler requestsInFlightToHost:@"b"], (NSUInteger)1);
+}
+
+- (void)testAttachmentsDontTakeTheLastSlot
+{
+    CDTHTTPRequestScheduler *scheduler = [[CDTHTTPRequestScheduler alloc] initWithLimitPerHost:3];
+    NSObject *owner = [[NSObject alloc] init];
+    for (NSString *name in @[ @"a1", @"a2", @"a3" ]) {
+        [self schedule:name forHost:@"a" owner:owner priority:CDTHTTPRequestPriorityAttachments
+            inScheduler:scheduler];
+    }
+    XCTAssertEqualObjects([self startedAfterWaiting], (@[ @"a1", @"a2" ]));
+
+    [self schedule:@"changes" forHost:@"a" owner:owner priority:CDTHTTPRequestPriorityChanges
+        inScheduler:scheduler];
+    XCTAssertEqualObjects([self startedAfterWaiting], (@[ @"a1", @"a2", @"changes" ]));
+    XCTAssertEqual([scheduler requestsQueuedForHost:@"a"], (NSUInteger)1);
+}
+
+- (void)testFreedSlotGoesToOwnerWithFewestInFlight
+{
+    CDTHTTPRequestScheduler *scheduler = [[CDTHTTPRequestScheduler alloc] initWithLimitPerHost:2];
+    NSObject *large = [[NSObject alloc] init];
+    NSObject *small = [[NSObject alloc] init];
+    for (NSString *name in @[ @"large1", @"large2", @"large3" ]) {
+        [self schedule:name forHost:@"a" owner:large priority:CDTHTTPRequestPriorityDocuments
+            inScheduler:scheduler];
+    }
+    [self schedule:@"small" forHost:@"a" owner:small priority:CDTHTTPRequestPriorityDocuments
+        inScheduler:scheduler];
+    XCTAssertEqualObjects([self startedAfterWaiting], (@[ @"large1", @"large2" ]));
+
+    [scheduler requestFinishedForHost:@"a" owner:large priority:CDTHTTPRequestPriorityDocuments];
+    XCTAssertEqualObjects([self startedAfterWaiting], (@[ @"large1", @"large2", @"small" ]));
+}
+
+@end
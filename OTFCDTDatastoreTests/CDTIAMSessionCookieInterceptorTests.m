@@ -21,6 +21,10 @@
 #import "CloudantSyncTests.h"
 #import "CDTIAMSessionCookieInterceptor.h"
 #import "CDTURLSession.h"
+#import "CDTDatastore.h"
+#import "CDTDatastoreManager.h"
+#import "CDTPullReplication.h"
+#import "CDTReplicatorFactory.h"
 #import <OHHTTPStubs/OHHTTPStubs.h>
 #import <OHHTTPStubs/OHHTTPStubsResponse+JSON.h>
 #import <OHHTTPStubs/NSURLRequest+HTTPBodyTesting.h>
@@ -715,4 +719,68 @@ NSDictionary *iamToken2;
     XCTAssert([helper currentResponse] == 5);
 }
 
+/**
+ * Test pre-warming a replication ahead of starting it:
+ * - Cookie jar empty, so get IAM token followed by session cookie
+ * - HEAD of the server's root, opening a connection to it
+ * - The first request of the replication is sent with the cookie, without logging in again
+ */
+- (void)testPrewarmingLogsInAndOpensConnection
+{
+    OHHTTPStubsHelper *IAMTokenHelper = [[OHHTTPStubsHelper alloc] init];
+    [IAMTokenHelper addResponse:^OHHTTPStubsResponse *__nonnull(NSURLRequest *__nonnull request) {
+        XCTAssert([request.HTTPMethod isEqualToString:@"POST"]);
+        return [OHHTTPStubsResponse responseWithJSONObject:iamToken1 statusCode:200 headers:@{}];
+    }];
+    [IAMTokenHelper doStubsForHost:@"iam.bluemix.net"];
+
+    // The login and the HEAD request are made at once, in either order.
+    __block int heads = 0;
+    OHHTTPStubsResponse * (^loginOrHead)(NSURLRequest *) = ^(NSURLRequest *request) {
+        if ([request.HTTPMethod isEqualToString:@"HEAD"]) {
+            XCTAssertEqualObjects(request.URL.path, @"/");
+            heads++;
+            return [OHHTTPStubsResponse responseWithData:[NSData data] statusCode:200 headers:@{}];
+        }
+        XCTAssert([request.URL.lastPathComponent isEqualToString:@"_iam_session"]);
+        return [OHHTTPStubsResponse
+            responseWithJSONObject:@{ @"ok" : @(YES) }
+                        statusCode:200
+                           headers:@{
+                               @"Set-Cookie" : [NSString
+                                   stringWithFormat:@"%@; Version=1; Path=/; HttpOnly; Max-Age=86400",
+                                                    testCookieHeaderValue]
+                           }];
+    };
+    OHHTTPStubsHelper *helper = [[OHHTTPStubsHelper alloc] init];
+    [helper addResponse:loginOrHead];
+    [helper addResponse:loginOrHead];
+    [helper doStubsForHost:@"username.cloudant.com"];
+
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"prewarm" error:nil];
+    NSURL *remote = [NSURL URLWithString:@"http://username.cloudant.com/animaldb"];
+    CDTPullReplication *pull =
+        [CDTPullReplication replicationWithSource:remote target:datastore IAMAPIKey:@"apikey"];
+    CDTReplicatorFactory *replicatorFactory =
+        [[CDTReplicatorFactory alloc] initWithDatastoreManager:self.factory];
+
+    XCTestExpectation *prewarmed = [self expectationWithDescription:@"prewarmed"];
+    [replicatorFactory prewarmReplications:@[ pull, [pull copy] ]
+                         completionHandler:^{
+                             [prewarmed fulfill];
+                         }];
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+
+    XCTAssertEqual([IAMTokenHelper currentResponse], 1);
+    XCTAssertEqual([helper currentResponse], 2);
+    XCTAssertEqual(heads, 1);
+
+    // Replicating would send the cookie, with no need to log in again.
+    CDTIAMSessionCookieInterceptor *interceptor = pull.httpInterceptors.firstObject;
+    NSArray<NSHTTPCookie *> *cookies = [interceptor sessionCookiesForRequestURL:remote];
+    XCTAssertEqualObjects([NSHTTPCookie requestHeaderFieldsWithCookies:cookies][@"Cookie"],
+                          testCookieHeaderValue);
+    XCTAssertEqual([IAMTokenHelper currentResponse], 1);
+}
+
 @end
@@ -0,0 +1,132 @@
+//
+//  CDTPartitionedDatastoreTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "CloudantSyncTests.h"
+
+#import "CDTDatastore.h"
+#import "CDTDocumentChange.h"
+#import "CDTDocumentRevision.h"
+#import "CDTPartitionedDatastore.h"
+
+@interface CDTPartitionedDatastoreTests : CloudantSyncTests
+@property (nonatomic, strong) CDTPartitionedDatastore *datastore;
+@end
+
+@implementation CDTPartitionedDatastoreTests
+
+- (void)setUp
+{
+    [super setUp];
+    NSError *error;
+    self.datastore = [[CDTPartitionedDatastore alloc] initWithManager:self.factory
+                                                                 name:@"sensors"
+                                                       partitionCount:4
+                                                                error:&error];
+    XCTAssertNotNil(self.datastore, @"%@", error);
+}
+
+- (void)tearDown
+{
+    self.datastore = nil;
+    [super tearDown];
+}
+
+- (void)testDocumentsAreSpreadOverPartitionsAndReadBack
+{
+    NSMutableArray *revisions = [NSMutableArray array];
+    for (int i = 0; i < 40; i++) {
+        NSString *docId = [NSString stringWithFormat:@"doc%d", i];
+        CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:docId];
+        rev.body = [@{ @"reading" : @(i) } mutableCopy];
+        [revisions addObject:rev];
+    }
+    NSError *error;
+    NSArray *created = [self.datastore createDocumentsFromRevisions:revisions error:&error];
+    XCTAssertEqual(created.count, (NSUInteger)40, @"%@", error);
+    XCTAssertEqual(self.datastore.documentCount, (NSUInteger)40);
+
+    // Each document is where its ID says, and every partition got some
+    for (CDTDatastore *partition in self.datastore.partitions) {
+        XCTAssertGreaterThan(partition.documentCount, (NSUInteger)0);
+        for (NSString *docId in [partition getAllDocumentIds]) {
+            XCTAssertEqual([self.datastore partitionForDocumentId:docId], partition);
+        }
+    }
+
+    NSArray *read = [self.datastore getDocumentsWithIds:@[ @"doc7", @"missing", @"doc3" ]];
+    XCTAssertEqualObjects([read valueForKey:@"docId"], (@[ @"doc7", @"doc3" ]));
+
+    CDTDocumentRevision *fresh = [CDTDocumentRevision revision];
+    fresh.body = [@{ @"reading" : @100 } mutableCopy];
+    CDTDocumentRevision *saved = [self.datastore createDocumentFromRevision:fresh error:&error];
+    XCTAssertNotNil(saved.docId, @"%@", error);
+    XCTAssertEqualObjects([self.datastore getDocumentWithId:saved.docId error:nil].body[@"reading"],
+                          @100);
+
+    // The same count finds the same partitions, and another is refused
+    CDTPartitionedDatastore *reopened =
+        [[CDTPartitionedDatastore alloc] initWithManager:self.factory
+                                                    name:@"sensors"
+                                          partitionCount:4
+                                                   error:nil];
+    XCTAssertEqual(reopened.documentCount, (NSUInteger)41);
+    XCTAssertNil([[CDTPartitionedDatastore alloc] initWithManager:self.factory
+                                                             name:@"sensors"
+                                                   partitionCount:3
+                                                            error:&error]);
+    XCTAssertNotNil(error);
+}
+
+- (void)testChangesArePagedThroughWithCompositeTokens
+{
+    NSMutableSet *docIds = [NSMutableSet set];
+    for (int i = 0; i < 25; i++) {
+        NSString *docId = [NSString stringWithFormat:@"doc%d", i];
+        CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:docId];
+        rev.body = [@{ @"reading" : @(i) } mutableCopy];
+        XCTAssertNotNil([self.datastore createDocumentFromRevision:rev error:nil]);
+        [docIds addObject:rev.docId];
+    }
+
+    NSMutableSet *listed = [NSMutableSet set];
+    NSString *token = nil;
+    NSArray<CDTDocumentChange *> *changes;
+    do {
+        NSError *error;
+        changes = [self.datastore changesSinceToken:token limit:10 nextToken:&token error:&error];
+        XCTAssertNotNil(changes, @"%@", error);
+        XCTAssertLessThanOrEqual(changes.count, (NSUInteger)10);
+        for (CDTDocumentChange *change in changes) {
+            XCTAssertFalse([listed containsObject:change.docId]);
+            [listed addObject:change.docId];
+        }
+    } while (changes.count > 0);
+    XCTAssertEqualObjects(listed, docIds);
+
+    // A later change is all that's listed after the last token
+    CDTDocumentRevision *doc = [self.datastore getDocumentWithId:@"doc5" error:nil];
+    XCTAssertNotNil([self.datastore deleteDocumentFromRevision:doc error:nil]);
+    changes = [self.datastore changesSinceToken:token limit:0 nextToken:&token error:nil];
+    XCTAssertEqual(changes.count, (NSUInteger)1);
+    XCTAssertEqualObjects(changes.firstObject.docId, @"doc5");
+    XCTAssertTrue(changes.firstObject.deleted);
+
+    NSError *error;
+    XCTAssertNil([self.datastore changesSinceToken:@"1,2" limit:0 nextToken:NULL error:&error]);
+    XCTAssertNotNil(error);
+}
+
+@end
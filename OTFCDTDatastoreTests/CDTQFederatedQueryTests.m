@@ -0,0 +1,176 @@
+//
+//  CDTQFederatedQueryTests.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#import <OTFCDTDatastore/CloudantSync.h>
+#import <Expecta/Expecta.h>
+#import <Specta/Specta.h>
+
+SpecBegin(CDTQFederatedQuery) describe(@"cdtq", ^{
+
+    __block NSString *factoryPath;
+    __block CDTDatastoreManager *factory;
+
+    beforeEach(^{
+        // Create a new CDTDatastoreFactory at a temp path
+
+        NSString *tempDirectoryTemplate = [NSTemporaryDirectory()
+            stringByAppendingPathComponent:@"cloudant_sync_ios_tests.XXXXXX"];
+        const char *tempDirectoryTemplateCString = [tempDirectoryTemplate fileSystemRepresentation];
+        char *tempDirectoryNameCString = (char *)malloc(strlen(tempDirectoryTemplateCString) + 1);
+        strcpy(tempDirectoryNameCString, tempDirectoryTemplateCString);
+
+        char *result = mkdtemp(tempDirectoryNameCString);
+        expect(result).to.beTruthy();
+
+        factoryPath = [[NSFileManager defaultManager]
+            stringWithFileSystemRepresentation:tempDirectoryNameCString
+                                        length:strlen(result)];
+        free(tempDirectoryNameCString);
+
+        NSError *error;
+        factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:&error];
+    });
+
+    afterEach(^{
+        // Delete the databases we used
+
+        factory = nil;
+        NSError *error;
+        [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:&error];
+    });
+
+    describe(@"when querying several datastores", ^{
+
+        beforeEach(^{
+            NSDictionary *projects = @{
+                @"alpha" : @{ @"a1" : @3, @"a2" : @7, @"a3" : @11 },
+                @"beta" : @{ @"b1" : @1, @"b2" : @8, @"b3" : @12 },
+                @"gamma" : @{ @"g1" : @5, @"g2" : @9 }
+            };
+            for (NSString *name in projects) {
+                CDTDatastore *ds = [factory datastoreNamed:name error:nil];
+                expect(ds).toNot.beNil();
+                for (NSString *docId in projects[name]) {
+                    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:docId];
+                    rev.body = [@{ @"type" : @"task", @"priority" : projects[name][docId],
+                                   @"owner" : name } mutableCopy];
+                    [ds createDocumentFromRevision:rev error:nil];
+                }
+                expect([ds ensureIndexed:@[ @"type", @"priority" ] withName:@"tasks"])
+                    .toNot.beNil();
+            }
+        });
+
+        NSArray *(^docIds)(NSArray<CDTQFederatedResult *> *) = ^(NSArray *results) {
+            NSMutableArray *ids = [NSMutableArray array];
+            for (CDTQFederatedResult *result in results) {
+                [ids addObject:result.revision.docId];
+            }
+            return ids;
+        };
+
+        it(@"merges sorted results", ^{
+            NSArray *results = [factory find:@{ @"type" : @"task" }
+                           inDatastoresNamed:nil
+                                        skip:0
+                                       limit:0
+                                      fields:nil
+                                        sort:@[ @{ @"priority" : @"asc" } ]];
+            expect(docIds(results))
+                .to.equal(@[ @"b1", @"a1", @"g1", @"a2", @"b2", @"g2", @"a3", @"b3" ]);
+            CDTQFederatedResult *first = results[0];
+            expect(first.datastoreName).to.equal(@"beta");
+
+            results = [factory find:@{ @"type" : @"task" }
+                  inDatastoresNamed:nil
+                               skip:0
+                              limit:0
+                             fields:nil
+                               sort:@[ @{ @"priority" : @"desc" } ]];
+            expect(docIds(results))
+                .to.equal(@[ @"b3", @"a3", @"g2", @"b2", @"a2", @"g1", @"a1", @"b1" ]);
+        });
+
+        it(@"applies skip and limit to the merged results", ^{
+            NSArray *results = [factory find:@{ @"type" : @"task" }
+                           inDatastoresNamed:nil
+                                        skip:2
+                                       limit:3
+                                      fields:nil
+                                        sort:@[ @{ @"priority" : @"asc" } ]];
+            expect(docIds(results)).to.equal(@[ @"g1", @"a2", @"b2" ]);
+
+            results = [factory find:@{ @"type" : @"task" }
+                  inDatastoresNamed:nil
+                               skip:7
+                              limit:5
+                             fields:nil
+                               sort:@[ @{ @"priority" : @"asc" } ]];
+            expect(docIds(results)).to.equal(@[ @"b3" ]);
+        });
+
+        it(@"queries only the named datastores", ^{
+            NSArray *results = [factory find:@{ @"priority" : @{ @"$gt" : @4 } }
+                           inDatastoresNamed:@[ @"gamma", @"alpha" ]
+                                        skip:0
+                                       limit:0
+                                      fields:nil
+                                        sort:@[ @{ @"priority" : @"asc" } ]];
+            expect(docIds(results)).to.equal(@[ @"g1", @"a2", @"g2", @"a3" ]);
+        });
+
+        it(@"returns each datastore's results in turn without a sort", ^{
+            NSArray *results = [factory find:@{ @"type" : @"task" }
+                           inDatastoresNamed:@[ @"gamma", @"alpha" ]
+                                        skip:1
+                                       limit:3
+                                      fields:nil
+                                        sort:nil];
+            expect(results.count).to.equal(3);
+            CDTQFederatedResult *first = results[0];
+            CDTQFederatedResult *last = results[2];
+            expect(first.datastoreName).to.equal(@"gamma");
+            expect(last.datastoreName).to.equal(@"alpha");
+        });
+
+        it(@"projects the sort fields too", ^{
+            NSArray *results = [factory find:@{ @"type" : @"task" }
+                           inDatastoresNamed:nil
+                                        skip:0
+                                       limit:2
+                                      fields:@[ @"owner" ]
+                                        sort:@[ @{ @"priority" : @"asc" } ]];
+            expect(docIds(results)).to.equal(@[ @"b1", @"a1" ]);
+            CDTQFederatedResult *first = results[0];
+            expect(first.revision.body[@"owner"]).to.equal(@"beta");
+            expect(first.revision.body[@"priority"]).to.equal(@1);
+            expect(first.revision.body[@"type"]).to.beNil();
+        });
+
+        it(@"fails if any datastore fails", ^{
+            NSArray *results = [factory find:@{ @"type" : @{ @"$bogus" : @1 } }
+                           inDatastoresNamed:nil
+                                        skip:0
+                                       limit:0
+                                      fields:nil
+                                        sort:nil];
+            expect(results).to.beNil();
+        });
+
+    });
+
+});
+
+SpecEnd
@@ -0,0 +1,153 @@
+//
+//  CDTQGeoSearchTests.m
+//  CloudantSync
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#import <OTFCDTDatastore/CloudantSync.h>
+#import <Expecta/Expecta.h>
+#import <Specta/Specta.h>
+#import "Matchers/CDTQContainsInAnyOrderMatcher.h"
+
+SpecBegin(CDTQQueryExecutorGeoSearch) describe(@"cdtq", ^{
+
+    __block NSString *factoryPath;
+    __block CDTDatastoreManager *factory;
+
+    beforeEach(^{
+        // Create a new CDTDatastoreFactory at a temp path
+
+        NSString *tempDirectoryTemplate = [NSTemporaryDirectory()
+            stringByAppendingPathComponent:@"cloudant_sync_ios_tests.XXXXXX"];
+        const char *tempDirectoryTemplateCString = [tempDirectoryTemplate fileSystemRepresentation];
+        char *tempDirectoryNameCString = (char *)malloc(strlen(tempDirectoryTemplateCString) + 1);
+        strcpy(tempDirectoryNameCString, tempDirectoryTemplateCString);
+
+        char *result = mkdtemp(tempDirectoryNameCString);
+        expect(result).to.beTruthy();
+
+        factoryPath = [[NSFileManager defaultManager]
+            stringWithFileSystemRepresentation:tempDirectoryNameCString
+                                        length:strlen(result)];
+        free(tempDirectoryNameCString);
+
+        NSError *error;
+        factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:&error];
+    });
+
+    afterEach(^{
+        // Delete the databases we used
+
+        factory = nil;
+        NSError *error;
+        [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:&error];
+    });
+
+    describe(@"when using a geo index", ^{
+
+        __block CDTDatastore *ds;
+        __block CDTQIndexManager *im;
+        NSDictionary *aroundLondon =
+            @{ @"$geoWithin" : @{ @"$box" : @[ @[ @51, @-1 ], @[ @52, @1 ] ] } };
+
+        beforeEach(^{
+            ds = [factory datastoreNamed:@"test" error:nil];
+            expect(ds).toNot.beNil();
+
+            NSDictionary *bodies = @{
+                @"london" : @{ @"name" : @"london", @"lat" : @51.5074, @"lon" : @-0.1278 },
+                @"greenwich" : @{ @"name" : @"greenwich", @"lat" : @51.4769, @"lon" : @0.0005 },
+                @"paris" : @{ @"name" : @"paris", @"lat" : @48.8566, @"lon" : @2.3522 },
+                @"newyork" : @{ @"name" : @"new york", @"lat" : @40.7128, @"lon" : @-74.006 },
+                @"atlantis" : @{ @"name" : @"atlantis", @"lat" : @"unknown", @"lon" : @0 },
+                @"nowhere" : @{ @"name" : @"nowhere" }
+            };
+            for (NSString *docId in bodies) {
+                CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:docId];
+                rev.body = [bodies[docId] mutableCopy];
+                [ds createDocumentFromRevision:rev error:nil];
+            }
+
+            im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect(im).toNot.beNil();
+
+            expect([im ensureIndexed:@[ @"lat", @"lon" ]
+                            withName:@"places"
+                              ofType:CDTQIndexTypeGeo]).toNot.beNil();
+            expect([im ensureIndexed:@[ @"name" ] withName:@"name"]).toNot.beNil();
+        });
+
+        it(@"finds the points in a box", ^{
+            CDTQResultSet *result = [im find:aroundLondon];
+            expect(result.documentIds).to.containsInAnyOrder(@[ @"london", @"greenwich" ]);
+        });
+
+        it(@"finds the points within a distance", ^{
+            NSArray *london = @[ @51.5074, @-0.1278 ];
+            CDTQResultSet *result =
+                [im find:@{ @"$geoWithin" : @{ @"$center" : @[ london, @20000 ] } }];
+            expect(result.documentIds).to.containsInAnyOrder(@[ @"london", @"greenwich" ]);
+
+            result = [im find:@{ @"$geoWithin" : @{ @"$center" : @[ london, @1000 ] } }];
+            expect(result.documentIds).to.equal(@[ @"london" ]);
+
+            result = [im find:@{ @"$geoWithin" : @{ @"$center" : @[ london, @400000 ] } }];
+            expect(result.documentIds)
+                .to.containsInAnyOrder(@[ @"london", @"greenwich", @"paris" ]);
+        });
+
+        it(@"combines a geo search with other clauses", ^{
+            NSDictionary *query = @{ @"$and" : @[ aroundLondon, @{ @"name" : @"greenwich" } ] };
+            expect([im find:query].documentIds).to.equal(@[ @"greenwich" ]);
+
+            query = @{ @"$or" : @[ aroundLondon, @{ @"name" : @"paris" } ] };
+            expect([im find:query].documentIds)
+                .to.containsInAnyOrder(@[ @"london", @"greenwich", @"paris" ]);
+        });
+
+        it(@"keeps the points up to date as documents change", ^{
+            CDTDocumentRevision *greenwich = [ds getDocumentWithId:@"greenwich" error:nil];
+            [ds deleteDocumentFromRevision:greenwich error:nil];
+
+            CDTDocumentRevision *paris = [ds getDocumentWithId:@"paris" error:nil];
+            paris.body[@"lat"] = @51.6;
+            paris.body[@"lon"] = @0.5;
+            [ds updateDocumentFromRevision:paris error:nil];
+
+            CDTQResultSet *result = [im find:aroundLondon];
+            expect(result.documentIds).to.containsInAnyOrder(@[ @"london", @"paris" ]);
+        });
+
+        it(@"rejects invalid geo searches", ^{
+            NSArray *reversedBox = @[ @[ @52, @1 ], @[ @51, @-1 ] ];
+            expect([im find:@{ @"$geoWithin" : @{ @"$box" : reversedBox } }]).to.beNil();
+            expect([im find:@{ @"$geoWithin" : @{ @"$center" : @[ @[ @91, @0 ], @10 ] } }])
+                .to.beNil();
+            expect([im find:@{ @"$geoWithin" : @{ @"$near" : @[ @51, @0 ] } }]).to.beNil();
+        });
+
+        it(@"needs a geo index", ^{
+            expect([im deleteIndexNamed:@"places"]).to.beTruthy();
+            expect([im find:aroundLondon]).to.beNil();
+        });
+
+        it(@"allows only one geo index", ^{
+            expect([im ensureIndexed:@[ @"lat", @"lon" ] withName:@"more" ofType:CDTQIndexTypeGeo])
+                .to.beNil();
+            expect([im ensureIndexed:@[ @"lat" ] withName:@"places" ofType:CDTQIndexTypeGeo])
+                .to.beNil();
+        });
+    });
+
+});
+
+SpecEnd
@@ -271,6 +271,17 @@ SpecBegin(CDTQIndexCreator)
               expect(index[@"settings"]).to.equal(@"{\"tokenize\":\"porter\"}");
             });
 
+            it(@"rejects invalid text index module and prefix settings", ^{
+              expect([im ensureIndexed:@[ @"name" ]
+                              withName:@"basic"
+                                ofType:CDTQIndexTypeText
+                              settings:@{ @"module" : @"fts3" }]).to.beNil();
+              expect([im ensureIndexed:@[ @"name" ]
+                              withName:@"basic"
+                                ofType:CDTQIndexTypeText
+                              settings:@{ @"prefix" : @"two" }]).to.beNil();
+            });
+
             it(@"supports coexistence of text and json indexes", ^{
               NSString *name = [im ensureIndexed:@[ @{ @"name" : @"asc" },
                                                     @{ @"age" : @"desc" } ]
@@ -438,16 +449,16 @@ SpecBegin(CDTQIndexCreator)
                 part = parts[0];
                 expect(part.sqlWithPlaceholders)
                     .to.equal(@"INSERT INTO _t_cloudant_sync_query_metadata"
-                               " (index_name, index_type, field_name, last_sequence) "
-                               "VALUES (?, ?, ?, 0);");
-                expect(part.placeholderValues).to.equal(@[ @"anIndex", @"json", @"_id" ]);
+                               " (index_name, index_type, field_name, last_sequence, covering) "
+                               "VALUES (?, ?, ?, 0, ?);");
+                expect(part.placeholderValues).to.equal(@[ @"anIndex", @"json", @"_id", @YES ]);
 
                 part = parts[1];
                 expect(part.sqlWithPlaceholders)
                     .to.equal(@"INSERT INTO _t_cloudant_sync_query_metadata"
-                               " (index_name, index_type, field_name, last_sequence) "
-                               "VALUES (?, ?, ?, 0);");
-                expect(part.placeholderValues).to.equal(@[ @"anIndex", @"json", @"name" ]);
+                               " (index_name, index_type, field_name, last_sequence, covering) "
+                               "VALUES (?, ?, ?, 0, ?);");
+                expect(part.placeholderValues).to.equal(@[ @"anIndex", @"json", @"name", @YES ]);
             });
 
             it(@"can create insert statements for an index with many fields", ^{
@@ -462,30 +473,30 @@ SpecBegin(CDTQIndexCreator)
                 part = parts[0];
                 expect(part.sqlWithPlaceholders)
                     .to.equal(@"INSERT INTO _t_cloudant_sync_query_metadata"
-                               " (index_name, index_type, field_name, last_sequence) "
-                               "VALUES (?, ?, ?, 0);");
-                expect(part.placeholderValues).to.equal(@[ @"anIndex", @"json", @"_id" ]);
+                               " (index_name, index_type, field_name, last_sequence, covering) "
+                               "VALUES (?, ?, ?, 0, ?);");
+                expect(part.placeholderValues).to.equal(@[ @"anIndex", @"json", @"_id", @YES ]);
 
                 part = parts[1];
                 expect(part.sqlWithPlaceholders)
                     .to.equal(@"INSERT INTO _t_cloudant_sync_query_metadata"
-                               " (index_name, index_type, field_name, last_sequence) "
-                               "VALUES (?, ?, ?, 0);");
-                expect(part.placeholderValues).to.equal(@[ @"anIndex", @"json", @"name" ]);
+                               " (index_name, index_type, field_name, last_sequence, covering) "
+                               "VALUES (?, ?, ?, 0, ?);");
+                expect(part.placeholderValues).to.equal(@[ @"anIndex", @"json", @"name", @YES ]);
 
                 part = parts[2];
                 expect(part.sqlWithPlaceholders)
                     .to.equal(@"INSERT INTO _t_cloudant_sync_query_metadata"
-                               " (index_name, index_type, field_name, last_sequence) "
-                               "VALUES (?, ?, ?, 0);");
-                expect(part.placeholderValues).to.equal(@[ @"anIndex", @"json", @"age" ]);
+                               " (index_name, index_type, field_name, last_sequence, covering) "
+                               "VALUES (?, ?, ?, 0, ?);");
+                expect(part.placeholderValues).to.equal(@[ @"anIndex", @"json", @"age", @YES ]);
 
                 part = parts[3];
                 expect(part.sqlWithPlaceholders)
                     .to.equal(@"INSERT INTO _t_cloudant_sync_query_metadata"
-                               " (index_name, index_type, field_name, last_sequence) "
-                               "VALUES (?, ?, ?, 0);");
-                expect(part.placeholderValues).to.equal(@[ @"anIndex", @"json", @"pet" ]);
+                               " (index_name, index_type, field_name, last_sequence, covering) "
+                               "VALUES (?, ?, ?, 0, ?);");
+                expect(part.placeholderValues).to.equal(@[ @"anIndex", @"json", @"pet", @YES ]);
             });
 
             // CREATE TABLE for Cloudant Query index
@@ -553,6 +564,32 @@ SpecBegin(CDTQIndexCreator)
                                " ( \"_id\", \"name\", \"age\", \"pet\" );");
                 expect(parts.placeholderValues).to.equal(@[]);
             });
+
+            // CREATE VIRTUAL TABLE for text indexes
+
+            it(@"can create FTS4 virtual table statements with prefix indexes", ^{
+                CDTQSqlParts *parts = [CDTQIndexCreator
+                    createVirtualTableStatementForIndexName:@"anIndex"
+                                                 fieldNames:@[ @"_id", @"comment" ]
+                                                   settings:@{ @"tokenize" : @"porter",
+                                                               @"prefix" : @"2 3" }];
+                expect(parts.sqlWithPlaceholders)
+                    .to.equal(@"CREATE VIRTUAL TABLE \"_t_cloudant_sync_query_index_anIndex\" "
+                               "USING FTS4 ( \"_id\", \"comment\", prefix=\"2,3\", tokenize=porter );");
+            });
+
+            it(@"can create FTS5 virtual table statements", ^{
+                CDTQSqlParts *parts = [CDTQIndexCreator
+                    createVirtualTableStatementForIndexName:@"anIndex"
+                                                 fieldNames:@[ @"_id", @"comment" ]
+                                                   settings:@{ @"module" : @"fts5",
+                                                               @"tokenize" : @"porter unicode61",
+                                                               @"prefix" : @"2,3" }];
+                expect(parts.sqlWithPlaceholders)
+                    .to.equal(@"CREATE VIRTUAL TABLE \"_t_cloudant_sync_query_index_anIndex\" "
+                               "USING FTS5 ( \"_id\", \"comment\", prefix='2 3', "
+                               "tokenize='porter unicode61' );");
+            });
         });
     });
 
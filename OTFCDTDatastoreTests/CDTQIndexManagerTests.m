@@ -5,15 +5,23 @@
 //  Created by Michael Rhodes on 09/27/2014.
 //  Copyright (c) 2014 Michael Rhodes. All rights reserved.
 //
+#import <OTFCDTDatastore/CDTQIndex.h>
+#import <OTFCDTDatastore/CDTQIndexAdvisor.h>
 #import <OTFCDTDatastore/CDTQIndexCreator.h>
 #import <OTFCDTDatastore/CDTQIndexManager.h>
 #import <OTFCDTDatastore/CDTQIndexUpdater.h>
+#import <OTFCDTDatastore/CDTQLiveQuery.h>
+#import <OTFCDTDatastore/CDTQProjectedDocumentRevision.h>
+#import <OTFCDTDatastore/CDTQQueryCache.h>
 #import <OTFCDTDatastore/CDTQQueryExecutor.h>
 #import <OTFCDTDatastore/CDTQResultSet.h>
 #import <OTFCDTDatastore/CloudantSync.h>
 #import <Expecta/Expecta.h>
+#import <FMDB/FMDB.h>
 #import <Specta/Specta.h>
 #import "DBQueryUtils.h"
+#import "TD_Database+Insertion.h"
+#import "TD_Database+PullThrough.h"
 
 SpecBegin(CDTQIndexManager)
 
@@ -257,4 +265,1070 @@ SpecBegin(CDTQIndexManager)
         
     });
 
+    describe(@"when indexing in the background", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTDatastore *ds;
+        __block CDTQIndexManager *im;
+        __block CDTQIndexUpdater *updater;
+
+        beforeEach(^{
+            factoryPath = [NSTemporaryDirectory()
+                stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:nil];
+            ds = [factory datastoreNamed:@"test" error:nil];
+            expect(ds).toNot.beNil();
+            im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect(im).toNot.beNil();
+            expect([im ensureIndexed:@[ @"name" ] withName:@"basic"]).toNot.beNil();
+            updater = [[CDTQIndexUpdater alloc] initWithDatabase:im.database datastore:ds];
+        });
+
+        afterEach(^{
+            im.backgroundIndexingEnabled = NO;
+            im = nil;
+            factory = nil;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:nil];
+        });
+
+        it(@"is disabled by default", ^{
+            expect(im.isBackgroundIndexingEnabled).to.beFalsy();
+
+            CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"mike"];
+            rev.body = [@{ @"name" : @"mike" } mutableCopy];
+            [ds createDocumentFromRevision:rev error:nil];
+
+            [NSThread sleepForTimeInterval:0.5];
+            expect([updater sequenceNumberForIndex:@"basic"]).to.equal(0);
+        });
+
+        it(@"updates indexes when documents change", ^{
+            im.backgroundIndexingEnabled = YES;
+
+            for (int i = 0; i < 10; i++) {
+                CDTDocumentRevision *rev =
+                    [CDTDocumentRevision revisionWithDocId:[NSString stringWithFormat:@"doc%d", i]];
+                rev.body = [@{ @"name" : @"mike" } mutableCopy];
+                [ds createDocumentFromRevision:rev error:nil];
+            }
+
+            expect([updater sequenceNumberForIndex:@"basic"]).will.equal(10);
+            expect([[im find:@{ @"name" : @"mike" }] documentIds].count).to.equal(10);
+        });
+
+        it(@"catches up with changes made before it was enabled", ^{
+            CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"mike"];
+            rev.body = [@{ @"name" : @"mike" } mutableCopy];
+            [ds createDocumentFromRevision:rev error:nil];
+
+            im.backgroundIndexingEnabled = YES;
+            expect([updater sequenceNumberForIndex:@"basic"]).will.equal(1);
+        });
+
+        it(@"indexes pulled revisions as they're inserted when inline", ^{
+            im.inlineIndexingEnabled = YES;
+            NSURL *source = [NSURL URLWithString:@"http://example.com/db"];
+            NSString *table = [CDTQIndexManager tableNameForIndex:@"basic"];
+            NSInteger (^rowCount)(void) = ^NSInteger {
+                __block NSInteger count = 0;
+                [im.database inDatabase:^(FMDatabase *db) {
+                    count = [db intForQuery:[NSString stringWithFormat:@"SELECT COUNT(*) FROM %@", table]];
+                }];
+                return count;
+            };
+
+            NSMutableArray *revs = [NSMutableArray array];
+            NSMutableArray *histories = [NSMutableArray array];
+            for (int i = 0; i < 3; i++) {
+                [revs addObject:[TD_Revision revisionWithProperties:@{
+                    @"_id" : [NSString stringWithFormat:@"doc%d", i],
+                    @"_rev" : @"1-a",
+                    @"name" : @"mike"
+                }]];
+                [histories addObject:@[ @"1-a" ]];
+            }
+            [ds.database forceInsertRevisions:revs revisionHistories:histories source:source];
+
+            // Already indexed when the insert returns
+            expect([updater sequenceNumberForIndex:@"basic"]).to.equal(3);
+            expect(rowCount()).to.equal(3);
+
+            TD_Revision *deletion = [TD_Revision
+                revisionWithProperties:@{ @"_id" : @"doc0", @"_rev" : @"2-b", @"_deleted" : @YES }];
+            [ds.database forceInsertRevisions:@[ deletion ]
+                            revisionHistories:@[ @[ @"2-b", @"1-a" ] ]
+                                       source:source];
+            expect([updater sequenceNumberForIndex:@"basic"]).to.equal(4);
+            expect(rowCount()).to.equal(2);
+
+            // Local changes are left for the next update
+            CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"local"];
+            rev.body = [@{ @"name" : @"mike" } mutableCopy];
+            [ds createDocumentFromRevision:rev error:nil];
+            expect([updater sequenceNumberForIndex:@"basic"]).to.equal(4);
+            expect([[im find:@{ @"name" : @"mike" }] documentIds].count).to.equal(3);
+
+            im.inlineIndexingEnabled = NO;
+        });
+    });
+
+    describe(@"when counting and aggregating", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTDatastore *ds;
+        __block CDTQIndexManager *im;
+
+        beforeEach(^{
+            factoryPath = [NSTemporaryDirectory()
+                stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:nil];
+            ds = [factory datastoreNamed:@"test" error:nil];
+            expect(ds).toNot.beNil();
+
+            NSArray *orders = @[
+                @{ @"status" : @"open", @"price" : @10, @"tags" : @[ @"red", @"big" ] },
+                @{ @"status" : @"open", @"price" : @5, @"tags" : @[ @"red" ] },
+                @{ @"status" : @"shipped", @"price" : @20, @"tags" : @[ @"big" ] },
+                @{ @"status" : @"shipped", @"price" : @1 },
+                @{ @"status" : @"cancelled" }
+            ];
+            for (NSUInteger i = 0; i < orders.count; i++) {
+                CDTDocumentRevision *rev = [CDTDocumentRevision
+                    revisionWithDocId:[NSString stringWithFormat:@"order%lu", (unsigned long)i]];
+                rev.body = [orders[i] mutableCopy];
+                [ds createDocumentFromRevision:rev error:nil];
+            }
+
+            im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect(im).toNot.beNil();
+            expect([im ensureIndexed:@[ @"status", @"price" ] withName:@"status"]).toNot.beNil();
+            expect([im ensureIndexed:@[ @"tags" ] withName:@"tags"]).toNot.beNil();
+        });
+
+        afterEach(^{
+            im = nil;
+            factory = nil;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:nil];
+        });
+
+        it(@"counts matching documents", ^{
+            expect([im count:@{ @"status" : @"open" }]).to.equal(2);
+            expect([im count:@{ @"tags" : @"red" }]).to.equal(2);
+            expect([im count:@{ @"$or" : @[ @{ @"tags" : @"big" }, @{ @"status" : @"open" } ] }])
+                .to.equal(3);
+            expect([im count:@{ @"status" : @"none" }]).to.equal(0);
+        });
+
+        it(@"counts queries that need matching by hand", ^{
+            expect([im count:@{ @"status" : @"shipped", @"colour" : @{ @"$exists" : @NO } }])
+                .to.equal(2);
+        });
+
+        it(@"returns NSNotFound for an invalid query", ^{
+            expect([im count:@{ @"status" : @{ @"$bad" : @1 } }]).to.equal(NSNotFound);
+        });
+
+        it(@"picks the matching documents among given IDs", ^{
+            NSSet *matching = [im documentIdsMatching:@{ @"status" : @"shipped" }
+                                                among:@[ @"order0", @"order2", @"order3", @"nope" ]];
+            expect(matching).to.equal([NSSet setWithArray:@[ @"order2", @"order3" ]]);
+            expect([im documentIdsMatching:@{ @"status" : @"open" } among:@[]]).to.equal([NSSet set]);
+            expect([im documentIdsMatching:@{ @"status" : @{ @"$bad" : @1 } } among:@[ @"order0" ]])
+                .to.beNil();
+        });
+
+        it(@"aggregates without grouping", ^{
+            NSArray *results = [im aggregate:@{ @"status" : @{ @"$in" : @[ @"open", @"shipped" ] } }
+                                  aggregates:@{
+                                      @"total" : @{ @"$sum" : @"price" },
+                                      @"cheapest" : @{ @"$min" : @"price" },
+                                      @"dearest" : @{ @"$max" : @"price" },
+                                      @"orders" : @{ @"$count" : @"_id" }
+                                  }
+                                     groupBy:nil];
+            expect(results).to.equal(
+                @[ @{ @"total" : @36, @"cheapest" : @1, @"dearest" : @20, @"orders" : @4 } ]);
+        });
+
+        it(@"aggregates grouped by a field", ^{
+            NSArray *results = [im aggregate:@{ @"status" : @{ @"$exists" : @YES } }
+                                  aggregates:@{
+                                      @"total" : @{ @"$sum" : @"price" },
+                                      @"priced" : @{ @"$count" : @"price" }
+                                  }
+                                     groupBy:@"status"];
+            expect(results).to.equal(@[
+                @{ @"status" : @"cancelled", @"total" : [NSNull null], @"priced" : @0 },
+                @{ @"status" : @"open", @"total" : @15, @"priced" : @2 },
+                @{ @"status" : @"shipped", @"total" : @21, @"priced" : @2 }
+            ]);
+        });
+
+        it(@"counts facets of an array field", ^{
+            NSArray *results = [im aggregate:@{ @"tags" : @{ @"$exists" : @YES } }
+                                  aggregates:@{ @"n" : @{ @"$count" : @"_id" } }
+                                     groupBy:@"tags"];
+            expect(results).to.equal(@[ @{ @"tags" : @"big", @"n" : @2 },
+                                        @{ @"tags" : @"red", @"n" : @2 } ]);
+        });
+
+        it(@"returns nil when no index holds the fields", ^{
+            expect([im aggregate:@{ @"status" : @"open" }
+                      aggregates:@{ @"total" : @{ @"$sum" : @"price" } }
+                         groupBy:@"tags"])
+                .to.beNil();
+            expect([im aggregate:@{ @"status" : @"open" }
+                      aggregates:@{ @"total" : @{ @"$avg" : @"price" } }
+                         groupBy:nil])
+                .to.beNil();
+        });
+    });
+
+    describe(@"when explaining queries", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTDatastore *ds;
+        __block CDTQIndexManager *im;
+
+        beforeEach(^{
+            factoryPath = [NSTemporaryDirectory()
+                stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:nil];
+            ds = [factory datastoreNamed:@"test" error:nil];
+            expect(ds).toNot.beNil();
+
+            NSArray *pets = @[ @"cat", @"dog", @"fish", @"snake" ];
+            for (int i = 0; i < 40; i++) {
+                CDTDocumentRevision *rev =
+                    [CDTDocumentRevision revisionWithDocId:[NSString stringWithFormat:@"doc%d", i]];
+                rev.body = [@{
+                    @"name" : [NSString stringWithFormat:@"name%d", i % 20],
+                    @"pet" : pets[i % 4]
+                } mutableCopy];
+                [ds createDocumentFromRevision:rev error:nil];
+            }
+
+            im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect(im).toNot.beNil();
+            expect([im ensureIndexed:@[ @"name" ] withName:@"name"]).toNot.beNil();
+            expect([im ensureIndexed:@[ @"pet" ] withName:@"pet"]).toNot.beNil();
+        });
+
+        afterEach(^{
+            im = nil;
+            factory = nil;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:nil];
+        });
+
+        it(@"describes a single index query", ^{
+            NSDictionary *plan = [im explain:@{ @"name" : @"name3" } sort:@[ @{ @"name" : @"asc" } ]];
+            expect(plan[@"strategy"]).to.equal(@"singleIndex");
+            expect(plan[@"indexesCoverQuery"]).to.equal(@YES);
+            expect(plan[@"sql"]).to.contain(@"_t_cloudant_sync_query_index_name");
+            expect(plan[@"parameters"]).to.equal(@[ @"name3" ]);
+
+            NSDictionary *sqlNode = plan[@"tree"][@"children"][0];
+            expect(sqlNode[@"type"]).to.equal(@"sql");
+            expect(sqlNode[@"index"]).to.equal(@"name");
+            expect([sqlNode[@"estimatedRows"] doubleValue]).to.beCloseTo(2);
+        });
+
+        it(@"uses a partial index only for queries which imply its selector", ^{
+            expect([im ensureIndexed:@[ @"name", @"pet" ]
+                            withName:@"catnames"
+                              ofType:CDTQIndexTypeJSON
+                            settings:nil
+                            selector:@{ @"pet" : @"cat" }]).toNot.beNil();
+            expect([im listIndexes][@"catnames"][@"selector"])
+                .to.equal(@{ @"$and" : @[ @{ @"pet" : @{ @"$eq" : @"cat" } } ] });
+
+            NSDictionary *query = @{ @"pet" : @"cat", @"name" : @"name4" };
+            NSDictionary *plan = [im explain:query];
+            expect(plan[@"tree"][@"children"][0][@"index"]).to.equal(@"catnames");
+            expect([NSSet setWithArray:[im find:query].documentIds])
+                .to.equal([NSSet setWithArray:@[ @"doc4", @"doc24" ]]);
+
+            query = @{ @"pet" : @"dog", @"name" : @"name5" };
+            plan = [im explain:query];
+            expect(plan[@"tree"][@"children"][0][@"index"]).toNot.equal(@"catnames");
+            expect([NSSet setWithArray:[im find:query].documentIds])
+                .to.equal([NSSet setWithArray:@[ @"doc5", @"doc25" ]]);
+
+            // A document which stops matching the selector leaves the index.
+            CDTDocumentRevision *rev = [ds getDocumentWithId:@"doc4" error:nil];
+            rev.body = [@{ @"name" : @"name4", @"pet" : @"dog" } mutableCopy];
+            expect([ds updateDocumentFromRevision:rev error:nil]).toNot.beNil();
+            expect([im find:@{ @"pet" : @"cat", @"name" : @"name4" }].documentIds)
+                .to.equal(@[ @"doc24" ]);
+        });
+
+        it(@"rejects partial text indexes and text search selectors", ^{
+            expect([im ensureIndexed:@[ @"name" ]
+                            withName:@"textnames"
+                              ofType:CDTQIndexTypeText
+                            settings:nil
+                            selector:@{ @"pet" : @"cat" }]).to.beNil();
+            expect([im ensureIndexed:@[ @"name" ]
+                            withName:@"searched"
+                              ofType:CDTQIndexTypeJSON
+                            settings:nil
+                            selector:@{ @"$text" : @{ @"$search" : @"cat" } }]).to.beNil();
+        });
+
+        it(@"runs the most selective AND clause first", ^{
+            NSDictionary *query = @{
+                @"$and" : @[
+                    @{ @"$or" : @[ @{ @"pet" : @"cat" }, @{ @"pet" : @"dog" } ] },
+                    @{ @"$or" : @[ @{ @"name" : @"name3" }, @{ @"name" : @"name4" } ] }
+                ]
+            };
+            NSDictionary *plan = [im explain:query];
+            expect(plan[@"strategy"]).to.equal(@"tree");
+
+            NSArray *children = plan[@"tree"][@"children"];
+            expect(children.count).to.equal(2);
+            expect(children[0][@"children"][0][@"index"]).to.equal(@"name");
+            expect(children[1][@"children"][0][@"index"]).to.equal(@"pet");
+            expect([children[0][@"estimatedRows"] doubleValue]).to.beCloseTo(4);
+            expect([children[1][@"estimatedRows"] doubleValue]).to.beCloseTo(20);
+
+            NSArray *docIds = [im find:query].documentIds;
+            expect([NSSet setWithArray:docIds]).to.equal([NSSet setWithArray:@[ @"doc4", @"doc24" ]]);
+        });
+
+        it(@"runs the whole tree as one statement", ^{
+            NSDictionary *query = @{
+                @"$or" : @[
+                    @{ @"$and" : @[ @{ @"pet" : @"cat" }, @{ @"name" : @"name4" } ] },
+                    @{ @"name" : @"name3" }
+                ]
+            };
+            NSDictionary *plan = [im explain:query];
+            expect(plan[@"strategy"]).to.equal(@"tree");
+            expect(plan[@"sql"]).to.contain(@" UNION ");
+            expect(plan[@"sql"]).to.contain(@"_id IN (");
+            expect(plan[@"parameters"]).to.equal(@[ @"name4", @"cat", @"name3" ]);
+
+            NSArray *docIds = [im find:query].documentIds;
+            NSSet *expected = [NSSet setWithArray:@[ @"doc3", @"doc4", @"doc23", @"doc24" ]];
+            expect([NSSet setWithArray:docIds]).to.equal(expected);
+        });
+
+        it(@"projects results from a covering index without loading documents", ^{
+            expect([im ensureIndexed:@[ @"name", @"pet" ] withName:@"namepet"]).toNot.beNil();
+            expect([im listIndexes][@"namepet"][@"covering"]).to.equal(@YES);
+
+            __block NSUInteger count = 0;
+            CDTQResultSet *result = [im find:@{ @"name" : @"name1", @"pet" : @"dog" }
+                                        skip:0
+                                       limit:0
+                                      fields:@[ @"pet", @"_id" ]
+                                        sort:nil];
+            [result enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger idx, BOOL *stop) {
+                expect(rev).to.beKindOf([CDTQProjectedDocumentRevision class]);
+                expect(rev.sequence).to.equal(0);  // not loaded from the datastore
+                expect(rev.body).to.equal(@{ @"pet" : @"dog", @"_id" : [NSNull null] });
+                CDTDocumentRevision *saved = [ds getDocumentWithId:rev.docId error:nil];
+                expect(rev.revId).to.equal(saved.revId);
+                count++;
+            }];
+            expect(count).to.equal(2);
+            expect(result.documentIds).to.containsInAnyOrder(@[ @"doc1", @"doc21" ]);
+        });
+
+        it(@"stops covering once a value the index can't hold is indexed", ^{
+            expect([im ensureIndexed:@[ @"name", @"pet" ] withName:@"namepet"]).toNot.beNil();
+            CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"arrays"];
+            rev.body = [@{ @"name" : @"name1", @"pet" : @[ @"dog", @"cat" ] } mutableCopy];
+            expect([ds createDocumentFromRevision:rev error:nil]).toNot.beNil();
+
+            CDTQResultSet *result = [im find:@{ @"name" : @"name1", @"pet" : @"dog" }
+                                        skip:0
+                                       limit:0
+                                      fields:@[ @"pet" ]
+                                        sort:nil];
+            expect([im listIndexes][@"namepet"][@"covering"]).to.equal(@NO);
+            NSMutableDictionary *pets = [NSMutableDictionary dictionary];
+            [result enumerateObjectsUsingBlock:^(CDTDocumentRevision *r, NSUInteger idx, BOOL *stop) {
+                expect(r.sequence).to.beGreaterThan(0);
+                pets[r.docId] = r.body[@"pet"];
+            }];
+            expect(pets).to.equal(
+                @{ @"doc1" : @"dog", @"doc21" : @"dog", @"arrays" : @[ @"dog", @"cat" ] });
+        });
+
+        it(@"reports when documents must be matched by hand", ^{
+            NSDictionary *plan = [im explain:@{ @"age" : @12 }];
+            expect(plan[@"indexesCoverQuery"]).to.equal(@NO);
+        });
+
+        it(@"returns nil for an invalid sort", ^{
+            expect([im explain:@{ @"name" : @"name3" } sort:@[ @"name" ]]).to.beNil();
+        });
+    });
+
+    describe(@"when caching queries", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTDatastore *ds;
+        __block CDTQIndexManager *im;
+
+        beforeEach(^{
+            factoryPath = [NSTemporaryDirectory()
+                stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:nil];
+            ds = [factory datastoreNamed:@"test" error:nil];
+            expect(ds).toNot.beNil();
+
+            for (NSUInteger i = 0; i < 10; i++) {
+                CDTDocumentRevision *rev = [CDTDocumentRevision
+                    revisionWithDocId:[NSString stringWithFormat:@"doc%lu", (unsigned long)i]];
+                rev.body = [@{ @"name" : @"mike", @"age" : @(i) } mutableCopy];
+                [ds createDocumentFromRevision:rev error:nil];
+            }
+
+            im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect(im).toNot.beNil();
+            expect([im ensureIndexed:@[ @"name", @"age" ] withName:@"basic"]).toNot.beNil();
+        });
+
+        afterEach(^{
+            im = nil;
+            factory = nil;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:nil];
+        });
+
+        it(@"reuses the plan of a repeated query", ^{
+            NSDictionary *query = @{ @"name" : @"mike", @"age" : @{ @"$gt" : @4 } };
+            NSString *key = [CDTQQueryCache keyForQuery:query sort:nil fields:nil];
+            expect([im.queryCache planForKey:key]).to.beNil();
+
+            CDTQResultSet *first = [im find:query];
+            expect(first.documentIds.count).to.equal(5);
+            CDTQQueryPlan *plan = [im.queryCache planForKey:key];
+            expect(plan).toNot.beNil();
+
+            CDTQResultSet *second = [im find:query];
+            expect([NSSet setWithArray:second.documentIds])
+                .to.equal([NSSet setWithArray:first.documentIds]);
+            expect([im.queryCache planForKey:key]).to.beIdenticalTo(plan);
+            // Results aren't cached unless asked for.
+            expect(second).toNot.beIdenticalTo(first);
+        });
+
+        it(@"drops plans when an index is created or deleted", ^{
+            NSDictionary *query = @{ @"age" : @3 };
+            NSString *key = [CDTQQueryCache keyForQuery:query sort:nil fields:nil];
+            expect([im find:query].documentIds).to.equal(@[ @"doc3" ]);
+            expect([im.queryCache planForKey:key]).toNot.beNil();
+
+            expect([im ensureIndexed:@[ @"age" ] withName:@"age"]).toNot.beNil();
+            expect([im.queryCache planForKey:key]).to.beNil();
+            expect([im find:query].documentIds).to.equal(@[ @"doc3" ]);
+
+            expect([im deleteIndexNamed:@"age"]).to.beTruthy();
+            expect([im.queryCache planForKey:key]).to.beNil();
+            expect([im find:query].documentIds).to.equal(@[ @"doc3" ]);
+        });
+
+        it(@"caches results until the datastore changes", ^{
+            im.queryCache.resultCachingEnabled = YES;
+            NSDictionary *query = @{ @"name" : @"mike" };
+
+            CDTQResultSet *first = [im find:query skip:0 limit:3 fields:nil sort:nil];
+            expect(first.documentIds.count).to.equal(3);
+            expect([im find:query skip:0 limit:3 fields:nil sort:nil]).to.beIdenticalTo(first);
+            // A different page is cached on its own.
+            expect([im find:query skip:3 limit:3 fields:nil sort:nil]).toNot.beIdenticalTo(first);
+
+            CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"doc10"];
+            rev.body = [@{ @"name" : @"mike", @"age" : @10 } mutableCopy];
+            [ds createDocumentFromRevision:rev error:nil];
+
+            CDTQResultSet *afterWrite = [im find:query skip:0 limit:0 fields:nil sort:nil];
+            expect(afterWrite.documentIds.count).to.equal(11);
+            expect([im find:query skip:0 limit:3 fields:nil sort:nil]).toNot.beIdenticalTo(first);
+        });
+
+        it(@"forgets documents purged when they expire", ^{
+            im.queryCache.resultCachingEnabled = YES;
+            NSDictionary *query = @{ @"name" : @"mike" };
+            expect([im find:query].documentIds.count).to.equal(10);
+            expect([im count:query]).to.equal(10);
+
+            expect([ds setExpiryDate:[NSDate distantPast] forDocumentWithId:@"doc3" error:nil])
+                .to.beTruthy();
+            NSUInteger purged = 0;
+            BOOL finished = NO;
+            expect([ds purgeExpiredDocumentsWithTimeBudget:10 purged:&purged finished:&finished
+                                                     error:nil]).to.beTruthy();
+            expect(purged).to.equal(1);
+            expect(finished).to.beTruthy();
+
+            // Nothing was added to the changes feed, so the index rows went on being found.
+            NSArray *docIds = [im find:query].documentIds;
+            expect(docIds.count).to.equal(9);
+            expect(docIds).toNot.contain(@"doc3");
+            expect([im find:@{ @"age" : @3 }].documentIds).to.equal(@[]);
+            expect([im count:query]).to.equal(9);
+            NSArray *results = [im aggregate:query
+                                  aggregates:@{ @"n" : @{ @"$count" : @"_id" } }
+                                     groupBy:nil];
+            expect(results).to.equal(@[ @{ @"n" : @9 } ]);
+        });
+
+        it(@"forgets pulled through documents when they're evicted", ^{
+            im.queryCache.resultCachingEnabled = YES;
+            NSDictionary *query = @{ @"name" : @"mike" };
+            expect([im count:query]).to.equal(10);
+
+            expect([ds.database notePulledThroughDocumentIDs:@[ @"doc4", @"doc5" ]])
+                .to.equal(kTDStatusOK);
+            NSUInteger evicted = 0;
+            expect([ds evictPulledThroughDocumentsOlderThan:-60 evicted:&evicted error:nil])
+                .to.beTruthy();
+            expect(evicted).to.equal(2);
+
+            NSArray *docIds = [im find:query].documentIds;
+            expect(docIds.count).to.equal(8);
+            expect(docIds).toNot.contain(@"doc4");
+            expect(docIds).toNot.contain(@"doc5");
+            expect([im count:query]).to.equal(8);
+        });
+    });
+
+    describe(@"when advising indexes", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTQIndexManager *im;
+
+        beforeEach(^{
+            factoryPath = [NSTemporaryDirectory()
+                stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:nil];
+            CDTDatastore *ds = [factory datastoreNamed:@"test" error:nil];
+            expect(ds).toNot.beNil();
+
+            for (NSUInteger i = 0; i < 10; i++) {
+                CDTDocumentRevision *rev = [CDTDocumentRevision
+                    revisionWithDocId:[NSString stringWithFormat:@"doc%lu", (unsigned long)i]];
+                rev.body = [@{
+                    @"name" : [NSString stringWithFormat:@"name%lu", (unsigned long)i],
+                    @"town" : i % 2 ? @"bristol" : @"bath",
+                    @"age" : @(i)
+                } mutableCopy];
+                [ds createDocumentFromRevision:rev error:nil];
+            }
+
+            im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect(im).toNot.beNil();
+            expect([im ensureIndexed:@[ @"name" ] withName:@"names"]).toNot.beNil();
+        });
+
+        afterEach(^{
+            im = nil;
+            factory = nil;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:nil];
+        });
+
+        it(@"records the shapes of unindexed queries without their values", ^{
+            expect([im find:@{ @"name" : @"name3" }].documentIds).to.equal(@[ @"doc3" ]);
+            expect(im.indexAdvisor.shapes).to.haveCountOf(0);
+
+            NSArray *sort = @[ @{ @"name" : @"asc" } ];
+            for (NSNumber *age in @[ @4, @6 ]) {
+                NSDictionary *query = @{ @"town" : @"bristol", @"age" : @{ @"$gt" : age } };
+                expect([im find:query skip:0 limit:0 fields:nil sort:sort].documentIds)
+                    .toNot.beEmpty();
+            }
+
+            NSArray<CDTQQueryShape *> *shapes = im.indexAdvisor.shapes;
+            expect(shapes).to.haveCountOf(1);
+            expect(shapes[0].count).to.equal(2);
+            expect(shapes[0].unindexedCount).to.equal(2);
+            // Every document is a candidate, as no index holds town or age.
+            expect(shapes[0].totalCandidateCount).to.equal(20);
+            expect(shapes[0].operatorsByField)
+                .to.equal((@{ @"town" : @[ @"$eq" ], @"age" : @[ @"$gt" ] }));
+            expect(shapes[0].sort).to.equal(sort);
+            expect(im.suggestedIndexes).to.equal((@[ @[ @"town", @"age", @"name" ] ]));
+        });
+
+        it(@"creates suggested indexes within the budget", ^{
+            for (NSUInteger i = 0; i < 2; i++) {
+                [im find:@{ @"town" : @"bath" }];
+                [im find:@{ @"age" : @{ @"$lt" : @3 } }];
+            }
+            expect(im.suggestedIndexes).to.haveCountOf(2);
+
+            NSArray *created = [im ensureSuggestedIndexesWithBudget:1];
+            expect(created).to.haveCountOf(1);
+            expect([created[0] hasPrefix:@"advised_"]).to.beTruthy();
+            expect(im.suggestedIndexes).to.haveCountOf(1);
+
+            // The index made earlier uses up the budget.
+            expect([im ensureSuggestedIndexesWithBudget:1]).to.equal(@[]);
+            expect([im ensureSuggestedIndexesWithBudget:2]).to.haveCountOf(1);
+            expect(im.suggestedIndexes).to.equal(@[]);
+            expect([im listIndexes]).to.haveCountOf(3);
+        });
+    });
+
+    describe(@"when creating several indexes at once", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTDatastore *ds;
+        __block CDTQIndexManager *im;
+
+        beforeEach(^{
+            factoryPath = [NSTemporaryDirectory()
+                stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:nil];
+            ds = [factory datastoreNamed:@"test" error:nil];
+            expect(ds).toNot.beNil();
+
+            for (NSUInteger i = 0; i < 20; i++) {
+                CDTDocumentRevision *rev = [CDTDocumentRevision
+                    revisionWithDocId:[NSString stringWithFormat:@"doc%lu", (unsigned long)i]];
+                rev.body = [@{ @"name" : (i % 2 ? @"mike" : @"fred"), @"age" : @(i) } mutableCopy];
+                [ds createDocumentFromRevision:rev error:nil];
+            }
+
+            im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect(im).toNot.beNil();
+        });
+
+        afterEach(^{
+            im = nil;
+            factory = nil;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:nil];
+        });
+
+        it(@"fills and indexes the tables of the new indexes", ^{
+            NSArray *names = [im ensureIndexes:@[
+                [CDTQIndex index:@"name" withFields:@[ @"name" ]],
+                [CDTQIndex index:@"age" withFields:@[ @"age" ]]
+            ]];
+            expect(names).to.equal(@[ @"name", @"age" ]);
+            expect([im listIndexes].count).to.equal(2);
+            expect([im indexSequenceLag]).to.equal(@{ @"name" : @0, @"age" : @0 });
+
+            expect([im find:@{ @"name" : @"mike" }].documentIds.count).to.equal(10);
+            expect([im find:@{ @"age" : @{ @"$lt" : @5 } }].documentIds.count).to.equal(5);
+
+            // Each table has its SQLite index, created after the table was filled.
+            [im.database inDatabase:^(FMDatabase *db) {
+                for (NSString *name in names) {
+                    NSString *table = [kCDTQIndexTablePrefix stringByAppendingString:name];
+                    FMResultSet *rs = [db executeQuery:@"SELECT COUNT(*) FROM sqlite_master "
+                                                       @"WHERE type = 'index' AND tbl_name = ?"
+                                  withArgumentsInArray:@[ table ]];
+                    expect([rs next]).to.beTruthy();
+                    expect([rs intForColumnIndex:0]).to.equal(1);
+                    [rs close];
+
+                    rs = [db executeQuery:[NSString stringWithFormat:@"SELECT COUNT(*) FROM \"%@\"",
+                                                                     table]];
+                    expect([rs next]).to.beTruthy();
+                    expect([rs intForColumnIndex:0]).to.equal(20);
+                    [rs close];
+                }
+            }];
+        });
+
+        it(@"uses existing indexes and updates them", ^{
+            expect([im ensureIndexed:@[ @"name" ] withName:@"name"]).to.equal(@"name");
+
+            CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"doc20"];
+            rev.body = [@{ @"name" : @"mike", @"age" : @20 } mutableCopy];
+            [ds createDocumentFromRevision:rev error:nil];
+
+            NSArray *names = [im ensureIndexes:@[
+                [CDTQIndex index:@"name" withFields:@[ @"name" ]],
+                [CDTQIndex index:@"age" withFields:@[ @"age" ]]
+            ]];
+            expect(names).to.equal(@[ @"name", @"age" ]);
+            expect([im indexSequenceLag]).to.equal(@{ @"name" : @0, @"age" : @0 });
+            expect([im find:@{ @"name" : @"mike" }].documentIds.count).to.equal(11);
+            expect([im find:@{ @"age" : @20 }].documentIds).to.equal(@[ @"doc20" ]);
+        });
+
+        it(@"creates none of the indexes if one is invalid", ^{
+            expect([im ensureIndexed:@[ @"name" ] withName:@"name"]).to.equal(@"name");
+
+            // A different definition of an existing index.
+            expect([im ensureIndexes:@[
+                [CDTQIndex index:@"age" withFields:@[ @"age" ]],
+                [CDTQIndex index:@"name" withFields:@[ @"age" ]]
+            ]]).to.beNil();
+            // The same name twice.
+            expect([im ensureIndexes:@[
+                [CDTQIndex index:@"age" withFields:@[ @"age" ]],
+                [CDTQIndex index:@"age" withFields:@[ @"name" ]]
+            ]]).to.beNil();
+
+            expect([[im listIndexes] allKeys]).to.equal(@[ @"name" ]);
+        });
+
+        it(@"replaces the rows of documents changed after the build", ^{
+            NSArray *names = [im ensureIndexes:@[ [CDTQIndex index:@"age" withFields:@[ @"age" ]] ]];
+            expect(names).to.equal(@[ @"age" ]);
+
+            CDTDocumentRevision *rev = [ds getDocumentWithId:@"doc3" error:nil];
+            rev.body = [@{ @"name" : @"fred", @"age" : @30 } mutableCopy];
+            expect([ds updateDocumentFromRevision:rev error:nil]).toNot.beNil();
+
+            expect([im find:@{ @"age" : @3 }].documentIds.count).to.equal(0);
+            expect([im find:@{ @"age" : @30 }].documentIds).to.equal(@[ @"doc3" ]);
+        });
+    });
+
+    describe(@"when indexing typed fields", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTDatastore *ds;
+        __block CDTQIndexManager *im;
+
+        beforeEach(^{
+            factoryPath = [NSTemporaryDirectory()
+                stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:nil];
+            ds = [factory datastoreNamed:@"test" error:nil];
+            expect(ds).toNot.beNil();
+
+            NSArray *bodies = @[
+                @{ @"name" : @"mike", @"age" : @12, @"born" : @"2006-03-01T10:00:00Z" },
+                @{ @"name" : @"fred", @"age" : @34, @"born" : @"1984-07-21T09:30:00+02:00" },
+                @{ @"name" : @"john", @"age" : @"old", @"born" : @448704000000 },
+                @{ @"name" : @"bill", @"age" : @2.5 },
+            ];
+            for (NSUInteger i = 0; i < bodies.count; i++) {
+                CDTDocumentRevision *rev = [CDTDocumentRevision
+                    revisionWithDocId:[NSString stringWithFormat:@"doc%lu", (unsigned long)i]];
+                rev.body = [bodies[i] mutableCopy];
+                [ds createDocumentFromRevision:rev error:nil];
+            }
+
+            im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect(im).toNot.beNil();
+            expect([im ensureIndexed:@[ @"age", @"name" ]
+                            withName:@"ages"
+                          fieldTypes:@{ @"age" : @(CDTQFieldTypeInteger) }])
+                .to.equal(@"ages");
+            expect([im ensureIndexed:@[ @"born" ]
+                            withName:@"births"
+                          fieldTypes:@{ @"born" : @(CDTQFieldTypeDate) }])
+                .to.equal(@"births");
+        });
+
+        afterEach(^{
+            im = nil;
+            factory = nil;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:nil];
+        });
+
+        it(@"declares typed columns and a seek index", ^{
+            expect([im listIndexes][@"ages"][@"fieldTypes"]).to.equal(@{ @"age" : @"integer" });
+            expect([im listIndexes][@"births"][@"covering"]).to.equal(@NO);
+
+            [im.database inDatabase:^(FMDatabase *db) {
+                NSString *table = [kCDTQIndexTablePrefix stringByAppendingString:@"ages"];
+                NSMutableDictionary *columnTypes = [NSMutableDictionary dictionary];
+                FMResultSet *rs = [db executeQuery:[NSString stringWithFormat:@"PRAGMA table_info(\"%@\")",
+                                                                              table]];
+                while ([rs next]) {
+                    columnTypes[[rs stringForColumn:@"name"]] = [rs stringForColumn:@"type"];
+                }
+                [rs close];
+                expect(columnTypes[@"age"]).to.equal(@"INTEGER");
+                expect(columnTypes[@"name"]).to.equal(@"NONE");
+
+                rs = [db executeQuery:@"SELECT COUNT(*) FROM sqlite_master WHERE name = ?"
+                    withArgumentsInArray:@[ [table stringByAppendingString:@"_seek"] ]];
+                expect([rs next]).to.beTruthy();
+                expect([rs intForColumnIndex:0]).to.equal(1);
+                [rs close];
+            }];
+        });
+
+        it(@"finds values of the declared type", ^{
+            expect([NSSet setWithArray:[im find:@{ @"age" : @{ @"$gt" : @10 } }].documentIds])
+                .to.equal([NSSet setWithArray:@[ @"doc0", @"doc1" ]]);
+            expect([im explain:@{ @"age" : @{ @"$gt" : @10 } }][@"tree"][@"children"][0][@"index"])
+                .to.equal(@"ages");
+
+            // Dates compare as instants, whatever their form.
+            NSDictionary *query = @{ @"born" : @{ @"$lt" : @"1990-01-01" } };
+            expect([NSSet setWithArray:[im find:query].documentIds])
+                .to.equal([NSSet setWithArray:@[ @"doc1", @"doc2" ]]);
+            NSArray *sorted = [im find:@{ @"born" : @{ @"$exists" : @YES } }
+                                  skip:0
+                                 limit:0
+                                fields:nil
+                                  sort:@[ @{ @"born" : @"asc" } ]]
+                                  .documentIds;
+            expect(sorted).to.equal(@[ @"doc2", @"doc1", @"doc0" ]);
+        });
+
+        it(@"doesn't use the index to compare with other types", ^{
+            NSDictionary *query = @{ @"age" : @{ @"$eq" : @"old" } };
+            NSDictionary *plan = [im explain:query];
+            expect(plan[@"indexesCoverQuery"]).to.equal(@NO);
+            expect([plan[@"tree"][@"children"] count]).to.equal(0);
+            expect([im find:query].documentIds).to.equal(@[ @"doc2" ]);
+        });
+
+        it(@"fails when the same index is declared with other types", ^{
+            expect([im ensureIndexed:@[ @"age", @"name" ] withName:@"ages"]).to.beNil();
+            expect([im ensureIndexed:@[ @"age", @"name" ]
+                            withName:@"ages"
+                          fieldTypes:@{ @"age" : @(CDTQFieldTypeReal) }])
+                .to.beNil();
+            expect([im ensureIndexed:@[ @"age", @"name" ]
+                            withName:@"ages"
+                          fieldTypes:@{ @"age" : @(CDTQFieldTypeInteger) }])
+                .to.equal(@"ages");
+            expect([im ensureIndexed:@[ @"age" ]
+                            withName:@"pets"
+                          fieldTypes:@{ @"pet" : @(CDTQFieldTypeText) }])
+                .to.beNil();
+        });
+    });
+
+    describe(@"when indexing expressions", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTDatastore *ds;
+        __block CDTQIndexManager *im;
+
+        beforeEach(^{
+            expect([CDTQIndexManager registerExpression:^id(NSDictionary *body) {
+                NSString *name = body[@"name"];
+                return [name isKindOfClass:[NSString class]] ? name.lowercaseString : nil;
+            }
+                                               withName:@"@lowerName"])
+                .to.beTruthy();
+            expect([CDTQIndexManager registerExpression:^id(NSDictionary *body) {
+                NSArray *tags = body[@"tags"];
+                return [tags isKindOfClass:[NSArray class]] ? @(tags.count) : nil;
+            }
+                                               withName:@"@tagCount"])
+                .to.beTruthy();
+
+            factoryPath = [NSTemporaryDirectory()
+                stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:nil];
+            ds = [factory datastoreNamed:@"test" error:nil];
+            expect(ds).toNot.beNil();
+
+            NSArray *bodies = @[
+                @{ @"name" : @"Mike", @"tags" : @[ @"a", @"b" ], @"pet" : @"cat" },
+                @{ @"name" : @"MIKE", @"tags" : @[ @"a" ], @"pet" : @"dog" },
+                @{ @"name" : @"fred", @"tags" : @[ @"a", @"b", @"c" ], @"pet" : @"cat" },
+                @{ @"name" : @"john" },
+            ];
+            for (NSUInteger i = 0; i < bodies.count; i++) {
+                CDTDocumentRevision *rev = [CDTDocumentRevision
+                    revisionWithDocId:[NSString stringWithFormat:@"doc%lu", (unsigned long)i]];
+                rev.body = [bodies[i] mutableCopy];
+                [ds createDocumentFromRevision:rev error:nil];
+            }
+
+            im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect(im).toNot.beNil();
+            expect([im ensureIndexed:@[ @"@lowerName", @"@tagCount" ] withName:@"computed"])
+                .to.equal(@"computed");
+        });
+
+        afterEach(^{
+            [CDTQIndexManager unregisterExpressionNamed:@"@lowerName"];
+            [CDTQIndexManager unregisterExpressionNamed:@"@tagCount"];
+            im = nil;
+            factory = nil;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:nil];
+        });
+
+        it(@"finds documents by an expression using its index", ^{
+            NSDictionary *query = @{ @"@lowerName" : @"mike" };
+            NSDictionary *plan = [im explain:query];
+            expect(plan[@"indexesCoverQuery"]).to.equal(@YES);
+            expect(plan[@"tree"][@"children"][0][@"index"]).to.equal(@"computed");
+            expect([NSSet setWithArray:[im find:query].documentIds])
+                .to.equal([NSSet setWithArray:@[ @"doc0", @"doc1" ]]);
+        });
+
+        it(@"sorts by an expression", ^{
+            NSArray *sorted = [im find:@{ @"@tagCount" : @{ @"$gt" : @0 } }
+                                  skip:0
+                                 limit:0
+                                fields:nil
+                                  sort:@[ @{ @"@tagCount" : @"desc" } ]]
+                                  .documentIds;
+            expect(sorted).to.equal(@[ @"doc2", @"doc0", @"doc1" ]);
+        });
+
+        it(@"matches expressions on documents the indexes don't cover", ^{
+            NSDictionary *query = @{ @"pet" : @"cat", @"@tagCount" : @{ @"$lt" : @3 } };
+            expect([im explain:query][@"indexesCoverQuery"]).to.equal(@NO);
+            expect([im find:query].documentIds).to.equal(@[ @"doc0" ]);
+        });
+
+        it(@"indexes documents written later", ^{
+            CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"doc4"];
+            rev.body = [@{ @"name" : @"Mike" } mutableCopy];
+            [ds createDocumentFromRevision:rev error:nil];
+            expect([NSSet setWithArray:[im find:@{ @"@lowerName" : @"mike" }].documentIds])
+                .to.equal([NSSet setWithArray:@[ @"doc0", @"doc1", @"doc4" ]]);
+        });
+
+        it(@"rejects invalid and unregistered expressions", ^{
+            CDTQExpressionBlock nothing = ^id(NSDictionary *body) { return nil; };
+            expect([CDTQIndexManager registerExpression:nothing withName:@"noPrefix"]).to.beFalsy();
+            expect([CDTQIndexManager registerExpression:nothing withName:@"@"]).to.beFalsy();
+            expect([CDTQIndexManager registerExpression:nothing withName:@"@a.b"]).to.beFalsy();
+
+            expect([im ensureIndexed:@[ @"@unknown" ] withName:@"unknown"]).to.beNil();
+
+            // Without its expression the index can't be brought up to date.
+            [CDTQIndexManager unregisterExpressionNamed:@"@lowerName"];
+            CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"doc4"];
+            rev.body = [@{ @"name" : @"Mike" } mutableCopy];
+            [ds createDocumentFromRevision:rev error:nil];
+            expect([im find:@{ @"@lowerName" : @"mike" }]).to.beNil();
+        });
+    });
+
+    describe(@"when running live queries", ^{
+
+        __block NSString *factoryPath;
+        __block CDTDatastoreManager *factory;
+        __block CDTDatastore *ds;
+        __block CDTQIndexManager *im;
+        __block NSMutableArray<CDTQLiveQueryChanges *> *changes;
+        __block CDTQLiveQuery *liveQuery;
+
+        NSArray * (^docIds)(NSArray<CDTDocumentRevision *> *) = ^(NSArray *revs) {
+            return [revs valueForKey:@"docId"];
+        };
+
+        beforeEach(^{
+            factoryPath = [NSTemporaryDirectory()
+                stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+            factory = [[CDTDatastoreManager alloc] initWithDirectory:factoryPath error:nil];
+            ds = [factory datastoreNamed:@"test" error:nil];
+            expect(ds).toNot.beNil();
+
+            NSDictionary *people = @{
+                @"mike" : @{ @"pet" : @"cat", @"age" : @12 },
+                @"fred" : @{ @"pet" : @"cat", @"age" : @34 },
+                @"john" : @{ @"pet" : @"dog", @"age" : @20 }
+            };
+            for (NSString *docId in people) {
+                CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:docId];
+                rev.body = [people[docId] mutableCopy];
+                [ds createDocumentFromRevision:rev error:nil];
+            }
+
+            im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+            expect(im).toNot.beNil();
+            expect([im ensureIndexed:@[ @"pet", @"age" ] withName:@"pets"]).toNot.beNil();
+
+            changes = [NSMutableArray array];
+            liveQuery = [im liveQuery:@{ @"pet" : @"cat" }
+                                 sort:@[ @{ @"age" : @"asc" } ]
+                                queue:nil
+                              handler:^(CDTQLiveQueryChanges *c) {
+                                  [changes addObject:c];
+                              }];
+            expect(liveQuery).toNot.beNil();
+            expect(changes.count).will.equal(1);
+        });
+
+        afterEach(^{
+            [liveQuery stop];
+            liveQuery = nil;
+            im = nil;
+            factory = nil;
+            [[NSFileManager defaultManager] removeItemAtPath:factoryPath error:nil];
+        });
+
+        it(@"delivers the initial results as insertions", ^{
+            expect(docIds(changes[0].results)).to.equal(@[ @"mike", @"fred" ]);
+            expect(changes[0].insertedIndexes)
+                .to.equal([NSIndexSet indexSetWithIndexesInRange:NSMakeRange(0, 2)]);
+            expect(changes[0].deletedIndexes.count).to.equal(0);
+        });
+
+        it(@"delivers inserts, updates and deletes in sort order", ^{
+            CDTDocumentRevision *john = [ds getDocumentWithId:@"john" error:nil];
+            CDTDocumentRevision *update = [john copy];
+            update.body = [@{ @"pet" : @"cat", @"age" : @20 } mutableCopy];
+            expect([ds updateDocumentFromRevision:update error:nil]).toNot.beNil();
+            expect(changes.count).will.equal(2);
+            expect(docIds(changes[1].results)).to.equal(@[ @"mike", @"john", @"fred" ]);
+            expect(changes[1].insertedIndexes).to.equal([NSIndexSet indexSetWithIndex:1]);
+
+            CDTDocumentRevision *mike = [ds getDocumentWithId:@"mike" error:nil];
+            update = [mike copy];
+            update.body = [@{ @"pet" : @"cat", @"age" : @12, @"name" : @"mike" } mutableCopy];
+            expect([ds updateDocumentFromRevision:update error:nil]).toNot.beNil();
+            expect(changes.count).will.equal(3);
+            expect(changes[2].updatedIndexes).to.equal([NSIndexSet indexSetWithIndex:0]);
+            expect(changes[2].results[0].body[@"name"]).to.equal(@"mike");
+
+            // Moving in the sort order is a delete and an insert.
+            CDTDocumentRevision *fred = [ds getDocumentWithId:@"fred" error:nil];
+            update = [fred copy];
+            update.body = [@{ @"pet" : @"cat", @"age" : @1 } mutableCopy];
+            expect([ds updateDocumentFromRevision:update error:nil]).toNot.beNil();
+            expect(changes.count).will.equal(4);
+            expect(docIds(changes[3].results)).to.equal(@[ @"fred", @"mike", @"john" ]);
+            expect(changes[3].deletedIndexes).to.equal([NSIndexSet indexSetWithIndex:2]);
+            expect(changes[3].insertedIndexes).to.equal([NSIndexSet indexSetWithIndex:0]);
+
+            john = [ds getDocumentWithId:@"john" error:nil];
+            expect([ds deleteDocumentFromRevision:john error:nil]).toNot.beNil();
+            expect(changes.count).will.equal(5);
+            expect(docIds(changes[4].results)).to.equal(@[ @"fred", @"mike" ]);
+            expect(changes[4].deletedIndexes).to.equal([NSIndexSet indexSetWithIndex:2]);
+            expect(docIds(liveQuery.results)).to.equal(@[ @"fred", @"mike" ]);
+        });
+
+        it(@"ignores changes to documents that neither match nor matched", ^{
+            CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"rex"];
+            rev.body = [@{ @"pet" : @"dog", @"age" : @3 } mutableCopy];
+            [ds createDocumentFromRevision:rev error:nil];
+            rev = [CDTDocumentRevision revisionWithDocId:@"tom"];
+            rev.body = [@{ @"pet" : @"cat", @"age" : @50 } mutableCopy];
+            [ds createDocumentFromRevision:rev error:nil];
+            expect(changes.count).will.equal(2);
+            expect(docIds(changes[1].results)).to.equal(@[ @"mike", @"fred", @"tom" ]);
+            expect(changes[1].insertedIndexes).to.equal([NSIndexSet indexSetWithIndex:2]);
+        });
+
+        it(@"rejects text searches and stops delivering once stopped", ^{
+            expect([im liveQuery:@{ @"$text" : @{ @"$search" : @"cat" } }
+                             sort:nil
+                            queue:nil
+                          handler:^(CDTQLiveQueryChanges *c){
+                          }])
+                .to.beNil();
+
+            [liveQuery stop];
+            CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"tom"];
+            rev.body = [@{ @"pet" : @"cat", @"age" : @50 } mutableCopy];
+            [ds createDocumentFromRevision:rev error:nil];
+            [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.2]];
+            expect(changes.count).to.equal(1);
+        });
+    });
+
 SpecEnd
@@ -11,6 +11,7 @@
 #import <OTFCDTDatastore/CDTQQueryExecutor.h>
 #import <OTFCDTDatastore/CDTQResultSet.h>
 #import <OTFCDTDatastore/CloudantSync.h>
+#import <FMDB/FMDB.h>
 #import <Expecta/Expecta.h>
 #import <Specta/Specta.h>
 
@@ -85,6 +86,19 @@ SpecBegin(CDTQIndexUpdater)
                 expect(parts.placeholderValues).to.equal(@[ @"123" ]);
             });
 
+            it(@"returns correctly for several documents", ^{
+                CDTQSqlParts *parts =
+                    [CDTQIndexUpdater partsToDeleteIndexEntriesForDocIds:@[ @"123", @"456" ]
+                                                               fromIndex:@"anIndex"];
+                NSString *sql = @"DELETE FROM \"_t_cloudant_sync_query_index_anIndex\" "
+                                @"WHERE _id IN ( ?, ? );";
+                expect(parts.sqlWithPlaceholders).to.equal(sql);
+                expect(parts.placeholderValues).to.equal((@[ @"123", @"456" ]));
+                expect([CDTQIndexUpdater partsToDeleteIndexEntriesForDocIds:@[]
+                                                                  fromIndex:@"anIndex"])
+                    .to.beNil();
+            });
+
         });
 
         describe(@"when generating INSERT statements", ^{
@@ -313,6 +327,86 @@ SpecBegin(CDTQIndexUpdater)
 
             });
 
+            context(@"when indexing for a multikey index", ^{
+
+                it(@"indexes every combination of several array fields", ^{
+                    CDTDocumentRevision *rev;
+                    rev = [CDTDocumentRevision revisionWithDocId:@"id123"];
+                    rev.body = [@{
+                        @"name" : @"mike",
+                        @"pet" : @[ @"cat", @"dog" ],
+                        @"pet2" : @[ @"fish" ]
+                    } mutableCopy];
+                    CDTDocumentRevision *saved = [ds createDocumentFromRevision:rev error:nil];
+                    NSArray *statements =
+                        [CDTQIndexUpdater partsToIndexRevision:saved
+                                                       inIndex:@"anIndex"
+                                                withFieldNames:@[ @"name", @"pet", @"pet2" ]
+                                                      multiKey:YES];
+                    expect(statements.count).to.equal(2);
+
+                    NSString *sql = @"INSERT INTO \"_t_cloudant_sync_query_index_anIndex\" "
+                                     "( \"_id\", \"_rev\", \"name\", \"pet\", \"pet2\" ) "
+                                     "VALUES ( ?, ?, ?, ?, ? );";
+                    CDTQSqlParts *parts = statements[0];
+                    expect(parts.sqlWithPlaceholders).to.equal(sql);
+                    expect(parts.placeholderValues)
+                        .to.equal(@[ @"id123", saved.revId, @"mike", @"cat", @"fish" ]);
+
+                    parts = statements[1];
+                    expect(parts.sqlWithPlaceholders).to.equal(sql);
+                    expect(parts.placeholderValues)
+                        .to.equal(@[ @"id123", saved.revId, @"mike", @"dog", @"fish" ]);
+                });
+
+                it(@"indexes the fields of each element of an array of objects together", ^{
+                    CDTDocumentRevision *rev;
+                    rev = [CDTDocumentRevision revisionWithDocId:@"id123"];
+                    rev.body = [@{
+                        @"items" : @[ @{ @"name" : @"apple", @"qty" : @1 }, @{ @"name" : @"pear" } ]
+                    } mutableCopy];
+                    CDTDocumentRevision *saved = [ds createDocumentFromRevision:rev error:nil];
+                    NSArray *statements =
+                        [CDTQIndexUpdater partsToIndexRevision:saved
+                                                       inIndex:@"anIndex"
+                                                withFieldNames:@[ @"items.name", @"items.qty" ]
+                                                      multiKey:YES];
+                    expect(statements.count).to.equal(2);
+
+                    CDTQSqlParts *parts = statements[0];
+                    expect(parts.sqlWithPlaceholders)
+                        .to.equal(@"INSERT INTO \"_t_cloudant_sync_query_index_anIndex\" "
+                                   "( \"_id\", \"_rev\", \"items.name\", \"items.qty\" ) "
+                                   "VALUES ( ?, ?, ?, ? );");
+                    expect(parts.placeholderValues)
+                        .to.equal(@[ @"id123", saved.revId, @"apple", @1 ]);
+
+                    parts = statements[1];
+                    expect(parts.sqlWithPlaceholders)
+                        .to.equal(@"INSERT INTO \"_t_cloudant_sync_query_index_anIndex\" "
+                                   "( \"_id\", \"_rev\", \"items.name\" ) VALUES ( ?, ?, ? );");
+                    expect(parts.placeholderValues).to.equal(@[ @"id123", saved.revId, @"pear" ]);
+                });
+
+                it(@"rejects documents needing too many rows", ^{
+                    NSMutableArray *values = [NSMutableArray array];
+                    for (NSUInteger i = 0; i < 40; i++) {
+                        [values addObject:@(i)];
+                    }
+                    CDTDocumentRevision *rev;
+                    rev = [CDTDocumentRevision revisionWithDocId:@"id123"];
+                    rev.body = [@{ @"a" : values, @"b" : values } mutableCopy];
+                    CDTDocumentRevision *saved = [ds createDocumentFromRevision:rev error:nil];
+                    NSArray *statements =
+                        [CDTQIndexUpdater partsToIndexRevision:saved
+                                                       inIndex:@"anIndex"
+                                                withFieldNames:@[ @"a", @"b" ]
+                                                      multiKey:YES];
+                    expect(statements).to.beNil();
+                });
+
+            });
+
         });
 
         describe(@"when setting sequence numbers", ^{
@@ -392,6 +486,96 @@ SpecBegin(CDTQIndexUpdater)
 
             });
 
+            it(@"updates indexes at different sequence numbers together", ^{
+                expect([im ensureIndexed:@[ @"age", @"pet", @"name" ] withName:@"basic"])
+                    .toNot.beNil();
+
+                CDTDocumentRevision *rev;
+                rev = [CDTDocumentRevision revisionWithDocId:@"newdoc"];
+                rev.body = [@{ @"name" : @"fred", @"age" : @12 } mutableCopy];
+                [ds createDocumentFromRevision:rev error:nil];
+
+                // Created after "newdoc", so already at sequence 7.
+                expect([im ensureIndexed:@[ @"name" ] withName:@"names"]).toNot.beNil();
+
+                rev = [CDTDocumentRevision revisionWithDocId:@"newerdoc"];
+                rev.body = [@{ @"name" : @"bill", @"age" : @50 } mutableCopy];
+                [ds createDocumentFromRevision:rev error:nil];
+                expect([ds deleteDocumentWithId:@"mike12" error:nil]).toNot.beNil();
+
+                FMDatabaseQueue *queue =
+                    (FMDatabaseQueue *)[im performSelector:@selector(database)];
+                CDTQIndexUpdater *updater =
+                    [[CDTQIndexUpdater alloc] initWithDatabase:queue datastore:ds];
+                expect([updater sequenceNumberForIndex:@"basic"]).to.equal(6);
+                expect([updater sequenceNumberForIndex:@"names"]).to.equal(7);
+
+                expect([updater updateAllIndexes:[im listIndexes]]).to.beTruthy();
+
+                expect([updater sequenceNumberForIndex:@"basic"]).to.equal(9);
+                expect([updater sequenceNumberForIndex:@"names"]).to.equal(9);
+
+                for (NSString *table in @[ [CDTQIndexManager tableNameForIndex:@"basic"],
+                                           [CDTQIndexManager tableNameForIndex:@"names"] ]) {
+                    [queue inDatabase:^(FMDatabase *db) {
+                        NSString *sql = [NSString stringWithFormat:@"SELECT _id FROM %@", table];
+                        NSMutableSet *docIds = [NSMutableSet set];
+                        FMResultSet *rs = [db executeQuery:sql];
+                        while ([rs next]) {
+                            [docIds addObject:[rs stringForColumnIndex:0]];
+                        }
+                        [rs close];
+                        expect(docIds).to.equal([NSSet setWithArray:@[ @"mike23", @"mike34",
+                                                                       @"john72", @"fred34",
+                                                                       @"fred12", @"newdoc",
+                                                                       @"newerdoc" ]]);
+                    }];
+                }
+            });
+
+            it(@"only rewrites rows whose indexed fields have changed", ^{
+                expect([im ensureIndexed:@[ @"age", @"pet", @"name" ] withName:@"basic"])
+                    .toNot.beNil();
+                FMDatabaseQueue *queue =
+                    (FMDatabaseQueue *)[im performSelector:@selector(database)];
+                CDTQIndexUpdater *updater =
+                    [[CDTQIndexUpdater alloc] initWithDatabase:queue datastore:ds];
+                NSString *table = [CDTQIndexManager tableNameForIndex:@"basic"];
+                NSArray * (^row)(NSString *) = ^NSArray *(NSString *docId) {
+                    __block NSArray *result = nil;
+                    [queue inDatabase:^(FMDatabase *db) {
+                        NSString *sql = [NSString
+                            stringWithFormat:@"SELECT rowid, _rev, age FROM %@ WHERE _id = ?", table];
+                        FMResultSet *rs = [db executeQuery:sql withArgumentsInArray:@[ docId ]];
+                        if ([rs next]) {
+                            result = @[
+                                [rs objectForColumnIndex:0], [rs objectForColumnIndex:1],
+                                [rs objectForColumnIndex:2]
+                            ];
+                        }
+                        [rs close];
+                    }];
+                    return result;
+                };
+                NSArray *before = row(@"mike23");
+
+                CDTDocumentRevision *rev = [[ds getDocumentWithId:@"mike23" error:nil] copy];
+                rev.body[@"lastSeen"] = @"today";
+                CDTDocumentRevision *seen = [ds updateDocumentFromRevision:rev error:nil];
+                expect([updater updateAllIndexes:[im listIndexes]]).to.beTruthy();
+                NSArray *after = row(@"mike23");
+                expect(after[0]).to.equal(before[0]);
+                expect(after[1]).to.equal(seen.revId);
+
+                rev = [seen copy];
+                rev.body[@"age"] = @24;
+                [ds updateDocumentFromRevision:rev error:nil];
+                expect([updater updateAllIndexes:[im listIndexes]]).to.beTruthy();
+                after = row(@"mike23");
+                expect(after[0]).toNot.equal(before[0]);
+                expect(after[2]).to.equal(@24);
+            });
+
             describe(
                 @"when using a text index", ^{
                   it(@"sets correct sequence number", ^{
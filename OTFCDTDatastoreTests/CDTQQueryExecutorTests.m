@@ -234,6 +234,51 @@ SharedExamplesBegin(QueryExecution)
                 });
             });
 
+            context(@"when enumerating document IDs", ^{
+
+                it(@"gives the same IDs as documentIds", ^{
+                    NSDictionary* query = @{ @"name" : @{@"$eq" : @"mike"} };
+                    CDTQResultSet* results = [im find:query skip:1 limit:0 fields:nil sort:nil];
+
+                    NSMutableArray* docIds = [NSMutableArray array];
+                    [results enumerateDocumentIdsUsingBlock:^(NSString* docId, NSUInteger idx,
+                                                              BOOL* stop) {
+                        expect(idx).to.equal(docIds.count);
+                        [docIds addObject:docId];
+                    }];
+                    expect(docIds).to.equal(results.documentIds);
+                    expect(docIds.count).to.equal(2);
+                });
+
+                it(@"stops when asked to", ^{
+                    CDTQResultSet* results = [im find:@{}];
+
+                    __block NSUInteger seen = 0;
+                    [results enumerateDocumentIdsUsingBlock:^(NSString* docId, NSUInteger idx,
+                                                              BOOL* stop) {
+                        seen++;
+                        *stop = (idx == 1);
+                    }];
+                    expect(seen).to.equal(2);
+                });
+
+                it(@"gives the IDs in chunks", ^{
+                    NSDictionary* query = @{ @"pet" : @{@"$eq" : @"cat"} };
+                    CDTQResultSet* results = [im find:query];
+
+                    NSMutableArray* chunks = [NSMutableArray array];
+                    [results enumerateDocumentIdsInChunksOfSize:2
+                                                     usingBlock:^(NSArray* docIds, BOOL* stop) {
+                                                         [chunks addObject:docIds];
+                                                     }];
+                    expect(chunks.count).to.equal(2);
+                    expect([chunks[0] count]).to.equal(2);
+                    expect([chunks[1] count]).to.equal(1);
+                    expect([chunks valueForKeyPath:@"@unionOfArrays.self"])
+                        .to.equal(results.documentIds);
+                });
+            });
+
             // TODO fill in when separate validation class written
             xdescribe(@"when using unsupported operator", ^{
                 it(@"fails", ^{
@@ -1486,6 +1531,102 @@ SharedExamplesBegin(QueryExecution)
             });
         });
 
+        describe(@"when using a multikey index", ^{
+
+            __block CDTDatastore* ds;
+            __block CDTQIndexManager* im;
+
+            beforeEach(^{
+                ds = [factory datastoreNamed:@"test" error:nil];
+                expect(ds).toNot.beNil();
+
+                NSArray* bodies = @[
+                    @{ @"tags" : @[ @"a", @"b", @"c" ],
+                       @"items" : @[ @{ @"name" : @"apple", @"qty" : @5 },
+                                     @{ @"name" : @"pear", @"qty" : @1 } ] },
+                    @{ @"tags" : @[ @"a", @"c" ],
+                       @"items" : @[ @{ @"name" : @"apple", @"qty" : @1 },
+                                     @{ @"name" : @"pear", @"qty" : @5 } ] },
+                    @{ @"tags" : @"a", @"items" : @[ @{ @"name" : @"plum", @"qty" : @3 } ] },
+                    @{ @"items" : @[] },
+                    @{ @"tags" : @[ @"b" ], @"scores" : @[ @82, @95 ] },
+                    @{ @"scores" : @[ @70, @90 ] }
+                ];
+                for (NSUInteger i = 0; i < bodies.count; i++) {
+                    CDTDocumentRevision* rev = [CDTDocumentRevision
+                        revisionWithDocId:[NSString stringWithFormat:@"order%lu", (unsigned long)i + 1]];
+                    rev.body = [bodies[i] mutableCopy];
+                    [ds createDocumentFromRevision:rev error:nil];
+                }
+
+                im = [imClass managerUsingDatastore:ds error:nil];
+                expect(im).toNot.beNil();
+
+                expect([im ensureIndexed:@[ @"tags", @"items.name", @"items.qty" ]
+                                withName:@"orders"
+                                  ofType:CDTQIndexTypeMultiKey]).toNot.beNil();
+                expect([im ensureIndexed:@[ @"scores" ]
+                                withName:@"scores"
+                                  ofType:CDTQIndexTypeMultiKey]).toNot.beNil();
+            });
+
+            it(@"can find documents using $all", ^{
+                CDTQResultSet* result = [im find:@{ @"tags" : @{ @"$all" : @[ @"c", @"a" ] } }];
+                expect(result.documentIds).to.containsInAnyOrder(@[ @"order1", @"order2" ]);
+
+                result = [im find:@{ @"tags" : @{ @"$all" : @[ @"a" ] } }];
+                expect(result.documentIds)
+                    .to.containsInAnyOrder(@[ @"order1", @"order2", @"order3" ]);
+            });
+
+            it(@"can find documents using $not $all", ^{
+                NSDictionary* query = @{ @"tags" : @{ @"$not" : @{ @"$all" : @[ @"a", @"c" ] } } };
+                CDTQResultSet* result = [im find:query];
+                expect(result.documentIds).to.containsInAnyOrder(@[ @"order3", @"order4",
+                                                                    @"order5", @"order6" ]);
+            });
+
+            it(@"matches the clauses of $elemMatch against a single element", ^{
+                NSDictionary* query = @{ @"items" : @{ @"$elemMatch" : @{
+                    @"name" : @"apple", @"qty" : @{ @"$gt" : @2 } } } };
+                CDTQResultSet* result = [im find:query];
+                expect(result.documentIds).to.containsInAnyOrder(@[ @"order1" ]);
+            });
+
+            it(@"matches each $elemMatch and other clause against any element", ^{
+                NSDictionary* query = @{ @"$and" : @[
+                    @{ @"items" : @{ @"$elemMatch" : @{
+                        @"name" : @"apple", @"qty" : @{ @"$gt" : @2 } } } },
+                    @{ @"items" : @{ @"$elemMatch" : @{ @"name" : @"pear" } } }
+                ] };
+                CDTQResultSet* result = [im find:query];
+                expect(result.documentIds).to.containsInAnyOrder(@[ @"order1" ]);
+
+                query = @{
+                    @"items.qty" : @1,
+                    @"items" : @{ @"$elemMatch" : @{ @"name" : @"pear", @"qty" : @5 } }
+                };
+                result = [im find:query];
+                expect(result.documentIds).to.containsInAnyOrder(@[ @"order2" ]);
+            });
+
+            it(@"can find documents using $elemMatch on an array of values", ^{
+                NSDictionary* query =
+                    @{ @"scores" : @{ @"$elemMatch" : @{ @"$gte" : @80, @"$lt" : @85 } } };
+                CDTQResultSet* result = [im find:query];
+                expect(result.documentIds).to.containsInAnyOrder(@[ @"order5" ]);
+            });
+
+            it(@"can combine $all and $elemMatch over different arrays", ^{
+                NSDictionary* query = @{
+                    @"tags" : @{ @"$all" : @[ @"a", @"b" ] },
+                    @"items" : @{ @"$elemMatch" : @{ @"name" : @"pear" } }
+                };
+                CDTQResultSet* result = [im find:query];
+                expect(result.documentIds).to.containsInAnyOrder(@[ @"order1" ]);
+            });
+        });
+
         describe(@"stopping enumeration", ^{
 
             __block CDTDatastore* ds;
@@ -1639,6 +1780,51 @@ SharedExamplesBegin(QueryExecution)
                             @"d109"
                         ]);
                 });
+
+                it(@"matches and enumerates every batch in order when they're prefetched", ^{
+                    CDTDocumentRevision* rev = [CDTDocumentRevision revision];
+                    [im ensureIndexed:@[ @"large_field", @"idx" ] withName:@"large"];
+
+                    // Large enough that later batches are smaller than the first
+                    NSString* padding = [@"" stringByPaddingToLength:8192
+                                                          withString:@"x"
+                                                     startingAtIndex:0];
+                    for (int i = 0; i < 200; i++) {
+                        rev = [CDTDocumentRevision
+                            revisionWithDocId:[NSString stringWithFormat:@"d%d", i]];
+                        rev.body = [@{
+                            @"large_field" : @"cat",
+                            @"idx" : @(i),
+                            @"odd" : @(i % 2 == 1),
+                            @"padding" : padding
+                        } mutableCopy];
+                        [ds createDocumentFromRevision:rev error:nil];
+                    }
+
+                    // "odd" isn't indexed, so it's matched against the loaded documents
+                    NSDictionary* query = @{ @"large_field" : @"cat", @"odd" : @YES };
+                    CDTQResultSet* results =
+                        [im find:query skip:10 limit:0 fields:nil sort:@[ @{ @"idx" : @"asc" } ]];
+                    NSMutableArray* expected = [NSMutableArray array];
+                    for (int i = 21; i < 200; i += 2) {
+                        [expected addObject:[NSString stringWithFormat:@"d%d", i]];
+                    }
+
+                    __block NSMutableArray* enumerated = [NSMutableArray array];
+                    [results enumerateObjectsUsingBlock:^(CDTDocumentRevision* rev, NSUInteger i,
+                                                          BOOL* stop) {
+                        expect(i).to.equal(enumerated.count);
+                        [enumerated addObject:rev.docId];
+                    }];
+                    expect(enumerated).to.equal(expected);
+
+                    __block NSUInteger count = 0;
+                    [results enumerateObjectsUsingBlock:^(CDTDocumentRevision* rev, NSUInteger i,
+                                                          BOOL* stop) {
+                        *stop = (++count == 30);
+                    }];
+                    expect(count).to.equal(30);
+                });
             });
 
         });
@@ -126,6 +126,41 @@ SpecBegin(CDTQQueryExecutorSorting)
                 expect(result).to.beNil();
             });
 
+            it(@"sorts a limited query on fields no index holds", ^{
+                CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"bill50"];
+                rev.body = [@{ @"name" : @"bill", @"age" : @50, @"same" : @"all", @"rank" : @2 }
+                    mutableCopy];
+                [ds createDocumentFromRevision:rev error:nil];
+                rev = [CDTDocumentRevision revisionWithDocId:@"anne"];
+                rev.body = [@{ @"name" : @"anne", @"same" : @"all", @"rank" : @1 } mutableCopy];
+                [ds createDocumentFromRevision:rev error:nil];
+
+                NSDictionary *query = @{ @"same" : @"all" };
+                NSArray *order = @[ @{ @"rank" : @"desc" }, @{ @"name" : @"asc" } ];
+                expect([im explain:query sort:order][@"sortInMemory"]).to.equal(@YES);
+
+                // Documents without rank sort first ascending, so last here, by ID.
+                CDTQResultSet *result = [im find:query skip:0 limit:3 fields:nil sort:order];
+                expect(result.documentIds).to.equal(@[ @"bill50", @"anne", @"fred11" ]);
+                result = [im find:query skip:1 limit:3 fields:@[ @"name" ] sort:order];
+                expect(result.documentIds).to.equal(@[ @"anne", @"fred11", @"fred34" ]);
+
+                // The limit is larger than the number of matches.
+                result = [im find:query skip:0 limit:NSUIntegerMax fields:nil sort:order];
+                expect(result.documentIds)
+                    .to.equal(@[ @"bill50", @"anne", @"fred11", @"fred34", @"mike12" ]);
+
+                // Matched on the documents themselves as well as sorted.
+                result = [im find:@{ @"same" : @"all", @"rank" : @{ @"$exists" : @NO } }
+                             skip:0
+                            limit:2
+                           fields:nil
+                             sort:@[ @{ @"rank" : @"asc" }, @{ @"age" : @"desc" } ]];
+                expect(result.documentIds).to.equal(@[ @"fred34", @"mike12" ]);
+
+                expect([im find:query skip:0 limit:0 fields:nil sort:order]).to.beNil();
+            });
+
             it(@"returns nil using too many clauses", ^{
                 NSDictionary *query = @{ @"same" : @"all" };
                 NSArray *order = @[ @{ @"name" : @"asc", @"age" : @"desc" } ];
@@ -136,6 +171,293 @@ SpecBegin(CDTQQueryExecutorSorting)
 
         });
 
+        describe(@"when paging with a cursor", ^{
+
+            __block CDTDatastore *ds;
+            __block CDTQIndexManager *im;
+
+            beforeEach(^{
+                ds = [factory datastoreNamed:@"test" error:nil];
+                expect(ds).toNot.beNil();
+
+                // Ages repeat so pages have to break ties on _id; doc5 has no age.
+                for (int i = 0; i < 10; i++) {
+                    CDTDocumentRevision *rev =
+                        [CDTDocumentRevision revisionWithDocId:[NSString stringWithFormat:@"doc%d", i]];
+                    rev.body = [@{ @"same" : @"all", @"age" : @(i % 4) } mutableCopy];
+                    if (i == 5) {
+                        [rev.body removeObjectForKey:@"age"];
+                    }
+                    [ds createDocumentFromRevision:rev error:nil];
+                }
+                CDTDocumentRevision *other = [CDTDocumentRevision revisionWithDocId:@"other"];
+                other.body = [@{ @"same" : @"none", @"age" : @1 } mutableCopy];
+                [ds createDocumentFromRevision:other error:nil];
+
+                im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+                expect(im).toNot.beNil();
+                expect([im ensureIndexed:@[ @"same", @"age" ] withName:@"ages"]).toNot.beNil();
+            });
+
+            NSArray *(^allPages)(CDTQIndexManager *, NSArray *, NSUInteger) =
+                ^NSArray *(CDTQIndexManager *im, NSArray *order, NSUInteger pageSize) {
+                    NSMutableArray *docIds = [NSMutableArray array];
+                    CDTQQueryCursor *cursor = nil;
+                    do {
+                        CDTQResultSet *page = [im find:@{ @"same" : @"all" }
+                                                 limit:pageSize
+                                                fields:nil
+                                                  sort:order
+                                                 after:cursor];
+                        expect(page).toNot.beNil();
+                        expect(page.documentIds.count).to.beLessThanOrEqualTo(pageSize);
+                        [docIds addObjectsFromArray:page.documentIds];
+                        cursor = page.nextPageCursor;
+                    } while (cursor);
+                    return docIds;
+                };
+
+            it(@"pages through ascending results", ^{
+                NSArray *order = @[ @{ @"age" : @"asc" } ];
+                CDTQResultSet *all =
+                    [im find:@{ @"same" : @"all" } skip:0 limit:0 fields:nil sort:order];
+                expect(all.documentIds).to.equal((@[ @"doc5", @"doc0", @"doc4", @"doc8", @"doc1",
+                                                     @"doc9", @"doc2", @"doc6", @"doc3", @"doc7" ]));
+                expect(all.nextPageCursor).to.beNil();
+
+                expect(allPages(im, order, 3)).to.equal(all.documentIds);
+                expect(allPages(im, order, 1)).to.equal(all.documentIds);
+            });
+
+            it(@"pages through descending results", ^{
+                NSArray *order = @[ @{ @"age" : @"desc" } ];
+                CDTQResultSet *all =
+                    [im find:@{ @"same" : @"all" } skip:0 limit:0 fields:nil sort:order];
+                expect(all.documentIds).to.equal((@[ @"doc3", @"doc7", @"doc2", @"doc6", @"doc1",
+                                                     @"doc9", @"doc0", @"doc4", @"doc8", @"doc5" ]));
+
+                expect(allPages(im, order, 4)).to.equal(all.documentIds);
+            });
+
+            it(@"pages through unsorted results in doc ID order", ^{
+                NSArray *docIds = allPages(im, nil, 3);
+                expect(docIds).to.equal([docIds sortedArrayUsingSelector:@selector(compare:)]);
+                expect(docIds.count).to.equal(10);
+            });
+
+            it(@"applies skip and limit in SQL", ^{
+                NSArray *order = @[ @{ @"age" : @"asc" } ];
+                CDTQResultSet *result =
+                    [im find:@{ @"same" : @"all" } skip:2 limit:3 fields:nil sort:order];
+                expect(result.documentIds).to.equal((@[ @"doc4", @"doc8", @"doc1" ]));
+            });
+
+            it(@"rejects a cursor from a differently sorted query", ^{
+                CDTQResultSet *page = [im find:@{ @"same" : @"all" }
+                                         limit:2
+                                        fields:nil
+                                          sort:@[ @{ @"age" : @"asc" } ]
+                                         after:nil];
+                expect(page.nextPageCursor).toNot.beNil();
+                expect([im find:@{ @"same" : @"all" }
+                           limit:2
+                          fields:nil
+                            sort:@[ @{ @"age" : @"desc" } ]
+                           after:page.nextPageCursor]).to.beNil();
+            });
+
+            it(@"rejects a cursor for a query no single index satisfies", ^{
+                CDTQResultSet *page = [im find:@{ @"same" : @"all" }
+                                         limit:2
+                                        fields:nil
+                                          sort:nil
+                                         after:nil];
+                expect([im find:@{ @"name" : @"mike" }
+                           limit:2
+                          fields:nil
+                            sort:nil
+                           after:page.nextPageCursor]).to.beNil();
+            });
+        });
+
+        describe(@"when sorting by an index with a collation", ^{
+
+            __block CDTDatastore *ds;
+            __block CDTQIndexManager *im;
+
+            beforeEach(^{
+                ds = [factory datastoreNamed:@"test" error:nil];
+                expect(ds).toNot.beNil();
+
+                // By binary comparison capitals sort first and accented letters last.
+                for (NSString *name in @[ @"Zoe", @"adam", @"\u00e9mile", @"bob" ]) {
+                    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:name];
+                    rev.body = [@{ @"same" : @"all", @"name" : name } mutableCopy];
+                    [ds createDocumentFromRevision:rev error:nil];
+                }
+
+                im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+                expect(im).toNot.beNil();
+            });
+
+            it(@"orders strings for the locale", ^{
+                expect([im ensureIndexed:@[ @"same", @"name" ]
+                                withName:@"names"
+                                  ofType:CDTQIndexTypeJSON
+                                settings:@{ @"collation" : @"en_US" }])
+                    .to.equal(@"names");
+
+                NSArray *order = @[ @{ @"name" : @"asc" } ];
+                CDTQResultSet *result =
+                    [im find:@{ @"same" : @"all" } skip:0 limit:0 fields:nil sort:order];
+                expect(result.documentIds).to.equal((@[ @"adam", @"bob", @"\u00e9mile", @"Zoe" ]));
+
+                result = [im find:@{ @"same" : @"all" }
+                             skip:0
+                            limit:0
+                           fields:nil
+                             sort:@[ @{ @"name" : @"desc" } ]];
+                expect(result.documentIds).to.equal((@[ @"Zoe", @"\u00e9mile", @"bob", @"adam" ]));
+
+                // Pages continue from the cursor in the same order.
+                CDTQResultSet *page =
+                    [im find:@{ @"same" : @"all" } limit:2 fields:nil sort:order after:nil];
+                expect(page.documentIds).to.equal((@[ @"adam", @"bob" ]));
+                page = [im find:@{ @"same" : @"all" }
+                          limit:2
+                         fields:nil
+                           sort:order
+                          after:page.nextPageCursor];
+                expect(page.documentIds).to.equal((@[ @"\u00e9mile", @"Zoe" ]));
+
+                // An $or's IDs are sorted by a query of their own.
+                result = [im find:@{ @"$or" : @[ @{ @"name" : @"Zoe" }, @{ @"name" : @"adam" },
+                                                 @{ @"name" : @"\u00e9mile" } ] }
+                             skip:0
+                            limit:0
+                           fields:nil
+                             sort:order];
+                expect(result.documentIds).to.equal((@[ @"adam", @"\u00e9mile", @"Zoe" ]));
+            });
+
+            it(@"orders strings by binary comparison without one", ^{
+                expect([im ensureIndexed:@[ @"same", @"name" ] withName:@"names"]).to.equal(@"names");
+                CDTQResultSet *result = [im find:@{ @"same" : @"all" }
+                                            skip:0
+                                           limit:0
+                                          fields:nil
+                                            sort:@[ @{ @"name" : @"asc" } ]];
+                expect(result.documentIds).to.equal((@[ @"Zoe", @"adam", @"bob", @"\u00e9mile" ]));
+            });
+
+            it(@"rejects an invalid collation", ^{
+                expect([im ensureIndexed:@[ @"name" ]
+                                withName:@"names"
+                                  ofType:CDTQIndexTypeJSON
+                                settings:@{ @"collation" : @"en\"US" }])
+                    .to.beNil();
+                expect([im ensureIndexed:@[ @"name" ]
+                                withName:@"names"
+                                  ofType:CDTQIndexTypeJSON
+                                settings:@{ @"collation" : @42 }])
+                    .to.beNil();
+            });
+        });
+
+        describe(@"when using a query handle", ^{
+
+            __block CDTQIndexManager *im;
+
+            beforeEach(^{
+                CDTDatastore *ds = [factory datastoreNamed:@"test" error:nil];
+                expect(ds).toNot.beNil();
+                for (int i = 0; i < 120; i++) {
+                    CDTDocumentRevision *rev =
+                        [CDTDocumentRevision revisionWithDocId:[NSString stringWithFormat:@"doc%03d", i]];
+                    rev.body = [@{ @"same" : @"all", @"age" : @(i), @"pet" : @"cat" } mutableCopy];
+                    [ds createDocumentFromRevision:rev error:nil];
+                }
+
+                im = [CDTQIndexManager managerUsingDatastore:ds error:nil];
+                expect(im).toNot.beNil();
+                expect([im ensureIndexed:@[ @"same", @"age" ] withName:@"ages"]).toNot.beNil();
+            });
+
+            it(@"runs the query while the handle isn't cancelled", ^{
+                NSArray *order = @[ @{ @"age" : @"asc" } ];
+                CDTQueryHandle *handle = [[CDTQueryHandle alloc] initWithTimeBudget:60];
+                CDTQResultSet *result = [im find:@{ @"same" : @"all" }
+                                            skip:0
+                                           limit:0
+                                          fields:nil
+                                            sort:order
+                                           after:nil
+                                          handle:handle];
+                expect(result.documentIds.count).to.equal(120);
+                expect(result.handle).to.equal(handle);
+                expect(handle.isCancelled).to.beFalsy();
+            });
+
+            it(@"returns nil for a cancelled handle", ^{
+                CDTQueryHandle *handle = [[CDTQueryHandle alloc] init];
+                [handle cancel];
+                expect(handle.isCancelled).to.beTruthy();
+                expect([im find:@{ @"same" : @"all" }
+                            skip:0
+                           limit:0
+                          fields:nil
+                            sort:@[ @{ @"age" : @"asc" } ]
+                           after:nil
+                          handle:handle]).to.beNil();
+                expect([im find:@{ @"same" : @"all", @"pet" : @"cat" }
+                            skip:0
+                           limit:0
+                          fields:nil
+                            sort:nil
+                           after:nil
+                          handle:handle]).to.beNil();
+            });
+
+            it(@"returns nil once the time budget has run out", ^{
+                CDTQueryHandle *handle = [[CDTQueryHandle alloc] initWithTimeBudget:0.001];
+                [NSThread sleepForTimeInterval:0.01];
+                expect(handle.isCancelled).to.beTruthy();
+                expect([im find:@{ @"same" : @"all" }
+                            skip:0
+                           limit:0
+                          fields:nil
+                            sort:nil
+                           after:nil
+                          handle:handle]).to.beNil();
+            });
+
+            it(@"stops matching documents when cancelled after the find", ^{
+                // pet isn't indexed, so the documents are loaded and matched as enumerated.
+                CDTQueryHandle *handle = [[CDTQueryHandle alloc] init];
+                CDTQResultSet *result = [im find:@{ @"same" : @"all", @"pet" : @"cat" }
+                                            skip:0
+                                           limit:0
+                                          fields:nil
+                                            sort:nil
+                                           after:nil
+                                          handle:handle];
+                expect(result).toNot.beNil();
+
+                __block NSUInteger seen = 0;
+                [result enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger idx,
+                                                     BOOL *stop) {
+                    if (++seen == 10) {
+                        [handle cancel];
+                    }
+                }];
+                expect(seen).to.equal(10);
+                expect(result.documentIds).to.equal(@[]);
+
+                // The same results under no handle are all enumerated.
+                expect([result resultSetWithHandle:nil].documentIds.count).to.equal(120);
+            });
+        });
+
         describe(@"when generating ordering SQL", ^{
 
             __block NSDictionary *indexes = @{
@@ -337,6 +659,25 @@ SpecBegin(CDTQQueryExecutorSorting)
                 expect(parts).to.beNil();
             });
 
+            it(@"keeps to the IDs a query tree selects", ^{
+                NSArray *order = @[ @{ @"y" : @"desc" }, @{ @"x" : @"asc" } ];
+                CDTQSqlParts *tree = [CDTQSqlParts
+                    partsForSql:@"SELECT _id FROM \"_t_cloudant_sync_query_index_a\" WHERE \"name\" = ?"
+                     parameters:@[ @"mike" ]];
+                CDTQSqlParts *parts =
+                    [CDTQQueryExecutor sqlToSortIdsMatching:tree usingOrder:order indexes:indexes];
+
+                NSString *sql = @"SELECT DISTINCT _id FROM \"_t_cloudant_sync_query_index_b\" "
+                                @"WHERE _id IN (SELECT _id FROM \"_t_cloudant_sync_query_index_a\" "
+                                @"WHERE \"name\" = ?) ORDER BY \"y\" DESC, \"x\" ASC;";
+                expect(parts.sqlWithPlaceholders).to.equal(sql);
+                expect(parts.placeholderValues).to.equal(@[ @"mike" ]);
+
+                order = @[ @{ @"apples" : @"asc" } ];
+                expect([CDTQQueryExecutor sqlToSortIdsMatching:tree usingOrder:order indexes:indexes])
+                    .to.beNil();
+            });
+
         });
 
         /*
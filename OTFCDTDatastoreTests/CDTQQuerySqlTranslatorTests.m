@@ -7,6 +7,7 @@
 //
 #import <OTFCDTDatastore/CDTQIndexCreator.h>
 #import <OTFCDTDatastore/CDTQIndexManager.h>
+#import <OTFCDTDatastore/CDTQIndexStatistics.h>
 #import <OTFCDTDatastore/CDTQIndexUpdater.h>
 #import <OTFCDTDatastore/CDTQQueryExecutor.h>
 #import <OTFCDTDatastore/CDTQQuerySqlTranslator.h>
@@ -727,6 +728,186 @@ SpecBegin(CDTQQuerySqlTranslator) describe(@"cdtq", ^{
                                                                    ]
                                                        fromIndexes:indexes]).to.beNil();
         });
+
+        it(@"selects the narrowest index, by name, when several match", ^{
+            NSDictionary *indexes = @{
+                @"named" : @{@"name" : @"named", @"type" : @"json", @"fields" : @[ @"name", @"pet" ]},
+                @"bopped" : @{@"name" : @"bopped", @"type" : @"json", @"fields" : @[ @"name", @"pet" ]},
+                @"many_field" : @{
+                    @"name" : @"many_field",
+                    @"type" : @"json",
+                    @"fields" : @[ @"name", @"age", @"pet" ]
+                },
+            };
+            NSString *idx = [CDTQQuerySqlTranslator
+                chooseIndexForAndClause:@[ @{ @"name" : @"mike" }, @{ @"pet" : @"cat" } ]
+                            fromIndexes:indexes];
+            expect(idx).to.equal(@"bopped");
+        });
+
+        it(@"selects the index which is cheapest to scan using statistics", ^{
+            NSDictionary *indexes = @{
+                @"narrow" : @{@"name" : @"narrow", @"type" : @"json", @"fields" : @[ @"name", @"pet" ]},
+                @"wide" : @{
+                    @"name" : @"wide",
+                    @"type" : @"json",
+                    @"fields" : @[ @"name", @"age", @"pet" ]
+                },
+            };
+            // An array field gives "narrow" many rows per document
+            NSDictionary *statistics = @{
+                @"narrow" : [[CDTQIndexStatistics alloc] initWithRowCount:1000
+                                                           distinctCounts:@{}
+                                                            nonNullCounts:@{}
+                                                                 sequence:1],
+                @"wide" : [[CDTQIndexStatistics alloc] initWithRowCount:10
+                                                         distinctCounts:@{}
+                                                          nonNullCounts:@{}
+                                                               sequence:1],
+            };
+            NSString *idx = [CDTQQuerySqlTranslator chooseIndexForFields:[NSSet setWithObject:@"name"]
+                                                             fromIndexes:indexes
+                                                              statistics:statistics];
+            expect(idx).to.equal(@"wide");
+            idx = [CDTQQuerySqlTranslator chooseIndexForFields:[NSSet setWithObject:@"name"]
+                                                   fromIndexes:indexes];
+            expect(idx).to.equal(@"narrow");
+        });
+
+        it(@"only selects a typed index for operands of its fields' types", ^{
+            NSDictionary *indexes = @{
+                @"typed" : @{
+                    @"name" : @"typed",
+                    @"type" : @"json",
+                    @"fields" : @[ @"_id", @"_rev", @"age" ],
+                    @"fieldTypes" : @{ @"age" : @"integer" }
+                },
+            };
+            expect([CDTQQuerySqlTranslator
+                       chooseIndexForAndClause:@[ @{ @"age" : @{ @"$gt" : @12 } } ]
+                                   fromIndexes:indexes])
+                .to.equal(@"typed");
+            expect([CDTQQuerySqlTranslator
+                       chooseIndexForAndClause:@[ @{ @"age" : @{ @"$gt" : @"twelve" } } ]
+                                   fromIndexes:indexes])
+                .to.beNil();
+            expect([CDTQQuerySqlTranslator
+                       chooseIndexForAndClause:@[ @{ @"age" : @{ @"$in" : @[ @1, @2.5 ] } } ]
+                                   fromIndexes:indexes])
+                .to.beNil();
+        });
+
+        it(@"prefers a typed index which can seek on its first field", ^{
+            NSDictionary *indexes = @{
+                @"scanned" : @{
+                    @"name" : @"scanned",
+                    @"type" : @"json",
+                    @"fields" : @[ @"_id", @"_rev", @"age" ]
+                },
+                @"typed" : @{
+                    @"name" : @"typed",
+                    @"type" : @"json",
+                    @"fields" : @[ @"_id", @"_rev", @"age", @"name" ],
+                    @"fieldTypes" : @{ @"age" : @"integer" }
+                },
+            };
+            NSArray *seekable = @[ @{ @"age" : @{ @"$lt" : @12 } } ];
+            expect([CDTQQuerySqlTranslator chooseIndexForAndClause:seekable fromIndexes:indexes])
+                .to.equal(@"typed");
+            NSArray *negated = @[ @{ @"age" : @{ @"$not" : @{ @"$lt" : @12 } } } ];
+            expect([CDTQQuerySqlTranslator chooseIndexForAndClause:negated fromIndexes:indexes])
+                .to.equal(@"scanned");
+        });
+
+        it(@"compares with values as a typed index stores them", ^{
+            NSDictionary *index = @{
+                @"name" : @"typed",
+                @"type" : @"json",
+                @"fields" : @[ @"_id", @"_rev", @"born", @"name" ],
+                @"fieldTypes" : @{ @"born" : @"date" }
+            };
+            NSArray *clause = @[
+                @{ @"born" : @{ @"$gte" : @"1970-01-01T00:00:01Z" } },
+                @{ @"born" : @{ @"$not" : @{ @"$in" : @[ @"1970-01-02" ] } } },
+                @{ @"name" : @{ @"$eq" : @"mike" } }
+            ];
+            expect([CDTQQuerySqlTranslator clause:clause normalisedForIndex:index]).to.equal(@[
+                @{ @"born" : @{ @"$gte" : @1000 } },
+                @{ @"born" : @{ @"$not" : @{ @"$in" : @[ @86400000 ] } } },
+                @{ @"name" : @{ @"$eq" : @"mike" } }
+            ]);
+            expect([CDTQQuerySqlTranslator clause:@[ @{ @"born" : @{ @"$eq" : @"soon" } } ]
+                               normalisedForIndex:index]).to.beNil();
+        });
+    });
+
+    describe(@"when estimating result sizes", ^{
+
+        __block NSDictionary *indexes;
+        __block CDTQIndexStatistics *statistics;
+
+        beforeEach(^{
+            indexes = @{
+                @"basic" : @{
+                    @"name" : @"basic",
+                    @"type" : @"json",
+                    @"fields" : @[ @"_id", @"_rev", @"name", @"pet" ]
+                }
+            };
+            statistics = [[CDTQIndexStatistics alloc] initWithRowCount:100
+                                                        distinctCounts:@{ @"name" : @10, @"pet" : @4 }
+                                                         nonNullCounts:@{ @"name" : @100, @"pet" : @50 }
+                                                              sequence:1];
+        });
+
+        it(@"estimates equality using distinct counts", ^{
+            expect([statistics estimatedRowsForAndClause:@[ @{ @"name" : @{ @"$eq" : @"mike" } } ]])
+                .to.beCloseTo(10);
+            expect([statistics estimatedRowsForAndClause:@[
+                @{ @"name" : @{ @"$eq" : @"mike" } }, @{ @"pet" : @{ @"$eq" : @"cat" } }
+            ]]).to.beCloseTo(1.25);
+        });
+
+        it(@"estimates $exists and $not using non-null counts", ^{
+            expect([statistics estimatedRowsForAndClause:@[ @{ @"pet" : @{ @"$exists" : @YES } } ]])
+                .to.beCloseTo(50);
+            expect([statistics estimatedRowsForAndClause:@[
+                @{ @"name" : @{ @"$not" : @{ @"$eq" : @"mike" } } }
+            ]]).to.beCloseTo(90);
+        });
+
+        it(@"sets estimates on the query tree", ^{
+            BOOL indexesCoverQuery;
+            NSDictionary *query = [CDTQQueryValidator normaliseAndValidateQuery:@{
+                @"$or" : @[ @{ @"name" : @"mike" }, @{ @"pet" : @"cat" } ]
+            }];
+            CDTQQueryNode *node = [CDTQQuerySqlTranslator translateQuery:query
+                                                            toUseIndexes:indexes
+                                                              statistics:@{ @"basic" : statistics }
+                                                       indexesCoverQuery:&indexesCoverQuery];
+            expect(node).to.beInstanceOf([CDTQOrQueryNode class]);
+            expect(indexesCoverQuery).to.beTruthy();
+            CDTQOrQueryNode *or = (CDTQOrQueryNode *)node;
+            expect([or.children[0] estimatedRows]).to.equal(@10);
+            expect([or.children[1] estimatedRows]).to.equal(@12.5);
+            expect(or.estimatedRows).to.equal(@22.5);
+        });
+
+        it(@"leaves estimates unset without statistics", ^{
+            BOOL indexesCoverQuery;
+            NSDictionary *query = [CDTQQueryValidator normaliseAndValidateQuery:@{ @"name" : @"mike" }];
+            CDTQQueryNode *node = [CDTQQuerySqlTranslator translateQuery:query
+                                                            toUseIndexes:indexes
+                                                       indexesCoverQuery:&indexesCoverQuery];
+            expect(node.estimatedRows).to.beNil();
+            expect([((CDTQAndQueryNode *)node).children[0] estimatedRows]).to.beNil();
+        });
+
+        it(@"treats statistics as stale after enough changes", ^{
+            expect([statistics isStaleAtSequence:50]).to.beFalsy();
+            expect([statistics isStaleAtSequence:102]).to.beTruthy();
+            expect([statistics isStaleAtSequence:0]).to.beTruthy();
+        });
     });
 
     describe(@"when generating query WHERE clauses", ^{
@@ -863,6 +1044,83 @@ SpecBegin(CDTQQuerySqlTranslator) describe(@"cdtq", ^{
                 expect(parts.placeholderValues).to.equal(@[ @2, @1 ]);
             });
         });
+
+        describe(@"when using the $all operator", ^{
+            it(@"requires a row for each distinct value", ^{
+                CDTQSqlParts *parts = [CDTQQuerySqlTranslator
+                    wherePartsForAndClause:@[ @{ @"tags" : @{ @"$all" : @[ @"a", @"b", @"a" ] } } ]
+                                usingIndex:@"named"];
+                NSString *expected = @"_id IN (SELECT _id "
+                                     @"FROM \"_t_cloudant_sync_query_index_named\" "
+                                     @"WHERE \"tags\" IN ( ?, ? ) "
+                                     @"GROUP BY _id HAVING COUNT(DISTINCT \"tags\") = 2)";
+                expect(parts.sqlWithPlaceholders).to.equal(expected);
+                expect(parts.placeholderValues).to.equal(@[ @"a", @"b" ]);
+            });
+        });
+
+        describe(@"when using the $elemMatch operator", ^{
+            it(@"applies every clause to the same row", ^{
+                NSDictionary *elemMatch = @{ @"$and" : @[
+                    @{ @"name" : @{ @"$eq" : @"apple" } }, @{ @"qty" : @{ @"$gt" : @2 } }
+                ] };
+                CDTQSqlParts *parts = [CDTQQuerySqlTranslator
+                    wherePartsForAndClause:@[ @{ @"items" : @{ @"$elemMatch" : elemMatch } },
+                                              @{ @"tags" : @{ @"$eq" : @"a" } } ]
+                                usingIndex:@"named"];
+                NSString *expected = @"_id IN (SELECT _id "
+                                     @"FROM \"_t_cloudant_sync_query_index_named\" "
+                                     @"WHERE \"items.name\" = ? AND \"items.qty\" > ?) "
+                                     @"AND \"tags\" = ?";
+                expect(parts.sqlWithPlaceholders).to.equal(expected);
+                expect(parts.placeholderValues).to.equal(@[ @"apple", @2, @"a" ]);
+            });
+
+            it(@"lets each $elemMatch match a different row", ^{
+                NSDictionary *apple = @{ @"$and" : @[ @{ @"name" : @{ @"$eq" : @"apple" } } ] };
+                NSDictionary *pear = @{ @"$and" : @[ @{ @"name" : @{ @"$eq" : @"pear" } } ] };
+                CDTQSqlParts *parts = [CDTQQuerySqlTranslator
+                    wherePartsForAndClause:@[ @{ @"items" : @{ @"$elemMatch" : apple } },
+                                              @{ @"items" : @{ @"$elemMatch" : pear } },
+                                              @{ @"items.qty" : @{ @"$eq" : @1 } } ]
+                                usingIndex:@"named"];
+                NSString *expected = @"_id IN (SELECT _id "
+                                     @"FROM \"_t_cloudant_sync_query_index_named\" "
+                                     @"WHERE \"items.name\" = ?) "
+                                     @"AND _id IN (SELECT _id "
+                                     @"FROM \"_t_cloudant_sync_query_index_named\" "
+                                     @"WHERE \"items.name\" = ?) "
+                                     @"AND \"items.qty\" = ?";
+                expect(parts.sqlWithPlaceholders).to.equal(expected);
+                expect(parts.placeholderValues).to.equal(@[ @"apple", @"pear", @1 ]);
+            });
+
+            it(@"uses the field itself for clauses on the element", ^{
+                NSDictionary *elemMatch = @{ @"$and" : @[ @{ @"" : @{ @"$gte" : @80 } } ] };
+                CDTQSqlParts *parts = [CDTQQuerySqlTranslator
+                    wherePartsForAndClause:@[ @{ @"scores" : @{ @"$elemMatch" : elemMatch } } ]
+                                usingIndex:@"named"];
+                expect(parts.sqlWithPlaceholders)
+                    .to.equal(@"_id IN (SELECT _id FROM \"_t_cloudant_sync_query_index_named\" "
+                              @"WHERE \"scores\" >= ?)");
+            });
+
+            it(@"only chooses a multikey index", ^{
+                NSDictionary *elemMatch = @{ @"$and" : @[ @{ @"name" : @{ @"$eq" : @"apple" } } ] };
+                NSArray *clause = @[ @{ @"items" : @{ @"$elemMatch" : elemMatch } } ];
+                NSDictionary *indexes = @{
+                    @"json" : @{ @"type" : @"json", @"fields" : @[ @"_id", @"items.name" ] },
+                    @"multi" : @{ @"type" : @"multikey", @"fields" : @[ @"_id", @"items.name" ] }
+                };
+                expect([CDTQQuerySqlTranslator chooseIndexForAndClause:clause fromIndexes:indexes])
+                    .to.equal(@"multi");
+
+                NSMutableDictionary *jsonOnly = [indexes mutableCopy];
+                [jsonOnly removeObjectForKey:@"multi"];
+                expect([CDTQQuerySqlTranslator chooseIndexForAndClause:clause fromIndexes:jsonOnly])
+                    .to.beNil();
+            });
+        });
         
     });
 
@@ -1315,6 +1573,30 @@ SpecBegin(CDTQQuerySqlTranslator) describe(@"cdtq", ^{
             [CDTQQueryValidator normaliseAndValidateQuery:@{@"pet": @{ @"$not" : @{ @"$size": @[ @2 ] } } } ];
             expect(actual).to.beNil();
         });
+
+        it(@"normalises the selector of $elemMatch", ^{
+            NSDictionary *actual = [CDTQQueryValidator normaliseAndValidateQuery:@{
+                @"items" : @{ @"$elemMatch" : @{ @"name" : @"apple" } },
+                @"scores" : @{ @"$not" : @{ @"$elemMatch" : @{ @"$gt" : @80 } } }
+            }];
+            expect(actual).to.beTheSameQueryAs(@{
+                @"$and" : @[
+                    @{ @"items" : @{ @"$elemMatch" : @{
+                        @"$and" : @[ @{ @"name" : @{ @"$eq" : @"apple" } } ] } } },
+                    @{ @"scores" : @{ @"$not" : @{ @"$elemMatch" : @{
+                        @"$and" : @[ @{ @"" : @{ @"$gt" : @80 } } ] } } } }
+                ]
+            });
+        });
+
+        it(@"returns nil for unsupported $elemMatch and $all arguments", ^{
+            expect([CDTQQueryValidator normaliseAndValidateQuery:@{
+                @"items" : @{ @"$elemMatch" : @{ @"name" : @{ @"$ne" : @"apple" } } } }]).to.beNil();
+            expect([CDTQQueryValidator normaliseAndValidateQuery:@{
+                @"items" : @{ @"$elemMatch" : @{ @"name" : @"apple", @"$gt" : @2 } } }]).to.beNil();
+            expect([CDTQQueryValidator normaliseAndValidateQuery:@{
+                @"tags" : @{ @"$all" : @[] } }]).to.beNil();
+        });
         
     });
     
@@ -419,6 +419,63 @@ SpecBegin(CDTQQueryExecutorTextSearch) describe(@"cdtq", ^{
           expect(result.documentIds.count).to.equal(0);
         });
 
+        it(@"can perform a search using an FTS5 text index with a prefix index", ^{
+          expect([im ensureIndexed:@[ @"comment" ]
+                          withName:@"basic_text"
+                            ofType:CDTQIndexTypeText
+                          settings:@{ @"module" : @"fts5", @"prefix" : @"2 3" }])
+              .toNot.beNil();
+
+          NSDictionary* query = @{ @"$text" : @{@"$search" : @"lives in Bristol"} };
+          CDTQResultSet* result = [im find:query];
+          expect(result.documentIds).to.containsInAnyOrder(@[ @"mike12", @"mike34", @"fred12" ]);
+
+          query = @{ @"$text" : @{@"$search" : @"liv* riv*"} };
+          result = [im find:query];
+          expect(result.documentIds).to.containsInAnyOrder(@[ @"mike34" ]);
+
+          // Merging its segments doesn't change what an index finds.
+          expect([im optimizeTextIndexes]).to.beTruthy();
+          expect([im find:query].documentIds).to.containsInAnyOrder(@[ @"mike34" ]);
+        });
+
+        it(@"can sort search results by relevance using an FTS5 text index", ^{
+          expect([im ensureIndexed:@[ @"comment" ]
+                          withName:@"basic_text"
+                            ofType:CDTQIndexTypeText
+                          settings:@{ @"module" : @"fts5" }])
+              .toNot.beNil();
+
+          // fred34 matches all three terms, mike72 only two.
+          NSDictionary* query = @{ @"$text" : @{@"$search" : @"cat OR Remus OR Romulus"} };
+          CDTQResultSet* result = [im find:query
+                                      skip:0
+                                     limit:0
+                                    fields:nil
+                                      sort:@[ @{ @"$textScore" : @"desc" } ]];
+          expect(result.documentIds).to.equal(@[ @"fred34", @"mike72" ]);
+
+          result = [im find:query
+                       skip:0
+                      limit:0
+                     fields:nil
+                       sort:@[ @{ @"$textScore" : @"asc" } ]];
+          expect(result.documentIds).to.equal(@[ @"mike72", @"fred34" ]);
+        });
+
+        it(@"returns nil when sorting by relevance without an FTS5 text index", ^{
+          expect([im ensureIndexed:@[ @"comment" ] withName:@"basic_text" ofType:CDTQIndexTypeText])
+              .toNot.beNil();
+
+          NSDictionary* query = @{ @"$text" : @{@"$search" : @"Remus"} };
+          CDTQResultSet* result = [im find:query
+                                      skip:0
+                                     limit:0
+                                    fields:nil
+                                      sort:@[ @{ @"$textScore" : @"desc" } ]];
+          expect(result).to.beNil();
+        });
+
     });
     
 });
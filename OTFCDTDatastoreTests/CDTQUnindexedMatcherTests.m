@@ -820,4 +820,53 @@ describe(@"matches", ^{
     });
 });
 
+describe(@"indexesOfMatchingRevisions", ^{
+
+    __block NSArray *revs;
+
+    beforeAll(^{
+        NSMutableArray *accumulator = [NSMutableArray array];
+        for (int i = 0; i < 50; i++) {
+            NSDictionary *body = @{ @"age" : @(i), @"address" : @{ @"number" : @(i % 5) } };
+            [accumulator addObject:[[CDTDocumentRevision alloc]
+                                       initWithDocId:[NSString stringWithFormat:@"doc%d", i]
+                                          revisionId:@"1-a"
+                                                body:body
+                                         attachments:nil]];
+        }
+        revs = accumulator;
+    });
+
+    it(@"returns the same results as matching one at a time", ^{
+        NSDictionary *selector = [CDTQQueryValidator normaliseAndValidateQuery:@{
+            @"$or" : @[ @{ @"age" : @{ @"$lt" : @10 } }, @{ @"address.number" : @0 } ]
+        }];
+        CDTQUnindexedMatcher *matcher = [CDTQUnindexedMatcher matcherWithSelector:selector];
+
+        NSMutableIndexSet *expected = [NSMutableIndexSet indexSet];
+        [revs enumerateObjectsUsingBlock:^(CDTDocumentRevision *rev, NSUInteger idx, BOOL *stop) {
+            if ([matcher matches:rev]) {
+                [expected addIndex:idx];
+            }
+        }];
+        expect(expected.count).to.equal(18);
+        expect([matcher indexesOfMatchingRevisions:revs]).to.equal(expected);
+    });
+
+    it(@"matches small batches", ^{
+        NSDictionary *selector =
+            [CDTQQueryValidator normaliseAndValidateQuery:@{ @"age" : @{ @"$gte" : @2 } }];
+        CDTQUnindexedMatcher *matcher = [CDTQUnindexedMatcher matcherWithSelector:selector];
+        NSIndexSet *matching =
+            [matcher indexesOfMatchingRevisions:[revs subarrayWithRange:NSMakeRange(0, 4)]];
+        expect(matching).to.equal([NSIndexSet indexSetWithIndexesInRange:NSMakeRange(2, 2)]);
+    });
+
+    it(@"returns no indexes for no revisions", ^{
+        NSDictionary *selector = [CDTQQueryValidator normaliseAndValidateQuery:@{ @"age" : @1 }];
+        CDTQUnindexedMatcher *matcher = [CDTQUnindexedMatcher matcherWithSelector:selector];
+        expect([matcher indexesOfMatchingRevisions:@[]].count).to.equal(0);
+    });
+});
+
 SpecEnd
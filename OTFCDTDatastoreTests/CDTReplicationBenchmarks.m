@@ -0,0 +1,505 @@
+//
+//  CDTReplicationBenchmarks.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import <OHHTTPStubs/OHHTTPStubs.h>
+#import <OHHTTPStubs/NSURLRequest+HTTPBodyTesting.h>
+
+#import "CloudantSyncTests.h"
+#import "CDTDatastore.h"
+#import "CDTDatastoreManager.h"
+#import "CDTDocumentRevision.h"
+#import "CDTPullReplication.h"
+#import "CDTPushReplication.h"
+#import "CDTReplicator.h"
+#import "CDTReplicatorFactory.h"
+#import "CDTReplicationMetrics.h"
+#import "TDPuller.h"
+#import "Version.h"
+
+/*
+ Benchmarks of pull and push replication, against a simulated CouchDB served in-process through
+ OHHTTPStubs, so that runs are repeatable and measure the replicator rather than a server.
+
+ Like CDTDatastoreBenchmarks they only run when CDT_BENCHMARK_OUTPUT is set (see
+ `rake benchmarkosx`); their results are written next to that file, with "-replication" added to
+ its name. Each reports documents per second, and the HTTP requests and body bytes per document
+ taken from the replicator's metrics. Pulls are measured both with and without `_bulk_get`.
+
+ CDT_BENCHMARK_DOCS sets the number of documents replicated (default 10000),
+ CDT_BENCHMARK_LATENCY_MS the simulated latency of each request (default 0), and
+ CDT_BENCHMARK_BANDWIDTH_KBPS the simulated download bandwidth in KB/s (default unlimited).
+ */
+
+static NSString *const kOutputVariable = @"CDT_BENCHMARK_OUTPUT";
+static NSString *const kDocCountVariable = @"CDT_BENCHMARK_DOCS";
+static NSString *const kLatencyVariable = @"CDT_BENCHMARK_LATENCY_MS";
+static NSString *const kBandwidthVariable = @"CDT_BENCHMARK_BANDWIDTH_KBPS";
+
+static NSString *const kRemoteHost = @"127.0.0.1";
+static const NSUInteger kSamples = 3;
+
+static NSMutableArray<NSDictionary *> *results;
+
+#pragma mark - Simulated remote
+
+/**
+ Just enough of a CouchDB database, held in memory, for the replicator to pull from and push to.
+ Every document is served with its revision history, so either way of fetching them works.
+ */
+@interface CDTBenchmarkRemoteDatabase : NSObject
+
+@property (nonatomic) BOOL supportsBulkGet;
+/** Added to every response, in seconds. */
+@property (nonatomic) NSTimeInterval latency;
+/** Download bandwidth in KB/s, or 0 for unlimited. */
+@property (nonatomic) double bandwidth;
+
+@property (readonly, nonatomic) NSURL *url;
+@property (readonly) NSUInteger documentCount;
+
+- (instancetype)initWithName:(NSString *)name;
+
+/** Replaces the contents of the database with `count` documents, every fourth one at its second
+    revision. */
+- (void)populateWithDocuments:(NSUInteger)count;
+- (void)reset;
+
+- (void)start;
+- (void)stop;
+
+@end
+
+@implementation CDTBenchmarkRemoteDatabase {
+    NSString *_name;
+    id<OHHTTPStubsDescriptor> _stub;
+    // All guarded by @synchronized(self), since stubbed responses are built on the URL loading
+    // threads.
+    NSMutableArray<NSDictionary *> *_changes;               // each {seq, id, rev}
+    NSMutableDictionary<NSString *, NSDictionary *> *_docs;  // by doc ID, with _revisions
+    NSMutableDictionary<NSString *, NSDictionary *> *_localDocs;
+}
+
+- (instancetype)initWithName:(NSString *)name
+{
+    self = [super init];
+    if (self) {
+        _name = [name copy];
+        _url = [NSURL URLWithString:[NSString stringWithFormat:@"http://%@:5984/%@", kRemoteHost, name]];
+        [self reset];
+    }
+    return self;
+}
+
+- (void)reset
+{
+    @synchronized(self)
+    {
+        _changes = [NSMutableArray array];
+        _docs = [NSMutableDictionary dictionary];
+        _localDocs = [NSMutableDictionary dictionary];
+    }
+}
+
+- (NSUInteger)documentCount
+{
+    @synchronized(self) { return _docs.count; }
+}
+
+- (void)populateWithDocuments:(NSUInteger)count
+{
+    [self reset];
+    for (NSUInteger n = 0; n < count; n++) {
+        NSUInteger generation = (n % 4 == 0) ? 2 : 1;
+        NSMutableArray *revHashes = [NSMutableArray array];
+        for (NSUInteger g = generation; g > 0; g--) {
+            [revHashes addObject:[NSString stringWithFormat:@"%032lx", (unsigned long)(n * 10 + g)]];
+        }
+        NSDictionary *doc = @{
+            @"_id" : [NSString stringWithFormat:@"doc-%06lu", (unsigned long)n],
+            @"_rev" : [NSString stringWithFormat:@"%lu-%@", (unsigned long)generation, revHashes[0]],
+            @"_revisions" : @{ @"start" : @(generation), @"ids" : revHashes },
+            @"name" : (n % 2) ? @"mike" : @"fred",
+            @"age" : @(n % 90),
+            @"docNumber" : @(n),
+            @"address" : @{ @"town" : @"Bristol", @"street" : @"High Street", @"number" : @(n % 200) }
+        };
+        [self storeDocument:doc];
+    }
+}
+
+- (void)storeDocument:(NSDictionary *)doc
+{
+    @synchronized(self)
+    {
+        _docs[doc[@"_id"]] = doc;
+        [_changes addObject:@{
+            @"seq" : @(_changes.count + 1),
+            @"id" : doc[@"_id"],
+            @"changes" : @[ @{ @"rev" : doc[@"_rev"] } ]
+        }];
+    }
+}
+
+- (void)start
+{
+    __weak CDTBenchmarkRemoteDatabase *weakSelf = self;
+    NSString *host = self.url.host;
+    _stub = [OHHTTPStubs stubRequestsPassingTest:^BOOL(NSURLRequest *request) {
+        return [request.URL.host isEqualToString:host];
+    }
+        withStubResponse:^OHHTTPStubsResponse *(NSURLRequest *request) {
+            return [weakSelf responseToRequest:request];
+        }];
+}
+
+- (void)stop
+{
+    if (_stub) [OHHTTPStubs removeStub:_stub];
+    _stub = nil;
+}
+
+#pragma mark Responding
+
+- (OHHTTPStubsResponse *)responseToRequest:(NSURLRequest *)request
+{
+    NSURLComponents *components = [NSURLComponents componentsWithURL:request.URL
+                                             resolvingAgainstBaseURL:NO];
+    NSMutableDictionary<NSString *, NSString *> *query = [NSMutableDictionary dictionary];
+    for (NSURLQueryItem *item in components.queryItems) {
+        if (item.value) query[item.name] = item.value;
+    }
+
+    // Path components after the database name, e.g. ["_local", "checkpoint"]:
+    NSArray<NSString *> *path = request.URL.pathComponents;
+    NSUInteger db = [path indexOfObject:_name];
+    path = (db == NSNotFound) ? @[] : [path subarrayWithRange:NSMakeRange(db + 1, path.count - db - 1)];
+
+    NSString *method = request.HTTPMethod;
+    NSData *body = request.OHHTTPStubs_HTTPBody;
+    id json = body.length ? [NSJSONSerialization JSONObjectWithData:body options:0 error:nil] : nil;
+
+    id result = nil;
+    int status = 200;
+    @synchronized(self)
+    {
+        if (db == NSNotFound) {
+            status = 404;
+        } else if (path.count == 0) {
+            if ([method isEqualToString:@"PUT"]) {
+                status = 201;
+                result = @{ @"ok" : @YES };
+            } else {
+                result = @{ @"db_name" : _name, @"doc_count" : @(_docs.count) };
+            }
+        } else if ([path[0] isEqualToString:@"_local"] && path.count == 2) {
+            if ([method isEqualToString:@"PUT"]) {
+                _localDocs[path[1]] = json;
+                status = 201;
+                result = @{ @"ok" : @YES, @"id" : path[1], @"rev" : @"0-1" };
+            } else {
+                result = _localDocs[path[1]];
+                if (!result) status = 404;
+            }
+        } else if ([path[0] isEqualToString:@"_changes"]) {
+            result = [self changesSince:query[@"since"].integerValue limit:query[@"limit"].integerValue];
+        } else if ([path[0] isEqualToString:@"_bulk_get"]) {
+            if (!self.supportsBulkGet) {
+                status = 404;
+            } else if ([json[@"docs"] count] == 0) {
+                // The replicator probes for _bulk_get support this way:
+                status = 405;
+            } else {
+                result = [self bulkGet:json[@"docs"]];
+            }
+        } else if ([path[0] isEqualToString:@"_all_docs"]) {
+            result = [self allDocsWithKeys:json[@"keys"]];
+        } else if ([path[0] isEqualToString:@"_revs_diff"]) {
+            result = [self revsDiff:json];
+        } else if ([path[0] isEqualToString:@"_bulk_docs"]) {
+            status = 201;
+            result = [self bulkDocs:json[@"docs"]];
+        } else if (![path[0] hasPrefix:@"_"] && path.count == 1) {
+            result = _docs[path[0]];
+            if (!result) status = 404;
+        } else {
+            status = 404;
+        }
+    }
+
+    if (!result) result = @{ @"error" : @"not_found", @"reason" : @"missing" };
+    NSData *data = [NSJSONSerialization dataWithJSONObject:result options:0 error:nil];
+    OHHTTPStubsResponse *response =
+        [OHHTTPStubsResponse responseWithData:data
+                                   statusCode:status
+                                      headers:@{ @"Content-Type" : @"application/json" }];
+    // A negative response time is taken by OHHTTPStubs as a download speed in KB/s.
+    return [response requestTime:self.latency
+                    responseTime:self.bandwidth > 0 ? -self.bandwidth : 0];
+}
+
+- (NSDictionary *)changesSince:(NSInteger)since limit:(NSInteger)limit
+{
+    NSUInteger start = MIN((NSUInteger)MAX(since, 0), _changes.count);
+    NSUInteger length = _changes.count - start;
+    if (limit > 0) length = MIN(length, (NSUInteger)limit);
+    NSArray *page = [_changes subarrayWithRange:NSMakeRange(start, length)];
+    return @{ @"results" : page, @"last_seq" : @(start + length) };
+}
+
+- (NSDictionary *)bulkGet:(NSArray<NSDictionary *> *)requested
+{
+    NSMutableArray *docs = [NSMutableArray arrayWithCapacity:requested.count];
+    for (NSDictionary *item in requested) {
+        NSDictionary *doc = _docs[item[@"id"]];
+        NSDictionary *entry = doc ? @{ @"ok" : doc } : @{
+            @"error" : @{ @"id" : item[@"id"], @"rev" : item[@"rev"], @"error" : @"not_found" }
+        };
+        [docs addObject:@{ @"id" : item[@"id"], @"docs" : @[ entry ] }];
+    }
+    return @{ @"results" : docs };
+}
+
+- (NSDictionary *)allDocsWithKeys:(NSArray<NSString *> *)keys
+{
+    NSMutableArray *rows = [NSMutableArray arrayWithCapacity:keys.count];
+    for (NSString *key in keys) {
+        NSDictionary *doc = _docs[key];
+        if (doc) {
+            [rows addObject:@{ @"id" : key, @"key" : key, @"value" : @{ @"rev" : doc[@"_rev"] },
+                               @"doc" : doc }];
+        } else {
+            [rows addObject:@{ @"key" : key, @"error" : @"not_found" }];
+        }
+    }
+    return @{ @"total_rows" : @(_docs.count), @"rows" : rows };
+}
+
+- (NSDictionary *)revsDiff:(NSDictionary<NSString *, NSArray *> *)revs
+{
+    NSMutableDictionary *diff = [NSMutableDictionary dictionary];
+    [revs enumerateKeysAndObjectsUsingBlock:^(NSString *docID, NSArray *revIDs, BOOL *stop) {
+        NSString *current = self->_docs[docID][@"_rev"];
+        NSArray *missing = [revIDs filteredArrayUsingPredicate:
+            [NSPredicate predicateWithFormat:@"SELF != %@", current ?: @""]];
+        if (missing.count > 0) diff[docID] = @{ @"missing" : missing };
+    }];
+    return diff;
+}
+
+- (NSArray *)bulkDocs:(NSArray<NSDictionary *> *)docs
+{
+    NSMutableArray *response = [NSMutableArray arrayWithCapacity:docs.count];
+    for (NSDictionary *doc in docs) {
+        [self storeDocument:doc];
+        [response addObject:@{ @"ok" : @YES, @"id" : doc[@"_id"], @"rev" : doc[@"_rev"] }];
+    }
+    return response;
+}
+
+@end
+
+#pragma mark - Benchmarks
+
+@interface CDTReplicationBenchmarks : CloudantSyncTests
+
+@property (nonatomic) NSUInteger docCount;
+@property (nonatomic, strong) CDTBenchmarkRemoteDatabase *remote;
+@property (nonatomic, strong) CDTReplicatorFactory *replicatorFactory;
+
+@end
+
+@implementation CDTReplicationBenchmarks
+
++ (XCTestSuite *)defaultTestSuite
+{
+    if (!NSProcessInfo.processInfo.environment[kOutputVariable]) {
+        return [XCTestSuite testSuiteWithName:NSStringFromClass(self)];
+    }
+    return [super defaultTestSuite];
+}
+
++ (void)setUp
+{
+    [super setUp];
+    results = [NSMutableArray array];
+}
+
++ (void)tearDown
+{
+    NSString *path = NSProcessInfo.processInfo.environment[kOutputVariable];
+    if (path && results.count > 0) {
+        NSDictionary *env = NSProcessInfo.processInfo.environment;
+        NSDictionary *report = @{
+            @"version" : @CLOUDANT_SYNC_VERSION,
+            @"date" : [[[NSISO8601DateFormatter alloc] init] stringFromDate:[NSDate date]],
+            @"os" : NSProcessInfo.processInfo.operatingSystemVersionString,
+            @"latency_ms" : @([env[kLatencyVariable] doubleValue]),
+            @"bandwidth_kbps" : @([env[kBandwidthVariable] doubleValue]),
+            @"benchmarks" : results
+        };
+        NSString *replicationPath = [[path.stringByDeletingPathExtension
+            stringByAppendingString:@"-replication"] stringByAppendingPathExtension:@"json"];
+        NSData *json = [NSJSONSerialization dataWithJSONObject:report
+                                                       options:NSJSONWritingPrettyPrinted
+                                                         error:nil];
+        [json writeToFile:replicationPath atomically:YES];
+    }
+    results = nil;
+    [super tearDown];
+}
+
+- (void)setUp
+{
+    [super setUp];
+    // Use sessions OHHTTPStubs can intercept, rather than background ones.
+    setenv("CDT_TEST_ENABLE_OHHTTPSTUBS", "1", true);
+
+    NSDictionary *env = NSProcessInfo.processInfo.environment;
+    NSInteger docCount = [env[kDocCountVariable] integerValue];
+    self.docCount = docCount > 0 ? (NSUInteger)docCount : 10000;
+
+    self.remote = [[CDTBenchmarkRemoteDatabase alloc] initWithName:@"benchmark"];
+    self.remote.latency = [env[kLatencyVariable] doubleValue] / 1000;
+    self.remote.bandwidth = [env[kBandwidthVariable] doubleValue];
+    [self.remote start];
+    // The fake server's support for _bulk_get changes from one benchmark to the next.
+    [TDPuller forgetServerCapabilities];
+
+    self.replicatorFactory = [[CDTReplicatorFactory alloc] initWithDatastoreManager:self.factory];
+}
+
+- (void)tearDown
+{
+    [self.remote stop];
+    self.remote = nil;
+    self.replicatorFactory = nil;
+    unsetenv("CDT_TEST_ENABLE_OHHTTPSTUBS");
+    [super tearDown];
+}
+
+#pragma mark Measuring
+
+/** Runs the replication to completion and returns its metrics. */
+- (CDTReplicationMetrics *)run:(CDTAbstractReplication *)replication
+{
+    NSError *error;
+    CDTReplicator *replicator = [self.replicatorFactory oneWay:replication error:&error];
+    XCTAssertNotNil(replicator, @"%@", error);
+
+    dispatch_group_t group = dispatch_group_create();
+    XCTAssertTrue([replicator startWithTaskGroup:group error:&error], @"%@", error);
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+    XCTAssertEqual(replicator.state, CDTReplicatorStateComplete, @"%@", replicator.error);
+    return replicator.metrics;
+}
+
+/**
+ Runs a replication of all the documents kSamples times and records the median run under `name`.
+
+ @param block sets up a fresh source or target and returns the replication to run
+ */
+- (void)measure:(NSString *)name replication:(CDTAbstractReplication * (^)(NSUInteger sample))block
+{
+    NSMutableArray<CDTReplicationMetrics *> *runs = [NSMutableArray arrayWithCapacity:kSamples];
+    for (NSUInteger i = 0; i < kSamples; i++) {
+        @autoreleasepool
+        {
+            [runs addObject:[self run:block(i)]];
+        }
+    }
+    [runs sortUsingComparator:^NSComparisonResult(CDTReplicationMetrics *a, CDTReplicationMetrics *b) {
+        return [@(a.elapsedTime) compare:@(b.elapsedTime)];
+    }];
+    CDTReplicationMetrics *median = runs[kSamples / 2];
+
+    NSUInteger requests = 0;
+    NSMutableDictionary *requestsByEndpoint = [NSMutableDictionary dictionary];
+    for (NSString *endpoint in median.endpoints) {
+        NSUInteger count = median.endpoints[endpoint].requestCount;
+        requestsByEndpoint[endpoint] = @(count);
+        requests += count;
+    }
+
+    double docs = (double)self.docCount;
+    NSDictionary *result = @{
+        @"name" : name,
+        @"samples" : @(kSamples),
+        @"documents" : @(self.docCount),
+        @"p50_ms" : @(median.elapsedTime * 1000),
+        @"docs_per_sec" : @(median.elapsedTime > 0 ? docs / median.elapsedTime : 0),
+        @"requests_per_doc" : @(requests / docs),
+        @"bytes_sent_per_doc" : @(median.bytesSent / docs),
+        @"bytes_received_per_doc" : @(median.bytesReceived / docs),
+        @"requests" : requestsByEndpoint
+    };
+    [results addObject:result];
+    NSLog(@"Benchmark %@", result);
+}
+
+- (CDTDatastore *)datastoreNamed:(NSString *)name
+{
+    NSError *error;
+    CDTDatastore *datastore = [self.factory datastoreNamed:name error:&error];
+    XCTAssertNotNil(datastore, @"%@", error);
+    return datastore;
+}
+
+#pragma mark Benchmarks
+
+- (void)measurePullWithBulkGet:(BOOL)bulkGet name:(NSString *)name
+{
+    self.remote.supportsBulkGet = bulkGet;
+    [self.remote populateWithDocuments:self.docCount];
+    [self measure:name
+        replication:^CDTAbstractReplication *(NSUInteger sample) {
+            NSString *dbName = [NSString stringWithFormat:@"%@-%lu", name, (unsigned long)sample];
+            return [CDTPullReplication replicationWithSource:self.remote.url
+                                                      target:[self datastoreNamed:dbName]];
+        }];
+}
+
+- (void)testPullWithBulkGet { [self measurePullWithBulkGet:YES name:@"pull_bulk_get"]; }
+
+- (void)testPullWithoutBulkGet { [self measurePullWithBulkGet:NO name:@"pull_without_bulk_get"]; }
+
+- (void)testPush
+{
+    CDTDatastore *datastore = [self datastoreNamed:@"push"];
+    const NSUInteger batchSize = 1000;
+    for (NSUInteger start = 0; start < self.docCount; start += batchSize) {
+        @autoreleasepool
+        {
+            NSMutableArray *revs = [NSMutableArray arrayWithCapacity:batchSize];
+            for (NSUInteger n = start; n < MIN(start + batchSize, self.docCount); n++) {
+                CDTDocumentRevision *rev = [CDTDocumentRevision
+                    revisionWithDocId:[NSString stringWithFormat:@"doc-%06lu", (unsigned long)n]];
+                rev.body = [@{ @"name" : (n % 2) ? @"mike" : @"fred", @"docNumber" : @(n) } mutableCopy];
+                [revs addObject:rev];
+            }
+            XCTAssertNotNil([datastore createDocumentsFromRevisions:revs error:nil]);
+        }
+    }
+
+    [self measure:@"push"
+        replication:^CDTAbstractReplication *(NSUInteger sample) {
+            // Each run pushes everything to an empty database, which has no checkpoint either.
+            [self.remote reset];
+            return [CDTPushReplication replicationWithSource:datastore target:self.remote.url];
+        }];
+    XCTAssertEqual(self.remote.documentCount, self.docCount);
+}
+
+@end
@@ -0,0 +1,116 @@
+//
+//  CDTReplicationEstimateTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "CDTReplicationEstimate.h"
+
+@interface CDTReplicationEstimateTests : XCTestCase
+
+@end
+
+@implementation CDTReplicationEstimateTests
+
+- (NSDictionary *)changesWithAttachmentLength:(NSUInteger)length count:(NSUInteger)count
+{
+    NSMutableArray *results = [NSMutableArray array];
+    for (NSUInteger i = 0; i < count; i++) {
+        NSString *docID = [NSString stringWithFormat:@"doc%lu", (unsigned long)i];
+        [results addObject:@{
+            @"id" : docID,
+            @"changes" : @[ @{ @"rev" : @"1-a" } ],
+            @"doc" : @{
+                @"_id" : docID,
+                @"_rev" : @"1-a",
+                @"_attachments" : @{ @"a.txt" : @{ @"stub" : @YES, @"length" : @(length) } }
+            }
+        }];
+    }
+    return @{ @"results" : results };
+}
+
+- (void)testExtrapolatesFromPendingCount
+{
+    NSMutableDictionary *changes = [[self changesWithAttachmentLength:1000 count:10] mutableCopy];
+    changes[@"pending"] = @90;
+    CDTReplicationEstimate *estimate =
+        [[CDTReplicationEstimate alloc] initWithDatabaseInfo:@{ @"doc_count" : @500 }
+                                                lastSequence:@"10-abc"
+                                               sampleChanges:changes
+                                                 sampleLimit:10
+                                              sampleDuration:1.0
+                                         sampleBytesReceived:10000];
+    XCTAssertEqual(estimate.remoteDocumentCount, (NSUInteger)500);
+    XCTAssertEqual(estimate.sampleSize, (NSUInteger)10);
+    XCTAssertEqual(estimate.pendingChanges, (NSUInteger)100);
+    XCTAssertEqual(estimate.pendingRevisions, (NSUInteger)100);
+    XCTAssertEqual(estimate.attachmentBytes, (UInt64)100000);
+    XCTAssertGreaterThan(estimate.documentBytes, (UInt64)0);
+    XCTAssertFalse(estimate.exact);
+
+    // The sample's ten changes took a second, and its bytes arrived at 10000 a second.
+    XCTAssertEqualWithAccuracy(estimate.estimatedDuration, 10.0 + 10.0, 0.001);
+}
+
+- (void)testShortPageIsExact
+{
+    CDTReplicationEstimate *estimate =
+        [[CDTReplicationEstimate alloc] initWithDatabaseInfo:@{ @"doc_count" : @500 }
+                                                lastSequence:nil
+                                               sampleChanges:[self changesWithAttachmentLength:5
+                                                                                         count:3]
+                                                 sampleLimit:10
+                                              sampleDuration:0.5
+                                         sampleBytesReceived:0];
+    XCTAssertTrue(estimate.exact);
+    XCTAssertEqual(estimate.pendingChanges, (NSUInteger)3);
+    XCTAssertEqual(estimate.attachmentBytes, (UInt64)15);
+    XCTAssertEqualWithAccuracy(estimate.estimatedDuration, 0.5, 0.001);
+}
+
+- (void)testFallsBackToDatabaseInfo
+{
+    NSDictionary *changes = [self changesWithAttachmentLength:0 count:10];
+    CDTReplicationEstimate *fromStart =
+        [[CDTReplicationEstimate alloc] initWithDatabaseInfo:@{ @"doc_count" : @40,
+                                                                @"doc_del_count" : @10 }
+                                                lastSequence:nil
+                                               sampleChanges:changes
+                                                 sampleLimit:10
+                                              sampleDuration:1.0
+                                         sampleBytesReceived:1000];
+    XCTAssertEqual(fromStart.pendingChanges, (NSUInteger)50);
+
+    CDTReplicationEstimate *numeric =
+        [[CDTReplicationEstimate alloc] initWithDatabaseInfo:@{ @"update_seq" : @120 }
+                                                lastSequence:@100
+                                               sampleChanges:changes
+                                                 sampleLimit:10
+                                              sampleDuration:1.0
+                                         sampleBytesReceived:1000];
+    XCTAssertEqual(numeric.pendingChanges, (NSUInteger)20);
+
+    // An opaque sequence gives no bound, so the sample is all that's known.
+    CDTReplicationEstimate *opaque =
+        [[CDTReplicationEstimate alloc] initWithDatabaseInfo:@{ @"update_seq" : @"120-xyz" }
+                                                lastSequence:@"100-abc"
+                                               sampleChanges:changes
+                                                 sampleLimit:10
+                                              sampleDuration:1.0
+                                         sampleBytesReceived:1000];
+    XCTAssertEqual(opaque.pendingChanges, (NSUInteger)10);
+    XCTAssertFalse(opaque.exact);
+}
+
+@end
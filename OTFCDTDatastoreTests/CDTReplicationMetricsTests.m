@@ -0,0 +1,98 @@
+//
+//  CDTReplicationMetricsTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "CDTReplicationMetrics.h"
+
+@interface CDTReplicationMetricsTests : XCTestCase
+
+@end
+
+@implementation CDTReplicationMetricsTests
+
+- (void)recordRequestTo:(NSString *)url status:(NSInteger)status latency:(NSTimeInterval)latency
+              inMetrics:(CDTReplicationMetrics *)metrics
+{
+    [metrics recordRequestWithURL:[NSURL URLWithString:url]
+                       statusCode:status
+                           failed:NO
+                        bytesSent:100
+                    bytesReceived:1000
+                          latency:latency];
+}
+
+- (void)testEndpointForURL
+{
+    XCTAssertEqualObjects([CDTReplicationMetrics
+                              endpointForURL:[NSURL URLWithString:@"http://h/db/_bulk_get"]],
+                          @"_bulk_get");
+    XCTAssertEqualObjects(
+        [CDTReplicationMetrics endpointForURL:[NSURL URLWithString:@"http://h/db/_changes?since=0"]],
+        @"_changes");
+    XCTAssertEqualObjects(
+        [CDTReplicationMetrics endpointForURL:[NSURL URLWithString:@"http://h/db/_local/abc"]],
+        @"_local");
+    XCTAssertEqualObjects(
+        [CDTReplicationMetrics endpointForURL:[NSURL URLWithString:@"http://h/db/doc1?revs=true"]],
+        @"document");
+}
+
+- (void)testRequestsAreRecordedPerEndpoint
+{
+    CDTReplicationMetrics *metrics = [[CDTReplicationMetrics alloc] init];
+    [self recordRequestTo:@"http://h/db/_bulk_get" status:200 latency:0.005 inMetrics:metrics];
+    [self recordRequestTo:@"http://h/db/_bulk_get" status:200 latency:0.3 inMetrics:metrics];
+    [self recordRequestTo:@"http://h/db/_bulk_get" status:429 latency:20 inMetrics:metrics];
+    [self recordRequestTo:@"http://h/db/_changes" status:200 latency:1.5 inMetrics:metrics];
+
+    XCTAssertEqual(metrics.bytesSent, (UInt64)400);
+    XCTAssertEqual(metrics.bytesReceived, (UInt64)4000);
+    XCTAssertEqual(metrics.throttledCount, (NSUInteger)1);
+
+    CDTEndpointMetrics *bulkGet = metrics.endpoints[@"_bulk_get"];
+    XCTAssertEqual(bulkGet.requestCount, (NSUInteger)3);
+    XCTAssertEqual(bulkGet.errorCount, (NSUInteger)1);
+    XCTAssertEqualWithAccuracy(bulkGet.maxLatency, 20, 0.001);
+
+    NSArray *histogram = bulkGet.latencyHistogram;
+    XCTAssertEqual(histogram.count, [CDTEndpointMetrics latencyBucketUpperBounds].count + 1);
+    XCTAssertEqualObjects(histogram[0], @1);   // < 10ms
+    XCTAssertEqualObjects(histogram[5], @1);   // 250-500ms
+    XCTAssertEqualObjects(histogram.lastObject, @1);  // > 10s
+
+    XCTAssertEqual(metrics.endpoints[@"_changes"].requestCount, (NSUInteger)1);
+}
+
+- (void)testCopyIsASnapshot
+{
+    CDTReplicationMetrics *metrics = [[CDTReplicationMetrics alloc] init];
+    [self recordRequestTo:@"http://h/db/_bulk_docs" status:201 latency:0.1 inMetrics:metrics];
+    [metrics recordRetry];
+    [metrics recordQueueDepth:40];
+    [metrics recordQueueDepth:10];
+
+    CDTReplicationMetrics *snapshot = [metrics copy];
+    [self recordRequestTo:@"http://h/db/_bulk_docs" status:201 latency:0.1 inMetrics:metrics];
+    [metrics recordRetry];
+
+    XCTAssertEqual(snapshot.retryCount, (NSUInteger)1);
+    XCTAssertEqual(snapshot.endpoints[@"_bulk_docs"].requestCount, (NSUInteger)1);
+    XCTAssertEqual(snapshot.queueDepth, (NSUInteger)10);
+    XCTAssertEqual(snapshot.maxQueueDepth, (NSUInteger)40);
+    XCTAssertEqual(metrics.retryCount, (NSUInteger)2);
+    XCTAssertEqual(metrics.endpoints[@"_bulk_docs"].requestCount, (NSUInteger)2);
+}
+
+@end
@@ -0,0 +1,182 @@
+//
+//  CDTReplicationSchedulerTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+
+#import <XCTest/XCTest.h>
+
+#import "CDTHTTPConnectionBudget.h"
+#import "CDTReplicationScheduler.h"
+
+@interface CDTReplicationSchedulerTests : XCTestCase
+
+@end
+
+@implementation CDTReplicationSchedulerTests
+
+- (void)testRunsAtMostMaxConcurrentReplications
+{
+    CDTReplicationScheduler *scheduler =
+        [[CDTReplicationScheduler alloc] initWithMaxConcurrentReplications:2 maxConnections:2];
+    NSMutableArray *started = [NSMutableArray array];
+    for (NSString *job in @[ @"a", @"b", @"c" ]) {
+        [scheduler enqueueJob:job
+                     priority:CDTReplicationPriorityNormal
+                    taskGroup:nil
+                        start:^{
+                            [started addObject:job];
+                        }];
+    }
+    XCTAssertEqualObjects(started, (@[ @"a", @"b" ]));
+    XCTAssertEqual(scheduler.runningCount, (NSUInteger)2);
+    XCTAssertEqual(scheduler.queuedCount, (NSUInteger)1);
+
+    [scheduler jobFinished:@"a"];
+    XCTAssertEqualObjects(started, (@[ @"a", @"b", @"c" ]));
+    XCTAssertEqual(scheduler.queuedCount, (NSUInteger)0);
+}
+
+- (void)testContinuousReplicationsDontTakeAWorker
+{
+    CDTReplicationScheduler *scheduler =
+        [[CDTReplicationScheduler alloc] initWithMaxConcurrentReplications:1 maxConnections:1];
+    NSMutableArray *started = [NSMutableArray array];
+    for (NSString *job in @[ @"continuous1", @"continuous2" ]) {
+        [scheduler enqueueJob:job
+                     priority:CDTReplicationPriorityNormal
+                   continuous:YES
+                    taskGroup:nil
+                        start:^{
+                            [started addObject:job];
+                        }];
+    }
+    [scheduler enqueueJob:@"oneShot"
+                 priority:CDTReplicationPriorityNormal
+                taskGroup:nil
+                    start:^{
+                        [started addObject:@"oneShot"];
+                    }];
+    XCTAssertEqualObjects(started, (@[ @"continuous1", @"continuous2", @"oneShot" ]));
+    XCTAssertEqual(scheduler.runningCount, (NSUInteger)1);
+    XCTAssertEqual(scheduler.queuedCount, (NSUInteger)0);
+
+    // Stopping a continuous replication doesn't free a worker it never had
+    XCTAssertFalse([scheduler cancelJob:@"continuous1"]);
+    [scheduler jobFinished:@"continuous1"];
+    XCTAssertEqual(scheduler.runningCount, (NSUInteger)1);
+}
+
+- (void)testQueuedReplicationsStartInPriorityOrder
+{
+    CDTReplicationScheduler *scheduler =
+        [[CDTReplicationScheduler alloc] initWithMaxConcurrentReplications:1 maxConnections:1];
+    NSMutableArray *started = [NSMutableArray array];
+    void (^enqueue)(NSString *, CDTReplicationPriority) =
+        ^(NSString *job, CDTReplicationPriority priority) {
+            [scheduler enqueueJob:job
+                         priority:priority
+                        taskGroup:nil
+                            start:^{
+                                [started addObject:job];
+                            }];
+        };
+    enqueue(@"running", CDTReplicationPriorityLow);
+    enqueue(@"low", CDTReplicationPriorityLow);
+    enqueue(@"normal1", CDTReplicationPriorityNormal);
+    enqueue(@"high", CDTReplicationPriorityHigh);
+    enqueue(@"normal2", CDTReplicationPriorityNormal);
+
+    for (NSString *job in @[ @"running", @"high", @"normal1", @"normal2" ]) {
+        [scheduler jobFinished:job];
+    }
+    XCTAssertEqualObjects(started, (@[ @"running", @"high", @"normal1", @"normal2", @"low" ]));
+}
+
+- (void)testCancelledJobNeverStartsAndLeavesTaskGroup
+{
+    CDTReplicationScheduler *scheduler =
+        [[CDTReplicationScheduler alloc] initWithMaxConcurrentReplications:1 maxConnections:1];
+    dispatch_group_t group = dispatch_group_create();
+    __block BOOL queuedStarted = NO;
+    [scheduler enqueueJob:@"running" priority:CDTReplicationPriorityNormal taskGroup:nil start:^{}];
+    [scheduler enqueueJob:@"queued"
+                 priority:CDTReplicationPriorityNormal
+                taskGroup:group
+                    start:^{
+                        queuedStarted = YES;
+                    }];
+    XCTAssertNotEqual(dispatch_group_wait(group, DISPATCH_TIME_NOW), 0);
+
+    XCTAssertTrue([scheduler cancelJob:@"queued"]);
+    XCTAssertFalse([scheduler cancelJob:@"running"]);
+    XCTAssertEqual(dispatch_group_wait(group, DISPATCH_TIME_NOW), 0);
+
+    [scheduler jobFinished:@"running"];
+    XCTAssertFalse(queuedStarted);
+    XCTAssertEqual(scheduler.runningCount, (NSUInteger)0);
+}
+
+- (void)testFreedConnectionGoesToOwnerWithFewestInFlight
+{
+    CDTHTTPConnectionBudget *budget = [[CDTHTTPConnectionBudget alloc] initWithLimit:2];
+    NSObject *large = [[NSObject alloc] init];
+    NSObject *small = [[NSObject alloc] init];
+    [budget acquireSlotForOwner:large weight:1];
+    [budget acquireSlotForOwner:large weight:1];
+
+    NSMutableArray *granted = [NSMutableArray array];
+    dispatch_group_t waiters = dispatch_group_create();
+    dispatch_queue_t queue = dispatch_get_global_queue(QOS_CLASS_UTILITY, 0);
+    dispatch_group_async(waiters, queue, ^{
+        [budget acquireSlotForOwner:large weight:1];
+        @synchronized(granted) { [granted addObject:@"large"]; }
+    });
+    [NSThread sleepForTimeInterval:0.1];  // so the large owner's request is queued first
+    dispatch_group_async(waiters, queue, ^{
+        [budget acquireSlotForOwner:small weight:1];
+        @synchronized(granted) { [granted addObject:@"small"]; }
+    });
+    [NSThread sleepForTimeInterval:0.1];
+    XCTAssertEqual(granted.count, (NSUInteger)0);
+
+    [budget releaseSlotForOwner:large];
+    [NSThread sleepForTimeInterval:0.1];
+    @synchronized(granted) { XCTAssertEqualObjects(granted, @[ @"small" ]); }
+
+    [budget releaseSlotForOwner:small];
+    XCTAssertEqual(dispatch_group_wait(waiters, dispatch_time(DISPATCH_TIME_NOW, 5 * NSEC_PER_SEC)), 0);
+    XCTAssertEqualObjects(granted, (@[ @"small", @"large" ]));
+    XCTAssertEqual(budget.slotsInUse, (NSUInteger)2);
+}
+
+- (void)testHandlerIsCalledOnceSlotIsFree
+{
+    CDTHTTPConnectionBudget *budget = [[CDTHTTPConnectionBudget alloc] initWithLimit:1];
+    NSObject *owner = [[NSObject alloc] init];
+    [budget acquireSlotForOwner:owner weight:1];
+
+    dispatch_semaphore_t granted = dispatch_semaphore_create(0);
+    [budget acquireSlotForOwner:owner
+                         weight:1
+                        handler:^{
+                            dispatch_semaphore_signal(granted);
+                        }];
+    // Returned without blocking, and the handler waits for the slot.
+    XCTAssertNotEqual(dispatch_semaphore_wait(granted, dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC / 10)), 0);
+
+    [budget releaseSlotForOwner:owner];
+    XCTAssertEqual(dispatch_semaphore_wait(granted, dispatch_time(DISPATCH_TIME_NOW, 5 * NSEC_PER_SEC)), 0);
+    XCTAssertEqual(budget.slotsInUse, (NSUInteger)1);
+}
+
+@end
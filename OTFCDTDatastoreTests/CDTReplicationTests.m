@@ -25,8 +25,12 @@
 #import "TD_Revision.h"
 #import "TDPuller.h"
 #import "TDPusher.h"
+#import "TDChangeTracker.h"
+#import "TDJSON.h"
 #import "CDTSessionCookieInterceptor.h"
 #import "CDTReplay429Interceptor.h"
+#import "CDTReplicationScheduler.h"
+#import "CDTReplicationEstimate.h"
 #import "TD_Database.h"
 #import <OHHTTPStubs/OHHTTPStubs.h>
 #import <OHHTTPStubs/OHHTTPStubsResponse+JSON.h>
@@ -235,6 +239,300 @@
     XCTAssertEqualObjects(expectedPayload, [cookieInterceptor sessionRequestBody]);
 }
 
+- (void)testAdaptiveBatchingAddsControllerToPull
+{
+    CDTReplicatorFactory *factory = [[CDTReplicatorFactory alloc] initWithDatastoreManager:self.factory];
+    NSError *error;
+    NSURL *remoteUrl = [[NSURL alloc] initWithString:@"http://example.com"];
+    CDTDatastore *tmp = [self.factory datastoreNamed:@"test_database" error:&error];
+    CDTPullReplication *pull = [CDTPullReplication replicationWithSource:remoteUrl target:tmp];
+
+    TDPuller *puller = (TDPuller *)[[factory oneWay:pull error:nil] buildTDReplicatorFromConfiguration:nil];
+    XCTAssertNil(puller.batchController);
+    XCTAssertEqual(puller.interceptors.count, 0);
+
+    pull.adaptiveBatching = YES;
+    XCTAssertTrue([pull copy].adaptiveBatching);
+    puller = (TDPuller *)[[factory oneWay:pull error:nil] buildTDReplicatorFromConfiguration:nil];
+    XCTAssertNotNil(puller.batchController);
+    XCTAssertEqual(puller.interceptors.count, 1);
+    XCTAssertEqual(puller.interceptors[0], puller.batchController);
+}
+
+- (void)testChangesFeedPrefetchDepthPassedToPuller
+{
+    CDTReplicatorFactory *factory = [[CDTReplicatorFactory alloc] initWithDatastoreManager:self.factory];
+    NSError *error;
+    NSURL *remoteUrl = [[NSURL alloc] initWithString:@"http://example.com"];
+    CDTDatastore *tmp = [self.factory datastoreNamed:@"test_database" error:&error];
+    CDTPullReplication *pull = [CDTPullReplication replicationWithSource:remoteUrl target:tmp];
+    XCTAssertEqual(pull.changesFeedPrefetchDepth, (NSUInteger)1);
+
+    pull.changesFeedPrefetchDepth = 2;
+    XCTAssertEqual([pull copy].changesFeedPrefetchDepth, (NSUInteger)2);
+    TDPuller *puller = (TDPuller *)[[factory oneWay:pull error:nil] buildTDReplicatorFromConfiguration:nil];
+    XCTAssertEqual(puller.changesFeedPrefetchDepth, 2u);
+}
+
+- (void)testPendingBudgetsPassedToPuller
+{
+    CDTReplicatorFactory *factory = [[CDTReplicatorFactory alloc] initWithDatastoreManager:self.factory];
+    NSError *error;
+    NSURL *remoteUrl = [[NSURL alloc] initWithString:@"http://example.com"];
+    CDTDatastore *tmp = [self.factory datastoreNamed:@"test_database" error:&error];
+    CDTPullReplication *pull = [CDTPullReplication replicationWithSource:remoteUrl target:tmp];
+    XCTAssertEqual(pull.maxPendingRevisions, (NSUInteger)5000);
+    XCTAssertEqual(pull.maxPendingBytes, (UInt64)(32 * 1024 * 1024));
+
+    pull.maxPendingRevisions = 200;
+    pull.maxPendingBytes = 1024;
+    CDTPullReplication *copy = [pull copy];
+    XCTAssertEqual(copy.maxPendingRevisions, (NSUInteger)200);
+    XCTAssertEqual(copy.maxPendingBytes, (UInt64)1024);
+    TDPuller *puller = (TDPuller *)[[factory oneWay:pull error:nil] buildTDReplicatorFromConfiguration:nil];
+    XCTAssertEqual(puller.maxPendingRevisions, (NSUInteger)200);
+    XCTAssertEqual(puller.maxPendingBytes, (UInt64)1024);
+}
+
+- (void)testCheckpointSettingsPassedToReplicator
+{
+    CDTReplicatorFactory *factory = [[CDTReplicatorFactory alloc] initWithDatastoreManager:self.factory];
+    NSError *error;
+    NSURL *remoteUrl = [[NSURL alloc] initWithString:@"http://example.com"];
+    CDTDatastore *tmp = [self.factory datastoreNamed:@"test_database" error:&error];
+    CDTPushReplication *push = [CDTPushReplication replicationWithSource:tmp target:remoteUrl];
+    XCTAssertEqual(push.checkpointInterval, 5.0);
+    XCTAssertFalse(push.localInterimCheckpoints);
+
+    push.checkpointInterval = 30;
+    push.checkpointAfterDocuments = 1000;
+    push.checkpointAfterBytes = 1 << 20;
+    push.localInterimCheckpoints = YES;
+    XCTAssertTrue([push copy].localInterimCheckpoints);
+    TDReplicator *pusher = [[factory oneWay:push error:nil] buildTDReplicatorFromConfiguration:nil];
+    XCTAssertEqual(pusher.checkpointInterval, 30.0);
+    XCTAssertEqual(pusher.checkpointAfterChanges, (NSUInteger)1000);
+    XCTAssertEqual(pusher.checkpointAfterBytes, (UInt64)(1 << 20));
+    XCTAssertTrue(pusher.localInterimCheckpoints);
+}
+
+- (void)testUploadSettingsPassedToPusher
+{
+    CDTReplicatorFactory *factory = [[CDTReplicatorFactory alloc] initWithDatastoreManager:self.factory];
+    NSError *error;
+    NSURL *remoteUrl = [[NSURL alloc] initWithString:@"http://example.com"];
+    CDTDatastore *tmp = [self.factory datastoreNamed:@"test_database" error:&error];
+    CDTPushReplication *push = [CDTPushReplication replicationWithSource:tmp target:remoteUrl];
+    XCTAssertEqual(push.maxConcurrentUploads, (NSUInteger)4);
+    XCTAssertEqual(push.multipartAttachmentLength, 1024ull * 1024);
+    XCTAssertEqual(push.maxBatchesInFlight, (NSUInteger)2);
+
+    push.maxConcurrentUploads = 8;
+    push.multipartAttachmentLength = 64 * 1024;
+    push.maxBatchesInFlight = 3;
+    XCTAssertEqual([push copy].maxConcurrentUploads, (NSUInteger)8);
+    XCTAssertEqual([push copy].maxBatchesInFlight, (NSUInteger)3);
+    TDPusher *pusher =
+        (TDPusher *)[[factory oneWay:push error:nil] buildTDReplicatorFromConfiguration:nil];
+    XCTAssertEqual(pusher.maxConcurrentUploads, (NSUInteger)8);
+    XCTAssertEqual(pusher.multipartAttachmentLength, (UInt64)(64 * 1024));
+    XCTAssertEqual(pusher.maxBatchesInFlight, (NSUInteger)3);
+}
+
+- (void)testEstimateOfPullReadsInfoAndSamplesChanges
+{
+    CDTReplicatorFactory *factory = [[CDTReplicatorFactory alloc] initWithDatastoreManager:self.factory];
+    NSError *error;
+    NSURL *remoteUrl = [[NSURL alloc] initWithString:@"http://estimate.example.com/db"];
+    CDTDatastore *tmp = [self.factory datastoreNamed:@"test_database" error:&error];
+    CDTPullReplication *pull = [CDTPullReplication replicationWithSource:remoteUrl target:tmp];
+
+    NSMutableArray<NSURLRequest *> *seen = [NSMutableArray array];
+    id<OHHTTPStubsDescriptor> stub = [OHHTTPStubs stubRequestsPassingTest:^BOOL(NSURLRequest *request) {
+        return [request.URL.host isEqualToString:@"estimate.example.com"];
+    }
+        withStubResponse:^OHHTTPStubsResponse *(NSURLRequest *request) {
+            @synchronized(seen) { [seen addObject:request]; }
+            NSDictionary *json;
+            if ([request.URL.path hasSuffix:@"/_changes"]) {
+                json = @{
+                    @"results" : @[ @{
+                        @"seq" : @"1-a",
+                        @"id" : @"doc1",
+                        @"changes" : @[ @{ @"rev" : @"1-x" } ],
+                        @"doc" : @{
+                            @"_id" : @"doc1",
+                            @"_rev" : @"1-x",
+                            @"_attachments" : @{ @"a" : @{ @"stub" : @YES, @"length" : @500 } }
+                        }
+                    } ],
+                    @"pending" : @9
+                };
+            } else {
+                json = @{ @"doc_count" : @10, @"update_seq" : @"10-z" };
+            }
+            return [OHHTTPStubsResponse responseWithJSONObject:json statusCode:200 headers:nil];
+        }];
+
+    __block CDTReplicationEstimate *estimate;
+    __block BOOL done = NO;
+    CDTReplicator *replicator = [factory oneWay:pull error:nil];
+    [replicator estimatePendingWorkWithCompletionHandler:^(CDTReplicationEstimate *e, NSError *err) {
+        XCTAssertNil(err);
+        estimate = e;
+        done = YES;
+    }];
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:10];
+    while (!done && [deadline timeIntervalSinceNow] > 0) {
+        [NSThread sleepForTimeInterval:0.05];
+    }
+    [OHHTTPStubs removeStub:stub];
+
+    XCTAssertTrue(done);
+    XCTAssertEqual(estimate.remoteDocumentCount, (NSUInteger)10);
+    XCTAssertEqual(estimate.pendingChanges, (NSUInteger)10);
+    XCTAssertEqual(estimate.attachmentBytes, (UInt64)5000);
+    XCTAssertNil(estimate.lastSequence);
+    XCTAssertEqual(seen.count, (NSUInteger)2);
+    XCTAssertTrue([seen.lastObject.URL.query containsString:@"include_docs=true"]);
+
+    // The replicator itself is still ready to start.
+    XCTAssertEqual(replicator.state, CDTReplicatorStatePending);
+}
+
+- (void)testEstimateOfPushIsAnError
+{
+    CDTReplicatorFactory *factory = [[CDTReplicatorFactory alloc] initWithDatastoreManager:self.factory];
+    NSError *error;
+    NSURL *remoteUrl = [[NSURL alloc] initWithString:@"http://example.com"];
+    CDTDatastore *tmp = [self.factory datastoreNamed:@"test_database" error:&error];
+    CDTPushReplication *push = [CDTPushReplication replicationWithSource:tmp target:remoteUrl];
+
+    __block NSError *estimateError;
+    [[factory oneWay:push error:nil]
+        estimatePendingWorkWithCompletionHandler:^(CDTReplicationEstimate *e, NSError *err) {
+            XCTAssertNil(e);
+            estimateError = err;
+        }];
+    XCTAssertEqual(estimateError.code, CDTReplicatorErrorEstimateNotSupported);
+}
+
+- (void)testPrioritizeDocumentPassedToPuller
+{
+    CDTReplicatorFactory *factory = [[CDTReplicatorFactory alloc] initWithDatastoreManager:self.factory];
+    NSError *error;
+    NSURL *remoteUrl = [[NSURL alloc] initWithString:@"http://example.com"];
+    CDTDatastore *tmp = [self.factory datastoreNamed:@"test_database" error:&error];
+    CDTPullReplication *pull = [CDTPullReplication replicationWithSource:remoteUrl target:tmp];
+    NSMutableSet *onScreen = [NSMutableSet setWithObject:@"seen"];
+    pull.prioritizeDocument = ^BOOL(NSString *documentId) {
+        return [onScreen containsObject:documentId];
+    };
+
+    XCTAssertNotNil([pull copy].prioritizeDocument);
+    TDPuller *puller = (TDPuller *)[[factory oneWay:pull error:nil] buildTDReplicatorFromConfiguration:nil];
+    XCTAssertTrue(puller.prioritizesDocID(@"seen"));
+    XCTAssertFalse(puller.prioritizesDocID(@"unseen"));
+
+    // The set can change while the replication runs
+    [onScreen addObject:@"unseen"];
+    XCTAssertTrue(puller.prioritizesDocID(@"unseen"));
+}
+
+- (void)testFactoryReplicatorsShareSchedulerConnectionBudget
+{
+    CDTReplicatorFactory *factory = [[CDTReplicatorFactory alloc] initWithDatastoreManager:self.factory];
+    XCTAssertEqual(factory.scheduler, [CDTReplicationScheduler sharedScheduler]);
+    NSError *error;
+    NSURL *remoteUrl = [[NSURL alloc] initWithString:@"http://example.com"];
+    CDTDatastore *tmp = [self.factory datastoreNamed:@"test_database" error:&error];
+    CDTPullReplication *pull = [CDTPullReplication replicationWithSource:remoteUrl target:tmp];
+    XCTAssertEqual(pull.priority, CDTReplicationPriorityNormal);
+
+    pull.priority = CDTReplicationPriorityHigh;
+    XCTAssertEqual([pull copy].priority, CDTReplicationPriorityHigh);
+    TDReplicator *puller = [[factory oneWay:pull error:nil] buildTDReplicatorFromConfiguration:nil];
+    XCTAssertEqual(puller.connectionBudget, factory.scheduler.connectionBudget);
+    XCTAssertEqual(puller.connectionWeight,
+                   [CDTReplicationScheduler connectionWeightForPriority:CDTReplicationPriorityHigh]);
+
+    CDTReplicatorFactory *unscheduled =
+        [[CDTReplicatorFactory alloc] initWithDatastoreManager:self.factory scheduler:nil];
+    puller = [[unscheduled oneWay:pull error:nil] buildTDReplicatorFromConfiguration:nil];
+    XCTAssertNil(puller.connectionBudget);
+}
+
+- (void)testSelectorPassedToPullerWithOwnCheckpoint
+{
+    CDTReplicatorFactory *factory = [[CDTReplicatorFactory alloc] initWithDatastoreManager:self.factory];
+    NSError *error;
+    NSURL *remoteUrl = [[NSURL alloc] initWithString:@"http://example.com"];
+    CDTDatastore *tmp = [self.factory datastoreNamed:@"test_database" error:&error];
+    CDTPullReplication *pull = [CDTPullReplication replicationWithSource:remoteUrl target:tmp];
+    NSString *unfilteredID =
+        [[[factory oneWay:pull error:nil] buildTDReplicatorFromConfiguration:nil] remoteCheckpointDocID];
+
+    pull.selector = @{ @"owner" : @"alice" };
+    XCTAssertEqualObjects([pull copy].selector, pull.selector);
+    TDPuller *puller = (TDPuller *)[[factory oneWay:pull error:nil] buildTDReplicatorFromConfiguration:nil];
+    XCTAssertEqualObjects(puller.selector, pull.selector);
+    NSString *aliceID = puller.remoteCheckpointDocID;
+    XCTAssertNotEqualObjects(aliceID, unfilteredID);
+
+    pull.selector = @{ @"owner" : @"bob" };
+    puller = (TDPuller *)[[factory oneWay:pull error:nil] buildTDReplicatorFromConfiguration:nil];
+    XCTAssertNotEqualObjects(puller.remoteCheckpointDocID, aliceID);
+}
+
+- (void)testWinningRevisionsOnlyPassedToPullerWithOwnCheckpoint
+{
+    CDTReplicatorFactory *factory = [[CDTReplicatorFactory alloc] initWithDatastoreManager:self.factory];
+    NSError *error;
+    NSURL *remoteUrl = [[NSURL alloc] initWithString:@"http://example.com"];
+    CDTDatastore *tmp = [self.factory datastoreNamed:@"test_database" error:&error];
+    CDTPullReplication *pull = [CDTPullReplication replicationWithSource:remoteUrl target:tmp];
+    XCTAssertFalse(pull.winningRevisionsOnly);
+    NSString *allDocsID =
+        [[[factory oneWay:pull error:nil] buildTDReplicatorFromConfiguration:nil] remoteCheckpointDocID];
+
+    pull.winningRevisionsOnly = YES;
+    XCTAssertTrue([pull copy].winningRevisionsOnly);
+    TDPuller *puller = (TDPuller *)[[factory oneWay:pull error:nil] buildTDReplicatorFromConfiguration:nil];
+    XCTAssertTrue(puller.winningRevisionsOnly);
+    XCTAssertNotEqualObjects(puller.remoteCheckpointDocID, allDocsID);
+
+    TDChangeTracker *tracker =
+        [[TDChangeTracker alloc] initWithDatabaseURL:[NSURL URLWithString:@"http://example.com/db"]
+                                                mode:kOneShot
+                                           conflicts:NO
+                                        lastSequence:nil
+                                              client:OCMProtocolMock(@protocol(TDChangeTrackerClient))
+                                             session:nil];
+    XCTAssertFalse([tracker.changesFeedPath containsString:@"style="]);
+}
+
+- (void)testChangeTrackerPostsSelector
+{
+    TDChangeTracker *tracker =
+        [[TDChangeTracker alloc] initWithDatabaseURL:[NSURL URLWithString:@"http://example.com/db"]
+                                                mode:kOneShot
+                                           conflicts:YES
+                                        lastSequence:nil
+                                              client:OCMProtocolMock(@protocol(TDChangeTrackerClient))
+                                             session:nil];
+    XCTAssertNil(tracker.changesFeedRequestBody);
+
+    tracker.selector = @{ @"owner" : @"alice" };
+    XCTAssertTrue([tracker.changesFeedPath containsString:@"&filter=_selector"]);
+    XCTAssertEqualObjects([TDJSON JSONObjectWithData:tracker.changesFeedRequestBody options:0 error:nil],
+                          (@{ @"selector" : @{ @"owner" : @"alice" } }));
+
+    // A named filter wins, as with doc_ids.
+    tracker.filterName = @"users/by_owner";
+    XCTAssertFalse([tracker.changesFeedPath containsString:@"_selector"]);
+    XCTAssertNil(tracker.changesFeedRequestBody);
+}
+
 - (void)testURLCredsReplacedWithCookieInterceptorPull
 {
     NSError *error;
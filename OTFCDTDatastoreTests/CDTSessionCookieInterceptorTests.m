@@ -478,4 +478,83 @@ static const NSString *testCookieHeaderValue2 =
     XCTAssert([helper currentResponse] == expectedRequests);
 }
 
+/** Stubs _session on `host`, counting the logins, with cookies living `maxAge` seconds. */
+- (void)stubSessionForHost:(NSString *)host
+                    maxAge:(NSUInteger)maxAge
+                    logins:(NSUInteger *)logins
+              cookieValues:(NSArray<NSString *> *)cookieValues
+{
+    [OHHTTPStubs stubRequestsPassingTest:^BOOL(NSURLRequest *__nonnull request) {
+      return [[request.URL host] isEqualToString:host];
+    }
+        withStubResponse:^OHHTTPStubsResponse *__nonnull(NSURLRequest *__nonnull request) {
+          NSUInteger login;
+          @synchronized(self) { login = (*logins)++; }
+          NSString *value = cookieValues[MIN(login, cookieValues.count - 1)];
+          return [[OHHTTPStubsResponse
+              responseWithJSONObject:@{ @"ok" : @(YES), @"name" : @"username" }
+                          statusCode:200
+                             headers:@{
+                                 @"Set-Cookie" : [NSString
+                                     stringWithFormat:@"%@; Version=1; Path=/; HttpOnly; Max-Age=%lu",
+                                                      value, (unsigned long)maxAge]
+                             }] responseTime:0.2];
+        }];
+}
+
+- (void)testConcurrentRequestsShareOneLogin
+{
+    __block NSUInteger logins = 0;
+    [self stubSessionForHost:@"username4.cloudant.com"
+                      maxAge:86400
+                      logins:&logins
+                cookieValues:@[ (NSString *)testCookieHeaderValue ]];
+
+    CDTSessionCookieInterceptor *interceptor =
+        [[CDTSessionCookieInterceptor alloc] initWithUsername:@"username" password:@"password"];
+    NSURL *url = [NSURL URLWithString:@"http://username4.cloudant.com/somedb"];
+
+    dispatch_apply(8, dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^(size_t i) {
+      CDTHTTPInterceptorContext *context = [[CDTHTTPInterceptorContext alloc]
+          initWithRequest:[[NSURLRequest requestWithURL:url] mutableCopy]
+                    state:[NSMutableDictionary dictionary]];
+      context = [interceptor interceptRequestInContext:context];
+      XCTAssertEqualObjects([context.request valueForHTTPHeaderField:@"Cookie"],
+                            testCookieHeaderValue);
+    });
+
+    XCTAssertEqual(logins, (NSUInteger)1);
+}
+
+- (void)testCookieIsRenewedInTheBackgroundBeforeItExpires
+{
+    // 400 seconds is usable, but within a quarter of its life of the 5 minute margin.
+    __block NSUInteger logins = 0;
+    [self stubSessionForHost:@"username5.cloudant.com"
+                      maxAge:400
+                      logins:&logins
+                cookieValues:@[ (NSString *)testCookieHeaderValue, (NSString *)testCookieHeaderValue2 ]];
+
+    CDTSessionCookieInterceptor *interceptor =
+        [[CDTSessionCookieInterceptor alloc] initWithUsername:@"username" password:@"password"];
+    NSURL *url = [NSURL URLWithString:@"http://username5.cloudant.com/somedb"];
+    NSArray<NSHTTPCookie *> *first = [interceptor sessionCookiesForRequestURL:url];
+    XCTAssertEqualObjects(first[0].value, interceptor.cookies[0].value);
+    XCTAssertEqual(logins, (NSUInteger)1);
+
+    // The next request is sent with the old cookie, without waiting for the renewal.
+    NSArray<NSHTTPCookie *> *second = [interceptor sessionCookiesForRequestURL:url];
+    XCTAssertEqualObjects(second[0].value, first[0].value);
+
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5];
+    while ([interceptor.cookies[0].value isEqualToString:first[0].value] &&
+           [deadline timeIntervalSinceNow] > 0) {
+        [NSThread sleepForTimeInterval:0.05];
+    }
+    NSString *renewed =
+        [NSString stringWithFormat:@"%@=%@", interceptor.cookies[0].name, interceptor.cookies[0].value];
+    XCTAssertEqualObjects(renewed, testCookieHeaderValue2);
+    XCTAssertEqual(logins, (NSUInteger)2);
+}
+
 @end
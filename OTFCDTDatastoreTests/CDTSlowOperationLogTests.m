@@ -0,0 +1,144 @@
+//
+//  CDTSlowOperationLogTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "CloudantSyncTests.h"
+
+#import "CDTDatastore.h"
+#import "CDTDatastore+Query.h"
+#import "CDTDocumentRevision.h"
+#import "CDTSlowOperationLog.h"
+#import "TD_Database.h"
+
+@interface CDTSlowOperationLogTests : CloudantSyncTests
+@property (nonatomic, strong) CDTDatastore *datastore;
+@end
+
+@implementation CDTSlowOperationLogTests
+
+- (void)setUp
+{
+    [super setUp];
+    NSError *error;
+    self.datastore = [self.factory datastoreNamed:@"slowoperations" error:&error];
+    XCTAssertNotNil(self.datastore, @"datastore is nil");
+}
+
+- (void)tearDown
+{
+    self.datastore = nil;
+    [super tearDown];
+}
+
+- (CDTSlowOperation *)operationNamed:(NSString *)name
+{
+    return [[CDTSlowOperation alloc] initWithOperation:name
+                                              duration:1
+                                                   sql:@[]
+                                             queryPlan:@[]
+                                              rowCount:0
+                                  usedUnindexedMatcher:NO
+                                               details:@{}];
+}
+
+- (NSArray *)namesInLog:(CDTSlowOperationLog *)log
+{
+    return [log.operations valueForKey:@"operation"];
+}
+
+- (void)testRingBufferKeepsTheNewest
+{
+    CDTSlowOperationLog *log = [[CDTSlowOperationLog alloc] init];
+    log.capacity = 3;
+    for (NSString *name in @[ @"a", @"b", @"c", @"d", @"e" ]) {
+        [log recordOperation:[self operationNamed:name]];
+    }
+    XCTAssertEqualObjects([self namesInLog:log], (@[ @"c", @"d", @"e" ]));
+
+    log.capacity = 2;
+    XCTAssertEqualObjects([self namesInLog:log], (@[ @"d", @"e" ]));
+    [log recordOperation:[self operationNamed:@"f"]];
+    XCTAssertEqualObjects([self namesInLog:log], (@[ @"e", @"f" ]));
+
+    [log removeAllOperations];
+    XCTAssertEqual(log.operations.count, (NSUInteger)0);
+}
+
+- (void)testDisabledByDefault
+{
+    CDTSlowOperationLog *log = self.datastore.slowOperationLog;
+    XCTAssertNotNil(log);
+    XCTAssertFalse([log isSlow:1000]);
+
+    CDTDocumentRevision *rev = [CDTDocumentRevision revision];
+    rev.body = [@{ @"name" : @"mike" } mutableCopy];
+    NSError *error;
+    XCTAssertNotNil([self.datastore createDocumentFromRevision:rev error:&error]);
+    XCTAssertEqual(log.operations.count, (NSUInteger)0);
+}
+
+- (void)testRecordsSlowOperations
+{
+    CDTSlowOperationLog *log = self.datastore.slowOperationLog;
+    XCTAssertNotNil([self.datastore ensureIndexed:@[ @"name" ] withName:@"names"]);
+    NSError *error;
+    for (NSString *name in @[ @"mike", @"fred" ]) {
+        CDTDocumentRevision *rev = [CDTDocumentRevision revision];
+        rev.body = [@{ @"name" : name, @"age" : @12 } mutableCopy];
+        XCTAssertNotNil([self.datastore createDocumentFromRevision:rev error:&error]);
+    }
+    XCTAssertTrue([self.datastore updateAllIndexes]);
+
+    // Everything takes longer than this.
+    log.threshold = 1e-9;
+
+    CDTDocumentRevision *rev = [CDTDocumentRevision revision];
+    rev.body = [@{ @"name" : @"bill" } mutableCopy];
+    XCTAssertNotNil([self.datastore createDocumentFromRevision:rev error:&error]);
+    NSPredicate *isTransaction = [NSPredicate predicateWithFormat:@"operation == 'transaction'"];
+    CDTSlowOperation *transaction =
+        [log.operations filteredArrayUsingPredicate:isTransaction].lastObject;
+    XCTAssertEqualObjects(transaction.operation, @"transaction");
+    XCTAssertGreaterThan(transaction.duration, 0);
+    XCTAssertNotNil(transaction.details[@"callStack"]);
+
+    [log removeAllOperations];
+    XCTAssertNotNil([self.datastore find:@{ @"name" : @"mike" }]);
+    CDTSlowOperation *find = log.operations.lastObject;
+    XCTAssertEqualObjects(find.operation, @"find:");
+    XCTAssertEqualObjects(find.details[@"selector"], @{ @"name" : @"mike" });
+    XCTAssertFalse(find.usedUnindexedMatcher);
+    XCTAssertEqual(find.rowCount, (NSUInteger)1);
+    XCTAssertGreaterThan(find.sql.count, (NSUInteger)0);
+    XCTAssertGreaterThan(find.queryPlan.count, (NSUInteger)0);
+
+    // Age isn't indexed, so the documents have to be matched after loading them.
+    [log removeAllOperations];
+    XCTAssertNotNil([self.datastore find:@{ @"name" : @"mike", @"age" : @12 }]);
+    XCTAssertTrue([(CDTSlowOperation *)log.operations.lastObject usedUnindexedMatcher]);
+
+    [log removeAllOperations];
+    [self.datastore.database changesSinceSequence:0 options:NULL filter:NULL params:nil];
+    CDTSlowOperation *changes = log.operations.lastObject;
+    XCTAssertEqualObjects(changes.operation, @"changesSinceSequence:");
+    XCTAssertEqual(changes.rowCount, (NSUInteger)3);
+    XCTAssertGreaterThan(changes.queryPlan.count, (NSUInteger)0);
+
+    [log removeAllOperations];
+    [self.datastore.database getDocsWithIDs:@[ @"missing" ] options:NULL];
+    XCTAssertEqualObjects([self namesInLog:log], @[ @"getDocsWithIDs:" ]);
+}
+
+@end
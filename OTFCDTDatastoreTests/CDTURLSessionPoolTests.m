@@ -0,0 +1,73 @@
+//
+//  CDTURLSessionPoolTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "CDTURLSessionPool.h"
+
+@interface CDTURLSessionPoolTests : XCTestCase
+
+@property (strong, nonatomic) CDTURLSessionPool *pool;
+
+@end
+
+@implementation CDTURLSessionPoolTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.pool = [[CDTURLSessionPool alloc] init];
+}
+
+- (void)tearDown
+{
+    [self.pool finishTasksAndInvalidate];
+    [super tearDown];
+}
+
+- (NSURLSession *)sessionFor:(NSString *)url
+{
+    return [self.pool sessionForURL:[NSURL URLWithString:url]];
+}
+
+- (void)testRequestsToOneHostShareASession
+{
+    NSURLSession *session = [self sessionFor:@"https://example.com/db/_bulk_get"];
+    XCTAssertEqual([self sessionFor:@"https://EXAMPLE.com:443/db/doc/att"], session);
+    XCTAssertNotEqual([self sessionFor:@"https://example.com:8443/db"], session);
+    XCTAssertNotEqual([self sessionFor:@"http://example.com/db"], session);
+    XCTAssertNotEqual([self sessionFor:@"https://other.example.com/db"], session);
+}
+
+- (void)testConnectionLimitsArePerHost
+{
+    [self.pool setMaximumConnections:8 forHost:@"Busy.example.com"];
+    XCTAssertEqual([self.pool maximumConnectionsForHost:@"busy.example.com"], (NSUInteger)8);
+    XCTAssertEqual([self.pool maximumConnectionsForHost:@"example.com"], (NSUInteger)4);
+
+    XCTAssertEqual(
+        [self sessionFor:@"https://busy.example.com/db"].configuration.HTTPMaximumConnectionsPerHost,
+        8);
+    XCTAssertEqual(
+        [self sessionFor:@"https://example.com/db"].configuration.HTTPMaximumConnectionsPerHost, 4);
+}
+
+- (void)testInvalidatedSessionsAreReplaced
+{
+    NSURLSession *session = [self sessionFor:@"https://example.com/db"];
+    [self.pool finishTasksAndInvalidate];
+    XCTAssertNotEqual([self sessionFor:@"https://example.com/db"], session);
+}
+
+@end
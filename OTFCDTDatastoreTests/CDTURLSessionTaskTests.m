@@ -32,7 +32,11 @@
     NSURLSessionDataTask *task = [[NSURLSessionDataTask alloc] init];
     id mockedTask = OCMPartialMock(task);
     OCMStub([mockedTask state]).andReturn(NSURLSessionTaskStateSuspended);
-    OCMStub([(NSURLSessionDataTask *)mockedTask resume]).andDo(nil);
+    // Tasks are resumed on a global queue once the session's scheduler has a slot for them.
+    XCTestExpectation *resumed = [self expectationWithDescription:@"task resumed"];
+    OCMStub([(NSURLSessionDataTask *)mockedTask resume]).andDo(^(NSInvocation *invocation) {
+        [resumed fulfill];
+    });
     OCMStub([mockedTask cancel]).andDo(nil);
 
     NSThread *thread = [[NSThread alloc] init];
@@ -51,6 +55,7 @@
 
     //call void methods methods
     [cdtTask resume];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
     [cdtTask cancel];
     
     //verify that object state is as expected
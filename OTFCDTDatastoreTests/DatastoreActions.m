@@ -17,10 +17,18 @@
 
 #import "CloudantSyncTests.h"
 #import "CDTDatastore.h"
+#import "CDTDatastore+Conflicts.h"
 #import "CDTDatastoreManager.h"
 #import "FMDatabaseAdditions.h"
 #import "CDTDocumentRevision.h"
 #import "TDJSON.h"
+#import "TD_Database.h"
+#import "TD_Database+Insertion.h"
+#import "TD_Database+Statistics.h"
+#import "TD_Database+Tombstones.h"
+#import "TD_Database+LocalDocs.h"
+#import "TDInternal.h"
+#import "FMDatabaseQueue.h"
 
 @interface DatastoreActions : CloudantSyncTests
 
@@ -126,4 +134,223 @@
     XCTAssertEqual(1, compacted, @"Wrong number of docs compacted");
 }
 
+- (void)testIncrementalCompaction
+{
+    NSError *error;
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"test_database" error:&error];
+
+    NSMutableArray *firstRevs = [NSMutableArray array];
+    for (int i = 0; i < 10; i++) {
+        CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:[NSString stringWithFormat:@"doc%d", i]];
+        rev.body = [@{ @"version" : @1 } mutableCopy];
+        CDTDocumentRevision *first = [datastore createDocumentFromRevision:rev error:&error];
+        [firstRevs addObject:first];
+        rev = [first copy];
+        rev.body = [@{ @"version" : @2 } mutableCopy];
+        XCTAssertNotNil([datastore updateDocumentFromRevision:rev error:&error]);
+    }
+
+    // One body per step, so the work has to be spread over several calls
+    BOOL finished = NO;
+    int steps = 0;
+    while (!finished && steps < 100) {
+        XCTAssertTrue([datastore compactWithTimeBudget:1 rowBudget:1 finished:&finished error:&error],
+                      @"Compaction failed: %@", error);
+        steps++;
+    }
+    XCTAssertTrue(finished);
+    XCTAssertGreaterThan(steps, 10);
+
+    for (CDTDocumentRevision *first in firstRevs) {
+        CDTDocumentRevision *old =
+            [datastore getDocumentWithId:first.docId rev:first.revId error:nil];
+        XCTAssertEqual(old.body.count, (NSUInteger)0, @"Obsolete body wasn't compacted");
+        CDTDocumentRevision *current = [datastore getDocumentWithId:first.docId error:nil];
+        XCTAssertEqualObjects(current.body, @{ @"version" : @2 });
+    }
+
+    // Nothing is left to do:
+    XCTAssertTrue([datastore compactWithTimeBudget:1 rowBudget:0 finished:&finished error:&error]);
+    XCTAssertTrue(finished);
+}
+
+- (CDTDocumentRevision *)updateDocument:(CDTDocumentRevision *)revision
+                                  times:(int)times
+                            inDatastore:(CDTDatastore *)datastore
+{
+    for (int i = 0; i < times; i++) {
+        CDTDocumentRevision *rev = [revision copy];
+        rev.body = [@{ @"version" : @(i) } mutableCopy];
+        revision = [datastore updateDocumentFromRevision:rev error:nil];
+        XCTAssertNotNil(revision);
+    }
+    return revision;
+}
+
+- (void)testCompactStemsRevisionsBeyondRevsLimit
+{
+    NSError *error;
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"test_database" error:&error];
+    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"myDocId"];
+    rev.body = [@{ @"hello" : @"world" } mutableCopy];
+    CDTDocumentRevision *revision = [datastore createDocumentFromRevision:rev error:&error];
+    revision = [self updateDocument:revision times:9 inDatastore:datastore];
+    XCTAssertEqual([datastore getRevisionHistory:revision].count, (NSUInteger)10);
+
+    datastore.revsLimit = 3;
+    XCTAssertTrue([datastore compactWithError:&error], @"Compaction failed: %@", error);
+    NSArray *history = [datastore getRevisionHistory:revision];
+    XCTAssertEqual(history.count, (NSUInteger)3);
+    XCTAssertEqualObjects([history[0] revId], revision.revId);
+
+    // The document can still be updated, and its history grows from the stem
+    revision = [self updateDocument:revision times:1 inDatastore:datastore];
+    XCTAssertTrue([revision.revId hasPrefix:@"11-"]);
+    XCTAssertEqual([datastore getRevisionHistory:revision].count, (NSUInteger)4);
+    XCTAssertEqual([datastore getConflictedDocumentIds].count, (NSUInteger)0);
+}
+
+- (void)testStemsRevisionsOnInsert
+{
+    NSError *error;
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"test_database" error:&error];
+    datastore.revsLimit = 2;
+    datastore.stemsRevisionsOnInsert = YES;
+
+    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"myDocId"];
+    rev.body = [@{ @"hello" : @"world" } mutableCopy];
+    CDTDocumentRevision *revision = [datastore createDocumentFromRevision:rev error:&error];
+    revision = [self updateDocument:revision times:5 inDatastore:datastore];
+
+    NSArray *history = [datastore getRevisionHistory:revision];
+    XCTAssertEqual(history.count, (NSUInteger)2);
+    CDTDocumentRevision *current = [datastore getDocumentWithId:@"myDocId" error:&error];
+    XCTAssertEqualObjects(current.body, @{ @"version" : @4 });
+}
+
+- (void)testCompactGivesBackFreePagesWithoutFullVacuum
+{
+    NSError *error;
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"test_database" error:&error];
+    NSString *padding = [@"" stringByPaddingToLength:2048 withString:@"x" startingAtIndex:0];
+    for (int i = 0; i < 100; i++) {
+        CDTDocumentRevision *rev =
+            [CDTDocumentRevision revisionWithDocId:[NSString stringWithFormat:@"doc%d", i]];
+        rev.body = [@{ @"padding" : padding } mutableCopy];
+        CDTDocumentRevision *first = [datastore createDocumentFromRevision:rev error:&error];
+        rev = [first copy];
+        rev.body = [@{ @"version" : @2 } mutableCopy];
+        XCTAssertNotNil([datastore updateDocumentFromRevision:rev error:&error]);
+    }
+
+    __block int autoVacuum = -1;
+    [datastore.database.fmdbQueue inDatabase:^(FMDatabase *db) {
+        autoVacuum = [db intForQuery:@"PRAGMA auto_vacuum"];
+    }];
+    XCTAssertEqual(autoVacuum, 2);
+
+    XCTAssertTrue([datastore compactWithError:&error], @"Compaction failed: %@", error);
+    XCTAssertEqual(datastore.database.freeSpace, (UInt64)0);
+
+    NSUInteger freePages = 1;
+    XCTAssertEqual([datastore.database incrementalVacuumPages:16 freePagesLeft:&freePages], kTDStatusOK);
+    XCTAssertEqual(freePages, (NSUInteger)0);
+
+    XCTAssertTrue([datastore vacuumWithError:&error], @"Vacuum failed: %@", error);
+    CDTDocumentRevision *current = [datastore getDocumentWithId:@"doc42" error:&error];
+    XCTAssertEqualObjects(current.body, @{ @"version" : @2 });
+}
+
+- (void)testPurgesOldTombstones
+{
+    NSError *error;
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"test_database" error:&error];
+    for (NSString *docId in @[ @"gone1", @"gone2", @"kept" ]) {
+        CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:docId];
+        rev.body = [@{ @"hello" : @"world" } mutableCopy];
+        XCTAssertNotNil([datastore createDocumentFromRevision:rev error:&error]);
+    }
+    XCTAssertNotNil([datastore deleteDocumentWithId:@"gone1" error:&error]);
+    XCTAssertNotNil([datastore deleteDocumentWithId:@"gone2" error:&error]);
+
+    // Too recent to purge
+    NSUInteger purged = 1;
+    BOOL finished = NO;
+    XCTAssertTrue([datastore purgeTombstonesOlderThan:3600
+                                           timeBudget:10
+                                               purged:&purged
+                                             finished:&finished
+                                                error:&error]);
+    XCTAssertEqual(purged, (NSUInteger)0);
+    XCTAssertTrue(finished);
+
+    [datastore.database.fmdbQueue inDatabase:^(FMDatabase *db) {
+        XCTAssertTrue([db executeUpdate:@"UPDATE tombstones SET deleted_at = deleted_at - 7200"]);
+    }];
+    XCTAssertTrue([datastore purgeTombstonesOlderThan:3600
+                                           timeBudget:10
+                                               purged:&purged
+                                             finished:&finished
+                                                error:&error]);
+    XCTAssertEqual(purged, (NSUInteger)2);
+    XCTAssertTrue(finished);
+
+    __block int revs = -1;
+    [datastore.database.fmdbQueue inDatabase:^(FMDatabase *db) {
+        revs = [db intForQuery:@"SELECT COUNT(*) FROM revs WHERE doc_id IN "
+                                "(SELECT doc_id FROM docs WHERE docid LIKE 'gone%')"];
+    }];
+    XCTAssertEqual(revs, 0);
+    XCTAssertNotNil([datastore getDocumentWithId:@"kept" error:&error]);
+    XCTAssertNil([datastore.database getLocalDocumentWithID:kTDTombstonePurgeProgressDocID
+                                                 revisionID:nil]);
+}
+
+- (void)testPurgesOnlyPushedTombstones
+{
+    NSError *error;
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"test_database" error:&error];
+    TD_Database *db = datastore.database;
+    for (NSString *docId in @[ @"pushed", @"unpushed" ]) {
+        CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:docId];
+        rev.body = [@{ @"hello" : @"world" } mutableCopy];
+        XCTAssertNotNil([datastore createDocumentFromRevision:rev error:&error]);
+    }
+    XCTAssertNotNil([datastore deleteDocumentWithId:@"pushed" error:&error]);
+    SequenceNumber pushedSequence = db.lastSequence;
+    XCTAssertNotNil([datastore deleteDocumentWithId:@"unpushed" error:&error]);
+    XCTAssertTrue([db saveCheckpointDocument:@{
+        @"_id" : @"_local/pusher",
+        @"source_last_seq" : @(pushedSequence)
+    } error:&error]);
+
+    NSUInteger purged = 0;
+    BOOL finished = NO;
+    XCTAssertEqual([db purgeTombstonesDeletedBefore:[NSDate distantFuture]
+                                 pushedToCheckpoint:@"pusher"
+                                         timeBudget:10
+                                             purged:&purged
+                                           finished:&finished],
+                   kTDStatusOK);
+    XCTAssertEqual(purged, (NSUInteger)1);
+    XCTAssertTrue(finished);
+    __block int pushedDocs = -1;
+    [db.fmdbQueue inDatabase:^(FMDatabase *fmdb) {
+        pushedDocs = [fmdb intForQuery:@"SELECT COUNT(*) FROM docs WHERE docid='pushed'"];
+    }];
+    XCTAssertEqual(pushedDocs, 0);
+
+    // The rest goes once the pusher has recorded sending it
+    XCTAssertTrue([db saveKnownRemoteSequences:[NSIndexSet indexSetWithIndex:(NSUInteger)db.lastSequence]
+                               forCheckpointID:@"pusher"
+                                         error:&error]);
+    XCTAssertEqual([db purgeTombstonesDeletedBefore:[NSDate distantFuture]
+                                 pushedToCheckpoint:@"pusher"
+                                         timeBudget:10
+                                             purged:&purged
+                                           finished:&finished],
+                   kTDStatusOK);
+    XCTAssertEqual(purged, (NSUInteger)1);
+}
+
 @end
@@ -22,6 +22,7 @@
 #import "CDTDatastoreManager.h"
 #import "CDTDatastore.h"
 #import "CDTDocumentRevision.h"
+#import "CDTDocumentRevision+Internal.h"
 #import "TD_Revision.h"
 
 #import "FMDatabaseAdditions.h"
@@ -348,6 +349,188 @@
     
 }
 
+- (void)testCreateDocumentsFromRevisions
+{
+    NSError *error;
+    NSMutableArray *docs = [NSMutableArray array];
+    for (NSDictionary *body in [self generateDocuments:100]) {
+        CDTDocumentRevision *doc = [CDTDocumentRevision revision];
+        doc.body = [body mutableCopy];
+        [docs addObject:doc];
+    }
+
+    NSArray *saved = [self.datastore createDocumentsFromRevisions:docs error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqual(saved.count, (NSUInteger)100);
+    XCTAssertEqual(self.datastore.documentCount, (NSUInteger)100);
+
+    for (NSUInteger i = 0; i < saved.count; i++) {
+        CDTDocumentRevision *rev = saved[i];
+        XCTAssertEqualObjects(rev.body, [docs[i] body]);
+        CDTDocumentRevision *read = [self.datastore getDocumentWithId:rev.docId error:&error];
+        XCTAssertEqualObjects(read.revId, rev.revId);
+        XCTAssertEqualObjects(read.body, rev.body);
+    }
+}
+
+- (void)testCreateDocumentsFromRevisionsGeneratesSameRevIDsAsSingleCreate
+{
+    NSError *error;
+    CDTDocumentRevision *single = [CDTDocumentRevision revisionWithDocId:@"single"];
+    single.body = [@{ @"hello" : @"world" } mutableCopy];
+    single = [self.datastore createDocumentFromRevision:single error:&error];
+
+    CDTDocumentRevision *batched = [CDTDocumentRevision revisionWithDocId:@"batched"];
+    batched.body = [@{ @"hello" : @"world" } mutableCopy];
+    NSArray *saved = [self.datastore createDocumentsFromRevisions:@[ batched ] error:&error];
+
+    XCTAssertEqualObjects([saved.firstObject revId], single.revId);
+}
+
+- (void)testPutRevisionGeneratesSameRevIDsAsBatchedPut
+{
+    TD_Database *db = self.datastore.database;
+    NSDictionary *body = @{ @"hello" : @"world" };
+    TDStatus status;
+
+    TD_Revision *single = [[TD_Revision alloc] initWithDocID:@"single" revID:nil deleted:NO];
+    single.body = [[TD_Body alloc] initWithProperties:body];
+    single = [db putRevision:single prevRevisionID:nil allowConflict:NO status:&status];
+    XCTAssertEqual(status, kTDStatusCreated);
+
+    TD_Revision *batched = [[TD_Revision alloc] initWithDocID:@"batched" revID:nil deleted:NO];
+    batched.body = [[TD_Body alloc] initWithProperties:body];
+    NSArray *saved = [db putRevisions:@[ batched ]
+                      prevRevisionIDs:@[ [NSNull null] ]
+                        allowConflict:NO
+                          afterInsert:nil
+                               status:&status
+                          failedIndex:NULL];
+    XCTAssertEqualObjects([saved.firstObject revID], single.revID);
+
+    // The revision ID generated up front isn't used for a revision which no longer replaces the
+    // current one.
+    TD_Revision *update = [[TD_Revision alloc] initWithDocID:@"single" revID:nil deleted:NO];
+    update.body = [[TD_Body alloc] initWithProperties:@{ @"hello" : @"again" }];
+    XCTAssertNotNil([db putRevision:update
+                     prevRevisionID:single.revID
+                      allowConflict:NO
+                             status:&status]);
+    XCTAssertNil([db putRevision:update
+                  prevRevisionID:single.revID
+                   allowConflict:NO
+                          status:&status]);
+    XCTAssertEqual(status, kTDStatusConflict);
+}
+
+- (void)testCreateDocumentsFromRevisionsRollsBackOnConflict
+{
+    NSError *error;
+    CDTDocumentRevision *existing = [CDTDocumentRevision revisionWithDocId:@"doc1"];
+    existing.body = [@{ @"hello" : @"world" } mutableCopy];
+    XCTAssertNotNil([self.datastore createDocumentFromRevision:existing error:&error]);
+
+    CDTDocumentRevision *new = [CDTDocumentRevision revisionWithDocId:@"doc0"];
+    new.body = [@{ @"hello" : @"world" } mutableCopy];
+    CDTDocumentRevision *conflict = [CDTDocumentRevision revisionWithDocId:@"doc1"];
+    conflict.body = [@{ @"hello" : @"again" } mutableCopy];
+
+    NSArray *saved =
+        [self.datastore createDocumentsFromRevisions:@[ new, conflict ] error:&error];
+    XCTAssertNil(saved);
+    XCTAssertEqual(error.code, (NSInteger)409);
+    XCTAssertEqualObjects(error.userInfo[@"index"], @1);
+    XCTAssertNil([self.datastore getDocumentWithId:@"doc0" error:nil]);
+    XCTAssertEqual(self.datastore.documentCount, (NSUInteger)1);
+}
+
+- (void)testUpdateDocumentsFromRevisions
+{
+    NSError *error;
+    NSMutableArray *docs = [NSMutableArray array];
+    for (NSDictionary *body in [self generateDocuments:10]) {
+        CDTDocumentRevision *doc = [CDTDocumentRevision revision];
+        doc.body = [body mutableCopy];
+        [docs addObject:doc];
+    }
+    NSArray *saved = [self.datastore createDocumentsFromRevisions:docs error:&error];
+
+    NSMutableArray *updates = [NSMutableArray array];
+    for (CDTDocumentRevision *rev in saved) {
+        CDTDocumentRevision *update = [rev copy];
+        update.body[@"updated"] = @YES;
+        [updates addObject:update];
+    }
+    NSArray *updated = [self.datastore updateDocumentsFromRevisions:updates error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqual(updated.count, (NSUInteger)10);
+    for (CDTDocumentRevision *rev in updated) {
+        XCTAssertTrue([rev.revId hasPrefix:@"2-"]);
+        XCTAssertEqualObjects(rev.body[@"updated"], @YES);
+    }
+    XCTAssertEqual(self.datastore.documentCount, (NSUInteger)10);
+}
+
+- (void)testDocumentCacheServesRepeatedReadsUntilDocumentChanges
+{
+    NSError *error;
+    self.datastore.documentCacheCapacity = 10;
+    CDTDocumentRevision *doc = [CDTDocumentRevision revisionWithDocId:@"config"];
+    doc.body = [@{ @"theme" : @"dark" } mutableCopy];
+    CDTDocumentRevision *saved = [self.datastore createDocumentFromRevision:doc error:&error];
+
+    CDTDocumentRevision *first = [self.datastore getDocumentWithId:@"config" error:&error];
+    CDTDocumentRevision *second = [self.datastore getDocumentWithId:@"config" error:&error];
+    XCTAssertEqual(self.datastore.documentCacheMissCount, 1);
+    XCTAssertEqual(self.datastore.documentCacheHitCount, 1);
+    XCTAssertEqualObjects(second.revId, saved.revId);
+    XCTAssertEqualObjects(second.body, first.body);
+    XCTAssertFalse(second.isChanged);
+
+    // Callers get their own copies
+    second.body[@"theme"] = @"light";
+    XCTAssertEqualObjects([self.datastore getDocumentWithId:@"config" error:&error].body[@"theme"],
+                          @"dark");
+    XCTAssertEqualObjects([self.datastore getDocumentWithId:@"config"
+                                                        rev:saved.revId
+                                                      error:&error].body[@"theme"],
+                          @"dark");
+    XCTAssertEqual(self.datastore.documentCacheHitCount, 3);
+
+    CDTDocumentRevision *updated = [self.datastore updateDocumentFromRevision:second error:&error];
+    CDTDocumentRevision *read = [self.datastore getDocumentWithId:@"config" error:&error];
+    XCTAssertEqualObjects(read.revId, updated.revId);
+    XCTAssertEqualObjects(read.body[@"theme"], @"light");
+    XCTAssertEqual(self.datastore.documentCacheMissCount, 2);
+
+    self.datastore.documentCacheCapacity = 0;
+    XCTAssertEqual(self.datastore.documentCacheHitCount, 0);
+    XCTAssertEqualObjects([self.datastore getDocumentWithId:@"config" error:&error].revId,
+                          updated.revId);
+}
+
+- (void)testDocumentAsDataIsStoredJSONUntilBodyIsUsed
+{
+    NSError *error;
+    self.datastore.documentCacheCapacity = 10;
+    CDTDocumentRevision *doc = [CDTDocumentRevision revisionWithDocId:@"fruit"];
+    doc.body = [@{ @"name" : @"apple", @"count" : @3 } mutableCopy];
+    [self.datastore createDocumentFromRevision:doc error:&error];
+
+    // Both the first read and the cached copy for the second keep the JSON unparsed.
+    for (int i = 0; i < 2; i++) {
+        CDTDocumentRevision *read = [self.datastore getDocumentWithId:@"fruit" error:&error];
+        XCTAssertNotNil(read.unparsedBodyJSON);
+        NSData *json = [read documentAsDataError:&error];
+        XCTAssertNotNil(read.unparsedBodyJSON);
+        NSDictionary *parsed = [TDJSON JSONObjectWithData:json options:0 error:NULL];
+        XCTAssertEqualObjects(parsed, (@{ @"name" : @"apple", @"count" : @3 }));
+        XCTAssertEqualObjects(read.body, parsed);
+        XCTAssertNil(read.unparsedBodyJSON);
+    }
+    XCTAssertEqual(self.datastore.documentCacheHitCount, 1);
+}
+
 - (void)testCreateWithoutBodyInCDTDocumentRevision
 {
     NSError *error;
@@ -505,6 +688,25 @@
     }
 }
 
+-(void)testGetDocumentsWithIdsAndFields
+{
+    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"doc1"];
+    rev.body = [@{ @"name" : @"mike", @"age" : @32, @"address" : @{ @"town" : @"bristol" } }
+        mutableCopy];
+    XCTAssertNotNil([self.datastore createDocumentFromRevision:rev error:nil]);
+
+    NSArray *obs = [self.datastore getDocumentsWithIds:@[ @"doc1", @"i_do_not_exist" ]
+                                                fields:@[ @"name", @"address.town", @"pet" ]];
+    XCTAssertEqual(obs.count, (NSUInteger)1);
+    CDTDocumentRevision *projected = obs.firstObject;
+    XCTAssertEqualObjects(projected.docId, @"doc1");
+    XCTAssertEqualObjects(projected.body,
+                          (@{ @"name" : @"mike", @"address" : @{ @"town" : @"bristol" } }));
+
+    // A copy to update is the whole document, so updating it doesn't lose the other fields
+    XCTAssertEqualObjects([projected copy].body[@"age"], @32);
+}
+
 -(void)testGetDocumentsWithIds_NonExistentDocument
 {
     NSError *error;
@@ -730,6 +932,177 @@
     //[self getAllDocuments_testCountAndOffset:objectCount expectedDbObjects:reversedObjects descending:YES];
 }
 
+- (NSArray *)docIdsOfPagesWithPrefix:(NSString *)prefix descending:(BOOL)descending
+{
+    NSMutableArray *docIds = [NSMutableArray array];
+    NSString *continuation = nil;
+    do {
+        NSError *error = nil;
+        NSArray *page = [self.datastore getDocumentsWithIdPrefix:prefix
+                                                      descending:descending
+                                                           limit:2
+                                                    continuation:continuation
+                                                nextContinuation:&continuation
+                                                           error:&error];
+        XCTAssertNotNil(page, @"%@", error);
+        XCTAssertLessThanOrEqual(page.count, (NSUInteger)2);
+        for (CDTDocumentRevision *rev in page) [docIds addObject:rev.docId];
+    } while (continuation);
+    return docIds;
+}
+
+- (void)testPagingThroughDocumentIdPrefixAndRange
+{
+    for (NSString *docId in @[ @"order:2023:9", @"order:2024:1", @"order:2024:2", @"order:2024:3",
+                               @"order:2024;", @"user:1" ]) {
+        CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:docId];
+        rev.body = [@{ @"hello" : @"world" } mutableCopy];
+        XCTAssertNotNil([self.datastore createDocumentFromRevision:rev error:nil]);
+    }
+
+    NSArray *expected = @[ @"order:2024:1", @"order:2024:2", @"order:2024:3" ];
+    XCTAssertEqualObjects([self docIdsOfPagesWithPrefix:@"order:2024:" descending:NO], expected);
+    XCTAssertEqualObjects([self docIdsOfPagesWithPrefix:@"order:2024:" descending:YES],
+                          expected.reverseObjectEnumerator.allObjects);
+    XCTAssertEqual([self docIdsOfPagesWithPrefix:@"" descending:NO].count, (NSUInteger)6);
+
+    // A page carries on after the last document of the one before, even if it's been deleted
+    NSString *continuation = nil;
+    NSArray *page = [self.datastore getDocumentsFromId:@"order:2024:1"
+                                                  toId:@"order:2024;"
+                                            descending:NO
+                                                 limit:2
+                                          continuation:nil
+                                      nextContinuation:&continuation
+                                                 error:nil];
+    XCTAssertEqualObjects([page valueForKey:@"docId"], (@[ @"order:2024:1", @"order:2024:2" ]));
+    XCTAssertNotNil([self.datastore deleteDocumentFromRevision:page.lastObject error:nil]);
+    page = [self.datastore getDocumentsFromId:@"order:2024:1"
+                                         toId:@"order:2024;"
+                                   descending:NO
+                                        limit:2
+                                 continuation:continuation
+                             nextContinuation:&continuation
+                                        error:nil];
+    XCTAssertEqualObjects([page valueForKey:@"docId"], (@[ @"order:2024:3", @"order:2024;" ]));
+
+    NSError *error = nil;
+    XCTAssertNil([self.datastore getDocumentsFromId:nil
+                                               toId:nil
+                                         descending:NO
+                                              limit:2
+                                       continuation:@"not a token!"
+                                   nextContinuation:NULL
+                                              error:&error]);
+    XCTAssertNotNil(error);
+}
+
+- (void)testEnumerateAllDocuments
+{
+    NSError *error;
+    // More than one page, with a conflicted document on a page boundary.
+    int objectCount = 250;
+    NSMutableArray *docs = [NSMutableArray array];
+    for (NSDictionary *body in [self generateDocuments:objectCount]) {
+        CDTDocumentRevision *doc =
+            [CDTDocumentRevision revisionWithDocId:[NSString stringWithFormat:@"hello-%04lu",
+                                                                              (unsigned long)docs.count]];
+        doc.body = [body mutableCopy];
+        [docs addObject:doc];
+    }
+    NSArray *saved = [self.datastore createDocumentsFromRevisions:docs error:&error];
+    XCTAssertNil(error);
+    XCTAssertNotNil([self.datastore deleteDocumentFromRevision:saved[10] error:&error]);
+
+    TD_Revision *conflict = [[TD_Revision alloc] initWithDocID:@"hello-0099" revID:@"1-zzzz" deleted:NO];
+    conflict.body = [[TD_Body alloc] initWithProperties:@{ @"_id" : @"hello-0099", @"_rev" : @"1-zzzz" }];
+    TDStatus status =
+        [self.datastore.database forceInsert:conflict revisionHistory:@[ @"1-zzzz" ] source:nil];
+    XCTAssertFalse(TDStatusIsError(status));
+
+    NSMutableArray *ascending = [NSMutableArray array];
+    XCTAssertTrue([self.datastore enumerateAllDocumentsDescending:NO
+                                                       usingBlock:^(CDTDocumentRevision *rev, BOOL *stop) {
+                                                           [ascending addObject:rev.docId];
+                                                       }
+                                                            error:&error]);
+    XCTAssertEqual(ascending.count, (NSUInteger)(objectCount - 1));
+    XCTAssertEqual([[NSSet setWithArray:ascending] count], ascending.count);
+    XCTAssertFalse([ascending containsObject:@"hello-0010"]);
+    XCTAssertEqualObjects(ascending, [ascending sortedArrayUsingSelector:@selector(compare:)]);
+
+    NSMutableArray *descending = [NSMutableArray array];
+    XCTAssertTrue([self.datastore enumerateAllDocumentsDescending:YES
+                                                       usingBlock:^(CDTDocumentRevision *rev, BOOL *stop) {
+                                                           [descending addObject:rev.docId];
+                                                       }
+                                                            error:&error]);
+    XCTAssertEqualObjects(descending, [[ascending reverseObjectEnumerator] allObjects]);
+
+    __block NSUInteger seen = 0;
+    XCTAssertTrue([self.datastore enumerateAllDocumentsDescending:NO
+                                                       usingBlock:^(CDTDocumentRevision *rev, BOOL *stop) {
+                                                           *stop = (++seen == 5);
+                                                       }
+                                                            error:&error]);
+    XCTAssertEqual(seen, (NSUInteger)5);
+    XCTAssertEqual([self.datastore getAllDocuments].count, (NSUInteger)(objectCount - 1));
+}
+
+- (void)testForceInsertRevisionsInOneBatch
+{
+    NSError *error;
+    CDTDocumentRevision *local = [CDTDocumentRevision revisionWithDocId:@"existing"];
+    local.body = [@{ @"hello" : @"world" } mutableCopy];
+    local = [self.datastore createDocumentFromRevision:local error:&error];
+    XCTAssertNotNil(local);
+
+    TD_Revision * (^mkrev)(NSString *, NSString *) = ^(NSString *docID, NSString *revID) {
+        TD_Revision *rev = [[TD_Revision alloc] initWithDocID:docID revID:revID deleted:NO];
+        rev.body = [[TD_Body alloc] initWithProperties:@{ @"_id" : docID, @"_rev" : revID }];
+        return rev;
+    };
+    NSArray *revs = @[
+        mkrev(@"new", @"1-aaaa"), mkrev(@"existing", @"2-bbbb"), mkrev(@"new", @"2-cccc"),
+        mkrev(@"bad", @"3-dddd")
+    ];
+    NSArray *histories = @[
+        [NSNull null], @[ @"2-bbbb", local.revId ], @[ @"2-cccc", @"1-aaaa" ],
+        @[ @"2-dddd" ]  // doesn't start with the rev's own ID
+    ];
+
+    __block NSUInteger notifications = 0;
+    __block NSArray *notifiedRevs = nil;
+    id observer = [[NSNotificationCenter defaultCenter]
+        addObserverForName:TD_DatabaseChangeNotification
+                    object:self.datastore.database
+                     queue:nil
+                usingBlock:^(NSNotification *n) {
+                    notifications++;
+                    notifiedRevs = n.userInfo[@"revs"];
+                }];
+    NSArray *statuses =
+        [self.datastore.database forceInsertRevisions:revs revisionHistories:histories source:nil];
+    [[NSNotificationCenter defaultCenter] removeObserver:observer];
+
+    XCTAssertEqual(statuses.count, revs.count);
+    XCTAssertEqual([statuses[0] intValue], kTDStatusCreated);
+    XCTAssertEqual([statuses[1] intValue], kTDStatusCreated);
+    XCTAssertEqual([statuses[2] intValue], kTDStatusCreated);
+    XCTAssertEqual([statuses[3] intValue], kTDStatusBadID);
+    XCTAssertEqual(notifications, (NSUInteger)1);
+    XCTAssertEqual(notifiedRevs.count, (NSUInteger)3);
+
+    XCTAssertEqualObjects([self.datastore getDocumentWithId:@"existing" error:&error].revId,
+                          @"2-bbbb");
+    XCTAssertEqualObjects([self.datastore getDocumentWithId:@"new" error:&error].revId, @"2-cccc");
+    XCTAssertEqual([[self.datastore getRevisionHistory:
+                                        [self.datastore getDocumentWithId:@"new" error:&error]]
+                       count],
+                   (NSUInteger)2);
+    XCTAssertNil([self.datastore getDocumentWithId:@"bad" error:nil]);
+}
+
 -(void)testGetAllDocumentIds
 {
     XCTAssertEqual([self.datastore getAllDocumentIds].count, 0, @"No documents should exist.");
@@ -1863,4 +2236,58 @@
     XCTAssertTrue([TDStatusToNSError( statusResults, nil) code] == 200, @"TDStatusAsNSError: %@", TDStatusToNSError( statusResults, nil));
     
 }
+- (void)testDocumentIDGenerator
+{
+    __block int calls = 0;
+    self.datastore.documentIDGenerator = ^NSString * {
+        return [NSString stringWithFormat:@"generated-%d", ++calls];
+    };
+    NSError *error;
+    CDTDocumentRevision *doc = [CDTDocumentRevision revision];
+    doc.body = [@{ @"a" : @1 } mutableCopy];
+    CDTDocumentRevision *saved = [self.datastore createDocumentFromRevision:doc error:&error];
+    XCTAssertEqualObjects(saved.docId, @"generated-1");
+
+    // Given IDs are used as they are.
+    doc = [CDTDocumentRevision revisionWithDocId:@"given"];
+    doc.body = [@{ @"a" : @2 } mutableCopy];
+    saved = [self.datastore createDocumentFromRevision:doc error:&error];
+    XCTAssertEqualObjects(saved.docId, @"given");
+    XCTAssertEqual(calls, 1);
+
+    self.datastore.documentIDGenerator = [CDTDatastore timeOrderedDocumentIDGenerator];
+    NSMutableArray *docIds = [NSMutableArray array];
+    for (int i = 0; i < 20; i++) {
+        doc = [CDTDocumentRevision revision];
+        doc.body = [@{ @"i" : @(i) } mutableCopy];
+        saved = [self.datastore createDocumentFromRevision:doc error:&error];
+        XCTAssertNotNil(saved);
+        [docIds addObject:saved.docId];
+    }
+    XCTAssertEqualObjects([docIds sortedArrayUsingSelector:@selector(compare:)], docIds);
+}
+
+- (void)testGetAllDocumentsReadsBodiesAndAttachments
+{
+    NSError *error;
+    CDTDocumentRevision *doc = [CDTDocumentRevision revisionWithDocId:@"withAttachment"];
+    doc.body = [@{ @"name" : @"a", @"nested" : @{ @"list" : @[ @1, @2 ] } } mutableCopy];
+    doc.attachments[@"att"] = [[CDTUnsavedDataAttachment alloc]
+        initWithData:[@"test" dataUsingEncoding:NSUTF8StringEncoding]
+                name:@"att"
+                type:@"text/plain"];
+    CDTDocumentRevision *saved = [self.datastore createDocumentFromRevision:doc error:&error];
+    XCTAssertNotNil(saved);
+
+    NSArray *all = [self.datastore getAllDocumentsOffset:0 limit:10 descending:NO];
+    XCTAssertEqual(all.count, (NSUInteger)1);
+    CDTDocumentRevision *read = all[0];
+    XCTAssertEqualObjects(read.docId, saved.docId);
+    XCTAssertEqualObjects(read.revId, saved.revId);
+    XCTAssertEqual(read.sequence, saved.sequence);
+    XCTAssertEqualObjects(read.body, doc.body);
+    XCTAssertEqualObjects([read.attachments.allKeys sortedArrayUsingSelector:@selector(compare:)],
+                          @[ @"att" ]);
+}
+
 @end
@@ -50,6 +50,13 @@
 @end
 
 
+/**
+ A CDTTestParticularDocBiggestResolver that declares itself thread-safe, so it's called
+ concurrently by -resolveConflictsForDocuments:resolver:.
+ */
+@interface CDTTestThreadSafeParticularDocBiggestResolver : CDTTestParticularDocBiggestResolver
+@end
+
 /** 
  This class does not resolve any document by implementing -resolve:conflict: to
  always return nil.
@@ -83,6 +83,13 @@
 }
 @end
 
+#pragma mark CDTTestThreadSafeParticularDocBiggestResolver
+@implementation CDTTestThreadSafeParticularDocBiggestResolver
+
+- (BOOL)isThreadSafe { return YES; }
+
+@end
+
 #pragma mark CDTTestDoesNoResolutionResolver
 @implementation CDTTestDoesNoResolutionResolver
 
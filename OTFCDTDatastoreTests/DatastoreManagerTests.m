@@ -145,6 +145,176 @@
 }
 #endif
 
+- (void)testDatastoresOpenConcurrently
+{
+    NSMutableArray *names = [NSMutableArray array];
+    for (int i = 0; i < 10; i++) {
+        [names addObject:[NSString stringWithFormat:@"concurrent%d", i]];
+    }
+
+    // Twice over, so the same datastore is also opened by two threads at once
+    NSMutableDictionary *opened = [NSMutableDictionary dictionary];
+    dispatch_apply(names.count * 2, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0),
+                   ^(size_t i) {
+                       NSString *name = names[i % names.count];
+                       NSError *error;
+                       CDTDatastore *ds = [self.factory datastoreNamed:name error:&error];
+                       XCTAssertNotNil(ds, @"%@", error);
+                       @synchronized(opened) {
+                           if (opened[name]) {
+                               XCTAssertEqual(opened[name], ds);
+                           } else if (ds) {
+                               opened[name] = ds;
+                           }
+                       }
+                   });
+    XCTAssertEqual(opened.count, names.count);
+
+    for (NSString *name in names) {
+        XCTAssertTrue([self.factory deleteDatastoreNamed:name error:nil]);
+    }
+    XCTAssertEqual([self.factory allDatastores].count, (NSUInteger)0);
+}
+
+- (void)testReopeningSkipsMigrationAndKeepsAttachments
+{
+    NSError *error;
+    CDTDatastore *ds = [self.factory datastoreNamed:@"reopen" error:&error];
+    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"doc"];
+    rev.body = [@{ @"hello" : @"world" } mutableCopy];
+    NSData *data = [@"attached" dataUsingEncoding:NSUTF8StringEncoding];
+    rev.attachments = [@{
+        @"txt" : [[CDTUnsavedDataAttachment alloc] initWithData:data name:@"txt" type:@"text/plain"]
+    } mutableCopy];
+    XCTAssertNotNil([ds createDocumentFromRevision:rev error:&error]);
+
+    [self.factory closeDatastoreNamed:@"reopen"];
+    ds = [self.factory datastoreNamed:@"reopen" error:&error];
+    XCTAssertNotNil(ds);
+    // The schema is already current, so opening didn't need a transaction to migrate it
+    XCTAssertEqual(ds.statistics.transactionCount, (NSUInteger)0);
+
+    CDTDocumentRevision *reread = [ds getDocumentWithId:@"doc" error:&error];
+    XCTAssertEqualObjects([reread.attachments[@"txt"] dataFromAttachmentContent], data);
+}
+
+- (void)testMaxOpenDatastoresClosesLeastRecentlyUsed
+{
+    self.factory.maxOpenDatastores = 2;
+    TD_DatabaseManager *dbManager = self.factory.manager;
+
+    CDTDatastore *a = [self.factory datastoreNamed:@"lru_a" error:nil];
+    XCTAssertNotNil([self.factory datastoreNamed:@"lru_b" error:nil]);
+    // Asking for a again makes b the least recently used
+    XCTAssertEqual([self.factory datastoreNamed:@"lru_a" error:nil], a);
+    XCTAssertNotNil([self.factory datastoreNamed:@"lru_c" error:nil]);
+
+    XCTAssertTrue([dbManager databaseNamed:@"lru_a"].isOpen);
+    XCTAssertFalse([dbManager databaseNamed:@"lru_b"].isOpen);
+    XCTAssertTrue([dbManager databaseNamed:@"lru_c"].isOpen);
+
+    // The closed datastore opens again when asked for
+    XCTAssertNotNil([self.factory datastoreNamed:@"lru_b" error:nil]);
+    XCTAssertTrue([dbManager databaseNamed:@"lru_b"].isOpen);
+    XCTAssertFalse([dbManager databaseNamed:@"lru_a"].isOpen);
+
+    // A closed datastore that's still held is handed out again, and reopens by itself when used
+    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"doc"];
+    rev.body = [@{ @"hello" : @"world" } mutableCopy];
+    XCTAssertNotNil([a createDocumentFromRevision:rev error:nil]);
+    XCTAssertEqual([self.factory datastoreNamed:@"lru_a" error:nil], a);
+    XCTAssertNotNil([a getDocumentWithId:@"doc" error:nil]);
+}
+
+- (void)testMaxOpenDatastoresKeepsDatastoresWithResultSets
+{
+    self.factory.maxOpenDatastores = 1;
+    CDTDatastore *queried = [self.factory datastoreNamed:@"lru_queried" error:nil];
+    XCTAssertNotNil([queried ensureIndexed:@[ @"name" ] withName:@"name"]);
+    @autoreleasepool {
+        CDTQResultSet *results = [queried find:@{ @"name" : @"mike" }];
+        XCTAssertNotNil(results);
+
+        XCTAssertNotNil([self.factory datastoreNamed:@"lru_other" error:nil]);
+        XCTAssertTrue([self.factory.manager databaseNamed:@"lru_queried"].isOpen);
+    }
+
+    // Once the result set has gone, the queried datastore is the one to close
+    XCTAssertNotNil([self.factory datastoreNamed:@"lru_other" error:nil]);
+    XCTAssertFalse([self.factory.manager databaseNamed:@"lru_queried"].isOpen);
+}
+
+- (void)testDeleteDatastoreInBackgroundFreesNameAtOnce
+{
+    NSError *error;
+    CDTDatastore *ds = [self.factory datastoreNamed:@"trashed" error:&error];
+    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"doc"];
+    rev.body = [@{ @"hello" : @"world" } mutableCopy];
+    NSData *data = [@"attached" dataUsingEncoding:NSUTF8StringEncoding];
+    rev.attachments = [@{
+        @"txt" : [[CDTUnsavedDataAttachment alloc] initWithData:data name:@"txt" type:@"text/plain"]
+    } mutableCopy];
+    XCTAssertNotNil([ds createDocumentFromRevision:rev error:&error]);
+    XCTAssertNotNil([ds ensureIndexed:@[ @"hello" ] withName:@"hello"]);
+    NSString *dbPath = [self.factory.manager pathForName:@"trashed"];
+    ds = nil;
+
+    XCTAssertTrue([self.factory deleteDatastoreNamedInBackground:@"trashed" error:&error]);
+    NSFileManager *fm = [NSFileManager defaultManager];
+    XCTAssertFalse([fm fileExistsAtPath:dbPath]);
+    XCTAssertFalse([fm fileExistsAtPath:[TD_Database attachmentStorePathWithDatabasePath:dbPath]]);
+    XCTAssertEqual([self.factory allDatastores].count, (NSUInteger)0);
+
+    ds = [self.factory datastoreNamed:@"trashed" error:&error];
+    XCTAssertNotNil(ds);
+    XCTAssertEqual(ds.documentCount, (NSUInteger)0);
+    XCTAssertEqual([ds listIndexes].count, (NSUInteger)0);
+
+    NSString *trashPath = [self.factory.manager.directory stringByAppendingPathComponent:@"trash"];
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:10];
+    while ([fm contentsOfDirectoryAtPath:trashPath error:nil].count > 0 &&
+           [deadline timeIntervalSinceNow] > 0) {
+        [NSThread sleepForTimeInterval:0.05];
+    }
+    XCTAssertEqual([fm contentsOfDirectoryAtPath:trashPath error:nil].count, (NSUInteger)0);
+}
+
+- (void)testDeleteDatastoreInBackgroundWithInvalidName
+{
+    NSError *error;
+    XCTAssertFalse([self.factory deleteDatastoreNamedInBackground:@"_invalid" error:&error]);
+    XCTAssertEqualObjects(error.domain, CDTDatastoreErrorDomain);
+    XCTAssertEqual(error.code, 404);
+}
+
+- (void)testInMemoryDatastoreKeepsDocumentsAcrossClose
+{
+    NSError *error;
+    CDTDatastoreManager *manager = [[CDTDatastoreManager alloc] initInMemoryWithError:&error];
+    XCTAssertNotNil(manager, @"%@", error);
+    NSString *directory = manager.manager.directory;
+
+    CDTDatastore *datastore = [manager datastoreNamed:@"cache" error:&error];
+    XCTAssertNotNil(datastore, @"%@", error);
+    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"doc"];
+    rev.body = [@{ @"hello" : @"world" } mutableCopy];
+    XCTAssertNotNil([datastore createDocumentFromRevision:rev error:&error], @"%@", error);
+    XCTAssertEqualObjects([manager allDatastores], @[ @"cache" ]);
+
+    [manager closeDatastoreNamed:@"cache"];
+    datastore = [manager datastoreNamed:@"cache" error:&error];
+    XCTAssertEqualObjects([datastore getDocumentWithId:@"doc" error:&error].body[@"hello"], @"world");
+
+    // Nothing but the attachments and extensions goes into the directory
+    NSArray *files = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:directory error:nil];
+    XCTAssertEqual([files pathsMatchingExtensions:@[ @"touchdb" ]].count, (NSUInteger)0);
+
+    XCTAssertTrue([manager deleteDatastoreNamed:@"cache" error:&error], @"%@", error);
+    XCTAssertEqual([manager allDatastores].count, (NSUInteger)0);
+    datastore = [manager datastoreNamed:@"cache" error:&error];
+    XCTAssertNil([datastore getDocumentWithId:@"doc" error:nil]);
+}
+
 // test disabled because it takes a few minutes to run
 // re-enable to check for regressions in synchronisation of _databases dictionary in TD_DatabaseManager
 - (void) xxxTestDatastoreGetThreaded {
@@ -18,6 +18,7 @@
 #import "CDTDatastore+Replication.h"
 #import "CDTReplicatorDelegate.h"
 #import "CDTReplicator.h"
+#import "CDTAttachment.h"
 
 @interface ReplicatorDelegate: NSObject<CDTReplicatorDelegate>
 @end
@@ -83,5 +84,45 @@
     XCTAssertEqual(replicator.delegate, delegate, "the replicator's delegate should be the same as the delegate passed into");
 }
 
+- (void)testReplicateToDatastore
+{
+    NSError *error = nil;
+    CDTDatastore *target = [self.factory datastoreNamed:@"target" error:&error];
+    XCTAssertNotNil(target);
+
+    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"doc"];
+    rev.body = [@{ @"hello" : @"world" } mutableCopy];
+    NSData *data = [@"attached" dataUsingEncoding:NSUTF8StringEncoding];
+    rev.attachments = [@{
+        @"txt" : [[CDTUnsavedDataAttachment alloc] initWithData:data name:@"txt" type:@"text/plain"]
+    } mutableCopy];
+    rev = [self.datastore createDocumentFromRevision:rev error:&error];
+    rev.body = [@{ @"hello" : @"again" } mutableCopy];
+    rev = [self.datastore updateDocumentFromRevision:rev error:&error];
+    XCTAssertNotNil(rev);
+    CDTDocumentRevision *other = [CDTDocumentRevision revisionWithDocId:@"other"];
+    other.body = [@{ @"other" : @YES } mutableCopy];
+    XCTAssertNotNil([self.datastore createDocumentFromRevision:other error:&error]);
+
+    NSUInteger replicated = 0;
+    XCTAssertTrue([self.datastore replicateToDatastore:target replicated:&replicated error:&error]);
+    XCTAssertEqual(replicated, (NSUInteger)2);
+    CDTDocumentRevision *copied = [target getDocumentWithId:@"doc" error:&error];
+    XCTAssertEqualObjects(copied.revId, rev.revId);
+    XCTAssertEqualObjects(copied.body, @{ @"hello" : @"again" });
+    XCTAssertEqualObjects([copied.attachments[@"txt"] dataFromAttachmentContent], data);
+    XCTAssertEqual([target getRevisionHistory:copied].count, (NSUInteger)2);
+
+    // The checkpoint means only later changes are looked at again
+    XCTAssertTrue([self.datastore replicateToDatastore:target replicated:&replicated error:&error]);
+    XCTAssertEqual(replicated, (NSUInteger)0);
+    XCTAssertNotNil([self.datastore deleteDocumentFromRevision:rev error:&error]);
+    XCTAssertTrue([self.datastore replicateToDatastore:target replicated:&replicated error:&error]);
+    XCTAssertEqual(replicated, (NSUInteger)1);
+    XCTAssertNil([target getDocumentWithId:@"doc" error:&error]);
+
+    XCTAssertFalse([self.datastore replicateToDatastore:self.datastore replicated:NULL error:&error]);
+}
+
 @end
 
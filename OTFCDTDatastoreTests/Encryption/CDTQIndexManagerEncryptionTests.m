@@ -25,6 +25,23 @@
 #import "CDTQIndexManager.h"
 #import "DBQueryUtils.h"
 
+/** Counts how often it is asked for its key, which for a real provider can be costly. */
+@interface CDTQCountingKeyProvider : CDTHelperFixedKeyProvider
+
+@property (nonatomic) NSUInteger keyRequests;
+
+@end
+
+@implementation CDTQCountingKeyProvider
+
+- (CDTEncryptionKey *)encryptionKey
+{
+    self.keyRequests++;
+    return [super encryptionKey];
+}
+
+@end
+
 @interface CDTQIndexManagerEncryptionTests : CloudantSyncTests
 
 @end
@@ -227,6 +244,27 @@
 
     XCTAssertTrue([im isTextSearchEnabled], @"It should be activated");
 }
+
+- (void)testQueryIndexManagerReusesKeyOfOpenDatastore
+{
+    NSData *key = [[[CDTHelperFixedKeyProvider provider] encryptionKey] data];
+    CDTQCountingKeyProvider *provider = [[CDTQCountingKeyProvider alloc] initWithKey:key];
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"reuses_key_of_open_datastore"
+                                 withEncryptionKeyProvider:provider
+                                                     error:nil];
+    NSUInteger keyRequestsToOpenDatastore = provider.keyRequests;
+
+    NSError *err = nil;
+    CDTQIndexManager *im = [[CDTQIndexManager alloc] initUsingDatastore:datastore error:&err];
+
+    XCTAssertNotNil(im, @"indexManager is not nil");
+    XCTAssertEqual(provider.keyRequests, keyRequestsToOpenDatastore,
+                   @"The key the datastore was opened with should be used for its indexes");
+
+    NSString *path = [CloudantSyncTests pathForQueryIndexInDatastore:datastore];
+    XCTAssertEqual([FMDatabase isDatabaseUnencryptedAtPath:path], kFMDatabaseUnencryptedIsEncrypted,
+                   @"If a key is provided, index has to be encrypted");
+}
 #endif
 
 @end
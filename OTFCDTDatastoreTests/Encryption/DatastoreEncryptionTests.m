@@ -16,10 +16,13 @@
 
 #import <XCTest/XCTest.h>
 
+#import "CDTAttachment.h"
+#import "CDTDocumentRevision.h"
 #import "CDTEncryptionKeyNilProvider.h"
 #import "CDTHelperFixedKeyProvider.h"
 #import "CloudantSyncTests.h"
 #import "TD_Database.h"
+#import "TD_Database+Rekey.h"
 
 #import "CDTDatastore+EncryptionKey.h"
 #import "CDTDatastore+Query.h"
@@ -214,4 +217,102 @@
 }
 #endif
 
+- (void)testRekeyChangesTheKeyOfDocumentsAttachmentsAndIndexes
+{
+    CDTHelperFixedKeyProvider *oldProvider = [CDTHelperFixedKeyProvider provider];
+    CDTHelperFixedKeyProvider *newProvider = [oldProvider negatedProvider];
+
+    NSError *error = nil;
+    CDTDatastore *datastore =
+        [self.factory datastoreNamed:@"test_rekey" withEncryptionKeyProvider:oldProvider error:&error];
+    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"doc"];
+    rev.body = [@{ @"pet" : @"cat" } mutableCopy];
+    NSData *data = [@"attached" dataUsingEncoding:NSUTF8StringEncoding];
+    rev.attachments = [@{
+        @"txt" : [[CDTUnsavedDataAttachment alloc] initWithData:data name:@"txt" type:@"text/plain"]
+    } mutableCopy];
+    XCTAssertNotNil([datastore createDocumentFromRevision:rev error:&error]);
+    XCTAssertNotNil([datastore ensureIndexed:@[ @"pet" ] withName:@"pets"]);
+
+    __block NSUInteger progressCalls = 0;
+    XCTAssertTrue([datastore rekeyWithEncryptionKeyProvider:newProvider
+                                                   progress:^(NSUInteger done, NSUInteger total) {
+                                                       XCTAssertEqual(total, (NSUInteger)1);
+                                                       progressCalls++;
+                                                   }
+                                                      error:&error],
+                  @"%@", error);
+    XCTAssertEqual(progressCalls, (NSUInteger)2);
+    XCTAssertEqualObjects([datastore encryptionKeyProvider], newProvider);
+    XCTAssertEqual([datastore find:@{ @"pet" : @"cat" }].documentIds.count, (NSUInteger)1);
+
+    [self.factory closeDatastoreNamed:@"test_rekey"];
+    XCTAssertNil([self.factory datastoreNamed:@"test_rekey"
+                    withEncryptionKeyProvider:oldProvider
+                                        error:nil],
+                 @"The old key no longer opens the datastore");
+
+    datastore =
+        [self.factory datastoreNamed:@"test_rekey" withEncryptionKeyProvider:newProvider error:&error];
+    XCTAssertNotNil(datastore);
+    CDTDocumentRevision *reread = [datastore getDocumentWithId:@"doc" error:&error];
+    XCTAssertEqualObjects([reread.attachments[@"txt"] dataFromAttachmentContent], data);
+    XCTAssertEqual([datastore find:@{ @"pet" : @"cat" }].documentIds.count, (NSUInteger)1);
+}
+
+- (void)testRekeyCutShortIsFinishedWhenTheDatastoreIsOpenedWithTheNewKey
+{
+    CDTHelperFixedKeyProvider *oldProvider = [CDTHelperFixedKeyProvider provider];
+    CDTHelperFixedKeyProvider *newProvider = [oldProvider negatedProvider];
+
+    NSError *error = nil;
+    CDTDatastore *datastore = [self.factory datastoreNamed:@"test_rekey_cut_short"
+                                 withEncryptionKeyProvider:oldProvider
+                                                     error:&error];
+    CDTDocumentRevision *rev = [CDTDocumentRevision revisionWithDocId:@"doc"];
+    rev.body = [@{ @"pet" : @"cat" } mutableCopy];
+    NSData *data = [@"attached" dataUsingEncoding:NSUTF8StringEncoding];
+    rev.attachments = [@{
+        @"txt" : [[CDTUnsavedDataAttachment alloc] initWithData:data name:@"txt" type:@"text/plain"]
+    } mutableCopy];
+    XCTAssertNotNil([datastore createDocumentFromRevision:rev error:&error]);
+
+    // As though the app stopped once the database had its new key, before any attachment did
+    TD_Database *database = datastore.database;
+    XCTAssertTrue([database beginRekeyWithError:&error], @"%@", error);
+    XCTAssertTrue([database rekeyWithEncryptionKeyProvider:newProvider error:&error], @"%@", error);
+    XCTAssertTrue(database.hasUnfinishedRekey);
+    [self.factory closeDatastoreNamed:@"test_rekey_cut_short"];
+
+    datastore = [self.factory datastoreNamed:@"test_rekey_cut_short"
+                   withEncryptionKeyProvider:newProvider
+                                       error:&error];
+    XCTAssertNotNil(datastore, @"%@", error);
+    XCTAssertFalse(datastore.database.hasUnfinishedRekey);
+    CDTDocumentRevision *reread = [datastore getDocumentWithId:@"doc" error:&error];
+    XCTAssertEqualObjects([reread.attachments[@"txt"] dataFromAttachmentContent], data);
+
+    // The old key is forgotten, so the attachment has to have been re-encrypted to be read
+    [self.factory closeDatastoreNamed:@"test_rekey_cut_short"];
+    datastore = [self.factory datastoreNamed:@"test_rekey_cut_short"
+                   withEncryptionKeyProvider:newProvider
+                                       error:&error];
+    reread = [datastore getDocumentWithId:@"doc" error:&error];
+    XCTAssertEqualObjects([reread.attachments[@"txt"] dataFromAttachmentContent], data);
+}
+
+- (void)testRekeyFailsIfTheDatastoreIsNotEncrypted
+{
+    CDTDatastore *datastore =
+        [self.factory datastoreNamed:@"test_rekey_plain"
+           withEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]
+                               error:nil];
+
+    NSError *error = nil;
+    XCTAssertFalse([datastore rekeyWithEncryptionKeyProvider:[CDTHelperFixedKeyProvider provider]
+                                                    progress:nil
+                                                       error:&error]);
+    XCTAssertNotNil(error);
+}
+
 @end
@@ -19,11 +19,13 @@
 
 #import "TD_Database+BlobFilenames.h"
 
+#import "CDTBlobHandleFactory.h"
 #import "CDTEncryptionKeyNilProvider.h"
 #import "CDTHelperFixedKeyProvider.h"
 
 #import "CDTMisc.h"
 #import "TDMisc.h"
+#import "TDBase64.h"
 
 #define TDBLOBSTOREENCRYPTIONTESTS_DBFILENAME @"schema100_1Bonsai_2Lorem.touchdb"
 #define TDBLOBSTOREENCRYPTIONTESTS_LOREM_FILE @"lorem.txt"
@@ -578,6 +580,29 @@
                           @"Both should be the same");
 }
 
+- (void)testBlobStoreWriterComputesOnlyTheDigestsAskedFor
+{
+    [self.blobStoreWriter appendData:self.plainData];
+    [self.blobStoreWriter finish];
+
+    unsigned char md5[CC_MD5_DIGEST_LENGTH];
+    CC_MD5(self.plainData.bytes, (CC_LONG)self.plainData.length, md5);
+    NSString *expectedMD5 =
+        [@"md5-" stringByAppendingString:[TDBase64 encode:md5 length:sizeof(md5)]];
+    XCTAssertEqualObjects(self.blobStoreWriter.MD5DigestString, expectedMD5);
+    XCTAssertEqualObjects(self.blobStoreWriter.digestString, expectedMD5);
+
+    TDBlobStoreWriter *writer = [[TDBlobStoreWriter alloc] initWithStore:self.blobStore];
+    writer.computesMD5Digest = NO;
+    [writer appendData:self.plainData];
+    [writer finish];
+
+    XCTAssertNil(writer.MD5DigestString);
+    XCTAssertEqualObjects(writer.digestString, writer.SHA1DigestString);
+    XCTAssertEqualObjects(TDHexFromBytes(writer.blobKey.bytes, sizeof(writer.blobKey.bytes)),
+                          self.hexExpectedSHA1Digest);
+}
+
 - (void)testBlobStoreWriterSavesEncryptedData
 {
     NSData *subData01 = [self.plainData subdataWithRange:NSMakeRange(0, self.plainData.length / 2)];
@@ -676,6 +701,100 @@
                           @"It has to return the same data previously saved");
 }
 
+- (void)testRekeyedCopyOfBlobIsOnlyReadableWithNewKey
+{
+    __block TDBlobKey blobKey;
+    __block NSString *filename = nil;
+    [self.otherDB.fmdbQueue inDatabase:^(FMDatabase *db) {
+      [_encryptedBlobStore storeBlob:_plainData creatingKey:&blobKey withDatabase:db error:nil];
+      filename = [TD_Database filenameForKey:blobKey inBlobFilenamesTableInDatabase:db];
+    }];
+
+    CDTHelperFixedKeyProvider *newProvider = [[CDTHelperFixedKeyProvider provider] negatedProvider];
+    [self.encryptedBlobStore changeEncryptionKeyToKeyOfProvider:newProvider];
+    XCTAssertTrue([self.encryptedBlobStore blobNeedsRekeyingWithFilename:filename]);
+
+    NSString *copyPath = [self.encryptedBlobStore writeRekeyedCopyOfBlobWithFilename:filename
+                                                                               error:nil];
+    XCTAssertNotNil(copyPath);
+
+    __block id<CDTBlobReader> reader = nil;
+    __block BOOL installed = NO;
+    [self.otherDB.fmdbQueue inDatabase:^(FMDatabase *db) {
+      reader = [_encryptedBlobStore blobForKey:blobKey withDatabase:db];
+      XCTAssertEqualObjects(self.plainData, [reader dataWithError:nil],
+                            @"The attachment is read with its old key until it's swapped");
+
+      installed = [_encryptedBlobStore installRekeyedCopyAtPath:copyPath
+                                                  ofBlobWithKey:blobKey
+                                                       filename:filename
+                                                   withDatabase:db];
+    }];
+    XCTAssertTrue(installed);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:copyPath]);
+    XCTAssertFalse([self.encryptedBlobStore blobNeedsRekeyingWithFilename:filename]);
+    XCTAssertEqualObjects(self.plainData, [reader dataWithError:nil]);
+
+    NSString *blobPath = [self.encryptedBlobStorePath stringByAppendingPathComponent:filename];
+    CDTBlobHandleFactory *newFactory =
+        [CDTBlobHandleFactory factoryWithEncryptionKeyProvider:newProvider];
+    CDTBlobHandleFactory *oldFactory =
+        [CDTBlobHandleFactory factoryWithEncryptionKeyProvider:[CDTHelperFixedKeyProvider provider]];
+    XCTAssertEqualObjects(self.plainData, [[newFactory readerWithPath:blobPath] dataWithError:nil]);
+    XCTAssertNil([[oldFactory readerWithPath:blobPath] dataWithError:nil]);
+}
+
+- (void)testRekeyedCopyOfDeletedBlobIsNotInstalled
+{
+    __block TDBlobKey blobKey;
+    __block NSString *filename = nil;
+    [self.otherDB.fmdbQueue inDatabase:^(FMDatabase *db) {
+      [_encryptedBlobStore storeBlob:_plainData creatingKey:&blobKey withDatabase:db error:nil];
+      filename = [TD_Database filenameForKey:blobKey inBlobFilenamesTableInDatabase:db];
+    }];
+
+    [self.encryptedBlobStore
+        changeEncryptionKeyToKeyOfProvider:[[CDTHelperFixedKeyProvider provider] negatedProvider]];
+    NSString *copyPath = [self.encryptedBlobStore writeRekeyedCopyOfBlobWithFilename:filename
+                                                                               error:nil];
+
+    __block BOOL installed = NO;
+    [self.otherDB.fmdbQueue inDatabase:^(FMDatabase *db) {
+      [_encryptedBlobStore deleteBlobsExceptWithKeys:[NSSet set] withDatabase:db];
+      installed = [_encryptedBlobStore installRekeyedCopyAtPath:copyPath
+                                                  ofBlobWithKey:blobKey
+                                                       filename:filename
+                                                   withDatabase:db];
+    }];
+    XCTAssertTrue(installed, @"A copy no longer needed is not an error");
+    XCTAssertEqualObjects(
+        [[NSFileManager defaultManager] contentsOfDirectoryAtPath:self.encryptedBlobStorePath
+                                                            error:nil],
+        @[]);
+}
+
+- (void)testBlobStoreWriterInstallsWithKeyChangedWhileWriting
+{
+    [self.encryptedBlobStoreWriter appendData:self.plainData];
+    [self.encryptedBlobStoreWriter finish];
+
+    [self.encryptedBlobStore
+        changeEncryptionKeyToKeyOfProvider:[[CDTHelperFixedKeyProvider provider] negatedProvider]];
+
+    __block NSString *filename = nil;
+    __block id<CDTBlobReader> reader = nil;
+    [self.otherDB.fmdbQueue inDatabase:^(FMDatabase *db) {
+      [_encryptedBlobStoreWriter installWithDatabase:db];
+      filename = [TD_Database filenameForKey:_encryptedBlobStoreWriter.blobKey
+              inBlobFilenamesTableInDatabase:db];
+      reader = [_encryptedBlobStore blobForKey:_encryptedBlobStoreWriter.blobKey withDatabase:db];
+    }];
+
+    XCTAssertFalse([self.encryptedBlobStore blobNeedsRekeyingWithFilename:filename],
+                   @"A blob written with the old key is re-encrypted as it's installed");
+    XCTAssertEqualObjects(self.plainData, [reader dataWithError:nil]);
+}
+
 @end
 
 @implementation TDFixedFilenameBlobStore
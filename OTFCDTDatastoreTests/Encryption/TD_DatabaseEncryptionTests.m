@@ -21,7 +21,9 @@
 #import "CloudantTests+EncryptionTests.h"
 #import "FMDatabase+SQLCipher.h"
 
+#import "TD_Body.h"
 #import "TD_Database.h"
+#import "TD_Database+Insertion.h"
 
 @interface TD_DatabaseEncryptionTests : CloudantSyncTests
 
@@ -244,6 +246,96 @@
     XCTAssertFalse([db openWithEncryptionKeyProvider:otherProvider],
                    @"An encrypted db can only be open with the same key it was created");
 }
+
+- (void)testOpenWithCipherPageSizeConvertsExistingDatabase
+{
+    // Create encrypted db with the default page size
+    CDTHelperFixedKeyProvider *fixedProvider = [CDTHelperFixedKeyProvider provider];
+
+    NSString *path = [[self createTemporaryDirectoryAndReturnPath]
+        stringByAppendingPathComponent:@"TD_DatabaseEncryptionTests_pageSize"];
+    TD_Database *db =
+        [TD_Database createEmptyDBAtPath:path withEncryptionKeyProvider:fixedProvider];
+    [db close];
+
+    // Re-open with a larger page size
+    CDTHelperFixedKeyProvider *tunedProvider = [CDTHelperFixedKeyProvider provider];
+    tunedProvider.cipherSettings = [[CDTEncryptionCipherSettings alloc] init];
+    tunedProvider.cipherSettings.pageSize = 8192;
+    tunedProvider.cipherSettings.cacheSize = -4096;
+
+    db = [[TD_Database alloc] initWithPath:path];
+    XCTAssertTrue([db openWithEncryptionKeyProvider:tunedProvider],
+                  @"An encrypted db is converted to the page size it is opened with");
+    [db close];
+
+    db = [[TD_Database alloc] initWithPath:path];
+    XCTAssertFalse([db openWithEncryptionKeyProvider:fixedProvider],
+                   @"Once converted, the db can only be open with the new page size");
+
+    db = [[TD_Database alloc] initWithPath:path];
+    XCTAssertTrue([db openWithEncryptionKeyProvider:tunedProvider]);
+    [db close];
+}
+
+- (void)testPageSizeConversionKeepsWhatIsOnlyInTheWAL
+{
+    CDTHelperFixedKeyProvider *fixedProvider = [CDTHelperFixedKeyProvider provider];
+    NSString *dir = [self createTemporaryDirectoryAndReturnPath];
+    NSString *path = [dir stringByAppendingPathComponent:@"TD_DatabaseEncryptionTests_wal"];
+    TD_Database *db =
+        [TD_Database createEmptyDBAtPath:path withEncryptionKeyProvider:fixedProvider];
+    TD_Revision *rev = [[TD_Revision alloc] initWithDocID:@"doc" revID:nil deleted:NO];
+    rev.body = [[TD_Body alloc] initWithProperties:@{ @"_id" : @"doc", @"hello" : @"world" }];
+    TDStatus status;
+    XCTAssertNotNil([db putRevision:rev prevRevisionID:nil allowConflict:NO status:&status]);
+
+    // Copied while open, the document is in the copy's WAL, as if the app had stopped
+    NSString *copyPath = [dir stringByAppendingPathComponent:@"TD_DatabaseEncryptionTests_walCopy"];
+    for (NSString *suffix in @[ @"", @"-wal", @"-shm" ]) {
+        [[NSFileManager defaultManager] copyItemAtPath:[path stringByAppendingString:suffix]
+                                                toPath:[copyPath stringByAppendingString:suffix]
+                                                 error:nil];
+    }
+    [db close];
+
+    CDTHelperFixedKeyProvider *tunedProvider = [CDTHelperFixedKeyProvider provider];
+    tunedProvider.cipherSettings = [[CDTEncryptionCipherSettings alloc] init];
+    tunedProvider.cipherSettings.pageSize = 8192;
+
+    db = [[TD_Database alloc] initWithPath:copyPath];
+    XCTAssertTrue([db openWithEncryptionKeyProvider:tunedProvider]);
+    XCTAssertNotNil([db getDocumentWithID:@"doc" revisionID:nil options:0 status:&status]);
+    [db close];
+}
+
+- (void)testOpenLatencyOfEncryptedDatabase
+{
+    CDTHelperFixedKeyProvider *provider = [CDTHelperFixedKeyProvider provider];
+    NSString *path = [[self createTemporaryDirectoryAndReturnPath]
+        stringByAppendingPathComponent:@"TD_DatabaseEncryptionTests_openLatencyEncrypted"];
+    [[TD_Database createEmptyDBAtPath:path withEncryptionKeyProvider:provider] close];
+
+    [self measureBlock:^{
+        TD_Database *db = [[TD_Database alloc] initWithPath:path];
+        XCTAssertTrue([db openWithEncryptionKeyProvider:provider]);
+        [db close];
+    }];
+}
 #endif
 
+- (void)testOpenLatencyOfNonEncryptedDatabase
+{
+    CDTEncryptionKeyNilProvider *provider = [CDTEncryptionKeyNilProvider provider];
+    NSString *path = [[self createTemporaryDirectoryAndReturnPath]
+        stringByAppendingPathComponent:@"TD_DatabaseEncryptionTests_openLatencyNotEncrypted"];
+    [[TD_Database createEmptyDBAtPath:path withEncryptionKeyProvider:provider] close];
+
+    [self measureBlock:^{
+        TD_Database *db = [[TD_Database alloc] initWithPath:path];
+        XCTAssertTrue([db openWithEncryptionKeyProvider:provider]);
+        [db close];
+    }];
+}
+
 @end
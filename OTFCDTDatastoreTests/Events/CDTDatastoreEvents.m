@@ -147,6 +147,38 @@
     XCTAssertEqual(self.otherWatcher.counter, (NSInteger)0, @"Event incorrectly fired");
 }
 
+- (void)testChangesAreListedTogether
+{
+    self.datastore.changeNotificationInterval = 0.5;
+    self.datastore.postsRevisionChangeNotifications = NO;
+
+    __block NSArray<CDTDocumentChange *> *changes = nil;
+    [self expectationForNotification:CDTDatastoreChangesNotification
+                              object:self.datastore
+                             handler:^BOOL(NSNotification *n) {
+                                 changes = n.userInfo[@"changes"];
+                                 return YES;
+                             }];
+
+    NSMutableArray *saved = [NSMutableArray array];
+    for (int i = 0; i < 3; i++) {
+        CDTDocumentRevision *rev = [CDTDocumentRevision revision];
+        rev.body = [@{ @"hello" : @"world" } mutableCopy];
+        [saved addObject:[self.datastore createDocumentFromRevision:rev error:nil]];
+    }
+    XCTAssertEqual(self.watcher.counter, (NSInteger)0, @"Event incorrectly fired");
+
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual(changes.count, (NSUInteger)3);
+    for (NSUInteger i = 0; i < changes.count; i++) {
+        CDTDocumentRevision *rev = saved[i];
+        XCTAssertEqualObjects(changes[i].docId, rev.docId);
+        XCTAssertEqualObjects(changes[i].revId, rev.revId);
+        XCTAssertEqual(changes[i].sequence, rev.sequence);
+        XCTAssertFalse(changes[i].deleted);
+    }
+}
+
 - (void)testEventFiredOnMultipleDelete
 {
     NSError * error;
@@ -0,0 +1,134 @@
+//
+//  CDTEncryptionKeychainKeyCacheTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "CDTEncryptionKeychainKeyCache.h"
+
+@interface CDTEncryptionKeychainKeyCacheTests : XCTestCase
+
+@property (strong, nonatomic) CDTEncryptionKeychainKeyCache *cache;
+@property (strong, nonatomic) CDTEncryptionKey *key;
+
+@end
+
+@implementation CDTEncryptionKeychainKeyCacheTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.cache = [[CDTEncryptionKeychainKeyCache alloc] init];
+    self.key = [CDTEncryptionKey
+        encryptionKeyWithData:[NSMutableData dataWithLength:CDTENCRYPTIONKEY_KEYSIZE]];
+}
+
+- (void)tearDown
+{
+    self.key = nil;
+    self.cache = nil;
+
+    [super tearDown];
+}
+
+- (void)testKeyIsDerivedOnceForTheSameIdentifierAndPassword
+{
+    __block NSUInteger derivations = 0;
+    CDTEncryptionKey * (^derive)(void) = ^{
+      derivations++;
+      return self.key;
+    };
+
+    XCTAssertEqual([self.cache keyForIdentifier:@"id" password:@"pw" lifetime:60 derivingWith:derive],
+                   self.key);
+    XCTAssertEqual([self.cache keyForIdentifier:@"id" password:@"pw" lifetime:60 derivingWith:derive],
+                   self.key);
+    XCTAssertEqual(derivations, 1, @"The second call should get the cached key");
+}
+
+- (void)testKeyIsNotReturnedForAnotherPassword
+{
+    [self.cache keyForIdentifier:@"id"
+                        password:@"pw"
+                        lifetime:60
+                    derivingWith:^{
+                      return self.key;
+                    }];
+
+    __block BOOL derived = NO;
+    CDTEncryptionKey *key = [self.cache keyForIdentifier:@"id"
+                                                password:@"wrong"
+                                                lifetime:60
+                                            derivingWith:^CDTEncryptionKey * {
+                                              derived = YES;
+                                              return nil;
+                                            }];
+    XCTAssertTrue(derived, @"A different password has to go to the keychain");
+    XCTAssertNil(key);
+}
+
+- (void)testKeyIsDerivedAgainOnceExpired
+{
+    __block NSUInteger derivations = 0;
+    CDTEncryptionKey * (^derive)(void) = ^{
+      derivations++;
+      return self.key;
+    };
+
+    [self.cache keyForIdentifier:@"id" password:@"pw" lifetime:0 derivingWith:derive];
+    [self.cache keyForIdentifier:@"id" password:@"pw" lifetime:0 derivingWith:derive];
+    XCTAssertEqual(derivations, 2);
+}
+
+- (void)testKeyIsDerivedAgainOnceRemoved
+{
+    __block NSUInteger derivations = 0;
+    CDTEncryptionKey * (^derive)(void) = ^{
+      derivations++;
+      return self.key;
+    };
+
+    [self.cache keyForIdentifier:@"id" password:@"pw" lifetime:60 derivingWith:derive];
+    [self.cache removeAllKeys];
+    [self.cache keyForIdentifier:@"id" password:@"pw" lifetime:60 derivingWith:derive];
+    XCTAssertEqual(derivations, 2);
+}
+
+- (void)testConcurrentCallersWaitForASingleDerivation
+{
+    __block NSUInteger derivations = 0;
+    CDTEncryptionKey * (^derive)(void) = ^{
+      derivations++;
+      [NSThread sleepForTimeInterval:0.2];
+      return self.key;
+    };
+
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    for (NSUInteger i = 0; i < 8; i++) {
+        dispatch_group_async(group, queue, ^{
+          XCTAssertEqual([self.cache keyForIdentifier:@"id"
+                                             password:@"pw"
+                                             lifetime:60
+                                         derivingWith:derive],
+                         self.key);
+        });
+    }
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+    XCTAssertEqual(derivations, 1);
+}
+
+@end
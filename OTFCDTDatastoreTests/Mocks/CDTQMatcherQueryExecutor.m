@@ -38,6 +38,12 @@
     return [[CDTQAndQueryNode alloc] init];
 }
 
+// MOD: no SQL for the tree, so sorted queries also take their IDs from -executeQueryTree:
+- (CDTQSqlParts *)sqlForIdsOfQueryTree:(CDTQQueryNode *)node
+{
+    return nil;
+}
+
 // MOD: just return all doc IDs rather than executing the query nodes
 - (NSSet*)executeQueryTree:(CDTQQueryNode*)node inDatabase:(FMDatabase*)db
 {
@@ -41,5 +41,37 @@ public class SwiftTests : CloudantSyncTests {
         }
         print("done")
     }
-    
+
+    struct Fruit : Codable, Equatable {
+        let name: String
+        let count: Int
+    }
+
+    // test that documents decode straight from their JSON with JSONDecoder
+    public func testDecodeDocumentsFromJSON() {
+        do {
+            let store = try factory.datastoreNamed("my_ds")
+            let rev = CDTDocumentRevision(docId: "apple")
+            rev.body = NSMutableDictionary(dictionary: ["name":"apple", "count":3])
+            try store.createDocument(from: rev)
+
+            let decoder = JSONDecoder()
+            let fetched = try store.getDocumentWithId("apple")
+            let apple = try decoder.decode(Fruit.self, from: try fetched.documentAsData())
+            XCTAssertEqual(apple, Fruit(name: "apple", count: 3))
+
+            store.ensureIndexed(["name"], withName: "index")
+            var found: [Fruit] = []
+            store.find(["name":"apple"])?.enumerateObjects { (rev, idx, stop) in
+                if let json = try? rev.documentAsData(),
+                    let fruit = try? decoder.decode(Fruit.self, from: json) {
+                    found.append(fruit)
+                }
+            }
+            XCTAssertEqual(found, [apple])
+        } catch {
+            XCTFail("Test failed with \(error)")
+        }
+    }
+
 }
@@ -0,0 +1,101 @@
+//
+//  TDAdaptiveBatchControllerTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "CDTHTTPInterceptorContext.h"
+#import "TDAdaptiveBatchController.h"
+
+@interface TDAdaptiveBatchControllerTests : XCTestCase
+
+@end
+
+@implementation TDAdaptiveBatchControllerTests
+
+- (CDTHTTPInterceptorContext *)contextWithStatusCode:(NSInteger)statusCode
+{
+    NSURL *url = [NSURL URLWithString:@"http://example.com/db/_bulk_get"];
+    CDTHTTPInterceptorContext *context =
+        [[CDTHTTPInterceptorContext alloc] initWithRequest:[NSMutableURLRequest requestWithURL:url]];
+    context.response = [[NSHTTPURLResponse alloc] initWithURL:url
+                                                   statusCode:statusCode
+                                                  HTTPVersion:@"HTTP/1.1"
+                                                 headerFields:@{}];
+    return context;
+}
+
+- (void)testStartsFromFixedDefaults
+{
+    TDAdaptiveBatchController *controller = [[TDAdaptiveBatchController alloc] init];
+    XCTAssertEqual(controller.bulkFetchSize, (NSUInteger)50);
+    XCTAssertEqual(controller.maxConnections, (NSUInteger)12);
+    XCTAssertGreaterThanOrEqual(controller.changesFeedLimit, 100u);
+}
+
+- (void)testFastFetchesGrowBatchesAndConnections
+{
+    TDAdaptiveBatchController *controller = [[TDAdaptiveBatchController alloc] init];
+    for (int i = 0; i < 50; i++) {
+        [controller recordFetchOfRevisions:50 duration:0.1];  // 500 revs/sec
+    }
+    XCTAssertEqual(controller.bulkFetchSize, (NSUInteger)500);
+    XCTAssertGreaterThan(controller.maxConnections, (NSUInteger)12);
+    XCTAssertEqual(controller.changesFeedLimit, 5000u);
+}
+
+- (void)testSlowFetchesShrinkBatches
+{
+    TDAdaptiveBatchController *controller = [[TDAdaptiveBatchController alloc] init];
+    for (int i = 0; i < 20; i++) {
+        [controller recordFetchOfRevisions:50 duration:20.0];  // 2.5 revs/sec
+    }
+    XCTAssertEqual(controller.bulkFetchSize, (NSUInteger)10);
+    XCTAssertGreaterThanOrEqual(controller.changesFeedLimit, 100u);
+}
+
+- (void)testInflatedLatencyDropsConnections
+{
+    TDAdaptiveBatchController *controller = [[TDAdaptiveBatchController alloc] init];
+    [controller recordFetchOfRevisions:50 duration:1.0];
+    NSUInteger connections = controller.maxConnections;
+    for (int i = 0; i < 10; i++) {
+        [controller recordFetchOfRevisions:50 duration:10.0];
+    }
+    XCTAssertLessThan(controller.maxConnections, connections);
+}
+
+- (void)testThrottlingHalvesConnections
+{
+    TDAdaptiveBatchController *controller = [[TDAdaptiveBatchController alloc] init];
+    [controller interceptResponseInContext:[self contextWithStatusCode:429]];
+    XCTAssertEqual(controller.maxConnections, (NSUInteger)6);
+    XCTAssertGreaterThan(controller.throttledRate, 0.0);
+
+    for (int i = 0; i < 10; i++) {
+        [controller recordThrottled];
+    }
+    XCTAssertEqual(controller.maxConnections, (NSUInteger)1);
+}
+
+- (void)testSuccessfulResponsesDecayThrottledRate
+{
+    TDAdaptiveBatchController *controller = [[TDAdaptiveBatchController alloc] init];
+    [controller interceptResponseInContext:[self contextWithStatusCode:429]];
+    double throttledRate = controller.throttledRate;
+    [controller interceptResponseInContext:[self contextWithStatusCode:200]];
+    XCTAssertLessThan(controller.throttledRate, throttledRate);
+    XCTAssertEqual(controller.maxConnections, (NSUInteger)6);
+}
+
+@end
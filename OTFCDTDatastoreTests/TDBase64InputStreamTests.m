@@ -0,0 +1,116 @@
+//
+//  TDBase64InputStreamTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "CDTBlobReader.h"
+#import "TDBase64InputStream.h"
+#import "TDMultiStreamWriter.h"
+
+@interface TDBase64InputStreamTestsBlob : NSObject <CDTBlobReader>
+@property (strong, nonatomic) NSData *data;
+@end
+
+@implementation TDBase64InputStreamTestsBlob
+
+- (NSData *)dataWithError:(NSError **)error { return self.data; }
+
+- (NSInputStream *)inputStreamWithOutputLength:(UInt64 *)outputLength
+{
+    if (outputLength) *outputLength = self.data.length;
+    return [NSInputStream inputStreamWithData:self.data];
+}
+
+- (NSData *)dataInRange:(NSRange)range error:(NSError **)error
+{
+    if (range.location >= self.data.length) return [NSData data];
+    range.length = MIN(range.length, self.data.length - range.location);
+    return [self.data subdataWithRange:range];
+}
+
+@end
+
+@interface TDBase64InputStreamTests : XCTestCase
+
+@end
+
+@implementation TDBase64InputStreamTests
+
+- (NSData *)dataOfLength:(NSUInteger)length
+{
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    uint8_t *bytes = data.mutableBytes;
+    for (NSUInteger i = 0; i < length; i++) {
+        bytes[i] = (uint8_t)(i * 7 + i / 251);
+    }
+    return data;
+}
+
+- (NSData *)readAll:(NSInputStream *)stream withBufferSize:(NSUInteger)bufferSize
+{
+    NSMutableData *result = [NSMutableData data];
+    uint8_t buffer[bufferSize];
+    [stream open];
+    NSInteger n;
+    while ((n = [stream read:buffer maxLength:bufferSize]) > 0) {
+        [result appendBytes:buffer length:n];
+    }
+    XCTAssertEqual(n, (NSInteger)0);
+    [stream close];
+    return result;
+}
+
+- (void)testEncodesLikeNSData
+{
+    TDBase64InputStreamTestsBlob *blob = [[TDBase64InputStreamTestsBlob alloc] init];
+    for (NSNumber *length in @[ @0, @1, @2, @3, @4, @5, @24575, @24576, @24577, @100000 ]) {
+        blob.data = [self dataOfLength:length.unsignedIntegerValue];
+        NSData *expected = [blob.data base64EncodedDataWithOptions:0];
+
+        TDBase64InputStream *stream = [[TDBase64InputStream alloc] initWithBlob:blob];
+        XCTAssertEqual(stream.length, (UInt64)expected.length, @"length %@", length);
+        XCTAssertEqualObjects([self readAll:stream withBufferSize:1000], expected, @"length %@",
+                              length);
+    }
+}
+
+- (void)testCanBeReadAgainAfterClosing
+{
+    TDBase64InputStreamTestsBlob *blob = [[TDBase64InputStreamTestsBlob alloc] init];
+    blob.data = [self dataOfLength:50000];
+    NSData *expected = [blob.data base64EncodedDataWithOptions:0];
+
+    TDBase64InputStream *stream = [[TDBase64InputStream alloc] initWithBlob:blob];
+    XCTAssertEqualObjects([self readAll:stream withBufferSize:4096], expected);
+    XCTAssertEqualObjects([self readAll:stream withBufferSize:7], expected);
+}
+
+- (void)testInlinesIntoMultiStreamWriter
+{
+    TDBase64InputStreamTestsBlob *blob = [[TDBase64InputStreamTestsBlob alloc] init];
+    blob.data = [@"hello world" dataUsingEncoding:NSUTF8StringEncoding];
+    TDBase64InputStream *stream = [[TDBase64InputStream alloc] initWithBlob:blob];
+
+    TDMultiStreamWriter *writer = [[TDMultiStreamWriter alloc] init];
+    [writer addData:[@"{\"data\":\"" dataUsingEncoding:NSUTF8StringEncoding]];
+    [writer addStream:stream length:stream.length];
+    [writer addData:[@"\"}" dataUsingEncoding:NSUTF8StringEncoding]];
+    XCTAssertEqual(writer.length, (SInt64)27);
+
+    NSString *output = [[NSString alloc] initWithData:[writer allOutput]
+                                             encoding:NSUTF8StringEncoding];
+    XCTAssertEqualObjects(output, @"{\"data\":\"aGVsbG8gd29ybGQ=\"}");
+}
+
+@end
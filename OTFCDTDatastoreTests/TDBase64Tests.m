@@ -0,0 +1,94 @@
+//
+//  TDBase64Tests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "CDTEncryptionKeyNilProvider.h"
+#import "TDBase64.h"
+#import "TDBlobStore.h"
+
+@interface TDBase64Tests : XCTestCase
+
+@end
+
+@implementation TDBase64Tests
+
+- (NSData *)dataOfLength:(NSUInteger)length
+{
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    uint8_t *bytes = data.mutableBytes;
+    for (NSUInteger i = 0; i < length; i++) {
+        bytes[i] = (uint8_t)(i * 7 + i / 251);
+    }
+    return data;
+}
+
+- (void)testEncodeAndDecodeAgreeWithFoundation
+{
+    // Every length up to a few of the vector loops' blocks, so each tail length is covered.
+    for (NSUInteger length = 0; length <= 300; length++) {
+        NSData *data = [self dataOfLength:length];
+        NSString *expected = [data base64EncodedStringWithOptions:0];
+        XCTAssertEqualObjects([TDBase64 encode:data], expected, @"length %lu",
+                              (unsigned long)length);
+        XCTAssertEqualObjects([TDBase64 decode:expected], data, @"length %lu",
+                              (unsigned long)length);
+    }
+}
+
+- (void)testInvalidCharactersAreRejectedWherever
+{
+    NSString *encoded = [TDBase64 encode:[self dataOfLength:300]];
+    for (NSUInteger i = 0; i < encoded.length; i++) {
+        NSString *invalid =
+            [encoded stringByReplacingCharactersInRange:NSMakeRange(i, 1) withString:@"*"];
+        XCTAssertNil([TDBase64 decode:invalid], @"'*' at %lu", (unsigned long)i);
+    }
+    XCTAssertNil([TDBase64 decode:@"QUJDéQUJD"]);
+    XCTAssertNil([TDBase64 decode:@"QUJ"]);
+    XCTAssertNil([TDBase64 decode:(NSString *)nil]);
+}
+
+- (void)testBlobWriterDecodesBase64
+{
+    NSString *path = [NSTemporaryDirectory()
+        stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    TDBlobStore *store = [[TDBlobStore alloc] initWithPath:path
+                                     encryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]
+                                                     error:nil];
+    XCTAssertNotNil(store);
+
+    // Longer than the chunks it's decoded in, and not a multiple of them
+    NSData *data = [self dataOfLength:200000];
+    TDBlobStoreWriter *decoding = [[TDBlobStoreWriter alloc] initWithStore:store];
+    XCTAssertTrue([decoding appendBase64String:[TDBase64 encode:data]]);
+    [decoding finish];
+    TDBlobStoreWriter *appending = [[TDBlobStoreWriter alloc] initWithStore:store];
+    [appending appendData:data];
+    [appending finish];
+
+    XCTAssertEqual(decoding.length, data.length);
+    XCTAssertEqualObjects(decoding.SHA1DigestString, appending.SHA1DigestString);
+    XCTAssertEqualObjects(decoding.MD5DigestString, appending.MD5DigestString);
+
+    TDBlobStoreWriter *invalid = [[TDBlobStoreWriter alloc] initWithStore:store];
+    XCTAssertFalse([invalid appendBase64String:@"QUJD*UJD"]);
+    [invalid cancel];
+    [decoding cancel];
+    [appending cancel];
+
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+@end
@@ -0,0 +1,95 @@
+//
+//  TDBatcherTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import "TDBatcher.h"
+
+@interface TDBatcherTests : XCTestCase
+@end
+
+@implementation TDBatcherTests
+
+- (void)testFlushesByCount
+{
+    NSMutableArray *batches = [NSMutableArray array];
+    TDBatcher *batcher = [[TDBatcher alloc] initWithCapacity:3
+                                                       delay:60
+                                                   processor:^(NSArray *objects) {
+                                                       [batches addObject:objects];
+                                                   }];
+    [batcher queueObjects:@[ @1, @2 ]];
+    XCTAssertEqual(batches.count, (NSUInteger)0);
+    [batcher queueObject:@3];
+    XCTAssertEqualObjects(batches, (@[ @[ @1, @2, @3 ] ]));
+    XCTAssertEqual(batcher.count, (NSUInteger)0);
+}
+
+- (void)testFlushesByBytes
+{
+    NSMutableArray *batches = [NSMutableArray array];
+    TDBatcher *batcher = [[TDBatcher alloc] initWithCapacity:100
+                                                       delay:60
+                                                   processor:^(NSArray *objects) {
+                                                       [batches addObject:objects];
+                                                   }];
+    batcher.byteLimit = 10;
+    batcher.sizeOfObject = ^UInt64(NSNumber *object) { return object.unsignedLongLongValue; };
+
+    [batcher queueObjects:@[ @4, @4 ]];
+    XCTAssertEqual(batches.count, (NSUInteger)0);
+    XCTAssertEqual(batcher.bytes, (UInt64)8);
+
+    // Over the limit: the first two fit in a batch, the third waits.
+    [batcher queueObject:@4];
+    XCTAssertEqualObjects(batches, (@[ @[ @4, @4 ] ]));
+    XCTAssertEqual(batcher.count, (NSUInteger)1);
+    XCTAssertEqual(batcher.bytes, (UInt64)4);
+
+    // An object bigger than the limit goes in a batch of its own.
+    [batcher queueObject:@20];
+    XCTAssertEqualObjects(batches.lastObject, (@[ @4 ]));
+    [batcher flush];
+    XCTAssertEqualObjects(batches.lastObject, (@[ @20 ]));
+    XCTAssertEqual(batcher.bytes, (UInt64)0);
+}
+
+- (void)testQueueFromOtherThreads
+{
+    NSMutableArray *processed = [NSMutableArray array];
+    NSThread *thread = [NSThread currentThread];
+    __block BOOL wrongThread = NO;
+    TDBatcher *batcher = [[TDBatcher alloc] initWithCapacity:50
+                                                       delay:0.1
+                                                   processor:^(NSArray *objects) {
+                                                       wrongThread |= [NSThread currentThread] != thread;
+                                                       [processed addObjectsFromArray:objects];
+                                                   }];
+
+    dispatch_apply(10, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^(size_t i) {
+        for (NSUInteger j = 0; j < 100; j++) {
+            [batcher queueObject:@(i * 100 + j)];
+        }
+    });
+
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5];
+    while (processed.count < 1000 && [deadline timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode
+                                 beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    XCTAssertEqual(processed.count, (NSUInteger)1000);
+    XCTAssertFalse(wrongThread);
+    XCTAssertEqual([NSSet setWithArray:processed].count, (NSUInteger)1000);
+}
+
+@end
@@ -0,0 +1,143 @@
+//
+//  TDBinaryJSONTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "TDBinaryJSON.h"
+#import "TDCanonicalJSON.h"
+#import "TD_Body.h"
+
+@interface TDBinaryJSONTests : XCTestCase
+
+@end
+
+@implementation TDBinaryJSONTests
+
+- (NSDictionary *)sampleDocument
+{
+    return @{
+        @"name" : @"mike",
+        @"unicode" : @"façade \U0001F600",
+        @"age" : @32,
+        @"big" : @(UINT64_MAX),
+        @"negative" : @(-7),
+        @"pi" : @3.14159,
+        @"married" : @YES,
+        @"pet" : [NSNull null],
+        @"empty" : @{},
+        @"tags" : @[ @"a", @1, @NO, @[], @{ @"x" : @2.5 } ],
+        @"address" : @{ @"city" : @"Bristol", @"geo" : @{ @"lat" : @51.45, @"lon" : @-2.58 } }
+    };
+}
+
+- (void)testRoundTrip
+{
+    NSDictionary *doc = [self sampleDocument];
+    NSData *data = [TDBinaryJSON dataWithJSONObject:doc];
+    XCTAssertTrue([TDBinaryJSON isBinaryJSON:data]);
+    XCTAssertEqualObjects([TDBinaryJSON JSONObjectWithData:data options:0], doc);
+
+    NSMutableDictionary *mutable =
+        [TDBinaryJSON JSONObjectWithData:data options:TDJSONReadingMutableContainers];
+    XCTAssertTrue([mutable isKindOfClass:[NSMutableDictionary class]]);
+    XCTAssertTrue([mutable[@"tags"] isKindOfClass:[NSMutableArray class]]);
+}
+
+- (void)testCanonicalJSONMatchesTheOriginal
+{
+    NSMutableDictionary *doc = [[self sampleDocument] mutableCopy];
+    // A float is kept as its text, since widening it to a double would change that.
+    doc[@"float"] = @0.1f;
+    doc[@"decimal"] = [NSDecimalNumber decimalNumberWithString:@"12345678901234567890.5"];
+    NSData *data = [TDBinaryJSON dataWithJSONObject:doc];
+    XCTAssertEqualObjects([TDBinaryJSON canonicalJSONWithData:data],
+                          [TDCanonicalJSON canonicalData:doc]);
+
+    // Also when encoded from JSON text, which is how bodies are stored:
+    NSData *json = [TDCanonicalJSON canonicalData:[self sampleDocument]];
+    XCTAssertEqualObjects([TDBinaryJSON canonicalJSONWithData:[TDBinaryJSON dataWithJSONData:json]],
+                          json);
+    XCTAssertEqualObjects([TD_Body bodyWithJSON:[TDBinaryJSON dataWithJSONData:json]].asJSON, json);
+}
+
+- (void)testJSONTextIsNotBinary
+{
+    XCTAssertFalse([TDBinaryJSON isBinaryJSON:[@"{\"a\":1}" dataUsingEncoding:NSUTF8StringEncoding]]);
+    XCTAssertFalse([TDBinaryJSON isBinaryJSON:[NSData data]]);
+    XCTAssertFalse([TDBinaryJSON isBinaryJSON:nil]);
+}
+
+- (void)testValueAtKeyPath
+{
+    NSData *data = [TDBinaryJSON dataWithJSONObject:[self sampleDocument]];
+    XCTAssertEqualObjects([TDBinaryJSON valueAtKeyPath:@[ @"name" ] inData:data], @"mike");
+    XCTAssertEqualObjects([TDBinaryJSON valueAtKeyPath:@[ @"address", @"geo", @"lat" ] inData:data],
+                          @51.45);
+    XCTAssertEqualObjects([TDBinaryJSON valueAtKeyPath:@[ @"address", @"geo" ] inData:data],
+                          (@{ @"lat" : @51.45, @"lon" : @-2.58 }));
+    XCTAssertEqualObjects([TDBinaryJSON valueAtKeyPath:@[ @"pet" ] inData:data], [NSNull null]);
+
+    XCTAssertNil([TDBinaryJSON valueAtKeyPath:@[ @"missing" ] inData:data]);
+    XCTAssertNil([TDBinaryJSON valueAtKeyPath:@[ @"name", @"first" ] inData:data]);
+    XCTAssertNil([TDBinaryJSON valueAtKeyPath:@[ @"tags", @"0" ] inData:data]);
+    XCTAssertNil([TDBinaryJSON valueAtKeyPath:@[ @"address", @"town" ] inData:data]);
+}
+
+- (void)testDictionaryWithValuesForKeys
+{
+    NSData *data = [TDBinaryJSON dataWithJSONObject:[self sampleDocument]];
+    NSDictionary *values =
+        [TDBinaryJSON dictionaryWithValuesForKeys:@[ @"name", @"age", @"missing" ] fromData:data];
+    XCTAssertEqualObjects(values, (@{ @"name" : @"mike", @"age" : @32 }));
+
+    NSData *array = [TDBinaryJSON dataWithJSONObject:@[ @1 ]];
+    XCTAssertNil([TDBinaryJSON dictionaryWithValuesForKeys:@[ @"name" ] fromData:array]);
+}
+
+- (void)testCommonKeysAreShared
+{
+    [TDBinaryJSON registerSharedKeys:@[ @"kind" ]];
+    XCTAssertTrue([[TDBinaryJSON sharedKeys] containsObject:@"_id"]);
+    XCTAssertTrue([[TDBinaryJSON sharedKeys] containsObject:@"kind"]);
+
+    NSDictionary *doc = @{ @"_id" : @"a", @"kind" : @"b", @"other" : @"c" };
+    NSData *data = [TDBinaryJSON dataWithJSONObject:doc];
+    NSDictionary *first = [TDBinaryJSON JSONObjectWithData:data options:0];
+    NSDictionary *second = [TDBinaryJSON JSONObjectWithData:data options:0];
+    XCTAssertEqualObjects(first, doc);
+
+    NSString * (^keyNamed)(NSDictionary *, NSString *) = ^(NSDictionary *dict, NSString *name) {
+        return [dict keysOfEntriesPassingTest:^BOOL(id key, id obj, BOOL *stop) {
+                   return [key isEqualToString:name];
+               }].anyObject;
+    };
+    XCTAssertEqual(keyNamed(first, @"_id"), keyNamed(second, @"_id"));
+    XCTAssertEqual(keyNamed(first, @"kind"), keyNamed(second, @"kind"));
+}
+
+- (void)testCorruptDataIsRejected
+{
+    NSData *data = [TDBinaryJSON dataWithJSONObject:[self sampleDocument]];
+    for (NSUInteger length = 5; length < data.length; length += 7) {
+        NSData *truncated = [data subdataWithRange:NSMakeRange(0, length)];
+        XCTAssertNil([TDBinaryJSON JSONObjectWithData:truncated options:0]);
+    }
+
+    NSMutableData *badTag = [data mutableCopy];
+    ((uint8_t *)badTag.mutableBytes)[4] = 0xFF;
+    XCTAssertNil([TDBinaryJSON JSONObjectWithData:badTag options:0]);
+    XCTAssertNil([TDBinaryJSON valueAtKeyPath:@[ @"name" ] inData:badTag]);
+}
+
+@end
@@ -0,0 +1,70 @@
+//
+//  TDBodyDeltaTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "TDBodyDelta.h"
+#import "TDCanonicalJSON.h"
+
+@interface TDBodyDeltaTests : XCTestCase
+
+@end
+
+@implementation TDBodyDeltaTests
+
+- (NSData *)documentWithName:(NSString *)name count:(NSUInteger)count
+{
+    NSMutableArray *items = [NSMutableArray array];
+    for (NSUInteger i = 0; i < count; i++) {
+        [items addObject:@{ @"index" : @(i), @"label" : [NSString stringWithFormat:@"item %lu",
+                                                                                    (unsigned long)i] }];
+    }
+    return [TDCanonicalJSON canonicalData:@{ @"name" : name, @"items" : items }];
+}
+
+- (void)testEditedDocumentRoundTrips
+{
+    NSData *base = [self documentWithName:@"mike" count:200];
+    NSData *edited = [self documentWithName:@"fred" count:201];
+    NSData *delta = [TDBodyDelta deltaOfData:edited fromBase:base baseSequence:42];
+    XCTAssertNotNil(delta);
+    XCTAssertTrue([TDBodyDelta isDelta:delta]);
+    XCTAssertLessThan(delta.length, edited.length / 10);
+    XCTAssertEqual([TDBodyDelta baseSequenceOfDelta:delta], (SequenceNumber)42);
+    XCTAssertEqualObjects([TDBodyDelta dataByApplyingDelta:delta toBase:base], edited);
+}
+
+- (void)testUnrelatedBodiesMakeNoDelta
+{
+    NSData *base = [self documentWithName:@"mike" count:50];
+    NSMutableData *unrelated = [NSMutableData dataWithLength:base.length];
+    arc4random_buf(unrelated.mutableBytes, unrelated.length);
+    XCTAssertNil([TDBodyDelta deltaOfData:unrelated fromBase:base baseSequence:1]);
+    XCTAssertFalse([TDBodyDelta isDelta:base]);
+    XCTAssertEqual([TDBodyDelta baseSequenceOfDelta:base], (SequenceNumber)0);
+}
+
+- (void)testDeltaNeedsItsOwnBase
+{
+    NSData *base = [self documentWithName:@"mike" count:100];
+    NSData *delta = [TDBodyDelta deltaOfData:[self documentWithName:@"fred" count:100]
+                                    fromBase:base
+                                baseSequence:7];
+    XCTAssertNil([TDBodyDelta dataByApplyingDelta:delta
+                                           toBase:[self documentWithName:@"mike" count:99]]);
+    XCTAssertNil([TDBodyDelta dataByApplyingDelta:[delta subdataWithRange:NSMakeRange(0, delta.length - 1)]
+                                           toBase:base]);
+}
+
+@end
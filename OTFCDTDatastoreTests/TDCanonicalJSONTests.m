@@ -103,4 +103,52 @@
     [self roundtrip:@{@"\"key\"": $false, @"": @{}}];
 }
 
+- (void)assertEncoderAgrees:(id)obj
+{
+    XCTAssertEqualObjects([TDCanonicalJSON canonicalData:obj], [TDCanonicalJSON slowCanonicalData:obj],
+                          @"Fast and slow encoders differ for %@", obj);
+}
+
+- (void)testFastEncoderMatchesSlowEncoder
+{
+    NSArray* strings = @[ @"", @"ordinary string", @"\"\\", @"a longer string with a \" quote in it",
+                          @"tab\there\r\nand\001\037\177", @"café 中文 \U0001F600",
+                          @"0123456789abcdef\\" ];
+    for (NSString* str in strings) {
+        [self assertEncoderAgrees:str];
+        [self assertEncoderAgrees:@{str: str}];
+    }
+
+    [self assertEncoderAgrees:@[ $true, $false, $null, @0, @-1, @INT64_MIN, @UINT64_MAX, @M_PI,
+                                 @1.0e-37, @((char)'x'), @((unsigned char)200), @((short)-7) ]];
+
+    // Key order, including non-ASCII keys, whose UTF-8 order differs from NSLiteralSearch's
+    [self assertEncoderAgrees:@{@"b": @1, @"a": @2, @"ab": @3, @"": @4, @"B": @5}];
+    [self assertEncoderAgrees:@{@"￿": @1, @"\U0001F600": @2, @"é": @3, @"e": @4}];
+
+    NSMutableDictionary* big = [NSMutableDictionary dictionary];
+    for (int i = 0; i < 100; i++) {
+        big[[NSString stringWithFormat:@"key%d", i]] = @{@"n": @(i), @"list": @[ @"x", @{} ]};
+    }
+    [self assertEncoderAgrees:@{@"_id": @"doc", @"nested": big, @"empty": @[]}];
+}
+
+- (void)testFastEncoderEscapes
+{
+    XCTAssertEqualObjects([TDCanonicalJSON canonicalString:@"a\"b\\c\r\n\t\001"],
+                          @"\"a\\\"b\\\\c\\r\\n\\u0009\\u0001\"");
+    XCTAssertEqualObjects([TDCanonicalJSON canonicalString:@{@"b": @1, @"a": @[ $null ]}],
+                          @"{\"a\":[null],\"b\":1}");
+}
+
+- (void)testIgnoreKeyPrefix
+{
+    TDCanonicalJSON* encoder =
+        [[TDCanonicalJSON alloc] initWithObject:@{@"_id": @"x", @"_rev": @"1-a", @"foo": @1}];
+    encoder.ignoreKeyPrefix = @"_";
+    encoder.whitelistedKeys = @[ @"_id" ];
+    XCTAssertEqualObjects(encoder.canonicalString, @"{\"_id\":\"x\",\"foo\":1}");
+    XCTAssertEqualObjects(encoder.canonicalData, encoder.slowCanonicalData);
+}
+
 @end
@@ -185,4 +185,58 @@ extern char convertEscape(const char**);
 }
 
 
+- (void)testCollateLongCommonPrefixes
+{
+    void* mode = kTDCollateJSON_Unicode;
+    [self scalarTest:mode str1:"[\"user\",\"2018-01-01\",[1,2],3]" str2:"[\"user\",\"2018-01-01\",[1,2],4]" retVal:-1];
+    [self scalarTest:mode str1:"[\"user\",\"2018-01-01\",12]" str2:"[\"user\",\"2018-01-01\",1]" retVal:1];
+    [self scalarTest:mode str1:"[\"user\",\"2018-01-01\"]" str2:"[\"user\",\"2018-01-01\",null]" retVal:-1];
+    [self scalarTest:mode str1:"[\"user\",\"a,b\"]" str2:"[\"user\",\"a,c\"]" retVal:-1];
+    [self scalarTest:mode str1:"[\"us\\\"er\",1]" str2:"[\"us\\\"er\",2]" retVal:-1];
+    [self scalarTest:mode str1:"{\"user\":\"a\",\"n\":1}" str2:"{\"user\":\"a\",\"n\":1.0}" retVal:0];
+    [self scalarTest:mode str1:"[\"user\",[1,2],3]" str2:"[\"user\",[1,2],4]" retVal:0 arrayLimit:2];
+    [self scalarTest:mode str1:"[\"user\",[1,2],3]" str2:"[\"user\",[1,3],4]" retVal:-1 arrayLimit:2];
+}
+
+- (int)compareSortKeys:(void*)mode str1:(const char*)str1 str2:(const char*)str2
+{
+    NSData* key1 = TDCollateJSONSortKey(mode, (int)strlen(str1), str1);
+    NSData* key2 = TDCollateJSONSortKey(mode, (int)strlen(str2), str2);
+    XCTAssertNotNil(key1);
+    XCTAssertNotNil(key2);
+    int result = memcmp(key1.bytes, key2.bytes, MIN(key1.length, key2.length));
+    if (result == 0) result = (key1.length > key2.length) - (key1.length < key2.length);
+    return result > 0 ? 1 : (result < 0 ? -1 : 0);
+}
+
+- (void)testSortKeysOrderLikeCollator
+{
+    const char* values[] = {"null", "false", "true", "-12.5", "-0", "0", "1", "1.0", "123", "1e10",
+        "\"\"", "\"A\"", "\"a\"", "\"aa\"", "\"a\\\"b\"", "\"\\u0041\"", "\"\\u0000\"", "\"\\t\"",
+        "\"fr\xc3\xa9\x64\"", "[]", "[null]", "[1]", "[1,2]", "[1,[2,3]]", "[[]]", "[\"b\",\"c\"]",
+        "{}", "{\"a\":1}", "{\"a\":1,\"b\":2}", "{\"b\":0}"};
+    const size_t count = sizeof(values) / sizeof(values[0]);
+    void* modes[] = {kTDCollateJSON_Raw, kTDCollateJSON_ASCII};
+    for (size_t m = 0; m < 2; ++m) {
+        void* mode = modes[m];
+        for (size_t i = 0; i < count; ++i) {
+            for (size_t j = 0; j < count; ++j) {
+                int expected = TDCollateJSON(mode, (int)strlen(values[i]), values[i],
+                                             (int)strlen(values[j]), values[j]);
+                expected = expected > 0 ? 1 : (expected < 0 ? -1 : 0);
+                XCTAssertEqual([self compareSortKeys:mode str1:values[i] str2:values[j]], expected,
+                               @"sort keys of %s and %s disagree with the collator in mode %p",
+                               values[i], values[j], mode);
+            }
+        }
+    }
+}
+
+- (void)testSortKeysUnavailableForUnicode
+{
+    XCTAssertNil(TDCollateJSONSortKey(kTDCollateJSON_Unicode, 3, "\"a\""));
+    XCTAssertNotNil(TDCollateJSONSortKey(kTDCollateJSON_ASCII, 3, "\"a\""));
+}
+
+
 @end
@@ -0,0 +1,121 @@
+//
+//  TDJSONDecodePoolTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "TDJSONDecodePool.h"
+#import "TDStreamingJSONParser.h"
+
+@interface TDJSONDecodePoolTests : XCTestCase
+
+@end
+
+@implementation TDJSONDecodePoolTests
+
+- (void)testResultsArePassedOnInOrder
+{
+    TDJSONDecodePool *pool = [[TDJSONDecodePool alloc] initWithMaximumWorkers:4];
+    NSMutableArray *results = [NSMutableArray array];
+    TDJSONDecodeSequence *sequence = [[TDJSONDecodeSequence alloc]
+        initWithPool:pool
+           transform:^id(NSDictionary *json) {
+               // Finish out of order, the earlier ones last:
+               NSInteger n = [json[@"n"] integerValue];
+               [NSThread sleepForTimeInterval:0.001 * (n % 7)];
+               return (n % 10 == 9) ? nil : @(n * 2);  // leave some out
+           }
+            onResult:^(id result, NSError *error) {
+                XCTAssertNil(error);
+                XCTAssertTrue([NSThread isMainThread]);
+                [results addObject:result];
+            }];
+
+    for (NSInteger n = 0; n < 100; n++) {
+        NSString *json = [NSString stringWithFormat:@"{\"n\": %ld}", (long)n];
+        [sequence decodeData:[json dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    XCTestExpectation *drained = [self expectationWithDescription:@"drained"];
+    [sequence whenDrained:^{
+        [drained fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+
+    XCTAssertEqual(results.count, 90u);
+    NSInteger expected = 0;
+    for (NSNumber *result in results) {
+        if (expected % 10 == 9) expected++;
+        XCTAssertEqualObjects(result, @(expected * 2));
+        expected++;
+    }
+    XCTAssertEqual(sequence.pendingCount, 0u);
+}
+
+- (void)testParserDecodesElementsOnPool
+{
+    TDJSONDecodePool *pool = [[TDJSONDecodePool alloc] initWithMaximumWorkers:2];
+    NSMutableArray *elements = [NSMutableArray array];
+    __block NSError *elementError = nil;
+    TDJSONDecodeSequence *sequence =
+        [[TDJSONDecodeSequence alloc] initWithPool:pool
+                                         transform:nil
+                                          onResult:^(id element, NSError *error) {
+                                              if (element) [elements addObject:element];
+                                              if (error) elementError = error;
+                                          }];
+    TDStreamingJSONParser *parser =
+        [[TDStreamingJSONParser alloc] initWithArrayKey:@"results" decodeSequence:sequence];
+
+    NSString *json = @"{\"results\": [{\"id\": \"a\"}, [1, 2], \"three\", {\"id\": \"d\"}]}";
+    // In small chunks, so elements span them:
+    NSData *data = [json dataUsingEncoding:NSUTF8StringEncoding];
+    for (NSUInteger i = 0; i < data.length; i += 5) {
+        XCTAssertTrue(
+            [parser parseData:[data subdataWithRange:NSMakeRange(i, MIN(5u, data.length - i))]]);
+    }
+    XCTAssertTrue(parser.finished);
+    XCTAssertEqual(parser.elementCount, 4u);
+
+    XCTestExpectation *drained = [self expectationWithDescription:@"drained"];
+    [sequence whenDrained:^{
+        [drained fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    XCTAssertEqualObjects(elements, (@[ @{ @"id" : @"a" }, @[ @1, @2 ], @"three", @{ @"id" : @"d" } ]));
+    XCTAssertNil(elementError);
+}
+
+- (void)testWithoutPoolDecodesStraightAway
+{
+    NSMutableArray *results = [NSMutableArray array];
+    NSMutableArray *errors = [NSMutableArray array];
+    TDJSONDecodeSequence *sequence =
+        [[TDJSONDecodeSequence alloc] initWithPool:nil
+                                         transform:nil
+                                          onResult:^(id result, NSError *error) {
+                                              if (result) [results addObject:result];
+                                              if (error) [errors addObject:error];
+                                          }];
+    [sequence decodeData:[@"[1]" dataUsingEncoding:NSUTF8StringEncoding]];
+    [sequence decodeData:[@"[1" dataUsingEncoding:NSUTF8StringEncoding]];
+    XCTAssertEqualObjects(results, @[ @[ @1 ] ]);
+    XCTAssertEqual(errors.count, 1u);
+    XCTAssertEqual(sequence.pendingCount, 0u);
+
+    // Cancelled, it passes nothing on.
+    [sequence cancel];
+    [sequence decodeData:[@"[2]" dataUsingEncoding:NSUTF8StringEncoding]];
+    XCTAssertEqual(results.count, 1u);
+}
+
+@end
@@ -0,0 +1,132 @@
+//
+//  TDJSONTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "TDJSON.h"
+#import "TDBinaryJSON.h"
+
+@interface TDJSONTests : XCTestCase
+
+@end
+
+@implementation TDJSONTests
+
+- (NSDictionary *)valuesForKeys:(NSArray *)keys inJSON:(NSString *)json
+{
+    return [TDJSON dictionaryWithValuesForKeys:keys
+                        fromJSONDictionaryData:[json dataUsingEncoding:NSUTF8StringEncoding]];
+}
+
+- (void)testValuesForKeysMatchesFullParse
+{
+    NSString *json = @"{\"name\":\"mike\",\"age\":12,\"pets\":[\"cat\",{\"a\":\"}]\"}],"
+                     @"\"address\":{\"town\":\"bristol\",\"nested\":{\"x\":[1,2]}},"
+                     @"\"quote\":\"say \\\"hi\\\"\",\"alive\":true,\"spouse\":null}";
+    NSDictionary *full =
+        [TDJSON JSONObjectWithData:[json dataUsingEncoding:NSUTF8StringEncoding] options:0 error:nil];
+    NSArray *keys = full.allKeys;
+    XCTAssertEqualObjects([self valuesForKeys:keys inJSON:json], full);
+
+    for (NSString *key in keys) {
+        XCTAssertEqualObjects([self valuesForKeys:@[ key ] inJSON:json], @{key : full[key]});
+    }
+}
+
+- (void)testValuesForKeysSkipsMissingKeys
+{
+    XCTAssertEqualObjects([self valuesForKeys:@[ @"age", @"missing" ] inJSON:@"{\"age\":12}"],
+                          @{ @"age" : @12 });
+    XCTAssertEqualObjects([self valuesForKeys:@[ @"age" ] inJSON:@"{}"], @{});
+    XCTAssertEqualObjects([self valuesForKeys:@[] inJSON:@"{\"age\":12}"], @{});
+}
+
+- (void)testValuesForKeysHandlesWhitespaceAndEscapedKeys
+{
+    NSDictionary *values =
+        [self valuesForKeys:@[ @"a b", @"caf\u00e9", @"n" ]
+                     inJSON:@" { \"a b\" : [ 1 , 2 ] ,\n\"caf\\u00e9\"\t:\"x\", \"n\" : -1.5e3 } "];
+    XCTAssertEqualObjects(values, (@{ @"a b" : @[ @1, @2 ], @"caf\u00e9" : @"x", @"n" : @(-1500) }));
+}
+
+- (void)testValuesForKeysRejectsInvalidJSON
+{
+    XCTAssertNil([self valuesForKeys:@[ @"a" ] inJSON:@"[1,2]"]);
+    XCTAssertNil([self valuesForKeys:@[ @"a" ] inJSON:@"{\"a\":1"]);
+    XCTAssertNil([self valuesForKeys:@[ @"a" ] inJSON:@"{\"a\" 1}"]);
+    XCTAssertNil([self valuesForKeys:@[ @"a" ] inJSON:@"{\"a\":[1,2}"]);
+    XCTAssertNil([self valuesForKeys:@[ @"a" ] inJSON:@""]);
+}
+
+- (void)testValuesForFieldsFollowsDottedPaths
+{
+    NSDictionary *doc = @{
+        @"name" : @"mike",
+        @"address" : @{ @"town" : @"bristol", @"geo" : @{ @"lat" : @51.45, @"lon" : @-2.58 } },
+        @"pets" : @[ @"cat" ]
+    };
+    NSArray *fields = @[ @"name", @"address.geo.lat", @"address.town", @"pets.0", @"missing.x" ];
+    NSDictionary *expected =
+        @{ @"name" : @"mike", @"address" : @{ @"town" : @"bristol", @"geo" : @{ @"lat" : @51.45 } } };
+
+    NSData *text = [TDJSON dataWithJSONObject:doc options:0 error:nil];
+    NSData *binary = [TDBinaryJSON dataWithJSONObject:doc];
+    for (NSData *json in @[ text, binary ]) {
+        XCTAssertEqualObjects([TDJSON dictionaryWithValuesForFields:fields fromJSONDictionaryData:json],
+                              expected);
+        // A field within another that's asked for comes whole with it:
+        XCTAssertEqualObjects(
+            [TDJSON dictionaryWithValuesForFields:@[ @"address.geo.lat", @"address" ]
+                           fromJSONDictionaryData:json],
+            @{ @"address" : doc[@"address"] });
+    }
+    XCTAssertNil([TDJSON dictionaryWithValuesForFields:@[ @"a" ]
+                                fromJSONDictionaryData:[TDBinaryJSON dataWithJSONObject:@[ @1 ]]]);
+}
+
+- (NSString *)removingKeys:(NSArray *)keys fromJSON:(NSString *)json
+{
+    NSData *result =
+        [TDJSON dataByRemovingKeys:[NSSet setWithArray:keys]
+            fromJSONDictionaryData:[json dataUsingEncoding:NSUTF8StringEncoding]];
+    return result ? [[NSString alloc] initWithData:result encoding:NSUTF8StringEncoding] : nil;
+}
+
+- (void)testRemovingKeysSplicesTheRemainingEntries
+{
+    NSString *json = @"{\"_id\":\"doc\",\"a\":{\"b\":\"}\"},\"n\":1,\"list\":[1,{\"c\":2}]}";
+    XCTAssertEqualObjects([self removingKeys:@[ @"_id" ] fromJSON:json],
+                          @"{\"a\":{\"b\":\"}\"},\"n\":1,\"list\":[1,{\"c\":2}]}");
+    XCTAssertEqualObjects([self removingKeys:@[ @"a", @"list" ] fromJSON:json],
+                          @"{\"_id\":\"doc\",\"n\":1}");
+    XCTAssertEqualObjects([self removingKeys:@[ @"_id", @"a", @"n", @"list" ] fromJSON:json], @"{}");
+    XCTAssertEqualObjects([self removingKeys:@[ @"missing" ] fromJSON:json], json);
+    // Only top-level keys are removed:
+    XCTAssertEqualObjects([self removingKeys:@[ @"c" ] fromJSON:json], json);
+}
+
+- (void)testRemovingKeysTrimsWhitespaceForAppending
+{
+    NSString *json = [self removingKeys:@[ @"b" ] fromJSON:@" { \"a\" : 1 ,\n \"b\":2 } "];
+    XCTAssertEqualObjects(json, @"{\"a\" : 1}");
+    NSData *appended = [TDJSON appendDictionary:@{ @"c" : @3 }
+                           toJSONDictionaryData:[json dataUsingEncoding:NSUTF8StringEncoding]];
+    XCTAssertEqualObjects([TDJSON JSONObjectWithData:appended options:0 error:nil],
+                          (@{ @"a" : @1, @"c" : @3 }));
+
+    XCTAssertNil([self removingKeys:@[ @"a" ] fromJSON:@"[1,2]"]);
+    XCTAssertNil([self removingKeys:@[ @"a" ] fromJSON:@"{\"a\":1"]);
+}
+
+@end
@@ -139,4 +139,17 @@
     
 }
 
+- (void)testTimeOrderedUUID
+{
+    NSString* previous = TDCreateTimeOrderedUUID();
+    XCTAssertEqual(previous.length, TDCreateUUID().length);
+    XCTAssertNotNil([[NSUUID alloc] initWithUUIDString:previous]);
+    XCTAssertEqual([previous characterAtIndex:14], (unichar)'7');  // version 7
+    for (int i = 0; i < 10000; i++) {
+        NSString* next = TDCreateTimeOrderedUUID();
+        XCTAssertEqual([previous compare:next], NSOrderedAscending, @"%@ !< %@", previous, next);
+        previous = next;
+    }
+}
+
 @end
@@ -140,5 +140,58 @@
 }
 
 
+- (void)testInputStreamReadsFilesDirectly
+{
+    NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSMutableData* fileData = [NSMutableData dataWithLength:300000];
+    for (NSUInteger i = 0; i < fileData.length; i++) ((uint8_t*)fileData.mutableBytes)[i] = (uint8_t)(i * 7);
+    XCTAssertTrue([fileData writeToFile:path atomically:YES]);
+
+    TDMultiStreamWriter* writer = [self createWriter:16];
+    XCTAssertTrue([writer addFile:path]);
+    [writer addData:[self.expectedOutputStringFirstPart dataUsingEncoding:NSUTF8StringEncoding]];
+    NSMutableData* expected = [[self.expectedOutputString dataUsingEncoding:NSUTF8StringEncoding] mutableCopy];
+    [expected appendData:fileData];
+    [expected appendData:[self.expectedOutputStringFirstPart dataUsingEncoding:NSUTF8StringEncoding]];
+    XCTAssertEqual(writer.length, (SInt64)expected.length);
+
+    NSInputStream* input = [writer openForInputStream];
+    // Read it twice, as a retried request would; reopening the stream starts it over.
+    for (int pass = 0; pass < 2; pass++) {
+        [input open];
+        NSMutableData* output = [NSMutableData data];
+        uint8_t buffer[65536];
+        NSInteger n;
+        while ((n = [input read:buffer maxLength:sizeof(buffer)]) > 0) {
+            [output appendBytes:buffer length:n];
+        }
+        XCTAssertEqual(n, 0);
+        XCTAssertEqual(input.streamStatus, NSStreamStatusAtEnd);
+        XCTAssertEqualObjects(output, expected);
+        [input close];
+    }
+    [writer close];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testInputStreamReportsMissingFile
+{
+    TDMultiStreamWriter* writer = [self createWriter:16];
+    NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    XCTAssertTrue([@"x" writeToFile:path atomically:YES encoding:NSUTF8StringEncoding error:nil]);
+    XCTAssertTrue([writer addFile:path]);
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+
+    NSInputStream* input = [writer openForInputStream];
+    [input open];
+    uint8_t buffer[1024];
+    while ([input read:buffer maxLength:sizeof(buffer)] > 0) {
+    }
+    XCTAssertEqual(input.streamStatus, NSStreamStatusError);
+    XCTAssertEqualObjects(writer.error.domain, NSPOSIXErrorDomain);
+    [input close];
+    [writer close];
+}
+
 
 @end
@@ -19,6 +19,7 @@
 #import "TDInternal.h"
 #import "CDTEncryptionKeyNilProvider.h"
 #import "CloudantTests.h"
+#import <OHHTTPStubs/OHHTTPStubs.h>
 
 @interface TDMultipartDownloaderTests : CloudantTests
 
@@ -84,5 +85,61 @@
         [[NSRunLoop currentRunLoop] runMode: NSDefaultRunLoopMode beforeDate: [NSDate dateWithTimeIntervalSinceNow: 0.5]];
 }
 
+- (void)testMultipartResponseIsStreamedIntoAttachmentWriters
+{
+    CDTEncryptionKeyNilProvider *provider = [CDTEncryptionKeyNilProvider provider];
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"TDMultipartStreaming"];
+    TD_Database *db = [TD_Database createEmptyDBAtPath:path withEncryptionKeyProvider:provider];
+
+    NSMutableData *attachment = [NSMutableData dataWithLength:256 * 1024];
+    memset(attachment.mutableBytes, 'x', attachment.length);
+    NSString *json = @"{\"_id\":\"doc\",\"_rev\":\"1-a\",\"_attachments\":{\"big\":{"
+                      "\"content_type\":\"text/plain\",\"follows\":true,\"length\":262144}}}";
+    NSMutableData *body = [NSMutableData data];
+    [body appendData:[@"--BOUNDARY\r\nContent-Type: application/json\r\n\r\n"
+                         dataUsingEncoding:NSUTF8StringEncoding]];
+    [body appendData:[json dataUsingEncoding:NSUTF8StringEncoding]];
+    [body appendData:[@"\r\n--BOUNDARY\r\nContent-Disposition: attachment; filename=\"big\"\r\n\r\n"
+                         dataUsingEncoding:NSUTF8StringEncoding]];
+    [body appendData:attachment];
+    [body appendData:[@"\r\n--BOUNDARY--" dataUsingEncoding:NSUTF8StringEncoding]];
+
+    [OHHTTPStubs stubRequestsPassingTest:^BOOL(NSURLRequest *request) {
+        return YES;
+    }
+        withStubResponse:^OHHTTPStubsResponse *(NSURLRequest *request) {
+            // Sent in small chunks, so the body arrives in many pieces:
+            return [[OHHTTPStubsResponse
+                responseWithData:body
+                      statusCode:200
+                         headers:@{ @"Content-Type" : @"multipart/related; boundary=\"BOUNDARY\"" }]
+                requestTime:0
+               responseTime:OHHTTPStubsDownloadSpeedWifi];
+        }];
+
+    __block BOOL done = NO;
+    __block TDMultipartDownloader *downloaded = nil;
+    NSURL *url = [NSURL URLWithString:@"http://127.0.0.1:5984/db/doc?revs=true&attachments=true"];
+    [[[TDMultipartDownloader alloc] initWithSession:[[CDTURLSession alloc] init]
+                                                URL:url
+                                           database:db
+                                     requestHeaders:nil
+                                       onCompletion:^(id result, NSError *error) {
+                                           XCTAssertNil(error);
+                                           downloaded = result;
+                                           done = YES;
+                                       }] start];
+    while (!done)
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode
+                                 beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+    [OHHTTPStubs removeAllStubs];
+
+    NSDictionary *stub = downloaded.document[@"_attachments"][@"big"];
+    XCTAssertNotNil(stub);
+    TDBlobStoreWriter *writer = [db attachmentWriterForAttachment:stub];
+    XCTAssertNotNil(writer);
+    XCTAssertEqual(writer.length, (UInt64)attachment.length);
+}
+
 
 @end
@@ -113,5 +113,34 @@
 }
 
 
+- (void)testLargePartWithPartialBoundaries
+{
+    // A body full of near misses, so the boundary search keeps having to back off, with its
+    // real boundaries split across chunks at every offset.
+    NSMutableData* body = [NSMutableData data];
+    for (NSUInteger i = 0; i < 20000; i++) {
+        NSString* line = (i % 3 == 0) ? @"\r\n--BOUNDAR" : (i % 3 == 1) ? @"\r\n-" : @"data\r";
+        [body appendData:[line dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    NSMutableData* mime = [NSMutableData data];
+    [mime appendData:[@"--BOUNDARY\r\n\r\n" dataUsingEncoding:NSUTF8StringEncoding]];
+    [mime appendData:body];
+    [mime appendData:[@"\r\n--BOUNDARY\r\n\r\nsmall\r\n--BOUNDARY--"
+                         dataUsingEncoding:NSUTF8StringEncoding]];
+    NSArray* expectedParts = @[ body, [@"small" dataUsingEncoding:NSUTF8StringEncoding] ];
+
+    for (NSUInteger chunkSize = 4000; chunkSize <= 4020; ++chunkSize) {
+        MyMultipartReaderDelegate* delegate = [[MyMultipartReaderDelegate alloc] init];
+        TDMultipartReader* reader = [[TDMultipartReader alloc] initWithContentType: @"multipart/related; boundary=BOUNDARY" delegate: delegate];
+        for (NSUInteger pos = 0; pos < mime.length && !reader.finished; pos += chunkSize) {
+            NSRange r = NSMakeRange(pos, MIN(chunkSize, mime.length - pos));
+            [reader appendData:[mime subdataWithRange:r]];
+            XCTAssertNil(reader.error);
+        }
+        XCTAssertTrue(reader.finished);
+        XCTAssertEqualObjects(delegate.partList, expectedParts);
+    }
+}
+
 @end
 
@@ -0,0 +1,117 @@
+//
+//  TDPushChangeSourceTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+#import "CloudantSyncTests.h"
+#import "CDTEncryptionKeyNilProvider.h"
+#import "TD_Body.h"
+#import "TD_Database.h"
+#import "TD_Database+Insertion.h"
+#import "TD_Revision.h"
+#import "TDPushChangeSource.h"
+
+@interface TDPushChangeSourceTests : CloudantSyncTests
+
+@property (strong, nonatomic) TD_Database *db;
+
+@end
+
+@implementation TDPushChangeSourceTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    NSString *path = [[self createTemporaryDirectoryAndReturnPath]
+        stringByAppendingPathComponent:@"TDPushChangeSourceTests.touchdb"];
+    self.db = [TD_Database createEmptyDBAtPath:path
+                     withEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]];
+    XCTAssertNotNil(self.db);
+}
+
+- (void)tearDown
+{
+    [self.db deleteDatabase:nil];
+    self.db = nil;
+
+    [super tearDown];
+}
+
+- (TD_Revision *)putDocWithID:(NSString *)docID
+{
+    TD_Revision *rev = [[TD_Revision alloc] initWithDocID:docID revID:nil deleted:NO];
+    rev.body = [[TD_Body alloc] initWithProperties:@{ @"_id" : docID, @"n" : @1 }];
+    TDStatus status;
+    TD_Revision *saved =
+        [self.db putRevision:rev prevRevisionID:nil allowConflict:NO status:&status];
+    XCTAssertEqual(status, kTDStatusCreated);
+    return saved;
+}
+
+- (void)testChangesAreSharedUntilTheDatabaseChanges
+{
+    [self putDocWithID:@"a"];
+    TD_Revision *b = [self putDocWithID:@"b"];
+    TDPushChangeSource *source = [[TDPushChangeSource alloc] initWithDatabase:self.db pusherCount:2];
+
+    TD_RevisionList *first = [source changesSinceSequence:0];
+    XCTAssertEqual(first.count, (NSUInteger)2);
+    // A pusher further along gets only what's after its checkpoint, as copies
+    TD_RevisionList *second = [source changesSinceSequence:b.sequence - 1];
+    XCTAssertEqualObjects(second.allDocIDs, @[ @"b" ]);
+    XCTAssertNotEqual(second[0], [first revWithDocID:@"b" revID:b.revID]);
+
+    [source changesSinceSequence:0];
+    [self putDocWithID:@"c"];
+    XCTAssertEqual([source changesSinceSequence:0].count, (NSUInteger)3);
+}
+
+- (void)testBodiesAreLoadedOnceForAllPushers
+{
+    TD_Revision *a = [self putDocWithID:@"a"];
+    TD_Revision *b = [self putDocWithID:@"b"];
+    TDPushChangeSource *source = [[TDPushChangeSource alloc] initWithDatabase:self.db pusherCount:2];
+
+    NSArray *revs = [source changesSinceSequence:0].allRevisions;
+    NSArray *statuses = [source loadRevisionBodies:revs options:kTDIncludeRevs];
+    XCTAssertEqualObjects(statuses, (@[ @(kTDStatusOK), @(kTDStatusOK) ]));
+    XCTAssertEqualObjects([revs[0] properties][@"n"], @1);
+
+    // The other pusher only needs one of them
+    TD_Revision *other = [[TD_Revision alloc] initWithDocID:@"b" revID:b.revID deleted:NO];
+    other.sequence = b.sequence;
+    XCTAssertEqualObjects([source loadRevisionBodies:@[ other ] options:kTDIncludeRevs],
+                          @[ @(kTDStatusOK) ]);
+    XCTAssertEqualObjects(other.properties[@"_id"], @"b");
+    XCTAssertNotNil(other.properties[@"_revisions"]);
+    XCTAssertEqual(source.revisionsLoaded, (NSUInteger)3);
+    XCTAssertEqual(source.revisionsShared, (NSUInteger)1);
+
+    // Each body is only kept until every other pusher has had it
+    other = [[TD_Revision alloc] initWithDocID:@"b" revID:b.revID deleted:NO];
+    other.sequence = b.sequence;
+    [source loadRevisionBodies:@[ other ] options:kTDIncludeRevs];
+    XCTAssertEqual(source.revisionsShared, (NSUInteger)1);
+    XCTAssertEqualObjects(other.properties[@"_id"], @"b");
+
+    // Bodies loaded differently aren't shared
+    other = [[TD_Revision alloc] initWithDocID:@"a" revID:a.revID deleted:NO];
+    other.sequence = a.sequence;
+    [source loadRevisionBodies:@[ other ] options:0];
+    XCTAssertEqual(source.revisionsShared, (NSUInteger)1);
+    XCTAssertNil(other.properties[@"_revisions"]);
+}
+
+@end
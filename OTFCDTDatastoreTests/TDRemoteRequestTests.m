@@ -0,0 +1,121 @@
+//
+//  TDRemoteRequestTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import "TDRemoteRequest.h"
+#import "CDTURLSession.h"
+#import <GoogleToolboxForMac/GTMNSData+zlib.h>
+#import <OHHTTPStubs/OHHTTPStubs.h>
+#import <OHHTTPStubs/NSURLRequest+HTTPBodyTesting.h>
+
+@interface TDRemoteRequestTests : XCTestCase
+@end
+
+@implementation TDRemoteRequestTests
+
+- (void)tearDown
+{
+    [OHHTTPStubs removeAllStubs];
+    [super tearDown];
+}
+
+- (NSDictionary *)largeBody
+{
+    NSMutableArray *docs = [NSMutableArray array];
+    for (int i = 0; i < 200; i++) {
+        [docs addObject:@{ @"_id" : [NSString stringWithFormat:@"doc%d", i], @"_rev" : @"1-abc" }];
+    }
+    return @{ @"docs" : docs, @"new_edits" : @NO };
+}
+
+/** Sends a JSON POST of body, returning the requests the server saw. */
+- (NSArray<NSURLRequest *> *)sendBody:(id)body
+                             compress:(BOOL)compress
+                       rejectEncoding:(BOOL)reject
+                              request:(TDRemoteRequest *__autoreleasing *)sent
+{
+    NSMutableArray<NSURLRequest *> *seen = [NSMutableArray array];
+    [OHHTTPStubs stubRequestsPassingTest:^BOOL(NSURLRequest *request) {
+        return YES;
+    }
+        withStubResponse:^OHHTTPStubsResponse *(NSURLRequest *request) {
+            @synchronized(seen) { [seen addObject:request]; }
+            BOOL gzipped = [[request valueForHTTPHeaderField:@"Content-Encoding"] isEqualToString:@"gzip"];
+            return [OHHTTPStubsResponse responseWithData:[@"[]" dataUsingEncoding:NSUTF8StringEncoding]
+                                              statusCode:(reject && gzipped) ? 415 : 201
+                                                 headers:@{ @"Content-Type" : @"application/json" }];
+        }];
+
+    __block BOOL done = NO;
+    NSURL *url = [NSURL URLWithString:@"http://127.0.0.1:5984/db/_bulk_docs"];
+    TDRemoteRequest *request =
+        [[TDRemoteJSONRequest alloc] initWithSession:[[CDTURLSession alloc] init]
+                                              method:@"POST"
+                                                 URL:url
+                                                body:body
+                                      requestHeaders:nil
+                                        onCompletion:^(id result, NSError *error) {
+                                            XCTAssertNil(error);
+                                            done = YES;
+                                        }];
+    request.compressBody = compress;
+    [request start];
+    while (!done)
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode
+                                 beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+    *sent = request;
+    return seen;
+}
+
+- (void)testCompressedBodyIsGzipped
+{
+    TDRemoteRequest *request;
+    NSArray<NSURLRequest *> *seen =
+        [self sendBody:[self largeBody] compress:YES rejectEncoding:NO request:&request];
+
+    XCTAssertEqual(seen.count, (NSUInteger)1);
+    XCTAssertEqualObjects([seen[0] valueForHTTPHeaderField:@"Content-Encoding"], @"gzip");
+    NSData *inflated = [NSData gtm_dataByInflatingData:seen[0].OHHTTPStubs_HTTPBody error:nil];
+    NSDictionary *received = [NSJSONSerialization JSONObjectWithData:inflated options:0 error:nil];
+    XCTAssertEqualObjects(received, [self largeBody]);
+    XCTAssertLessThan(seen[0].OHHTTPStubs_HTTPBody.length, inflated.length);
+    XCTAssertFalse(request.compressionRejected);
+}
+
+- (void)testSmallBodyIsNotCompressed
+{
+    TDRemoteRequest *request;
+    NSArray<NSURLRequest *> *seen =
+        [self sendBody:@{ @"docs" : @[] } compress:YES rejectEncoding:NO request:&request];
+
+    XCTAssertEqual(seen.count, (NSUInteger)1);
+    XCTAssertNil([seen[0] valueForHTTPHeaderField:@"Content-Encoding"]);
+}
+
+- (void)testRefusedCompressedBodyIsSentUncompressed
+{
+    TDRemoteRequest *request;
+    NSArray<NSURLRequest *> *seen =
+        [self sendBody:[self largeBody] compress:YES rejectEncoding:YES request:&request];
+
+    XCTAssertEqual(seen.count, (NSUInteger)2);
+    XCTAssertEqualObjects([seen[0] valueForHTTPHeaderField:@"Content-Encoding"], @"gzip");
+    XCTAssertNil([seen[1] valueForHTTPHeaderField:@"Content-Encoding"]);
+    NSDictionary *received =
+        [NSJSONSerialization JSONObjectWithData:seen[1].OHHTTPStubs_HTTPBody options:0 error:nil];
+    XCTAssertEqualObjects(received, [self largeBody]);
+    XCTAssertTrue(request.compressionRejected);
+}
+
+@end
@@ -0,0 +1,96 @@
+//
+//  TDReplicationTraceTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import "CloudantSyncTests.h"
+#import "TDReplicationTrace.h"
+
+@interface TDReplicationTraceTests : CloudantSyncTests
+@property (nonatomic, strong) NSURL *url;
+@end
+
+@implementation TDReplicationTraceTests
+
+- (void)setUp
+{
+    [super setUp];
+    NSString *directory = [self createTemporaryDirectoryAndReturnPath];
+    self.url = [NSURL fileURLWithPath:[directory stringByAppendingPathComponent:@"trace.jsonl"]];
+}
+
+- (NSArray<NSDictionary *> *)events
+{
+    NSString *contents = [NSString stringWithContentsOfURL:self.url
+                                                  encoding:NSUTF8StringEncoding
+                                                     error:nil];
+    NSMutableArray *events = [NSMutableArray array];
+    for (NSString *line in [contents componentsSeparatedByString:@"\n"]) {
+        if (line.length == 0) continue;
+        NSDictionary *event =
+            [NSJSONSerialization JSONObjectWithData:[line dataUsingEncoding:NSUTF8StringEncoding]
+                                            options:0
+                                              error:nil];
+        XCTAssertNotNil(event, @"%@", line);
+        if (event) [events addObject:event];
+    }
+    return events;
+}
+
+- (void)testEventsAreAppendedOnePerLine
+{
+    NSError *error;
+    TDReplicationTrace *trace = [[TDReplicationTrace alloc] initWithURL:self.url error:&error];
+    XCTAssertNotNil(trace, @"%@", error);
+    [trace recordEvent:@"request" fields:@{ @"endpoint" : @"_revs_diff", @"ms" : @12 }];
+    [trace recordEvent:@"insert" fields:@{ @"revs" : @5 }];
+    [trace flush];
+
+    NSArray<NSDictionary *> *events = self.events;
+    XCTAssertEqual(events.count, (NSUInteger)3);
+    XCTAssertEqualObjects(events[0][@"e"], @"open");
+    XCTAssertNotNil(events[0][@"date"]);
+    XCTAssertEqualObjects(events[1][@"e"], @"request");
+    XCTAssertEqualObjects(events[1][@"endpoint"], @"_revs_diff");
+    XCTAssertEqualObjects(events[2][@"revs"], @5);
+    XCTAssertGreaterThanOrEqual([events[2][@"t"] doubleValue], [events[1][@"t"] doubleValue]);
+    [trace close];
+
+    // A second trace carries on after the first.
+    trace = [[TDReplicationTrace alloc] initWithURL:self.url error:&error];
+    [trace recordEvent:@"start" fields:nil];
+    [trace close];
+    events = self.events;
+    XCTAssertEqual(events.count, (NSUInteger)5);
+    XCTAssertEqualObjects(events[3][@"e"], @"open");
+    XCTAssertEqualObjects(events[4][@"e"], @"start");
+}
+
+- (void)testStopsAtMaximumFileSize
+{
+    TDReplicationTrace *trace = [[TDReplicationTrace alloc] initWithURL:self.url error:nil];
+    trace.maximumFileSize = 1000;
+    for (int i = 0; i < 100; i++) {
+        [trace recordEvent:@"changes" fields:@{ @"changes" : @(i) }];
+    }
+    [trace close];
+
+    NSArray<NSDictionary *> *events = self.events;
+    XCTAssertLessThan(events.count, (NSUInteger)100);
+    XCTAssertEqualObjects(events.lastObject[@"e"], @"truncated");
+    NSDictionary *attributes =
+        [[NSFileManager defaultManager] attributesOfItemAtPath:self.url.path error:nil];
+    XCTAssertLessThanOrEqual(attributes.fileSize, (unsigned long long)1000);
+}
+
+@end
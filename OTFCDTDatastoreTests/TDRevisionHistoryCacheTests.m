@@ -0,0 +1,107 @@
+//
+//  TDRevisionHistoryCacheTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "TDRevisionHistoryCache.h"
+#import "TD_Revision.h"
+
+@interface TDRevisionHistoryCacheTests : XCTestCase
+
+@end
+
+@implementation TDRevisionHistoryCacheTests
+
+- (TD_Revision *)revWithDocID:(NSString *)docID revID:(NSString *)revID
+{
+    return [[TD_Revision alloc] initWithDocID:docID revID:revID deleted:NO];
+}
+
+/** A linear history of the given length, newest revision first. */
+- (NSArray<TD_Revision *> *)historyOfDocID:(NSString *)docID length:(int)length
+{
+    NSMutableArray *history = [NSMutableArray array];
+    for (int generation = length; generation > 0; generation--) {
+        TD_Revision *rev =
+            [self revWithDocID:docID revID:[NSString stringWithFormat:@"%d-abc", generation]];
+        rev.sequence = generation;
+        rev.missing = generation < length;
+        [history addObject:rev];
+    }
+    return history;
+}
+
+- (void)testHistoryAnswersForAncestors
+{
+    TDRevisionHistoryCache *cache = [[TDRevisionHistoryCache alloc] initWithCapacity:10];
+    NSArray *history = [self historyOfDocID:@"doc" length:3];
+    [cache setHistory:history ofRevision:history[0] generation:cache.generation];
+
+    NSArray *cached = [cache historyOfRevision:[self revWithDocID:@"doc" revID:@"2-abc"]];
+    XCTAssertEqual(cached.count, 2);
+    XCTAssertEqualObjects([cached[0] revID], @"2-abc");
+    XCTAssertEqualObjects([cached[1] revID], @"1-abc");
+    XCTAssertEqual([cached[1] sequence], 1);
+    XCTAssertTrue([cached[1] missing]);
+
+    XCTAssertNil([cache historyOfRevision:[self revWithDocID:@"doc" revID:@"4-abc"]]);
+    XCTAssertNil([cache historyOfRevision:[self revWithDocID:@"other" revID:@"2-abc"]]);
+}
+
+- (void)testCachedRevisionsAreCopies
+{
+    TDRevisionHistoryCache *cache = [[TDRevisionHistoryCache alloc] initWithCapacity:10];
+    NSArray *history = [self historyOfDocID:@"doc" length:2];
+    [cache setHistory:history ofRevision:history[0] generation:cache.generation];
+    [history[0] setSequence:99];
+
+    TD_Revision *rev = [self revWithDocID:@"doc" revID:@"2-abc"];
+    NSArray *cached = [cache historyOfRevision:rev];
+    XCTAssertEqual([cached[0] sequence], 2);
+    [cached[0] setMissing:YES];
+    XCTAssertFalse([[cache historyOfRevision:rev][0] missing]);
+}
+
+- (void)testHistoryReadBeforeRemovalIsNotStored
+{
+    TDRevisionHistoryCache *cache = [[TDRevisionHistoryCache alloc] initWithCapacity:10];
+    NSArray *history = [self historyOfDocID:@"doc" length:2];
+    NSUInteger generation = cache.generation;
+    [cache removeDocumentID:@"doc"];
+    [cache setHistory:history ofRevision:history[0] generation:generation];
+    XCTAssertNil([cache historyOfRevision:history[0]]);
+
+    [cache setHistory:history ofRevision:history[0] generation:cache.generation];
+    XCTAssertNotNil([cache historyOfRevision:history[0]]);
+    [cache removeAllDocuments];
+    XCTAssertNil([cache historyOfRevision:history[0]]);
+}
+
+- (void)testLeastRecentlyUsedDocumentIsDropped
+{
+    TDRevisionHistoryCache *cache = [[TDRevisionHistoryCache alloc] initWithCapacity:2];
+    NSArray *a = [self historyOfDocID:@"a" length:1];
+    NSArray *b = [self historyOfDocID:@"b" length:1];
+    NSArray *c = [self historyOfDocID:@"c" length:1];
+    [cache setHistory:a ofRevision:a[0] generation:cache.generation];
+    [cache setHistory:b ofRevision:b[0] generation:cache.generation];
+    XCTAssertNotNil([cache historyOfRevision:a[0]]);  // now b is the least recently used
+
+    [cache setHistory:c ofRevision:c[0] generation:cache.generation];
+    XCTAssertNotNil([cache historyOfRevision:a[0]]);
+    XCTAssertNil([cache historyOfRevision:b[0]]);
+    XCTAssertNotNil([cache historyOfRevision:c[0]]);
+}
+
+@end
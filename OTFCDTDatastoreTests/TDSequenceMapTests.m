@@ -73,4 +73,58 @@
 }
 
 
+- (void)testSequenceMapGrowsPastItsInitialCapacity
+{
+    TDSequenceMap *map = [[TDSequenceMap alloc] init];
+    for (NSUInteger i = 1; i <= 1000; i++) {
+        XCTAssertEqual([map addValue:@(i)], (SequenceNumber)i);
+    }
+
+    // Remove all but the first, from the end, and the checkpoint can't move.
+    for (SequenceNumber seq = 1000; seq > 1; seq--) {
+        [map removeSequence:seq];
+    }
+    XCTAssertEqual(map.checkpointedSequence, (SequenceNumber)0);
+    XCTAssertFalse(map.isEmpty);
+    XCTAssertEqual(map.pendingCount, (NSUInteger)1);
+
+    [map removeSequence:1];
+    XCTAssertEqual(map.checkpointedSequence, (SequenceNumber)1000);
+    XCTAssertEqualObjects(map.checkpointedValue, @1000);
+    XCTAssertTrue(map.isEmpty);
+    XCTAssertEqual(map.pendingCount, (NSUInteger)0);
+
+    // The ring wraps around as the window moves along.
+    for (NSUInteger i = 1001; i <= 1500; i++) {
+        SequenceNumber seq = [map addValue:@(i)];
+        if (seq > 1011) {
+            [map removeSequence:seq - 10];
+        }
+    }
+    XCTAssertEqual(map.checkpointedSequence, (SequenceNumber)1000);
+    [map removeSequence:1001];
+    XCTAssertEqual(map.checkpointedSequence, (SequenceNumber)1490);
+    XCTAssertEqualObjects(map.checkpointedValue, @1490);
+}
+
+- (void)testRemovedValuesAfterCheckpoint
+{
+    TDSequenceMap *map = [[TDSequenceMap alloc] init];
+    // Two revisions of change "b", as for a change with conflicts.
+    for (NSString *value in @[ @"a", @"b", @"b", @"c", @"d" ]) {
+        [map addValue:value];
+    }
+    [map removeSequence:2];
+    [map removeSequence:4];
+    [map removeSequence:5];
+    XCTAssertEqualObjects([map removedValuesAfterCheckpoint], (@[ @"c", @"d" ]));
+
+    [map removeSequence:1];
+    XCTAssertEqual(map.checkpointedSequence, (SequenceNumber)2);
+    XCTAssertEqualObjects([map removedValuesAfterCheckpoint], (@[ @"c", @"d" ]));
+
+    [map removeSequence:3];
+    XCTAssertEqualObjects([map removedValuesAfterCheckpoint], (@[]));
+}
+
 @end
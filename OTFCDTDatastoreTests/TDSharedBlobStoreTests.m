@@ -0,0 +1,131 @@
+//
+//  TDSharedBlobStoreTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "TDBase64.h"
+#import "TDMisc.h"
+#import "TDSharedBlobStore.h"
+
+@interface TDSharedBlobStoreTests : XCTestCase
+
+@property (strong, nonatomic) NSString *dir;
+@property (strong, nonatomic) TDSharedBlobStore *store;
+
+@end
+
+@implementation TDSharedBlobStoreTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.dir = [NSTemporaryDirectory() stringByAppendingPathComponent:TDCreateUUID()];
+    [[NSFileManager defaultManager] createDirectoryAtPath:self.dir
+                              withIntermediateDirectories:NO
+                                               attributes:nil
+                                                    error:nil];
+    self.store = [[TDSharedBlobStore alloc]
+        initWithPath:[self.dir stringByAppendingPathComponent:@"shared attachments"]
+               error:nil];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtPath:self.dir error:nil];
+    [super tearDown];
+}
+
+- (NSString *)writeBlob:(NSData *)data named:(NSString *)name key:(TDBlobKey *)outKey
+{
+    NSString *path = [self.dir stringByAppendingPathComponent:name];
+    [data writeToFile:path atomically:NO];
+    CC_SHA1(data.bytes, (CC_LONG)data.length, outKey->bytes);
+    return path;
+}
+
+- (NSString *)MD5DigestOfData:(NSData *)data
+{
+    uint8_t md5[CC_MD5_DIGEST_LENGTH];
+    CC_MD5(data.bytes, (CC_LONG)data.length, md5);
+    return [@"md5-" stringByAppendingString:[TDBase64 encode:md5 length:sizeof(md5)]];
+}
+
+- (NSUInteger)linkCountAtPath:(NSString *)path
+{
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path error:nil];
+    return [attributes[NSFileReferenceCount] unsignedIntegerValue];
+}
+
+- (void)testCopiesOfABlobAreLinkedTogether
+{
+    NSData *data = [@"the same large PDF" dataUsingEncoding:NSUTF8StringEncoding];
+    TDBlobKey key;
+    NSString *first = [self writeBlob:data named:@"first" key:&key];
+    NSString *second = [self writeBlob:data named:@"second" key:&key];
+
+    [self.store addBlobAtPath:first withKey:key MD5Digest:nil];
+    XCTAssertEqual([self linkCountAtPath:first], (NSUInteger)2);
+
+    [self.store addBlobAtPath:second withKey:key MD5Digest:nil];
+    XCTAssertEqual([self linkCountAtPath:first], (NSUInteger)3);
+    XCTAssertEqual([self linkCountAtPath:second], (NSUInteger)3);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:second], data);
+}
+
+- (void)testBlobsAreFoundByEitherDigest
+{
+    NSData *data = [@"attachment" dataUsingEncoding:NSUTF8StringEncoding];
+    TDBlobKey key;
+    NSString *path = [self writeBlob:data named:@"blob" key:&key];
+    NSString *md5Digest = [self MD5DigestOfData:data];
+    NSString *sha1Digest =
+        [@"sha1-" stringByAppendingString:[TDBase64 encode:key.bytes length:sizeof(key.bytes)]];
+
+    TDBlobKey foundKey;
+    XCTAssertFalse([self.store getKey:&foundKey forDigest:md5Digest]);
+    XCTAssertFalse([self.store getKey:&foundKey forDigest:sha1Digest]);
+
+    [self.store addBlobAtPath:path withKey:key MD5Digest:md5Digest];
+    XCTAssertTrue([self.store getKey:&foundKey forDigest:md5Digest]);
+    XCTAssertEqual(memcmp(foundKey.bytes, key.bytes, sizeof(key.bytes)), 0);
+    XCTAssertTrue([self.store getKey:&foundKey forDigest:sha1Digest]);
+    XCTAssertEqual(memcmp(foundKey.bytes, key.bytes, sizeof(key.bytes)), 0);
+
+    UInt64 length = 0;
+    NSString *linkPath = [self.dir stringByAppendingPathComponent:@"link"];
+    XCTAssertTrue([self.store linkBlobWithKey:key toPath:linkPath length:&length]);
+    XCTAssertEqual(length, (UInt64)data.length);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:linkPath], data);
+}
+
+- (void)testUnreferencedBlobsAreDeleted
+{
+    NSData *data = [@"attachment" dataUsingEncoding:NSUTF8StringEncoding];
+    TDBlobKey key;
+    NSString *first = [self writeBlob:data named:@"first" key:&key];
+    NSString *second = [self writeBlob:data named:@"second" key:&key];
+    NSString *md5Digest = [self MD5DigestOfData:data];
+    [self.store addBlobAtPath:first withKey:key MD5Digest:md5Digest];
+    [self.store addBlobAtPath:second withKey:key MD5Digest:md5Digest];
+
+    [[NSFileManager defaultManager] removeItemAtPath:first error:nil];
+    XCTAssertEqual([self.store deleteUnreferencedBlobs], (NSUInteger)0);
+    XCTAssertTrue([self.store getKey:NULL forDigest:md5Digest]);
+
+    [[NSFileManager defaultManager] removeItemAtPath:second error:nil];
+    XCTAssertEqual([self.store deleteUnreferencedBlobs], (NSUInteger)1);
+    XCTAssertFalse([self.store getKey:NULL forDigest:md5Digest]);
+}
+
+@end
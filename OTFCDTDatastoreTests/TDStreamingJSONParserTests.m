@@ -0,0 +1,128 @@
+//
+//  TDStreamingJSONParserTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import "TDJSON.h"
+#import "TDStreamingJSONParser.h"
+
+@interface TDStreamingJSONParserTests : XCTestCase
+
+@property (strong, nonatomic) NSMutableArray *elements;
+@property (strong, nonatomic) TDStreamingJSONParser *parser;
+
+@end
+
+@implementation TDStreamingJSONParserTests
+
+- (void)setUp
+{
+    [super setUp];
+    NSMutableArray *elements = [NSMutableArray array];
+    self.elements = elements;
+    self.parser = [[TDStreamingJSONParser alloc] initWithArrayKey:@"results"
+                                                        onElement:^(id element) {
+                                                            [elements addObject:element];
+                                                        }];
+}
+
+- (BOOL)parseString:(NSString *)json inChunksOf:(NSUInteger)chunkSize
+{
+    NSData *data = [json dataUsingEncoding:NSUTF8StringEncoding];
+    for (NSUInteger i = 0; i < data.length; i += chunkSize) {
+        NSRange range = NSMakeRange(i, MIN(chunkSize, data.length - i));
+        if (![self.parser parseData:[data subdataWithRange:range]]) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+- (void)testChangesFeedInEveryChunkSize
+{
+    NSDictionary *feed = @{
+        @"pending" : @0,
+        @"results" : @[
+            @{ @"seq" : @"1-a", @"id" : @"a\"]}", @"changes" : @[ @{ @"rev" : @"1-x" } ] },
+            @{ @"seq" : @"2-b", @"id" : @"b", @"deleted" : @YES, @"changes" : @[] },
+            @3,
+            @"four",
+            @[ @5, @[ @6 ] ],
+            [NSNull null]
+        ],
+        @"last_seq" : @"2-b"
+    };
+    NSString *json = [TDJSON stringWithJSONObject:feed options:0 error:nil];
+
+    for (NSUInteger chunkSize = 1; chunkSize <= 16; chunkSize++) {
+        [self setUp];
+        XCTAssertTrue([self parseString:json inChunksOf:chunkSize]);
+        XCTAssertTrue(self.parser.finished);
+        XCTAssertTrue(self.parser.foundArray);
+        XCTAssertEqualObjects(self.elements, feed[@"results"], @"chunk size %lu",
+                              (unsigned long)chunkSize);
+        XCTAssertEqual(self.parser.elementCount, (NSUInteger)6);
+    }
+}
+
+- (void)testElementsAreReportedAsTheyArrive
+{
+    XCTAssertTrue([self parseString:@"{\"results\":[{\"id\":\"a\"},{\"id\":" inChunksOf:1024]);
+    XCTAssertEqualObjects(self.elements, @[ @{ @"id" : @"a" } ]);
+    XCTAssertFalse(self.parser.finished);
+
+    XCTAssertTrue([self parseString:@"\"b\"}]}" inChunksOf:1024]);
+    XCTAssertEqual(self.elements.count, (NSUInteger)2);
+    XCTAssertTrue(self.parser.finished);
+}
+
+- (void)testOtherArraysAreSkipped
+{
+    XCTAssertTrue([self parseString:@" { \"other\" : [1, 2], \"nested\": {\"results\": [3]}, "
+                                    @"\"results\" : [ 4 , 5 ] } "
+                         inChunksOf:3]);
+    XCTAssertEqualObjects(self.elements, (@[ @4, @5 ]));
+    XCTAssertTrue(self.parser.finished);
+}
+
+- (void)testEmptyArray
+{
+    XCTAssertTrue([self parseString:@"{\"results\":[],\"last_seq\":0}" inChunksOf:4]);
+    XCTAssertTrue(self.parser.finished);
+    XCTAssertTrue(self.parser.foundArray);
+    XCTAssertEqual(self.elements.count, (NSUInteger)0);
+}
+
+- (void)testTruncatedResponseIsNotFinished
+{
+    XCTAssertTrue([self parseString:@"{\"results\":[{\"id\":\"a\"},{\"id\":\"b" inChunksOf:5]);
+    XCTAssertFalse(self.parser.finished);
+    XCTAssertTrue(self.parser.foundArray);
+    XCTAssertEqual(self.elements.count, (NSUInteger)1);
+    XCTAssertNil(self.parser.errorMessage);
+}
+
+- (void)testInvalidResponses
+{
+    XCTAssertFalse([self parseString:@"<html>" inChunksOf:64]);
+    XCTAssertNotNil(self.parser.errorMessage);
+    XCTAssertFalse(self.parser.foundArray);
+
+    [self setUp];
+    XCTAssertFalse([self parseString:@"{\"results\":[{\"id\" \"a\"}]}" inChunksOf:64]);
+    XCTAssertNotNil(self.parser.errorMessage);
+    XCTAssertFalse([self.parser parseData:[@"{}" dataUsingEncoding:NSUTF8StringEncoding]]);
+}
+
+@end
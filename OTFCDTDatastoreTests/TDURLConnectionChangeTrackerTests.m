@@ -0,0 +1,134 @@
+//
+//  TDURLConnectionChangeTrackerTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import "TDURLConnectionChangeTracker.h"
+#import "CDTURLSession.h"
+#import <OHHTTPStubs/OHHTTPStubs.h>
+
+@interface ChangeCollectingClient : NSObject <TDChangeTrackerClient>
+@property (nonatomic, strong) NSMutableArray *changes;
+@property (nonatomic) BOOL stopped;
+@end
+
+@implementation ChangeCollectingClient
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _changes = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void)changeTrackerReceivedChanges:(NSArray *)changes { [self.changes addObjectsFromArray:changes]; }
+
+- (void)changeTrackerStopped:(TDChangeTracker *)tracker { self.stopped = YES; }
+
+@end
+
+@interface TDURLConnectionChangeTrackerTests : XCTestCase
+@end
+
+@implementation TDURLConnectionChangeTrackerTests
+
+- (void)tearDown
+{
+    [OHHTTPStubs removeAllStubs];
+    [super tearDown];
+}
+
+- (TDChangeTracker *)trackerWithClient:(ChangeCollectingClient *)client
+{
+    CDTURLSession *session = [[CDTURLSession alloc] initWithCallbackThread:[NSThread currentThread]
+                                                       requestInterceptors:@[]
+                                                     sessionConfigDelegate:nil];
+    return [[TDURLConnectionChangeTracker alloc]
+        initWithDatabaseURL:[NSURL URLWithString:@"http://127.0.0.1:5984/db"]
+                       mode:kContinuous
+                  conflicts:YES
+               lastSequence:nil
+                     client:client
+                    session:session];
+}
+
+- (void)spinUntil:(BOOL (^)(void))condition
+{
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:10];
+    while (!condition() && [deadline timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode
+                                 beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+}
+
+- (void)testContinuousFeedHasNoLimit
+{
+    TDChangeTracker *tracker = [self trackerWithClient:[[ChangeCollectingClient alloc] init]];
+    tracker.limit = 100;
+    XCTAssertTrue([tracker.changesFeedPath containsString:@"feed=continuous"]);
+    XCTAssertFalse([tracker.changesFeedPath containsString:@"limit="]);
+}
+
+- (void)testContinuousFeedIsReadLineByLineAndReconnects
+{
+    NSMutableArray<NSURL *> *requested = [NSMutableArray array];
+    [OHHTTPStubs stubRequestsPassingTest:^BOOL(NSURLRequest *request) {
+        return [request.URL.path hasSuffix:@"/_changes"];
+    }
+        withStubResponse:^OHHTTPStubsResponse *(NSURLRequest *request) {
+            NSUInteger count;
+            @synchronized(requested)
+            {
+                [requested addObject:request.URL];
+                count = requested.count;
+            }
+            // Changes split over heartbeats, then the feed closing; after that, an idle feed.
+            NSString *body = count == 1 ? @"{\"seq\":\"1-a\",\"id\":\"doc1\",\"changes\":[{\"rev\":\"1-x\"}]}\n"
+                                           "\n"
+                                           "{\"seq\":\"2-b\",\"id\":\"doc2\",\"changes\":[{\"rev\":\"1-y\"}]}\n"
+                                           "{\"last_seq\":\"2-b\"}\n"
+                                        : @"\n\n";
+            return [OHHTTPStubsResponse responseWithData:[body dataUsingEncoding:NSUTF8StringEncoding]
+                                              statusCode:200
+                                                 headers:@{ @"Content-Type" : @"application/json" }];
+        }];
+
+    ChangeCollectingClient *client = [[ChangeCollectingClient alloc] init];
+    TDChangeTracker *tracker = [self trackerWithClient:client];
+    XCTAssertTrue([tracker start]);
+    [self spinUntil:^BOOL {
+        @synchronized(requested) { return requested.count >= 2; }
+    }];
+
+    XCTAssertEqual(client.changes.count, (NSUInteger)2);
+    XCTAssertEqualObjects(tracker.lastSequenceID, @"2-b");
+    XCTAssertFalse(client.stopped);
+    @synchronized(requested)
+    {
+        XCTAssertGreaterThanOrEqual(requested.count, (NSUInteger)2);
+        XCTAssertTrue([requested[1].query containsString:@"since=2-b"]);
+    }
+
+    // The idle feed is reconnected to only after a delay.
+    NSDate *later = [NSDate dateWithTimeIntervalSinceNow:0.5];
+    [self spinUntil:^BOOL {
+        return [later timeIntervalSinceNow] < 0;
+    }];
+    @synchronized(requested) { XCTAssertEqual(requested.count, (NSUInteger)2); }
+    [tracker stop];
+    XCTAssertTrue(client.stopped);
+}
+
+@end
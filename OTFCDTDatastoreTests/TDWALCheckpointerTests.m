@@ -0,0 +1,98 @@
+//
+//  TDWALCheckpointerTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import "CloudantSyncTests.h"
+#import "CDTDatastore.h"
+#import "CDTDocumentRevision.h"
+#import "TD_Database.h"
+#import "TD_Database+Statistics.h"
+#import "TDInternal.h"
+#import "TDWALCheckpointer.h"
+
+@interface TDWALCheckpointerTests : CloudantSyncTests
+@property (nonatomic, strong) CDTDatastore *datastore;
+@end
+
+@implementation TDWALCheckpointerTests
+
+- (void)setUp
+{
+    [super setUp];
+    NSError *error;
+    self.datastore = [self.factory datastoreNamed:@"checkpoints" error:&error];
+    XCTAssertNotNil(self.datastore, @"datastore is nil");
+}
+
+- (void)tearDown
+{
+    self.datastore = nil;
+    [super tearDown];
+}
+
+- (void)createDocuments:(NSUInteger)count
+{
+    for (NSUInteger i = 0; i < count; i++) {
+        CDTDocumentRevision *rev = [CDTDocumentRevision revision];
+        rev.body = [@{ @"index" : @(i) } mutableCopy];
+        NSError *error;
+        XCTAssertNotNil([self.datastore createDocumentFromRevision:rev error:&error]);
+    }
+}
+
+/** Polls, as checkpoints run in the background. */
+- (BOOL)waitFor:(BOOL (^)(void))condition
+{
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5];
+    while (!condition()) {
+        if ([deadline timeIntervalSinceNow] < 0) return NO;
+        [NSThread sleepForTimeInterval:0.02];
+    }
+    return YES;
+}
+
+- (void)testCheckpointsOnceIdle
+{
+    TDWALCheckpointer *checkpointer = self.datastore.database.walCheckpointer;
+    XCTAssertNotNil(checkpointer);
+    checkpointer.idleDelay = 0.2;
+    NSUInteger before = checkpointer.checkpointCount;
+
+    [self createDocuments:10];
+    XCTAssertTrue([self waitFor:^BOOL {
+        return checkpointer.checkpointCount > before;
+    }]);
+
+    // A burst of writes only gets one checkpoint, after the last of them.
+    [NSThread sleepForTimeInterval:0.5];
+    XCTAssertEqual(checkpointer.checkpointCount, before + 1);
+}
+
+- (void)testTruncateEmptiesTheLog
+{
+    TD_Database *db = self.datastore.database;
+    db.walCheckpointer.idleDelay = 0;
+    [self createDocuments:100];
+    XCTAssertGreaterThan(db.walFileSize, (UInt64)0);
+
+    [db.walCheckpointer truncate];
+    XCTAssertTrue([self waitFor:^BOOL {
+        return db.walFileSize == 0;
+    }]);
+
+    // The data is all still there.
+    XCTAssertEqual(self.datastore.documentCount, (NSUInteger)100);
+}
+
+@end
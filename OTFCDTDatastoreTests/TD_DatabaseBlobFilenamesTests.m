@@ -11,6 +11,8 @@
 #import <FMDB/FMDB.h>
 
 #import "TD_Database+BlobFilenames.h"
+#import "TDBlobStore+Internal.h"
+#import "TDInternal.h"
 
 #import "CDTEncryptionKeyNilProvider.h"
 
@@ -146,7 +148,22 @@
       dbVersion = [db intForQuery:@"PRAGMA user_version"];
     }];
 
-    XCTAssertEqual(dbVersion, 200, @"Database version should be 101");
+    XCTAssertEqual(dbVersion, 215, @"Database version should be 215");
+}
+
+- (void)testWinningRevisionLookupIsCoveredByIndex
+{
+    __block NSString *plan = @"";
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+        FMResultSet *r = [db executeQuery:@"EXPLAIN QUERY PLAN SELECT revid, deleted FROM revs "
+                                           "WHERE doc_id=? and current=1 "
+                                           "ORDER BY deleted asc, revid desc LIMIT 1", @1];
+        while ([r next]) {
+            plan = [plan stringByAppendingString:[r stringForColumn:@"detail"]];
+        }
+        [r close];
+    }];
+    XCTAssertTrue([plan containsString:@"COVERING INDEX revs_winner"], @"Plan: %@", plan);
 }
 
 - (void)testReopenSucceedsAfterUpdatingDBVersion
@@ -194,6 +211,203 @@
         @"No new filename should be generated if there is already a row with the same key");
 }
 
+- (void)testOnlyUnusedFilenamesAreMarkedForDeletion
+{
+    NSString *filename =
+        [@"unusedFilename" stringByAppendingPathExtension:TDDatabaseBlobFilenamesFileExtension];
+
+    __block BOOL marked = NO;
+    __block NSUInteger remainingRows = 0;
+    __block NSArray *pending = nil;
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+      NSData *data = dataFromHexadecimalString(TDDATABASEBLOBFILENAMESTESTS_SHA1DIGEST_03);
+
+      TDBlobKey key;
+      [data getBytes:key.bytes length:CC_SHA1_DIGEST_LENGTH];
+
+      [TD_Database insertFilename:filename withKey:key intoBlobFilenamesTableInDatabase:db];
+
+      marked = [TD_Database markUnusedBlobFilenamesForDeletionInDatabase:db];
+      remainingRows = [TD_Database countRowsInBlobFilenamesTableInDatabase:db];
+      pending = [TD_Database pendingDeleteBlobFilenamesWithLimit:10 inDatabase:db];
+    }];
+
+    XCTAssertTrue(marked);
+    XCTAssertEqual(remainingRows, (NSUInteger)TDDATABASEBLOBFILENAMESTESTS_NUMBER_OF_ATTACHMENTS,
+                   @"Filenames of keys still in use should be kept");
+    XCTAssertEqualObjects(pending, @[ filename ]);
+
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+      [TD_Database deletePendingDeleteBlobFilenames:pending inDatabase:db];
+      pending = [TD_Database pendingDeleteBlobFilenamesWithLimit:10 inDatabase:db];
+    }];
+
+    XCTAssertEqual(pending.count, (NSUInteger)0);
+}
+
+- (void)testUnusedInlineBlobsAreDeletedWithoutMarkingAFile
+{
+    NSData *data = dataFromHexadecimalString(TDDATABASEBLOBFILENAMESTESTS_SHA1DIGEST_03);
+    TDBlobKey key;
+    [data getBytes:key.bytes length:CC_SHA1_DIGEST_LENGTH];
+
+    __block NSString *filename = nil;
+    __block NSData *inlineData = nil;
+    __block NSUInteger remainingRows = 0;
+    __block NSArray *pending = nil;
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+      filename = [TD_Database generateAndInsertInlineFilenameBasedOnKey:key
+                                                                   data:data
+                                       intoBlobFilenamesTableInDatabase:db];
+      inlineData = [TD_Database inlineDataForKey:key inBlobInlineTableInDatabase:db];
+
+      [TD_Database markUnusedBlobFilenamesForDeletionInDatabase:db];
+      remainingRows = [TD_Database countRowsInBlobFilenamesTableInDatabase:db];
+      pending = [TD_Database pendingDeleteBlobFilenamesWithLimit:10 inDatabase:db];
+    }];
+
+    XCTAssertTrue([TD_Database isInlineBlobFilename:filename]);
+    XCTAssertEqualObjects(inlineData, data);
+    XCTAssertEqual(remainingRows, (NSUInteger)TDDATABASEBLOBFILENAMESTESTS_NUMBER_OF_ATTACHMENTS);
+    XCTAssertEqual(pending.count, (NSUInteger)0, @"An inline blob has no file to delete");
+
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+      inlineData = [TD_Database inlineDataForKey:key inBlobInlineTableInDatabase:db];
+    }];
+    XCTAssertNil(inlineData);
+}
+
+- (void)testBlobsBelowTheInlineThresholdAreStoredInTheDatabase
+{
+    self.db.inlineAttachmentThreshold = 16;
+
+    NSData *small = [@"small" dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *large = [@"large enough for a file" dataUsingEncoding:NSUTF8StringEncoding];
+    TDBlobKey smallKey, largeKey;
+    XCTAssertTrue([self.db storeBlob:small creatingKey:&smallKey]);
+    XCTAssertTrue([self.db storeBlob:large creatingKey:&largeKey]);
+
+    __block NSString *smallFilename = nil;
+    __block NSString *largeFilename = nil;
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+      smallFilename = [TD_Database filenameForKey:smallKey inBlobFilenamesTableInDatabase:db];
+      largeFilename = [TD_Database filenameForKey:largeKey inBlobFilenamesTableInDatabase:db];
+    }];
+    XCTAssertTrue([TD_Database isInlineBlobFilename:smallFilename]);
+    XCTAssertFalse([TD_Database isInlineBlobFilename:largeFilename]);
+
+    id<CDTBlobReader> reader = [self.db blobForKey:smallKey];
+    XCTAssertEqualObjects([reader dataWithError:nil], small);
+    XCTAssertEqualObjects([reader dataInRange:NSMakeRange(2, 10) error:nil],
+                          [@"all" dataUsingEncoding:NSUTF8StringEncoding]);
+    UInt64 length = 0;
+    XCTAssertNotNil([reader inputStreamWithOutputLength:&length]);
+    XCTAssertEqual(length, (UInt64)small.length);
+    XCTAssertEqualObjects([[self.db blobForKey:largeKey] dataWithError:nil], large);
+
+    // Written through a TDBlobStoreWriter, as pulled attachments are
+    NSData *pulled = [@"pulled" dataUsingEncoding:NSUTF8StringEncoding];
+    TDBlobStoreWriter *writer = [[TDBlobStoreWriter alloc] initWithStore:self.db.attachmentStore];
+    [writer appendData:pulled];
+    [writer finish];
+    NSString *tempPath = writer.tempPath;
+    __block BOOL installed = NO;
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+      installed = [writer installWithDatabase:db];
+    }];
+    XCTAssertTrue(installed);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:tempPath]);
+    XCTAssertEqualObjects([[self.db blobForKey:writer.blobKey] dataWithError:nil], pulled);
+}
+
+- (void)testShardedBlobFilenameIsInTwoLevelsOfSubdirectories
+{
+    XCTAssertEqualObjects([TD_Database shardedBlobFilename:@"3ff2989b.blob"], @"3f/f2/3ff2989b.blob");
+    XCTAssertEqualObjects([TD_Database shardedBlobFilename:@"3f/f2/3ff2989b.blob"],
+                          @"3f/f2/3ff2989b.blob");
+    XCTAssertEqualObjects([TD_Database shardedBlobFilename:@"3ff2989b.inline"], @"3ff2989b.inline");
+}
+
+- (void)testBlobFilesAreMovedToTheShardedLayout
+{
+    NSData *flat = [@"written before sharding" dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *sharded = [@"written after sharding" dataUsingEncoding:NSUTF8StringEncoding];
+    TDBlobKey flatKey, shardedKey;
+    XCTAssertTrue([self.db storeBlob:flat creatingKey:&flatKey]);
+    self.db.shardsAttachmentFiles = YES;
+    XCTAssertTrue([self.db storeBlob:sharded creatingKey:&shardedKey]);
+
+    __block NSString *flatFilename = nil;
+    __block NSString *shardedFilename = nil;
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+      flatFilename = [TD_Database filenameForKey:flatKey inBlobFilenamesTableInDatabase:db];
+      shardedFilename = [TD_Database filenameForKey:shardedKey inBlobFilenamesTableInDatabase:db];
+    }];
+    XCTAssertEqual(flatFilename.pathComponents.count, (NSUInteger)1);
+    XCTAssertEqualObjects(shardedFilename, [TD_Database shardedBlobFilename:shardedFilename.lastPathComponent]);
+    XCTAssertEqualObjects([[self.db blobForKey:shardedKey] dataWithError:nil], sharded);
+
+    NSError *error = nil;
+    XCTAssertTrue([self.db moveBlobFilesToShardedLayoutWithError:&error], @"%@", error);
+
+    __block NSString *movedFilename = nil;
+    __block NSArray *unsharded = nil;
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+      movedFilename = [TD_Database filenameForKey:flatKey inBlobFilenamesTableInDatabase:db];
+      unsharded = [TD_Database unshardedRowsInBlobFilenamesTableWithLimit:10 inDatabase:db];
+    }];
+    XCTAssertEqualObjects(movedFilename, [TD_Database shardedBlobFilename:flatFilename]);
+    XCTAssertEqual(unsharded.count, (NSUInteger)0);
+    XCTAssertEqualObjects([[self.db blobForKey:flatKey] dataWithError:nil], flat);
+}
+
+- (void)testFilenamesForKeysLeavesOutUnknownKeys
+{
+    NSData *oneKey = dataFromHexadecimalString(TDDATABASEBLOBFILENAMESTESTS_SHA1DIGEST_01);
+    NSData *otherKey = dataFromHexadecimalString(TDDATABASEBLOBFILENAMESTESTS_SHA1DIGEST_02);
+    NSData *unknownKey = dataFromHexadecimalString(TDDATABASEBLOBFILENAMESTESTS_SHA1DIGEST_03);
+
+    __block NSDictionary *filenames = nil;
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+      filenames = [TD_Database filenamesForKeys:@[ oneKey, unknownKey, otherKey ]
+                 inBlobFilenamesTableInDatabase:db];
+    }];
+
+    NSDictionary *expected = @{
+        oneKey : [TDDATABASEBLOBFILENAMESTESTS_SHA1DIGEST_01
+            stringByAppendingPathExtension:TDDatabaseBlobFilenamesFileExtension],
+        otherKey : [TDDATABASEBLOBFILENAMESTESTS_SHA1DIGEST_02
+            stringByAppendingPathExtension:TDDatabaseBlobFilenamesFileExtension]
+    };
+    XCTAssertEqualObjects(filenames, expected);
+}
+
+- (void)testFilenameCacheIgnoresFilenamesReadBeforeItWasEmptied
+{
+    NSData *key = dataFromHexadecimalString(TDDATABASEBLOBFILENAMESTESTS_SHA1DIGEST_01);
+    TDBlobFilenameCache *cache = [[TDBlobFilenameCache alloc] initWithCountLimit:10];
+
+    NSUInteger generation = cache.generation;
+    [cache removeAllFilenames];
+    [cache setFilenames:@{key : @"stale.blob"} generation:generation];
+    XCTAssertNil([cache filenameForKey:key]);
+
+    [cache setFilenames:@{key : @"fresh.blob"} generation:cache.generation];
+    XCTAssertEqualObjects([cache filenameForKey:key], @"fresh.blob");
+
+    // Rows read within a transaction may yet be rolled back
+    __block NSUInteger autocommitGeneration = 0;
+    __block NSUInteger transactionGeneration = 0;
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+      autocommitGeneration = [cache generationForDatabase:db];
+      [db beginTransaction];
+      transactionGeneration = [cache generationForDatabase:db];
+      [db rollback];
+    }];
+    XCTAssertEqual(autocommitGeneration, cache.generation);
+    XCTAssertEqual(transactionGeneration, (NSUInteger)NSNotFound);
+}
+
 - (void)testInsertFailsIfFilenameIsAlreadyInTheTable
 {
     NSString *filename =
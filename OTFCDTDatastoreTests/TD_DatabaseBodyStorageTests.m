@@ -0,0 +1,238 @@
+//
+//  TD_DatabaseBodyStorageTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+#import <FMDB/FMDB.h>
+
+#import "CloudantSyncTests.h"
+#import "CDTEncryptionKeyNilProvider.h"
+#import "TD_Body.h"
+#import "TD_Database.h"
+#import "TD_Database+Archive.h"
+#import "TD_Database+Insertion.h"
+#import "TDBodyDelta.h"
+
+@interface TD_DatabaseBodyStorageTests : CloudantSyncTests
+
+@property (strong, nonatomic) TD_Database *db;
+
+@end
+
+@implementation TD_DatabaseBodyStorageTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    NSString *path = [[self createTemporaryDirectoryAndReturnPath]
+        stringByAppendingPathComponent:@"TD_DatabaseBodyStorageTests.touchdb"];
+    self.db = [TD_Database createEmptyDBAtPath:path
+                     withEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]];
+    XCTAssertNotNil(self.db);
+    self.db.outOfLineBodyThreshold = 1024;
+}
+
+- (void)tearDown
+{
+    [self.db deleteDatabase:nil];
+    self.db = nil;
+
+    [super tearDown];
+}
+
+- (TD_Revision *)putDocWithID:(NSString *)docID
+                         text:(NSString *)text
+               prevRevisionID:(NSString *)prevRevID
+{
+    return [self putDocWithID:docID text:text prevRevisionID:prevRevID allowConflict:NO];
+}
+
+- (TD_Revision *)putDocWithID:(NSString *)docID
+                         text:(NSString *)text
+               prevRevisionID:(NSString *)prevRevID
+                allowConflict:(BOOL)allowConflict
+{
+    TD_Revision *rev = [[TD_Revision alloc] initWithDocID:docID revID:nil deleted:NO];
+    rev.body = [[TD_Body alloc] initWithProperties:@{ @"_id" : docID, @"text" : text }];
+    TDStatus status;
+    TD_Revision *saved = [self.db putRevision:rev
+                               prevRevisionID:prevRevID
+                                allowConflict:allowConflict
+                                       status:&status];
+    XCTAssertFalse(TDStatusIsError(status));
+    return saved;
+}
+
+- (int)countOfBodiesStoredOutOfLine
+{
+    __block int count = 0;
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+        count = [db intForQuery:@"SELECT COUNT(*) FROM bodies"];
+    }];
+    return count;
+}
+
+- (void)testLargeBodiesAreStoredOutOfLineAndReadBack
+{
+    NSString *large = [@"" stringByPaddingToLength:4096 withString:@"abc" startingAtIndex:0];
+    TD_Revision *first = [self putDocWithID:@"large" text:large prevRevisionID:nil];
+    [self putDocWithID:@"small" text:@"hello" prevRevisionID:nil];
+    XCTAssertEqual([self countOfBodiesStoredOutOfLine], 1);
+
+    TDStatus status;
+    TD_Revision *read =
+        [self.db getDocumentWithID:@"large" revisionID:nil options:0 status:&status];
+    XCTAssertEqualObjects(read[@"text"], large);
+    XCTAssertEqualObjects([self.db getDocumentWithID:@"small" revisionID:nil options:0
+                                              status:&status][@"text"],
+                          @"hello");
+
+    // Compaction drops the old revision's body, wherever it was kept
+    TD_Revision *second = [self putDocWithID:@"large" text:large prevRevisionID:first.revID];
+    XCTAssertEqual([self countOfBodiesStoredOutOfLine], 2);
+    XCTAssertEqual([self.db compact], kTDStatusOK);
+    XCTAssertEqual([self countOfBodiesStoredOutOfLine], 1);
+    read = [self.db getDocumentWithID:@"large" revisionID:second.revID options:0 status:&status];
+    XCTAssertEqualObjects(read[@"text"], large);
+
+    // And purging drops the rest
+    NSDictionary *result;
+    XCTAssertEqual([self.db purgeRevisions:@{ @"large" : @[ @"*" ] } result:&result],
+                   kTDStatusOK);
+    XCTAssertEqual([self countOfBodiesStoredOutOfLine], 0);
+}
+
+- (NSData *)storedJSONOfSequence:(SequenceNumber)sequence
+{
+    __block NSData *json;
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+        json = [db dataForQuery:@"SELECT json FROM revs WHERE sequence=?", @(sequence)];
+    }];
+    return json;
+}
+
+- (void)testHistoryIsStoredAsDeltasAndRebuilt
+{
+    self.db.storesHistoryAsDeltas = YES;
+    NSString *text = [@"" stringByPaddingToLength:4096 withString:@"abcdefg" startingAtIndex:0];
+    NSString *edited = [text stringByAppendingString:@" edited"];
+    TD_Revision *first = [self putDocWithID:@"doc" text:text prevRevisionID:nil];
+    TD_Revision *second = [self putDocWithID:@"doc" text:edited prevRevisionID:first.revID];
+    TD_Revision *third =
+        [self putDocWithID:@"doc" text:[edited stringByAppendingString:@" again"]
+            prevRevisionID:second.revID];
+
+    // Each replaced revision is a delta of the next, and is rebuilt through the chain
+    XCTAssertTrue([TDBodyDelta isDelta:[self storedJSONOfSequence:first.sequence]]);
+    XCTAssertTrue([TDBodyDelta isDelta:[self storedJSONOfSequence:second.sequence]]);
+    XCTAssertFalse([TDBodyDelta isDelta:[self storedJSONOfSequence:third.sequence]]);
+    XCTAssertLessThan([self storedJSONOfSequence:first.sequence].length, (NSUInteger)100);
+    TDStatus status;
+    XCTAssertEqualObjects([self.db getDocumentWithID:@"doc" revisionID:first.revID options:0
+                                              status:&status][@"text"],
+                          text);
+    XCTAssertEqualObjects([self.db getDocumentWithID:@"doc" revisionID:second.revID options:0
+                                              status:&status][@"text"],
+                          edited);
+}
+
+- (void)testPurgingTheBaseOfADeltaKeepsItsBody
+{
+    self.db.storesHistoryAsDeltas = YES;
+    NSString *text = [@"" stringByPaddingToLength:4096 withString:@"abcdefg" startingAtIndex:0];
+    TD_Revision *first = [self putDocWithID:@"doc" text:text prevRevisionID:nil];
+    TD_Revision *second =
+        [self putDocWithID:@"doc" text:[text stringByAppendingString:@"a"] prevRevisionID:first.revID];
+    [self putDocWithID:@"doc"
+                  text:[text stringByAppendingString:@"b"]
+        prevRevisionID:first.revID
+         allowConflict:YES];
+    XCTAssertTrue([TDBodyDelta isDelta:[self storedJSONOfSequence:first.sequence]]);
+
+    // The first revision stays, as the conflicting leaf's parent, but its delta's base goes
+    NSDictionary *result;
+    XCTAssertEqual([self.db purgeRevisions:@{ @"doc" : @[ second.revID ] } result:&result],
+                   kTDStatusOK);
+    XCTAssertEqualObjects(result[@"doc"], @[ second.revID ]);
+    XCTAssertFalse([TDBodyDelta isDelta:[self storedJSONOfSequence:first.sequence]]);
+    TDStatus status;
+    XCTAssertEqualObjects([self.db getDocumentWithID:@"doc" revisionID:first.revID options:0
+                                              status:&status][@"text"],
+                          text);
+}
+
+- (int)countOfArchivedBodies
+{
+    __block int count = 0;
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+        count = [db intForQuery:@"SELECT COUNT(*) FROM archive.bodies"];
+    }];
+    return count;
+}
+
+- (void)testArchivedBodiesAreReadBackFromTheArchive
+{
+    NSString *large = [@"old " stringByPaddingToLength:4096 withString:@"abc" startingAtIndex:0];
+    [self putDocWithID:@"large" text:large prevRevisionID:nil];
+    TD_Revision *old = [self putDocWithID:@"old" text:@"old news" prevRevisionID:nil];
+    [self putDocWithID:@"new" text:@"new news" prevRevisionID:nil];
+    XCTAssertFalse(self.db.hasArchive);
+
+    BOOL (^isOld)(TD_Revision *) = ^BOOL(TD_Revision *rev) {
+        return [rev[@"text"] hasPrefix:@"old"];
+    };
+    NSArray *archived;
+    NSError *error;
+    XCTAssertTrue([self.db archiveDocumentsPassingTest:isOld
+                                   archivedDocumentIDs:&archived
+                                                 error:&error],
+                  @"%@", error);
+    XCTAssertEqualObjects([NSSet setWithArray:archived],
+                          ([NSSet setWithObjects:@"large", @"old", nil]));
+    XCTAssertTrue(self.db.hasArchive);
+    XCTAssertEqual([self countOfArchivedBodies], 2);
+    // Only the marker is left behind, and the out-of-line copy is dropped
+    XCTAssertEqual([self storedJSONOfSequence:old.sequence].length, (NSUInteger)1);
+    XCTAssertEqual([self countOfBodiesStoredOutOfLine], 0);
+
+    // Archived bodies are read as before, once the database is reopened too
+    [self.db close];
+    XCTAssertTrue([self.db openWithEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]]);
+    TDStatus status;
+    XCTAssertEqualObjects([self.db getDocumentWithID:@"large" revisionID:nil options:0
+                                              status:&status][@"text"],
+                          large);
+    XCTAssertEqualObjects([self.db getDocumentWithID:@"old" revisionID:old.revID options:0
+                                              status:&status][@"text"],
+                          @"old news");
+
+    // Only the update of an archived document is looked at again
+    [self putDocWithID:@"old" text:@"old news, updated" prevRevisionID:old.revID];
+    XCTAssertTrue(
+        [self.db archiveDocumentsPassingTest:isOld archivedDocumentIDs:&archived error:NULL]);
+    XCTAssertEqualObjects(archived, @[ @"old" ]);
+    XCTAssertEqual([self countOfArchivedBodies], 3);
+
+    // The bodies of purged documents are swept out of the archive the next time round
+    NSDictionary *result;
+    XCTAssertEqual([self.db purgeRevisions:@{ @"large" : @[ @"*" ] } result:&result],
+                   kTDStatusOK);
+    XCTAssertTrue(
+        [self.db archiveDocumentsPassingTest:isOld archivedDocumentIDs:&archived error:NULL]);
+    XCTAssertEqualObjects(archived, @[]);
+    XCTAssertEqual([self countOfArchivedBodies], 2);
+}
+
+@end
@@ -0,0 +1,121 @@
+//
+//  TD_DatabaseExpiryTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+#import "CloudantSyncTests.h"
+#import "CDTEncryptionKeyNilProvider.h"
+#import "TD_Body.h"
+#import "TD_Database.h"
+#import "TD_Database+Expiry.h"
+#import "TD_Database+Insertion.h"
+
+@interface TD_DatabaseExpiryTests : CloudantSyncTests
+
+@property (strong, nonatomic) TD_Database *db;
+
+@end
+
+@implementation TD_DatabaseExpiryTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    NSString *path = [[self createTemporaryDirectoryAndReturnPath]
+        stringByAppendingPathComponent:@"TD_DatabaseExpiryTests.touchdb"];
+    self.db = [TD_Database createEmptyDBAtPath:path
+                     withEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]];
+    XCTAssertNotNil(self.db);
+}
+
+- (void)tearDown
+{
+    [self.db deleteDatabase:nil];
+    self.db = nil;
+
+    [super tearDown];
+}
+
+- (TD_Revision *)putDocWithID:(NSString *)docID prevRevisionID:(NSString *)prevRevID
+{
+    TD_Revision *rev = [[TD_Revision alloc] initWithDocID:docID revID:nil deleted:NO];
+    rev.body = [[TD_Body alloc] initWithProperties:@{ @"_id" : docID, @"hello" : @"world" }];
+    TDStatus status;
+    TD_Revision *saved =
+        [self.db putRevision:rev prevRevisionID:prevRevID allowConflict:NO status:&status];
+    XCTAssertFalse(TDStatusIsError(status));
+    return saved;
+}
+
+- (void)testExpiredDocumentsArePurgedWithoutTombstones
+{
+    TD_Revision *expired = [self putDocWithID:@"expired" prevRevisionID:nil];
+    [self putDocWithID:@"later" prevRevisionID:nil];
+    [self putDocWithID:@"forever" prevRevisionID:nil];
+    NSDate *past = [NSDate dateWithTimeIntervalSinceNow:-60];
+    XCTAssertEqual([self.db setExpiryDate:past forDocumentID:@"expired"], kTDStatusOK);
+    XCTAssertEqual([self.db setExpiryDate:[NSDate distantFuture] forDocumentID:@"later"],
+                   kTDStatusOK);
+    // The expiry stays with the document as it's updated
+    [self putDocWithID:@"expired" prevRevisionID:expired.revID];
+    XCTAssertEqualWithAccuracy([self.db expiryDateOfDocumentID:@"expired"].timeIntervalSince1970,
+                               past.timeIntervalSince1970, 0.001);
+    XCTAssertNil([self.db expiryDateOfDocumentID:@"forever"]);
+    SequenceNumber lastSequence = self.db.lastSequence;
+
+    NSArray *purged;
+    BOOL finished;
+    XCTAssertEqual([self.db purgeDocumentsExpiredBefore:[NSDate date]
+                                             timeBudget:10
+                                      purgedDocumentIDs:&purged
+                                               finished:&finished],
+                   kTDStatusOK);
+    XCTAssertEqualObjects(purged, @[ @"expired" ]);
+    XCTAssertTrue(finished);
+
+    TDStatus status;
+    XCTAssertNil([self.db getDocumentWithID:@"expired" revisionID:nil options:0 status:&status]);
+    XCTAssertEqual(status, kTDStatusNotFound);
+    XCTAssertNil([self.db expiryDateOfDocumentID:@"expired"]);
+    XCTAssertNotNil([self.db getDocumentWithID:@"later" revisionID:nil options:0 status:&status]);
+    XCTAssertNotNil([self.db getDocumentWithID:@"forever" revisionID:nil options:0 status:&status]);
+    // Nothing was written that would replicate
+    XCTAssertEqual(self.db.lastSequence, lastSequence);
+}
+
+- (void)testClearedExpiryKeepsDocument
+{
+    [self putDocWithID:@"kept" prevRevisionID:nil];
+    XCTAssertEqual([self.db setExpiryDate:[NSDate distantPast] forDocumentID:@"kept"], kTDStatusOK);
+    XCTAssertEqual([self.db setExpiryDate:nil forDocumentID:@"kept"], kTDStatusOK);
+
+    NSArray *purged;
+    XCTAssertEqual([self.db purgeDocumentsExpiredBefore:[NSDate date]
+                                             timeBudget:10
+                                      purgedDocumentIDs:&purged
+                                               finished:NULL],
+                   kTDStatusOK);
+    XCTAssertEqual(purged.count, (NSUInteger)0);
+    TDStatus status;
+    XCTAssertNotNil([self.db getDocumentWithID:@"kept" revisionID:nil options:0 status:&status]);
+}
+
+- (void)testMissingDocumentHasNoExpiry
+{
+    XCTAssertEqual([self.db setExpiryDate:[NSDate date] forDocumentID:@"missing"],
+                   kTDStatusNotFound);
+}
+
+@end
@@ -0,0 +1,157 @@
+//
+//  TD_DatabaseLocalDocsTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+#import "CloudantSyncTests.h"
+#import "CDTDatastore.h"
+#import "TD_Database.h"
+#import "TD_Database+LocalDocs.h"
+#import "TD_Revision.h"
+#import "TDInternal.h"
+
+#import <fmdb/FMDatabase.h>
+#import <fmdb/FMDatabaseQueue.h>
+
+@interface TD_DatabaseLocalDocsTests : CloudantSyncTests
+@property (nonatomic, strong) CDTDatastore *datastore;
+@end
+
+@implementation TD_DatabaseLocalDocsTests
+
+- (void)setUp
+{
+    [super setUp];
+    NSError *error;
+    self.datastore = [self.factory datastoreNamed:@"localdocs" error:&error];
+    XCTAssertNotNil(self.datastore, @"datastore is nil");
+}
+
+- (void)tearDown
+{
+    self.datastore = nil;
+    [super tearDown];
+}
+
+- (TD_Revision *)revisionWithID:(NSString *)docID revID:(NSString *)revID body:(NSDictionary *)body
+{
+    NSMutableDictionary *properties = [body mutableCopy];
+    properties[@"_id"] = docID;
+    if (revID) properties[@"_rev"] = revID;
+    return [[TD_Revision alloc] initWithProperties:properties];
+}
+
+/** The revision IDs in the localdocs table, bypassing the cache. */
+- (NSDictionary *)storedRevIDs
+{
+    NSMutableDictionary *revIDs = [NSMutableDictionary dictionary];
+    [self.datastore.database.fmdbQueue inDatabase:^(FMDatabase *db) {
+        FMResultSet *r = [db executeQuery:@"SELECT docid, revid FROM localdocs"];
+        while ([r next]) {
+            revIDs[[r stringForColumnIndex:0]] = [r stringForColumnIndex:1];
+        }
+        [r close];
+    }];
+    return revIDs;
+}
+
+- (void)testPutGetAndConflict
+{
+    TD_Database *db = self.datastore.database;
+    TDStatus status;
+    TD_Revision *rev = [db putLocalRevision:[self revisionWithID:@"_local/a" revID:nil body:@{ @"n" : @1 }]
+                             prevRevisionID:nil
+                                     status:&status];
+    XCTAssertEqual(status, kTDStatusCreated);
+    XCTAssertEqualObjects(rev.revID, @"1-local");
+
+    TD_Revision *got = [db getLocalDocumentWithID:@"_local/a" revisionID:nil];
+    XCTAssertEqualObjects(got[@"n"], @1);
+    XCTAssertEqualObjects(got.revID, @"1-local");
+
+    // Creating it again, or updating from the wrong revision, conflicts.
+    XCTAssertNil([db putLocalRevision:[self revisionWithID:@"_local/a" revID:nil body:@{}]
+                       prevRevisionID:nil
+                               status:&status]);
+    XCTAssertEqual(status, kTDStatusConflict);
+    XCTAssertNil([db putLocalRevision:[self revisionWithID:@"_local/a" revID:nil body:@{}]
+                       prevRevisionID:@"2-local"
+                               status:&status]);
+    XCTAssertEqual(status, kTDStatusConflict);
+
+    rev = [db putLocalRevision:[self revisionWithID:@"_local/a" revID:nil body:@{ @"n" : @2 }]
+                prevRevisionID:@"1-local"
+                        status:&status];
+    XCTAssertEqualObjects(rev.revID, @"2-local");
+    XCTAssertEqual([db deleteLocalDocumentWithID:@"_local/a" revisionID:@"1-local"],
+                   kTDStatusConflict);
+    XCTAssertEqual([db deleteLocalDocumentWithID:@"_local/a" revisionID:@"2-local"], kTDStatusOK);
+    XCTAssertNil([db getLocalDocumentWithID:@"_local/a" revisionID:nil]);
+    XCTAssertEqual([db deleteLocalDocumentWithID:@"_local/a" revisionID:@"2-local"],
+                   kTDStatusNotFound);
+}
+
+- (void)testBatchIsAllOrNothing
+{
+    TD_Database *db = self.datastore.database;
+    TDStatus status;
+    NSArray *revs = @[
+        [self revisionWithID:@"_local/a" revID:nil body:@{}],
+        [self revisionWithID:@"_local/b" revID:nil body:@{}]
+    ];
+    XCTAssertEqual([db putLocalRevisions:revs status:&status].count, (NSUInteger)2);
+    XCTAssertEqual(status, kTDStatusCreated);
+
+    // The second conflicts, so the first isn't saved either.
+    revs = @[
+        [self revisionWithID:@"_local/a" revID:@"1-local" body:@{ @"n" : @1 }],
+        [self revisionWithID:@"_local/b" revID:@"2-local" body:@{ @"n" : @1 }]
+    ];
+    XCTAssertNil([db putLocalRevisions:revs status:&status]);
+    XCTAssertEqual(status, kTDStatusConflict);
+    XCTAssertEqualObjects([db getLocalDocumentWithID:@"_local/a" revisionID:nil].revID, @"1-local");
+}
+
+- (void)testWritesAreFlushedTogether
+{
+    TD_Database *db = self.datastore.database;
+    db.localDocumentFlushDelay = 60;
+    TDStatus status;
+    NSString *revID = nil;
+    for (int i = 0; i < 10; i++) {
+        revID = [db putLocalRevision:[self revisionWithID:@"_local/a" revID:nil body:@{ @"n" : @(i) }]
+                      prevRevisionID:revID
+                              status:&status]
+                    .revID;
+    }
+    XCTAssertEqualObjects(revID, @"10-local");
+    XCTAssertEqualObjects([db getLocalDocumentWithID:@"_local/a" revisionID:nil][@"n"], @9);
+    XCTAssertNil([self storedRevIDs][@"_local/a"]);
+
+    XCTAssertEqual([db flushLocalDocuments], kTDStatusOK);
+    XCTAssertEqualObjects([self storedRevIDs][@"_local/a"], @"10-local");
+}
+
+- (void)testWritesThroughWithoutDelay
+{
+    TD_Database *db = self.datastore.database;
+    db.localDocumentFlushDelay = 0;
+    TDStatus status;
+    [db putLocalRevision:[self revisionWithID:@"_local/a" revID:nil body:@{}]
+          prevRevisionID:nil
+                  status:&status];
+    XCTAssertEqual(status, kTDStatusCreated);
+    XCTAssertEqualObjects([self storedRevIDs][@"_local/a"], @"1-local");
+}
+
+@end
@@ -0,0 +1,148 @@
+//
+//  TD_DatabaseMultiProcessTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+
+#import <Foundation/Foundation.h>
+
+#import "CloudantSyncTests.h"
+#import "CDTEncryptionKeyNilProvider.h"
+#import "TD_Body.h"
+#import "TD_Database.h"
+#import "TD_Database+Insertion.h"
+#import "TD_Database+LocalDocs.h"
+
+/** Two databases opened on the same file stand in for an app and its extension: each has its own
+    connections, and Darwin notifications reach the process that posts them. */
+@interface TD_DatabaseMultiProcessTests : CloudantSyncTests
+
+@property (strong, nonatomic) TD_Database *app;
+@property (strong, nonatomic) TD_Database *extension;
+
+@end
+
+@implementation TD_DatabaseMultiProcessTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    NSString *path = [[self createTemporaryDirectoryAndReturnPath]
+        stringByAppendingPathComponent:@"TD_DatabaseMultiProcessTests.touchdb"];
+    self.app = [TD_Database createEmptyDBAtPath:path
+                      withEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]];
+    XCTAssertNotNil(self.app);
+    [self.app close];
+    self.app.multiProcess = YES;
+    XCTAssertTrue([self.app openWithEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]]);
+
+    self.extension = [[TD_Database alloc] initWithPath:path];
+    self.extension.multiProcess = YES;
+    XCTAssertTrue(
+        [self.extension openWithEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]]);
+}
+
+- (void)tearDown
+{
+    [self.extension close];
+    self.extension = nil;
+    [self.app deleteDatabase:nil];
+    self.app = nil;
+
+    [super tearDown];
+}
+
+- (TD_Revision *)putDocWithID:(NSString *)docID into:(TD_Database *)db
+{
+    TD_Revision *rev = [[TD_Revision alloc] initWithDocID:docID revID:nil deleted:NO];
+    rev.body = [[TD_Body alloc] initWithProperties:@{ @"_id" : docID, @"hello" : @"world" }];
+    TDStatus status;
+    TD_Revision *saved = [db putRevision:rev prevRevisionID:nil allowConflict:NO status:&status];
+    XCTAssertEqual(status, kTDStatusCreated);
+    return saved;
+}
+
+- (void)testWaitsLongerForOtherProcesses
+{
+    XCTAssertEqual(self.app.busyTimeout, 10.0);
+    XCTAssertEqual([[TD_Database alloc] initWithPath:@"/tmp/single"].busyTimeout, 2.0);
+}
+
+- (void)testChangesReachTheOtherProcess
+{
+    __block NSArray *revs = nil;
+    [self expectationForNotification:TD_DatabaseChangeNotification
+                              object:self.extension
+                             handler:^BOOL(NSNotification *n) {
+                                 revs = n.userInfo[@"revs"];
+                                 return YES;
+                             }];
+    TD_Revision *saved = [self putDocWithID:@"doc1" into:self.app];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertEqual(revs.count, (NSUInteger)1);
+    XCTAssertEqualObjects([revs.firstObject docID], @"doc1");
+    XCTAssertEqualObjects([revs.firstObject revID], saved.revID);
+    XCTAssertEqual([revs.firstObject sequence], saved.sequence);
+}
+
+- (void)testOwnChangesAreNotReportedAgain
+{
+    __block NSUInteger appNotifications = 0;
+    id observer = [[NSNotificationCenter defaultCenter]
+        addObserverForName:TD_DatabaseChangeNotification
+                    object:self.app
+                     queue:nil
+                usingBlock:^(NSNotification *n) {
+                    @synchronized(self) { appNotifications++; }
+                }];
+    [self expectationForNotification:TD_DatabaseChangeNotification
+                              object:self.extension
+                             handler:nil];
+    [self putDocWithID:@"doc1" into:self.app];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    // Give the app time to hear its own broadcast too.
+    [NSThread sleepForTimeInterval:0.5];
+    [[NSNotificationCenter defaultCenter] removeObserver:observer];
+    @synchronized(self) { XCTAssertEqual(appNotifications, (NSUInteger)1); }
+}
+
+- (void)testLocalDocumentsAreNotCachedStale
+{
+    TDStatus status;
+    TD_Revision *doc = [[TD_Revision alloc] initWithDocID:@"_local/shared" revID:nil deleted:NO];
+    doc.body = [[TD_Body alloc] initWithProperties:@{ @"value" : @1 }];
+    TD_Revision *saved =
+        [self.app putLocalRevision:doc prevRevisionID:nil status:&status];
+    XCTAssertEqual(status, kTDStatusCreated);
+    XCTAssertEqualObjects([self.extension getLocalDocumentWithID:@"_local/shared"
+                                                      revisionID:nil][@"value"],
+                          @1);
+
+    doc.body = [[TD_Body alloc] initWithProperties:@{ @"value" : @2 }];
+    [self.app putLocalRevision:doc prevRevisionID:saved.revID status:&status];
+    XCTAssertEqual(status, kTDStatusCreated);
+
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5];
+    while (![[self.extension getLocalDocumentWithID:@"_local/shared" revisionID:nil][@"value"]
+                isEqual:@2] &&
+           [deadline timeIntervalSinceNow] > 0) {
+        [NSThread sleepForTimeInterval:0.02];
+    }
+    XCTAssertEqualObjects([self.extension getLocalDocumentWithID:@"_local/shared"
+                                                      revisionID:nil][@"value"],
+                          @2);
+}
+
+@end
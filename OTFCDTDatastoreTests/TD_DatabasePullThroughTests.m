@@ -0,0 +1,136 @@
+//
+//  TD_DatabasePullThroughTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+#import "CloudantSyncTests.h"
+#import "CDTEncryptionKeyNilProvider.h"
+#import "TD_Body.h"
+#import "TD_Database.h"
+#import "TD_Database+Insertion.h"
+#import "TD_Database+PullThrough.h"
+
+#import <fmdb/FMDB.h>
+
+@interface TD_DatabasePullThroughTests : CloudantSyncTests
+
+@property (strong, nonatomic) TD_Database *db;
+
+@end
+
+@implementation TD_DatabasePullThroughTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    NSString *path = [[self createTemporaryDirectoryAndReturnPath]
+        stringByAppendingPathComponent:@"TD_DatabasePullThroughTests.touchdb"];
+    self.db = [TD_Database createEmptyDBAtPath:path
+                     withEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]];
+    XCTAssertNotNil(self.db);
+}
+
+- (void)tearDown
+{
+    [self.db deleteDatabase:nil];
+    self.db = nil;
+
+    [super tearDown];
+}
+
+- (TD_Revision *)putDocWithID:(NSString *)docID prevRevisionID:(NSString *)prevRevID
+{
+    TD_Revision *rev = [[TD_Revision alloc] initWithDocID:docID revID:nil deleted:NO];
+    rev.body = [[TD_Body alloc] initWithProperties:@{ @"_id" : docID, @"hello" : @"world" }];
+    TDStatus status;
+    TD_Revision *saved =
+        [self.db putRevision:rev prevRevisionID:prevRevID allowConflict:NO status:&status];
+    XCTAssertFalse(TDStatusIsError(status));
+    return saved;
+}
+
+- (void)testOnlyUnchangedDocumentsAreEvicted
+{
+    [self putDocWithID:@"fetched" prevRevisionID:nil];
+    TD_Revision *edited = [self putDocWithID:@"edited" prevRevisionID:nil];
+    [self putDocWithID:@"local" prevRevisionID:nil];
+    XCTAssertEqual([self.db notePulledThroughDocumentIDs:@[ @"fetched", @"edited", @"missing" ]],
+                   kTDStatusOK);
+    [self putDocWithID:@"edited" prevRevisionID:edited.revID];
+
+    NSArray *evicted;
+    XCTAssertEqual([self.db evictPulledThroughDocumentsFetchedBefore:[NSDate distantFuture]
+                                                  evictedDocumentIDs:&evicted],
+                   kTDStatusOK);
+    XCTAssertEqualObjects(evicted, @[ @"fetched" ]);
+
+    TDStatus status;
+    XCTAssertNil([self.db getDocumentWithID:@"fetched" revisionID:nil options:0 status:&status]);
+    XCTAssertEqual(status, kTDStatusNotFound);
+    XCTAssertNotNil([self.db getDocumentWithID:@"edited" revisionID:nil options:0 status:&status]);
+    XCTAssertNotNil([self.db getDocumentWithID:@"local" revisionID:nil options:0 status:&status]);
+}
+
+- (void)testEvictionIsNotifiedAndLeavesNoRows
+{
+    [self putDocWithID:@"fetched" prevRevisionID:nil];
+    XCTAssertEqual([self.db notePulledThroughDocumentIDs:@[ @"fetched" ]], kTDStatusOK);
+
+    __block NSArray *notified;
+    id observer = [[NSNotificationCenter defaultCenter]
+        addObserverForName:TD_DatabasePurgedNotification
+                    object:self.db
+                     queue:nil
+                usingBlock:^(NSNotification *n) { notified = n.userInfo[@"docIDs"]; }];
+    XCTAssertEqual([self.db evictPulledThroughDocumentsFetchedBefore:[NSDate distantFuture]
+                                                  evictedDocumentIDs:NULL],
+                   kTDStatusOK);
+    [[NSNotificationCenter defaultCenter] removeObserver:observer];
+    XCTAssertEqualObjects(notified, @[ @"fetched" ]);
+
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+        for (NSString *table in @[ @"docs", @"revs", @"pulled_through" ]) {
+            NSString *sql = [NSString stringWithFormat:@"SELECT COUNT(*) FROM %@", table];
+            XCTAssertEqual([db intForQuery:sql], 0, @"%@", table);
+        }
+    }];
+}
+
+- (void)testRecentDocumentsAreKept
+{
+    [self putDocWithID:@"fetched" prevRevisionID:nil];
+    XCTAssertEqual([self.db notePulledThroughDocumentIDs:@[ @"fetched" ]], kTDStatusOK);
+
+    NSArray *evicted;
+    XCTAssertEqual([self.db evictPulledThroughDocumentsFetchedBefore:[NSDate distantPast]
+                                                  evictedDocumentIDs:&evicted],
+                   kTDStatusOK);
+    XCTAssertEqual(evicted.count, (NSUInteger)0);
+}
+
+- (void)testHeldDocumentsAreNotFetchedAgain
+{
+    [self putDocWithID:@"fetched" prevRevisionID:nil];
+    TD_Revision *edited = [self putDocWithID:@"edited" prevRevisionID:nil];
+    [self putDocWithID:@"local" prevRevisionID:nil];
+    [self.db notePulledThroughDocumentIDs:@[ @"fetched", @"edited" ]];
+    [self putDocWithID:@"edited" prevRevisionID:edited.revID];
+
+    NSSet *held =
+        [self.db heldDocumentIDsAmong:@[ @"fetched", @"edited", @"local", @"missing" ]];
+    XCTAssertEqualObjects(held, ([NSSet setWithObjects:@"edited", @"local", nil]));
+}
+
+@end
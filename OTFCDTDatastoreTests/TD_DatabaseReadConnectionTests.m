@@ -0,0 +1,142 @@
+//
+//  TD_DatabaseReadConnectionTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+
+#import <FMDB/FMDB.h>
+
+#import "CloudantSyncTests.h"
+#import "CDTEncryptionKeyNilProvider.h"
+#import "TD_Body.h"
+#import "TD_Database.h"
+#import "TD_Database+Insertion.h"
+
+@interface TD_DatabaseReadConnectionTests : CloudantSyncTests
+
+@property (strong, nonatomic) TD_Database *db;
+
+@end
+
+@implementation TD_DatabaseReadConnectionTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    NSString *path = [[self createTemporaryDirectoryAndReturnPath]
+        stringByAppendingPathComponent:@"TD_DatabaseReadConnectionTests.touchdb"];
+    self.db = [TD_Database createEmptyDBAtPath:path
+                     withEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]];
+    XCTAssertNotNil(self.db);
+}
+
+- (void)tearDown
+{
+    [self.db deleteDatabase:nil];
+    self.db = nil;
+
+    [super tearDown];
+}
+
+- (TD_Revision *)putDocWithID:(NSString *)docID
+{
+    TD_Revision *rev = [[TD_Revision alloc] initWithDocID:docID revID:nil deleted:NO];
+    rev.body = [[TD_Body alloc] initWithProperties:@{ @"_id" : docID, @"hello" : @"world" }];
+    TDStatus status;
+    TD_Revision *saved =
+        [self.db putRevision:rev prevRevisionID:nil allowConflict:NO status:&status];
+    XCTAssertEqual(status, kTDStatusCreated);
+    return saved;
+}
+
+- (void)testReadConnectionSeesCommittedWrites
+{
+    TD_Revision *saved = [self putDocWithID:@"doc1"];
+
+    __block NSString *revID = nil;
+    [self.db inReadTransaction:^(FMDatabase *db) {
+        revID = [db stringForQuery:@"SELECT revid FROM revs WHERE current=1"];
+    }];
+    XCTAssertEqualObjects(revID, saved.revID);
+    XCTAssertEqualObjects([self.db getDocumentWithID:@"doc1" revisionID:nil].revID, saved.revID);
+}
+
+- (void)testReadConnectionsAreReadOnly
+{
+    __block BOOL updated = YES;
+    [self.db inReadTransaction:^(FMDatabase *db) {
+        updated = [db executeUpdate:@"DELETE FROM docs"];
+    }];
+    XCTAssertFalse(updated);
+}
+
+- (void)testConcurrentReadsWhileWriting
+{
+    for (int i = 0; i < 20; i++) {
+        [self putDocWithID:[NSString stringWithFormat:@"doc%d", i]];
+    }
+
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_group_async(group, dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+        for (int i = 20; i < 40; i++) {
+            [self putDocWithID:[NSString stringWithFormat:@"doc%d", i]];
+        }
+    });
+
+    __block NSUInteger failures = 0;
+    dispatch_apply(200, dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^(size_t i) {
+        NSString *docID = [NSString stringWithFormat:@"doc%zu", i % 20];
+        if (![self.db getDocumentWithID:docID revisionID:nil]) {
+            @synchronized(self) { failures++; }
+        }
+    });
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+    XCTAssertEqual(failures, (NSUInteger)0);
+    XCTAssertEqual(self.db.documentCount, (NSUInteger)40);
+}
+
+- (void)testReadsInSnapshotDontSeeLaterWrites
+{
+    [self putDocWithID:@"doc1"];
+
+    __block NSUInteger countBefore = 0, countAfter = 0;
+    __block TD_Revision *missing = nil;
+    [self.db inReadSnapshot:^{
+        XCTAssertTrue(self.db.isInReadSnapshot);
+        countBefore = self.db.documentCount;
+        // Written on another thread, as the block holds this one's snapshot open
+        dispatch_sync(dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+            [self putDocWithID:@"doc2"];
+        });
+        countAfter = self.db.documentCount;
+        missing = [self.db getDocumentWithID:@"doc2" revisionID:nil];
+    }];
+    XCTAssertFalse(self.db.isInReadSnapshot);
+
+    XCTAssertEqual(countBefore, (NSUInteger)1);
+    XCTAssertEqual(countAfter, (NSUInteger)1);
+    XCTAssertNil(missing);
+    XCTAssertEqual(self.db.documentCount, (NSUInteger)2);
+}
+
+- (void)testReadsStillWorkAfterCompaction
+{
+    [self putDocWithID:@"doc1"];
+    XCTAssertEqual([self.db compact], kTDStatusOK);
+    XCTAssertNotNil([self.db getDocumentWithID:@"doc1" revisionID:nil]);
+    XCTAssertEqual(self.db.documentCount, (NSUInteger)1);
+}
+
+@end
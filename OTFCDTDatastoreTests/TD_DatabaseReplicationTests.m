@@ -0,0 +1,282 @@
+//
+//  TD_DatabaseReplicationTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import <FMDB/FMDB.h>
+
+#import "CloudantSyncTests.h"
+#import "CDTEncryptionKeyNilProvider.h"
+#import "TD_Body.h"
+#import "TD_Database.h"
+#import "TD_Database+Attachments.h"
+#import "TD_Database+Insertion.h"
+#import "TD_Database+Replication.h"
+#import "TDInternal.h"
+
+@interface TD_DatabaseReplicationTests : CloudantSyncTests
+
+@property (strong, nonatomic) TD_Database *db;
+
+@end
+
+@implementation TD_DatabaseReplicationTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    NSString *path = [[self createTemporaryDirectoryAndReturnPath]
+        stringByAppendingPathComponent:@"TD_DatabaseReplicationTests.touchdb"];
+    self.db = [TD_Database createEmptyDBAtPath:path
+                     withEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]];
+    XCTAssertNotNil(self.db);
+}
+
+- (void)tearDown
+{
+    [self.db deleteDatabase:nil];
+    self.db = nil;
+
+    [super tearDown];
+}
+
+- (TD_Revision *)putDocWithID:(NSString *)docID
+{
+    TD_Revision *rev = [[TD_Revision alloc] initWithDocID:docID revID:nil deleted:NO];
+    rev.body = [[TD_Body alloc] initWithProperties:@{ @"_id" : docID }];
+    TDStatus status;
+    TD_Revision *saved =
+        [self.db putRevision:rev prevRevisionID:nil allowConflict:NO status:&status];
+    XCTAssertEqual(status, kTDStatusCreated);
+    return saved;
+}
+
+- (void)testFindMissingRevisionsMatchesWholePairs
+{
+    TD_Revision *a = [self putDocWithID:@"a"];
+    TD_Revision *b = [self putDocWithID:@"b"];
+
+    NSMutableArray *revs = [NSMutableArray array];
+    [revs addObject:[[TD_Revision alloc] initWithDocID:@"a" revID:a.revID deleted:NO]];
+    // Each half of these pairs exists, but not together.
+    [revs addObject:[[TD_Revision alloc] initWithDocID:@"a" revID:b.revID deleted:NO]];
+    [revs addObject:[[TD_Revision alloc] initWithDocID:@"b" revID:a.revID deleted:NO]];
+    // More than fit in one statement.
+    for (NSUInteger i = 0; i < 300; i++) {
+        [revs addObject:[[TD_Revision alloc] initWithDocID:[NSString stringWithFormat:@"m%lu", (unsigned long)i]
+                                                     revID:@"1-abc"
+                                                   deleted:NO]];
+    }
+    [revs addObject:[[TD_Revision alloc] initWithDocID:@"b" revID:b.revID deleted:NO]];
+
+    TD_RevisionList *list = [[TD_RevisionList alloc] initWithArray:revs];
+    XCTAssertTrue([self.db findMissingRevisions:list]);
+    XCTAssertEqual(list.count, (NSUInteger)302);
+    XCTAssertNil([list revWithDocID:@"a" revID:a.revID]);
+    XCTAssertNil([list revWithDocID:@"b" revID:b.revID]);
+    XCTAssertNotNil([list revWithDocID:@"a" revID:b.revID]);
+    XCTAssertNotNil([list revWithDocID:@"b" revID:a.revID]);
+}
+
+- (void)testPossibleAncestorsOfRevisionsLookedUpTogether
+{
+    TD_Revision *a = [self putDocWithID:@"a"];
+    NSArray *revs = @[
+        [[TD_Revision alloc] initWithDocID:@"a" revID:@"2-def" deleted:NO],
+        [[TD_Revision alloc] initWithDocID:@"missing" revID:@"2-def" deleted:NO],
+        [[TD_Revision alloc] initWithDocID:@"a" revID:@"1-def" deleted:NO]
+    ];
+    NSArray *ancestors = [self.db getPossibleAncestorRevisionIDsOfRevisions:revs limit:10];
+    XCTAssertEqualObjects(ancestors, (@[ @[ a.revID ], @[], @[] ]));
+    XCTAssertEqualObjects([self.db getPossibleAncestorRevisionIDsOfRevisions:@[] limit:10], @[]);
+
+    XCTAssertEqualObjects([self.db existingDocumentIDsAmong:@[ @"a", @"missing" ]],
+                          [NSSet setWithObject:@"a"]);
+}
+
+- (void)testBodiesLoadedTogetherHaveTheirOwnHistories
+{
+    TD_Revision *a1 = [self putDocWithID:@"a"];
+    TD_Revision *a2 = [[TD_Revision alloc] initWithDocID:@"a" revID:nil deleted:NO];
+    a2.body = [[TD_Body alloc] initWithProperties:@{ @"_id" : @"a", @"n" : @2 }];
+    TDStatus status;
+    a2 = [self.db putRevision:a2 prevRevisionID:a1.revID allowConflict:NO status:&status];
+    XCTAssertEqual(status, kTDStatusCreated);
+    TD_Revision *b1 = [self putDocWithID:@"b"];
+
+    NSArray<TD_Revision *> *revs = @[
+        [[TD_Revision alloc] initWithDocID:@"a" revID:a2.revID deleted:NO],
+        [[TD_Revision alloc] initWithDocID:@"b" revID:b1.revID deleted:NO],
+        [[TD_Revision alloc] initWithDocID:@"a" revID:a1.revID deleted:NO]
+    ];
+    revs[0].sequence = a2.sequence;
+    revs[1].sequence = b1.sequence;
+    revs[2].sequence = a1.sequence;
+    XCTAssertEqualObjects([self.db loadRevisionBodies:revs options:kTDIncludeRevs],
+                          (@[ @(kTDStatusOK), @(kTDStatusOK), @(kTDStatusOK) ]));
+
+    NSString *(^suffix)(NSString *) = ^(NSString *revID) {
+        return [revID substringFromIndex:[revID rangeOfString:@"-"].location + 1];
+    };
+    XCTAssertEqualObjects(revs[0][@"_revisions"],
+                          (@{ @"start" : @2, @"ids" : @[ suffix(a2.revID), suffix(a1.revID) ] }));
+    XCTAssertEqualObjects(revs[1][@"_revisions"], (@{ @"start" : @1, @"ids" : @[ suffix(b1.revID) ] }));
+    XCTAssertEqualObjects(revs[2][@"_revisions"], (@{ @"start" : @1, @"ids" : @[ suffix(a1.revID) ] }));
+    XCTAssertEqualObjects(revs[0][@"n"], @2);
+}
+
+- (void)testKnownRemoteSequencesRoundTrip
+{
+    XCTAssertNil([self.db knownRemoteSequencesForCheckpointID:@"abc"]);
+
+    NSMutableIndexSet *known = [NSMutableIndexSet indexSetWithIndexesInRange:NSMakeRange(5, 10)];
+    [known addIndex:42];
+    NSError *error;
+    XCTAssertTrue([self.db saveKnownRemoteSequences:known forCheckpointID:@"abc" error:&error]);
+    XCTAssertNil(error);
+    XCTAssertEqualObjects([self.db knownRemoteSequencesForCheckpointID:@"abc"], known);
+
+    // Having no checkpoint yet doesn't make one up
+    XCTAssertNil([self.db checkpointDocumentWithID:@"abc"]);
+    XCTAssertNil([self.db knownRemoteSequencesForCheckpointID:@"def"]);
+}
+
+- (void)testSavingCheckpointKeepsKnownRemoteSequences
+{
+    NSIndexSet *known = [NSIndexSet indexSetWithIndex:7];
+    XCTAssertTrue([self.db saveKnownRemoteSequences:known forCheckpointID:@"abc" error:nil]);
+
+    NSDictionary *checkpoint = @{ @"_id" : @"_local/abc", @"source_last_seq" : @3 };
+    XCTAssertTrue([self.db saveCheckpointDocument:checkpoint error:nil]);
+
+    XCTAssertEqualObjects([self.db checkpointDocumentWithID:@"abc"][@"source_last_seq"], @3);
+    XCTAssertEqualObjects([self.db knownRemoteSequencesForCheckpointID:@"abc"], known);
+}
+
+- (void)testDeferredAttachmentIsInstalledOnceDownloaded
+{
+    NSDictionary *doc = @{
+        @"_id" : @"doc1",
+        @"_rev" : @"1-abc",
+        @"foo" : @"bar",
+        @"_attachments" : @{
+            @"a.txt" : @{
+                @"stub" : @YES,
+                @"revpos" : @1,
+                @"content_type" : @"text/plain",
+                @"length" : @11,
+                @"digest" : @"md5-XrY7u+Ae7tCTyyK7j1rNww=="
+            }
+        }
+    };
+
+    // The stub is for an attachment we don't have, so it's taken out to download later
+    NSDictionary *pending;
+    NSDictionary *deferredDoc = [self.db documentDeferringAttachments:doc
+                                                   pendingAttachments:&pending];
+    XCTAssertNil(deferredDoc[@"_attachments"]);
+    XCTAssertEqualObjects(pending.allKeys, @[ @"a.txt" ]);
+
+    TD_Revision *rev = [TD_Revision revisionWithProperties:deferredDoc];
+    rev.pendingAttachments = pending;
+    XCTAssertEqual([self.db forceInsert:rev revisionHistory:@[ @"1-abc" ] source:nil],
+                   kTDStatusCreated);
+    XCTAssertTrue([self.db hasPendingAttachmentDownloadsForSequence:rev.sequence]);
+
+    NSArray *downloads = [self.db pendingAttachmentDownloadsWithLimit:10];
+    XCTAssertEqual(downloads.count, 1);
+    XCTAssertEqualObjects(downloads[0][@"docID"], @"doc1");
+    XCTAssertEqualObjects(downloads[0][@"revID"], @"1-abc");
+    XCTAssertEqualObjects(downloads[0][@"name"], @"a.txt");
+
+    TDBlobStoreWriter *writer = [self.db attachmentWriter];
+    [writer appendData:[@"hello world" dataUsingEncoding:NSUTF8StringEncoding]];
+    [writer finish];
+    XCTAssertEqual([self.db installPendingAttachmentDownload:downloads[0] withWriter:writer],
+                   kTDStatusOK);
+
+    XCTAssertFalse([self.db hasPendingAttachmentDownloadsForSequence:rev.sequence]);
+    XCTAssertEqual([self.db pendingAttachmentDownloadsWithLimit:10].count, 0);
+    __block NSDictionary *attachments;
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+        attachments = [self.db getAttachmentDictForSequence:rev.sequence options:0 inDatabase:db];
+    }];
+    XCTAssertEqualObjects(attachments[@"a.txt"][@"length"], @11);
+
+    // Installing it again finds nothing waiting for it
+    XCTAssertEqual([self.db installPendingAttachmentDownload:downloads[0] withWriter:writer],
+                   kTDStatusNotFound);
+}
+
+- (void)testStubOutAttachmentsMatchingRemoteDigests
+{
+    NSDictionary *doc = @{
+        @"_id" : @"doc1",
+        @"_rev" : @"1-abc",
+        @"_attachments" : @{
+            @"a.txt" : @{
+                @"stub" : @YES,
+                @"revpos" : @1,
+                @"content_type" : @"text/plain",
+                @"length" : @11,
+                @"digest" : @"md5-XrY7u+Ae7tCTyyK7j1rNww=="
+            }
+        }
+    };
+    NSDictionary *pending;
+    TD_Revision *stored = [TD_Revision
+        revisionWithProperties:[self.db documentDeferringAttachments:doc
+                                                  pendingAttachments:&pending]];
+    stored.pendingAttachments = pending;
+    XCTAssertEqual([self.db forceInsert:stored revisionHistory:@[ @"1-abc" ] source:nil],
+                   kTDStatusCreated);
+    TDBlobStoreWriter *writer = [self.db attachmentWriter];
+    [writer appendData:[@"hello world" dataUsingEncoding:NSUTF8StringEncoding]];
+    [writer finish];
+    NSDictionary *download = [self.db pendingAttachmentDownloadsWithLimit:1][0];
+    XCTAssertEqual([self.db installPendingAttachmentDownload:download withWriter:writer],
+                   kTDStatusOK);
+
+    // A later revision to push, with two attachments of the same contents following
+    __block NSDictionary *attachments;
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+        attachments =
+            [self.db getAttachmentDictForSequence:stored.sequence options:0 inDatabase:db];
+    }];
+    NSMutableDictionary *following = [attachments[@"a.txt"] mutableCopy];
+    [following removeObjectForKey:@"stub"];
+    following[@"follows"] = @YES;
+    following[@"revpos"] = @2;
+    TD_Revision *rev = [TD_Revision revisionWithProperties:@{
+        @"_id" : @"doc1",
+        @"_rev" : @"2-def",
+        @"_attachments" : @{@"a.txt" : following, @"b.txt" : following}
+    }];
+
+    // Only the one the remote has with the same digest is stubbed out
+    NSDictionary *remote = @{
+        @"a.txt" : @{@"stub" : @YES, @"length" : @11, @"digest" : @"md5-XrY7u+Ae7tCTyyK7j1rNww=="},
+        @"b.txt" : @{@"stub" : @YES, @"length" : @11, @"digest" : @"md5-AAAAAAAAAAAAAAAAAAAAAA=="}
+    };
+    XCTAssertTrue([self.db stubOutAttachmentsIn:rev matchingRemoteAttachments:remote]);
+    NSDictionary *sent = rev[@"_attachments"];
+    XCTAssertEqualObjects(sent[@"a.txt"][@"stub"], @YES);
+    XCTAssertNil(sent[@"a.txt"][@"follows"]);
+    XCTAssertEqualObjects(sent[@"b.txt"][@"follows"], @YES);
+    XCTAssertNil(sent[@"b.txt"][@"stub"]);
+
+    XCTAssertFalse([self.db stubOutAttachmentsIn:rev matchingRemoteAttachments:remote]);
+}
+
+@end
@@ -0,0 +1,150 @@
+//
+//  TD_DatabaseValidationTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+
+#import <Foundation/Foundation.h>
+
+#import "CloudantSyncTests.h"
+#import "CDTEncryptionKeyNilProvider.h"
+#import "TD_Body.h"
+#import "TD_Database.h"
+#import "TD_Database+Insertion.h"
+
+@interface TD_DatabaseValidationTests : CloudantSyncTests
+
+@property (strong, nonatomic) TD_Database *db;
+
+@end
+
+@implementation TD_DatabaseValidationTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    NSString *path = [[self createTemporaryDirectoryAndReturnPath]
+        stringByAppendingPathComponent:@"TD_DatabaseValidationTests.touchdb"];
+    self.db = [TD_Database createEmptyDBAtPath:path
+                     withEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]];
+    XCTAssertNotNil(self.db);
+
+    // Rejects revisions without a "type", and any change to it once created.
+    [self.db defineValidation:@"type"
+                      asBlock:^BOOL(TD_Revision *newRevision, id<TD_ValidationContext> context) {
+                          return newRevision.deleted || newRevision[@"type"] != nil;
+                      }];
+    [self.db defineValidation:@"fixedType"
+                      asBlock:^BOOL(TD_Revision *newRevision, id<TD_ValidationContext> context) {
+                          return !context.currentRevision ||
+                                 [context disallowChangesTo:@[ @"type" ]];
+                      }];
+}
+
+- (void)tearDown
+{
+    [self.db deleteDatabase:nil];
+    self.db = nil;
+
+    [super tearDown];
+}
+
+- (TD_Revision *)revWithID:(NSString *)docID properties:(NSDictionary *)properties
+{
+    TD_Revision *rev = [[TD_Revision alloc] initWithDocID:docID revID:nil deleted:NO];
+    NSMutableDictionary *body = [properties mutableCopy];
+    body[@"_id"] = docID;
+    rev.body = [[TD_Body alloc] initWithProperties:body];
+    return rev;
+}
+
+- (void)checkValidations
+{
+    TDStatus status;
+    TD_Revision *rev1 = [self.db putRevision:[self revWithID:@"doc1" properties:@{}]
+                              prevRevisionID:nil
+                               allowConflict:NO
+                                      status:&status];
+    XCTAssertNil(rev1);
+    XCTAssertEqual(status, kTDStatusForbidden);
+
+    rev1 = [self.db putRevision:[self revWithID:@"doc1" properties:@{ @"type" : @"a" }]
+                 prevRevisionID:nil
+                  allowConflict:NO
+                         status:&status];
+    XCTAssertEqual(status, kTDStatusCreated);
+
+    TD_Revision *rev2 = [self.db putRevision:[self revWithID:@"doc1" properties:@{ @"type" : @"b" }]
+                              prevRevisionID:rev1.revID
+                               allowConflict:NO
+                                      status:&status];
+    XCTAssertNil(rev2);
+    XCTAssertEqual(status, kTDStatusForbidden);
+
+    rev2 = [self.db putRevision:[self revWithID:@"doc1" properties:@{ @"type" : @"a", @"n" : @2 }]
+                 prevRevisionID:rev1.revID
+                  allowConflict:NO
+                         status:&status];
+    XCTAssertEqual(status, kTDStatusCreated);
+
+    // Replacing a revision that's no longer current is still a conflict.
+    [self.db putRevision:[self revWithID:@"doc1" properties:@{ @"type" : @"a", @"n" : @3 }]
+          prevRevisionID:rev1.revID
+           allowConflict:NO
+                  status:&status];
+    XCTAssertEqual(status, kTDStatusConflict);
+}
+
+- (void)testValidatesInsideTransaction { [self checkValidations]; }
+
+- (void)testValidatesConcurrently
+{
+    self.db.validatesConcurrently = YES;
+    [self checkValidations];
+}
+
+- (void)testValidatesPulledBatchConcurrently
+{
+    self.db.validatesConcurrently = YES;
+    TDStatus status;
+    TD_Revision *local = [self revWithID:@"doc1" properties:@{ @"type" : @"a" }];
+    local = [self.db putRevision:local prevRevisionID:nil allowConflict:NO status:&status];
+    XCTAssertEqual(status, kTDStatusCreated);
+
+    NSMutableArray *revs = [NSMutableArray array];
+    NSMutableArray *histories = [NSMutableArray array];
+    void (^add)(NSString *, NSString *, NSArray *, NSDictionary *) =
+        ^(NSString *docID, NSString *revID, NSArray *history, NSDictionary *properties) {
+            NSMutableDictionary *body = [properties mutableCopy];
+            body[@"_id"] = docID;
+            body[@"_rev"] = revID;
+            [revs addObject:[[TD_Revision alloc] initWithProperties:body]];
+            [histories addObject:history];
+        };
+    // A change of type to a local document, a valid and an invalid new document, and a second
+    // revision of a document first seen in the same batch.
+    add(@"doc1", @"2-x", @[ @"2-x", local.revID ], @{ @"type" : @"b" });
+    add(@"doc2", @"1-x", @[ @"1-x" ], @{ @"type" : @"a" });
+    add(@"doc3", @"1-x", @[ @"1-x" ], @{});
+    add(@"doc2", @"2-y", @[ @"2-y", @"1-x" ], @{ @"type" : @"c" });
+
+    NSArray *statuses = [self.db forceInsertRevisions:revs revisionHistories:histories source:nil];
+    XCTAssertEqualObjects(statuses,
+                          (@[ @(kTDStatusForbidden), @(kTDStatusCreated), @(kTDStatusForbidden),
+                              @(kTDStatusForbidden) ]));
+    XCTAssertEqualObjects([self.db getDocumentWithID:@"doc1" revisionID:nil].revID, local.revID);
+    XCTAssertEqualObjects([self.db getDocumentWithID:@"doc2" revisionID:nil].revID, @"1-x");
+    XCTAssertNil([self.db getDocumentWithID:@"doc3" revisionID:nil]);
+}
+
+@end
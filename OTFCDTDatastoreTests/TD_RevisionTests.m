@@ -16,6 +16,8 @@
 #import <Foundation/Foundation.h>
 #import "CollectionUtils.h"
 #import "TD_Revision.h"
+#import "TD_Body.h"
+#import "TDJSON.h"
 //#import "TDCollateRevIDs.h"
 #import "CloudantTests.h"
 
@@ -105,4 +107,38 @@
     
 }
 
+- (void)testCopyWithDocIDEditsUnparsedJSON
+{
+    NSData *json = [@"{\"_id\":\"doc\",\"_rev\":\"1-a\",\"name\":\"mike\"}"
+        dataUsingEncoding:NSUTF8StringEncoding];
+    TD_Revision *rev = [[TD_Revision alloc] initWithDocID:@"doc" revID:@"1-a" deleted:NO];
+    rev.asJSON = json;
+
+    TD_Revision *copy = [rev copyWithDocID:@"doc" revID:@"2-b"];
+    XCTAssertEqualObjects(copy.revID, @"2-b");
+    XCTAssertEqualObjects([TDJSON JSONObjectWithData:copy.asJSON options:0 error:nil],
+                          (@{ @"_id" : @"doc", @"_rev" : @"2-b", @"name" : @"mike" }));
+    // The original body is unchanged:
+    XCTAssertEqualObjects(rev.asJSON, json);
+}
+
+- (void)testBodyBySettingPropertiesGivesTheSameResultParsedOrNot
+{
+    NSData *json = [@"{\"_attachments\":{\"a\":{\"stub\":true}},\"name\":\"mike\",\"age\":3}"
+        dataUsingEncoding:NSUTF8StringEncoding];
+    NSDictionary *changes = @{ @"_attachments" : @{ @"b" : @{ @"follows" : @YES } } };
+    NSDictionary *expected = @{ @"_attachments" : @{ @"b" : @{ @"follows" : @YES } }, @"name" : @"mike" };
+
+    TD_Body *unparsed = [TD_Body bodyWithJSON:json];
+    XCTAssertEqualObjects([unparsed valuesForKeys:@[ @"age", @"missing" ]], @{ @"age" : @3 });
+    XCTAssertEqualObjects([unparsed bodyBySettingProperties:changes removingKeys:@[ @"age" ]].properties,
+                          expected);
+
+    TD_Body *parsed = [TD_Body bodyWithJSON:json];
+    XCTAssertNotNil(parsed.properties);
+    XCTAssertEqualObjects([parsed valuesForKeys:@[ @"age", @"missing" ]], @{ @"age" : @3 });
+    XCTAssertEqualObjects([parsed bodyBySettingProperties:changes removingKeys:@[ @"age" ]].properties,
+                          expected);
+}
+
 @end
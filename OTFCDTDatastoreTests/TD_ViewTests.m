@@ -0,0 +1,297 @@
+//
+//  TD_ViewTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#import <FMDB/FMDB.h>
+#import <Foundation/Foundation.h>
+
+#import "CloudantSyncTests.h"
+#import "CDTEncryptionKeyNilProvider.h"
+#import "CDTQueryHandle.h"
+#import "TD_Database.h"
+#import "TD_Body.h"
+#import "TD_Database+Insertion.h"
+#import "TD_Revision.h"
+#import "TD_View.h"
+
+@interface TD_ViewTests : CloudantSyncTests
+
+@property (strong, nonatomic) TD_Database *db;
+
+@end
+
+@implementation TD_ViewTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    NSString *path = [[self createTemporaryDirectoryAndReturnPath]
+        stringByAppendingPathComponent:@"TD_ViewTests.touchdb"];
+    self.db = [TD_Database createEmptyDBAtPath:path
+                     withEncryptionKeyProvider:[CDTEncryptionKeyNilProvider provider]];
+    XCTAssertNotNil(self.db);
+}
+
+- (void)tearDown
+{
+    [self.db deleteDatabase:nil];
+    self.db = nil;
+
+    [super tearDown];
+}
+
+- (TD_Revision *)putDocWithID:(NSString *)docID
+                     category:(NSString *)category
+                       amount:(NSInteger)amount
+                   replacing:(TD_Revision *)prev
+{
+    TD_Revision *rev = [[TD_Revision alloc]
+        initWithProperties:@{ @"_id" : docID, @"category" : category, @"amount" : @(amount) }];
+    TDStatus status;
+    TD_Revision *put =
+        [self.db putRevision:rev prevRevisionID:prev.revID allowConflict:NO status:&status];
+    XCTAssertEqual(status, kTDStatusCreated);
+    return put;
+}
+
+- (NSArray *)groupedRowsOfView:(NSString *)name
+                   reduceBlock:(TDReduceBlock)reduceBlock
+                    groupLevel:(unsigned)groupLevel
+{
+    TD_View *view = [self.db viewNamed:name];
+    [view setMapBlock:^(NSDictionary *doc, TDMapEmitBlock emit) {
+        emit(@[ doc[@"category"], doc[@"_id"] ], doc[@"amount"]);
+    }
+          reduceBlock:reduceBlock
+              version:@"1"];
+    XCTAssertLessThan([view updateIndex], kTDStatusBadRequest);
+
+    TDQueryOptions options = kDefaultTDQueryOptions;
+    options.reduce = YES;
+    options.groupLevel = groupLevel;
+    TDStatus status;
+    NSArray *rows = [view queryWithOptions:&options status:&status];
+    XCTAssertEqual(status, kTDStatusOK);
+    return rows;
+}
+
+- (void)testBuiltInReducesMatchRereducingEveryRow
+{
+    NSMutableDictionary *revs = [NSMutableDictionary dictionary];
+    for (NSInteger i = 0; i < 60; i++) {
+        NSString *docID = [NSString stringWithFormat:@"doc%02ld", (long)i];
+        NSString *category = @[ @"a", @"b", @"c" ][i % 3];
+        revs[docID] = [self putDocWithID:docID category:category amount:i replacing:nil];
+    }
+
+    NSArray *reduces = @[ [TD_View countReduceBlock], [TD_View sumReduceBlock],
+                          [TD_View statsReduceBlock] ];
+    for (NSUInteger n = 0; n < reduces.count; n++) {
+        TDReduceBlock builtIn = reduces[n];
+        // The same reduction, but not recognisable as built in, so reduced row by row:
+        TDReduceBlock custom = ^id(NSArray *keys, NSArray *values, BOOL rereduce) {
+            return builtIn(keys, values, rereduce);
+        };
+        NSString *cached = [NSString stringWithFormat:@"cached%lu", (unsigned long)n];
+        NSString *uncached = [NSString stringWithFormat:@"uncached%lu", (unsigned long)n];
+
+        for (unsigned groupLevel = 0; groupLevel <= 2; groupLevel++) {
+            XCTAssertEqualObjects([self groupedRowsOfView:cached
+                                              reduceBlock:builtIn
+                                               groupLevel:groupLevel],
+                                  [self groupedRowsOfView:uncached
+                                              reduceBlock:custom
+                                               groupLevel:groupLevel]);
+        }
+
+        // Updating and deleting rows, including the largest value of a group, keeps them in step:
+        revs[@"doc59"] = [self putDocWithID:@"doc59" category:@"a" amount:-5
+                                  replacing:revs[@"doc59"]];
+        revs[@"doc03"] = [self putDocWithID:@"doc03" category:@"c" amount:100
+                                  replacing:revs[@"doc03"]];
+        XCTAssertEqualObjects([self groupedRowsOfView:cached reduceBlock:builtIn groupLevel:1],
+                              [self groupedRowsOfView:uncached reduceBlock:custom groupLevel:1]);
+    }
+
+    NSArray *counts = [self groupedRowsOfView:@"cached0"
+                                  reduceBlock:[TD_View countReduceBlock]
+                                   groupLevel:1];
+    XCTAssertEqual(counts.count, 3u);
+    XCTAssertEqualObjects(counts[0][@"key"], @[ @"a" ]);
+}
+
+- (void)testCancelledHandleStopsQuery
+{
+    for (NSInteger i = 0; i < 20; i++) {
+        [self putDocWithID:[NSString stringWithFormat:@"doc%02ld", (long)i]
+                  category:@"a"
+                    amount:i
+                 replacing:nil];
+    }
+    TD_View *view = [self.db viewNamed:@"amounts"];
+    [view setMapBlock:^(NSDictionary *doc, TDMapEmitBlock emit) {
+        emit(doc[@"amount"], @1);
+    }
+          reduceBlock:nil
+              version:@"1"];
+    XCTAssertLessThan([view updateIndex], kTDStatusBadRequest);
+
+    CDTQueryHandle *handle = [[CDTQueryHandle alloc] init];
+    TDQueryOptions options = kDefaultTDQueryOptions;
+    options.handle = handle;
+    TDStatus status;
+    XCTAssertEqual([view queryWithOptions:&options status:&status].count, 20u);
+    XCTAssertEqual(status, kTDStatusOK);
+
+    [handle cancel];
+    XCTAssertNil([view queryWithOptions:&options status:&status]);
+    XCTAssertEqual(status, kTDStatusCancelled);
+
+    // The handle is detached once the query returns, so others on the connection aren't stopped.
+    options.handle = nil;
+    XCTAssertEqual([view queryWithOptions:&options status:&status].count, 20u);
+    XCTAssertEqual(status, kTDStatusOK);
+}
+
+- (void)testPagesContinueFromStartKeyAndDocID
+{
+    for (NSInteger i = 0; i < 25; i++) {
+        [self putDocWithID:[NSString stringWithFormat:@"doc%02ld", (long)i]
+                  category:@[ @"a", @"b", @"c" ][i % 3]
+                    amount:i
+                 replacing:nil];
+    }
+    TD_View *view = [self.db viewNamed:@"categories"];
+    [view setMapBlock:^(NSDictionary *doc, TDMapEmitBlock emit) {
+        emit(doc[@"category"], doc[@"amount"]);
+    }
+          reduceBlock:nil
+              version:@"1"];
+    XCTAssertLessThan([view updateIndex], kTDStatusBadRequest);
+
+    for (NSNumber *descending in @[ @NO, @YES ]) {
+        TDQueryOptions options = kDefaultTDQueryOptions;
+        options.descending = descending.boolValue;
+        TDStatus status;
+        NSArray *all = [view queryWithOptions:&options status:&status];
+        XCTAssertEqual(all.count, 25u);
+
+        // Pages of 4 split the rows of each key, so have to continue part way through them.
+        NSMutableArray *paged = [NSMutableArray array];
+        id startKey = nil;
+        NSString *startKeyDocID = nil;
+        NSUInteger pages = 0;
+        do {
+            options.limit = 4;
+            options.startKey = startKey;
+            options.startKeyDocID = startKeyDocID;
+            NSArray *page = [view queryPageWithOptions:&options
+                                          nextStartKey:&startKey
+                                     nextStartKeyDocID:&startKeyDocID
+                                                status:&status];
+            XCTAssertEqual(status, kTDStatusOK);
+            XCTAssertLessThanOrEqual(page.count, 4u);
+            [paged addObjectsFromArray:page];
+            pages++;
+        } while (startKey && pages < 10);
+        XCTAssertEqual(pages, 7u);
+        XCTAssertEqualObjects(paged, all);
+    }
+
+    // Streaming stops when the block asks it to, and can't reduce.
+    __block NSUInteger streamed = 0;
+    XCTAssertEqual([view enumerateRowsWithOptions:NULL
+                                       usingBlock:^(NSDictionary *row, BOOL *stop) {
+                                           *stop = (++streamed == 10);
+                                       }],
+                   kTDStatusOK);
+    XCTAssertEqual(streamed, 10u);
+    TDQueryOptions reduced = kDefaultTDQueryOptions;
+    reduced.reduce = YES;
+    XCTAssertEqual([view enumerateRowsWithOptions:&reduced
+                                       usingBlock:^(NSDictionary *row, BOOL *stop){
+                                       }],
+                   kTDStatusBadParam);
+}
+
+- (NSArray *)allRowsOfView:(TD_View *)view
+{
+    TDQueryOptions options = kDefaultTDQueryOptions;
+    TDStatus status;
+    NSArray *rows = [view queryWithOptions:&options status:&status];
+    XCTAssertEqual(status, kTDStatusOK);
+    return rows;
+}
+
+- (void)testThreadSafeMapIndexesTheSameRowsAsSerialMap
+{
+    // Enough documents for several batches of concurrent mapping, some of them conflicted:
+    for (NSInteger i = 0; i < 600; i++) {
+        NSString *docID = [NSString stringWithFormat:@"doc%03ld", (long)i];
+        TD_Revision *rev = [self putDocWithID:docID
+                                     category:@[ @"a", @"b", @"c" ][i % 3]
+                                       amount:i
+                                    replacing:nil];
+        for (NSString *revID in (i % 7 == 0 ? @[ @"2-yyyy", @"2-zzzz" ] : @[])) {
+            TD_Revision *branch = [[TD_Revision alloc] initWithDocID:docID revID:revID deleted:NO];
+            branch.body = [[TD_Body alloc]
+                initWithProperties:@{ @"_id" : docID, @"_rev" : revID, @"category" : @"z" }];
+            XCTAssertFalse(TDStatusIsError([self.db forceInsert:branch
+                                                revisionHistory:@[ revID, rev.revID ]
+                                                         source:nil]));
+        }
+    }
+    [self putDocWithID:@"doc600" category:@"fail" amount:600 replacing:nil];
+
+    TDMapBlock map = ^(NSDictionary *doc, TDMapEmitBlock emit) {
+        emit(@[ doc[@"category"], doc[@"_id"] ], doc[@"amount"]);
+        if (doc[@"_conflicts"]) emit(@"conflicted", doc[@"_conflicts"]);
+        if ([doc[@"category"] isEqual:@"fail"]) emit(@"fail", nil);
+    };
+    TD_View *serial = [self.db viewNamed:@"serial"];
+    [serial setMapBlock:map reduceBlock:nil version:@"1"];
+    TD_View *concurrent = [self.db viewNamed:@"concurrent"];
+    [concurrent setMapBlock:map reduceBlock:nil version:@"1"];
+    concurrent.mapBlockIsThreadSafe = YES;
+
+    // An emit that can't be inserted fails the update either way, leaving nothing indexed:
+    __block BOOL crashOnErrors = NO;
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+        crashOnErrors = db.crashOnErrors;
+        db.crashOnErrors = NO;
+        XCTAssertTrue([db executeUpdate:@"CREATE TEMP TRIGGER fail_emit BEFORE INSERT ON maps "
+                                         "WHEN NEW.key = '\"fail\"' "
+                                         "BEGIN SELECT RAISE(ABORT, 'emit failed'); END"]);
+    }];
+    XCTAssertEqual([serial updateIndex], kTDStatusCallbackError);
+    XCTAssertEqual([concurrent updateIndex], kTDStatusCallbackError);
+    XCTAssertEqual(serial.lastSequenceIndexed, (SequenceNumber)0);
+    XCTAssertEqual(concurrent.lastSequenceIndexed, (SequenceNumber)0);
+    XCTAssertEqual([self allRowsOfView:concurrent].count, 0u);
+
+    [self.db.fmdbQueue inDatabase:^(FMDatabase *db) {
+        XCTAssertTrue([db executeUpdate:@"DROP TRIGGER fail_emit"]);
+        db.crashOnErrors = crashOnErrors;
+    }];
+    XCTAssertEqual([serial updateIndex], kTDStatusOK);
+    XCTAssertEqual([concurrent updateIndex], kTDStatusOK);
+
+    NSArray *rows = [self allRowsOfView:serial];
+    // A row per document, plus one for each conflicted document and the failing one:
+    XCTAssertEqual(rows.count, 601u + 86u + 1u);
+    XCTAssertEqualObjects([self allRowsOfView:concurrent], rows);
+}
+
+@end
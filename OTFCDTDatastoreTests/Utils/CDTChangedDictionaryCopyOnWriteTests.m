@@ -0,0 +1,102 @@
+//
+//  CDTChangedDictionaryCopyOnWriteTests.m
+//  Tests
+//
+//  Copyright © 2018 IBM Corporation. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <XCTest/XCTest.h>
+
+#import <OTFCDTDatastore/CDTChangedDictionary.h>
+#import <OTFCDTDatastore/CDTChangedArray.h>
+
+@interface CDTChangedDictionaryCopyOnWriteTests : XCTestCase
+
+@property (nonatomic, strong) NSDictionary *source;
+@property (nonatomic, strong) CDTChangedDictionary *dictionary;
+
+@end
+
+@implementation CDTChangedDictionaryCopyOnWriteTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.source = @{
+        @"dict" :
+            @{@"array" : @[ @"one", @"two" ], @"dict" : @{@"one" : @"two"}, @"hello" : @"world"},
+
+        @"array" : @[ @[ @"foo", @YES ], @{@"foo" : @YES}, @"two" ]
+    };
+
+    self.dictionary = [CDTChangedDictionary dictionaryWrappingContents:self.source];
+}
+
+- (void)testUnmodifiedReadsAreEqual
+{
+    XCTAssertEqualObjects(self.dictionary, self.source);
+    XCTAssertTrue([self.dictionary[@"dict"] isKindOfClass:[CDTChangedDictionary class]]);
+    XCTAssertTrue([self.dictionary[@"array"][0] isKindOfClass:[CDTChangedArray class]]);
+    XCTAssertFalse(self.dictionary.isChanged);
+}
+
+- (void)testReadsReturnTheSameWrapper
+{
+    XCTAssertEqual(self.dictionary[@"dict"], self.dictionary[@"dict"]);
+    XCTAssertEqual(self.dictionary[@"array"][1], self.dictionary[@"array"][1]);
+}
+
+- (void)testModifyTopLevelField
+{
+    self.dictionary[@"dict"] = @[ @1, @2 ];
+    XCTAssertTrue(self.dictionary.isChanged);
+    XCTAssertEqualObjects(self.dictionary[@"dict"], (@[ @1, @2 ]));
+}
+
+- (void)testModifyDictionaryNestedInDictionary
+{
+    self.dictionary[@"dict"][@"dict"][@"one"] = @"two_changed";
+    XCTAssertTrue(self.dictionary.isChanged);
+    XCTAssertEqualObjects(self.dictionary[@"dict"][@"dict"][@"one"], @"two_changed");
+
+    // The source is shared, not changed.
+    XCTAssertEqualObjects(self.source[@"dict"][@"dict"][@"one"], @"two");
+}
+
+- (void)testModifyDictionaryNestedInArray
+{
+    self.dictionary[@"array"][1][@"foo"] = @"two_changed";
+    XCTAssertTrue(self.dictionary.isChanged);
+    XCTAssertEqualObjects(self.dictionary[@"array"][1][@"foo"], @"two_changed");
+    XCTAssertEqualObjects(self.source[@"array"][1][@"foo"], @YES);
+}
+
+- (void)testModifyArrayNestedInArray
+{
+    self.dictionary[@"array"][0][1] = @"two_changed";
+    XCTAssertTrue(self.dictionary.isChanged);
+    XCTAssertEqualObjects(self.dictionary[@"array"][0], (@[ @"foo", @"two_changed" ]));
+}
+
+- (void)testModifyingParentKeepsChangedChild
+{
+    NSMutableDictionary *nested = self.dictionary[@"dict"][@"dict"];
+    nested[@"one"] = @"two_changed";
+
+    // Copying the parents now must keep the change, and the wrapper, already made.
+    self.dictionary[@"dict"][@"hello"] = @"there";
+    self.dictionary[@"new"] = @YES;
+    XCTAssertEqual(self.dictionary[@"dict"][@"dict"], nested);
+    XCTAssertEqualObjects(self.dictionary[@"dict"][@"dict"][@"one"], @"two_changed");
+    XCTAssertEqualObjects(self.dictionary[@"dict"][@"hello"], @"there");
+}
+
+@end